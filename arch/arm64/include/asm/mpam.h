@@ -114,6 +114,7 @@ DECLARE_STATIC_KEY_FALSE(resctrl_mon_enable_key);
 
 extern bool rdt_alloc_capable;
 extern bool rdt_mon_capable;
+extern bool rdt_mba_sc;
 
 enum rdt_group_type {
 	RDTCTRL_GROUP = 0,
@@ -185,6 +186,8 @@ extern int max_name_width, max_data_width;
  * @cqm_work_cpu:
  *		worker cpu for CQM h/w counters
  * @ctrl_val:	array of cache or mem ctrl values (indexed by CLOSID)
+ * @mbps_val:	with mba_MBps, the bandwidth target in MBps (indexed by CLOSID)
+ * @mbwu_prev:	with mba_MBps, the last MBWU count read (indexed by CLOSID)
  * @new_ctrl:	new ctrl value to be loaded
  * @have_new_ctrl: did user provide new_ctrl for this domain
  */
@@ -196,6 +199,8 @@ struct rdt_domain {
 
 	/* arch specific fields */
 	u32			*ctrl_val;
+	u32			*mbps_val;
+	u32			*mbwu_prev;
 	u32			new_ctrl;
 	bool			have_new_ctrl;
 
@@ -239,6 +244,8 @@ int parse_rdtgroupfs_options(char *data);
 
 static inline int __resctrl_group_show_options(struct seq_file *seq)
 {
+	if (rdt_mba_sc)
+		seq_puts(seq, ",mba_MBps");
 	return 0;
 }
 
@@ -301,6 +308,14 @@ struct raw_resctrl_resource {
 int parse_cbm(char *buf, struct raw_resctrl_resource *r, struct rdt_domain *d);
 int parse_bw(char *buf, struct raw_resctrl_resource *r, struct rdt_domain *d);
 
+/* Bandwidth targets of the MBA software controller */
+#define MBA_MAX_MBPS		U32_MAX
+#define MBWU_PREV_INVALID	U32_MAX
+
+bool is_mba_sc(struct resctrl_resource *r);
+void mba_sc_update(struct resctrl_resource *r, struct rdt_domain *d,
+		   struct rdtgroup *g, unsigned int elapsed_ms);
+
 union mon_data_bits {
 	void *priv;
 	struct {
@@ -76,6 +76,9 @@
 
 #define MSMON_CFG_CTL_EN        BIT(31)
 
+#define MSMON_NRDY		BIT(31)
+#define MSMON_VALUE_MASK	(BIT(31) - 1)
+
 #define MSMON_CFG_FLT_SET(r, p)		((r) << 16|(p))
 
 #define MBWU_SUBTYPE_DEFAULT		(3 << 20)
@@ -539,6 +539,72 @@ static __init void mpam_init_padding(void)
 	}
 }
 
+/* MBA software controller, see mba_sc_update() */
+bool rdt_mba_sc;
+
+#define MBA_SC_INTERVAL_MS	100
+
+static unsigned long mba_sc_last;
+
+static void mba_sc_work_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(mba_sc_work, mba_sc_work_fn);
+
+static void mba_sc_work_fn(struct work_struct *work)
+{
+	struct resctrl_resource *r = &resctrl_resources_all[MPAM_RESOURCE_MC];
+	unsigned long now = jiffies;
+	unsigned int elapsed_ms;
+	struct rdtgroup *rdtgrp;
+	struct rdt_domain *d;
+
+	mutex_lock(&resctrl_group_mutex);
+	if (!static_branch_likely(&resctrl_enable_key) || !rdt_mba_sc)
+		goto out_unlock;
+
+	elapsed_ms = jiffies_to_msecs(now - mba_sc_last);
+	mba_sc_last = now;
+
+	list_for_each_entry(rdtgrp, &resctrl_all_groups, resctrl_group_list) {
+		if (!(rdtgrp->flags & RDT_CTRLMON))
+			continue;
+		list_for_each_entry(d, &r->domains, list)
+			mba_sc_update(r, d, rdtgrp, elapsed_ms);
+	}
+
+	schedule_delayed_work(&mba_sc_work,
+			      msecs_to_jiffies(MBA_SC_INTERVAL_MS));
+out_unlock:
+	mutex_unlock(&resctrl_group_mutex);
+}
+
+bool is_mba_sc(struct resctrl_resource *r)
+{
+	return rdt_mba_sc && r->rid == MPAM_RESOURCE_MC;
+}
+
+static int set_mba_sc(bool mba_sc)
+{
+	struct resctrl_resource *r = &resctrl_resources_all[MPAM_RESOURCE_MC];
+	struct raw_resctrl_resource *rr = r->res;
+	struct rdt_domain *d;
+	int partid;
+
+	if (mba_sc && (!r->alloc_enabled || !r->mon_enabled))
+		return -EINVAL;
+
+	rdt_mba_sc = mba_sc;
+	if (!mba_sc)
+		return 0;
+
+	list_for_each_entry(d, &r->domains, list) {
+		for (partid = 0; partid < rr->num_partid; partid++) {
+			d->mbps_val[partid] = MBA_MAX_MBPS;
+			d->mbwu_prev[partid] = MBWU_PREV_INVALID;
+		}
+	}
+	return 0;
+}
+
 void post_resctrl_mount(void)
 {
 	if (rdt_alloc_capable)
@@ -548,6 +614,12 @@ void post_resctrl_mount(void)
 
 	if (rdt_alloc_capable || rdt_mon_capable)
 		static_branch_enable_cpuslocked(&resctrl_enable_key);
+
+	if (rdt_mba_sc) {
+		mba_sc_last = jiffies;
+		schedule_delayed_work(&mba_sc_work,
+				      msecs_to_jiffies(MBA_SC_INTERVAL_MS));
+	}
 }
 
 static int reset_all_ctrls(struct resctrl_resource *r)
@@ -578,15 +650,44 @@ void resctrl_resource_reset(void)
 		if (r->alloc_enabled)
 			reset_all_ctrls(r);
 	}
+
+	/* The work gives up once it sees this, under resctrl_group_mutex */
+	set_mba_sc(false);
+	cancel_delayed_work(&mba_sc_work);
 }
 
 void release_rdtgroupfs_options(void)
 {
+	set_mba_sc(false);
 }
 
 int parse_rdtgroupfs_options(char *data)
 {
+	char *token, *o = data;
+	int ret = 0;
+
+	while ((token = strsep(&o, ",")) != NULL) {
+		if (!*token) {
+			ret = -EINVAL;
+			goto out;
+		}
+
+		if (!strcmp(token, "mba_MBps")) {
+			ret = set_mba_sc(true);
+			if (ret)
+				goto out;
+		} else {
+			ret = -EINVAL;
+			goto out;
+		}
+	}
+
 	return 0;
+
+out:
+	pr_err("Invalid mount option \"%s\"\n", token);
+
+	return ret;
 }
 
 /*
@@ -1298,6 +1399,8 @@ static void mpam_domains_destroy(struct resctrl_resource *r)
 		list_del(pos);
 		if (d) {
 			kfree(d->ctrl_val);
+			kfree(d->mbps_val);
+			kfree(d->mbwu_prev);
 			kfree(d);
 		}
 	}
@@ -1367,7 +1470,17 @@ static void mpam_domains_init(struct resctrl_resource *r)
 		d->cpus_list = n->cpus_list;
 
 		d->ctrl_val = kmalloc_array(rr->num_partid, sizeof(*d->ctrl_val), GFP_KERNEL);
-		if (!d->ctrl_val) {
+		if (r->rid == MPAM_RESOURCE_MC) {
+			d->mbps_val = kmalloc_array(rr->num_partid,
+						    sizeof(*d->mbps_val), GFP_KERNEL);
+			d->mbwu_prev = kmalloc_array(rr->num_partid,
+						     sizeof(*d->mbwu_prev), GFP_KERNEL);
+		}
+		if (!d->ctrl_val || (r->rid == MPAM_RESOURCE_MC &&
+				     (!d->mbps_val || !d->mbwu_prev))) {
+			kfree(d->ctrl_val);
+			kfree(d->mbps_val);
+			kfree(d->mbwu_prev);
 			kfree(d);
 			mpam_domains_destroy(r);
 
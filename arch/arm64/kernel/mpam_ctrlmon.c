@@ -135,8 +135,15 @@ int parse_bw(char *buf, struct raw_resctrl_resource *r, struct rdt_domain *d)
 		return -EINVAL;
 	}
 
-	if (!bw_validate(buf, &data, r))
+	if (rdt_mba_sc) {
+		/* a bandwidth target, see mba_sc_update() */
+		if (kstrtoul(buf, 10, &data) || data > MBA_MAX_MBPS) {
+			rdt_last_cmd_printf("invalid MBps value %s\n", buf);
+			return -EINVAL;
+		}
+	} else if (!bw_validate(buf, &data, r)) {
 		return -EINVAL;
+	}
 
 	d->new_ctrl = data;
 	d->have_new_ctrl = true;
@@ -144,6 +151,69 @@ int parse_bw(char *buf, struct raw_resctrl_resource *r, struct rdt_domain *d)
 	return 0;
 }
 
+static int bw_max_mask_idx(u32 mask)
+{
+	int idx;
+
+	for (idx = 0; idx < ARRAY_SIZE(bw_max_mask) - 1; idx++) {
+		if (bw_max_mask[idx] >= mask)
+			break;
+	}
+	return idx;
+}
+
+/*
+ * MBA software controller (mount option mba_MBps)
+ *
+ * MBW_MAX is a percentage of the bandwidth the memory controller can
+ * deliver, and how many MBps a percentage gets a group depends on what
+ * it and everybody else are doing.  With mba_MBps the MB schemata take a
+ * target in MBps instead, and every MBA_SC_INTERVAL_MS the bandwidth a
+ * group used, as measured by its MBWU monitor, moves its MBW_MAX one 5%
+ * step towards it: down when above the target, up when the step is
+ * expected to stay below it, assuming bandwidth scales linearly with the
+ * limit.  Requiring that margin keeps a group that sits just under its
+ * target from bouncing between two steps.
+ *
+ * Only control groups with ctrlmon enabled have a monitor to go by.  The
+ * MBWU counter is 31 bits wide, which the interval is short enough for at
+ * up to ~20GB/s per group and memory controller.
+ */
+void mba_sc_update(struct resctrl_resource *r, struct rdt_domain *d,
+		   struct rdtgroup *g, unsigned int elapsed_ms)
+{
+	struct raw_resctrl_resource *rr = r->res;
+	u32 partid = g->closid;
+	u32 prev = d->mbwu_prev[partid];
+	u64 user_bw = d->mbps_val[partid];
+	u64 val, cur_bw;
+	int idx;
+
+	val = rr->mon_read(d, g);
+	if (val & MSMON_NRDY)
+		return;
+	val &= MSMON_VALUE_MASK;
+	d->mbwu_prev[partid] = val;
+	if (prev == MBWU_PREV_INVALID || !elapsed_ms)
+		return;
+
+	cur_bw = div_u64(((val - prev) & MSMON_VALUE_MASK) * MSEC_PER_SEC,
+			 elapsed_ms) >> 20;
+
+	/* step idx is a limit of (idx + 1) * 5% */
+	idx = bw_max_mask_idx(d->ctrl_val[partid]);
+	if (cur_bw > user_bw && idx > 0)
+		idx--;
+	else if (idx < ARRAY_SIZE(bw_max_mask) - 1 &&
+		 cur_bw * (idx + 2) < user_bw * (idx + 1))
+		idx++;
+	else
+		return;
+
+	d->ctrl_val[partid] = bw_max_mask[idx];
+	rr->msr_update(d, partid);
+}
+
 /*
  * For each domain in this resource we expect to find a series of:
  * id=mask
@@ -189,7 +259,14 @@ static int update_domains(struct resctrl_resource *r, struct rdtgroup *g)
 
 	rr = (struct raw_resctrl_resource *)r->res;
 	list_for_each_entry(d, &r->domains, list) {
-		if (d->have_new_ctrl && d->new_ctrl != d->ctrl_val[partid]) {
+		if (!d->have_new_ctrl)
+			continue;
+		if (is_mba_sc(r)) {
+			/* mba_sc_update() gets the limit there */
+			d->mbps_val[partid] = d->new_ctrl;
+			continue;
+		}
+		if (d->new_ctrl != d->ctrl_val[partid]) {
 			d->ctrl_val[partid] = d->new_ctrl;
 			rr->msr_update(d, partid);
 		}
@@ -285,8 +362,11 @@ static void show_doms(struct seq_file *s, struct resctrl_resource *r, int partid
 	list_for_each_entry(dom, &r->domains, list) {
 		if (sep)
 			seq_puts(s, ";");
-		seq_printf(s, rr->format_str, dom->id, max_data_width,
-			   rr->msr_read(dom, partid));
+		if (is_mba_sc(r))
+			seq_printf(s, "%d=%u", dom->id, dom->mbps_val[partid]);
+		else
+			seq_printf(s, rr->format_str, dom->id, max_data_width,
+				   rr->msr_read(dom, partid));
 		sep = true;
 	}
 	seq_puts(s, "\n");
@@ -610,6 +690,13 @@ int rdtgroup_init_alloc(struct rdtgroup *rdtgrp)
 		list_for_each_entry(d, &r->domains, list) {
 			d->new_ctrl = rr->default_ctrl;
 			d->have_new_ctrl = true;
+			if (is_mba_sc(r)) {
+				/* start unthrottled, without a target */
+				d->ctrl_val[rdtgrp->closid] = rr->default_ctrl;
+				rr->msr_update(d, rdtgrp->closid);
+				d->mbwu_prev[rdtgrp->closid] = MBWU_PREV_INVALID;
+				d->new_ctrl = MBA_MAX_MBPS;
+			}
 		}
 
 		ret = update_domains(r, rdtgrp);
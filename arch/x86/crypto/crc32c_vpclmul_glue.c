@@ -0,0 +1,183 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * CRC32C, folded with VPCLMULQDQ on AVX-512 registers, glue code
+ *
+ * Buffers shorter than CRC32C_VPCLMUL_MIN_LEN, and anything done where the
+ * FPU can't be used, go through the SSE4.2 CRC32 instruction instead.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <asm/unaligned.h>
+#include <crypto/internal/hash.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/types.h>
+#include <asm/cpufeature.h>
+#include <asm/fpu/api.h>
+#include <asm/simd.h>
+
+#define CHKSUM_BLOCK_SIZE	1
+#define CHKSUM_DIGEST_SIZE	4
+
+/* below this saving the FPU state costs more than the folding gains */
+#define CRC32C_VPCLMUL_MIN_LEN	512
+
+asmlinkage u32 crc32c_vpclmul_avx512(u32 crc, const u8 *buf, size_t len);
+
+struct chksum_ctx {
+	u32 key;
+};
+
+struct chksum_desc_ctx {
+	u32 crc;
+};
+
+static u32 crc32c_hw(u32 crc, const u8 *p, unsigned int len)
+{
+	unsigned long crc64 = crc;
+
+	for (; len >= 8; len -= 8, p += 8)
+		asm("crc32q %1, %0"
+		    : "+r" (crc64) : "rm" (get_unaligned((const u64 *)p)));
+	crc = crc64;
+	for (; len; len--, p++)
+		asm("crc32b %1, %0" : "+r" (crc) : "rm" (*p));
+	return crc;
+}
+
+static u32 crc32c_vpclmul(u32 crc, const u8 *p, unsigned int len)
+{
+	if (len < CRC32C_VPCLMUL_MIN_LEN || !may_use_simd())
+		return crc32c_hw(crc, p, len);
+
+	kernel_fpu_begin();
+	crc = crc32c_vpclmul_avx512(crc, p, len);
+	kernel_fpu_end();
+	return crc;
+}
+
+static int chksum_init(struct shash_desc *desc)
+{
+	struct chksum_ctx *mctx = crypto_shash_ctx(desc->tfm);
+	struct chksum_desc_ctx *ctx = shash_desc_ctx(desc);
+
+	ctx->crc = mctx->key;
+	return 0;
+}
+
+/*
+ * Setting the seed allows arbitrary accumulators and flexible XOR policy
+ * If your algorithm starts with ~0, then XOR with ~0 before you set
+ * the seed.
+ */
+static int chksum_setkey(struct crypto_shash *tfm, const u8 *key,
+			 unsigned int keylen)
+{
+	struct chksum_ctx *mctx = crypto_shash_ctx(tfm);
+
+	if (keylen != sizeof(mctx->key)) {
+		crypto_shash_set_flags(tfm, CRYPTO_TFM_RES_BAD_KEY_LEN);
+		return -EINVAL;
+	}
+	mctx->key = get_unaligned_le32(key);
+	return 0;
+}
+
+static int chksum_update(struct shash_desc *desc, const u8 *data,
+			 unsigned int length)
+{
+	struct chksum_desc_ctx *ctx = shash_desc_ctx(desc);
+
+	ctx->crc = crc32c_vpclmul(ctx->crc, data, length);
+	return 0;
+}
+
+static int chksum_final(struct shash_desc *desc, u8 *out)
+{
+	struct chksum_desc_ctx *ctx = shash_desc_ctx(desc);
+
+	put_unaligned_le32(~ctx->crc, out);
+	return 0;
+}
+
+static int chksum_finup(struct shash_desc *desc, const u8 *data,
+			unsigned int len, u8 *out)
+{
+	struct chksum_desc_ctx *ctx = shash_desc_ctx(desc);
+
+	put_unaligned_le32(~crc32c_vpclmul(ctx->crc, data, len), out);
+	return 0;
+}
+
+static int chksum_digest(struct shash_desc *desc, const u8 *data,
+			 unsigned int length, u8 *out)
+{
+	struct chksum_ctx *mctx = crypto_shash_ctx(desc->tfm);
+
+	put_unaligned_le32(~crc32c_vpclmul(mctx->key, data, length), out);
+	return 0;
+}
+
+static int crc32c_vpclmul_cra_init(struct crypto_tfm *tfm)
+{
+	struct chksum_ctx *mctx = crypto_tfm_ctx(tfm);
+
+	mctx->key = ~0;
+	return 0;
+}
+
+static struct shash_alg alg = {
+	.digestsize		=	CHKSUM_DIGEST_SIZE,
+	.setkey			=	chksum_setkey,
+	.init			=	chksum_init,
+	.update			=	chksum_update,
+	.final			=	chksum_final,
+	.finup			=	chksum_finup,
+	.digest			=	chksum_digest,
+	.descsize		=	sizeof(struct chksum_desc_ctx),
+	.base			=	{
+		.cra_name		=	"crc32c",
+		.cra_driver_name	=	"crc32c-vpclmul",
+		.cra_priority		=	250,
+		.cra_flags		=	CRYPTO_ALG_OPTIONAL_KEY,
+		.cra_blocksize		=	CHKSUM_BLOCK_SIZE,
+		.cra_ctxsize		=	sizeof(struct chksum_ctx),
+		.cra_module		=	THIS_MODULE,
+		.cra_init		=	crc32c_vpclmul_cra_init,
+	}
+};
+
+static int __init crc32c_vpclmul_mod_init(void)
+{
+	const char *feature_name;
+
+	if (!boot_cpu_has(X86_FEATURE_XMM4_2) ||
+	    !boot_cpu_has(X86_FEATURE_AVX512F) ||
+	    !boot_cpu_has(X86_FEATURE_VPCLMULQDQ)) {
+		pr_info("VPCLMULQDQ/AVX-512 instructions are not detected.\n");
+		return -ENODEV;
+	}
+
+	if (!cpu_has_xfeatures(XFEATURE_MASK_SSE | XFEATURE_MASK_YMM |
+			       XFEATURE_MASK_AVX512, &feature_name)) {
+		pr_info("CPU feature '%s' is not supported.\n", feature_name);
+		return -ENODEV;
+	}
+
+	return crypto_register_shash(&alg);
+}
+
+static void __exit crc32c_vpclmul_mod_exit(void)
+{
+	crypto_unregister_shash(&alg);
+}
+
+module_init(crc32c_vpclmul_mod_init);
+module_exit(crc32c_vpclmul_mod_exit);
+
+MODULE_LICENSE("GPL v2");
+MODULE_DESCRIPTION("CRC32c (Castagnoli) calculation, VPCLMULQDQ/AVX-512 optimized");
+MODULE_ALIAS_CRYPTO("crc32c");
+MODULE_ALIAS_CRYPTO("crc32c-vpclmul");
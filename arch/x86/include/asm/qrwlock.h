@@ -5,4 +5,7 @@
 #include <asm-generic/qrwlock_types.h>
 #include <asm-generic/qrwlock.h>
 
+/* Waiters, readers or writers, queue up on the wait_lock */
+#define arch_rwlock_is_contended(l)	arch_spin_is_locked(&(l)->wait_lock)
+
 #endif /* _ASM_X86_QRWLOCK_H */
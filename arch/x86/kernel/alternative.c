@@ -647,6 +647,11 @@ void __init alternative_instructions(void)
 				(unsigned long)__smp_locks_end);
 #endif
 
+#ifdef CONFIG_NUMA_AWARE_SPINLOCKS
+	/* Before the pv_lock_ops call sites get patched below */
+	cna_configure_spin_lock_slowpath();
+#endif
+
 	apply_paravirt(__parainstructions, __parainstructions_end);
 
 	restart_nmi();
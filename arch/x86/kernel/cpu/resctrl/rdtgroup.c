@@ -32,6 +32,7 @@
 #include <linux/sched/task.h>
 #include <linux/slab.h>
 #include <linux/task_work.h>
+#include <linux/resctrl_cgroup.h>
 
 #include <uapi/linux/magic.h>
 
@@ -2185,6 +2186,10 @@ static void rmdir_all_sub(void)
 {
 	struct rdtgroup *rdtgrp, *tmp;
 
+	/* Unbind all cpu cgroups before the tasks are moved */
+	list_for_each_entry(rdtgrp, &rdt_all_groups, rdtgroup_list)
+		resctrl_cgroup_unbind(rdtgrp->closid, rdtgrp->mon.rmid, true);
+
 	/* Move all tasks to the default resource group */
 	rdt_move_group_tasks(NULL, &rdtgroup_default, NULL);
 
@@ -2801,6 +2806,8 @@ static int rdtgroup_rmdir_mon(struct kernfs_node *kn, struct rdtgroup *rdtgrp,
 	struct rdtgroup *prdtgrp = rdtgrp->mon.parent;
 	int cpu;
 
+	resctrl_cgroup_unbind(rdtgrp->closid, rdtgrp->mon.rmid, false);
+
 	/* Give any tasks back to the parent group */
 	rdt_move_group_tasks(rdtgrp, prdtgrp, tmpmask);
 
@@ -2843,6 +2850,8 @@ static int rdtgroup_rmdir_ctrl(struct kernfs_node *kn, struct rdtgroup *rdtgrp,
 {
 	int cpu;
 
+	resctrl_cgroup_unbind(rdtgrp->closid, rdtgrp->mon.rmid, true);
+
 	/* Give any tasks back to the default group */
 	rdt_move_group_tasks(rdtgrp, &rdtgroup_default, tmpmask);
 
@@ -2876,6 +2885,63 @@ static int rdtgroup_rmdir_ctrl(struct kernfs_node *kn, struct rdtgroup *rdtgrp,
 	return 0;
 }
 
+#ifdef CONFIG_CGROUP_RESCTRL
+int resctrl_group_lookup_ids(const char *ctrl, const char *mon,
+			     u32 *closid, u32 *rmid)
+{
+	struct rdtgroup *prgrp = NULL, *rdtgrp = NULL, *entry;
+	int ret = -ENOENT;
+
+	mutex_lock(&rdtgroup_mutex);
+	if (!static_branch_unlikely(&rdt_enable_key)) {
+		ret = -ENODEV;
+		goto out;
+	}
+
+	if (!ctrl) {
+		prgrp = &rdtgroup_default;
+	} else {
+		list_for_each_entry(entry, &rdt_all_groups, rdtgroup_list) {
+			if (entry != &rdtgroup_default &&
+			    !strcmp(entry->kn->name, ctrl)) {
+				prgrp = entry;
+				break;
+			}
+		}
+	}
+	if (!prgrp)
+		goto out;
+
+	if (!mon) {
+		rdtgrp = prgrp;
+	} else {
+		list_for_each_entry(entry, &prgrp->mon.crdtgrp_list,
+				    mon.crdtgrp_list) {
+			if (!strcmp(entry->kn->name, mon)) {
+				rdtgrp = entry;
+				break;
+			}
+		}
+	}
+	if (!rdtgrp)
+		goto out;
+
+	/* Pseudo-locked regions must not be entered by ordinary tasks */
+	if (prgrp->mode == RDT_MODE_PSEUDO_LOCKSETUP ||
+	    prgrp->mode == RDT_MODE_PSEUDO_LOCKED) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	*closid = rdtgrp->closid;
+	*rmid = rdtgrp->mon.rmid;
+	ret = 0;
+out:
+	mutex_unlock(&rdtgroup_mutex);
+	return ret;
+}
+#endif
+
 static int rdtgroup_rmdir(struct kernfs_node *kn)
 {
 	struct kernfs_node *parent_kn = kn->parent;
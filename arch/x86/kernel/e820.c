@@ -979,6 +979,42 @@ static int __init parse_memmap_opt(char *str)
 }
 early_param("memmap", parse_memmap_opt);
 
+/*
+ * With "kexec_keep_pram" the memmap=nn!ss ranges are also handed on to
+ * kexec-ed kernels, as legacy persistent memory.  What was put there, guest
+ * memory backed by the pmem device say, then survives a kexec reboot
+ * without the new command line having to carve out the same ranges.  The
+ * new kernel gets them from its boot E820 map, so they keep being handed
+ * on until the next firmware reboot.
+ */
+static bool kexec_keep_pram __initdata;
+
+static int __init parse_kexec_keep_pram(char *str)
+{
+	kexec_keep_pram = true;
+	return 0;
+}
+early_param("kexec_keep_pram", parse_kexec_keep_pram);
+
+static void __init e820__keep_pram_kexec(void)
+{
+	bool added = false;
+	int i;
+
+	for (i = 0; i < e820_table->nr_entries; i++) {
+		struct e820_entry *entry = &e820_table->entries[i];
+
+		if (entry->type != E820_TYPE_PRAM)
+			continue;
+		__e820__range_add(e820_table_kexec, entry->addr, entry->size,
+				  E820_TYPE_PRAM);
+		added = true;
+	}
+
+	if (added && e820__update_table(e820_table_kexec) < 0)
+		pr_warn("cannot hand persistent memory on to kexec\n");
+}
+
 /*
  * Reserve all entries from the bootloader's extensible data nodes list,
  * because if present we are going to use it later on to fetch e820
@@ -1022,6 +1058,9 @@ void __init e820__finish_early_params(void)
 		pr_info("user-defined physical RAM map:\n");
 		e820__print_table("user");
 	}
+
+	if (kexec_keep_pram)
+		e820__keep_pram_kexec();
 }
 
 static const char *__init e820_type_to_string(struct e820_entry *entry)
@@ -266,6 +266,15 @@ static inline void kvm_apic_set_xapic_id(struct kvm_lapic *apic, u8 id)
 	recalculate_apic_map(apic->vcpu->kvm);
 }
 
+static void kvm_apic_xapic_id_updated(struct kvm_lapic *apic)
+{
+	if (kvm_xapic_id(apic) == apic->vcpu->vcpu_id)
+		return;
+
+	if (kvm_x86_ops->apic_id_changed)
+		kvm_x86_ops->apic_id_changed(apic->vcpu->kvm);
+}
+
 static inline void kvm_apic_set_ldr(struct kvm_lapic *apic, u32 id)
 {
 	kvm_lapic_set_reg(apic, APIC_LDR, id);
@@ -1435,6 +1444,48 @@ static void apic_update_lvtt(struct kvm_lapic *apic)
 	}
 }
 
+static bool kvm_can_post_timer_interrupt(struct kvm_vcpu *vcpu)
+{
+	return pi_inject_timer && kvm_vcpu_apicv_active(vcpu);
+}
+
+static bool kvm_use_posted_timer_interrupt(struct kvm_vcpu *vcpu)
+{
+	return kvm_can_post_timer_interrupt(vcpu) &&
+	       vcpu->mode == IN_GUEST_MODE;
+}
+
+/*
+ * A posted timer interrupt needs the hrtimer, which need not fire on the
+ * cpu of the vcpu: the timer core can then keep it off isolated cpus.
+ */
+static bool kvm_can_use_hv_timer(struct kvm_vcpu *vcpu)
+{
+	return kvm_x86_ops->set_hv_timer &&
+	       !kvm_can_post_timer_interrupt(vcpu);
+}
+
+static enum hrtimer_mode apic_timer_mode(struct kvm_lapic *apic)
+{
+	return kvm_can_post_timer_interrupt(apic->vcpu) ?
+	       HRTIMER_MODE_ABS : HRTIMER_MODE_ABS_PINNED;
+}
+
+static void kvm_apic_inject_pending_timer_irqs(struct kvm_lapic *apic)
+{
+	struct kvm_timer *ktimer = &apic->lapic_timer;
+
+	kvm_apic_local_deliver(apic, APIC_LVTT);
+	if (apic_lvtt_tscdeadline(apic))
+		ktimer->tscdeadline = 0;
+	if (apic_lvtt_oneshot(apic)) {
+		ktimer->tscdeadline = 0;
+		ktimer->target_expiration = 0;
+	}
+}
+
+static void __wait_lapic_expire(struct kvm_vcpu *vcpu);
+
 static void apic_timer_expired(struct kvm_lapic *apic)
 {
 	struct kvm_vcpu *vcpu = apic->vcpu;
@@ -1444,6 +1495,20 @@ static void apic_timer_expired(struct kvm_lapic *apic)
 	if (atomic_read(&apic->lapic_timer.pending))
 		return;
 
+	if (apic_lvtt_tscdeadline(apic) || ktimer->hv_timer_in_use)
+		ktimer->expired_tscdeadline = ktimer->tscdeadline;
+
+	/*
+	 * The vcpu is running guest code: post the interrupt now, which does
+	 * not even need a VM exit, rather than kicking it to inject it.
+	 */
+	if (kvm_use_posted_timer_interrupt(vcpu)) {
+		if (ktimer->expired_tscdeadline && lapic_timer_advance_ns)
+			__wait_lapic_expire(vcpu);
+		kvm_apic_inject_pending_timer_irqs(apic);
+		return;
+	}
+
 	atomic_inc(&apic->lapic_timer.pending);
 	kvm_set_pending_timer(vcpu);
 
@@ -1453,9 +1518,6 @@ static void apic_timer_expired(struct kvm_lapic *apic)
 	 */
 	if (swait_active(q))
 		swake_up_one(q);
-
-	if (apic_lvtt_tscdeadline(apic) || ktimer->hv_timer_in_use)
-		ktimer->expired_tscdeadline = ktimer->tscdeadline;
 }
 
 /*
@@ -1481,20 +1543,11 @@ static bool lapic_timer_int_injected(struct kvm_vcpu *vcpu)
 	return false;
 }
 
-void wait_lapic_expire(struct kvm_vcpu *vcpu)
+static void __wait_lapic_expire(struct kvm_vcpu *vcpu)
 {
 	struct kvm_lapic *apic = vcpu->arch.apic;
 	u64 guest_tsc, tsc_deadline;
 
-	if (!lapic_in_kernel(vcpu))
-		return;
-
-	if (apic->lapic_timer.expired_tscdeadline == 0)
-		return;
-
-	if (!lapic_timer_int_injected(vcpu))
-		return;
-
 	tsc_deadline = apic->lapic_timer.expired_tscdeadline;
 	apic->lapic_timer.expired_tscdeadline = 0;
 	guest_tsc = kvm_read_l1_tsc(vcpu, rdtsc());
@@ -1506,6 +1559,22 @@ void wait_lapic_expire(struct kvm_vcpu *vcpu)
 			nsec_to_cycles(vcpu, lapic_timer_advance_ns)));
 }
 
+void wait_lapic_expire(struct kvm_vcpu *vcpu)
+{
+	struct kvm_lapic *apic = vcpu->arch.apic;
+
+	if (!lapic_in_kernel(vcpu))
+		return;
+
+	if (apic->lapic_timer.expired_tscdeadline == 0)
+		return;
+
+	if (!lapic_timer_int_injected(vcpu))
+		return;
+
+	__wait_lapic_expire(vcpu);
+}
+
 static void start_sw_tscdeadline(struct kvm_lapic *apic)
 {
 	u64 guest_tsc, tscdeadline = apic->lapic_timer.tscdeadline;
@@ -1529,7 +1598,7 @@ static void start_sw_tscdeadline(struct kvm_lapic *apic)
 		expire = ktime_add_ns(now, ns);
 		expire = ktime_sub_ns(expire, lapic_timer_advance_ns);
 		hrtimer_start(&apic->lapic_timer.timer,
-				expire, HRTIMER_MODE_ABS_PINNED);
+				expire, apic_timer_mode(apic));
 	} else
 		apic_timer_expired(apic);
 
@@ -1631,7 +1700,7 @@ static void start_sw_period(struct kvm_lapic *apic)
 
 	hrtimer_start(&apic->lapic_timer.timer,
 		apic->lapic_timer.target_expiration,
-		HRTIMER_MODE_ABS_PINNED);
+		apic_timer_mode(apic));
 }
 
 bool kvm_lapic_hv_timer_in_use(struct kvm_vcpu *vcpu)
@@ -1657,7 +1726,7 @@ static bool start_hv_timer(struct kvm_lapic *apic)
 	int r;
 
 	WARN_ON(preemptible());
-	if (!kvm_x86_ops->set_hv_timer)
+	if (!kvm_can_use_hv_timer(apic->vcpu))
 		return false;
 
 	if (!apic_lvtt_period(apic) && atomic_read(&ktimer->pending))
@@ -1794,9 +1863,10 @@ int kvm_lapic_reg_write(struct kvm_lapic *apic, u32 reg, u32 val)
 
 	switch (reg) {
 	case APIC_ID:		/* Local APIC ID */
-		if (!apic_x2apic_mode(apic))
+		if (!apic_x2apic_mode(apic)) {
 			kvm_apic_set_xapic_id(apic, val >> 24);
-		else
+			kvm_apic_xapic_id_updated(apic);
+		} else
 			ret = 1;
 		break;
 
@@ -1982,6 +2052,17 @@ void kvm_apic_write_nodecode(struct kvm_vcpu *vcpu, u32 offset)
 	/* hw has done the conditional check and inst decode */
 	offset &= 0xff0;
 
+	/*
+	 * IPI virtualization leaves an IPI it cannot post in the 64-bit
+	 * x2APIC ICR, destination included.
+	 */
+	if (apic_x2apic_mode(vcpu->arch.apic) && offset == APIC_ICR) {
+		u64 icr = *(u64 *)(vcpu->arch.apic->regs + APIC_ICR);
+
+		kvm_x2apic_msr_write(vcpu, APIC_BASE_MSR + (APIC_ICR >> 4), icr);
+		return;
+	}
+
 	kvm_lapic_reg_read(vcpu->arch.apic, offset, 4, &val);
 
 	/* TODO: optimize to just emulate side effect w/o one more write */
@@ -2305,13 +2386,7 @@ void kvm_inject_apic_timer_irqs(struct kvm_vcpu *vcpu)
 	struct kvm_lapic *apic = vcpu->arch.apic;
 
 	if (atomic_read(&apic->lapic_timer.pending) > 0) {
-		kvm_apic_local_deliver(apic, APIC_LVTT);
-		if (apic_lvtt_tscdeadline(apic))
-			apic->lapic_timer.tscdeadline = 0;
-		if (apic_lvtt_oneshot(apic)) {
-			apic->lapic_timer.tscdeadline = 0;
-			apic->lapic_timer.target_expiration = 0;
-		}
+		kvm_apic_inject_pending_timer_irqs(apic);
 		atomic_set(&apic->lapic_timer.pending, 0);
 	}
 }
@@ -2401,6 +2476,8 @@ int kvm_apic_set_state(struct kvm_vcpu *vcpu, struct kvm_lapic_state *s)
 	memcpy(vcpu->arch.apic->regs, s->regs, sizeof *s);
 
 	recalculate_apic_map(vcpu->kvm);
+	if (!apic_x2apic_mode(apic))
+		kvm_apic_xapic_id_updated(apic);
 	kvm_apic_set_version(vcpu);
 
 	apic_update_ppr(apic);
@@ -2433,7 +2510,8 @@ void __kvm_migrate_apic_timer(struct kvm_vcpu *vcpu)
 {
 	struct hrtimer *timer;
 
-	if (!lapic_in_kernel(vcpu))
+	/* A timer whose interrupt is posted can fire on any cpu */
+	if (!lapic_in_kernel(vcpu) || kvm_can_post_timer_interrupt(vcpu))
 		return;
 
 	timer = &vcpu->arch.apic->lapic_timer.timer;
@@ -0,0 +1,1149 @@
+/*
+ * tdp_mmu.c:
+ *
+ * TDP MMU for KVM, included from mmu.c
+ *
+ * With EPT or NPT the roots that map guest physical memory are direct:
+ * each spte only depends on the gfn it covers.  The TDP MMU builds them
+ * without the hash table and the rmaps of the shadow MMU: a page table is
+ * only reachable from its parent spte, roots are shared by all vcpus with
+ * the same role and the memslot wide operations walk the roots.
+ *
+ * Page faults install sptes with cmpxchg holding mmu_lock for read, so the
+ * vcpus of a VM fault in parallel.  Everything else takes mmu_lock for
+ * write, and page tables are only unlinked and freed with the lock held
+ * for write, after a remote TLB flush.  As with shadow pages, that flush
+ * also waits for the lockless walkers that run with IRQs disabled.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ */
+
+static bool __read_mostly enable_tdp_mmu;
+module_param_named(tdp_mmu, enable_tdp_mmu, bool, 0644);
+
+/* Split the huge pages of a slot when dirty logging gets enabled on it */
+static bool __read_mostly eager_page_split = true;
+module_param(eager_page_split, bool, 0644);
+
+/*
+ * Pre-order walk of the sptes of a TDP MMU root mapping [goal_gfn, ...).
+ */
+struct tdp_iter {
+	/* The gfn the walk goes for next, in the last level it can reach */
+	gfn_t goal_gfn;
+	/* The goal_gfn at the time the walk last dropped mmu_lock */
+	gfn_t yielded_gfn;
+	/* Page tables traversed to reach the current spte, by level */
+	u64 *pt_path[PT64_ROOT_MAX_LEVEL];
+	u64 *sptep;
+	/* The lowest gfn mapped by the current spte */
+	gfn_t gfn;
+	int root_level;
+	/* The walk does not go below this level */
+	int min_level;
+	int level;
+	/* The value of *sptep when the walk last read or set it */
+	u64 old_spte;
+	/* Whether the walk is past the end of the root */
+	bool valid;
+};
+
+static u64 *tdp_iter_sptep(u64 *pt, gfn_t gfn, int level)
+{
+	return pt + SHADOW_PT_INDEX(gfn << PAGE_SHIFT, level);
+}
+
+static void tdp_iter_refresh_sptep(struct tdp_iter *iter)
+{
+	iter->sptep = tdp_iter_sptep(iter->pt_path[iter->level - 1],
+				     iter->gfn, iter->level);
+	iter->old_spte = READ_ONCE(*iter->sptep);
+}
+
+static void tdp_iter_start(struct tdp_iter *iter, u64 *root_pt, int root_level,
+			   int min_level, gfn_t goal_gfn)
+{
+	WARN_ON(root_level < 1 || root_level > PT64_ROOT_MAX_LEVEL);
+
+	iter->goal_gfn = goal_gfn;
+	iter->yielded_gfn = goal_gfn;
+	iter->root_level = root_level;
+	iter->min_level = min_level;
+	iter->level = root_level;
+	iter->pt_path[iter->level - 1] = root_pt;
+
+	iter->gfn = goal_gfn & ~(KVM_PAGES_PER_HPAGE(iter->level) - 1);
+	tdp_iter_refresh_sptep(iter);
+
+	iter->valid = true;
+}
+
+/* The page table a non-leaf spte points to, or NULL for a leaf spte */
+static u64 *spte_to_child_pt(u64 spte, int level)
+{
+	if (!is_shadow_present_pte(spte) || is_last_spte(spte, level))
+		return NULL;
+
+	return __va(spte_to_pfn(spte) << PAGE_SHIFT);
+}
+
+static bool try_step_down(struct tdp_iter *iter)
+{
+	u64 *child_pt;
+
+	if (iter->level == iter->min_level)
+		return false;
+
+	/* The spte may have changed since it was read, go by its value now */
+	iter->old_spte = READ_ONCE(*iter->sptep);
+
+	child_pt = spte_to_child_pt(iter->old_spte, iter->level);
+	if (!child_pt)
+		return false;
+
+	iter->level--;
+	iter->pt_path[iter->level - 1] = child_pt;
+	iter->gfn = iter->goal_gfn & ~(KVM_PAGES_PER_HPAGE(iter->level) - 1);
+	tdp_iter_refresh_sptep(iter);
+
+	return true;
+}
+
+static bool try_step_side(struct tdp_iter *iter)
+{
+	/* The last spte of the page table, the walk has to go up first */
+	if (SHADOW_PT_INDEX(iter->gfn << PAGE_SHIFT, iter->level) ==
+	    PT64_ENT_PER_PAGE - 1)
+		return false;
+
+	iter->gfn += KVM_PAGES_PER_HPAGE(iter->level);
+	iter->goal_gfn = iter->gfn;
+	iter->sptep++;
+	iter->old_spte = READ_ONCE(*iter->sptep);
+
+	return true;
+}
+
+static bool try_step_up(struct tdp_iter *iter)
+{
+	if (iter->level == iter->root_level)
+		return false;
+
+	iter->level++;
+	iter->gfn &= ~(KVM_PAGES_PER_HPAGE(iter->level) - 1);
+	tdp_iter_refresh_sptep(iter);
+
+	return true;
+}
+
+/*
+ * Move to the child of the current spte if it has one, else to the next
+ * spte of the page table, going up as many levels as it takes.
+ */
+static void tdp_iter_next(struct tdp_iter *iter)
+{
+	if (try_step_down(iter))
+		return;
+
+	do {
+		if (try_step_side(iter))
+			return;
+	} while (try_step_up(iter));
+
+	iter->valid = false;
+}
+
+/*
+ * Walk again from the root to the current goal_gfn, the page tables on the
+ * way may have been freed while mmu_lock was dropped.
+ */
+static void tdp_iter_refresh_walk(struct tdp_iter *iter)
+{
+	tdp_iter_start(iter, iter->pt_path[iter->root_level - 1],
+		       iter->root_level, iter->min_level, iter->goal_gfn);
+}
+
+#define for_each_tdp_pte_min_level(_iter, _root, _min_level, _start, _end) \
+	for (tdp_iter_start(&(_iter), (_root)->spt, (_root)->role.level,   \
+			    (_min_level), (_start));			     \
+	     (_iter).valid && (_iter).gfn < (_end);			     \
+	     tdp_iter_next(&(_iter)))
+
+#define for_each_tdp_pte(_iter, _root, _start, _end)			\
+	for_each_tdp_pte_min_level(_iter, _root, PT_PAGE_TABLE_LEVEL,	\
+				   _start, _end)
+
+/* One past the last gfn a root can map */
+static gfn_t tdp_mmu_max_gfn(struct kvm_mmu_page *root)
+{
+	return 1ULL << (root->role.level * PT64_LEVEL_BITS);
+}
+
+static bool is_tdp_mmu_root(struct kvm *kvm, hpa_t hpa)
+{
+	struct kvm_mmu_page *sp;
+
+	if (!kvm->arch.tdp_mmu_enabled || !VALID_PAGE(hpa))
+		return false;
+
+	sp = page_header(hpa);
+	return sp && sp->tdp_mmu_page;
+}
+
+/* Whether @root maps the address space @slot belongs to */
+static bool tdp_mmu_root_has_slot(struct kvm *kvm, struct kvm_mmu_page *root,
+				  const struct kvm_memory_slot *slot)
+{
+	struct kvm_memslots *slots = kvm_memslots_for_spte_role(kvm, root->role);
+
+	return id_to_memslot(slots, slot->id) == slot;
+}
+
+static struct kvm_mmu_page *tdp_mmu_alloc_sp(struct kvm_vcpu *vcpu, gfn_t gfn,
+					     union kvm_mmu_page_role role)
+{
+	struct kvm_mmu_page *sp;
+
+	sp = mmu_memory_cache_alloc(&vcpu->arch.mmu_page_header_cache);
+	sp->spt = mmu_memory_cache_alloc(&vcpu->arch.mmu_page_cache);
+	set_page_private(virt_to_page(sp->spt), (unsigned long)sp);
+	clear_page(sp->spt);
+
+	sp->gfn = gfn;
+	sp->role = role;
+	sp->tdp_mmu_page = true;
+	trace_kvm_mmu_get_page(sp, true);
+
+	return sp;
+}
+
+static void tdp_mmu_free_sp(struct kvm_mmu_page *sp)
+{
+	free_page((unsigned long)sp->spt);
+	kmem_cache_free(mmu_page_header_cache, sp);
+}
+
+/*
+ * Free the page tables zapped under mmu_lock held for write, once no vcpu
+ * and no lockless walker can see them anymore.
+ */
+static void tdp_mmu_commit_zap(struct kvm *kvm, struct list_head *invalid_list)
+{
+	struct kvm_mmu_page *sp, *nsp;
+
+	if (list_empty(invalid_list))
+		return;
+
+	kvm_flush_remote_tlbs(kvm);
+
+	list_for_each_entry_safe(sp, nsp, invalid_list, link) {
+		list_del(&sp->link);
+		tdp_mmu_free_sp(sp);
+	}
+}
+
+/*
+ * Account for an spte that was cleared: the accessed and dirty state of a
+ * leaf goes to its pfn, and the page table of a non-leaf is torn down and
+ * queued on @invalid_list, which may be NULL for a leaf.
+ */
+static void handle_zapped_spte(struct kvm *kvm, u64 old_spte, int level,
+			       struct list_head *invalid_list)
+{
+	kvm_pfn_t pfn = spte_to_pfn(old_spte);
+	struct kvm_mmu_page *sp;
+	int i;
+
+	if (!is_shadow_present_pte(old_spte))
+		return;
+
+	if (is_last_spte(old_spte, level)) {
+		if (is_accessed_spte(old_spte))
+			kvm_set_pfn_accessed(pfn);
+		if (is_dirty_spte(old_spte))
+			kvm_set_pfn_dirty(pfn);
+		return;
+	}
+
+	/*
+	 * The child is unreachable already, but until the TLB flush the CPU
+	 * may still set accessed and dirty bits in it.
+	 */
+	sp = page_header(pfn << PAGE_SHIFT);
+	for (i = 0; i < PT64_ENT_PER_PAGE; i++)
+		handle_zapped_spte(kvm, __update_clear_spte_slow(&sp->spt[i], 0ull),
+				   level - 1, invalid_list);
+
+	list_add(&sp->link, invalid_list);
+}
+
+/* mmu_lock must be held for write */
+static void tdp_mmu_zap_spte(struct kvm *kvm, struct tdp_iter *iter,
+			     struct list_head *invalid_list)
+{
+	u64 old_spte = __update_clear_spte_slow(iter->sptep, 0ull);
+
+	iter->old_spte = 0;
+	handle_zapped_spte(kvm, old_spte, iter->level, invalid_list);
+}
+
+/*
+ * Change the spte under mmu_lock held for read, whatever another vcpu put
+ * there since the walk read it.  Returns false if the spte changed.
+ */
+static bool tdp_mmu_set_spte_atomic(struct tdp_iter *iter, u64 new_spte)
+{
+	if (cmpxchg64(iter->sptep, iter->old_spte, new_spte) != iter->old_spte)
+		return false;
+
+	iter->old_spte = new_spte;
+	return true;
+}
+
+/*
+ * Give up mmu_lock if the CPU or another mmu_lock user wants it, after the
+ * pending flush and the zapped page tables are taken care of.  The walk
+ * then goes on from the root: returns true if it was restarted.
+ */
+static bool tdp_mmu_iter_cond_resched(struct kvm *kvm, struct tdp_iter *iter,
+				      bool flush, struct list_head *invalid_list)
+{
+	/* Make some progress since the last time the lock was given up */
+	if (iter->goal_gfn == iter->yielded_gfn)
+		return false;
+
+	if (!need_resched() && !rwlock_needbreak(&kvm->mmu_lock))
+		return false;
+
+	if (invalid_list && !list_empty(invalid_list))
+		tdp_mmu_commit_zap(kvm, invalid_list);
+	else if (flush)
+		kvm_flush_remote_tlbs(kvm);
+
+	cond_resched_rwlock_write(&kvm->mmu_lock);
+	tdp_iter_refresh_walk(iter);
+
+	return true;
+}
+
+static hpa_t kvm_tdp_mmu_get_vcpu_root_hpa(struct kvm_vcpu *vcpu)
+{
+	struct kvm *kvm = vcpu->kvm;
+	union kvm_mmu_page_role role;
+	struct kvm_mmu_page *root;
+
+	role = vcpu->arch.mmu.base_role;
+	role.level = vcpu->arch.mmu.shadow_root_level;
+	role.direct = 1;
+	role.cr4_pae = 0;
+	role.access = ACC_ALL;
+
+	write_lock(&kvm->mmu_lock);
+
+	list_for_each_entry(root, &kvm->arch.tdp_mmu_roots, link) {
+		if (root->role.word == role.word) {
+			root->root_count++;
+			goto out;
+		}
+	}
+
+	root = tdp_mmu_alloc_sp(vcpu, 0, role);
+	root->root_count = 1;
+	list_add(&root->link, &kvm->arch.tdp_mmu_roots);
+
+out:
+	write_unlock(&kvm->mmu_lock);
+
+	return __pa(root->spt);
+}
+
+/* A root goes away with its last user, mmu_lock must be held for write */
+static void tdp_mmu_put_root(struct kvm *kvm, struct kvm_mmu_page *root)
+{
+	LIST_HEAD(invalid_list);
+	struct tdp_iter iter;
+
+	lockdep_assert_held_exclusive(&kvm->mmu_lock);
+
+	if (--root->root_count)
+		return;
+
+	list_del(&root->link);
+
+	for_each_tdp_pte_min_level(iter, root, root->role.level, 0,
+				   tdp_mmu_max_gfn(root))
+		tdp_mmu_zap_spte(kvm, &iter, &invalid_list);
+
+	list_add(&root->link, &invalid_list);
+	tdp_mmu_commit_zap(kvm, &invalid_list);
+}
+
+/*
+ * Walk the roots holding a reference to the current one, so that the body
+ * can give up mmu_lock.  The loop must run to its end to drop the last one.
+ */
+static struct kvm_mmu_page *tdp_mmu_next_root(struct kvm *kvm,
+					      struct kvm_mmu_page *prev)
+{
+	struct kvm_mmu_page *next;
+
+	if (prev)
+		next = list_next_entry(prev, link);
+	else
+		next = list_first_entry(&kvm->arch.tdp_mmu_roots,
+					struct kvm_mmu_page, link);
+
+	if (&next->link == &kvm->arch.tdp_mmu_roots)
+		next = NULL;
+	else
+		next->root_count++;
+
+	if (prev)
+		tdp_mmu_put_root(kvm, prev);
+
+	return next;
+}
+
+#define for_each_tdp_mmu_root_yield_safe(_kvm, _root)			\
+	for (_root = tdp_mmu_next_root(_kvm, NULL); _root;		\
+	     _root = tdp_mmu_next_root(_kvm, _root))
+
+#define for_each_tdp_mmu_root(_kvm, _root)				\
+	list_for_each_entry(_root, &(_kvm)->arch.tdp_mmu_roots, link)
+
+/*
+ * Page faults on a TDP MMU root hold mmu_lock for read, unless the VM has
+ * shadow pages for nested guests: mmu_need_write_protect() may have to
+ * unsync those, which is only done with the lock held for write.
+ * Returns whether the lock was taken for read.
+ */
+static bool kvm_tdp_mmu_fault_lock(struct kvm *kvm)
+{
+	read_lock(&kvm->mmu_lock);
+	if (likely(!kvm->arch.indirect_shadow_pages))
+		return true;
+
+	read_unlock(&kvm->mmu_lock);
+	write_lock(&kvm->mmu_lock);
+	return false;
+}
+
+static void kvm_tdp_mmu_fault_unlock(struct kvm *kvm, bool shared)
+{
+	if (shared)
+		read_unlock(&kvm->mmu_lock);
+	else
+		write_unlock(&kvm->mmu_lock);
+}
+
+/*
+ * The leaf spte of a fault replaced @old_spte: account for what it does not
+ * map anymore and tell whether the TLBs need a flush for it.
+ */
+static bool tdp_mmu_handle_changed_leaf(struct kvm *kvm, u64 old_spte,
+					u64 new_spte, int level)
+{
+	bool flush;
+
+	if (!is_shadow_present_pte(old_spte))
+		return false;
+
+	if (!is_shadow_present_pte(new_spte) ||
+	    spte_to_pfn(old_spte) != spte_to_pfn(new_spte)) {
+		handle_zapped_spte(kvm, old_spte, level, NULL);
+		return true;
+	}
+
+	flush = spte_can_locklessly_be_made_writable(old_spte) &&
+		!is_writable_pte(new_spte);
+
+	if (is_accessed_spte(old_spte) && !is_accessed_spte(new_spte)) {
+		flush = true;
+		kvm_set_pfn_accessed(spte_to_pfn(old_spte));
+	}
+
+	if (is_dirty_spte(old_spte) && !is_dirty_spte(new_spte)) {
+		flush = true;
+		kvm_set_pfn_dirty(spte_to_pfn(old_spte));
+	}
+
+	return flush;
+}
+
+static int tdp_mmu_map_handle_target_level(struct kvm_vcpu *vcpu,
+					   struct tdp_iter *iter, int write,
+					   int map_writable, kvm_pfn_t pfn,
+					   bool prefault, bool ad_disabled)
+{
+	int ret = RET_PF_RETRY;
+	u64 old_spte = iter->old_spte;
+	u64 new_spte;
+	int make_ret;
+
+	if (unlikely(is_noslot_pfn(pfn))) {
+		new_spte = make_mmio_spte(vcpu, iter->gfn, ACC_ALL);
+		trace_mark_mmio_spte(iter->sptep, iter->gfn,
+				     ACC_WRITE_MASK | ACC_USER_MASK,
+				     get_mmio_spte_generation(new_spte));
+		make_ret = 0;
+	} else {
+		make_ret = make_spte(vcpu, ACC_ALL, iter->level, iter->gfn,
+				     pfn, old_spte, prefault, true,
+				     map_writable, ad_disabled, &new_spte);
+		if (make_ret & SET_SPTE_RETRY)
+			return RET_PF_RETRY;
+	}
+
+	/* Another vcpu may have fixed the same fault already */
+	if (new_spte != old_spte) {
+		if (!tdp_mmu_set_spte_atomic(iter, new_spte))
+			return RET_PF_RETRY;
+
+		if (tdp_mmu_handle_changed_leaf(vcpu->kvm, old_spte, new_spte,
+						iter->level))
+			kvm_flush_remote_tlbs(vcpu->kvm);
+	}
+
+	if (make_ret & SET_SPTE_WRITE_PROTECTED_PT) {
+		if (write)
+			ret = RET_PF_EMULATE;
+		kvm_make_request(KVM_REQ_TLB_FLUSH, vcpu);
+	}
+
+	if (unlikely(is_mmio_spte(new_spte)))
+		ret = RET_PF_EMULATE;
+
+	trace_kvm_mmu_set_spte(iter->level, iter->gfn, iter->sptep);
+	++vcpu->stat.pf_fixed;
+
+	return ret;
+}
+
+/*
+ * Handle a TDP page fault on a TDP MMU root.  Called with mmu_lock held
+ * for read (see kvm_tdp_mmu_fault_lock()), so every spte is changed with
+ * cmpxchg and the fault is retried if another vcpu changed it first.
+ */
+static int kvm_tdp_mmu_map(struct kvm_vcpu *vcpu, gpa_t gpa, int write,
+			   int map_writable, int level, kvm_pfn_t pfn,
+			   bool prefault)
+{
+	struct kvm_mmu_page *root = page_header(vcpu->arch.mmu.root_hpa);
+	union kvm_mmu_page_role role;
+	gfn_t gfn = gpa >> PAGE_SHIFT;
+	struct kvm_mmu_page *sp;
+	struct tdp_iter iter;
+	u64 old_spte;
+
+	trace_kvm_mmu_spte_requested(gpa, level, pfn);
+
+	tdp_iter_start(&iter, root->spt, root->role.level,
+		       PT_PAGE_TABLE_LEVEL, gfn);
+
+	while (iter.level > level ||
+	       spte_to_child_pt(iter.old_spte, iter.level)) {
+		if (iter.level == level) {
+			/*
+			 * A page table maps part of the huge page already:
+			 * leave it there and map the next level down.
+			 */
+			level--;
+			pfn |= gfn & (KVM_PAGES_PER_HPAGE(level + 1) -
+				      KVM_PAGES_PER_HPAGE(level));
+		}
+
+		if (is_shadow_present_pte(iter.old_spte) &&
+		    is_large_pte(iter.old_spte)) {
+			/* A huge page above the goal level has to go first */
+			old_spte = iter.old_spte;
+			if (!tdp_mmu_set_spte_atomic(&iter, 0))
+				return RET_PF_RETRY;
+
+			kvm_flush_remote_tlbs(vcpu->kvm);
+			handle_zapped_spte(vcpu->kvm, old_spte, iter.level, NULL);
+		}
+
+		if (!is_shadow_present_pte(iter.old_spte)) {
+			role = root->role;
+			role.level = iter.level - 1;
+			sp = tdp_mmu_alloc_sp(vcpu, iter.gfn, role);
+
+			if (!tdp_mmu_set_spte_atomic(&iter,
+						     make_nonleaf_spte(sp))) {
+				tdp_mmu_free_sp(sp);
+				return RET_PF_RETRY;
+			}
+		}
+
+		tdp_iter_next(&iter);
+	}
+
+	return tdp_mmu_map_handle_target_level(vcpu, &iter, write,
+					       map_writable, pfn, prefault,
+					       root->role.ad_disabled);
+}
+
+/*
+ * Zap the sptes mapping [start, end) in @root, the page tables entirely
+ * inside the range go with their parent.  Returns whether the zapped leaf
+ * sptes still need a TLB flush.
+ */
+static bool zap_gfn_range(struct kvm *kvm, struct kvm_mmu_page *root,
+			  gfn_t start, gfn_t end, bool can_yield)
+{
+	LIST_HEAD(invalid_list);
+	struct tdp_iter iter;
+	bool flush = false;
+
+	for_each_tdp_pte(iter, root, start, end) {
+		if (can_yield &&
+		    tdp_mmu_iter_cond_resched(kvm, &iter, flush,
+					      &invalid_list)) {
+			flush = false;
+			continue;
+		}
+
+		if (!is_shadow_present_pte(iter.old_spte))
+			continue;
+
+		/* The walk goes into page tables partly outside the range */
+		if ((iter.gfn < start ||
+		     iter.gfn + KVM_PAGES_PER_HPAGE(iter.level) > end) &&
+		    !is_last_spte(iter.old_spte, iter.level))
+			continue;
+
+		tdp_mmu_zap_spte(kvm, &iter, &invalid_list);
+		flush = true;
+	}
+
+	if (list_empty(&invalid_list))
+		return flush;
+
+	tdp_mmu_commit_zap(kvm, &invalid_list);
+	return false;
+}
+
+static bool kvm_tdp_mmu_zap_gfn_range(struct kvm *kvm, gfn_t start, gfn_t end)
+{
+	struct kvm_mmu_page *root;
+	bool flush = false;
+
+	for_each_tdp_mmu_root_yield_safe(kvm, root)
+		flush |= zap_gfn_range(kvm, root, start, end, true);
+
+	return flush;
+}
+
+static void kvm_tdp_mmu_zap_all(struct kvm *kvm)
+{
+	struct kvm_mmu_page *root;
+	bool flush = false;
+
+	for_each_tdp_mmu_root_yield_safe(kvm, root)
+		flush |= zap_gfn_range(kvm, root, 0, tdp_mmu_max_gfn(root),
+				       true);
+
+	if (flush)
+		kvm_flush_remote_tlbs(kvm);
+}
+
+/*
+ * Call @handler on the gfns of every root that the memslots of the root's
+ * address space map to [start, end).  Called from MMU notifiers, which may
+ * not be allowed to sleep, so the handlers do not give up mmu_lock.
+ */
+static int kvm_tdp_mmu_handle_hva_range(struct kvm *kvm, unsigned long start,
+		unsigned long end, unsigned long data,
+		int (*handler)(struct kvm *kvm, struct kvm_memory_slot *slot,
+			       struct kvm_mmu_page *root, gfn_t start,
+			       gfn_t end, unsigned long data))
+{
+	struct kvm_memslots *slots;
+	struct kvm_memory_slot *memslot;
+	struct kvm_mmu_page *root;
+	int ret = 0;
+
+	for_each_tdp_mmu_root_yield_safe(kvm, root) {
+		slots = kvm_memslots_for_spte_role(kvm, root->role);
+		kvm_for_each_memslot(memslot, slots) {
+			unsigned long hva_start, hva_end;
+			gfn_t gfn_start, gfn_end;
+
+			hva_start = max(start, memslot->userspace_addr);
+			hva_end = min(end, memslot->userspace_addr +
+				      (memslot->npages << PAGE_SHIFT));
+			if (hva_start >= hva_end)
+				continue;
+			/*
+			 * {gfn(page) | page intersects with [hva_start, hva_end)} =
+			 * {gfn_start, gfn_start+1, ..., gfn_end-1}.
+			 */
+			gfn_start = hva_to_gfn_memslot(hva_start, memslot);
+			gfn_end = hva_to_gfn_memslot(hva_end + PAGE_SIZE - 1,
+						     memslot);
+
+			ret |= handler(kvm, memslot, root, gfn_start, gfn_end,
+				       data);
+		}
+	}
+
+	return ret;
+}
+
+static int zap_gfn_range_hva_wrapper(struct kvm *kvm,
+				     struct kvm_memory_slot *slot,
+				     struct kvm_mmu_page *root, gfn_t start,
+				     gfn_t end, unsigned long unused)
+{
+	return zap_gfn_range(kvm, root, start, end, false);
+}
+
+static int kvm_tdp_mmu_zap_hva_range(struct kvm *kvm, unsigned long start,
+				     unsigned long end)
+{
+	return kvm_tdp_mmu_handle_hva_range(kvm, start, end, 0,
+					    zap_gfn_range_hva_wrapper);
+}
+
+/*
+ * The host pte changed, the next fault maps the new pfn: just zap the old
+ * one as kvm_set_pte_rmapp() does for a writable host pte.
+ */
+static void kvm_tdp_mmu_set_spte_hva(struct kvm *kvm, unsigned long address)
+{
+	if (kvm_tdp_mmu_handle_hva_range(kvm, address, address + 1, 0,
+					 zap_gfn_range_hva_wrapper))
+		kvm_flush_remote_tlbs(kvm);
+}
+
+static int age_gfn_range(struct kvm *kvm, struct kvm_memory_slot *slot,
+			 struct kvm_mmu_page *root, gfn_t start, gfn_t end,
+			 unsigned long unused)
+{
+	struct tdp_iter iter;
+	int young = 0;
+
+	for_each_tdp_pte(iter, root, start, end) {
+		if (!is_shadow_present_pte(iter.old_spte) ||
+		    !is_last_spte(iter.old_spte, iter.level))
+			continue;
+
+		young |= mmu_spte_age(iter.sptep);
+		trace_kvm_age_page(iter.gfn, iter.level, slot, young);
+	}
+
+	return young;
+}
+
+static int kvm_tdp_mmu_age_hva_range(struct kvm *kvm, unsigned long start,
+				     unsigned long end)
+{
+	return kvm_tdp_mmu_handle_hva_range(kvm, start, end, 0,
+					    age_gfn_range);
+}
+
+static int test_age_gfn(struct kvm *kvm, struct kvm_memory_slot *slot,
+			struct kvm_mmu_page *root, gfn_t gfn, gfn_t unused,
+			unsigned long unused2)
+{
+	struct tdp_iter iter;
+
+	for_each_tdp_pte(iter, root, gfn, gfn + 1)
+		if (is_shadow_present_pte(iter.old_spte) &&
+		    is_last_spte(iter.old_spte, iter.level) &&
+		    is_accessed_spte(iter.old_spte))
+			return 1;
+
+	return 0;
+}
+
+static int kvm_tdp_mmu_test_age_hva(struct kvm *kvm, unsigned long hva)
+{
+	return kvm_tdp_mmu_handle_hva_range(kvm, hva, hva + 1, 0,
+					    test_age_gfn);
+}
+
+/* Write protect the leaf sptes of [start, end) at or above @min_level */
+static bool wrprot_gfn_range(struct kvm *kvm, struct kvm_mmu_page *root,
+			     gfn_t start, gfn_t end, int min_level)
+{
+	struct tdp_iter iter;
+	bool flush = false;
+
+	for_each_tdp_pte_min_level(iter, root, min_level, start, end) {
+		if (tdp_mmu_iter_cond_resched(kvm, &iter, flush, NULL)) {
+			flush = false;
+			continue;
+		}
+
+		if (!is_shadow_present_pte(iter.old_spte) ||
+		    !is_last_spte(iter.old_spte, iter.level))
+			continue;
+
+		flush |= spte_write_protect(iter.sptep, false);
+	}
+
+	return flush;
+}
+
+static bool kvm_tdp_mmu_wrprot_slot(struct kvm *kvm,
+				    struct kvm_memory_slot *slot, int min_level)
+{
+	struct kvm_mmu_page *root;
+	bool flush = false;
+
+	for_each_tdp_mmu_root_yield_safe(kvm, root) {
+		if (!tdp_mmu_root_has_slot(kvm, root, slot))
+			continue;
+
+		flush |= wrprot_gfn_range(kvm, root, slot->base_gfn,
+					  slot->base_gfn + slot->npages,
+					  min_level);
+	}
+
+	return flush;
+}
+
+/*
+ * Clear the dirty bit of a 4K leaf spte, or write protect it if it has no
+ * accessed and dirty bits, so that the next write is logged again.
+ */
+static bool tdp_mmu_clear_dirty_spte(u64 *sptep)
+{
+	if (spte_ad_enabled(*sptep))
+		return spte_clear_dirty(sptep);
+
+	return wrprot_ad_disabled_spte(sptep);
+}
+
+static bool clear_dirty_gfn_range(struct kvm *kvm, struct kvm_mmu_page *root,
+				  gfn_t start, gfn_t end)
+{
+	struct tdp_iter iter;
+	bool flush = false;
+
+	for_each_tdp_pte(iter, root, start, end) {
+		if (tdp_mmu_iter_cond_resched(kvm, &iter, flush, NULL)) {
+			flush = false;
+			continue;
+		}
+
+		if (iter.level != PT_PAGE_TABLE_LEVEL ||
+		    !is_shadow_present_pte(iter.old_spte))
+			continue;
+
+		flush |= tdp_mmu_clear_dirty_spte(iter.sptep);
+	}
+
+	return flush;
+}
+
+static bool kvm_tdp_mmu_clear_dirty_slot(struct kvm *kvm,
+					 struct kvm_memory_slot *slot)
+{
+	struct kvm_mmu_page *root;
+	bool flush = false;
+
+	for_each_tdp_mmu_root_yield_safe(kvm, root) {
+		if (!tdp_mmu_root_has_slot(kvm, root, slot))
+			continue;
+
+		flush |= clear_dirty_gfn_range(kvm, root, slot->base_gfn,
+					       slot->base_gfn + slot->npages);
+	}
+
+	return flush;
+}
+
+static bool set_dirty_gfn_range(struct kvm *kvm, struct kvm_mmu_page *root,
+				gfn_t start, gfn_t end)
+{
+	struct tdp_iter iter;
+	bool flush = false;
+
+	for_each_tdp_pte(iter, root, start, end) {
+		if (tdp_mmu_iter_cond_resched(kvm, &iter, flush, NULL)) {
+			flush = false;
+			continue;
+		}
+
+		if (!is_shadow_present_pte(iter.old_spte) ||
+		    !is_last_spte(iter.old_spte, iter.level) ||
+		    !spte_ad_enabled(iter.old_spte))
+			continue;
+
+		flush |= spte_set_dirty(iter.sptep);
+	}
+
+	return flush;
+}
+
+static bool kvm_tdp_mmu_slot_set_dirty(struct kvm *kvm,
+				       struct kvm_memory_slot *slot)
+{
+	struct kvm_mmu_page *root;
+	bool flush = false;
+
+	for_each_tdp_mmu_root_yield_safe(kvm, root) {
+		if (!tdp_mmu_root_has_slot(kvm, root, slot))
+			continue;
+
+		flush |= set_dirty_gfn_range(kvm, root, slot->base_gfn,
+					     slot->base_gfn + slot->npages);
+	}
+
+	return flush;
+}
+
+/*
+ * Clear the dirty bit, or write protect if @wrprot, of the 4K sptes of the
+ * gfns set in @mask, starting at @gfn.
+ */
+static void clear_dirty_pt_masked(struct kvm *kvm, struct kvm_mmu_page *root,
+				  gfn_t gfn, unsigned long mask, bool wrprot)
+{
+	struct tdp_iter iter;
+
+	for_each_tdp_pte(iter, root, gfn + __ffs(mask), gfn + BITS_PER_LONG) {
+		if (!mask)
+			break;
+
+		if (iter.level != PT_PAGE_TABLE_LEVEL ||
+		    !(mask & (1UL << (iter.gfn - gfn))))
+			continue;
+
+		mask &= ~(1UL << (iter.gfn - gfn));
+
+		if (!is_shadow_present_pte(iter.old_spte))
+			continue;
+
+		if (wrprot)
+			spte_write_protect(iter.sptep, false);
+		else
+			tdp_mmu_clear_dirty_spte(iter.sptep);
+	}
+}
+
+static void kvm_tdp_mmu_clear_dirty_pt_masked(struct kvm *kvm,
+					      struct kvm_memory_slot *slot,
+					      gfn_t gfn, unsigned long mask,
+					      bool wrprot)
+{
+	struct kvm_mmu_page *root;
+
+	lockdep_assert_held_exclusive(&kvm->mmu_lock);
+
+	for_each_tdp_mmu_root(kvm, root)
+		if (tdp_mmu_root_has_slot(kvm, root, slot))
+			clear_dirty_pt_masked(kvm, root, gfn, mask, wrprot);
+}
+
+/*
+ * Zap the page tables of 4K sptes of which some map a transparent huge
+ * page, so that the next fault maps it huge again now that dirty logging
+ * is off.
+ */
+static void zap_collapsible_spte_range(struct kvm *kvm,
+				       struct kvm_mmu_page *root,
+				       gfn_t start, gfn_t end)
+{
+	LIST_HEAD(invalid_list);
+	struct tdp_iter iter;
+	kvm_pfn_t pfn;
+	u64 *child_pt;
+	int i;
+
+	for_each_tdp_pte_min_level(iter, root, PT_DIRECTORY_LEVEL, start, end) {
+		if (tdp_mmu_iter_cond_resched(kvm, &iter, false,
+					      &invalid_list))
+			continue;
+
+		if (iter.level != PT_DIRECTORY_LEVEL)
+			continue;
+
+		child_pt = spte_to_child_pt(iter.old_spte, iter.level);
+		if (!child_pt)
+			continue;
+
+		for (i = 0; i < PT64_ENT_PER_PAGE; i++) {
+			if (!is_shadow_present_pte(child_pt[i]))
+				continue;
+
+			pfn = spte_to_pfn(child_pt[i]);
+			if (!kvm_is_reserved_pfn(pfn) &&
+			    !kvm_is_zone_device_pfn(pfn) &&
+			    kvm_is_transparent_hugepage(pfn))
+				break;
+		}
+
+		if (i < PT64_ENT_PER_PAGE)
+			tdp_mmu_zap_spte(kvm, &iter, &invalid_list);
+	}
+
+	tdp_mmu_commit_zap(kvm, &invalid_list);
+}
+
+static void kvm_tdp_mmu_zap_collapsible_sptes(struct kvm *kvm,
+					      const struct kvm_memory_slot *slot)
+{
+	struct kvm_mmu_page *root;
+
+	for_each_tdp_mmu_root_yield_safe(kvm, root) {
+		if (!tdp_mmu_root_has_slot(kvm, root, slot))
+			continue;
+
+		zap_collapsible_spte_range(kvm, root, slot->base_gfn,
+					   slot->base_gfn + slot->npages);
+	}
+}
+
+/* Write protect the leaf sptes mapping @gfn, at any level */
+static bool kvm_tdp_mmu_write_protect_gfn(struct kvm *kvm,
+					  struct kvm_memory_slot *slot,
+					  gfn_t gfn)
+{
+	struct kvm_mmu_page *root;
+	struct tdp_iter iter;
+	bool spte_set = false;
+
+	lockdep_assert_held_exclusive(&kvm->mmu_lock);
+
+	for_each_tdp_mmu_root(kvm, root) {
+		if (!tdp_mmu_root_has_slot(kvm, root, slot))
+			continue;
+
+		for_each_tdp_pte(iter, root, gfn, gfn + 1)
+			if (is_shadow_present_pte(iter.old_spte) &&
+			    is_last_spte(iter.old_spte, iter.level))
+				spte_set |= spte_write_protect(iter.sptep,
+							       true);
+	}
+
+	return spte_set;
+}
+
+static struct kvm_mmu_page *tdp_mmu_alloc_sp_for_split(gfp_t gfp)
+{
+	struct kvm_mmu_page *sp;
+
+	sp = kmem_cache_zalloc(mmu_page_header_cache, gfp);
+	if (!sp)
+		return NULL;
+
+	sp->spt = (void *)__get_free_page(gfp | __GFP_ZERO);
+	if (!sp->spt) {
+		kmem_cache_free(mmu_page_header_cache, sp);
+		return NULL;
+	}
+	set_page_private(virt_to_page(sp->spt), (unsigned long)sp);
+
+	return sp;
+}
+
+/*
+ * Replace the huge leaf spte with a page table of sptes mapping the same
+ * pfns with the same permissions.  Until the next flush the vcpus may use
+ * either translation, which is fine since they are the same.
+ */
+static void tdp_mmu_split_huge_page(struct tdp_iter *iter,
+				    struct kvm_mmu_page *root,
+				    struct kvm_mmu_page *sp)
+{
+	int child_level = iter->level - 1;
+	u64 huge_spte = iter->old_spte;
+	u64 new_spte, old_spte;
+	int i;
+
+	sp->role = root->role;
+	sp->role.level = child_level;
+	sp->gfn = iter->gfn;
+	sp->tdp_mmu_page = true;
+	new_spte = make_nonleaf_spte(sp);
+
+	for (;;) {
+		for (i = 0; i < PT64_ENT_PER_PAGE; i++) {
+			sp->spt[i] = huge_spte |
+				((u64)i * KVM_PAGES_PER_HPAGE(child_level)
+				 << PAGE_SHIFT);
+			if (child_level == PT_PAGE_TABLE_LEVEL)
+				sp->spt[i] &= ~PT_PAGE_SIZE_MASK;
+		}
+
+		/*
+		 * The CPU may set the accessed and dirty bits, and
+		 * fast_page_fault() the writable bit, under us.
+		 */
+		old_spte = cmpxchg64(iter->sptep, huge_spte, new_spte);
+		if (old_spte == huge_spte)
+			break;
+		huge_spte = old_spte;
+	}
+
+	iter->old_spte = new_spte;
+}
+
+/*
+ * Split the huge pages of [start, end) in @root down to 4K.  The walk goes
+ * into each new page table right after installing it, so 1G pages become
+ * 2M ones first and then 4K ones.
+ */
+static void tdp_mmu_split_huge_pages_root(struct kvm *kvm,
+					  struct kvm_mmu_page *root,
+					  gfn_t start, gfn_t end)
+{
+	struct kvm_mmu_page *sp = NULL;
+	struct tdp_iter iter;
+
+	for_each_tdp_pte_min_level(iter, root, PT_DIRECTORY_LEVEL, start, end) {
+		if (tdp_mmu_iter_cond_resched(kvm, &iter, false, NULL))
+			continue;
+
+		if (!is_shadow_present_pte(iter.old_spte) ||
+		    !is_large_pte(iter.old_spte))
+			continue;
+
+		if (!sp) {
+			sp = tdp_mmu_alloc_sp_for_split(GFP_NOWAIT |
+							__GFP_ACCOUNT);
+			if (!sp) {
+				write_unlock(&kvm->mmu_lock);
+				sp = tdp_mmu_alloc_sp_for_split(GFP_KERNEL_ACCOUNT);
+				write_lock(&kvm->mmu_lock);
+				if (!sp)
+					break;
+
+				/* The spte may be gone, look it up again */
+				tdp_iter_refresh_walk(&iter);
+				continue;
+			}
+		}
+
+		tdp_mmu_split_huge_page(&iter, root, sp);
+		sp = NULL;
+	}
+
+	/*
+	 * Out of memory is not an error: the pages left huge are split by
+	 * the write faults of dirty logging.
+	 */
+	if (sp)
+		tdp_mmu_free_sp(sp);
+}
+
+static void kvm_tdp_mmu_try_split_huge_pages(struct kvm *kvm,
+					     const struct kvm_memory_slot *slot)
+{
+	struct kvm_mmu_page *root;
+
+	lockdep_assert_held_exclusive(&kvm->mmu_lock);
+
+	for_each_tdp_mmu_root_yield_safe(kvm, root) {
+		if (!tdp_mmu_root_has_slot(kvm, root, slot))
+			continue;
+
+		tdp_mmu_split_huge_pages_root(kvm, root, slot->base_gfn,
+					      slot->base_gfn + slot->npages);
+	}
+}
@@ -102,6 +102,10 @@ module_param(fasteoi, bool, S_IRUGO);
 static bool __read_mostly enable_apicv = 1;
 module_param(enable_apicv, bool, S_IRUGO);
 
+/* IPI virtualization, used on top of APICv when the processor has it */
+static bool __read_mostly enable_ipiv = 1;
+module_param(enable_ipiv, bool, S_IRUGO);
+
 static bool __read_mostly enable_shadow_vmcs = 1;
 module_param_named(enable_shadow_vmcs, enable_shadow_vmcs, bool, S_IRUGO);
 /*
@@ -356,8 +360,20 @@ struct kvm_vmx {
 
 	enum ept_pointers_status ept_pointers_match;
 	spinlock_t ept_pointer_lock;
+
+	/*
+	 * PID-pointer table of IPI virtualization, indexed by the APIC ID
+	 * of the destination; it is only valid while every APIC ID is
+	 * the vcpu_id, so it is emptied for good when one changes.
+	 */
+	u64 *pid_table;
+	spinlock_t pid_table_lock;
+	bool ipiv_inhibited;
 };
 
+#define PID_TABLE_ENTRY_VALID		1
+#define PID_TABLE_ORDER			get_order(KVM_MAX_VCPU_ID * sizeof(u64))
+
 #define NR_AUTOLOAD_MSRS 8
 
 struct vmcs_hdr {
@@ -1012,6 +1028,8 @@ struct vcpu_vmx {
 	bool emulation_required;
 
 	u32 exit_reason;
+	/* The exit was handled with interrupts disabled right after it */
+	bool exit_fastpath;
 
 	/* Posted interrupt descriptor */
 	struct pi_desc pi_desc;
@@ -1329,6 +1347,7 @@ static struct vmcs_config {
 	u32 pin_based_exec_ctrl;
 	u32 cpu_based_exec_ctrl;
 	u32 cpu_based_2nd_exec_ctrl;
+	u64 cpu_based_3rd_exec_ctrl;
 	u32 vmexit_ctrl;
 	u32 vmentry_ctrl;
 	struct nested_vmx_msrs nested;
@@ -1528,6 +1547,13 @@ static void evmcs_sanitize_exec_ctrls(struct vmcs_config *vmcs_conf)
 	 */
 	vmcs_conf->pin_based_exec_ctrl &= ~PIN_BASED_VMX_PREEMPTION_TIMER;
 
+	/*
+	 *	TERTIARY_VM_EXEC_CONTROL	= 0x00002034,
+	 *	PID_POINTER_TABLE		= 0x00002042,
+	 */
+	vmcs_conf->cpu_based_exec_ctrl &= ~CPU_BASED_ACTIVATE_TERTIARY_CONTROLS;
+	vmcs_conf->cpu_based_3rd_exec_ctrl = 0;
+
 	/*
 	 *      GUEST_IA32_PERF_GLOBAL_CTRL     = 0x00002808,
 	 *      HOST_IA32_PERF_GLOBAL_CTRL      = 0x00002c04,
@@ -1676,6 +1702,18 @@ static inline bool cpu_has_secondary_exec_ctrls(void)
 		CPU_BASED_ACTIVATE_SECONDARY_CONTROLS;
 }
 
+static inline bool cpu_has_tertiary_exec_ctrls(void)
+{
+	return vmcs_config.cpu_based_exec_ctrl &
+		CPU_BASED_ACTIVATE_TERTIARY_CONTROLS;
+}
+
+static inline bool cpu_has_vmx_ipiv(void)
+{
+	return cpu_has_tertiary_exec_ctrls() &&
+		(vmcs_config.cpu_based_3rd_exec_ctrl & TERTIARY_EXEC_IPI_VIRT);
+}
+
 static inline bool cpu_has_vmx_virtualize_apic_accesses(void)
 {
 	return vmcs_config.cpu_based_2nd_exec_ctrl &
@@ -4523,6 +4561,7 @@ static __init int setup_vmcs_config(struct vmcs_config *vmcs_conf)
 	u32 _pin_based_exec_control = 0;
 	u32 _cpu_based_exec_control = 0;
 	u32 _cpu_based_2nd_exec_control = 0;
+	u64 _cpu_based_3rd_exec_control = 0;
 	u32 _vmexit_control = 0;
 	u32 _vmentry_control = 0;
 
@@ -4544,7 +4583,8 @@ static __init int setup_vmcs_config(struct vmcs_config *vmcs_conf)
 
 	opt = CPU_BASED_TPR_SHADOW |
 	      CPU_BASED_USE_MSR_BITMAPS |
-	      CPU_BASED_ACTIVATE_SECONDARY_CONTROLS;
+	      CPU_BASED_ACTIVATE_SECONDARY_CONTROLS |
+	      CPU_BASED_ACTIVATE_TERTIARY_CONTROLS;
 	if (adjust_vmx_controls(min, opt, MSR_IA32_VMX_PROCBASED_CTLS,
 				&_cpu_based_exec_control) < 0)
 		return -EIO;
@@ -4580,6 +4620,16 @@ static __init int setup_vmcs_config(struct vmcs_config *vmcs_conf)
 					&_cpu_based_2nd_exec_control) < 0)
 			return -EIO;
 	}
+	if (_cpu_based_exec_control & CPU_BASED_ACTIVATE_TERTIARY_CONTROLS) {
+		u64 allowed1 = 0;
+
+		/* The tertiary controls MSR only reports allowed 1-settings */
+		rdmsrl_safe(MSR_IA32_VMX_PROCBASED_CTLS3, &allowed1);
+		_cpu_based_3rd_exec_control = allowed1 & TERTIARY_EXEC_IPI_VIRT;
+		if (!_cpu_based_3rd_exec_control)
+			_cpu_based_exec_control &=
+				~CPU_BASED_ACTIVATE_TERTIARY_CONTROLS;
+	}
 #ifndef CONFIG_X86_64
 	if (!(_cpu_based_2nd_exec_control &
 				SECONDARY_EXEC_VIRTUALIZE_APIC_ACCESSES))
@@ -4592,6 +4642,13 @@ static __init int setup_vmcs_config(struct vmcs_config *vmcs_conf)
 				SECONDARY_EXEC_VIRTUALIZE_X2APIC_MODE |
 				SECONDARY_EXEC_VIRTUAL_INTR_DELIVERY);
 
+	/* IPI virtualization posts into the PIR, it needs the rest of APICv */
+	if (!(_cpu_based_2nd_exec_control &
+	      SECONDARY_EXEC_VIRTUAL_INTR_DELIVERY)) {
+		_cpu_based_3rd_exec_control = 0;
+		_cpu_based_exec_control &= ~CPU_BASED_ACTIVATE_TERTIARY_CONTROLS;
+	}
+
 	rdmsr_safe(MSR_IA32_VMX_EPT_VPID_CAP,
 		&vmx_capability.ept, &vmx_capability.vpid);
 
@@ -4667,6 +4724,7 @@ static __init int setup_vmcs_config(struct vmcs_config *vmcs_conf)
 	vmcs_conf->pin_based_exec_ctrl = _pin_based_exec_control;
 	vmcs_conf->cpu_based_exec_ctrl = _cpu_based_exec_control;
 	vmcs_conf->cpu_based_2nd_exec_ctrl = _cpu_based_2nd_exec_control;
+	vmcs_conf->cpu_based_3rd_exec_ctrl = _cpu_based_3rd_exec_control;
 	vmcs_conf->vmexit_ctrl         = _vmexit_control;
 	vmcs_conf->vmentry_ctrl        = _vmentry_control;
 
@@ -6116,6 +6174,8 @@ static void vmx_update_msr_bitmap_x2apic(unsigned long *msr_bitmap,
 			vmx_enable_intercept_for_msr(msr_bitmap, X2APIC_MSR(APIC_TMCCT), MSR_TYPE_R);
 			vmx_disable_intercept_for_msr(msr_bitmap, X2APIC_MSR(APIC_EOI), MSR_TYPE_W);
 			vmx_disable_intercept_for_msr(msr_bitmap, X2APIC_MSR(APIC_SELF_IPI), MSR_TYPE_W);
+			if (enable_ipiv)
+				vmx_disable_intercept_for_msr(msr_bitmap, X2APIC_MSR(APIC_ICR), MSR_TYPE_W);
 		}
 	}
 }
@@ -6396,6 +6456,63 @@ static u32 vmx_pin_based_exec_ctrl(struct vcpu_vmx *vmx)
 	return pin_based_exec_ctrl;
 }
 
+static bool vmx_can_use_ipiv(struct kvm_vcpu *vcpu)
+{
+	return enable_ipiv && kvm_vcpu_apicv_active(vcpu);
+}
+
+/*
+ * With IPI virtualization, a physical fixed IPI whose destination has a
+ * valid entry in the PID-pointer table is posted by the processor without
+ * a VM exit; any other IPI still causes an APIC-write exit.
+ */
+static void vmx_update_ipiv(struct kvm_vcpu *vcpu)
+{
+	struct kvm_vmx *kvm_vmx = to_kvm_vmx(vcpu->kvm);
+	u64 *pid_entry = &kvm_vmx->pid_table[vcpu->vcpu_id];
+
+	if (!enable_ipiv)
+		return;
+
+	spin_lock(&kvm_vmx->pid_table_lock);
+	if (vmx_can_use_ipiv(vcpu)) {
+		vmcs_write64(TERTIARY_VM_EXEC_CONTROL, TERTIARY_EXEC_IPI_VIRT);
+		vmcs_write64(PID_POINTER_TABLE, __pa(kvm_vmx->pid_table));
+		vmcs_write16(LAST_PID_POINTER_INDEX, KVM_MAX_VCPU_ID - 1);
+		vmcs_set_bits(CPU_BASED_VM_EXEC_CONTROL,
+			      CPU_BASED_ACTIVATE_TERTIARY_CONTROLS);
+		if (!kvm_vmx->ipiv_inhibited)
+			WRITE_ONCE(*pid_entry, __pa(vcpu_to_pi_desc(vcpu)) |
+					       PID_TABLE_ENTRY_VALID);
+	} else {
+		vmcs_clear_bits(CPU_BASED_VM_EXEC_CONTROL,
+				CPU_BASED_ACTIVATE_TERTIARY_CONTROLS);
+		WRITE_ONCE(*pid_entry, 0);
+	}
+	spin_unlock(&kvm_vmx->pid_table_lock);
+}
+
+static void vmx_apic_id_changed(struct kvm *kvm)
+{
+	struct kvm_vmx *kvm_vmx = to_kvm_vmx(kvm);
+	int i;
+
+	if (!enable_ipiv)
+		return;
+
+	/*
+	 * The processor may be reading the table: clear the entries one by
+	 * one, so that it never sees a torn one.
+	 */
+	spin_lock(&kvm_vmx->pid_table_lock);
+	if (!kvm_vmx->ipiv_inhibited) {
+		kvm_vmx->ipiv_inhibited = true;
+		for (i = 0; i < KVM_MAX_VCPU_ID; i++)
+			WRITE_ONCE(kvm_vmx->pid_table[i], 0);
+	}
+	spin_unlock(&kvm_vmx->pid_table_lock);
+}
+
 static void vmx_refresh_apicv_exec_ctrl(struct kvm_vcpu *vcpu)
 {
 	struct vcpu_vmx *vmx = to_vmx(vcpu);
@@ -6411,6 +6528,7 @@ static void vmx_refresh_apicv_exec_ctrl(struct kvm_vcpu *vcpu)
 					SECONDARY_EXEC_APIC_REGISTER_VIRT |
 					SECONDARY_EXEC_VIRTUAL_INTR_DELIVERY);
 	}
+	vmx_update_ipiv(vcpu);
 
 	if (cpu_has_vmx_msr_bitmap())
 		vmx_update_msr_bitmap(vcpu);
@@ -6439,6 +6557,8 @@ static u32 vmx_exec_control(struct vcpu_vmx *vmx)
 				CPU_BASED_MONITOR_EXITING);
 	if (kvm_hlt_in_guest(vmx->vcpu.kvm))
 		exec_control &= ~CPU_BASED_HLT_EXITING;
+	/* Only vmcs01 uses the tertiary controls, see vmx_update_ipiv() */
+	exec_control &= ~CPU_BASED_ACTIVATE_TERTIARY_CONTROLS;
 	return exec_control;
 }
 
@@ -6635,6 +6755,7 @@ static void vmx_vcpu_setup(struct vcpu_vmx *vmx)
 		vmcs_write16(POSTED_INTR_NV, POSTED_INTR_VECTOR);
 		vmcs_write64(POSTED_INTR_DESC_ADDR, __pa((&vmx->pi_desc)));
 	}
+	vmx_update_ipiv(&vmx->vcpu);
 
 	if (!kvm_pause_in_guest(vmx->vcpu.kvm)) {
 		vmcs_write32(PLE_GAP, ple_gap);
@@ -7487,6 +7608,34 @@ static int handle_wrmsr(struct kvm_vcpu *vcpu)
 	return kvm_skip_emulated_instruction(vcpu);
 }
 
+/*
+ * Called by vmx_vcpu_run() with interrupts still disabled.  Without IPI
+ * virtualization, a physical fixed IPI in x2APIC mode still exits, but it
+ * is sent right away: a running target gets it as a posted interrupt and
+ * vmx_handle_exit() only has to skip the WRMSR.
+ */
+static bool handle_fastpath_set_x2apic_icr_irqoff(struct kvm_vcpu *vcpu)
+{
+	u32 ecx = vcpu->arch.regs[VCPU_REGS_RCX];
+	u64 data;
+
+	if (is_guest_mode(vcpu) || ecx != X2APIC_MSR(APIC_ICR) ||
+	    !lapic_in_kernel(vcpu) || !apic_x2apic_mode(vcpu->arch.apic))
+		return false;
+
+	data = kvm_read_edx_eax(vcpu);
+	if ((data & APIC_SHORT_MASK) != APIC_DEST_NOSHORT ||
+	    (data & APIC_DEST_MASK) != APIC_DEST_PHYSICAL ||
+	    (data & APIC_MODE_MASK) != APIC_DM_FIXED)
+		return false;
+
+	if (kvm_x2apic_msr_write(vcpu, ecx, data))
+		return false;
+
+	trace_kvm_msr_write(ecx, data);
+	return true;
+}
+
 static int handle_tpr_below_threshold(struct kvm_vcpu *vcpu)
 {
 	kvm_apic_update_ppr(vcpu);
@@ -7975,6 +8124,9 @@ static __init int hardware_setup(void)
 		kvm_x86_ops->sync_pir_to_irr = NULL;
 	}
 
+	if (!enable_apicv || !cpu_has_vmx_ipiv())
+		enable_ipiv = 0;
+
 	if (cpu_has_vmx_tsc_scaling()) {
 		kvm_has_tsc_control = true;
 		kvm_max_tsc_scaling_ratio = KVM_VMX_TSC_MULTIPLIER_MAX;
@@ -8005,6 +8157,7 @@ static __init int hardware_setup(void)
 		kvm_x86_ops->slot_disable_log_dirty = NULL;
 		kvm_x86_ops->flush_log_dirty = NULL;
 		kvm_x86_ops->enable_log_dirty_pt_masked = NULL;
+		kvm_x86_ops->cpu_dirty_log_size = 0;
 	}
 
 	if (!cpu_has_vmx_preemption_timer())
@@ -10132,6 +10285,9 @@ static int vmx_handle_exit(struct kvm_vcpu *vcpu)
 	if (vmx->emulation_required)
 		return handle_invalid_guest_state(vcpu);
 
+	if (vmx->exit_fastpath)
+		return kvm_skip_emulated_instruction(vcpu);
+
 	if (is_guest_mode(vcpu) && nested_vmx_exit_reflected(vcpu, exit_reason))
 		return nested_vmx_reflect_vmexit(vcpu, exit_reason);
 
@@ -10731,6 +10887,8 @@ static void __noclone vmx_vcpu_run(struct kvm_vcpu *vcpu)
 	struct vcpu_vmx *vmx = to_vmx(vcpu);
 	unsigned long cr3, cr4, evmcs_rsp;
 
+	vmx->exit_fastpath = false;
+
 	/* Record the guest's net vcpu time for enforced NMI injections. */
 	if (unlikely(!enable_vnmi &&
 		     vmx->loaded_vmcs->soft_vnmi_blocked))
@@ -11011,6 +11169,9 @@ static void __noclone vmx_vcpu_run(struct kvm_vcpu *vcpu)
 	vmx_complete_atomic_exit(vmx);
 	vmx_recover_nmi_blocking(vmx);
 	vmx_complete_interrupts(vmx);
+
+	if (vmx->exit_reason == EXIT_REASON_MSR_WRITE)
+		vmx->exit_fastpath = handle_fastpath_set_x2apic_icr_irqoff(vcpu);
 }
 STACK_FRAME_NON_STANDARD(vmx_vcpu_run);
 
@@ -11022,7 +11183,11 @@ static struct kvm *vmx_vm_alloc(void)
 
 static void vmx_vm_free(struct kvm *kvm)
 {
-	vfree(to_kvm_vmx(kvm));
+	struct kvm_vmx *kvm_vmx = to_kvm_vmx(kvm);
+
+	if (kvm_vmx->pid_table)
+		free_pages((unsigned long)kvm_vmx->pid_table, PID_TABLE_ORDER);
+	vfree(kvm_vmx);
 }
 
 static void vmx_switch_vmcs(struct kvm_vcpu *vcpu, struct loaded_vmcs *vmcs)
@@ -11060,6 +11225,8 @@ static void vmx_free_vcpu(struct kvm_vcpu *vcpu)
 
 	if (enable_pml)
 		vmx_destroy_pml_buffer(vmx);
+	if (enable_ipiv)
+		WRITE_ONCE(to_kvm_vmx(vcpu->kvm)->pid_table[vcpu->vcpu_id], 0);
 	free_vpid(vmx->vpid);
 	leave_guest_mode(vcpu);
 	vmx_free_vcpu_nested(vcpu);
@@ -11119,6 +11286,13 @@ static struct kvm_vcpu *vmx_create_vcpu(struct kvm *kvm, unsigned int id)
 	vmx_disable_intercept_for_msr(msr_bitmap, MSR_IA32_SYSENTER_EIP, MSR_TYPE_RW);
 	vmx->msr_bitmap_mode = 0;
 
+	/*
+	 * Enforce invariant: pi_desc.nv is always either POSTED_INTR_VECTOR
+	 * or POSTED_INTR_WAKEUP_VECTOR.  IPI virtualization can post to the
+	 * descriptor as soon as vmx_vcpu_setup() publishes it.
+	 */
+	vmx->pi_desc.nv = POSTED_INTR_VECTOR;
+
 	vmx->loaded_vmcs = &vmx->vmcs01;
 	cpu = get_cpu();
 	vmx_vcpu_load(&vmx->vcpu, cpu);
@@ -11147,16 +11321,13 @@ static struct kvm_vcpu *vmx_create_vcpu(struct kvm *kvm, unsigned int id)
 
 	vmx->msr_ia32_feature_control_valid_bits = FEAT_CTL_LOCKED;
 
-	/*
-	 * Enforce invariant: pi_desc.nv is always either POSTED_INTR_VECTOR
-	 * or POSTED_INTR_WAKEUP_VECTOR.
-	 */
-	vmx->pi_desc.nv = POSTED_INTR_VECTOR;
 	vmx->pi_desc.sn = 1;
 
 	return &vmx->vcpu;
 
 free_vmcs:
+	if (enable_ipiv)
+		WRITE_ONCE(to_kvm_vmx(kvm)->pid_table[id], 0);
 	free_loaded_vmcs(vmx->loaded_vmcs);
 free_msrs:
 	kfree(vmx->guest_msrs);
@@ -11175,7 +11346,18 @@ static struct kvm_vcpu *vmx_create_vcpu(struct kvm *kvm, unsigned int id)
 
 static int vmx_vm_init(struct kvm *kvm)
 {
-	spin_lock_init(&to_kvm_vmx(kvm)->ept_pointer_lock);
+	struct kvm_vmx *kvm_vmx = to_kvm_vmx(kvm);
+
+	spin_lock_init(&kvm_vmx->ept_pointer_lock);
+	spin_lock_init(&kvm_vmx->pid_table_lock);
+
+	if (enable_ipiv) {
+		kvm_vmx->pid_table = (void *)__get_free_pages(GFP_KERNEL_ACCOUNT |
+							      __GFP_ZERO,
+							      PID_TABLE_ORDER);
+		if (!kvm_vmx->pid_table)
+			return -ENOMEM;
+	}
 
 	if (!ple_gap)
 		kvm->arch.pause_in_guest = true;
@@ -13948,9 +14130,15 @@ static int pi_pre_block(struct kvm_vcpu *vcpu)
 	struct pi_desc old, new;
 	struct pi_desc *pi_desc = vcpu_to_pi_desc(vcpu);
 
-	if (!kvm_arch_has_assigned_device(vcpu->kvm) ||
-		!irq_remapping_cap(IRQ_POSTING_CAP)  ||
-		!kvm_vcpu_apicv_active(vcpu))
+	/*
+	 * Interrupts posted by VT-d or by IPI virtualization do not kick
+	 * the vCPU, only the wakeup vector gets it out of kvm_vcpu_block().
+	 */
+	if ((!kvm_arch_has_assigned_device(vcpu->kvm) ||
+	     !irq_remapping_cap(IRQ_POSTING_CAP)) && !vmx_can_use_ipiv(vcpu))
+		return 0;
+
+	if (!kvm_vcpu_apicv_active(vcpu))
 		return 0;
 
 	WARN_ON(irqs_disabled());
@@ -14456,6 +14644,7 @@ static struct kvm_x86_ops vmx_x86_ops __ro_after_init = {
 	.set_apic_access_page_addr = vmx_set_apic_access_page_addr,
 	.get_enable_apicv = vmx_get_enable_apicv,
 	.refresh_apicv_exec_ctrl = vmx_refresh_apicv_exec_ctrl,
+	.apic_id_changed = vmx_apic_id_changed,
 	.load_eoi_exitmap = vmx_load_eoi_exitmap,
 	.apicv_post_state_restore = vmx_apicv_post_state_restore,
 	.hwapic_irr_update = vmx_hwapic_irr_update,
@@ -14504,6 +14693,7 @@ static struct kvm_x86_ops vmx_x86_ops __ro_after_init = {
 	.slot_disable_log_dirty = vmx_slot_disable_log_dirty,
 	.flush_log_dirty = vmx_flush_log_dirty,
 	.enable_log_dirty_pt_masked = vmx_enable_log_dirty_pt_masked,
+	.cpu_dirty_log_size = PML_ENTITY_NUM,
 	.write_log_dirty = vmx_write_pml_buffer,
 
 	.pre_block = vmx_pre_block,
@@ -1334,6 +1334,21 @@ __do_page_fault(struct pt_regs *regs, unsigned long error_code,
 	if (error_code & X86_PF_INSTR)
 		flags |= FAULT_FLAG_INSTRUCTION;
 
+	/*
+	 * Not-present user faults on private anonymous memory can often be
+	 * handled without mmap_sem, see handle_speculative_fault().
+	 */
+	if ((error_code & (X86_PF_USER | X86_PF_PROT | X86_PF_PK |
+			   X86_PF_INSTR)) == X86_PF_USER) {
+		fault = handle_speculative_fault(mm, address, flags);
+		if (!(fault & VM_FAULT_RETRY)) {
+			tsk->min_flt++;
+			perf_sw_event(PERF_COUNT_SW_PAGE_FAULTS_MIN, 1,
+				      regs, address);
+			return;
+		}
+	}
+
 	/*
 	 * When running in the kernel we expect faults to occur only to
 	 * addresses in user space.  All other faults represent errors in
@@ -30,6 +30,7 @@
 #include <linux/cgroup.h>
 #include <linux/blk-cgroup.h>
 #include <linux/highmem.h>
+#include <linux/cpuhotplug.h>
 
 #include <trace/events/block.h>
 #include "blk.h"
@@ -556,19 +557,168 @@ EXPORT_SYMBOL(zero_fill_bio_iter);
  *   Put a reference to a &struct bio, either one you have gotten with
  *   bio_alloc, bio_get or bio_clone_*. The last put of a bio will free it.
  **/
+#define ALLOC_CACHE_MAX		512
+#define ALLOC_CACHE_SLACK	 64
+
+struct bio_alloc_cache {
+	struct bio		*free_list;
+	unsigned int		nr;
+};
+
+/* Cached bios only ever have inline vecs, so no bvec to free */
+static void bio_alloc_cache_free(struct bio *bio)
+{
+	void *p = bio;
+
+	p -= bio->bi_pool->front_pad;
+	mempool_free(p, &bio->bi_pool->bio_pool);
+}
+
+/* Unlink up to @nr bios from @cache, with interrupts off */
+static struct bio *bio_alloc_cache_take(struct bio_alloc_cache *cache,
+					unsigned int nr)
+{
+	struct bio *bio, *free_list = NULL;
+
+	while (nr-- && (bio = cache->free_list)) {
+		cache->free_list = bio->bi_next;
+		cache->nr--;
+		bio->bi_next = free_list;
+		free_list = bio;
+	}
+	return free_list;
+}
+
+static void bio_alloc_cache_free_list(struct bio *free_list)
+{
+	struct bio *bio;
+
+	while ((bio = free_list)) {
+		free_list = bio->bi_next;
+		bio_alloc_cache_free(bio);
+	}
+}
+
+static void bio_alloc_cache_prune(struct bio_alloc_cache *cache)
+{
+	unsigned long flags;
+	struct bio *free_list;
+
+	local_irq_save(flags);
+	free_list = bio_alloc_cache_take(cache, -1U);
+	local_irq_restore(flags);
+
+	bio_alloc_cache_free_list(free_list);
+}
+
+static int bio_cpu_dead(unsigned int cpu, struct hlist_node *node)
+{
+	struct bio_set *bs;
+
+	bs = hlist_entry_safe(node, struct bio_set, cpuhp_dead);
+	if (bs->cache)
+		bio_alloc_cache_prune(per_cpu_ptr(bs->cache, cpu));
+	return 0;
+}
+
+static void bio_alloc_cache_destroy(struct bio_set *bs)
+{
+	int cpu;
+
+	if (!bs->cache)
+		return;
+
+	cpuhp_state_remove_instance_nocalls(CPUHP_BIO_DEAD, &bs->cpuhp_dead);
+	for_each_possible_cpu(cpu)
+		bio_alloc_cache_prune(per_cpu_ptr(bs->cache, cpu));
+	free_percpu(bs->cache);
+	bs->cache = NULL;
+}
+
+/*
+ * The cache is only touched with interrupts off, a cached bio may be
+ * freed from the completion interrupt of its I/O.
+ */
+static void bio_put_percpu_cache(struct bio *bio)
+{
+	struct bio_alloc_cache *cache;
+	struct bio *free_list = NULL;
+	unsigned long flags;
+
+	bio_uninit(bio);
+
+	local_irq_save(flags);
+	cache = this_cpu_ptr(bio->bi_pool->cache);
+	bio->bi_next = cache->free_list;
+	cache->free_list = bio;
+	if (++cache->nr > ALLOC_CACHE_MAX + ALLOC_CACHE_SLACK)
+		free_list = bio_alloc_cache_take(cache, ALLOC_CACHE_SLACK);
+	local_irq_restore(flags);
+
+	bio_alloc_cache_free_list(free_list);
+}
+
+/**
+ * bio_alloc_kiocb - Allocate a bio from bio_set based on kiocb
+ * @kiocb:	kiocb describing the IO
+ * @nr_vecs:	number of iovecs to pre-allocate
+ * @bs:		bio_set to allocate from
+ *
+ * Description:
+ *    Like @bio_alloc_bioset with GFP_KERNEL, but for a kiocb marked
+ *    IOCB_ALLOC_CACHE a bio with inline vecs is taken from the per-cpu
+ *    cache of a %BIOSET_PERCPU_CACHE bio_set, and goes back there on its
+ *    final bio_put().
+ */
+struct bio *bio_alloc_kiocb(struct kiocb *kiocb, unsigned short nr_vecs,
+			    struct bio_set *bs)
+{
+	struct bio_alloc_cache *cache;
+	unsigned long flags;
+	struct bio *bio;
+
+	if (!(kiocb->ki_flags & IOCB_ALLOC_CACHE) || !bs->cache ||
+	    nr_vecs > BIO_INLINE_VECS)
+		return bio_alloc_bioset(GFP_KERNEL, nr_vecs, bs);
+
+	local_irq_save(flags);
+	cache = this_cpu_ptr(bs->cache);
+	bio = cache->free_list;
+	if (bio) {
+		cache->free_list = bio->bi_next;
+		cache->nr--;
+	}
+	local_irq_restore(flags);
+
+	if (bio) {
+		bio_init(bio, nr_vecs ? bio->bi_inline_vecs : NULL, nr_vecs);
+		bio->bi_pool = bs;
+	} else {
+		bio = bio_alloc_bioset(GFP_KERNEL, nr_vecs, bs);
+		if (unlikely(!bio))
+			return NULL;
+	}
+	bio_set_ext_flag(bio, BIO_PERCPU_CACHE);
+	return bio;
+}
+EXPORT_SYMBOL_GPL(bio_alloc_kiocb);
+
 void bio_put(struct bio *bio)
 {
-	if (!bio_flagged(bio, BIO_REFFED))
-		bio_free(bio);
-	else {
+	if (bio_flagged(bio, BIO_REFFED)) {
 		BIO_BUG_ON(!atomic_read(&bio->__bi_cnt));
 
 		/*
 		 * last put frees it
 		 */
-		if (atomic_dec_and_test(&bio->__bi_cnt))
-			bio_free(bio);
+		if (!atomic_dec_and_test(&bio->__bi_cnt))
+			return;
 	}
+
+	if (bio_ext_flagged(bio, BIO_PERCPU_CACHE))
+		bio_put_percpu_cache(bio);
+	else
+		bio_free(bio);
 }
 EXPORT_SYMBOL(bio_put);
 
@@ -1956,6 +2106,7 @@ int biovec_init_pool(mempool_t *pool, int pool_entries)
  */
 void bioset_exit(struct bio_set *bs)
 {
+	bio_alloc_cache_destroy(bs);
 	if (bs->rescue_workqueue)
 		destroy_workqueue(bs->rescue_workqueue);
 	bs->rescue_workqueue = NULL;
@@ -1975,8 +2126,8 @@ EXPORT_SYMBOL(bioset_exit);
  * @bs:		pool to initialize
  * @pool_size:	Number of bio and bio_vecs to cache in the mempool
  * @front_pad:	Number of bytes to allocate in front of the returned bio
- * @flags:	Flags to modify behavior, currently %BIOSET_NEED_BVECS
- *              and %BIOSET_NEED_RESCUER
+ * @flags:	Flags to modify behavior, currently %BIOSET_NEED_BVECS,
+ *              %BIOSET_NEED_RESCUER and %BIOSET_PERCPU_CACHE
  *
  * Description:
  *    Set up a bio_set to be used with @bio_alloc_bioset. Allows the caller
@@ -1999,6 +2150,7 @@ int bioset_init(struct bio_set *bs,
 	unsigned int back_pad = BIO_INLINE_VECS * sizeof(struct bio_vec);
 
 	bs->front_pad = front_pad;
+	bs->cache = NULL;
 
 	spin_lock_init(&bs->rescue_lock);
 	bio_list_init(&bs->rescue_list);
@@ -2015,12 +2167,20 @@ int bioset_init(struct bio_set *bs,
 	    biovec_init_pool(&bs->bvec_pool, pool_size))
 		goto bad;
 
-	if (!(flags & BIOSET_NEED_RESCUER))
-		return 0;
+	if (flags & BIOSET_NEED_RESCUER) {
+		bs->rescue_workqueue = alloc_workqueue("bioset",
+						       WQ_MEM_RECLAIM, 0);
+		if (!bs->rescue_workqueue)
+			goto bad;
+	}
 
-	bs->rescue_workqueue = alloc_workqueue("bioset", WQ_MEM_RECLAIM, 0);
-	if (!bs->rescue_workqueue)
-		goto bad;
+	if (flags & BIOSET_PERCPU_CACHE) {
+		bs->cache = alloc_percpu(struct bio_alloc_cache);
+		if (!bs->cache)
+			goto bad;
+		cpuhp_state_add_instance_nocalls(CPUHP_BIO_DEAD,
+						 &bs->cpuhp_dead);
+	}
 
 	return 0;
 bad:
@@ -2178,7 +2338,11 @@ static int __init init_bio(void)
 	bio_integrity_init();
 	biovec_init_slabs();
 
-	if (bioset_init(&fs_bio_set, BIO_POOL_SIZE, 0, BIOSET_NEED_BVECS))
+	cpuhp_setup_state_multi(CPUHP_BIO_DEAD, "block/bio:dead", NULL,
+				bio_cpu_dead);
+
+	if (bioset_init(&fs_bio_set, BIO_POOL_SIZE, 0,
+			BIOSET_NEED_BVECS | BIOSET_PERCPU_CACHE))
 		panic("bio: can't allocate bios\n");
 
 	if (bioset_integrity_create(&fs_bio_set, BIO_POOL_SIZE))
@@ -29,6 +29,7 @@
 #include <linux/blk-cgroup.h>
 #include <linux/tracehook.h>
 #include <linux/psi.h>
+#include <trace/events/cgroup.h>
 #include "blk.h"
 
 #define MAX_KEY_LEN 100
@@ -54,6 +55,8 @@ static LIST_HEAD(all_blkcgs);		/* protected by blkcg_pol_mutex */
 
 static bool blkcg_debug_stats = false;
 
+bool blkcg_latency_hist __read_mostly;
+
 static bool blkcg_policy_enabled(struct request_queue *q,
 				 const struct blkcg_policy *pol)
 {
@@ -82,6 +85,11 @@ static void blkg_free(struct blkcg_gq *blkg)
 
 	blkg_rwstat_exit(&blkg->stat_ios);
 	blkg_rwstat_exit(&blkg->stat_bytes);
+	if (blkg->poll_stats) {
+		free_percpu(blkg->poll_stats->cpu_stat);
+		kfree(blkg->poll_stats);
+	}
+	free_percpu(blkg->lat_hist);
 	kfree(blkg);
 }
 
@@ -444,7 +452,7 @@ static int blkcg_reset_stats(struct cgroup_subsys_state *css,
 {
 	struct blkcg *blkcg = css_to_blkcg(css);
 	struct blkcg_gq *blkg;
-	int i;
+	int i, cpu;
 
 	mutex_lock(&blkcg_pol_mutex);
 	spin_lock_irq(&blkcg->lock);
@@ -457,6 +465,10 @@ static int blkcg_reset_stats(struct cgroup_subsys_state *css,
 	hlist_for_each_entry(blkg, &blkcg->blkg_list, blkcg_node) {
 		blkg_rwstat_reset(&blkg->stat_bytes);
 		blkg_rwstat_reset(&blkg->stat_ios);
+		if (blkg->lat_hist)
+			for_each_possible_cpu(cpu)
+				memset(per_cpu_ptr(blkg->lat_hist, cpu), 0,
+				       sizeof(struct blkg_lat_hist));
 
 		for (i = 0; i < BLKCG_MAX_POLS; i++) {
 			struct blkcg_policy *pol = blkcg_policy[i];
@@ -1058,12 +1070,155 @@ static int blkcg_print_stat(struct seq_file *sf, void *v)
 	return 0;
 }
 
+static int blkg_lat_hist_bkt(u64 value)
+{
+	u64 usecs = div_u64(value, NSEC_PER_USEC);
+
+	if (!usecs)
+		return 0;
+	return min_t(int, ilog2(usecs) + 1, BLKG_LAT_HIST_BKTS - 1);
+}
+
+/*
+ * Called on completion, possibly from hard irq context, so the histogram
+ * is allocated without sleeping and the counters bumped irq safely.
+ */
+void __blkcg_rq_lat_done(struct request *rq, u64 now)
+{
+	struct request_list *rl = blk_rq_rl(rq);
+	struct blkg_lat_hist __percpu *lh, *old;
+	int sgrp = op_stat_group(req_op(rq));
+
+	/* dispatched before blkcg_latency_hist was set, or a flush step */
+	if (!rl || !rl->blkg || !rq->io_start_time_ns ||
+	    (rq->rq_flags & RQF_FLUSH_SEQ))
+		return;
+
+	lh = READ_ONCE(rl->blkg->lat_hist);
+	if (unlikely(!lh)) {
+		lh = alloc_percpu_gfp(struct blkg_lat_hist,
+				      GFP_NOWAIT | __GFP_NOWARN);
+		if (!lh)
+			return;
+		old = cmpxchg(&rl->blkg->lat_hist, NULL, lh);
+		if (old) {
+			free_percpu(lh);
+			lh = old;
+		}
+	}
+
+	this_cpu_inc(lh->hist[sgrp][BLKG_LAT_QUEUE]
+		     [blkg_lat_hist_bkt(rq->io_start_time_ns - rq->start_time_ns)]);
+	this_cpu_inc(lh->hist[sgrp][BLKG_LAT_DEVICE]
+		     [blkg_lat_hist_bkt(now - rq->io_start_time_ns)]);
+
+	if (trace_cgroup_sli_event_enabled()) {
+		struct cgroup *cgrp = rl->blkg->blkcg->css.cgroup;
+		u64 data = sgrp;
+
+		if (rq->rq_disk)
+			data |= (u64)new_encode_dev(disk_devt(rq->rq_disk)) << 32;
+		trace_cgroup_sli_event(cgrp, 0, SLI_EVENT_IO, SLI_IO_QUEUE,
+				rq->io_start_time_ns - rq->start_time_ns, data);
+		trace_cgroup_sli_event(cgrp, 0, SLI_EVENT_IO, SLI_IO_DEVICE,
+				now - rq->io_start_time_ns, data);
+	}
+}
+
+/*
+ * One line per device, op and stage with the bucket counts of the cgroup
+ * and its online descendants, like io.stat:
+ *
+ *   8:16 read queue 0 10 52 ...
+ *   8:16 read device 0 0 0 ...
+ */
+static int blkcg_print_lat_hist(struct seq_file *sf, void *v)
+{
+	static const char * const op_names[NR_STAT_GROUPS] = {
+		[STAT_READ]	= "read",
+		[STAT_WRITE]	= "write",
+		[STAT_DISCARD]	= "discard",
+	};
+	static const char * const stage_names[BLKG_LAT_NR_STAGES] = {
+		[BLKG_LAT_QUEUE]	= "queue",
+		[BLKG_LAT_DEVICE]	= "device",
+	};
+	struct blkcg *blkcg = css_to_blkcg(seq_css(sf));
+	struct blkg_lat_hist *sum;
+	struct blkcg_gq *blkg;
+
+	sum = kmalloc(sizeof(*sum), GFP_KERNEL);
+	if (!sum)
+		return -ENOMEM;
+
+	rcu_read_lock();
+
+	hlist_for_each_entry_rcu(blkg, &blkcg->blkg_list, blkcg_node) {
+		struct cgroup_subsys_state *pos_css;
+		struct blkcg_gq *pos_blkg;
+		bool has_stats = false;
+		const char *dname;
+		int cpu, op, stage, i;
+
+		spin_lock_irq(blkg->q->queue_lock);
+
+		if (!blkg->online)
+			goto skip;
+
+		dname = blkg_dev_name(blkg);
+		if (!dname)
+			goto skip;
+
+		memset(sum, 0, sizeof(*sum));
+		blkg_for_each_descendant_pre(pos_blkg, pos_css, blkg) {
+			struct blkg_lat_hist __percpu *lh;
+
+			lh = READ_ONCE(pos_blkg->lat_hist);
+			if (!pos_blkg->online || !lh)
+				continue;
+			has_stats = true;
+
+			for_each_possible_cpu(cpu) {
+				u64 *src = &per_cpu_ptr(lh, cpu)->hist[0][0][0];
+				u64 *dst = &sum->hist[0][0][0];
+
+				for (i = 0; i < sizeof(*sum) / sizeof(u64); i++)
+					dst[i] += src[i];
+			}
+		}
+		if (!has_stats)
+			goto skip;
+
+		for (op = 0; op < NR_STAT_GROUPS; op++) {
+			for (stage = 0; stage < BLKG_LAT_NR_STAGES; stage++) {
+				seq_printf(sf, "%s %s %s", dname, op_names[op],
+					   stage_names[stage]);
+				for (i = 0; i < BLKG_LAT_HIST_BKTS; i++)
+					seq_printf(sf, " %llu",
+						   sum->hist[op][stage][i]);
+				seq_putc(sf, '\n');
+			}
+		}
+	skip:
+		spin_unlock_irq(blkg->q->queue_lock);
+	}
+
+	rcu_read_unlock();
+	kfree(sum);
+	return 0;
+}
+
 static struct cftype blkcg_files[] = {
 	{
 		.name = "stat",
 		.flags = CFTYPE_NOT_ON_ROOT,
 		.seq_show = blkcg_print_stat,
 	},
+	{
+		.name = "latency_hist",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = blkcg_print_lat_hist,
+	},
 	{ }	/* terminate */
 };
 
@@ -1072,6 +1227,10 @@ static struct cftype blkcg_legacy_files[] = {
 		.name = "reset_stats",
 		.write_u64 = blkcg_reset_stats,
 	},
+	{
+		.name = "latency_hist",
+		.seq_show = blkcg_print_lat_hist,
+	},
 	{ }	/* terminate */
 };
 
@@ -1914,3 +2073,5 @@ EXPORT_SYMBOL_GPL(blkcg_add_delay);
 
 module_param(blkcg_debug_stats, bool, 0644);
 MODULE_PARM_DESC(blkcg_debug_stats, "True if you want debug stats, false if not");
+module_param(blkcg_latency_hist, bool, 0644);
+MODULE_PARM_DESC(blkcg_latency_hist, "True to collect the latency histograms of io.latency_hist");
@@ -3038,6 +3038,8 @@ void blk_start_request(struct request *req)
 		req->stats_sectors = blk_rq_sectors(req);
 		req->rq_flags |= RQF_STATS;
 		rq_qos_issue(req->q, req);
+	} else if (blkcg_latency_hist_enabled()) {
+		req->io_start_time_ns = ktime_get_ns();
 	}
 
 	BUG_ON(blk_rq_is_complete(req));
@@ -3244,6 +3246,7 @@ void blk_finish_request(struct request *req, blk_status_t error)
 
 	if (req->rq_flags & RQF_STATS)
 		blk_stat_add(req, now);
+	blkcg_rq_lat_done(req, now);
 
 	if (req->rq_flags & RQF_QUEUED)
 		blk_queue_end_tag(q, req);
@@ -44,7 +44,12 @@
  * /sys/fs/cgroup/io.cost.model.
  *
  * If needed, tools/cgroup/iocost_coef_gen.py can be used to generate
- * device-specific coefficients.
+ * device-specific coefficients.  Alternatively, "ctrl=calib" makes the
+ * controller learn them passively.  Whenever the device is saturated for
+ * a period and the completed IOs are dominated by one kind - random 4k,
+ * sequential 4k or large sequential, of either direction - the achieved
+ * rate is taken as a sample of the matching coefficient.  See
+ * ioc_calib_period().
  *
  * 2. Control Strategy
  *
@@ -289,6 +294,15 @@ enum {
 	/* switch iff the conditions are met for longer than this */
 	AUTOP_CYCLE_NSEC	= 10LLU * NSEC_PER_SEC,
 
+	/*
+	 * Cost model calibration only samples periods in which one kind of
+	 * IO makes up at least 90% of the completions.  IOs up to 8k count
+	 * as small, from 256k on as large.
+	 */
+	CALIB_DOMINANT_PCT	= 90,
+	CALIB_SMALL_PAGES	= 2,
+	CALIB_LARGE_PAGES	= 64,
+
 	/*
 	 * Count IO size in 4k pages.  The 12bit shift helps keeping
 	 * size-proportional components of cost calculation in closer
@@ -379,11 +393,20 @@ struct ioc_missed {
 	u32				last_missed;
 };
 
+struct ioc_calib_stat {
+	u64				nr_seqio;
+	u64				nr_randio;
+	u64				nr_pages;
+};
+
 struct ioc_pcpu_stat {
 	struct ioc_missed		missed[2];
 
 	u64				rq_wait_ns;
 	u64				last_rq_wait_ns;
+
+	struct ioc_calib_stat		calib[2];
+	struct ioc_calib_stat		last_calib[2];
 };
 
 /* per device */
@@ -422,6 +445,11 @@ struct ioc {
 	int				autop_idx;
 	bool				user_qos_params:1;
 	bool				user_cost_model:1;
+
+	/* cost model calibration, tested locklessly on completion */
+	bool				calib_cost_model;
+	sector_t			calib_cursor[2];
+	u64				calib_i_lcoefs[NR_I_LCOEFS];
 };
 
 /* per device-cgroup pair */
@@ -734,7 +762,8 @@ static int ioc_autop_idx(struct ioc *ioc)
 		return AUTOP_SSD_DFL;
 
 	/* if user is overriding anything, maintain what was there */
-	if (ioc->user_qos_params || ioc->user_cost_model)
+	if (ioc->user_qos_params || ioc->user_cost_model ||
+	    ioc->calib_cost_model)
 		return idx;
 
 	/* step up/down based on the vrate */
@@ -811,6 +840,16 @@ static void ioc_refresh_lcoefs(struct ioc *ioc)
 		    &c[LCOEF_WPAGE], &c[LCOEF_WSEQIO], &c[LCOEF_WRANDIO]);
 }
 
+/* override the builtin coefficients with the ones calibrated so far */
+static void ioc_calib_apply(struct ioc *ioc)
+{
+	int i;
+
+	for (i = 0; i < NR_I_LCOEFS; i++)
+		if (ioc->calib_i_lcoefs[i])
+			ioc->params.i_lcoefs[i] = ioc->calib_i_lcoefs[i];
+}
+
 static bool ioc_refresh_params(struct ioc *ioc, bool force)
 {
 	const struct ioc_params *p;
@@ -835,6 +874,8 @@ static bool ioc_refresh_params(struct ioc *ioc, bool force)
 		memcpy(ioc->params.qos, p->qos, sizeof(p->qos));
 	if (!ioc->user_cost_model)
 		memcpy(ioc->params.i_lcoefs, p->i_lcoefs, sizeof(p->i_lcoefs));
+	if (ioc->calib_cost_model)
+		ioc_calib_apply(ioc);
 
 	ioc_refresh_period_us(ioc);
 	ioc_refresh_lcoefs(ioc);
@@ -1307,6 +1348,100 @@ static void ioc_lat_stat(struct ioc *ioc, u32 *missed_ppm_ar, u32 *rq_wait_pct_p
 				   ioc->period_us * NSEC_PER_USEC);
 }
 
+static void ioc_calib_stat(struct ioc *ioc, struct ioc_calib_stat *calib)
+{
+	int cpu, rw;
+
+	memset(calib, 0, 2 * sizeof(*calib));
+
+	for_each_online_cpu(cpu) {
+		struct ioc_pcpu_stat *stat = per_cpu_ptr(ioc->pcpu_stat, cpu);
+
+		for (rw = READ; rw <= WRITE; rw++) {
+			struct ioc_calib_stat *cs = &stat->calib[rw];
+			struct ioc_calib_stat *last = &stat->last_calib[rw];
+			u64 this_seqio = READ_ONCE(cs->nr_seqio);
+			u64 this_randio = READ_ONCE(cs->nr_randio);
+			u64 this_pages = READ_ONCE(cs->nr_pages);
+
+			calib[rw].nr_seqio += this_seqio - last->nr_seqio;
+			calib[rw].nr_randio += this_randio - last->nr_randio;
+			calib[rw].nr_pages += this_pages - last->nr_pages;
+			last->nr_seqio = this_seqio;
+			last->nr_randio = this_randio;
+			last->nr_pages = this_pages;
+		}
+	}
+}
+
+static void ioc_calib_sample(struct ioc *ioc, int idx, u64 v)
+{
+	u64 *c = &ioc->calib_i_lcoefs[idx];
+
+	if (!v)
+		return;
+	/* the first sample is taken as is, then a 1/4 weighted average */
+	if (*c)
+		*c = div64_u64(*c * 3 + v, 4);
+	else
+		*c = v;
+}
+
+/*
+ * The device was saturated during the last @period_us and completed the
+ * IOs in @calib.  If one kind of IO dominates, its rate approximates what
+ * the device can do for that kind and is fed into the matching
+ * coefficient.  Returns whether any coefficient was updated.
+ */
+static bool ioc_calib_period(struct ioc *ioc, struct ioc_calib_stat *calib,
+			     u32 period_us)
+{
+	static const int lcoef_base[2] = { I_LCOEF_RBPS, I_LCOEF_WBPS };
+	u64 total = 0, ios, pages_per_io;
+	bool updated = false;
+	int rw, base;
+
+	if (!period_us)
+		return false;
+
+	for (rw = READ; rw <= WRITE; rw++)
+		total += calib[rw].nr_seqio + calib[rw].nr_randio;
+
+	for (rw = READ; rw <= WRITE; rw++) {
+		struct ioc_calib_stat *cs = &calib[rw];
+
+		ios = cs->nr_seqio + cs->nr_randio;
+		if (!ios || ios * 100 < total * CALIB_DOMINANT_PCT)
+			continue;
+
+		base = lcoef_base[rw];
+		pages_per_io = div64_u64(cs->nr_pages, ios);
+
+		if (cs->nr_randio * 100 >= ios * CALIB_DOMINANT_PCT) {
+			if (pages_per_io > CALIB_SMALL_PAGES)
+				continue;
+			ioc_calib_sample(ioc, base + I_LCOEF_RRANDIOPS,
+					 div64_u64(cs->nr_randio * USEC_PER_SEC,
+						   period_us));
+			updated = true;
+		} else if (cs->nr_seqio * 100 >= ios * CALIB_DOMINANT_PCT) {
+			if (pages_per_io <= CALIB_SMALL_PAGES) {
+				ioc_calib_sample(ioc, base + I_LCOEF_RSEQIOPS,
+					div64_u64(cs->nr_seqio * USEC_PER_SEC,
+						  period_us));
+				updated = true;
+			} else if (pages_per_io >= CALIB_LARGE_PAGES) {
+				ioc_calib_sample(ioc, base + I_LCOEF_RBPS,
+					div64_u64(cs->nr_pages * IOC_PAGE_SIZE *
+						  USEC_PER_SEC, period_us));
+				updated = true;
+			}
+		}
+	}
+
+	return updated;
+}
+
 /* was iocg idle this period? */
 static bool iocg_is_idle(struct ioc_gq *iocg)
 {
@@ -1347,11 +1482,13 @@ static void ioc_timer_fn(struct timer_list *timer)
 	u32 ppm_rthr = MILLION - ioc->params.qos[QOS_RPPM];
 	u32 ppm_wthr = MILLION - ioc->params.qos[QOS_WPPM];
 	u32 missed_ppm[2], rq_wait_pct;
+	struct ioc_calib_stat calib[2];
 	u64 period_vtime;
 	int prev_busy_level, i;
 
 	/* how were the latencies during the period? */
 	ioc_lat_stat(ioc, missed_ppm, &rq_wait_pct);
+	ioc_calib_stat(ioc, calib);
 
 	/* take care of active iocgs */
 	spin_lock_irq(&ioc->lock);
@@ -1536,6 +1673,16 @@ static void ioc_timer_fn(struct timer_list *timer)
 	 * and experiencing shortages but not surpluses, we're too stingy
 	 * and should increase vtime rate.
 	 */
+	/*
+	 * IOs waiting for requests means the device queue was full for
+	 * the period, whatever the current model thinks of it.
+	 */
+	if (ioc->calib_cost_model && rq_wait_pct > RQ_WAIT_BUSY_PCT &&
+	    ioc_calib_period(ioc, calib, now.now - ioc->period_at)) {
+		ioc_calib_apply(ioc);
+		ioc_refresh_lcoefs(ioc);
+	}
+
 	prev_busy_level = ioc->busy_level;
 	if (rq_wait_pct > RQ_WAIT_BUSY_PCT ||
 	    missed_ppm[READ] > ppm_rthr ||
@@ -1964,6 +2111,29 @@ static void ioc_rqos_done_bio(struct rq_qos *rqos, struct bio *bio)
 		atomic64_add(bio->bi_iocost_cost, &iocg->done_vtime);
 }
 
+/*
+ * Count a completed IO for cost model calibration.  The cursor is shared
+ * and updated racily, which is good enough to tell seq from random.
+ */
+static void ioc_calib_account(struct ioc *ioc, struct request *rq, int rw)
+{
+	sector_t pos = blk_rq_pos(rq);
+	sector_t cursor = READ_ONCE(ioc->calib_cursor[rw]);
+	u64 sectors = blk_rq_stats_sectors(rq);
+	u64 seek_pages;
+
+	seek_pages = (pos > cursor ? pos - cursor : cursor - pos) >>
+		IOC_SECT_TO_PAGE_SHIFT;
+	if (seek_pages > LCOEF_RANDIO_PAGES)
+		this_cpu_inc(ioc->pcpu_stat->calib[rw].nr_randio);
+	else
+		this_cpu_inc(ioc->pcpu_stat->calib[rw].nr_seqio);
+	this_cpu_add(ioc->pcpu_stat->calib[rw].nr_pages,
+		     max_t(u64, sectors >> IOC_SECT_TO_PAGE_SHIFT, 1));
+
+	WRITE_ONCE(ioc->calib_cursor[rw], pos + sectors);
+}
+
 static void ioc_rqos_done(struct rq_qos *rqos, struct request *rq)
 {
 	struct ioc *ioc = rqos_to_ioc(rqos);
@@ -1997,6 +2167,9 @@ static void ioc_rqos_done(struct rq_qos *rqos, struct request *rq)
 		this_cpu_inc(ioc->pcpu_stat->missed[rw].nr_missed);
 
 	this_cpu_add(ioc->pcpu_stat->rq_wait_ns, rq_wait_ns);
+
+	if (READ_ONCE(ioc->calib_cost_model))
+		ioc_calib_account(ioc, rq, rw);
 }
 
 static void ioc_rqos_queue_depth_changed(struct rq_qos *rqos)
@@ -2439,7 +2612,8 @@ static u64 ioc_cost_model_prfill(struct seq_file *sf,
 	seq_printf(sf, "%s ctrl=%s model=linear "
 		   "rbps=%llu rseqiops=%llu rrandiops=%llu "
 		   "wbps=%llu wseqiops=%llu wrandiops=%llu\n",
-		   dname, ioc->user_cost_model ? "user" : "auto",
+		   dname, ioc->calib_cost_model ? "calib" :
+		   (ioc->user_cost_model ? "user" : "auto"),
 		   u[I_LCOEF_RBPS], u[I_LCOEF_RSEQIOPS], u[I_LCOEF_RRANDIOPS],
 		   u[I_LCOEF_WBPS], u[I_LCOEF_WSEQIOPS], u[I_LCOEF_WRANDIOPS]);
 	return 0;
@@ -2476,7 +2650,7 @@ static ssize_t ioc_cost_model_write(struct kernfs_open_file *of, char *input,
 	struct gendisk *disk;
 	struct ioc *ioc;
 	u64 u[NR_I_LCOEFS];
-	bool user;
+	bool user, calib;
 	char *p;
 	int ret;
 
@@ -2495,6 +2669,7 @@ static ssize_t ioc_cost_model_write(struct kernfs_open_file *of, char *input,
 	spin_lock_irq(&ioc->lock);
 	memcpy(u, ioc->params.i_lcoefs, sizeof(u));
 	user = ioc->user_cost_model;
+	calib = ioc->calib_cost_model;
 	spin_unlock_irq(&ioc->lock);
 
 	while ((p = strsep(&input, " \t\n"))) {
@@ -2509,12 +2684,18 @@ static ssize_t ioc_cost_model_write(struct kernfs_open_file *of, char *input,
 		switch (match_token(p, cost_ctrl_tokens, args)) {
 		case COST_CTRL:
 			match_strlcpy(buf, &args[0], sizeof(buf));
-			if (!strcmp(buf, "auto"))
+			if (!strcmp(buf, "auto")) {
 				user = false;
-			else if (!strcmp(buf, "user"))
+				calib = false;
+			} else if (!strcmp(buf, "user")) {
 				user = true;
-			else
+				calib = false;
+			} else if (!strcmp(buf, "calib")) {
+				user = false;
+				calib = true;
+			} else {
 				goto einval;
+			}
 			continue;
 		case COST_MODEL:
 			match_strlcpy(buf, &args[0], sizeof(buf));
@@ -2530,6 +2711,7 @@ static ssize_t ioc_cost_model_write(struct kernfs_open_file *of, char *input,
 			goto einval;
 		u[tok] = v;
 		user = true;
+		calib = false;
 	}
 
 	spin_lock_irq(&ioc->lock);
@@ -2539,6 +2721,7 @@ static ssize_t ioc_cost_model_write(struct kernfs_open_file *of, char *input,
 	} else {
 		ioc->user_cost_model = false;
 	}
+	WRITE_ONCE(ioc->calib_cost_model, calib);
 	ioc_refresh_params(ioc, true);
 	spin_unlock_irq(&ioc->lock);
 
@@ -19,6 +19,7 @@
 #include <linux/debugfs.h>
 
 #include <linux/blk-mq.h>
+#include <linux/blk-cgroup.h>
 #include "blk.h"
 #include "blk-mq.h"
 #include "blk-mq-debugfs.h"
@@ -51,6 +52,48 @@ static int queue_poll_stat_show(void *data, struct seq_file *m)
 	return 0;
 }
 
+#ifdef CONFIG_BLK_CGROUP
+static int queue_poll_stat_blkcg_show(void *data, struct seq_file *m)
+{
+	struct request_queue *q = data;
+	struct blkg_poll_stats *ps;
+	struct blkcg_gq *blkg;
+	int bucket, i;
+	char *path;
+
+	path = kmalloc(PATH_MAX, GFP_KERNEL);
+	if (!path)
+		return -ENOMEM;
+
+	spin_lock_irq(q->queue_lock);
+	list_for_each_entry(blkg, &q->blkg_list, q_node) {
+		ps = blkg->poll_stats;
+		if (!ps)
+			continue;
+
+		blkg_path(blkg, path, PATH_MAX);
+		seq_printf(m, "%s\n", path);
+		for (bucket = 0; bucket < BLK_MQ_POLL_STATS_BKTS; bucket++) {
+			if (!ps->cur.stat[bucket].nr_samples)
+				continue;
+			seq_printf(m, "  %s (%d Bytes): ",
+				   bucket & 1 ? "write" : "read ",
+				   1 << (9 + bucket / 2));
+			print_stat(m, &ps->cur.stat[bucket]);
+			seq_puts(m, "\n");
+		}
+		seq_puts(m, "  hist (usecs):");
+		for (i = 0; i < BLKG_POLL_HIST_BKTS - 1; i++)
+			seq_printf(m, " <%d=%llu", 1 << i, ps->cur.hist[i]);
+		seq_printf(m, " >=%d=%llu\n", 1 << (i - 1), ps->cur.hist[i]);
+	}
+	spin_unlock_irq(q->queue_lock);
+
+	kfree(path);
+	return 0;
+}
+#endif
+
 static void *queue_requeue_list_start(struct seq_file *m, loff_t *pos)
 	__acquires(&q->requeue_lock)
 {
@@ -250,6 +293,9 @@ static int queue_rq_hang_show(void *data, struct seq_file *m)
 
 static const struct blk_mq_debugfs_attr blk_mq_debugfs_queue_attrs[] = {
 	{ "poll_stat", 0400, queue_poll_stat_show },
+#ifdef CONFIG_BLK_CGROUP
+	{ "poll_stat_blkcg", 0400, queue_poll_stat_blkcg_show },
+#endif
 	{ "requeue_list", 0400, .seq_ops = &queue_requeue_list_seq_ops },
 	{ "pm_only", 0600, queue_pm_only_show, NULL },
 	{ "state", 0600, queue_state_show, queue_state_write },
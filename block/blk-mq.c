@@ -573,6 +573,7 @@ inline void __blk_mq_end_request(struct request *rq, blk_status_t error)
 		blk_stat_add(rq, now);
 	}
 
+	blkcg_rq_lat_done(rq, now);
 	blk_account_io_done(rq, now);
 
 	if (rq->end_io) {
@@ -687,6 +688,8 @@ void blk_mq_start_request(struct request *rq)
 		rq->stats_sectors = blk_rq_sectors(rq);
 		rq->rq_flags |= RQF_STATS;
 		rq_qos_issue(q, rq);
+	} else if (blkcg_latency_hist_enabled()) {
+		rq->io_start_time_ns = ktime_get_ns();
 	}
 
 	WARN_ON_ONCE(blk_mq_rq_state(rq) != MQ_RQ_IDLE);
@@ -3323,12 +3326,36 @@ static void blk_mq_poll_stats_fn(struct blk_stat_callback *cb)
 		if (cb->stat[bucket].nr_samples)
 			q->poll_stat[bucket] = cb->stat[bucket];
 	}
+
+	blkg_poll_stats_fold(q);
+}
+
+/*
+ * Prefer the stats of the cgroup @rq was issued from, so that the large
+ * requests of a batch job don't stretch the sleep of a latency sensitive
+ * neighbour. Fall back to the queue wide stats until the cgroup has some.
+ */
+static struct blk_rq_stat *blk_mq_poll_rq_stat(struct request_queue *q,
+					       struct request *rq, int bucket)
+{
+#ifdef CONFIG_BLK_CGROUP
+	struct request_list *rl = blk_rq_rl(rq);
+	struct blkg_poll_stats *ps;
+
+	if (rl && rl->blkg) {
+		ps = blkg_poll_stats(rl->blkg);
+		if (ps && ps->cur.stat[bucket].nr_samples)
+			return &ps->cur.stat[bucket];
+	}
+#endif
+	return &q->poll_stat[bucket];
 }
 
 static unsigned long blk_mq_poll_nsecs(struct request_queue *q,
 				       struct blk_mq_hw_ctx *hctx,
 				       struct request *rq)
 {
+	struct blk_rq_stat *stat;
 	unsigned long ret = 0;
 	int bucket;
 
@@ -3341,19 +3368,22 @@ static unsigned long blk_mq_poll_nsecs(struct request_queue *q,
 
 	/*
 	 * As an optimistic guess, use half of the mean service time
-	 * for this type of request. We can (and should) make this smarter.
-	 * For instance, if the completion latencies are tight, we can
-	 * get closer than just half the mean. This is especially
-	 * important on devices where the completion latencies are longer
-	 * than ~10 usec. We do use the stats for the relevant IO size
-	 * if available which does lead to better estimates.
+	 * for this type of request. If the completion latencies are tight
+	 * we get closer than that, but never past the fastest completion
+	 * of the last window. This is especially important on devices
+	 * where the completion latencies are longer than ~10 usec. We do
+	 * use the stats for the relevant IO size and cgroup if available
+	 * which does lead to better estimates.
 	 */
 	bucket = blk_mq_poll_stats_bkt(rq);
 	if (bucket < 0)
 		return ret;
 
-	if (q->poll_stat[bucket].nr_samples)
-		ret = (q->poll_stat[bucket].mean + 1) / 2;
+	stat = blk_mq_poll_rq_stat(q, rq, bucket);
+	if (stat->nr_samples) {
+		ret = (stat->mean + 1) / 2;
+		ret = max_t(u64, ret, div_u64(stat->min * 3, 4));
+	}
 
 	return ret;
 }
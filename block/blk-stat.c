@@ -6,6 +6,7 @@
 #include <linux/kernel.h>
 #include <linux/rculist.h>
 #include <linux/blk-mq.h>
+#include <linux/blk-cgroup.h>
 
 #include "blk-stat.h"
 #include "blk-mq.h"
@@ -47,6 +48,127 @@ void blk_rq_stat_add(struct blk_rq_stat *stat, u64 value)
 	stat->nr_samples++;
 }
 
+#ifdef CONFIG_BLK_CGROUP
+static void blkg_poll_stat_init(struct blkg_poll_stat *stat)
+{
+	int bucket;
+
+	for (bucket = 0; bucket < BLK_MQ_POLL_STATS_BKTS; bucket++)
+		blk_rq_stat_init(&stat->stat[bucket]);
+	memset(stat->hist, 0, sizeof(stat->hist));
+}
+
+/*
+ * Return the polling stats of @blkg, allocating them if this is the first
+ * time @blkg polls. Called from the polling task, so this must not sleep.
+ */
+struct blkg_poll_stats *blkg_poll_stats(struct blkcg_gq *blkg)
+{
+	struct blkg_poll_stats *ps, *old;
+	int cpu;
+
+	ps = READ_ONCE(blkg->poll_stats);
+	if (likely(ps))
+		return ps;
+
+	ps = kmalloc_node(sizeof(*ps), GFP_NOWAIT | __GFP_NOWARN,
+			  blkg->q->node);
+	if (!ps)
+		return NULL;
+	ps->cpu_stat = alloc_percpu_gfp(struct blkg_poll_stat,
+					GFP_NOWAIT | __GFP_NOWARN);
+	if (!ps->cpu_stat) {
+		kfree(ps);
+		return NULL;
+	}
+
+	blkg_poll_stat_init(&ps->cur);
+	for_each_possible_cpu(cpu)
+		blkg_poll_stat_init(per_cpu_ptr(ps->cpu_stat, cpu));
+
+	old = cmpxchg(&blkg->poll_stats, NULL, ps);
+	if (old) {
+		free_percpu(ps->cpu_stat);
+		kfree(ps);
+		return old;
+	}
+	return ps;
+}
+
+static int blkg_poll_hist_bkt(u64 value)
+{
+	u64 usecs = div_u64(value, NSEC_PER_USEC);
+
+	if (!usecs)
+		return 0;
+	return min_t(int, ilog2(usecs) + 1, BLKG_POLL_HIST_BKTS - 1);
+}
+
+static void blkg_poll_stat_add(struct request *rq, int bucket, u64 value)
+{
+	struct request_list *rl = blk_rq_rl(rq);
+	struct blkg_poll_stats *ps;
+	struct blkg_poll_stat *stat;
+
+	if (!rl || !rl->blkg)
+		return;
+	ps = READ_ONCE(rl->blkg->poll_stats);
+	if (!ps)
+		return;
+
+	stat = get_cpu_ptr(ps->cpu_stat);
+	blk_rq_stat_add(&stat->stat[bucket], value);
+	stat->hist[blkg_poll_hist_bkt(value)]++;
+	put_cpu_ptr(ps->cpu_stat);
+}
+
+/* called from the poll_cb timer when a stats window of @q ends */
+void blkg_poll_stats_fold(struct request_queue *q)
+{
+	struct blkcg_gq *blkg;
+	unsigned long flags;
+	int bucket, cpu, i;
+
+	spin_lock_irqsave(q->queue_lock, flags);
+	list_for_each_entry(blkg, &q->blkg_list, q_node) {
+		struct blkg_poll_stats *ps = blkg->poll_stats;
+		struct blk_rq_stat sum;
+
+		if (!ps)
+			continue;
+
+		for (bucket = 0; bucket < BLK_MQ_POLL_STATS_BKTS; bucket++) {
+			blk_rq_stat_init(&sum);
+			for_each_online_cpu(cpu) {
+				struct blkg_poll_stat *stat;
+
+				stat = per_cpu_ptr(ps->cpu_stat, cpu);
+				blk_rq_stat_sum(&sum, &stat->stat[bucket]);
+				blk_rq_stat_init(&stat->stat[bucket]);
+			}
+			if (sum.nr_samples)
+				ps->cur.stat[bucket] = sum;
+		}
+
+		for_each_online_cpu(cpu) {
+			struct blkg_poll_stat *stat;
+
+			stat = per_cpu_ptr(ps->cpu_stat, cpu);
+			for (i = 0; i < BLKG_POLL_HIST_BKTS; i++) {
+				ps->cur.hist[i] += stat->hist[i];
+				stat->hist[i] = 0;
+			}
+		}
+	}
+	spin_unlock_irqrestore(q->queue_lock, flags);
+}
+#else
+static inline void blkg_poll_stat_add(struct request *rq, int bucket,
+				      u64 value)
+{
+}
+#endif
+
 void blk_stat_add(struct request *rq, u64 now)
 {
 	struct request_queue *q = rq->q;
@@ -71,6 +193,9 @@ void blk_stat_add(struct request *rq, u64 now)
 		stat = &get_cpu_ptr(cb->cpu_stat)[bucket];
 		blk_rq_stat_add(stat, value);
 		put_cpu_ptr(cb->cpu_stat);
+
+		if (cb == q->poll_cb)
+			blkg_poll_stat_add(rq, bucket, value);
 	}
 	rcu_read_unlock();
 }
@@ -168,4 +168,14 @@ void blk_rq_stat_add(struct blk_rq_stat *, u64);
 void blk_rq_stat_sum(struct blk_rq_stat *, struct blk_rq_stat *);
 void blk_rq_stat_init(struct blk_rq_stat *);
 
+#ifdef CONFIG_BLK_CGROUP
+struct blkcg_gq;
+struct blkg_poll_stats *blkg_poll_stats(struct blkcg_gq *blkg);
+void blkg_poll_stats_fold(struct request_queue *q);
+#else
+static inline void blkg_poll_stats_fold(struct request_queue *q)
+{
+}
+#endif
+
 #endif
@@ -156,6 +156,15 @@ struct throtl_grp {
 	/* Number of bio's dispatched in current slice */
 	unsigned int io_disp[2];
 
+	/*
+	 * Unused budget carried over from previous slices, capped by the
+	 * user configured burst.  A zero burst disables carrying over.
+	 */
+	uint64_t bps_burst[2];
+	unsigned int iops_burst[2];
+	uint64_t bytes_credit[2];
+	unsigned int io_credit[2];
+
 	unsigned long last_low_overflow_time[2];
 
 	uint64_t last_bytes_disp[2];
@@ -834,8 +843,51 @@ static inline void throtl_start_new_slice_with_credit(struct throtl_grp *tg,
 		   tg->slice_end[rw], jiffies);
 }
 
+/*
+ * Fold the budget left unused since the start of the current slice into
+ * the burst credit.  Called before the slice is restarted, so a group
+ * which was idle for a while gets to dispatch up to its burst at once.
+ */
+static void throtl_update_credit(struct throtl_grp *tg, bool rw)
+{
+	unsigned long elapsed = jiffies - tg->slice_start[rw];
+	u64 bps_limit = tg_bps_limit(tg, rw);
+	u32 iops_limit = tg_iops_limit(tg, rw);
+	u64 allowed, fill;
+
+	if (tg->bps_burst[rw] && bps_limit != U64_MAX) {
+		/* no need to look further back than it takes to fill up */
+		fill = div64_u64(tg->bps_burst[rw] * HZ, bps_limit) + 1;
+		allowed = bps_limit * min_t(u64, elapsed, fill);
+		do_div(allowed, HZ);
+		allowed += tg->bytes_credit[rw];
+		if (allowed > tg->bytes_disp[rw])
+			tg->bytes_credit[rw] = min(allowed - tg->bytes_disp[rw],
+						   tg->bps_burst[rw]);
+		else
+			tg->bytes_credit[rw] = 0;
+	} else {
+		tg->bytes_credit[rw] = 0;
+	}
+
+	if (tg->iops_burst[rw] && iops_limit != UINT_MAX) {
+		fill = div64_u64((u64)tg->iops_burst[rw] * HZ, iops_limit) + 1;
+		allowed = (u64)iops_limit * min_t(u64, elapsed, fill);
+		do_div(allowed, HZ);
+		allowed += tg->io_credit[rw];
+		if (allowed > tg->io_disp[rw])
+			tg->io_credit[rw] = min_t(u64, allowed - tg->io_disp[rw],
+						  tg->iops_burst[rw]);
+		else
+			tg->io_credit[rw] = 0;
+	} else {
+		tg->io_credit[rw] = 0;
+	}
+}
+
 static inline void throtl_start_new_slice(struct throtl_grp *tg, bool rw)
 {
+	throtl_update_credit(tg, rw);
 	tg->bytes_disp[rw] = 0;
 	tg->io_disp[rw] = 0;
 	tg->slice_start[rw] = jiffies;
@@ -913,15 +965,26 @@ static inline void throtl_trim_slice(struct throtl_grp *tg, bool rw)
 	if (!bytes_trim && !io_trim)
 		return;
 
-	if (tg->bytes_disp[rw] >= bytes_trim)
+	/* budget trimmed away unused goes to the burst credit */
+	if (tg->bytes_disp[rw] >= bytes_trim) {
 		tg->bytes_disp[rw] -= bytes_trim;
-	else
+	} else {
+		if (tg->bps_burst[rw])
+			tg->bytes_credit[rw] = min(tg->bytes_credit[rw] +
+					bytes_trim - tg->bytes_disp[rw],
+					tg->bps_burst[rw]);
 		tg->bytes_disp[rw] = 0;
+	}
 
-	if (tg->io_disp[rw] >= io_trim)
+	if (tg->io_disp[rw] >= io_trim) {
 		tg->io_disp[rw] -= io_trim;
-	else
+	} else {
+		if (tg->iops_burst[rw])
+			tg->io_credit[rw] = min_t(u64, (u64)tg->io_credit[rw] +
+					io_trim - tg->io_disp[rw],
+					tg->iops_burst[rw]);
 		tg->io_disp[rw] = 0;
+	}
 
 	tg->slice_start[rw] += nr_slices * tg->td->throtl_slice;
 
@@ -959,6 +1022,7 @@ static bool tg_with_in_iops_limit(struct throtl_grp *tg, struct bio *bio,
 
 	tmp = (u64)iops_limit * jiffy_elapsed_rnd;
 	do_div(tmp, HZ);
+	tmp += tg->io_credit[rw];
 
 	if (tmp > UINT_MAX)
 		io_allowed = UINT_MAX;
@@ -1003,7 +1067,7 @@ static bool tg_with_in_bps_limit(struct throtl_grp *tg, struct bio *bio,
 
 	tmp = bps_limit * jiffy_elapsed_rnd;
 	do_div(tmp, HZ);
-	bytes_allowed = tmp;
+	bytes_allowed = tmp + tg->bytes_credit[rw];
 
 	if (tg->bytes_disp[rw] + bio_size <= bytes_allowed) {
 		if (wait)
@@ -1710,6 +1774,8 @@ static u64 tg_prfill_limit(struct seq_file *sf, struct blkg_policy_data *pd,
 	unsigned int iops_dft;
 	char idle_time[26] = "";
 	char latency_time[26] = "";
+	char burst[4][34] = { "", "", "", "" };
+	bool has_burst = false;
 
 	if (!dname)
 		return 0;
@@ -1722,10 +1788,14 @@ static u64 tg_prfill_limit(struct seq_file *sf, struct blkg_policy_data *pd,
 		iops_dft = UINT_MAX;
 	}
 
+	if (off == LIMIT_MAX)
+		has_burst = tg->bps_burst[READ] || tg->bps_burst[WRITE] ||
+			    tg->iops_burst[READ] || tg->iops_burst[WRITE];
+
 	if (tg->bps_conf[READ][off] == bps_dft &&
 	    tg->bps_conf[WRITE][off] == bps_dft &&
 	    tg->iops_conf[READ][off] == iops_dft &&
-	    tg->iops_conf[WRITE][off] == iops_dft &&
+	    tg->iops_conf[WRITE][off] == iops_dft && !has_burst &&
 	    (off != LIMIT_LOW ||
 	     (tg->idletime_threshold_conf == DFL_IDLE_THRESHOLD &&
 	      tg->latency_target_conf == DFL_LATENCY_TARGET)))
@@ -1757,9 +1827,22 @@ static u64 tg_prfill_limit(struct seq_file *sf, struct blkg_policy_data *pd,
 				" latency=%lu", tg->latency_target_conf);
 	}
 
-	seq_printf(sf, "%s rbps=%s wbps=%s riops=%s wiops=%s%s%s\n",
+	if (tg->bps_burst[READ])
+		snprintf(burst[0], sizeof(burst[0]), " rbps_burst=%llu",
+			 tg->bps_burst[READ]);
+	if (tg->bps_burst[WRITE])
+		snprintf(burst[1], sizeof(burst[1]), " wbps_burst=%llu",
+			 tg->bps_burst[WRITE]);
+	if (tg->iops_burst[READ])
+		snprintf(burst[2], sizeof(burst[2]), " riops_burst=%u",
+			 tg->iops_burst[READ]);
+	if (tg->iops_burst[WRITE])
+		snprintf(burst[3], sizeof(burst[3]), " wiops_burst=%u",
+			 tg->iops_burst[WRITE]);
+
+	seq_printf(sf, "%s rbps=%s wbps=%s riops=%s wiops=%s%s%s%s%s%s%s\n",
 		   dname, bufs[0], bufs[1], bufs[2], bufs[3], idle_time,
-		   latency_time);
+		   latency_time, burst[0], burst[1], burst[2], burst[3]);
 	return 0;
 }
 
@@ -1776,7 +1859,7 @@ static ssize_t tg_set_limit(struct kernfs_open_file *of,
 	struct blkcg *blkcg = css_to_blkcg(of_css(of));
 	struct blkg_conf_ctx ctx;
 	struct throtl_grp *tg;
-	u64 v[4];
+	u64 v[4], burst[4];
 	unsigned long idle_time;
 	unsigned long latency_time;
 	int ret;
@@ -1793,15 +1876,20 @@ static ssize_t tg_set_limit(struct kernfs_open_file *of,
 	v[2] = tg->iops_conf[READ][index];
 	v[3] = tg->iops_conf[WRITE][index];
 
+	burst[0] = tg->bps_burst[READ];
+	burst[1] = tg->bps_burst[WRITE];
+	burst[2] = tg->iops_burst[READ];
+	burst[3] = tg->iops_burst[WRITE];
+
 	idle_time = tg->idletime_threshold_conf;
 	latency_time = tg->latency_target_conf;
 	while (true) {
-		char tok[27];	/* wiops=18446744073709551616 */
+		char tok[33];	/* wiops_burst=18446744073709551616 */
 		char *p;
 		u64 val = U64_MAX;
 		int len;
 
-		if (sscanf(ctx.body, "%26s%n", tok, &len) != 1)
+		if (sscanf(ctx.body, "%32s%n", tok, &len) != 1)
 			break;
 		if (tok[0] == '\0')
 			break;
@@ -1813,6 +1901,23 @@ static ssize_t tg_set_limit(struct kernfs_open_file *of,
 		if (!p || (sscanf(p, "%llu", &val) != 1 && strcmp(p, "max")))
 			goto out_finish;
 
+		/* bursts are plain amounts, zero turns them off */
+		if (index == LIMIT_MAX && val != U64_MAX) {
+			if (!strcmp(tok, "rbps_burst")) {
+				burst[0] = val;
+				continue;
+			} else if (!strcmp(tok, "wbps_burst")) {
+				burst[1] = val;
+				continue;
+			} else if (!strcmp(tok, "riops_burst")) {
+				burst[2] = min_t(u64, val, UINT_MAX);
+				continue;
+			} else if (!strcmp(tok, "wiops_burst")) {
+				burst[3] = min_t(u64, val, UINT_MAX);
+				continue;
+			}
+		}
+
 		ret = -ERANGE;
 		if (!val)
 			goto out_finish;
@@ -1840,6 +1945,10 @@ static ssize_t tg_set_limit(struct kernfs_open_file *of,
 	tg->iops_conf[WRITE][index] = v[3];
 
 	if (index == LIMIT_MAX) {
+		tg->bps_burst[READ] = burst[0];
+		tg->bps_burst[WRITE] = burst[1];
+		tg->iops_burst[READ] = burst[2];
+		tg->iops_burst[WRITE] = burst[3];
 		tg->bps[READ][index] = v[0];
 		tg->bps[WRITE][index] = v[1];
 		tg->iops[READ][index] = v[2];
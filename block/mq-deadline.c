@@ -32,10 +32,19 @@ static const int writes_starved = 2;    /* max times reads can starve a write */
 static const int fifo_batch = 16;       /* # of sequential requests treated as one
 				     by the above parameters. For throughput. */
 
-struct deadline_data {
-	/*
-	 * run time data
-	 */
+/*
+ * With shard_hctx set, each hardware queue gets its own sort and fifo lists
+ * and lock, so submitters on different hardware queues never contend.
+ * Requests only meet requests of their own hardware queue then, merging is
+ * left to plugging like without a scheduler. Zoned devices and single queue
+ * devices always use one shard.
+ */
+static bool shard_hctx;
+module_param(shard_hctx, bool, 0644);
+MODULE_PARM_DESC(shard_hctx, "Schedule each hardware queue separately");
+
+struct dd_shard {
+	spinlock_t lock;
 
 	/*
 	 * requests (deadline_rq s) are present on both sort_list and fifo_list
@@ -50,6 +59,10 @@ struct deadline_data {
 	unsigned int batching;		/* number of sequential requests made */
 	unsigned int starved;		/* times reads have starved writes */
 
+	struct list_head dispatch;
+} ____cacheline_aligned_in_smp;
+
+struct deadline_data {
 	/*
 	 * settings that change how the i/o scheduler behaves
 	 */
@@ -58,15 +71,25 @@ struct deadline_data {
 	int writes_starved;
 	int front_merges;
 
-	spinlock_t lock;
 	spinlock_t zone_lock;
-	struct list_head dispatch;
+
+	/*
+	 * run time data, one shard per hardware queue or a single one
+	 */
+	unsigned int nr_shards;
+	struct dd_shard shards[];
 };
 
+static inline struct dd_shard *
+dd_shard(struct deadline_data *dd, struct blk_mq_hw_ctx *hctx)
+{
+	return &dd->shards[dd->nr_shards > 1 ? hctx->queue_num : 0];
+}
+
 static inline struct rb_root *
-deadline_rb_root(struct deadline_data *dd, struct request *rq)
+deadline_rb_root(struct dd_shard *ds, struct request *rq)
 {
-	return &dd->sort_list[rq_data_dir(rq)];
+	return &ds->sort_list[rq_data_dir(rq)];
 }
 
 /*
@@ -84,38 +107,37 @@ deadline_latter_request(struct request *rq)
 }
 
 static void
-deadline_add_rq_rb(struct deadline_data *dd, struct request *rq)
+deadline_add_rq_rb(struct dd_shard *ds, struct request *rq)
 {
-	struct rb_root *root = deadline_rb_root(dd, rq);
+	struct rb_root *root = deadline_rb_root(ds, rq);
 
 	elv_rb_add(root, rq);
 }
 
 static inline void
-deadline_del_rq_rb(struct deadline_data *dd, struct request *rq)
+deadline_del_rq_rb(struct dd_shard *ds, struct request *rq)
 {
 	const int data_dir = rq_data_dir(rq);
 
-	if (dd->next_rq[data_dir] == rq)
-		dd->next_rq[data_dir] = deadline_latter_request(rq);
+	if (ds->next_rq[data_dir] == rq)
+		ds->next_rq[data_dir] = deadline_latter_request(rq);
 
-	elv_rb_del(deadline_rb_root(dd, rq), rq);
+	elv_rb_del(deadline_rb_root(ds, rq), rq);
 }
 
 /*
  * remove rq from rbtree and fifo.
  */
-static void deadline_remove_request(struct request_queue *q, struct request *rq)
+static void deadline_remove_request(struct request_queue *q,
+				    struct dd_shard *ds, struct request *rq)
 {
-	struct deadline_data *dd = q->elevator->elevator_data;
-
 	list_del_init(&rq->queuelist);
 
 	/*
 	 * We might not be on the rbtree, if we are doing an insert merge
 	 */
 	if (!RB_EMPTY_NODE(&rq->rb_node))
-		deadline_del_rq_rb(dd, rq);
+		deadline_del_rq_rb(ds, rq);
 
 	elv_rqhash_del(q, rq);
 	if (q->last_merge == rq)
@@ -126,19 +148,22 @@ static void dd_request_merged(struct request_queue *q, struct request *req,
 			      enum elv_merge type)
 {
 	struct deadline_data *dd = q->elevator->elevator_data;
+	struct dd_shard *ds = dd_shard(dd, req->mq_hctx);
 
 	/*
 	 * if the merge was a front merge, we need to reposition request
 	 */
 	if (type == ELEVATOR_FRONT_MERGE) {
-		elv_rb_del(deadline_rb_root(dd, req), req);
-		deadline_add_rq_rb(dd, req);
+		elv_rb_del(deadline_rb_root(ds, req), req);
+		deadline_add_rq_rb(ds, req);
 	}
 }
 
 static void dd_merged_requests(struct request_queue *q, struct request *req,
 			       struct request *next)
 {
+	struct deadline_data *dd = q->elevator->elevator_data;
+
 	/*
 	 * if next expires before rq, assign its expire time to rq
 	 * and move into next position (next will be deleted) in fifo
@@ -154,34 +179,34 @@ static void dd_merged_requests(struct request_queue *q, struct request *req,
 	/*
 	 * kill knowledge of next, this one is a goner
 	 */
-	deadline_remove_request(q, next);
+	deadline_remove_request(q, dd_shard(dd, next->mq_hctx), next);
 }
 
 /*
  * move an entry to dispatch queue
  */
 static void
-deadline_move_request(struct deadline_data *dd, struct request *rq)
+deadline_move_request(struct dd_shard *ds, struct request *rq)
 {
 	const int data_dir = rq_data_dir(rq);
 
-	dd->next_rq[READ] = NULL;
-	dd->next_rq[WRITE] = NULL;
-	dd->next_rq[data_dir] = deadline_latter_request(rq);
+	ds->next_rq[READ] = NULL;
+	ds->next_rq[WRITE] = NULL;
+	ds->next_rq[data_dir] = deadline_latter_request(rq);
 
 	/*
 	 * take it off the sort and fifo list
 	 */
-	deadline_remove_request(rq->q, rq);
+	deadline_remove_request(rq->q, ds, rq);
 }
 
 /*
  * deadline_check_fifo returns 0 if there are no expired requests on the fifo,
- * 1 otherwise. Requires !list_empty(&dd->fifo_list[data_dir])
+ * 1 otherwise. Requires !list_empty(&ds->fifo_list[data_dir])
  */
-static inline int deadline_check_fifo(struct deadline_data *dd, int ddir)
+static inline int deadline_check_fifo(struct dd_shard *ds, int ddir)
 {
-	struct request *rq = rq_entry_fifo(dd->fifo_list[ddir].next);
+	struct request *rq = rq_entry_fifo(ds->fifo_list[ddir].next);
 
 	/*
 	 * rq is expired!
@@ -197,7 +222,8 @@ static inline int deadline_check_fifo(struct deadline_data *dd, int ddir)
  * dispatch using arrival ordered lists.
  */
 static struct request *
-deadline_fifo_request(struct deadline_data *dd, int data_dir)
+deadline_fifo_request(struct deadline_data *dd, struct dd_shard *ds,
+		      int data_dir)
 {
 	struct request *rq;
 	unsigned long flags;
@@ -205,10 +231,10 @@ deadline_fifo_request(struct deadline_data *dd, int data_dir)
 	if (WARN_ON_ONCE(data_dir != READ && data_dir != WRITE))
 		return NULL;
 
-	if (list_empty(&dd->fifo_list[data_dir]))
+	if (list_empty(&ds->fifo_list[data_dir]))
 		return NULL;
 
-	rq = rq_entry_fifo(dd->fifo_list[data_dir].next);
+	rq = rq_entry_fifo(ds->fifo_list[data_dir].next);
 	if (data_dir == READ || !blk_queue_is_zoned(rq->q))
 		return rq;
 
@@ -217,7 +243,7 @@ deadline_fifo_request(struct deadline_data *dd, int data_dir)
 	 * an unlocked target zone.
 	 */
 	spin_lock_irqsave(&dd->zone_lock, flags);
-	list_for_each_entry(rq, &dd->fifo_list[WRITE], queuelist) {
+	list_for_each_entry(rq, &ds->fifo_list[WRITE], queuelist) {
 		if (blk_req_can_dispatch_to_zone(rq))
 			goto out;
 	}
@@ -233,7 +259,8 @@ deadline_fifo_request(struct deadline_data *dd, int data_dir)
  * dispatch using sector position sorted lists.
  */
 static struct request *
-deadline_next_request(struct deadline_data *dd, int data_dir)
+deadline_next_request(struct deadline_data *dd, struct dd_shard *ds,
+		      int data_dir)
 {
 	struct request *rq;
 	unsigned long flags;
@@ -241,7 +268,7 @@ deadline_next_request(struct deadline_data *dd, int data_dir)
 	if (WARN_ON_ONCE(data_dir != READ && data_dir != WRITE))
 		return NULL;
 
-	rq = dd->next_rq[data_dir];
+	rq = ds->next_rq[data_dir];
 	if (!rq)
 		return NULL;
 
@@ -267,29 +294,30 @@ deadline_next_request(struct deadline_data *dd, int data_dir)
  * deadline_dispatch_requests selects the best request according to
  * read/write expire, fifo_batch, etc
  */
-static struct request *__dd_dispatch_request(struct deadline_data *dd)
+static struct request *__dd_dispatch_request(struct deadline_data *dd,
+					      struct dd_shard *ds)
 {
 	struct request *rq, *next_rq;
 	bool reads, writes;
 	int data_dir;
 
-	if (!list_empty(&dd->dispatch)) {
-		rq = list_first_entry(&dd->dispatch, struct request, queuelist);
+	if (!list_empty(&ds->dispatch)) {
+		rq = list_first_entry(&ds->dispatch, struct request, queuelist);
 		list_del_init(&rq->queuelist);
 		goto done;
 	}
 
-	reads = !list_empty(&dd->fifo_list[READ]);
-	writes = !list_empty(&dd->fifo_list[WRITE]);
+	reads = !list_empty(&ds->fifo_list[READ]);
+	writes = !list_empty(&ds->fifo_list[WRITE]);
 
 	/*
 	 * batches are currently reads XOR writes
 	 */
-	rq = deadline_next_request(dd, WRITE);
+	rq = deadline_next_request(dd, ds, WRITE);
 	if (!rq)
-		rq = deadline_next_request(dd, READ);
+		rq = deadline_next_request(dd, ds, READ);
 
-	if (rq && dd->batching < dd->fifo_batch)
+	if (rq && ds->batching < dd->fifo_batch)
 		/* we have a next request are still entitled to batch */
 		goto dispatch_request;
 
@@ -299,10 +327,10 @@ static struct request *__dd_dispatch_request(struct deadline_data *dd)
 	 */
 
 	if (reads) {
-		BUG_ON(RB_EMPTY_ROOT(&dd->sort_list[READ]));
+		BUG_ON(RB_EMPTY_ROOT(&ds->sort_list[READ]));
 
-		if (deadline_fifo_request(dd, WRITE) &&
-		    (dd->starved++ >= dd->writes_starved))
+		if (deadline_fifo_request(dd, ds, WRITE) &&
+		    (ds->starved++ >= dd->writes_starved))
 			goto dispatch_writes;
 
 		data_dir = READ;
@@ -316,9 +344,9 @@ static struct request *__dd_dispatch_request(struct deadline_data *dd)
 
 	if (writes) {
 dispatch_writes:
-		BUG_ON(RB_EMPTY_ROOT(&dd->sort_list[WRITE]));
+		BUG_ON(RB_EMPTY_ROOT(&ds->sort_list[WRITE]));
 
-		dd->starved = 0;
+		ds->starved = 0;
 
 		data_dir = WRITE;
 
@@ -331,14 +359,14 @@ static struct request *__dd_dispatch_request(struct deadline_data *dd)
 	/*
 	 * we are not running a batch, find best request for selected data_dir
 	 */
-	next_rq = deadline_next_request(dd, data_dir);
-	if (deadline_check_fifo(dd, data_dir) || !next_rq) {
+	next_rq = deadline_next_request(dd, ds, data_dir);
+	if (deadline_check_fifo(ds, data_dir) || !next_rq) {
 		/*
 		 * A deadline has expired, the last request was in the other
 		 * direction, or we have run out of higher-sectored requests.
 		 * Start again from the request with the earliest expiry time.
 		 */
-		rq = deadline_fifo_request(dd, data_dir);
+		rq = deadline_fifo_request(dd, ds, data_dir);
 	} else {
 		/*
 		 * The last req was the same dir and we have a next request in
@@ -354,14 +382,14 @@ static struct request *__dd_dispatch_request(struct deadline_data *dd)
 	if (!rq)
 		return NULL;
 
-	dd->batching = 0;
+	ds->batching = 0;
 
 dispatch_request:
 	/*
 	 * rq is the selected appropriate request.
 	 */
-	dd->batching++;
-	deadline_move_request(dd, rq);
+	ds->batching++;
+	deadline_move_request(ds, rq);
 done:
 	/*
 	 * If the request needs its target zone locked, do it.
@@ -375,16 +403,18 @@ static struct request *__dd_dispatch_request(struct deadline_data *dd)
  * One confusing aspect here is that we get called for a specific
  * hardware queue, but we may return a request that is for a
  * different hardware queue. This is because mq-deadline has shared
- * state for all hardware queues, in terms of sorting, FIFOs, etc.
+ * state for all hardware queues, in terms of sorting, FIFOs, etc,
+ * unless the queues are sharded.
  */
 static struct request *dd_dispatch_request(struct blk_mq_hw_ctx *hctx)
 {
 	struct deadline_data *dd = hctx->queue->elevator->elevator_data;
+	struct dd_shard *ds = dd_shard(dd, hctx);
 	struct request *rq;
 
-	spin_lock(&dd->lock);
-	rq = __dd_dispatch_request(dd);
-	spin_unlock(&dd->lock);
+	spin_lock(&ds->lock);
+	rq = __dd_dispatch_request(dd, ds);
+	spin_unlock(&ds->lock);
 
 	return rq;
 }
@@ -392,9 +422,12 @@ static struct request *dd_dispatch_request(struct blk_mq_hw_ctx *hctx)
 static void dd_exit_queue(struct elevator_queue *e)
 {
 	struct deadline_data *dd = e->elevator_data;
+	unsigned int i;
 
-	BUG_ON(!list_empty(&dd->fifo_list[READ]));
-	BUG_ON(!list_empty(&dd->fifo_list[WRITE]));
+	for (i = 0; i < dd->nr_shards; i++) {
+		BUG_ON(!list_empty(&dd->shards[i].fifo_list[READ]));
+		BUG_ON(!list_empty(&dd->shards[i].fifo_list[WRITE]));
+	}
 
 	kfree(dd);
 }
@@ -406,30 +439,40 @@ static int dd_init_queue(struct request_queue *q, struct elevator_type *e)
 {
 	struct deadline_data *dd;
 	struct elevator_queue *eq;
+	unsigned int i, nr_shards = 1;
 
 	eq = elevator_alloc(q, e);
 	if (!eq)
 		return -ENOMEM;
 
-	dd = kzalloc_node(sizeof(*dd), GFP_KERNEL, q->node);
+	if (shard_hctx && q->nr_hw_queues > 1 && !blk_queue_is_zoned(q))
+		nr_shards = q->nr_hw_queues;
+
+	dd = kzalloc_node(struct_size(dd, shards, nr_shards), GFP_KERNEL,
+			  q->node);
 	if (!dd) {
 		kobject_put(&eq->kobj);
 		return -ENOMEM;
 	}
 	eq->elevator_data = dd;
 
-	INIT_LIST_HEAD(&dd->fifo_list[READ]);
-	INIT_LIST_HEAD(&dd->fifo_list[WRITE]);
-	dd->sort_list[READ] = RB_ROOT;
-	dd->sort_list[WRITE] = RB_ROOT;
+	for (i = 0; i < nr_shards; i++) {
+		struct dd_shard *ds = &dd->shards[i];
+
+		spin_lock_init(&ds->lock);
+		INIT_LIST_HEAD(&ds->fifo_list[READ]);
+		INIT_LIST_HEAD(&ds->fifo_list[WRITE]);
+		ds->sort_list[READ] = RB_ROOT;
+		ds->sort_list[WRITE] = RB_ROOT;
+		INIT_LIST_HEAD(&ds->dispatch);
+	}
+	dd->nr_shards = nr_shards;
 	dd->fifo_expire[READ] = read_expire;
 	dd->fifo_expire[WRITE] = write_expire;
 	dd->writes_starved = writes_starved;
 	dd->front_merges = 1;
 	dd->fifo_batch = fifo_batch;
-	spin_lock_init(&dd->lock);
 	spin_lock_init(&dd->zone_lock);
-	INIT_LIST_HEAD(&dd->dispatch);
 
 	q->elevator = eq;
 	return 0;
@@ -442,10 +485,11 @@ static int dd_request_merge(struct request_queue *q, struct request **rq,
 	sector_t sector = bio_end_sector(bio);
 	struct request *__rq;
 
+	/* only reached unsharded, see dd_bio_merge() */
 	if (!dd->front_merges)
 		return ELEVATOR_NO_MERGE;
 
-	__rq = elv_rb_find(&dd->sort_list[bio_data_dir(bio)], sector);
+	__rq = elv_rb_find(&dd->shards[0].sort_list[bio_data_dir(bio)], sector);
 	if (__rq) {
 		BUG_ON(sector != blk_rq_pos(__rq));
 
@@ -465,9 +509,13 @@ static bool dd_bio_merge(struct blk_mq_hw_ctx *hctx, struct bio *bio)
 	struct request *free = NULL;
 	bool ret;
 
-	spin_lock(&dd->lock);
+	/* the merge hash and last_merge are shared by all hardware queues */
+	if (dd->nr_shards > 1)
+		return false;
+
+	spin_lock(&dd->shards[0].lock);
 	ret = blk_mq_sched_try_merge(q, bio, &free);
-	spin_unlock(&dd->lock);
+	spin_unlock(&dd->shards[0].lock);
 
 	if (free)
 		blk_mq_free_request(free);
@@ -483,7 +531,9 @@ static void dd_insert_request(struct blk_mq_hw_ctx *hctx, struct request *rq,
 {
 	struct request_queue *q = hctx->queue;
 	struct deadline_data *dd = q->elevator->elevator_data;
+	struct dd_shard *ds = dd_shard(dd, hctx);
 	const int data_dir = rq_data_dir(rq);
+	bool merge = dd->nr_shards == 1;
 
 	/*
 	 * This may be a requeue of a write request that has locked its
@@ -491,20 +541,20 @@ static void dd_insert_request(struct blk_mq_hw_ctx *hctx, struct request *rq,
 	 */
 	blk_req_zone_write_unlock(rq);
 
-	if (blk_mq_sched_try_insert_merge(q, rq))
+	if (merge && blk_mq_sched_try_insert_merge(q, rq))
 		return;
 
 	blk_mq_sched_request_inserted(rq);
 
 	if (at_head || blk_rq_is_passthrough(rq)) {
 		if (at_head)
-			list_add(&rq->queuelist, &dd->dispatch);
+			list_add(&rq->queuelist, &ds->dispatch);
 		else
-			list_add_tail(&rq->queuelist, &dd->dispatch);
+			list_add_tail(&rq->queuelist, &ds->dispatch);
 	} else {
-		deadline_add_rq_rb(dd, rq);
+		deadline_add_rq_rb(ds, rq);
 
-		if (rq_mergeable(rq)) {
+		if (merge && rq_mergeable(rq)) {
 			elv_rqhash_add(q, rq);
 			if (!q->last_merge)
 				q->last_merge = rq;
@@ -514,7 +564,7 @@ static void dd_insert_request(struct blk_mq_hw_ctx *hctx, struct request *rq,
 		 * set expire time and add to fifo list
 		 */
 		rq->fifo_time = jiffies + dd->fifo_expire[data_dir];
-		list_add_tail(&rq->queuelist, &dd->fifo_list[data_dir]);
+		list_add_tail(&rq->queuelist, &ds->fifo_list[data_dir]);
 	}
 }
 
@@ -523,8 +573,9 @@ static void dd_insert_requests(struct blk_mq_hw_ctx *hctx,
 {
 	struct request_queue *q = hctx->queue;
 	struct deadline_data *dd = q->elevator->elevator_data;
+	struct dd_shard *ds = dd_shard(dd, hctx);
 
-	spin_lock(&dd->lock);
+	spin_lock(&ds->lock);
 	while (!list_empty(list)) {
 		struct request *rq;
 
@@ -532,7 +583,7 @@ static void dd_insert_requests(struct blk_mq_hw_ctx *hctx,
 		list_del_init(&rq->queuelist);
 		dd_insert_request(hctx, rq, at_head);
 	}
-	spin_unlock(&dd->lock);
+	spin_unlock(&ds->lock);
 }
 
 /*
@@ -565,9 +616,10 @@ static void dd_finish_request(struct request *rq)
 		struct deadline_data *dd = q->elevator->elevator_data;
 		unsigned long flags;
 
+		/* zoned devices are never sharded */
 		spin_lock_irqsave(&dd->zone_lock, flags);
 		blk_req_zone_write_unlock(rq);
-		if (!list_empty(&dd->fifo_list[WRITE])) {
+		if (!list_empty(&dd->shards[0].fifo_list[WRITE])) {
 			struct blk_mq_hw_ctx *hctx;
 
 			hctx = blk_mq_map_queue(q, rq->cmd_flags, rq->mq_ctx->cpu);
@@ -580,10 +632,11 @@ static void dd_finish_request(struct request *rq)
 static bool dd_has_work(struct blk_mq_hw_ctx *hctx)
 {
 	struct deadline_data *dd = hctx->queue->elevator->elevator_data;
+	struct dd_shard *ds = dd_shard(dd, hctx);
 
-	return !list_empty_careful(&dd->dispatch) ||
-		!list_empty_careful(&dd->fifo_list[0]) ||
-		!list_empty_careful(&dd->fifo_list[1]);
+	return !list_empty_careful(&ds->dispatch) ||
+		!list_empty_careful(&ds->fifo_list[0]) ||
+		!list_empty_careful(&ds->fifo_list[1]);
 }
 
 /*
@@ -655,34 +708,42 @@ static struct elv_fs_entry deadline_attrs[] = {
 };
 
 #ifdef CONFIG_BLK_DEBUG_FS
+/* all of the state unsharded, that of the first hardware queue otherwise */
+static struct dd_shard *dd_debugfs_shard(struct request_queue *q)
+{
+	struct deadline_data *dd = q->elevator->elevator_data;
+
+	return &dd->shards[0];
+}
+
 #define DEADLINE_DEBUGFS_DDIR_ATTRS(ddir, name)				\
 static void *deadline_##name##_fifo_start(struct seq_file *m,		\
 					  loff_t *pos)			\
-	__acquires(&dd->lock)						\
+	__acquires(&ds->lock)						\
 {									\
 	struct request_queue *q = m->private;				\
-	struct deadline_data *dd = q->elevator->elevator_data;		\
+	struct dd_shard *ds = dd_debugfs_shard(q);			\
 									\
-	spin_lock(&dd->lock);						\
-	return seq_list_start(&dd->fifo_list[ddir], *pos);		\
+	spin_lock(&ds->lock);						\
+	return seq_list_start(&ds->fifo_list[ddir], *pos);		\
 }									\
 									\
 static void *deadline_##name##_fifo_next(struct seq_file *m, void *v,	\
 					 loff_t *pos)			\
 {									\
 	struct request_queue *q = m->private;				\
-	struct deadline_data *dd = q->elevator->elevator_data;		\
+	struct dd_shard *ds = dd_debugfs_shard(q);			\
 									\
-	return seq_list_next(v, &dd->fifo_list[ddir], pos);		\
+	return seq_list_next(v, &ds->fifo_list[ddir], pos);		\
 }									\
 									\
 static void deadline_##name##_fifo_stop(struct seq_file *m, void *v)	\
-	__releases(&dd->lock)						\
+	__releases(&ds->lock)						\
 {									\
 	struct request_queue *q = m->private;				\
-	struct deadline_data *dd = q->elevator->elevator_data;		\
+	struct dd_shard *ds = dd_debugfs_shard(q);			\
 									\
-	spin_unlock(&dd->lock);						\
+	spin_unlock(&ds->lock);						\
 }									\
 									\
 static const struct seq_operations deadline_##name##_fifo_seq_ops = {	\
@@ -696,8 +757,8 @@ static int deadline_##name##_next_rq_show(void *data,			\
 					  struct seq_file *m)		\
 {									\
 	struct request_queue *q = data;					\
-	struct deadline_data *dd = q->elevator->elevator_data;		\
-	struct request *rq = dd->next_rq[ddir];				\
+	struct dd_shard *ds = dd_debugfs_shard(q);			\
+	struct request *rq = ds->next_rq[ddir];				\
 									\
 	if (rq)								\
 		__blk_mq_debugfs_rq_show(m, rq);			\
@@ -710,46 +771,46 @@ DEADLINE_DEBUGFS_DDIR_ATTRS(WRITE, write)
 static int deadline_batching_show(void *data, struct seq_file *m)
 {
 	struct request_queue *q = data;
-	struct deadline_data *dd = q->elevator->elevator_data;
+	struct dd_shard *ds = dd_debugfs_shard(q);
 
-	seq_printf(m, "%u\n", dd->batching);
+	seq_printf(m, "%u\n", ds->batching);
 	return 0;
 }
 
 static int deadline_starved_show(void *data, struct seq_file *m)
 {
 	struct request_queue *q = data;
-	struct deadline_data *dd = q->elevator->elevator_data;
+	struct dd_shard *ds = dd_debugfs_shard(q);
 
-	seq_printf(m, "%u\n", dd->starved);
+	seq_printf(m, "%u\n", ds->starved);
 	return 0;
 }
 
 static void *deadline_dispatch_start(struct seq_file *m, loff_t *pos)
-	__acquires(&dd->lock)
+	__acquires(&ds->lock)
 {
 	struct request_queue *q = m->private;
-	struct deadline_data *dd = q->elevator->elevator_data;
+	struct dd_shard *ds = dd_debugfs_shard(q);
 
-	spin_lock(&dd->lock);
-	return seq_list_start(&dd->dispatch, *pos);
+	spin_lock(&ds->lock);
+	return seq_list_start(&ds->dispatch, *pos);
 }
 
 static void *deadline_dispatch_next(struct seq_file *m, void *v, loff_t *pos)
 {
 	struct request_queue *q = m->private;
-	struct deadline_data *dd = q->elevator->elevator_data;
+	struct dd_shard *ds = dd_debugfs_shard(q);
 
-	return seq_list_next(v, &dd->dispatch, pos);
+	return seq_list_next(v, &ds->dispatch, pos);
 }
 
 static void deadline_dispatch_stop(struct seq_file *m, void *v)
-	__releases(&dd->lock)
+	__releases(&ds->lock)
 {
 	struct request_queue *q = m->private;
-	struct deadline_data *dd = q->elevator->elevator_data;
+	struct dd_shard *ds = dd_debugfs_shard(q);
 
-	spin_unlock(&dd->lock);
+	spin_unlock(&ds->lock);
 }
 
 static const struct seq_operations deadline_dispatch_seq_ops = {
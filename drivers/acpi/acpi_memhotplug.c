@@ -205,6 +205,7 @@ static int acpi_memory_enable_device(struct acpi_memory_device *mem_device)
 	acpi_handle handle = mem_device->device->handle;
 	int result, num_enabled = 0;
 	struct acpi_memory_info *info;
+	mhp_t mhp_flags;
 	int node;
 
 	node = acpi_get_node(handle);
@@ -228,7 +229,11 @@ static int acpi_memory_enable_device(struct acpi_memory_device *mem_device)
 		if (node < 0)
 			node = memory_add_physaddr_to_nid(info->start_addr);
 
-		result = __add_memory(node, info->start_addr, info->length);
+		mhp_flags = MHP_NONE;
+		if (mhp_supports_memmap_on_memory(info->length))
+			mhp_flags |= MHP_MEMMAP_ON_MEMORY;
+		result = __add_memory(node, info->start_addr, info->length,
+				      mhp_flags);
 
 		/*
 		 * If the memory block has been used by the kernel, add_memory()
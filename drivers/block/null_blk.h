@@ -28,6 +28,7 @@ struct nullb_queue {
 	unsigned int queue_depth;
 	struct nullb_device *dev;
 	unsigned int requeue_selection;
+	sector_t next_sector; /* end of the last request, seq/rand model */
 
 	struct nullb_cmd *cmds;
 };
@@ -58,6 +59,16 @@ struct nullb_device {
 	unsigned int hw_queue_depth; /* queue depth */
 	unsigned int index; /* index of the disk, only valid with a disk */
 	unsigned int mbps; /* Bandwidth throttle cap (in MB/s) */
+	/* latency model of irqmode 2, see null_cmd_latency() */
+	unsigned long read_nsec; /* read latency, completion_nsec if 0 */
+	unsigned long write_nsec; /* write latency, completion_nsec if 0 */
+	unsigned long flush_nsec; /* flush latency, completion_nsec if 0 */
+	unsigned long rand_nsec; /* added to non-sequential requests */
+	unsigned int read_kb_nsec; /* added per KB read */
+	unsigned int write_kb_nsec; /* added per KB written */
+	unsigned int latency_spread; /* lognormal sigma of the latency (in %) */
+	unsigned int tail_permille; /* requests per mille with a latency spike */
+	unsigned long tail_nsec; /* added to a request with a spike */
 	bool blocking; /* blocking blk-mq device */
 	bool use_per_node_hctx; /* use per-node allocation for hardware context */
 	bool power; /* power on/off the device */
@@ -66,6 +77,8 @@ struct nullb_device {
 	bool zoned; /* if device is zoned */
 };
 
+#define NULL_LAT_BUCKETS	128
+
 struct nullb {
 	struct nullb_device *dev;
 	struct list_head list;
@@ -79,6 +92,8 @@ struct nullb {
 	struct hrtimer bw_timer;
 	unsigned long cache_flush_pos;
 	spinlock_t lock;
+	/* lognormal latency multipliers (1024 = median), with latency_spread */
+	u32 lat_mult[NULL_LAT_BUCKETS];
 
 	struct nullb_queue *queues;
 	unsigned int nr_queues;
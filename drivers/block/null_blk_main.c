@@ -8,6 +8,7 @@
 #include <linux/sched.h>
 #include <linux/fs.h>
 #include <linux/init.h>
+#include <linux/random.h>
 #include "null_blk.h"
 
 #define PAGE_SECTORS_SHIFT	(PAGE_SHIFT - SECTOR_SHIFT)
@@ -298,6 +299,15 @@ NULLB_DEVICE_ATTR(cache_size, ulong);
 NULLB_DEVICE_ATTR(zoned, bool);
 NULLB_DEVICE_ATTR(zone_size, ulong);
 NULLB_DEVICE_ATTR(zone_nr_conv, uint);
+NULLB_DEVICE_ATTR(read_nsec, ulong);
+NULLB_DEVICE_ATTR(write_nsec, ulong);
+NULLB_DEVICE_ATTR(flush_nsec, ulong);
+NULLB_DEVICE_ATTR(rand_nsec, ulong);
+NULLB_DEVICE_ATTR(read_kb_nsec, uint);
+NULLB_DEVICE_ATTR(write_kb_nsec, uint);
+NULLB_DEVICE_ATTR(latency_spread, uint);
+NULLB_DEVICE_ATTR(tail_permille, uint);
+NULLB_DEVICE_ATTR(tail_nsec, ulong);
 
 static ssize_t nullb_device_power_show(struct config_item *item, char *page)
 {
@@ -414,6 +424,15 @@ static struct configfs_attribute *nullb_device_attrs[] = {
 	&nullb_device_attr_zoned,
 	&nullb_device_attr_zone_size,
 	&nullb_device_attr_zone_nr_conv,
+	&nullb_device_attr_read_nsec,
+	&nullb_device_attr_write_nsec,
+	&nullb_device_attr_flush_nsec,
+	&nullb_device_attr_rand_nsec,
+	&nullb_device_attr_read_kb_nsec,
+	&nullb_device_attr_write_kb_nsec,
+	&nullb_device_attr_latency_spread,
+	&nullb_device_attr_tail_permille,
+	&nullb_device_attr_tail_nsec,
 	NULL,
 };
 
@@ -653,9 +672,103 @@ static enum hrtimer_restart null_cmd_timer_expired(struct hrtimer *timer)
 	return HRTIMER_NORESTART;
 }
 
+/*
+ * Upper half of the standard normal quantiles of NULL_LAT_BUCKETS equally
+ * likely buckets, times 1024. The lower half is the same, negated.
+ */
+static const u16 null_lat_quantiles[NULL_LAT_BUCKETS / 2] = {
+	  10,   30,   50,   70,   90,  111,  131,  151,
+	 171,  192,  212,  233,  253,  274,  295,  316,
+	 337,  358,  379,  401,  423,  445,  467,  489,
+	 512,  535,  558,  581,  605,  629,  653,  678,
+	 703,  729,  755,  782,  809,  836,  865,  894,
+	 923,  954,  985, 1018, 1051, 1086, 1121, 1159,
+	1198, 1238, 1281, 1326, 1374, 1425, 1480, 1539,
+	1604, 1677, 1758, 1853, 1967, 2113, 2321, 2724,
+};
+
+/* e^(x / 1024) * 1024, good to about a percent */
+static u32 null_exp(s32 x)
+{
+	s32 t = x * 1477 / 1024;	/* log2(e) * 1024 */
+	s32 i = t >= 0 ? t / 1024 : -((1023 - t) / 1024);
+	u32 f = t - i * 1024, p;
+
+	/* 2^f on [0, 1), cubic fit */
+	p = 1024 + ((f * (710 + ((f * (246 + ((f * 57) >> 10))) >> 10))) >> 10);
+	return i >= 0 ? p << i : p >> -i;
+}
+
+static void null_init_latency(struct nullb *nullb)
+{
+	s32 sigma = nullb->dev->latency_spread * 1024 / 100;
+	int i, half = NULL_LAT_BUCKETS / 2;
+
+	for (i = 0; i < half; i++) {
+		s32 x = sigma * null_lat_quantiles[i] / 1024;
+
+		nullb->lat_mult[half + i] = null_exp(x);
+		nullb->lat_mult[half - 1 - i] = null_exp(-x);
+	}
+}
+
+/*
+ * The time a timer-completed command takes: the read, write or flush
+ * latency, lognormally spread around that median by latency_spread, plus
+ * the transfer time, the seek penalty of a request that doesn't start
+ * where the last one on its queue ended, and now and then a tail spike.
+ */
+static u64 null_cmd_latency(struct nullb_cmd *cmd)
+{
+	struct nullb_queue *nq = cmd->nq;
+	struct nullb_device *dev = nq->dev;
+	unsigned int bytes, kb_nsec;
+	sector_t sector;
+	u64 lat;
+	int op;
+
+	if (dev->queue_mode == NULL_Q_BIO) {
+		op = bio_op(cmd->bio);
+		sector = cmd->bio->bi_iter.bi_sector;
+		bytes = cmd->bio->bi_iter.bi_size;
+	} else {
+		op = req_op(cmd->rq);
+		sector = blk_rq_pos(cmd->rq);
+		bytes = blk_rq_bytes(cmd->rq);
+	}
+
+	if (op == REQ_OP_FLUSH) {
+		lat = dev->flush_nsec;
+		kb_nsec = 0;
+	} else if (op_is_write(op)) {
+		lat = dev->write_nsec;
+		kb_nsec = dev->write_kb_nsec;
+	} else {
+		lat = dev->read_nsec;
+		kb_nsec = dev->read_kb_nsec;
+	}
+	if (!lat)
+		lat = dev->completion_nsec;
+
+	if (dev->latency_spread)
+		lat = lat * dev->nullb->lat_mult[prandom_u32_max(NULL_LAT_BUCKETS)]
+			>> 10;
+	lat += (u64)(bytes >> 10) * kb_nsec;
+
+	if (bytes) {
+		if (sector != nq->next_sector)
+			lat += dev->rand_nsec;
+		nq->next_sector = sector + (bytes >> SECTOR_SHIFT);
+	}
+
+	if (dev->tail_permille && prandom_u32_max(1000) < dev->tail_permille)
+		lat += dev->tail_nsec;
+	return lat;
+}
+
 static void null_cmd_end_timer(struct nullb_cmd *cmd)
 {
-	ktime_t kt = cmd->nq->dev->completion_nsec;
+	ktime_t kt = null_cmd_latency(cmd);
 
 	hrtimer_start(&cmd->timer, kt, HRTIMER_MODE_REL);
 }
@@ -1687,6 +1800,8 @@ static void null_validate_conf(struct nullb_device *dev)
 	dev->cache_size = min_t(unsigned long, ULONG_MAX / 1024 / 1024,
 						dev->cache_size);
 	dev->mbps = min_t(unsigned int, 1024 * 40, dev->mbps);
+	dev->latency_spread = min_t(unsigned int, 200, dev->latency_spread);
+	dev->tail_permille = min_t(unsigned int, 1000, dev->tail_permille);
 	/* can not stop a queue */
 	if (dev->queue_mode == NULL_Q_BIO)
 		dev->mbps = 0;
@@ -1796,6 +1911,9 @@ static int null_add_dev(struct nullb_device *dev)
 		nullb_setup_bwtimer(nullb);
 	}
 
+	if (dev->latency_spread)
+		null_init_latency(nullb);
+
 	if (dev->cache_size > 0) {
 		set_bit(NULLB_DEV_FL_CACHE, &nullb->dev->flags);
 		blk_queue_write_cache(nullb->q, true, true);
@@ -125,6 +125,27 @@ static unsigned long zram_get_element(struct zram *zram, u32 index)
 	return zram->table[index].element;
 }
 
+#ifdef CONFIG_MEMCG
+static struct mem_cgroup *zram_get_memcg(struct zram *zram, u32 index)
+{
+	return zram->table[index].memcg;
+}
+
+static void zram_set_memcg(struct zram *zram, u32 index,
+			struct mem_cgroup *memcg)
+{
+	zram->table[index].memcg = memcg;
+}
+#else
+static struct mem_cgroup *zram_get_memcg(struct zram *zram, u32 index)
+{
+	return NULL;
+}
+
+static void zram_set_memcg(struct zram *zram, u32 index,
+			struct mem_cgroup *memcg) {}
+#endif
+
 static size_t zram_get_obj_size(struct zram *zram, u32 index)
 {
 	return zram->table[index].value & (BIT(ZRAM_FLAG_SHIFT) - 1);
@@ -620,6 +641,52 @@ static void zram_wb_clear(struct zram *zram, u32 index)
 	put_entry_bdev(zram, entry);
 }
 
+/*
+ * Move the uncompressed copy of an idle huge page, already read into @page,
+ * to the backing device. Called with the slot lock held, which is dropped
+ * around the write. The page is only switched over if nobody touched the
+ * slot in the meantime: any access clears ZRAM_IDLE, any rewrite
+ * ZRAM_UNDER_WB.
+ */
+static void zram_writeback_slot(struct zram *zram, u32 index,
+				struct page *page)
+{
+	struct bio bio;
+	struct bio_vec bio_vec;
+	unsigned long entry;
+	int ret;
+
+	entry = get_entry_bdev(zram);
+	if (!entry)
+		return;
+
+	/* zram_free_page() clears it if the slot is rewritten meanwhile */
+	zram_set_flag(zram, index, ZRAM_UNDER_WB);
+	zram_slot_unlock(zram, index);
+
+	bio_init(&bio, &bio_vec, 1);
+	bio_set_dev(&bio, zram->bdev);
+	bio.bi_iter.bi_sector = entry * (PAGE_SIZE >> 9);
+	bio.bi_opf = REQ_OP_WRITE | REQ_SYNC;
+	bio_add_page(&bio, page, PAGE_SIZE, 0);
+	ret = submit_bio_wait(&bio);
+
+	zram_slot_lock(zram, index);
+	if (ret || !zram_test_flag(zram, index, ZRAM_UNDER_WB) ||
+	    !zram_test_flag(zram, index, ZRAM_IDLE)) {
+		zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+		put_entry_bdev(zram, entry);
+		return;
+	}
+
+	zram_free_page(zram, index);
+	zram_set_flag(zram, index, ZRAM_HUGE);
+	atomic64_inc(&zram->stats.huge_pages);
+	zram_set_flag(zram, index, ZRAM_WB);
+	zram_set_element(zram, index, entry);
+	atomic64_inc(&zram->stats.pages_stored);
+}
+
 #else
 static bool zram_wb_enabled(struct zram *zram) { return false; }
 static inline void reset_bdev(struct zram *zram) {};
@@ -637,6 +704,8 @@ static int read_from_bdev(struct zram *zram, struct bio_vec *bvec,
 	return -EIO;
 }
 static void zram_wb_clear(struct zram *zram, u32 index) {}
+static void zram_writeback_slot(struct zram *zram, u32 index,
+				struct page *page) {}
 #endif
 
 #ifdef CONFIG_ZRAM_MEMORY_TRACKING
@@ -655,6 +724,7 @@ static void zram_debugfs_destroy(void)
 
 static void zram_accessed(struct zram *zram, u32 index)
 {
+	zram_clear_flag(zram, index, ZRAM_IDLE);
 	zram->table[index].ac_time = ktime_get_boottime();
 }
 
@@ -742,7 +812,10 @@ static void zram_debugfs_unregister(struct zram *zram)
 #else
 static void zram_debugfs_create(void) {};
 static void zram_debugfs_destroy(void) {};
-static void zram_accessed(struct zram *zram, u32 index) {};
+static void zram_accessed(struct zram *zram, u32 index)
+{
+	zram_clear_flag(zram, index, ZRAM_IDLE);
+};
 static void zram_reset_access(struct zram *zram, u32 index) {};
 static void zram_debugfs_register(struct zram *zram) {};
 static void zram_debugfs_unregister(struct zram *zram) {};
@@ -810,6 +883,101 @@ static ssize_t comp_algorithm_store(struct device *dev,
 	return len;
 }
 
+static ssize_t recomp_algorithm_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	size_t sz;
+	struct zram *zram = dev_to_zram(dev);
+
+	down_read(&zram->init_lock);
+	sz = zcomp_available_show(zram->recompressor, buf);
+	up_read(&zram->init_lock);
+
+	return sz;
+}
+
+/*
+ * The secondary algorithm only ever sees idle pages, so it can trade speed
+ * for ratio. An empty string disables recompression.
+ */
+static ssize_t recomp_algorithm_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	char compressor[ARRAY_SIZE(zram->recompressor)];
+	size_t sz;
+
+	strlcpy(compressor, buf, sizeof(compressor));
+	/* ignore trailing newline */
+	sz = strlen(compressor);
+	if (sz > 0 && compressor[sz - 1] == '\n')
+		compressor[sz - 1] = 0x00;
+
+	if (compressor[0] && !zcomp_available_algorithm(compressor))
+		return -EINVAL;
+
+	down_write(&zram->init_lock);
+	if (init_done(zram)) {
+		up_write(&zram->init_lock);
+		pr_info("Can't change algorithm for initialized device\n");
+		return -EBUSY;
+	}
+
+	strcpy(zram->recompressor, compressor);
+	up_write(&zram->init_lock);
+	return len;
+}
+
+/*
+ * Writing "all" marks every stored page idle; the next access to a page
+ * clears the mark again.
+ */
+static ssize_t idle_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	unsigned long nr_pages;
+	u32 index;
+
+	if (!sysfs_streq(buf, "all"))
+		return -EINVAL;
+
+	down_read(&zram->init_lock);
+	if (!init_done(zram)) {
+		up_read(&zram->init_lock);
+		return -EINVAL;
+	}
+
+	nr_pages = zram->disksize >> PAGE_SHIFT;
+	for (index = 0; index < nr_pages; index++) {
+		zram_slot_lock(zram, index);
+		if (zram_allocated(zram, index) &&
+				!zram_test_flag(zram, index, ZRAM_WB))
+			zram_set_flag(zram, index, ZRAM_IDLE);
+		zram_slot_unlock(zram, index);
+		cond_resched();
+	}
+	up_read(&zram->init_lock);
+
+	return len;
+}
+
+static ssize_t recompress_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	ssize_t ret = len;
+
+	down_read(&zram->init_lock);
+	if (!init_done(zram) || (!zram->recomp && !zram_wb_enabled(zram)))
+		ret = -EINVAL;
+	else
+		queue_work(system_unbound_wq, &zram->recomp_work);
+	up_read(&zram->init_lock);
+
+	return ret;
+}
+
 static ssize_t compact_store(struct device *dev,
 		struct device_attribute *attr, const char *buf, size_t len)
 {
@@ -942,10 +1110,16 @@ static bool zram_meta_alloc(struct zram *zram, u64 disksize)
  */
 static void zram_free_page(struct zram *zram, size_t index)
 {
+	struct mem_cgroup *memcg;
 	unsigned long handle;
 
 	zram_reset_access(zram, index);
 
+	zram_clear_flag(zram, index, ZRAM_IDLE);
+	zram_clear_flag(zram, index, ZRAM_RECOMP);
+	zram_clear_flag(zram, index, ZRAM_INCOMPRESSIBLE);
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+
 	if (zram_test_flag(zram, index, ZRAM_HUGE)) {
 		zram_clear_flag(zram, index, ZRAM_HUGE);
 		atomic64_dec(&zram->stats.huge_pages);
@@ -975,6 +1149,13 @@ static void zram_free_page(struct zram *zram, size_t index)
 
 	zs_free(zram->mem_pool, handle);
 
+	memcg = zram_get_memcg(zram, index);
+	if (memcg) {
+		mem_cgroup_uncharge_zram(memcg, zram_get_obj_size(zram, index));
+		mem_cgroup_put(memcg);
+		zram_set_memcg(zram, index, NULL);
+	}
+
 	atomic64_sub(zram_get_obj_size(zram, index),
 			&zram->stats.compr_data_size);
 	atomic64_dec(&zram->stats.pages_stored);
@@ -983,13 +1164,49 @@ static void zram_free_page(struct zram *zram, size_t index)
 	zram_set_obj_size(zram, index, 0);
 }
 
+/*
+ * Decompress the zsmalloc object of @index into @page, with the algorithm
+ * it was stored with. Caller should hold the slot lock.
+ */
+static int zram_read_from_zspool(struct zram *zram, struct page *page,
+				u32 index)
+{
+	struct zcomp *comp;
+	unsigned long handle;
+	unsigned int size;
+	void *src, *dst;
+	int ret;
+
+	handle = zram_get_handle(zram, index);
+	size = zram_get_obj_size(zram, index);
+
+	src = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
+	if (size == PAGE_SIZE) {
+		dst = kmap_atomic(page);
+		memcpy(dst, src, PAGE_SIZE);
+		kunmap_atomic(dst);
+		ret = 0;
+	} else {
+		struct zcomp_strm *zstrm;
+
+		comp = zram_test_flag(zram, index, ZRAM_RECOMP) ?
+				zram->recomp : zram->comp;
+		zstrm = zcomp_stream_get(comp);
+		dst = kmap_atomic(page);
+		ret = zcomp_decompress(zstrm, src, size, dst);
+		kunmap_atomic(dst);
+		zcomp_stream_put(comp);
+	}
+	zs_unmap_object(zram->mem_pool, handle);
+
+	return ret;
+}
+
 static int __zram_bvec_read(struct zram *zram, struct page *page, u32 index,
 				struct bio *bio, bool partial_io)
 {
 	int ret;
 	unsigned long handle;
-	unsigned int size;
-	void *src, *dst;
 
 	if (zram_wb_enabled(zram)) {
 		zram_slot_lock(zram, index);
@@ -1022,23 +1239,7 @@ static int __zram_bvec_read(struct zram *zram, struct page *page, u32 index,
 		return 0;
 	}
 
-	size = zram_get_obj_size(zram, index);
-
-	src = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
-	if (size == PAGE_SIZE) {
-		dst = kmap_atomic(page);
-		memcpy(dst, src, PAGE_SIZE);
-		kunmap_atomic(dst);
-		ret = 0;
-	} else {
-		struct zcomp_strm *zstrm = zcomp_stream_get(zram->comp);
-
-		dst = kmap_atomic(page);
-		ret = zcomp_decompress(zstrm, src, size, dst);
-		kunmap_atomic(dst);
-		zcomp_stream_put(zram->comp);
-	}
-	zs_unmap_object(zram->mem_pool, handle);
+	ret = zram_read_from_zspool(zram, page, index);
 	zram_slot_unlock(zram, index);
 
 	/* Should NEVER happen. Return bio error if it does. */
@@ -1093,6 +1294,7 @@ static int __zram_bvec_write(struct zram *zram, struct bio_vec *bvec,
 	struct page *page = bvec->bv_page;
 	unsigned long element = 0;
 	enum zram_pageflags flags = 0;
+	struct mem_cgroup *memcg = NULL;
 	bool allow_wb = true;
 
 	mem = kmap_atomic(page);
@@ -1172,6 +1374,12 @@ static int __zram_bvec_write(struct zram *zram, struct bio_vec *bvec,
 		return -ENOMEM;
 	}
 
+	if (mem_cgroup_charge_zram(page, comp_len, &memcg)) {
+		zcomp_stream_put(zram->comp);
+		zs_free(zram->mem_pool, handle);
+		return -ENOMEM;
+	}
+
 	dst = zs_map_object(zram->mem_pool, handle, ZS_MM_WO);
 
 	src = zstrm->buffer;
@@ -1203,6 +1411,7 @@ static int __zram_bvec_write(struct zram *zram, struct bio_vec *bvec,
 	}  else {
 		zram_set_handle(zram, index, handle);
 		zram_set_obj_size(zram, index, comp_len);
+		zram_set_memcg(zram, index, memcg);
 	}
 	zram_slot_unlock(zram, index);
 
@@ -1465,9 +1674,122 @@ static int zram_rw_page(struct block_device *bdev, sector_t sector,
 	return ret;
 }
 
+/*
+ * Store the idle page of @index, read into @page, with the secondary
+ * algorithm if that makes it smaller. Caller should hold the slot lock.
+ */
+static void zram_recompress(struct zram *zram, u32 index, struct page *page)
+{
+	unsigned int old_len = zram_get_obj_size(zram, index);
+	struct mem_cgroup *memcg;
+	unsigned int comp_len;
+	unsigned long handle;
+	struct zcomp_strm *zstrm;
+	void *src, *dst;
+	int ret;
+
+	zstrm = zcomp_stream_get(zram->recomp);
+	src = kmap_atomic(page);
+	ret = zcomp_compress(zstrm, src, &comp_len);
+	kunmap_atomic(src);
+
+	if (ret || comp_len >= huge_class_size || comp_len >= old_len) {
+		zcomp_stream_put(zram->recomp);
+		zram_set_flag(zram, index, ZRAM_INCOMPRESSIBLE);
+		return;
+	}
+
+	/* Never stall for memory on behalf of a background pass */
+	handle = zs_malloc(zram->mem_pool, comp_len,
+			__GFP_KSWAPD_RECLAIM |
+			__GFP_NOWARN |
+			__GFP_HIGHMEM |
+			__GFP_MOVABLE);
+	if (!handle) {
+		zcomp_stream_put(zram->recomp);
+		return;
+	}
+
+	dst = zs_map_object(zram->mem_pool, handle, ZS_MM_WO);
+	memcpy(dst, zstrm->buffer, comp_len);
+	zcomp_stream_put(zram->recomp);
+	zs_unmap_object(zram->mem_pool, handle);
+
+	/* The charge stays with the slot, only shrunk to the new size */
+	memcg = zram_get_memcg(zram, index);
+	zram_set_memcg(zram, index, NULL);
+	zram_free_page(zram, index);
+	zram_set_handle(zram, index, handle);
+	zram_set_obj_size(zram, index, comp_len);
+	if (memcg) {
+		mem_cgroup_uncharge_zram(memcg, old_len - comp_len);
+		zram_set_memcg(zram, index, memcg);
+	}
+	zram_set_flag(zram, index, ZRAM_RECOMP);
+	zram_set_flag(zram, index, ZRAM_IDLE);
+	atomic64_add(comp_len, &zram->stats.compr_data_size);
+	atomic64_inc(&zram->stats.pages_stored);
+}
+
+/*
+ * Walk the pages still idle since the last marking: recompress them with the
+ * secondary algorithm, and move those that stay incompressible to the
+ * backing device. Slots are locked one at a time, so the I/O path only ever
+ * waits for a single page.
+ */
+static void zram_recomp_work(struct work_struct *work)
+{
+	struct zram *zram = container_of(work, struct zram, recomp_work);
+	unsigned long nr_pages;
+	struct page *page;
+	u32 index;
+
+	page = alloc_page(GFP_KERNEL);
+	if (!page)
+		return;
+
+	down_read(&zram->init_lock);
+	if (!init_done(zram))
+		goto out;
+
+	nr_pages = zram->disksize >> PAGE_SHIFT;
+	for (index = 0; index < nr_pages; index++) {
+		bool recomp, wb;
+
+		zram_slot_lock(zram, index);
+		if (!zram_get_handle(zram, index) ||
+		    !zram_test_flag(zram, index, ZRAM_IDLE) ||
+		    zram_test_flag(zram, index, ZRAM_SAME) ||
+		    zram_test_flag(zram, index, ZRAM_WB))
+			goto next;
+
+		recomp = zram->recomp &&
+			 !zram_test_flag(zram, index, ZRAM_RECOMP) &&
+			 !zram_test_flag(zram, index, ZRAM_INCOMPRESSIBLE);
+		wb = zram_wb_enabled(zram) &&
+		     zram_test_flag(zram, index, ZRAM_HUGE);
+		if ((!recomp && !wb) ||
+		    zram_read_from_zspool(zram, page, index))
+			goto next;
+
+		if (recomp)
+			zram_recompress(zram, index, page);
+
+		/* Recompression clears ZRAM_HUGE if it helped */
+		if (wb && zram_test_flag(zram, index, ZRAM_HUGE))
+			zram_writeback_slot(zram, index, page);
+next:
+		zram_slot_unlock(zram, index);
+		cond_resched();
+	}
+out:
+	up_read(&zram->init_lock);
+	__free_page(page);
+}
+
 static void zram_reset_device(struct zram *zram)
 {
-	struct zcomp *comp;
+	struct zcomp *comp, *recomp;
 	u64 disksize;
 
 	down_write(&zram->init_lock);
@@ -1480,6 +1802,8 @@ static void zram_reset_device(struct zram *zram)
 	}
 
 	comp = zram->comp;
+	recomp = zram->recomp;
+	zram->recomp = NULL;
 	disksize = zram->disksize;
 	zram->disksize = 0;
 
@@ -1487,10 +1811,14 @@ static void zram_reset_device(struct zram *zram)
 	part_stat_set_all(&zram->disk->part0, 0);
 
 	up_write(&zram->init_lock);
+	/* A queued pass sees the device uninitialized and bails out */
+	flush_work(&zram->recomp_work);
 	/* I/O operation under all of CPU are done so let's free */
 	zram_meta_free(zram, disksize);
 	memset(&zram->stats, 0, sizeof(zram->stats));
 	zcomp_destroy(comp);
+	if (recomp)
+		zcomp_destroy(recomp);
 	reset_bdev(zram);
 }
 
@@ -1498,7 +1826,7 @@ static ssize_t disksize_store(struct device *dev,
 		struct device_attribute *attr, const char *buf, size_t len)
 {
 	u64 disksize;
-	struct zcomp *comp;
+	struct zcomp *comp, *recomp = NULL;
 	struct zram *zram = dev_to_zram(dev);
 	int err;
 
@@ -1527,7 +1855,18 @@ static ssize_t disksize_store(struct device *dev,
 		goto out_free_meta;
 	}
 
+	if (zram->recompressor[0]) {
+		recomp = zcomp_create(zram->recompressor);
+		if (IS_ERR(recomp)) {
+			pr_err("Cannot initialise %s compressing backend\n",
+					zram->recompressor);
+			err = PTR_ERR(recomp);
+			goto out_free_comp;
+		}
+	}
+
 	zram->comp = comp;
+	zram->recomp = recomp;
 	zram->disksize = disksize;
 	set_capacity(zram->disk, zram->disksize >> SECTOR_SHIFT);
 
@@ -1536,6 +1875,8 @@ static ssize_t disksize_store(struct device *dev,
 
 	return len;
 
+out_free_comp:
+	zcomp_destroy(comp);
 out_free_meta:
 	zram_meta_free(zram, disksize);
 out_unlock:
@@ -1618,6 +1959,9 @@ static DEVICE_ATTR_WO(mem_limit);
 static DEVICE_ATTR_WO(mem_used_max);
 static DEVICE_ATTR_RW(max_comp_streams);
 static DEVICE_ATTR_RW(comp_algorithm);
+static DEVICE_ATTR_RW(recomp_algorithm);
+static DEVICE_ATTR_WO(idle);
+static DEVICE_ATTR_WO(recompress);
 #ifdef CONFIG_ZRAM_WRITEBACK
 static DEVICE_ATTR_RW(backing_dev);
 #endif
@@ -1631,6 +1975,9 @@ static struct attribute *zram_disk_attrs[] = {
 	&dev_attr_mem_used_max.attr,
 	&dev_attr_max_comp_streams.attr,
 	&dev_attr_comp_algorithm.attr,
+	&dev_attr_recomp_algorithm.attr,
+	&dev_attr_idle.attr,
+	&dev_attr_recompress.attr,
 #ifdef CONFIG_ZRAM_WRITEBACK
 	&dev_attr_backing_dev.attr,
 #endif
@@ -1669,6 +2016,7 @@ static int zram_add(void)
 	device_id = ret;
 
 	init_rwsem(&zram->init_lock);
+	INIT_WORK(&zram->recomp_work, zram_recomp_work);
 
 	queue = blk_alloc_queue(GFP_KERNEL);
 	if (!queue) {
@@ -1774,6 +2122,8 @@ static int zram_remove(struct zram *zram)
 	pr_info("Removed device: %s\n", zram->disk->disk_name);
 
 	del_gendisk(zram->disk);
+	/* recompress may have queued a pass until its attribute went away */
+	cancel_work_sync(&zram->recomp_work);
 	blk_cleanup_queue(zram->disk->queue);
 	put_disk(zram->disk);
 	kfree(zram);
@@ -16,8 +16,10 @@
 #define _ZRAM_DRV_H_
 
 #include <linux/rwsem.h>
+#include <linux/workqueue.h>
 #include <linux/zsmalloc.h>
 #include <linux/crypto.h>
+#include <linux/memcontrol.h>
 
 #include "zcomp.h"
 
@@ -48,6 +50,10 @@ enum zram_pageflags {
 	ZRAM_SAME,	/* Page consists the same element */
 	ZRAM_WB,	/* page is stored on backing_device */
 	ZRAM_HUGE,	/* Incompressible page */
+	ZRAM_IDLE,	/* not accessed since last idle marking */
+	ZRAM_RECOMP,	/* page is compressed by the secondary algorithm */
+	ZRAM_INCOMPRESSIBLE, /* secondary algorithm gave no gain */
+	ZRAM_UNDER_WB,	/* page is being written to backing_device */
 
 	__NR_ZRAM_PAGEFLAGS,
 };
@@ -64,6 +70,10 @@ struct zram_table_entry {
 #ifdef CONFIG_ZRAM_MEMORY_TRACKING
 	ktime_t ac_time;
 #endif
+#ifdef CONFIG_MEMCG
+	/* memcg the stored object is charged to */
+	struct mem_cgroup *memcg;
+#endif
 };
 
 struct zram_stats {
@@ -86,6 +96,8 @@ struct zram {
 	struct zram_table_entry *table;
 	struct zs_pool *mem_pool;
 	struct zcomp *comp;
+	/* secondary algorithm for idle pages, NULL if not configured */
+	struct zcomp *recomp;
 	struct gendisk *disk;
 	/* Prevent concurrent execution of device init */
 	struct rw_semaphore init_lock;
@@ -101,6 +113,9 @@ struct zram {
 	 */
 	u64 disksize;	/* bytes */
 	char compressor[CRYPTO_MAX_ALG_NAME];
+	char recompressor[CRYPTO_MAX_ALG_NAME];
+	/* recompresses and writes back idle pages off the I/O path */
+	struct work_struct recomp_work;
 	/*
 	 * zram is claimed so open request will be failed
 	 */
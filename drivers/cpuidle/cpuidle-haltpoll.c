@@ -14,6 +14,7 @@
 #include <linux/cpu.h>
 #include <linux/cpuidle.h>
 #include <linux/module.h>
+#include <linux/cpuidle_haltpoll.h>
 #include <linux/sched/idle.h>
 #include <linux/kvm_para.h>
 
@@ -60,6 +61,7 @@ static int haltpoll_cpu_online(unsigned int cpu)
 			pr_notice("cpuidle_register_device %d failed!\n", cpu);
 			return -EIO;
 		}
+		arch_haltpoll_enable(cpu);
 	}
 
 	return 0;
@@ -70,8 +72,10 @@ static int haltpoll_cpu_offline(unsigned int cpu)
 	struct cpuidle_device *dev;
 
 	dev = per_cpu_ptr(haltpoll_cpuidle_devices, cpu);
-	if (dev->registered)
+	if (dev->registered) {
+		arch_haltpoll_disable(cpu);
 		cpuidle_unregister_device(dev);
+	}
 
 	return 0;
 }
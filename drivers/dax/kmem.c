@@ -70,7 +70,8 @@ int dev_dax_kmem_probe(struct device *dev)
 	 */
 	new_res->flags = IORESOURCE_SYSTEM_RAM;
 
-	rc = add_memory(numa_node, new_res->start, resource_size(new_res));
+	rc = add_memory(numa_node, new_res->start, resource_size(new_res),
+			MHP_NONE);
 	if (rc) {
 		release_resource(new_res);
 		kfree(new_res);
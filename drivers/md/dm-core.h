@@ -66,6 +66,9 @@ struct mapped_device {
 	struct work_struct work;
 	wait_queue_head_t wait;
 	atomic_t pending[2];
+	/* bios mapped in place, see dm_remap_bio() */
+	int __percpu *remap_pending;
+	mempool_t remap_io_pool;
 	spinlock_t deferred_lock;
 	struct bio_list deferred;
 
@@ -49,6 +49,7 @@ struct dm_table {
 	bool singleton:1;
 	bool all_blk_mq:1;
 	unsigned integrity_added:1;
+	bool remap_in_place:1;
 
 	/*
 	 * Indicates the rw permissions for the new logical
@@ -1295,6 +1296,30 @@ static int dm_table_register_integrity(struct dm_table *t)
  * Prepares the table for use by building the indices,
  * setting the type, and allocating mempools.
  */
+/* Bio-based tables whose targets all remap data bios in place */
+static bool dm_table_supports_remap_in_place(struct dm_table *t)
+{
+	struct dm_target *ti;
+	unsigned i = 0;
+
+	if (t->type != DM_TYPE_BIO_BASED && t->type != DM_TYPE_DAX_BIO_BASED)
+		return false;
+
+	while (i < dm_table_get_num_targets(t)) {
+		ti = dm_table_get_target(t, i++);
+
+		if (!dm_target_remaps_in_place(ti->type))
+			return false;
+	}
+
+	return true;
+}
+
+bool dm_table_remap_in_place(struct dm_table *t)
+{
+	return t->remap_in_place;
+}
+
 int dm_table_complete(struct dm_table *t)
 {
 	int r;
@@ -1304,6 +1329,7 @@ int dm_table_complete(struct dm_table *t)
 		DMERR("unable to determine table type");
 		return r;
 	}
+	t->remap_in_place = dm_table_supports_remap_in_place(t);
 
 	r = dm_table_build_index(t);
 	if (r) {
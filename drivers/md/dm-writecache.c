@@ -15,6 +15,7 @@
 #include <linux/dax.h>
 #include <linux/pfn_t.h>
 #include <linux/libnvdimm.h>
+#include <linux/blk-cgroup.h>
 
 #define DM_MSG_PREFIX "writecache"
 
@@ -23,6 +24,7 @@
 #define MAX_WRITEBACK_JOBS		0
 #define ENDIO_LATENCY			16
 #define WRITEBACK_LATENCY		64
+#define WC_MAX_CGROUPS			16
 #define AUTOCOMMIT_BLOCKS_SSD		65536
 #define AUTOCOMMIT_BLOCKS_PMEM		64
 #define AUTOCOMMIT_MSEC			1000
@@ -85,7 +87,13 @@ struct wc_entry {
 	;
 	unsigned long index
 #if BITS_PER_LONG == 64
-		:47
+		:43
+#endif
+	;
+	/* slot in dm_writecache.cgroups, 0 if no policy applies */
+	unsigned long cgroup
+#if BITS_PER_LONG == 64
+		:4
 #endif
 	;
 #ifdef DM_WRITECACHE_HANDLE_HARDWARE_ERRORS
@@ -101,6 +109,23 @@ struct wc_entry {
 #define WC_MODE_PMEM(wc)			false
 #define WC_MODE_FUA(wc)				false
 #endif
+
+/*
+ * Admission policy of one blkcg, set with the cgroup_policy message. The
+ * counters of a cleared slot keep running until its last block is gone,
+ * only then it can be reused.
+ */
+struct wc_cgroup {
+	u64 ino;		/* cgroup inode number, 0 if the slot is unused */
+	bool bypass;
+	size_t budget;		/* cache blocks, 0 for no limit */
+	size_t n_blocks;	/* cache blocks held */
+	u64 read_hits;
+	u64 read_misses;
+	u64 write_hits;
+	u64 bypassed;
+	u64 evictions;
+};
 #define WC_MODE_SORT_FREELIST(wc)		(!WC_MODE_PMEM(wc))
 
 struct dm_writecache {
@@ -181,6 +206,10 @@ struct dm_writecache {
 
 	struct bio_set bio_set;
 	mempool_t copy_pool;
+
+	/* slot 0 is unused, entries without a policy point at it */
+	unsigned n_cgroups;
+	struct wc_cgroup cgroups[WC_MAX_CGROUPS];
 };
 
 #define WB_LIST_INLINE		16
@@ -655,8 +684,17 @@ static struct wc_entry *writecache_pop_from_freelist(struct dm_writecache *wc)
 	return e;
 }
 
+static void writecache_uncharge_entry(struct dm_writecache *wc, struct wc_entry *e)
+{
+	if (e->cgroup) {
+		wc->cgroups[e->cgroup].n_blocks--;
+		e->cgroup = 0;
+	}
+}
+
 static void writecache_free_entry(struct dm_writecache *wc, struct wc_entry *e)
 {
+	writecache_uncharge_entry(wc, e);
 	writecache_unlink(wc, e);
 	writecache_add_to_freelist(wc, e);
 	clear_seq_count(wc, e);
@@ -870,6 +908,7 @@ static int writecache_alloc_entries(struct dm_writecache *wc)
 	for (b = 0; b < wc->n_blocks; b++) {
 		struct wc_entry *e = &wc->entries[b];
 		e->index = b;
+		e->cgroup = 0;
 		e->write_in_progress = false;
 	}
 
@@ -930,6 +969,7 @@ static void writecache_resume(struct dm_target *ti)
 	for (b = 0; b < wc->n_blocks; b++) {
 		struct wc_entry *e = &wc->entries[b];
 		if (!writecache_entry_is_committed(wc, e)) {
+			writecache_uncharge_entry(wc, e);
 			if (read_seq_count(wc, e) != -1) {
 erase_this:
 				clear_seq_count(wc, e);
@@ -1014,6 +1054,109 @@ static int process_flush_on_suspend_mesg(unsigned argc, char **argv, struct dm_w
 	return 0;
 }
 
+/* cgroup_policy <cgroup inode> <bypass 0|1> <budget in blocks, 0 for none> */
+static int process_cgroup_policy_mesg(unsigned argc, char **argv, struct dm_writecache *wc)
+{
+	unsigned long long ino, budget;
+	unsigned bypass, i, free_slot = 0;
+	struct wc_cgroup *c;
+	char dummy;
+
+	if (argc != 4)
+		return -EINVAL;
+	if (sscanf(argv[1], "%llu%c", &ino, &dummy) != 1 || !ino)
+		return -EINVAL;
+	if (sscanf(argv[2], "%u%c", &bypass, &dummy) != 1 || bypass > 1)
+		return -EINVAL;
+	if (sscanf(argv[3], "%llu%c", &budget, &dummy) != 1 ||
+	    budget != (size_t)budget)
+		return -EINVAL;
+
+	wc_lock(wc);
+	for (i = 1; i < WC_MAX_CGROUPS; i++) {
+		if (wc->cgroups[i].ino == ino)
+			break;
+		if (!free_slot && !wc->cgroups[i].ino && !wc->cgroups[i].n_blocks)
+			free_slot = i;
+	}
+	if (i == WC_MAX_CGROUPS) {
+		if (!free_slot) {
+			wc_unlock(wc);
+			return -ENOSPC;
+		}
+		i = free_slot;
+		memset(&wc->cgroups[i], 0, sizeof(struct wc_cgroup));
+		wc->cgroups[i].ino = ino;
+		wc->n_cgroups++;
+	}
+	c = &wc->cgroups[i];
+	c->bypass = bypass;
+	c->budget = budget;
+	wc_unlock(wc);
+
+	return 0;
+}
+
+static int process_cgroup_clear_mesg(unsigned argc, char **argv, struct dm_writecache *wc)
+{
+	unsigned long long ino;
+	unsigned i;
+	char dummy;
+
+	if (argc != 2)
+		return -EINVAL;
+	if (sscanf(argv[1], "%llu%c", &ino, &dummy) != 1 || !ino)
+		return -EINVAL;
+
+	wc_lock(wc);
+	for (i = 1; i < WC_MAX_CGROUPS; i++) {
+		if (wc->cgroups[i].ino == ino) {
+			wc->cgroups[i].ino = 0;
+			wc->cgroups[i].bypass = false;
+			wc->cgroups[i].budget = 0;
+			wc->n_cgroups--;
+			break;
+		}
+	}
+	wc_unlock(wc);
+
+	return i == WC_MAX_CGROUPS ? -ENOENT : 0;
+}
+
+/*
+ * One line per cgroup with a policy: inode, bypass, budget, blocks held,
+ * read hits, read misses, write hits, blocks bypassed, blocks evicted.
+ */
+static int process_cgroup_stats_mesg(unsigned argc, char **argv, struct dm_writecache *wc,
+				     char *result, unsigned maxlen)
+{
+	unsigned sz = 0;
+	unsigned i;
+
+	if (argc != 1)
+		return -EINVAL;
+
+	wc_lock(wc);
+	for (i = 1; i < WC_MAX_CGROUPS; i++) {
+		struct wc_cgroup *c = &wc->cgroups[i];
+
+		if (!c->ino)
+			continue;
+		DMEMIT("%llu %u %llu %llu %llu %llu %llu %llu %llu\n",
+		       (unsigned long long)c->ino, c->bypass,
+		       (unsigned long long)c->budget,
+		       (unsigned long long)c->n_blocks,
+		       (unsigned long long)c->read_hits,
+		       (unsigned long long)c->read_misses,
+		       (unsigned long long)c->write_hits,
+		       (unsigned long long)c->bypassed,
+		       (unsigned long long)c->evictions);
+	}
+	wc_unlock(wc);
+
+	return 1;
+}
+
 static int writecache_message(struct dm_target *ti, unsigned argc, char **argv,
 			      char *result, unsigned maxlen)
 {
@@ -1024,6 +1167,12 @@ static int writecache_message(struct dm_target *ti, unsigned argc, char **argv,
 		r = process_flush_mesg(argc, argv, wc);
 	else if (!strcasecmp(argv[0], "flush_on_suspend"))
 		r = process_flush_on_suspend_mesg(argc, argv, wc);
+	else if (!strcasecmp(argv[0], "cgroup_policy"))
+		r = process_cgroup_policy_mesg(argc, argv, wc);
+	else if (!strcasecmp(argv[0], "cgroup_clear"))
+		r = process_cgroup_clear_mesg(argc, argv, wc);
+	else if (!strcasecmp(argv[0], "cgroup_stats"))
+		r = process_cgroup_stats_mesg(argc, argv, wc, result, maxlen);
 	else
 		DMERR("unrecognised message received: %s", argv[0]);
 
@@ -1113,10 +1262,63 @@ static void writecache_offload_bio(struct dm_writecache *wc, struct bio *bio)
 	bio_list_add(&wc->flush_list, bio);
 }
 
+#ifdef CONFIG_BLK_CGROUP
+/* The policy slot of the cgroup that issued @bio, 0 if it has none */
+static unsigned writecache_bio_cgroup(struct dm_writecache *wc, struct bio *bio)
+{
+	struct blkcg *blkcg;
+	u64 ino = 0;
+	unsigned i;
+
+	if (likely(!wc->n_cgroups))
+		return 0;
+
+	rcu_read_lock();
+	blkcg = bio_blkcg(bio);
+	if (blkcg)
+		ino = cgroup_ino(blkcg->css.cgroup);
+	rcu_read_unlock();
+	if (!ino)
+		return 0;
+
+	for (i = 1; i < WC_MAX_CGROUPS; i++)
+		if (wc->cgroups[i].ino == ino)
+			return i;
+	return 0;
+}
+#else
+static unsigned writecache_bio_cgroup(struct dm_writecache *wc, struct bio *bio)
+{
+	return 0;
+}
+#endif
+
+/*
+ * Send a write of a cgroup that is set to bypass, or is over its budget,
+ * to the origin. Blocks that are in the cache already have to be
+ * overwritten there, or their writeback would revert the write later.
+ */
+static bool writecache_cgroup_bypass(struct dm_writecache *wc, struct bio *bio,
+				     unsigned cg)
+{
+	struct wc_cgroup *c = &wc->cgroups[cg];
+	struct wc_entry *e;
+
+	if (!c->bypass && (!c->budget || c->n_blocks < c->budget))
+		return false;
+
+	e = writecache_find_entry(wc, bio->bi_iter.bi_sector, WFE_RETURN_FOLLOWING);
+	if (e && read_original_sector(wc, e) < bio_end_sector(bio))
+		return false;
+
+	return true;
+}
+
 static int writecache_map(struct dm_target *ti, struct bio *bio)
 {
 	struct wc_entry *e;
 	struct dm_writecache *wc = ti->private;
+	unsigned cg;
 
 	bio->bi_private = NULL;
 
@@ -1158,10 +1360,13 @@ static int writecache_map(struct dm_target *ti, struct bio *bio)
 		}
 	}
 
+	cg = writecache_bio_cgroup(wc, bio);
+
 	if (bio_data_dir(bio) == READ) {
 read_next_block:
 		e = writecache_find_entry(wc, bio->bi_iter.bi_sector, WFE_RETURN_FOLLOWING);
 		if (e && read_original_sector(wc, e) == bio->bi_iter.bi_sector) {
+			wc->cgroups[cg].read_hits++;
 			if (WC_MODE_PMEM(wc)) {
 				bio_copy_block(wc, bio, memory_data(wc, e));
 				if (bio->bi_iter.bi_size)
@@ -1176,6 +1381,7 @@ static int writecache_map(struct dm_target *ti, struct bio *bio)
 				goto unlock_remap;
 			}
 		} else {
+			wc->cgroups[cg].read_misses++;
 			if (e) {
 				sector_t next_boundary =
 					read_original_sector(wc, e) - bio->bi_iter.bi_sector;
@@ -1186,14 +1392,22 @@ static int writecache_map(struct dm_target *ti, struct bio *bio)
 			goto unlock_remap_origin;
 		}
 	} else {
+		if (cg && writecache_cgroup_bypass(wc, bio, cg)) {
+			wc->cgroups[cg].bypassed += bio_sectors(bio) >>
+				(wc->block_size_bits - SECTOR_SHIFT);
+			goto unlock_remap_origin;
+		}
 		do {
 			if (writecache_has_error(wc))
 				goto unlock_error;
 			e = writecache_find_entry(wc, bio->bi_iter.bi_sector, 0);
 			if (e) {
-				if (!writecache_entry_is_committed(wc, e))
+				if (!writecache_entry_is_committed(wc, e)) {
+					wc->cgroups[cg].write_hits++;
 					goto bio_copy;
+				}
 				if (!WC_MODE_PMEM(wc) && !e->write_in_progress) {
+					wc->cgroups[cg].write_hits++;
 					wc->overwrote_committed = true;
 					goto bio_copy;
 				}
@@ -1203,6 +1417,10 @@ static int writecache_map(struct dm_target *ti, struct bio *bio)
 				writecache_wait_on_freelist(wc);
 				continue;
 			}
+			if (cg) {
+				e->cgroup = cg;
+				wc->cgroups[cg].n_blocks++;
+			}
 			write_original_sector_seq_count(wc, e, bio->bi_iter.bi_sector, wc->seq_count);
 			writecache_insert_entry(wc, e);
 			wc->uncommitted_blocks++;
@@ -1341,8 +1559,10 @@ static void __writecache_endio_pmem(struct dm_writecache *wc, struct list_head *
 			BUG_ON(!e->write_in_progress);
 			e->write_in_progress = false;
 			INIT_LIST_HEAD(&e->lru);
-			if (!writecache_has_error(wc))
+			if (!writecache_has_error(wc)) {
+				wc->cgroups[e->cgroup].evictions++;
 				writecache_free_entry(wc, e);
+			}
 			BUG_ON(!wc->writeback_size);
 			wc->writeback_size--;
 			n_walked++;
@@ -1377,8 +1597,10 @@ static void __writecache_endio_ssd(struct dm_writecache *wc, struct list_head *l
 			BUG_ON(!e->write_in_progress);
 			e->write_in_progress = false;
 			INIT_LIST_HEAD(&e->lru);
-			if (!writecache_has_error(wc))
+			if (!writecache_has_error(wc)) {
+				wc->cgroups[e->cgroup].evictions++;
 				writecache_free_entry(wc, e);
+			}
 
 			BUG_ON(!wc->writeback_size);
 			wc->writeback_size--;
@@ -2284,7 +2506,7 @@ static void writecache_status(struct dm_target *ti, status_type_t type,
 
 static struct target_type writecache_target = {
 	.name			= "writecache",
-	.version		= {1, 1, 1},
+	.version		= {1, 2, 0},
 	.module			= THIS_MODULE,
 	.ctr			= writecache_ctr,
 	.dtr			= writecache_dtr,
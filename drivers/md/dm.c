@@ -1687,6 +1687,91 @@ static blk_qc_t __process_bio(struct mapped_device *md,
 	return ret;
 }
 
+struct dm_remap_io {
+	struct mapped_device *md;
+	bio_end_io_t *orig_end_io;
+	void *orig_private;
+	struct gendisk *orig_disk;
+	u8 orig_partno;
+	unsigned long start_time;
+};
+
+static void remap_endio(struct bio *bio)
+{
+	struct dm_remap_io *rio = bio->bi_private;
+	struct mapped_device *md = rio->md;
+
+	bio->bi_end_io = rio->orig_end_io;
+	bio->bi_private = rio->orig_private;
+	bio->bi_disk = rio->orig_disk;
+	bio->bi_partno = rio->orig_partno;
+
+	generic_end_io_acct(md->queue, bio_op(bio), &dm_disk(md)->part0,
+			    rio->start_time);
+	mempool_free(rio, &md->remap_io_pool);
+
+	this_cpu_dec(*md->remap_pending);
+	/* nudge anyone waiting on suspend queue */
+	if (wq_has_sleeper(&md->wait))
+		wake_up(&md->wait);
+
+	bio_endio(bio);
+}
+
+/*
+ * Linear and striped tables only move a data bio to another sector of one
+ * of their devices, so do that on the bio itself rather than on a clone
+ * when it stays within one target and chunk. The in-flight count is per
+ * cpu, it's only summed up by suspend.
+ */
+static bool dm_remap_bio(struct mapped_device *md, struct dm_table *map,
+			 struct bio *bio)
+{
+	sector_t sector = bio->bi_iter.bi_sector;
+	struct dm_remap_io *rio;
+	struct dm_target *ti;
+
+	if (!map || !dm_table_remap_in_place(map) ||
+	    (bio_op(bio) != REQ_OP_READ && bio_op(bio) != REQ_OP_WRITE) ||
+	    (bio->bi_opf & REQ_PREFLUSH) || !bio_sectors(bio) ||
+	    unlikely(dm_stats_used(&md->stats)))
+		return false;
+
+	ti = dm_table_find_target(map, sector);
+	if (!dm_target_is_valid(ti) ||
+	    max_io_len(sector, ti) < bio_sectors(bio))
+		return false;
+
+	rio = mempool_alloc(&md->remap_io_pool, GFP_NOIO);
+	rio->md = md;
+	rio->orig_end_io = bio->bi_end_io;
+	rio->orig_private = bio->bi_private;
+	rio->orig_disk = bio->bi_disk;
+	rio->orig_partno = bio->bi_partno;
+	rio->start_time = jiffies;
+
+	generic_start_io_acct(md->queue, bio_op(bio), bio_sectors(bio),
+			      &dm_disk(md)->part0);
+	this_cpu_inc(*md->remap_pending);
+
+	bio->bi_end_io = remap_endio;
+	bio->bi_private = rio;
+	ti->type->map(ti, bio);
+	trace_block_bio_remap(bio->bi_disk->queue, bio,
+			      disk_devt(dm_disk(md)), sector);
+	generic_make_request(bio);
+	return true;
+}
+
+static bool md_remap_in_flight(struct mapped_device *md)
+{
+	int cpu, sum = 0;
+
+	for_each_possible_cpu(cpu)
+		sum += *per_cpu_ptr(md->remap_pending, cpu);
+	return sum != 0;
+}
+
 static blk_qc_t dm_process_bio(struct mapped_device *md,
 			       struct dm_table *map, struct bio *bio)
 {
@@ -1718,7 +1803,8 @@ static blk_qc_t dm_make_request(struct request_queue *q, struct bio *bio)
 		return ret;
 	}
 
-	ret = dm_process_bio(md, map, bio);
+	if (!dm_remap_bio(md, map, bio))
+		ret = dm_process_bio(md, map, bio);
 
 	dm_put_live_table(md, srcu_idx);
 	return ret;
@@ -1903,6 +1989,8 @@ static void cleanup_mapped_device(struct mapped_device *md)
 		kthread_stop(md->kworker_task);
 	bioset_exit(&md->bs);
 	bioset_exit(&md->io_bs);
+	mempool_exit(&md->remap_io_pool);
+	free_percpu(md->remap_pending);
 
 	if (md->dax_dev) {
 		kill_dax(md->dax_dev);
@@ -1999,6 +2087,13 @@ static struct mapped_device *alloc_dev(int minor)
 
 	atomic_set(&md->pending[0], 0);
 	atomic_set(&md->pending[1], 0);
+	md->remap_pending = alloc_percpu(int);
+	if (!md->remap_pending)
+		goto bad;
+	if (mempool_init_kmalloc_pool(&md->remap_io_pool,
+				      RESERVED_BIO_BASED_IOS,
+				      sizeof(struct dm_remap_io)))
+		goto bad;
 	init_waitqueue_head(&md->wait);
 	INIT_WORK(&md->work, dm_wq_work);
 	init_waitqueue_head(&md->eventq);
@@ -2471,7 +2566,7 @@ static int dm_wait_for_completion(struct mapped_device *md, long task_state)
 	while (1) {
 		prepare_to_wait(&md->wait, &wait, task_state);
 
-		if (!md_in_flight(md))
+		if (!md_in_flight(md) && !md_remap_in_flight(md))
 			break;
 
 		if (signal_pending_state(task_state, current)) {
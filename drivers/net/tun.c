@@ -2369,18 +2369,112 @@ static void tun_sock_write_space(struct sock *sk)
 	kill_fasync(&tfile->fasync, SIGIO, POLL_OUT);
 }
 
+/* Build an skb around a packet built by vhost-net in an xdp_buff and receive
+ * it, called with bh disabled and under rcu_read_lock. */
+static void tun_xdp_one(struct tun_struct *tun, struct tun_file *tfile,
+			struct xdp_buff *xdp)
+{
+	struct tun_xdp_hdr *hdr = xdp->data_hard_start;
+	struct tun_pcpu_stats *stats;
+	struct bpf_prog *xdp_prog;
+	struct sk_buff *skb;
+	u32 rxhash = 0;
+	int len;
+
+	skb = build_skb(xdp->data_hard_start, hdr->buflen);
+	if (!skb) {
+		put_page(virt_to_head_page(xdp->data));
+		this_cpu_inc(tun->pcpu_stats->rx_dropped);
+		return;
+	}
+
+	skb_reserve(skb, xdp->data - xdp->data_hard_start);
+	skb_put(skb, xdp->data_end - xdp->data);
+
+	if (virtio_net_hdr_to_skb(skb, &hdr->gso, tun_is_little_endian(tun))) {
+		this_cpu_inc(tun->pcpu_stats->rx_frame_errors);
+		kfree_skb(skb);
+		return;
+	}
+
+	if (tun->flags & IFF_TAP) {
+		skb->protocol = eth_type_trans(skb, tun->dev);
+	} else {
+		/* Without IFF_NO_PI the packet info would have been taken
+		 * for the vnet header, so only IFF_NO_PI can be batched. */
+		u8 ip_version = skb->len ? (skb->data[0] >> 4) : 0;
+
+		if (!(tun->flags & IFF_NO_PI) ||
+		    (ip_version != 4 && ip_version != 6)) {
+			this_cpu_inc(tun->pcpu_stats->rx_dropped);
+			kfree_skb(skb);
+			return;
+		}
+		skb_reset_mac_header(skb);
+		skb->protocol = ip_version == 4 ? htons(ETH_P_IP) :
+						  htons(ETH_P_IPV6);
+		skb->dev = tun->dev;
+	}
+
+	skb_reset_network_header(skb);
+	skb_probe_transport_header(skb, 0);
+
+	xdp_prog = rcu_dereference(tun->xdp_prog);
+	if (xdp_prog && do_xdp_generic(xdp_prog, skb) != XDP_PASS)
+		return;
+
+	if (unlikely(!(tun->dev->flags & IFF_UP))) {
+		this_cpu_inc(tun->pcpu_stats->rx_dropped);
+		kfree_skb(skb);
+		return;
+	}
+
+	if (!rcu_access_pointer(tun->steering_prog) && tun->numqueues > 1 &&
+	    !tfile->detached)
+		rxhash = __skb_get_hash_symmetric(skb);
+
+	len = skb->len;
+	netif_receive_skb(skb);
+
+	stats = this_cpu_ptr(tun->pcpu_stats);
+	u64_stats_update_begin(&stats->syncp);
+	stats->rx_packets++;
+	stats->rx_bytes += len;
+	u64_stats_update_end(&stats->syncp);
+
+	if (rxhash)
+		tun_flow_update(tun, rxhash, tfile);
+}
+
 static int tun_sendmsg(struct socket *sock, struct msghdr *m, size_t total_len)
 {
-	int ret;
+	int ret, i;
 	struct tun_file *tfile = container_of(sock, struct tun_file, socket);
 	struct tun_struct *tun = tun_get(tfile);
+	struct tun_msg_ctl *ctl = m->msg_control;
 
 	if (!tun)
 		return -EBADFD;
 
-	ret = tun_get_user(tun, tfile, m->msg_control, &m->msg_iter,
+	if (ctl && ctl->type == TUN_MSG_PTR) {
+		struct xdp_buff *xdp = ctl->ptr;
+
+		local_bh_disable();
+		rcu_read_lock();
+		for (i = 0; i < ctl->num; i++)
+			tun_xdp_one(tun, tfile, &xdp[i]);
+		rcu_read_unlock();
+		local_bh_enable();
+
+		ret = total_len;
+		goto out;
+	}
+
+	ret = tun_get_user(tun, tfile, ctl && ctl->type == TUN_MSG_UBUF ?
+			   ctl->ptr : NULL, &m->msg_iter,
 			   m->msg_flags & MSG_DONTWAIT,
 			   m->msg_flags & MSG_MORE);
+out:
 	tun_put(tun);
 	return ret;
 }
@@ -68,12 +68,20 @@ module_param(force_xdp, bool, 0644);
 /* Amount of XDP headroom to prepend to packets for use by xdp_adjust_head */
 #define VIRTIO_XDP_HEADROOM 256
 
+/* Largest mergeable buffer with XDP, half of a frag page (32K) so that
+ * jumbo frames still fit in a single buffer.
+ */
+#define VIRTIO_XDP_MAX_BUF max_t(unsigned long, PAGE_SIZE, 32768 / 2)
+
 /* Separating two types of XDP xmit */
 #define VIRTIO_XDP_TX		BIT(0)
 #define VIRTIO_XDP_REDIR	BIT(1)
 
 #define VIRTIO_XDP_FLAG	BIT(0)
 
+/* Frag pages still referenced by skbs, kept per RX queue for reuse */
+#define VIRTNET_RECYCLE_PAGES	8
+
 /* RX packet size EWMA. The average packet size is used to determine the packet
  * buffer size when refilling RX rings. As the entire RX ring may be refilled
  * at once, the weight is chosen so that the EWMA will be insensitive to short-
@@ -233,6 +241,10 @@ struct receive_queue {
 	/* Page frag for packet buffer allocation. */
 	struct page_frag alloc_frag;
 
+	/* Retired frag pages, reused once the stack released them. */
+	struct page *recycle[VIRTNET_RECYCLE_PAGES];
+	unsigned int recycle_next;
+
 	/* RX: fragments + linear part + virtio header */
 	struct scatterlist sg[MAX_SKB_FRAGS + 2];
 
@@ -729,8 +741,11 @@ static struct page *xdp_linearize_page(struct receive_queue *rq,
 				       int page_off,
 				       unsigned int *len)
 {
-	struct page *page = alloc_page(GFP_ATOMIC);
+	/* A scattered packet may be a jumbo frame */
+	unsigned int order = *num_buf > 1 ? get_order(VIRTIO_XDP_MAX_BUF) : 0;
+	struct page *page;
 
+	page = alloc_pages(GFP_ATOMIC | __GFP_COMP | __GFP_NOWARN, order);
 	if (!page)
 		return NULL;
 
@@ -753,7 +768,7 @@ static struct page *xdp_linearize_page(struct receive_queue *rq,
 		/* guard against a misconfigured or uncooperative backend that
 		 * is sending packet larger than the MTU.
 		 */
-		if ((page_off + buflen + tailroom) > PAGE_SIZE) {
+		if ((page_off + buflen + tailroom) > (PAGE_SIZE << order)) {
 			put_page(p);
 			goto err_buf;
 		}
@@ -768,7 +783,7 @@ static struct page *xdp_linearize_page(struct receive_queue *rq,
 	*len = page_off - VIRTIO_XDP_HEADROOM;
 	return page;
 err_buf:
-	__free_pages(page, 0);
+	__free_pages(page, order);
 	return NULL;
 }
 
@@ -1012,7 +1027,9 @@ static struct sk_buff *receive_mergeable(struct net_device *dev,
 				put_page(page);
 				head_skb = page_to_skb(vi, rq, xdp_page,
 						       offset, len,
-						       PAGE_SIZE, false);
+						       PAGE_SIZE <<
+						       compound_order(xdp_page),
+						       false);
 				return head_skb;
 			}
 			break;
@@ -1054,7 +1071,7 @@ static struct sk_buff *receive_mergeable(struct net_device *dev,
 			/* fall through */
 		case XDP_DROP:
 			if (unlikely(xdp_page != page))
-				__free_pages(xdp_page, 0);
+				put_page(xdp_page);
 			goto err_xdp;
 		}
 	}
@@ -1212,6 +1229,73 @@ static void receive_buf(struct virtnet_info *vi, struct receive_queue *rq,
 	dev_kfree_skb(skb);
 }
 
+/* Keep our reference on a frag page the stack still uses, dropping the
+ * oldest one kept when the ring is full.
+ */
+static void virtnet_park_page(struct receive_queue *rq, struct page *page)
+{
+	unsigned int i = rq->recycle_next;
+
+	if (rq->recycle[i])
+		put_page(rq->recycle[i]);
+	rq->recycle[i] = page;
+	rq->recycle_next = (i + 1) % VIRTNET_RECYCLE_PAGES;
+}
+
+/* A kept page of @sz bytes at least all skbs are done with */
+static struct page *virtnet_reuse_page(struct receive_queue *rq,
+				       unsigned int sz)
+{
+	struct page *page;
+	int i;
+
+	for (i = 0; i < VIRTNET_RECYCLE_PAGES; i++) {
+		page = rq->recycle[i];
+		if (page && page_ref_count(page) == 1 &&
+		    (PAGE_SIZE << compound_order(page)) >= sz) {
+			rq->recycle[i] = NULL;
+			return page;
+		}
+	}
+
+	return NULL;
+}
+
+/* Like skb_page_frag_refill(), but a page which is full while skbs still
+ * hold fragments of it is kept instead of released. At 10M pps their skbs
+ * are usually freed within a few refills, so most refills reuse a page
+ * and never reach the page allocator.
+ */
+static bool virtnet_page_frag_refill(struct receive_queue *rq,
+				     unsigned int sz, gfp_t gfp)
+{
+	struct page_frag *pfrag = &rq->alloc_frag;
+	struct page *page;
+
+	if (pfrag->page) {
+		if (page_ref_count(pfrag->page) == 1)
+			pfrag->offset = 0;
+		if (pfrag->offset + sz <= pfrag->size)
+			return true;
+		virtnet_park_page(rq, pfrag->page);
+		pfrag->page = NULL;
+	}
+
+	page = virtnet_reuse_page(rq, sz);
+	if (page) {
+		pfrag->page = page;
+		pfrag->offset = 0;
+		pfrag->size = PAGE_SIZE << compound_order(page);
+		return true;
+	}
+
+	if (!skb_page_frag_refill(sz, pfrag, gfp))
+		return false;
+
+	/* XDP jumbo buffers don't fit the order-0 fallback */
+	return pfrag->offset + sz <= pfrag->size;
+}
+
 /* Unlike mergeable buffers, all buffers are allocated to the
  * same size, except for the headroom. For this reason we do
  * not need to use  mergeable_len_to_ctx here - it is enough
@@ -1229,7 +1313,7 @@ static int add_recvbuf_small(struct virtnet_info *vi, struct receive_queue *rq,
 
 	len = SKB_DATA_ALIGN(len) +
 	      SKB_DATA_ALIGN(sizeof(struct skb_shared_info));
-	if (unlikely(!skb_page_frag_refill(len, alloc_frag, gfp)))
+	if (unlikely(!virtnet_page_frag_refill(rq, len, gfp)))
 		return -ENOMEM;
 
 	buf = (char *)page_address(alloc_frag->page) + alloc_frag->offset;
@@ -1299,8 +1383,15 @@ static unsigned int get_mergeable_buf_len(struct receive_queue *rq,
 	const size_t hdr_len = sizeof(struct virtio_net_hdr_mrg_rxbuf);
 	unsigned int len;
 
-	if (room)
-		return PAGE_SIZE - room;
+	/* With XDP a frame must not span buffers, size them for the MTU */
+	if (room) {
+		struct virtnet_info *vi = rq->vq->vdev->priv;
+
+		len = ALIGN(hdr_len + ETH_HLEN + VLAN_HLEN + vi->dev->mtu,
+			    L1_CACHE_BYTES);
+		return clamp_t(unsigned int, len, PAGE_SIZE - room,
+			       VIRTIO_XDP_MAX_BUF - room);
+	}
 
 	len = hdr_len +	clamp_t(unsigned int, ewma_pkt_len_read(avg_pkt_len),
 				rq->min_buf_len, PAGE_SIZE - hdr_len);
@@ -1325,7 +1416,7 @@ static int add_recvbuf_mergeable(struct virtnet_info *vi,
 	 * disabled GSO for XDP, it won't be a big issue.
 	 */
 	len = get_mergeable_buf_len(rq, &rq->mrg_avg_pkt_len, room);
-	if (unlikely(!skb_page_frag_refill(len + room, alloc_frag, gfp)))
+	if (unlikely(!virtnet_page_frag_refill(rq, len + room, gfp)))
 		return -ENOMEM;
 
 	buf = (char *)page_address(alloc_frag->page) + alloc_frag->offset;
@@ -1675,6 +1766,7 @@ static int virtnet_open(struct net_device *dev)
 		err = xdp_rxq_info_reg(&vi->rq[i].xdp_rxq, dev, i);
 		if (err < 0)
 			return err;
+		vi->rq[i].xdp_rxq.napi_id = vi->rq[i].napi.napi_id;
 
 		err = xdp_rxq_info_reg_mem_model(&vi->rq[i].xdp_rxq,
 						 MEM_TYPE_PAGE_SHARED, NULL);
@@ -2564,6 +2656,8 @@ static int virtnet_xdp_set(struct net_device *dev, struct bpf_prog *prog,
 {
 	unsigned long int max_sz = PAGE_SIZE - sizeof(struct padded_vnet_hdr);
 	struct virtnet_info *vi = netdev_priv(dev);
+	unsigned int room = SKB_DATA_ALIGN(VIRTIO_XDP_HEADROOM +
+					   sizeof(struct skb_shared_info));
 	struct bpf_prog *old_prog;
 	u16 xdp_qp = 0, curr_qp;
 	int i, err;
@@ -2583,6 +2677,12 @@ static int virtnet_xdp_set(struct net_device *dev, struct bpf_prog *prog,
 		return -EINVAL;
 	}
 
+	/* Mergeable buffers grow with the MTU, see get_mergeable_buf_len() */
+	if (vi->mergeable_rx_bufs)
+		max_sz = VIRTIO_XDP_MAX_BUF - room -
+			 sizeof(struct virtio_net_hdr_mrg_rxbuf) -
+			 ETH_HLEN - VLAN_HLEN;
+
 	if (dev->mtu > max_sz) {
 		NL_SET_ERR_MSG_MOD(extack, "MTU too large to enable XDP");
 		netdev_warn(dev, "XDP requires MTU less than %lu\n", max_sz);
@@ -2954,6 +3054,11 @@ static int virtnet_xsk_run(struct send_queue *sq,
 	if (!err) {
 		struct xdp_desc desc;
 
+		/* Set while we still own the ring, a sendto() racing with
+		 * the clear_bit is caught by the check below.
+		 */
+		if (xsk_umem_uses_need_wakeup(umem))
+			xsk_set_tx_need_wakeup(umem);
 		clear_bit(VIRTNET_XSK_TXNAPI_RUNNING, &sq->xsk.state);
 
 		/* Memory barrier make sure xsk_umem_consume_tx must come after
@@ -2972,6 +3077,8 @@ static int virtnet_xsk_run(struct send_queue *sq,
 
 		/* this after if check, so memory barrier is no needed. */
 		set_bit(VIRTNET_XSK_TXNAPI_RUNNING, &sq->xsk.state);
+		if (xsk_umem_uses_need_wakeup(umem))
+			xsk_clear_tx_need_wakeup(umem);
 
 		sq->xsk.last_desc = desc;
 		ret = budget;
@@ -3046,6 +3153,10 @@ static int virtnet_xsk_wakeup(struct net_device *dev, u32 qid)
 	if (test_and_set_bit(VIRTNET_XSK_TXNAPI_RUNNING, &sq->xsk.state))
 		goto end;
 
+	/* NAPI and the timer own the Tx ring until it drains again */
+	if (xsk_umem_uses_need_wakeup(umem))
+		xsk_clear_tx_need_wakeup(umem);
+
 	txq = netdev_get_tx_queue(dev, qid);
 
 	local_bh_disable();
@@ -3209,10 +3320,14 @@ static void free_receive_bufs(struct virtnet_info *vi)
 
 static void free_receive_page_frags(struct virtnet_info *vi)
 {
-	int i;
-	for (i = 0; i < vi->max_queue_pairs; i++)
+	int i, j;
+	for (i = 0; i < vi->max_queue_pairs; i++) {
 		if (vi->rq[i].alloc_frag.page)
 			put_page(vi->rq[i].alloc_frag.page);
+		for (j = 0; j < VIRTNET_RECYCLE_PAGES; j++)
+			if (vi->rq[i].recycle[j])
+				put_page(vi->rq[i].recycle[j]);
+	}
 }
 
 static void free_unused_bufs(struct virtnet_info *vi)
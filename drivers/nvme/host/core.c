@@ -679,6 +679,8 @@ void nvme_cleanup_cmd(struct request *req)
 		else
 			kfree(page_address(page) + req->special_vec.bv_offset);
 	}
+	if (nvme_req(req)->flags & NVME_MPATH_IO_STATS)
+		nvme_mpath_end_request(req);
 }
 EXPORT_SYMBOL_GPL(nvme_cleanup_cmd);
 
@@ -712,6 +714,8 @@ blk_status_t nvme_setup_cmd(struct nvme_ns *ns, struct request *req,
 	}
 
 	cmd->common.command_id = req->tag;
+	if (!ret && (req->cmd_flags & REQ_NVME_MPATH))
+		nvme_mpath_start_request(req);
 	trace_nvme_setup_cmd(req, cmd);
 	return ret;
 }
@@ -1054,7 +1058,7 @@ static struct nvme_id_ns *nvme_identify_ns(struct nvme_ctrl *ctrl,
 	return id;
 }
 
-static int nvme_set_features(struct nvme_ctrl *dev, unsigned fid, unsigned dword11,
+int nvme_set_features(struct nvme_ctrl *dev, unsigned fid, unsigned dword11,
 		      void *buffer, size_t buflen, u32 *result)
 {
 	struct nvme_command c;
@@ -1072,6 +1076,7 @@ static int nvme_set_features(struct nvme_ctrl *dev, unsigned fid, unsigned dword
 		*result = le32_to_cpu(res.u32);
 	return ret;
 }
+EXPORT_SYMBOL_GPL(nvme_set_features);
 
 int nvme_set_queue_count(struct nvme_ctrl *ctrl, int *count)
 {
@@ -2243,6 +2248,9 @@ static struct attribute *nvme_subsys_attrs[] = {
 	&subsys_attr_serial.attr,
 	&subsys_attr_firmware_rev.attr,
 	&subsys_attr_subsysnqn.attr,
+#ifdef CONFIG_NVME_MULTIPATH
+	&subsys_attr_iopolicy.attr,
+#endif
 	NULL,
 };
 
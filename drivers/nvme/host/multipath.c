@@ -173,10 +173,54 @@ static inline bool nvme_path_is_optimized(struct nvme_ns *ns)
 		ns->ana_state == NVME_ANA_OPTIMIZED;
 }
 
+/*
+ * Pick the usable path with the lowest cost, optimized paths before
+ * non-optimized ones.  The cost is the number of requests in flight on the
+ * controller, for service-time weighted by its average completion latency
+ * as dm-service-time does.  Only atomics and plain reads here, the
+ * accounting is done as requests are set up and cleaned up.
+ */
+static struct nvme_ns *nvme_least_busy_path(struct nvme_ns_head *head,
+		enum nvme_iopolicy iopolicy)
+{
+	struct nvme_ns *ns, *best = NULL;
+	u64 cost, best_cost = 0;
+
+	list_for_each_entry_rcu(ns, &head->list, siblings) {
+		if (ns->ctrl->state != NVME_CTRL_LIVE ||
+		    test_bit(NVME_NS_ANA_PENDING, &ns->flags))
+			continue;
+		if (ns->ana_state != NVME_ANA_OPTIMIZED &&
+		    ns->ana_state != NVME_ANA_NONOPTIMIZED)
+			continue;
+		if (best && best->ana_state == NVME_ANA_OPTIMIZED &&
+		    ns->ana_state != NVME_ANA_OPTIMIZED)
+			continue;
+
+		cost = atomic_read(&ns->ctrl->nr_active);
+		if (iopolicy == NVME_IOPOLICY_ST)
+			cost = (cost + 1) * READ_ONCE(ns->ctrl->mpath_lat);
+
+		if (!best || cost < best_cost ||
+		    (ns->ana_state == NVME_ANA_OPTIMIZED &&
+		     best->ana_state != NVME_ANA_OPTIMIZED)) {
+			best = ns;
+			best_cost = cost;
+		}
+	}
+
+	return best;
+}
+
 inline struct nvme_ns *nvme_find_path(struct nvme_ns_head *head)
 {
-	struct nvme_ns *ns = srcu_dereference(head->current_path, &head->srcu);
+	enum nvme_iopolicy iopolicy = READ_ONCE(head->subsys->iopolicy);
+	struct nvme_ns *ns;
 
+	if (iopolicy != NVME_IOPOLICY_FAILOVER)
+		return nvme_least_busy_path(head, iopolicy);
+
+	ns = srcu_dereference(head->current_path, &head->srcu);
 	if (unlikely(!ns || !nvme_path_is_optimized(ns)))
 		ns = __nvme_find_path(head);
 	return ns;
@@ -459,6 +503,77 @@ void nvme_mpath_stop(struct nvme_ctrl *ctrl)
 	cancel_work_sync(&ctrl->ana_work);
 }
 
+/* Weight of a new latency sample in the average, as a power of two */
+#define NVME_MPATH_LAT_SHIFT	3
+
+void nvme_mpath_start_request(struct request *rq)
+{
+	struct nvme_ns *ns = rq->q->queuedata;
+
+	if (READ_ONCE(ns->head->subsys->iopolicy) == NVME_IOPOLICY_FAILOVER ||
+	    (nvme_req(rq)->flags & NVME_MPATH_IO_STATS))
+		return;
+
+	atomic_inc(&ns->ctrl->nr_active);
+	nvme_req(rq)->start_time = ktime_get_ns();
+	nvme_req(rq)->flags |= NVME_MPATH_IO_STATS;
+}
+
+void nvme_mpath_end_request(struct request *rq)
+{
+	struct nvme_ns *ns = rq->q->queuedata;
+	u64 lat, avg;
+
+	nvme_req(rq)->flags &= ~NVME_MPATH_IO_STATS;
+	atomic_dec(&ns->ctrl->nr_active);
+
+	/* Requests failed before or by the controller say little of the path */
+	if (!blk_mq_request_started(rq) || nvme_req(rq)->status)
+		return;
+
+	/* Concurrent updates may drop a sample, the average absorbs that */
+	lat = ktime_get_ns() - nvme_req(rq)->start_time;
+	avg = READ_ONCE(ns->ctrl->mpath_lat);
+	WRITE_ONCE(ns->ctrl->mpath_lat, avg - (avg >> NVME_MPATH_LAT_SHIFT) +
+		   (lat >> NVME_MPATH_LAT_SHIFT));
+}
+
+static const char *nvme_iopolicy_names[] = {
+	[NVME_IOPOLICY_FAILOVER]	= "failover",
+	[NVME_IOPOLICY_QD]		= "queue-depth",
+	[NVME_IOPOLICY_ST]		= "service-time",
+};
+
+static ssize_t nvme_subsys_iopolicy_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct nvme_subsystem *subsys =
+		container_of(dev, struct nvme_subsystem, dev);
+
+	return sprintf(buf, "%s\n",
+			nvme_iopolicy_names[READ_ONCE(subsys->iopolicy)]);
+}
+
+static ssize_t nvme_subsys_iopolicy_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct nvme_subsystem *subsys =
+		container_of(dev, struct nvme_subsystem, dev);
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(nvme_iopolicy_names); i++) {
+		if (sysfs_streq(buf, nvme_iopolicy_names[i])) {
+			WRITE_ONCE(subsys->iopolicy, i);
+			return count;
+		}
+	}
+
+	return -EINVAL;
+}
+struct device_attribute subsys_attr_iopolicy =
+	__ATTR(iopolicy, S_IRUGO | S_IWUSR, nvme_subsys_iopolicy_show,
+	       nvme_subsys_iopolicy_store);
+
 static ssize_t ana_grpid_show(struct device *dev, struct device_attribute *attr,
 		char *buf)
 {
@@ -89,6 +89,18 @@ static int poll_queues = 0;
 module_param_cb(poll_queues, &queue_count_ops, &poll_queues, 0644);
 MODULE_PARM_DESC(poll_queues, "Number of queues to use for polled IO.");
 
+static unsigned int irq_coalesce_interval;
+module_param(irq_coalesce_interval, uint, 0644);
+MODULE_PARM_DESC(irq_coalesce_interval,
+	"Interval in ms at which interrupt coalescing is tuned to the observed "
+	"load, applied at the next controller reset. Use 0 to disable.");
+
+/*
+ * Queues completing fewer commands per second than this, or with no more
+ * than one in flight, take an interrupt for each completion.
+ */
+#define NVME_COALESCE_MIN_IOPS	10000
+
 struct nvme_dev;
 struct nvme_queue;
 
@@ -108,6 +120,10 @@ struct nvme_dev {
 	unsigned online_queues;
 	unsigned max_qid;
 	unsigned io_queues[HCTX_MAX_TYPES];
+	unsigned int nr_allocated_queues;
+	unsigned int nr_io_queues;
+	unsigned int nr_poll_queues;
+	unsigned int max_hw_queues;
 	unsigned int num_vecs;
 	int q_depth;
 	u32 db_stride;
@@ -138,6 +154,12 @@ struct nvme_dev {
 	dma_addr_t host_mem_descs_dma;
 	struct nvme_host_mem_buf_desc *host_mem_descs;
 	void **host_mem_desc_bufs;
+
+	/* interrupt coalescing auto-tuning: */
+	struct delayed_work coalesce_work;
+	unsigned long coalesce_stamp;
+	u32 irq_coalesce;
+	bool coalesce_unsupported;
 };
 
 static int io_queue_depth_set(const char *val, const struct kernel_param *kp)
@@ -204,6 +226,10 @@ struct nvme_queue {
 	u16 qid;
 	u8 cq_phase;
 	u8 polled;
+	u8 coalesce_off;
+	unsigned long nr_cqes;
+	unsigned long last_nr_cqes;
+	unsigned int inflight;
 	u32 *dbbuf_sq_db;
 	u32 *dbbuf_cq_db;
 	u32 *dbbuf_sq_ei;
@@ -254,6 +280,11 @@ static unsigned int max_io_queues(void)
 	return num_possible_cpus() + write_queues + poll_queues;
 }
 
+static unsigned int nvme_max_io_queues(struct nvme_dev *dev)
+{
+	return num_possible_cpus() + write_queues + dev->nr_poll_queues;
+}
+
 static unsigned int max_queue_count(void)
 {
 	/* IO queues + admin queue */
@@ -1062,6 +1093,9 @@ static irqreturn_t nvme_irq(int irq, void *data)
 		ret = IRQ_HANDLED;
 	nvme_process_cq(nvmeq, &start, &end, -1);
 	nvmeq->last_cq_head = nvmeq->cq_head;
+	if (start != end)
+		nvmeq->nr_cqes += end > start ? end - start :
+				  end + nvmeq->q_depth - start;
 	spin_unlock(&nvmeq->cq_lock);
 
 	if (start != end) {
@@ -1109,6 +1143,10 @@ static int nvme_poll_noirq(struct blk_mq_hw_ctx *hctx, unsigned int tag)
 	u16 start, end;
 	bool found;
 
+	/* Poll queues can be removed at runtime, leaving only irq driven ones */
+	if (!nvmeq->polled)
+		return __nvme_poll(nvmeq, tag);
+
 	if (!nvme_cqe_pending(nvmeq))
 		return 0;
 
@@ -1803,6 +1841,136 @@ static ssize_t nvme_cmb_show(struct device *dev,
 }
 static DEVICE_ATTR(cmb, S_IRUGO, nvme_cmb_show, NULL);
 
+/* Poll queues always are the highest queue identifiers */
+static int nvme_add_poll_queues(struct nvme_dev *dev, unsigned int nr)
+{
+	unsigned int i, qid;
+	int ret = 0;
+
+	for (i = 0; i < nr; i++) {
+		qid = dev->online_queues;
+		ret = nvme_alloc_queue(dev, qid, dev->q_depth);
+		if (ret)
+			break;
+		ret = nvme_create_queue(&dev->queues[qid], qid, true);
+		if (ret) {
+			nvme_free_queues(dev, qid);
+			break;
+		}
+	}
+
+	dev->io_queues[HCTX_TYPE_POLL] += i;
+	dev->max_qid = dev->online_queues - 1;
+	blk_mq_update_nr_hw_queues(&dev->tagset, dev->online_queues - 1);
+
+	/* As at reset, failing Create SQ/CQ commands leave us with fewer */
+	return ret >= 0 ? 0 : ret;
+}
+
+static int nvme_remove_poll_queues(struct nvme_dev *dev, unsigned int nr)
+{
+	unsigned int qid;
+	int ret = 0;
+
+	/* Freezing the request queues drains the poll queues going away */
+	dev->io_queues[HCTX_TYPE_POLL] -= nr;
+	blk_mq_update_nr_hw_queues(&dev->tagset, dev->online_queues - 1 - nr);
+
+	for (qid = dev->online_queues - 1; nr; nr--, qid--) {
+		nvme_suspend_queue(&dev->queues[qid]);
+		ret = adapter_delete_sq(dev, qid);
+		if (!ret)
+			ret = adapter_delete_cq(dev, qid);
+		if (ret)
+			break;
+	}
+
+	dev->max_qid = dev->online_queues - 1;
+	nvme_free_queues(dev, dev->online_queues);
+	return ret > 0 ? -EIO : ret;
+}
+
+/*
+ * Change the number of poll queues without resetting the controller. The
+ * queues set up at reset are kept, poll queues are created or deleted on
+ * top of them within the queues granted by the controller at reset.
+ */
+static int nvme_set_poll_queues(struct nvme_dev *dev, unsigned int nr)
+{
+	unsigned int cur, irq_queues, max;
+	int ret = 0;
+
+	if (dev->ctrl.state != NVME_CTRL_LIVE || !dev->ctrl.tagset)
+		return -EBUSY;
+	/* Keeps resets and other resizes away while queues are changed */
+	if (!nvme_change_ctrl_state(&dev->ctrl, NVME_CTRL_RESETTING))
+		return -EBUSY;
+
+	dev->nr_poll_queues = nr;
+	cur = dev->io_queues[HCTX_TYPE_POLL];
+	irq_queues = dev->online_queues - 1 - cur;
+
+	max = min3(dev->nr_io_queues, dev->max_hw_queues,
+		   dev->nr_allocated_queues - 1);
+	max = max > irq_queues ? max - irq_queues : 0;
+	/* The CMB only has room for the submission queues set up at reset */
+	if (dev->cmb && use_cmb_sqes && (dev->cmbsz & NVME_CMBSZ_SQS))
+		max = min(max, cur);
+	nr = min(nr, max);
+
+	if (nr > cur)
+		ret = nvme_add_poll_queues(dev, nr - cur);
+	else if (nr < cur)
+		ret = nvme_remove_poll_queues(dev, cur - nr);
+
+	/* A timeout may have disabled the controller under us */
+	if (!ret && !dev->online_queues)
+		ret = -EIO;
+	if (ret) {
+		dev_warn(dev->ctrl.device,
+			 "failed to change poll queues (%d), resetting\n", ret);
+		queue_work(nvme_reset_wq, &dev->ctrl.reset_work);
+		return ret;
+	}
+
+	dev_info(dev->ctrl.device, "%d/%d/%d default/read/poll queues\n",
+					dev->io_queues[HCTX_TYPE_DEFAULT],
+					dev->io_queues[HCTX_TYPE_READ],
+					dev->io_queues[HCTX_TYPE_POLL]);
+	nvme_change_ctrl_state(&dev->ctrl, NVME_CTRL_LIVE);
+	return 0;
+}
+
+static ssize_t nvme_poll_queues_show(struct device *dev,
+				     struct device_attribute *attr,
+				     char *buf)
+{
+	struct nvme_dev *ndev = to_nvme_dev(dev_get_drvdata(dev));
+
+	return scnprintf(buf, PAGE_SIZE, "%u\n",
+			 ndev->io_queues[HCTX_TYPE_POLL]);
+}
+
+static ssize_t nvme_poll_queues_store(struct device *dev,
+				      struct device_attribute *attr,
+				      const char *buf, size_t count)
+{
+	struct nvme_dev *ndev = to_nvme_dev(dev_get_drvdata(dev));
+	unsigned int nr;
+	int ret;
+
+	ret = kstrtouint(buf, 10, &nr);
+	if (ret)
+		return ret;
+	if (nr > num_possible_cpus())
+		nr = num_possible_cpus();
+
+	ret = nvme_set_poll_queues(ndev, nr);
+	return ret ? ret : count;
+}
+static DEVICE_ATTR(poll_queues, S_IRUGO | S_IWUSR, nvme_poll_queues_show,
+		   nvme_poll_queues_store);
+
 static u64 nvme_cmb_size_unit(struct nvme_dev *dev)
 {
 	u8 szu = (dev->cmbsz >> NVME_CMBSZ_SZU_SHIFT) & NVME_CMBSZ_SZU_MASK;
@@ -2103,7 +2271,7 @@ static int nvme_setup_irqs(struct nvme_dev *dev, unsigned int nr_io_queues)
 	 * Poll queues don't need interrupts, but we need at least one IO
 	 * queue left over for non-polled IO.
 	 */
-	this_p_queues = poll_queues;
+	this_p_queues = dev->nr_poll_queues;
 	if (this_p_queues >= nr_io_queues) {
 		this_p_queues = nr_io_queues - 1;
 		irq_queues = 1;
@@ -2166,7 +2334,11 @@ static int nvme_setup_io_queues(struct nvme_dev *dev)
 	int result, nr_io_queues;
 	unsigned long size;
 
-	nr_io_queues = max_io_queues();
+	/*
+	 * Ask for all the queues we have room for, the ones not used now are
+	 * left for poll queues added at runtime.
+	 */
+	nr_io_queues = dev->nr_allocated_queues - 1;
 	result = nvme_set_queue_count(&dev->ctrl, &nr_io_queues);
 	if (result < 0)
 		return result;
@@ -2175,7 +2347,8 @@ static int nvme_setup_io_queues(struct nvme_dev *dev)
 		return 0;
 
 	if (dev->cmb && (dev->cmbsz & NVME_CMBSZ_SQS)) {
-		result = nvme_cmb_qdepth(dev, nr_io_queues,
+		result = nvme_cmb_qdepth(dev,
+				min(nr_io_queues, (int)nvme_max_io_queues(dev)),
 				sizeof(struct nvme_command));
 		if (result > 0)
 			dev->q_depth = result;
@@ -2192,6 +2365,7 @@ static int nvme_setup_io_queues(struct nvme_dev *dev)
 			return -ENOMEM;
 	} while (1);
 	adminq->q_db = dev->dbs;
+	dev->nr_io_queues = nr_io_queues;
 
 	/* Deregister the admin queue's interrupt */
 	pci_free_irq(pdev, 0, adminq);
@@ -2202,7 +2376,8 @@ static int nvme_setup_io_queues(struct nvme_dev *dev)
 	 */
 	pci_free_irq_vectors(pdev);
 
-	result = nvme_setup_irqs(dev, nr_io_queues);
+	result = nvme_setup_irqs(dev, min(nr_io_queues,
+					  (int)nvme_max_io_queues(dev)));
 	if (result <= 0)
 		return -EIO;
 
@@ -2320,6 +2495,8 @@ static int nvme_dev_add(struct nvme_dev *dev)
 			dev->tagset.ops = &nvme_mq_poll_noirq_ops;
 
 		dev->tagset.nr_hw_queues = dev->online_queues - 1;
+		dev->max_hw_queues = max_t(unsigned int,
+					   dev->tagset.nr_hw_queues, nr_cpu_ids);
 		dev->tagset.nr_maps = HCTX_MAX_TYPES;
 		dev->tagset.timeout = NVME_IO_TIMEOUT;
 		dev->tagset.numa_node = dev_to_node(dev->dev);
@@ -2436,6 +2613,8 @@ static void nvme_dev_disable(struct nvme_dev *dev, bool shutdown)
 	bool dead = true;
 	struct pci_dev *pdev = to_pci_dev(dev->dev);
 
+	cancel_delayed_work(&dev->coalesce_work);
+
 	mutex_lock(&dev->shutdown_lock);
 	if (pci_is_enabled(pdev)) {
 		u32 csts = readl(dev->bar + NVME_REG_CSTS);
@@ -2522,6 +2701,124 @@ static void nvme_pci_free_ctrl(struct nvme_ctrl *ctrl)
 	kfree(dev);
 }
 
+static void nvme_count_inflight(struct request *req, void *data,
+				bool reserved)
+{
+	struct nvme_iod *iod = blk_mq_rq_to_pdu(req);
+
+	iod->nvmeq->inflight++;
+}
+
+/*
+ * Interrupt coalescing (feature 08h) is a single controller wide setting,
+ * so it is sized for the average busy queue: wait for half the commands it
+ * has in flight, but no longer than a quarter of their estimated latency.
+ * Vectors of the other queues opt out of it (feature 09h) so that lightly
+ * loaded queues keep their latency.
+ */
+static void nvme_coalesce_work(struct work_struct *work)
+{
+	struct nvme_dev *dev = container_of(to_delayed_work(work),
+					    struct nvme_dev, coalesce_work);
+	unsigned int interval = READ_ONCE(irq_coalesce_interval);
+	unsigned int i, elapsed, nr_busy = 0, depth = 0;
+	unsigned long iops, total_iops = 0;
+	u32 thr, time, value = 0;
+	bool busy;
+	int ret;
+
+	if (!interval || dev->ctrl.state != NVME_CTRL_LIVE)
+		return;
+
+	elapsed = max(jiffies_to_msecs(jiffies - dev->coalesce_stamp), 1U);
+	dev->coalesce_stamp = jiffies;
+
+	for (i = 1; i < dev->online_queues; i++)
+		dev->queues[i].inflight = 0;
+	blk_mq_tagset_busy_iter(&dev->tagset, nvme_count_inflight, NULL);
+
+	for (i = 1; i < dev->online_queues; i++) {
+		struct nvme_queue *nvmeq = &dev->queues[i];
+		unsigned long nr_cqes = READ_ONCE(nvmeq->nr_cqes);
+
+		iops = (nr_cqes - nvmeq->last_nr_cqes) * MSEC_PER_SEC / elapsed;
+		nvmeq->last_nr_cqes = nr_cqes;
+		if (nvmeq->polled || iops < NVME_COALESCE_MIN_IOPS ||
+		    nvmeq->inflight <= 1) {
+			nvmeq->inflight = 0;
+			continue;
+		}
+		nr_busy++;
+		depth += nvmeq->inflight;
+		total_iops += iops;
+	}
+
+	if (nr_busy) {
+		depth /= nr_busy;
+		iops = total_iops / nr_busy;
+		/* Aggregation threshold is 0's based, time in 100us units */
+		thr = clamp(depth / 2, 1U, 256U) - 1;
+		time = min_t(unsigned long, depth * 10000 / (4 * iops), 255);
+		value = thr | time << 8;
+	}
+
+	if (value != dev->irq_coalesce) {
+		ret = nvme_set_features(&dev->ctrl, NVME_FEAT_IRQ_COALESCE,
+					value, NULL, 0, NULL);
+		if (ret)
+			goto out_error;
+		dev->irq_coalesce = value;
+	}
+
+	/* With a single vector the admin queue shares it with all I/O */
+	for (i = 1; dev->num_vecs > 1 && i < dev->online_queues; i++) {
+		struct nvme_queue *nvmeq = &dev->queues[i];
+
+		if (nvmeq->polled)
+			continue;
+		busy = nvmeq->inflight != 0;
+		if (nvmeq->coalesce_off == !busy)
+			continue;
+		ret = nvme_set_features(&dev->ctrl, NVME_FEAT_IRQ_CONFIG,
+					nvmeq->cq_vector | (busy ? 0 : 1 << 16),
+					NULL, 0, NULL);
+		if (ret)
+			goto out_error;
+		nvmeq->coalesce_off = !busy;
+	}
+
+	queue_delayed_work(nvme_wq, &dev->coalesce_work,
+			   msecs_to_jiffies(interval));
+	return;
+
+ out_error:
+	/* Errors other than an NVMe status are left to the reset handling */
+	if (ret > 0) {
+		dev_info(dev->ctrl.device,
+			 "interrupt coalescing not supported (%d)\n", ret);
+		dev->coalesce_unsupported = true;
+	}
+}
+
+static void nvme_start_coalesce(struct nvme_dev *dev)
+{
+	unsigned int i;
+
+	if (!irq_coalesce_interval || dev->coalesce_unsupported ||
+	    !dev->ctrl.tagset)
+		return;
+
+	/* The reset put the controller back to its defaults */
+	dev->irq_coalesce = U32_MAX;
+	for (i = 1; i < dev->online_queues; i++) {
+		dev->queues[i].coalesce_off = false;
+		dev->queues[i].last_nr_cqes = dev->queues[i].nr_cqes;
+	}
+	dev->coalesce_stamp = jiffies;
+	queue_delayed_work(nvme_wq, &dev->coalesce_work,
+			   msecs_to_jiffies(irq_coalesce_interval));
+}
+
 static void nvme_remove_dead_ctrl(struct nvme_dev *dev, int status)
 {
 	dev_warn(dev->ctrl.device, "Removing after probe failure status: %d\n", status);
@@ -2647,6 +2944,7 @@ static void nvme_reset_work(struct work_struct *work)
 	}
 
 	nvme_start_ctrl(&dev->ctrl);
+	nvme_start_coalesce(dev);
 	return;
 
  out_unlock:
@@ -2773,8 +3071,11 @@ static int nvme_probe(struct pci_dev *pdev, const struct pci_device_id *id)
 	if (!dev)
 		return -ENOMEM;
 
-	dev->queues = kcalloc_node(max_queue_count(), sizeof(struct nvme_queue),
-					GFP_KERNEL, node);
+	/* Leave room for up to one poll queue per CPU added through sysfs */
+	dev->nr_allocated_queues = max_queue_count() + num_possible_cpus();
+	dev->nr_poll_queues = poll_queues;
+	dev->queues = kcalloc_node(dev->nr_allocated_queues,
+				   sizeof(struct nvme_queue), GFP_KERNEL, node);
 	if (!dev->queues)
 		goto free;
 
@@ -2787,6 +3088,7 @@ static int nvme_probe(struct pci_dev *pdev, const struct pci_device_id *id)
 
 	INIT_WORK(&dev->ctrl.reset_work, nvme_reset_work);
 	INIT_WORK(&dev->remove_work, nvme_remove_dead_ctrl_work);
+	INIT_DELAYED_WORK(&dev->coalesce_work, nvme_coalesce_work);
 	mutex_init(&dev->shutdown_lock);
 	init_completion(&dev->ioq_wait);
 
@@ -2820,6 +3122,11 @@ static int nvme_probe(struct pci_dev *pdev, const struct pci_device_id *id)
 
 	dev_info(dev->ctrl.device, "pci function %s\n", dev_name(&pdev->dev));
 
+	if (sysfs_add_file_to_group(&dev->ctrl.device->kobj,
+				    &dev_attr_poll_queues.attr, NULL))
+		dev_warn(dev->ctrl.device,
+			 "failed to add sysfs attribute for poll queues\n");
+
 	nvme_reset_ctrl(&dev->ctrl);
 	nvme_get_ctrl(&dev->ctrl);
 	async_schedule(nvme_async_probe, dev);
@@ -2869,6 +3176,8 @@ static void nvme_remove(struct pci_dev *pdev)
 
 	nvme_change_ctrl_state(&dev->ctrl, NVME_CTRL_DELETING);
 	pci_set_drvdata(pdev, NULL);
+	sysfs_remove_file_from_group(&dev->ctrl.device->kobj,
+				     &dev_attr_poll_queues.attr, NULL);
 
 	if (!pci_device_is_present(pdev)) {
 		nvme_change_ctrl_state(&dev->ctrl, NVME_CTRL_DEAD);
@@ -2877,6 +3186,7 @@ static void nvme_remove(struct pci_dev *pdev)
 	}
 
 	flush_work(&dev->ctrl.reset_work);
+	cancel_delayed_work_sync(&dev->coalesce_work);
 	nvme_stop_ctrl(&dev->ctrl);
 	nvme_remove_namespaces(&dev->ctrl);
 	nvme_dev_disable(dev, true);
@@ -187,12 +187,14 @@ EXPORT_SYMBOL_GPL(vhost_work_init);
 
 /* Init poll structure */
 void vhost_poll_init(struct vhost_poll *poll, vhost_work_fn_t fn,
-		     __poll_t mask, struct vhost_dev *dev)
+		     __poll_t mask, struct vhost_dev *dev,
+		     struct vhost_virtqueue *vq)
 {
 	init_waitqueue_func_entry(&poll->wait, vhost_poll_wakeup);
 	init_poll_funcptr(&poll->table, vhost_poll_func);
 	poll->mask = mask;
 	poll->dev = dev;
+	poll->vq = vq;
 	poll->wqh = NULL;
 
 	vhost_work_init(&poll->work, fn);
@@ -232,17 +234,41 @@ void vhost_poll_stop(struct vhost_poll *poll)
 }
 EXPORT_SYMBOL_GPL(vhost_poll_stop);
 
-void vhost_work_flush(struct vhost_dev *dev, struct vhost_work *work)
+static void vhost_worker_queue(struct vhost_worker *worker,
+			       struct vhost_work *work)
+{
+	if (!test_and_set_bit(VHOST_WORK_QUEUED, &work->flags)) {
+		/* We can only add the work to the list after we're
+		 * sure it was not in the list.
+		 * test_and_set_bit() implies a memory barrier.
+		 */
+		llist_add(&work->node, &worker->work_list);
+		wake_up_process(worker->task);
+	}
+}
+
+static void vhost_worker_flush(struct vhost_worker *worker)
 {
 	struct vhost_flush_struct flush;
 
-	if (dev->worker) {
-		init_completion(&flush.wait_event);
-		vhost_work_init(&flush.work, vhost_flush_work);
+	init_completion(&flush.wait_event);
+	vhost_work_init(&flush.work, vhost_flush_work);
 
-		vhost_work_queue(dev, &flush.work);
-		wait_for_completion(&flush.wait_event);
-	}
+	vhost_worker_queue(worker, &flush.work);
+	wait_for_completion(&flush.wait_event);
+}
+
+/* The worker of @vq only changes under the device mutex, which flushers
+ * hold unless the device is being released. */
+static struct vhost_worker *vhost_vq_worker(struct vhost_virtqueue *vq)
+{
+	return rcu_dereference_protected(vq->worker, 1);
+}
+
+void vhost_work_flush(struct vhost_dev *dev, struct vhost_work *work)
+{
+	if (dev->worker)
+		vhost_worker_flush(dev->worker);
 }
 EXPORT_SYMBOL_GPL(vhost_work_flush);
 
@@ -250,7 +276,16 @@ EXPORT_SYMBOL_GPL(vhost_work_flush);
  * locks that are also used by the callback. */
 void vhost_poll_flush(struct vhost_poll *poll)
 {
-	vhost_work_flush(poll->dev, &poll->work);
+	struct vhost_worker *worker;
+
+	if (!poll->vq) {
+		vhost_work_flush(poll->dev, &poll->work);
+		return;
+	}
+
+	worker = vhost_vq_worker(poll->vq);
+	if (worker)
+		vhost_worker_flush(worker);
 }
 EXPORT_SYMBOL_GPL(vhost_poll_flush);
 
@@ -259,27 +294,45 @@ void vhost_work_queue(struct vhost_dev *dev, struct vhost_work *work)
 	if (!dev->worker)
 		return;
 
-	if (!test_and_set_bit(VHOST_WORK_QUEUED, &work->flags)) {
-		/* We can only add the work to the list after we're
-		 * sure it was not in the list.
-		 * test_and_set_bit() implies a memory barrier.
-		 */
-		llist_add(&work->node, &dev->work_list);
-		wake_up_process(dev->worker);
-	}
+	vhost_worker_queue(dev->worker, work);
 }
 EXPORT_SYMBOL_GPL(vhost_work_queue);
 
+/* Queue @work on the worker @vq is attached to */
+void vhost_vq_work_queue(struct vhost_virtqueue *vq, struct vhost_work *work)
+{
+	struct vhost_worker *worker;
+
+	rcu_read_lock();
+	worker = rcu_dereference(vq->worker);
+	if (worker)
+		vhost_worker_queue(worker, work);
+	rcu_read_unlock();
+}
+EXPORT_SYMBOL_GPL(vhost_vq_work_queue);
+
 /* A lockless hint for busy polling code to exit the loop */
-bool vhost_has_work(struct vhost_dev *dev)
+bool vhost_vq_has_work(struct vhost_virtqueue *vq)
 {
-	return !llist_empty(&dev->work_list);
+	struct vhost_worker *worker;
+	bool has_work = false;
+
+	rcu_read_lock();
+	worker = rcu_dereference(vq->worker);
+	if (worker && !llist_empty(&worker->work_list))
+		has_work = true;
+	rcu_read_unlock();
+
+	return has_work;
 }
-EXPORT_SYMBOL_GPL(vhost_has_work);
+EXPORT_SYMBOL_GPL(vhost_vq_has_work);
 
 void vhost_poll_queue(struct vhost_poll *poll)
 {
-	vhost_work_queue(poll->dev, &poll->work);
+	if (poll->vq)
+		vhost_vq_work_queue(poll->vq, &poll->work);
+	else
+		vhost_work_queue(poll->dev, &poll->work);
 }
 EXPORT_SYMBOL_GPL(vhost_poll_queue);
 
@@ -325,6 +378,10 @@ static void vhost_vq_reset(struct vhost_dev *dev,
 	vhost_reset_is_le(vq);
 	vhost_disable_cross_endian(vq);
 	vq->busyloop_timeout = 0;
+	vq->busyloop_polls = 0;
+	vq->busyloop_hits = 0;
+	vq->busyloop_breaks = 0;
+	vq->busyloop_time = 0;
 	vq->umem = NULL;
 	vq->iotlb = NULL;
 	__vhost_vq_meta_reset(vq);
@@ -332,7 +389,8 @@ static void vhost_vq_reset(struct vhost_dev *dev,
 
 static int vhost_worker(void *data)
 {
-	struct vhost_dev *dev = data;
+	struct vhost_worker *worker = data;
+	struct vhost_dev *dev = worker->dev;
 	struct vhost_work *work, *work_next;
 	struct llist_node *node;
 	mm_segment_t oldfs = get_fs();
@@ -349,7 +407,7 @@ static int vhost_worker(void *data)
 			break;
 		}
 
-		node = llist_del_all(&dev->work_list);
+		node = llist_del_all(&worker->work_list);
 		if (!node)
 			schedule();
 
@@ -446,7 +504,8 @@ void vhost_dev_init(struct vhost_dev *dev,
 	dev->iov_limit = iov_limit;
 	dev->weight = weight;
 	dev->byte_weight = byte_weight;
-	init_llist_head(&dev->work_list);
+	dev->msg_handler = NULL;
+	idr_init(&dev->worker_idr);
 	init_waitqueue_head(&dev->wait);
 	INIT_LIST_HEAD(&dev->read_list);
 	INIT_LIST_HEAD(&dev->pending_list);
@@ -459,11 +518,12 @@ void vhost_dev_init(struct vhost_dev *dev,
 		vq->indirect = NULL;
 		vq->heads = NULL;
 		vq->dev = dev;
+		RCU_INIT_POINTER(vq->worker, NULL);
 		mutex_init(&vq->mutex);
 		vhost_vq_reset(dev, vq);
 		if (vq->handle_kick)
 			vhost_poll_init(&vq->poll, vq->handle_kick,
-					EPOLLIN, dev);
+					EPOLLIN, dev, vq);
 	}
 }
 EXPORT_SYMBOL_GPL(vhost_dev_init);
@@ -490,17 +550,140 @@ static void vhost_attach_cgroups_work(struct vhost_work *work)
 	s->ret = cgroup_attach_task_all(s->owner, current);
 }
 
-static int vhost_attach_cgroups(struct vhost_dev *dev)
+static int vhost_attach_cgroups(struct vhost_worker *worker)
 {
 	struct vhost_attach_cgroups_struct attach;
 
 	attach.owner = current;
 	vhost_work_init(&attach.work, vhost_attach_cgroups_work);
-	vhost_work_queue(dev, &attach.work);
-	vhost_work_flush(dev, &attach.work);
+	vhost_worker_queue(worker, &attach.work);
+	vhost_worker_flush(worker);
 	return attach.ret;
 }
 
+/* Caller should have device mutex */
+static struct vhost_worker *vhost_worker_create(struct vhost_dev *dev)
+{
+	struct vhost_worker *worker;
+	struct task_struct *task;
+	int id, ret;
+
+	worker = kzalloc(sizeof(*worker), GFP_KERNEL_ACCOUNT);
+	if (!worker)
+		return ERR_PTR(-ENOMEM);
+
+	worker->dev = dev;
+	init_llist_head(&worker->work_list);
+
+	id = idr_alloc(&dev->worker_idr, worker, 0, 0, GFP_KERNEL);
+	if (id < 0) {
+		ret = id;
+		goto err_idr;
+	}
+	worker->id = id;
+
+	task = kthread_create(vhost_worker, worker, "vhost-%d", current->pid);
+	if (IS_ERR(task)) {
+		ret = PTR_ERR(task);
+		goto err_task;
+	}
+
+	worker->task = task;
+	wake_up_process(task);	/* avoid contributing to loadavg */
+
+	ret = vhost_attach_cgroups(worker);
+	if (ret)
+		goto err_cgroup;
+
+	return worker;
+err_cgroup:
+	kthread_stop(task);
+err_task:
+	idr_remove(&dev->worker_idr, id);
+err_idr:
+	kfree(worker);
+	return ERR_PTR(ret);
+}
+
+static void vhost_worker_destroy(struct vhost_dev *dev,
+				 struct vhost_worker *worker)
+{
+	WARN_ON(!llist_empty(&worker->work_list));
+	idr_remove(&dev->worker_idr, worker->id);
+	kthread_stop(worker->task);
+	kfree(worker);
+}
+
+/* Caller should have device mutex, polling must have been stopped */
+static void vhost_workers_free(struct vhost_dev *dev)
+{
+	struct vhost_worker *worker;
+	int i, id;
+
+	for (i = 0; i < dev->nvqs; ++i)
+		RCU_INIT_POINTER(dev->vqs[i]->worker, NULL);
+
+	idr_for_each_entry(&dev->worker_idr, worker, id)
+		vhost_worker_destroy(dev, worker);
+	idr_destroy(&dev->worker_idr);
+	dev->worker = NULL;
+}
+
+/* Caller should have device mutex, but not the vq mutex */
+static void vhost_vq_attach_worker(struct vhost_virtqueue *vq,
+				   struct vhost_worker *worker)
+{
+	struct vhost_worker *old = vhost_vq_worker(vq);
+
+	if (old == worker)
+		return;
+
+	worker->attachment_cnt++;
+	rcu_assign_pointer(vq->worker, worker);
+	if (!old)
+		return;
+
+	/* Work queued on the old worker before the switch must be done
+	 * before the vq handlers can run on the new one. */
+	synchronize_rcu();
+	vhost_worker_flush(old);
+	old->attachment_cnt--;
+}
+
+static long vhost_new_worker(struct vhost_dev *dev, void __user *argp)
+{
+	struct vhost_worker_state state;
+	struct vhost_worker *worker;
+
+	worker = vhost_worker_create(dev);
+	if (IS_ERR(worker))
+		return PTR_ERR(worker);
+
+	state.worker_id = worker->id;
+	if (copy_to_user(argp, &state, sizeof(state)))
+		return -EFAULT;
+	return 0;
+}
+
+static long vhost_free_worker(struct vhost_dev *dev, void __user *argp)
+{
+	struct vhost_worker_state state;
+	struct vhost_worker *worker;
+
+	if (copy_from_user(&state, argp, sizeof(state)))
+		return -EFAULT;
+
+	worker = idr_find(&dev->worker_idr, state.worker_id);
+	if (!worker)
+		return -ENODEV;
+	/* The default worker stays until the owner goes away */
+	if (worker == dev->worker || worker->attachment_cnt)
+		return -EBUSY;
+
+	vhost_worker_destroy(dev, worker);
+	return 0;
+}
+
 /* Caller should have device mutex */
 bool vhost_dev_has_owner(struct vhost_dev *dev)
 {
@@ -511,8 +694,8 @@ EXPORT_SYMBOL_GPL(vhost_dev_has_owner);
 /* Caller should have device mutex */
 long vhost_dev_set_owner(struct vhost_dev *dev)
 {
-	struct task_struct *worker;
-	int err;
+	struct vhost_worker *worker;
+	int i, err;
 
 	/* Is there an owner already? */
 	if (vhost_dev_has_owner(dev)) {
@@ -522,27 +705,23 @@ long vhost_dev_set_owner(struct vhost_dev *dev)
 
 	/* No owner, become one */
 	dev->mm = get_task_mm(current);
-	worker = kthread_create(vhost_worker, dev, "vhost-%d", current->pid);
+	worker = vhost_worker_create(dev);
 	if (IS_ERR(worker)) {
 		err = PTR_ERR(worker);
 		goto err_worker;
 	}
 
 	dev->worker = worker;
-	wake_up_process(worker);	/* avoid contributing to loadavg */
-
-	err = vhost_attach_cgroups(dev);
-	if (err)
-		goto err_cgroup;
+	for (i = 0; i < dev->nvqs; ++i)
+		vhost_vq_attach_worker(dev->vqs[i], worker);
 
 	err = vhost_dev_alloc_iovecs(dev);
 	if (err)
-		goto err_cgroup;
+		goto err_iovecs;
 
 	return 0;
-err_cgroup:
-	kthread_stop(worker);
-	dev->worker = NULL;
+err_iovecs:
+	vhost_workers_free(dev);
 err_worker:
 	if (dev->mm)
 		mmput(dev->mm);
@@ -654,11 +833,7 @@ void vhost_dev_cleanup(struct vhost_dev *dev)
 	dev->iotlb = NULL;
 	vhost_clear_msg(dev);
 	wake_up_interruptible_poll(&dev->wait, EPOLLIN | EPOLLRDNORM);
-	WARN_ON(!llist_empty(&dev->work_list));
-	if (dev->worker) {
-		kthread_stop(dev->worker);
-		dev->worker = NULL;
-	}
+	vhost_workers_free(dev);
 	if (dev->mm)
 		mmput(dev->mm);
 	dev->mm = NULL;
@@ -1083,7 +1258,11 @@ ssize_t vhost_chr_write_iter(struct vhost_dev *dev,
 		ret = -EINVAL;
 		goto done;
 	}
-	if (vhost_process_iotlb_msg(dev, &msg)) {
+	if (dev->msg_handler)
+		ret = dev->msg_handler(dev, &msg);
+	else
+		ret = vhost_process_iotlb_msg(dev, &msg);
+	if (ret) {
 		ret = -EFAULT;
 		goto done;
 	}
@@ -1406,6 +1585,36 @@ static long vhost_set_memory(struct vhost_dev *d, struct vhost_memory __user *m)
 	return -EFAULT;
 }
 
+/* Caller should have device mutex */
+static long vhost_vring_worker_ioctl(struct vhost_virtqueue *vq, u32 idx,
+				     unsigned int ioctl, void __user *argp)
+{
+	struct vhost_vring_worker w;
+	struct vhost_worker *worker;
+
+	switch (ioctl) {
+	case VHOST_ATTACH_VRING_WORKER:
+		if (copy_from_user(&w, argp, sizeof(w)))
+			return -EFAULT;
+		worker = idr_find(&vq->dev->worker_idr, w.worker_id);
+		if (!worker)
+			return -ENODEV;
+		vhost_vq_attach_worker(vq, worker);
+		return 0;
+	case VHOST_GET_VRING_WORKER:
+		worker = vhost_vq_worker(vq);
+		if (!worker)
+			return -ENODEV;
+		w.index = idx;
+		w.worker_id = worker->id;
+		if (copy_to_user(argp, &w, sizeof(w)))
+			return -EFAULT;
+		return 0;
+	default:
+		return -ENOIOCTLCMD;
+	}
+}
+
 long vhost_vring_ioctl(struct vhost_dev *d, unsigned int ioctl, void __user *argp)
 {
 	struct file *eventfp, *filep = NULL;
@@ -1413,6 +1622,7 @@ long vhost_vring_ioctl(struct vhost_dev *d, unsigned int ioctl, void __user *arg
 	struct eventfd_ctx *ctx = NULL;
 	u32 __user *idxp = argp;
 	struct vhost_virtqueue *vq;
+	struct vhost_vring_busyloop_stats bs;
 	struct vhost_vring_state s;
 	struct vhost_vring_file f;
 	struct vhost_vring_addr a;
@@ -1428,6 +1638,11 @@ long vhost_vring_ioctl(struct vhost_dev *d, unsigned int ioctl, void __user *arg
 	idx = array_index_nospec(idx, d->nvqs);
 	vq = d->vqs[idx];
 
+	/* Switching workers flushes vq work, which takes the vq mutex */
+	if (ioctl == VHOST_ATTACH_VRING_WORKER ||
+	    ioctl == VHOST_GET_VRING_WORKER)
+		return vhost_vring_worker_ioctl(vq, idx, ioctl, argp);
+
 	mutex_lock(&vq->mutex);
 
 	switch (ioctl) {
@@ -1588,6 +1803,18 @@ long vhost_vring_ioctl(struct vhost_dev *d, unsigned int ioctl, void __user *arg
 		if (copy_to_user(argp, &s, sizeof(s)))
 			r = -EFAULT;
 		break;
+	case VHOST_GET_VRING_BUSYLOOP_STATS:
+		memset(&bs, 0, sizeof(bs));
+		bs.index = idx;
+		bs.polls = vq->busyloop_polls;
+		bs.hits = vq->busyloop_hits;
+		bs.breaks = vq->busyloop_breaks;
+		bs.misses = vq->busyloop_polls - vq->busyloop_hits -
+			    vq->busyloop_breaks;
+		bs.time_us = vq->busyloop_time;
+		if (copy_to_user(argp, &bs, sizeof(bs)))
+			r = -EFAULT;
+		break;
 	default:
 		r = -ENOIOCTLCMD;
 	}
@@ -1661,6 +1888,12 @@ long vhost_dev_ioctl(struct vhost_dev *d, unsigned int ioctl, void __user *argp)
 	case VHOST_SET_MEM_TABLE:
 		r = vhost_set_memory(d, argp);
 		break;
+	case VHOST_NEW_WORKER:
+		r = vhost_new_worker(d, argp);
+		break;
+	case VHOST_FREE_WORKER:
+		r = vhost_free_worker(d, argp);
+		break;
 	case VHOST_SET_LOG_BASE:
 		if (copy_from_user(&p, argp, sizeof p)) {
 			r = -EFAULT;
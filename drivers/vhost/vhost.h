@@ -12,6 +12,7 @@
 #include <linux/virtio_config.h>
 #include <linux/virtio_ring.h>
 #include <linux/atomic.h>
+#include <linux/idr.h>
 
 struct vhost_work;
 typedef void (*vhost_work_fn_t)(struct vhost_work *work);
@@ -32,14 +33,28 @@ struct vhost_poll {
 	struct vhost_work	  work;
 	__poll_t		  mask;
 	struct vhost_dev	 *dev;
+	/* The virtqueue whose worker runs the work, NULL for the default one */
+	struct vhost_virtqueue	 *vq;
+};
+
+/* A kthread running the work queued on it, shared by one or more vqs */
+struct vhost_worker {
+	struct task_struct	  *task;
+	struct llist_head	  work_list;
+	struct vhost_dev	  *dev;
+	u32			  id;
+	/* Number of vqs attached, protected by the device mutex */
+	int			  attachment_cnt;
 };
 
 void vhost_work_init(struct vhost_work *work, vhost_work_fn_t fn);
 void vhost_work_queue(struct vhost_dev *dev, struct vhost_work *work);
-bool vhost_has_work(struct vhost_dev *dev);
+void vhost_vq_work_queue(struct vhost_virtqueue *vq, struct vhost_work *work);
+bool vhost_vq_has_work(struct vhost_virtqueue *vq);
 
 void vhost_poll_init(struct vhost_poll *poll, vhost_work_fn_t fn,
-		     __poll_t mask, struct vhost_dev *dev);
+		     __poll_t mask, struct vhost_dev *dev,
+		     struct vhost_virtqueue *vq);
 int vhost_poll_start(struct vhost_poll *poll, struct file *file);
 void vhost_poll_stop(struct vhost_poll *poll);
 void vhost_poll_flush(struct vhost_poll *poll);
@@ -83,6 +98,8 @@ enum vhost_uaddr_type {
 /* The virtqueue structure describes a queue attached to a device. */
 struct vhost_virtqueue {
 	struct vhost_dev *dev;
+	/* Changed under the device mutex, readers queueing work use RCU */
+	struct vhost_worker __rcu *worker;
 
 	/* The actual ring of buffers. */
 	struct mutex mutex;
@@ -145,6 +162,11 @@ struct vhost_virtqueue {
 	bool user_be;
 #endif
 	u32 busyloop_timeout;
+	/* Busy polling outcome, protected by the vq mutex */
+	u64 busyloop_polls;
+	u64 busyloop_hits;
+	u64 busyloop_breaks;
+	u64 busyloop_time;
 };
 
 struct vhost_msg_node {
@@ -162,8 +184,9 @@ struct vhost_dev {
 	struct vhost_virtqueue **vqs;
 	int nvqs;
 	struct eventfd_ctx *log_ctx;
-	struct llist_head work_list;
-	struct task_struct *worker;
+	/* Created with the owner, runs the work not bound to a vq */
+	struct vhost_worker *worker;
+	struct idr worker_idr;
 	struct vhost_umem *umem;
 	struct vhost_umem *iotlb;
 	spinlock_t iotlb_lock;
@@ -173,6 +196,10 @@ struct vhost_dev {
 	int iov_limit;
 	int weight;
 	int byte_weight;
+	/* Handles IOTLB messages written by the owner instead of the
+	 * software IOTLB, set by backends translating in hardware. */
+	int (*msg_handler)(struct vhost_dev *dev,
+			   struct vhost_iotlb_msg *msg);
 };
 
 bool vhost_exceeds_weight(struct vhost_virtqueue *vq, int pkts, int total_len);
@@ -27,6 +27,11 @@ static bool unplug_online = true;
 module_param(unplug_online, bool, 0644);
 MODULE_PARM_DESC(unplug_online, "Try to unplug online memory");
 
+static bool unplug_movable_first;
+module_param(unplug_movable_first, bool, 0644);
+MODULE_PARM_DESC(unplug_movable_first,
+		 "Unplug online memory from ZONE_MOVABLE first and skip unmovable subblocks");
+
 enum virtio_mem_mb_state {
 	/* Unplugged, not added to Linux. Can be reused later. */
 	VIRTIO_MEM_MB_STATE_UNUSED = 0,
@@ -81,6 +86,11 @@ struct virtio_mem {
 	uint64_t subblock_size;
 	/* The number of subblocks per memory block. */
 	uint32_t nb_sb_per_mb;
+	/*
+	 * The memmap of added memory blocks is put into their first subblock,
+	 * which stays plugged until the memory block is removed.
+	 */
+	bool memmap_on_memory;
 
 	/* Id of the first memory block of this device. */
 	unsigned long first_mb_id;
@@ -409,7 +419,8 @@ static int virtio_mem_mb_add(struct virtio_mem *vm, unsigned long mb_id)
 		nid = memory_add_physaddr_to_nid(addr);
 
 	dev_dbg(&vm->vdev->dev, "adding memory block: %lu\n", mb_id);
-	return add_memory(nid, addr, memory_block_size_bytes());
+	return add_memory(nid, addr, memory_block_size_bytes(),
+			  vm->memmap_on_memory ? MHP_MEMMAP_ON_MEMORY : MHP_NONE);
 }
 
 /*
@@ -1020,17 +1031,50 @@ static int virtio_mem_mb_unplug_sb(struct virtio_mem *vm, unsigned long mb_id,
 	return rc;
 }
 
+/*
+ * The first subblock that can be unplugged while the memory block is added
+ * to Linux. A memmap in the memory block must not go away under it.
+ */
+static int virtio_mem_first_unpluggable_sb(struct virtio_mem *vm)
+{
+	return vm->memmap_on_memory ? 1 : 0;
+}
+
+/*
+ * Unplug the subblock holding the memmap of a memory block that was just
+ * removed from Linux.
+ *
+ * Will modify the state of the memory block.
+ */
+static int virtio_mem_mb_unplug_memmap_sb(struct virtio_mem *vm,
+					  unsigned long mb_id, uint64_t *nb_sb)
+{
+	int rc;
+
+	rc = virtio_mem_mb_unplug_sb(vm, mb_id, 0, 1);
+	if (rc) {
+		/* virtio_mem_unplug_pending_mb() will retry */
+		virtio_mem_mb_set_state(vm, mb_id,
+					VIRTIO_MEM_MB_STATE_PLUGGED);
+		return rc;
+	}
+	*nb_sb -= 1;
+	virtio_mem_mb_set_state(vm, mb_id, VIRTIO_MEM_MB_STATE_UNUSED);
+	return 0;
+}
+
 /*
  * Unplug the desired number of plugged subblocks of a offline or not-added
- * memory block. Will fail if any subblock cannot get unplugged (instead of
- * skipping it).
+ * memory block, leaving the ones before @first_sb alone. Will fail if any
+ * subblock cannot get unplugged (instead of skipping it).
  *
  * Will not modify the state of the memory block.
  *
  * Note: can fail after some subblocks were unplugged.
  */
 static int virtio_mem_mb_unplug_any_sb(struct virtio_mem *vm,
-				       unsigned long mb_id, uint64_t *nb_sb)
+				       unsigned long mb_id, int first_sb,
+				       uint64_t *nb_sb)
 {
 	int sb_id, count;
 	int rc;
@@ -1038,14 +1082,14 @@ static int virtio_mem_mb_unplug_any_sb(struct virtio_mem *vm,
 	sb_id = vm->nb_sb_per_mb - 1;
 	while (*nb_sb) {
 		/* Find the next candidate subblock */
-		while (sb_id >= 0 &&
+		while (sb_id >= first_sb &&
 		       virtio_mem_mb_test_sb_unplugged(vm, mb_id, sb_id, 1))
 			sb_id--;
-		if (sb_id < 0)
+		if (sb_id < first_sb)
 			break;
 		/* Try to unplug multiple subblocks at a time */
 		count = 1;
-		while (count < *nb_sb && sb_id > 0 &&
+		while (count < *nb_sb && sb_id > first_sb &&
 		       virtio_mem_mb_test_sb_plugged(vm, mb_id, sb_id - 1, 1)) {
 			count++;
 			sb_id--;
@@ -1072,7 +1116,7 @@ static int virtio_mem_mb_unplug(struct virtio_mem *vm, unsigned long mb_id)
 {
 	uint64_t nb_sb = vm->nb_sb_per_mb;
 
-	return virtio_mem_mb_unplug_any_sb(vm, mb_id, &nb_sb);
+	return virtio_mem_mb_unplug_any_sb(vm, mb_id, 0, &nb_sb);
 }
 
 /*
@@ -1309,9 +1353,10 @@ static int virtio_mem_mb_unplug_any_sb_offline(struct virtio_mem *vm,
 					       unsigned long mb_id,
 					       uint64_t *nb_sb)
 {
+	const int first_sb = virtio_mem_first_unpluggable_sb(vm);
 	int rc;
 
-	rc = virtio_mem_mb_unplug_any_sb(vm, mb_id, nb_sb);
+	rc = virtio_mem_mb_unplug_any_sb(vm, mb_id, first_sb, nb_sb);
 
 	/* some subblocks might have been unplugged even on failure */
 	if (!virtio_mem_mb_test_sb_plugged(vm, mb_id, 0, vm->nb_sb_per_mb))
@@ -1320,7 +1365,11 @@ static int virtio_mem_mb_unplug_any_sb_offline(struct virtio_mem *vm,
 	if (rc)
 		return rc;
 
-	if (virtio_mem_mb_test_sb_unplugged(vm, mb_id, 0, vm->nb_sb_per_mb)) {
+	if (virtio_mem_mb_test_sb_unplugged(vm, mb_id, first_sb,
+					    vm->nb_sb_per_mb - first_sb)) {
+		/* Keep the memmap subblock unless it is to be unplugged. */
+		if (first_sb && !*nb_sb)
+			return 0;
 		/*
 		 * Remove the block from Linux - this should never fail.
 		 * Hinder the block from getting onlined by marking it
@@ -1334,6 +1383,9 @@ static int virtio_mem_mb_unplug_any_sb_offline(struct virtio_mem *vm,
 		rc = virtio_mem_mb_remove(vm, mb_id);
 		BUG_ON(rc);
 		mutex_lock(&vm->hotplug_mutex);
+
+		if (first_sb)
+			return virtio_mem_mb_unplug_memmap_sb(vm, mb_id, nb_sb);
 	}
 	return 0;
 }
@@ -1343,6 +1395,44 @@ static int virtio_mem_mb_unplug_any_sb_offline(struct virtio_mem *vm,
  *
  * Will modify the state of the memory block.
  */
+/*
+ * Test if an online memory block was onlined to ZONE_MOVABLE. The last
+ * subblock is looked at, the first one might hold the memmap.
+ */
+static bool virtio_mem_mb_movable(struct virtio_mem *vm, unsigned long mb_id)
+{
+	const unsigned long pfn = PFN_DOWN(virtio_mem_mb_id_to_phys(mb_id) +
+					   memory_block_size_bytes() -
+					   vm->subblock_size);
+
+	return page_zonenum(pfn_to_page(pfn)) == ZONE_MOVABLE;
+}
+
+/*
+ * Test if all pageblocks of a range of an online memory block are movable,
+ * so fake-offlining them has a chance to succeed without migrating most of
+ * it first. Racy, but only a hint.
+ */
+static bool virtio_mem_mb_sb_movable(struct virtio_mem *vm,
+				     unsigned long mb_id, int sb_id,
+				     int count)
+{
+	const unsigned long nr_pages = PFN_DOWN(vm->subblock_size) * count;
+	unsigned long pfn, start_pfn;
+	int mt;
+
+	start_pfn = PFN_DOWN(virtio_mem_mb_id_to_phys(mb_id) +
+			     sb_id * vm->subblock_size);
+
+	for (pfn = start_pfn; pfn < start_pfn + nr_pages;
+	     pfn += pageblock_nr_pages) {
+		mt = get_pageblock_migratetype(pfn_to_page(pfn));
+		if (!is_migrate_movable(mt))
+			return false;
+	}
+	return true;
+}
+
 static int virtio_mem_mb_unplug_sb_online(struct virtio_mem *vm,
 					  unsigned long mb_id, int sb_id,
 					  int count)
@@ -1354,6 +1444,11 @@ static int virtio_mem_mb_unplug_sb_online(struct virtio_mem *vm,
 	start_pfn = PFN_DOWN(virtio_mem_mb_id_to_phys(mb_id) +
 			     sb_id * vm->subblock_size);
 
+	/* Don't pay for migrating a range that is not going to make it. */
+	if (unplug_movable_first && !virtio_mem_mb_movable(vm, mb_id) &&
+	    !virtio_mem_mb_sb_movable(vm, mb_id, sb_id, count))
+		return -EBUSY;
+
 	rc = virtio_mem_fake_offline(start_pfn, nr_pages);
 	if (rc)
 		return rc;
@@ -1385,27 +1480,30 @@ static int virtio_mem_mb_unplug_any_sb_online(struct virtio_mem *vm,
 					      unsigned long mb_id,
 					      uint64_t *nb_sb)
 {
+	const int first_sb = virtio_mem_first_unpluggable_sb(vm);
+	const int count = vm->nb_sb_per_mb - first_sb;
 	int rc, sb_id;
 
 	/* If possible, try to unplug the complete block in one shot. */
-	if (*nb_sb >= vm->nb_sb_per_mb &&
+	if (*nb_sb >= vm->nb_sb_per_mb && count &&
 	    virtio_mem_mb_test_sb_plugged(vm, mb_id, 0, vm->nb_sb_per_mb)) {
-		rc = virtio_mem_mb_unplug_sb_online(vm, mb_id, 0,
-						    vm->nb_sb_per_mb);
+		rc = virtio_mem_mb_unplug_sb_online(vm, mb_id, first_sb,
+						    count);
 		if (!rc) {
-			*nb_sb -= vm->nb_sb_per_mb;
+			*nb_sb -= count;
 			goto unplugged;
 		} else if (rc != -EBUSY)
 			return rc;
 	}
 
 	/* Fallback to single subblocks. */
-	for (sb_id = vm->nb_sb_per_mb - 1; sb_id >= 0 && *nb_sb; sb_id--) {
+	for (sb_id = vm->nb_sb_per_mb - 1; sb_id >= first_sb && *nb_sb;
+	     sb_id--) {
 		/* Find the next candidate subblock */
-		while (sb_id >= 0 &&
+		while (sb_id >= first_sb &&
 		       !virtio_mem_mb_test_sb_plugged(vm, mb_id, sb_id, 1))
 			sb_id--;
-		if (sb_id < 0)
+		if (sb_id < first_sb)
 			break;
 
 		rc = virtio_mem_mb_unplug_sb_online(vm, mb_id, sb_id, 1);
@@ -1421,11 +1519,15 @@ static int virtio_mem_mb_unplug_any_sb_online(struct virtio_mem *vm,
 	 * Once all subblocks of a memory block were unplugged, offline and
 	 * remove it. This will usually not fail, as no memory is in use
 	 * anymore - however some other notifiers might NACK the request.
+	 * The memmap subblock is only unplugged once the block is gone.
 	 */
-	if (virtio_mem_mb_test_sb_unplugged(vm, mb_id, 0, vm->nb_sb_per_mb)) {
+	if (virtio_mem_mb_test_sb_unplugged(vm, mb_id, first_sb, count) &&
+	    (!first_sb || *nb_sb)) {
 		mutex_unlock(&vm->hotplug_mutex);
 		rc = virtio_mem_mb_offline_and_remove(vm, mb_id);
 		mutex_lock(&vm->hotplug_mutex);
+		if (!rc && first_sb)
+			return virtio_mem_mb_unplug_memmap_sb(vm, mb_id, nb_sb);
 		if (!rc)
 			virtio_mem_mb_set_state(vm, mb_id,
 						VIRTIO_MEM_MB_STATE_UNUSED);
@@ -1434,6 +1536,41 @@ static int virtio_mem_mb_unplug_any_sb_online(struct virtio_mem *vm,
 	return 0;
 }
 
+/*
+ * Try to unplug subblocks of online memory blocks. With unplug_movable_first,
+ * only ZONE_MOVABLE blocks are tried if @movable is set and only the other
+ * ones if not.
+ *
+ * Must be called with the hotplug_mutex held, which is temporarily dropped.
+ */
+static int virtio_mem_unplug_online_mbs(struct virtio_mem *vm,
+					uint64_t *nb_sb, bool movable)
+{
+	static const enum virtio_mem_mb_state states[] = {
+		VIRTIO_MEM_MB_STATE_ONLINE_PARTIAL,
+		VIRTIO_MEM_MB_STATE_ONLINE,
+	};
+	unsigned long mb_id;
+	int rc, i;
+
+	/* Partially plugged blocks first, then plugged ones. */
+	for (i = 0; i < ARRAY_SIZE(states); i++) {
+		virtio_mem_for_each_mb_state_rev(vm, mb_id, states[i]) {
+			if (unplug_movable_first &&
+			    virtio_mem_mb_movable(vm, mb_id) != movable)
+				continue;
+			rc = virtio_mem_mb_unplug_any_sb_online(vm, mb_id,
+								nb_sb);
+			if (rc || !*nb_sb)
+				return rc;
+			mutex_unlock(&vm->hotplug_mutex);
+			cond_resched();
+			mutex_lock(&vm->hotplug_mutex);
+		}
+	}
+	return 0;
+}
+
 /*
  * Try to unplug the requested amount of memory.
  */
@@ -1478,29 +1615,19 @@ static int virtio_mem_unplug_request(struct virtio_mem *vm, uint64_t diff)
 		return 0;
 	}
 
-	/* Try to unplug subblocks of partially plugged online blocks. */
-	virtio_mem_for_each_mb_state_rev(vm, mb_id,
-					 VIRTIO_MEM_MB_STATE_ONLINE_PARTIAL) {
-		rc = virtio_mem_mb_unplug_any_sb_online(vm, mb_id,
-							&nb_sb);
+	/*
+	 * ZONE_MOVABLE blocks are the ones that reliably give memory back,
+	 * try them before the ones that likely hold unmovable pages.
+	 */
+	if (unplug_movable_first) {
+		rc = virtio_mem_unplug_online_mbs(vm, &nb_sb, true);
 		if (rc || !nb_sb)
 			goto out_unlock;
-		mutex_unlock(&vm->hotplug_mutex);
-		cond_resched();
-		mutex_lock(&vm->hotplug_mutex);
 	}
 
-	/* Try to unplug subblocks of plugged online blocks. */
-	virtio_mem_for_each_mb_state_rev(vm, mb_id,
-					 VIRTIO_MEM_MB_STATE_ONLINE) {
-		rc = virtio_mem_mb_unplug_any_sb_online(vm, mb_id,
-							&nb_sb);
-		if (rc || !nb_sb)
-			goto out_unlock;
-		mutex_unlock(&vm->hotplug_mutex);
-		cond_resched();
-		mutex_lock(&vm->hotplug_mutex);
-	}
+	rc = virtio_mem_unplug_online_mbs(vm, &nb_sb, false);
+	if (rc || !nb_sb)
+		goto out_unlock;
 
 	mutex_unlock(&vm->hotplug_mutex);
 	return nb_sb ? -EBUSY : 0;
@@ -1728,6 +1855,15 @@ static int virtio_mem_init(struct virtio_mem *vm)
 				  vm->subblock_size);
 	vm->nb_sb_per_mb = memory_block_size_bytes() / vm->subblock_size;
 
+	/*
+	 * Hosting the memmap in the memory block itself saves taking it from
+	 * the memory we have already, as long as it fits the first subblock.
+	 */
+	vm->memmap_on_memory =
+		mhp_supports_memmap_on_memory(memory_block_size_bytes()) &&
+		PHYS_PFN(memory_block_size_bytes()) * sizeof(struct page) <=
+		vm->subblock_size;
+
 	/* Round up to the next full memory block */
 	vm->first_mb_id = virtio_mem_phys_to_mb_id(vm->addr - 1 +
 						   memory_block_size_bytes());
@@ -1743,6 +1879,8 @@ static int virtio_mem_init(struct virtio_mem *vm)
 		 memory_block_size_bytes());
 	dev_info(&vm->vdev->dev, "subblock size: 0x%llx",
 		 (unsigned long long)vm->subblock_size);
+	if (vm->memmap_on_memory)
+		dev_info(&vm->vdev->dev, "memmap on memory: enabled");
 	if (vm->nid != NUMA_NO_NODE)
 		dev_info(&vm->vdev->dev, "nid: %d", vm->nid);
 
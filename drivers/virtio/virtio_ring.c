@@ -63,6 +63,7 @@ static bool vring_weak_barriers;
 struct vring_desc_state {
 	void *data;			/* Data for callback. */
 	struct vring_desc *indir_desc;	/* Indirect descriptor, if any. */
+	u32 in_len;			/* Device writable bytes. */
 };
 
 struct vring_virtqueue {
@@ -83,6 +84,13 @@ struct vring_virtqueue {
 	/* Host publishes avail event idx */
 	bool event;
 
+	/*
+	 * Host uses buffers in the order they were made available: the
+	 * descriptors are then used in ring order, and a used entry may
+	 * complete all the buffers before it too.
+	 */
+	bool in_order;
+
 	/* Head of free buffer list. */
 	unsigned int free_head;
 	/* Number we've added since last sync. */
@@ -307,6 +315,7 @@ static inline int virtqueue_add(struct virtqueue *_vq,
 	struct scatterlist *sg;
 	struct vring_desc *desc;
 	unsigned int i, n, avail, descs_used, uninitialized_var(prev), err_idx;
+	u32 in_len = 0;
 	int head;
 	bool indirect;
 
@@ -395,6 +404,7 @@ static inline int virtqueue_add(struct virtqueue *_vq,
 			desc[i].flags = cpu_to_virtio16(_vq->vdev, VRING_DESC_F_NEXT | VRING_DESC_F_WRITE);
 			desc[i].addr = cpu_to_virtio64(_vq->vdev, addr);
 			desc[i].len = cpu_to_virtio32(_vq->vdev, sg->length);
+			in_len += sg->length;
 			prev = i;
 			i = virtio16_to_cpu(_vq->vdev, desc[i].next);
 		}
@@ -427,6 +437,7 @@ static inline int virtqueue_add(struct virtqueue *_vq,
 
 	/* Store token and indirect buffer state. */
 	vq->desc_state[head].data = data;
+	vq->desc_state[head].in_len = in_len;
 	if (indirect)
 		vq->desc_state[head].indir_desc = desc;
 	else
@@ -682,8 +693,15 @@ static void detach_buf(struct vring_virtqueue *vq, unsigned int head,
 	}
 
 	vring_unmap_one(vq, &vq->vring.desc[i]);
-	vq->vring.desc[i].next = cpu_to_virtio16(vq->vq.vdev, vq->free_head);
-	vq->free_head = head;
+	/*
+	 * In order, buffers are freed in the order they were allocated,
+	 * the chain stays linked in ring order behind the free ones.
+	 */
+	if (!vq->in_order) {
+		vq->vring.desc[i].next = cpu_to_virtio16(vq->vq.vdev,
+							 vq->free_head);
+		vq->free_head = head;
+	}
 
 	/* Plus final descriptor */
 	vq->vq.num_free++;
@@ -737,8 +755,9 @@ void *virtqueue_get_buf_ctx(struct virtqueue *_vq, unsigned int *len,
 			    void **ctx)
 {
 	struct vring_virtqueue *vq = to_vvq(_vq);
+	bool batched = false;
 	void *ret;
-	unsigned int i;
+	unsigned int i, head;
 	u16 last_used;
 
 	START_USE(vq);
@@ -765,6 +784,22 @@ void *virtqueue_get_buf_ctx(struct virtqueue *_vq, unsigned int *len,
 		BAD_RING(vq, "id %u out of range\n", i);
 		return NULL;
 	}
+
+	/*
+	 * In order, the device may write a single used entry for a batch
+	 * of buffers, the one of the last buffer.  The buffers before it
+	 * are returned first, as fully written, and the entry is consumed
+	 * along with the last one.
+	 */
+	if (vq->in_order) {
+		head = (vq->free_head + vq->vq.num_free) & (vq->vring.num - 1);
+		if (head != i) {
+			*len = vq->desc_state[head].in_len;
+			i = head;
+			batched = true;
+		}
+	}
+
 	if (unlikely(!vq->desc_state[i].data)) {
 		BAD_RING(vq, "id %u is not a head!\n", i);
 		return NULL;
@@ -773,6 +808,9 @@ void *virtqueue_get_buf_ctx(struct virtqueue *_vq, unsigned int *len,
 	/* detach_buf clears data, so grab it now. */
 	ret = vq->desc_state[i].data;
 	detach_buf(vq, i, ctx);
+	if (batched)
+		goto out;
+
 	vq->last_used_idx++;
 	/* If we expect an interrupt for the next entry, tell host
 	 * by writing event index and flush out the write before
@@ -782,6 +820,7 @@ void *virtqueue_get_buf_ctx(struct virtqueue *_vq, unsigned int *len,
 				&vring_used_event(&vq->vring),
 				cpu_to_virtio16(_vq->vdev, vq->last_used_idx));
 
+out:
 #ifdef DEBUG
 	vq->last_add_time_valid = false;
 #endif
@@ -1040,6 +1079,7 @@ struct virtqueue *__vring_new_virtqueue(unsigned int index,
 	vq->indirect = virtio_has_feature(vdev, VIRTIO_RING_F_INDIRECT_DESC) &&
 		!context;
 	vq->event = virtio_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX);
+	vq->in_order = virtio_has_feature(vdev, VIRTIO_F_IN_ORDER);
 
 	/* No callback?  Tell other side not to bother us. */
 	if (!callback) {
@@ -1052,6 +1092,8 @@ struct virtqueue *__vring_new_virtqueue(unsigned int index,
 	vq->free_head = 0;
 	for (i = 0; i < vring.num-1; i++)
 		vq->vring.desc[i].next = cpu_to_virtio16(vdev, i + 1);
+	/* Wraps around for in order use */
+	vq->vring.desc[i].next = 0;
 	memset(vq->desc_state, 0, vring.num * sizeof(struct vring_desc_state));
 
 	return &vq->vq;
@@ -1226,6 +1268,8 @@ void vring_transport_features(struct virtio_device *vdev)
 			break;
 		case VIRTIO_F_IOMMU_PLATFORM:
 			break;
+		case VIRTIO_F_IN_ORDER:
+			break;
 		default:
 			/* We don't understand this bit. */
 			__virtio_clear_bit(vdev, i);
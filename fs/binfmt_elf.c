@@ -387,6 +387,23 @@ static unsigned long elf_map(struct file *filep, unsigned long addr,
 
 #endif /* !elf_map */
 
+/*
+ * Fault in the file backed part of a segment right away rather than one
+ * page at a time as the program runs into it.  The faults go through
+ * fault-around, so text that khugepaged already collapsed in the page
+ * cache, by an earlier run, ends up mapped with PMDs.  Errors are left for
+ * the program to run into later.
+ */
+static void elf_prefault(unsigned long map_addr, struct elf_phdr *eppnt)
+{
+	unsigned long size = eppnt->p_filesz + ELF_PAGEOFFSET(eppnt->p_vaddr);
+
+	if (!hugetext_prefault_enabled() || !size)
+		return;
+
+	mm_populate(ELF_PAGESTART(map_addr), ELF_PAGEALIGN(size));
+}
+
 static unsigned long total_mapping_size(struct elf_phdr *cmds, int nr)
 {
 	int i, first_idx = -1, last_idx = -1;
@@ -1020,6 +1037,7 @@ static int load_elf_binary(struct linux_binprm *bprm)
 				PTR_ERR((void*)error) : -EINVAL;
 			goto out_free_dentry;
 		}
+		elf_prefault(error, elf_ppnt);
 
 		if (!load_addr_set) {
 			load_addr_set = 1;
@@ -30,6 +30,8 @@ static int cachefiles_daemon_add_cache(struct cachefiles_cache *caches);
  */
 int cachefiles_daemon_bind(struct cachefiles_cache *cache, char *args)
 {
+	bool ondemand = false;
+
 	_enter("{%u,%u,%u,%u,%u,%u},%s",
 	       cache->frun_percent,
 	       cache->fcull_percent,
@@ -50,8 +52,11 @@ int cachefiles_daemon_bind(struct cachefiles_cache *cache, char *args)
 	       cache->bcull_percent < cache->brun_percent &&
 	       cache->brun_percent  < 100);
 
-	if (*args) {
-		pr_err("'bind' command doesn't take an argument\n");
+	if (IS_ENABLED(CONFIG_CACHEFILES_ONDEMAND) &&
+	    !strcmp(args, "ondemand")) {
+		ondemand = true;
+	} else if (*args) {
+		pr_err("Invalid argument to the 'bind' command\n");
 		return -EINVAL;
 	}
 
@@ -75,6 +80,9 @@ int cachefiles_daemon_bind(struct cachefiles_cache *cache, char *args)
 			return -ENOMEM;
 	}
 
+	if (ondemand)
+		set_bit(CACHEFILES_ONDEMAND_MODE, &cache->flags);
+
 	/* add the cache */
 	return cachefiles_daemon_add_cache(cache);
 }
@@ -68,6 +68,7 @@ static const struct cachefiles_daemon_cmd cachefiles_daemon_cmds[] = {
 	{ "brun",	cachefiles_daemon_brun		},
 	{ "bcull",	cachefiles_daemon_bcull		},
 	{ "bstop",	cachefiles_daemon_bstop		},
+	{ "copen",	cachefiles_ondemand_copen	},
 	{ "cull",	cachefiles_daemon_cull		},
 	{ "debug",	cachefiles_daemon_debug		},
 	{ "dir",	cachefiles_daemon_dir		},
@@ -109,6 +110,8 @@ static int cachefiles_daemon_open(struct inode *inode, struct file *file)
 	cache->active_nodes = RB_ROOT;
 	rwlock_init(&cache->active_lock);
 	init_waitqueue_head(&cache->daemon_pollwq);
+	atomic_set(&cache->unbind_pincount, 1);
+	cachefiles_ondemand_init(cache);
 
 	/* set default caching limits
 	 * - limit at 1% free space and/or free files
@@ -140,21 +143,38 @@ static int cachefiles_daemon_release(struct inode *inode, struct file *file)
 
 	set_bit(CACHEFILES_DEAD, &cache->flags);
 
-	cachefiles_daemon_unbind(cache);
-
-	ASSERT(!cache->active_nodes.rb_node);
+	if (cachefiles_in_ondemand_mode(cache))
+		cachefiles_ondemand_flush(cache);
 
 	/* clean up the control file interface */
 	cache->cachefilesd = NULL;
 	file->private_data = NULL;
-	cachefiles_open = 0;
 
-	kfree(cache);
+	/* the descriptors handed out in on-demand mode may outlive us */
+	cachefiles_put_unbind_pincount(cache);
 
 	_leave("");
 	return 0;
 }
 
+void cachefiles_get_unbind_pincount(struct cachefiles_cache *cache)
+{
+	atomic_inc(&cache->unbind_pincount);
+}
+
+void cachefiles_put_unbind_pincount(struct cachefiles_cache *cache)
+{
+	if (!atomic_dec_and_test(&cache->unbind_pincount))
+		return;
+
+	cachefiles_daemon_unbind(cache);
+
+	ASSERT(!cache->active_nodes.rb_node);
+
+	cachefiles_open = 0;
+	kfree(cache);
+}
+
 /*
  * read the cache state
  */
@@ -172,6 +192,9 @@ static ssize_t cachefiles_daemon_read(struct file *file, char __user *_buffer,
 	if (!test_bit(CACHEFILES_READY, &cache->flags))
 		return 0;
 
+	if (cachefiles_in_ondemand_mode(cache))
+		return cachefiles_ondemand_daemon_read(cache, _buffer, buflen);
+
 	/* check how much space the cache has */
 	cachefiles_has_space(cache, 0, 0);
 
@@ -300,8 +323,12 @@ static __poll_t cachefiles_daemon_poll(struct file *file,
 	poll_wait(file, &cache->daemon_pollwq, poll);
 	mask = 0;
 
-	if (test_bit(CACHEFILES_STATE_CHANGED, &cache->flags))
+	if (cachefiles_in_ondemand_mode(cache)) {
+		if (cachefiles_ondemand_pending(cache))
+			mask |= EPOLLIN;
+	} else if (test_bit(CACHEFILES_STATE_CHANGED, &cache->flags)) {
 		mask |= EPOLLIN;
+	}
 
 	if (test_bit(CACHEFILES_CULLING, &cache->flags))
 		mask |= EPOLLOUT;
@@ -145,9 +145,11 @@ static int cachefiles_lookup_object(struct fscache_object *_object)
 					lookup_data->auxdata);
 	cachefiles_end_secure(cache, saved_cred);
 
-	/* polish off by setting the attributes of non-index files */
+	/* polish off by setting the attributes of non-index files, unless
+	 * the daemon owns the file size */
 	if (ret == 0 &&
-	    object->fscache.cookie->def->type != FSCACHE_COOKIE_TYPE_INDEX)
+	    object->fscache.cookie->def->type != FSCACHE_COOKIE_TYPE_INDEX &&
+	    !cachefiles_in_ondemand_mode(cache))
 		cachefiles_attr_changed(&object->fscache);
 
 	if (ret < 0 && ret != -ETIMEDOUT) {
@@ -310,6 +312,9 @@ static void cachefiles_drop_object(struct fscache_object *_object)
 		object->backer = NULL;
 	}
 
+	if (cachefiles_in_ondemand_mode(cache))
+		cachefiles_ondemand_close(object);
+
 	/* note that the object is now inactive */
 	if (test_bit(CACHEFILES_OBJECT_ACTIVE, &object->flags))
 		cachefiles_mark_object_inactive(cache, object, i_blocks);
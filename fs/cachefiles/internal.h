@@ -22,6 +22,7 @@
 #include <linux/cred.h>
 #include <linux/workqueue.h>
 #include <linux/security.h>
+#include <linux/idr.h>
 
 struct cachefiles_cache;
 struct cachefiles_object;
@@ -49,6 +50,10 @@ struct cachefiles_object {
 	uint8_t				new;		/* T if object new */
 	spinlock_t			work_lock;
 	struct rb_node			active_node;	/* link in active tree (dentry is key) */
+#ifdef CONFIG_CACHEFILES_ONDEMAND
+	int				ondemand_id;	/* object id given to the daemon, 0 if not open */
+	struct mutex			ondemand_mutex;	/* serialises the OPEN request */
+#endif
 };
 
 extern struct kmem_cache *cachefiles_object_jar;
@@ -88,11 +93,25 @@ struct cachefiles_cache {
 #define CACHEFILES_DEAD			1	/* T if cache dead */
 #define CACHEFILES_CULLING		2	/* T if cull engaged */
 #define CACHEFILES_STATE_CHANGED	3	/* T if state changed (poll trigger) */
+#define CACHEFILES_ONDEMAND_MODE	4	/* T if in on-demand read mode */
 	char				*rootdirname;	/* name of cache root directory */
 	char				*secctx;	/* LSM security context */
 	char				*tag;		/* cache binding tag */
+	atomic_t			unbind_pincount;/* daemon and on-demand fds holding the cache */
+#ifdef CONFIG_CACHEFILES_ONDEMAND
+	spinlock_t			reqs_lock;	/* lock for the fields below */
+	struct idr			reqs;		/* requests not yet completed */
+	struct list_head		reqs_pending;	/* requests not yet read by the daemon */
+	struct idr			ondemand_ids;	/* objects open to the daemon */
+#endif
 };
 
+static inline bool cachefiles_in_ondemand_mode(struct cachefiles_cache *cache)
+{
+	return IS_ENABLED(CONFIG_CACHEFILES_ONDEMAND) &&
+		test_bit(CACHEFILES_ONDEMAND_MODE, &cache->flags);
+}
+
 /*
  * backing file read tracking
  */
@@ -145,6 +164,8 @@ extern void cachefiles_daemon_unbind(struct cachefiles_cache *cache);
  * daemon.c
  */
 extern const struct file_operations cachefiles_daemon_fops;
+extern void cachefiles_get_unbind_pincount(struct cachefiles_cache *cache);
+extern void cachefiles_put_unbind_pincount(struct cachefiles_cache *cache);
 
 extern int cachefiles_has_space(struct cachefiles_cache *cache,
 				unsigned fnr, unsigned bnr);
@@ -181,6 +202,46 @@ extern int cachefiles_cull(struct cachefiles_cache *cache, struct dentry *dir,
 extern int cachefiles_check_in_use(struct cachefiles_cache *cache,
 				   struct dentry *dir, char *filename);
 
+/*
+ * ondemand.c
+ */
+#ifdef CONFIG_CACHEFILES_ONDEMAND
+extern void cachefiles_ondemand_init(struct cachefiles_cache *cache);
+extern void cachefiles_ondemand_flush(struct cachefiles_cache *cache);
+extern ssize_t cachefiles_ondemand_daemon_read(struct cachefiles_cache *cache,
+					char __user *_buffer, size_t buflen);
+extern bool cachefiles_ondemand_pending(struct cachefiles_cache *cache);
+extern int cachefiles_ondemand_copen(struct cachefiles_cache *cache,
+				     char *args);
+extern int cachefiles_ondemand_read(struct cachefiles_object *object,
+				    loff_t pos, size_t len);
+extern void cachefiles_ondemand_close(struct cachefiles_object *object);
+#else
+static inline void cachefiles_ondemand_init(struct cachefiles_cache *cache) {}
+static inline void cachefiles_ondemand_flush(struct cachefiles_cache *cache) {}
+static inline
+ssize_t cachefiles_ondemand_daemon_read(struct cachefiles_cache *cache,
+					char __user *_buffer, size_t buflen)
+{
+	return -EOPNOTSUPP;
+}
+static inline bool cachefiles_ondemand_pending(struct cachefiles_cache *cache)
+{
+	return false;
+}
+static inline int cachefiles_ondemand_copen(struct cachefiles_cache *cache,
+					    char *args)
+{
+	return -EOPNOTSUPP;
+}
+static inline int cachefiles_ondemand_read(struct cachefiles_object *object,
+					   loff_t pos, size_t len)
+{
+	return -EOPNOTSUPP;
+}
+static inline void cachefiles_ondemand_close(struct cachefiles_object *object) {}
+#endif
+
 /*
  * proc.c
  */
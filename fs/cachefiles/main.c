@@ -47,6 +47,9 @@ static void cachefiles_object_init_once(void *_object)
 
 	memset(object, 0, sizeof(*object));
 	spin_lock_init(&object->work_lock);
+#ifdef CONFIG_CACHEFILES_ONDEMAND
+	mutex_init(&object->ondemand_mutex);
+#endif
 }
 
 /*
@@ -550,7 +550,7 @@ int cachefiles_walk_to_object(struct cachefiles_object *parent,
 	/* if this element of the path doesn't exist, then the lookup phase
 	 * failed, and we can release any readers in the certain knowledge that
 	 * there's nothing for them to actually read */
-	if (d_is_negative(next))
+	if (d_is_negative(next) && !cachefiles_in_ondemand_mode(cache))
 		fscache_object_lookup_negative(&object->fscache);
 
 	/* we need to create the object if it's negative */
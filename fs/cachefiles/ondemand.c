@@ -0,0 +1,552 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/* On-demand reading of cache files
+ *
+ * Copyright (C) 2022 Alibaba Cloud
+ *
+ * With the cache bound by "bind ondemand", a read which finds a hole in the
+ * backing file is not failed back to the netfs.  It is turned into a request
+ * that the daemon reads from /dev/cachefiles; the daemon fetches the data
+ * from wherever it really lives, writes it into the backing file through a
+ * descriptor the cache gave it, and completes the request, after which the
+ * read is retried against the backing file.
+ */
+#include <linux/anon_inodes.h>
+#include <linux/file.h>
+#include <linux/uio.h>
+#include <linux/slab.h>
+#include <uapi/linux/cachefiles.h>
+#include "internal.h"
+
+/*
+ * a descriptor onto a backing file as handed to the daemon by OPEN
+ */
+struct cachefiles_ondemand_fd {
+	struct cachefiles_cache		*cache;
+	struct cachefiles_object	*object;	/* ref held */
+	struct file			*file;		/* the backing file */
+	int				object_id;
+};
+
+/*
+ * a request to the daemon
+ * - lives in cache->reqs until completed, and on cache->reqs_pending until
+ *   the daemon has read it
+ * - nobody waits on CLOSE, it is freed once read
+ */
+struct cachefiles_req {
+	struct cachefiles_object	*object;
+	struct cachefiles_ondemand_fd	*cfd;		/* OPEN: not yet installed */
+	struct completion		done;
+	int				error;
+	struct list_head		pending;
+	struct cachefiles_msg		msg;		/* must be last */
+};
+
+void cachefiles_ondemand_init(struct cachefiles_cache *cache)
+{
+	spin_lock_init(&cache->reqs_lock);
+	idr_init(&cache->reqs);
+	INIT_LIST_HEAD(&cache->reqs_pending);
+	idr_init(&cache->ondemand_ids);
+}
+
+static void cachefiles_ondemand_put_fd(struct cachefiles_ondemand_fd *cfd)
+{
+	struct cachefiles_cache *cache = cfd->cache;
+	struct cachefiles_object *object = cfd->object;
+
+	spin_lock(&cache->reqs_lock);
+	idr_remove(&cache->ondemand_ids, cfd->object_id);
+	if (object->ondemand_id == cfd->object_id)
+		object->ondemand_id = 0;
+	spin_unlock(&cache->reqs_lock);
+
+	fput(cfd->file);
+	cache->cache.ops->put_object(&object->fscache,
+		(enum fscache_obj_ref_trace)cachefiles_obj_put_ondemand_fd);
+	cachefiles_put_unbind_pincount(cache);
+	kfree(cfd);
+}
+
+static int cachefiles_ondemand_fd_release(struct inode *inode,
+					  struct file *file)
+{
+	cachefiles_ondemand_put_fd(file->private_data);
+	return 0;
+}
+
+static ssize_t cachefiles_ondemand_fd_write_iter(struct kiocb *kiocb,
+						 struct iov_iter *iter)
+{
+	struct cachefiles_ondemand_fd *cfd = kiocb->ki_filp->private_data;
+	loff_t pos = kiocb->ki_pos;
+	ssize_t ret;
+
+	file_start_write(cfd->file);
+	ret = vfs_iter_write(cfd->file, iter, &pos, 0);
+	file_end_write(cfd->file);
+	if (ret > 0)
+		kiocb->ki_pos = pos;
+	return ret;
+}
+
+/*
+ * the daemon has written the data asked for by READ request @arg
+ */
+static long cachefiles_ondemand_fd_ioctl(struct file *filp, unsigned int ioctl,
+					 unsigned long arg)
+{
+	struct cachefiles_ondemand_fd *cfd = filp->private_data;
+	struct cachefiles_cache *cache = cfd->cache;
+	struct cachefiles_req *req;
+
+	if (ioctl != CACHEFILES_IOC_READ_COMPLETE)
+		return -EINVAL;
+	if (arg > INT_MAX)
+		return -EINVAL;
+
+	spin_lock(&cache->reqs_lock);
+	req = idr_find(&cache->reqs, arg);
+	if (!req || req->msg.opcode != CACHEFILES_OP_READ ||
+	    req->msg.object_id != cfd->object_id ||
+	    !list_empty(&req->pending)) {
+		spin_unlock(&cache->reqs_lock);
+		return -EINVAL;
+	}
+	idr_remove(&cache->reqs, arg);
+	complete(&req->done);
+	spin_unlock(&cache->reqs_lock);
+	return 0;
+}
+
+static const struct file_operations cachefiles_ondemand_fd_fops = {
+	.owner		= THIS_MODULE,
+	.release	= cachefiles_ondemand_fd_release,
+	.write_iter	= cachefiles_ondemand_fd_write_iter,
+	.unlocked_ioctl	= cachefiles_ondemand_fd_ioctl,
+	.llseek		= noop_llseek,
+};
+
+/*
+ * open the backing file of an object for the daemon to fill
+ */
+static struct cachefiles_ondemand_fd *
+cachefiles_ondemand_new_fd(struct cachefiles_object *object)
+{
+	struct cachefiles_cache *cache = container_of(object->fscache.cache,
+					struct cachefiles_cache, cache);
+	struct path path = { .mnt = cache->mnt, .dentry = object->backer };
+	struct cachefiles_ondemand_fd *cfd;
+	const struct cred *saved_cred;
+	int id, u;
+
+	cfd = kzalloc(sizeof(*cfd), GFP_KERNEL);
+	if (!cfd)
+		return ERR_PTR(-ENOMEM);
+
+	cachefiles_begin_secure(cache, &saved_cred);
+	cfd->file = dentry_open(&path, O_RDWR | O_LARGEFILE, cache->cache_cred);
+	cachefiles_end_secure(cache, saved_cred);
+	if (IS_ERR(cfd->file)) {
+		id = PTR_ERR(cfd->file);
+		kfree(cfd);
+		return ERR_PTR(id);
+	}
+
+	idr_preload(GFP_KERNEL);
+	spin_lock(&cache->reqs_lock);
+	id = idr_alloc_cyclic(&cache->ondemand_ids, cfd, 1, INT_MAX,
+			      GFP_NOWAIT);
+	spin_unlock(&cache->reqs_lock);
+	idr_preload_end();
+	if (id < 0) {
+		fput(cfd->file);
+		kfree(cfd);
+		return ERR_PTR(id);
+	}
+
+	cfd->object_id = id;
+	cfd->cache = cache;
+	cachefiles_get_unbind_pincount(cache);
+	cfd->object = object;
+	u = atomic_inc_return(&object->usage);
+	trace_cachefiles_ref(object, object->fscache.cookie,
+		(enum cachefiles_obj_ref_trace)cachefiles_obj_get_ondemand_fd,
+		u);
+	return cfd;
+}
+
+static struct cachefiles_req *
+cachefiles_ondemand_alloc_req(struct cachefiles_object *object,
+			      enum cachefiles_opcode opcode, size_t data_len)
+{
+	struct cachefiles_req *req;
+
+	if (sizeof(struct cachefiles_msg) + data_len > CACHEFILES_MSG_MAX_SIZE)
+		return NULL;
+
+	req = kzalloc(sizeof(*req) + data_len, GFP_KERNEL);
+	if (!req)
+		return NULL;
+
+	req->object = object;
+	init_completion(&req->done);
+	INIT_LIST_HEAD(&req->pending);
+	req->msg.opcode = opcode;
+	req->msg.len = sizeof(struct cachefiles_msg) + data_len;
+	return req;
+}
+
+/*
+ * queue a request for the daemon and, if @wait, wait for its completion
+ */
+static int cachefiles_ondemand_send(struct cachefiles_cache *cache,
+				    struct cachefiles_req *req, bool wait)
+{
+	int id, ret;
+
+	idr_preload(GFP_KERNEL);
+	spin_lock(&cache->reqs_lock);
+	if (test_bit(CACHEFILES_DEAD, &cache->flags)) {
+		ret = -EIO;
+		goto unlock;
+	}
+	id = idr_alloc_cyclic(&cache->reqs, req, 1, INT_MAX, GFP_NOWAIT);
+	if (id < 0) {
+		ret = id;
+		goto unlock;
+	}
+	req->msg.msg_id = id;
+	list_add_tail(&req->pending, &cache->reqs_pending);
+	spin_unlock(&cache->reqs_lock);
+	idr_preload_end();
+
+	wake_up_all(&cache->daemon_pollwq);
+	if (!wait)
+		return 0;
+
+	ret = wait_for_completion_killable(&req->done);
+	if (ret < 0) {
+		spin_lock(&cache->reqs_lock);
+		if (idr_find(&cache->reqs, id) == req) {
+			idr_remove(&cache->reqs, id);
+			list_del_init(&req->pending);
+			spin_unlock(&cache->reqs_lock);
+			return -EINTR;
+		}
+		spin_unlock(&cache->reqs_lock);
+		/* being completed right now */
+		wait_for_completion(&req->done);
+	}
+	return req->error;
+
+unlock:
+	spin_unlock(&cache->reqs_lock);
+	idr_preload_end();
+	return ret;
+}
+
+/*
+ * complete a request the daemon could not be handed
+ */
+static void cachefiles_ondemand_fail(struct cachefiles_cache *cache, int id,
+				     int error)
+{
+	struct cachefiles_req *req;
+
+	spin_lock(&cache->reqs_lock);
+	req = idr_find(&cache->reqs, id);
+	if (req) {
+		idr_remove(&cache->reqs, id);
+		req->error = error;
+		complete(&req->done);
+	}
+	spin_unlock(&cache->reqs_lock);
+}
+
+/*
+ * fail all outstanding requests, the daemon is going away
+ */
+void cachefiles_ondemand_flush(struct cachefiles_cache *cache)
+{
+	struct cachefiles_req *req;
+	int id;
+
+	spin_lock(&cache->reqs_lock);
+	idr_for_each_entry(&cache->reqs, req, id) {
+		idr_remove(&cache->reqs, id);
+		list_del_init(&req->pending);
+		if (req->msg.opcode == CACHEFILES_OP_CLOSE) {
+			kfree(req);
+			continue;
+		}
+		req->error = -EIO;
+		complete(&req->done);
+	}
+	spin_unlock(&cache->reqs_lock);
+}
+
+bool cachefiles_ondemand_pending(struct cachefiles_cache *cache)
+{
+	return !list_empty_careful(&cache->reqs_pending);
+}
+
+/*
+ * hand the oldest pending request to the daemon
+ * - the request is copied under the lock, its waiter may give up on it as
+ *   soon as the lock is dropped
+ */
+ssize_t cachefiles_ondemand_daemon_read(struct cachefiles_cache *cache,
+					char __user *_buffer, size_t buflen)
+{
+	struct cachefiles_ondemand_fd *cfd = NULL;
+	struct file *file = NULL;
+	struct cachefiles_req *req;
+	struct cachefiles_msg *msg;
+	int fd = -1, ret = 0;
+	size_t n;
+
+	msg = kmalloc(CACHEFILES_MSG_MAX_SIZE, GFP_KERNEL);
+	if (!msg)
+		return -ENOMEM;
+
+	spin_lock(&cache->reqs_lock);
+	req = list_first_entry_or_null(&cache->reqs_pending,
+				       struct cachefiles_req, pending);
+	if (!req) {
+		spin_unlock(&cache->reqs_lock);
+		kfree(msg);
+		return 0;
+	}
+	n = req->msg.len;
+	if (n > buflen) {
+		spin_unlock(&cache->reqs_lock);
+		kfree(msg);
+		return -EMSGSIZE;
+	}
+	list_del_init(&req->pending);
+	memcpy(msg, &req->msg, n);
+	if (msg->opcode == CACHEFILES_OP_OPEN) {
+		cfd = req->cfd;
+		req->cfd = NULL;
+	} else if (msg->opcode == CACHEFILES_OP_CLOSE) {
+		idr_remove(&cache->reqs, msg->msg_id);
+		kfree(req);
+	}
+	spin_unlock(&cache->reqs_lock);
+
+	if (cfd) {
+		struct cachefiles_open *load = (void *)msg->data;
+
+		fd = get_unused_fd_flags(O_WRONLY);
+		if (fd < 0) {
+			ret = fd;
+			cachefiles_ondemand_put_fd(cfd);
+			goto out;
+		}
+		file = anon_inode_getfile("[cachefiles]",
+					  &cachefiles_ondemand_fd_fops,
+					  cfd, O_WRONLY);
+		if (IS_ERR(file)) {
+			ret = PTR_ERR(file);
+			put_unused_fd(fd);
+			cachefiles_ondemand_put_fd(cfd);
+			goto out;
+		}
+		file->f_mode |= FMODE_PWRITE;
+		load->fd = fd;
+	}
+
+	if (copy_to_user(_buffer, msg, n) != 0)
+		ret = -EFAULT;
+
+	if (file) {
+		if (ret) {
+			/* releasing the file puts the cfd */
+			fput(file);
+			put_unused_fd(fd);
+		} else {
+			fd_install(fd, file);
+		}
+	}
+
+out:
+	if (ret && msg->opcode != CACHEFILES_OP_CLOSE)
+		cachefiles_ondemand_fail(cache, msg->msg_id, ret);
+	kfree(msg);
+	return ret ?: n;
+}
+
+/*
+ * the daemon answers an OPEN: "copen <msg_id>,<size>"
+ * - a negative size is the error the open fails with
+ */
+int cachefiles_ondemand_copen(struct cachefiles_cache *cache, char *args)
+{
+	struct cachefiles_req *req;
+	unsigned long id;
+	char *psize;
+	long size;
+	int ret;
+
+	if (!cachefiles_in_ondemand_mode(cache))
+		return -EOPNOTSUPP;
+
+	psize = strchr(args, ',');
+	if (!psize) {
+		pr_err("Cache size is not specified\n");
+		return -EINVAL;
+	}
+	*psize++ = '\0';
+
+	ret = kstrtoul(args, 0, &id);
+	if (ret)
+		return ret;
+	ret = kstrtol(psize, 0, &size);
+	if (ret)
+		return ret;
+	if (id > INT_MAX)
+		return -EINVAL;
+
+	spin_lock(&cache->reqs_lock);
+	req = idr_find(&cache->reqs, id);
+	if (!req || req->msg.opcode != CACHEFILES_OP_OPEN ||
+	    !list_empty(&req->pending)) {
+		spin_unlock(&cache->reqs_lock);
+		return -EINVAL;
+	}
+	idr_remove(&cache->reqs, id);
+
+	if (size < 0) {
+		req->error = IS_ERR_VALUE(size) ? size : -EINVAL;
+	} else if (idr_find(&cache->ondemand_ids, req->msg.object_id)) {
+		req->object->ondemand_id = req->msg.object_id;
+	} else {
+		/* the daemon closed the descriptor already */
+		req->error = -EBADF;
+	}
+	complete(&req->done);
+	spin_unlock(&cache->reqs_lock);
+	return 0;
+}
+
+/*
+ * give the daemon a descriptor onto the backing file, if it has none
+ */
+static int cachefiles_ondemand_open(struct cachefiles_object *object)
+{
+	struct cachefiles_cache *cache = container_of(object->fscache.cache,
+					struct cachefiles_cache, cache);
+	struct fscache_cookie *cookie = object->fscache.cookie;
+	struct fscache_cookie *volume = cookie->parent;
+	struct cachefiles_ondemand_fd *cfd;
+	struct cachefiles_open *load;
+	struct cachefiles_req *req;
+	size_t vlen, clen;
+	void *p;
+	int ret;
+
+	if (READ_ONCE(object->ondemand_id))
+		return 0;
+
+	ret = mutex_lock_killable(&object->ondemand_mutex);
+	if (ret < 0)
+		return ret;
+	if (object->ondemand_id)
+		goto out;
+
+	vlen = volume ? volume->key_len : 0;
+	clen = cookie->key_len;
+	ret = -ENOMEM;
+	req = cachefiles_ondemand_alloc_req(object, CACHEFILES_OP_OPEN,
+					    sizeof(*load) + vlen + clen);
+	if (!req)
+		goto out;
+
+	cfd = cachefiles_ondemand_new_fd(object);
+	if (IS_ERR(cfd)) {
+		ret = PTR_ERR(cfd);
+		kfree(req);
+		goto out;
+	}
+	req->cfd = cfd;
+	req->msg.object_id = cfd->object_id;
+
+	load = (void *)req->msg.data;
+	load->volume_key_size = vlen;
+	load->cookie_key_size = clen;
+	if (vlen) {
+		p = vlen <= sizeof(volume->inline_key) ?
+			volume->inline_key : volume->key;
+		memcpy(load->data, p, vlen);
+	}
+	p = clen <= sizeof(cookie->inline_key) ?
+		cookie->inline_key : cookie->key;
+	memcpy(load->data + vlen, p, clen);
+
+	ret = cachefiles_ondemand_send(cache, req, true);
+	/* never handed to the daemon */
+	if (req->cfd)
+		cachefiles_ondemand_put_fd(req->cfd);
+	kfree(req);
+out:
+	mutex_unlock(&object->ondemand_mutex);
+	return ret;
+}
+
+/*
+ * ask the daemon to fill [pos, pos + len) of the backing file
+ */
+int cachefiles_ondemand_read(struct cachefiles_object *object,
+			     loff_t pos, size_t len)
+{
+	struct cachefiles_cache *cache = container_of(object->fscache.cache,
+					struct cachefiles_cache, cache);
+	struct cachefiles_read *load;
+	struct cachefiles_req *req;
+	int ret;
+
+	ret = cachefiles_ondemand_open(object);
+	if (ret < 0)
+		return ret;
+
+	req = cachefiles_ondemand_alloc_req(object, CACHEFILES_OP_READ,
+					    sizeof(*load));
+	if (!req)
+		return -ENOMEM;
+
+	req->msg.object_id = READ_ONCE(object->ondemand_id);
+	if (!req->msg.object_id) {
+		kfree(req);
+		return -EIO;
+	}
+	load = (void *)req->msg.data;
+	load->off = pos;
+	load->len = len;
+
+	ret = cachefiles_ondemand_send(cache, req, true);
+	kfree(req);
+	return ret;
+}
+
+/*
+ * tell the daemon an object it has open is gone
+ */
+void cachefiles_ondemand_close(struct cachefiles_object *object)
+{
+	struct cachefiles_cache *cache = container_of(object->fscache.cache,
+					struct cachefiles_cache, cache);
+	struct cachefiles_req *req;
+	int object_id;
+
+	object_id = READ_ONCE(object->ondemand_id);
+	if (!object_id)
+		return;
+
+	req = cachefiles_ondemand_alloc_req(object, CACHEFILES_OP_CLOSE, 0);
+	if (!req)
+		return;
+	req->msg.object_id = object_id;
+	if (cachefiles_ondemand_send(cache, req, false) < 0)
+		kfree(req);
+}
@@ -440,6 +440,19 @@ int cachefiles_read_or_alloc_page(struct fscache_retrieval *op,
 	       (unsigned long long) block0,
 	       (unsigned long long) block);
 
+	/* in on-demand mode a hole is filled by the daemon, and there is no
+	 * netfs write to allocate for */
+	if (!block && cachefiles_in_ondemand_mode(cache)) {
+		ret = cachefiles_ondemand_read(object,
+				(loff_t)page->index << PAGE_SHIFT, PAGE_SIZE);
+		if (ret < 0)
+			goto enobufs;
+		block = inode->i_mapping->a_ops->bmap(inode->i_mapping,
+						      block0);
+		if (!block)
+			goto enobufs;
+	}
+
 	if (block) {
 		/* submit the apparently valid page to the backing fs to be
 		 * read from disk */
@@ -119,6 +119,36 @@ struct dentry_stat_t dentry_stat = {
 
 static DEFINE_PER_CPU(long, nr_dentry);
 static DEFINE_PER_CPU(long, nr_dentry_unused);
+static DEFINE_PER_CPU(long, nr_dentry_negative);
+
+/*
+ * Upper bound on the unused negative dentries of one superblock, 0 for
+ * none.  Going over it kicks negative_dentry_work, which prunes the oldest
+ * ones down to the limit.
+ */
+unsigned long sysctl_negative_dentry_limit __read_mostly;
+
+static void prune_negative_dentries(struct work_struct *work);
+static DECLARE_WORK(negative_dentry_work, prune_negative_dentries);
+
+/* d_lock held, for dentries on an LRU or shrink list */
+static void d_negative_inc(struct dentry *dentry)
+{
+	struct super_block *sb = dentry->d_sb;
+	unsigned long limit = READ_ONCE(sysctl_negative_dentry_limit);
+
+	this_cpu_inc(nr_dentry_negative);
+	percpu_counter_inc(&sb->s_nr_negative_dentry);
+	if (unlikely(limit) &&
+	    percpu_counter_read(&sb->s_nr_negative_dentry) > (s64)limit)
+		schedule_work(&negative_dentry_work);
+}
+
+static void d_negative_dec(struct dentry *dentry)
+{
+	this_cpu_dec(nr_dentry_negative);
+	percpu_counter_dec(&dentry->d_sb->s_nr_negative_dentry);
+}
 
 #if defined(CONFIG_SYSCTL) && defined(CONFIG_PROC_FS)
 
@@ -152,11 +182,22 @@ static long get_nr_dentry_unused(void)
 	return sum < 0 ? 0 : sum;
 }
 
+static long get_nr_dentry_negative(void)
+{
+	int i;
+	long sum = 0;
+
+	for_each_possible_cpu(i)
+		sum += per_cpu(nr_dentry_negative, i);
+	return sum < 0 ? 0 : sum;
+}
+
 int proc_nr_dentry(struct ctl_table *table, int write, void __user *buffer,
 		   size_t *lenp, loff_t *ppos)
 {
 	dentry_stat.nr_dentry = get_nr_dentry();
 	dentry_stat.nr_unused = get_nr_dentry_unused();
+	dentry_stat.nr_negative = get_nr_dentry_negative();
 	return proc_doulongvec_minmax(table, write, buffer, lenp, ppos);
 }
 #endif
@@ -364,6 +405,8 @@ static void dentry_unlink_inode(struct dentry * dentry)
 	__d_clear_type_and_inode(dentry);
 	hlist_del_init(&dentry->d_u.d_alias);
 	raw_write_seqcount_end(&dentry->d_seq);
+	if (dentry->d_flags & DCACHE_LRU_LIST)
+		d_negative_inc(dentry);
 	spin_unlock(&dentry->d_lock);
 	spin_unlock(&inode->i_lock);
 	if (!inode->i_nlink)
@@ -383,7 +426,8 @@ static void dentry_unlink_inode(struct dentry * dentry)
  * on the shrink list (ie not on the superblock LRU list).
  *
  * The per-cpu "nr_dentry_unused" counters are updated with
- * the DCACHE_LRU_LIST bit.
+ * the DCACHE_LRU_LIST bit, and so are the "nr_dentry_negative" ones
+ * and the superblock's negative count for negative dentries.
  *
  * These helper functions make sure we always follow the
  * rules. d_lock must be held by the caller.
@@ -394,6 +438,8 @@ static void d_lru_add(struct dentry *dentry)
 	D_FLAG_VERIFY(dentry, 0);
 	dentry->d_flags |= DCACHE_LRU_LIST;
 	this_cpu_inc(nr_dentry_unused);
+	if (d_is_negative(dentry))
+		d_negative_inc(dentry);
 	WARN_ON_ONCE(!list_lru_add(&dentry->d_sb->s_dentry_lru, &dentry->d_lru));
 }
 
@@ -402,6 +448,8 @@ static void d_lru_del(struct dentry *dentry)
 	D_FLAG_VERIFY(dentry, DCACHE_LRU_LIST);
 	dentry->d_flags &= ~DCACHE_LRU_LIST;
 	this_cpu_dec(nr_dentry_unused);
+	if (d_is_negative(dentry))
+		d_negative_dec(dentry);
 	WARN_ON_ONCE(!list_lru_del(&dentry->d_sb->s_dentry_lru, &dentry->d_lru));
 }
 
@@ -411,6 +459,8 @@ static void d_shrink_del(struct dentry *dentry)
 	list_del_init(&dentry->d_lru);
 	dentry->d_flags &= ~(DCACHE_SHRINK_LIST | DCACHE_LRU_LIST);
 	this_cpu_dec(nr_dentry_unused);
+	if (d_is_negative(dentry))
+		d_negative_dec(dentry);
 }
 
 static void d_shrink_add(struct dentry *dentry, struct list_head *list)
@@ -419,6 +469,8 @@ static void d_shrink_add(struct dentry *dentry, struct list_head *list)
 	list_add(&dentry->d_lru, list);
 	dentry->d_flags |= DCACHE_SHRINK_LIST | DCACHE_LRU_LIST;
 	this_cpu_inc(nr_dentry_unused);
+	if (d_is_negative(dentry))
+		d_negative_inc(dentry);
 }
 
 /*
@@ -432,6 +484,8 @@ static void d_lru_isolate(struct list_lru_one *lru, struct dentry *dentry)
 	D_FLAG_VERIFY(dentry, DCACHE_LRU_LIST);
 	dentry->d_flags &= ~DCACHE_LRU_LIST;
 	this_cpu_dec(nr_dentry_unused);
+	if (d_is_negative(dentry))
+		d_negative_dec(dentry);
 	list_lru_isolate(lru, &dentry->d_lru);
 }
 
@@ -1240,6 +1294,90 @@ void shrink_dcache_sb(struct super_block *sb)
 }
 EXPORT_SYMBOL(shrink_dcache_sb);
 
+struct negative_prune {
+	struct list_head dispose;
+	long nr;		/* negative dentries still to take */
+	unsigned long walked;
+};
+
+static enum lru_status dentry_negative_isolate(struct list_head *item,
+		struct list_lru_one *lru, spinlock_t *lru_lock, void *arg)
+{
+	struct negative_prune *np = arg;
+	struct dentry *dentry = container_of(item, struct dentry, d_lru);
+
+	np->walked++;
+	if (!np->nr || !spin_trylock(&dentry->d_lock))
+		return LRU_SKIP;
+
+	if (dentry->d_lockref.count) {
+		d_lru_isolate(lru, dentry);
+		spin_unlock(&dentry->d_lock);
+		return LRU_REMOVED;
+	}
+
+	/*
+	 * Positive dentries are left to the shrinker, move them out of the
+	 * way with their referenced bit intact so the next batch gets to new
+	 * entries.  Referenced negative dentries get another pass, as they
+	 * would from the shrinker.
+	 */
+	if (!d_is_negative(dentry)) {
+		spin_unlock(&dentry->d_lock);
+		return LRU_ROTATE;
+	}
+	if (dentry->d_flags & DCACHE_REFERENCED) {
+		dentry->d_flags &= ~DCACHE_REFERENCED;
+		spin_unlock(&dentry->d_lock);
+		return LRU_ROTATE;
+	}
+
+	d_lru_shrink_move(lru, dentry, &np->dispose);
+	np->nr--;
+	spin_unlock(&dentry->d_lock);
+	return LRU_REMOVED;
+}
+
+/*
+ * Bring the unused negative dentries of @sb back under the limit, oldest
+ * first.  At most one pass over the LRU is made, in batches so that the LRU
+ * lock is not held for long.
+ */
+static void prune_negative_dentries_sb(struct super_block *sb, void *unused)
+{
+	unsigned long limit = READ_ONCE(sysctl_negative_dentry_limit);
+	struct negative_prune np = { .walked = 0 };
+	unsigned long nr_lru;
+	s64 excess;
+
+	if (!limit)
+		return;
+	excess = percpu_counter_sum(&sb->s_nr_negative_dentry) - (s64)limit;
+	if (excess <= 0)
+		return;
+
+	nr_lru = list_lru_count(&sb->s_dentry_lru);
+	while (excess > 0 && np.walked < nr_lru) {
+		unsigned long walked = np.walked;
+
+		INIT_LIST_HEAD(&np.dispose);
+		np.nr = min_t(s64, excess, 1024);
+		excess -= np.nr;
+		list_lru_walk(&sb->s_dentry_lru, dentry_negative_isolate, &np,
+			      1024);
+		excess += np.nr;
+		shrink_dentry_list(&np.dispose);
+		if (np.walked == walked)
+			break;
+		cond_resched();
+	}
+}
+
+static void prune_negative_dentries(struct work_struct *work)
+{
+	iterate_supers(prune_negative_dentries_sb, NULL);
+}
+
 /**
  * enum d_walk_ret - action to talke during tree walk
  * @D_WALK_CONTINUE:	contrinue walk
@@ -1870,6 +2008,9 @@ static void __d_instantiate(struct dentry *dentry, struct inode *inode)
 	WARN_ON(d_in_lookup(dentry));
 
 	spin_lock(&dentry->d_lock);
+	/* a negative dentry on the LRU is about to become positive */
+	if (dentry->d_flags & DCACHE_LRU_LIST)
+		d_negative_dec(dentry);
 	hlist_add_head(&dentry->d_u.d_alias, &inode->i_dentry);
 	raw_write_seqcount_begin(&dentry->d_seq);
 	__d_set_inode_and_type(dentry, inode, add_flags);
@@ -3115,7 +3256,8 @@ static void __init dcache_init(void)
 	 * of the dcache.
 	 */
 	dentry_cache = KMEM_CACHE_USERCOPY(dentry,
-		SLAB_RECLAIM_ACCOUNT|SLAB_PANIC|SLAB_MEM_SPREAD|SLAB_ACCOUNT,
+		SLAB_RECLAIM_ACCOUNT|SLAB_PANIC|SLAB_MEM_SPREAD|SLAB_ACCOUNT|
+		SLAB_SHEAVES,
 		d_iname);
 
 	/* Hash may have been set up in dcache_init_early */
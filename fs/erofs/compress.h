@@ -55,4 +55,12 @@ static inline bool z_erofs_put_stagingpage(struct list_head *pagepool,
 int z_erofs_decompress(struct z_erofs_decompress_req *rq,
 		       struct list_head *pagepool);
 
+#ifdef CONFIG_EROFS_FS_ZIP_ZSTD
+int z_erofs_zstd_decompress(struct z_erofs_decompress_req *rq,
+			    struct list_head *pagepool);
+void z_erofs_zstd_exit(void);
+#else
+static inline void z_erofs_zstd_exit(void) {}
+#endif
+
 #endif
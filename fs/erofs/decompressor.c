@@ -24,6 +24,12 @@ struct z_erofs_decompressor {
 	int (*prepare_destpages)(struct z_erofs_decompress_req *rq,
 				 struct list_head *pagepool);
 	int (*decompress)(struct z_erofs_decompress_req *rq, u8 *out);
+	/*
+	 * if set, used instead of the two above: decompresses straight into
+	 * rq->out page by page and may sleep, e.g. for a shared context.
+	 */
+	int (*decompress_pages)(struct z_erofs_decompress_req *rq,
+				struct list_head *pagepool);
 	char *name;
 };
 
@@ -195,8 +201,21 @@ static struct z_erofs_decompressor decompressors[] = {
 		.decompress = z_erofs_lz4_decompress,
 		.name = "lz4"
 	},
+#ifdef CONFIG_EROFS_FS_ZIP_ZSTD
+	[Z_EROFS_COMPRESSION_ZSTD] = {
+		.decompress_pages = z_erofs_zstd_decompress,
+		.name = "zstd"
+	},
+#endif
 };
 
+bool z_erofs_decompressor_supported(unsigned int alg)
+{
+	return alg < Z_EROFS_COMPRESSION_MAX &&
+		(decompressors[alg].decompress ||
+		 decompressors[alg].decompress_pages);
+}
+
 static void copy_from_pcpubuf(struct page **out, const char *dst,
 			      unsigned short pageofs_out,
 			      unsigned int outputsize)
@@ -337,7 +356,11 @@ static int z_erofs_shifted_transform(const struct z_erofs_decompress_req *rq,
 int z_erofs_decompress(struct z_erofs_decompress_req *rq,
 		       struct list_head *pagepool)
 {
+	const struct z_erofs_decompressor *alg = decompressors + rq->alg;
+
 	if (rq->alg == Z_EROFS_COMPRESSION_SHIFTED)
 		return z_erofs_shifted_transform(rq, pagepool);
+	if (alg->decompress_pages)
+		return alg->decompress_pages(rq, pagepool);
 	return z_erofs_decompress_generic(rq, pagepool);
 }
@@ -0,0 +1,204 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (C) 2022, Alibaba Cloud
+ */
+#include <linux/zstd.h>
+#include "compress.h"
+
+/* pclusters never decompress to more than this */
+#define Z_EROFS_ZSTD_MAX_WINDOW	(1U << 20)
+
+struct z_erofs_zstd {
+	struct z_erofs_zstd *next;
+	void *wksp;
+	size_t wksp_size;
+	u8 *inbuf;		/* the whole pcluster, copied */
+	u8 *bounce;		/* for the output pages not needed */
+};
+
+/*
+ * Streams are large, they are only allocated when zstd pclusters are read,
+ * up to one per possible CPU, and then kept around.
+ */
+static DEFINE_SPINLOCK(z_erofs_zstd_lock);
+static struct z_erofs_zstd *z_erofs_zstd_head;
+static unsigned int z_erofs_zstd_nstrms;
+static DECLARE_WAIT_QUEUE_HEAD(z_erofs_zstd_wq);
+
+static void z_erofs_zstd_free(struct z_erofs_zstd *strm)
+{
+	kvfree(strm->wksp);
+	kvfree(strm->inbuf);
+	kfree(strm->bounce);
+	kfree(strm);
+}
+
+static struct z_erofs_zstd *z_erofs_zstd_alloc(void)
+{
+	struct z_erofs_zstd *strm;
+
+	strm = kzalloc(sizeof(*strm), GFP_KERNEL);
+	if (!strm)
+		return NULL;
+
+	strm->wksp_size = ZSTD_DStreamWorkspaceBound(Z_EROFS_ZSTD_MAX_WINDOW);
+	strm->wksp = kvmalloc(strm->wksp_size, GFP_KERNEL);
+	strm->inbuf = kvmalloc(Z_EROFS_CLUSTER_MAX_PAGES * PAGE_SIZE,
+			       GFP_KERNEL);
+	strm->bounce = kmalloc(PAGE_SIZE, GFP_KERNEL);
+	if (!strm->wksp || !strm->inbuf || !strm->bounce) {
+		z_erofs_zstd_free(strm);
+		return NULL;
+	}
+	return strm;
+}
+
+static struct z_erofs_zstd *z_erofs_zstd_get(void)
+{
+	struct z_erofs_zstd *strm;
+	unsigned int nstrms;
+
+again:
+	spin_lock(&z_erofs_zstd_lock);
+	strm = z_erofs_zstd_head;
+	if (strm) {
+		z_erofs_zstd_head = strm->next;
+		spin_unlock(&z_erofs_zstd_lock);
+		return strm;
+	}
+	if (z_erofs_zstd_nstrms < num_possible_cpus()) {
+		++z_erofs_zstd_nstrms;
+		spin_unlock(&z_erofs_zstd_lock);
+
+		strm = z_erofs_zstd_alloc();
+		if (strm)
+			return strm;
+
+		spin_lock(&z_erofs_zstd_lock);
+		nstrms = --z_erofs_zstd_nstrms;
+		spin_unlock(&z_erofs_zstd_lock);
+		/* nobody to wait for */
+		if (!nstrms)
+			return ERR_PTR(-ENOMEM);
+	} else {
+		spin_unlock(&z_erofs_zstd_lock);
+	}
+
+	wait_event(z_erofs_zstd_wq, READ_ONCE(z_erofs_zstd_head));
+	goto again;
+}
+
+static void z_erofs_zstd_put(struct z_erofs_zstd *strm)
+{
+	spin_lock(&z_erofs_zstd_lock);
+	strm->next = z_erofs_zstd_head;
+	z_erofs_zstd_head = strm;
+	spin_unlock(&z_erofs_zstd_lock);
+	wake_up(&z_erofs_zstd_wq);
+}
+
+void z_erofs_zstd_exit(void)
+{
+	struct z_erofs_zstd *strm;
+
+	while ((strm = z_erofs_zstd_head)) {
+		z_erofs_zstd_head = strm->next;
+		z_erofs_zstd_free(strm);
+	}
+}
+
+int z_erofs_zstd_decompress(struct z_erofs_decompress_req *rq,
+			    struct list_head *pagepool)
+{
+	const unsigned int nrpages_in =
+		PAGE_ALIGN(rq->inputsize) >> PAGE_SHIFT;
+	const unsigned int nrpages_out =
+		PAGE_ALIGN(rq->pageofs_out + rq->outputsize) >> PAGE_SHIFT;
+	unsigned int i, inputmargin, pageofs, remaining;
+	struct z_erofs_zstd *strm;
+	ZSTD_inBuffer in_buf;
+	ZSTD_DStream *stream;
+	int err = 0;
+
+	if (nrpages_in > Z_EROFS_CLUSTER_MAX_PAGES)
+		return -EOPNOTSUPP;
+
+	strm = z_erofs_zstd_get();
+	if (IS_ERR(strm))
+		return PTR_ERR(strm);
+
+	/* the output may overlap the input for inplace I/O, copy it first */
+	for (i = 0; i < nrpages_in; ++i) {
+		unsigned int cnt = min_t(unsigned int, PAGE_SIZE,
+					 rq->inputsize - i * PAGE_SIZE);
+		u8 *src = kmap_atomic(rq->in[i]);
+
+		memcpy(strm->inbuf + i * PAGE_SIZE, src, cnt);
+		kunmap_atomic(src);
+	}
+
+	/* skip the 0padding, a zstd frame never starts with 0 */
+	inputmargin = 0;
+	while (inputmargin < rq->inputsize && !strm->inbuf[inputmargin])
+		++inputmargin;
+	if (inputmargin >= rq->inputsize) {
+		err = -EFSCORRUPTED;
+		goto out;
+	}
+
+	stream = ZSTD_initDStream(Z_EROFS_ZSTD_MAX_WINDOW, strm->wksp,
+				  strm->wksp_size);
+	if (!stream) {
+		err = -EIO;
+		goto out;
+	}
+
+	in_buf.src = strm->inbuf + inputmargin;
+	in_buf.size = rq->inputsize - inputmargin;
+	in_buf.pos = 0;
+
+	pageofs = rq->pageofs_out;
+	remaining = rq->outputsize;
+	for (i = 0; i < nrpages_out && remaining; ++i) {
+		struct page *page = rq->out[i];
+		unsigned int cnt = min_t(unsigned int, PAGE_SIZE - pageofs,
+					 remaining);
+		ZSTD_outBuffer out_buf;
+		u8 *dst = page ? kmap(page) : strm->bounce;
+
+		out_buf.dst = dst + pageofs;
+		out_buf.size = cnt;
+		out_buf.pos = 0;
+
+		while (out_buf.pos < out_buf.size) {
+			size_t pos = out_buf.pos;
+			size_t zerr = ZSTD_decompressStream(stream, &out_buf,
+							    &in_buf);
+
+			if (ZSTD_isError(zerr)) {
+				erofs_err(rq->sb, "zstd decompression error %d",
+					  ZSTD_getErrorCode(zerr));
+				err = -EIO;
+				break;
+			}
+			/* the frame ended or stalled short of the output */
+			if (out_buf.pos < out_buf.size &&
+			    (!zerr || (out_buf.pos == pos &&
+				       in_buf.pos == in_buf.size))) {
+				erofs_err(rq->sb, "zstd stream too short, in[%u] out[%u]",
+					  rq->inputsize, rq->outputsize);
+				err = -EIO;
+				break;
+			}
+		}
+		if (page)
+			kunmap(page);
+		if (err)
+			break;
+		remaining -= cnt;
+		pageofs = 0;
+	}
+out:
+	z_erofs_zstd_put(strm);
+	return err;
+}
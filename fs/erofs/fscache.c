@@ -0,0 +1,561 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (C) 2022, Alibaba Cloud
+ *
+ * fscache mode: mounted with fsid=, the image and its extra devices are
+ * blobs in fscache rather than block devices or files.  Together with the
+ * cachefiles on-demand mode, a blob missing from the cache is fetched by
+ * the cachefiles daemon, only the parts that are actually read.
+ *
+ * Mounts given the same domain_id= share their blobs: the cookie and the
+ * pseudo inode of a blob are looked up by name within the domain, so the
+ * chunks several images have in common are cached once, keyed by blob and
+ * offset.  Such pseudo inodes live on an internal mount since they outlive
+ * any one superblock, and regular files read straight from them rather than
+ * keeping a copy in their own page cache, mmap() aside.
+ */
+#include <linux/fscache.h>
+#include <linux/mount.h>
+#include <linux/uio.h>
+#include "internal.h"
+
+static struct fscache_netfs erofs_fscache_netfs = {
+	.name		= "erofs",
+	.version	= 0,
+};
+
+struct erofs_domain {
+	refcount_t ref;
+	struct list_head list;
+	struct fscache_cookie *volume;
+	char *domain_id;
+};
+
+/* protects the lists and the pseudo mount */
+static DEFINE_MUTEX(erofs_domain_list_lock);
+static LIST_HEAD(erofs_domain_list);
+static LIST_HEAD(erofs_domain_cookies_list);
+static struct vfsmount *erofs_pseudo_mnt;
+
+static struct dentry *erofs_anon_mount(struct file_system_type *fs_type,
+				       int flags, const char *dev_name,
+				       void *data)
+{
+	return mount_pseudo(fs_type, "erofs:", NULL, NULL, EROFS_SUPER_MAGIC);
+}
+
+static struct file_system_type erofs_anon_fs_type = {
+	.owner		= THIS_MODULE,
+	.name		= "pseudo_erofs",
+	.mount		= erofs_anon_mount,
+	.kill_sb	= kill_anon_super,
+};
+
+/* one volume per fsid */
+static const struct fscache_cookie_def erofs_fscache_volume_def = {
+	.name		= "erofs.volume",
+	.type		= FSCACHE_COOKIE_TYPE_INDEX,
+};
+
+/* one data file per blob */
+static const struct fscache_cookie_def erofs_fscache_blob_def = {
+	.name		= "erofs.blob",
+	.type		= FSCACHE_COOKIE_TYPE_DATAFILE,
+};
+
+static void erofs_fscache_read_done(struct page *page, void *context,
+				    int error)
+{
+	if (!error)
+		SetPageUptodate(page);
+	else
+		SetPageError(page);
+	unlock_page(page);
+}
+
+/* read a page of the blob cached by the pseudo inode */
+static int erofs_fscache_meta_readpage(struct file *data, struct page *page)
+{
+	struct erofs_fscache *ctx = page->mapping->host->i_private;
+	int ret;
+
+	ret = fscache_read_or_alloc_page(ctx->cookie, page,
+					 erofs_fscache_read_done, NULL,
+					 GFP_NOFS);
+	if (!ret)
+		return 0;	/* unlocked on completion */
+
+	if (ret == -ENODATA)
+		fscache_uncache_page(ctx->cookie, page);
+	SetPageError(page);
+	unlock_page(page);
+	return -EIO;
+}
+
+static int erofs_fscache_releasepage(struct page *page, gfp_t gfp)
+{
+	struct erofs_fscache *ctx = page->mapping->host->i_private;
+
+	return fscache_maybe_release_page(ctx->cookie, page, gfp);
+}
+
+static void erofs_fscache_invalidatepage(struct page *page,
+					 unsigned int offset,
+					 unsigned int length)
+{
+	struct erofs_fscache *ctx = page->mapping->host->i_private;
+
+	DBG_BUGON(!PageLocked(page));
+
+	if (offset == 0 && length == PAGE_SIZE) {
+		fscache_wait_on_page_write(ctx->cookie, page);
+		fscache_uncache_page(ctx->cookie, page);
+	}
+}
+
+static const struct address_space_operations erofs_fscache_meta_aops = {
+	.readpage	= erofs_fscache_meta_readpage,
+	.releasepage	= erofs_fscache_releasepage,
+	.invalidatepage	= erofs_fscache_invalidatepage,
+};
+
+static struct page *erofs_fscache_get_page(struct erofs_fscache *ctx,
+					   pgoff_t index)
+{
+	struct address_space *mapping = ctx->inode->i_mapping;
+
+	return read_cache_page_gfp(mapping, index,
+			mapping_gfp_constraint(mapping, ~__GFP_FS));
+}
+
+struct page *erofs_fscache_read_meta_page(struct super_block *sb,
+					  pgoff_t index)
+{
+	return erofs_fscache_get_page(EROFS_SB(sb)->s_fscache, index);
+}
+
+/* copy @len bytes at @pa of the blob to the start of @page */
+static int erofs_fscache_copy(struct erofs_fscache *ctx, erofs_off_t pa,
+			      struct page *page, unsigned int len)
+{
+	unsigned int done = 0;
+
+	while (done < len) {
+		unsigned int off = offset_in_page(pa + done);
+		unsigned int cnt = min_t(unsigned int, len - done,
+					 PAGE_SIZE - off);
+		struct page *src;
+		void *dst, *kaddr;
+
+		src = erofs_fscache_get_page(ctx, (pa + done) >> PAGE_SHIFT);
+		if (IS_ERR(src))
+			return PTR_ERR(src);
+
+		kaddr = kmap_atomic(src);
+		dst = kmap_atomic(page);
+		memcpy(dst + done, kaddr + off, cnt);
+		kunmap_atomic(dst);
+		kunmap_atomic(kaddr);
+		put_page(src);
+		done += cnt;
+	}
+	return 0;
+}
+
+static int erofs_fscache_readpage(struct file *file, struct page *page)
+{
+	struct inode *inode = page->mapping->host;
+	struct super_block *sb = inode->i_sb;
+	erofs_off_t pos = page_offset(page);
+	struct erofs_map_blocks map = { .m_la = pos };
+	struct erofs_map_dev mdev;
+	unsigned int len = 0;
+	int ret;
+
+	ret = erofs_map_blocks(inode, &map, EROFS_GET_BLOCKS_RAW);
+	if (ret)
+		goto out;
+
+	if (map.m_flags & EROFS_MAP_MAPPED) {
+		mdev = (struct erofs_map_dev) {
+			.m_deviceid = map.m_deviceid,
+			.m_pa = map.m_pa + (pos - map.m_la),
+		};
+		ret = erofs_map_dev(sb, &mdev);
+		if (ret)
+			goto out;
+		if (!mdev.m_fscache) {
+			ret = -EIO;
+			goto out;
+		}
+
+		len = min_t(u64, PAGE_SIZE, map.m_llen - (pos - map.m_la));
+		ret = erofs_fscache_copy(mdev.m_fscache, mdev.m_pa, page, len);
+		if (ret)
+			goto out;
+	}
+	if (len < PAGE_SIZE)
+		zero_user_segment(page, len, PAGE_SIZE);
+	SetPageUptodate(page);
+out:
+	if (ret)
+		SetPageError(page);
+	unlock_page(page);
+	return ret;
+}
+
+const struct address_space_operations erofs_fscache_access_aops = {
+	.readpage	= erofs_fscache_readpage,
+};
+
+/* copy @len bytes at @pa of the blob to @to, returns what was copied */
+static size_t erofs_fscache_copy_to_iter(struct erofs_fscache *ctx,
+					 erofs_off_t pa, size_t len,
+					 struct iov_iter *to, int *err)
+{
+	size_t done = 0;
+
+	while (done < len) {
+		unsigned int off = offset_in_page(pa + done);
+		size_t cnt = min_t(size_t, len - done, PAGE_SIZE - off);
+		struct page *src;
+		size_t copied;
+
+		src = erofs_fscache_get_page(ctx, (pa + done) >> PAGE_SHIFT);
+		if (IS_ERR(src)) {
+			*err = PTR_ERR(src);
+			break;
+		}
+		copied = copy_page_to_iter(src, off, cnt, to);
+		put_page(src);
+		done += copied;
+		if (copied < cnt) {
+			*err = -EFAULT;
+			break;
+		}
+	}
+	return done;
+}
+
+static ssize_t erofs_fscache_file_read_iter(struct kiocb *iocb,
+					    struct iov_iter *to)
+{
+	struct inode *inode = file_inode(iocb->ki_filp);
+	struct super_block *sb = inode->i_sb;
+	ssize_t done = 0;
+	int err = 0;
+
+	while (iov_iter_count(to) && iocb->ki_pos < inode->i_size) {
+		erofs_off_t pos = iocb->ki_pos;
+		struct erofs_map_blocks map = { .m_la = pos };
+		struct erofs_map_dev mdev;
+		size_t count, copied;
+
+		err = erofs_map_blocks(inode, &map, EROFS_GET_BLOCKS_RAW);
+		if (err)
+			break;
+
+		count = min_t(u64, iov_iter_count(to), inode->i_size - pos);
+		count = min_t(u64, count, map.m_la + map.m_llen - pos);
+		if (!count) {
+			err = -EFSCORRUPTED;
+			break;
+		}
+
+		if (!(map.m_flags & EROFS_MAP_MAPPED)) {
+			copied = iov_iter_zero(count, to);
+			if (copied < count)
+				err = -EFAULT;
+		} else {
+			mdev = (struct erofs_map_dev) {
+				.m_deviceid = map.m_deviceid,
+				.m_pa = map.m_pa + (pos - map.m_la),
+			};
+			err = erofs_map_dev(sb, &mdev);
+			if (err)
+				break;
+			if (!mdev.m_fscache) {
+				err = -EIO;
+				break;
+			}
+			copied = erofs_fscache_copy_to_iter(mdev.m_fscache,
+					mdev.m_pa, count, to, &err);
+		}
+		iocb->ki_pos += copied;
+		done += copied;
+		if (err)
+			break;
+	}
+	return done ?: err;
+}
+
+/* read() shares the blob pages, only mmap() goes through the page cache */
+const struct file_operations erofs_fscache_file_fops = {
+	.llseek		= generic_file_llseek,
+	.read_iter	= erofs_fscache_file_read_iter,
+	.mmap		= generic_file_readonly_mmap,
+	.splice_read	= generic_file_splice_read,
+};
+
+static struct erofs_fscache *erofs_fscache_acquire(struct super_block *sb,
+						   struct fscache_cookie *volume,
+						   struct super_block *isb,
+						   char *name)
+{
+	struct fscache_cookie *cookie;
+	struct erofs_fscache *ctx;
+	struct inode *inode;
+
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return ERR_PTR(-ENOMEM);
+
+	cookie = fscache_acquire_cookie(volume, &erofs_fscache_blob_def,
+					name, strlen(name), NULL, 0,
+					ctx, 0, true);
+	if (!cookie) {
+		erofs_err(sb, "failed to get cookie for %s", name);
+		kfree(ctx);
+		return ERR_PTR(-EINVAL);
+	}
+
+	inode = new_inode(isb);
+	if (!inode) {
+		fscache_relinquish_cookie(cookie, NULL, false);
+		kfree(ctx);
+		return ERR_PTR(-ENOMEM);
+	}
+	set_nlink(inode, 1);
+	inode->i_size = OFFSET_MAX;
+	inode->i_private = ctx;
+	inode->i_mapping->a_ops = &erofs_fscache_meta_aops;
+	mapping_set_gfp_mask(inode->i_mapping, GFP_NOFS);
+
+	ctx->cookie = cookie;
+	ctx->inode = inode;
+	INIT_LIST_HEAD(&ctx->node);
+	refcount_set(&ctx->ref, 1);
+	return ctx;
+}
+
+static void erofs_fscache_relinquish(struct erofs_fscache *ctx)
+{
+	fscache_uncache_all_inode_pages(ctx->cookie, ctx->inode);
+	fscache_relinquish_cookie(ctx->cookie, NULL, false);
+	iput(ctx->inode);
+	kfree(ctx->name);
+	kfree(ctx);
+}
+
+static void erofs_domain_put(struct erofs_domain *domain)
+{
+	mutex_lock(&erofs_domain_list_lock);
+	if (refcount_dec_and_test(&domain->ref)) {
+		list_del(&domain->list);
+		fscache_relinquish_cookie(domain->volume, NULL, false);
+		kfree(domain->domain_id);
+		kfree(domain);
+	}
+	mutex_unlock(&erofs_domain_list_lock);
+}
+
+static int erofs_domain_get(struct super_block *sb)
+{
+	struct erofs_sb_info *sbi = EROFS_SB(sb);
+	struct erofs_domain *domain;
+	struct vfsmount *mnt;
+	int err = 0;
+
+	mutex_lock(&erofs_domain_list_lock);
+	list_for_each_entry(domain, &erofs_domain_list, list) {
+		if (!strcmp(domain->domain_id, sbi->domain_id)) {
+			refcount_inc(&domain->ref);
+			goto found;
+		}
+	}
+
+	if (!erofs_pseudo_mnt) {
+		mnt = kern_mount(&erofs_anon_fs_type);
+		if (IS_ERR(mnt)) {
+			err = PTR_ERR(mnt);
+			goto out;
+		}
+		erofs_pseudo_mnt = mnt;
+	}
+
+	err = -ENOMEM;
+	domain = kzalloc(sizeof(*domain), GFP_KERNEL);
+	if (!domain)
+		goto out;
+	domain->domain_id = kstrdup(sbi->domain_id, GFP_KERNEL);
+	if (!domain->domain_id) {
+		kfree(domain);
+		goto out;
+	}
+	domain->volume = fscache_acquire_cookie(
+				erofs_fscache_netfs.primary_index,
+				&erofs_fscache_volume_def,
+				domain->domain_id, strlen(domain->domain_id),
+				NULL, 0, NULL, 0, true);
+	if (!domain->volume) {
+		erofs_err(sb, "failed to register volume for domain %s",
+			  domain->domain_id);
+		kfree(domain->domain_id);
+		kfree(domain);
+		err = -EINVAL;
+		goto out;
+	}
+	refcount_set(&domain->ref, 1);
+	list_add(&domain->list, &erofs_domain_list);
+found:
+	sbi->domain = domain;
+	sbi->volume = domain->volume;
+	err = 0;
+out:
+	mutex_unlock(&erofs_domain_list_lock);
+	return err;
+}
+
+/* look the blob @name up in the domain, acquiring it on first use */
+static struct erofs_fscache *erofs_domain_get_cookie(struct super_block *sb,
+						     char *name)
+{
+	struct erofs_domain *domain = EROFS_SB(sb)->domain;
+	struct erofs_fscache *ctx;
+
+	mutex_lock(&erofs_domain_list_lock);
+	list_for_each_entry(ctx, &erofs_domain_cookies_list, node) {
+		if (ctx->domain == domain && !strcmp(ctx->name, name)) {
+			refcount_inc(&ctx->ref);
+			goto out;
+		}
+	}
+
+	ctx = erofs_fscache_acquire(sb, domain->volume,
+				    erofs_pseudo_mnt->mnt_sb, name);
+	if (IS_ERR(ctx))
+		goto out;
+	ctx->name = kstrdup(name, GFP_KERNEL);
+	if (!ctx->name) {
+		erofs_fscache_relinquish(ctx);
+		ctx = ERR_PTR(-ENOMEM);
+		goto out;
+	}
+	/* the cookie is relinquished before its volume */
+	refcount_inc(&domain->ref);
+	ctx->domain = domain;
+	list_add(&ctx->node, &erofs_domain_cookies_list);
+out:
+	mutex_unlock(&erofs_domain_list_lock);
+	return ctx;
+}
+
+int erofs_fscache_register_cookie(struct super_block *sb,
+				  struct erofs_fscache **fscache, char *name)
+{
+	struct erofs_fscache *ctx;
+
+	if (EROFS_SB(sb)->domain)
+		ctx = erofs_domain_get_cookie(sb, name);
+	else
+		ctx = erofs_fscache_acquire(sb, EROFS_SB(sb)->volume, sb,
+					    name);
+	if (IS_ERR(ctx))
+		return PTR_ERR(ctx);
+	*fscache = ctx;
+	return 0;
+}
+
+void erofs_fscache_unregister_cookie(struct erofs_fscache **fscache)
+{
+	struct erofs_fscache *ctx = *fscache;
+	struct erofs_domain *domain;
+
+	if (!ctx)
+		return;
+	*fscache = NULL;
+
+	domain = ctx->domain;
+	if (!domain) {
+		erofs_fscache_relinquish(ctx);
+		return;
+	}
+
+	mutex_lock(&erofs_domain_list_lock);
+	if (!refcount_dec_and_test(&ctx->ref)) {
+		mutex_unlock(&erofs_domain_list_lock);
+		return;
+	}
+	list_del(&ctx->node);
+	mutex_unlock(&erofs_domain_list_lock);
+
+	erofs_fscache_relinquish(ctx);
+	erofs_domain_put(domain);
+}
+
+int erofs_fscache_register_fs(struct super_block *sb)
+{
+	struct erofs_sb_info *sbi = EROFS_SB(sb);
+	struct fscache_cookie *volume;
+	int err;
+
+	if (strlen(sbi->fsid) > 255 ||
+	    (sbi->domain_id && strlen(sbi->domain_id) > 255)) {
+		erofs_err(sb, "fsid or domain_id is too long");
+		return -EINVAL;
+	}
+
+	if (sbi->domain_id) {
+		err = erofs_domain_get(sb);
+		if (err)
+			return err;
+	} else {
+		volume = fscache_acquire_cookie(
+				erofs_fscache_netfs.primary_index,
+				&erofs_fscache_volume_def,
+				sbi->fsid, strlen(sbi->fsid),
+				NULL, 0, NULL, 0, true);
+		if (!volume) {
+			erofs_err(sb, "failed to register volume for %s",
+				  sbi->fsid);
+			return -EINVAL;
+		}
+		sbi->volume = volume;
+	}
+
+	/* the primary blob is named after the fsid as well */
+	return erofs_fscache_register_cookie(sb, &sbi->s_fscache, sbi->fsid);
+}
+
+/* can be called twice, from ->put_super() and ->kill_sb() */
+void erofs_fscache_unregister_fs(struct super_block *sb)
+{
+	struct erofs_sb_info *sbi = EROFS_SB(sb);
+	struct erofs_device_info *dif;
+	int id;
+
+	if (sbi->devs)
+		idr_for_each_entry(&sbi->devs->tree, dif, id)
+			erofs_fscache_unregister_cookie(&dif->fscache);
+	erofs_fscache_unregister_cookie(&sbi->s_fscache);
+
+	if (sbi->domain) {
+		erofs_domain_put(sbi->domain);
+		sbi->domain = NULL;
+	} else if (sbi->volume) {
+		fscache_relinquish_cookie(sbi->volume, NULL, false);
+	}
+	sbi->volume = NULL;
+}
+
+int __init erofs_init_fscache(void)
+{
+	return fscache_register_netfs(&erofs_fscache_netfs);
+}
+
+void erofs_exit_fscache(void)
+{
+	if (erofs_pseudo_mnt)
+		kern_unmount(erofs_pseudo_mnt);
+	fscache_unregister_netfs(&erofs_fscache_netfs);
+}
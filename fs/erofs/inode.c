@@ -266,6 +266,8 @@ static int erofs_fill_inode(struct inode *inode, int isdir)
 		inode->i_op = &erofs_generic_iops;
 		if (inode->i_sb->s_bdev)
 			inode->i_fop = &generic_ro_fops;
+		else if (erofs_is_fscache_mode(inode->i_sb))
+			inode->i_fop = &erofs_fscache_file_fops;
 		else
 			inode->i_fop = &rafs_v6_file_ro_fops;
 		break;
@@ -292,11 +294,17 @@ static int erofs_fill_inode(struct inode *inode, int isdir)
 	}
 
 	if (erofs_inode_is_data_compressed(vi->datalayout)) {
-		err = z_erofs_fill_inode(inode);
+		/* compressed data is only read through bios */
+		if (erofs_is_fscache_mode(inode->i_sb))
+			err = -EOPNOTSUPP;
+		else
+			err = z_erofs_fill_inode(inode);
 		goto out_unlock;
 	}
 	if (inode->i_sb->s_bdev) {
 		inode->i_mapping->a_ops = &erofs_raw_access_aops;
+	} else if (erofs_is_fscache_mode(inode->i_sb)) {
+		inode->i_mapping->a_ops = &erofs_fscache_access_aops;
 	} else if (!S_ISREG(inode->i_mode)) {
 		inode_nohighmem(inode);
 		inode->i_mapping->a_ops = &rafs_v6_aops;
@@ -18,6 +18,7 @@
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
 #include <linux/iomap.h>
+#include <linux/refcount.h>
 #include "erofs_fs.h"
 
 /* redefine pr_fmt "erofs: " */
@@ -48,10 +49,24 @@ typedef u64 erofs_off_t;
 /* data type for filesystem-wide blocks number */
 typedef u32 erofs_blk_t;
 
+struct erofs_domain;
+
+struct erofs_fscache {
+	struct fscache_cookie *cookie;
+	struct inode *inode;	/* pseudo inode caching the blob */
+
+	/* shared by the mounts of a domain, see erofs_domain_get_cookie() */
+	struct erofs_domain *domain;
+	struct list_head node;
+	refcount_t ref;
+	char *name;
+};
+
 struct erofs_device_info {
 	char *path;
 	struct block_device *bdev;
 	struct file *blobfile;
+	struct erofs_fscache *fscache;
 
 	u32 blocks;
 	u32 mapped_blkaddr;
@@ -89,6 +104,13 @@ struct erofs_sb_info {
 	char *bootstrap_path;
 	char *blob_dir_path;
 	struct erofs_dev_context *devs;
+	/* fscache mode: the volume, the primary blob and its fsid */
+	struct fscache_cookie *volume;
+	struct erofs_fscache *s_fscache;
+	char *fsid;
+	/* mounts of the same domain share the blobs' page cache */
+	struct erofs_domain *domain;
+	char *domain_id;
 	u64 total_blocks;
 	u32 primarydevice_blocks;
 
@@ -411,6 +433,7 @@ static inline int z_erofs_map_blocks_iter(struct inode *inode,
 struct erofs_map_dev {
 	struct block_device *m_bdev;
 	struct file *m_fp;
+	struct erofs_fscache *m_fscache;
 
 	erofs_off_t m_pa;
 	unsigned int m_deviceid;
@@ -486,6 +509,7 @@ int erofs_try_to_free_all_cached_pages(struct erofs_sb_info *sbi,
 				       struct erofs_workgroup *egrp);
 int erofs_try_to_free_cached_page(struct address_space *mapping,
 				  struct page *page);
+bool z_erofs_decompressor_supported(unsigned int alg);
 #else
 static inline void erofs_shrinker_register(struct super_block *sb) {}
 static inline void erofs_shrinker_unregister(struct super_block *sb) {}
@@ -495,6 +519,52 @@ static inline int z_erofs_init_zip_subsystem(void) { return 0; }
 static inline void z_erofs_exit_zip_subsystem(void) {}
 #endif	/* !CONFIG_EROFS_FS_ZIP */
 
+/* fscache.c */
+#ifdef CONFIG_EROFS_FS_ONDEMAND
+static inline bool erofs_is_fscache_mode(struct super_block *sb)
+{
+	return !sb->s_bdev && EROFS_SB(sb)->fsid;
+}
+
+int __init erofs_init_fscache(void);
+void erofs_exit_fscache(void);
+int erofs_fscache_register_fs(struct super_block *sb);
+void erofs_fscache_unregister_fs(struct super_block *sb);
+int erofs_fscache_register_cookie(struct super_block *sb,
+				  struct erofs_fscache **fscache, char *name);
+void erofs_fscache_unregister_cookie(struct erofs_fscache **fscache);
+struct page *erofs_fscache_read_meta_page(struct super_block *sb,
+					  pgoff_t index);
+
+extern const struct address_space_operations erofs_fscache_access_aops;
+extern const struct file_operations erofs_fscache_file_fops;
+#else
+static inline bool erofs_is_fscache_mode(struct super_block *sb)
+{
+	return false;
+}
+
+static inline int erofs_init_fscache(void) { return 0; }
+static inline void erofs_exit_fscache(void) {}
+static inline int erofs_fscache_register_fs(struct super_block *sb)
+{
+	return -EOPNOTSUPP;
+}
+static inline void erofs_fscache_unregister_fs(struct super_block *sb) {}
+static inline int erofs_fscache_register_cookie(struct super_block *sb,
+				struct erofs_fscache **fscache, char *name)
+{
+	return -EOPNOTSUPP;
+}
+static inline
+void erofs_fscache_unregister_cookie(struct erofs_fscache **fscache) {}
+static inline struct page *erofs_fscache_read_meta_page(struct super_block *sb,
+							pgoff_t index)
+{
+	return ERR_PTR(-EOPNOTSUPP);
+}
+#endif	/* !CONFIG_EROFS_FS_ONDEMAND */
+
 #define EFSCORRUPTED    EUCLEAN         /* Filesystem is corrupted */
 
 #ifndef lru_to_page
@@ -146,7 +146,7 @@ static int erofs_init_devices(struct super_block *sb,
 		ondisk_extradevs = le16_to_cpu(dsb->extra_devices);
 
 	if (ondisk_extradevs != sbi->devs->extra_devices &&
-	    !sbi->blob_dir_path) {
+	    !sbi->blob_dir_path && !erofs_is_fscache_mode(sb)) {
 		erofs_err(sb, "extra devices don't match (ondisk %u, given %u)",
 			  ondisk_extradevs, sbi->devs->extra_devices);
 		return -EINVAL;
@@ -168,7 +168,12 @@ static int erofs_init_devices(struct super_block *sb,
 		}
 		dis = ptr + erofs_blkoff(pos);
 
-		if (!sbi->bootstrap) {
+		if (erofs_is_fscache_mode(sb)) {
+			err = erofs_fscache_register_cookie(sb, &dif->fscache,
+							    dif->path);
+			if (err)
+				goto err_out;
+		} else if (!sbi->bootstrap) {
 			bdev = blkdev_get_by_path(dif->path,
 						  FMODE_READ | FMODE_EXCL,
 						  sb->s_type);
@@ -218,6 +223,15 @@ static int erofs_init_devices(struct super_block *sb,
 		strncpy(blob_id, dis->u.userdata, sizeof(blob_id));
 		blob_id[sizeof(blob_id) - 1] = '\0';
 
+		/* in fscache mode the blob is named by the device tag */
+		if (erofs_is_fscache_mode(sb)) {
+			err = erofs_fscache_register_cookie(sb, &dif->fscache,
+							    blob_id);
+			if (err)
+				goto err_out;
+			goto next;
+		}
+
 		f = file_open_root(sbi->blob_dir.dentry, sbi->blob_dir.mnt,
 				   blob_id, O_RDONLY | O_LARGEFILE, 0);
 		if (IS_ERR(f)) {
@@ -226,6 +240,7 @@ static int erofs_init_devices(struct super_block *sb,
 			goto err_out;
 		}
 		dif->blobfile = f;
+next:
 		dif->blocks = le32_to_cpu(dis->blocks);
 		dif->mapped_blkaddr = le32_to_cpu(dis->mapped_blkaddr);
 		sbi->total_blocks += dif->blocks;
@@ -370,6 +385,8 @@ enum {
 	Opt_device,
 	Opt_bootstrap_path,
 	Opt_blob_dir_path,
+	Opt_fsid,
+	Opt_domain_id,
 	Opt_err
 };
 
@@ -382,6 +399,8 @@ static match_table_t erofs_tokens = {
 	{Opt_device, "device=%s"},
 	{Opt_bootstrap_path, "bootstrap_path=%s"},
 	{Opt_blob_dir_path, "blob_dir_path=%s"},
+	{Opt_fsid, "fsid=%s"},
+	{Opt_domain_id, "domain_id=%s"},
 	{Opt_err, NULL}
 };
 
@@ -474,6 +493,25 @@ static int erofs_parse_options(struct super_block *sb, char *options)
 				return -ENOMEM;
 			erofs_dbg("RAFS bootstrap_path %s", sbi->bootstrap_path);
 			break;
+#ifdef CONFIG_EROFS_FS_ONDEMAND
+		case Opt_fsid:
+			kfree(sbi->fsid);
+			sbi->fsid = match_strdup(&args[0]);
+			if (!sbi->fsid)
+				return -ENOMEM;
+			break;
+		case Opt_domain_id:
+			kfree(sbi->domain_id);
+			sbi->domain_id = match_strdup(&args[0]);
+			if (!sbi->domain_id)
+				return -ENOMEM;
+			break;
+#else
+		case Opt_fsid:
+		case Opt_domain_id:
+			erofs_err(sb, "fsid and domain_id options not supported");
+			return -EINVAL;
+#endif
 		default:
 			erofs_err(sb, "Unrecognized mount option \"%s\" or missing value", p);
 			return -EINVAL;
@@ -608,10 +646,25 @@ static int erofs_fill_super(struct super_block *sb, void *data, int silent)
 	if (err)
 		return err;
 
+	if (sbi->domain_id && !sbi->fsid) {
+		erofs_err(sb, "domain_id requires fsid");
+		return -EINVAL;
+	}
+
 	err = rafs_v6_fill_super(sb, data);
 	if (err)
 		return err;
 
+	if (erofs_is_fscache_mode(sb)) {
+		if (sbi->bootstrap || sbi->blob_dir_path) {
+			erofs_err(sb, "fsid can't be used with RAFS options");
+			return -EINVAL;
+		}
+		err = erofs_fscache_register_fs(sb);
+		if (err)
+			return err;
+	}
+
 	err = erofs_read_superblock(sb);
 	if (err)
 		return err;
@@ -698,6 +751,8 @@ static bool erofs_mount_is_rafs_v6(char *options)
 		switch (token) {
 		case Opt_bootstrap_path:
 		case Opt_blob_dir_path:
+		case Opt_fsid:
+		case Opt_domain_id:
 			kfree(tmpstr);
 			return true;
 		default:
@@ -734,6 +789,7 @@ static void erofs_kill_sb(struct super_block *sb)
 	sbi = EROFS_SB(sb);
 	if (!sbi)
 		return;
+	erofs_fscache_unregister_fs(sb);
 	erofs_free_dev_context(sbi->devs);
 	if (sbi->bootstrap)
 		filp_close(sbi->bootstrap, NULL);
@@ -742,6 +798,8 @@ static void erofs_kill_sb(struct super_block *sb)
 		kfree(sbi->blob_dir_path);
 	}
 	kfree(sbi->bootstrap_path);
+	kfree(sbi->fsid);
+	kfree(sbi->domain_id);
 	kfree(sbi);
 	sb->s_fs_info = NULL;
 }
@@ -758,6 +816,8 @@ static void erofs_put_super(struct super_block *sb)
 	iput(sbi->managed_cache);
 	sbi->managed_cache = NULL;
 #endif
+	/* the pseudo inodes must go before the busy inodes check */
+	erofs_fscache_unregister_fs(sb);
 }
 
 static struct file_system_type erofs_fs_type = {
@@ -792,6 +852,10 @@ static int __init erofs_module_init(void)
 	if (err)
 		goto zip_err;
 
+	err = erofs_init_fscache();
+	if (err)
+		goto fscache_err;
+
 	err = register_filesystem(&erofs_fs_type);
 	if (err)
 		goto fs_err;
@@ -799,6 +863,8 @@ static int __init erofs_module_init(void)
 	return 0;
 
 fs_err:
+	erofs_exit_fscache();
+fscache_err:
 	z_erofs_exit_zip_subsystem();
 zip_err:
 	erofs_exit_shrinker();
@@ -811,6 +877,7 @@ static int __init erofs_module_init(void)
 static void __exit erofs_module_exit(void)
 {
 	unregister_filesystem(&erofs_fs_type);
+	erofs_exit_fscache();
 	z_erofs_exit_zip_subsystem();
 	erofs_exit_shrinker();
 
@@ -6,6 +6,8 @@
 #include "zdata.h"
 #include "compress.h"
 #include <linux/prefetch.h>
+#include <linux/cpuhotplug.h>
+#include <uapi/linux/sched/types.h>
 
 #include <trace/events/erofs.h>
 
@@ -33,10 +35,107 @@ typedef tagptr1_t compressed_page_t;
 static struct workqueue_struct *z_erofs_workqueue __read_mostly;
 static struct kmem_cache *pcluster_cachep __read_mostly;
 
+#ifdef CONFIG_EROFS_FS_PCPU_KTHREAD
+static struct kthread_worker __rcu **z_erofs_pcpu_workers;
+static enum cpuhp_state z_erofs_cpuhp_state;
+
+static struct kthread_worker *z_erofs_init_pcpu_worker(unsigned int cpu)
+{
+	struct kthread_worker *worker =
+		kthread_create_worker_on_cpu(cpu, 0, "erofs_worker/%u", cpu);
+
+	if (IS_ERR(worker))
+		return worker;
+	if (IS_ENABLED(CONFIG_EROFS_FS_PCPU_KTHREAD_HIPRI)) {
+		struct sched_param param = { .sched_priority = 1 };
+
+		sched_setscheduler_nocheck(worker->task, SCHED_FIFO, &param);
+	}
+	return worker;
+}
+
+static int z_erofs_cpu_online(unsigned int cpu)
+{
+	struct kthread_worker *worker = z_erofs_init_pcpu_worker(cpu);
+
+	if (IS_ERR(worker))
+		return PTR_ERR(worker);
+	rcu_assign_pointer(z_erofs_pcpu_workers[cpu], worker);
+	return 0;
+}
+
+/* what is queued on the worker is flushed by kthread_destroy_worker() */
+static int z_erofs_cpu_offline(unsigned int cpu)
+{
+	struct kthread_worker *worker;
+
+	worker = rcu_dereference_protected(z_erofs_pcpu_workers[cpu], 1);
+	rcu_assign_pointer(z_erofs_pcpu_workers[cpu], NULL);
+	synchronize_rcu();
+	if (worker)
+		kthread_destroy_worker(worker);
+	return 0;
+}
+
+static int z_erofs_init_pcpu_workers(void)
+{
+	int ret;
+
+	z_erofs_pcpu_workers = kcalloc(nr_cpu_ids,
+				       sizeof(*z_erofs_pcpu_workers),
+				       GFP_KERNEL);
+	if (!z_erofs_pcpu_workers)
+		return -ENOMEM;
+
+	ret = cpuhp_setup_state(CPUHP_AP_ONLINE_DYN, "fs/erofs:online",
+				z_erofs_cpu_online, z_erofs_cpu_offline);
+	if (ret < 0) {
+		kfree(z_erofs_pcpu_workers);
+		return ret;
+	}
+	z_erofs_cpuhp_state = ret;
+	return 0;
+}
+
+static void z_erofs_destroy_pcpu_workers(void)
+{
+	cpuhp_remove_state(z_erofs_cpuhp_state);
+	kfree(z_erofs_pcpu_workers);
+}
+
+static void z_erofs_decompressqueue_kthread_work(struct kthread_work *work);
+
+/* queue @io on the worker of this CPU, false if it has none */
+static bool z_erofs_queue_pcpu_work(struct z_erofs_decompressqueue *io)
+{
+	struct kthread_worker *worker;
+
+	rcu_read_lock();
+	worker = rcu_dereference(
+			z_erofs_pcpu_workers[raw_smp_processor_id()]);
+	if (worker) {
+		kthread_init_work(&io->u.kthread_work,
+				  z_erofs_decompressqueue_kthread_work);
+		kthread_queue_work(worker, &io->u.kthread_work);
+	}
+	rcu_read_unlock();
+	return worker;
+}
+#else
+static inline int z_erofs_init_pcpu_workers(void) { return 0; }
+static inline void z_erofs_destroy_pcpu_workers(void) {}
+static inline bool z_erofs_queue_pcpu_work(struct z_erofs_decompressqueue *io)
+{
+	return false;
+}
+#endif
+
 void z_erofs_exit_zip_subsystem(void)
 {
+	z_erofs_destroy_pcpu_workers();
 	destroy_workqueue(z_erofs_workqueue);
 	kmem_cache_destroy(pcluster_cachep);
+	z_erofs_zstd_exit();
 }
 
 static inline int z_erofs_init_workqueue(void)
@@ -83,9 +182,11 @@ int __init z_erofs_init_zip_subsystem(void)
 					    SLAB_RECLAIM_ACCOUNT,
 					    z_erofs_pcluster_init_once);
 	if (pcluster_cachep) {
-		if (!z_erofs_init_workqueue())
-			return 0;
-
+		if (!z_erofs_init_workqueue()) {
+			if (!z_erofs_init_pcpu_workers())
+				return 0;
+			destroy_workqueue(z_erofs_workqueue);
+		}
 		kmem_cache_destroy(pcluster_cachep);
 	}
 	return -ENOMEM;
@@ -703,7 +804,10 @@ static void z_erofs_decompress_kickoff(struct z_erofs_decompressqueue *io,
 		return;
 	}
 
-	if (!atomic_add_return(bios, &io->pending_bios))
+	if (atomic_add_return(bios, &io->pending_bios))
+		return;
+
+	if (!z_erofs_queue_pcpu_work(io))
 		queue_work(z_erofs_workqueue, &io->u.work);
 }
 
@@ -956,10 +1060,8 @@ static void z_erofs_decompress_queue(const struct z_erofs_decompressqueue *io,
 	}
 }
 
-static void z_erofs_decompressqueue_work(struct work_struct *work)
+static void z_erofs_decompress_bgqueue(struct z_erofs_decompressqueue *bgq)
 {
-	struct z_erofs_decompressqueue *bgq =
-		container_of(work, struct z_erofs_decompressqueue, u.work);
 	LIST_HEAD(pagepool);
 
 	DBG_BUGON(bgq->head == Z_EROFS_PCLUSTER_TAIL_CLOSED);
@@ -969,6 +1071,20 @@ static void z_erofs_decompressqueue_work(struct work_struct *work)
 	kvfree(bgq);
 }
 
+static void z_erofs_decompressqueue_work(struct work_struct *work)
+{
+	z_erofs_decompress_bgqueue(container_of(work,
+			struct z_erofs_decompressqueue, u.work));
+}
+
+#ifdef CONFIG_EROFS_FS_PCPU_KTHREAD
+static void z_erofs_decompressqueue_kthread_work(struct kthread_work *work)
+{
+	z_erofs_decompress_bgqueue(container_of(work,
+			struct z_erofs_decompressqueue, u.kthread_work));
+}
+#endif
+
 static struct page *pickup_page_for_submission(struct z_erofs_pcluster *pcl,
 					       unsigned int nr,
 					       struct list_head *pagepool,
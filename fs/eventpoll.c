@@ -50,14 +50,19 @@
  *
  * 1) epmutex (mutex)
  * 2) ep->mtx (mutex)
- * 3) ep->wq.lock (spinlock)
+ * 3) ep->lock (rwlock)
  *
  * The acquire order is the one listed above, from 1 to 3.
- * We need a spinlock (ep->wq.lock) because we manipulate objects
+ * We need a rwlock (ep->lock) because we manipulate objects
  * from inside the poll callback, that might be triggered from
  * a wake_up() that in turn might be called from IRQ context.
  * So we can't sleep inside the poll callback and hence we need
- * a spinlock. During the event transfer loop (from kernel to
+ * a spinning lock. Poll callbacks only take it for read and add
+ * items to the ready lists locklessly, so wakeups coming from many
+ * CPUs at once don't serialize on it; everything else that touches
+ * the ready lists takes it for write. The wait queue ep->wq has its
+ * own lock, taken inside ep->lock by the wakeups.
+ * During the event transfer loop (from kernel to
  * user space) we could end up sleeping due a copy_to_user(), so
  * we need a lock that will allow us to sleep. This lock is a
  * mutex (ep->mtx). It is acquired during the event transfer loop,
@@ -85,7 +90,7 @@
  * of epoll file descriptors, we use the current recursion depth as
  * the lockdep subkey.
  * It is possible to drop the "ep->mtx" and to use the global
- * mutex "epmutex" (together with "ep->wq.lock") to have it working,
+ * mutex "epmutex" (together with "ep->lock") to have it working,
  * but having "ep->mtx" will make the interface more scalable.
  * Events that require holding "epmutex" are very rare, while for
  * normal operations the epoll private "ep->mtx" will guarantee
@@ -97,6 +102,9 @@
 
 #define EPOLLINOUT_BITS (EPOLLIN | EPOLLOUT)
 
+/* Number of NAPI contexts an epoll set busy polls at most */
+#define EP_NAPI_IDS 4
+
 #define EPOLLEXCLUSIVE_OK_BITS (EPOLLINOUT_BITS | EPOLLERR | EPOLLHUP | \
 				EPOLLWAKEUP | EPOLLET | EPOLLEXCLUSIVE)
 
@@ -184,6 +192,7 @@ struct epitem {
  * interface.
  *
  * Access to it is protected by the lock inside wq.
+ * Access to the ready lists is protected by ep->lock.
  */
 struct eventpoll {
 	/*
@@ -203,13 +212,16 @@ struct eventpoll {
 	/* List of ready file descriptors */
 	struct list_head rdllist;
 
+	/* Lock which protects rdllist and ovflist */
+	rwlock_t lock;
+
 	/* RB tree root used to store monitored fd structs */
 	struct rb_root_cached rbr;
 
 	/*
 	 * This is a single linked list that chains all the "struct epitem" that
 	 * happened while transferring ready events to userspace w/out
-	 * holding ->wq.lock.
+	 * holding ->lock.
 	 */
 	struct epitem *ovflist;
 
@@ -226,8 +238,13 @@ struct eventpoll {
 	struct list_head visited_list_link;
 
 #ifdef CONFIG_NET_RX_BUSY_POLL
-	/* used to track busy poll napi_id */
-	unsigned int napi_id;
+	/* used to track busy poll napi_ids, see ep_set_busy_poll_napi_id() */
+	unsigned int napi_ids[EP_NAPI_IDS];
+
+	/* busy poll parameters set with EPIOCSPARAMS */
+	u32 busy_poll_usecs;
+	u16 busy_poll_budget;
+	bool prefer_busy_poll;
 #endif
 };
 
@@ -375,35 +392,85 @@ static void ep_nested_calls_init(struct nested_calls *ncalls)
  */
 static inline int ep_events_available(struct eventpoll *ep)
 {
-	return !list_empty(&ep->rdllist) || ep->ovflist != EP_UNACTIVE_PTR;
+	return !list_empty_careful(&ep->rdllist) ||
+		READ_ONCE(ep->ovflist) != EP_UNACTIVE_PTR;
 }
 
 #ifdef CONFIG_NET_RX_BUSY_POLL
+/*
+ * Busy poll is on for @ep if it has been given a timeout of its own, or
+ * globally.
+ */
+static bool ep_busy_loop_on(struct eventpoll *ep)
+{
+	return READ_ONCE(ep->busy_poll_usecs) || net_busy_loop_on();
+}
+
 static bool ep_busy_loop_end(void *p, unsigned long start_time)
 {
 	struct eventpoll *ep = p;
+	unsigned long bp_usec;
+
+	if (ep_events_available(ep))
+		return true;
 
-	return ep_events_available(ep) || busy_loop_timeout(start_time);
+	bp_usec = READ_ONCE(ep->busy_poll_usecs);
+	if (!bp_usec)
+		return busy_loop_timeout(start_time);
+
+	return time_after(busy_loop_current_time(), start_time + bp_usec);
 }
 
 /*
- * Busy poll if globally on and supporting sockets found && no events,
+ * Busy poll if on and supporting sockets found && no events,
  * busy loop will return if need_resched or ep_events_available.
+ * With sockets behind several NAPI contexts, they are polled in turn.
  *
  * we must do our busy polling with irqs enabled
  */
 static void ep_busy_loop(struct eventpoll *ep, int nonblock)
 {
-	unsigned int napi_id = READ_ONCE(ep->napi_id);
+	unsigned int napi_ids[EP_NAPI_IDS];
+	unsigned long start_time;
+	int i, nr = 0;
+	u16 budget;
+
+	if (!ep_busy_loop_on(ep))
+		return;
+
+	for (i = 0; i < EP_NAPI_IDS; i++) {
+		napi_ids[nr] = READ_ONCE(ep->napi_ids[i]);
+		if (napi_ids[nr] >= MIN_NAPI_ID)
+			nr++;
+	}
+	if (!nr)
+		return;
+
+	budget = READ_ONCE(ep->busy_poll_budget) ? : BUSY_POLL_BUDGET;
+	if (nr == 1) {
+		napi_busy_loop(napi_ids[0], nonblock ? NULL : ep_busy_loop_end,
+			       ep, budget);
+		return;
+	}
 
-	if ((napi_id >= MIN_NAPI_ID) && net_busy_loop_on())
-		napi_busy_loop(napi_id, nonblock ? NULL : ep_busy_loop_end, ep);
+	start_time = busy_loop_current_time();
+	for (;;) {
+		for (i = 0; i < nr; i++)
+			napi_busy_loop(napi_ids[i], NULL, NULL, budget);
+		if (nonblock || ep_busy_loop_end(ep, start_time) ||
+		    signal_pending(current))
+			break;
+		cond_resched();
+	}
 }
 
 static inline void ep_reset_busy_poll_napi_id(struct eventpoll *ep)
 {
-	if (ep->napi_id)
-		ep->napi_id = 0;
+	int i;
+
+	for (i = 0; i < EP_NAPI_IDS; i++)
+		if (ep->napi_ids[i])
+			WRITE_ONCE(ep->napi_ids[i], 0);
 }
 
 /*
@@ -415,9 +482,9 @@ static inline void ep_set_busy_poll_napi_id(struct epitem *epi)
 	unsigned int napi_id;
 	struct socket *sock;
 	struct sock *sk;
-	int err;
+	int err, i, slot;
 
-	if (!net_busy_loop_on())
+	if (!ep_busy_loop_on(epi->ep))
 		return;
 
 	sock = sock_from_file(epi->ffd.file, &err);
@@ -431,15 +498,68 @@ static inline void ep_set_busy_poll_napi_id(struct epitem *epi)
 	napi_id = READ_ONCE(sk->sk_napi_id);
 	ep = epi->ep;
 
-	/* Non-NAPI IDs can be rejected
-	 *	or
-	 * Nothing to do if we already have this ID
-	 */
-	if (napi_id < MIN_NAPI_ID || napi_id == ep->napi_id)
+	/* Non-NAPI IDs can be rejected */
+	if (napi_id < MIN_NAPI_ID)
 		return;
 
+	/*
+	 * Nothing to do if we already have this ID.  Otherwise take a free
+	 * slot, or evict the one the ID hashes to.  This runs locklessly
+	 * from the poll callbacks: racing updates may lose an ID, which is
+	 * recorded again on its next event.
+	 */
+	slot = napi_id % EP_NAPI_IDS;
+	for (i = EP_NAPI_IDS - 1; i >= 0; i--) {
+		unsigned int id = READ_ONCE(ep->napi_ids[i]);
+
+		if (id == napi_id)
+			return;
+		if (!id)
+			slot = i;
+	}
+
 	/* record NAPI ID for use in next busy poll */
-	ep->napi_id = napi_id;
+	WRITE_ONCE(ep->napi_ids[slot], napi_id);
+}
+
+static long ep_set_params(struct eventpoll *ep,
+			  struct epoll_params __user *uparams)
+{
+	struct epoll_params params;
+
+	if (copy_from_user(&params, uparams, sizeof(params)))
+		return -EFAULT;
+
+	/* pad byte must be zero */
+	if (params.__pad)
+		return -EINVAL;
+	if (params.busy_poll_usecs > S32_MAX)
+		return -EINVAL;
+	if (params.prefer_busy_poll > 1)
+		return -EINVAL;
+	if (params.busy_poll_budget > NAPI_POLL_WEIGHT &&
+	    !capable(CAP_NET_ADMIN))
+		return -EPERM;
+
+	WRITE_ONCE(ep->busy_poll_usecs, params.busy_poll_usecs);
+	WRITE_ONCE(ep->busy_poll_budget, params.busy_poll_budget);
+	WRITE_ONCE(ep->prefer_busy_poll, params.prefer_busy_poll);
+	return 0;
+}
+
+static long ep_get_params(struct eventpoll *ep,
+			  struct epoll_params __user *uparams)
+{
+	struct epoll_params params;
+
+	memset(&params, 0, sizeof(params));
+	params.busy_poll_usecs = READ_ONCE(ep->busy_poll_usecs);
+	params.busy_poll_budget = READ_ONCE(ep->busy_poll_budget);
+	params.prefer_busy_poll = READ_ONCE(ep->prefer_busy_poll);
+
+	if (copy_to_user(uparams, &params, sizeof(params)))
+		return -EFAULT;
+	return 0;
 }
 
 #else
@@ -456,6 +576,18 @@ static inline void ep_set_busy_poll_napi_id(struct epitem *epi)
 {
 }
 
+static long ep_set_params(struct eventpoll *ep,
+			  struct epoll_params __user *uparams)
+{
+	return -EOPNOTSUPP;
+}
+
+static long ep_get_params(struct eventpoll *ep,
+			  struct epoll_params __user *uparams)
+{
+	return -EOPNOTSUPP;
+}
+
 #endif /* CONFIG_NET_RX_BUSY_POLL */
 
 /**
@@ -691,17 +823,17 @@ static __poll_t ep_scan_ready_list(struct eventpoll *ep,
 	 * because we want the "sproc" callback to be able to do it
 	 * in a lockless way.
 	 */
-	spin_lock_irq(&ep->wq.lock);
+	write_lock_irq(&ep->lock);
 	list_splice_init(&ep->rdllist, &txlist);
-	ep->ovflist = NULL;
-	spin_unlock_irq(&ep->wq.lock);
+	WRITE_ONCE(ep->ovflist, NULL);
+	write_unlock_irq(&ep->lock);
 
 	/*
 	 * Now call the callback function.
 	 */
 	res = (*sproc)(ep, &txlist, priv);
 
-	spin_lock_irq(&ep->wq.lock);
+	write_lock_irq(&ep->lock);
 	/*
 	 * During the time we spent inside the "sproc" callback, some
 	 * other events might have been queued by the poll callback.
@@ -725,7 +857,7 @@ static __poll_t ep_scan_ready_list(struct eventpoll *ep,
 	 * releasing the lock, events will be queued in the normal way inside
 	 * ep->rdllist.
 	 */
-	ep->ovflist = EP_UNACTIVE_PTR;
+	WRITE_ONCE(ep->ovflist, EP_UNACTIVE_PTR);
 
 	/*
 	 * Quickly re-inject items left on "txlist".
@@ -739,11 +871,11 @@ static __poll_t ep_scan_ready_list(struct eventpoll *ep,
 		 * the ->poll() wait list (delayed after we release the lock).
 		 */
 		if (waitqueue_active(&ep->wq))
-			wake_up_locked(&ep->wq);
+			wake_up(&ep->wq);
 		if (waitqueue_active(&ep->poll_wait))
 			pwake++;
 	}
-	spin_unlock_irq(&ep->wq.lock);
+	write_unlock_irq(&ep->lock);
 
 	if (!ep_locked)
 		mutex_unlock(&ep->mtx);
@@ -783,10 +915,10 @@ static int ep_remove(struct eventpoll *ep, struct epitem *epi)
 
 	rb_erase_cached(&epi->rbn, &ep->rbr);
 
-	spin_lock_irq(&ep->wq.lock);
+	write_lock_irq(&ep->lock);
 	if (ep_is_linked(epi))
 		list_del_init(&epi->rdllink);
-	spin_unlock_irq(&ep->wq.lock);
+	write_unlock_irq(&ep->lock);
 
 	wakeup_source_unregister(ep_wakeup_source(epi));
 	/*
@@ -836,7 +968,7 @@ static void ep_free(struct eventpoll *ep)
 	 * Walks through the whole tree by freeing each "struct epitem". At this
 	 * point we are sure no poll callbacks will be lingering around, and also by
 	 * holding "epmutex" we can be sure that no file cleanup code will hit
-	 * us during this operation. So we can avoid the lock on "ep->wq.lock".
+	 * us during this operation. So we can avoid the lock on "ep->lock".
 	 * We do not need to lock ep->mtx, either, we only do it to prevent
 	 * a lockdep warning.
 	 */
@@ -961,6 +1093,30 @@ static void ep_show_fdinfo(struct seq_file *m, struct file *f)
 }
 #endif
 
+static long ep_eventpoll_ioctl(struct file *file, unsigned int cmd,
+			       unsigned long arg)
+{
+	struct eventpoll *ep = file->private_data;
+	void __user *uarg = (void __user *)arg;
+
+	switch (cmd) {
+	case EPIOCSPARAMS:
+		return ep_set_params(ep, uarg);
+	case EPIOCGPARAMS:
+		return ep_get_params(ep, uarg);
+	default:
+		return -ENOIOCTLCMD;
+	}
+}
+
+#ifdef CONFIG_COMPAT
+static long ep_eventpoll_compat_ioctl(struct file *file, unsigned int cmd,
+				      unsigned long arg)
+{
+	return ep_eventpoll_ioctl(file, cmd, (unsigned long)compat_ptr(arg));
+}
+#endif
+
 /* File callbacks that implement the eventpoll file behaviour */
 static const struct file_operations eventpoll_fops = {
 #ifdef CONFIG_PROC_FS
@@ -969,6 +1125,10 @@ static const struct file_operations eventpoll_fops = {
 	.release	= ep_eventpoll_release,
 	.poll		= ep_eventpoll_poll,
 	.llseek		= noop_llseek,
+	.unlocked_ioctl	= ep_eventpoll_ioctl,
+#ifdef CONFIG_COMPAT
+	.compat_ioctl	= ep_eventpoll_compat_ioctl,
+#endif
 };
 
 /*
@@ -1020,6 +1180,7 @@ static int ep_alloc(struct eventpoll **pep)
 	init_waitqueue_head(&ep->wq);
 	init_waitqueue_head(&ep->poll_wait);
 	INIT_LIST_HEAD(&ep->rdllist);
+	rwlock_init(&ep->lock);
 	ep->rbr = RB_ROOT_CACHED;
 	ep->ovflist = EP_UNACTIVE_PTR;
 	ep->user = user;
@@ -1106,10 +1267,87 @@ struct file *get_epoll_tfile_raw_ptr(struct file *file, int tfd,
 }
 #endif /* CONFIG_CHECKPOINT_RESTORE */
 
+/*
+ * Adds a new entry to the tail of the list in a lockless way, i.e.
+ * multiple CPUs are allowed to call this function concurrently.
+ *
+ * Beware: it is necessary to prevent any other modifications of the
+ *         existing list until all changes are completed, in other words
+ *         concurrent list_add_tail_lockless() calls should be protected
+ *         with a read lock, where write lock acts as a barrier which
+ *         makes sure all list_add_tail_lockless() calls are fully
+ *         completed.
+ *
+ *         Also an element can be locklessly added to the list only in one
+ *         direction i.e. either to the tail either to the head, otherwise
+ *         concurrent access will corrupt the list.
+ *
+ * Returns %false if element has been already added to the list, %true
+ * otherwise.
+ */
+static inline bool list_add_tail_lockless(struct list_head *new,
+					  struct list_head *head)
+{
+	struct list_head *prev;
+
+	/*
+	 * This is simple 'new->next = head' operation, but cmpxchg()
+	 * is used in order to detect that same element has been just
+	 * added to the list from another CPU: the winner observes
+	 * new->next == new.
+	 */
+	if (cmpxchg(&new->next, new, head) != new)
+		return false;
+
+	/*
+	 * Initially ->next of a new element must be updated with the head
+	 * (we are inserting to the tail) and only then pointers are atomically
+	 * exchanged.  XCHG guarantees memory ordering, thus ->next should be
+	 * updated before pointers are actually swapped and pointers are
+	 * swapped before prev->next is updated.
+	 */
+	prev = xchg(&head->prev, new);
+
+	/*
+	 * It is safe to modify prev->next and new->prev, because a new element
+	 * is added only to the tail and new->next is updated before XCHG.
+	 */
+	prev->next = new;
+	new->prev = prev;
+
+	return true;
+}
+
+/*
+ * Chains a new epi entry to the head of the ep->ovflist in a lockless way,
+ * i.e. multiple CPUs are allowed to call this function concurrently.
+ *
+ * Returns %false if epi element has been already chained, %true otherwise.
+ */
+static inline bool chain_epi_lockless(struct epitem *epi)
+{
+	struct eventpoll *ep = epi->ep;
+
+	/* Check that the same epi has not been just chained from another CPU */
+	if (cmpxchg(&epi->next, EP_UNACTIVE_PTR, NULL) != EP_UNACTIVE_PTR)
+		return false;
+
+	/* Atomically exchange the head */
+	epi->next = xchg(&ep->ovflist, epi);
+
+	return true;
+}
+
 /*
  * This is the callback that is passed to the wait queue wakeup
  * mechanism. It is called by the stored file descriptors when they
  * have events to report.
+ *
+ * This callback takes a read lock in order not to contend with concurrent
+ * events from another file descriptor, thus all modifications to ->rdllist
+ * or ->ovflist are lockless.  Read lock is paired with the write lock from
+ * ep_scan_ready_list(), which stops all list modifications and guarantees
+ * that lists state is seen correctly.
  */
 static int ep_poll_callback(wait_queue_entry_t *wait, unsigned mode, int sync, void *key)
 {
@@ -1120,7 +1358,7 @@ static int ep_poll_callback(wait_queue_entry_t *wait, unsigned mode, int sync, v
 	__poll_t pollflags = key_to_poll(key);
 	int ewake = 0;
 
-	spin_lock_irqsave(&ep->wq.lock, flags);
+	read_lock_irqsave(&ep->lock, flags);
 
 	ep_set_busy_poll_napi_id(epi);
 
@@ -1148,27 +1386,22 @@ static int ep_poll_callback(wait_queue_entry_t *wait, unsigned mode, int sync, v
 	 * semantics). All the events that happen during that period of time are
 	 * chained in ep->ovflist and requeued later on.
 	 */
-	if (ep->ovflist != EP_UNACTIVE_PTR) {
-		if (epi->next == EP_UNACTIVE_PTR) {
-			epi->next = ep->ovflist;
-			ep->ovflist = epi;
-			if (epi->ws) {
-				/*
-				 * Activate ep->ws since epi->ws may get
-				 * deactivated at any time.
-				 */
-				__pm_stay_awake(ep->ws);
-			}
-
+	if (READ_ONCE(ep->ovflist) != EP_UNACTIVE_PTR) {
+		if (epi->next == EP_UNACTIVE_PTR && chain_epi_lockless(epi) &&
+		    epi->ws) {
+			/*
+			 * Activate ep->ws since epi->ws may get
+			 * deactivated at any time.
+			 */
+			__pm_stay_awake(ep->ws);
 		}
 		goto out_unlock;
 	}
 
 	/* If this file is already in the ready list we exit soon */
-	if (!ep_is_linked(epi)) {
-		list_add_tail(&epi->rdllink, &ep->rdllist);
+	if (!ep_is_linked(epi) &&
+	    list_add_tail_lockless(&epi->rdllink, &ep->rdllist))
 		ep_pm_stay_awake_rcu(epi);
-	}
 
 	/*
 	 * Wake up ( if active ) both the eventpoll wait list and the ->poll()
@@ -1191,13 +1424,13 @@ static int ep_poll_callback(wait_queue_entry_t *wait, unsigned mode, int sync, v
 				break;
 			}
 		}
-		wake_up_locked(&ep->wq);
+		wake_up(&ep->wq);
 	}
 	if (waitqueue_active(&ep->poll_wait))
 		pwake++;
 
 out_unlock:
-	spin_unlock_irqrestore(&ep->wq.lock, flags);
+	read_unlock_irqrestore(&ep->lock, flags);
 
 	/* We have to call this outside the lock */
 	if (pwake)
@@ -1483,7 +1716,7 @@ static int ep_insert(struct eventpoll *ep, const struct epoll_event *event,
 		goto error_remove_epi;
 
 	/* We have to drop the new item inside our item list to keep track of it */
-	spin_lock_irq(&ep->wq.lock);
+	write_lock_irq(&ep->lock);
 
 	/* record NAPI ID of new item if present */
 	ep_set_busy_poll_napi_id(epi);
@@ -1495,12 +1728,12 @@ static int ep_insert(struct eventpoll *ep, const struct epoll_event *event,
 
 		/* Notify waiting tasks that events are available */
 		if (waitqueue_active(&ep->wq))
-			wake_up_locked(&ep->wq);
+			wake_up(&ep->wq);
 		if (waitqueue_active(&ep->poll_wait))
 			pwake++;
 	}
 
-	spin_unlock_irq(&ep->wq.lock);
+	write_unlock_irq(&ep->lock);
 
 	atomic_long_inc(&ep->user->epoll_watches);
 
@@ -1526,10 +1759,10 @@ static int ep_insert(struct eventpoll *ep, const struct epoll_event *event,
 	 * list, since that is used/cleaned only inside a section bound by "mtx".
 	 * And ep_insert() is called with "mtx" held.
 	 */
-	spin_lock_irq(&ep->wq.lock);
+	write_lock_irq(&ep->lock);
 	if (ep_is_linked(epi))
 		list_del_init(&epi->rdllink);
-	spin_unlock_irq(&ep->wq.lock);
+	write_unlock_irq(&ep->lock);
 
 	wakeup_source_unregister(ep_wakeup_source(epi));
 
@@ -1573,9 +1806,9 @@ static int ep_modify(struct eventpoll *ep, struct epitem *epi,
 	 * 1) Flush epi changes above to other CPUs.  This ensures
 	 *    we do not miss events from ep_poll_callback if an
 	 *    event occurs immediately after we call f_op->poll().
-	 *    We need this because we did not take ep->wq.lock while
+	 *    We need this because we did not take ep->lock while
 	 *    changing epi above (but ep_poll_callback does take
-	 *    ep->wq.lock).
+	 *    ep->lock).
 	 *
 	 * 2) We also need to ensure we do not miss _past_ events
 	 *    when calling f_op->poll().  This barrier also
@@ -1594,18 +1827,18 @@ static int ep_modify(struct eventpoll *ep, struct epitem *epi,
 	 * list, push it inside.
 	 */
 	if (ep_item_poll(epi, &pt, 1)) {
-		spin_lock_irq(&ep->wq.lock);
+		write_lock_irq(&ep->lock);
 		if (!ep_is_linked(epi)) {
 			list_add_tail(&epi->rdllink, &ep->rdllist);
 			ep_pm_stay_awake(epi);
 
 			/* Notify waiting tasks that events are available */
 			if (waitqueue_active(&ep->wq))
-				wake_up_locked(&ep->wq);
+				wake_up(&ep->wq);
 			if (waitqueue_active(&ep->poll_wait))
 				pwake++;
 		}
-		spin_unlock_irq(&ep->wq.lock);
+		write_unlock_irq(&ep->lock);
 	}
 
 	/* We have to call this outside the lock */
@@ -1758,7 +1991,6 @@ static int ep_poll(struct eventpoll *ep, struct epoll_event __user *events,
 		 * caller specified a non blocking operation.
 		 */
 		timed_out = 1;
-		spin_lock_irq(&ep->wq.lock);
 		goto check_events;
 	}
 
@@ -1767,8 +1999,6 @@ static int ep_poll(struct eventpoll *ep, struct epoll_event __user *events,
 	if (!ep_events_available(ep))
 		ep_busy_loop(ep, timed_out);
 
-	spin_lock_irq(&ep->wq.lock);
-
 	if (!ep_events_available(ep)) {
 		/*
 		 * Busy poll timed out.  Drop NAPI ID for now, we can add
@@ -1783,7 +2013,9 @@ static int ep_poll(struct eventpoll *ep, struct epoll_event __user *events,
 		 * ep_poll_callback() when events will become available.
 		 */
 		init_waitqueue_entry(&wait, current);
+		spin_lock_irq(&ep->wq.lock);
 		__add_wait_queue_exclusive(&ep->wq, &wait);
+		spin_unlock_irq(&ep->wq.lock);
 
 		for (;;) {
 			/*
@@ -1809,22 +2041,22 @@ static int ep_poll(struct eventpoll *ep, struct epoll_event __user *events,
 				break;
 			}
 
-			spin_unlock_irq(&ep->wq.lock);
 			if (!schedule_hrtimeout_range(to, slack, HRTIMER_MODE_ABS))
 				timed_out = 1;
-
-			spin_lock_irq(&ep->wq.lock);
 		}
 
-		__remove_wait_queue(&ep->wq, &wait);
 		__set_current_state(TASK_RUNNING);
+		spin_lock_irq(&ep->wq.lock);
+		__remove_wait_queue(&ep->wq, &wait);
+		spin_unlock_irq(&ep->wq.lock);
 	}
 check_events:
-	/* Is it worth to try to dig for events ? */
+	/*
+	 * Is it worth to try to dig for events ?  This is a lockless
+	 * check: ep_send_events() takes ep->lock and finds out for sure.
+	 */
 	eavail = ep_events_available(ep);
 
-	spin_unlock_irq(&ep->wq.lock);
-
 	/*
 	 * Try to transfer events to user space. In case we get 0 events and
 	 * there's still timeout left over, we go trying again in search of
@@ -5714,6 +5714,10 @@ ext4_swap_extents(handle_t *handle, struct inode *inode1,
 	BUG_ON(!inode_is_locked(inode1));
 	BUG_ON(!inode_is_locked(inode2));
 
+	/* Neither inode can be replayed without the other */
+	ext4_fc_mark_ineligible(handle, inode1);
+	ext4_fc_mark_ineligible(handle, inode2);
+
 	*erp = ext4_es_remove_extent(inode1, lblk1, count);
 	if (unlikely(*erp))
 		return 0;
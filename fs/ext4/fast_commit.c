@@ -0,0 +1,302 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * linux/fs/ext4/fast_commit.c
+ *
+ * Fast commits: fsync of a file whose changes in the running transaction
+ * are confined to its own on-disk inode logs that inode into the fast
+ * commit area of the journal, instead of committing the whole transaction.
+ *
+ * The raw inode can only be replayed on its own if nothing else it depends
+ * on changed in the same transaction, so everything that touches other
+ * metadata on behalf of an inode (block and inode allocation, tree blocks,
+ * xattrs, the orphan list, links) marks it ineligible for that transaction
+ * and its fsync falls back to a full commit.
+ */
+
+#include <linux/crc32.h>
+#include "ext4.h"
+#include "ext4_jbd2.h"
+#include "fast_commit.h"
+
+/*
+ * The fast commit records of @inode would not be enough to replay its
+ * changes in the current transaction of @handle.
+ */
+void ext4_fc_mark_ineligible(handle_t *handle, struct inode *inode)
+{
+	if (!ext4_handle_valid(handle) || !handle->h_transaction)
+		return;
+
+	WRITE_ONCE(EXT4_I(inode)->i_fc_ineligible_tid,
+		   handle->h_transaction->t_tid);
+}
+
+static bool ext4_fc_eligible(journal_t *journal, struct inode *inode,
+			     tid_t tid)
+{
+	return jbd2_has_feature_fast_commit(journal) &&
+	       S_ISREG(inode->i_mode) &&
+	       READ_ONCE(EXT4_I(inode)->i_fc_ineligible_tid) != tid;
+}
+
+static void *ext4_fc_add_tlv(void *dst, u16 tag, u16 len)
+{
+	struct ext4_fc_tl tl = {
+		.fc_tag = cpu_to_le16(tag),
+		.fc_len = cpu_to_le16(len),
+	};
+
+	memcpy(dst, &tl, sizeof(tl));
+	return dst + sizeof(tl);
+}
+
+/* Write a fast commit block holding the raw inode, with updates locked */
+static int ext4_fc_write_inode(journal_t *journal, struct inode *inode,
+			       tid_t tid)
+{
+	struct super_block *sb = inode->i_sb;
+	int inode_len = EXT4_INODE_SIZE(sb);
+	struct ext4_fc_head head = {
+		.fc_features = cpu_to_le32(EXT4_FC_SUPPORTED_FEATURES),
+		.fc_tid = cpu_to_le32(tid),
+	};
+	struct ext4_fc_tail tail = {
+		.fc_tid = cpu_to_le32(tid),
+	};
+	int write_flags = REQ_SYNC;
+	struct buffer_head *bh;
+	struct ext4_iloc iloc;
+	void *start, *dst;
+	__le32 ino;
+	int ret;
+
+	if (3 * sizeof(struct ext4_fc_tl) + sizeof(head) + sizeof(ino) +
+	    inode_len + sizeof(tail) > journal->j_blocksize)
+		return -ENOSPC;
+
+	ret = ext4_get_inode_loc(inode, &iloc);
+	if (ret)
+		return ret;
+
+	ret = jbd2_fc_get_buf(journal, &bh);
+	if (ret)
+		goto out;
+
+	/* The blocks the inode covers have to be stable before it is */
+	if (journal->j_flags & JBD2_BARRIER) {
+		if (journal->j_fs_dev != journal->j_dev) {
+			ret = blkdev_issue_flush(journal->j_fs_dev, GFP_NOFS,
+						 NULL);
+			if (ret)
+				goto out;
+		}
+		write_flags |= REQ_PREFLUSH | REQ_FUA;
+	}
+
+	lock_buffer(bh);
+	start = bh->b_data;
+	memset(start, 0, journal->j_blocksize);
+
+	dst = ext4_fc_add_tlv(start, EXT4_FC_TAG_HEAD, sizeof(head));
+	memcpy(dst, &head, sizeof(head));
+	dst += sizeof(head);
+
+	dst = ext4_fc_add_tlv(dst, EXT4_FC_TAG_INODE, sizeof(ino) + inode_len);
+	ino = cpu_to_le32(inode->i_ino);
+	memcpy(dst, &ino, sizeof(ino));
+	dst += sizeof(ino);
+	spin_lock(&EXT4_I(inode)->i_raw_lock);
+	memcpy(dst, ext4_raw_inode(&iloc), inode_len);
+	spin_unlock(&EXT4_I(inode)->i_raw_lock);
+	dst += inode_len;
+
+	dst = ext4_fc_add_tlv(dst, EXT4_FC_TAG_TAIL, start +
+			      journal->j_blocksize -
+			      (dst + sizeof(struct ext4_fc_tl)));
+	memcpy(dst, &tail, sizeof(tail));
+	tail.fc_crc = cpu_to_le32(crc32_le(~0, start, dst +
+			offsetof(struct ext4_fc_tail, fc_crc) - start));
+	memcpy(dst, &tail, sizeof(tail));
+
+	set_buffer_uptodate(bh);
+	clear_buffer_dirty(bh);
+	bh->b_end_io = end_buffer_write_sync;
+	get_bh(bh);
+	submit_bh(REQ_OP_WRITE, write_flags, bh);
+	wait_on_buffer(bh);
+	if (unlikely(!buffer_uptodate(bh)))
+		ret = -EIO;
+out:
+	brelse(iloc.bh);
+	return ret;
+}
+
+/*
+ * Make the changes of @inode in transaction @tid durable, by a fast commit
+ * when @inode is eligible for it and a full commit of @tid otherwise.
+ */
+int ext4_fc_commit(journal_t *journal, struct inode *inode, tid_t tid)
+{
+	bool running;
+	int ret;
+
+	if (!ext4_fc_eligible(journal, inode, tid))
+		return jbd2_complete_transaction(journal, tid);
+
+restart:
+	ret = jbd2_fc_begin_commit(journal, tid);
+	if (ret == -EALREADY) {
+		/* A full commit ran, @tid may still be the running one */
+		read_lock(&journal->j_state_lock);
+		running = journal->j_running_transaction &&
+			  journal->j_running_transaction->t_tid == tid;
+		read_unlock(&journal->j_state_lock);
+		if (running)
+			goto restart;
+	}
+	if (ret)
+		return jbd2_complete_transaction(journal, tid);
+
+	/* All handles are done now, so the inode cannot change under us */
+	if (!ext4_fc_eligible(journal, inode, tid)) {
+		jbd2_fc_end_commit(journal);
+		return jbd2_complete_transaction(journal, tid);
+	}
+
+	ret = ext4_fc_write_inode(journal, inode, tid);
+	if (ret)
+		return jbd2_fc_end_commit_fallback(journal, tid);
+
+	jbd2_fc_end_commit(journal);
+	return 0;
+}
+
+/* Copy a logged raw inode over its slot in the inode table */
+static int ext4_fc_replay_inode(struct super_block *sb, void *val, u16 len)
+{
+	int inode_len = EXT4_INODE_SIZE(sb);
+	struct ext4_group_desc *gdp;
+	struct buffer_head *bh;
+	unsigned long offset;
+	ext4_fsblk_t block;
+	__le32 raw_ino;
+	u32 ino;
+
+	if (len != sizeof(raw_ino) + inode_len)
+		return -EFSCORRUPTED;
+
+	memcpy(&raw_ino, val, sizeof(raw_ino));
+	ino = le32_to_cpu(raw_ino);
+	if (ino < EXT4_FIRST_INO(sb) ||
+	    ino > le32_to_cpu(EXT4_SB(sb)->s_es->s_inodes_count))
+		return -EFSCORRUPTED;
+
+	gdp = ext4_get_group_desc(sb, (ino - 1) / EXT4_INODES_PER_GROUP(sb),
+				  NULL);
+	if (!gdp)
+		return -EFSCORRUPTED;
+
+	offset = ((ino - 1) % EXT4_INODES_PER_GROUP(sb)) * inode_len;
+	block = ext4_inode_table(sb, gdp) + offset / sb->s_blocksize;
+	bh = sb_bread(sb, block);
+	if (!bh)
+		return -EIO;
+
+	jbd_debug(1, "EXT4-fs: fast commit replay of inode %u\n", ino);
+	lock_buffer(bh);
+	memcpy(bh->b_data + offset % sb->s_blocksize,
+	       val + sizeof(raw_ino), inode_len);
+	unlock_buffer(bh);
+	/* Written out with the rest of the recovery */
+	mark_buffer_dirty(bh);
+	brelse(bh);
+	return 0;
+}
+
+/*
+ * Walk the records of a fast commit block, checking them or, once they
+ * were checked, replaying them.
+ */
+static int ext4_fc_walk_block(struct super_block *sb, void *data,
+			      tid_t tid, bool replay)
+{
+	void *end = data + sb->s_blocksize;
+	struct ext4_fc_head head;
+	struct ext4_fc_tail tail;
+	struct ext4_fc_tl tl;
+	void *p, *val;
+	u16 len;
+	int ret;
+
+	for (p = data; p + sizeof(tl) <= end; p = val + len) {
+		memcpy(&tl, p, sizeof(tl));
+		val = p + sizeof(tl);
+		len = le16_to_cpu(tl.fc_len);
+		if (val + len > end)
+			return -EFSCORRUPTED;
+
+		switch (le16_to_cpu(tl.fc_tag)) {
+		case EXT4_FC_TAG_HEAD:
+			if (p != data || len < sizeof(head))
+				return -EFSCORRUPTED;
+			memcpy(&head, val, sizeof(head));
+			if (le32_to_cpu(head.fc_tid) != tid ||
+			    le32_to_cpu(head.fc_features) &
+			    ~EXT4_FC_SUPPORTED_FEATURES)
+				return -EFSCORRUPTED;
+			break;
+		case EXT4_FC_TAG_INODE:
+			if (p == data)
+				return -EFSCORRUPTED;
+			if (!replay)
+				break;
+			ret = ext4_fc_replay_inode(sb, val, len);
+			if (ret)
+				return ret;
+			break;
+		case EXT4_FC_TAG_TAIL:
+			if (p == data || len < sizeof(tail))
+				return -EFSCORRUPTED;
+			memcpy(&tail, val, sizeof(tail));
+			if (le32_to_cpu(tail.fc_tid) != tid ||
+			    le32_to_cpu(tail.fc_crc) != crc32_le(~0, data,
+				val + offsetof(struct ext4_fc_tail, fc_crc) -
+				data))
+				return -EFSCORRUPTED;
+			return 0;
+		default:
+			return -EFSCORRUPTED;
+		}
+	}
+	return -EFSCORRUPTED;
+}
+
+/*
+ * jbd2 recovery callback: the scan pass counts the blocks at the start of
+ * the fast commit area holding complete fast commits of @expected_tid, the
+ * replay pass applies them.
+ */
+int ext4_fc_replay(journal_t *journal, struct buffer_head *bh,
+		   enum passtype pass, int off, tid_t expected_tid)
+{
+	struct super_block *sb = journal->j_private;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	int ret;
+
+	if (pass == PASS_SCAN) {
+		if (!off)
+			sbi->s_fc_replay_blocks = 0;
+		if (ext4_fc_walk_block(sb, bh->b_data, expected_tid, false))
+			return JBD2_FC_REPLAY_STOP;
+		sbi->s_fc_replay_blocks = off + 1;
+		return 0;
+	}
+
+	if (off >= sbi->s_fc_replay_blocks)
+		return JBD2_FC_REPLAY_STOP;
+
+	ret = ext4_fc_walk_block(sb, bh->b_data, expected_tid, true);
+	if (ret)
+		ext4_msg(sb, KERN_ERR, "fast commit replay failed (%d)", ret);
+	return ret;
+}
@@ -0,0 +1,42 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+#ifndef __FAST_COMMIT_H__
+#define __FAST_COMMIT_H__
+
+/*
+ * On-disk format of a fast commit.
+ *
+ * A fast commit takes one block of the fast commit area of the journal and
+ * is a sequence of tag-length-value records: a HEAD, one INODE record
+ * holding the raw on-disk inode, and a TAIL whose value extends to the end
+ * of the block. Lengths are those of the value following the ext4_fc_tl.
+ */
+#define EXT4_FC_TAG_INODE		0x0006
+#define EXT4_FC_TAG_TAIL		0x0008
+#define EXT4_FC_TAG_HEAD		0x0009
+
+/* No features defined yet, a fast commit with unknown ones is not replayed */
+#define EXT4_FC_SUPPORTED_FEATURES	0x0
+
+struct ext4_fc_tl {
+	__le16 fc_tag;
+	__le16 fc_len;
+};
+
+struct ext4_fc_head {
+	__le32 fc_features;
+	__le32 fc_tid;
+};
+
+struct ext4_fc_inode {
+	__le32 fc_ino;
+	__u8 fc_raw_inode[0];
+};
+
+/* fc_crc is the crc32 of the block from the HEAD up to fc_crc */
+struct ext4_fc_tail {
+	__le32 fc_tid;
+	__le32 fc_crc;
+};
+
+#endif /* __FAST_COMMIT_H__ */
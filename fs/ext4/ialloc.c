@@ -1179,6 +1179,8 @@ struct inode *__ext4_new_inode(handle_t *handle, struct inode *dir,
 		ei->i_sync_tid = handle->h_transaction->t_tid;
 		ei->i_datasync_tid = handle->h_transaction->t_tid;
 	}
+	/* Its bitmap bit and directory entry are in this transaction */
+	ext4_fc_mark_ineligible(handle, inode);
 
 	err = ext4_mark_inode_dirty(handle, inode);
 	if (err) {
@@ -5193,6 +5193,9 @@ int ext4_setattr(struct dentry *dentry, struct iattr *attr)
 			goto err_out;
 		}
 
+		/* The quota files change along with the owner */
+		ext4_fc_mark_ineligible(handle, inode);
+
 		/* dquot_transfer() calls back ext4_get_inode_usage() which
 		 * counts xattr inode references.
 		 */
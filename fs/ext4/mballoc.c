@@ -688,23 +688,40 @@ static void ext4_mb_mark_free_simple(struct super_block *sb,
 
 /*
  * Cache the order of the largest free extent we have available in this block
- * group.
+ * group, and keep the group on the list of that order.
+ *
+ * Must be called with the group lock held.
  */
 static void
 mb_set_largest_free_order(struct super_block *sb, struct ext4_group_info *grp)
 {
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	int old_order = grp->bb_largest_free_order;
+	int new_order = -1; /* uninit */
 	int i;
-	int bits;
-
-	grp->bb_largest_free_order = -1; /* uninit */
 
-	bits = sb->s_blocksize_bits + 1;
-	for (i = bits; i >= 0; i--) {
+	for (i = MB_NUM_ORDERS(sb) - 1; i >= 0; i--) {
 		if (grp->bb_counters[i] > 0) {
-			grp->bb_largest_free_order = i;
+			new_order = i;
 			break;
 		}
 	}
+
+	if (new_order == old_order)
+		return;
+
+	if (old_order >= 0) {
+		write_lock(&sbi->s_mb_largest_free_orders_locks[old_order]);
+		list_del_init(&grp->bb_largest_free_order_node);
+		write_unlock(&sbi->s_mb_largest_free_orders_locks[old_order]);
+	}
+	grp->bb_largest_free_order = new_order;
+	if (new_order >= 0) {
+		write_lock(&sbi->s_mb_largest_free_orders_locks[new_order]);
+		list_add_tail(&grp->bb_largest_free_order_node,
+			      &sbi->s_mb_largest_free_orders[new_order]);
+		write_unlock(&sbi->s_mb_largest_free_orders_locks[new_order]);
+	}
 }
 
 static noinline_for_stack
@@ -1665,10 +1682,12 @@ static void ext4_mb_use_best_found(struct ext4_allocation_context *ac,
 	get_page(ac->ac_buddy_page);
 	/* store last allocated for subsequent stream allocation */
 	if (ac->ac_flags & EXT4_MB_STREAM_ALLOC) {
-		spin_lock(&sbi->s_md_lock);
-		sbi->s_mb_last_group = ac->ac_f_ex.fe_group;
-		sbi->s_mb_last_start = ac->ac_f_ex.fe_start;
-		spin_unlock(&sbi->s_md_lock);
+		struct ext4_mb_stream_goal *goal;
+
+		goal = get_cpu_ptr(sbi->s_mb_last_goal);
+		goal->sg_group = ac->ac_f_ex.fe_group;
+		goal->sg_start = ac->ac_f_ex.fe_start;
+		put_cpu_ptr(sbi->s_mb_last_goal);
 	}
 }
 
@@ -2104,10 +2123,45 @@ static int ext4_mb_good_group(struct ext4_allocation_context *ac,
 	return 0;
 }
 
+/*
+ * Pick a group for cr 0 from the lists of groups whose largest free extent
+ * is at least 2^ac_2order, instead of walking all groups from the goal.
+ * Groups move to the tail of their list whenever their largest free order
+ * changes, so concurrent allocators do not all land on the same group.
+ */
+static bool ext4_mb_choose_group_cr0(struct ext4_allocation_context *ac,
+				     ext4_group_t *group)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(ac->ac_sb);
+	struct ext4_group_info *grp;
+	bool found = false;
+	int i;
+
+	for (i = ac->ac_2order; i < MB_NUM_ORDERS(ac->ac_sb); i++) {
+		if (list_empty(&sbi->s_mb_largest_free_orders[i]))
+			continue;
+		read_lock(&sbi->s_mb_largest_free_orders_locks[i]);
+		list_for_each_entry(grp, &sbi->s_mb_largest_free_orders[i],
+				    bb_largest_free_order_node) {
+			/* Listed groups are initialized, this cannot sleep */
+			if (ext4_mb_good_group(ac, grp->bb_group, 0) > 0) {
+				*group = grp->bb_group;
+				found = true;
+				break;
+			}
+		}
+		read_unlock(&sbi->s_mb_largest_free_orders_locks[i]);
+		if (found)
+			break;
+	}
+	return found;
+}
+
 static noinline_for_stack int
 ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 {
 	ext4_group_t ngroups, group, i;
+	bool optimize_scan;
 	int cr;
 	int err = 0, first_err = 0;
 	struct ext4_sb_info *sbi;
@@ -2120,6 +2174,8 @@ ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 	/* non-extent files are limited to low blocks/groups */
 	if (!(ext4_test_inode_flag(ac->ac_inode, EXT4_INODE_EXTENTS)))
 		ngroups = sbi->s_blockfile_groups;
+	optimize_scan = READ_ONCE(sbi->s_mb_optimize_scan) &&
+			ngroups == ext4_get_groups_count(sb);
 
 	BUG_ON(ac->ac_status == AC_STATUS_FOUND);
 
@@ -2156,11 +2212,12 @@ ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 
 	/* if stream allocation is enabled, use global goal */
 	if (ac->ac_flags & EXT4_MB_STREAM_ALLOC) {
-		/* TBD: may be hot point */
-		spin_lock(&sbi->s_md_lock);
-		ac->ac_g_ex.fe_group = sbi->s_mb_last_group;
-		ac->ac_g_ex.fe_start = sbi->s_mb_last_start;
-		spin_unlock(&sbi->s_md_lock);
+		struct ext4_mb_stream_goal *goal;
+
+		goal = get_cpu_ptr(sbi->s_mb_last_goal);
+		ac->ac_g_ex.fe_group = goal->sg_group;
+		ac->ac_g_ex.fe_start = goal->sg_start;
+		put_cpu_ptr(sbi->s_mb_last_goal);
 	}
 
 	/* Let's just scan groups to find more-less suitable blocks */
@@ -2181,6 +2238,9 @@ ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 		for (i = 0; i < ngroups; group++, i++) {
 			int ret = 0;
 			cond_resched();
+			if (cr == 0 && optimize_scan &&
+			    !ext4_mb_choose_group_cr0(ac, &group))
+				break;
 			/*
 			 * Artificially restricted ngroups for non-extent
 			 * files makes group > ngroups possible on first loop.
@@ -2450,7 +2510,9 @@ int ext4_mb_add_groupinfo(struct super_block *sb, ext4_group_t group,
 	INIT_LIST_HEAD(&meta_group_info[i]->bb_prealloc_list);
 	init_rwsem(&meta_group_info[i]->alloc_sem);
 	meta_group_info[i]->bb_free_root = RB_ROOT;
+	INIT_LIST_HEAD(&meta_group_info[i]->bb_largest_free_order_node);
 	meta_group_info[i]->bb_largest_free_order = -1;  /* uninit */
+	meta_group_info[i]->bb_group = group;
 
 #ifdef DOUBLE_CHECK
 	{
@@ -2632,6 +2694,23 @@ int ext4_mb_init(struct super_block *sb)
 		i++;
 	} while (i <= sb->s_blocksize_bits + 1);
 
+	i = MB_NUM_ORDERS(sb) * sizeof(*sbi->s_mb_largest_free_orders);
+	sbi->s_mb_largest_free_orders = kmalloc(i, GFP_KERNEL);
+	if (sbi->s_mb_largest_free_orders == NULL) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	i = MB_NUM_ORDERS(sb) * sizeof(*sbi->s_mb_largest_free_orders_locks);
+	sbi->s_mb_largest_free_orders_locks = kmalloc(i, GFP_KERNEL);
+	if (sbi->s_mb_largest_free_orders_locks == NULL) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < MB_NUM_ORDERS(sb); i++) {
+		INIT_LIST_HEAD(&sbi->s_mb_largest_free_orders[i]);
+		rwlock_init(&sbi->s_mb_largest_free_orders_locks[i]);
+	}
+
 	spin_lock_init(&sbi->s_md_lock);
 	spin_lock_init(&sbi->s_bal_lock);
 	sbi->s_mb_free_pending = 0;
@@ -2643,6 +2722,7 @@ int ext4_mb_init(struct super_block *sb)
 	sbi->s_mb_stream_request = MB_DEFAULT_STREAM_THRESHOLD;
 	sbi->s_mb_order2_reqs = MB_DEFAULT_ORDER2_REQS;
 	sbi->s_mb_max_inode_prealloc = MB_DEFAULT_MAX_INODE_PREALLOC;
+	sbi->s_mb_optimize_scan = MB_DEFAULT_OPTIMIZE_SCAN;
 	/*
 	 * The default group preallocation is 512, which for 4k block
 	 * sizes translates to 2 megabytes.  However for bigalloc file
@@ -2684,17 +2764,40 @@ int ext4_mb_init(struct super_block *sb)
 		spin_lock_init(&lg->lg_prealloc_lock);
 	}
 
+	sbi->s_mb_last_goal = alloc_percpu(struct ext4_mb_stream_goal);
+	if (sbi->s_mb_last_goal == NULL) {
+		ret = -ENOMEM;
+		goto out_free_locality_groups;
+	}
+	/* Start the streams of different CPUs in different groups */
+	j = 0;
+	for_each_possible_cpu(i) {
+		struct ext4_mb_stream_goal *goal;
+
+		goal = per_cpu_ptr(sbi->s_mb_last_goal, i);
+		goal->sg_group = div_u64((u64)ext4_get_groups_count(sb) * j++,
+					 num_possible_cpus());
+		goal->sg_start = 0;
+	}
+
 	/* init file for buddy data */
 	ret = ext4_mb_init_backend(sb);
 	if (ret != 0)
-		goto out_free_locality_groups;
+		goto out_free_last_goal;
 
 	return 0;
 
+out_free_last_goal:
+	free_percpu(sbi->s_mb_last_goal);
+	sbi->s_mb_last_goal = NULL;
 out_free_locality_groups:
 	free_percpu(sbi->s_locality_groups);
 	sbi->s_locality_groups = NULL;
 out:
+	kfree(sbi->s_mb_largest_free_orders);
+	sbi->s_mb_largest_free_orders = NULL;
+	kfree(sbi->s_mb_largest_free_orders_locks);
+	sbi->s_mb_largest_free_orders_locks = NULL;
 	kfree(sbi->s_mb_offsets);
 	sbi->s_mb_offsets = NULL;
 	kfree(sbi->s_mb_maxs);
@@ -2753,6 +2856,8 @@ int ext4_mb_release(struct super_block *sb)
 	}
 	kfree(sbi->s_mb_offsets);
 	kfree(sbi->s_mb_maxs);
+	kfree(sbi->s_mb_largest_free_orders);
+	kfree(sbi->s_mb_largest_free_orders_locks);
 	iput(sbi->s_buddy_cache);
 	if (sbi->s_mb_stats) {
 		ext4_msg(sb, KERN_INFO,
@@ -2778,6 +2883,7 @@ int ext4_mb_release(struct super_block *sb)
 				atomic_read(&sbi->s_mb_discarded));
 	}
 
+	free_percpu(sbi->s_mb_last_goal);
 	free_percpu(sbi->s_locality_groups);
 
 	return 0;
@@ -4562,6 +4668,7 @@ ext4_fsblk_t ext4_mb_new_blocks(handle_t *handle,
 	sbi = EXT4_SB(sb);
 
 	trace_ext4_request_blocks(ar);
+	ext4_fc_mark_ineligible(handle, ar->inode);
 
 	/* Allow to use superuser reservation for quota file */
 	if (ext4_is_quota_file(ar->inode))
@@ -4805,6 +4912,7 @@ void ext4_free_blocks(handle_t *handle, struct inode *inode,
 	int ret;
 
 	might_sleep();
+	ext4_fc_mark_ineligible(handle, inode);
 	if (bh) {
 		if (block)
 			BUG_ON(block != bh->b_blocknr);
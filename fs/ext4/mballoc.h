@@ -82,6 +82,17 @@ do {									\
  */
 #define MB_DEFAULT_MAX_INODE_PREALLOC	512
 
+/*
+ * Groups whose largest free extent has the same order are kept on the
+ * per-order s_mb_largest_free_orders lists, so that cr 0 can pick a group
+ * with a large enough free extent without scanning all of them. Tunable
+ * via /sys/fs/ext4/<partition>/mb_optimize_scan
+ */
+#define MB_DEFAULT_OPTIMIZE_SCAN	1
+
+/* Orders of the buddy, 0 is the bitmap itself */
+#define MB_NUM_ORDERS(sb)		((sb)->s_blocksize_bits + 2)
+
 struct ext4_free_data {
 	/* this links the free block information from sb_info */
 	struct list_head		efd_list;
@@ -149,6 +160,16 @@ struct ext4_locality_group {
 	spinlock_t		lg_prealloc_lock;
 };
 
+/*
+ * Where the last stream allocation on a CPU ended, the next one on that
+ * CPU starts from there. Keeping it per CPU spreads concurrent streaming
+ * writers across groups instead of piling them all into the same one.
+ */
+struct ext4_mb_stream_goal {
+	ext4_group_t		sg_group;
+	ext4_grpblk_t		sg_start;
+};
+
 struct ext4_allocation_context {
 	struct inode *ac_inode;
 	struct super_block *ac_sb;
@@ -2430,6 +2430,7 @@ static int ext4_delete_entry(handle_t *handle,
  */
 static void ext4_inc_count(handle_t *handle, struct inode *inode)
 {
+	ext4_fc_mark_ineligible(handle, inode);
 	inc_nlink(inode);
 	if (is_dx(inode) &&
 	    (inode->i_nlink > EXT4_LINK_MAX || inode->i_nlink == 2))
@@ -2442,6 +2443,7 @@ static void ext4_inc_count(handle_t *handle, struct inode *inode)
  */
 static void ext4_dec_count(handle_t *handle, struct inode *inode)
 {
+	ext4_fc_mark_ineligible(handle, inode);
 	if (!S_ISDIR(inode->i_mode) || inode->i_nlink > 2)
 		drop_nlink(inode);
 }
@@ -2815,6 +2817,8 @@ int ext4_orphan_add(handle_t *handle, struct inode *inode)
 	if (!list_empty(&EXT4_I(inode)->i_orphan))
 		return 0;
 
+	ext4_fc_mark_ineligible(handle, inode);
+
 	/*
 	 * Orphan handling is only valid for files with data blocks
 	 * being truncated, or files being unlinked. Note that we either
@@ -2916,6 +2920,7 @@ int ext4_orphan_del(handle_t *handle, struct inode *inode)
 		goto out_err;
 	}
 
+	ext4_fc_mark_ineligible(handle, inode);
 	ino_next = NEXT_ORPHAN(inode);
 	if (prev == &sbi->s_orphan) {
 		jbd_debug(4, "superblock will point to %u\n", ino_next);
@@ -2941,6 +2946,7 @@ int ext4_orphan_del(handle_t *handle, struct inode *inode)
 			goto out_brelse;
 		}
 		NEXT_ORPHAN(i_prev) = ino_next;
+		ext4_fc_mark_ineligible(handle, i_prev);
 		err = ext4_mark_iloc_dirty(handle, i_prev, &iloc2);
 		mutex_unlock(&sbi->s_orphan_lock);
 	}
@@ -3084,6 +3090,7 @@ static int ext4_unlink(struct inode *dir, struct dentry *dentry)
 	dir->i_ctime = dir->i_mtime = current_time(dir);
 	ext4_update_dx_flag(dir);
 	ext4_mark_inode_dirty(handle, dir);
+	ext4_fc_mark_ineligible(handle, inode);
 	if (inode->i_nlink == 0)
 		ext4_warning_inode(inode, "Deleting file '%.*s' with no links",
 				   dentry->d_name.len, dentry->d_name.name);
@@ -3611,6 +3618,10 @@ static int ext4_rename(struct inode *old_dir, struct dentry *old_dentry,
 	if (IS_DIRSYNC(old.dir) || IS_DIRSYNC(new.dir))
 		ext4_handle_sync(handle);
 
+	ext4_fc_mark_ineligible(handle, old.inode);
+	if (new.inode)
+		ext4_fc_mark_ineligible(handle, new.inode);
+
 	if (S_ISDIR(old.inode->i_mode)) {
 		if (new.inode) {
 			retval = -ENOTEMPTY;
@@ -3792,6 +3803,9 @@ static int ext4_cross_rename(struct inode *old_dir, struct dentry *old_dentry,
 	if (IS_DIRSYNC(old.dir) || IS_DIRSYNC(new.dir))
 		ext4_handle_sync(handle);
 
+	ext4_fc_mark_ineligible(handle, old.inode);
+	ext4_fc_mark_ineligible(handle, new.inode);
+
 	if (S_ISDIR(old.inode->i_mode)) {
 		old.is_dir = true;
 		retval = ext4_rename_dir_prepare(handle, &old);
@@ -1131,6 +1131,7 @@ static struct inode *ext4_alloc_inode(struct super_block *sb)
 	spin_lock_init(&ei->i_completed_io_lock);
 	ei->i_sync_tid = 0;
 	ei->i_datasync_tid = 0;
+	ei->i_fc_ineligible_tid = 0;
 	atomic_set(&ei->i_unwritten, 0);
 	INIT_WORK(&ei->i_rsv_conversion_work, ext4_end_io_rsv_work);
 	return &ei->vfs_inode;
@@ -1495,6 +1496,7 @@ enum {
 	Opt_dioread_nolock, Opt_dioread_lock,
 	Opt_discard, Opt_nodiscard, Opt_init_itable, Opt_noinit_itable,
 	Opt_max_dir_size_kb, Opt_nojournal_checksum, Opt_nombcache,
+	Opt_journal_async_ckpt, Opt_nojournal_async_ckpt,
 };
 
 static const match_table_t tokens = {
@@ -1530,6 +1532,8 @@ static const match_table_t tokens = {
 	{Opt_journal_checksum, "journal_checksum"},
 	{Opt_nojournal_checksum, "nojournal_checksum"},
 	{Opt_journal_async_commit, "journal_async_commit"},
+	{Opt_journal_async_ckpt, "journal_async_checkpoint"},
+	{Opt_nojournal_async_ckpt, "nojournal_async_checkpoint"},
 	{Opt_abort, "abort"},
 	{Opt_data_journal, "data=journal"},
 	{Opt_data_ordered, "data=ordered"},
@@ -1730,6 +1734,10 @@ static const struct mount_opts {
 	{Opt_journal_async_commit, (EXT4_MOUNT_JOURNAL_ASYNC_COMMIT |
 				    EXT4_MOUNT_JOURNAL_CHECKSUM),
 	 MOPT_EXT4_ONLY | MOPT_SET | MOPT_EXPLICIT},
+	{Opt_journal_async_ckpt, EXT4_MOUNT_JOURNAL_ASYNC_CKPT,
+	 MOPT_NO_EXT2 | MOPT_SET},
+	{Opt_nojournal_async_ckpt, EXT4_MOUNT_JOURNAL_ASYNC_CKPT,
+	 MOPT_NO_EXT2 | MOPT_CLEAR},
 	{Opt_noload, EXT4_MOUNT_NOLOAD, MOPT_NO_EXT2 | MOPT_SET},
 	{Opt_err_panic, EXT4_MOUNT_ERRORS_PANIC, MOPT_SET | MOPT_CLEAR_ERR},
 	{Opt_err_ro, EXT4_MOUNT_ERRORS_RO, MOPT_SET | MOPT_CLEAR_ERR},
@@ -4377,6 +4385,11 @@ static int ext4_fill_super(struct super_block *sb, void *data, int silent)
 		goto failed_mount_wq;
 	}
 
+	if (ext4_has_feature_fast_commit(sb) && !sb_rdonly(sb) &&
+	    !jbd2_journal_set_features(sbi->s_journal, 0, 0,
+				       JBD2_FEATURE_INCOMPAT_FAST_COMMIT))
+		ext4_msg(sb, KERN_WARNING, "Failed to enable fast commits");
+
 	/* We have now updated the journal if required, so we can
 	 * validate the data journaling mode. */
 	switch (test_opt(sb, DATA_FLAGS)) {
@@ -4712,6 +4725,7 @@ static void ext4_init_journal_params(struct super_block *sb, journal_t *journal)
 	journal->j_commit_interval = sbi->s_commit_interval;
 	journal->j_min_batch_time = sbi->s_min_batch_time;
 	journal->j_max_batch_time = sbi->s_max_batch_time;
+	journal->j_fc_replay_callback = ext4_fc_replay;
 
 	write_lock(&journal->j_state_lock);
 	if (test_opt(sb, BARRIER))
@@ -4722,6 +4736,10 @@ static void ext4_init_journal_params(struct super_block *sb, journal_t *journal)
 		journal->j_flags |= JBD2_ABORT_ON_SYNCDATA_ERR;
 	else
 		journal->j_flags &= ~JBD2_ABORT_ON_SYNCDATA_ERR;
+	if (test_opt(sb, JOURNAL_ASYNC_CKPT))
+		journal->j_flags |= JBD2_ASYNC_CHECKPOINT;
+	else
+		journal->j_flags &= ~JBD2_ASYNC_CHECKPOINT;
 	write_unlock(&journal->j_state_lock);
 }
 
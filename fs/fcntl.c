@@ -24,6 +24,7 @@
 #include <linux/pid_namespace.h>
 #include <linux/user_namespace.h>
 #include <linux/memfd.h>
+#include <linux/shmem_fs.h>
 #include <linux/compat.h>
 
 #include <linux/poll.h>
@@ -414,12 +415,19 @@ static long do_fcntl(int fd, unsigned int cmd, unsigned long arg,
 		break;
 	case F_SETPIPE_SZ:
 	case F_GETPIPE_SZ:
+	case F_SETPIPE_BUFSZ:
+	case F_GETPIPE_BUFSZ:
 		err = pipe_fcntl(filp, cmd, arg);
 		break;
 	case F_ADD_SEALS:
 	case F_GET_SEALS:
 		err = memfd_fcntl(filp, cmd, arg);
 		break;
+	case F_GET_SHMEM_HUGE:
+	case F_SET_SHMEM_HUGE:
+	case F_SET_SHMEM_INTERLEAVE:
+		err = shmem_fcntl(filp, cmd, arg);
+		break;
 	case F_GET_RW_HINT:
 	case F_SET_RW_HINT:
 	case F_GET_FILE_RW_HINT:
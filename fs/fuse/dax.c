@@ -55,6 +55,9 @@ struct fuse_dax_mapping {
 	/* Is this mapping read-only or read-write */
 	bool writable;
 
+	/* Used since the reclaimer last looked, gets it a second chance */
+	bool accessed;
+
 	/* reference count when the mapping is used by dax iomap. */
 	refcount_t refcnt;
 };
@@ -91,6 +94,13 @@ struct fuse_conn_dax {
 	struct list_head free_ranges;
 
 	unsigned long nr_ranges;
+
+	/* Statistics, shown in the fusectl dax_stats file */
+	atomic_long_t nr_hits;		/* range already mapped */
+	atomic_long_t nr_setups;	/* range newly mapped */
+	atomic_long_t nr_reclaims;	/* ranges freed by the worker */
+	atomic_long_t nr_inline_reclaims; /* ranges taken over inline */
+	atomic_long_t nr_waits;		/* waits for a free range */
 };
 
 static inline struct fuse_dax_mapping *
@@ -297,6 +307,7 @@ static void dmap_reinit_add_to_free_pool(struct fuse_conn_dax *fcd,
 	__dmap_remove_busy_list(fcd, dmap);
 	dmap->inode = NULL;
 	dmap->itn.start = dmap->itn.last = 0;
+	dmap->accessed = false;
 	__dmap_add_to_free_pool(fcd, dmap);
 }
 
@@ -412,6 +423,8 @@ static void fuse_fill_iomap(struct inode *inode, loff_t pos, loff_t length,
 		if (flags & IOMAP_FAULT)
 			iomap->length = ALIGN(len, PAGE_SIZE);
 		iomap->type = IOMAP_MAPPED;
+		if (!READ_ONCE(dmap->accessed))
+			WRITE_ONCE(dmap->accessed, true);
 		/*
 		 * increace refcnt so that reclaim code knows this dmap is in
 		 * use. This assumes fi->dax->sem mutex is held either
@@ -453,8 +466,10 @@ static int fuse_setup_new_dax_mapping(struct inode *inode, loff_t pos,
 	 */
 	if (flags & IOMAP_FAULT) {
 		alloc_dmap = alloc_dax_mapping(fcd);
-		if (!alloc_dmap)
+		if (!alloc_dmap) {
+			atomic_long_inc(&fcd->nr_waits);
 			return -EAGAIN;
+		}
 	} else {
 		alloc_dmap = alloc_dax_mapping_reclaim(fcd, inode);
 		if (IS_ERR(alloc_dmap))
@@ -480,6 +495,7 @@ static int fuse_setup_new_dax_mapping(struct inode *inode, loff_t pos,
 		fuse_fill_iomap(inode, pos, length, iomap, dmap, flags);
 		dmap_add_to_free_pool(fcd, alloc_dmap);
 		up_write(&fi->dax->sem);
+		atomic_long_inc(&fcd->nr_hits);
 		return 0;
 	}
 
@@ -491,6 +507,7 @@ static int fuse_setup_new_dax_mapping(struct inode *inode, loff_t pos,
 		up_write(&fi->dax->sem);
 		return ret;
 	}
+	atomic_long_inc(&fcd->nr_setups);
 	fuse_fill_iomap(inode, pos, length, iomap, alloc_dmap, flags);
 	up_write(&fi->dax->sem);
 	return 0;
@@ -589,6 +606,7 @@ static int fuse_iomap_begin(struct inode *inode, loff_t pos, loff_t length,
 	node = interval_tree_iter_first(&fi->dax->tree, start_idx, start_idx);
 	if (node) {
 		dmap = node_to_dmap(node);
+		atomic_long_inc(&fc->dax->nr_hits);
 		if (writable && !dmap->writable) {
 			/* Upgrade read-only mapping to read-write. This will
 			 * require exclusive fi->dax->sem lock as we don't want
@@ -1167,6 +1185,8 @@ inode_inline_reclaim_one_dmap(struct fuse_conn_dax *fcd, struct inode *inode,
 	dmap_remove_busy_list(fcd, dmap);
 	dmap->inode = NULL;
 	dmap->itn.start = dmap->itn.last = 0;
+	dmap->accessed = false;
+	atomic_long_inc(&fcd->nr_inline_reclaims);
 
 	pr_debug("fuse: %s: inline reclaimed memory range. inode=%p, window_offset=0x%llx, length=0x%llx\n",
 		 __func__, inode, dmap->window_offset, dmap->length);
@@ -1218,6 +1238,7 @@ alloc_dax_mapping_reclaim(struct fuse_conn_dax *fcd, struct inode *inode)
 		 * a range and wake us up.
 		 */
 		if (!fi->dax->nr && !(fcd->nr_free_ranges > 0)) {
+			atomic_long_inc(&fcd->nr_waits);
 			if (wait_event_killable_exclusive(fcd->range_waitq,
 					(fcd->nr_free_ranges > 0))) {
 				return ERR_PTR(-EINTR);
@@ -1255,6 +1276,7 @@ static int lookup_and_reclaim_dmap_locked(struct fuse_conn_dax *fcd,
 	spin_lock(&fcd->lock);
 	dmap_reinit_add_to_free_pool(fcd, dmap);
 	spin_unlock(&fcd->lock);
+	atomic_long_inc(&fcd->nr_reclaims);
 	return ret;
 }
 
@@ -1299,7 +1321,11 @@ static int try_to_free_dmap_chunks(struct fuse_conn_dax *fcd,
 	unsigned long start_idx = 0, end_idx = 0;
 	struct inode *inode = NULL;
 
-	/* Pick first busy range and free it for now*/
+	/*
+	 * Busy ranges are kept in the order they were set up or last looked
+	 * at. Pick the first idle one not used since then, those which were
+	 * get moved to the tail, so an approximation of LRU is reclaimed.
+	 */
 	while (1) {
 		if (nr_freed >= nr_to_free)
 			break;
@@ -1318,6 +1344,13 @@ static int try_to_free_dmap_chunks(struct fuse_conn_dax *fcd,
 			if (refcount_read(&pos->refcnt) > 1)
 				continue;
 
+			if (READ_ONCE(pos->accessed)) {
+				WRITE_ONCE(pos->accessed, false);
+				list_move_tail(&pos->busy_list,
+					       &fcd->busy_ranges);
+				continue;
+			}
+
 			inode = igrab(pos->inode);
 			/*
 			 * This inode is going away. That will free
@@ -1377,6 +1410,24 @@ static void fuse_free_dax_mem_ranges(struct list_head *mem_list)
 	}
 }
 
+int fuse_dax_show_stats(struct fuse_conn *fc, char *buf, size_t size)
+{
+	struct fuse_conn_dax *fcd = fc->dax;
+
+	if (!fcd)
+		return 0;
+
+	return scnprintf(buf, size,
+			 "ranges %lu\nfree %ld\nhits %ld\nsetups %ld\n"
+			 "reclaims %ld\ninline_reclaims %ld\nwaits %ld\n",
+			 fcd->nr_ranges, READ_ONCE(fcd->nr_free_ranges),
+			 atomic_long_read(&fcd->nr_hits),
+			 atomic_long_read(&fcd->nr_setups),
+			 atomic_long_read(&fcd->nr_reclaims),
+			 atomic_long_read(&fcd->nr_inline_reclaims),
+			 atomic_long_read(&fcd->nr_waits));
+}
+
 void fuse_dax_conn_free(struct fuse_conn *fc)
 {
 	if (fc->dax) {
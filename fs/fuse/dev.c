@@ -328,7 +328,7 @@ EXPORT_SYMBOL_GPL(fuse_len_args);
 
 u64 fuse_get_unique(struct fuse_iqueue *fiq)
 {
-	return ++fiq->reqctr;
+	return atomic64_inc_return(&fiq->reqctr);
 }
 EXPORT_SYMBOL_GPL(fuse_get_unique);
 
@@ -350,17 +350,62 @@ const struct fuse_iqueue_ops fuse_dev_fiq_ops = {
 };
 EXPORT_SYMBOL_GPL(fuse_dev_fiq_ops);
 
-static void queue_request_and_unlock(struct fuse_iqueue *fiq,
-				     struct fuse_req *req)
-__releases(fiq->lock)
+static void fuse_set_req_len(struct fuse_req *req)
 {
 	req->in.h.len = sizeof(struct fuse_in_header) +
 		fuse_len_args(req->in.numargs,
 			      (struct fuse_arg *) req->in.args);
+}
+
+static void queue_request_and_unlock(struct fuse_iqueue *fiq,
+				     struct fuse_req *req)
+__releases(fiq->lock)
+{
+	fuse_set_req_len(req);
 	list_add_tail(&req->list, &fiq->pending);
 	fiq->ops->wake_pending_and_unlock(fiq);
 }
 
+/*
+ * Hand @req to the input queue unless it was shut down, assigning a new
+ * unique id if @new_unique.  A transport with ->send_req() gets the request
+ * without fiq->lock being taken, so that submitters on different CPUs do
+ * not contend on it.  Returns false if @req was not queued.
+ */
+static bool fuse_queue_request(struct fuse_iqueue *fiq, struct fuse_req *req,
+			       bool new_unique)
+{
+	if (fiq->ops->send_req) {
+		if (!READ_ONCE(fiq->connected))
+			return false;
+		if (new_unique)
+			req->in.h.unique = fuse_get_unique(fiq);
+		fuse_set_req_len(req);
+		fiq->ops->send_req(fiq, req);
+		return true;
+	}
+
+	if (fuse_uring_ready(fiq)) {
+		if (new_unique) {
+			req->in.h.unique = fuse_get_unique(fiq);
+			new_unique = false;
+		}
+		fuse_set_req_len(req);
+		if (fuse_uring_queue_req(fiq, req))
+			return true;
+	}
+
+	spin_lock(&fiq->lock);
+	if (!fiq->connected) {
+		spin_unlock(&fiq->lock);
+		return false;
+	}
+	if (new_unique)
+		req->in.h.unique = fuse_get_unique(fiq);
+	queue_request_and_unlock(fiq, req);
+	return true;
+}
+
 void fuse_queue_forget(struct fuse_conn *fc, struct fuse_forget_link *forget,
 		       u64 nodeid, u64 nlookup)
 {
@@ -391,6 +436,18 @@ static void flush_bg_queue(struct fuse_conn *fc)
 		req = list_first_entry(&fc->bg_queue, struct fuse_req, list);
 		list_del(&req->list);
 		fc->active_background++;
+		if (fiq->ops->send_req) {
+			req->in.h.unique = fuse_get_unique(fiq);
+			fuse_set_req_len(req);
+			fiq->ops->send_req(fiq, req);
+			continue;
+		}
+		if (fuse_uring_ready(fiq)) {
+			req->in.h.unique = fuse_get_unique(fiq);
+			fuse_set_req_len(req);
+			if (fuse_uring_queue_req(fiq, req))
+				continue;
+		}
 		spin_lock(&fiq->lock);
 		req->in.h.unique = fuse_get_unique(fiq);
 		queue_request_and_unlock(fiq, req);
@@ -516,19 +573,15 @@ static void __fuse_request_send(struct fuse_conn *fc, struct fuse_req *req)
 	struct fuse_iqueue *fiq = &fc->iq;
 
 	BUG_ON(test_bit(FR_BACKGROUND, &req->flags));
-	spin_lock(&fiq->lock);
-	if (!fiq->connected) {
-		spin_unlock(&fiq->lock);
+	/*
+	 * acquire extra reference, since request is still
+	 * needed after fuse_request_end()
+	 */
+	__fuse_get_request(req);
+	if (!fuse_queue_request(fiq, req, true)) {
+		__fuse_put_request(req);
 		req->out.h.error = -ENOTCONN;
 	} else {
-		req->in.h.unique = fuse_get_unique(fiq);
-		/*
-		 * acquire extra reference, since request is still
-		 * needed after fuse_request_end()
-		 */
-		__fuse_get_request(req);
-		queue_request_and_unlock(fiq, req);
-
 		request_wait_answer(fc, req);
 		/* Pairs with smp_wmb() in fuse_request_end() */
 		smp_rmb();
@@ -658,13 +711,8 @@ static int fuse_request_send_notify_reply(struct fuse_conn *fc,
 
 	__clear_bit(FR_ISREPLY, &req->flags);
 	req->in.h.unique = unique;
-	spin_lock(&fiq->lock);
-	if (fiq->connected) {
-		queue_request_and_unlock(fiq, req);
+	if (fuse_queue_request(fiq, req, false))
 		err = 0;
-	} else {
-		spin_unlock(&fiq->lock);
-	}
 
 	return err;
 }
@@ -1271,6 +1319,74 @@ __releases(fiq->lock)
 		return fuse_read_batch_forget(fiq, cs, nbytes);
 }
 
+static void fuse_req_too_large(struct fuse_conn *fc, struct fuse_req *req)
+{
+	req->out.h.error = -EIO;
+	/* SETXATTR is special, since it may contain too large data */
+	if (req->in.h.opcode == FUSE_SETXATTR)
+		req->out.h.error = -E2BIG;
+	fuse_request_end(fc, req);
+}
+
+/*
+ * Copy @req to the userspace buffer of @cs.  If no reply is needed or
+ * there was an error, it's finished right away.  Otherwise add it to the
+ * processing list and set the 'sent' flag.
+ */
+static ssize_t fuse_dev_transfer_req(struct fuse_dev *fud,
+				     struct fuse_copy_state *cs,
+				     struct fuse_req *req)
+{
+	ssize_t err;
+	struct fuse_conn *fc = fud->fc;
+	struct fuse_iqueue *fiq = &fc->iq;
+	struct fuse_pqueue *fpq = &fud->pq;
+	struct fuse_in *in = &req->in;
+	unsigned reqsize = in->h.len;
+
+	spin_lock(&fpq->lock);
+	list_add(&req->list, &fpq->io);
+	spin_unlock(&fpq->lock);
+	cs->req = req;
+	err = fuse_copy_one(cs, &in->h, sizeof(in->h));
+	if (!err)
+		err = fuse_copy_args(cs, in->numargs, in->argpages,
+				     (struct fuse_arg *) in->args, 0);
+	fuse_copy_finish(cs);
+	spin_lock(&fpq->lock);
+	clear_bit(FR_LOCKED, &req->flags);
+	if (!fpq->connected) {
+		err = (fc->aborted && fc->abort_err) ? -ECONNABORTED : -ENODEV;
+		goto out_end;
+	}
+	if (err) {
+		req->out.h.error = -EIO;
+		goto out_end;
+	}
+	if (!test_bit(FR_ISREPLY, &req->flags)) {
+		err = reqsize;
+		goto out_end;
+	}
+	list_move_tail(&req->list, &fpq->processing);
+	__fuse_get_request(req);
+	set_bit(FR_SENT, &req->flags);
+	spin_unlock(&fpq->lock);
+	/* matches barrier in request_wait_answer() */
+	smp_mb__after_atomic();
+	if (test_bit(FR_INTERRUPTED, &req->flags))
+		queue_interrupt(fiq, req);
+	fuse_put_request(fc, req);
+
+	return reqsize;
+
+out_end:
+	if (!test_bit(FR_PRIVATE, &req->flags))
+		list_del_init(&req->list);
+	spin_unlock(&fpq->lock);
+	fuse_request_end(fc, req);
+	return err;
+}
+
 /*
  * Read a single request into the userspace filesystem's buffer.  This
  * function waits until a request is available, then removes it from
@@ -1286,10 +1402,7 @@ static ssize_t fuse_dev_do_read(struct fuse_dev *fud, struct file *file,
 	ssize_t err;
 	struct fuse_conn *fc = fud->fc;
 	struct fuse_iqueue *fiq = &fc->iq;
-	struct fuse_pqueue *fpq = &fud->pq;
 	struct fuse_req *req;
-	struct fuse_in *in;
-	unsigned reqsize;
 
  restart:
 	for (;;) {
@@ -1330,65 +1443,47 @@ static ssize_t fuse_dev_do_read(struct fuse_dev *fud, struct file *file,
 	list_del_init(&req->list);
 	spin_unlock(&fiq->lock);
 
-	in = &req->in;
-	reqsize = in->h.len;
-
 	/* If request is too large, reply with an error and restart the read */
-	if (nbytes < reqsize) {
-		req->out.h.error = -EIO;
-		/* SETXATTR is special, since it may contain too large data */
-		if (in->h.opcode == FUSE_SETXATTR)
-			req->out.h.error = -E2BIG;
-		fuse_request_end(fc, req);
+	if (nbytes < req->in.h.len) {
+		fuse_req_too_large(fc, req);
 		goto restart;
 	}
-	spin_lock(&fpq->lock);
-	list_add(&req->list, &fpq->io);
-	spin_unlock(&fpq->lock);
-	cs->req = req;
-	err = fuse_copy_one(cs, &in->h, sizeof(in->h));
-	if (!err)
-		err = fuse_copy_args(cs, in->numargs, in->argpages,
-				     (struct fuse_arg *) in->args, 0);
-	fuse_copy_finish(cs);
-	spin_lock(&fpq->lock);
-	clear_bit(FR_LOCKED, &req->flags);
-	if (!fpq->connected) {
-		err = (fc->aborted && fc->abort_err) ? -ECONNABORTED : -ENODEV;
-		goto out_end;
-	}
-	if (err) {
-		req->out.h.error = -EIO;
-		goto out_end;
-	}
-	if (!test_bit(FR_ISREPLY, &req->flags)) {
-		err = reqsize;
-		goto out_end;
-	}
-	list_move_tail(&req->list, &fpq->processing);
-	__fuse_get_request(req);
-	set_bit(FR_SENT, &req->flags);
-	spin_unlock(&fpq->lock);
-	/* matches barrier in request_wait_answer() */
-	smp_mb__after_atomic();
-	if (test_bit(FR_INTERRUPTED, &req->flags))
-		queue_interrupt(fiq, req);
-	fuse_put_request(fc, req);
 
-	return reqsize;
-
-out_end:
-	if (!test_bit(FR_PRIVATE, &req->flags))
-		list_del_init(&req->list);
-	spin_unlock(&fpq->lock);
-	fuse_request_end(fc, req);
-	return err;
+	return fuse_dev_transfer_req(fud, cs, req);
 
  err_unlock:
 	spin_unlock(&fiq->lock);
 	return err;
 }
 
+/*
+ * Copy @req, already taken off the input queue, into the daemon's buffer
+ * at @buf for the io_uring transport, just like a read of the device.
+ */
+ssize_t fuse_dev_read_req(struct fuse_dev *fud, struct fuse_req *req,
+			  void __user *buf, size_t nbytes)
+{
+	struct fuse_copy_state cs;
+	struct iov_iter iter;
+	struct iovec iov;
+	int err;
+
+	if (nbytes < req->in.h.len) {
+		fuse_req_too_large(fud->fc, req);
+		return -EINVAL;
+	}
+
+	err = import_single_range(READ, buf, nbytes, &iov, &iter);
+	if (err) {
+		req->out.h.error = -EIO;
+		fuse_request_end(fud->fc, req);
+		return err;
+	}
+
+	fuse_copy_init(&cs, 1, &iter);
+	return fuse_dev_transfer_req(fud, &cs, req);
+}
+
 static int fuse_dev_open(struct inode *inode, struct file *file)
 {
 	/*
@@ -2002,6 +2097,24 @@ static ssize_t fuse_dev_write(struct kiocb *iocb, struct iov_iter *from)
 	return fuse_dev_do_write(fud, &cs, iov_iter_count(from));
 }
 
+/* A reply or notification of @nbytes at @buf, from the io_uring transport */
+ssize_t fuse_dev_write_buf(struct fuse_dev *fud, void __user *buf,
+			   size_t nbytes)
+{
+	struct fuse_copy_state cs;
+	struct iov_iter iter;
+	struct iovec iov;
+	int err;
+
+	err = import_single_range(WRITE, buf, nbytes, &iov, &iter);
+	if (err)
+		return err;
+
+	fuse_copy_init(&cs, 0, &iter);
+
+	return fuse_dev_do_write(fud, &cs, nbytes);
+}
+
 static ssize_t fuse_dev_splice_write(struct pipe_inode_info *pipe,
 				     struct file *out, loff_t *ppos,
 				     size_t len, unsigned int flags)
@@ -2213,6 +2326,7 @@ void fuse_abort_conn(struct fuse_conn *fc, bool is_abort)
 			kfree(fuse_dequeue_forget(fiq, 1, NULL));
 		wake_up_all(&fiq->waitq);
 		spin_unlock(&fiq->lock);
+		fuse_uring_abort(fc, &to_end);
 		kill_fasync(&fiq->fasync, SIGIO, POLL_IN);
 		end_polls(fc);
 		wake_up_all(&fc->blocked_waitq);
@@ -2354,6 +2468,21 @@ static long fuse_dev_ioctl(struct file *file, unsigned int cmd,
 			}
 		}
 		break;
+	case FUSE_DEV_IOC_PASSTHROUGH_OPEN: {
+		struct fuse_passthrough_out pto;
+
+		res = -EFAULT;
+		if (copy_from_user(&pto, (void __user *)arg, sizeof(pto)))
+			break;
+
+		res = -EINVAL;
+		fud = fuse_get_dev(file);
+		if (!fud || pto.flags)
+			break;
+
+		res = fuse_passthrough_open(fud, pto.fd);
+		break;
+	}
 	default:
 		res = -ENOTTY;
 		break;
@@ -2374,6 +2503,9 @@ const struct file_operations fuse_dev_operations = {
 	.fasync		= fuse_dev_fasync,
 	.unlocked_ioctl = fuse_dev_ioctl,
 	.compat_ioctl   = fuse_dev_ioctl,
+#ifdef CONFIG_IO_URING
+	.uring_cmd	= fuse_uring_cmd,
+#endif
 };
 EXPORT_SYMBOL_GPL(fuse_dev_operations);
 
@@ -0,0 +1,368 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * FUSE: io_uring transport
+ *
+ * The daemon queues buffers with IORING_OP_URING_CMD on a device fd, on
+ * one queue per CPU.  A request issued on a CPU is copied into a buffer of
+ * that CPU's queue from the daemon's task, which completes the command.
+ * The reply comes back in the same buffer, with the command fetching the
+ * next request.  A round trip thus takes no read or write of the device,
+ * and the submitters of different CPUs do not meet on the input queue.
+ */
+
+#include "fuse_i.h"
+
+#include <linux/io_uring.h>
+#include <linux/mm.h>
+#include <linux/uaccess.h>
+
+struct fuse_ring_queue {
+	spinlock_t lock;
+
+	/* buffers waiting for a request */
+	struct list_head cmds;
+
+	/* requests waiting for a buffer */
+	struct list_head reqs;
+
+	/* buffers which were fetched and not failed or canceled since */
+	unsigned int nr_cmds;
+
+	/* connection was aborted */
+	bool stopped;
+} ____cacheline_aligned_in_smp;
+
+struct fuse_ring {
+	unsigned int nr_queues;
+	struct fuse_ring_queue queues[];
+};
+
+/* Kept in io_uring_cmd->pdu while the command is ours */
+struct fuse_uring_pdu {
+	union {
+		/* on queue->cmds */
+		struct list_head list;
+		/* being copied to the buffer */
+		struct fuse_req *req;
+	};
+	void __user *buf;
+	u32 buf_len;
+	u16 qid;
+	u16 queued;
+};
+
+static struct fuse_uring_pdu *fuse_uring_pdu(struct io_uring_cmd *ioucmd)
+{
+	BUILD_BUG_ON(sizeof(struct fuse_uring_pdu) > sizeof(ioucmd->pdu));
+	return (struct fuse_uring_pdu *) ioucmd->pdu;
+}
+
+static struct io_uring_cmd *fuse_uring_pdu_cmd(struct fuse_uring_pdu *pdu)
+{
+	return container_of((void *) pdu, struct io_uring_cmd, pdu);
+}
+
+static int fuse_uring_conn_err(struct fuse_conn *fc)
+{
+	return (fc->aborted && fc->abort_err) ? -ECONNABORTED : -ENODEV;
+}
+
+static struct fuse_ring *fuse_uring_get(struct fuse_conn *fc)
+{
+	struct fuse_ring *ring = READ_ONCE(fc->ring);
+	unsigned int qid;
+	int err = 0;
+
+	if (ring)
+		return ring;
+
+	ring = kvzalloc(struct_size(ring, queues, nr_cpu_ids), GFP_KERNEL);
+	if (!ring)
+		return ERR_PTR(-ENOMEM);
+
+	ring->nr_queues = nr_cpu_ids;
+	for (qid = 0; qid < ring->nr_queues; qid++) {
+		struct fuse_ring_queue *queue = &ring->queues[qid];
+
+		spin_lock_init(&queue->lock);
+		INIT_LIST_HEAD(&queue->cmds);
+		INIT_LIST_HEAD(&queue->reqs);
+	}
+
+	/* fuse_uring_abort() runs under fc->lock */
+	spin_lock(&fc->lock);
+	if (!fc->connected) {
+		err = fuse_uring_conn_err(fc);
+	} else if (!fc->ring) {
+		smp_store_release(&fc->ring, ring);
+		ring = NULL;
+	}
+	spin_unlock(&fc->lock);
+
+	kvfree(ring);
+	return err ? ERR_PTR(err) : fc->ring;
+}
+
+/* Hand requests back to the device, after the last buffer of a queue left */
+static void fuse_uring_requeue(struct fuse_conn *fc, struct list_head *reqs)
+{
+	struct fuse_iqueue *fiq = &fc->iq;
+	struct fuse_req *req, *next;
+
+	list_for_each_entry_safe(req, next, reqs, list) {
+		list_del_init(&req->list);
+		spin_lock(&fiq->lock);
+		if (fiq->connected) {
+			set_bit(FR_PENDING, &req->flags);
+			list_add_tail(&req->list, &fiq->pending);
+			fiq->ops->wake_pending_and_unlock(fiq);
+			continue;
+		}
+		spin_unlock(&fiq->lock);
+		req->out.h.error = -ENOTCONN;
+		fuse_request_end(fc, req);
+	}
+}
+
+/* A buffer fetched on @queue failed or was canceled */
+static void fuse_uring_put_cmd(struct fuse_conn *fc,
+			       struct fuse_ring_queue *queue)
+{
+	LIST_HEAD(reqs);
+
+	spin_lock(&queue->lock);
+	if (queue->nr_cmds && !--queue->nr_cmds)
+		list_splice_init(&queue->reqs, &reqs);
+	spin_unlock(&queue->lock);
+
+	fuse_uring_requeue(fc, &reqs);
+}
+
+/* Runs in the daemon's task, where its buffer can be written */
+static void fuse_uring_send_in_task(struct io_uring_cmd *ioucmd,
+				    unsigned int issue_flags)
+{
+	struct fuse_uring_pdu *pdu = fuse_uring_pdu(ioucmd);
+	struct fuse_dev *fud = fuse_get_dev(ioucmd->file);
+	struct fuse_conn *fc = fud->fc;
+	struct fuse_req *req = pdu->req;
+	ssize_t ret;
+
+	if (unlikely(issue_flags & IO_URING_F_TASK_DEAD)) {
+		LIST_HEAD(reqs);
+
+		list_add(&req->list, &reqs);
+		fuse_uring_requeue(fc, &reqs);
+		ret = -ECANCELED;
+	} else {
+		ret = fuse_dev_read_req(fud, req, pdu->buf, pdu->buf_len);
+	}
+
+	if (ret < 0)
+		fuse_uring_put_cmd(fc, &fc->ring->queues[pdu->qid]);
+	io_uring_cmd_done(ioucmd, ret);
+}
+
+/*
+ * Queue @req on the queue of this CPU.  Returns false if that queue has no
+ * buffers, the request then goes to the device.
+ */
+bool fuse_uring_queue_req(struct fuse_iqueue *fiq, struct fuse_req *req)
+{
+	struct fuse_conn *fc = container_of(fiq, struct fuse_conn, iq);
+	struct fuse_ring *ring = READ_ONCE(fc->ring);
+	struct fuse_ring_queue *queue = &ring->queues[raw_smp_processor_id()];
+	struct fuse_uring_pdu *pdu;
+
+	spin_lock(&queue->lock);
+	if (queue->stopped || !queue->nr_cmds) {
+		spin_unlock(&queue->lock);
+		return false;
+	}
+
+	/* like a virtio-fs request, never taken back by the submitter */
+	clear_bit(FR_PENDING, &req->flags);
+	pdu = list_first_entry_or_null(&queue->cmds, struct fuse_uring_pdu,
+				       list);
+	if (!pdu) {
+		list_add_tail(&req->list, &queue->reqs);
+		spin_unlock(&queue->lock);
+		return true;
+	}
+	list_del(&pdu->list);
+	pdu->queued = 0;
+	pdu->req = req;
+	spin_unlock(&queue->lock);
+
+	io_uring_cmd_complete_in_task(fuse_uring_pdu_cmd(pdu),
+				      fuse_uring_send_in_task);
+	return true;
+}
+
+static ssize_t fuse_uring_fetch(struct fuse_dev *fud, struct fuse_ring *ring,
+				struct io_uring_cmd *ioucmd, bool new)
+{
+	struct fuse_uring_pdu *pdu = fuse_uring_pdu(ioucmd);
+	struct fuse_ring_queue *queue = &ring->queues[pdu->qid];
+	struct fuse_req *req;
+	ssize_t ret;
+
+	spin_lock(&queue->lock);
+	if (queue->stopped) {
+		spin_unlock(&queue->lock);
+		return fuse_uring_conn_err(fud->fc);
+	}
+	if (new)
+		queue->nr_cmds++;
+
+	req = list_first_entry_or_null(&queue->reqs, struct fuse_req, list);
+	if (!req) {
+		list_add_tail(&pdu->list, &queue->cmds);
+		pdu->queued = 1;
+		spin_unlock(&queue->lock);
+		return -EIOCBQUEUED;
+	}
+	list_del_init(&req->list);
+	spin_unlock(&queue->lock);
+
+	ret = fuse_dev_read_req(fud, req, pdu->buf, pdu->buf_len);
+	if (ret < 0)
+		fuse_uring_put_cmd(fud->fc, queue);
+	return ret;
+}
+
+/* The reply to a fetched request, as it would be written to the device */
+static ssize_t fuse_uring_commit(struct fuse_dev *fud,
+				 struct fuse_uring_pdu *pdu)
+{
+	struct fuse_out_header __user *oh = pdu->buf;
+	u32 len;
+
+	if (get_user(len, &oh->len))
+		return -EFAULT;
+	if (len > pdu->buf_len)
+		return -EINVAL;
+
+	return fuse_dev_write_buf(fud, pdu->buf, len);
+}
+
+static void fuse_uring_cancel(struct io_uring_cmd *ioucmd)
+{
+	struct fuse_uring_pdu *pdu = fuse_uring_pdu(ioucmd);
+	struct fuse_dev *fud = fuse_get_dev(ioucmd->file);
+	struct fuse_ring_queue *queue;
+	struct fuse_ring *ring;
+	bool queued;
+
+	ring = fud ? READ_ONCE(fud->fc->ring) : NULL;
+	if (!ring)
+		return;
+
+	queue = &ring->queues[pdu->qid];
+	spin_lock(&queue->lock);
+	queued = pdu->queued;
+	if (queued) {
+		list_del(&pdu->list);
+		pdu->queued = 0;
+	}
+	spin_unlock(&queue->lock);
+
+	/* otherwise a request is on its way, the command completes with it */
+	if (!queued)
+		return;
+
+	fuse_uring_put_cmd(fud->fc, queue);
+	io_uring_cmd_done(ioucmd, -ECANCELED);
+}
+
+int fuse_uring_cmd(struct io_uring_cmd *ioucmd, unsigned int issue_flags)
+{
+	struct fuse_uring_pdu *pdu = fuse_uring_pdu(ioucmd);
+	struct fuse_dev *fud = fuse_get_dev(ioucmd->file);
+	struct fuse_uring_cmd_req cmd_req;
+	struct fuse_ring *ring;
+	ssize_t err;
+
+	if (issue_flags & IO_URING_F_CANCEL) {
+		fuse_uring_cancel(ioucmd);
+		return 0;
+	}
+
+	if (!fud)
+		return -EPERM;
+
+	if (ioucmd->cmd_len != sizeof(cmd_req))
+		return -EINVAL;
+	if (copy_from_user(&cmd_req, ioucmd->cmd, sizeof(cmd_req)))
+		return -EFAULT;
+	if (cmd_req.flags || cmd_req.qid >= nr_cpu_ids ||
+	    !cpu_possible(cmd_req.qid))
+		return -EINVAL;
+	if (cmd_req.buf_len < FUSE_MIN_READ_BUFFER)
+		return -EINVAL;
+
+	pdu->buf = u64_to_user_ptr(cmd_req.buf);
+	pdu->buf_len = cmd_req.buf_len;
+	pdu->qid = cmd_req.qid;
+	pdu->queued = 0;
+
+	switch (ioucmd->cmd_op) {
+	case FUSE_URING_REQ_FETCH:
+		ring = fuse_uring_get(fud->fc);
+		if (IS_ERR(ring))
+			return PTR_ERR(ring);
+		return fuse_uring_fetch(fud, ring, ioucmd, true);
+
+	case FUSE_URING_REQ_COMMIT_AND_FETCH:
+		ring = READ_ONCE(fud->fc->ring);
+		if (!ring)
+			return -EINVAL;
+		err = fuse_uring_commit(fud, pdu);
+		if (err < 0) {
+			fuse_uring_put_cmd(fud->fc, &ring->queues[pdu->qid]);
+			return err;
+		}
+		return fuse_uring_fetch(fud, ring, ioucmd, false);
+
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+/*
+ * Called by fuse_abort_conn() with fc->lock held.  Queued requests go to
+ * @to_end, buffers are returned to the daemon.
+ */
+void fuse_uring_abort(struct fuse_conn *fc, struct list_head *to_end)
+{
+	struct fuse_ring *ring = fc->ring;
+	struct fuse_uring_pdu *pdu, *next;
+	unsigned int qid;
+	LIST_HEAD(cmds);
+
+	if (!ring)
+		return;
+
+	for (qid = 0; qid < ring->nr_queues; qid++) {
+		struct fuse_ring_queue *queue = &ring->queues[qid];
+
+		spin_lock(&queue->lock);
+		queue->stopped = true;
+		list_splice_tail_init(&queue->reqs, to_end);
+		list_for_each_entry(pdu, &queue->cmds, list)
+			pdu->queued = 0;
+		list_splice_tail_init(&queue->cmds, &cmds);
+		spin_unlock(&queue->lock);
+	}
+
+	list_for_each_entry_safe(pdu, next, &cmds, list) {
+		list_del(&pdu->list);
+		io_uring_cmd_done(fuse_uring_pdu_cmd(pdu),
+				  fuse_uring_conn_err(fc));
+	}
+}
+
+void fuse_uring_free(struct fuse_conn *fc)
+{
+	kvfree(fc->ring);
+}
@@ -229,7 +229,7 @@ static int fuse_dentry_revalidate(struct dentry *entry, unsigned int flags)
 		    (outarg.attr.mode ^ inode->i_mode) & S_IFMT)
 			goto invalid;
 
-		forget_all_cached_acls(inode);
+		fuse_forget_stale_acls(inode, &outarg.attr);
 		fuse_change_attributes(inode, &outarg.attr,
 				       entry_attr_timeout(&outarg),
 				       attr_version);
@@ -237,8 +237,18 @@ static int fuse_dentry_revalidate(struct dentry *entry, unsigned int flags)
 	} else if (inode) {
 		fi = get_fuse_inode(inode);
 		if (flags & LOOKUP_RCU) {
-			if (test_bit(FUSE_I_INIT_RDPLUS, &fi->state))
-				return -ECHILD;
+			struct inode *dir;
+
+			/* the parent can't be freed under us in RCU mode */
+			if (test_bit(FUSE_I_INIT_RDPLUS, &fi->state)) {
+				parent = READ_ONCE(entry->d_parent);
+				dir = d_inode_rcu(parent);
+				if (!dir)
+					return -ECHILD;
+				if (test_and_clear_bit(FUSE_I_INIT_RDPLUS,
+						       &fi->state))
+					fuse_advise_use_readdirplus(dir);
+			}
 		} else if (test_and_clear_bit(FUSE_I_INIT_RDPLUS, &fi->state)) {
 			parent = dget_parent(entry);
 			fuse_advise_use_readdirplus(d_inode(parent));
@@ -458,6 +468,9 @@ static int fuse_create_open(struct inode *dir, struct dentry *entry,
 	ff->fh = outopen.fh;
 	ff->nodeid = outentry.nodeid;
 	ff->open_flags = outopen.open_flags;
+	if ((ff->open_flags & FOPEN_PASSTHROUGH) &&
+	    fuse_passthrough_setup(fc, ff, &outopen))
+		ff->open_flags &= ~FOPEN_PASSTHROUGH;
 	inode = fuse_iget(dir->i_sb, outentry.nodeid, outentry.generation,
 			  &outentry.attr, entry_attr_timeout(&outentry), 0);
 	if (!inode) {
@@ -925,6 +938,7 @@ static int fuse_do_getattr(struct inode *inode, struct kstat *stat,
 			make_bad_inode(inode);
 			err = -EIO;
 		} else {
+			fuse_forget_stale_acls(inode, &outarg.attr);
 			fuse_change_attributes(inode, &outarg.attr,
 					       attr_timeout(&outarg),
 					       attr_version);
@@ -950,7 +964,6 @@ static int fuse_update_get_attr(struct inode *inode, struct file *file,
 		sync = time_before64(fi->i_time, get_jiffies_64());
 
 	if (sync) {
-		forget_all_cached_acls(inode);
 		err = fuse_do_getattr(inode, stat, file);
 	} else if (stat) {
 		generic_fillattr(inode, stat);
@@ -1096,7 +1109,6 @@ static int fuse_perm_getattr(struct inode *inode, int mask)
 	if (mask & MAY_NOT_BLOCK)
 		return -ECHILD;
 
-	forget_all_cached_acls(inode);
 	return fuse_do_getattr(inode, NULL, NULL);
 }
 
@@ -27,6 +27,7 @@
 #include <linux/pid_namespace.h>
 #include <linux/refcount.h>
 #include <linux/user_namespace.h>
+#include <linux/idr.h>
 
 /** Default max number of pages that can be used in a single read request */
 #define FUSE_DEFAULT_MAX_PAGES_PER_REQ 32
@@ -41,7 +42,7 @@
 #define FUSE_NAME_MAX 1024
 
 /** Number of dentries for each connection in the control filesystem */
-#define FUSE_CTL_NUM_DENTRIES 6
+#define FUSE_CTL_NUM_DENTRIES 7
 
 /** Number of page pointers embedded in fuse_req */
 #define FUSE_REQ_INLINE_PAGES 1
@@ -205,6 +206,14 @@ enum {
 
 struct fuse_conn;
 
+/** Backing file of a FOPEN_PASSTHROUGH file */
+struct fuse_passthrough {
+	struct file *filp;
+
+	/** Credentials of the daemon which registered it */
+	const struct cred *cred;
+};
+
 /** FUSE specific file data */
 struct fuse_file {
 	/** Fuse connection for this file */
@@ -259,6 +268,9 @@ struct fuse_file {
 	/** Wait queue head for poll */
 	wait_queue_head_t poll_wait;
 
+	/** Backing file, if FOPEN_PASSTHROUGH */
+	struct fuse_passthrough passthrough;
+
 	/** Has flock been performed on this file? */
 	bool flock:1;
 };
@@ -523,6 +535,12 @@ struct fuse_iqueue_ops {
 	void (*wake_pending_and_unlock)(struct fuse_iqueue *fiq)
 	__releases(fiq->lock);
 
+	/**
+	 * Send a request straight to the transport, bypassing fiq->pending
+	 * and without taking fiq->lock (optional)
+	 */
+	void (*send_req)(struct fuse_iqueue *fiq, struct fuse_req *req);
+
 	/**
 	 * Clean up when fuse_iqueue is destroyed
 	 */
@@ -543,7 +561,7 @@ struct fuse_iqueue {
 	wait_queue_head_t waitq;
 
 	/** The next unique request id */
-	u64 reqctr;
+	atomic64_t reqctr;
 
 	/** The list of pending requests */
 	struct list_head pending;
@@ -816,6 +834,9 @@ struct fuse_conn {
 	/* Does the filesystem support per-file DAX? */
 	unsigned int perfile_dax:1;
 
+	/** Passthrough of I/O to backing files enabled? */
+	unsigned int passthrough:1;
+
 	/* Does the filesystem has its own magic? */
 	unsigned int conn_fs_magic:1;
 
@@ -858,6 +879,12 @@ struct fuse_conn {
 	/** List of device instances belonging to this connection */
 	struct list_head devices;
 
+	/** Backing files registered by the daemon, not opened yet */
+	struct idr passthrough_req;
+
+	/** io_uring transport, set once the daemon queued a buffer */
+	struct fuse_ring *ring;
+
 #ifdef CONFIG_FUSE_DAX
 	/* dax mode: FUSE_DAX_* (always, never or per-file) */
 	enum fuse_dax_mode dax_mode;
@@ -995,6 +1022,11 @@ void fuse_change_attributes(struct inode *inode, struct fuse_attr *attr,
 void fuse_change_attributes_common(struct inode *inode, struct fuse_attr *attr,
 				   u64 attr_valid);
 
+/**
+ * Forget cached ACLs if the new attributes show that they may have changed
+ */
+void fuse_forget_stale_acls(struct inode *inode, struct fuse_attr *attr);
+
 /**
  * Initialize the client device
  */
@@ -1262,5 +1294,54 @@ void fuse_dax_inode_cleanup(struct inode *inode);
 void fuse_dax_dontcache(struct inode *inode, bool newdax);
 bool fuse_dax_check_alignment(struct fuse_conn *fc, unsigned int map_alignment);
 void fuse_dax_cancel_work(struct fuse_conn *fc);
+int fuse_dax_show_stats(struct fuse_conn *fc, char *buf, size_t size);
+
+/* passthrough.c */
+int fuse_passthrough_open(struct fuse_dev *fud, u32 fd);
+int fuse_passthrough_setup(struct fuse_conn *fc, struct fuse_file *ff,
+			   struct fuse_open_out *openarg);
+void fuse_passthrough_release(struct fuse_passthrough *passthrough);
+void fuse_passthrough_free_reqs(struct fuse_conn *fc);
+ssize_t fuse_passthrough_read_iter(struct kiocb *iocb, struct iov_iter *to);
+ssize_t fuse_passthrough_write_iter(struct kiocb *iocb, struct iov_iter *from);
+int fuse_passthrough_mmap(struct file *file, struct vm_area_struct *vma);
+
+/* dev.c, for the io_uring transport */
+ssize_t fuse_dev_read_req(struct fuse_dev *fud, struct fuse_req *req,
+			  void __user *buf, size_t nbytes);
+ssize_t fuse_dev_write_buf(struct fuse_dev *fud, void __user *buf,
+			   size_t nbytes);
+
+/* dev_uring.c */
+#ifdef CONFIG_IO_URING
+struct io_uring_cmd;
+
+int fuse_uring_cmd(struct io_uring_cmd *ioucmd, unsigned int issue_flags);
+bool fuse_uring_queue_req(struct fuse_iqueue *fiq, struct fuse_req *req);
+void fuse_uring_abort(struct fuse_conn *fc, struct list_head *to_end);
+void fuse_uring_free(struct fuse_conn *fc);
+
+static inline bool fuse_uring_ready(struct fuse_iqueue *fiq)
+{
+	return READ_ONCE(container_of(fiq, struct fuse_conn, iq)->ring);
+}
+#else
+static inline bool fuse_uring_queue_req(struct fuse_iqueue *fiq,
+					struct fuse_req *req)
+{
+	return false;
+}
+static inline void fuse_uring_abort(struct fuse_conn *fc,
+				    struct list_head *to_end)
+{
+}
+static inline void fuse_uring_free(struct fuse_conn *fc)
+{
+}
+static inline bool fuse_uring_ready(struct fuse_iqueue *fiq)
+{
+	return false;
+}
+#endif
 
 #endif /* _FS_FUSE_I_H */
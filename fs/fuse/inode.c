@@ -208,6 +208,26 @@ void fuse_change_attributes_common(struct inode *inode, struct fuse_attr *attr,
 	fi->orig_ino = attr->ino;
 }
 
+/*
+ * Setting an ACL changes the ctime of the inode, and often the mode too.
+ * Only drop the cached ACLs when fresh attributes show such a change, so
+ * that an attribute refresh doesn't force the next RCU path walk through
+ * this inode to fall back to ref-walk for fetching the ACL again.
+ */
+void fuse_forget_stale_acls(struct inode *inode, struct fuse_attr *attr)
+{
+	struct fuse_conn *fc = get_fuse_conn(inode);
+	struct fuse_inode *fi = get_fuse_inode(inode);
+
+	if (!fc->posix_acl)
+		return;
+
+	if (inode->i_ctime.tv_sec != attr->ctime ||
+	    inode->i_ctime.tv_nsec != attr->ctimensec ||
+	    (fi->orig_i_mode ^ attr->mode) & 07777)
+		forget_all_cached_acls(inode);
+}
+
 void fuse_change_attributes(struct inode *inode, struct fuse_attr *attr,
 			    u64 attr_valid, u64 attr_version)
 {
@@ -705,6 +725,7 @@ void fuse_conn_init(struct fuse_conn *fc, struct user_namespace *user_ns,
 	INIT_LIST_HEAD(&fc->bg_queue);
 	INIT_LIST_HEAD(&fc->entry);
 	INIT_LIST_HEAD(&fc->devices);
+	idr_init(&fc->passthrough_req);
 	atomic_set(&fc->num_waiting, 0);
 	fc->max_background = FUSE_DEFAULT_MAX_BACKGROUND;
 	fc->congestion_threshold = FUSE_DEFAULT_CONGESTION_THRESHOLD;
@@ -731,6 +752,9 @@ void fuse_conn_put(struct fuse_conn *fc)
 		if (IS_ENABLED(CONFIG_FUSE_DAX))
 			fuse_dax_conn_free(fc);
 
+		fuse_passthrough_free_reqs(fc);
+		fuse_uring_free(fc);
+
 		if (fc->destroy_req)
 			fuse_request_free(fc->destroy_req);
 
@@ -1033,6 +1057,15 @@ static void process_init_reply(struct fuse_conn *fc, struct fuse_req *req)
 				fc->cache_symlinks = 1;
 			if (arg->flags & FUSE_ABORT_ERROR)
 				fc->abort_err = 1;
+			if (arg->flags & FUSE_PASSTHROUGH) {
+				fc->passthrough = 1;
+				/*
+				 * The backing files may be stacked already,
+				 * don't let anything stack on top of this.
+				 */
+				fc->sb->s_stack_depth =
+					FILESYSTEM_MAX_STACK_DEPTH;
+			}
 			if (arg->flags & FUSE_MAX_PAGES) {
 				fc->max_pages =
 					min_t(unsigned int, fc->max_pages_limit,
@@ -1083,7 +1116,8 @@ void fuse_send_init(struct fuse_conn *fc, struct fuse_req *req)
 		FUSE_DO_READDIRPLUS | FUSE_READDIRPLUS_AUTO | FUSE_ASYNC_DIO |
 		FUSE_WRITEBACK_CACHE | FUSE_NO_OPEN_SUPPORT |
 		FUSE_PARALLEL_DIROPS | FUSE_HANDLE_KILLPRIV | FUSE_POSIX_ACL |
-		FUSE_ABORT_ERROR | FUSE_MAX_PAGES | FUSE_CACHE_SYMLINKS;
+		FUSE_ABORT_ERROR | FUSE_MAX_PAGES | FUSE_CACHE_SYMLINKS |
+		FUSE_PASSTHROUGH;
 #ifdef CONFIG_FUSE_DAX
 	if (fc->dax)
 		arg->flags |= FUSE_MAP_ALIGNMENT;
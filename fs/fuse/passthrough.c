@@ -0,0 +1,230 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * FUSE passthrough: read, write and mmap of a FOPEN_PASSTHROUGH file go
+ * straight to a backing file the daemon registered, without a round trip
+ * through userspace.
+ */
+
+#include "fuse_i.h"
+
+#include <linux/file.h>
+#include <linux/fs_stack.h>
+#include <linux/uio.h>
+
+static rwf_t fuse_iocb_to_rwf(struct kiocb *iocb)
+{
+	int ifl = iocb->ki_flags;
+	rwf_t flags = 0;
+
+	if (ifl & IOCB_NOWAIT)
+		flags |= RWF_NOWAIT;
+	if (ifl & IOCB_HIPRI)
+		flags |= RWF_HIPRI;
+	if (ifl & IOCB_DSYNC)
+		flags |= RWF_DSYNC;
+	if (ifl & IOCB_SYNC)
+		flags |= RWF_SYNC;
+	if (ifl & IOCB_APPEND)
+		flags |= RWF_APPEND;
+
+	return flags;
+}
+
+/* Size and times of the fuse inode follow the backing one */
+static void fuse_copyattr(struct file *dst_file, struct file *src_file)
+{
+	struct inode *dst = file_inode(dst_file);
+	struct inode *src = file_inode(src_file);
+
+	dst->i_atime = src->i_atime;
+	dst->i_mtime = src->i_mtime;
+	dst->i_ctime = src->i_ctime;
+	i_size_write(dst, i_size_read(src));
+}
+
+ssize_t fuse_passthrough_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct file *fuse_filp = iocb->ki_filp;
+	struct fuse_file *ff = fuse_filp->private_data;
+	struct file *passthrough_filp = ff->passthrough.filp;
+	const struct cred *old_cred;
+	ssize_t ret;
+
+	if (!iov_iter_count(to))
+		return 0;
+
+	old_cred = override_creds(ff->passthrough.cred);
+	ret = vfs_iter_read(passthrough_filp, to, &iocb->ki_pos,
+			    fuse_iocb_to_rwf(iocb));
+	revert_creds(old_cred);
+
+	if (ret >= 0)
+		fsstack_copy_attr_atime(file_inode(fuse_filp),
+					file_inode(passthrough_filp));
+	return ret;
+}
+
+ssize_t fuse_passthrough_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct file *fuse_filp = iocb->ki_filp;
+	struct fuse_file *ff = fuse_filp->private_data;
+	struct inode *fuse_inode = file_inode(fuse_filp);
+	struct file *passthrough_filp = ff->passthrough.filp;
+	const struct cred *old_cred;
+	ssize_t ret;
+
+	if (!iov_iter_count(from))
+		return 0;
+
+	inode_lock(fuse_inode);
+	old_cred = override_creds(ff->passthrough.cred);
+	file_start_write(passthrough_filp);
+	ret = vfs_iter_write(passthrough_filp, from, &iocb->ki_pos,
+			     fuse_iocb_to_rwf(iocb));
+	file_end_write(passthrough_filp);
+	if (ret > 0)
+		fuse_copyattr(fuse_filp, passthrough_filp);
+	revert_creds(old_cred);
+	inode_unlock(fuse_inode);
+
+	return ret;
+}
+
+int fuse_passthrough_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct fuse_file *ff = file->private_data;
+	struct file *passthrough_filp = ff->passthrough.filp;
+	const struct cred *old_cred;
+	int ret;
+
+	if (!passthrough_filp->f_op->mmap)
+		return -ENODEV;
+
+	if (WARN_ON(file != vma->vm_file))
+		return -EIO;
+
+	vma->vm_file = get_file(passthrough_filp);
+
+	old_cred = override_creds(ff->passthrough.cred);
+	ret = call_mmap(vma->vm_file, vma);
+	revert_creds(old_cred);
+
+	if (ret) {
+		/* Drop reference count from new vm_file value */
+		fput(passthrough_filp);
+	} else {
+		/* Drop reference count from previous vm_file value */
+		fput(file);
+	}
+
+	fsstack_copy_attr_atime(file_inode(file), file_inode(passthrough_filp));
+	return ret;
+}
+
+/*
+ * FUSE_DEV_IOC_PASSTHROUGH_OPEN: register @fd as a backing file, returns
+ * the id the daemon replies to an open with.
+ */
+int fuse_passthrough_open(struct fuse_dev *fud, u32 fd)
+{
+	struct fuse_conn *fc = fud->fc;
+	struct fuse_passthrough *passthrough;
+	struct file *passthrough_filp;
+	struct super_block *sb;
+	int res;
+
+	if (!fc->passthrough)
+		return -EPERM;
+
+	passthrough_filp = fget(fd);
+	if (!passthrough_filp)
+		return -EBADF;
+
+	res = -EINVAL;
+	if (!passthrough_filp->f_op->read_iter ||
+	    !passthrough_filp->f_op->write_iter)
+		goto out_fput;
+
+	/* Nothing stacks on a passthrough fuse, see process_init_reply() */
+	sb = file_inode(passthrough_filp)->i_sb;
+	if (sb->s_stack_depth >= FILESYSTEM_MAX_STACK_DEPTH)
+		goto out_fput;
+
+	res = -ENOMEM;
+	passthrough = kmalloc(sizeof(*passthrough), GFP_KERNEL);
+	if (!passthrough)
+		goto out_fput;
+
+	passthrough->filp = passthrough_filp;
+	passthrough->cred = get_cred(current_cred());
+
+	idr_preload(GFP_KERNEL);
+	spin_lock(&fc->lock);
+	res = idr_alloc(&fc->passthrough_req, passthrough, 1, 0, GFP_ATOMIC);
+	spin_unlock(&fc->lock);
+	idr_preload_end();
+
+	if (res > 0)
+		return res;
+
+	fuse_passthrough_release(passthrough);
+	kfree(passthrough);
+	return res;
+
+out_fput:
+	fput(passthrough_filp);
+	return res;
+}
+
+/* Take over the backing file named in the open reply */
+int fuse_passthrough_setup(struct fuse_conn *fc, struct fuse_file *ff,
+			   struct fuse_open_out *openarg)
+{
+	struct fuse_passthrough *passthrough;
+	int passthrough_fh = openarg->passthrough_fh;
+
+	if (!fc->passthrough)
+		return -EPERM;
+
+	if (passthrough_fh <= 0)
+		return -EINVAL;
+
+	spin_lock(&fc->lock);
+	passthrough = idr_remove(&fc->passthrough_req, passthrough_fh);
+	spin_unlock(&fc->lock);
+
+	if (!passthrough)
+		return -EINVAL;
+
+	ff->passthrough = *passthrough;
+	kfree(passthrough);
+	return 0;
+}
+
+void fuse_passthrough_release(struct fuse_passthrough *passthrough)
+{
+	if (passthrough->filp) {
+		fput(passthrough->filp);
+		passthrough->filp = NULL;
+	}
+	if (passthrough->cred) {
+		put_cred(passthrough->cred);
+		passthrough->cred = NULL;
+	}
+}
+
+static int fuse_passthrough_free_req(int id, void *p, void *data)
+{
+	struct fuse_passthrough *passthrough = p;
+
+	fuse_passthrough_release(passthrough);
+	kfree(passthrough);
+	return 0;
+}
+
+/* Drop the backing files which were registered but never opened */
+void fuse_passthrough_free_reqs(struct fuse_conn *fc)
+{
+	idr_for_each(&fc->passthrough_req, fuse_passthrough_free_req, NULL);
+	idr_destroy(&fc->passthrough_req);
+}
@@ -10,6 +10,7 @@
 #include <linux/pfn_t.h>
 #include <linux/module.h>
 #include <linux/virtio.h>
+#include <linux/virtio_config.h>
 #include <linux/virtio_fs.h>
 #include <linux/delay.h>
 #include <linux/highmem.h>
@@ -75,6 +76,7 @@ struct virtio_fs {
 	struct virtio_fs_vq *vqs;
 	unsigned int nvqs;               /* number of virtqueues */
 	unsigned int num_request_queues; /* number of request queues */
+	unsigned int *mq_map;            /* request queue used by each CPU */
 	struct dax_device *dax_dev;
 
 	/* DAX memory window where file contents are mapped */
@@ -129,6 +131,7 @@ static void release_virtio_fs_obj(struct kref *ref)
 	struct virtio_fs *vfs = container_of(ref, struct virtio_fs, refcount);
 
 	kfree(vfs->vqs);
+	kfree(vfs->mq_map);
 	kfree(vfs);
 }
 
@@ -605,10 +608,39 @@ static void virtio_fs_init_vq(struct virtio_fs_vq *fsvq, char *name,
 	}
 }
 
+/*
+ * Pick a request queue for each CPU: in contiguous blocks of CPU ids, so
+ * that a queue tends to stay within a node, then by the interrupt
+ * affinity of the queues where the transport spread them.
+ */
+static void virtio_fs_map_queues(struct virtio_device *vdev,
+				 struct virtio_fs *fs)
+{
+	const struct cpumask *mask;
+	unsigned int q, cpu, nr = 0;
+
+	for_each_possible_cpu(cpu)
+		fs->mq_map[cpu] = VQ_REQUEST +
+			nr++ * fs->num_request_queues / num_possible_cpus();
+
+	if (!vdev->config->get_vq_affinity)
+		return;
+
+	for (q = 0; q < fs->num_request_queues; q++) {
+		mask = vdev->config->get_vq_affinity(vdev, VQ_REQUEST + q);
+		if (!mask)
+			return;
+
+		for_each_cpu(cpu, mask)
+			fs->mq_map[cpu] = VQ_REQUEST + q;
+	}
+}
+
 /* Initialize virtqueues */
 static int virtio_fs_setup_vqs(struct virtio_device *vdev,
 			       struct virtio_fs *fs)
 {
+	struct irq_affinity desc = { .pre_vectors = VQ_REQUEST };
 	struct virtqueue **vqs;
 	vq_callback_t **callbacks;
 	const char **names;
@@ -620,11 +652,20 @@ static int virtio_fs_setup_vqs(struct virtio_device *vdev,
 	if (fs->num_request_queues == 0)
 		return -EINVAL;
 
+	/* Queues beyond one per CPU would never be used */
+	fs->num_request_queues = min_t(unsigned int, fs->num_request_queues,
+				       num_possible_cpus());
 	fs->nvqs = VQ_REQUEST + fs->num_request_queues;
 	fs->vqs = kcalloc(fs->nvqs, sizeof(fs->vqs[VQ_HIPRIO]), GFP_KERNEL);
 	if (!fs->vqs)
 		return -ENOMEM;
 
+	fs->mq_map = kcalloc(nr_cpu_ids, sizeof(*fs->mq_map), GFP_KERNEL);
+	if (!fs->mq_map) {
+		kfree(fs->vqs);
+		return -ENOMEM;
+	}
+
 	vqs = kmalloc_array(fs->nvqs, sizeof(vqs[VQ_HIPRIO]), GFP_KERNEL);
 	callbacks = kmalloc_array(fs->nvqs, sizeof(callbacks[VQ_HIPRIO]),
 					GFP_KERNEL);
@@ -649,20 +690,23 @@ static int virtio_fs_setup_vqs(struct virtio_device *vdev,
 		names[i] = fs->vqs[i].name;
 	}
 
-	ret = virtio_find_vqs(vdev, fs->nvqs, vqs, callbacks, names, NULL);
+	ret = virtio_find_vqs(vdev, fs->nvqs, vqs, callbacks, names, &desc);
 	if (ret < 0)
 		goto out;
 
 	for (i = 0; i < fs->nvqs; i++)
 		fs->vqs[i].vq = vqs[i];
 
+	virtio_fs_map_queues(vdev, fs);
 	virtio_fs_start_all_queues(fs);
 out:
 	kfree(names);
 	kfree(callbacks);
 	kfree(vqs);
-	if (ret)
+	if (ret) {
 		kfree(fs->vqs);
+		kfree(fs->mq_map);
+	}
 	return ret;
 }
 
@@ -867,8 +911,6 @@ static int virtio_fs_probe(struct virtio_device *vdev)
 	if (ret < 0)
 		goto out;
 
-	/* TODO vq affinity */
-
 	ret = virtio_fs_setup_dax(vdev, fs);
 	if (ret < 0)
 		goto out_vqs;
@@ -1186,28 +1228,23 @@ static int virtio_fs_enqueue_req(struct virtio_fs_vq *fsvq,
 	return ret;
 }
 
-static void virtio_fs_wake_pending_and_unlock(struct fuse_iqueue *fiq)
-__releases(fiq->lock)
+/* Submit on the request queue of the current CPU, fiq->lock is not held */
+static void virtio_fs_send_req(struct fuse_iqueue *fiq, struct fuse_req *req)
 {
-	unsigned int queue_id = VQ_REQUEST; /* TODO multiqueue */
-	struct virtio_fs *fs;
-	struct fuse_req *req;
+	struct virtio_fs *fs = fiq->priv;
+	unsigned int queue_id;
 	struct virtio_fs_vq *fsvq;
 	int ret;
 
-	WARN_ON(list_empty(&fiq->pending));
-	req = list_last_entry(&fiq->pending, struct fuse_req, list);
+	/* Never on fiq->pending, nothing to take it off there */
 	clear_bit(FR_PENDING, &req->flags);
-	list_del_init(&req->list);
-	WARN_ON(!list_empty(&fiq->pending));
-	spin_unlock(&fiq->lock);
 
-	fs = fiq->priv;
+	queue_id = fs->mq_map[raw_smp_processor_id()];
 
-	pr_debug("%s: opcode %u unique %#llx nodeid %#llx in.len %u out.len %u\n",
+	pr_debug("%s: opcode %u unique %#llx nodeid %#llx in.len %u out.len %u queue %u\n",
 		  __func__, req->in.h.opcode, req->in.h.unique,
 		 req->in.h.nodeid, req->in.h.len,
-		 fuse_len_args(req->out.numargs, req->out.args));
+		 fuse_len_args(req->out.numargs, req->out.args), queue_id);
 
 	fsvq = &fs->vqs[queue_id];
 	ret = virtio_fs_enqueue_req(fsvq, req, false);
@@ -1237,10 +1274,25 @@ __releases(fiq->lock)
 	}
 }
 
+static void virtio_fs_wake_pending_and_unlock(struct fuse_iqueue *fiq)
+__releases(fiq->lock)
+{
+	struct fuse_req *req;
+
+	WARN_ON(list_empty(&fiq->pending));
+	req = list_last_entry(&fiq->pending, struct fuse_req, list);
+	list_del_init(&req->list);
+	WARN_ON(!list_empty(&fiq->pending));
+	spin_unlock(&fiq->lock);
+
+	virtio_fs_send_req(fiq, req);
+}
+
 static const struct fuse_iqueue_ops virtio_fs_fiq_ops = {
 	.wake_forget_and_unlock		= virtio_fs_wake_forget_and_unlock,
 	.wake_interrupt_and_unlock	= virtio_fs_wake_interrupt_and_unlock,
 	.wake_pending_and_unlock	= virtio_fs_wake_pending_and_unlock,
+	.send_req			= virtio_fs_send_req,
 	.release			= virtio_fs_fiq_release,
 };
 
@@ -1298,10 +1350,13 @@ static int virtio_fs_fill_super(struct super_block *sb, void *data,
 	}
 
 	err = -ENOMEM;
-	/* Allocate fuse_dev for hiprio and notification queues */
-	for (i = 0; i < VQ_REQUEST; i++) {
+	/* Allocate fuse_dev for all but the first request queue */
+	for (i = 0; i < fs->nvqs; i++) {
 		struct virtio_fs_vq *fsvq = &fs->vqs[i];
 
+		if (i == VQ_REQUEST)
+			continue; /* allocated by fuse_fill_super_common() */
+
 		fsvq->fud = fuse_dev_alloc();
 		if (!fsvq->fud)
 			goto err_free_fuse_devs;
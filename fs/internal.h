@@ -88,6 +88,7 @@ extern void __init mnt_init(void);
 
 extern int __mnt_want_write_file(struct file *);
 extern void __mnt_drop_write_file(struct file *);
+extern void dissolve_on_fput(struct vfsmount *);
 
 /*
  * fs_struct.c
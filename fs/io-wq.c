@@ -117,6 +117,8 @@ struct io_wq {
 
 	struct task_struct *manager;
 	struct user_struct *user;
+	/* RLIMIT_NPROC at creation, caps unbound workers across the user */
+	unsigned long nproc;
 	refcount_t refs;
 	struct completion done;
 
@@ -663,6 +665,9 @@ static bool create_io_worker(struct io_wq *wq, struct io_wqe *wqe, int index)
 		kfree(worker);
 		return false;
 	}
+	/* keep punted work on the node it was queued from */
+	if (wqe->node != NUMA_NO_NODE)
+		set_cpus_allowed_ptr(worker->task, cpumask_of_node(wqe->node));
 
 	spin_lock_irq(&wqe->lock);
 	hlist_nulls_add_head_rcu(&worker->nulls_node, &wqe->free_list);
@@ -771,7 +776,7 @@ static bool io_wq_can_queue(struct io_wqe *wqe, struct io_wqe_acct *acct,
 	if (free_worker)
 		return true;
 
-	if (atomic_read(&wqe->wq->user->processes) >= acct->max_workers &&
+	if (atomic_read(&wqe->wq->user->processes) >= wqe->wq->nproc &&
 	    !(capable(CAP_SYS_RESOURCE) || capable(CAP_SYS_ADMIN)))
 		return false;
 
@@ -1045,6 +1050,7 @@ struct io_wq *io_wq_create(unsigned bounded, struct io_wq_data *data)
 
 	/* caller must already hold a reference to this */
 	wq->user = data->user;
+	wq->nproc = task_rlimit(current, RLIMIT_NPROC);
 
 	for_each_node(node) {
 		struct io_wqe *wqe;
@@ -1096,6 +1102,40 @@ struct io_wq *io_wq_create(unsigned bounded, struct io_wq_data *data)
 	return ERR_PTR(ret);
 }
 
+/*
+ * Set the max number of bounded and unbounded workers, per node. A zero
+ * count leaves that limit alone. The previous limits are returned in
+ * @new_count.
+ */
+int io_wq_max_workers(struct io_wq *wq, unsigned *new_count)
+{
+	unsigned prev[2] = { 0, 0 };
+	int i, node;
+
+	for (i = 0; i < 2; i++) {
+		if (new_count[i] > task_rlimit(current, RLIMIT_NPROC))
+			new_count[i] = task_rlimit(current, RLIMIT_NPROC);
+	}
+
+	for_each_node(node) {
+		struct io_wqe *wqe = wq->wqes[node];
+
+		spin_lock_irq(&wqe->lock);
+		for (i = 0; i < 2; i++) {
+			struct io_wqe_acct *acct = &wqe->acct[i];
+
+			prev[i] = max(prev[i], acct->max_workers);
+			if (new_count[i])
+				acct->max_workers = new_count[i];
+		}
+		spin_unlock_irq(&wqe->lock);
+	}
+
+	for (i = 0; i < 2; i++)
+		new_count[i] = prev[i];
+	return 0;
+}
+
 bool io_wq_get(struct io_wq *wq, struct io_wq_data *data)
 {
 	if (data->free_work != wq->free_work || data->do_work != wq->do_work)
@@ -79,8 +79,10 @@
 #include <linux/fs_struct.h>
 #include <linux/splice.h>
 #include <linux/task_work.h>
+#include <linux/futex.h>
 #include <linux/pagemap.h>
 #include <linux/cgroup.h>
+#include <linux/io_uring.h>
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/io_uring.h>
@@ -227,6 +229,21 @@ struct io_buffer {
 	__u16 bid;
 };
 
+/*
+ * Provided buffer ring, registered through IORING_REGISTER_PBUF_RING. The
+ * ring memory is allocated by the kernel and mapped by the application, so
+ * it must stay around until the ctx goes away even if the group is
+ * unregistered earlier. Dead rings are parked on ->io_buf_ring_dead.
+ */
+struct io_buffer_ring {
+	struct list_head		list;
+	struct io_uring_buf_ring	*br;
+	size_t				size;
+	__u16				bgid;
+	__u16				head;
+	__u16				mask;
+};
+
 struct io_ring_ctx {
 	struct {
 		struct percpu_ref	refs;
@@ -282,7 +299,8 @@ struct io_ring_ctx {
 	wait_queue_head_t	*sqo_wait;
 	wait_queue_head_t	__sqo_wait;
 
-	/* Used for percpu io sq thread */
+	/* Used for shared io sq thread */
+	struct io_sq_data	*sq_data;
 	int			sq_thread_cpu;
 	struct list_head	sqd_list;
 
@@ -315,6 +333,13 @@ struct io_ring_ctx {
 #endif
 
 	struct idr		io_buffer_idr;
+	struct idr		io_buf_ring_idr;
+	struct list_head	io_buf_ring_dead;
+
+	/* armed futex waits, protected by ->completion_lock */
+	struct hlist_head	futex_list;
+	/* commands owned by a driver, protected by ->completion_lock */
+	struct list_head	uring_cmd_list;
 
 	struct idr		personality_idr;
 
@@ -322,6 +347,8 @@ struct io_ring_ctx {
 		unsigned		cached_cq_tail;
 		unsigned		cq_entries;
 		unsigned		cq_mask;
+		/* CQEs posted without consuming an SQE (multishot) */
+		unsigned		cq_extra;
 		atomic_t		cq_timeouts;
 		unsigned long		cq_check_overflow;
 		struct wait_queue_head	cq_wait;
@@ -355,7 +382,14 @@ struct io_ring_ctx {
 	struct work_struct		exit_work;
 };
 
-struct sq_thread_percpu {
+/*
+ * A SQPOLL thread, shared by every ring attached to it. The percpu ones are
+ * static and live as long as some ring uses them, the rest are allocated on
+ * ring creation and refcounted by their rings (IORING_SETUP_ATTACH_WQ).
+ */
+struct io_sq_data {
+	refcount_t refs;
+	bool percpu;
 	struct list_head ctx_list;
 	wait_queue_head_t sqo_wait;
 	struct mutex lock;
@@ -365,7 +399,22 @@ struct sq_thread_percpu {
 	bool idle_mode_us;
 };
 
-static struct sq_thread_percpu __percpu *percpu_threads;
+static struct io_sq_data __percpu *percpu_threads;
+
+/* cap per-ring submissions per pass when several rings share a thread */
+#define IORING_SQPOLL_CAP_ENTRIES_VALUE	8
+
+#define IO_RINGFD_REG_MAX	16
+
+struct io_ringfd_reg {
+	struct file	*file;
+	int		fd;
+};
+
+struct io_uring_task {
+	/* rings registered with IORING_REGISTER_RING_FDS */
+	struct io_ringfd_reg	registered_rings[IO_RINGFD_REG_MAX];
+};
 
 /*
  * First field must be the file pointer in all the
@@ -447,7 +496,49 @@ struct io_sr_msg {
 	int				msg_flags;
 	int				bgid;
 	size_t				len;
-	struct io_buffer		*kbuf;
+	union {
+		struct io_buffer	*kbuf;
+		/* buffer picked from a provided buffer ring */
+		struct {
+			u64		addr;
+			u16		bid;
+		} rbuf;
+	};
+};
+
+struct io_sendzc {
+	struct file			*file;
+	void __user			*buf;
+	size_t				len;
+	unsigned			msg_flags;
+	unsigned			flags;
+	/* buffer release notification, a separate request */
+	struct io_kiocb			*notif;
+};
+
+/*
+ * A SEND_ZC notification is a bare io_kiocb carrying the ubuf_info handed
+ * to the network stack through msghdr->msg_ubuf. Every skb referencing
+ * the user pages holds a uarg reference, when the last one is dropped the
+ * notification CQE is posted.
+ */
+struct io_notif_data {
+	struct file			*file;
+	struct ubuf_info		uarg;
+	bool				report_usage;
+};
+
+struct io_futex {
+	struct file			*file;
+	union {
+		u32 __user			*uaddr;
+		struct futex_waitv __user	*uwaitv;
+	};
+	unsigned long			futex_val;
+	unsigned long			futex_mask;
+	u32				futex_flags;
+	unsigned int			futex_nr;
+	struct io_futex_data		*ifd;
 };
 
 struct io_open {
@@ -577,6 +668,9 @@ enum {
 	REQ_F_QUEUE_TIMEOUT_BIT,
 	REQ_F_WORK_INITIALIZED_BIT,
 	REQ_F_TASK_PINNED_BIT,
+	REQ_F_APOLL_MULTISHOT_BIT,
+	REQ_F_BUFFER_RING_BIT,
+	REQ_F_CMD_CANCELING_BIT,
 
 	/* not a real bit, just to check we're not overflowing the space */
 	__REQ_F_LAST_BIT,
@@ -632,6 +726,12 @@ enum {
 	REQ_F_WORK_INITIALIZED	= BIT(REQ_F_WORK_INITIALIZED_BIT),
 	/* req->task is refcounted */
 	REQ_F_TASK_PINNED	= BIT(REQ_F_TASK_PINNED_BIT),
+	/* keep armed and post CQEs with IORING_CQE_F_MORE */
+	REQ_F_APOLL_MULTISHOT	= BIT(REQ_F_APOLL_MULTISHOT_BIT),
+	/* selected buffer came from a provided buffer ring */
+	REQ_F_BUFFER_RING	= BIT(REQ_F_BUFFER_RING_BIT),
+	/* driver was asked to cancel the uring_cmd */
+	REQ_F_CMD_CANCELING	= BIT(REQ_F_CMD_CANCELING_BIT),
 };
 
 struct async_poll {
@@ -667,6 +767,10 @@ struct io_kiocb {
 		struct io_provide_buf	pbuf;
 		struct io_statx		statx;
 		struct io_ioctl         ioctl;
+		struct io_sendzc	sendzc;
+		struct io_notif_data	notif;
+		struct io_futex		futex;
+		struct io_uring_cmd	uring_cmd;
 	};
 
 	struct io_async_ctx		*io;
@@ -914,6 +1018,26 @@ static const struct io_op_def io_op_defs[] = {
 		.needs_mm = 1,
 		.file_table = 1,
 	},
+	[IORING_OP_SEND_ZC] = {
+		.needs_mm		= 1,
+		.needs_file		= 1,
+		.unbound_nonreg_file	= 1,
+		.pollout		= 1,
+	},
+	[IORING_OP_FUTEX_WAIT] = {
+		.needs_mm		= 1,
+	},
+	[IORING_OP_FUTEX_WAKE] = {
+		.needs_mm		= 1,
+	},
+	[IORING_OP_FUTEX_WAITV] = {
+		.needs_mm		= 1,
+	},
+	[IORING_OP_URING_CMD] = {
+		.needs_mm		= 1,
+		.needs_file		= 1,
+		.unbound_nonreg_file	= 1,
+	},
 };
 
 static void io_cqring_fill_event(struct io_kiocb *req, long res);
@@ -939,6 +1063,8 @@ static ssize_t io_import_iovec(int rw, struct io_kiocb *req,
 static int io_setup_async_rw(struct io_kiocb *req, const struct iovec *iovec,
 			     const struct iovec *fast_iov,
 			     struct iov_iter *iter, bool force);
+static int io_req_task_work_add(struct io_kiocb *req, struct callback_head *cb,
+				bool twa_signal_ok);
 
 static struct kmem_cache *req_cachep;
 
@@ -1040,6 +1166,10 @@ static struct io_ring_ctx *io_ring_ctx_alloc(struct io_uring_params *p)
 	init_completion(&ctx->ref_comp);
 	init_completion(&ctx->sq_thread_comp);
 	idr_init(&ctx->io_buffer_idr);
+	idr_init(&ctx->io_buf_ring_idr);
+	INIT_LIST_HEAD(&ctx->io_buf_ring_dead);
+	INIT_HLIST_HEAD(&ctx->futex_list);
+	INIT_LIST_HEAD(&ctx->uring_cmd_list);
 	idr_init(&ctx->personality_idr);
 	mutex_init(&ctx->uring_lock);
 	init_waitqueue_head(&ctx->wait);
@@ -1063,7 +1193,7 @@ static inline bool __req_need_defer(struct io_kiocb *req)
 {
 	struct io_ring_ctx *ctx = req->ctx;
 
-	return req->sequence != ctx->cached_cq_tail
+	return req->sequence != ctx->cached_cq_tail - ctx->cq_extra
 				+ atomic_read(&ctx->cached_cq_overflow);
 }
 
@@ -1408,6 +1538,36 @@ static void io_cqring_add_event(struct io_kiocb *req, long res, long cflags)
 	io_cqring_ev_posted(ctx);
 }
 
+/*
+ * Post an intermediate CQE for a multishot request, flagged with
+ * IORING_CQE_F_MORE. Returns false if the CQ ring has no room, in which case
+ * nothing is posted and the caller must terminate the request instead: the
+ * overflow list can only hold a request once.
+ */
+static bool io_cqring_post_more(struct io_kiocb *req, long res, unsigned cflags)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	struct io_uring_cqe *cqe = NULL;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ctx->completion_lock, flags);
+	if (list_empty(&ctx->cq_overflow_list))
+		cqe = io_get_cqring(ctx);
+	if (cqe) {
+		trace_io_uring_complete(ctx, req->user_data, res);
+		WRITE_ONCE(cqe->user_data, req->user_data);
+		WRITE_ONCE(cqe->res, res);
+		WRITE_ONCE(cqe->flags, cflags | IORING_CQE_F_MORE);
+		ctx->cq_extra++;
+		io_commit_cqring(ctx);
+	}
+	spin_unlock_irqrestore(&ctx->completion_lock, flags);
+
+	if (cqe)
+		io_cqring_ev_posted(ctx);
+	return cqe != NULL;
+}
+
 static void __io_req_complete(struct io_kiocb *req, long res, unsigned cflags)
 {
 	io_cqring_add_event(req, res, cflags);
@@ -1902,6 +2062,8 @@ static int io_do_iopoll(struct io_ring_ctx *ctx, unsigned int *nr_events,
 			long min)
 {
 	struct io_kiocb *req, *tmp;
+	struct file *last_file = NULL;
+	unsigned int last_queue = 0;
 	LIST_HEAD(done);
 	bool spin;
 	int ret;
@@ -1915,22 +2077,35 @@ static int io_do_iopoll(struct io_ring_ctx *ctx, unsigned int *nr_events,
 	ret = 0;
 	list_for_each_entry_safe(req, tmp, &ctx->poll_list, list) {
 		struct kiocb *kiocb = &req->rw.kiocb;
+		unsigned int queue;
 
 		/*
-		 * Move completed and retryable entries to our local lists.
-		 * If we find a request that requires polling, break out
-		 * and complete those lists first, if we have entries there.
+		 * Move completed and retryable entries to our local list, they
+		 * are all completed in one batch at the end.
 		 */
 		if (READ_ONCE(req->iopoll_completed)) {
 			list_move_tail(&req->list, &done);
 			continue;
 		}
-		if (!list_empty(&done))
-			break;
+
+		/*
+		 * A poll call reaps the whole hw queue. If it didn't complete
+		 * this request, polling again for it right away won't either,
+		 * move on to requests of other queues.
+		 */
+		queue = blk_qc_t_to_queue_num(READ_ONCE(kiocb->ki_cookie));
+		if (kiocb->ki_filp == last_file && queue == last_queue)
+			continue;
 
 		ret = kiocb->ki_filp->f_op->iopoll(kiocb, spin);
 		if (ret < 0)
 			break;
+		last_file = kiocb->ki_filp;
+		last_queue = queue;
+
+		/* iopoll may have completed current req */
+		if (READ_ONCE(req->iopoll_completed))
+			list_move_tail(&req->list, &done);
 
 		if (ret && spin)
 			spin = false;
@@ -2421,6 +2596,7 @@ static int io_prep_rw(struct io_kiocb *req, const struct io_uring_sqe *sqe,
 
 	if (force_nonblock)
 		kiocb->ki_flags |= IOCB_NOWAIT;
+	kiocb->ki_flags |= IOCB_ALLOC_CACHE;
 
 	if (ctx->flags & IORING_SETUP_IOPOLL) {
 		if (!(kiocb->ki_flags & IOCB_DIRECT) ||
@@ -2483,15 +2659,14 @@ static void kiocb_done(struct kiocb *kiocb, ssize_t ret)
 		io_rw_done(kiocb, ret);
 }
 
-static ssize_t io_import_fixed(struct io_kiocb *req, int rw,
-			       struct iov_iter *iter)
+static ssize_t __io_import_fixed(struct io_kiocb *req, int rw,
+				 struct iov_iter *iter, u64 buf_addr,
+				 size_t len)
 {
 	struct io_ring_ctx *ctx = req->ctx;
-	size_t len = req->rw.len;
 	struct io_mapped_ubuf *imu;
 	u16 index, buf_index;
 	size_t offset;
-	u64 buf_addr;
 
 	/* attempt to use fixed buffers without having provided iovecs */
 	if (unlikely(!ctx->user_bufs))
@@ -2503,7 +2678,6 @@ static ssize_t io_import_fixed(struct io_kiocb *req, int rw,
 
 	index = array_index_nospec(buf_index, ctx->nr_user_bufs);
 	imu = &ctx->user_bufs[index];
-	buf_addr = req->rw.addr;
 
 	/* overflow */
 	if (buf_addr + len < buf_addr)
@@ -2557,6 +2731,12 @@ static ssize_t io_import_fixed(struct io_kiocb *req, int rw,
 	return len;
 }
 
+static ssize_t io_import_fixed(struct io_kiocb *req, int rw,
+			       struct iov_iter *iter)
+{
+	return __io_import_fixed(req, rw, iter, req->rw.addr, req->rw.len);
+}
+
 static void io_ring_submit_unlock(struct io_ring_ctx *ctx, bool needs_lock)
 {
 	if (needs_lock)
@@ -2598,7 +2778,7 @@ static struct io_buffer *io_buffer_select(struct io_kiocb *req, size_t *len,
 			kbuf = head;
 			idr_remove(&req->ctx->io_buffer_idr, bgid);
 		}
-		if (*len > kbuf->len)
+		if (*len == 0 || *len > kbuf->len)
 			*len = kbuf->len;
 	} else {
 		kbuf = ERR_PTR(-ENOBUFS);
@@ -3173,6 +3353,9 @@ static int io_write(struct io_kiocb *req, bool force_nonblock)
 	iov_count = iov_iter_count(iter);
 	io_size = ret;
 	req->result = io_size;
+	/* what a nonblocking attempt already wrote is part of the result */
+	if (req->io)
+		req->result += req->io->rw.bytes_done;
 
 	/* Ensure we clear previously set non-block flag */
 	if (!force_nonblock)
@@ -3184,6 +3367,7 @@ static int io_write(struct io_kiocb *req, bool force_nonblock)
 
 	/* file path doesn't support NOWAIT for non-direct_IO */
 	if (force_nonblock && !(kiocb->ki_flags & IOCB_DIRECT) &&
+	    !(req->file->f_mode & FMODE_BUF_WASYNC) &&
 	    (req->flags & REQ_F_ISREG))
 		goto copy_iov;
 
@@ -3225,12 +3409,28 @@ static int io_write(struct io_kiocb *req, bool force_nonblock)
 	 */
 	if (ret2 == -EOPNOTSUPP && (kiocb->ki_flags & IOCB_NOWAIT))
 		ret2 = -EAGAIN;
+	/*
+	 * A nonblocking buffered write may stop short where it would have had
+	 * to block, finish the rest from io-wq.
+	 */
+	if (force_nonblock && ret2 > 0 && iov_iter_count(iter) &&
+	    !(kiocb->ki_flags & IOCB_DIRECT) && (req->flags & REQ_F_ISREG)) {
+		kiocb_end_write(req);
+		ret = io_setup_async_rw(req, iovec, inline_vecs, iter, false);
+		if (ret)
+			goto out_free;
+		req->io->rw.bytes_done += ret2;
+		return -EAGAIN;
+	}
 	if (!force_nonblock || ret2 != -EAGAIN) {
 		/* IOPOLL retry should happen for io-wq threads */
 		if ((req->ctx->flags & IORING_SETUP_IOPOLL) && ret2 == -EAGAIN)
 			goto copy_iov;
 		kiocb_done(kiocb, ret2);
 	} else {
+		/* the retry takes freeze protection again */
+		if (req->flags & REQ_F_ISREG)
+			kiocb_end_write(req);
 copy_iov:
 		/* some cases will consume bytes even on error returns */
 		iov_iter_revert(iter, iov_count - iov_iter_count(iter));
@@ -3676,6 +3876,10 @@ static int io_provide_buffers(struct io_kiocb *req, bool force_nonblock)
 
 	lockdep_assert_held(&ctx->uring_lock);
 
+	ret = -EEXIST;
+	if (idr_find(&ctx->io_buf_ring_idr, p->bgid))
+		goto out;
+
 	list = head = idr_find(&ctx->io_buffer_idr, p->bgid);
 
 	ret = io_add_buffers(p, &head);
@@ -4078,6 +4282,7 @@ static int io_send(struct io_kiocb *req, bool force_nonblock)
 		msg.msg_control = NULL;
 		msg.msg_controllen = 0;
 		msg.msg_namelen = 0;
+		msg.msg_ubuf = NULL;
 
 		flags = req->sr_msg.msg_flags;
 		if (flags & MSG_DONTWAIT)
@@ -4099,6 +4304,188 @@ static int io_send(struct io_kiocb *req, bool force_nonblock)
 	return 0;
 }
 
+static void io_notif_complete_tw(struct callback_head *cb)
+{
+	struct io_kiocb *notif = container_of(cb, struct io_kiocb, task_work);
+
+	__io_req_complete(notif, notif->result, IORING_CQE_F_NOTIF);
+}
+
+static void io_tx_ubuf_callback(struct ubuf_info *uarg, bool success)
+{
+	struct io_notif_data *nd = container_of(uarg, struct io_notif_data,
+						uarg);
+	struct io_kiocb *notif = container_of(nd, struct io_kiocb, notif);
+	struct task_struct *tsk;
+
+	if (!success)
+		uarg->zerocopy = 0;
+	if (!refcount_dec_and_test(&uarg->refcnt))
+		return;
+
+	if (nd->report_usage && !uarg->zerocopy)
+		notif->result = IORING_NOTIF_USAGE_ZC_COPIED;
+
+	/* skbs may be freed from softirq context, post from the task */
+	init_task_work(&notif->task_work, io_notif_complete_tw);
+	if (unlikely(io_req_task_work_add(notif, &notif->task_work, true))) {
+		tsk = io_wq_get_task(notif->ctx->io_wq);
+		task_work_add(tsk, &notif->task_work, TWA_NONE);
+		wake_up_process(tsk);
+	}
+}
+
+static struct io_kiocb *io_alloc_notif(struct io_kiocb *req)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	struct io_kiocb *notif;
+	struct ubuf_info *uarg;
+
+	notif = kmem_cache_alloc(req_cachep, GFP_KERNEL | __GFP_NOWARN);
+	if (unlikely(!notif))
+		return NULL;
+
+	notif->opcode = IORING_OP_NOP;
+	notif->user_data = req->user_data;
+	notif->io = NULL;
+	notif->file = NULL;
+	notif->ctx = ctx;
+	notif->flags = 0;
+	refcount_set(&notif->refs, 1);
+	notif->task = req->task;
+	notif->result = 0;
+	INIT_LIST_HEAD(&notif->link_list);
+	io_get_req_task(notif);
+	percpu_ref_get(&ctx->refs);
+
+	notif->notif.report_usage = req->sendzc.flags &
+					IORING_SEND_ZC_REPORT_USAGE;
+	uarg = &notif->notif.uarg;
+	uarg->callback = io_tx_ubuf_callback;
+	uarg->id = 0;
+	uarg->len = 0;
+	uarg->bytelen = 0;
+	uarg->zerocopy = 1;
+	refcount_set(&uarg->refcnt, 1);
+	uarg->mmp.user = NULL;
+	uarg->mmp.num_pg = 0;
+	return notif;
+}
+
+static int io_sendzc_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe)
+{
+	struct io_sendzc *zc = &req->sendzc;
+	struct io_ring_ctx *ctx = req->ctx;
+
+	if (unlikely(ctx->flags & IORING_SETUP_IOPOLL))
+		return -EINVAL;
+	if (READ_ONCE(sqe->off))
+		return -EINVAL;
+
+	zc->flags = READ_ONCE(sqe->ioprio);
+	if (zc->flags & ~(IORING_RECVSEND_FIXED_BUF |
+			  IORING_SEND_ZC_REPORT_USAGE))
+		return -EINVAL;
+	if (zc->flags & IORING_RECVSEND_FIXED_BUF) {
+		req->buf_index = READ_ONCE(sqe->buf_index);
+		if (unlikely(req->buf_index >= ctx->nr_user_bufs))
+			return -EFAULT;
+	}
+
+	zc->buf = u64_to_user_ptr(READ_ONCE(sqe->addr));
+	zc->len = READ_ONCE(sqe->len);
+	zc->msg_flags = READ_ONCE(sqe->msg_flags) | MSG_ZEROCOPY;
+	zc->notif = NULL;
+
+#ifdef CONFIG_COMPAT
+	if (ctx->compat)
+		zc->msg_flags |= MSG_CMSG_COMPAT;
+#endif
+	return 0;
+}
+
+/*
+ * Zero copy send. The user pages, or the pages backing a registered buffer,
+ * are attached to skb frags without copying. Two CQEs are posted on
+ * success: the send result flagged with IORING_CQE_F_MORE, and later a
+ * IORING_CQE_F_NOTIF one once the network stack has released the pages and
+ * the buffer may be reused. Errors before anything was queued complete with
+ * a single CQE without IORING_CQE_F_MORE.
+ */
+static int io_sendzc(struct io_kiocb *req, bool force_nonblock)
+{
+	struct io_sendzc *zc = &req->sendzc;
+	struct io_kiocb *notif;
+	struct socket *sock;
+	struct msghdr msg;
+	struct iovec iov;
+	unsigned flags;
+	int ret;
+
+	sock = sock_from_file(req->file, &ret);
+	if (unlikely(!sock))
+		goto out;
+	ret = -EOPNOTSUPP;
+	if (sock->type != SOCK_STREAM || sock->sk->sk_protocol != IPPROTO_TCP)
+		goto out;
+
+	if (zc->flags & IORING_RECVSEND_FIXED_BUF) {
+		ret = __io_import_fixed(req, WRITE, &msg.msg_iter,
+					(u64) (unsigned long) zc->buf, zc->len);
+		if (ret < 0)
+			goto out;
+	} else {
+		ret = import_single_range(WRITE, zc->buf, zc->len, &iov,
+						&msg.msg_iter);
+		if (unlikely(ret))
+			goto out;
+	}
+
+	if (!zc->notif) {
+		zc->notif = io_alloc_notif(req);
+		if (unlikely(!zc->notif)) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		req->flags |= REQ_F_NEED_CLEANUP;
+	}
+	notif = zc->notif;
+
+	msg.msg_name = NULL;
+	msg.msg_control = NULL;
+	msg.msg_controllen = 0;
+	msg.msg_namelen = 0;
+	msg.msg_iocb = NULL;
+	msg.msg_ubuf = &notif->notif.uarg;
+
+	flags = zc->msg_flags;
+	if (flags & MSG_DONTWAIT)
+		req->flags |= REQ_F_NOWAIT;
+	else if (force_nonblock)
+		flags |= MSG_DONTWAIT;
+
+	msg.msg_flags = flags;
+	ret = sock_sendmsg(sock, &msg);
+	if (force_nonblock && ret == -EAGAIN)
+		return -EAGAIN;
+	if (ret == -ERESTARTSYS)
+		ret = -EINTR;
+
+	zc->notif = NULL;
+	req->flags &= ~REQ_F_NEED_CLEANUP;
+	if (ret < 0)
+		req_set_fail_links(req);
+	__io_req_complete(req, ret, IORING_CQE_F_MORE);
+	/* drop our uarg reference, after the send CQE to keep them ordered */
+	io_tx_ubuf_callback(&notif->notif.uarg, true);
+	return 0;
+out:
+	if (ret < 0)
+		req_set_fail_links(req);
+	io_req_complete(req, ret);
+	return 0;
+}
+
 static int __io_recvmsg_copy_hdr(struct io_kiocb *req, struct io_async_ctx *io)
 {
 	struct io_sr_msg *sr = &req->sr_msg;
@@ -4186,25 +4573,96 @@ static int io_recvmsg_copy_hdr(struct io_kiocb *req, struct io_async_ctx *io)
 	return __io_recvmsg_copy_hdr(req, io);
 }
 
-static struct io_buffer *io_recv_buffer_select(struct io_kiocb *req,
-					       int *cflags, bool needs_lock)
+/*
+ * Grab the next buffer from a provided buffer ring. The head is consumed
+ * right away, the buffer belongs to the request until its CQE is posted.
+ */
+static int io_ring_buffer_select(struct io_kiocb *req,
+				 struct io_buffer_ring *bl, size_t *len)
+{
+	struct io_sr_msg *sr = &req->sr_msg;
+	struct io_uring_buf_ring *br = bl->br;
+	struct io_uring_buf *buf;
+	__u16 tail, head = bl->head;
+	__u32 buf_len;
+
+	/* pairs with the smp_store_release() of the tail by the application */
+	tail = smp_load_acquire(&br->tail);
+	if (unlikely(tail == head))
+		return -ENOBUFS;
+
+	buf = &br->bufs[head & bl->mask];
+	buf_len = READ_ONCE(buf->len);
+	if (*len == 0 || *len > buf_len)
+		*len = buf_len;
+	sr->rbuf.addr = READ_ONCE(buf->addr);
+	sr->rbuf.bid = READ_ONCE(buf->bid);
+	bl->head = head + 1;
+	req->flags |= REQ_F_BUFFER_RING;
+	return 0;
+}
+
+static void __user *io_recv_buffer_select(struct io_kiocb *req,
+					  int *cflags, bool needs_lock)
 {
 	struct io_sr_msg *sr = &req->sr_msg;
+	struct io_buffer_ring *bl;
 	struct io_buffer *kbuf;
+	u64 addr;
+	u16 bid;
 
 	if (!(req->flags & REQ_F_BUFFER_SELECT))
 		return NULL;
 
-	kbuf = io_buffer_select(req, &sr->len, sr->bgid, sr->kbuf, needs_lock);
-	if (IS_ERR(kbuf))
-		return kbuf;
+	if (req->flags & REQ_F_BUFFER_SELECTED) {
+		if (req->flags & REQ_F_BUFFER_RING) {
+			addr = sr->rbuf.addr;
+			bid = sr->rbuf.bid;
+		} else {
+			addr = sr->kbuf->addr;
+			bid = sr->kbuf->bid;
+		}
+		goto done;
+	}
 
-	sr->kbuf = kbuf;
-	req->flags |= REQ_F_BUFFER_SELECTED;
+	io_ring_submit_lock(req->ctx, needs_lock);
+	bl = idr_find(&req->ctx->io_buf_ring_idr, sr->bgid);
+	if (bl) {
+		int ret = io_ring_buffer_select(req, bl, &sr->len);
+
+		kbuf = ret ? ERR_PTR(ret) : NULL;
+	} else {
+		/* already holding the lock, if it was needed */
+		kbuf = io_buffer_select(req, &sr->len, sr->bgid, NULL, false);
+	}
+	io_ring_submit_unlock(req->ctx, needs_lock);
 
-	*cflags = kbuf->bid << IORING_CQE_BUFFER_SHIFT;
+	if (IS_ERR(kbuf))
+		return ERR_CAST(kbuf);
+	if (kbuf) {
+		sr->kbuf = kbuf;
+		addr = kbuf->addr;
+		bid = kbuf->bid;
+	} else {
+		addr = sr->rbuf.addr;
+		bid = sr->rbuf.bid;
+	}
+	req->flags |= REQ_F_BUFFER_SELECTED;
+done:
+	*cflags = bid << IORING_CQE_BUFFER_SHIFT;
 	*cflags |= IORING_CQE_F_BUFFER;
-	return kbuf;
+	return u64_to_user_ptr(addr);
+}
+
+/* release a buffer picked by io_recv_buffer_select(), if any */
+static void io_recv_kbuf_drop(struct io_kiocb *req)
+{
+	if (!(req->flags & REQ_F_BUFFER_SELECTED))
+		return;
+	if (!(req->flags & REQ_F_BUFFER_RING))
+		kfree(req->sr_msg.kbuf);
+	req->sr_msg.kbuf = NULL;
+	req->flags &= ~(REQ_F_BUFFER_SELECTED | REQ_F_BUFFER_RING);
 }
 
 static int io_recvmsg_prep(struct io_kiocb *req,
@@ -4212,6 +4670,7 @@ static int io_recvmsg_prep(struct io_kiocb *req,
 {
 	struct io_sr_msg *sr = &req->sr_msg;
 	struct io_async_ctx *io = req->io;
+	unsigned flags;
 	int ret;
 
 	if (unlikely(req->ctx->flags & IORING_SETUP_IOPOLL))
@@ -4222,6 +4681,19 @@ static int io_recvmsg_prep(struct io_kiocb *req,
 	sr->len = READ_ONCE(sqe->len);
 	sr->bgid = READ_ONCE(sqe->buf_group);
 
+	flags = READ_ONCE(sqe->ioprio);
+	if (flags & ~IORING_RECV_MULTISHOT)
+		return -EINVAL;
+	if (flags & IORING_RECV_MULTISHOT) {
+		if (req->opcode != IORING_OP_RECV)
+			return -EINVAL;
+		if (!(req->flags & REQ_F_BUFFER_SELECT) || sr->len)
+			return -EINVAL;
+		if (req->flags & (REQ_F_LINK | REQ_F_HARDLINK))
+			return -EINVAL;
+		req->flags |= REQ_F_APOLL_MULTISHOT;
+	}
+
 #ifdef CONFIG_COMPAT
 	if (req->ctx->compat)
 		sr->msg_flags |= MSG_CMSG_COMPAT;
@@ -4247,8 +4719,8 @@ static int io_recvmsg(struct io_kiocb *req, bool force_nonblock)
 
 	sock = sock_from_file(req->file, &ret);
 	if (sock) {
-		struct io_buffer *kbuf;
 		struct io_async_ctx io;
+		void __user *buf;
 		unsigned flags;
 
 		if (req->io) {
@@ -4267,11 +4739,11 @@ static int io_recvmsg(struct io_kiocb *req, bool force_nonblock)
 				return ret;
 		}
 
-		kbuf = io_recv_buffer_select(req, &cflags, !force_nonblock);
-		if (IS_ERR(kbuf)) {
-			return PTR_ERR(kbuf);
-		} else if (kbuf) {
-			kmsg->fast_iov[0].iov_base = u64_to_user_ptr(kbuf->addr);
+		buf = io_recv_buffer_select(req, &cflags, !force_nonblock);
+		if (IS_ERR(buf)) {
+			return PTR_ERR(buf);
+		} else if (buf) {
+			kmsg->fast_iov[0].iov_base = buf;
 			iov_iter_init(&kmsg->msg.msg_iter, READ, kmsg->iov,
 					1, req->sr_msg.len);
 		}
@@ -4287,13 +4759,12 @@ static int io_recvmsg(struct io_kiocb *req, bool force_nonblock)
 		if (force_nonblock && ret == -EAGAIN) {
 			ret = io_setup_async_msg(req, kmsg);
 			if (ret != -EAGAIN)
-				kfree(kbuf);
+				io_recv_kbuf_drop(req);
 			return ret;
 		}
 		if (ret == -ERESTARTSYS)
 			ret = -EINTR;
-		if (kbuf)
-			kfree(kbuf);
+		io_recv_kbuf_drop(req);
 	}
 
 	if (kmsg && kmsg->iov != kmsg->fast_iov)
@@ -4307,53 +4778,67 @@ static int io_recvmsg(struct io_kiocb *req, bool force_nonblock)
 
 static int io_recv(struct io_kiocb *req, bool force_nonblock)
 {
-	struct io_buffer *kbuf = NULL;
+	struct io_sr_msg *sr = &req->sr_msg;
 	struct socket *sock;
+	void __user *buf;
+	struct msghdr msg;
+	struct iovec iov;
+	unsigned flags;
 	int ret, cflags = 0;
 
 	sock = sock_from_file(req->file, &ret);
-	if (sock) {
-		struct io_sr_msg *sr = &req->sr_msg;
-		void __user *buf = sr->buf;
-		struct msghdr msg;
-		struct iovec iov;
-		unsigned flags;
-
-		kbuf = io_recv_buffer_select(req, &cflags, !force_nonblock);
-		if (IS_ERR(kbuf))
-			return PTR_ERR(kbuf);
-		else if (kbuf)
-			buf = u64_to_user_ptr(kbuf->addr);
+	if (unlikely(!sock))
+		goto out;
+retry_multishot:
+	buf = io_recv_buffer_select(req, &cflags, !force_nonblock);
+	if (IS_ERR(buf)) {
+		ret = PTR_ERR(buf);
+		goto out;
+	} else if (!buf) {
+		buf = sr->buf;
+	}
 
-		ret = import_single_range(READ, buf, sr->len, &iov,
-						&msg.msg_iter);
-		if (ret) {
-			kfree(kbuf);
-			return ret;
-		}
+	ret = import_single_range(READ, buf, sr->len, &iov, &msg.msg_iter);
+	if (ret)
+		goto out;
 
-		req->flags |= REQ_F_NEED_CLEANUP;
-		msg.msg_name = NULL;
-		msg.msg_control = NULL;
-		msg.msg_controllen = 0;
-		msg.msg_namelen = 0;
-		msg.msg_iocb = NULL;
-		msg.msg_flags = 0;
+	req->flags |= REQ_F_NEED_CLEANUP;
+	msg.msg_name = NULL;
+	msg.msg_control = NULL;
+	msg.msg_controllen = 0;
+	msg.msg_namelen = 0;
+	msg.msg_iocb = NULL;
+	msg.msg_flags = 0;
+
+	flags = req->sr_msg.msg_flags;
+	if (flags & MSG_DONTWAIT)
+		req->flags |= REQ_F_NOWAIT;
+	else if (force_nonblock)
+		flags |= MSG_DONTWAIT;
 
-		flags = req->sr_msg.msg_flags;
-		if (flags & MSG_DONTWAIT)
-			req->flags |= REQ_F_NOWAIT;
-		else if (force_nonblock)
-			flags |= MSG_DONTWAIT;
+	ret = sock_recvmsg(sock, &msg, flags);
+	if (force_nonblock && ret == -EAGAIN)
+		return -EAGAIN;
+	if (ret == -ERESTARTSYS)
+		ret = -EINTR;
 
-		ret = sock_recvmsg(sock, &msg, flags);
-		if (force_nonblock && ret == -EAGAIN)
-			return -EAGAIN;
-		if (ret == -ERESTARTSYS)
-			ret = -EINTR;
+	/*
+	 * Multishot keeps going as long as data arrives and there is room in
+	 * the CQ ring. Once the socket runs dry, -EAGAIN above re-arms the
+	 * poll handler. From io-wq we just finish the request, the final CQE
+	 * lacks IORING_CQE_F_MORE so the application knows to resubmit.
+	 */
+	if (ret > 0 && force_nonblock && (req->flags & REQ_F_APOLL_MULTISHOT)) {
+		io_recv_kbuf_drop(req);
+		req->flags &= ~REQ_F_NEED_CLEANUP;
+		if (io_cqring_post_more(req, ret, cflags)) {
+			sr->len = 0;
+			cflags = 0;
+			goto retry_multishot;
+		}
 	}
-
-	kfree(kbuf);
+out:
+	io_recv_kbuf_drop(req);
 	req->flags &= ~REQ_F_NEED_CLEANUP;
 	if (ret < 0)
 		req_set_fail_links(req);
@@ -4364,25 +4849,36 @@ static int io_recv(struct io_kiocb *req, bool force_nonblock)
 static int io_accept_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe)
 {
 	struct io_accept *accept = &req->accept;
+	unsigned flags;
 
 	if (unlikely(req->ctx->flags & (IORING_SETUP_IOPOLL|IORING_SETUP_SQPOLL)))
 		return -EINVAL;
-	if (sqe->ioprio || sqe->len || sqe->buf_index)
+	if (sqe->len || sqe->buf_index)
 		return -EINVAL;
 
 	accept->addr = u64_to_user_ptr(READ_ONCE(sqe->addr));
 	accept->addr_len = u64_to_user_ptr(READ_ONCE(sqe->addr2));
 	accept->flags = READ_ONCE(sqe->accept_flags);
 	accept->nofile = rlimit(RLIMIT_NOFILE);
-	return 0;
-}
 
-static int io_accept(struct io_kiocb *req, bool force_nonblock)
+	flags = READ_ONCE(sqe->ioprio);
+	if (flags & ~IORING_ACCEPT_MULTISHOT)
+		return -EINVAL;
+	if (flags & IORING_ACCEPT_MULTISHOT) {
+		if (req->flags & (REQ_F_LINK | REQ_F_HARDLINK))
+			return -EINVAL;
+		req->flags |= REQ_F_APOLL_MULTISHOT;
+	}
+	return 0;
+}
+
+static int io_accept(struct io_kiocb *req, bool force_nonblock)
 {
 	struct io_accept *accept = &req->accept;
 	unsigned int file_flags = force_nonblock ? O_NONBLOCK : 0;
 	int ret;
 
+retry:
 	ret = __sys_accept4_file(req->file, file_flags, accept->addr,
 					accept->addr_len, accept->flags,
 					accept->nofile);
@@ -4392,6 +4888,10 @@ static int io_accept(struct io_kiocb *req, bool force_nonblock)
 		if (ret == -ERESTARTSYS)
 			ret = -EINTR;
 		req_set_fail_links(req);
+	} else if (force_nonblock && (req->flags & REQ_F_APOLL_MULTISHOT)) {
+		/* drain the backlog, -EAGAIN re-arms the poll handler */
+		if (io_cqring_post_more(req, ret, 0))
+			goto retry;
 	}
 	io_req_complete(req, ret);
 	return 0;
@@ -4472,6 +4972,16 @@ static int io_send(struct io_kiocb *req, bool force_nonblock)
 	return -EOPNOTSUPP;
 }
 
+static int io_sendzc_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe)
+{
+	return -EOPNOTSUPP;
+}
+
+static int io_sendzc(struct io_kiocb *req, bool force_nonblock)
+{
+	return -EOPNOTSUPP;
+}
+
 static int io_recvmsg_prep(struct io_kiocb *req,
 			   const struct io_uring_sqe *sqe)
 {
@@ -4946,7 +5456,9 @@ static bool io_arm_poll_handler(struct io_kiocb *req)
 
 	if (!req->file || !file_can_poll(req->file))
 		return false;
-	if (req->flags & REQ_F_POLLED)
+	/* multishot requests re-arm every time they run out of data */
+	if ((req->flags & (REQ_F_POLLED | REQ_F_APOLL_MULTISHOT)) ==
+	    REQ_F_POLLED)
 		return false;
 	if (!def->pollin && !def->pollout)
 		return false;
@@ -5367,6 +5879,449 @@ static bool io_cancel_cb(struct io_wq_work *work, void *data)
 	return req->user_data == (unsigned long) data;
 }
 
+struct io_futex_slot {
+	struct futex_q		*q;
+	struct io_futex_data	*ifd;
+};
+
+/*
+ * State of an armed FUTEX_WAIT(V). The first of the wakeups or a cancel
+ * claims ->owned and sets the result, the request completes once that
+ * happened and the issue path is done arming, whichever is last.
+ */
+struct io_futex_data {
+	struct io_kiocb		*req;
+	struct hlist_node	node;
+	unsigned long		owned;
+	atomic_t		pending;
+	unsigned int		nr;
+	struct io_futex_slot	slots[];
+};
+
+static int io_futex_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe)
+{
+	struct io_futex *iof = &req->futex;
+
+	if (unlikely(req->ctx->flags & IORING_SETUP_IOPOLL))
+		return -EINVAL;
+	if (sqe->ioprio || sqe->len || sqe->futex_flags || sqe->buf_index)
+		return -EINVAL;
+
+	iof->uaddr = u64_to_user_ptr(READ_ONCE(sqe->addr));
+	iof->futex_val = READ_ONCE(sqe->addr2);
+	iof->futex_mask = READ_ONCE(sqe->addr3);
+	iof->futex_flags = READ_ONCE(sqe->fd);
+	iof->ifd = NULL;
+
+	if (iof->futex_flags & ~(FUTEX2_SIZE_MASK | FUTEX2_PRIVATE))
+		return -EINVAL;
+	if ((iof->futex_flags & FUTEX2_SIZE_MASK) != FUTEX2_SIZE_U32)
+		return -EINVAL;
+	if (!iof->futex_mask || iof->futex_mask > U32_MAX)
+		return -EINVAL;
+	/* the value to wait for, or the number of waiters to wake */
+	if (req->opcode == IORING_OP_FUTEX_WAIT) {
+		if (iof->futex_val > U32_MAX)
+			return -EINVAL;
+	} else if (iof->futex_val > INT_MAX) {
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static int io_futexv_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe)
+{
+	struct io_futex *iof = &req->futex;
+
+	if (unlikely(req->ctx->flags & IORING_SETUP_IOPOLL))
+		return -EINVAL;
+	if (sqe->ioprio || sqe->fd || sqe->off || sqe->futex_flags ||
+	    sqe->buf_index || sqe->addr3)
+		return -EINVAL;
+
+	iof->uwaitv = u64_to_user_ptr(READ_ONCE(sqe->addr));
+	iof->futex_nr = READ_ONCE(sqe->len);
+	iof->ifd = NULL;
+	if (!iof->futex_nr || iof->futex_nr > FUTEX_WAITV_MAX)
+		return -EINVAL;
+	return 0;
+}
+
+static void io_futex_complete(struct io_kiocb *req)
+{
+	struct io_futex_data *ifd = req->futex.ifd;
+	struct io_ring_ctx *ctx = req->ctx;
+	unsigned int i;
+
+	/* also waits for wake callbacks still running on other queues */
+	for (i = 0; i < ifd->nr; i++)
+		futex_unqueue_async(ifd->slots[i].q);
+
+	spin_lock_irq(&ctx->completion_lock);
+	hlist_del(&ifd->node);
+	spin_unlock_irq(&ctx->completion_lock);
+	kfree(ifd);
+	req->futex.ifd = NULL;
+
+	if (req->result < 0)
+		req_set_fail_links(req);
+	io_req_complete(req, req->result);
+}
+
+static void io_futex_complete_tw(struct callback_head *cb)
+{
+	struct io_kiocb *req = container_of(cb, struct io_kiocb, task_work);
+
+	io_futex_complete(req);
+}
+
+static bool io_futex_claim(struct io_futex_data *ifd, long res)
+{
+	if (test_and_set_bit(0, &ifd->owned))
+		return false;
+	ifd->req->result = res;
+	return true;
+}
+
+/* drop the claim's pending count, may be called from any context */
+static void io_futex_put(struct io_futex_data *ifd)
+{
+	struct io_kiocb *req = ifd->req;
+	struct task_struct *tsk;
+
+	if (!atomic_dec_and_test(&ifd->pending))
+		return;
+
+	init_task_work(&req->task_work, io_futex_complete_tw);
+	if (unlikely(io_req_task_work_add(req, &req->task_work, true))) {
+		tsk = io_wq_get_task(req->ctx->io_wq);
+		task_work_add(tsk, &req->task_work, TWA_NONE);
+		wake_up_process(tsk);
+	}
+}
+
+/* called by futex wakers, with the hash bucket locked */
+static void io_futex_wake_fn(void *data)
+{
+	struct io_futex_slot *slot = data;
+	struct io_futex_data *ifd = slot->ifd;
+	long res = 0;
+
+	/* FUTEX_WAITV returns the index of the futex that woke us */
+	if (ifd->req->opcode == IORING_OP_FUTEX_WAITV)
+		res = slot - ifd->slots;
+	if (io_futex_claim(ifd, res))
+		io_futex_put(ifd);
+}
+
+static struct io_futex_data *io_futex_alloc(struct io_kiocb *req,
+					    unsigned int nr)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	struct io_futex_data *ifd;
+
+	ifd = kzalloc(struct_size(ifd, slots, nr), GFP_KERNEL);
+	if (!ifd)
+		return NULL;
+
+	ifd->req = req;
+	/* one for the claim, one for the issue path */
+	atomic_set(&ifd->pending, 2);
+	req->futex.ifd = ifd;
+
+	spin_lock_irq(&ctx->completion_lock);
+	hlist_add_head(&ifd->node, &ctx->futex_list);
+	spin_unlock_irq(&ctx->completion_lock);
+	return ifd;
+}
+
+static int io_futex_arm(struct io_futex_data *ifd, u32 __user *uaddr,
+			u32 flags, u32 val, u32 mask)
+{
+	struct io_futex_slot *slot = &ifd->slots[ifd->nr];
+	struct futex_q *q;
+
+	slot->ifd = ifd;
+	q = futex_queue_async(uaddr, !(flags & FUTEX2_PRIVATE), val, mask,
+			      io_futex_wake_fn, slot);
+	if (IS_ERR(q))
+		return PTR_ERR(q);
+	slot->q = q;
+	ifd->nr++;
+	return 0;
+}
+
+/* issue path is done arming, a failure competes with the wakeups */
+static void io_futex_armed(struct io_futex_data *ifd, int ret)
+{
+	if (ret < 0)
+		io_futex_claim(ifd, ret);
+	if (atomic_dec_and_test(&ifd->pending))
+		io_futex_complete(ifd->req);
+}
+
+static int io_futex_wait(struct io_kiocb *req)
+{
+	struct io_futex *iof = &req->futex;
+	struct io_futex_data *ifd;
+
+	ifd = io_futex_alloc(req, 1);
+	if (!ifd) {
+		req_set_fail_links(req);
+		io_req_complete(req, -ENOMEM);
+		return 0;
+	}
+
+	io_futex_armed(ifd, io_futex_arm(ifd, iof->uaddr, iof->futex_flags,
+					 iof->futex_val, iof->futex_mask));
+	return 0;
+}
+
+static int io_futexv_wait(struct io_kiocb *req)
+{
+	struct io_futex *iof = &req->futex;
+	struct io_futex_data *ifd;
+	struct futex_waitv *waitv;
+	unsigned int i;
+	int ret;
+
+	waitv = kmalloc_array(iof->futex_nr, sizeof(*waitv), GFP_KERNEL);
+	if (!waitv) {
+		ret = -ENOMEM;
+		goto err;
+	}
+	ret = -EFAULT;
+	if (copy_from_user(waitv, iof->uwaitv,
+			   iof->futex_nr * sizeof(*waitv)))
+		goto err_free;
+
+	ret = -EINVAL;
+	for (i = 0; i < iof->futex_nr; i++) {
+		if (waitv[i].flags & ~(FUTEX2_SIZE_MASK | FUTEX2_PRIVATE))
+			goto err_free;
+		if ((waitv[i].flags & FUTEX2_SIZE_MASK) != FUTEX2_SIZE_U32)
+			goto err_free;
+		if (waitv[i].__reserved || waitv[i].val > U32_MAX)
+			goto err_free;
+	}
+
+	ret = -ENOMEM;
+	ifd = io_futex_alloc(req, iof->futex_nr);
+	if (!ifd)
+		goto err_free;
+
+	ret = 0;
+	for (i = 0; i < iof->futex_nr; i++) {
+		/* woken or canceled already, no point in queueing more */
+		if (test_bit(0, &ifd->owned))
+			break;
+		ret = io_futex_arm(ifd, u64_to_user_ptr(waitv[i].uaddr),
+				   waitv[i].flags, waitv[i].val,
+				   FUTEX_BITSET_MATCH_ANY);
+		if (ret)
+			break;
+	}
+	kfree(waitv);
+	io_futex_armed(ifd, ret);
+	return 0;
+
+err_free:
+	kfree(waitv);
+err:
+	req_set_fail_links(req);
+	io_req_complete(req, ret);
+	return 0;
+}
+
+static int io_futex_wake(struct io_kiocb *req)
+{
+	struct io_futex *iof = &req->futex;
+	int op = FUTEX_WAKE_BITSET;
+	int ret;
+
+	if (iof->futex_flags & FUTEX2_PRIVATE)
+		op |= FUTEX_PRIVATE_FLAG;
+	ret = do_futex(iof->uaddr, op, iof->futex_val, NULL, NULL, 0,
+		       iof->futex_mask);
+	if (ret < 0)
+		req_set_fail_links(req);
+	io_req_complete(req, ret);
+	return 0;
+}
+
+static int io_futex_cancel(struct io_ring_ctx *ctx, __u64 sqe_addr)
+	__must_hold(&ctx->completion_lock)
+{
+	struct io_futex_data *ifd;
+
+	hlist_for_each_entry(ifd, &ctx->futex_list, node) {
+		if (ifd->req->user_data != sqe_addr)
+			continue;
+		if (!io_futex_claim(ifd, -ECANCELED))
+			return -EALREADY;
+		io_futex_put(ifd);
+		return 0;
+	}
+	return -ENOENT;
+}
+
+static void io_futex_remove_all(struct io_ring_ctx *ctx)
+{
+	struct io_futex_data *ifd;
+
+	spin_lock_irq(&ctx->completion_lock);
+	hlist_for_each_entry(ifd, &ctx->futex_list, node) {
+		if (io_futex_claim(ifd, -ECANCELED))
+			io_futex_put(ifd);
+	}
+	spin_unlock_irq(&ctx->completion_lock);
+}
+
+static int io_uring_cmd_prep(struct io_kiocb *req,
+			     const struct io_uring_sqe *sqe)
+{
+	struct io_uring_cmd *ioucmd = &req->uring_cmd;
+
+	if (unlikely(sqe->ioprio || sqe->rw_flags || sqe->buf_index ||
+		     sqe->__pad1))
+		return -EINVAL;
+	/* drivers complete from the submitter's context, not a poller's */
+	if (unlikely(req->ctx->flags & (IORING_SETUP_IOPOLL |
+					IORING_SETUP_SQPOLL)))
+		return -EINVAL;
+
+	ioucmd->cmd = u64_to_user_ptr(READ_ONCE(sqe->addr));
+	ioucmd->cmd_len = READ_ONCE(sqe->len);
+	ioucmd->cmd_op = READ_ONCE(sqe->cmd_op);
+	ioucmd->task_work_cb = NULL;
+	return 0;
+}
+
+static void io_uring_cmd_del(struct io_kiocb *req)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ctx->completion_lock, flags);
+	list_del_init(&req->list);
+	spin_unlock_irqrestore(&ctx->completion_lock, flags);
+}
+
+static void io_uring_cmd_work(struct callback_head *cb)
+{
+	struct io_kiocb *req = container_of(cb, struct io_kiocb, task_work);
+	struct io_uring_cmd *ioucmd = &req->uring_cmd;
+	void (*task_work_cb)(struct io_uring_cmd *, unsigned int);
+	int ret;
+
+	task_work_cb = ioucmd->task_work_cb;
+	if (task_work_cb) {
+		ioucmd->task_work_cb = NULL;
+		task_work_cb(ioucmd, current == req->task ?
+				     0 : IO_URING_F_TASK_DEAD);
+		return;
+	}
+
+	ret = req->result;
+	if (ret < 0)
+		req_set_fail_links(req);
+	io_req_complete(req, ret);
+}
+
+static void io_uring_cmd_queue_work(struct io_kiocb *req)
+{
+	struct task_struct *tsk;
+
+	init_task_work(&req->task_work, io_uring_cmd_work);
+	if (unlikely(io_req_task_work_add(req, &req->task_work, true))) {
+		tsk = io_wq_get_task(req->ctx->io_wq);
+		task_work_add(tsk, &req->task_work, TWA_NONE);
+		wake_up_process(tsk);
+	}
+}
+
+/*
+ * Run @task_work_cb from the submitter's task, where the driver can access
+ * its memory.  May be called from any context.
+ */
+void io_uring_cmd_complete_in_task(struct io_uring_cmd *ioucmd,
+			void (*task_work_cb)(struct io_uring_cmd *, unsigned int))
+{
+	struct io_kiocb *req = container_of(ioucmd, struct io_kiocb, uring_cmd);
+
+	ioucmd->task_work_cb = task_work_cb;
+	io_uring_cmd_queue_work(req);
+}
+EXPORT_SYMBOL_GPL(io_uring_cmd_complete_in_task);
+
+/* the driver is done with @ioucmd, may be called from any context */
+void io_uring_cmd_done(struct io_uring_cmd *ioucmd, ssize_t ret)
+{
+	struct io_kiocb *req = container_of(ioucmd, struct io_kiocb, uring_cmd);
+
+	io_uring_cmd_del(req);
+	req->result = ret;
+	ioucmd->task_work_cb = NULL;
+	io_uring_cmd_queue_work(req);
+}
+EXPORT_SYMBOL_GPL(io_uring_cmd_done);
+
+static int io_uring_cmd(struct io_kiocb *req, bool force_nonblock)
+{
+	struct io_uring_cmd *ioucmd = &req->uring_cmd;
+	struct io_ring_ctx *ctx = req->ctx;
+	struct file *file = req->file;
+	int ret;
+
+	if (!file->f_op->uring_cmd)
+		return -EOPNOTSUPP;
+
+	/* the driver may hand the command over to another context right away */
+	io_get_req_task(req);
+	spin_lock_irq(&ctx->completion_lock);
+	list_add_tail(&req->list, &ctx->uring_cmd_list);
+	spin_unlock_irq(&ctx->completion_lock);
+
+	ret = file->f_op->uring_cmd(ioucmd, force_nonblock ?
+					    IO_URING_F_NONBLOCK : 0);
+	if (ret == -EIOCBQUEUED)
+		return 0;
+
+	io_uring_cmd_del(req);
+	if (ret == -EAGAIN && force_nonblock)
+		return -EAGAIN;
+	if (ret < 0)
+		req_set_fail_links(req);
+	io_req_complete(req, ret);
+	return 0;
+}
+
+/* ask the drivers to complete the commands they hold, the ring is dying */
+static void io_uring_cmd_cancel_all(struct io_ring_ctx *ctx)
+{
+	struct io_kiocb *req;
+
+	for (;;) {
+		bool found = false;
+
+		spin_lock_irq(&ctx->completion_lock);
+		list_for_each_entry(req, &ctx->uring_cmd_list, list) {
+			if (req->flags & REQ_F_CMD_CANCELING)
+				continue;
+			req->flags |= REQ_F_CMD_CANCELING;
+			refcount_inc(&req->refs);
+			found = true;
+			break;
+		}
+		spin_unlock_irq(&ctx->completion_lock);
+		if (!found)
+			break;
+
+		req->file->f_op->uring_cmd(&req->uring_cmd, IO_URING_F_CANCEL);
+		io_put_req(req);
+	}
+}
+
 static int io_async_cancel_one(struct io_ring_ctx *ctx, void *sqe_addr)
 {
 	enum io_wq_cancel cancel_ret;
@@ -5403,6 +6358,9 @@ static void io_async_find_and_cancel(struct io_ring_ctx *ctx,
 
 	spin_lock_irqsave(&ctx->completion_lock, flags);
 	ret = io_timeout_cancel(ctx, sqe_addr);
+	if (ret != -ENOENT)
+		goto done;
+	ret = io_futex_cancel(ctx, sqe_addr);
 	if (ret != -ENOENT)
 		goto done;
 	ret = io_poll_cancel(ctx, sqe_addr);
@@ -5590,6 +6548,19 @@ static int io_req_defer_prep(struct io_kiocb *req,
 	case IORING_OP_IOCTL:
 		ret = io_ioctl_prep(req, sqe);
 		break;
+	case IORING_OP_SEND_ZC:
+		ret = io_sendzc_prep(req, sqe);
+		break;
+	case IORING_OP_FUTEX_WAIT:
+	case IORING_OP_FUTEX_WAKE:
+		ret = io_futex_prep(req, sqe);
+		break;
+	case IORING_OP_FUTEX_WAITV:
+		ret = io_futexv_prep(req, sqe);
+		break;
+	case IORING_OP_URING_CMD:
+		ret = io_uring_cmd_prep(req, sqe);
+		break;
 	default:
 		printk_once(KERN_WARNING "io_uring: unhandled opcode %d\n",
 				req->opcode);
@@ -5648,16 +6619,19 @@ static void io_cleanup_req(struct io_kiocb *req)
 			kfree(io->rw.free_iovec);
 		break;
 	case IORING_OP_RECVMSG:
-		if (req->flags & REQ_F_BUFFER_SELECTED)
-			kfree(req->sr_msg.kbuf);
+		io_recv_kbuf_drop(req);
 		/* fallthrough */
 	case IORING_OP_SENDMSG:
 		if (io->msg.iov != io->msg.fast_iov)
 			kfree(io->msg.iov);
 		break;
 	case IORING_OP_RECV:
-		if (req->flags & REQ_F_BUFFER_SELECTED)
-			kfree(req->sr_msg.kbuf);
+		io_recv_kbuf_drop(req);
+		break;
+	case IORING_OP_SEND_ZC:
+		/* nothing was queued with it yet, no CQE for it either */
+		if (req->sendzc.notif)
+			io_put_req(req->sendzc.notif);
 		break;
 	case IORING_OP_OPENAT:
 	case IORING_OP_OPENAT2:
@@ -5910,6 +6884,46 @@ static int io_issue_sqe(struct io_kiocb *req, const struct io_uring_sqe *sqe,
 		}
 		ret = io_ioctl(req, force_nonblock);
 		break;
+	case IORING_OP_SEND_ZC:
+		if (sqe) {
+			ret = io_sendzc_prep(req, sqe);
+			if (ret < 0)
+				break;
+		}
+		ret = io_sendzc(req, force_nonblock);
+		break;
+	case IORING_OP_FUTEX_WAIT:
+		if (sqe) {
+			ret = io_futex_prep(req, sqe);
+			if (ret < 0)
+				break;
+		}
+		ret = io_futex_wait(req);
+		break;
+	case IORING_OP_FUTEX_WAKE:
+		if (sqe) {
+			ret = io_futex_prep(req, sqe);
+			if (ret < 0)
+				break;
+		}
+		ret = io_futex_wake(req);
+		break;
+	case IORING_OP_FUTEX_WAITV:
+		if (sqe) {
+			ret = io_futexv_prep(req, sqe);
+			if (ret < 0)
+				break;
+		}
+		ret = io_futexv_wait(req);
+		break;
+	case IORING_OP_URING_CMD:
+		if (sqe) {
+			ret = io_uring_cmd_prep(req, sqe);
+			if (ret < 0)
+				break;
+		}
+		ret = io_uring_cmd(req, force_nonblock);
+		break;
 	default:
 		ret = -EINVAL;
 		break;
@@ -6525,200 +7539,68 @@ static int io_submit_sqes(struct io_ring_ctx *ctx, unsigned int nr,
 		req = io_alloc_req(ctx, &state);
 		if (unlikely(!req)) {
 			if (!submitted)
-				submitted = -EAGAIN;
-			break;
-		}
-
-		err = io_init_req(ctx, req, sqe, &state);
-		io_consume_sqe(ctx);
-		/* will complete beyond this point, count as submitted */
-		submitted++;
-
-		if (unlikely(err)) {
-fail_req:
-			io_put_req(req);
-			io_req_complete(req, err);
-			break;
-		}
-
-		trace_io_uring_submit_sqe(ctx, req->opcode, req->user_data,
-						true, io_async_submit(ctx));
-		err = io_submit_sqe(req, sqe, &link);
-		if (err)
-			goto fail_req;
-	}
-
-	if (unlikely(submitted != nr)) {
-		int ref_used = (submitted == -EAGAIN) ? 0 : submitted;
-
-		percpu_ref_put_many(&ctx->refs, nr - ref_used);
-	}
-	if (link)
-		io_queue_link_head(link);
-	io_submit_state_end(&state);
-
-	 /* Commit SQ ring head once we've consumed and submitted all SQEs */
-	io_commit_sqring(ctx);
-
-	return submitted;
-}
-
-static inline void io_ring_set_wakeup_flag(struct io_ring_ctx *ctx)
-{
-	/* Tell userspace we may need a wakeup call */
-	spin_lock_irq(&ctx->completion_lock);
-	ctx->rings->sq_flags |= IORING_SQ_NEED_WAKEUP;
-	spin_unlock_irq(&ctx->completion_lock);
-}
-
-static inline void io_ring_clear_wakeup_flag(struct io_ring_ctx *ctx)
-{
-	spin_lock_irq(&ctx->completion_lock);
-	ctx->rings->sq_flags &= ~IORING_SQ_NEED_WAKEUP;
-	spin_unlock_irq(&ctx->completion_lock);
-}
-
-static int io_sq_thread(void *data)
-{
-	struct io_ring_ctx *ctx = data;
-	struct files_struct *old_files = current->files;
-	struct nsproxy *old_nsproxy = current->nsproxy;
-	const struct cred *old_cred;
-	mm_segment_t old_fs;
-	DEFINE_WAIT(wait);
-	unsigned long timeout;
-	int ret = 0;
-
-	task_lock(current);
-	current->files = NULL;
-	current->nsproxy = NULL;
-	task_unlock(current);
-
-	complete(&ctx->sq_thread_comp);
-
-	old_fs = get_fs();
-	set_fs(USER_DS);
-	old_cred = override_creds(ctx->creds);
-
-	timeout = jiffies + ctx->sq_thread_idle;
-	while (!kthread_should_park()) {
-		unsigned int to_submit;
-
-		if (!list_empty(&ctx->poll_list)) {
-			unsigned nr_events = 0;
-
-			mutex_lock(&ctx->uring_lock);
-			if (!list_empty(&ctx->poll_list))
-				io_iopoll_getevents(ctx, &nr_events, 0);
-			else
-				timeout = jiffies + ctx->sq_thread_idle;
-			mutex_unlock(&ctx->uring_lock);
-		}
-
-		to_submit = io_sqring_entries(ctx);
-
-		/*
-		 * If submit got -EBUSY, flag us as needing the application
-		 * to enter the kernel to reap and flush events.
-		 */
-		if (!to_submit || ret == -EBUSY || need_resched()) {
-			/*
-			 * Drop cur_mm before scheduling, we can't hold it for
-			 * long periods (or over schedule()). Do this before
-			 * adding ourselves to the waitqueue, as the unuse/drop
-			 * may sleep.
-			 */
-			io_sq_thread_drop_mm_files(ctx);
-
-			/*
-			 * We're polling. If we're within the defined idle
-			 * period, then let us spin without work before going
-			 * to sleep. The exception is if we got EBUSY doing
-			 * more IO, we should wait for the application to
-			 * reap events and wake us up.
-			 */
-			if (!list_empty(&ctx->poll_list) || need_resched() ||
-			    (!time_after(jiffies, timeout) && ret != -EBUSY &&
-			    !percpu_ref_is_dying(&ctx->refs))) {
-				if (current->task_works)
-					task_work_run();
-				cond_resched();
-				continue;
-			}
-
-			prepare_to_wait(ctx->sqo_wait, &wait,
-						TASK_INTERRUPTIBLE);
-			/*
-			 * While doing polled IO, before going to sleep, we need
-			 * to check if there are new reqs added to poll_list, it
-			 * is because reqs may have been punted to io worker and
-			 * will be added to poll_list later, hence check the
-			 * poll_list again.
-			 */
-			if ((ctx->flags & IORING_SETUP_IOPOLL) &&
-			    !list_empty_careful(&ctx->poll_list)) {
-				finish_wait(ctx->sqo_wait, &wait);
-				continue;
-			}
-
-			io_ring_set_wakeup_flag(ctx);
-
-			to_submit = io_sqring_entries(ctx);
-			if (!to_submit || ret == -EBUSY) {
-				if (kthread_should_park()) {
-					finish_wait(ctx->sqo_wait, &wait);
-					break;
-				}
-				if (current->task_works) {
-					task_work_run();
-					finish_wait(ctx->sqo_wait, &wait);
-					io_ring_clear_wakeup_flag(ctx);
-					continue;
-				}
-				if (signal_pending(current))
-					flush_signals(current);
-				schedule();
-				finish_wait(ctx->sqo_wait, &wait);
+				submitted = -EAGAIN;
+			break;
+		}
 
-				io_ring_clear_wakeup_flag(ctx);
-				ret = 0;
-				continue;
-			}
-			finish_wait(ctx->sqo_wait, &wait);
+		err = io_init_req(ctx, req, sqe, &state);
+		io_consume_sqe(ctx);
+		/* will complete beyond this point, count as submitted */
+		submitted++;
 
-			io_ring_clear_wakeup_flag(ctx);
+		if (unlikely(err)) {
+fail_req:
+			io_put_req(req);
+			io_req_complete(req, err);
+			break;
 		}
 
-		mutex_lock(&ctx->uring_lock);
-		if (likely(!percpu_ref_is_dying(&ctx->refs)))
-			ret = io_submit_sqes(ctx, to_submit, NULL, -1);
-		mutex_unlock(&ctx->uring_lock);
-		timeout = jiffies + ctx->sq_thread_idle;
+		trace_io_uring_submit_sqe(ctx, req->opcode, req->user_data,
+						true, io_async_submit(ctx));
+		err = io_submit_sqe(req, sqe, &link);
+		if (err)
+			goto fail_req;
 	}
 
-	if (current->task_works)
-		task_work_run();
+	if (unlikely(submitted != nr)) {
+		int ref_used = (submitted == -EAGAIN) ? 0 : submitted;
 
-	set_fs(old_fs);
-	io_sq_thread_drop_mm_files(ctx);
-	revert_creds(old_cred);
+		percpu_ref_put_many(&ctx->refs, nr - ref_used);
+	}
+	if (link)
+		io_queue_link_head(link);
+	io_submit_state_end(&state);
 
-	task_lock(current);
-	current->files = old_files;
-	current->nsproxy = old_nsproxy;
-	task_unlock(current);
+	 /* Commit SQ ring head once we've consumed and submitted all SQEs */
+	io_commit_sqring(ctx);
 
-	kthread_parkme();
+	return submitted;
+}
 
-	return 0;
+static inline void io_ring_set_wakeup_flag(struct io_ring_ctx *ctx)
+{
+	/* Tell userspace we may need a wakeup call */
+	spin_lock_irq(&ctx->completion_lock);
+	ctx->rings->sq_flags |= IORING_SQ_NEED_WAKEUP;
+	spin_unlock_irq(&ctx->completion_lock);
+}
+
+static inline void io_ring_clear_wakeup_flag(struct io_ring_ctx *ctx)
+{
+	spin_lock_irq(&ctx->completion_lock);
+	ctx->rings->sq_flags &= ~IORING_SQ_NEED_WAKEUP;
+	spin_unlock_irq(&ctx->completion_lock);
 }
 
-static int process_ctx(struct io_ring_ctx *ctx)
+static int process_ctx(struct io_ring_ctx *ctx, bool cap_entries)
 {
 	int ret = 0;
 	unsigned int to_submit;
 
 	to_submit = io_sqring_entries(ctx);
+	/* if we're handling multiple rings, cap submit size for fairness */
+	if (cap_entries && to_submit > IORING_SQPOLL_CAP_ENTRIES_VALUE)
+		to_submit = IORING_SQPOLL_CAP_ENTRIES_VALUE;
 	if (!list_empty(&ctx->poll_list) || to_submit) {
 		unsigned int nr_events = 0;
 
@@ -6734,7 +7616,7 @@ static int process_ctx(struct io_ring_ctx *ctx)
 	return ret;
 }
 
-static void io_sqd_update_thread_idle(struct sq_thread_percpu *t)
+static void io_sqd_update_thread_idle(struct io_sq_data *t)
 {
 	struct io_ring_ctx *ctx;
 	unsigned int sq_thread_idle = 0;
@@ -6769,7 +7651,7 @@ static inline bool io_time_after(bool idle_mode_us, u64 timeout)
 	return time_after64(now, timeout);
 }
 
-static void io_sqd_init_new(struct sq_thread_percpu *t)
+static void io_sqd_init_new(struct io_sq_data *t)
 {
 	struct io_ring_ctx *ctx;
 
@@ -6782,12 +7664,12 @@ static void io_sqd_init_new(struct sq_thread_percpu *t)
 	io_sqd_update_thread_idle(t);
 }
 
-static inline void io_sq_thread_unpark(struct sq_thread_percpu *t)
+static inline void io_sq_thread_unpark(struct io_sq_data *t)
 {
 	kthread_unpark(t->sqo_thread);
 }
 
-static inline void io_sq_thread_park(struct sq_thread_percpu *t)
+static inline void io_sq_thread_park(struct io_sq_data *t)
 {
 	kthread_park(t->sqo_thread);
 }
@@ -6801,7 +7683,7 @@ struct cgrp_migr_info {
 static void io_sq_cgrp_migr_work(struct work_struct *work)
 {
 	struct cgrp_migr_info *info;
-	struct sq_thread_percpu *t;
+	struct io_sq_data *t;
 	struct file *file;
 	pid_t pid;
 	char pid_str[16] = {0};
@@ -6840,7 +7722,7 @@ static int io_sq_attach_cpu_cgroup(int cpu)
 	char *buf = NULL;
 	int ret = 0, len, size = 0;
 	struct cgrp_migr_info info;
-	struct sq_thread_percpu *t = per_cpu_ptr(percpu_threads, cpu);
+	struct io_sq_data *t = per_cpu_ptr(percpu_threads, cpu);
 
 	mutex_lock(&t->lock);
 	if (!t->sqo_thread) {
@@ -6899,9 +7781,9 @@ static int io_sq_attach_cpu_cgroup(int cpu)
 	return ret;
 }
 
-static int io_sq_thread_percpu(void *data)
+static int io_sq_thread(void *data)
 {
-	struct sq_thread_percpu *t = data;
+	struct io_sq_data *t = data;
 	struct io_ring_ctx *ctx;
 	struct files_struct *old_files = current->files;
 	struct nsproxy *old_nsproxy = current->nsproxy;
@@ -6919,7 +7801,7 @@ static int io_sq_thread_percpu(void *data)
 	set_fs(USER_DS);
 	while (!kthread_should_stop()) {
 		int ret;
-		bool sqt_spin, needs_sched;
+		bool sqt_spin, needs_sched, cap_entries;
 
 		/*
 		 * Any changes to the sqd lists are synchronized through the
@@ -6943,6 +7825,7 @@ static int io_sq_thread_percpu(void *data)
 		}
 
 		sqt_spin = false;
+		cap_entries = !list_is_singular(&t->ctx_list);
 		list_for_each_entry(ctx, &t->ctx_list, sqd_list) {
 			if (current->cred != ctx->creds) {
 				if (old_cred)
@@ -6950,10 +7833,19 @@ static int io_sq_thread_percpu(void *data)
 				old_cred = override_creds(ctx->creds);
 			}
 
-			ret = process_ctx(ctx);
+			/* attached rings may come from different processes */
+			if ((current->mm && current->mm != ctx->sqo_mm) ||
+			    (current->files &&
+			     current->files != READ_ONCE(ctx->sqo_task->files)))
+				io_sq_thread_drop_mm_files(ctx);
+
+			ret = process_ctx(ctx, cap_entries);
 			if (!sqt_spin && (ret > 0 || !list_empty(&ctx->poll_list)))
 				sqt_spin = true;
 		}
+		/* rotate, so that no ring is always served first */
+		if (cap_entries)
+			list_rotate_left(&t->ctx_list);
 
 		if (sqt_spin || !io_time_after(t->idle_mode_us, timeout)) {
 			if (current->task_works)
@@ -6985,8 +7877,11 @@ static int io_sq_thread_percpu(void *data)
 				break;
 			}
 		}
-		if (needs_sched && !kthread_should_park())
+		if (needs_sched && !kthread_should_park()) {
+			if (signal_pending(current))
+				flush_signals(current);
 			schedule();
+		}
 		list_for_each_entry(ctx, &t->ctx_list, sqd_list)
 			io_ring_clear_wakeup_flag(ctx);
 
@@ -7201,26 +8096,12 @@ static int io_sqe_files_unregister(struct io_ring_ctx *ctx)
 	return 0;
 }
 
-static void destroy_sq_thread_percpu(struct io_ring_ctx *ctx, int cpu);
+static void io_sq_thread_detach(struct io_ring_ctx *ctx);
 
 static void io_sq_thread_stop(struct io_ring_ctx *ctx)
 {
-	if (ctx->sqo_thread) {
-		if ((ctx->flags & IORING_SETUP_SQ_AFF) &&
-		    (ctx->flags & IORING_SETUP_SQPOLL_PERCPU) && percpu_threads) {
-			destroy_sq_thread_percpu(ctx, ctx->sq_thread_cpu);
-		} else {
-			wait_for_completion(&ctx->sq_thread_comp);
-			/*
-			 * The park is a bit of a work-around, without it we get
-			 * warning spews on shutdown with SQPOLL set and affinity
-			 * set to a single CPU.
-			 */
-			kthread_park(ctx->sqo_thread);
-			kthread_stop(ctx->sqo_thread);
-			ctx->sqo_thread = NULL;
-		}
-	}
+	if (ctx->sq_data)
+		io_sq_thread_detach(ctx);
 }
 
 static void io_finish_async(struct io_ring_ctx *ctx)
@@ -7817,23 +8698,77 @@ static int io_init_wq_offload(struct io_ring_ctx *ctx,
 	return ret;
 }
 
-static void create_sq_thread_percpu(struct io_ring_ctx *ctx, int cpu)
+static void io_put_sq_data(struct io_sq_data *sqd)
+{
+	if (!sqd->percpu && refcount_dec_and_test(&sqd->refs))
+		kfree(sqd);
+}
+
+static struct io_sq_data *io_get_sq_data(struct io_uring_params *p)
+{
+	struct io_ring_ctx *ctx_attach;
+	struct io_sq_data *sqd;
+	struct fd f;
+
+	if ((p->flags & IORING_SETUP_SQ_AFF) &&
+	    (p->flags & IORING_SETUP_SQPOLL_PERCPU) && percpu_threads)
+		return per_cpu_ptr(percpu_threads, p->sq_thread_cpu);
+
+	if (p->flags & IORING_SETUP_ATTACH_WQ) {
+		f = fdget(p->wq_fd);
+		if (!f.file)
+			return ERR_PTR(-ENXIO);
+		if (f.file->f_op != &io_uring_fops) {
+			fdput(f);
+			return ERR_PTR(-EINVAL);
+		}
+
+		/*
+		 * Holding the fd keeps ctx_attach, and with it the sq_data,
+		 * alive. A ring without SQPOLL only shares its io-wq.
+		 */
+		ctx_attach = f.file->private_data;
+		sqd = ctx_attach->sq_data;
+		if (sqd) {
+			if (!sqd->percpu)
+				refcount_inc(&sqd->refs);
+			fdput(f);
+			return sqd;
+		}
+		fdput(f);
+	}
+
+	sqd = kzalloc(sizeof(*sqd), GFP_KERNEL);
+	if (!sqd)
+		return ERR_PTR(-ENOMEM);
+
+	refcount_set(&sqd->refs, 1);
+	INIT_LIST_HEAD(&sqd->ctx_list);
+	INIT_LIST_HEAD(&sqd->ctx_new_list);
+	init_waitqueue_head(&sqd->sqo_wait);
+	mutex_init(&sqd->lock);
+	return sqd;
+}
+
+static int io_sq_thread_attach(struct io_ring_ctx *ctx, struct io_sq_data *t,
+			       int cpu)
 {
-	struct sq_thread_percpu *t;
+	struct task_struct *tsk;
 	char buf[TASK_COMM_LEN];
 
-	t = per_cpu_ptr(percpu_threads, cpu);
 	mutex_lock(&t->lock);
 	if (!t->sqo_thread) {
 		snprintf(buf, sizeof(buf), "iou-sqp-%d", current->pid);
-		t->sqo_thread = kthread_create_on_cpu(io_sq_thread_percpu, t,
-					cpu, buf);
-		if (IS_ERR(t->sqo_thread)) {
-			ctx->sqo_thread = t->sqo_thread;
-			t->sqo_thread = NULL;
+		if (cpu >= 0)
+			tsk = kthread_create_on_cpu(io_sq_thread, t, cpu, buf);
+		else
+			tsk = kthread_create(io_sq_thread, t, "%s", buf);
+		if (IS_ERR(tsk)) {
 			mutex_unlock(&t->lock);
-			return;
+			io_put_sq_data(t);
+			return PTR_ERR(tsk);
 		}
+		t->sqo_thread = tsk;
 	}
 
 	io_sq_thread_park(t);
@@ -7841,17 +8776,17 @@ static void create_sq_thread_percpu(struct io_ring_ctx *ctx, int cpu)
 	io_sq_thread_unpark(t);
 
 	ctx->sqo_wait = &t->sqo_wait;
+	ctx->sq_data = t;
 	ctx->sq_thread_cpu = cpu;
 	ctx->sqo_thread = t->sqo_thread;
 	mutex_unlock(&t->lock);
+	return 0;
 }
 
-static void destroy_sq_thread_percpu(struct io_ring_ctx *ctx, int cpu)
+static void io_sq_thread_detach(struct io_ring_ctx *ctx)
 {
-	struct sq_thread_percpu *t;
-	struct task_struct *sqo_thread = NULL;
+	struct io_sq_data *t = ctx->sq_data;
 
-	t = per_cpu_ptr(percpu_threads, cpu);
 	mutex_lock(&t->lock);
 	/*
 	 * We may arrive here from the error branch in io_sq_offload_create()
@@ -7867,16 +8802,20 @@ static void destroy_sq_thread_percpu(struct io_ring_ctx *ctx, int cpu)
 	io_sqd_update_thread_idle(t);
 	io_sq_thread_unpark(t);
 
+	/*
+	 * Stop it under the lock, a ring attaching meanwhile must start a new
+	 * thread rather than queue itself to the dying one.
+	 */
 	if (list_empty(&t->ctx_list) && list_empty(&t->ctx_new_list)) {
-		sqo_thread = t->sqo_thread;
+		kthread_park(t->sqo_thread);
+		kthread_stop(t->sqo_thread);
 		t->sqo_thread = NULL;
 	}
 	mutex_unlock(&t->lock);
 
-	if (sqo_thread) {
-		kthread_park(sqo_thread);
-		kthread_stop(sqo_thread);
-	}
+	ctx->sq_data = NULL;
+	ctx->sqo_thread = NULL;
+	io_put_sq_data(t);
 }
 
 #define DEFAULT_SQ_IDLE_US 10
@@ -7884,7 +8823,8 @@ static void destroy_sq_thread_percpu(struct io_ring_ctx *ctx, int cpu)
 static int io_sq_offload_start(struct io_ring_ctx *ctx,
 			       struct io_uring_params *p)
 {
-	int ret;
+	struct io_sq_data *sqd;
+	int ret, cpu = -1;
 
 	mmgrab(current->mm);
 	ctx->sqo_mm = current->mm;
@@ -7912,28 +8852,26 @@ static int io_sq_offload_start(struct io_ring_ctx *ctx,
 				msecs_to_jiffies(p->sq_thread_idle) : HZ;
 
 		if (p->flags & IORING_SETUP_SQ_AFF) {
-			int cpu = p->sq_thread_cpu;
-
 			ret = -EINVAL;
-			if (cpu >= nr_cpu_ids)
+			if (p->sq_thread_cpu >= nr_cpu_ids)
 				goto err;
+			cpu = p->sq_thread_cpu;
 			if (!cpu_online(cpu))
 				goto err;
-
-			if ((p->flags & IORING_SETUP_SQPOLL_PERCPU) && percpu_threads)
-				create_sq_thread_percpu(ctx, cpu);
-			else
-				ctx->sqo_thread = kthread_create_on_cpu(io_sq_thread, ctx, cpu,
-									"io_uring-sq");
-		} else {
-			ctx->sqo_thread = kthread_create(io_sq_thread, ctx,
-							"io_uring-sq");
 		}
-		if (IS_ERR(ctx->sqo_thread)) {
-			ret = PTR_ERR(ctx->sqo_thread);
-			ctx->sqo_thread = NULL;
+
+		/*
+		 * With IORING_SETUP_ATTACH_WQ the ring joins the SQ thread of
+		 * wq_fd, which then serves all its rings round-robin.
+		 */
+		sqd = io_get_sq_data(p);
+		if (IS_ERR(sqd)) {
+			ret = PTR_ERR(sqd);
 			goto err;
 		}
+		ret = io_sq_thread_attach(ctx, sqd, cpu);
+		if (ret)
+			goto err;
 		wake_up_process(ctx->sqo_thread);
 		set_user_nice(ctx->sqo_thread, MIN_NICE);
 	} else if (p->flags & (IORING_SETUP_SQ_AFF | IORING_SETUP_IDLE_US |
@@ -8273,10 +9211,105 @@ static int __io_destroy_buffers(int id, void *p, void *data)
 	return 0;
 }
 
+static int io_register_pbuf_ring(struct io_ring_ctx *ctx, void __user *arg)
+{
+	struct io_uring_buf_reg reg;
+	struct io_buffer_ring *bl;
+	unsigned long nr_pages;
+	size_t size;
+	int ret;
+
+	if (copy_from_user(&reg, arg, sizeof(reg)))
+		return -EFAULT;
+	if (reg.resv[0] || reg.resv[1] || reg.resv[2])
+		return -EINVAL;
+	if (reg.flags != IOU_PBUF_RING_MMAP || reg.ring_addr)
+		return -EINVAL;
+	if (!is_power_of_2(reg.ring_entries) || reg.ring_entries >= 65536)
+		return -EINVAL;
+	if (idr_find(&ctx->io_buffer_idr, reg.bgid) ||
+	    idr_find(&ctx->io_buf_ring_idr, reg.bgid))
+		return -EEXIST;
+
+	bl = kzalloc(sizeof(*bl), GFP_KERNEL);
+	if (!bl)
+		return -ENOMEM;
+
+	size = array_size(sizeof(struct io_uring_buf), reg.ring_entries);
+	nr_pages = 1UL << get_order(size);
+	if (ctx->account_mem) {
+		ret = io_account_mem(ctx->user, nr_pages);
+		if (ret)
+			goto err_free;
+	}
+
+	ret = -ENOMEM;
+	bl->br = io_mem_alloc(size);
+	if (!bl->br)
+		goto err_unaccount;
+	bl->size = size;
+	bl->bgid = reg.bgid;
+	bl->mask = reg.ring_entries - 1;
+
+	ret = idr_alloc(&ctx->io_buf_ring_idr, bl, reg.bgid, reg.bgid + 1,
+			GFP_KERNEL);
+	if (ret < 0)
+		goto err_mem;
+	return 0;
+err_mem:
+	io_mem_free(bl->br);
+err_unaccount:
+	if (ctx->account_mem)
+		io_unaccount_mem(ctx->user, nr_pages);
+err_free:
+	kfree(bl);
+	return ret;
+}
+
+static int io_unregister_pbuf_ring(struct io_ring_ctx *ctx, void __user *arg)
+{
+	struct io_uring_buf_reg reg;
+	struct io_buffer_ring *bl;
+
+	if (copy_from_user(&reg, arg, sizeof(reg)))
+		return -EFAULT;
+	if (reg.resv[0] || reg.resv[1] || reg.resv[2] || reg.flags)
+		return -EINVAL;
+
+	bl = idr_remove(&ctx->io_buf_ring_idr, reg.bgid);
+	if (!bl)
+		return -ENOENT;
+
+	/* may still be mapped by the application, freed with the ctx */
+	list_add(&bl->list, &ctx->io_buf_ring_dead);
+	return 0;
+}
+
+static void io_free_buf_ring(struct io_ring_ctx *ctx, struct io_buffer_ring *bl)
+{
+	if (ctx->account_mem)
+		io_unaccount_mem(ctx->user, 1UL << get_order(bl->size));
+	io_mem_free(bl->br);
+	kfree(bl);
+}
+
+static int __io_destroy_buf_ring(int id, void *p, void *data)
+{
+	io_free_buf_ring(data, p);
+	return 0;
+}
+
 static void io_destroy_buffers(struct io_ring_ctx *ctx)
 {
+	struct io_buffer_ring *bl, *tmp;
+
 	idr_for_each(&ctx->io_buffer_idr, __io_destroy_buffers, ctx);
 	idr_destroy(&ctx->io_buffer_idr);
+
+	idr_for_each(&ctx->io_buf_ring_idr, __io_destroy_buf_ring, ctx);
+	idr_destroy(&ctx->io_buf_ring_idr);
+	list_for_each_entry_safe(bl, tmp, &ctx->io_buf_ring_dead, list)
+		io_free_buf_ring(ctx, bl);
 }
 
 static void io_ring_ctx_free(struct io_ring_ctx *ctx)
@@ -8383,6 +9416,8 @@ static void io_ring_ctx_wait_and_kill(struct io_ring_ctx *ctx)
 
 	io_kill_timeouts(ctx);
 	io_poll_remove_all(ctx);
+	io_futex_remove_all(ctx);
+	io_uring_cmd_cancel_all(ctx);
 
 	if (ctx->io_wq)
 		io_wq_cancel_all(ctx->io_wq);
@@ -8562,10 +9597,11 @@ static void *io_uring_validate_mmap_request(struct file *file,
 {
 	struct io_ring_ctx *ctx = file->private_data;
 	loff_t offset = pgoff << PAGE_SHIFT;
+	struct io_buffer_ring *bl;
 	struct page *page;
 	void *ptr;
 
-	switch (offset) {
+	switch (offset & IORING_OFF_MMAP_MASK) {
 	case IORING_OFF_SQ_RING:
 	case IORING_OFF_CQ_RING:
 		ptr = ctx->rings;
@@ -8573,6 +9609,21 @@ static void *io_uring_validate_mmap_request(struct file *file,
 	case IORING_OFF_SQES:
 		ptr = ctx->sq_sqes;
 		break;
+	case IORING_OFF_PBUF_RING:
+		/*
+		 * Ring memory is only freed along with the ctx, and the idr
+		 * nodes are RCU freed, so no need for ->uring_lock here.
+		 * That would also invert against mmap_sem.
+		 */
+		rcu_read_lock();
+		bl = idr_find(&ctx->io_buf_ring_idr,
+			      (offset & ~IORING_OFF_MMAP_MASK) >>
+			      IORING_OFF_PBUF_SHIFT);
+		ptr = bl ? bl->br : NULL;
+		rcu_read_unlock();
+		if (!ptr)
+			return ERR_PTR(-EINVAL);
+		break;
 	default:
 		return ERR_PTR(-EINVAL);
 	}
@@ -8671,12 +9722,33 @@ SYSCALL_DEFINE6(io_uring_enter, unsigned int, fd, u32, to_submit,
 		task_work_run();
 
 	if (flags & ~(IORING_ENTER_GETEVENTS | IORING_ENTER_SQ_WAKEUP |
-		      IORING_ENTER_EXT_ARG | IORING_ENTER_SQ_SUBMIT_ON_IDLE))
+		      IORING_ENTER_EXT_ARG | IORING_ENTER_SQ_SUBMIT_ON_IDLE |
+		      IORING_ENTER_REGISTERED_RING))
 		return -EINVAL;
 
-	f = fdget(fd);
-	if (!f.file)
-		return -EBADF;
+	/*
+	 * A registered ring is pinned by the task's table, no need to grab
+	 * another file reference. fdput() below is a nop for it.
+	 */
+	if (flags & IORING_ENTER_REGISTERED_RING) {
+		struct io_uring_task *tctx = current->io_uring;
+		struct io_ringfd_reg *reg;
+
+		if (!tctx || fd >= IO_RINGFD_REG_MAX)
+			return -EINVAL;
+		reg = &tctx->registered_rings[array_index_nospec(fd,
+							IO_RINGFD_REG_MAX)];
+		f.file = reg->file;
+		f.flags = 0;
+		if (!f.file)
+			return -EBADF;
+		/* the real fd is still needed for the io_grab_files() check */
+		fd = reg->fd;
+	} else {
+		f = fdget(fd);
+		if (!f.file)
+			return -EBADF;
+	}
 
 	ret = -EOPNOTSUPP;
 	if (f.file->f_op != &io_uring_fops)
@@ -9183,6 +10255,174 @@ static int io_unregister_personality(struct io_ring_ctx *ctx, unsigned id)
 	return -EINVAL;
 }
 
+static int io_register_iowq_max_workers(struct io_ring_ctx *ctx,
+					void __user *arg)
+{
+	__u32 new_count[2];
+	int i, ret;
+
+	if (copy_from_user(new_count, arg, sizeof(new_count)))
+		return -EFAULT;
+	for (i = 0; i < ARRAY_SIZE(new_count); i++)
+		if (new_count[i] > INT_MAX)
+			return -EINVAL;
+
+	/* shared with the rings attached through IORING_SETUP_ATTACH_WQ */
+	ret = io_wq_max_workers(ctx->io_wq, new_count);
+	if (ret)
+		return ret;
+
+	if (copy_to_user(arg, new_count, sizeof(new_count)))
+		return -EFAULT;
+	return 0;
+}
+
+static int io_ring_add_registered_fd(struct io_uring_task *tctx, int fd,
+				     int start, int end)
+{
+	struct file *file;
+	int offset;
+
+	file = fget(fd);
+	if (!file)
+		return -EBADF;
+	if (file->f_op != &io_uring_fops) {
+		fput(file);
+		return -EOPNOTSUPP;
+	}
+
+	for (offset = start; offset < end; offset++) {
+		struct io_ringfd_reg *reg;
+
+		reg = &tctx->registered_rings[array_index_nospec(offset,
+							IO_RINGFD_REG_MAX)];
+		if (reg->file)
+			continue;
+		reg->file = file;
+		reg->fd = fd;
+		return offset;
+	}
+
+	fput(file);
+	return -EBUSY;
+}
+
+/*
+ * Register ring fds in the per-task table, io_uring_enter() can then be
+ * passed the table offset with IORING_ENTER_REGISTERED_RING and skip the
+ * fdget/fdput of the ring file. The table is private to the task, it is
+ * dropped when the task exits or execs.
+ */
+static int io_ringfd_register(struct io_ring_ctx *ctx, void __user *__arg,
+			      unsigned nr_args)
+{
+	struct io_uring_rsrc_update __user *arg = __arg;
+	struct io_uring_rsrc_update reg;
+	struct io_uring_task *tctx;
+	int ret = 0;
+	unsigned i;
+
+	if (!nr_args || nr_args > IO_RINGFD_REG_MAX)
+		return -EINVAL;
+
+	tctx = current->io_uring;
+	if (!tctx) {
+		tctx = kzalloc(sizeof(*tctx), GFP_KERNEL);
+		if (!tctx)
+			return -ENOMEM;
+		current->io_uring = tctx;
+	}
+
+	for (i = 0; i < nr_args; i++) {
+		int start, end;
+
+		if (copy_from_user(&reg, &arg[i], sizeof(reg))) {
+			ret = -EFAULT;
+			break;
+		}
+		if (reg.resv) {
+			ret = -EINVAL;
+			break;
+		}
+
+		if (reg.offset == -1U) {
+			start = 0;
+			end = IO_RINGFD_REG_MAX;
+		} else {
+			if (reg.offset >= IO_RINGFD_REG_MAX) {
+				ret = -EINVAL;
+				break;
+			}
+			start = reg.offset;
+			end = start + 1;
+		}
+
+		ret = io_ring_add_registered_fd(tctx, reg.data, start, end);
+		if (ret < 0)
+			break;
+
+		reg.offset = ret;
+		if (copy_to_user(&arg[i], &reg, sizeof(reg))) {
+			fput(tctx->registered_rings[reg.offset].file);
+			tctx->registered_rings[reg.offset].file = NULL;
+			ret = -EFAULT;
+			break;
+		}
+	}
+
+	return i ? i : ret;
+}
+
+static int io_ringfd_unregister(struct io_ring_ctx *ctx, void __user *__arg,
+				unsigned nr_args)
+{
+	struct io_uring_rsrc_update __user *arg = __arg;
+	struct io_uring_task *tctx = current->io_uring;
+	struct io_uring_rsrc_update reg;
+	int ret = 0;
+	unsigned i;
+
+	if (!nr_args || nr_args > IO_RINGFD_REG_MAX)
+		return -EINVAL;
+	if (!tctx)
+		return 0;
+
+	for (i = 0; i < nr_args; i++) {
+		struct io_ringfd_reg *ringfd;
+
+		if (copy_from_user(&reg, &arg[i], sizeof(reg))) {
+			ret = -EFAULT;
+			break;
+		}
+		if (reg.resv || reg.data || reg.offset >= IO_RINGFD_REG_MAX) {
+			ret = -EINVAL;
+			break;
+		}
+
+		ringfd = &tctx->registered_rings[array_index_nospec(reg.offset,
+							IO_RINGFD_REG_MAX)];
+		if (ringfd->file) {
+			fput(ringfd->file);
+			ringfd->file = NULL;
+		}
+	}
+
+	return i ? i : ret;
+}
+
+void __io_uring_free(struct task_struct *tsk)
+{
+	struct io_uring_task *tctx = tsk->io_uring;
+	int i;
+
+	for (i = 0; i < IO_RINGFD_REG_MAX; i++) {
+		if (tctx->registered_rings[i].file)
+			fput(tctx->registered_rings[i].file);
+	}
+	tsk->io_uring = NULL;
+	kfree(tctx);
+}
+
 static bool io_register_op_must_quiesce(int op)
 {
 	switch (op) {
@@ -9191,6 +10431,11 @@ static bool io_register_op_must_quiesce(int op)
 	case IORING_REGISTER_PROBE:
 	case IORING_REGISTER_PERSONALITY:
 	case IORING_UNREGISTER_PERSONALITY:
+	case IORING_REGISTER_PBUF_RING:
+	case IORING_UNREGISTER_PBUF_RING:
+	case IORING_REGISTER_RING_FDS:
+	case IORING_UNREGISTER_RING_FDS:
+	case IORING_REGISTER_IOWQ_MAX_WORKERS:
 		return false;
 	default:
 		return true;
@@ -9292,6 +10537,30 @@ static int __io_uring_register(struct io_ring_ctx *ctx, unsigned opcode,
 			break;
 		ret = io_unregister_personality(ctx, nr_args);
 		break;
+	case IORING_REGISTER_PBUF_RING:
+		ret = -EINVAL;
+		if (!arg || nr_args != 1)
+			break;
+		ret = io_register_pbuf_ring(ctx, arg);
+		break;
+	case IORING_UNREGISTER_PBUF_RING:
+		ret = -EINVAL;
+		if (!arg || nr_args != 1)
+			break;
+		ret = io_unregister_pbuf_ring(ctx, arg);
+		break;
+	case IORING_REGISTER_RING_FDS:
+		ret = io_ringfd_register(ctx, arg, nr_args);
+		break;
+	case IORING_REGISTER_IOWQ_MAX_WORKERS:
+		ret = -EINVAL;
+		if (!arg || nr_args != 2)
+			break;
+		ret = io_register_iowq_max_workers(ctx, arg);
+		break;
+	case IORING_UNREGISTER_RING_FDS:
+		ret = io_ringfd_unregister(ctx, arg, nr_args);
+		break;
 	default:
 		ret = -EINVAL;
 		break;
@@ -9351,6 +10620,7 @@ static int __init io_uring_init(void)
 	BUILD_BUG_SQE_ELEM(4,  __s32,  fd);
 	BUILD_BUG_SQE_ELEM(8,  __u64,  off);
 	BUILD_BUG_SQE_ELEM(8,  __u64,  addr2);
+	BUILD_BUG_SQE_ELEM(8,  __u32,  cmd_op);
 	BUILD_BUG_SQE_ELEM(16, __u64,  addr);
 	BUILD_BUG_SQE_ELEM(16, __u64,  splice_off_in);
 	BUILD_BUG_SQE_ELEM(24, __u32,  len);
@@ -9374,12 +10644,16 @@ static int __init io_uring_init(void)
 	BUILD_BUG_SQE_ELEM(42, __u16,  personality);
 	BUILD_BUG_SQE_ELEM(44, __s32,  splice_fd_in);
 
+	BUILD_BUG_ON(offsetof(struct io_uring_buf_ring, bufs) != 0);
+	BUILD_BUG_ON(offsetof(struct io_uring_buf, resv) !=
+		     offsetof(struct io_uring_buf_ring, tail));
+
 	BUILD_BUG_ON(ARRAY_SIZE(io_op_defs) != IORING_OP_LAST);
 	BUILD_BUG_ON(__REQ_F_LAST_BIT >= 8 * sizeof(int));
 	req_cachep = KMEM_CACHE(io_kiocb, SLAB_HWCACHE_ALIGN | SLAB_PANIC);
 
 
-	percpu_threads = alloc_percpu(struct sq_thread_percpu);
+	percpu_threads = alloc_percpu(struct io_sq_data);
 	/*
 	 * Don't take this as fatal error, if this happens, we will just
 	 * make io sq thread not go through io_sq_thread percpu version.
@@ -9388,9 +10662,10 @@ static int __init io_uring_init(void)
 		return 0;
 
 	for_each_possible_cpu(cpu) {
-		struct sq_thread_percpu *t;
+		struct io_sq_data *t;
 
 		t = per_cpu_ptr(percpu_threads, cpu);
+		t->percpu = true;
 		INIT_LIST_HEAD(&t->ctx_list);
 		INIT_LIST_HEAD(&t->ctx_new_list);
 		init_waitqueue_head(&t->sqo_wait);
@@ -643,7 +643,7 @@ iomap_read_page_sync(struct inode *inode, loff_t block_start, struct page *page,
 
 static int
 __iomap_write_begin(struct inode *inode, loff_t pos, unsigned len,
-		struct page *page, struct iomap *srcmap)
+		unsigned flags, struct page *page, struct iomap *srcmap)
 {
 	struct iomap_page *iop = iomap_page_create(inode, page);
 	loff_t block_size = i_blocksize(inode);
@@ -663,6 +663,13 @@ __iomap_write_begin(struct inode *inode, loff_t pos, unsigned len,
 
 		if ((from > poff && from < poff + plen) ||
 		    (to > poff && to < poff + plen)) {
+			/* Only zeroing the block does not block */
+			if ((flags & AOP_FLAG_NOWAIT) &&
+			    srcmap->type == IOMAP_MAPPED &&
+			    block_start < i_size_read(inode)) {
+				status = -EAGAIN;
+				break;
+			}
 			status = iomap_read_page_sync(inode, block_start, page,
 					poff, plen, from, to, srcmap);
 			if (status)
@@ -691,14 +698,18 @@ iomap_write_begin(struct inode *inode, loff_t pos, unsigned len, unsigned flags,
 
 	page = grab_cache_page_write_begin(inode->i_mapping, index, flags);
 	if (!page)
-		return -ENOMEM;
+		return (flags & AOP_FLAG_NOWAIT) ? -EAGAIN : -ENOMEM;
 
 	if (srcmap->type == IOMAP_INLINE)
 		iomap_read_inline_data(inode, page, srcmap);
+	else if ((flags & AOP_FLAG_NOWAIT) && !PageUptodate(page) &&
+		 (iomap->flags & IOMAP_F_BUFFER_HEAD))
+		status = -EAGAIN;
 	else if (iomap->flags & IOMAP_F_BUFFER_HEAD)
 		status = __block_write_begin_int(page, pos, len, NULL, srcmap);
 	else
-		status = __iomap_write_begin(inode, pos, len, page, srcmap);
+		status = __iomap_write_begin(inode, pos, len, flags, page,
+				srcmap);
 	if (unlikely(status)) {
 		unlock_page(page);
 		put_page(page);
@@ -805,14 +816,21 @@ iomap_write_end(struct inode *inode, loff_t pos, unsigned len, unsigned copied,
 	return ret;
 }
 
+struct iomap_write_ctx {
+	struct iov_iter		*iter;
+	unsigned int		aop_flags;
+};
+
 static loff_t
 iomap_write_actor(struct inode *inode, loff_t pos, loff_t length, void *data,
 		struct iomap *iomap, struct iomap *srcmap)
 {
-	struct iov_iter *i = data;
+	struct iomap_write_ctx *ctx = data;
+	struct iov_iter *i = ctx->iter;
 	long status = 0;
 	ssize_t written = 0;
-	unsigned int flags = AOP_FLAG_NOFS;
+	unsigned int flags = ctx->aop_flags;
+	bool nowait = flags & AOP_FLAG_NOWAIT;
 
 	do {
 		struct page *page;
@@ -842,6 +860,14 @@ iomap_write_actor(struct inode *inode, loff_t pos, loff_t length, void *data,
 			break;
 		}
 
+		/* Without waiting, only dirty pages while not throttled */
+		if (nowait) {
+			status = balance_dirty_pages_ratelimited_flags(
+					inode->i_mapping, BDP_ASYNC);
+			if (unlikely(status))
+				break;
+		}
+
 		status = iomap_write_begin(inode, pos, bytes, flags, &page,
 				iomap, srcmap);
 		if (unlikely(status))
@@ -880,22 +906,38 @@ iomap_write_actor(struct inode *inode, loff_t pos, loff_t length, void *data,
 		written += copied;
 		length -= copied;
 
-		balance_dirty_pages_ratelimited(inode->i_mapping);
+		if (!nowait)
+			balance_dirty_pages_ratelimited(inode->i_mapping);
 	} while (iov_iter_count(i) && length);
 
 	return written ? written : status;
 }
 
+/*
+ * For an IOCB_NOWAIT write, neither the filesystem mapping nor the page
+ * cache may block: -EAGAIN is returned when they would, or a short count
+ * when some of the data was already written.
+ */
 ssize_t
 iomap_file_buffered_write(struct kiocb *iocb, struct iov_iter *iter,
 		const struct iomap_ops *ops)
 {
 	struct inode *inode = iocb->ki_filp->f_mapping->host;
 	loff_t pos = iocb->ki_pos, ret = 0, written = 0;
+	struct iomap_write_ctx ctx = {
+		.iter		= iter,
+		.aop_flags	= AOP_FLAG_NOFS,
+	};
+	unsigned int flags = IOMAP_WRITE;
+
+	if (iocb->ki_flags & IOCB_NOWAIT) {
+		ctx.aop_flags |= AOP_FLAG_NOWAIT;
+		flags |= IOMAP_NOWAIT;
+	}
 
 	while (iov_iter_count(iter)) {
 		ret = iomap_apply(inode, pos, iov_iter_count(iter),
-				IOMAP_WRITE, ops, iter, iomap_write_actor);
+				flags, ops, &ctx, iomap_write_actor);
 		if (ret <= 0)
 			break;
 		pos += ret;
@@ -1707,7 +1749,7 @@ iomap_dio_bio_actor(struct inode *inode, loff_t pos, loff_t length,
 			return 0;
 		}
 
-		bio = bio_alloc(GFP_KERNEL, nr_pages);
+		bio = bio_alloc_kiocb(dio->iocb, nr_pages, &fs_bio_set);
 		bio_set_dev(bio, iomap->bdev);
 		bio->bi_iter.bi_sector = iomap_sector(iomap, pos);
 		bio->bi_write_hint = dio->iocb->ki_hint;
@@ -183,6 +183,23 @@ void __jbd2_log_wait_for_space(journal_t *journal)
 	}
 }
 
+/*
+ * With JBD2_ASYNC_CHECKPOINT the checkpoint thread is kicked as soon as less
+ * than half of the log is free, so that space is reclaimed in the
+ * background before __jbd2_log_wait_for_space() has to stall handles for
+ * it.
+ *
+ * Called with j_state_lock held.
+ */
+bool jbd2_log_need_bg_checkpoint(journal_t *journal)
+{
+	return (journal->j_flags & JBD2_ASYNC_CHECKPOINT) &&
+	       !(journal->j_flags & (JBD2_ABORT | JBD2_UNMOUNT)) &&
+	       READ_ONCE(journal->j_checkpoint_transactions) &&
+	       jbd2_log_space_left(journal) <
+	       (journal->j_last - journal->j_first) / 2;
+}
+
 static void
 __flush_batch(journal_t *journal, int *batch_count)
 {
@@ -375,6 +375,7 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 	struct buffer_head *cbh = NULL; /* For transactional checksums */
 	__u32 crc32_sum = ~0;
 	struct blk_plug plug;
+	bool bg_checkpoint;
 	/* Tail of the journal */
 	unsigned long first_block;
 	tid_t first_tid;
@@ -420,6 +421,18 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 			commit_transaction->t_tid);
 
 	write_lock(&journal->j_state_lock);
+	/* Let a running fast commit finish, no new one starts until we end */
+	journal->j_flags |= JBD2_FULL_COMMIT_ONGOING;
+	while (journal->j_flags & JBD2_FAST_COMMIT_ONGOING) {
+		DEFINE_WAIT(wait);
+
+		prepare_to_wait(&journal->j_fc_wait, &wait,
+				TASK_UNINTERRUPTIBLE);
+		write_unlock(&journal->j_state_lock);
+		schedule();
+		write_lock(&journal->j_state_lock);
+		finish_wait(&journal->j_fc_wait, &wait);
+	}
 	J_ASSERT(commit_transaction->t_state == T_RUNNING);
 	commit_transaction->t_state = T_LOCKED;
 	WRITE_ONCE(commit_transaction->t_locked_time, jiffies);
@@ -1125,8 +1138,15 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 		jbd2_journal_free_transaction(commit_transaction);
 	}
 	spin_unlock(&journal->j_list_lock);
+	/* The fast commits of this transaction are in the log now */
+	jbd2_fc_release_bufs(journal);
+	journal->j_flags &= ~JBD2_FULL_COMMIT_ONGOING;
+	bg_checkpoint = jbd2_log_need_bg_checkpoint(journal);
 	write_unlock(&journal->j_state_lock);
 	wake_up(&journal->j_wait_done_commit);
+	wake_up(&journal->j_fc_wait);
+	if (bg_checkpoint)
+		wake_up(&journal->j_wait_checkpoint);
 
 	/*
 	 * Calculate overall stats
@@ -298,6 +298,7 @@ static int jbd2_checkpoint_thread(void *arg)
 {
 	journal_t *journal = arg;
 	DEFINE_WAIT(wait);
+	bool more;
 	jbd_debug(1, "jbd2_checkpoint_thread\n");
 	journal->j_checkpoint_task = current;
 
@@ -313,6 +314,19 @@ static int jbd2_checkpoint_thread(void *arg)
 
 	mutex_lock(&journal->j_checkpoint_mutex);
 	jbd2_log_do_checkpoint(journal);
+	/* In the background, go on until half of the log is free again */
+	for (;;) {
+		read_lock(&journal->j_state_lock);
+		more = jbd2_log_need_bg_checkpoint(journal);
+		read_unlock(&journal->j_state_lock);
+		if (!more || jbd2_log_do_checkpoint(journal) < 0)
+			break;
+		/* Let handles waiting for space see the progress */
+		wake_up_all(&journal->j_wait_done_checkpoint);
+		cond_resched();
+	}
+	if (journal->j_flags & JBD2_ASYNC_CHECKPOINT)
+		jbd2_cleanup_journal_tail(journal);
 	mutex_unlock(&journal->j_checkpoint_mutex);
 
 	goto loop;
@@ -839,6 +853,126 @@ int jbd2_complete_transaction(journal_t *journal, tid_t tid)
 }
 EXPORT_SYMBOL(jbd2_complete_transaction);
 
+/*
+ * Fast commit support:
+ *
+ * A fast commit writes filesystem specific records for the running
+ * transaction into the fast commit area instead of committing it.  It runs
+ * with updates locked, so the records see a stable filesystem, and never
+ * together with a full commit, which throws the fast commit area away once
+ * the transaction it covers is in the log.
+ */
+
+/*
+ * Start a fast commit of the running transaction @tid.  Returns -EALREADY
+ * if @tid was or is being committed in full, the caller should check the
+ * state of @tid again.  Any other error means that no fast commit can be
+ * done now and the caller has to fall back to a full commit.
+ */
+int jbd2_fc_begin_commit(journal_t *journal, tid_t tid)
+{
+	if (unlikely(is_journal_aborted(journal)))
+		return -EIO;
+
+	write_lock(&journal->j_state_lock);
+	if (tid_geq(journal->j_commit_sequence, tid)) {
+		write_unlock(&journal->j_state_lock);
+		return -EALREADY;
+	}
+
+	if (journal->j_flags & (JBD2_FULL_COMMIT_ONGOING |
+				JBD2_FAST_COMMIT_ONGOING)) {
+		DEFINE_WAIT(wait);
+
+		prepare_to_wait(&journal->j_fc_wait, &wait,
+				TASK_UNINTERRUPTIBLE);
+		write_unlock(&journal->j_state_lock);
+		schedule();
+		finish_wait(&journal->j_fc_wait, &wait);
+		return -EALREADY;
+	}
+
+	/*
+	 * Recovery only looks at the fast commit area once the on-disk
+	 * superblock knows about it, which it does after the first commit.
+	 */
+	if (!journal->j_fc_wbuf || (journal->j_flags & JBD2_FLUSHED) ||
+	    !journal->j_running_transaction ||
+	    journal->j_running_transaction->t_tid != tid) {
+		write_unlock(&journal->j_state_lock);
+		return -EINVAL;
+	}
+	journal->j_flags |= JBD2_FAST_COMMIT_ONGOING;
+	write_unlock(&journal->j_state_lock);
+
+	jbd2_journal_lock_updates(journal);
+	return 0;
+}
+EXPORT_SYMBOL(jbd2_fc_begin_commit);
+
+static void __jbd2_fc_end_commit(journal_t *journal, bool fallback)
+{
+	jbd2_journal_unlock_updates(journal);
+
+	write_lock(&journal->j_state_lock);
+	journal->j_flags &= ~JBD2_FAST_COMMIT_ONGOING;
+	/* Nothing after a failed fast commit can be replayed */
+	if (fallback)
+		journal->j_flags |= JBD2_FULL_COMMIT_ONGOING;
+	write_unlock(&journal->j_state_lock);
+	wake_up(&journal->j_fc_wait);
+}
+
+void jbd2_fc_end_commit(journal_t *journal)
+{
+	__jbd2_fc_end_commit(journal, false);
+}
+EXPORT_SYMBOL(jbd2_fc_end_commit);
+
+/* End a failed fast commit and commit transaction @tid in full instead */
+int jbd2_fc_end_commit_fallback(journal_t *journal, tid_t tid)
+{
+	__jbd2_fc_end_commit(journal, true);
+	return jbd2_complete_transaction(journal, tid);
+}
+EXPORT_SYMBOL(jbd2_fc_end_commit_fallback);
+
+/*
+ * Get the next block of the fast commit area, the journal keeps a reference
+ * to it until the area is reset.  Returns -ENOSPC when the area is full.
+ */
+int jbd2_fc_get_buf(journal_t *journal, struct buffer_head **bh_out)
+{
+	unsigned long long pblock;
+	struct buffer_head *bh;
+	unsigned long blocknr;
+	int ret;
+
+	blocknr = journal->j_fc_first + journal->j_fc_off;
+	if (blocknr >= journal->j_fc_last)
+		return -ENOSPC;
+
+	ret = jbd2_journal_bmap(journal, blocknr, &pblock);
+	if (ret)
+		return ret;
+
+	bh = __getblk(journal->j_dev, pblock, journal->j_blocksize);
+	if (!bh)
+		return -ENOMEM;
+
+	journal->j_fc_wbuf[journal->j_fc_off++] = bh;
+	*bh_out = bh;
+	return 0;
+}
+EXPORT_SYMBOL(jbd2_fc_get_buf);
+
+/* Forget the fast commit area, its records are stale after a full commit */
+void jbd2_fc_release_bufs(journal_t *journal)
+{
+	while (journal->j_fc_off)
+		brelse(journal->j_fc_wbuf[--journal->j_fc_off]);
+}
+
 /*
  * Log buffer allocation routines:
  */
@@ -1406,6 +1540,7 @@ static journal_t *journal_init_common(struct block_device *bdev,
 	init_waitqueue_head(&journal->j_wait_commit);
 	init_waitqueue_head(&journal->j_wait_updates);
 	init_waitqueue_head(&journal->j_wait_reserved);
+	init_waitqueue_head(&journal->j_fc_wait);
 	mutex_init(&journal->j_barrier);
 	mutex_init(&journal->j_checkpoint_mutex);
 	spin_lock_init(&journal->j_revoke_lock);
@@ -1567,7 +1702,7 @@ static int journal_reset(journal_t *journal)
 	unsigned long long first, last;
 
 	first = be32_to_cpu(sb->s_first);
-	last = be32_to_cpu(sb->s_maxlen);
+	last = journal->j_fc_first;
 	if (first + JBD2_MIN_JOURNAL_BLOCKS > last + 1) {
 		printk(KERN_ERR "JBD2: Journal too short (blocks %llu-%llu).\n",
 		       first, last);
@@ -1891,6 +2026,69 @@ static int journal_get_superblock(journal_t *journal)
  * journal_t.
  */
 
+static unsigned long jbd2_journal_num_fc_blks(journal_superblock_t *sb)
+{
+	unsigned long num_fc_blks = be32_to_cpu(sb->s_num_fc_blks);
+
+	return num_fc_blks ? num_fc_blks : JBD2_DEFAULT_FAST_COMMIT_BLOCKS;
+}
+
+/* Check that the fast commit area fits and allocate its buffer array */
+static int jbd2_journal_init_fc(journal_t *journal)
+{
+	unsigned long num_fc_blks =
+		jbd2_journal_num_fc_blks(journal->j_superblock);
+
+	if (journal->j_first + JBD2_MIN_JOURNAL_BLOCKS + num_fc_blks >
+	    journal->j_fc_last + 1) {
+		printk(KERN_ERR "JBD2: Journal too short for %lu fast commit "
+		       "blocks.\n", num_fc_blks);
+		return -EINVAL;
+	}
+
+	if (!journal->j_fc_wbuf) {
+		journal->j_fc_wbuf = kcalloc(num_fc_blks,
+					     sizeof(struct buffer_head *),
+					     GFP_KERNEL);
+		if (!journal->j_fc_wbuf)
+			return -ENOMEM;
+	}
+	return 0;
+}
+
+/*
+ * Turn on fast commits on a loaded journal.  The fast commit area is taken
+ * from the end of the log, so the log has to be empty.
+ */
+static int jbd2_journal_enable_fc(journal_t *journal)
+{
+	journal_superblock_t *sb = journal->j_superblock;
+	unsigned long num_fc_blks = jbd2_journal_num_fc_blks(sb);
+	int err;
+
+	err = jbd2_journal_init_fc(journal);
+	if (err)
+		return err;
+
+	write_lock(&journal->j_state_lock);
+	if (journal->j_running_transaction ||
+	    journal->j_committing_transaction ||
+	    journal->j_head != journal->j_first ||
+	    journal->j_tail != journal->j_first) {
+		write_unlock(&journal->j_state_lock);
+		return -EBUSY;
+	}
+	journal->j_fc_first = journal->j_fc_last - num_fc_blks;
+	journal->j_last = journal->j_fc_first;
+	journal->j_free = journal->j_last - journal->j_first;
+	sb->s_num_fc_blks = cpu_to_be32(num_fc_blks);
+	/* No fast commit until the next commit wrote the superblock */
+	journal->j_flags |= JBD2_FLUSHED;
+	write_unlock(&journal->j_state_lock);
+
+	return 0;
+}
+
 static int load_superblock(journal_t *journal)
 {
 	int err;
@@ -1905,9 +2103,20 @@ static int load_superblock(journal_t *journal)
 	journal->j_tail_sequence = be32_to_cpu(sb->s_sequence);
 	journal->j_tail = be32_to_cpu(sb->s_start);
 	journal->j_first = be32_to_cpu(sb->s_first);
-	journal->j_last = be32_to_cpu(sb->s_maxlen);
 	journal->j_errno = be32_to_cpu(sb->s_errno);
 
+	/* The fast commit area is at the end and not part of the log */
+	journal->j_fc_last = be32_to_cpu(sb->s_maxlen);
+	journal->j_fc_first = journal->j_fc_last;
+	if (jbd2_has_feature_fast_commit(journal)) {
+		err = jbd2_journal_init_fc(journal);
+		if (err)
+			return err;
+		journal->j_fc_first = journal->j_fc_last -
+			jbd2_journal_num_fc_blks(sb);
+	}
+	journal->j_last = journal->j_fc_first;
+
 	return 0;
 }
 
@@ -2047,6 +2256,10 @@ int jbd2_journal_destroy(journal_t *journal)
 		jbd2_journal_destroy_revoke(journal);
 	if (journal->j_chksum_driver)
 		crypto_free_shash(journal->j_chksum_driver);
+	if (journal->j_fc_wbuf) {
+		jbd2_fc_release_bufs(journal);
+		kfree(journal->j_fc_wbuf);
+	}
 	kfree(journal->j_wbuf);
 	kfree(journal);
 
@@ -2164,6 +2377,10 @@ int jbd2_journal_set_features (journal_t *journal, unsigned long compat,
 
 	sb = journal->j_superblock;
 
+	if (INCOMPAT_FEATURE_ON(JBD2_FEATURE_INCOMPAT_FAST_COMMIT) &&
+	    (journal->j_flags & JBD2_LOADED) && jbd2_journal_enable_fc(journal))
+		return 0;
+
 	/* Load the checksum driver if necessary */
 	if ((journal->j_chksum_driver == NULL) &&
 	    INCOMPAT_FEATURE_ON(JBD2_FEATURE_INCOMPAT_CSUM_V3)) {
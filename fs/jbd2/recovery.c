@@ -35,7 +35,6 @@ struct recovery_info
 	int		nr_revoke_hits;
 };
 
-enum passtype {PASS_SCAN, PASS_REVOKE, PASS_REPLAY};
 static int do_one_pass(journal_t *journal,
 				struct recovery_info *info, enum passtype pass);
 static int scan_revoke_records(journal_t *, struct buffer_head *,
@@ -229,6 +228,38 @@ do {									\
 		var -= ((journal)->j_last - (journal)->j_first);	\
 } while (0)
 
+/*
+ * Hand the fast commit blocks to the filesystem, once to find out how many
+ * of them hold valid records for @expected_tid and then to replay those.
+ */
+static int fc_do_one_pass(journal_t *journal, tid_t expected_tid)
+{
+	unsigned long nr_blocks = journal->j_fc_last - journal->j_fc_first;
+	enum passtype pass = PASS_SCAN;
+	struct buffer_head *bh;
+	unsigned long i;
+	int err;
+
+again:
+	for (i = 0, err = 0; i < nr_blocks; i++) {
+		err = jread(&bh, journal, journal->j_fc_first + i);
+		if (err)
+			return err;
+		err = journal->j_fc_replay_callback(journal, bh, pass, i,
+						    expected_tid);
+		brelse(bh);
+		if (err)
+			break;
+	}
+	if (err < 0)
+		return err;
+	if (pass == PASS_SCAN) {
+		pass = PASS_REPLAY;
+		goto again;
+	}
+	return 0;
+}
+
 /**
  * jbd2_journal_recover - recovers a on-disk journal
  * @journal: the journal to recover
@@ -269,6 +300,9 @@ int jbd2_journal_recover(journal_t *journal)
 		err = do_one_pass(journal, &info, PASS_REVOKE);
 	if (!err)
 		err = do_one_pass(journal, &info, PASS_REPLAY);
+	if (!err && jbd2_has_feature_fast_commit(journal) &&
+	    journal->j_fc_replay_callback)
+		err = fc_do_one_pass(journal, info.end_transaction);
 
 	jbd_debug(1, "JBD2: recovery, exit status %d, "
 		  "recovered transactions %u to %u\n",
@@ -19,6 +19,12 @@ struct mnt_namespace {
 	unsigned int		pending_mounts;
 } __randomize_layout;
 
+/* holds a detached mount tree made by open_tree(2), seq is 0 for these */
+static inline bool is_anon_ns(struct mnt_namespace *ns)
+{
+	return ns->seq == 0;
+}
+
 struct mnt_pcp {
 	int mnt_count;
 	int mnt_writers;
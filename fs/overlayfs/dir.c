@@ -1254,5 +1254,6 @@ const struct inode_operations ovl_dir_inode_operations = {
 	.getattr	= ovl_getattr,
 	.listxattr	= ovl_listxattr,
 	.get_acl	= ovl_get_acl,
+	.get_acl_rcu	= ovl_get_acl_rcu,
 	.update_time	= ovl_update_time,
 };
@@ -23,6 +23,12 @@ struct ovl_aio_req {
 
 static struct kmem_cache *ovl_aio_request_cachep;
 
+struct ovl_file {
+	struct file *realfile;
+	/* opened on the first write of a file which was opened in lower */
+	struct file *upperfile;
+};
+
 static char ovl_whatisit(struct inode *inode, struct inode *realinode)
 {
 	if (realinode != ovl_inode_upper(inode))
@@ -43,10 +49,15 @@ static struct file *ovl_open_realfile(const struct file *file,
 	struct file *realfile;
 	const struct cred *old_cred;
 	int flags = file->f_flags | OVL_OPEN_FLAGS;
-	int acc_mode = ACC_MODE(flags);
+	int acc_mode;
 	int err;
 
-	if (flags & O_APPEND)
+	/* Lower is never written, a write open got there by ovl_open() */
+	if (realinode != ovl_inode_upper(inode))
+		flags &= ~O_ACCMODE;
+
+	acc_mode = ACC_MODE(flags);
+	if ((flags & O_APPEND) && (OPEN_FMODE(flags) & FMODE_WRITE))
 		acc_mode |= MAY_APPEND;
 
 	old_cred = ovl_override_creds(inode->i_sb);
@@ -104,10 +115,12 @@ static int ovl_real_fdget_meta(const struct file *file, struct fd *real,
 			       bool allow_meta)
 {
 	struct inode *inode = file_inode(file);
+	struct ovl_file *of = file->private_data;
 	struct inode *realinode;
+	struct file *upperfile;
 
 	real->flags = 0;
-	real->file = file->private_data;
+	real->file = of->realfile;
 
 	if (allow_meta)
 		realinode = ovl_inode_real(inode);
@@ -116,14 +129,20 @@ static int ovl_real_fdget_meta(const struct file *file, struct fd *real,
 
 	/* Has it been copied up since we'd opened it? */
 	if (unlikely(file_inode(real->file) != realinode)) {
-		real->flags = FDPUT_FPUT;
-		real->file = ovl_open_realfile(file, realinode);
-
-		return PTR_ERR_OR_ZERO(real->file);
+		upperfile = READ_ONCE(of->upperfile);
+		if (upperfile && file_inode(upperfile) == realinode) {
+			real->file = upperfile;
+		} else {
+			real->flags = FDPUT_FPUT;
+			real->file = ovl_open_realfile(file, realinode);
+
+			return PTR_ERR_OR_ZERO(real->file);
+		}
 	}
 
 	/* Did the flags change since open? */
-	if (unlikely((file->f_flags ^ real->file->f_flags) & ~OVL_OPEN_FLAGS))
+	if (unlikely((file->f_flags ^ real->file->f_flags) &
+		     ~(OVL_OPEN_FLAGS | O_ACCMODE)))
 		return ovl_change_flags(real->file, file->f_flags);
 
 	return 0;
@@ -134,30 +153,85 @@ static int ovl_real_fdget(const struct file *file, struct fd *real)
 	return ovl_real_fdget_meta(file, real, false);
 }
 
+/*
+ * With metacopy, a write open does not copy up: reads keep going to lower,
+ * sharing its page cache, until the first write copies the file up.
+ */
+static bool ovl_lazy_copy_up(struct file *file)
+{
+	struct ovl_fs *ofs = OVL_FS(file_inode(file)->i_sb);
+
+	return ofs->config.metacopy && !(file->f_flags & O_TRUNC);
+}
+
+/* Copy up a file opened in lower, before the first change to its data */
+static int ovl_copy_up_for_write(struct file *file)
+{
+	struct inode *inode = file_inode(file);
+	struct ovl_file *of = file->private_data;
+	struct file *upperfile;
+	int err;
+
+	if (likely(READ_ONCE(of->upperfile) ||
+		   file_inode(of->realfile) == ovl_inode_upper(inode)))
+		return 0;
+
+	err = ovl_maybe_copy_up(file_dentry(file), O_WRONLY);
+	if (err)
+		return err;
+
+	upperfile = ovl_open_realfile(file, ovl_inode_upper(inode));
+	if (IS_ERR(upperfile))
+		return PTR_ERR(upperfile);
+
+	/* Raced with another writer of this file */
+	if (cmpxchg(&of->upperfile, NULL, upperfile))
+		fput(upperfile);
+
+	return 0;
+}
+
 static int ovl_open(struct inode *inode, struct file *file)
 {
+	struct ovl_file *of;
 	struct file *realfile;
+	int flags = file->f_flags;
 	int err;
 
-	err = ovl_maybe_copy_up(file_dentry(file), file->f_flags);
+	if (ovl_lazy_copy_up(file))
+		flags &= ~O_ACCMODE;
+
+	err = ovl_maybe_copy_up(file_dentry(file), flags);
 	if (err)
 		return err;
 
+	of = kzalloc(sizeof(*of), GFP_KERNEL);
+	if (!of)
+		return -ENOMEM;
+
 	/* No longer need these flags, so don't pass them on to underlying fs */
 	file->f_flags &= ~(O_CREAT | O_EXCL | O_NOCTTY | O_TRUNC);
 
 	realfile = ovl_open_realfile(file, ovl_inode_realdata(inode));
-	if (IS_ERR(realfile))
+	if (IS_ERR(realfile)) {
+		kfree(of);
 		return PTR_ERR(realfile);
+	}
 
-	file->private_data = realfile;
+	of->realfile = realfile;
+	file->private_data = of;
 
 	return 0;
 }
 
 static int ovl_release(struct inode *inode, struct file *file)
 {
-	fput(file->private_data);
+	struct ovl_file *of = file->private_data;
+
+	fput(of->realfile);
+	if (of->upperfile)
+		fput(of->upperfile);
+	kfree(of);
 
 	return 0;
 }
@@ -340,6 +414,10 @@ static ssize_t ovl_write_iter(struct kiocb *iocb, struct iov_iter *iter)
 	if (!iov_iter_count(iter))
 		return 0;
 
+	ret = ovl_copy_up_for_write(file);
+	if (ret)
+		return ret;
+
 	inode_lock(inode);
 	/* Update mode */
 	ovl_copyattr(ovl_inode_real(inode), inode);
@@ -424,10 +502,20 @@ static int ovl_fsync(struct file *file, loff_t start, loff_t end, int datasync)
 
 static int ovl_mmap(struct file *file, struct vm_area_struct *vma)
 {
-	struct file *realfile = file->private_data;
+	struct ovl_file *of = file->private_data;
+	struct file *realfile;
 	const struct cred *old_cred;
 	int ret;
 
+	/* A shared mapping may be made writable later on */
+	if ((vma->vm_flags & (VM_SHARED | VM_MAYWRITE)) ==
+	    (VM_SHARED | VM_MAYWRITE)) {
+		ret = ovl_copy_up_for_write(file);
+		if (ret)
+			return ret;
+	}
+
+	realfile = READ_ONCE(of->upperfile) ?: of->realfile;
 	if (!realfile->f_op->mmap)
 		return -ENODEV;
 
@@ -460,6 +548,10 @@ static long ovl_fallocate(struct file *file, int mode, loff_t offset, loff_t len
 	const struct cred *old_cred;
 	int ret;
 
+	ret = ovl_copy_up_for_write(file);
+	if (ret)
+		return ret;
+
 	ret = ovl_real_fdget(file, &real);
 	if (ret)
 		return ret;
@@ -670,6 +762,12 @@ static ssize_t ovl_copyfile(struct file *file_in, loff_t pos_in,
 	const struct cred *old_cred;
 	ssize_t ret;
 
+	if (op != OVL_DEDUPE) {
+		ret = ovl_copy_up_for_write(file_out);
+		if (ret)
+			return ret;
+	}
+
 	ret = ovl_real_fdget(file_out, &real_out);
 	if (ret)
 		return ret;
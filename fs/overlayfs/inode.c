@@ -455,6 +455,20 @@ struct posix_acl *ovl_get_acl(struct inode *inode, int type)
 	return acl;
 }
 
+/*
+ * Overlay inodes don't cache ACLs, but whatever the real inode has cached
+ * is good enough for permission checks in RCU walk mode.
+ */
+struct posix_acl *ovl_get_acl_rcu(struct inode *inode, int type)
+{
+	struct inode *realinode = ovl_inode_real(inode);
+
+	if (!IS_ENABLED(CONFIG_FS_POSIX_ACL) || !IS_POSIXACL(realinode))
+		return NULL;
+
+	return get_cached_acl_rcu(realinode, type);
+}
+
 int ovl_update_time(struct inode *inode, struct timespec64 *ts, int flags)
 {
 	if (flags & S_ATIME) {
@@ -499,6 +513,7 @@ static const struct inode_operations ovl_file_inode_operations = {
 	.getattr	= ovl_getattr,
 	.listxattr	= ovl_listxattr,
 	.get_acl	= ovl_get_acl,
+	.get_acl_rcu	= ovl_get_acl_rcu,
 	.update_time	= ovl_update_time,
 	.fiemap		= ovl_fiemap,
 };
@@ -517,6 +532,7 @@ static const struct inode_operations ovl_special_inode_operations = {
 	.getattr	= ovl_getattr,
 	.listxattr	= ovl_listxattr,
 	.get_acl	= ovl_get_acl,
+	.get_acl_rcu	= ovl_get_acl_rcu,
 	.update_time	= ovl_update_time,
 };
 
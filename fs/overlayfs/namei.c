@@ -806,6 +806,7 @@ struct dentry *ovl_lookup(struct inode *dir, struct dentry *dentry,
 	struct ovl_fs *ofs = dentry->d_sb->s_fs_info;
 	struct ovl_entry *poe = dentry->d_parent->d_fsdata;
 	struct ovl_entry *roe = dentry->d_sb->s_root->d_fsdata;
+	struct ovl_lookup_bloom *bloom = NULL;
 	struct ovl_path *stack = NULL, *origin_path = NULL;
 	struct dentry *upperdir, *upperdentry = NULL;
 	struct dentry *origin = NULL;
@@ -880,6 +881,9 @@ struct dentry *ovl_lookup(struct inode *dir, struct dentry *dentry,
 				GFP_KERNEL);
 		if (!stack)
 			goto out_put_upper;
+
+		if (poe == OVL_E(dentry->d_parent))
+			bloom = ovl_lookup_bloom_get(dentry->d_parent);
 	}
 
 	for (i = 0; !d.stop && i < poe->numlower; i++) {
@@ -890,6 +894,15 @@ struct dentry *ovl_lookup(struct inode *dir, struct dentry *dentry,
 		else
 			d.last = lower.layer->idx == roe->numlower;
 
+		/*
+		 * The filter only knows the names of the parent's own lower
+		 * dirs, not where a redirect leads to.
+		 */
+		if (bloom && d.name.name == dentry->d_name.name &&
+		    poe == OVL_E(dentry->d_parent) &&
+		    !ovl_lookup_bloom_may_contain(bloom, i, &d.name))
+			continue;
+
 		err = ovl_lookup_layer(lower.dentry, &d, &this);
 		if (err)
 			goto out_put;
@@ -88,6 +88,8 @@ static inline bool ovl_should_sync(struct ovl_fs *ofs)
 	return !ofs->config.ovl_volatile;
 }
 
+struct ovl_lookup_bloom;
+
 /* private information held for every overlayfs dentry */
 struct ovl_entry {
 	union {
@@ -96,6 +98,8 @@ struct ovl_entry {
 		};
 		struct rcu_head rcu;
 	};
+	/* names of the lower dirs, see ovl_lookup_bloom_get() */
+	struct ovl_lookup_bloom *bloom;
 	unsigned numlower;
 	struct ovl_path lowerstack[];
 };
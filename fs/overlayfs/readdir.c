@@ -16,6 +16,10 @@
 #include <linux/security.h>
 #include <linux/cred.h>
 #include <linux/ratelimit.h>
+#include <linux/stringhash.h>
+#include <linux/hash.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
 #include "overlayfs.h"
 
 struct ovl_cache_entry {
@@ -238,6 +242,26 @@ void ovl_dir_cache_free(struct inode *inode)
 	}
 }
 
+/*
+ * Detach a stale cache from the inode.  The merged cache holds one reference
+ * for the inode so that it outlives the last close of the directory, it is
+ * freed here unless an open file is still reading from it.  The impure cache
+ * is not refcounted at all.
+ */
+static void ovl_dir_cache_drop(struct inode *inode)
+{
+	struct ovl_dir_cache *cache = ovl_dir_cache(inode);
+
+	if (!cache)
+		return;
+
+	ovl_set_dir_cache(inode, NULL);
+	if (!cache->refcount || !--cache->refcount) {
+		ovl_cache_free(&cache->entries);
+		kfree(cache);
+	}
+}
+
 static void ovl_cache_put(struct ovl_dir_file *od, struct dentry *dentry)
 {
 	struct ovl_dir_cache *cache = od->cache;
@@ -416,13 +440,14 @@ static struct ovl_dir_cache *ovl_cache_get(struct dentry *dentry)
 		cache->refcount++;
 		return cache;
 	}
-	ovl_set_dir_cache(d_inode(dentry), NULL);
+	ovl_dir_cache_drop(d_inode(dentry));
 
 	cache = kzalloc(sizeof(struct ovl_dir_cache), GFP_KERNEL);
 	if (!cache)
 		return ERR_PTR(-ENOMEM);
 
-	cache->refcount = 1;
+	/* One reference for the caller and one for the inode */
+	cache->refcount = 2;
 	INIT_LIST_HEAD(&cache->entries);
 	cache->root = RB_ROOT;
 
@@ -601,9 +626,7 @@ static struct ovl_dir_cache *ovl_cache_get_impure(struct path *path)
 	if (cache && ovl_dentry_version_get(dentry) == cache->version)
 		return cache;
 
-	/* Impure cache is not refcounted, free it here */
-	ovl_dir_cache_free(d_inode(dentry));
-	ovl_set_dir_cache(d_inode(dentry), NULL);
+	ovl_dir_cache_drop(d_inode(dentry));
 
 	cache = kzalloc(sizeof(struct ovl_dir_cache), GFP_KERNEL);
 	if (!cache)
@@ -1157,3 +1180,175 @@ int ovl_indexdir_cleanup(struct ovl_fs *ofs)
 		pr_err("overlayfs: failed index dir cleanup (%i)\n", err);
 	return err;
 }
+
+/*
+ * Lookup in a directory with many lower layers does one real lookup per layer
+ * and most of them miss.  Lower layers do not change under the overlay, so
+ * the names of each lower dir are read once into a bloom filter and a layer
+ * that surely does not have the name is skipped without calling into the
+ * lower fs.  The filter is keyed by the name hash of the overlay dentry,
+ * which is salted with the overlay parent and computed by the vfs anyway.
+ */
+#define OVL_BLOOM_MIN_LAYERS		4
+#define OVL_BLOOM_MAX_ENTRIES		(1U << 16)
+#define OVL_BLOOM_BITS_PER_ENTRY	8
+
+struct ovl_bloom {
+	unsigned int shift;
+	unsigned long bits[];
+};
+
+struct ovl_lookup_bloom {
+	unsigned int numlower;
+	/* NULL if the layer could not be read, it may have any name */
+	struct ovl_bloom *layer[];
+};
+
+struct ovl_bloom_data {
+	struct dir_context ctx;
+	struct dentry *dir;
+	struct ovl_bloom *bloom;
+	unsigned int count;
+	int err;
+};
+
+static void ovl_bloom_add(struct ovl_bloom *bloom, u32 hash)
+{
+	__set_bit(hash & ((1U << bloom->shift) - 1), bloom->bits);
+	__set_bit(hash_32(hash, bloom->shift), bloom->bits);
+}
+
+static bool ovl_bloom_test(struct ovl_bloom *bloom, u32 hash)
+{
+	return test_bit(hash & ((1U << bloom->shift) - 1), bloom->bits) &&
+	       test_bit(hash_32(hash, bloom->shift), bloom->bits);
+}
+
+static int ovl_fill_bloom(struct dir_context *ctx, const char *name,
+			  int namelen, loff_t offset, u64 ino,
+			  unsigned int d_type)
+{
+	struct ovl_bloom_data *bd =
+		container_of(ctx, struct ovl_bloom_data, ctx);
+
+	bd->count++;
+	if (bd->bloom)
+		ovl_bloom_add(bd->bloom, full_name_hash(bd->dir, name, namelen));
+	else if (bd->count > OVL_BLOOM_MAX_ENTRIES)
+		bd->err = -E2BIG;
+
+	return bd->err;
+}
+
+static int ovl_bloom_read(struct path *realpath, struct ovl_bloom_data *bd)
+{
+	struct file *realfile;
+	unsigned int count;
+	int err;
+
+	realfile = ovl_path_open(realpath, O_RDONLY | O_DIRECTORY);
+	if (IS_ERR(realfile))
+		return PTR_ERR(realfile);
+
+	bd->count = 0;
+	bd->err = 0;
+	do {
+		count = bd->count;
+		err = iterate_dir(realfile, &bd->ctx);
+		if (err >= 0)
+			err = bd->err;
+	} while (!err && bd->count != count);
+
+	fput(realfile);
+
+	return err;
+}
+
+static struct ovl_bloom *ovl_bloom_build(struct dentry *dir,
+					 struct ovl_path *lower)
+{
+	struct path realpath = {
+		.mnt = lower->layer->mnt,
+		.dentry = lower->dentry,
+	};
+	struct ovl_bloom_data bd = {
+		.ctx.actor = ovl_fill_bloom,
+		.dir = dir,
+	};
+	struct ovl_bloom *bloom;
+	unsigned int shift;
+
+	/* Count the entries first to size the filter */
+	if (ovl_bloom_read(&realpath, &bd))
+		return NULL;
+
+	shift = order_base_2(max(bd.count, 8U) * OVL_BLOOM_BITS_PER_ENTRY);
+	bloom = kvzalloc(sizeof(*bloom) + BITS_TO_LONGS(1U << shift) *
+			 sizeof(unsigned long), GFP_KERNEL);
+	if (!bloom)
+		return NULL;
+
+	bloom->shift = shift;
+	bd.bloom = bloom;
+	if (ovl_bloom_read(&realpath, &bd)) {
+		kvfree(bloom);
+		return NULL;
+	}
+
+	return bloom;
+}
+
+void ovl_lookup_bloom_free(struct ovl_lookup_bloom *lb)
+{
+	unsigned int i;
+
+	if (!lb)
+		return;
+
+	for (i = 0; i < lb->numlower; i++)
+		kvfree(lb->layer[i]);
+	kfree(lb);
+}
+
+/*
+ * Get the filters of the lower dirs of @dir, reading them on first use.
+ * Called with mounter creds from lookup.
+ */
+struct ovl_lookup_bloom *ovl_lookup_bloom_get(struct dentry *dir)
+{
+	struct ovl_entry *oe = OVL_E(dir);
+	struct ovl_lookup_bloom *lb, *old;
+	unsigned int i;
+
+	lb = READ_ONCE(oe->bloom);
+	if (lb || oe->numlower < OVL_BLOOM_MIN_LAYERS)
+		return lb;
+
+	lb = kzalloc(offsetof(struct ovl_lookup_bloom, layer[oe->numlower]),
+		     GFP_KERNEL);
+	if (!lb)
+		return NULL;
+
+	lb->numlower = oe->numlower;
+	for (i = 0; i < oe->numlower; i++)
+		lb->layer[i] = ovl_bloom_build(dir, &oe->lowerstack[i]);
+
+	/* Parallel lookups may all have built one, keep the first */
+	old = cmpxchg(&oe->bloom, NULL, lb);
+	if (old) {
+		ovl_lookup_bloom_free(lb);
+		lb = old;
+	}
+
+	return lb;
+}
+
+/* Can lower layer @idx of the dir have an entry with overlay name @name? */
+bool ovl_lookup_bloom_may_contain(struct ovl_lookup_bloom *lb,
+				  unsigned int idx, const struct qstr *name)
+{
+	if (idx >= lb->numlower || !lb->layer[idx])
+		return true;
+
+	return ovl_bloom_test(lb->layer[idx], name->hash);
+}
@@ -75,6 +75,7 @@ static void ovl_dentry_release(struct dentry *dentry)
 
 	if (oe) {
 		ovl_entry_stack_free(oe);
+		ovl_lookup_bloom_free(oe->bloom);
 		kfree_rcu(oe, rcu);
 	}
 }
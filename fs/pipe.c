@@ -128,7 +128,7 @@ static void anon_pipe_buf_release(struct pipe_inode_info *pipe,
 	 * temporary page, let's keep track of it as a one-deep
 	 * allocation cache. (Otherwise just release our reference to it)
 	 */
-	if (page_count(page) == 1 && !pipe->tmp_page)
+	if (page_count(page) == 1 && !pipe->tmp_page && !PageCompound(page))
 		pipe->tmp_page = page;
 	else
 		put_page(page);
@@ -139,7 +139,8 @@ static int anon_pipe_buf_steal(struct pipe_inode_info *pipe,
 {
 	struct page *page = buf->page;
 
-	if (page_count(page) == 1) {
+	/* Large buffers can't go into the page cache */
+	if (page_count(page) == 1 && !PageCompound(page)) {
 		if (memcg_kmem_enabled())
 			memcg_kmem_uncharge(page, 0);
 		__SetPageLocked(page);
@@ -363,6 +364,38 @@ static inline int is_packetized(struct file *file)
 	return (file->f_flags & O_DIRECT) != 0;
 }
 
+/*
+ * Get a page for a new buffer of pipe_write().  Pipes set up with
+ * F_SETPIPE_BUFSZ try for a compound page of that size first, so that a
+ * bulk write needs fewer buffers; packets always get a single page.
+ */
+static struct page *pipe_alloc_buf_page(struct pipe_inode_info *pipe,
+					struct file *filp)
+{
+	struct page *page;
+
+	if (pipe->buf_order && !is_packetized(filp)) {
+		/* lowmem, so the whole buffer is mapped contiguously */
+		page = alloc_pages(GFP_USER | __GFP_ACCOUNT | __GFP_COMP |
+				   __GFP_NORETRY | __GFP_NOWARN,
+				   pipe->buf_order);
+		if (page)
+			return page;
+	}
+
+	page = pipe->tmp_page;
+	if (page) {
+		pipe->tmp_page = NULL;
+		return page;
+	}
+	return alloc_page(GFP_HIGHUSER | __GFP_ACCOUNT);
+}
+
+static inline size_t pipe_buf_page_size(struct pipe_buffer *buf)
+{
+	return PAGE_SIZE << compound_order(buf->page);
+}
+
 static ssize_t
 pipe_write(struct kiocb *iocb, struct iov_iter *from)
 {
@@ -386,14 +419,15 @@ pipe_write(struct kiocb *iocb, struct iov_iter *from)
 	}
 
 	/* We try to merge small writes */
-	chars = total_len & (PAGE_SIZE-1); /* size of the last buffer */
+	chars = total_len & ((PAGE_SIZE << pipe->buf_order) - 1); /* size of the last buffer */
 	if (pipe->nrbufs && chars != 0) {
 		int lastbuf = (pipe->curbuf + pipe->nrbufs - 1) &
 							(pipe->buffers - 1);
 		struct pipe_buffer *buf = pipe->bufs + lastbuf;
 		int offset = buf->offset + buf->len;
 
-		if (buf->ops->can_merge && offset + chars <= PAGE_SIZE) {
+		if (buf->ops->can_merge &&
+		    offset + chars <= pipe_buf_page_size(buf)) {
 			ret = pipe_buf_confirm(pipe, buf);
 			if (ret)
 				goto out;
@@ -423,25 +457,25 @@ pipe_write(struct kiocb *iocb, struct iov_iter *from)
 		if (bufs < pipe->buffers) {
 			int newbuf = (pipe->curbuf + bufs) & (pipe->buffers-1);
 			struct pipe_buffer *buf = pipe->bufs + newbuf;
-			struct page *page = pipe->tmp_page;
+			struct page *page;
+			size_t size;
 			int copied;
 
-			if (!page) {
-				page = alloc_page(GFP_HIGHUSER | __GFP_ACCOUNT);
-				if (unlikely(!page)) {
-					ret = ret ? : -ENOMEM;
-					break;
-				}
-				pipe->tmp_page = page;
+			page = pipe_alloc_buf_page(pipe, filp);
+			if (unlikely(!page)) {
+				ret = ret ? : -ENOMEM;
+				break;
 			}
+			size = PAGE_SIZE << compound_order(page);
 			/* Always wake up, even if the copy fails. Otherwise
 			 * we lock up (O_NONBLOCK-)readers that sleep due to
 			 * syscall merging.
 			 * FIXME! Is this really true?
 			 */
 			do_wakeup = 1;
-			copied = copy_page_from_iter(page, 0, PAGE_SIZE, from);
-			if (unlikely(copied < PAGE_SIZE && iov_iter_count(from))) {
+			copied = copy_page_from_iter(page, 0, size, from);
+			if (unlikely(copied < size && iov_iter_count(from))) {
+				put_page(page);
 				if (!ret)
 					ret = -EFAULT;
 				break;
@@ -459,7 +493,6 @@ pipe_write(struct kiocb *iocb, struct iov_iter *from)
 				buf->flags = PIPE_BUF_FLAG_PACKET;
 			}
 			pipe->nrbufs = ++bufs;
-			pipe->tmp_page = NULL;
 
 			if (!iov_iter_count(from))
 				break;
@@ -685,7 +718,8 @@ void free_pipe_info(struct pipe_inode_info *pipe)
 {
 	int i;
 
-	(void) account_pipe_buffers(pipe->user, pipe->buffers, 0);
+	(void) account_pipe_buffers(pipe->user,
+				    pipe->buffers << pipe->buf_order, 0);
 	free_uid(pipe->user);
 	for (i = 0; i < pipe->buffers; i++) {
 		struct pipe_buffer *buf = pipe->bufs + i;
@@ -1038,19 +1072,25 @@ unsigned int round_pipe_size(unsigned long size)
 /*
  * Allocate a new array of pipe buffers and copy the info over. Returns the
  * pipe size if successful, or return -ERROR on error.
+ *
+ * Buffers of pipe_write() are 2^@order pages: the pipe gets size >> @order
+ * buffers, and is accounted for size pages all the same.
  */
-static long pipe_set_size(struct pipe_inode_info *pipe, unsigned long arg)
+static long pipe_set_size(struct pipe_inode_info *pipe, unsigned long arg,
+			  unsigned int order)
 {
 	struct pipe_buffer *bufs;
-	unsigned int size, nr_pages;
+	unsigned int size, nr_pages, nr_bufs, cur_pages;
 	unsigned long user_bufs;
 	long ret = 0;
 
 	size = round_pipe_size(arg);
-	nr_pages = size >> PAGE_SHIFT;
-
-	if (!nr_pages)
+	if (!size)
 		return -EINVAL;
+	size = max_t(unsigned int, size, PAGE_SIZE << order);
+	nr_pages = size >> PAGE_SHIFT;
+	nr_bufs = nr_pages >> order;
+	cur_pages = pipe->buffers << pipe->buf_order;
 
 	/*
 	 * If trying to increase the pipe capacity, check that an
@@ -1059,13 +1099,13 @@ static long pipe_set_size(struct pipe_inode_info *pipe, unsigned long arg)
 	 * Decreasing the pipe capacity is always permitted, even
 	 * if the user is currently over a limit.
 	 */
-	if (nr_pages > pipe->buffers &&
+	if (nr_pages > cur_pages &&
 			size > pipe_max_size && !capable(CAP_SYS_RESOURCE))
 		return -EPERM;
 
-	user_bufs = account_pipe_buffers(pipe->user, pipe->buffers, nr_pages);
+	user_bufs = account_pipe_buffers(pipe->user, cur_pages, nr_pages);
 
-	if (nr_pages > pipe->buffers &&
+	if (nr_pages > cur_pages &&
 			(too_many_pipe_buffers_hard(user_bufs) ||
 			 too_many_pipe_buffers_soft(user_bufs)) &&
 			is_unprivileged_user()) {
@@ -1079,12 +1119,12 @@ static long pipe_set_size(struct pipe_inode_info *pipe, unsigned long arg)
 	 * again like we would do for growing. If the pipe currently
 	 * contains more buffers than arg, then return busy.
 	 */
-	if (nr_pages < pipe->nrbufs) {
+	if (nr_bufs < pipe->nrbufs) {
 		ret = -EBUSY;
 		goto out_revert_acct;
 	}
 
-	bufs = kcalloc(nr_pages, sizeof(*bufs),
+	bufs = kcalloc(nr_bufs, sizeof(*bufs),
 		       GFP_KERNEL_ACCOUNT | __GFP_NOWARN);
 	if (unlikely(!bufs)) {
 		ret = -ENOMEM;
@@ -1115,14 +1155,39 @@ static long pipe_set_size(struct pipe_inode_info *pipe, unsigned long arg)
 	pipe->curbuf = 0;
 	kfree(pipe->bufs);
 	pipe->bufs = bufs;
-	pipe->buffers = nr_pages;
+	pipe->buffers = nr_bufs;
+	pipe->buf_order = order;
 	return nr_pages * PAGE_SIZE;
 
 out_revert_acct:
-	(void) account_pipe_buffers(pipe->user, nr_pages, pipe->buffers);
+	(void) account_pipe_buffers(pipe->user, nr_pages, cur_pages);
 	return ret;
 }
 
+/*
+ * Switch pipe_write() to buffers of @arg bytes, keeping the pipe size.
+ * Fewer, larger buffers mean fewer pipe_buffer operations per byte for
+ * bulk writes, at the cost of holding fewer buffers spliced in from
+ * elsewhere.
+ */
+static long pipe_set_buf_size(struct pipe_inode_info *pipe, unsigned long arg)
+{
+	unsigned int order;
+	long ret;
+
+	if (arg < PAGE_SIZE || !is_power_of_2(arg) ||
+	    arg > (PAGE_SIZE << PIPE_MAX_BUF_ORDER))
+		return -EINVAL;
+
+	order = ilog2(arg) - PAGE_SHIFT;
+	if (order == pipe->buf_order)
+		return arg;
+
+	ret = pipe_set_size(pipe, pipe->buffers << (PAGE_SHIFT + pipe->buf_order),
+			    order);
+	return ret < 0 ? ret : arg;
+}
+
 /*
  * After the inode slimming patch, i_pipe/i_bdev/i_cdev share the same
  * location, so checking ->i_pipe is not enough to verify that this is a
@@ -1146,10 +1211,16 @@ long pipe_fcntl(struct file *file, unsigned int cmd, unsigned long arg)
 
 	switch (cmd) {
 	case F_SETPIPE_SZ:
-		ret = pipe_set_size(pipe, arg);
+		ret = pipe_set_size(pipe, arg, pipe->buf_order);
 		break;
 	case F_GETPIPE_SZ:
-		ret = pipe->buffers * PAGE_SIZE;
+		ret = (pipe->buffers << pipe->buf_order) * PAGE_SIZE;
+		break;
+	case F_SETPIPE_BUFSZ:
+		ret = pipe_set_buf_size(pipe, arg);
+		break;
+	case F_GETPIPE_BUFSZ:
+		ret = PAGE_SIZE << pipe->buf_order;
 		break;
 	default:
 		ret = -EINVAL;
@@ -55,7 +55,16 @@ EXPORT_SYMBOL(get_cached_acl);
 
 struct posix_acl *get_cached_acl_rcu(struct inode *inode, int type)
 {
-	return rcu_dereference(*acl_by_type(inode, type));
+	struct posix_acl *acl = rcu_dereference(*acl_by_type(inode, type));
+
+	/* the filesystem may know the ACL without blocking regardless */
+	if (acl == ACL_DONT_CACHE && inode->i_op->get_acl_rcu) {
+		struct posix_acl *ret = inode->i_op->get_acl_rcu(inode, type);
+
+		if (!IS_ERR(ret))
+			acl = ret;
+	}
+	return acl;
 }
 EXPORT_SYMBOL(get_cached_acl_rcu);
 
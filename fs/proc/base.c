@@ -94,6 +94,7 @@
 #include <linux/sched/stat.h>
 #include <linux/flex_array.h>
 #include <linux/posix-timers.h>
+#include <linux/kidled.h>
 #include <trace/events/oom.h>
 #include "internal.h"
 #include "fd.h"
@@ -2938,6 +2939,42 @@ static int proc_pid_personality(struct seq_file *m, struct pid_namespace *ns,
 	return err;
 }
 
+#ifdef CONFIG_KIDLED
+static int proc_pid_idle_page_stats(struct seq_file *m, struct pid_namespace *ns,
+				    struct pid *pid, struct task_struct *task)
+{
+	struct kidled_scan_period scan_period;
+	struct idle_page_stats *stats;
+	struct mm_struct *mm;
+	int ret;
+
+	mm = mm_access(task, PTRACE_MODE_READ_FSCREDS);
+	if (IS_ERR_OR_NULL(mm))
+		return mm ? PTR_ERR(mm) : 0;
+
+	stats = kmalloc(sizeof(*stats), GFP_KERNEL);
+	if (!stats) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	scan_period = kidled_get_current_scan_period();
+	ret = kidled_mm_idle_page_stats(mm, stats);
+	if (ret)
+		goto out_free;
+
+	seq_printf(m, "# version: %s\n", KIDLED_VERSION);
+	seq_printf(m, "# scan_period_in_seconds: %u\n", scan_period.duration);
+	kidled_show_idle_page_stats(m, stats);
+
+out_free:
+	kfree(stats);
+out:
+	mmput(mm);
+	return ret;
+}
+#endif
+
 #ifdef CONFIG_LIVEPATCH
 static int proc_pid_patch_state(struct seq_file *m, struct pid_namespace *ns,
 				struct pid *pid, struct task_struct *task)
@@ -3047,6 +3084,9 @@ static const struct pid_entry tgid_base_stuff[] = {
 	REG("timerslack_ns", S_IRUGO|S_IWUGO, proc_pid_set_timerslack_ns_operations),
 #ifdef CONFIG_LIVEPATCH
 	ONE("patch_state",  S_IRUSR, proc_pid_patch_state),
+#endif
+#ifdef CONFIG_KIDLED
+	ONE("idle_page_stats", S_IRUSR, proc_pid_idle_page_stats),
 #endif
 	ONE("wait_res",  S_IRUGO, proc_wait_res),
 };
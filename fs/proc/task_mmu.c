@@ -713,8 +713,13 @@ static int smaps_hugetlb_range(pte_t *pte, unsigned long hmask,
 }
 #endif /* HUGETLB_PAGE */
 
+/*
+ * Account [start, end) of @vma. A walk that does not start at vm_start
+ * resumes one that accounted the beginning of the vma already.
+ */
 static void smap_gather_stats(struct vm_area_struct *vma,
-			     struct mem_size_stats *mss)
+			     struct mem_size_stats *mss,
+			     unsigned long start, unsigned long end)
 {
 	struct mm_walk smaps_walk = {
 		.pmd_entry = smaps_pte_range,
@@ -727,9 +732,13 @@ static void smap_gather_stats(struct vm_area_struct *vma,
 	smaps_walk.private = mss;
 
 #ifdef CONFIG_SHMEM
-	/* In case of smaps_rollup, reset the value from previous vma */
-	mss->check_shmem_swap = false;
-	if (vma->vm_file && shmem_mapping(vma->vm_file->f_mapping)) {
+	/*
+	 * In case of smaps_rollup, reset the value from previous vma, unless
+	 * resuming a shmem vma whose first part decided it.
+	 */
+	if (!vma->vm_file || !shmem_mapping(vma->vm_file->f_mapping)) {
+		mss->check_shmem_swap = false;
+	} else if (start == vma->vm_start) {
 		/*
 		 * For shared or readonly shmem mappings we know that all
 		 * swapped out pages belong to the shmem object, and we can
@@ -745,14 +754,16 @@ static void smap_gather_stats(struct vm_area_struct *vma,
 		if (!shmem_swapped || (vma->vm_flags & VM_SHARED) ||
 					!(vma->vm_flags & VM_WRITE)) {
 			mss->swap += shmem_swapped;
+			mss->check_shmem_swap = false;
 		} else {
 			mss->check_shmem_swap = true;
-			smaps_walk.pte_hole = smaps_pte_hole;
 		}
 	}
+	if (mss->check_shmem_swap)
+		smaps_walk.pte_hole = smaps_pte_hole;
 #endif
-	/* mmap_sem is held in m_start */
-	walk_page_vma(vma, &smaps_walk);
+	/* mmap_sem is held in m_start or show_smaps_rollup */
+	walk_page_range(start, end, &smaps_walk);
 }
 
 #define SEQ_PUT_DEC(str, val) \
@@ -791,7 +802,7 @@ static int show_smap(struct seq_file *m, void *v)
 
 	memset(&mss, 0, sizeof(mss));
 
-	smap_gather_stats(vma, &mss);
+	smap_gather_stats(vma, &mss, vma->vm_start, vma->vm_end);
 
 	show_map_vma(m, vma);
 
@@ -814,13 +825,20 @@ static int show_smap(struct seq_file *m, void *v)
 	return 0;
 }
 
+/*
+ * smaps_rollup walks this much at a time, a power of 2 of PMDs so that a
+ * hugetlb page is never split between two walks, and lets the writers
+ * waiting for mmap_sem in between.
+ */
+#define SMAPS_ROLLUP_BATCH	(PMD_SIZE * 512)
+
 static int show_smaps_rollup(struct seq_file *m, void *v)
 {
 	struct proc_maps_private *priv = m->private;
 	struct mem_size_stats mss;
 	struct mm_struct *mm;
 	struct vm_area_struct *vma;
-	unsigned long last_vma_end = 0;
+	unsigned long vma_start = 0, last_vma_end = 0, addr;
 	int ret = 0;
 
 	priv->task = get_proc_task(priv->inode);
@@ -841,13 +859,37 @@ static int show_smaps_rollup(struct seq_file *m, void *v)
 
 	hold_task_mempolicy(priv);
 
-	for (vma = priv->mm->mmap; vma; vma = vma->vm_next) {
-		smap_gather_stats(vma, &mss);
-		last_vma_end = vma->vm_end;
+	vma = mm->mmap;
+	if (vma)
+		vma_start = vma->vm_start;
+	addr = vma_start;
+	while (vma) {
+		unsigned long start = max(addr, vma->vm_start);
+		unsigned long end = min(vma->vm_end,
+					ALIGN(start + 1, SMAPS_ROLLUP_BATCH));
+
+		smap_gather_stats(vma, &mss, start, end);
+		addr = last_vma_end = end;
+		if (end == vma->vm_end)
+			vma = vma->vm_next;
+
+		/*
+		 * Don't hold up faults and mmap()s of a large process for the
+		 * whole walk. Once back, the vmas may have changed, carry on
+		 * from the first one still above what has been accounted.
+		 */
+		if (rwsem_is_contended(&mm->mmap_sem)) {
+			up_read(&mm->mmap_sem);
+			ret = down_read_killable(&mm->mmap_sem);
+			if (ret) {
+				release_task_mempolicy(priv);
+				goto out_put_mm;
+			}
+			vma = find_vma(mm, addr);
+		}
 	}
 
-	show_vma_header_prefix(m, priv->mm->mmap->vm_start,
-			       last_vma_end, 0, 0, 0, 0);
+	show_vma_header_prefix(m, vma_start, last_vma_end, 0, 0, 0, 0);
 	seq_pad(m, ' ');
 	seq_puts(m, "[rollup]\n");
 
@@ -1575,6 +1617,218 @@ static ssize_t pagemap_read(struct file *file, char __user *buf,
 	return ret;
 }
 
+#define PM_SCAN_CATEGORIES	(PAGE_IS_FILE | PAGE_IS_PRESENT | \
+				 PAGE_IS_SWAPPED | PAGE_IS_SOFT_DIRTY)
+
+struct pagemap_scan_private {
+	struct pm_scan_arg arg;
+	struct page_region __user *vec;
+	struct page_region cur;		/* being built, empty if start == end */
+	unsigned long nr_regions;
+	unsigned long nr_pages;
+};
+
+static u64 pagemap_scan_categories(u64 pme)
+{
+	u64 categories = 0;
+
+	if (pme & PM_FILE)
+		categories |= PAGE_IS_FILE;
+	if (pme & PM_PRESENT)
+		categories |= PAGE_IS_PRESENT;
+	if (pme & PM_SWAP)
+		categories |= PAGE_IS_SWAPPED;
+	if (pme & PM_SOFT_DIRTY)
+		categories |= PAGE_IS_SOFT_DIRTY;
+	return categories;
+}
+
+static bool pagemap_scan_match(const struct pm_scan_arg *arg, u64 categories)
+{
+	categories ^= arg->category_inverted;
+	if ((categories & arg->category_mask) != arg->category_mask)
+		return false;
+	if (arg->category_anyof_mask && !(categories & arg->category_anyof_mask))
+		return false;
+	return true;
+}
+
+static int pagemap_scan_flush(struct pagemap_scan_private *p)
+{
+	if (p->cur.start == p->cur.end)
+		return 0;
+	if (copy_to_user(&p->vec[p->nr_regions], &p->cur, sizeof(p->cur)))
+		return -EFAULT;
+	p->nr_regions++;
+	p->cur.start = p->cur.end;
+	return 0;
+}
+
+/*
+ * Add the page at @addr to the regions, PM_END_OF_BUFFER once there is no
+ * room left for it.
+ */
+static int pagemap_scan_add(struct pagemap_scan_private *p,
+			    unsigned long addr, u64 categories)
+{
+	bool empty = p->cur.start == p->cur.end;
+	int err;
+
+	if (p->arg.max_pages && p->nr_pages == p->arg.max_pages)
+		return PM_END_OF_BUFFER;
+
+	categories &= p->arg.return_mask;
+	if (!empty && p->cur.end == addr && p->cur.categories == categories) {
+		p->cur.end += PAGE_SIZE;
+	} else {
+		/* cur takes a slot of its own until flushed */
+		if (!empty && p->nr_regions + 1 == p->arg.vec_len)
+			return PM_END_OF_BUFFER;
+		err = pagemap_scan_flush(p);
+		if (err)
+			return err;
+		p->cur.start = addr;
+		p->cur.end = addr + PAGE_SIZE;
+		p->cur.categories = categories;
+	}
+	p->nr_pages++;
+	return 0;
+}
+
+static int pagemap_scan_args(struct pm_scan_arg *arg,
+			     struct pm_scan_arg __user *uarg)
+{
+	if (copy_from_user(arg, uarg, sizeof(*arg)))
+		return -EFAULT;
+
+	if (arg->size != sizeof(*arg) || arg->flags)
+		return -EINVAL;
+	if ((arg->category_inverted | arg->category_mask |
+	     arg->category_anyof_mask | arg->return_mask) & ~PM_SCAN_CATEGORIES)
+		return -EINVAL;
+	if (!arg->return_mask || !arg->vec_len)
+		return -EINVAL;
+	if (!IS_ALIGNED(arg->start, PAGE_SIZE) ||
+	    !IS_ALIGNED(arg->end, PAGE_SIZE) || arg->start > arg->end)
+		return -EINVAL;
+	if (arg->vec_len > ULONG_MAX / sizeof(struct page_region) ||
+	    !access_ok(VERIFY_WRITE, u64_to_user_ptr(arg->vec),
+		       arg->vec_len * sizeof(struct page_region)))
+		return -EFAULT;
+	return 0;
+}
+
+/*
+ * PAGEMAP_SCAN - the ranges of pages matching some categories, found with
+ * the pagemap walk one PMD at a time, without the copy of an entry per
+ * page out to userspace.
+ */
+static long pagemap_scan(struct mm_struct *mm, struct pm_scan_arg __user *uarg)
+{
+	struct pagemap_scan_private p = {};
+	struct pagemapread pm;
+	struct mm_walk pagemap_walk = {};
+	unsigned long addr, end, walk_end;
+	long ret;
+	int i;
+
+	ret = pagemap_scan_args(&p.arg, uarg);
+	if (ret)
+		return ret;
+	p.vec = u64_to_user_ptr(p.arg.vec);
+
+	if (!mm || !mmget_not_zero(mm))
+		return -ESRCH;
+
+	pm.show_pfn = false;
+	pm.len = (PAGEMAP_WALK_SIZE >> PAGE_SHIFT);
+	pm.buffer = kmalloc_array(pm.len, PM_ENTRY_BYTES, GFP_KERNEL);
+	ret = -ENOMEM;
+	if (!pm.buffer)
+		goto out_mm;
+
+	pagemap_walk.pmd_entry = pagemap_pmd_range;
+	pagemap_walk.pte_hole = pagemap_pte_hole;
+#ifdef CONFIG_HUGETLB_PAGE
+	pagemap_walk.hugetlb_entry = pagemap_hugetlb_range;
+#endif
+	pagemap_walk.mm = mm;
+	pagemap_walk.private = &pm;
+
+	addr = p.arg.start;
+	end = min_t(u64, p.arg.end, mm->task_size);
+	walk_end = p.arg.end;
+	while (addr < end) {
+		struct vm_area_struct *vma;
+		unsigned long next;
+
+		ret = down_read_killable(&mm->mmap_sem);
+		if (ret)
+			goto out_free;
+		/* holes are skipped, not reported as unmapped pages */
+		vma = find_vma(mm, addr);
+		if (!vma || vma->vm_start >= end) {
+			up_read(&mm->mmap_sem);
+			break;
+		}
+		addr = max(addr, vma->vm_start);
+		next = (addr + PAGEMAP_WALK_SIZE) & PAGEMAP_WALK_MASK;
+		next = min3(next, vma->vm_end, end);
+
+		pm.pos = 0;
+		ret = walk_page_range(addr, next, &pagemap_walk);
+		up_read(&mm->mmap_sem);
+		if (ret < 0)
+			goto out_free;
+
+		for (i = 0; i < pm.pos; i++, addr += PAGE_SIZE) {
+			u64 categories = pagemap_scan_categories(pm.buffer[i].pme);
+
+			if (!pagemap_scan_match(&p.arg, categories))
+				continue;
+			ret = pagemap_scan_add(&p, addr, categories);
+			if (ret < 0)
+				goto out_free;
+			if (ret == PM_END_OF_BUFFER) {
+				walk_end = addr;
+				goto out_full;
+			}
+		}
+		addr = next;
+
+		if (fatal_signal_pending(current)) {
+			ret = -EINTR;
+			goto out_free;
+		}
+	}
+out_full:
+	ret = pagemap_scan_flush(&p);
+	if (ret)
+		goto out_free;
+	if (put_user(walk_end, &uarg->walk_end))
+		ret = -EFAULT;
+	else
+		ret = p.nr_regions;
+
+out_free:
+	kfree(pm.buffer);
+out_mm:
+	mmput(mm);
+	return ret;
+}
+
+static long pagemap_ioctl(struct file *file, unsigned int cmd,
+			  unsigned long arg)
+{
+	struct mm_struct *mm = file->private_data;
+
+	switch (cmd) {
+	case PAGEMAP_SCAN:
+		return pagemap_scan(mm, (struct pm_scan_arg __user *)arg);
+	}
+	return -EINVAL;
+}
+
 static int pagemap_open(struct inode *inode, struct file *file)
 {
 	struct mm_struct *mm;
@@ -1598,6 +1852,8 @@ static int pagemap_release(struct inode *inode, struct file *file)
 const struct file_operations proc_pagemap_operations = {
 	.llseek		= mem_lseek, /* borrow this */
 	.read		= pagemap_read,
+	.unlocked_ioctl	= pagemap_ioctl,
+	.compat_ioctl	= pagemap_ioctl,
 	.open		= pagemap_open,
 	.release	= pagemap_release,
 };
@@ -37,6 +37,7 @@
 #include <linux/sched/task.h>
 #include <linux/slab.h>
 #include <linux/resctrlfs.h>
+#include <linux/resctrl_cgroup.h>
 
 #include <uapi/linux/magic.h>
 
@@ -447,6 +448,10 @@ static void rmdir_all_sub(void)
 {
 	struct resctrl_group *rdtgrp, *tmp;
 
+	/* Unbind all cpu cgroups before the tasks are moved */
+	list_for_each_entry(rdtgrp, &resctrl_all_groups, resctrl_group_list)
+		resctrl_cgroup_unbind(rdtgrp->closid, rdtgrp->mon.rmid, true);
+
 	/* Move all tasks to the default resource group */
 	resctrl_move_group_tasks(NULL, &resctrl_group_default, NULL);
 
@@ -754,6 +759,8 @@ static void resctrl_group_rm_mon(struct resctrl_group *rdtgrp,
 	free_mon(rdtgrp->mon.mon);
 #endif
 
+	resctrl_cgroup_unbind(rdtgrp->closid, rdtgrp->mon.rmid, false);
+
 	/* Give any tasks back to the parent group */
 	resctrl_move_group_tasks(rdtgrp, prdtgrp, tmpmask);
 
@@ -777,6 +784,56 @@ static void resctrl_group_rm_mon(struct resctrl_group *rdtgrp,
 	list_del(&rdtgrp->mon.crdtgrp_list);
 }
 
+#ifdef CONFIG_CGROUP_RESCTRL
+int resctrl_group_lookup_ids(const char *ctrl, const char *mon,
+			     u32 *closid, u32 *rmid)
+{
+	struct resctrl_group *prgrp = NULL, *rdtgrp = NULL, *entry;
+	int ret = -ENOENT;
+
+	mutex_lock(&resctrl_group_mutex);
+	if (!static_branch_unlikely(&resctrl_enable_key)) {
+		ret = -ENODEV;
+		goto out;
+	}
+
+	if (!ctrl) {
+		prgrp = &resctrl_group_default;
+	} else {
+		list_for_each_entry(entry, &resctrl_all_groups, resctrl_group_list) {
+			if (entry != &resctrl_group_default &&
+			    !strcmp(entry->kn->name, ctrl)) {
+				prgrp = entry;
+				break;
+			}
+		}
+	}
+	if (!prgrp)
+		goto out;
+
+	if (!mon) {
+		rdtgrp = prgrp;
+	} else {
+		list_for_each_entry(entry, &prgrp->mon.crdtgrp_list,
+				    mon.crdtgrp_list) {
+			if (!strcmp(entry->kn->name, mon)) {
+				rdtgrp = entry;
+				break;
+			}
+		}
+	}
+	if (!rdtgrp)
+		goto out;
+
+	*closid = rdtgrp->closid;
+	*rmid = rdtgrp->mon.rmid;
+	ret = 0;
+out:
+	mutex_unlock(&resctrl_group_mutex);
+	return ret;
+}
+#endif
+
 static int resctrl_group_rmdir_mon(struct kernfs_node *kn, struct resctrl_group *rdtgrp,
 			      cpumask_var_t tmpmask)
 {
@@ -796,6 +853,8 @@ static void resctrl_group_rm_ctrl(struct resctrl_group *rdtgrp, cpumask_var_t tm
 {
 	int cpu;
 
+	resctrl_cgroup_unbind(rdtgrp->closid, rdtgrp->mon.rmid, true);
+
 	/* Give any tasks back to the default group */
 	resctrl_move_group_tasks(rdtgrp, &resctrl_group_default, tmpmask);
 
@@ -1484,8 +1484,10 @@ static int userfaultfd_register(struct userfaultfd_ctx *ctx,
 		 * the next vma was merged into the current one and
 		 * the current one has not been updated yet.
 		 */
+		mmap_seq_write_begin(mm);
 		vma->vm_flags = new_flags;
 		vma->vm_userfaultfd_ctx.ctx = ctx;
+		mmap_seq_write_end(mm);
 
 	skip:
 		prev = vma;
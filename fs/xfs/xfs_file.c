@@ -354,6 +354,10 @@ xfs_file_aio_write_checks(
 			goto restart;
 		}
 	
+		/* Zeroing the blocks past EOF has to wait for their I/O */
+		if (iocb->ki_flags & IOCB_NOWAIT)
+			return -EAGAIN;
+
 		trace_xfs_zero_eof(ip, isize, iocb->ki_pos - isize);
 		error = iomap_zero_range(inode, isize, iocb->ki_pos - isize,
 				NULL, &xfs_iomap_ops);
@@ -367,18 +371,23 @@ xfs_file_aio_write_checks(
 	 * xfs_fs_dirty_inode, so we have to call it after dropping the
 	 * lock above.  Eventually we should look into a way to avoid
 	 * the pointless lock roundtrip.
+	 *
+	 * If we're writing the file then make sure to clear the setuid and
+	 * setgid bits if the process is not being run by root.  This keeps
+	 * people from modifying setuid and setgid binaries.
+	 *
+	 * Buffered IOCB_NOWAIT writes get -EAGAIN if either has to be done,
+	 * as the timestamp update needs a transaction.
 	 */
+	if (!(iocb->ki_flags & IOCB_DIRECT))
+		return kiocb_modified(iocb);
+
 	if (likely(!(file->f_mode & FMODE_NOCMTIME))) {
 		error = file_update_time(file);
 		if (error)
 			return error;
 	}
 
-	/*
-	 * If we're writing the file then make sure to clear the setuid and
-	 * setgid bits if the process is not being run by root.  This keeps
-	 * people from modifying setuid and setgid binaries.
-	 */
 	if (!IS_NOSEC(inode))
 		return file_remove_privs(file);
 	return 0;
@@ -630,13 +639,20 @@ xfs_file_buffered_aio_write(
 	ssize_t			ret;
 	int			enospc = 0;
 	int			iolock;
+	bool			nowait = iocb->ki_flags & IOCB_NOWAIT;
 
-	if (iocb->ki_flags & IOCB_NOWAIT)
-		return -EOPNOTSUPP;
+	/* Syncing the data after the write always blocks */
+	if (nowait && (iocb->ki_flags & IOCB_DSYNC))
+		return -EAGAIN;
 
 write_retry:
 	iolock = XFS_IOLOCK_EXCL;
-	xfs_ilock(ip, iolock);
+	if (nowait) {
+		if (!xfs_ilock_nowait(ip, iolock))
+			return -EAGAIN;
+	} else {
+		xfs_ilock(ip, iolock);
+	}
 
 	ret = xfs_file_aio_write_checks(iocb, from, &iolock);
 	if (ret)
@@ -658,8 +674,13 @@ xfs_file_buffered_aio_write(
 	 * waits on dirty mappings. Since xfs_flush_inodes() is serialized, this
 	 * also behaves as a filter to prevent too many eofblocks scans from
 	 * running at the same time.
+	 *
+	 * All of that blocks, so an IOCB_NOWAIT write leaves it to a blocking
+	 * retry.
 	 */
-	if (ret == -EDQUOT && !enospc) {
+	if (nowait && (ret == -EDQUOT || ret == -ENOSPC)) {
+		ret = -EAGAIN;
+	} else if (ret == -EDQUOT && !enospc) {
 		xfs_iunlock(ip, iolock);
 		enospc = xfs_inode_free_quota_eofblocks(ip);
 		if (enospc)
@@ -990,7 +1011,7 @@ xfs_file_open(
 		return -EFBIG;
 	if (XFS_FORCED_SHUTDOWN(XFS_M(inode->i_sb)))
 		return -EIO;
-	file->f_mode |= FMODE_NOWAIT | FMODE_BUF_RASYNC;
+	file->f_mode |= FMODE_NOWAIT | FMODE_BUF_RASYNC | FMODE_BUF_WASYNC;
 	return 0;
 }
 
@@ -502,6 +502,7 @@ xfs_file_iomap_begin_delay(
 	struct inode		*inode,
 	loff_t			offset,
 	loff_t			count,
+	unsigned		flags,
 	struct iomap		*iomap)
 {
 	struct xfs_inode	*ip = XFS_I(inode);
@@ -519,7 +520,22 @@ xfs_file_iomap_begin_delay(
 	ASSERT(!XFS_IS_REALTIME_INODE(ip));
 	ASSERT(!xfs_get_extsz_hint(ip));
 
-	xfs_ilock(ip, XFS_ILOCK_EXCL);
+	if (flags & IOMAP_NOWAIT) {
+		if (!xfs_ilock_nowait(ip, XFS_ILOCK_EXCL))
+			return -EAGAIN;
+		/*
+		 * Reading in the extent list or the dquots and COW reservations
+		 * for shared extents may block, leave those to a blocking
+		 * attempt.
+		 */
+		if (!(ifp->if_flags & XFS_IFEXTENTS) ||
+		    xfs_is_reflink_inode(ip) || XFS_NOT_DQATTACHED(mp, ip)) {
+			error = -EAGAIN;
+			goto out_unlock;
+		}
+	} else {
+		xfs_ilock(ip, XFS_ILOCK_EXCL);
+	}
 
 	if (unlikely(XFS_TEST_ERROR(
 	    (XFS_IFORK_FORMAT(ip, XFS_DATA_FORK) != XFS_DINODE_FMT_EXTENTS &&
@@ -1013,7 +1029,8 @@ xfs_file_iomap_begin(
 	if (((flags & (IOMAP_WRITE | IOMAP_DIRECT)) == IOMAP_WRITE) &&
 			!IS_DAX(inode) && !xfs_get_extsz_hint(ip)) {
 		/* Reserve delalloc blocks for regular writeback. */
-		return xfs_file_iomap_begin_delay(inode, offset, length, iomap);
+		return xfs_file_iomap_begin_delay(inode, offset, length, flags,
+				iomap);
 	}
 
 	/*
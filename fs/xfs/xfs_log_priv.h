@@ -240,7 +240,8 @@ struct xfs_cil_ctx {
 	xfs_lsn_t		commit_lsn;	/* chkpt commit record lsn */
 	struct xlog_ticket	*ticket;	/* chkpt ticket */
 	int			nvecs;		/* number of regions */
-	int			space_used;	/* aggregate size of regions */
+	atomic_t		space_used;	/* aggregate size of regions */
+	atomic_t		order_id;	/* last commit order id */
 	struct list_head	busy_extents;	/* busy extents in chkpt */
 	struct xfs_log_vec	*lv_chain;	/* logvecs being pushed */
 	struct xfs_log_callback	log_cb;		/* completion callback hook. */
@@ -263,11 +264,29 @@ struct xfs_cil_ctx {
  * checkpoint is still in the process of committing, we can block waiting for
  * the commit LSN to be determined as well. This should make synchronous
  * operations almost as efficient as the old logging methods.
+ *
+ * Transaction commits only ever touch the CIL state of the CPU they run on,
+ * so that they do not contend on a shared lock. The push runs with commits
+ * locked out by xc_ctx_lock and gathers the per-CPU state into the
+ * checkpoint, sorting the log items back into commit order.
  */
+struct xlog_cil_pcp {
+	int			space_used;	/* ctx space used here */
+	int			space_folded;	/* ... added to ctx space_used */
+	int			curr_res;	/* stolen for the ctx ticket */
+	int			unit_res;
+	int			nvecs;
+	struct list_head	busy_extents;
+	struct list_head	log_items;
+};
+
+/* xc_flags */
+#define XLOG_CIL_EMPTY		1	/* nothing committed to the ctx yet */
+
 struct xfs_cil {
 	struct xlog		*xc_log;
-	struct list_head	xc_cil;
-	spinlock_t		xc_cil_lock;
+	unsigned long		xc_flags;
+	struct xlog_cil_pcp __percpu *xc_pcp;
 
 	struct rw_semaphore	xc_ctx_lock ____cacheline_aligned_in_smp;
 	struct xfs_cil_ctx	*xc_ctx;
@@ -329,6 +348,14 @@ struct xfs_cil {
  */
 #define XLOG_CIL_SPACE_LIMIT(log)	(log->l_logsize >> 3)
 
+/*
+ * Space used by commits is added to the context once a CPU has gathered this
+ * much of it, so that the push threshold check does not need a shared counter
+ * update on every commit.
+ */
+#define XLOG_CIL_PCP_SPACE(log)	\
+	(XLOG_CIL_SPACE_LIMIT(log) / num_online_cpus())
+
 /*
  * ticket grant locks, queues and accounting have their own cachlines
  * as these are quite hot and can be operated on concurrently.
@@ -0,0 +1,136 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef _LINUX_ASYNC_FORK_H
+#define _LINUX_ASYNC_FORK_H
+
+#include <linux/mm.h>
+
+struct task_struct;
+
+#ifdef CONFIG_ASYNC_FORK
+
+extern int sysctl_async_fork;
+extern unsigned long sysctl_async_fork_min_rss_mb;
+
+/*
+ * VMAs whose pte tables may be left behind by fork.  This is evaluated on
+ * the parent's VMA at fork time and on the child's copy afterwards, so it
+ * may only look at state dup_mmap() carries over unchanged.
+ */
+static inline bool async_fork_vma_eligible(struct vm_area_struct *vma)
+{
+	return vma->anon_vma &&
+	       !(vma->vm_flags & (VM_HUGETLB | VM_PFNMAP | VM_MIXEDMAP |
+				  VM_WIPEONFORK));
+}
+
+/*
+ * A pte table the child has not got a copy of yet.  User pmds otherwise
+ * always carry _PAGE_RW, so a write-protected table entry can only come
+ * from an asynchronous fork.
+ */
+static inline bool async_fork_pmd_pending(pmd_t pmd)
+{
+	return pmd_present(pmd) && !pmd_trans_huge(pmd) &&
+	       !pmd_devmap(pmd) && !pmd_write(pmd);
+}
+
+static inline bool mm_async_fork_pending(struct mm_struct *mm)
+{
+	return READ_ONCE(mm->async_fork_parent) ||
+	       READ_ONCE(mm->async_fork_child);
+}
+
+extern void async_fork_prepare(struct mm_struct *mm,
+			       struct mm_struct *oldmm);
+extern void async_fork_queue(struct task_struct *p);
+extern bool __async_fork_defer_pmd(struct mm_struct *src_mm, pmd_t *src_pmd,
+				   struct vm_area_struct *vma);
+extern void __async_fork_fixup_pmd(struct mm_struct *mm, pmd_t *pmd,
+				   unsigned long addr);
+extern void __async_fork_finish(struct mm_struct *mm, bool copy);
+
+/* Called by copy_pmd_range() instead of copying a pte table. */
+static inline bool async_fork_defer_pmd(struct mm_struct *dst_mm,
+					struct mm_struct *src_mm,
+					pmd_t *src_pmd,
+					struct vm_area_struct *vma)
+{
+	if (likely(dst_mm->async_fork_parent != src_mm))
+		return false;
+	return __async_fork_defer_pmd(src_mm, src_pmd, vma);
+}
+
+/*
+ * The parent is about to change the ptes under @pmd: hand the child its
+ * copy first.
+ */
+static inline void async_fork_fixup_pmd(struct mm_struct *mm, pmd_t *pmd,
+					unsigned long addr)
+{
+	if (unlikely(READ_ONCE(mm->async_fork_child)) &&
+	    async_fork_pmd_pending(*pmd))
+		__async_fork_fixup_pmd(mm, pmd, addr);
+}
+
+/* Somebody is about to fault on @mm: make sure it is fully populated. */
+static inline void async_fork_sync(struct mm_struct *mm)
+{
+	if (unlikely(READ_ONCE(mm->async_fork_parent)))
+		__async_fork_finish(mm, true);
+}
+
+/*
+ * @mm is being torn down.  A parent still owes its child the remaining
+ * pte tables; a child that never ran just releases the parent's.
+ */
+static inline void async_fork_exit(struct mm_struct *mm)
+{
+	if (unlikely(mm_async_fork_pending(mm)))
+		__async_fork_finish(mm, !READ_ONCE(mm->async_fork_parent));
+}
+
+#else /* !CONFIG_ASYNC_FORK */
+
+static inline bool async_fork_pmd_pending(pmd_t pmd)
+{
+	return false;
+}
+
+static inline bool mm_async_fork_pending(struct mm_struct *mm)
+{
+	return false;
+}
+
+static inline void async_fork_prepare(struct mm_struct *mm,
+				      struct mm_struct *oldmm)
+{
+}
+
+static inline void async_fork_queue(struct task_struct *p)
+{
+}
+
+static inline bool async_fork_defer_pmd(struct mm_struct *dst_mm,
+					struct mm_struct *src_mm,
+					pmd_t *src_pmd,
+					struct vm_area_struct *vma)
+{
+	return false;
+}
+
+static inline void async_fork_fixup_pmd(struct mm_struct *mm, pmd_t *pmd,
+					unsigned long addr)
+{
+}
+
+static inline void async_fork_sync(struct mm_struct *mm)
+{
+}
+
+static inline void async_fork_exit(struct mm_struct *mm)
+{
+}
+
+#endif /* CONFIG_ASYNC_FORK */
+
+#endif /* _LINUX_ASYNC_FORK_H */
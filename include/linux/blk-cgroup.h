@@ -110,6 +110,43 @@ struct blkcg_policy_data {
 	int				plid;
 };
 
+#define BLKG_POLL_HIST_BKTS	12
+
+/*
+ * Completion latencies of polled requests of one blkg. @stat is bucketed
+ * like request_queue->poll_stat, @hist counts completions in power of two
+ * microsecond buckets, the last one collecting everything from 1ms up.
+ */
+struct blkg_poll_stat {
+	struct blk_rq_stat		stat[BLK_MQ_POLL_STATS_BKTS];
+	u64				hist[BLKG_POLL_HIST_BKTS];
+};
+
+#define BLKG_LAT_HIST_BKTS	22
+
+enum blkg_lat_stage {
+	BLKG_LAT_QUEUE,		/* allocation to dispatch */
+	BLKG_LAT_DEVICE,	/* dispatch to completion */
+	BLKG_LAT_NR_STAGES,
+};
+
+/*
+ * Request latencies of one blkg per op group and stage for io.latency_hist,
+ * in power of two microsecond buckets like blkg_poll_stat::hist, the last
+ * one collecting everything from 1s up.
+ */
+struct blkg_lat_hist {
+	u64				hist[NR_STAT_GROUPS][BLKG_LAT_NR_STAGES]
+					    [BLKG_LAT_HIST_BKTS];
+};
+
+struct blkg_poll_stats {
+	/* filled during a stats window, folded into @cur when it ends */
+	struct blkg_poll_stat __percpu	*cpu_stat;
+	/* @stat of the last window with samples, @hist since allocation */
+	struct blkg_poll_stat		cur;
+};
+
 /* association between a blk cgroup and a request queue */
 struct blkcg_gq {
 	/* Pointer to the associated request_queue */
@@ -148,6 +185,12 @@ struct blkcg_gq {
 	atomic64_t			delay_start;
 	u64				last_delay;
 	int				last_use;
+
+	/* hybrid polling stats, allocated on first use by blk_mq_poll() */
+	struct blkg_poll_stats		*poll_stats;
+
+	/* allocated on the first completion with blkcg_latency_hist set */
+	struct blkg_lat_hist __percpu	*lat_hist;
 };
 
 typedef struct blkcg_policy_data *(blkcg_pol_alloc_cpd_fn)(gfp_t gfp);
@@ -927,6 +970,22 @@ static inline void blkcg_clear_delay(struct blkcg_gq *blkg)
 void blkcg_add_delay(struct blkcg_gq *blkg, u64 now, u64 delta);
 void blkcg_schedule_throttle(struct request_queue *q, bool use_memdelay);
 void blkcg_maybe_throttle_current(void);
+
+extern bool blkcg_latency_hist;
+void __blkcg_rq_lat_done(struct request *rq, u64 now);
+
+/* whether requests have to be timed at dispatch for io.latency_hist */
+static inline bool blkcg_latency_hist_enabled(void)
+{
+	return unlikely(READ_ONCE(blkcg_latency_hist));
+}
+
+/* account a completed request to the io.latency_hist of its blkg */
+static inline void blkcg_rq_lat_done(struct request *rq, u64 now)
+{
+	if (blkcg_latency_hist_enabled())
+		__blkcg_rq_lat_done(rq, now);
+}
 #else	/* CONFIG_BLK_CGROUP */
 
 struct blkcg {
@@ -952,6 +1011,8 @@ static inline bool blk_cgroup_congested(void) { return false; }
 #ifdef CONFIG_BLOCK
 
 static inline void blkcg_schedule_throttle(struct request_queue *q, bool use_memdelay) { }
+static inline bool blkcg_latency_hist_enabled(void) { return false; }
+static inline void blkcg_rq_lat_done(struct request *rq, u64 now) { }
 
 static inline struct blkcg_gq *blkg_lookup(struct blkcg *blkcg, void *key) { return NULL; }
 static inline struct blkcg_gq *blk_queue_root_blkg(struct request_queue *q)
@@ -251,6 +251,7 @@ struct bio {
  * Extend bio flags should be added in here
  */
 #define BIO_THROTL_STATED 0	/* bio already stated */
+#define BIO_PERCPU_CACHE 1	/* can participate in per-cpu alloc cache */
 
 /* See BVEC_POOL_OFFSET below before adding new flags */
 
@@ -534,6 +534,8 @@ struct cgroup {
 	/* per-cpu recursive resource statistics */
 	struct cgroup_rstat_cpu __percpu *rstat_cpu;
 	struct list_head rstat_css_list;
+	/* number of cpus with updates in the subtree not flushed yet */
+	atomic_t rstat_pending;
 
 	/* cgroup basic resource statistics */
 	struct cgroup_base_stat pending_bstat;	/* pending from children */
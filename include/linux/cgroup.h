@@ -780,16 +780,25 @@ void cgroup_rstat_flush_irqsafe(struct cgroup *cgrp);
 void cgroup_rstat_flush_hold(struct cgroup *cgrp);
 void cgroup_rstat_flush_release(void);
 
+extern unsigned int sysctl_cgroup_rstat_flush_threshold;
+extern unsigned int sysctl_cgroup_rstat_flush_interval_ms;
+int cgroup_rstat_flush_threshold_handler(struct ctl_table *table, int write,
+					 void __user *buffer, size_t *lenp,
+					 loff_t *ppos);
+
 /*
  * Basic resource stats.
  */
 #ifdef CONFIG_CGROUP_CPUACCT
 void cpuacct_charge(struct task_struct *tsk, u64 cputime);
 void cpuacct_account_field(struct task_struct *tsk, int index, u64 val);
+void cpuacct_charge_css(struct cgroup_subsys_state *css, u64 cputime);
 #else
 static inline void cpuacct_charge(struct task_struct *tsk, u64 cputime) {}
 static inline void cpuacct_account_field(struct task_struct *tsk, int index,
 					 u64 val) {}
+static inline void cpuacct_charge_css(struct cgroup_subsys_state *css,
+				      u64 cputime) {}
 #endif
 
 void __cgroup_account_cputime(struct cgroup *cgrp, u64 delta_exec);
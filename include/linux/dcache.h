@@ -66,9 +66,11 @@ struct dentry_stat_t {
 	long nr_unused;
 	long age_limit;          /* age in seconds */
 	long want_pages;         /* pages requested by system */
-	long dummy[2];
+	long nr_negative;        /* # of unused negative dentries */
+	long dummy;
 };
 extern struct dentry_stat_t dentry_stat;
+extern unsigned long sysctl_negative_dentry_limit;
 
 /*
  * Try to keep struct dentry aligned on 64 byte cachelines (this will
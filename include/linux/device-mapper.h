@@ -255,6 +255,15 @@ struct target_type {
 #define DM_TARGET_NOWAIT		0x00000080
 #define dm_target_supports_nowait(type) ((type)->features & DM_TARGET_NOWAIT)
 
+/*
+ * For plain read and write bios not crossing max_io_len, ->map only
+ * moves the bio to another device and sector and returns
+ * DM_MAPIO_REMAPPED, without using per-bio data: dm may map the
+ * original bio instead of a clone.
+ */
+#define DM_TARGET_REMAP_IN_PLACE	0x00000100
+#define dm_target_remaps_in_place(type) ((type)->features & DM_TARGET_REMAP_IN_PLACE)
+
 struct dm_target {
 	struct dm_table *table;
 	struct target_type *type;
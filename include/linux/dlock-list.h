@@ -0,0 +1,127 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Distributed and locked lists
+ *
+ * A dlock list is a set of lists, each with its own spinlock.  Entries are
+ * added to the list that belongs to the adding CPU and removed from
+ * whichever list they were added to, so that adding and removing entries
+ * from many CPUs doesn't bounce a single lock around.  Walking all the
+ * entries visits the lists one after another with the lock of the current
+ * list held.
+ */
+#ifndef __LINUX_DLOCK_LIST_H
+#define __LINUX_DLOCK_LIST_H
+
+#include <linux/list.h>
+#include <linux/spinlock.h>
+
+struct dlock_list_head {
+	struct list_head list;
+	spinlock_t lock;
+} ____cacheline_aligned_in_smp;
+
+struct dlock_list_heads {
+	struct dlock_list_head *heads;
+};
+
+/*
+ * An entry embeds a dlock_list_node, which remembers the list it is on.
+ * @head is only changed under the lock of that list.
+ */
+struct dlock_list_node {
+	struct list_head list;
+	struct dlock_list_head *head;
+};
+
+/*
+ * Iterator state, the lock of @entry is held while an iteration is
+ * positioned on one of its entries.
+ */
+struct dlock_list_iter {
+	int index;
+	struct dlock_list_head *head, *entry;
+};
+
+#define DLOCK_LIST_ITER_INIT(dlist)			\
+	{						\
+		.index = -1,				\
+		.head = (dlist)->heads,			\
+	}
+
+#define DEFINE_DLOCK_LIST_ITER(s, dlist)		\
+	struct dlock_list_iter s = DLOCK_LIST_ITER_INIT(dlist)
+
+static inline void init_dlock_list_iter(struct dlock_list_iter *iter,
+					struct dlock_list_heads *dlist)
+{
+	*iter = (struct dlock_list_iter)DLOCK_LIST_ITER_INIT(dlist);
+}
+
+static inline void init_dlock_list_node(struct dlock_list_node *node)
+{
+	INIT_LIST_HEAD(&node->list);
+	node->head = NULL;
+}
+
+static inline bool dlock_list_node_empty(struct dlock_list_node *node)
+{
+	return list_empty_careful(&node->list);
+}
+
+/*
+ * Drop and retake the lock of the list the iterator is on, for walkers
+ * that have to sleep.  The entry the walk continues from must be kept on
+ * the list meanwhile, e.g. by holding a reference to it.
+ */
+static inline void dlock_list_unlock(struct dlock_list_iter *iter)
+{
+	spin_unlock(&iter->entry->lock);
+}
+
+static inline void dlock_list_relock(struct dlock_list_iter *iter)
+{
+	spin_lock(&iter->entry->lock);
+}
+
+extern int __alloc_dlock_list_heads(struct dlock_list_heads *dlist,
+				    struct lock_class_key *key);
+extern void free_dlock_list_heads(struct dlock_list_heads *dlist);
+
+/* one lock class for all the lists of a set, per call site */
+#define alloc_dlock_list_heads(dlist)					\
+({									\
+	static struct lock_class_key _key;				\
+	__alloc_dlock_list_heads(dlist, &_key);				\
+})
+
+extern bool dlock_lists_empty(struct dlock_list_heads *dlist);
+extern void dlock_lists_add(struct dlock_list_node *node,
+			    struct dlock_list_heads *dlist);
+extern void dlock_lists_del(struct dlock_list_node *node);
+
+extern struct dlock_list_node *
+__dlock_list_next_entry(struct dlock_list_node *curr,
+			struct dlock_list_iter *iter);
+
+/**
+ * dlist_for_each_entry - iterate over all the entries of a dlock list
+ * @pos:    the type * to use as a loop cursor
+ * @iter:   the dlock list iterator
+ * @member: the name of the dlock_list_node within the struct
+ *
+ * The lock of the list @pos is on is held in the loop body.  A walk that
+ * is left early must be finished with dlock_list_unlock().
+ */
+#define dlist_for_each_entry(pos, iter, member)				\
+	for (pos = NULL;						\
+	     ({								\
+		struct dlock_list_node *_n;				\
+									\
+		_n = __dlock_list_next_entry(pos ? &(pos)->member : NULL,\
+					     iter);			\
+		pos = _n ? list_entry(_n, typeof(*pos), member) : NULL;	\
+		pos != NULL;						\
+	     });							\
+	     )
+
+#endif /* __LINUX_DLOCK_LIST_H */
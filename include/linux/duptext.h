@@ -0,0 +1,52 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef _LINUX_DUPTEXT_H
+#define _LINUX_DUPTEXT_H
+
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/memcontrol.h>
+
+#ifdef CONFIG_DUPTEXT
+
+/*
+ * Text mappings of executables whose faults may be served from a copy of
+ * the page cache page on the faulting node.  VM_DENYWRITE keeps the file
+ * from being written for as long as such a copy is mapped.
+ */
+static inline bool duptext_vma(struct vm_area_struct *vma)
+{
+	if (!vma->vm_file ||
+	    (vma->vm_flags & (VM_EXEC | VM_DENYWRITE | VM_WRITE | VM_SHARED |
+			      VM_LOCKED)) != (VM_EXEC | VM_DENYWRITE))
+		return false;
+	if (num_online_nodes() < 2 || vma_is_dax(vma))
+		return false;
+	return mem_cgroup_duptext_enabled(vma->vm_mm);
+}
+
+extern void duptext_fault(struct vm_fault *vmf);
+
+static inline void duptext_drop_mapping(struct address_space *mapping)
+{
+	if (unlikely(READ_ONCE(mapping->nrduptext)))
+		__duptext_drop_mapping(mapping);
+}
+
+#else /* !CONFIG_DUPTEXT */
+
+static inline bool duptext_vma(struct vm_area_struct *vma)
+{
+	return false;
+}
+
+static inline void duptext_fault(struct vm_fault *vmf)
+{
+}
+
+static inline void duptext_drop_mapping(struct address_space *mapping)
+{
+}
+
+#endif /* CONFIG_DUPTEXT */
+
+#endif /* _LINUX_DUPTEXT_H */
@@ -3,11 +3,13 @@
 #define _LINUX_FUTEX_H
 
 #include <linux/ktime.h>
+#include <linux/err.h>
 #include <uapi/linux/futex.h>
 
 struct inode;
 struct mm_struct;
 struct task_struct;
+struct futex_q;
 
 /*
  * Futexes are matched on equal values of this key.
@@ -49,20 +51,44 @@ union futex_key {
 
 #ifdef CONFIG_FUTEX
 extern void exit_robust_list(struct task_struct *curr);
+extern void futex_mm_free(struct mm_struct *mm);
 
 long do_futex(u32 __user *uaddr, int op, u32 val, ktime_t *timeout,
 	      u32 __user *uaddr2, u32 val2, u32 val3);
+
+struct futex_q *futex_queue_async(u32 __user *uaddr, bool shared, u32 val,
+				  u32 bitset, void (*wake)(void *data),
+				  void *data);
+bool futex_unqueue_async(struct futex_q *q);
 #else
 static inline void exit_robust_list(struct task_struct *curr)
 {
 }
 
+static inline void futex_mm_free(struct mm_struct *mm)
+{
+}
+
 static inline long do_futex(u32 __user *uaddr, int op, u32 val,
 			    ktime_t *timeout, u32 __user *uaddr2,
 			    u32 val2, u32 val3)
 {
 	return -EINVAL;
 }
+
+static inline struct futex_q *futex_queue_async(u32 __user *uaddr,
+						bool shared, u32 val,
+						u32 bitset,
+						void (*wake)(void *data),
+						void *data)
+{
+	return ERR_PTR(-EOPNOTSUPP);
+}
+
+static inline bool futex_unqueue_async(struct futex_q *q)
+{
+	return false;
+}
 #endif
 
 #ifdef CONFIG_FUTEX_PI
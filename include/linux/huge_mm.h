@@ -65,6 +65,7 @@ enum transparent_hugepage_flag {
 #ifdef CONFIG_HUGETEXT
 	TRANSPARENT_HUGEPAGE_FILE_TEXT_ENABLED_FLAG,
 	TRANSPARENT_HUGEPAGE_ANON_TEXT_ENABLED_FLAG,
+	TRANSPARENT_HUGEPAGE_EXEC_PREFAULT_FLAG,
 #endif
 };
 
@@ -135,6 +136,10 @@ static inline bool transhuge_vma_enabled(struct vm_area_struct *vma,
 	(transparent_hugepage_flags &		\
 	 (1<<TRANSPARENT_HUGEPAGE_ANON_TEXT_ENABLED_FLAG))
 
+#define hugetext_prefault_enabled()		\
+	(transparent_hugepage_flags &		\
+	 (1<<TRANSPARENT_HUGEPAGE_EXEC_PREFAULT_FLAG))
+
 extern unsigned long hugetext_get_unmapped_area(struct file *filp,
 		unsigned long addr, unsigned long len, unsigned long pgoff,
 		unsigned long flags);
@@ -142,6 +147,7 @@ extern unsigned long hugetext_get_unmapped_area(struct file *filp,
 #define hugetext_enabled()	false
 #define hugetext_file_enabled()	false
 #define hugetext_anon_enabled()	false
+#define hugetext_prefault_enabled()	false
 
 static inline unsigned long hugetext_get_unmapped_area(struct file *filp,
 		unsigned long addr, unsigned long len, unsigned long pgoff,
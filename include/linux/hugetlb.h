@@ -81,6 +81,12 @@ struct resv_map {
 	long adds_in_progress;
 	struct list_head region_cache;
 	long region_cache_count;
+#ifdef CONFIG_CGROUP_HUGETLB
+	/* reservations are charged here by hugetlb_cgroup_charge_resv() */
+	struct hugetlb_cgroup *rsvd_cg;
+	struct page_counter *rsvd_counter;
+	unsigned long rsvd_charged;		/* in base pages */
+#endif
 };
 extern struct resv_map *resv_map_alloc(void);
 void resv_map_release(struct kref *ref);
@@ -466,10 +472,18 @@ struct hstate {
 	unsigned int surplus_huge_pages_node[MAX_NUMNODES];
 #ifdef CONFIG_HUGETLB_PAGE_FREE_VMEMMAP
 	unsigned int nr_free_vmemmap_pages;
+	/* stop freeing vmemmap of new pages, set via sysfs */
+	bool free_vmemmap_disabled;
+	/* vmemmap pages of a pool resize waiting for one TLB flush */
+	spinlock_t vmemmap_batch_lock;
+	unsigned int vmemmap_batch_depth;
+	struct list_head vmemmap_batch_pages;
+	unsigned long vmemmap_batch_start;
+	unsigned long vmemmap_batch_end;
 #endif
 #ifdef CONFIG_CGROUP_HUGETLB
 	/* cgroup control files */
-	struct cftype cgroup_files[5];
+	struct cftype cgroup_files[9];
 #endif
 	char name[HSTATE_NAME_LEN];
 };
@@ -17,6 +17,9 @@
 
 #include <linux/mmdebug.h>
 
+struct hstate;
+struct resv_map;
+
 #ifdef CONFIG_CGROUP_HUGETLB
 struct hugetlb_cgroup;
 /*
@@ -51,6 +54,30 @@ int set_hugetlb_cgroup(struct page *page, struct hugetlb_cgroup *h_cg)
 	return 0;
 }
 
+static inline struct hugetlb_cgroup *
+hugetlb_cgroup_from_page_rsvd(struct page *page)
+{
+	VM_BUG_ON_PAGE(!PageHuge(page), page);
+
+	if (compound_order(page) < HUGETLB_CGROUP_MIN_ORDER)
+		return NULL;
+	return (void *)page_private(page + SUBPAGE_INDEX_CGROUP_RSVD);
+}
+
+static inline
+int set_hugetlb_cgroup_rsvd(struct page *page, struct hugetlb_cgroup *h_cg)
+{
+	VM_BUG_ON_PAGE(!PageHuge(page), page);
+
+	if (compound_order(page) < HUGETLB_CGROUP_MIN_ORDER)
+		return -1;
+
+	set_page_private(page + SUBPAGE_INDEX_CGROUP_RSVD,
+			 (unsigned long)h_cg);
+
+	return 0;
+}
+
 static inline bool hugetlb_cgroup_disabled(void)
 {
 	return !cgroup_subsys_enabled(hugetlb_cgrp_subsys);
@@ -58,13 +85,27 @@ static inline bool hugetlb_cgroup_disabled(void)
 
 extern int hugetlb_cgroup_charge_cgroup(int idx, unsigned long nr_pages,
 					struct hugetlb_cgroup **ptr);
+extern int hugetlb_cgroup_charge_cgroup_rsvd(int idx, unsigned long nr_pages,
+					     struct hugetlb_cgroup **ptr);
 extern void hugetlb_cgroup_commit_charge(int idx, unsigned long nr_pages,
 					 struct hugetlb_cgroup *h_cg,
 					 struct page *page);
+extern void hugetlb_cgroup_commit_charge_rsvd(int idx, unsigned long nr_pages,
+					      struct hugetlb_cgroup *h_cg,
+					      struct page *page);
 extern void hugetlb_cgroup_uncharge_page(int idx, unsigned long nr_pages,
 					 struct page *page);
+extern void hugetlb_cgroup_uncharge_page_rsvd(int idx, unsigned long nr_pages,
+					      struct page *page);
 extern void hugetlb_cgroup_uncharge_cgroup(int idx, unsigned long nr_pages,
 					   struct hugetlb_cgroup *h_cg);
+extern void hugetlb_cgroup_uncharge_cgroup_rsvd(int idx, unsigned long nr_pages,
+						struct hugetlb_cgroup *h_cg);
+extern int hugetlb_cgroup_charge_resv(struct resv_map *resv, struct hstate *h,
+				      long nr);
+extern void hugetlb_cgroup_uncharge_resv(struct resv_map *resv,
+					 struct hstate *h, long nr);
+extern void hugetlb_cgroup_release_resv(struct resv_map *resv);
 extern void hugetlb_cgroup_file_init(void) __init;
 extern void hugetlb_cgroup_migrate(struct page *oldhpage,
 				   struct page *newhpage);
@@ -75,12 +116,24 @@ static inline struct hugetlb_cgroup *hugetlb_cgroup_from_page(struct page *page)
 	return NULL;
 }
 
+static inline struct hugetlb_cgroup *
+hugetlb_cgroup_from_page_rsvd(struct page *page)
+{
+	return NULL;
+}
+
 static inline
 int set_hugetlb_cgroup(struct page *page, struct hugetlb_cgroup *h_cg)
 {
 	return 0;
 }
 
+static inline
+int set_hugetlb_cgroup_rsvd(struct page *page, struct hugetlb_cgroup *h_cg)
+{
+	return 0;
+}
+
 static inline bool hugetlb_cgroup_disabled(void)
 {
 	return true;
@@ -93,6 +146,14 @@ hugetlb_cgroup_charge_cgroup(int idx, unsigned long nr_pages,
 	return 0;
 }
 
+static inline int
+hugetlb_cgroup_charge_cgroup_rsvd(int idx, unsigned long nr_pages,
+				  struct hugetlb_cgroup **ptr)
+{
+	*ptr = NULL;
+	return 0;
+}
+
 static inline void
 hugetlb_cgroup_commit_charge(int idx, unsigned long nr_pages,
 			     struct hugetlb_cgroup *h_cg,
@@ -100,17 +161,51 @@ hugetlb_cgroup_commit_charge(int idx, unsigned long nr_pages,
 {
 }
 
+static inline void
+hugetlb_cgroup_commit_charge_rsvd(int idx, unsigned long nr_pages,
+				  struct hugetlb_cgroup *h_cg,
+				  struct page *page)
+{
+}
+
 static inline void
 hugetlb_cgroup_uncharge_page(int idx, unsigned long nr_pages, struct page *page)
 {
 }
 
+static inline void
+hugetlb_cgroup_uncharge_page_rsvd(int idx, unsigned long nr_pages,
+				  struct page *page)
+{
+}
+
 static inline void
 hugetlb_cgroup_uncharge_cgroup(int idx, unsigned long nr_pages,
 			       struct hugetlb_cgroup *h_cg)
 {
 }
 
+static inline void
+hugetlb_cgroup_uncharge_cgroup_rsvd(int idx, unsigned long nr_pages,
+				    struct hugetlb_cgroup *h_cg)
+{
+}
+
+static inline int hugetlb_cgroup_charge_resv(struct resv_map *resv,
+					     struct hstate *h, long nr)
+{
+	return 0;
+}
+
+static inline void hugetlb_cgroup_uncharge_resv(struct resv_map *resv,
+						struct hstate *h, long nr)
+{
+}
+
+static inline void hugetlb_cgroup_release_resv(struct resv_map *resv)
+{
+}
+
 static inline void hugetlb_cgroup_file_init(void)
 {
 }
@@ -0,0 +1,57 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef _LINUX_IO_URING_H
+#define _LINUX_IO_URING_H
+
+#include <linux/sched.h>
+
+/*
+ * IORING_OP_URING_CMD hands sqe->cmd_op and the sqe->addr/sqe->len payload
+ * to ->uring_cmd() of the file.  A driver which returns -EIOCBQUEUED owns
+ * the command until it calls io_uring_cmd_done(), any other return value
+ * completes it right away.
+ */
+struct io_uring_cmd {
+	struct file	*file;
+	const void __user *cmd;
+	u32		cmd_len;
+	u32		cmd_op;
+	void (*task_work_cb)(struct io_uring_cmd *ioucmd,
+			     unsigned int issue_flags);
+	/* private to the driver while it owns the command */
+	u8		pdu[32];
+};
+
+/* ->uring_cmd() issue_flags */
+#define IO_URING_F_NONBLOCK	(1U << 0)
+/* the ring is going away, complete the command if it is still queued */
+#define IO_URING_F_CANCEL	(1U << 1)
+/* task_work_cb runs in a helper thread, the submitter is exiting */
+#define IO_URING_F_TASK_DEAD	(1U << 2)
+
+#if defined(CONFIG_IO_URING)
+void io_uring_cmd_done(struct io_uring_cmd *ioucmd, ssize_t ret);
+void io_uring_cmd_complete_in_task(struct io_uring_cmd *ioucmd,
+			void (*task_work_cb)(struct io_uring_cmd *, unsigned int));
+
+void __io_uring_free(struct task_struct *tsk);
+
+/* drop the rings registered with IORING_REGISTER_RING_FDS */
+static inline void io_uring_free(struct task_struct *tsk)
+{
+	if (tsk->io_uring)
+		__io_uring_free(tsk);
+}
+#else
+static inline void io_uring_cmd_done(struct io_uring_cmd *ioucmd, ssize_t ret)
+{
+}
+static inline void io_uring_cmd_complete_in_task(struct io_uring_cmd *ioucmd,
+			void (*task_work_cb)(struct io_uring_cmd *, unsigned int))
+{
+}
+static inline void io_uring_free(struct task_struct *tsk)
+{
+}
+#endif
+
+#endif
@@ -37,6 +37,9 @@ struct pt_regs;
  * @affinity_hint:	hint to user space for preferred irq affinity
  * @affinity_notify:	context for notification of affinity changes
  * @pending_mask:	pending rebalanced interrupts
+ * @balance_count:	tot_count at the last in-kernel balancer pass
+ * @balance_moved:	jiffies of the last move by the balancer
+ * @balance_cpu:	CPU the balancer moved the irq to plus one, 0 if none
  * @threads_oneshot:	bitfield to handle shared oneshot threads
  * @threads_active:	number of irqaction threads currently running
  * @wait_for_threads:	wait queue for sync_irq to wait for threaded handlers
@@ -80,6 +83,11 @@ struct irq_desc {
 #ifdef CONFIG_GENERIC_PENDING_IRQ
 	cpumask_var_t		pending_mask;
 #endif
+#ifdef CONFIG_IRQ_BALANCE
+	unsigned int		balance_count;
+	unsigned long		balance_moved;
+	unsigned int		balance_cpu;
+#endif
 #endif
 	unsigned long		threads_oneshot;
 	atomic_t		threads_active;
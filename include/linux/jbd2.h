@@ -265,7 +265,9 @@ typedef struct journal_superblock_s
 /* 0x0050 */
 	__u8	s_checksum_type;	/* checksum type */
 	__u8	s_padding2[3];
-	__u32	s_padding[42];
+/* 0x0054 */
+	__be32	s_num_fc_blks;		/* Number of fast commit blocks */
+	__u32	s_padding[41];
 	__be32	s_checksum;		/* crc32c(superblock) */
 
 /* 0x0100 */
@@ -291,6 +293,7 @@ typedef struct journal_superblock_s
 #define JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT	0x00000004
 #define JBD2_FEATURE_INCOMPAT_CSUM_V2		0x00000008
 #define JBD2_FEATURE_INCOMPAT_CSUM_V3		0x00000010
+#define JBD2_FEATURE_INCOMPAT_FAST_COMMIT	0x00000020
 
 /* See "journal feature predicate functions" below */
 
@@ -301,7 +304,21 @@ typedef struct journal_superblock_s
 					JBD2_FEATURE_INCOMPAT_64BIT | \
 					JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT | \
 					JBD2_FEATURE_INCOMPAT_CSUM_V2 | \
-					JBD2_FEATURE_INCOMPAT_CSUM_V3)
+					JBD2_FEATURE_INCOMPAT_CSUM_V3 | \
+					JBD2_FEATURE_INCOMPAT_FAST_COMMIT)
+
+/*
+ * The last s_num_fc_blks blocks of a journal with the fast commit feature
+ * are kept out of the log. Between two full commits they hold small
+ * filesystem specific records, which recovery hands back to the filesystem
+ * when they belong to the transaction following the last committed one.
+ */
+#define JBD2_DEFAULT_FAST_COMMIT_BLOCKS	256
+
+/* Recovery passes, the fast commit replay callback sees SCAN and REPLAY */
+enum passtype {PASS_SCAN, PASS_REVOKE, PASS_REPLAY};
+
+#define JBD2_FC_REPLAY_STOP	1
 
 #ifdef __KERNEL__
 
@@ -1124,6 +1141,55 @@ struct journal_s
 	void			(*j_commit_callback)(journal_t *,
 						     transaction_t *);
 
+	/**
+	 * @j_fc_first:
+	 *
+	 * The block number of the first fast commit block in the journal
+	 * [j_state_lock].
+	 */
+	unsigned long		j_fc_first;
+
+	/**
+	 * @j_fc_last:
+	 *
+	 * The block number one beyond the last fast commit block in the
+	 * journal [j_state_lock].
+	 */
+	unsigned long		j_fc_last;
+
+	/**
+	 * @j_fc_off:
+	 *
+	 * Number of fast commit blocks used since the last full commit.
+	 * [JBD2_FAST_COMMIT_ONGOING]
+	 */
+	unsigned long		j_fc_off;
+
+	/**
+	 * @j_fc_wbuf: Array of bhs of the fast commit blocks in use.
+	 */
+	struct buffer_head	**j_fc_wbuf;
+
+	/**
+	 * @j_fc_wait:
+	 *
+	 * Wait queue for fast and full commits to wait for each other.
+	 */
+	wait_queue_head_t	j_fc_wait;
+
+	/**
+	 * @j_fc_replay_callback:
+	 *
+	 * Called during recovery for each fast commit block, first for all of
+	 * them with PASS_SCAN then again with PASS_REPLAY. Returns 0 to get
+	 * the next block, JBD2_FC_REPLAY_STOP when done or a negative error.
+	 */
+	int			(*j_fc_replay_callback)(journal_t *journal,
+							struct buffer_head *bh,
+							enum passtype pass,
+							int off,
+							tid_t expected_tid);
+
 	/**
 	 * @j_checkpoint_task:
 	 *
@@ -1274,6 +1340,7 @@ JBD2_FEATURE_INCOMPAT_FUNCS(64bit,		64BIT)
 JBD2_FEATURE_INCOMPAT_FUNCS(async_commit,	ASYNC_COMMIT)
 JBD2_FEATURE_INCOMPAT_FUNCS(csum2,		CSUM_V2)
 JBD2_FEATURE_INCOMPAT_FUNCS(csum3,		CSUM_V3)
+JBD2_FEATURE_INCOMPAT_FUNCS(fast_commit,	FAST_COMMIT)
 
 /*
  * Journal flag definitions
@@ -1288,6 +1355,10 @@ JBD2_FEATURE_INCOMPAT_FUNCS(csum3,		CSUM_V3)
 						 * data write error in ordered
 						 * mode */
 #define JBD2_REC_ERR	0x080	/* The errno in the sb has been recorded */
+#define JBD2_FAST_COMMIT_ONGOING	0x100	/* Fast commit is ongoing */
+#define JBD2_FULL_COMMIT_ONGOING	0x200	/* Full commit is ongoing */
+#define JBD2_ASYNC_CHECKPOINT	0x400	/* Checkpoint in the background before
+					 * the log runs out of space */
 
 /*
  * Function declarations for the journaling transaction and buffer
@@ -1448,6 +1519,10 @@ extern int	   jbd2_journal_errno      (journal_t *);
 extern void	   jbd2_journal_ack_err    (journal_t *);
 extern int	   jbd2_journal_clear_err  (journal_t *);
 extern int	   jbd2_journal_bmap(journal_t *, unsigned long, unsigned long long *);
+extern int	   jbd2_fc_begin_commit(journal_t *journal, tid_t tid);
+extern void	   jbd2_fc_end_commit(journal_t *journal);
+extern int	   jbd2_fc_end_commit_fallback(journal_t *journal, tid_t tid);
+extern int	   jbd2_fc_get_buf(journal_t *journal, struct buffer_head **bh_out);
 extern int	   jbd2_journal_force_commit(journal_t *);
 extern int	   jbd2_journal_force_commit_nested(journal_t *);
 extern int	   jbd2_journal_inode_add_write(handle_t *handle, struct jbd2_inode *inode);
@@ -1539,8 +1614,10 @@ int jbd2_log_do_checkpoint(journal_t *journal);
 int jbd2_trans_will_send_data_barrier(journal_t *journal, tid_t tid);
 
 void __jbd2_log_wait_for_space(journal_t *journal);
+bool jbd2_log_need_bg_checkpoint(journal_t *journal);
 extern void __jbd2_journal_drop_transaction(journal_t *, transaction_t *);
 extern int jbd2_cleanup_journal_tail(journal_t *);
+extern void jbd2_fc_release_bufs(journal_t *journal);
 
 /*
  * is_journal_abort
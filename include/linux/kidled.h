@@ -214,6 +214,12 @@ static inline void kidled_inc_scan_seq(void)
 extern const int kidled_default_buckets[NUM_KIDLED_BUCKETS];
 
 bool kidled_use_hierarchy(void);
+struct mm_struct;
+struct seq_file;
+int kidled_mm_idle_page_stats(struct mm_struct *mm,
+			      struct idle_page_stats *stats);
+void kidled_show_idle_page_stats(struct seq_file *m,
+				 struct idle_page_stats *stats);
 #ifdef CONFIG_MEMCG
 void kidled_mem_cgroup_move_stats(struct mem_cgroup *from,
 				  struct mem_cgroup *to,
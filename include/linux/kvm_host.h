@@ -37,6 +37,7 @@
 #include <linux/kvm_types.h>
 
 #include <asm/kvm_host.h>
+#include <linux/kvm_dirty_ring.h>
 
 #ifndef KVM_MAX_VCPU_ID
 #define KVM_MAX_VCPU_ID KVM_MAX_VCPUS
@@ -216,6 +217,20 @@ struct kvm_mmio_fragment {
 	unsigned len;
 };
 
+/*
+ * Halt polls by duration: bucket 0 counts polls shorter than 1us and
+ * bucket n, up to the last one, those of [2^(n-1), 2^n) us.
+ */
+#define KVM_HALT_POLL_HIST_BUCKETS	16
+
+struct kvm_halt_poll_hist {
+	u64 success[KVM_HALT_POLL_HIST_BUCKETS];
+	u64 fail[KVM_HALT_POLL_HIST_BUCKETS];
+	/* Time spent in polls that did, or did not, avoid a wait */
+	u64 success_ns;
+	u64 fail_ns;
+};
+
 struct kvm_vcpu {
 	struct kvm *kvm;
 #ifdef CONFIG_PREEMPT_NOTIFIERS
@@ -242,6 +257,7 @@ struct kvm_vcpu {
 	struct kvm_vcpu_stat stat;
 	unsigned int halt_poll_ns;
 	bool valid_wakeup;
+	struct kvm_halt_poll_hist halt_poll_hist;
 
 #ifdef CONFIG_HAS_IOMEM
 	int mmio_needed;
@@ -276,6 +292,7 @@ struct kvm_vcpu {
 	bool preempted;
 	struct kvm_vcpu_arch arch;
 	struct dentry *debugfs_dentry;
+	struct kvm_dirty_ring dirty_ring;
 };
 
 static inline int kvm_vcpu_exiting_guest_mode(struct kvm_vcpu *vcpu)
@@ -303,8 +320,14 @@ struct kvm_memory_slot {
 	unsigned long userspace_addr;
 	u32 flags;
 	short id;
+	u16 as_id;
 };
 
+static inline bool kvm_slot_dirty_track_enabled(struct kvm_memory_slot *slot)
+{
+	return slot->flags & KVM_MEM_LOG_DIRTY_PAGES;
+}
+
 static inline unsigned long kvm_dirty_bitmap_bytes(struct kvm_memory_slot *memslot)
 {
 	return ALIGN(memslot->npages, BITS_PER_LONG) / 8;
@@ -396,7 +419,11 @@ struct kvm_memslots {
 };
 
 struct kvm {
+#ifdef KVM_HAVE_MMU_RWLOCK
+	rwlock_t mmu_lock;
+#else
 	spinlock_t mmu_lock;
+#endif /* KVM_HAVE_MMU_RWLOCK */
 	struct mutex slots_lock;
 	struct mm_struct *mm; /* userspace tied to this vm */
 	struct kvm_memslots __rcu *memslots[KVM_ADDRESS_SPACE_NUM];
@@ -455,6 +482,14 @@ struct kvm {
 	struct srcu_struct srcu;
 	struct srcu_struct irq_srcu;
 	pid_t userspace_pid;
+	/* Size in bytes of the dirty ring of each vcpu, 0 if not used */
+	u32 dirty_ring_size;
+	/* Set by KVM_CAP_HALT_POLL, the module parameters apply otherwise */
+	bool override_halt_poll;
+	bool halt_poll_uncontended;
+	unsigned int max_halt_poll_ns;
+	unsigned int halt_poll_grow;
+	unsigned int halt_poll_shrink;
 };
 
 #define kvm_err(fmt, ...) \
@@ -544,6 +579,7 @@ void kvm_vcpu_uninit(struct kvm_vcpu *vcpu);
 
 void vcpu_load(struct kvm_vcpu *vcpu);
 void vcpu_put(struct kvm_vcpu *vcpu);
+struct kvm_vcpu *kvm_get_running_vcpu(void);
 
 #ifdef __KVM_HAVE_IOAPIC
 void kvm_arch_post_irq_ack_notifier_list_update(struct kvm *kvm);
@@ -39,6 +39,7 @@ struct kmem_cache;
 struct oom_control;
 
 #define MEMCG_OOM_PRIORITY 12
+#define MEMCG_OOM_RANK_NR 8
 
 /* Cgroup-specific page state, on top of universal node page state */
 enum memcg_stat_item {
@@ -49,10 +50,14 @@ enum memcg_stat_item {
 	MEMCG_NR_STAT,
 };
 
+/* Counters BPF programs keep through bpf_memcg_exstat_add() */
+#define MEMCG_EXSTAT_BPF_NR	8
+
 enum memcg_exstat_item {
 	MEMCG_WMARK_MIN,
 	MEMCG_WMARK_RECLAIM,
-	MEMCG_NR_EXSTAT,
+	MEMCG_EXSTAT_BPF,
+	MEMCG_NR_EXSTAT = MEMCG_EXSTAT_BPF + MEMCG_EXSTAT_BPF_NR,
 };
 
 /* Only care about 64bit using "long" */
@@ -72,6 +77,14 @@ enum memcg_memory_event {
 	MEMCG_NR_MEMORY_EVENTS,
 };
 
+/* Per-memcg overrides of the kernel.numa_balancing_scan_* sysctls */
+enum memcg_numa_scan_param {
+	MEMCG_NUMA_SCAN_PERIOD_MIN,	/* ms */
+	MEMCG_NUMA_SCAN_PERIOD_MAX,	/* ms */
+	MEMCG_NUMA_SCAN_SIZE,		/* MB */
+	MEMCG_NR_NUMA_SCAN_PARAMS,
+};
+
 enum mem_cgroup_protection {
 	MEMCG_PROT_NONE,
 	MEMCG_PROT_LOW,
@@ -94,6 +107,8 @@ enum mem_lat_stat_item {
 	MEM_LAT_MEMCG_DIRECT_SWAPOUT,	/* memcg direct swapout latency */
 	MEM_LAT_DIRECT_SWAPIN,		/* direct swapin latency */
 	MEM_LAT_DIRTY_THROTTLE,		/* dirty throttle latency */
+	MEM_LAT_MAJOR_FAULT,		/* file major fault latency */
+	MEM_LAT_THP_FALLBACK,		/* failed THP fault allocation latency */
 	MEM_LAT_NR_STAT,
 };
 
@@ -247,6 +262,24 @@ struct memcg_padding {
 #define THP_RECLAIM_THRESHOLD_DEFAULT	16
 #endif
 
+/*
+ * Bucket for arbitrarily byte-sized objects charged to a memory
+ * cgroup. The bucket can be reparented in one piece when the cgroup
+ * is destroyed, without having to round up the individual references
+ * of all live memory objects in the wild.
+ */
+struct obj_cgroup {
+	struct percpu_ref refcnt;
+	struct mem_cgroup *memcg;
+	atomic_t nr_charged_bytes;
+	/* slab bytes, folded into the memcg's NR_SLAB_* page counters */
+	atomic_long_t nr_slab_bytes[2];
+	union {
+		struct list_head list;
+		struct rcu_head rcu;
+	};
+};
+
 /*
  * The memory controller data structure. The memory controller controls both
  * page cache and RSS per cgroup. We would eventually like to provide
@@ -262,6 +295,8 @@ struct mem_cgroup {
 	/* Accounted resources */
 	struct page_counter memory;
 	struct page_counter swap;
+	/* compressed zram storage, counted in bytes */
+	struct page_counter zram;
 
 	/* Legacy consumer-oriented counters */
 	struct page_counter memsw;
@@ -295,8 +330,13 @@ struct mem_cgroup {
 	int priority;
 	int num_oom_skip;
 	struct mem_cgroup *next_reset;
+	/* OOM victim candidates from the last full scan, under oom_lock */
+	struct pid *oom_rank[MEMCG_OOM_RANK_NR];
+	unsigned long oom_rank_stamp;
 
 	int	swappiness;
+	/* lowest priority of the swap devices used, SWAP_TIER_ALL for all */
+	int	swap_tier;
 	/* OOM-Killer disable */
 	int		oom_kill_disable;
 
@@ -366,12 +406,17 @@ struct mem_cgroup {
 	unsigned int		wmark_ratio;
 	struct work_struct	wmark_work;
 	unsigned int		wmark_scale_factor;
+	/* memory.pagecache_limit, reclaimed down to by wmark_work */
+	unsigned long		pagecache_limit;
 
 #ifdef CONFIG_MEMCG_KMEM
         /* Index in the kmem_cache->memcg_params.memcg_caches array */
 	int kmemcg_id;
 	enum memcg_kmem_state kmem_state;
 	struct list_head kmem_caches;
+	struct obj_cgroup __rcu *objcg;
+	/* list of inherited objcgs, protected by objcg_lock */
+	struct list_head objcg_list;
 #endif
 
 	int last_scanned_node;
@@ -384,6 +429,9 @@ struct mem_cgroup {
 #ifdef CONFIG_CGROUP_WRITEBACK
 	struct list_head cgwb_list;
 	struct wb_domain cgwb_domain;
+	/* limits of cgwb_domain, -1 and 0 follow the vm.dirty_* ones */
+	int dirty_ratio;
+	unsigned long dirty_background_bytes;
 #endif
 
 	/* List of events which userspace want to receive */
@@ -396,6 +444,8 @@ struct mem_cgroup {
 	struct kidled_scan_period scan_period;
 	int idle_stable_idx;
 	struct idle_page_stats idle_stats[KIDLED_STATS_NR_TYPE];
+	/* reclaim pages idle for more than this many scan periods */
+	int cold_reclaim_age;
 #endif
 
 	unsigned long offline_jiffies;
@@ -408,6 +458,22 @@ struct mem_cgroup {
 #ifdef CONFIG_TRANSPARENT_HUGEPAGE
 	int thp_reclaim;
 	int thp_reclaim_threshold;
+	/* huge pages khugepaged may collapse per minute, 0 means no limit */
+	unsigned int khugepaged_budget;
+	unsigned int khugepaged_collapsed;
+	unsigned long khugepaged_window;
+#endif
+
+#ifdef CONFIG_NUMA_BALANCING
+	/* memory.numa_balancing, 0 stops NUMA scanning of this memcg's mms */
+	bool numa_balancing;
+	/* memory.numa_balancing_scan_*, 0 means the kernel.* sysctl */
+	unsigned int numa_scan_params[MEMCG_NR_NUMA_SCAN_PARAMS];
+#endif
+
+#ifdef CONFIG_DUPTEXT
+	/* memory.allow_duptext, map node-local copies of executable text */
+	bool allow_duptext;
 #endif
 
 	CK_HOTFIX_RESERVE(1)
@@ -498,6 +564,10 @@ struct mem_cgroup *get_mem_cgroup_from_mm(struct mm_struct *mm);
 
 struct mem_cgroup *get_mem_cgroup_from_page(struct page *page);
 
+int mem_cgroup_charge_zram(struct page *page, unsigned int size,
+			   struct mem_cgroup **memcgp);
+void mem_cgroup_uncharge_zram(struct mem_cgroup *memcg, unsigned int size);
+
 static inline
 struct mem_cgroup *mem_cgroup_from_css(struct cgroup_subsys_state *css){
 	return css ? container_of(css, struct mem_cgroup, css) : NULL;
@@ -838,8 +908,9 @@ static inline void count_memcg_page_event(struct page *page,
 		count_memcg_events(page->mem_cgroup, idx, 1);
 }
 
-static inline void count_memcg_event_mm(struct mm_struct *mm,
-					enum vm_event_item idx)
+static inline void count_memcg_events_mm(struct mm_struct *mm,
+					 enum vm_event_item idx,
+					 unsigned long count)
 {
 	struct mem_cgroup *memcg;
 
@@ -849,10 +920,16 @@ static inline void count_memcg_event_mm(struct mm_struct *mm,
 	rcu_read_lock();
 	memcg = mem_cgroup_from_task(rcu_dereference(mm->owner));
 	if (likely(memcg))
-		count_memcg_events(memcg, idx, 1);
+		count_memcg_events(memcg, idx, count);
 	rcu_read_unlock();
 }
 
+static inline void count_memcg_event_mm(struct mm_struct *mm,
+					enum vm_event_item idx)
+{
+	count_memcg_events_mm(mm, idx, 1);
+}
+
 static inline void memcg_memory_event(struct mem_cgroup *memcg,
 				      enum memcg_memory_event event)
 {
@@ -938,6 +1015,7 @@ extern int global_thp_reclaim;
 extern void set_hugepage_reclaim_shrinker_bit(struct mem_cgroup *memcg,
 					      int nid);
 extern void reclaim_memcg_huge_pages(struct mem_cgroup *memcg);
+extern bool mem_cgroup_khugepaged_charge(struct mm_struct *mm);
 
 static inline struct list_head *hugepage_reclaim_list(struct page *page)
 {
@@ -1009,6 +1087,17 @@ static inline bool del_hugepage_from_queue(struct page *page)
 }
 #endif
 
+#ifdef CONFIG_NUMA_BALANCING
+extern bool mem_cgroup_numa_balancing_enabled(struct mm_struct *mm);
+extern unsigned int mem_cgroup_numa_scan_param(struct mm_struct *mm,
+					enum memcg_numa_scan_param param,
+					unsigned int dflt);
+#endif
+
+#ifdef CONFIG_DUPTEXT
+extern bool mem_cgroup_duptext_enabled(struct mm_struct *mm);
+#endif
+
 #else /* CONFIG_MEMCG */
 
 #ifdef CONFIG_TRANSPARENT_HUGEPAGE
@@ -1021,6 +1110,25 @@ static inline bool del_hugepage_from_queue(struct page *page)
 {
 	return false;
 }
+
+static inline bool mem_cgroup_khugepaged_charge(struct mm_struct *mm)
+{
+	return true;
+}
+#endif
+
+#ifdef CONFIG_NUMA_BALANCING
+static inline bool mem_cgroup_numa_balancing_enabled(struct mm_struct *mm)
+{
+	return true;
+}
+
+static inline unsigned int mem_cgroup_numa_scan_param(struct mm_struct *mm,
+					enum memcg_numa_scan_param param,
+					unsigned int dflt)
+{
+	return dflt;
+}
 #endif
 
 #define MEM_CGROUP_ID_SHIFT	0
@@ -1111,6 +1219,18 @@ static inline struct mem_cgroup *get_mem_cgroup_from_page(struct page *page)
 	return NULL;
 }
 
+static inline int mem_cgroup_charge_zram(struct page *page, unsigned int size,
+					 struct mem_cgroup **memcgp)
+{
+	*memcgp = NULL;
+	return 0;
+}
+
+static inline void mem_cgroup_uncharge_zram(struct mem_cgroup *memcg,
+					    unsigned int size)
+{
+}
+
 static inline void mem_cgroup_put(struct mem_cgroup *memcg)
 {
 }
@@ -1331,6 +1451,12 @@ static inline void count_memcg_page_event(struct page *page,
 {
 }
 
+static inline void count_memcg_events_mm(struct mm_struct *mm,
+					 enum vm_event_item idx,
+					 unsigned long count)
+{
+}
+
 static inline
 void count_memcg_event_mm(struct mm_struct *mm, enum vm_event_item idx)
 {
@@ -1494,6 +1620,8 @@ struct wb_domain *mem_cgroup_wb_domain(struct bdi_writeback *wb);
 void mem_cgroup_wb_stats(struct bdi_writeback *wb, unsigned long *pfilepages,
 			 unsigned long *pheadroom, unsigned long *pdirty,
 			 unsigned long *pwriteback);
+void mem_cgroup_wb_dirty_limits(struct bdi_writeback *wb, int *pratio,
+				unsigned long *pbg_bytes);
 
 #else	/* CONFIG_CGROUP_WRITEBACK */
 
@@ -1510,6 +1638,14 @@ static inline void mem_cgroup_wb_stats(struct bdi_writeback *wb,
 {
 }
 
+static inline void mem_cgroup_wb_dirty_limits(struct bdi_writeback *wb,
+					      int *pratio,
+					      unsigned long *pbg_bytes)
+{
+	*pratio = -1;
+	*pbg_bytes = 0;
+}
+
 #endif	/* CONFIG_CGROUP_WRITEBACK */
 
 struct sock;
@@ -1531,6 +1667,29 @@ static inline bool mem_cgroup_under_socket_pressure(struct mem_cgroup *memcg)
 	return false;
 }
 
+/*
+ * With cgroup v1, sockets are only charged to a memcg which has a
+ * memory.kmem.tcp limit of its own.  Tell where it stands against it,
+ * in pages.
+ */
+static inline bool mem_cgroup_tcpmem_usage(struct mem_cgroup *memcg,
+					   unsigned long *usage,
+					   unsigned long *max)
+{
+	if (cgroup_subsys_on_dfl(memory_cgrp_subsys) || !memcg->tcpmem_active)
+		return false;
+
+	*usage = page_counter_read(&memcg->tcpmem);
+	*max = READ_ONCE(memcg->tcpmem.max);
+	return true;
+}
+
+/* Cleared again by the next charge which finds memcg below its limit. */
+static inline void mem_cgroup_enter_tcpmem_pressure(struct mem_cgroup *memcg)
+{
+	memcg->tcpmem_pressure = 1;
+}
+
 extern int memcg_expand_shrinker_maps(int new_id);
 
 extern void memcg_set_shrinker_bit(struct mem_cgroup *memcg,
@@ -1544,6 +1703,17 @@ static inline bool mem_cgroup_under_socket_pressure(struct mem_cgroup *memcg)
 	return false;
 }
 
+static inline bool mem_cgroup_tcpmem_usage(struct mem_cgroup *memcg,
+					   unsigned long *usage,
+					   unsigned long *max)
+{
+	return false;
+}
+
+static inline void mem_cgroup_enter_tcpmem_pressure(struct mem_cgroup *memcg)
+{
+}
+
 static inline void memcg_set_shrinker_bit(struct mem_cgroup *memcg,
 					  int nid, int shrinker_id)
 {
@@ -1588,6 +1758,58 @@ static inline int memcg_cache_id(struct mem_cgroup *memcg)
 	return memcg ? memcg->kmemcg_id : -1;
 }
 
+static inline bool obj_cgroup_tryget(struct obj_cgroup *objcg)
+{
+	return percpu_ref_tryget(&objcg->refcnt);
+}
+
+static inline void obj_cgroup_get(struct obj_cgroup *objcg)
+{
+	percpu_ref_get(&objcg->refcnt);
+}
+
+static inline void obj_cgroup_put(struct obj_cgroup *objcg)
+{
+	percpu_ref_put(&objcg->refcnt);
+}
+
+/*
+ * After the initialization objcg->memcg is always pointing at
+ * a valid memcg, but can be atomically swapped to the parent memcg.
+ *
+ * The caller must ensure that the returned memcg won't be released:
+ * e.g. acquire the rcu_read_lock or objcg_lock.
+ */
+static inline struct mem_cgroup *obj_cgroup_memcg(struct obj_cgroup *objcg)
+{
+	return READ_ONCE(objcg->memcg);
+}
+
+/*
+ * Slab pages shared by several memory cgroups carry a vector of
+ * obj_cgroup pointers, one per object, instead of page->mem_cgroup.
+ * The vector pointer is tagged with the lowest bit to tell it apart.
+ */
+static inline struct obj_cgroup **page_obj_cgroups(struct page *page)
+{
+	return (struct obj_cgroup **)
+		((unsigned long)page->obj_cgroups & ~0x1UL);
+}
+
+static inline bool page_has_obj_cgroups(struct page *page)
+{
+	return ((unsigned long)page->obj_cgroups & 0x1UL);
+}
+
+struct obj_cgroup *get_obj_cgroup_from_current(void);
+int obj_cgroup_charge(struct obj_cgroup *objcg, gfp_t gfp, size_t size);
+void obj_cgroup_uncharge(struct obj_cgroup *objcg, size_t size);
+void mod_objcg_slab_state(struct obj_cgroup *objcg, bool reclaimable,
+			  int nr_bytes);
+int memcg_alloc_page_obj_cgroups(struct page *page, struct kmem_cache *s,
+				 gfp_t gfp);
+struct mem_cgroup *mem_cgroup_from_obj(void *p);
+
 #else
 #define for_each_memcg_cache_index(_idx)	\
 	for (; NULL; )
@@ -1610,6 +1832,16 @@ static inline void memcg_put_cache_ids(void)
 {
 }
 
+static inline bool page_has_obj_cgroups(struct page *page)
+{
+	return false;
+}
+
+static inline struct mem_cgroup *mem_cgroup_from_obj(void *p)
+{
+	return NULL;
+}
+
 #endif /* CONFIG_MEMCG_KMEM */
 
 #endif /* _LINUX_MEMCONTROL_H */
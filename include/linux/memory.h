@@ -34,6 +34,7 @@ struct memory_block {
 	int (*phys_callback)(struct memory_block *);
 	struct device dev;
 	int nid;			/* NID for this memory block */
+	unsigned long nr_vmemmap_pages;	/* memmap at the start of the block */
 };
 
 int arch_get_memory_phys_device(unsigned long start_pfn);
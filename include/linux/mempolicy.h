@@ -132,6 +132,8 @@ void mpol_shared_policy_init(struct shared_policy *sp, struct mempolicy *mpol);
 int mpol_set_shared_policy(struct shared_policy *info,
 				struct vm_area_struct *vma,
 				struct mempolicy *new);
+int mpol_shared_policy_set_all(struct shared_policy *sp, unsigned short mode,
+			       nodemask_t *nodes);
 void mpol_free_shared_policy(struct shared_policy *p);
 struct mempolicy *mpol_shared_policy_lookup(struct shared_policy *sp,
 					    unsigned long idx);
@@ -233,6 +235,13 @@ static inline void mpol_shared_policy_init(struct shared_policy *sp,
 {
 }
 
+static inline int mpol_shared_policy_set_all(struct shared_policy *sp,
+					     unsigned short mode,
+					     nodemask_t *nodes)
+{
+	return -EINVAL;
+}
+
 static inline void mpol_free_shared_policy(struct shared_policy *p)
 {
 }
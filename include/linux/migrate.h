@@ -25,6 +25,7 @@ enum migrate_reason {
 	MR_MEMPOLICY_MBIND,
 	MR_NUMA_MISPLACED,
 	MR_CONTIG_RANGE,
+	MR_DEMOTION,
 	MR_TYPES
 };
 
@@ -123,7 +124,25 @@ static inline void __ClearPageMovable(struct page *page)
 }
 #endif
 
+#if defined(CONFIG_MIGRATION) && defined(CONFIG_NUMA)
+extern bool numa_demotion_enabled;
+extern int next_demotion_node(int node);
+extern bool node_is_toptier(int node);
+#else
+#define numa_demotion_enabled	false
+static inline int next_demotion_node(int node)
+{
+	return NUMA_NO_NODE;
+}
+static inline bool node_is_toptier(int node)
+{
+	return true;
+}
+#endif
+
 #ifdef CONFIG_NUMA_BALANCING
+extern bool numa_promotion_enabled;
+extern bool numa_promotion_allowed(struct page *page, int dst_nid);
 extern bool pmd_trans_migrating(pmd_t pmd);
 extern int migrate_misplaced_page(struct page *page,
 				  struct vm_area_struct *vma, int node);
@@ -1595,6 +1595,38 @@ static inline void unmap_mapping_range(struct address_space *mapping,
 		loff_t const holebegin, loff_t const holelen, int even_cows) { }
 #endif
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+extern int sysctl_speculative_page_fault;
+extern vm_fault_t handle_speculative_fault(struct mm_struct *mm,
+			unsigned long address, unsigned int flags);
+
+/*
+ * Called with mmap_sem held for write around anything a speculative
+ * fault must not race with.  Sections may nest.
+ */
+static inline void mmap_seq_write_begin(struct mm_struct *mm)
+{
+	if (!mm->mmap_seq_depth++)
+		write_seqcount_begin(&mm->mmap_seq);
+}
+
+static inline void mmap_seq_write_end(struct mm_struct *mm)
+{
+	VM_BUG_ON_MM(mm->mmap_seq_depth <= 0, mm);
+	if (!--mm->mmap_seq_depth)
+		write_seqcount_end(&mm->mmap_seq);
+}
+#else
+static inline vm_fault_t handle_speculative_fault(struct mm_struct *mm,
+			unsigned long address, unsigned int flags)
+{
+	return VM_FAULT_RETRY;
+}
+
+static inline void mmap_seq_write_begin(struct mm_struct *mm) { }
+static inline void mmap_seq_write_end(struct mm_struct *mm) { }
+#endif
+
 static inline void unmap_shared_mapping_range(struct address_space *mapping,
 		loff_t const holebegin, loff_t const holelen)
 {
@@ -2540,6 +2572,8 @@ void page_cache_async_readahead(struct address_space *mapping,
 				pgoff_t offset,
 				unsigned long size);
 
+void ra_streams_free(struct address_space *mapping);
+
 extern unsigned long stack_guard_gap;
 /* Generic expand stack which grows the stack according to GROWS{UP,DOWN} */
 extern int expand_stack(struct vm_area_struct *vma, unsigned long address);
@@ -2819,6 +2853,11 @@ const char * arch_vma_name(struct vm_area_struct *vma);
 void print_vma_addr(char *prefix, unsigned long rip);
 void vmemmap_remap_free(unsigned long start, unsigned long end,
 			unsigned long reuse);
+void vmemmap_remap_free_batch(unsigned long start, unsigned long end,
+			      unsigned long reuse,
+			      struct list_head *vmemmap_pages);
+void vmemmap_free_batch(unsigned long start, unsigned long end,
+			struct list_head *vmemmap_pages);
 int vmemmap_remap_alloc(unsigned long start, unsigned long end,
 			unsigned long reuse, gfp_t gfp_mask);
 
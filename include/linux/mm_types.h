@@ -9,6 +9,8 @@
 #include <linux/spinlock.h>
 #include <linux/rbtree.h>
 #include <linux/rwsem.h>
+#include <linux/mutex.h>
+#include <linux/seqlock.h>
 #include <linux/completion.h>
 #include <linux/cpumask.h>
 #include <linux/uprobes.h>
@@ -28,6 +30,7 @@ typedef int vm_fault_t;
 
 struct address_space;
 struct mem_cgroup;
+struct obj_cgroup;
 struct hmm;
 
 /*
@@ -194,7 +197,10 @@ struct page {
 	atomic_t _refcount;
 
 #ifdef CONFIG_MEMCG
-	struct mem_cgroup *mem_cgroup;
+	union {
+		struct mem_cgroup *mem_cgroup;
+		struct obj_cgroup **obj_cgroups;
+	};
 #endif
 
 	/*
@@ -342,6 +348,10 @@ struct vm_area_struct {
 	struct mempolicy *vm_policy;	/* NUMA policy for the VMA */
 #endif
 	struct vm_userfaultfd_ctx vm_userfaultfd_ctx;
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	/* Freed after a grace period, handle_speculative_fault() peeks */
+	struct rcu_head vm_rcu;
+#endif
 
 	CK_HOTFIX_RESERVE(1)
 	CK_HOTFIX_RESERVE(2)
@@ -411,6 +421,30 @@ struct mm_struct {
 					     * counters
 					     */
 		struct rw_semaphore mmap_sem;
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+		/*
+		 * Written under mmap_sem write around changes to the VMA
+		 * tree, to the VMA fields a fault depends on and to the page
+		 * table layout, so handle_speculative_fault() can tell its
+		 * lockless view went stale.  mmap_seq_depth lets such
+		 * sections nest.
+		 */
+		seqcount_t mmap_seq;
+		int mmap_seq_depth;
+#endif
+#ifdef CONFIG_ASYNC_FORK
+		/*
+		 * Pte tables fork left behind are still being copied from
+		 * async_fork_parent (seen from the child) to async_fork_child
+		 * (seen from the parent).  Copies are serialized by the
+		 * parent's async_fork_mutex.
+		 */
+		struct mm_struct *async_fork_parent;
+		struct mm_struct *async_fork_child;
+		struct mutex async_fork_mutex;
+		struct callback_head async_fork_work;
+		bool async_fork_failed;
+#endif
 
 		struct list_head mmlist; /* List of maybe swapped mm's.	These
 					  * are globally strung together off
@@ -510,6 +544,10 @@ struct mm_struct {
 		atomic_long_t hugetlb_usage;
 #endif
 		struct work_struct async_put_work;
+#ifdef CONFIG_FUTEX
+		/* Private futex hash, see hash_futex() */
+		struct futex_private_hash *futex_hash;
+#endif
 
 #if IS_ENABLED(CONFIG_HMM)
 		/* HMM needs to track a few things per mm */
@@ -301,13 +301,42 @@ enum zone_watermarks {
 #define high_wmark_pages(z) (z->_watermark[WMARK_HIGH] + z->watermark_boost)
 #define wmark_pages(z, i) (z->_watermark[i] + z->watermark_boost)
 
+/*
+ * The pcp-lists hold pages of every order up to PAGE_ALLOC_COSTLY_ORDER,
+ * plus pageblock_order pages for THP, one list per order and migrate type.
+ */
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+#define NR_PCP_THP 1
+#else
+#define NR_PCP_THP 0
+#endif
+#define NR_PCP_ORDERS (PAGE_ALLOC_COSTLY_ORDER + 1 + NR_PCP_THP)
+#define NR_PCP_LISTS (MIGRATE_PCPTYPES * NR_PCP_ORDERS)
+
 struct per_cpu_pages {
 	int count;		/* number of pages in the list */
 	int high;		/* high watermark, emptying needed */
 	int batch;		/* chunk size for buddy add/remove */
 
-	/* Lists of pages, one per migrate type stored on the pcp-lists */
-	struct list_head lists[MIGRATE_PCPTYPES];
+	/*
+	 * high moves between high_min and high_max with the rate pages are
+	 * freed to this CPU, free_count counts them since the last decay.
+	 */
+	int high_min;
+	int high_max;
+	int free_count;
+
+	/*
+	 * The order > 0 lists are accounted and trimmed on their own, in
+	 * base pages, so a burst of high-order frees can't push the order-0
+	 * pages out and vice versa.  They are part of count as well.
+	 */
+	int high_order_count;
+	int high_order_high;
+	int high_order_batch;
+
+	/* Lists of pages, one per migrate type and order on the pcp-lists */
+	struct list_head lists[NR_PCP_LISTS];
 };
 
 struct per_cpu_pageset {
@@ -498,6 +527,13 @@ struct zone {
 	/* Primarily protects free_area */
 	spinlock_t		lock;
 
+#ifdef CONFIG_PAGE_REPORTING
+	/* Free page reporting state, see mm/page_reporting.c */
+	unsigned int		reporting_order;
+	unsigned long		reported_pages;
+	unsigned long		reported_refaults;
+#endif
+
 	/* Write-intensive fields used by compaction and vmstats. */
 	ZONE_PADDING(_pad2_)
 
@@ -747,6 +783,12 @@ typedef struct pglist_data {
 	unsigned long		min_slab_pages;
 #endif /* CONFIG_NUMA */
 
+#ifdef CONFIG_NUMA_BALANCING
+	/* Promotion rate limiting window, see numa_promotion_allowed() */
+	unsigned long		numa_promote_rl_start;
+	atomic_long_t		numa_promote_rl_nr;
+#endif
+
 	/* Write-intensive fields used by page reclaim */
 	ZONE_PADDING(_pad1_)
 	spinlock_t		lru_lock;
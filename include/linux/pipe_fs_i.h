@@ -4,6 +4,9 @@
 
 #define PIPE_DEF_BUFFERS	16
 
+/* Largest pipe_write() buffer F_SETPIPE_BUFSZ accepts */
+#define PIPE_MAX_BUF_ORDER	PAGE_ALLOC_COSTLY_ORDER
+
 #define PIPE_BUF_FLAG_LRU	0x01	/* page is on the LRU */
 #define PIPE_BUF_FLAG_ATOMIC	0x02	/* was atomically mapped */
 #define PIPE_BUF_FLAG_GIFT	0x04	/* page is a gift */
@@ -32,6 +35,7 @@ struct pipe_buffer {
  *	@wait: reader/writer wait point in case of empty/full pipe
  *	@nrbufs: the number of non-empty pipe buffers in this pipe
  *	@buffers: total number of buffers (should be a power of 2)
+ *	@buf_order: page order of the buffers pipe_write() allocates
  *	@curbuf: the current pipe buffer entry
  *	@tmp_page: cached released page
  *	@readers: number of current readers of this pipe
@@ -49,6 +53,7 @@ struct pipe_inode_info {
 	struct mutex mutex;
 	wait_queue_head_t wait;
 	unsigned int nrbufs, curbuf, buffers;
+	unsigned int buf_order;
 	unsigned int readers;
 	unsigned int writers;
 	unsigned int files;
@@ -189,7 +194,7 @@ void pipe_buf_mark_unmergeable(struct pipe_buffer *buf);
 
 extern const struct pipe_buf_operations nosteal_pipe_buf_ops;
 
-/* for F_SETPIPE_SZ and F_GETPIPE_SZ */
+/* for F_SETPIPE_SZ, F_GETPIPE_SZ, F_SETPIPE_BUFSZ and F_GETPIPE_BUFSZ */
 long pipe_fcntl(struct file *, unsigned int, unsigned long arg);
 struct pipe_inode_info *get_pipe_info(struct file *file);
 
@@ -101,6 +101,8 @@ struct psi_window {
 	u64 prev_growth;
 };
 
+struct psi_monitor;
+
 struct psi_trigger {
 	/* PSI state being monitored by the trigger */
 	enum psi_states state;
@@ -131,6 +133,10 @@ struct psi_trigger {
 
 	/* Refcounting to prevent premature destruction */
 	struct kref refcount;
+
+	/* Optional shared monitor the events are also reported to */
+	struct psi_monitor *monitor;
+	u64 cookie;
 };
 
 struct psi_group {
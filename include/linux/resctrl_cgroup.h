@@ -0,0 +1,39 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef _LINUX_RESCTRL_CGROUP_H
+#define _LINUX_RESCTRL_CGROUP_H
+
+#include <linux/types.h>
+
+#ifdef CONFIG_CGROUP_RESCTRL
+
+/*
+ * Interface between the cpu cgroup controller and the resctrl filesystem
+ * (x86 RDT, or MPAM on arm64).  A cpu cgroup bound to a resctrl group
+ * through cpu.resctrl_group hands its tasks that group's CLOSID/PARTID and
+ * RMID/PMG at fork and attach, so the two hierarchies can't drift apart.
+ */
+
+/*
+ * Implemented by the resctrl filesystem: look up the group named @mon under
+ * the control group @ctrl (either may be NULL for the default group), with
+ * the filesystem mutex held.
+ */
+extern int resctrl_group_lookup_ids(const char *ctrl, const char *mon,
+				    u32 *closid, u32 *rmid);
+
+/*
+ * Implemented by the scheduler: the resctrl group with @closid (and @rmid,
+ * unless @ctrl) is going away, unbind every cpu cgroup bound to it.  Called
+ * with the filesystem mutex held.
+ */
+extern void resctrl_cgroup_unbind(u32 closid, u32 rmid, bool ctrl);
+
+#else /* !CONFIG_CGROUP_RESCTRL */
+
+static inline void resctrl_cgroup_unbind(u32 closid, u32 rmid, bool ctrl)
+{
+}
+
+#endif /* CONFIG_CGROUP_RESCTRL */
+
+#endif /* _LINUX_RESCTRL_CGROUP_H */
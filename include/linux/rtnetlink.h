@@ -95,6 +95,11 @@ void net_inc_egress_queue(void);
 void net_dec_egress_queue(void);
 #endif
 
+#ifdef CONFIG_NET_SCHED
+void net_inc_tc_txq_map(void);
+void net_dec_tc_txq_map(void);
+#endif
+
 void rtnetlink_init(void);
 void __rtnl_unlock(void);
 void rtnl_kfree_skbs(struct sk_buff *head, struct sk_buff *tail);
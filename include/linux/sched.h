@@ -40,6 +40,7 @@ struct cfs_rq;
 struct fs_struct;
 struct futex_pi_state;
 struct io_context;
+struct io_uring_task;
 struct mempolicy;
 struct nameidata;
 struct nsproxy;
@@ -524,6 +525,7 @@ struct sched_entity {
 	int				id_flags;
 #ifdef CONFIG_SCHED_SMT
 	struct list_head		expel_node;
+	u64				expel_stamp;
 #endif
 #endif
 
@@ -652,6 +654,45 @@ struct sched_dl_entity {
 	CK_HOTFIX_RESERVE(8)
 };
 
+#ifdef CONFIG_UCLAMP_TASK
+/* Number of utilization clamp buckets (shorter alias) */
+#define UCLAMP_BUCKETS CONFIG_UCLAMP_BUCKETS_COUNT
+
+enum uclamp_id {
+	UCLAMP_MIN = 0, /* Minimum utilization */
+	UCLAMP_MAX,     /* Maximum utilization */
+	UCLAMP_CNT
+};
+
+/*
+ * Utilization clamp for a scheduling entity
+ * @value:		clamp value "assigned" to a se
+ * @bucket_id:		bucket index corresponding to the "assigned" value
+ * @active:		the se is currently refcounted in a rq's bucket
+ * @user_defined:	the requested clamp value comes from user-space
+ *
+ * The bucket_id is the index of the clamp bucket matching the clamp value
+ * which is pre-computed and stored to avoid expensive integer divisions from
+ * the fast path.
+ *
+ * The active bit is set whenever a task has got an "effective" value assigned,
+ * which can be different from the clamp value "requested" from user-space.
+ * This allows to know a task is refcounted in the rq's bucket corresponding
+ * to the "effective" bucket_id.
+ *
+ * The user_defined bit is set whenever a task has got a task-specific clamp
+ * value requested from userspace, i.e. the system defaults apply to this task
+ * just as its default value, not as a restriction.
+ */
+struct uclamp_se {
+	/* [0..SCHED_CAPACITY_SCALE] fits in 11 bits, 20 buckets in 5 */
+	unsigned int value		: 11;
+	unsigned int bucket_id		: 5;
+	unsigned int active		: 1;
+	unsigned int user_defined	: 1;
+};
+#endif /* CONFIG_UCLAMP_TASK */
+
 union rcu_special {
 	struct {
 		u8			blocked;
@@ -734,6 +775,13 @@ struct task_struct {
 #endif
 	struct sched_dl_entity		dl;
 
+#ifdef CONFIG_UCLAMP_TASK
+	/* Clamp values requested for a scheduling entity */
+	struct uclamp_se		uclamp_req[UCLAMP_CNT];
+	/* Effective clamp values used for a scheduling entity */
+	struct uclamp_se		uclamp[UCLAMP_CNT];
+#endif
+
 #ifdef CONFIG_PREEMPT_NOTIFIERS
 	/* List of struct preempt_notifier: */
 	struct hlist_head		preempt_notifiers;
@@ -1028,6 +1076,14 @@ struct task_struct {
 	struct held_lock		held_locks[MAX_LOCK_DEPTH];
 #endif
 
+#ifdef CONFIG_LOCK_CONTENTION_STAT
+	/* The sleeping lock being waited for, see lock_contention.c: */
+	void				*contention_lock;
+	void				*contention_site;
+	u64				contention_start;
+	unsigned int			contention_epoch;
+#endif
+
 #ifdef CONFIG_UBSAN
 	unsigned int			in_ubsan;
 #endif
@@ -1050,6 +1106,10 @@ struct task_struct {
 
 	struct io_context		*io_context;
 
+#ifdef CONFIG_IO_URING
+	struct io_uring_task		*io_uring;
+#endif
+
 #ifdef CONFIG_COMPACTION
 	struct capture_control		*capture_control;
 #endif
@@ -1852,12 +1912,24 @@ static inline int _cond_resched(void) { return 0; }
 })
 
 extern int __cond_resched_lock(spinlock_t *lock);
+extern int __cond_resched_rwlock_read(rwlock_t *lock);
+extern int __cond_resched_rwlock_write(rwlock_t *lock);
 
 #define cond_resched_lock(lock) ({				\
 	___might_sleep(__FILE__, __LINE__, PREEMPT_LOCK_OFFSET);\
 	__cond_resched_lock(lock);				\
 })
 
+#define cond_resched_rwlock_read(lock) ({			\
+	___might_sleep(__FILE__, __LINE__, PREEMPT_LOCK_OFFSET);\
+	__cond_resched_rwlock_read(lock);			\
+})
+
+#define cond_resched_rwlock_write(lock) ({			\
+	___might_sleep(__FILE__, __LINE__, PREEMPT_LOCK_OFFSET);\
+	__cond_resched_rwlock_write(lock);			\
+})
+
 static inline void cond_resched_rcu(void)
 {
 #if defined(CONFIG_DEBUG_ATOMIC_SLEEP) || !defined(CONFIG_PREEMPT_RCU)
@@ -1881,6 +1953,16 @@ static inline int spin_needbreak(spinlock_t *lock)
 #endif
 }
 
+/* The same for an rwlock held for read or for write */
+static inline int rwlock_needbreak(rwlock_t *lock)
+{
+#ifdef CONFIG_PREEMPT
+	return rwlock_is_contended(lock);
+#else
+	return 0;
+#endif
+}
+
 static __always_inline bool need_resched(void)
 {
 	return unlikely(tif_need_resched());
@@ -2138,4 +2220,14 @@ static inline void create_rich_container_reaper(struct task_struct *tsk) { }
 
 extern void sched_task_release(struct task_struct *p);
 
+#ifdef CONFIG_GROUP_IDENTITY
+extern bool sched_current_underclass(void);
+extern bool sched_cpu_highclass_running(int cpu);
+extern bool sched_cpu_underclass_only(int cpu);
+#else
+static inline bool sched_current_underclass(void) { return false; }
+static inline bool sched_cpu_highclass_running(int cpu) { return false; }
+static inline bool sched_cpu_underclass_only(int cpu) { return false; }
+#endif
+
 #endif
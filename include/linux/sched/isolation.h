@@ -2,6 +2,7 @@
 #define _LINUX_SCHED_ISOLATION_H
 
 #include <linux/cpumask.h>
+#include <linux/errno.h>
 #include <linux/init.h>
 #include <linux/tick.h>
 
@@ -43,8 +44,20 @@ static inline void housekeeping_init(void) { }
 #if defined(CONFIG_CPU_ISOLATION) && defined(CONFIG_CGROUP_SCHED)
 DECLARE_STATIC_KEY_FALSE(dyn_isolcpus_enabled);
 extern void wilds_cpus_allowed(struct cpumask *pmask);
+extern bool dyn_isolcpus_cpuset_check(const struct cpumask *isolated);
+extern int dyn_isolcpus_cpuset_update(const struct cpumask *isolated);
 #else
 static inline void wilds_cpus_allowed(struct cpumask *pmask) {}
+
+static inline bool dyn_isolcpus_cpuset_check(const struct cpumask *isolated)
+{
+	return cpumask_empty(isolated);
+}
+
+static inline int dyn_isolcpus_cpuset_update(const struct cpumask *isolated)
+{
+	return cpumask_empty(isolated) ? 0 : -EOPNOTSUPP;
+}
 #endif
 
 static inline bool housekeeping_cpu(int cpu, enum hk_flags flags)
@@ -52,6 +65,10 @@ static inline bool housekeeping_cpu(int cpu, enum hk_flags flags)
 #ifdef CONFIG_CPU_ISOLATION
 	if (static_branch_unlikely(&housekeeping_overriden))
 		return housekeeping_test_cpu(cpu, flags);
+#ifdef CONFIG_CGROUP_SCHED
+	if (static_branch_unlikely(&dyn_isolcpus_enabled))
+		return housekeeping_test_cpu(cpu, flags);
+#endif
 #endif
 	return true;
 }
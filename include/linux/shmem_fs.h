@@ -20,6 +20,7 @@ struct shmem_inode_info {
 	struct list_head        shrinklist;     /* shrinkable hpage inodes */
 	struct list_head	swaplist;	/* chain of maybes on swap */
 	struct shared_policy	policy;		/* NUMA memory alloc policy */
+	unsigned char		huge;		/* F_SET_SHMEM_HUGE, 0 if unset */
 	struct simple_xattrs	xattrs;		/* list of xattrs */
 	struct inode		vfs_inode;
 };
@@ -62,11 +63,17 @@ extern unsigned long shmem_get_unmapped_area(struct file *, unsigned long addr,
 extern int shmem_lock(struct file *file, int lock, struct user_struct *user);
 #ifdef CONFIG_SHMEM
 extern bool shmem_mapping(struct address_space *mapping);
+extern long shmem_fcntl(struct file *file, unsigned int cmd, unsigned long arg);
 #else
 static inline bool shmem_mapping(struct address_space *mapping)
 {
 	return false;
 }
+static inline long shmem_fcntl(struct file *file, unsigned int cmd,
+			       unsigned long arg)
+{
+	return -EINVAL;
+}
 #endif /* CONFIG_SHMEM */
 extern void shmem_unlock_mapping(struct address_space *mapping);
 extern struct page *shmem_read_mapping_page_gfp(struct address_space *mapping,
@@ -92,6 +92,13 @@
 /* Avoid kmemleak tracing */
 #define SLAB_NOLEAKTRACE	((slab_flags_t __force)0x00800000U)
 
+/* Front the cache with per-cpu sheaves of objects (SLUB only) */
+#ifdef CONFIG_SLUB_SHEAVES
+# define SLAB_SHEAVES		((slab_flags_t __force)0x01000000U)
+#else
+# define SLAB_SHEAVES		0
+#endif
+
 /* Fault injection mark */
 #ifdef CONFIG_FAILSLAB
 # define SLAB_FAILSLAB		((slab_flags_t __force)0x02000000U)
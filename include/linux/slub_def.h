@@ -8,6 +8,7 @@
  * (C) 2007 SGI, Christoph Lameter
  */
 #include <linux/kobject.h>
+#include <linux/reciprocal_div.h>
 
 enum stat_item {
 	ALLOC_FASTPATH,		/* Allocation from cpu slab */
@@ -36,6 +37,12 @@ enum stat_item {
 	CPU_PARTIAL_FREE,	/* Refill cpu partial on free */
 	CPU_PARTIAL_NODE,	/* Refill cpu partial from node partial */
 	CPU_PARTIAL_DRAIN,	/* Drain cpu partial to node partial */
+	ALLOC_PCS,		/* Allocation from percpu sheaf */
+	FREE_PCS,		/* Free to percpu sheaf */
+	SHEAF_REFILL,		/* Sheaf refilled from slabs */
+	SHEAF_FLUSH,		/* Objects of a sheaf flushed to slabs */
+	BARN_GET,		/* Full sheaf taken from the node barn */
+	BARN_PUT,		/* Full sheaf stored in the node barn */
 	NR_SLUB_STAT_ITEMS };
 
 struct kmem_cache_cpu {
@@ -67,6 +74,15 @@ struct kmem_cache_cpu {
 #define slub_percpu_partial_read_once(c)	NULL
 #endif // CONFIG_SLUB_CPU_PARTIAL
 
+#ifdef CONFIG_SLUB_SHEAVES
+struct slab_sheaf;
+
+struct slub_percpu_sheaves {
+	struct slab_sheaf *main;	/* never NULL */
+	struct slab_sheaf *spare;	/* may be NULL */
+};
+#endif
+
 /*
  * Word size structure that can be atomically updated or read and that
  * contains both the order and the number of objects that a slab of the
@@ -86,10 +102,15 @@ struct kmem_cache {
 	unsigned long min_partial;
 	unsigned int size;	/* The size of an object including meta data */
 	unsigned int object_size;/* The size of an object without meta data */
+	struct reciprocal_value reciprocal_size; /* For fast obj_to_index */
 	unsigned int offset;	/* Free pointer offset. */
 #ifdef CONFIG_SLUB_CPU_PARTIAL
 	/* Number of per cpu partial objects to keep around */
 	unsigned int cpu_partial;
+#endif
+#ifdef CONFIG_SLUB_SHEAVES
+	struct slub_percpu_sheaves __percpu *cpu_sheaves;
+	unsigned int sheaf_capacity;	/* Objects per sheaf */
 #endif
 	struct kmem_cache_order_objects oo;
 
@@ -182,4 +203,23 @@ static inline void *nearest_obj(struct kmem_cache *cache, struct page *page,
 	return result;
 }
 
+/* Determine object index from a given position */
+static inline unsigned int __obj_to_index(const struct kmem_cache *cache,
+					  void *addr, void *obj)
+{
+	return reciprocal_divide(obj - addr, cache->reciprocal_size);
+}
+
+static inline unsigned int obj_to_index(const struct kmem_cache *cache,
+					const struct page *page, void *obj)
+{
+	return __obj_to_index(cache, page_address(page), obj);
+}
+
+static inline int objs_per_slab_page(const struct kmem_cache *cache,
+				     const struct page *page)
+{
+	return page->objects;
+}
+
 #endif /* _LINUX_SLUB_DEF_H */
@@ -14,6 +14,7 @@ struct pid;
 struct cred;
 struct socket;
 struct file;
+struct ubuf_info;
 
 #define __sockaddr_check_size(size)	\
 	BUILD_BUG_ON(((size) > sizeof(struct __kernel_sockaddr_storage)))
@@ -55,6 +56,11 @@ struct msghdr {
 	__kernel_size_t	msg_controllen;	/* ancillary data buffer length */
 	unsigned int	msg_flags;	/* flags on received message */
 	struct kiocb	*msg_iocb;	/* ptr to iocb for async requests */
+	/*
+	 * With MSG_ZEROCOPY, use this caller-owned notification instead of
+	 * allocating one from the socket. Only valid for in-kernel senders.
+	 */
+	struct ubuf_info *msg_ubuf;
 };
  
 struct user_msghdr {
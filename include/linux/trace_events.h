@@ -464,6 +464,9 @@ trace_trigger_soft_disabled(struct trace_event_file *file)
 	return false;
 }
 
+/* BPF_RAW_TRACEPOINT_OPEN names of function entry attachments */
+#define BPF_FENTRY_PREFIX	"fentry/"
+
 #ifdef CONFIG_BPF_EVENTS
 unsigned int trace_call_bpf(struct trace_event_call *call, void *ctx);
 int perf_event_attach_bpf_prog(struct perf_event *event, struct bpf_prog *prog);
@@ -475,6 +478,7 @@ struct bpf_raw_event_map *bpf_find_raw_tracepoint(const char *name);
 int bpf_get_perf_event_info(const struct perf_event *event, u32 *prog_id,
 			    u32 *fd_type, const char **buf,
 			    u64 *probe_offset, u64 *probe_addr);
+int bpf_fentry_open(const char *func, u32 prog_fd);
 #else
 static inline unsigned int trace_call_bpf(struct trace_event_call *call, void *ctx)
 {
@@ -506,6 +510,10 @@ static inline struct bpf_raw_event_map *bpf_find_raw_tracepoint(const char *name
 {
 	return NULL;
 }
+static inline int bpf_fentry_open(const char *func, u32 prog_fd)
+{
+	return -EOPNOTSUPP;
+}
 static inline int bpf_get_perf_event_info(const struct perf_event *event,
 					  u32 *prog_id, u32 *fd_type,
 					  const char **buf, u64 *probe_offset,
@@ -47,15 +47,25 @@ enum vm_event_item { PGPGIN, PGPGOUT, PSWPIN, PSWPOUT,
 		PAGEOUTRUN, PGROTATED,
 		DROP_PAGECACHE, DROP_SLAB,
 		OOM_KILL,
+		READAHEAD_HIT,		/* readahead marker reached */
+		READAHEAD_MISS,		/* synchronous readahead on a miss */
+		READAHEAD_WASTED,	/* marker reclaimed before it was reached */
+		READAHEAD_STRIDE,	/* pages read ahead along a stride */
 #ifdef CONFIG_NUMA_BALANCING
 		NUMA_PTE_UPDATES,
 		NUMA_HUGE_PTE_UPDATES,
 		NUMA_HINT_FAULTS,
 		NUMA_HINT_FAULTS_LOCAL,
 		NUMA_PAGE_MIGRATE,
+		PGPROMOTE_SUCCESS,
+		PGPROMOTE_RATE_LIMITED,
 #endif
 #ifdef CONFIG_MIGRATION
 		PGMIGRATE_SUCCESS, PGMIGRATE_FAIL,
+#ifdef CONFIG_NUMA
+		PGDEMOTE_KSWAPD,
+		PGDEMOTE_DIRECT,
+#endif
 #endif
 #ifdef CONFIG_COMPACTION
 		COMPACTMIGRATE_SCANNED, COMPACTFREE_SCANNED,
@@ -113,6 +123,15 @@ enum vm_event_item { PGPGIN, PGPGOUT, PSWPIN, PSWPOUT,
 #ifdef CONFIG_SWAP
 		SWAP_RA,
 		SWAP_RA_HIT,
+#endif
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+		SPECULATIVE_PGFAULT,
+		SPECULATIVE_PGFAULT_ABORT,
+#endif
+#ifdef CONFIG_DUPTEXT
+		DUPTEXT_ALLOC,
+		DUPTEXT_FREE,
+		DUPTEXT_FAULT,
 #endif
 		NR_VM_EVENT_ITEMS
 };
@@ -340,6 +340,13 @@ enum {
 	 */
 	WQ_POWER_EFFICIENT	= 1 << 7,
 
+	/*
+	 * Unbound work items queued by a task of a cpuacct cgroup run in a
+	 * pool restricted to the task's cpuset, and the CPU time they take
+	 * is charged to that cgroup.  See wq_cgroup_pwq().
+	 */
+	WQ_CGROUP		= 1 << 8,
+
 	__WQ_DRAINING		= 1 << 16, /* internal: workqueue is draining */
 	__WQ_ORDERED		= 1 << 17, /* internal: workqueue is ordered */
 	__WQ_LEGACY		= 1 << 18, /* internal: create*_workqueue() */
@@ -495,6 +502,10 @@ extern __printf(1, 2) void set_worker_desc(const char *fmt, ...);
 extern void print_worker_info(const char *log_lvl, struct task_struct *task);
 extern void show_workqueue_state(void);
 extern void wq_worker_comm(char *buf, size_t size, struct task_struct *task);
+#ifdef CONFIG_CGROUP_CPUACCT
+struct cgroup_subsys_state;
+extern void workqueue_cgroup_offline(struct cgroup_subsys_state *css);
+#endif
 
 /**
  * queue_work - queue work on a workqueue
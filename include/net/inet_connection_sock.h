@@ -144,8 +144,8 @@ struct inet_connection_sock {
 	void                     *icsk_tcp_rt_priv;
 #endif
 
-	u64			  icsk_ca_priv[88 / sizeof(u64)];
-#define ICSK_CA_PRIV_SIZE      (11 * sizeof(u64))
+	u64			  icsk_ca_priv[104 / sizeof(u64)];
+#define ICSK_CA_PRIV_SIZE      (13 * sizeof(u64))
 };
 
 #define ICSK_TIME_RETRANS	1	/* Retransmit timer */
@@ -220,6 +220,20 @@ static inline void inet_csk_clear_xmit_timer(struct sock *sk, const int what)
 	}
 }
 
+/* A timer that is already due at or before @expires is left alone: the
+ * retransmit and delayed ACK handlers re-arm themselves for icsk_timeout and
+ * icsk_ack.timeout when they fire early. Pushing the timer later on every
+ * ACK would otherwise cost a timer base lock round trip each time.
+ */
+static inline void inet_csk_reset_timer_lazy(struct sock *sk,
+					     struct timer_list *timer,
+					     unsigned long expires)
+{
+	if (timer_pending(timer) && !time_after(timer->expires, expires))
+		return;
+	sk_reset_timer(sk, timer, expires);
+}
+
 /*
  *	Reset the retransmission timer
  */
@@ -240,11 +254,13 @@ static inline void inet_csk_reset_xmit_timer(struct sock *sk, const int what,
 	    what == ICSK_TIME_REO_TIMEOUT) {
 		icsk->icsk_pending = what;
 		icsk->icsk_timeout = jiffies + when;
-		sk_reset_timer(sk, &icsk->icsk_retransmit_timer, icsk->icsk_timeout);
+		inet_csk_reset_timer_lazy(sk, &icsk->icsk_retransmit_timer,
+					  icsk->icsk_timeout);
 	} else if (what == ICSK_TIME_DACK) {
 		icsk->icsk_ack.pending |= ICSK_ACK_TIMER;
 		icsk->icsk_ack.timeout = jiffies + when;
-		sk_reset_timer(sk, &icsk->icsk_delack_timer, icsk->icsk_ack.timeout);
+		inet_csk_reset_timer_lazy(sk, &icsk->icsk_delack_timer,
+					  icsk->icsk_ack.timeout);
 	} else {
 		pr_debug("inet_csk BUG: unknown timer value\n");
 	}
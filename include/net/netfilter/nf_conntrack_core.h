@@ -69,11 +69,24 @@ static inline int nf_conntrack_confirm(struct sk_buff *skb)
 void print_tuple(struct seq_file *s, const struct nf_conntrack_tuple *tuple,
 		 const struct nf_conntrack_l4proto *proto);
 
+/*
+ * The hash buckets share nf_conntrack_locks[], a power of two of them sized
+ * at boot from the number of possible cpus, CONNTRACK_LOCKS at least and
+ * CONNTRACK_LOCKS_MAX at most.  CONNTRACK_LOCKS is also the size of the
+ * fixed lock arrays of the NAT bysource hash.
+ */
 #define CONNTRACK_LOCKS 1024
+#define CONNTRACK_LOCKS_MAX 65536
 
-extern spinlock_t nf_conntrack_locks[CONNTRACK_LOCKS];
+extern spinlock_t *nf_conntrack_locks;
+extern unsigned int nf_conntrack_locks_mask;
 void nf_conntrack_lock(spinlock_t *lock);
 
+static inline spinlock_t *nf_conntrack_bucket_lock(unsigned int bucket)
+{
+	return &nf_conntrack_locks[bucket & nf_conntrack_locks_mask];
+}
+
 extern spinlock_t nf_conntrack_expect_lock;
 
 #endif /* _NF_CONNTRACK_CORE_H */
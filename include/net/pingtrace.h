@@ -33,10 +33,13 @@ enum pingtrace_function {
 	P_L_RX_SKDATAREADY,
 	P_L_RX_WAKEUP,
 	P_L_RX_USER,
+	P_R_RX_HWTS,
+	P_R_RX_NETIF,
 };
 
 enum PINGTRACE_HDR_FLAGS {
 	PINGTRACE_F_DONTADD	=	1,
+	PINGTRACE_F_NSEC	=	2,
 };
 
 struct pingtrace_timestamp {
@@ -65,5 +68,6 @@ DECLARE_STATIC_KEY_FALSE(pingtrace_control);
 int skb_pingtrace_check(struct sk_buff *skb, u64 flags);
 int skb_pingtrace_add_ts(struct sk_buff *skb, struct net *net, u32 function_id,
 			 u64 flags);
+void skb_pingtrace_add_rx_ts(struct sk_buff *skb, struct net *net);
 
 #endif /* _PINGTRACE_H */
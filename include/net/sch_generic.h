@@ -1123,6 +1123,26 @@ void mini_qdisc_pair_swap(struct mini_Qdisc_pair *miniqp,
 void mini_qdisc_pair_init(struct mini_Qdisc_pair *miniqp, struct Qdisc *qdisc,
 			  struct mini_Qdisc __rcu **p_miniq);
 
+/* What netdev_pick_tx() steers by when a root qdisc shapes per TX queue:
+ * skb->priority naming one of the classes in @entries, sorted by classid,
+ * goes to that class' queue, anything else to @default_queue or, when that
+ * is -1 or skb->priority is the qdisc's own X:0, to a queue below
+ * @num_direct.
+ */
+struct tc_txq_map_entry {
+	u32			classid;
+	unsigned int		queue;
+};
+
+struct tc_txq_map {
+	struct rcu_head		rcu;
+	u32			handle;
+	int			default_queue;
+	unsigned int		num_direct;
+	unsigned int		num_entries;
+	struct tc_txq_map_entry	entries[];
+};
+
 static inline void skb_tc_reinsert(struct sk_buff *skb, struct tcf_result *res)
 {
 	struct gnet_stats_queue *stats = res->qstats;
@@ -98,10 +98,13 @@ struct tls_sw_context_tx {
 	struct crypto_wait async_wait;
 
 	char aad_space[TLS_AAD_SPACE_SIZE];
+	/* TLS 1.3 inner content type, encrypted after the plaintext */
+	unsigned char content_type;
 
 	unsigned int sg_plaintext_size;
 	int sg_plaintext_num_elem;
-	struct scatterlist sg_plaintext_data[MAX_SKB_FRAGS];
+	/* one more entry than there may be data frags, for content_type */
+	struct scatterlist sg_plaintext_data[MAX_SKB_FRAGS + 1];
 
 	unsigned int sg_encrypted_size;
 	int sg_encrypted_num_elem;
@@ -124,6 +127,11 @@ struct tls_sw_context_rx {
 	struct sk_buff *recv_pkt;
 	u8 control;
 	bool decrypted;
+	bool async_capable;
+
+	/* records being decrypted by an async AEAD, see tls_decrypt_done() */
+	atomic_t decrypt_pending;
+	bool async_notify;
 };
 
 struct tls_record_info {
@@ -173,11 +181,14 @@ struct cipher_context {
 	char *iv;
 	u16 rec_seq_size;
 	char *rec_seq;
+	u16 aad_size;
+	u16 tail_size;
 };
 
 union tls_crypto_context {
 	struct tls_crypto_info info;
 	struct tls12_crypto_info_aes_gcm_128 aes_gcm_128;
+	struct tls12_crypto_info_chacha20_poly1305 chacha20_poly1305;
 };
 
 struct tls_context {
@@ -349,13 +360,30 @@ static inline bool tls_bigint_increment(unsigned char *seq, int len)
 	return (i == -1);
 }
 
+/* Only TLS 1.2 AES-GCM records carry their nonce, right after the header */
+static inline bool tls_nonce_explicit(const struct cipher_context *ctx)
+{
+	return ctx->prepend_size > TLS_HEADER_SIZE;
+}
+
+/* Otherwise the nonce is the IV xored with the record sequence number */
+static inline void tls_xor_iv_with_seq(char *iv, const char *seq)
+{
+	int i;
+
+	for (i = 0; i < 8; i++)
+		iv[i + 4] ^= seq[i];
+}
+
 static inline void tls_advance_record_sn(struct sock *sk,
 					 struct cipher_context *ctx)
 {
 	if (tls_bigint_increment(ctx->rec_seq, ctx->rec_seq_size))
 		tls_err_abort(sk, EBADMSG);
-	tls_bigint_increment(ctx->iv + TLS_CIPHER_AES_GCM_128_SALT_SIZE,
-			     ctx->iv_size);
+	if (tls_nonce_explicit(ctx))
+		tls_bigint_increment(ctx->iv +
+				     TLS_CIPHER_AES_GCM_128_SALT_SIZE,
+				     ctx->iv_size);
 }
 
 static inline void tls_fill_prepend(struct tls_context *ctx,
@@ -363,29 +391,52 @@ static inline void tls_fill_prepend(struct tls_context *ctx,
 			     size_t plaintext_len,
 			     unsigned char record_type)
 {
-	size_t pkt_len, iv_size = ctx->tx.iv_size;
+	size_t pkt_len, nonce_size = ctx->tx.prepend_size - TLS_HEADER_SIZE;
+	u16 version = ctx->crypto_send.info.version;
+
+	pkt_len = plaintext_len + nonce_size + ctx->tx.tail_size +
+		  ctx->tx.tag_size;
 
-	pkt_len = plaintext_len + iv_size + ctx->tx.tag_size;
+	/* TLS 1.3 records all look like 1.2 application data on the wire,
+	 * the real type is encrypted along with the data.
+	 */
+	if (version == TLS_1_3_VERSION) {
+		record_type = TLS_RECORD_TYPE_DATA;
+		version = TLS_1_2_VERSION;
+	}
 
 	/* we cover nonce explicit here as well, so buf should be of
 	 * size KTLS_DTLS_HEADER_SIZE + KTLS_DTLS_NONCE_EXPLICIT_SIZE
 	 */
 	buf[0] = record_type;
-	buf[1] = TLS_VERSION_MINOR(ctx->crypto_send.info.version);
-	buf[2] = TLS_VERSION_MAJOR(ctx->crypto_send.info.version);
+	buf[1] = TLS_VERSION_MINOR(version);
+	buf[2] = TLS_VERSION_MAJOR(version);
 	/* we can use IV for nonce explicit according to spec */
 	buf[3] = pkt_len >> 8;
 	buf[4] = pkt_len & 0xFF;
 	memcpy(buf + TLS_NONCE_OFFSET,
-	       ctx->tx.iv + TLS_CIPHER_AES_GCM_128_SALT_SIZE, iv_size);
+	       ctx->tx.iv + TLS_CIPHER_AES_GCM_128_SALT_SIZE, nonce_size);
 }
 
+/* For TLS 1.3 the AAD is the record header, @size being the length of
+ * the encrypted data including the tag.
+ */
 static inline void tls_make_aad(char *buf,
 				size_t size,
 				char *record_sequence,
 				int record_sequence_size,
-				unsigned char record_type)
+				unsigned char record_type,
+				u16 version)
 {
+	if (version == TLS_1_3_VERSION) {
+		buf[0] = TLS_RECORD_TYPE_DATA;
+		buf[1] = TLS_1_2_VERSION_MAJOR;
+		buf[2] = TLS_1_2_VERSION_MINOR;
+		buf[3] = size >> 8;
+		buf[4] = size & 0xFF;
+		return;
+	}
+
 	memcpy(buf, record_sequence, record_sequence_size);
 
 	buf[8] = record_type;
@@ -26,6 +26,13 @@ struct xdp_umem_page {
 	dma_addr_t dma;
 };
 
+/* Flags for the umem flags field */
+#define XDP_UMEM_USES_NEED_WAKEUP (1 << 0)
+
+/* Rings of the umem which currently need a wakeup */
+#define XDP_WAKEUP_RX (1 << 0)
+#define XDP_WAKEUP_TX (1 << 1)
+
 struct xdp_umem {
 	struct xsk_queue *fq;
 	struct xsk_queue *cq;
@@ -41,6 +48,8 @@ struct xdp_umem {
 	u32 npgs;
 	struct net_device *dev;
 	u16 queue_id;
+	u8 flags;
+	u8 need_wakeup;
 	bool zc;
 	bool delay_unpin;
 	spinlock_t xsk_list_lock;
@@ -92,6 +101,15 @@ void xsk_umem_discard_addr(struct xdp_umem *umem);
 void xsk_umem_complete_tx(struct xdp_umem *umem, u32 nb_entries);
 bool xsk_umem_consume_tx(struct xdp_umem *umem, struct xdp_desc *desc);
 void xsk_umem_consume_tx_done(struct xdp_umem *umem);
+void xsk_set_rx_need_wakeup(struct xdp_umem *umem);
+void xsk_set_tx_need_wakeup(struct xdp_umem *umem);
+void xsk_clear_rx_need_wakeup(struct xdp_umem *umem);
+void xsk_clear_tx_need_wakeup(struct xdp_umem *umem);
+
+static inline bool xsk_umem_uses_need_wakeup(struct xdp_umem *umem)
+{
+	return umem->flags & XDP_UMEM_USES_NEED_WAKEUP;
+}
 
 struct page **xsk_umem_pgs_delay_unpin(struct xdp_umem *umem, u64 *npgs);
 void xsk_umem_unpin_pages(struct page **pgs, u64 npgs);
@@ -158,6 +176,27 @@ static inline void xsk_umem_consume_tx_done(struct xdp_umem *umem)
 {
 }
 
+static inline void xsk_set_rx_need_wakeup(struct xdp_umem *umem)
+{
+}
+
+static inline void xsk_set_tx_need_wakeup(struct xdp_umem *umem)
+{
+}
+
+static inline void xsk_clear_rx_need_wakeup(struct xdp_umem *umem)
+{
+}
+
+static inline void xsk_clear_tx_need_wakeup(struct xdp_umem *umem)
+{
+}
+
+static inline bool xsk_umem_uses_need_wakeup(struct xdp_umem *umem)
+{
+	return false;
+}
+
 static inline char *xdp_umem_get_data(struct xdp_umem *umem, u64 addr)
 {
 	return NULL;
@@ -25,6 +25,8 @@
 enum cachefiles_obj_ref_trace {
 	cachefiles_obj_put_wait_retry = fscache_obj_ref__nr_traces,
 	cachefiles_obj_put_wait_timeo,
+	cachefiles_obj_get_ondemand_fd,
+	cachefiles_obj_put_ondemand_fd,
 	cachefiles_obj_ref__nr_traces
 };
 
@@ -49,7 +51,9 @@ enum cachefiles_obj_ref_trace {
 	EM(fscache_obj_put_queue,		"PUT queue")		\
 	EM(fscache_obj_put_work,		"PUT work")		\
 	EM(cachefiles_obj_put_wait_retry,	"PUT wait_retry")	\
-	E_(cachefiles_obj_put_wait_timeo,	"PUT wait_timeo")
+	EM(cachefiles_obj_put_wait_timeo,	"PUT wait_timeo")	\
+	EM(cachefiles_obj_get_ondemand_fd,	"GET ondemand_fd")	\
+	E_(cachefiles_obj_put_ondemand_fd,	"PUT ondemand_fd")
 
 /*
  * Export enum symbols via userspace.
@@ -7,6 +7,7 @@
 
 #include <linux/cgroup.h>
 #include <linux/tracepoint.h>
+#include <uapi/linux/cgroup_sli.h>
 
 DECLARE_EVENT_CLASS(cgroup_root,
 
@@ -149,6 +150,47 @@ DEFINE_EVENT(cgroup_migrate, cgroup_transfer_tasks,
 	TP_ARGS(dst_cgrp, path, task, threadgroup)
 );
 
+/*
+ * A latency seen by the sli accounting, see uapi/linux/cgroup_sli.h for
+ * the fields.
+ */
+TRACE_EVENT(cgroup_sli_event,
+
+	TP_PROTO(struct cgroup *cgrp, pid_t pid, unsigned int type,
+		 unsigned int subtype, u64 latency, u64 data),
+
+	TP_ARGS(cgrp, pid, type, subtype, latency, data),
+
+	TP_STRUCT__entry(
+		__field(	int,		root			)
+		__field(	u64,		cgrp_id			)
+		__field(	int,		pid			)
+		__field(	u16,		type			)
+		__field(	u16,		subtype			)
+		__field(	u64,		latency			)
+		__field(	u64,		data			)
+	),
+
+	TP_fast_assign(
+		__entry->root = cgrp->root->hierarchy_id;
+		__entry->cgrp_id = cgrp->kn->id.id;
+		__entry->pid = pid;
+		__entry->type = type;
+		__entry->subtype = subtype;
+		__entry->latency = latency;
+		__entry->data = data;
+	),
+
+	TP_printk("root=%d cgrp_id=%llu pid=%d type=%s subtype=%u latency=%llu data=%llu",
+		  __entry->root, __entry->cgrp_id, __entry->pid,
+		  __print_symbolic(__entry->type,
+				   { SLI_EVENT_SCHED_DELAY,	"sched_delay" },
+				   { SLI_EVENT_MEM_STALL,	"mem_stall" },
+				   { SLI_EVENT_IO,		"io" },
+				   { SLI_EVENT_NET_RT,		"net_rt" }),
+		  __entry->subtype, __entry->latency, __entry->data)
+);
+
 #endif /* _TRACE_CGROUP_H */
 
 /* This part must be outside protection */
@@ -8,6 +8,12 @@
 #include <linux/lockdep.h>
 #include <linux/tracepoint.h>
 
+/* flags for lock:contention_begin */
+#define LCB_F_SPIN	(1U << 0)
+#define LCB_F_READ	(1U << 1)
+#define LCB_F_WRITE	(1U << 2)
+#define LCB_F_MUTEX	(1U << 3)
+
 #ifdef CONFIG_LOCKDEP
 
 TRACE_EVENT(lock_acquire,
@@ -81,6 +87,54 @@ DEFINE_EVENT(lock, lock_acquired,
 #endif
 #endif
 
+/*
+ * Contention in the slowpaths, which unlike the events above doesn't need
+ * lockdep: the begin event when a task starts waiting for @lock, the end
+ * event when it got it (ret 0) or gave up (ret < 0).
+ */
+TRACE_EVENT(contention_begin,
+
+	TP_PROTO(void *lock, unsigned int flags),
+
+	TP_ARGS(lock, flags),
+
+	TP_STRUCT__entry(
+		__field(void *, lock_addr)
+		__field(unsigned int, flags)
+	),
+
+	TP_fast_assign(
+		__entry->lock_addr = lock;
+		__entry->flags = flags;
+	),
+
+	TP_printk("%p (flags=%s)", __entry->lock_addr,
+		  __print_flags(__entry->flags, "|",
+				{ LCB_F_SPIN,	"SPIN" },
+				{ LCB_F_READ,	"READ" },
+				{ LCB_F_WRITE,	"WRITE" },
+				{ LCB_F_MUTEX,	"MUTEX" }))
+);
+
+TRACE_EVENT(contention_end,
+
+	TP_PROTO(void *lock, int ret),
+
+	TP_ARGS(lock, ret),
+
+	TP_STRUCT__entry(
+		__field(void *, lock_addr)
+		__field(int, ret)
+	),
+
+	TP_fast_assign(
+		__entry->lock_addr = lock;
+		__entry->ret = ret;
+	),
+
+	TP_printk("%p (ret=%d)", __entry->lock_addr, __entry->ret)
+);
+
 #endif /* _TRACE_LOCK_H */
 
 /* This part must be outside protection */
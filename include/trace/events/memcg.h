@@ -0,0 +1,94 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM memcg
+
+#if !defined(_TRACE_MEMCG_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_MEMCG_H
+
+#include <linux/memcontrol.h>
+#include <linux/tracepoint.h>
+#include <trace/events/mmflags.h>
+
+/*
+ * The memcg id reported here is what bpf_memcg_exstat_add() takes, so BPF
+ * programs attached to these events can keep per-memcg counters.
+ */
+DECLARE_EVENT_CLASS(memcg_pages_template,
+
+	TP_PROTO(struct mem_cgroup *memcg, unsigned long nr_pages),
+
+	TP_ARGS(memcg, nr_pages),
+
+	TP_STRUCT__entry(
+		__field(	unsigned short,	id)
+		__field(	unsigned long,	nr_pages)
+	),
+
+	TP_fast_assign(
+		__entry->id = mem_cgroup_id(memcg);
+		__entry->nr_pages = nr_pages;
+	),
+
+	TP_printk("id=%hu nr_pages=%lu", __entry->id, __entry->nr_pages)
+);
+
+DEFINE_EVENT(memcg_pages_template, memcg_reclaim_begin,
+
+	TP_PROTO(struct mem_cgroup *memcg, unsigned long nr_pages),
+
+	TP_ARGS(memcg, nr_pages)
+);
+
+DEFINE_EVENT(memcg_pages_template, memcg_reclaim_end,
+
+	TP_PROTO(struct mem_cgroup *memcg, unsigned long nr_pages),
+
+	TP_ARGS(memcg, nr_pages)
+);
+
+TRACE_EVENT(memcg_charge_fail,
+
+	TP_PROTO(struct mem_cgroup *memcg, unsigned int nr_pages,
+		 gfp_t gfp_mask),
+
+	TP_ARGS(memcg, nr_pages, gfp_mask),
+
+	TP_STRUCT__entry(
+		__field(	unsigned short,	id)
+		__field(	unsigned int,	nr_pages)
+		__field(	gfp_t,		gfp_mask)
+	),
+
+	TP_fast_assign(
+		__entry->id = mem_cgroup_id(memcg);
+		__entry->nr_pages = nr_pages;
+		__entry->gfp_mask = gfp_mask;
+	),
+
+	TP_printk("id=%hu nr_pages=%u gfp_flags=%s", __entry->id,
+		  __entry->nr_pages, show_gfp_flags(__entry->gfp_mask))
+);
+
+TRACE_EVENT(memcg_oom,
+
+	TP_PROTO(struct mem_cgroup *memcg, int order),
+
+	TP_ARGS(memcg, order),
+
+	TP_STRUCT__entry(
+		__field(	unsigned short,	id)
+		__field(	int,		order)
+	),
+
+	TP_fast_assign(
+		__entry->id = mem_cgroup_id(memcg);
+		__entry->order = order;
+	),
+
+	TP_printk("id=%hu order=%d", __entry->id, __entry->order)
+);
+
+#endif /* _TRACE_MEMCG_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
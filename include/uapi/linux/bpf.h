@@ -103,6 +103,11 @@ enum bpf_cmd {
 	BPF_BTF_LOAD,
 	BPF_BTF_GET_FD_BY_ID,
 	BPF_TASK_FD_QUERY,
+	/* 21 to 23 are taken upstream, keep the numbers libbpf uses */
+	BPF_MAP_LOOKUP_BATCH = 24,
+	BPF_MAP_LOOKUP_AND_DELETE_BATCH,
+	BPF_MAP_UPDATE_BATCH,
+	BPF_MAP_DELETE_BATCH,
 };
 
 enum bpf_map_type {
@@ -134,6 +139,7 @@ enum bpf_map_type {
 	BPF_MAP_TYPE_DEVMAP_HASH,
 	BPF_MAP_TYPE_STRUCT_OPS,
 	BPF_MAP_TYPE_RINGBUF,
+	BPF_MAP_TYPE_RINGBUF_PERCPU,
 };
 
 enum bpf_prog_type {
@@ -181,6 +187,8 @@ enum bpf_attach_type {
 	BPF_LIRC_MODE2,
 	BPF_CGROUP_UDP4_RECVMSG = 19,
 	BPF_CGROUP_UDP6_RECVMSG,
+	BPF_SK_REUSEPORT_SELECT,
+	BPF_SK_REUSEPORT_SELECT_OR_MIGRATE,
 	__MAX_BPF_ATTACH_TYPE
 };
 
@@ -323,6 +331,23 @@ union bpf_attr {
 		__u64		flags;
 	};
 
+	struct { /* struct used by BPF_MAP_*_BATCH commands */
+		__aligned_u64	in_batch;	/* start batch,
+						 * NULL to start from beginning
+						 */
+		__aligned_u64	out_batch;	/* output: next start batch */
+		__aligned_u64	keys;
+		__aligned_u64	values;
+		__u32		count;		/* input/output:
+						 * input: # of key/value
+						 * elements
+						 * output: # of filled elements
+						 */
+		__u32		map_fd;
+		__u64		elem_flags;
+		__u64		flags;
+	} batch;
+
 	struct { /* anonymous struct used by BPF_PROG_LOAD command */
 		__u32		prog_type;	/* one of enum bpf_prog_type */
 		__u32		insn_cnt;
@@ -2227,6 +2252,18 @@ union bpf_attr {
  *	Return
  *		0 on success, or a negative error in case of failure.
  *
+ * int bpf_seq_write(struct seq_file *m, const void *data, u32 len)
+ *	Description
+ *		Write *len* bytes from *data* to the output of the BPF
+ *		iterator being read.  *m* is the first argument the program
+ *		was run with; the helper fails for anything else, so it is
+ *		only of use to programs opened as a "bpf_iter_<target>" with
+ *		**BPF_RAW_TRACEPOINT_OPEN**.
+ *	Return
+ *		0 on success, **-EOVERFLOW** if the output buffer is full
+ *		(the object is then run again with a larger one), or
+ *		**-EINVAL** if *m* is not the iterator's.
+ *
  * void *bpf_ringbuf_output(void *ringbuf, void *data, u64 size, u64 flags)
  * 	Description
  * 		Copy *size* bytes from *data* into a ring buffer *ringbuf*.
@@ -2279,6 +2316,32 @@ union bpf_attr {
  *		calculation.
  *	Return
  *		Requested value, or 0, if flags are not recognized.
+ *
+ * long bpf_memcg_exstat_add(u32 memcg_id, u32 slot, u64 delta)
+ *	Description
+ *		Add *delta* to counter *slot* (0-7) of the memory cgroup
+ *		with id *memcg_id*, as reported by the memcg tracepoints, or
+ *		of the current task's memory cgroup if *memcg_id* is 0.  The
+ *		counters are per-cpu and shown as bpf_<slot> in the cgroup's
+ *		memory.exstat.
+ *	Return
+ *		0 on success, **-EINVAL** if *slot* is out of range, or
+ *		**-ENOENT** if there is no such memory cgroup.
+ *
+ * long bpf_ringbuf_output_batch(void *ringbuf, void *data, u64 size, u64 rec_size, u64 flags)
+ *	Description
+ *		Copy *size* bytes from *data* into ring buffer *ringbuf* as
+ *		*size* / *rec_size* records of *rec_size* bytes each, taking
+ *		the ring's lock and moving its producer position only once.
+ *		*flags* are as for **bpf_ringbuf_output**\ (), and apply to
+ *		the batch as a whole.
+ *
+ *		For a **BPF_MAP_TYPE_RINGBUF_PERCPU** map, this and the other
+ *		ring buffer helpers work on the ring of the current cpu.
+ *	Return
+ *		The number of records written, **-EAGAIN** if there isn't
+ *		room for all of them, or **-EINVAL** if *size* isn't a
+ *		multiple of *rec_size*.
  */
 #define __BPF_FUNC_MAPPER(FN)		\
 	FN(unspec),			\
@@ -2415,7 +2478,9 @@ union bpf_attr {
 	FN(ringbuf_reserve),		\
 	FN(ringbuf_submit),		\
 	FN(ringbuf_discard),		\
-	FN(ringbuf_query),
+	FN(ringbuf_query),		\
+	FN(memcg_exstat_add),		\
+	FN(ringbuf_output_batch),
 
 /* integer value in 'imm' field of BPF_CALL instruction selects which helper
  * function eBPF program intends to call
@@ -2545,6 +2610,7 @@ struct __sk_buff {
 	/* ... here. */
 
 	__u32 data_meta;
+	__u64 tstamp;		/* earliest departure time on egress, ns */
 };
 
 struct bpf_tunnel_key {
@@ -2694,6 +2760,10 @@ struct sk_reuseport_md {
 	__u32 ip_protocol;	/* IP protocol. e.g. IPPROTO_TCP, IPPROTO_UDP */
 	__u32 bind_inany;	/* Is sock bound to an INANY address? */
 	__u32 hash;		/* A hash of the packet 4 tuples */
+	__u32 migrating;	/* Selecting a listener for a request or a
+				 * child of a closed one?  Only with
+				 * BPF_SK_REUSEPORT_SELECT_OR_MIGRATE.
+				 */
 };
 
 #define BPF_TAG_SIZE	8
@@ -0,0 +1,57 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note */
+#ifndef _LINUX_CACHEFILES_H
+#define _LINUX_CACHEFILES_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * Messages read from /dev/cachefiles by a daemon which bound the cache with
+ * "bind ondemand". Each read() returns exactly one message.
+ *
+ * OPEN carries a new file descriptor onto the backing file of the object, the
+ * daemon answers with "copen <msg_id>,<size>" written to /dev/cachefiles, a
+ * negative size failing the open.
+ *
+ * READ asks for the data at [off, off + len) of the object. The daemon
+ * writes it with pwrite() on the descriptor from OPEN, then completes the
+ * request with ioctl(fd, CACHEFILES_IOC_READ_COMPLETE, msg_id).
+ *
+ * CLOSE tells that the object is gone, the daemon closes the descriptor.
+ */
+#define CACHEFILES_MSG_MAX_SIZE	1024
+
+enum cachefiles_opcode {
+	CACHEFILES_OP_OPEN,
+	CACHEFILES_OP_CLOSE,
+	CACHEFILES_OP_READ,
+};
+
+struct cachefiles_msg {
+	__u32 msg_id;
+	__u32 opcode;
+	__u32 len;		/* of the whole message */
+	__u32 object_id;
+	__u8  data[];
+};
+
+/*
+ * data[] holds the volume key (the key of the parent index), then the cookie
+ * key, sizes as given
+ */
+struct cachefiles_open {
+	__u32 volume_key_size;
+	__u32 cookie_key_size;
+	__u32 fd;
+	__u32 flags;
+	__u8  data[];
+};
+
+struct cachefiles_read {
+	__u64 off;
+	__u64 len;
+};
+
+#define CACHEFILES_IOC_READ_COMPLETE	_IOW(0x98, 1, int)
+
+#endif
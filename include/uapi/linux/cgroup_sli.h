@@ -0,0 +1,68 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note */
+#ifndef _UAPI_LINUX_CGROUP_SLI_H
+#define _UAPI_LINUX_CGROUP_SLI_H
+
+/*
+ * Types of the cgroup:cgroup_sli_event tracepoint, which publishes the
+ * scheduler, memory, I/O and network latencies the sli accounting sees
+ * as one stream. Every event carries the same fields:
+ *
+ *   root	hierarchy id of the cgroup, as in /proc/cgroups
+ *   cgrp_id	kernfs id of the cgroup, the bpf_get_current_cgroup_id()
+ *		and name_to_handle_at() one
+ *   pid	the task that waited, 0 when not known
+ *   type	SLI_EVENT_*
+ *   subtype	meaning depends on the type, see below
+ *   latency	in nanoseconds
+ *   data	meaning depends on the type, see below
+ *
+ * The events go to the per-cpu trace buffers, or the perf ring buffers
+ * of a perf_event_open() on the tracepoint, and BPF programs attached to
+ * it can aggregate them into their own maps. Filter on latency to only
+ * see the slow ones. Each type follows the switches of its accounting:
+ * sched and memory sli, blkcg_latency_hist and the tcp_rt module.
+ */
+#define SLI_EVENT_SCHED_DELAY	0	/* runqueue wait, cpu cgroup */
+#define SLI_EVENT_MEM_STALL	1	/* memsli stall, memory cgroup */
+#define SLI_EVENT_IO		2	/* request latency, blkio cgroup */
+#define SLI_EVENT_NET_RT	3	/* tcp_rt request, socket's cgroup */
+
+/*
+ * SLI_EVENT_SCHED_DELAY subtypes, data is unused. A group entity wait is
+ * the one of a child cgroup's entity on its parent's runqueue.
+ */
+#define SLI_SCHED_WAIT		0
+#define SLI_SCHED_CGROUP_WAIT	1
+
+/*
+ * SLI_EVENT_MEM_STALL subtypes, in the order of memory.*latency*
+ * histograms, data is unused.
+ */
+#define SLI_MEM_GLOBAL_DIRECT_RECLAIM	0
+#define SLI_MEM_MEMCG_DIRECT_RECLAIM	1
+#define SLI_MEM_DIRECT_COMPACT		2
+#define SLI_MEM_GLOBAL_DIRECT_SWAPOUT	3
+#define SLI_MEM_MEMCG_DIRECT_SWAPOUT	4
+#define SLI_MEM_DIRECT_SWAPIN		5
+#define SLI_MEM_DIRTY_THROTTLE		6
+#define SLI_MEM_MAJOR_FAULT		7
+#define SLI_MEM_THP_FALLBACK		8
+
+/*
+ * SLI_EVENT_IO subtypes, the stages of blkio latency_hist, data is the
+ * operation, 0 read, 1 write or 2 discard, with the new_encode_dev()
+ * device number, the stat() one, in the upper 32 bits. Only published
+ * while the blkcg_latency_hist parameter is set, as the dispatch time is
+ * not taken otherwise.
+ */
+#define SLI_IO_QUEUE		0
+#define SLI_IO_DEVICE		1
+
+/*
+ * SLI_EVENT_NET_RT subtypes, the tcp_rt log flags of complete requests,
+ * data is the bytes sent.
+ */
+#define SLI_NET_RT_LOCAL	'R'
+#define SLI_NET_RT_PEER		'P'
+
+#endif /* _UAPI_LINUX_CGROUP_SLI_H */
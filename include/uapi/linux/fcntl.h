@@ -54,6 +54,32 @@
 #define F_GET_FILE_RW_HINT	(F_LINUX_SPECIFIC_BASE + 13)
 #define F_SET_FILE_RW_HINT	(F_LINUX_SPECIFIC_BASE + 14)
 
+/*
+ * Set and get the size of each buffer of a pipe, a power of 2 from the page
+ * size up.  The pipe keeps its capacity in bytes, with fewer buffers.
+ */
+#define F_SETPIPE_BUFSZ	(F_LINUX_SPECIFIC_BASE + 15)
+#define F_GETPIPE_BUFSZ	(F_LINUX_SPECIFIC_BASE + 16)
+
+/*
+ * Set/Get the huge page policy of a tmpfs file, and spread the pages of a
+ * tmpfs file over the memory nodes (arg 1) or use the default policy again
+ * (arg 0).
+ */
+#define F_GET_SHMEM_HUGE	(F_LINUX_SPECIFIC_BASE + 17)
+#define F_SET_SHMEM_HUGE	(F_LINUX_SPECIFIC_BASE + 18)
+#define F_SET_SHMEM_INTERLEAVE	(F_LINUX_SPECIFIC_BASE + 19)
+
+/*
+ * Valid values for F_{GET,SET}_SHMEM_HUGE, as for the huge= mount option.
+ * F_SHMEM_HUGE_MOUNT is "not set", the file follows its mount.
+ */
+#define F_SHMEM_HUGE_MOUNT		0
+#define F_SHMEM_HUGE_NEVER		1
+#define F_SHMEM_HUGE_ALWAYS		2
+#define F_SHMEM_HUGE_WITHIN_SIZE	3
+#define F_SHMEM_HUGE_ADVISE		4
+
 /*
  * Valid hint values for F_{GET,SET}_RW_HINT. 0 is "not set", or can be
  * used to clear any hints previously set.
@@ -91,4 +117,6 @@
 #define AT_STATX_FORCE_SYNC	0x2000	/* - Force the attributes to be sync'd with the server */
 #define AT_STATX_DONT_SYNC	0x4000	/* - Don't sync attributes with the server */
 
+#define AT_RECURSIVE		0x8000	/* Apply to the entire subtree */
+
 #endif /* _UAPI_LINUX_FCNTL_H */
@@ -124,6 +124,9 @@
  *
  *  7.31
  *  - add FUSE_WRITE_KILL_PRIV flag
+ *  - add FUSE_PASSTHROUGH, FOPEN_PASSTHROUGH, passthrough_fh in
+ *    fuse_open_out and FUSE_DEV_IOC_PASSTHROUGH_OPEN
+ *  - add the io_uring transport, struct fuse_uring_cmd_req
  */
 
 #ifndef _LINUX_FUSE_H
@@ -229,12 +232,15 @@ struct fuse_file_lock {
  * FOPEN_NONSEEKABLE: the file is not seekable
  * FOPEN_CACHE_DIR: allow caching this directory
  * FOPEN_STREAM: the file is stream-like (no file position at all)
+ * FOPEN_PASSTHROUGH: read/write/mmap go to the backing file registered with
+ *		      FUSE_DEV_IOC_PASSTHROUGH_OPEN, fuse_open_out.passthrough_fh
  */
 #define FOPEN_DIRECT_IO		(1 << 0)
 #define FOPEN_KEEP_CACHE	(1 << 1)
 #define FOPEN_NONSEEKABLE	(1 << 2)
 #define FOPEN_CACHE_DIR		(1 << 3)
 #define FOPEN_STREAM		(1 << 4)
+#define FOPEN_PASSTHROUGH	(1 << 7)
 
 /**
  * INIT request/reply flags
@@ -267,6 +273,7 @@ struct fuse_file_lock {
  *		       foffset and moffset fields in struct
  *		       fuse_setupmapping_out and fuse_removemapping_one.
  * FUSE_PERFILE_DAX:	kernel supports per-file DAX
+ * FUSE_PASSTHROUGH: kernel supports passthrough of I/O to a backing file
  */
 #define FUSE_ASYNC_READ		(1 << 0)
 #define FUSE_POSIX_LOCKS	(1 << 1)
@@ -294,6 +301,7 @@ struct fuse_file_lock {
 #define FUSE_CACHE_SYMLINKS	(1 << 23)
 #define FUSE_MAP_ALIGNMENT	(1 << 26)
 #define FUSE_PERFILE_DAX	(1 << 30)
+#define FUSE_PASSTHROUGH	(1u << 31)
 
 /**
  * CUSE INIT request/reply flags
@@ -540,7 +548,7 @@ struct fuse_create_in {
 struct fuse_open_out {
 	uint64_t	fh;
 	uint32_t	open_flags;
-	uint32_t	padding;
+	uint32_t	passthrough_fh;
 };
 
 struct fuse_release_in {
@@ -820,6 +828,43 @@ struct fuse_notify_retrieve_in {
 /* Device ioctls: */
 #define FUSE_DEV_IOC_MAGIC		229
 #define FUSE_DEV_IOC_CLONE		_IOR(FUSE_DEV_IOC_MAGIC, 0, uint32_t)
+#define FUSE_DEV_IOC_PASSTHROUGH_OPEN	_IOW(FUSE_DEV_IOC_MAGIC, 1, \
+					     struct fuse_passthrough_out)
+
+/*
+ * Argument of FUSE_DEV_IOC_PASSTHROUGH_OPEN: @fd is the backing file, the
+ * ioctl returns the id to reply with in fuse_open_out.passthrough_fh.  An
+ * id is consumed by the open it is used in.
+ */
+struct fuse_passthrough_out {
+	uint32_t	fd;
+	uint32_t	flags;	/* must be zero */
+};
+
+/*
+ * io_uring transport: IORING_OP_URING_CMD on a device fd, with a
+ * struct fuse_uring_cmd_req as payload (sqe->addr, sqe->len).
+ *
+ * FUSE_URING_REQ_FETCH queues @buf of @buf_len bytes on queue @qid.  The
+ * command completes with the length of the request copied into it, laid
+ * out as a read of the device would return it.
+ *
+ * FUSE_URING_REQ_COMMIT_AND_FETCH finds the reply to that request at @buf,
+ * laid out as a write to the device, and then queues @buf again.  Replies
+ * must come on the fd which the request was fetched on.
+ *
+ * Queue @qid gets the requests issued on CPU @qid.  Those of CPUs without
+ * any buffer queued, interrupts and forgets are still read from the device.
+ */
+#define FUSE_URING_REQ_FETCH		1
+#define FUSE_URING_REQ_COMMIT_AND_FETCH	2
+
+struct fuse_uring_cmd_req {
+	uint64_t	buf;
+	uint32_t	buf_len;
+	uint16_t	qid;
+	uint16_t	flags;	/* must be zero */
+};
 
 struct fuse_lseek_in {
 	uint64_t	fh;
@@ -22,6 +22,10 @@ struct io_uring_sqe {
 	union {
 		__u64	off;	/* offset into file */
 		__u64	addr2;
+		struct {
+			__u32	cmd_op;
+			__u32	__pad1;
+		};
 	};
 	union {
 		__u64	addr;	/* pointer to buffer or iovecs */
@@ -42,6 +46,7 @@ struct io_uring_sqe {
 		__u32		statx_flags;
 		__u32		fadvise_advice;
 		__u32		splice_flags;
+		__u32		futex_flags;
 	};
 	__u64	user_data;	/* data to be passed back at completion time */
 	union {
@@ -56,6 +61,7 @@ struct io_uring_sqe {
 			/* personality to use, if used */
 			__u16	personality;
 			__s32	splice_fd_in;
+			__u64	addr3;
 		};
 		__u64	__pad2[3];
 	};
@@ -134,6 +140,11 @@ enum {
 	IORING_OP_REMOVE_BUFFERS,
 	IORING_OP_TEE,
 	IORING_OP_IOCTL,
+	IORING_OP_SEND_ZC,
+	IORING_OP_FUTEX_WAIT,
+	IORING_OP_FUTEX_WAKE,
+	IORING_OP_FUTEX_WAITV,
+	IORING_OP_URING_CMD,
 
 	/* this goes last, obviously */
 	IORING_OP_LAST,
@@ -149,6 +160,36 @@ enum {
  */
 #define IORING_TIMEOUT_ABS	(1U << 0)
 
+/*
+ * accept flags stored in sqe->ioprio
+ */
+#define IORING_ACCEPT_MULTISHOT	(1U << 0)
+
+/*
+ * send/recv flags stored in sqe->ioprio
+ *
+ * IORING_RECV_MULTISHOT	Keep the request armed and post a CQE for each
+ *				chunk of received data. Requires
+ *				IOSQE_BUFFER_SELECT and sqe->len == 0.
+ *
+ * IORING_RECVSEND_FIXED_BUF	Use registered buffers, the index is stored in
+ *				the buf_index field.
+ *
+ * IORING_SEND_ZC_REPORT_USAGE
+ *				If set, SEND_ZC will report in the notification
+ *				CQE whether the data had to be copied after
+ *				all, by setting IORING_NOTIF_USAGE_ZC_COPIED.
+ */
+#define IORING_RECV_MULTISHOT		(1U << 1)
+#define IORING_RECVSEND_FIXED_BUF	(1U << 2)
+#define IORING_SEND_ZC_REPORT_USAGE	(1U << 3)
+
+/*
+ * cqe.res for IORING_CQE_F_NOTIF if IORING_SEND_ZC_REPORT_USAGE was
+ * requested
+ */
+#define IORING_NOTIF_USAGE_ZC_COPIED	(1U << 31)
+
 /*
  * sqe->splice_flags
  * extends splice(2) flags
@@ -168,8 +209,13 @@ struct io_uring_cqe {
  * cqe->flags
  *
  * IORING_CQE_F_BUFFER	If set, the upper 16 bits are the buffer ID
+ * IORING_CQE_F_MORE	If set, parent SQE will generate more CQE entries
+ * IORING_CQE_F_NOTIF	Set for notification CQEs, e.g. the buffer release
+ *			notification of IORING_OP_SEND_ZC
  */
 #define IORING_CQE_F_BUFFER		(1U << 0)
+#define IORING_CQE_F_MORE		(1U << 1)
+#define IORING_CQE_F_NOTIF		(1U << 3)
 
 enum {
 	IORING_CQE_BUFFER_SHIFT		= 16,
@@ -181,6 +227,9 @@ enum {
 #define IORING_OFF_SQ_RING		0ULL
 #define IORING_OFF_CQ_RING		0x8000000ULL
 #define IORING_OFF_SQES			0x10000000ULL
+#define IORING_OFF_PBUF_RING		0x80000000ULL
+#define IORING_OFF_PBUF_SHIFT		16
+#define IORING_OFF_MMAP_MASK		0xf8000000ULL
 
 /*
  * Filled with the offset for mmap(2)
@@ -229,6 +278,7 @@ struct io_cqring_offsets {
 #define IORING_ENTER_SQ_WAKEUP	(1U << 1)
 #define IORING_ENTER_EXT_ARG	(1U << 3)
 #define IORING_ENTER_SQ_SUBMIT_ON_IDLE (1U << 4)
+#define IORING_ENTER_REGISTERED_RING	(1U << 5)	/* fd is a registered ring index */
 
 /*
  * Passed in for io_uring_setup(2). Copied back with updated info on success
@@ -274,12 +324,33 @@ struct io_uring_params {
 #define IORING_REGISTER_PERSONALITY	9
 #define IORING_UNREGISTER_PERSONALITY	10
 
+/* set max bounded/unbounded io-wq workers per node, __u32[2] */
+#define IORING_REGISTER_IOWQ_MAX_WORKERS	19
+
+/* register/unregister ring fds for IORING_ENTER_REGISTERED_RING */
+#define IORING_REGISTER_RING_FDS	20
+#define IORING_UNREGISTER_RING_FDS	21
+
+/* register/unregister provided buffer rings */
+#define IORING_REGISTER_PBUF_RING	22
+#define IORING_UNREGISTER_PBUF_RING	23
+
 struct io_uring_files_update {
 	__u32 offset;
 	__u32 resv;
 	__aligned_u64 /* __s32 * */ fds;
 };
 
+/*
+ * Argument for IORING_(UN)REGISTER_RING_FDS. An offset of -1U picks any
+ * free slot, the chosen one is copied back.
+ */
+struct io_uring_rsrc_update {
+	__u32 offset;
+	__u32 resv;
+	__aligned_u64 data;
+};
+
 #define IO_URING_OP_SUPPORTED	(1U << 0)
 
 struct io_uring_probe_op {
@@ -297,6 +368,50 @@ struct io_uring_probe {
 	struct io_uring_probe_op ops[0];
 };
 
+struct io_uring_buf {
+	__u64	addr;
+	__u32	len;
+	__u16	bid;
+	__u16	resv;
+};
+
+struct io_uring_buf_ring {
+	union {
+		/*
+		 * To avoid spilling into more pages than we need to, the
+		 * ring tail is overlaid with the io_uring_buf->resv field.
+		 */
+		struct {
+			__u64	resv1;
+			__u32	resv2;
+			__u16	resv3;
+			__u16	tail;
+		};
+		struct io_uring_buf	bufs[0];
+	};
+};
+
+/*
+ * Flags for IORING_REGISTER_PBUF_RING.
+ *
+ * IOU_PBUF_RING_MMAP:	The kernel allocates the memory for the ring, the
+ *			application maps it at IORING_OFF_PBUF_RING |
+ *			(bgid << IORING_OFF_PBUF_SHIFT). This is currently
+ *			the only supported mode, ->ring_addr must be 0.
+ */
+enum {
+	IOU_PBUF_RING_MMAP	= 1,
+};
+
+/* argument for IORING_(UN)REGISTER_PBUF_RING */
+struct io_uring_buf_reg {
+	__u64	ring_addr;
+	__u32	ring_entries;
+	__u16	bgid;
+	__u16	flags;
+	__u64	resv[3];
+};
+
 struct io_uring_getevents_arg {
 	__u64	sigmask;
 	__u32	sigmask_sz;
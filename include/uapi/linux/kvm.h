@@ -235,6 +235,7 @@ struct kvm_hyperv_exit {
 #define KVM_EXIT_S390_STSI        25
 #define KVM_EXIT_IOAPIC_EOI       26
 #define KVM_EXIT_HYPERV           27
+#define KVM_EXIT_DIRTY_RING_FULL  31
 
 /* For KVM_EXIT_INTERNAL_ERROR */
 /* Emulate instruction failed. */
@@ -963,6 +964,8 @@ struct kvm_ppc_resize_hpt {
 #define KVM_CAP_ARM_INJECT_SERROR_ESR 158
 #define KVM_CAP_MSR_PLATFORM_INFO 159
 #define KVM_CAP_ARM_VM_IPA_SIZE 165 /* returns maximum IPA bits for a VM */
+#define KVM_CAP_HALT_POLL 182
+#define KVM_CAP_DIRTY_LOG_RING 192
 
 #ifdef KVM_CAP_IRQ_ROUTING
 
@@ -1409,6 +1412,20 @@ struct kvm_enc_region {
 #define KVM_GET_NESTED_STATE         _IOWR(KVMIO, 0xbe, struct kvm_nested_state)
 #define KVM_SET_NESTED_STATE         _IOW(KVMIO,  0xbf, struct kvm_nested_state)
 
+/* Available with KVM_CAP_DIRTY_LOG_RING */
+#define KVM_RESET_DIRTY_RINGS        _IO(KVMIO, 0xc7)
+
+/*
+ * KVM_ENABLE_CAP of KVM_CAP_HALT_POLL sets the halt polling ceiling of the
+ * VM to args[0] ns.  With KVM_HALT_POLL_SET_FACTORS, args[1] and args[2]
+ * are the grow and shrink factors of the per-vcpu poll time, otherwise the
+ * halt_poll_ns_grow and halt_poll_ns_shrink module parameters are used.
+ * With KVM_HALT_POLL_UNCONTENDED, a vcpu does not poll while other tasks
+ * are runnable on its host cpu.
+ */
+#define KVM_HALT_POLL_SET_FACTORS	(1 << 0)
+#define KVM_HALT_POLL_UNCONTENDED	(1 << 1)
+
 /* Secure Encrypted Virtualization command */
 enum sev_cmd_id {
 	/* Guest initialization commands */
@@ -1559,4 +1576,35 @@ struct kvm_hyperv_eventfd {
 #define KVM_HYPERV_CONN_ID_MASK		0x00ffffff
 #define KVM_HYPERV_EVENTFD_DEASSIGN	(1 << 0)
 
+/*
+ * Arch needs to define the macro after implementing the dirty ring
+ * feature.  KVM_DIRTY_LOG_PAGE_OFFSET should be defined as the
+ * starting page offset of the dirty ring structures.
+ */
+#ifndef KVM_DIRTY_LOG_PAGE_OFFSET
+#define KVM_DIRTY_LOG_PAGE_OFFSET 0
+#endif
+
+/*
+ * With KVM_CAP_DIRTY_LOG_RING enabled, each vcpu logs the gfns it dirties
+ * in a ring of struct kvm_dirty_gfn, which userspace mmaps from the vcpu
+ * fd at page offset KVM_DIRTY_LOG_PAGE_OFFSET.  The flags of an entry go:
+ *
+ *   0 (invalid) --KVM--> DIRTY --userspace--> RESET --KVM_RESET_DIRTY_RINGS--> 0
+ *
+ * KVM sets DIRTY when it pushes the entry; userspace sets RESET when it
+ * collected it, and KVM_RESET_DIRTY_RINGS write protects the collected
+ * gfns again and gives their entries back.  The vcpu exits to userspace
+ * with KVM_EXIT_DIRTY_RING_FULL when its ring is about to be full.
+ */
+#define KVM_DIRTY_GFN_F_DIRTY           (1 << 0)
+#define KVM_DIRTY_GFN_F_RESET           (1 << 1)
+#define KVM_DIRTY_GFN_F_MASK            0x3
+
+struct kvm_dirty_gfn {
+	__u32 flags;
+	__u32 slot; /* as_id << 16 | slot id */
+	__u64 offset; /* gfn - memslot base_gfn */
+};
+
 #endif /* __LINUX_KVM_H */
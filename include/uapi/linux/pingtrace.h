@@ -17,6 +17,15 @@
 #define PINGTRACE_HDR_MAGIC 0x7ace
 #define PINGTRACE_MAP_ENTRY_NUM 8
 
+/*
+ * Timestamps are CLOCK_MONOTONIC in usec truncated to 31 bits, or the low
+ * 32 bits of nsec when the prober sets PINGTRACE_F_NSEC in hdr.flags.
+ *
+ * P_R_RX_HWTS is the receive timestamp of the NIC, in the NIC's clock, so
+ * it only compares to other hardware stamps. P_R_RX_NETIF is the software
+ * receive timestamp taken when the NAPI poll handed the packet to the stack.
+ * Either is only added when the responder has that timestamp enabled.
+ */
 enum pingtrace_function {
 	P_L_TX_USER,
 	P_L_TX_DEVQUEUE,
@@ -27,10 +36,13 @@ enum pingtrace_function {
 	P_L_RX_SKDATAREADY,
 	P_L_RX_WAKEUP,
 	P_L_RX_USER,
+	P_R_RX_HWTS,
+	P_R_RX_NETIF,
 };
 
 enum PINGTRACE_HDR_FLAGS {
 	PINGTRACE_F_DONTADD     =       1,
+	PINGTRACE_F_NSEC        =       2,
 };
 
 struct pingtrace_timestamp {
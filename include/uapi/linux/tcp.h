@@ -305,5 +305,10 @@ struct tcp_zerocopy_receive {
 	__u64 address;		/* in: address of mapping */
 	__u32 length;		/* in/out: number of bytes to map/mapped */
 	__u32 recv_skip_hint;	/* out: amount of bytes to skip */
+	__u32 inq;		/* out: amount of bytes in read queue */
+	__s32 err;		/* out: socket error */
+	__u64 copybuf_address;	/* in: copybuf address (unaligned tail) */
+	__s32 copybuf_len;	/* in/out: copybuf bytes avail/used or error */
+	__u32 reserved;		/* must be zero */
 };
 #endif /* _UAPI_LINUX_TCP_H */
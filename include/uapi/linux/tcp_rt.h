@@ -0,0 +1,69 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note */
+#ifndef _UAPI_LINUX_TCP_RT_H
+#define _UAPI_LINUX_TCP_RT_H
+
+#include <linux/types.h>
+
+/*
+ * Binary records of the tcp_rt module, written instead of text lines when
+ * it is loaded with binary=1. They go to the same per-cpu relay buffers,
+ * debugfs tcp-rt/rt-network-log<cpu> and tcp-rt/rt-network-stats, which
+ * can be mmap()ed. Both records have a power of 2 size, so they never
+ * straddle a sub-buffer and need no parsing.
+ *
+ * A reader checks hdr.version and steps by hdr.len. New fields are only
+ * ever added into the reserved space, which is zero.
+ */
+#define TCP_RT_RECORD_VERSION	1
+
+struct tcp_rt_record_hdr {
+	__u8	version;
+	__u8	flag;		/* LOG_STATUS_* for logs, 'L' or 'P' for stats */
+	__u16	len;		/* of the whole record */
+};
+
+#define TCP_RT_LOG_NR_VALS	10
+
+/*
+ * vals[] holds, in order, the numbers the text line has after the ports,
+ * the ones not used by the flag are zero:
+ *
+ * 'R' bytes rt mrtt retrans request_num server_time recv_time recv_data
+ *     rcv_reorder mss
+ * 'W' bytes rt mrtt retrans request_num server_time recv_time unacked
+ *     rcv_reorder mss
+ * 'N' request_num rt received rcv_reorder mss
+ * 'E' request_num sent unacked received total_retrans mrtt
+ * 'P' sent rt mrtt retrans request_num server_time recv_time received
+ *     rcv_reorder mss
+ */
+struct tcp_rt_log_record {
+	struct tcp_rt_record_hdr hdr;
+	__u32	start_sec;
+	__u32	start_usec;
+	__be32	daddr;
+	__be32	saddr;
+	__u16	dport;
+	__u16	sport;
+	__u32	vals[TCP_RT_LOG_NR_VALS];
+};
+
+/* Per port averages over the stats interval, as the text "all" line */
+struct tcp_rt_stats_record {
+	struct tcp_rt_record_hdr hdr;
+	__u16	port;
+	__u16	reserved0;
+	__u64	time;
+	__u64	rt;
+	__u64	server_time;
+	__u64	drop;		/* per thousand packets */
+	__u64	rtt;
+	__u64	fail;		/* per thousand requests */
+	__u64	bytes;
+	__u64	recv_time;
+	__u64	recv_data;
+	__u64	number;
+	__u64	reserved[5];
+};
+
+#endif /* _UAPI_LINUX_TCP_RT_H */
@@ -0,0 +1,253 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * BPF iterators
+ *
+ * A target registered here is a seq_file walk over some kernel objects:
+ * tasks, open files, cgroups, sockets.  BPF_RAW_TRACEPOINT_OPEN with the
+ * name "bpf_iter_<target>" and a BPF_PROG_TYPE_RAW_TRACEPOINT program
+ * returns a file that runs the program once for every object when read,
+ * and the program writes whatever it wants to report with bpf_seq_write().
+ * That's one read() for what would otherwise take parsing a /proc file per
+ * object.
+ *
+ * Like for raw tracepoints, the program's context is an array of u64
+ * arguments:
+ *
+ *	ctx[0]	the struct seq_file * to pass to bpf_seq_write()
+ *	ctx[1]	the number of objects shown so far in this pass
+ *	ctx[2]	the object, and target specific arguments after it
+ *
+ * Once the walk is complete the program is run one more time with a NULL
+ * object, which is the place to write out totals.  lseek() to the start
+ * of the file begins another pass.
+ */
+#include <linux/anon_inodes.h>
+#include <linux/bpf.h>
+#include <linux/file.h>
+#include <linux/filter.h>
+#include <linux/nsproxy.h>
+#include <linux/seq_file.h>
+#include <linux/seq_file_net.h>
+#include <linux/slab.h>
+
+struct bpf_iter_priv_data {
+	struct bpf_iter_reg *reg;
+	struct bpf_prog *prog;
+	u64 seq_num;
+	bool done_stop;
+	u8 target_private[] __aligned(8);
+};
+
+static LIST_HEAD(targets);
+static DEFINE_MUTEX(targets_mutex);
+
+/* The seq_file bpf_seq_write() may write to on this cpu. */
+static DEFINE_PER_CPU(struct seq_file *, bpf_iter_seq);
+
+int bpf_iter_reg_target(struct bpf_iter_reg *reg)
+{
+	mutex_lock(&targets_mutex);
+	list_add(&reg->list, &targets);
+	mutex_unlock(&targets_mutex);
+	return 0;
+}
+
+static struct bpf_iter_priv_data *bpf_iter_priv(struct seq_file *seq)
+{
+	return container_of(seq->private, struct bpf_iter_priv_data,
+			    target_private[0]);
+}
+
+/*
+ * Run the program for the object in @args[2...], with @args[0] and
+ * @args[1] filled in here.  @in_stop is for the final run from the
+ * target's ->stop().
+ */
+int bpf_iter_run_prog(struct seq_file *seq, u64 *args, bool in_stop)
+{
+	struct bpf_iter_priv_data *priv = bpf_iter_priv(seq);
+	struct bpf_prog *prog = priv->prog;
+	u32 ret;
+
+	if (in_stop) {
+		if (priv->done_stop)
+			return 0;
+		priv->done_stop = true;
+	}
+
+	args[0] = (unsigned long)seq;
+	args[1] = in_stop ? priv->seq_num : priv->seq_num++;
+
+	preempt_disable();
+	rcu_read_lock();
+	__this_cpu_write(bpf_iter_seq, seq);
+	ret = BPF_PROG_RUN(prog, args);
+	__this_cpu_write(bpf_iter_seq, NULL);
+	rcu_read_unlock();
+	preempt_enable();
+
+	/* anything but 0 ends this read with what has been written so far */
+	return ret ? -EAGAIN : 0;
+}
+
+int bpf_iter_init_seq_net(void *priv_data)
+{
+#ifdef CONFIG_NET_NS
+	struct seq_net_private *p = priv_data;
+
+	p->net = get_net(current->nsproxy->net_ns);
+#endif
+	return 0;
+}
+
+void bpf_iter_fini_seq_net(void *priv_data)
+{
+#ifdef CONFIG_NET_NS
+	struct seq_net_private *p = priv_data;
+
+	put_net(p->net);
+#endif
+}
+
+static loff_t bpf_iter_llseek(struct file *file, loff_t offset, int whence)
+{
+	struct seq_file *seq = file->private_data;
+	struct bpf_iter_priv_data *priv = bpf_iter_priv(seq);
+
+	/* the walks can't skip objects, only start over */
+	if (offset || whence != SEEK_SET)
+		return -ESPIPE;
+
+	mutex_lock(&seq->lock);
+	priv->seq_num = 0;
+	priv->done_stop = false;
+	mutex_unlock(&seq->lock);
+
+	return seq_lseek(file, 0, SEEK_SET);
+}
+
+static int bpf_iter_release(struct inode *inode, struct file *file)
+{
+	struct seq_file *seq = file->private_data;
+	struct bpf_iter_priv_data *priv;
+
+	/* seq_open() failed, bpf_iter_open() cleans up */
+	if (!seq)
+		return 0;
+
+	priv = bpf_iter_priv(seq);
+	if (priv->reg->fini_seq_private)
+		priv->reg->fini_seq_private(priv->target_private);
+	bpf_prog_put(priv->prog);
+	kfree(priv);
+	return seq_release(inode, file);
+}
+
+static const struct file_operations bpf_iter_fops = {
+	.read		= seq_read,
+	.llseek		= bpf_iter_llseek,
+	.release	= bpf_iter_release,
+};
+
+static struct bpf_iter_reg *bpf_iter_find_target(const char *name)
+{
+	struct bpf_iter_reg *reg;
+
+	mutex_lock(&targets_mutex);
+	list_for_each_entry(reg, &targets, list) {
+		if (!strcmp(reg->target, name)) {
+			mutex_unlock(&targets_mutex);
+			return reg;
+		}
+	}
+	mutex_unlock(&targets_mutex);
+	return NULL;
+}
+
+/* BPF_RAW_TRACEPOINT_OPEN of "bpf_iter_<target>" */
+int bpf_iter_open(const char *target, u32 prog_fd)
+{
+	struct bpf_iter_priv_data *priv;
+	struct bpf_iter_reg *reg;
+	struct bpf_prog *prog;
+	struct file *file;
+	int fd, err;
+
+	reg = bpf_iter_find_target(target);
+	if (!reg)
+		return -ENOENT;
+
+	prog = bpf_prog_get_type(prog_fd, BPF_PROG_TYPE_RAW_TRACEPOINT);
+	if (IS_ERR(prog))
+		return PTR_ERR(prog);
+
+	/* same as for a raw tracepoint: no reading beyond the arguments */
+	err = -EINVAL;
+	if (prog->aux->max_ctx_offset > reg->num_args * sizeof(u64))
+		goto out_put_prog;
+
+	err = -ENOMEM;
+	priv = kzalloc(sizeof(*priv) + reg->seq_priv_size, GFP_USER);
+	if (!priv)
+		goto out_put_prog;
+	priv->reg = reg;
+	priv->prog = prog;
+
+	if (reg->init_seq_private) {
+		err = reg->init_seq_private(priv->target_private);
+		if (err)
+			goto out_free_priv;
+	}
+
+	fd = get_unused_fd_flags(O_CLOEXEC);
+	if (fd < 0) {
+		err = fd;
+		goto out_fini;
+	}
+
+	file = anon_inode_getfile("bpf-iter", &bpf_iter_fops, NULL,
+				  O_RDONLY | O_CLOEXEC);
+	if (IS_ERR(file)) {
+		err = PTR_ERR(file);
+		goto out_put_fd;
+	}
+
+	err = seq_open(file, reg->seq_ops);
+	if (err) {
+		fput(file);
+		goto out_put_fd;
+	}
+	((struct seq_file *)file->private_data)->private = priv->target_private;
+
+	fd_install(fd, file);
+	return fd;
+
+out_put_fd:
+	put_unused_fd(fd);
+out_fini:
+	if (reg->fini_seq_private)
+		reg->fini_seq_private(priv->target_private);
+out_free_priv:
+	kfree(priv);
+out_put_prog:
+	bpf_prog_put(prog);
+	return err;
+}
+
+BPF_CALL_3(bpf_seq_write, struct seq_file *, m, const void *, data, u32, len)
+{
+	/* only the seq_file of the iterator running the program */
+	if (!m || m != this_cpu_read(bpf_iter_seq))
+		return -EINVAL;
+
+	return seq_write(m, data, len) ? -EOVERFLOW : 0;
+}
+
+const struct bpf_func_proto bpf_seq_write_proto = {
+	.func		= bpf_seq_write,
+	.gpl_only	= true,
+	.ret_type	= RET_INTEGER,
+	.arg1_type	= ARG_ANYTHING,
+	.arg2_type	= ARG_PTR_TO_MEM,
+	.arg3_type	= ARG_CONST_SIZE_OR_ZERO,
+};
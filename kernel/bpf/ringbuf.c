@@ -31,7 +31,7 @@
 	(((1ULL << 24) - RINGBUF_POS_PAGES - RINGBUF_PGOFF) * PAGE_SIZE)
 
 struct bpf_ringbuf {
-	wait_queue_head_t waitq;
+	wait_queue_head_t *waitq;
 	struct irq_work work;
 	u64 mask;
 	struct page **pages;
@@ -51,6 +51,14 @@ struct bpf_ringbuf_map {
 	struct bpf_map map;
 	struct bpf_map_memory memory;
 	struct bpf_ringbuf *rb;
+	/*
+	 * BPF_MAP_TYPE_RINGBUF_PERCPU has a ring for every possible cpu
+	 * instead, so that producers never share a lock or a producer
+	 * position.  The rings all wake up the map's waitq, one poll on the
+	 * map fd is good for all of them.
+	 */
+	struct bpf_ringbuf **rbs;
+	wait_queue_head_t waitq;
 };
 
 /* 8-byte ring buffer record header structure */
@@ -127,10 +135,11 @@ static void bpf_ringbuf_notify(struct irq_work *work)
 {
 	struct bpf_ringbuf *rb = container_of(work, struct bpf_ringbuf, work);
 
-	wake_up_all(&rb->waitq);
+	wake_up_all(rb->waitq);
 }
 
-static struct bpf_ringbuf *bpf_ringbuf_alloc(size_t data_sz, int numa_node)
+static struct bpf_ringbuf *bpf_ringbuf_alloc(size_t data_sz, int numa_node,
+					     wait_queue_head_t *waitq)
 {
 	struct bpf_ringbuf *rb;
 
@@ -139,7 +148,7 @@ static struct bpf_ringbuf *bpf_ringbuf_alloc(size_t data_sz, int numa_node)
 		return ERR_PTR(-ENOMEM);
 
 	spin_lock_init(&rb->spinlock);
-	init_waitqueue_head(&rb->waitq);
+	rb->waitq = waitq;
 	init_irq_work(&rb->work, bpf_ringbuf_notify);
 
 	rb->mask = data_sz - 1;
@@ -174,6 +183,7 @@ static struct bpf_map *ringbuf_map_alloc(union bpf_attr *attr)
 		return ERR_PTR(-ENOMEM);
 
 	bpf_map_init_from_attr(&rb_map->map, attr);
+	init_waitqueue_head(&rb_map->waitq);
 
 	cost = sizeof(struct bpf_ringbuf_map) +
 	       sizeof(struct bpf_ringbuf) +
@@ -182,7 +192,8 @@ static struct bpf_map *ringbuf_map_alloc(union bpf_attr *attr)
 	if (err)
 		goto err_free_map;
 
-	rb_map->rb = bpf_ringbuf_alloc(attr->max_entries, rb_map->map.numa_node);
+	rb_map->rb = bpf_ringbuf_alloc(attr->max_entries, rb_map->map.numa_node,
+				       &rb_map->waitq);
 	if (IS_ERR(rb_map->rb)) {
 		err = PTR_ERR(rb_map->rb);
 		goto err_uncharge;
@@ -211,6 +222,73 @@ static void bpf_ringbuf_free(struct bpf_ringbuf *rb)
 	kvfree(pages);
 }
 
+/* max_entries is the size of each cpu's ring */
+static struct bpf_map *ringbuf_percpu_map_alloc(union bpf_attr *attr)
+{
+	struct bpf_ringbuf_map *rb_map;
+	struct bpf_ringbuf *rb;
+	int cpu, err;
+	u64 cost;
+
+	/* each ring is allocated on its cpu's node */
+	if (attr->map_flags)
+		return ERR_PTR(-EINVAL);
+
+	if (attr->key_size || attr->value_size ||
+	    !is_power_of_2(attr->max_entries) ||
+	    !PAGE_ALIGNED(attr->max_entries))
+		return ERR_PTR(-EINVAL);
+
+#ifdef CONFIG_64BIT
+	if (attr->max_entries > RINGBUF_MAX_DATA_SZ)
+		return ERR_PTR(-E2BIG);
+#endif
+
+	rb_map = kzalloc(sizeof(*rb_map), GFP_USER);
+	if (!rb_map)
+		return ERR_PTR(-ENOMEM);
+
+	bpf_map_init_from_attr(&rb_map->map, attr);
+	init_waitqueue_head(&rb_map->waitq);
+
+	cost = sizeof(struct bpf_ringbuf_map) +
+	       (u64)nr_cpu_ids * sizeof(struct bpf_ringbuf *) +
+	       (u64)num_possible_cpus() * (sizeof(struct bpf_ringbuf) +
+					   attr->max_entries);
+	err = bpf_map_charge_init(&rb_map->map.memory, cost);
+	if (err)
+		goto err_free_map;
+
+	err = -ENOMEM;
+	rb_map->rbs = kcalloc(nr_cpu_ids, sizeof(*rb_map->rbs), GFP_USER);
+	if (!rb_map->rbs)
+		goto err_uncharge;
+
+	for_each_possible_cpu(cpu) {
+		rb = bpf_ringbuf_alloc(attr->max_entries, cpu_to_node(cpu),
+				       &rb_map->waitq);
+		if (IS_ERR(rb)) {
+			err = PTR_ERR(rb);
+			goto err_free_rbs;
+		}
+		rb_map->rbs[cpu] = rb;
+	}
+
+	return &rb_map->map;
+
+err_free_rbs:
+	for_each_possible_cpu(cpu) {
+		if (rb_map->rbs[cpu])
+			bpf_ringbuf_free(rb_map->rbs[cpu]);
+	}
+	kfree(rb_map->rbs);
+err_uncharge:
+	bpf_map_charge_finish(&rb_map->map.memory);
+err_free_map:
+	kfree(rb_map);
+	return ERR_PTR(err);
+}
+
 static void ringbuf_map_free(struct bpf_map *map)
 {
 	struct bpf_ringbuf_map *rb_map;
@@ -223,7 +301,15 @@ static void ringbuf_map_free(struct bpf_map *map)
 	synchronize_rcu();
 
 	rb_map = container_of(map, struct bpf_ringbuf_map, map);
-	bpf_ringbuf_free(rb_map->rb);
+	if (rb_map->rbs) {
+		int cpu;
+
+		for_each_possible_cpu(cpu)
+			bpf_ringbuf_free(rb_map->rbs[cpu]);
+		kfree(rb_map->rbs);
+	} else {
+		bpf_ringbuf_free(rb_map->rb);
+	}
 	kfree(rb_map);
 }
 
@@ -249,22 +335,47 @@ static int ringbuf_map_get_next_key(struct bpf_map *map, void *key,
 	return -ENOTSUPP;
 }
 
-static int ringbuf_map_mmap(struct bpf_map *map, struct vm_area_struct *vma)
+static int __ringbuf_map_mmap(struct bpf_ringbuf *rb,
+			      struct vm_area_struct *vma, unsigned long pgoff)
 {
-	struct bpf_ringbuf_map *rb_map;
-
-	rb_map = container_of(map, struct bpf_ringbuf_map, map);
-
 	if (vma->vm_flags & VM_WRITE) {
 		/* allow writable mapping for the consumer_pos only */
-		if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start != PAGE_SIZE)
+		if (pgoff != 0 || vma->vm_end - vma->vm_start != PAGE_SIZE)
 			return -EPERM;
 	} else {
 		vma->vm_flags &= ~VM_MAYWRITE;
 	}
 	/* remap_vmalloc_range() checks size and offset constraints */
-	return remap_vmalloc_range(vma, rb_map->rb,
-				   vma->vm_pgoff + RINGBUF_PGOFF);
+	return remap_vmalloc_range(vma, rb, pgoff + RINGBUF_PGOFF);
+}
+
+static int ringbuf_map_mmap(struct bpf_map *map, struct vm_area_struct *vma)
+{
+	struct bpf_ringbuf_map *rb_map;
+
+	rb_map = container_of(map, struct bpf_ringbuf_map, map);
+	return __ringbuf_map_mmap(rb_map->rb, vma, vma->vm_pgoff);
+}
+
+/*
+ * The rings of a BPF_MAP_TYPE_RINGBUF_PERCPU map are laid out one after
+ * another, by cpu number: cpu N's consumer page is at page offset
+ * N * (2 + 2 * max_entries / PAGE_SIZE), and its producer page and
+ * double-mapped data pages follow as for a single ring buffer.
+ */
+static int ringbuf_percpu_map_mmap(struct bpf_map *map,
+				   struct vm_area_struct *vma)
+{
+	unsigned long stride = RINGBUF_POS_PAGES +
+			       2 * (map->max_entries >> PAGE_SHIFT);
+	unsigned long cpu = vma->vm_pgoff / stride;
+	struct bpf_ringbuf_map *rb_map;
+
+	rb_map = container_of(map, struct bpf_ringbuf_map, map);
+	if (cpu >= nr_cpu_ids || !rb_map->rbs[cpu])
+		return -EINVAL;
+
+	return __ringbuf_map_mmap(rb_map->rbs[cpu], vma, vma->vm_pgoff % stride);
 }
 
 static unsigned long ringbuf_avail_data_sz(struct bpf_ringbuf *rb)
@@ -282,13 +393,29 @@ static __poll_t ringbuf_map_poll(struct bpf_map *map, struct file *filp,
 	struct bpf_ringbuf_map *rb_map;
 
 	rb_map = container_of(map, struct bpf_ringbuf_map, map);
-	poll_wait(filp, &rb_map->rb->waitq, pts);
+	poll_wait(filp, &rb_map->waitq, pts);
 
 	if (ringbuf_avail_data_sz(rb_map->rb))
 		return EPOLLIN | EPOLLRDNORM;
 	return 0;
 }
 
+static __poll_t ringbuf_percpu_map_poll(struct bpf_map *map, struct file *filp,
+					struct poll_table_struct *pts)
+{
+	struct bpf_ringbuf_map *rb_map;
+	int cpu;
+
+	rb_map = container_of(map, struct bpf_ringbuf_map, map);
+	poll_wait(filp, &rb_map->waitq, pts);
+
+	for_each_possible_cpu(cpu) {
+		if (ringbuf_avail_data_sz(rb_map->rbs[cpu]))
+			return EPOLLIN | EPOLLRDNORM;
+	}
+	return 0;
+}
+
 const struct bpf_map_ops ringbuf_map_ops = {
 	.map_alloc = ringbuf_map_alloc,
 	.map_free = ringbuf_map_free,
@@ -300,6 +427,28 @@ const struct bpf_map_ops ringbuf_map_ops = {
 	.map_get_next_key = ringbuf_map_get_next_key,
 };
 
+const struct bpf_map_ops ringbuf_percpu_map_ops = {
+	.map_alloc = ringbuf_percpu_map_alloc,
+	.map_free = ringbuf_map_free,
+	.map_mmap = ringbuf_percpu_map_mmap,
+	.map_poll = ringbuf_percpu_map_poll,
+	.map_lookup_elem = ringbuf_map_lookup_elem,
+	.map_update_elem = ringbuf_map_update_elem,
+	.map_delete_elem = ringbuf_map_delete_elem,
+	.map_get_next_key = ringbuf_map_get_next_key,
+};
+
+/* The ring programs running on this cpu produce into. */
+static struct bpf_ringbuf *bpf_ringbuf_this_cpu(struct bpf_map *map)
+{
+	struct bpf_ringbuf_map *rb_map;
+
+	rb_map = container_of(map, struct bpf_ringbuf_map, map);
+	if (rb_map->rbs)
+		return rb_map->rbs[smp_processor_id()];
+	return rb_map->rb;
+}
+
 /* Given pointer to ring buffer record metadata and struct bpf_ringbuf itself,
  * calculate offset from record metadata to ring buffer in pages, rounded
  * down. This page offset is stored as part of record metadata and allows to
@@ -324,17 +473,23 @@ bpf_ringbuf_restore_from_rec(struct bpf_ringbuf_hdr *hdr)
 	return (void*)((addr & PAGE_MASK) - off);
 }
 
-static void *__bpf_ringbuf_reserve(struct bpf_ringbuf *rb, u64 size)
+/*
+ * Reserve @nr consecutive records of @size bytes each, and return the
+ * first one.  Thanks to the double mapping of the data pages the records
+ * are contiguous in memory even if they wrap around the end of the ring.
+ */
+static void *__bpf_ringbuf_reserve_batch(struct bpf_ringbuf *rb, u64 size,
+					 u32 nr)
 {
 	unsigned long cons_pos, prod_pos, new_prod_pos, flags;
-	u32 len, pg_off;
-	struct bpf_ringbuf_hdr *hdr;
+	struct bpf_ringbuf_hdr *hdr, *first;
+	u32 len, i;
 
 	if (unlikely(size > RINGBUF_MAX_RECORD_SZ))
 		return NULL;
 
 	len = round_up(size + BPF_RINGBUF_HDR_SZ, 8);
-	if (len > rb->mask + 1)
+	if ((u64)len * nr > rb->mask + 1)
 		return NULL;
 
 	cons_pos = smp_load_acquire(&rb->consumer_pos);
@@ -347,7 +502,7 @@ static void *__bpf_ringbuf_reserve(struct bpf_ringbuf *rb, u64 size)
 	}
 
 	prod_pos = rb->producer_pos;
-	new_prod_pos = prod_pos + len;
+	new_prod_pos = prod_pos + len * nr;
 
 	/* check for out of ringbuf space by ensuring producer position
 	 * doesn't advance more than (ringbuf_size - 1) ahead
@@ -357,28 +512,32 @@ static void *__bpf_ringbuf_reserve(struct bpf_ringbuf *rb, u64 size)
 		return NULL;
 	}
 
-	hdr = (void *)rb->data + (prod_pos & rb->mask);
-	pg_off = bpf_ringbuf_rec_pg_off(rb, hdr);
-	hdr->len = size | BPF_RINGBUF_BUSY_BIT;
-	hdr->pg_off = pg_off;
+	first = (void *)rb->data + (prod_pos & rb->mask);
+	for (i = 0, hdr = first; i < nr; i++, hdr = (void *)hdr + len) {
+		hdr->len = size | BPF_RINGBUF_BUSY_BIT;
+		hdr->pg_off = bpf_ringbuf_rec_pg_off(rb, hdr);
+	}
 
 	/* pairs with consumer's smp_load_acquire() */
 	smp_store_release(&rb->producer_pos, new_prod_pos);
 
 	spin_unlock_irqrestore(&rb->spinlock, flags);
 
-	return (void *)hdr + BPF_RINGBUF_HDR_SZ;
+	return (void *)first + BPF_RINGBUF_HDR_SZ;
 }
 
-BPF_CALL_3(bpf_ringbuf_reserve, struct bpf_map *, map, u64, size, u64, flags)
+static void *__bpf_ringbuf_reserve(struct bpf_ringbuf *rb, u64 size)
 {
-	struct bpf_ringbuf_map *rb_map;
+	return __bpf_ringbuf_reserve_batch(rb, size, 1);
+}
 
+BPF_CALL_3(bpf_ringbuf_reserve, struct bpf_map *, map, u64, size, u64, flags)
+{
 	if (unlikely(flags))
 		return 0;
 
-	rb_map = container_of(map, struct bpf_ringbuf_map, map);
-	return (unsigned long)__bpf_ringbuf_reserve(rb_map->rb, size);
+	return (unsigned long)__bpf_ringbuf_reserve(bpf_ringbuf_this_cpu(map),
+						    size);
 }
 
 const struct bpf_func_proto bpf_ringbuf_reserve_proto = {
@@ -389,9 +548,23 @@ const struct bpf_func_proto bpf_ringbuf_reserve_proto = {
 	.arg3_type	= ARG_ANYTHING,
 };
 
-static void bpf_ringbuf_commit(void *sample, u64 flags, bool discard)
+/* If the consumer caught up and is waiting for the record at @hdr, wake it. */
+static void bpf_ringbuf_wakeup(struct bpf_ringbuf *rb,
+			       struct bpf_ringbuf_hdr *hdr, u64 flags)
 {
 	unsigned long rec_pos, cons_pos;
+
+	rec_pos = ((void *)hdr - (void *)rb->data) & rb->mask;
+	cons_pos = smp_load_acquire(&rb->consumer_pos) & rb->mask;
+
+	if (flags & BPF_RB_FORCE_WAKEUP)
+		irq_work_queue(&rb->work);
+	else if (cons_pos == rec_pos && !(flags & BPF_RB_NO_WAKEUP))
+		irq_work_queue(&rb->work);
+}
+
+static void bpf_ringbuf_commit(void *sample, u64 flags, bool discard)
+{
 	struct bpf_ringbuf_hdr *hdr;
 	struct bpf_ringbuf *rb;
 	u32 new_len;
@@ -405,16 +578,7 @@ static void bpf_ringbuf_commit(void *sample, u64 flags, bool discard)
 	/* update record header with correct final size prefix */
 	xchg(&hdr->len, new_len);
 
-	/* if consumer caught up and is waiting for our record, notify about
-	 * new data availability
-	 */
-	rec_pos = (void *)hdr - (void *)rb->data;
-	cons_pos = smp_load_acquire(&rb->consumer_pos) & rb->mask;
-
-	if (flags & BPF_RB_FORCE_WAKEUP)
-		irq_work_queue(&rb->work);
-	else if (cons_pos == rec_pos && !(flags & BPF_RB_NO_WAKEUP))
-		irq_work_queue(&rb->work);
+	bpf_ringbuf_wakeup(rb, hdr, flags);
 }
 
 BPF_CALL_2(bpf_ringbuf_submit, void *, sample, u64, flags)
@@ -446,14 +610,12 @@ const struct bpf_func_proto bpf_ringbuf_discard_proto = {
 BPF_CALL_4(bpf_ringbuf_output, struct bpf_map *, map, void *, data, u64, size,
 	   u64, flags)
 {
-	struct bpf_ringbuf_map *rb_map;
 	void *rec;
 
 	if (unlikely(flags & ~(BPF_RB_NO_WAKEUP | BPF_RB_FORCE_WAKEUP)))
 		return -EINVAL;
 
-	rb_map = container_of(map, struct bpf_ringbuf_map, map);
-	rec = __bpf_ringbuf_reserve(rb_map->rb, size);
+	rec = __bpf_ringbuf_reserve(bpf_ringbuf_this_cpu(map), size);
 	if (!rec)
 		return -EAGAIN;
 
@@ -471,11 +633,61 @@ const struct bpf_func_proto bpf_ringbuf_output_proto = {
 	.arg4_type	= ARG_ANYTHING,
 };
 
-BPF_CALL_2(bpf_ringbuf_query, struct bpf_map *, map, u64, flags)
+/*
+ * bpf_ringbuf_output() for a buffer of records a program has been
+ * collecting: one reservation under the ring's lock, one producer position
+ * update and at most one wakeup for all of them.
+ */
+BPF_CALL_5(bpf_ringbuf_output_batch, struct bpf_map *, map, void *, data,
+	   u64, size, u64, rec_size, u64, flags)
 {
-	struct bpf_ringbuf *rb;
+	struct bpf_ringbuf_hdr *hdr, *first;
+	u64 nr, rem;
+	void *rec;
+	u32 len, i;
 
-	rb = container_of(map, struct bpf_ringbuf_map, map)->rb;
+	if (unlikely(flags & ~(BPF_RB_NO_WAKEUP | BPF_RB_FORCE_WAKEUP)))
+		return -EINVAL;
+	if (unlikely(!rec_size || rec_size > RINGBUF_MAX_RECORD_SZ))
+		return -EINVAL;
+
+	nr = div64_u64_rem(size, rec_size, &rem);
+	if (unlikely(rem || nr > U32_MAX))
+		return -EINVAL;
+	if (!nr)
+		return 0;
+
+	rec = __bpf_ringbuf_reserve_batch(bpf_ringbuf_this_cpu(map), rec_size,
+					  nr);
+	if (!rec)
+		return -EAGAIN;
+
+	len = round_up(rec_size + BPF_RINGBUF_HDR_SZ, 8);
+	first = rec - BPF_RINGBUF_HDR_SZ;
+	for (i = 0, hdr = first; i < nr; i++, hdr = (void *)hdr + len) {
+		memcpy((void *)hdr + BPF_RINGBUF_HDR_SZ, data, rec_size);
+		data += rec_size;
+		/* update record header with correct final size prefix */
+		xchg(&hdr->len, rec_size);
+	}
+
+	bpf_ringbuf_wakeup(bpf_ringbuf_restore_from_rec(first), first, flags);
+	return nr;
+}
+
+const struct bpf_func_proto bpf_ringbuf_output_batch_proto = {
+	.func		= bpf_ringbuf_output_batch,
+	.ret_type	= RET_INTEGER,
+	.arg1_type	= ARG_CONST_MAP_PTR,
+	.arg2_type	= ARG_PTR_TO_MEM,
+	.arg3_type	= ARG_CONST_SIZE_OR_ZERO,
+	.arg4_type	= ARG_ANYTHING,
+	.arg5_type	= ARG_ANYTHING,
+};
+
+BPF_CALL_2(bpf_ringbuf_query, struct bpf_map *, map, u64, flags)
+{
+	struct bpf_ringbuf *rb = bpf_ringbuf_this_cpu(map);
 
 	switch (flags) {
 	case BPF_RB_AVAIL_DATA:
@@ -116,6 +116,10 @@ struct smap_psock {
 	int eval;
 	struct sk_msg_buff *cork;
 	struct list_head ingress;
+	/* bytes on ingress, count against sk_rcvbuf under the sock lock */
+	int ingress_bytes;
+	/* non-blocking sender refused for lack of space, woken on read */
+	struct sock *ingress_blocked;
 
 	struct strparser strp;
 	struct bpf_prog *bpf_tx_msg;
@@ -685,9 +689,73 @@ static unsigned int smap_do_tx_msg(struct sock *sk,
 	return _rc;
 }
 
+/*
+ * Data redirected to the ingress queue is accounted as if it had been
+ * received, so that a fast sender cannot queue more than sk_rcvbuf.
+ */
+static bool bpf_ingress_full(struct sock *sk, struct smap_psock *psock)
+{
+	return psock->ingress_bytes + atomic_read(&sk->sk_rmem_alloc) >=
+	       sk->sk_rcvbuf;
+}
+
+static int bpf_wait_ingress_space(struct sock *sk, struct smap_psock *psock,
+				  long *timeo)
+{
+	DEFINE_WAIT_FUNC(wait, woken_wake_function);
+	int err = 0;
+
+	add_wait_queue(sk_sleep(sk), &wait);
+	while (bpf_ingress_full(sk, psock)) {
+		if (sk->sk_err || (sk->sk_shutdown & RCV_SHUTDOWN)) {
+			err = -EPIPE;
+			break;
+		}
+		if (!*timeo) {
+			err = -EAGAIN;
+			break;
+		}
+		if (signal_pending(current)) {
+			err = sock_intr_errno(*timeo);
+			break;
+		}
+		sk_wait_event(sk, timeo,
+			      !bpf_ingress_full(sk, psock) || sk->sk_err ||
+			      (sk->sk_shutdown & RCV_SHUTDOWN), &wait);
+	}
+	remove_wait_queue(sk_sleep(sk), &wait);
+
+	return err;
+}
+
+/* The reader made room on ingress, let the senders refill it */
+static void bpf_ingress_space(struct sock *sk, struct smap_psock *psock)
+{
+	struct sock *blocked = psock->ingress_blocked;
+	struct socket_wq *wq;
+
+	if (bpf_ingress_full(sk, psock))
+		return;
+
+	rcu_read_lock();
+	wq = rcu_dereference(sk->sk_wq);
+	if (skwq_has_sleeper(wq))
+		wake_up_interruptible_all(&wq->wait);
+	rcu_read_unlock();
+
+	if (blocked) {
+		psock->ingress_blocked = NULL;
+		blocked->sk_write_space(blocked);
+		sock_put(blocked);
+	}
+
+	if (psock->save_skb)
+		schedule_work(&psock->tx_work);
+}
+
 static int bpf_tcp_ingress(struct sock *sk, int apply_bytes,
 			   struct smap_psock *psock,
-			   struct sk_msg_buff *md, int flags)
+			   struct sk_msg_buff *md, int flags, long timeo)
 {
 	bool apply = apply_bytes;
 	size_t size, copied = 0;
@@ -699,6 +767,21 @@ static int bpf_tcp_ingress(struct sock *sk, int apply_bytes,
 		return -ENOMEM;
 
 	lock_sock(sk);
+	if (bpf_ingress_full(sk, psock)) {
+		err = bpf_wait_ingress_space(sk, psock, &timeo);
+		if (err) {
+			/* The sender's EPOLLOUT does not see this queue */
+			if (err == -EAGAIN && !psock->ingress_blocked &&
+			    md->sk) {
+				sock_hold(md->sk);
+				psock->ingress_blocked = md->sk;
+			}
+			release_sock(sk);
+			kfree(r);
+			return err;
+		}
+	}
+
 	r->sg_start = md->sg_start;
 	i = md->sg_start;
 
@@ -739,6 +822,7 @@ static int bpf_tcp_ingress(struct sock *sk, int apply_bytes,
 	md->sg_start = i;
 
 	if (!err) {
+		psock->ingress_bytes += copied;
 		list_add_tail(&r->list, &psock->ingress);
 		sk->sk_data_ready(sk);
 	} else {
@@ -752,7 +836,7 @@ static int bpf_tcp_ingress(struct sock *sk, int apply_bytes,
 
 static int bpf_tcp_sendmsg_do_redirect(struct sock *sk, int send,
 				       struct sk_msg_buff *md,
-				       int flags)
+				       int flags, long timeo)
 {
 	bool ingress = !!(md->flags & BPF_F_INGRESS);
 	struct smap_psock *psock;
@@ -769,7 +853,7 @@ static int bpf_tcp_sendmsg_do_redirect(struct sock *sk, int send,
 	rcu_read_unlock();
 
 	if (ingress) {
-		err = bpf_tcp_ingress(sk, send, psock, md, flags);
+		err = bpf_tcp_ingress(sk, send, psock, md, flags, timeo);
 	} else {
 		lock_sock(sk);
 		err = bpf_tcp_push(sk, send, md, flags, false);
@@ -811,6 +895,7 @@ static int bpf_exec_tx_verdict(struct smap_psock *psock,
 	bool cork = false, enospc = (m->sg_start == m->sg_end);
 	struct sock *redir;
 	int err = 0;
+	long timeo;
 	int send;
 
 more_data:
@@ -851,6 +936,7 @@ static int bpf_exec_tx_verdict(struct smap_psock *psock,
 		break;
 	case __SK_REDIRECT:
 		redir = psock->sk_redir;
+		timeo = sock_sndtimeo(sk, flags & MSG_DONTWAIT);
 		apply_bytes_dec(psock, send);
 
 		if (psock->cork) {
@@ -861,7 +947,7 @@ static int bpf_exec_tx_verdict(struct smap_psock *psock,
 		return_mem_sg(sk, send, m);
 		release_sock(sk);
 
-		err = bpf_tcp_sendmsg_do_redirect(redir, send, m, flags);
+		err = bpf_tcp_sendmsg_do_redirect(redir, send, m, flags, timeo);
 		lock_sock(sk);
 
 		if (unlikely(err < 0)) {
@@ -981,6 +1067,7 @@ static int bpf_tcp_recvmsg(struct sock *sk, struct msghdr *msg, size_t len,
 			sg->offset += copy;
 			sg->length -= copy;
 			sk_mem_uncharge(sk, copy);
+			psock->ingress_bytes -= copy;
 
 			if (!sg->length) {
 				i++;
@@ -1002,6 +1089,9 @@ static int bpf_tcp_recvmsg(struct sock *sk, struct msghdr *msg, size_t len,
 		}
 	}
 
+	if (copied)
+		bpf_ingress_space(sk, psock);
+
 	if (!copied) {
 		long timeo;
 		int data;
@@ -1289,7 +1379,9 @@ static int smap_do_ingress(struct smap_psock *psock, struct sk_buff *skb)
 	if (unlikely(!r))
 		return -EAGAIN;
 
-	if (!sk_rmem_schedule(sk, skb, skb->len)) {
+	/* retried from bpf_ingress_space() once the reader catches up */
+	if (bpf_ingress_full(sk, psock) ||
+	    !sk_rmem_schedule(sk, skb, skb->len)) {
 		kfree(r);
 		return -EAGAIN;
 	}
@@ -1301,6 +1393,7 @@ static int smap_do_ingress(struct smap_psock *psock, struct sk_buff *skb)
 		return num_sg;
 	}
 	sk_mem_charge(sk, skb->len);
+	psock->ingress_bytes += skb->len;
 	copied = skb->len;
 	r->sg_start = 0;
 	r->sg_end = num_sg == MAX_SKB_FRAGS ? 0 : num_sg;
@@ -1628,6 +1721,8 @@ static void smap_gc_work(struct work_struct *w)
 
 	if (psock->sk_redir)
 		sock_put(psock->sk_redir);
+	if (psock->ingress_blocked)
+		sock_put(psock->ingress_blocked);
 
 	sock_put(psock->sock);
 	kfree(psock);
@@ -346,55 +346,68 @@ static void stack_map_get_build_id_offset(struct bpf_stack_build_id *id_offs,
 	}
 }
 
-BPF_CALL_3(bpf_get_stackid, struct pt_regs *, regs, struct bpf_map *, map,
-	   u64, flags)
-{
-	struct bpf_stack_map *smap = container_of(map, struct bpf_stack_map, map);
-	struct perf_callchain_entry *trace;
-	struct stack_map_bucket *bucket, *new_bucket, *old_bucket;
-	u32 max_depth = map->value_size / stack_map_data_size(map);
-	/* stack_map_alloc() checks that max_depth <= sysctl_perf_event_max_stack */
-	u32 init_nr = sysctl_perf_event_max_stack - max_depth;
-	u32 skip = flags & BPF_F_SKIP_FIELD_MASK;
-	u32 hash, id, trace_nr, trace_len;
-	bool user = flags & BPF_F_USER_STACK;
-	bool kernel = !user;
-	u64 *ips;
-	bool hash_matches;
-
-	if (unlikely(flags & ~(BPF_F_SKIP_FIELD_MASK | BPF_F_USER_STACK |
-			       BPF_F_FAST_STACK_CMP | BPF_F_REUSE_STACKID)))
-		return -EINVAL;
-
-	trace = get_perf_callchain(regs, init_nr, kernel, user,
-				   sysctl_perf_event_max_stack, false, false);
+/*
+ * A stack whose bucket is taken by a different stack may use one of the
+ * next few buckets instead.  While the map has room, a hash collision then
+ * neither loses the sample nor, with BPF_F_REUSE_STACKID, hands the id of a
+ * stack that is still being counted to another one.
+ */
+#define STACK_MAP_PROBES	4
 
-	if (unlikely(!trace))
-		/* couldn't fetch the stack trace */
-		return -EFAULT;
+/*
+ * The id of the bucket holding the stack with @hash and @data of @len
+ * bytes, or -ENOENT with *@free_id set to the first empty bucket probed,
+ * -1 if there was none.  @fast only compares the hash.
+ */
+static int stack_map_find_bucket(struct bpf_stack_map *smap, u32 hash,
+				 const void *data, u32 nr, u32 len, bool fast,
+				 int *free_id)
+{
+	u32 probes = min_t(u32, STACK_MAP_PROBES, smap->n_buckets);
+	struct stack_map_bucket *bucket;
+	u32 i, id;
+
+	*free_id = -1;
+	for (i = 0; i < probes; i++) {
+		id = (hash + i) & (smap->n_buckets - 1);
+		bucket = READ_ONCE(smap->buckets[id]);
+		if (!bucket) {
+			if (*free_id < 0)
+				*free_id = id;
+			continue;
+		}
+		if (bucket->hash != hash)
+			continue;
+		if (fast || (bucket->nr == nr &&
+			     memcmp(bucket->data, data, len) == 0))
+			return id;
+	}
 
-	/* get_perf_callchain() guarantees that trace->nr >= init_nr
-	 * and trace-nr <= sysctl_perf_event_max_stack, so trace_nr <= max_depth
-	 */
-	trace_nr = trace->nr - init_nr;
+	return -ENOENT;
+}
 
-	if (trace_nr <= skip)
-		/* skipping more than usable stack trace */
-		return -EFAULT;
+static int __bpf_get_stackid(struct bpf_map *map, u64 *ips, u32 trace_nr,
+			     u64 flags)
+{
+	struct bpf_stack_map *smap = container_of(map, struct bpf_stack_map, map);
+	struct stack_map_bucket *new_bucket = NULL, *old_bucket;
+	bool fast = flags & BPF_F_FAST_STACK_CMP;
+	bool user = flags & BPF_F_USER_STACK;
+	u32 hash, trace_len;
+	int id, free_id;
 
-	trace_nr -= skip;
 	trace_len = trace_nr * sizeof(u64);
-	ips = trace->ip + skip + init_nr;
 	hash = jhash2((u32 *)ips, trace_len / sizeof(u32), 0);
-	id = hash & (smap->n_buckets - 1);
-	bucket = READ_ONCE(smap->buckets[id]);
-
-	hash_matches = bucket && bucket->hash == hash;
-	/* fast cmp */
-	if (hash_matches && flags & BPF_F_FAST_STACK_CMP)
-		return id;
 
 	if (stack_map_use_build_id(map)) {
+		/* fast cmp needs no build_id */
+		if (fast) {
+			id = stack_map_find_bucket(smap, hash, NULL, 0, 0, true,
+						   &free_id);
+			if (id >= 0)
+				return id;
+		}
+
 		/* for build_id+offset, pop a bucket before slow cmp */
 		new_bucket = (struct stack_map_bucket *)
 			pcpu_freelist_pop(&smap->freelist);
@@ -404,23 +417,36 @@ BPF_CALL_3(bpf_get_stackid, struct pt_regs *, regs, struct bpf_map *, map,
 		stack_map_get_build_id_offset(
 			(struct bpf_stack_build_id *)new_bucket->data,
 			ips, trace_nr, user);
-		trace_len = trace_nr * sizeof(struct bpf_stack_build_id);
-		if (hash_matches && bucket->nr == trace_nr &&
-		    memcmp(bucket->data, new_bucket->data, trace_len) == 0) {
-			pcpu_freelist_push(&smap->freelist, &new_bucket->fnode);
-			return id;
-		}
-		if (bucket && !(flags & BPF_F_REUSE_STACKID)) {
-			pcpu_freelist_push(&smap->freelist, &new_bucket->fnode);
-			return -EEXIST;
+
+		if (!fast) {
+			id = stack_map_find_bucket(smap, hash, new_bucket->data,
+				trace_nr,
+				trace_nr * sizeof(struct bpf_stack_build_id),
+				false, &free_id);
+			if (id >= 0) {
+				pcpu_freelist_push(&smap->freelist,
+						   &new_bucket->fnode);
+				return id;
+			}
 		}
 	} else {
-		if (hash_matches && bucket->nr == trace_nr &&
-		    memcmp(bucket->data, ips, trace_len) == 0)
+		id = stack_map_find_bucket(smap, hash, ips, trace_nr, trace_len,
+					   fast, &free_id);
+		if (id >= 0)
 			return id;
-		if (bucket && !(flags & BPF_F_REUSE_STACKID))
-			return -EEXIST;
+	}
 
+	if (free_id >= 0) {
+		id = free_id;
+	} else if (flags & BPF_F_REUSE_STACKID) {
+		id = hash & (smap->n_buckets - 1);
+	} else {
+		if (new_bucket)
+			pcpu_freelist_push(&smap->freelist, &new_bucket->fnode);
+		return -EEXIST;
+	}
+
+	if (!new_bucket) {
 		new_bucket = (struct stack_map_bucket *)
 			pcpu_freelist_pop(&smap->freelist);
 		if (unlikely(!new_bucket))
@@ -437,6 +463,43 @@ BPF_CALL_3(bpf_get_stackid, struct pt_regs *, regs, struct bpf_map *, map,
 	return id;
 }
 
+BPF_CALL_3(bpf_get_stackid, struct pt_regs *, regs, struct bpf_map *, map,
+	   u64, flags)
+{
+	u32 max_depth = map->value_size / stack_map_data_size(map);
+	/* stack_map_alloc() checks that max_depth <= sysctl_perf_event_max_stack */
+	u32 init_nr = sysctl_perf_event_max_stack - max_depth;
+	u32 skip = flags & BPF_F_SKIP_FIELD_MASK;
+	bool user = flags & BPF_F_USER_STACK;
+	struct perf_callchain_entry *trace;
+	bool kernel = !user;
+	u32 trace_nr;
+
+	if (unlikely(flags & ~(BPF_F_SKIP_FIELD_MASK | BPF_F_USER_STACK |
+			       BPF_F_FAST_STACK_CMP | BPF_F_REUSE_STACKID)))
+		return -EINVAL;
+
+	trace = get_perf_callchain(regs, init_nr, kernel, user,
+				   sysctl_perf_event_max_stack, false, false);
+
+	if (unlikely(!trace))
+		/* couldn't fetch the stack trace */
+		return -EFAULT;
+
+	/* get_perf_callchain() guarantees that trace->nr >= init_nr
+	 * and trace-nr <= sysctl_perf_event_max_stack, so trace_nr <= max_depth
+	 */
+	trace_nr = trace->nr - init_nr;
+
+	if (trace_nr <= skip)
+		/* skipping more than usable stack trace */
+		return -EFAULT;
+
+	trace_nr -= skip;
+	return __bpf_get_stackid(map, trace->ip + skip + init_nr, trace_nr,
+				 flags);
+}
+
 const struct bpf_func_proto bpf_get_stackid_proto = {
 	.func		= bpf_get_stackid,
 	.gpl_only	= true,
@@ -446,8 +509,41 @@ const struct bpf_func_proto bpf_get_stackid_proto = {
 	.arg3_type	= ARG_ANYTHING,
 };
 
-BPF_CALL_4(bpf_get_stack, struct pt_regs *, regs, void *, buf, u32, size,
-	   u64, flags)
+/*
+ * The part of a sample's callchain that bpf_get_stack() or bpf_get_stackid()
+ * would walk for @flags: the ips after its PERF_CONTEXT_KERNEL or
+ * PERF_CONTEXT_USER mark, up to the next mark.  False if the sample has no
+ * such part, perf may have been asked to leave it out.
+ */
+static bool stack_map_callchain_part(struct perf_callchain_entry *trace,
+				     u64 flags, u64 **ips, u32 *nr)
+{
+	u64 mark = flags & BPF_F_USER_STACK ? (u64)PERF_CONTEXT_USER :
+					      (u64)PERF_CONTEXT_KERNEL;
+	u32 i, start;
+
+	for (i = 0; i < trace->nr; i++)
+		if (trace->ip[i] == mark)
+			break;
+	if (i == trace->nr)
+		return false;
+
+	start = ++i;
+	while (i < trace->nr && trace->ip[i] < (u64)PERF_CONTEXT_MAX)
+		i++;
+
+	*ips = trace->ip + start;
+	*nr = i - start;
+	return true;
+}
+
+/*
+ * With @trace_in, the callchain of the sample being handled, the stack is
+ * taken from there if it has the part asked for and walked otherwise.
+ */
+static u64 __bpf_get_stack(struct pt_regs *regs,
+			   struct perf_callchain_entry *trace_in,
+			   void *buf, u32 size, u64 flags)
 {
 	u32 init_nr, trace_nr, copy_len, elem_size, num_elem;
 	bool user_build_id = flags & BPF_F_USER_BUILD_ID;
@@ -470,23 +566,29 @@ BPF_CALL_4(bpf_get_stack, struct pt_regs *, regs, void *, buf, u32, size,
 		goto clear;
 
 	num_elem = size / elem_size;
-	if (sysctl_perf_event_max_stack < num_elem)
-		init_nr = 0;
-	else
-		init_nr = sysctl_perf_event_max_stack - num_elem;
-	trace = get_perf_callchain(regs, init_nr, kernel, user,
-				   sysctl_perf_event_max_stack, false, false);
-	if (unlikely(!trace))
-		goto err_fault;
+	if (!trace_in || !stack_map_callchain_part(trace_in, flags, &ips,
+						   &trace_nr)) {
+		if (sysctl_perf_event_max_stack < num_elem)
+			init_nr = 0;
+		else
+			init_nr = sysctl_perf_event_max_stack - num_elem;
+		trace = get_perf_callchain(regs, init_nr, kernel, user,
+					   sysctl_perf_event_max_stack,
+					   false, false);
+		if (unlikely(!trace))
+			goto err_fault;
+
+		trace_nr = trace->nr - init_nr;
+		ips = trace->ip + init_nr;
+	}
 
-	trace_nr = trace->nr - init_nr;
 	if (trace_nr < skip)
 		goto err_fault;
 
 	trace_nr -= skip;
 	trace_nr = (trace_nr <= num_elem) ? trace_nr : num_elem;
 	copy_len = trace_nr * elem_size;
-	ips = trace->ip + skip + init_nr;
+	ips += skip;
 	if (user && user_build_id)
 		stack_map_get_build_id_offset(buf, ips, trace_nr, user);
 	else
@@ -503,6 +605,12 @@ BPF_CALL_4(bpf_get_stack, struct pt_regs *, regs, void *, buf, u32, size,
 	return err;
 }
 
+BPF_CALL_4(bpf_get_stack, struct pt_regs *, regs, void *, buf, u32, size,
+	   u64, flags)
+{
+	return __bpf_get_stack(regs, NULL, buf, size, flags);
+}
+
 const struct bpf_func_proto bpf_get_stack_proto = {
 	.func		= bpf_get_stack,
 	.gpl_only	= true,
@@ -513,6 +621,63 @@ const struct bpf_func_proto bpf_get_stack_proto = {
 	.arg4_type	= ARG_ANYTHING,
 };
 
+/*
+ * For BPF_PROG_TYPE_PERF_EVENT: an event sampling PERF_SAMPLE_CALLCHAIN has
+ * the stack walked once before the program runs, see bpf_overflow_handler(),
+ * and these take it from the sample rather than walking it again.
+ */
+BPF_CALL_3(bpf_get_stackid_pe, struct bpf_perf_event_data_kern *, ctx,
+	   struct bpf_map *, map, u64, flags)
+{
+	struct perf_callchain_entry *trace = ctx->data->callchain;
+	u32 max_depth = map->value_size / stack_map_data_size(map);
+	u32 skip = flags & BPF_F_SKIP_FIELD_MASK;
+	u32 trace_nr;
+	u64 *ips;
+
+	if (!trace || !stack_map_callchain_part(trace, flags, &ips, &trace_nr))
+		return bpf_get_stackid((unsigned long)ctx->regs,
+				       (unsigned long)map, flags, 0, 0);
+
+	if (unlikely(flags & ~(BPF_F_SKIP_FIELD_MASK | BPF_F_USER_STACK |
+			       BPF_F_FAST_STACK_CMP | BPF_F_REUSE_STACKID)))
+		return -EINVAL;
+
+	if (trace_nr <= skip)
+		return -EFAULT;
+
+	trace_nr -= skip;
+	if (trace_nr > max_depth)
+		trace_nr = max_depth;
+	return __bpf_get_stackid(map, ips + skip, trace_nr, flags);
+}
+
+const struct bpf_func_proto bpf_get_stackid_proto_pe = {
+	.func		= bpf_get_stackid_pe,
+	.gpl_only	= true,
+	.ret_type	= RET_INTEGER,
+	.arg1_type	= ARG_PTR_TO_CTX,
+	.arg2_type	= ARG_CONST_MAP_PTR,
+	.arg3_type	= ARG_ANYTHING,
+};
+
+BPF_CALL_4(bpf_get_stack_pe, struct bpf_perf_event_data_kern *, ctx,
+	   void *, buf, u32, size, u64, flags)
+{
+	return __bpf_get_stack((struct pt_regs *)ctx->regs, ctx->data->callchain,
+			       buf, size, flags);
+}
+
+const struct bpf_func_proto bpf_get_stack_proto_pe = {
+	.func		= bpf_get_stack_pe,
+	.gpl_only	= true,
+	.ret_type	= RET_INTEGER,
+	.arg1_type	= ARG_PTR_TO_CTX,
+	.arg2_type	= ARG_PTR_TO_UNINIT_MEM,
+	.arg3_type	= ARG_CONST_SIZE_OR_ZERO,
+	.arg4_type	= ARG_ANYTHING,
+};
+
 /* Called from eBPF program */
 static void *stack_map_lookup_elem(struct bpf_map *map, void *key)
 {
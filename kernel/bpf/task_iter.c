@@ -0,0 +1,267 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * bpf_iter_task and bpf_iter_task_file: every task, or every open file of
+ * every task, in the pid namespace of whoever opened the iterator.
+ *
+ *	bpf_iter_task		ctx[2] struct task_struct *
+ *	bpf_iter_task_file	ctx[2] struct task_struct *, ctx[3] fd,
+ *				ctx[4] struct file *
+ */
+#include <linux/bpf.h>
+#include <linux/fdtable.h>
+#include <linux/file.h>
+#include <linux/fs.h>
+#include <linux/init.h>
+#include <linux/pid_namespace.h>
+#include <linux/sched/task.h>
+#include <linux/seq_file.h>
+
+struct bpf_iter_seq_task_common {
+	struct pid_namespace *ns;
+};
+
+struct bpf_iter_seq_task_info {
+	/* must be first, init_seq_pidns() and fini_seq_pidns() take it */
+	struct bpf_iter_seq_task_common common;
+	u32 tid;
+};
+
+/* The first task with a tid of *@tid or more, with a reference held. */
+static struct task_struct *task_seq_get_next(struct pid_namespace *ns,
+					     u32 *tid)
+{
+	struct task_struct *task = NULL;
+	struct pid *pid;
+
+	rcu_read_lock();
+retry:
+	pid = find_ge_pid(*tid, ns);
+	if (pid) {
+		*tid = pid_nr_ns(pid, ns);
+		task = get_pid_task(pid, PIDTYPE_PID);
+		if (!task) {
+			++*tid;
+			goto retry;
+		}
+	}
+	rcu_read_unlock();
+
+	return task;
+}
+
+static void *task_seq_start(struct seq_file *seq, loff_t *pos)
+{
+	struct bpf_iter_seq_task_info *info = seq->private;
+
+	/*
+	 * A new pass starts from the first task.  Otherwise the last stop
+	 * was at a task that was fetched but not shown, start with it again.
+	 */
+	if (!*pos)
+		info->tid = 0;
+
+	return task_seq_get_next(info->common.ns, &info->tid);
+}
+
+static void *task_seq_next(struct seq_file *seq, void *v, loff_t *pos)
+{
+	struct bpf_iter_seq_task_info *info = seq->private;
+
+	++*pos;
+	++info->tid;
+	put_task_struct((struct task_struct *)v);
+	return task_seq_get_next(info->common.ns, &info->tid);
+}
+
+static int task_seq_show(struct seq_file *seq, void *v)
+{
+	u64 args[3] = { 0, 0, (unsigned long)v };
+
+	return bpf_iter_run_prog(seq, args, false);
+}
+
+static void task_seq_stop(struct seq_file *seq, void *v)
+{
+	if (!v) {
+		u64 args[3] = {};
+
+		bpf_iter_run_prog(seq, args, true);
+	} else {
+		put_task_struct((struct task_struct *)v);
+	}
+}
+
+static const struct seq_operations task_seq_ops = {
+	.start	= task_seq_start,
+	.next	= task_seq_next,
+	.stop	= task_seq_stop,
+	.show	= task_seq_show,
+};
+
+struct bpf_iter_seq_task_file_info {
+	/* must be first, init_seq_pidns() and fini_seq_pidns() take it */
+	struct bpf_iter_seq_task_common common;
+	struct task_struct *task;
+	struct files_struct *files;
+	u32 tid;
+	u32 fd;
+};
+
+/*
+ * The next open file at or after info->fd of the current task, moving on
+ * to the next task with files when there is none.  Returns the file with a
+ * reference held, info->task and info->files hold theirs as long as the
+ * task is being walked.
+ */
+static struct file *
+task_file_seq_get_next(struct bpf_iter_seq_task_file_info *info)
+{
+	struct pid_namespace *ns = info->common.ns;
+	struct files_struct *files;
+	struct task_struct *task;
+	struct file *file;
+
+	for (;;) {
+		if (!info->task) {
+			task = task_seq_get_next(ns, &info->tid);
+			if (!task)
+				return NULL;
+			files = get_files_struct(task);
+			if (!files) {
+				put_task_struct(task);
+				info->tid++;
+				continue;
+			}
+			info->task = task;
+			info->files = files;
+			info->fd = 0;
+		}
+
+		rcu_read_lock();
+		for (; info->fd < files_fdtable(info->files)->max_fds;
+		     info->fd++) {
+			file = fcheck_files(info->files, info->fd);
+			if (file && get_file_rcu(file)) {
+				rcu_read_unlock();
+				return file;
+			}
+		}
+		rcu_read_unlock();
+
+		put_files_struct(info->files);
+		put_task_struct(info->task);
+		info->files = NULL;
+		info->task = NULL;
+		info->tid++;
+	}
+}
+
+static void *task_file_seq_start(struct seq_file *seq, loff_t *pos)
+{
+	struct bpf_iter_seq_task_file_info *info = seq->private;
+
+	if (!*pos && info->task) {
+		put_files_struct(info->files);
+		put_task_struct(info->task);
+		info->files = NULL;
+		info->task = NULL;
+	}
+	if (!*pos)
+		info->tid = 0;
+
+	return task_file_seq_get_next(info);
+}
+
+static void *task_file_seq_next(struct seq_file *seq, void *v, loff_t *pos)
+{
+	struct bpf_iter_seq_task_file_info *info = seq->private;
+
+	++*pos;
+	++info->fd;
+	fput((struct file *)v);
+	return task_file_seq_get_next(info);
+}
+
+static int task_file_seq_show(struct seq_file *seq, void *v)
+{
+	struct bpf_iter_seq_task_file_info *info = seq->private;
+	u64 args[5] = { 0, 0, (unsigned long)info->task, info->fd,
+			(unsigned long)v };
+
+	return bpf_iter_run_prog(seq, args, false);
+}
+
+static void task_file_seq_stop(struct seq_file *seq, void *v)
+{
+	if (!v) {
+		u64 args[5] = {};
+
+		bpf_iter_run_prog(seq, args, true);
+	} else {
+		/* the task stays held for the next start */
+		fput((struct file *)v);
+	}
+}
+
+static const struct seq_operations task_file_seq_ops = {
+	.start	= task_file_seq_start,
+	.next	= task_file_seq_next,
+	.stop	= task_file_seq_stop,
+	.show	= task_file_seq_show,
+};
+
+static int init_seq_pidns(void *priv_data)
+{
+	struct bpf_iter_seq_task_common *common = priv_data;
+
+	common->ns = get_pid_ns(task_active_pid_ns(current));
+	return 0;
+}
+
+static void fini_seq_pidns(void *priv_data)
+{
+	struct bpf_iter_seq_task_common *common = priv_data;
+
+	put_pid_ns(common->ns);
+}
+
+static void fini_seq_task_file(void *priv_data)
+{
+	struct bpf_iter_seq_task_file_info *info = priv_data;
+
+	if (info->task) {
+		put_files_struct(info->files);
+		put_task_struct(info->task);
+	}
+	fini_seq_pidns(priv_data);
+}
+
+static struct bpf_iter_reg task_reg_info = {
+	.target			= "task",
+	.seq_ops		= &task_seq_ops,
+	.init_seq_private	= init_seq_pidns,
+	.fini_seq_private	= fini_seq_pidns,
+	.seq_priv_size		= sizeof(struct bpf_iter_seq_task_info),
+	.num_args		= 3,
+};
+
+static struct bpf_iter_reg task_file_reg_info = {
+	.target			= "task_file",
+	.seq_ops		= &task_file_seq_ops,
+	.init_seq_private	= init_seq_pidns,
+	.fini_seq_private	= fini_seq_task_file,
+	.seq_priv_size		= sizeof(struct bpf_iter_seq_task_file_info),
+	.num_args		= 5,
+};
+
+static int __init task_iter_init(void)
+{
+	int ret;
+
+	ret = bpf_iter_reg_target(&task_reg_info);
+	if (ret)
+		return ret;
+
+	return bpf_iter_reg_target(&task_file_reg_info);
+}
+late_initcall(task_iter_init);
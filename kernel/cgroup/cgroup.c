@@ -58,10 +58,13 @@
 #include <linux/backing-dev.h>
 #include <net/sock.h>
 #include <linux/psi.h>
+#include <linux/bpf.h>
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/cgroup.h>
 
+EXPORT_TRACEPOINT_SYMBOL_GPL(cgroup_sli_event);
+
 #define CGROUP_FILE_NAME_MAX		(MAX_CGROUP_TYPE_NAMELEN +	\
 					 MAX_CFTYPE_NAME + 2)
 /* let's not notify more than 100 times per second */
@@ -6457,6 +6460,97 @@ int cgroup_bpf_query(struct cgroup *cgrp, const union bpf_attr *attr,
 }
 #endif /* CONFIG_CGROUP_BPF */
 
+#ifdef CONFIG_BPF_SYSCALL
+/*
+ * bpf_iter_cgroup: every online cgroup of every hierarchy, the default one
+ * first, in order of cgroup id rather than in tree order so that a read
+ * can pick up where the last one stopped.  ctx[2] is the struct cgroup *.
+ * cgroup_mutex is held from ->start() to ->stop().
+ */
+struct bpf_iter_seq_cgroup_info {
+	int hierarchy_id;
+	int id;
+};
+
+static struct cgroup *cgroup_iter_get_next(struct bpf_iter_seq_cgroup_info *info)
+{
+	struct cgroup_root *root;
+	struct cgroup *cgrp;
+
+	lockdep_assert_held(&cgroup_mutex);
+
+	while ((root = idr_get_next(&cgroup_hierarchy_idr,
+				    &info->hierarchy_id))) {
+		while ((cgrp = idr_get_next(&root->cgroup_idr, &info->id))) {
+			if (!cgroup_is_dead(cgrp))
+				return cgrp;
+			info->id++;
+		}
+		info->hierarchy_id++;
+		info->id = 0;
+	}
+	return NULL;
+}
+
+static void *cgroup_iter_seq_start(struct seq_file *seq, loff_t *pos)
+{
+	struct bpf_iter_seq_cgroup_info *info = seq->private;
+
+	mutex_lock(&cgroup_mutex);
+	if (!*pos) {
+		info->hierarchy_id = 0;
+		info->id = 0;
+	}
+	return cgroup_iter_get_next(info);
+}
+
+static void *cgroup_iter_seq_next(struct seq_file *seq, void *v, loff_t *pos)
+{
+	struct bpf_iter_seq_cgroup_info *info = seq->private;
+
+	++*pos;
+	++info->id;
+	return cgroup_iter_get_next(info);
+}
+
+static int cgroup_iter_seq_show(struct seq_file *seq, void *v)
+{
+	u64 args[3] = { 0, 0, (unsigned long)v };
+
+	return bpf_iter_run_prog(seq, args, false);
+}
+
+static void cgroup_iter_seq_stop(struct seq_file *seq, void *v)
+{
+	if (!v) {
+		u64 args[3] = {};
+
+		bpf_iter_run_prog(seq, args, true);
+	}
+	mutex_unlock(&cgroup_mutex);
+}
+
+static const struct seq_operations cgroup_iter_seq_ops = {
+	.start	= cgroup_iter_seq_start,
+	.next	= cgroup_iter_seq_next,
+	.stop	= cgroup_iter_seq_stop,
+	.show	= cgroup_iter_seq_show,
+};
+
+static struct bpf_iter_reg cgroup_iter_reg_info = {
+	.target			= "cgroup",
+	.seq_ops		= &cgroup_iter_seq_ops,
+	.seq_priv_size		= sizeof(struct bpf_iter_seq_cgroup_info),
+	.num_args		= 3,
+};
+
+static int __init cgroup_iter_init(void)
+{
+	return bpf_iter_reg_target(&cgroup_iter_reg_info);
+}
+late_initcall(cgroup_iter_init);
+#endif /* CONFIG_BPF_SYSCALL */
+
 #ifdef CONFIG_SYSFS
 static ssize_t show_delegatable_files(struct cftype *files, char *buf,
 				      ssize_t size, const char *prefix)
@@ -176,6 +176,7 @@ typedef enum {
 	CS_SCHED_LOAD_BALANCE,
 	CS_SPREAD_PAGE,
 	CS_SPREAD_SLAB,
+	CS_CPU_ISOLATED,
 } cpuset_flagbits_t;
 
 /* convenient tests for these bits */
@@ -219,6 +220,11 @@ static inline int is_spread_slab(const struct cpuset *cs)
 	return test_bit(CS_SPREAD_SLAB, &cs->flags);
 }
 
+static inline int is_cpu_isolated(const struct cpuset *cs)
+{
+	return test_bit(CS_CPU_ISOLATED, &cs->flags);
+}
+
 static struct cpuset top_cpuset = {
 	.flags = ((1 << CS_ONLINE) | (1 << CS_CPU_EXCLUSIVE) |
 		  (1 << CS_MEM_EXCLUSIVE)),
@@ -499,6 +505,11 @@ static int validate_change(struct cpuset *cur, struct cpuset *trial)
 
 	par = parent_cs(cur);
 
+	/* An isolated partition must not share its CPUs with its siblings */
+	ret = -EINVAL;
+	if (is_cpu_isolated(trial) && !is_cpu_exclusive(trial))
+		goto out;
+
 	/* On legacy hiearchy, we must be a subset of our parent cpuset. */
 	ret = -EACCES;
 	if (!is_in_v2_mode() && !is_cpuset_subset(trial, par))
@@ -884,6 +895,43 @@ static void update_tasks_cpumask(struct cpuset *cs)
 
 /* Don't care about the concurrency of these vars protected by cpuset_mutex. */
 struct cpumask added, deleted, old_cpus;
+static struct cpumask isolated_cpus;
+
+/*
+ * Collect the CPUs of all the isolated cpusets into isolated_cpus, with
+ * @cpus standing in for those of @cs if given.
+ *
+ * Called with cpuset_mutex held
+ */
+static void collect_isolated_cpus(struct cpuset *cs, const struct cpumask *cpus)
+{
+	struct cpuset *cp;
+	struct cgroup_subsys_state *pos_css;
+
+	cpumask_clear(&isolated_cpus);
+	rcu_read_lock();
+	cpuset_for_each_descendant_pre(cp, pos_css, &top_cpuset) {
+		if (!is_cpu_isolated(cp))
+			continue;
+		cpumask_or(&isolated_cpus, &isolated_cpus,
+			   cp == cs && cpus ? cpus : cp->cpus_allowed);
+	}
+	rcu_read_unlock();
+}
+
+/*
+ * update_isolated_cpus - hand the CPUs of the isolated cpusets over to the
+ * dynamic isolation, which keeps tasks outside of them, unbound workqueues
+ * and timers away and takes them out of the sched domains.  The caller
+ * rebuilds the sched domains.
+ *
+ * Called with cpuset_mutex held
+ */
+static int update_isolated_cpus(void)
+{
+	collect_isolated_cpus(NULL, NULL);
+	return dyn_isolcpus_cpuset_update(&isolated_cpus);
+}
 
 /*
  * update_cpumasks_hier - Update effective cpumasks and tasks in the subtree
@@ -1006,12 +1054,24 @@ static int update_cpumask(struct cpuset *cs, struct cpuset *trialcs,
 	if (retval < 0)
 		return retval;
 
+	if (is_cpu_isolated(cs)) {
+		collect_isolated_cpus(cs, trialcs->cpus_allowed);
+		if (!dyn_isolcpus_cpuset_check(&isolated_cpus))
+			return -EINVAL;
+	}
+
 	spin_lock_irq(&callback_lock);
 	cpumask_copy(cs->cpus_allowed, trialcs->cpus_allowed);
 	spin_unlock_irq(&callback_lock);
 
+	if (is_cpu_isolated(cs))
+		update_isolated_cpus();
+
 	/* use trialcs->cpus_allowed as a temp variable */
 	update_cpumasks_hier(cs, trialcs->cpus_allowed);
+
+	if (is_cpu_isolated(cs))
+		rebuild_sched_domains_locked();
 	return 0;
 }
 
@@ -1334,6 +1394,8 @@ static int update_flag(cpuset_flagbits_t bit, struct cpuset *cs,
 	struct cpuset *trialcs;
 	int balance_flag_changed;
 	int spread_flag_changed;
+	int isolated_flag_changed;
+	unsigned long old_flags;
 	int err;
 
 	trialcs = alloc_trial_cpuset(cs);
@@ -1355,11 +1417,26 @@ static int update_flag(cpuset_flagbits_t bit, struct cpuset *cs,
 	spread_flag_changed = ((is_spread_slab(cs) != is_spread_slab(trialcs))
 			|| (is_spread_page(cs) != is_spread_page(trialcs)));
 
+	isolated_flag_changed = (is_cpu_isolated(cs) !=
+				 is_cpu_isolated(trialcs));
+
+	old_flags = cs->flags;
 	spin_lock_irq(&callback_lock);
 	cs->flags = trialcs->flags;
 	spin_unlock_irq(&callback_lock);
 
-	if (!cpumask_empty(trialcs->cpus_allowed) && balance_flag_changed)
+	if (isolated_flag_changed) {
+		err = update_isolated_cpus();
+		if (err) {
+			spin_lock_irq(&callback_lock);
+			cs->flags = old_flags;
+			spin_unlock_irq(&callback_lock);
+			goto out;
+		}
+	}
+
+	if ((!cpumask_empty(trialcs->cpus_allowed) && balance_flag_changed) ||
+	    isolated_flag_changed)
 		rebuild_sched_domains_locked();
 
 	if (spread_flag_changed)
@@ -1620,6 +1697,7 @@ typedef enum {
 	FILE_MEMORY_PRESSURE,
 	FILE_SPREAD_PAGE,
 	FILE_SPREAD_SLAB,
+	FILE_CPU_ISOLATED,
 } cpuset_filetype_t;
 
 static int cpuset_write_u64(struct cgroup_subsys_state *css, struct cftype *cft,
@@ -1660,6 +1738,9 @@ static int cpuset_write_u64(struct cgroup_subsys_state *css, struct cftype *cft,
 	case FILE_SPREAD_SLAB:
 		retval = update_flag(CS_SPREAD_SLAB, cs, val);
 		break;
+	case FILE_CPU_ISOLATED:
+		retval = update_flag(CS_CPU_ISOLATED, cs, val);
+		break;
 	default:
 		retval = -EINVAL;
 		break;
@@ -1819,6 +1900,8 @@ static u64 cpuset_read_u64(struct cgroup_subsys_state *css, struct cftype *cft)
 		return is_spread_page(cs);
 	case FILE_SPREAD_SLAB:
 		return is_spread_slab(cs);
+	case FILE_CPU_ISOLATED:
+		return is_cpu_isolated(cs);
 	default:
 		BUG();
 	}
@@ -1883,6 +1966,14 @@ static struct cftype files[] = {
 		.private = FILE_CPU_EXCLUSIVE,
 	},
 
+	{
+		.name = "cpu_isolated",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = cpuset_read_u64,
+		.write_u64 = cpuset_write_u64,
+		.private = FILE_CPU_ISOLATED,
+	},
+
 	{
 		.name = "mem_exclusive",
 		.read_u64 = cpuset_read_u64,
@@ -2066,6 +2157,9 @@ static void cpuset_css_offline(struct cgroup_subsys_state *css)
 	if (is_sched_load_balance(cs))
 		update_flag(CS_SCHED_LOAD_BALANCE, cs, 0);
 
+	if (is_cpu_isolated(cs))
+		update_flag(CS_CPU_ISOLATED, cs, 0);
+
 	cpuset_dec();
 	clear_bit(CS_ONLINE, &cs->flags);
 
@@ -2389,7 +2483,12 @@ static void cpuset_hotplug_workfn(struct work_struct *work)
 	/* rebuild sched domains if cpus_allowed has changed */
 	if (cpus_updated || force_rebuild) {
 		force_rebuild = false;
-		rebuild_sched_domains();
+		mutex_lock(&cpuset_mutex);
+		/* the legacy hierarchy drops offlined CPUs from cpus_allowed */
+		if (cpus_updated)
+			update_isolated_cpus();
+		rebuild_sched_domains_locked();
+		mutex_unlock(&cpuset_mutex);
 	}
 }
 
@@ -5,6 +5,19 @@
 static DEFINE_SPINLOCK(cgroup_rstat_lock);
 static DEFINE_PER_CPU(raw_spinlock_t, cgroup_rstat_cpu_lock);
 
+/*
+ * Readers of cgroup stats don't flush while fewer than this many cpus have
+ * updates pending in the cgroup's subtree, and the whole hierarchy is then
+ * flushed every sysctl_cgroup_rstat_flush_interval_ms instead.  0 flushes
+ * on every read.
+ */
+unsigned int sysctl_cgroup_rstat_flush_threshold;
+unsigned int sysctl_cgroup_rstat_flush_interval_ms = 2000;
+
+static void cgroup_rstat_flush_workfn(struct work_struct *work);
+static DECLARE_DEFERRABLE_WORK(cgroup_rstat_flush_work,
+			       cgroup_rstat_flush_workfn);
+
 static void cgroup_base_stat_flush(struct cgroup *cgrp, int cpu);
 
 static struct cgroup_rstat_cpu *cgroup_rstat_cpu(struct cgroup *cgrp, int cpu)
@@ -62,6 +75,7 @@ void cgroup_rstat_updated(struct cgroup *cgrp, int cpu)
 
 		rstatc->updated_next = prstatc->updated_children;
 		prstatc->updated_children = cgrp;
+		atomic_inc(&cgrp->rstat_pending);
 	}
 
 	raw_spin_unlock_irqrestore(cpu_lock, flags);
@@ -132,6 +146,7 @@ static struct cgroup *cgroup_rstat_cpu_pop_updated(struct cgroup *pos,
 
 		*nextp = rstatc->updated_next;
 		rstatc->updated_next = NULL;
+		atomic_dec(&pos->rstat_pending);
 
 		/*
 		 * Paired with the one in cgroup_rstat_cpu_updated().
@@ -227,16 +242,21 @@ void cgroup_rstat_flush_irqsafe(struct cgroup *cgrp)
  * @cgrp: target cgroup
  *
  * Flush stats in @cgrp's subtree and prevent further flushes.  Must be
- * paired with cgroup_rstat_flush_release().
+ * paired with cgroup_rstat_flush_release().  With a flush threshold set,
+ * the stats are only flushed once enough cpus have updates pending, and
+ * may be up to an interval of the flush work old.
  *
  * This function may block.
  */
 void cgroup_rstat_flush_hold(struct cgroup *cgrp)
 	__acquires(&cgroup_rstat_lock)
 {
+	unsigned int threshold = READ_ONCE(sysctl_cgroup_rstat_flush_threshold);
+
 	might_sleep();
 	spin_lock_irq(&cgroup_rstat_lock);
-	cgroup_rstat_flush_locked(cgrp, true);
+	if (!threshold || atomic_read(&cgrp->rstat_pending) >= threshold)
+		cgroup_rstat_flush_locked(cgrp, true);
 }
 
 /**
@@ -248,6 +268,33 @@ void cgroup_rstat_flush_release(void)
 	spin_unlock_irq(&cgroup_rstat_lock);
 }
 
+static void cgroup_rstat_flush_workfn(struct work_struct *work)
+{
+	if (!READ_ONCE(sysctl_cgroup_rstat_flush_threshold))
+		return;
+
+	cgroup_rstat_flush(&cgrp_dfl_root.cgrp);
+	queue_delayed_work(system_unbound_wq, &cgroup_rstat_flush_work,
+		msecs_to_jiffies(READ_ONCE(sysctl_cgroup_rstat_flush_interval_ms)));
+}
+
+int cgroup_rstat_flush_threshold_handler(struct ctl_table *table, int write,
+					 void __user *buffer, size_t *lenp,
+					 loff_t *ppos)
+{
+	int ret;
+
+	ret = proc_douintvec(table, write, buffer, lenp, ppos);
+	if (ret || !write)
+		return ret;
+
+	/* the work stops by itself once the threshold is cleared */
+	if (sysctl_cgroup_rstat_flush_threshold)
+		queue_delayed_work(system_unbound_wq, &cgroup_rstat_flush_work,
+			msecs_to_jiffies(sysctl_cgroup_rstat_flush_interval_ms));
+	return 0;
+}
+
 int cgroup_rstat_init(struct cgroup *cgrp)
 {
 	int cpu;
@@ -6540,7 +6540,8 @@ void perf_prepare_sample(struct perf_event_header *header,
 	if (sample_type & PERF_SAMPLE_CALLCHAIN) {
 		int size = 1;
 
-		if (!(sample_type & __PERF_SAMPLE_CALLCHAIN_EARLY))
+		/* taken early by PEBS or by bpf_overflow_handler() */
+		if (!data->callchain)
 			data->callchain = perf_callchain(event, regs);
 
 		size += data->callchain->nr;
@@ -8668,6 +8669,14 @@ static void bpf_overflow_handler(struct perf_event *event,
 	if (unlikely(__this_cpu_inc_return(bpf_prog_active) != 1))
 		goto out;
 	rcu_read_lock();
+	/*
+	 * Walk the stack once for both the program's bpf_get_stack[id]()
+	 * and the sample, rather than once for each.
+	 */
+	if (event->prog->call_get_stack &&
+	    (event->attr.sample_type & PERF_SAMPLE_CALLCHAIN) &&
+	    !data->callchain)
+		data->callchain = perf_callchain(event, regs);
 	ret = BPF_PROG_RUN(event->prog, &ctx);
 	rcu_read_unlock();
 out:
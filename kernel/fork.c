@@ -94,6 +94,7 @@
 #include <linux/livepatch.h>
 #include <linux/thread_info.h>
 #include <linux/fault_event.h>
+#include <linux/async_fork.h>
 
 #include <asm/pgtable.h>
 #include <asm/pgalloc.h>
@@ -328,10 +329,25 @@ struct vm_area_struct *vm_area_dup(struct vm_area_struct *orig)
 	return new;
 }
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+static void __vm_area_free(struct rcu_head *head)
+{
+	struct vm_area_struct *vma = container_of(head, struct vm_area_struct,
+						  vm_rcu);
+
+	kmem_cache_free(vm_area_cachep, vma);
+}
+
+void vm_area_free(struct vm_area_struct *vma)
+{
+	call_rcu(&vma->vm_rcu, __vm_area_free);
+}
+#else
 void vm_area_free(struct vm_area_struct *vma)
 {
 	kmem_cache_free(vm_area_cachep, vma);
 }
+#endif
 
 static void account_kernel_stack(struct task_struct *tsk, int account)
 {
@@ -436,6 +452,7 @@ static __latent_entropy int dup_mmap(struct mm_struct *mm,
 	 * Not linked in yet - no deadlock potential:
 	 */
 	down_write_nested(&mm->mmap_sem, SINGLE_DEPTH_NESTING);
+	async_fork_prepare(mm, oldmm);
 
 	/* No ordering required: file already has been exposed. */
 	RCU_INIT_POINTER(mm->exe_file, get_mm_exe_file(oldmm));
@@ -636,6 +653,7 @@ void __mmdrop(struct mm_struct *mm)
 	hmm_mm_destroy(mm);
 	mmu_notifier_mm_destroy(mm);
 	check_mm(mm);
+	futex_mm_free(mm);
 	put_user_ns(mm->user_ns);
 	free_mm(mm);
 }
@@ -943,6 +961,19 @@ static struct mm_struct *mm_init(struct mm_struct *mm, struct task_struct *p,
 	atomic_set(&mm->mm_users, 1);
 	atomic_set(&mm->mm_count, 1);
 	init_rwsem(&mm->mmap_sem);
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	seqcount_init(&mm->mmap_seq);
+	mm->mmap_seq_depth = 0;
+#endif
+#ifdef CONFIG_ASYNC_FORK
+	mm->async_fork_parent = NULL;
+	mm->async_fork_child = NULL;
+	mutex_init(&mm->async_fork_mutex);
+	mm->async_fork_failed = false;
+#endif
+#ifdef CONFIG_FUTEX
+	mm->futex_hash = NULL;
+#endif
 	INIT_LIST_HEAD(&mm->mmlist);
 	mm->core_state = NULL;
 	mm_pgtables_bytes_init(mm);
@@ -1958,6 +1989,9 @@ static __latent_entropy struct task_struct *copy_process(
 	posix_cpu_timers_init(p);
 
 	p->io_context = NULL;
+#ifdef CONFIG_IO_URING
+	p->io_uring = NULL;
+#endif
 	audit_set_context(p, NULL);
 	cgroup_fork(p);
 #ifdef CONFIG_NUMA
@@ -2134,6 +2168,7 @@ static __latent_entropy struct task_struct *copy_process(
 	p->pdeath_signal = 0;
 	INIT_LIST_HEAD(&p->thread_group);
 	p->task_works = NULL;
+	async_fork_queue(p);
 
 	cgroup_threadgroup_change_begin(current);
 	/*
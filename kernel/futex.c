@@ -227,6 +227,9 @@ struct futex_pi_state {
  * @rt_waiter:		rt_waiter storage for use with requeue_pi
  * @requeue_pi_key:	the requeue_pi target futex key
  * @bitset:		bitset for the optional bitmasked wakeup
+ * @wake:		optional callback replacing the task wakeup, see
+ *			futex_queue_async()
+ * @wake_data:		argument of @wake
  *
  * We use this hashed waitqueue, instead of a normal wait_queue_entry_t, so
  * we can wake only the relevant ones (hashed queues may be shared).
@@ -249,6 +252,8 @@ struct futex_q {
 	struct rt_mutex_waiter *rt_waiter;
 	union futex_key *requeue_pi_key;
 	u32 bitset;
+	void (*wake)(void *data);
+	void *wake_data;
 } __randomize_layout;
 
 static const struct futex_q futex_q_init = {
@@ -269,16 +274,39 @@ struct futex_hash_bucket {
 } ____cacheline_aligned_in_smp;
 
 /*
- * The base of the bucket array and its size are always used together
- * (after initialization only in hash_futex()), so ensure that they
- * reside in the same cacheline.
+ * The global hash is split into one bucket array per node, each allocated
+ * on its node, so that the buckets of shared futexes are spread over all
+ * of memory rather than all living on the boot node.  The arrays and their
+ * size are always used together (after initialization only in
+ * hash_futex()), so ensure that they reside in the same cacheline.
  */
 static struct {
-	struct futex_hash_bucket *queues;
-	unsigned long            hashsize;
-} __futex_data __read_mostly __aligned(2*sizeof(long));
+	struct futex_hash_bucket **queues;
+	unsigned long		 hashsize;
+	unsigned int		 shift;
+} __futex_data __read_mostly __aligned(4*sizeof(long));
 #define futex_queues   (__futex_data.queues)
 #define futex_hashsize (__futex_data.hashsize)
+#define futex_shift    (__futex_data.shift)
+
+/*
+ * PROCESS_PRIVATE futexes of a process hash into a table of its own,
+ * allocated on the first private futex operation of the mm, so that they
+ * don't share buckets with unrelated processes.  An mm that failed to get
+ * one is left with an error pointer and keeps using the global hash.
+ */
+struct futex_private_hash {
+	unsigned long hashsize;
+	struct futex_hash_bucket queues[];
+};
+
+static bool futex_private_hash_enabled __read_mostly = true;
+
+static int __init setup_futex_private_hash(char *str)
+{
+	return !strtobool(str, &futex_private_hash_enabled);
+}
+__setup("futex_private_hash=", setup_futex_private_hash);
 
 
 /*
@@ -386,19 +414,75 @@ static inline int hb_waiters_pending(struct futex_hash_bucket *hb)
 #endif
 }
 
+static void futex_hash_init(struct futex_hash_bucket *queues,
+			    unsigned long hashsize)
+{
+	unsigned long i;
+
+	for (i = 0; i < hashsize; i++) {
+		atomic_set(&queues[i].waiters, 0);
+		plist_head_init(&queues[i].chain);
+		spin_lock_init(&queues[i].lock);
+	}
+}
+
+/*
+ * Give @mm its private futex hash.  Called from get_futex_key(), before any
+ * private key of @mm gets hashed, and never resized afterwards: waiters
+ * already queued would be lost.
+ */
+static void futex_private_hash_alloc(struct mm_struct *mm)
+{
+	struct futex_private_hash *fph = ERR_PTR(-ENOMEM);
+	unsigned long hashsize;
+
+	if (futex_private_hash_enabled) {
+		hashsize = roundup_pow_of_two(4 * num_online_cpus());
+		hashsize = clamp(hashsize, 16UL, futex_hashsize);
+		fph = kvzalloc(struct_size(fph, queues, hashsize),
+			       GFP_KERNEL_ACCOUNT);
+		if (fph) {
+			fph->hashsize = hashsize;
+			futex_hash_init(fph->queues, hashsize);
+		} else {
+			fph = ERR_PTR(-ENOMEM);
+		}
+	}
+
+	if (cmpxchg(&mm->futex_hash, NULL, fph) && !IS_ERR(fph))
+		kvfree(fph);
+}
+
+/* Called from __mmdrop(): nothing can be queued on @mm's futexes anymore. */
+void futex_mm_free(struct mm_struct *mm)
+{
+	if (!IS_ERR_OR_NULL(mm->futex_hash))
+		kvfree(mm->futex_hash);
+}
+
 /**
- * hash_futex - Return the hash bucket in the global hash
+ * hash_futex - Return the hash bucket of a futex
  * @key:	Pointer to the futex key for which the hash is calculated
  *
  * We hash on the keys returned from get_futex_key (see below) and return the
- * corresponding hash bucket in the global hash.
+ * corresponding hash bucket in the private hash of the key's mm, or in the
+ * global hash for shared futexes.
  */
 static struct futex_hash_bucket *hash_futex(union futex_key *key)
 {
 	u32 hash = jhash2((u32*)&key->both.word,
 			  (sizeof(key->both.word)+sizeof(key->both.ptr))/4,
 			  key->both.offset);
-	return &futex_queues[hash & (futex_hashsize - 1)];
+	struct futex_private_hash *fph;
+
+	if (!(key->both.offset & (FUT_OFF_INODE | FUT_OFF_MMSHARED))) {
+		fph = READ_ONCE(key->private.mm->futex_hash);
+		if (!IS_ERR_OR_NULL(fph))
+			return &fph->queues[hash & (fph->hashsize - 1)];
+	}
+
+	return &futex_queues[(hash >> futex_shift) % nr_node_ids]
+			    [hash & (futex_hashsize - 1)];
 }
 
 
@@ -530,6 +614,8 @@ get_futex_key(u32 __user *uaddr, int fshared, union futex_key *key, int rw)
 	 *        but access_ok() should be faster than find_vma()
 	 */
 	if (!fshared) {
+		if (unlikely(!READ_ONCE(mm->futex_hash)))
+			futex_private_hash_alloc(mm);
 		key->private.mm = mm;
 		key->private.address = address;
 		get_futex_key_refs(key);  /* implies smp_mb(); (B) */
@@ -1449,6 +1535,18 @@ static void mark_wake_futex(struct wake_q_head *wake_q, struct futex_q *q)
 	if (WARN(q->pi_state || q->rt_waiter, "refusing to wake PI futex\n"))
 		return;
 
+	if (q->wake) {
+		__unqueue_futex(q);
+		/*
+		 * Call back before releasing lock_ptr, an owner still sees
+		 * the futex_q locked until then and futex_unqueue_async()
+		 * waits for the callback to be done with it.
+		 */
+		q->wake(q->wake_data);
+		smp_store_release(&q->lock_ptr, NULL);
+		return;
+	}
+
 	get_task_struct(p);
 	__unqueue_futex(q);
 	/*
@@ -2754,6 +2852,68 @@ static int futex_wait(u32 __user *uaddr, unsigned int flags, u32 val,
 }
 
 
+/**
+ * futex_queue_async() - Queue a waiter that is not a sleeping task
+ * @uaddr:	the futex userspace address
+ * @shared:	whether the futex may be shared between processes
+ * @val:	the expected value
+ * @bitset:	bitset for the bitmasked wakeup
+ * @wake:	called instead of waking a task, under the hash bucket lock
+ * @data:	argument of @wake
+ *
+ * Used by io_uring to wait on a futex without blocking. @wake must not
+ * sleep nor unqueue the futex_q itself. Every futex_q returned here must be
+ * passed to futex_unqueue_async() exactly once.
+ *
+ * Return: the queued futex_q, or an ERR_PTR (-EWOULDBLOCK if uaddr does not
+ * contain val).
+ */
+struct futex_q *futex_queue_async(u32 __user *uaddr, bool shared, u32 val,
+				  u32 bitset, void (*wake)(void *data),
+				  void *data)
+{
+	struct futex_hash_bucket *hb;
+	struct futex_q *q;
+	int ret;
+
+	if (!bitset)
+		return ERR_PTR(-EINVAL);
+
+	q = kmalloc(sizeof(*q), GFP_KERNEL);
+	if (!q)
+		return ERR_PTR(-ENOMEM);
+	*q = futex_q_init;
+	q->bitset = bitset;
+	q->wake = wake;
+	q->wake_data = data;
+
+	ret = futex_wait_setup(uaddr, val, shared ? FLAGS_SHARED : 0, q, &hb);
+	if (ret) {
+		kfree(q);
+		return ERR_PTR(ret);
+	}
+
+	queue_me(q, hb);
+	return q;
+}
+
+/**
+ * futex_unqueue_async() - Remove and free a futex_q of futex_queue_async()
+ * @q:	the futex_q
+ *
+ * Once this returns, the wake callback of @q is not running and won't be
+ * called anymore. Must be called from a context that may sleep.
+ *
+ * Return: true if @q was still queued, false if it had been woken.
+ */
+bool futex_unqueue_async(struct futex_q *q)
+{
+	int ret = unqueue_me(q);
+
+	kfree(q);
+	return ret;
+}
+
 static long futex_wait_restart(struct restart_block *restart)
 {
 	u32 __user *uaddr = restart->futex.uaddr;
@@ -3958,30 +4118,40 @@ static void __init futex_detect_cmpxchg(void)
 
 static int __init futex_init(void)
 {
-	unsigned int futex_shift;
-	unsigned long i;
+	unsigned long hashsize;
+	int nid;
 
 #if CONFIG_BASE_SMALL
-	futex_hashsize = 16;
+	hashsize = 16;
 #else
-	futex_hashsize = roundup_pow_of_two(256 * num_possible_cpus());
+	hashsize = roundup_pow_of_two(256 * num_possible_cpus());
 #endif
+	hashsize = max(hashsize / roundup_pow_of_two(nr_node_ids), 16UL);
+
+	futex_queues = kcalloc(nr_node_ids, sizeof(*futex_queues), GFP_KERNEL);
+	if (!futex_queues)
+		panic("futex: cannot allocate hash table");
+
+	for_each_node(nid) {
+		futex_queues[nid] = kvmalloc_node(hashsize *
+						  sizeof(**futex_queues),
+						  GFP_KERNEL, nid);
+		if (!futex_queues[nid])
+			panic("futex: cannot allocate hash table");
+		futex_hash_init(futex_queues[nid], hashsize);
+	}
+	/* Node ids that can never come online share the first array */
+	for (nid = 0; nid < nr_node_ids; nid++)
+		if (!futex_queues[nid])
+			futex_queues[nid] = futex_queues[first_node(node_possible_map)];
 
-	futex_queues = alloc_large_system_hash("futex", sizeof(*futex_queues),
-					       futex_hashsize, 0,
-					       futex_hashsize < 256 ? HASH_SMALL : 0,
-					       &futex_shift, NULL,
-					       futex_hashsize, futex_hashsize);
-	futex_hashsize = 1UL << futex_shift;
+	futex_hashsize = hashsize;
+	futex_shift = ilog2(hashsize);
+	pr_info("futex hash table entries: %lu x %u nodes\n",
+		hashsize, num_possible_nodes());
 
 	futex_detect_cmpxchg();
 
-	for (i = 0; i < futex_hashsize; i++) {
-		atomic_set(&futex_queues[i].waiters, 0);
-		plist_head_init(&futex_queues[i].chain);
-		spin_lock_init(&futex_queues[i].lock);
-	}
-
 	return 0;
 }
 core_initcall(futex_init);
@@ -0,0 +1,239 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * In-kernel balancing of unmanaged interrupts
+ *
+ * Every interval the interrupt and softirq time of the balanced CPUs is
+ * compared.  When the busiest one exceeds the least busy one by more than
+ * the threshold, the unmanaged interrupt that fired most often on the
+ * busiest CPU is moved to the least busy one.  CPUs that run highclass
+ * group identity tasks count as fully busy, so interrupts are moved off
+ * them and never onto them.  A moved interrupt stays put for a few
+ * intervals, which keeps two CPUs of similar load from trading it back
+ * and forth.
+ *
+ * Only interrupts that still have the default affinity, or the single CPU
+ * the balancer gave them, are touched.  Writing smp_affinity takes an
+ * interrupt out of the balancer's hands.  Isolated CPUs (isolcpus=) are
+ * never balanced.
+ */
+
+#define pr_fmt(fmt) "irq_balance: " fmt
+
+#include <linux/cpu.h>
+#include <linux/interrupt.h>
+#include <linux/irq.h>
+#include <linux/kernel_stat.h>
+#include <linux/moduleparam.h>
+#include <linux/sched.h>
+#include <linux/sched/isolation.h>
+#include <linux/workqueue.h>
+
+#include "internals.h"
+
+#ifdef MODULE_PARAM_PREFIX
+#undef MODULE_PARAM_PREFIX
+#endif
+#define MODULE_PARAM_PREFIX "irq_balance."
+
+static bool irq_balance_enabled;
+static unsigned int irq_balance_interval_ms = 1000;
+module_param_named(interval_ms, irq_balance_interval_ms, uint, 0644);
+/* imbalance worth a move, in percent of the interval */
+static unsigned int irq_balance_threshold = 10;
+module_param_named(threshold_pct, irq_balance_threshold, uint, 0644);
+/* intervals a moved interrupt stays on its new CPU */
+static unsigned int irq_balance_hold = 10;
+module_param_named(hold_intervals, irq_balance_hold, uint, 0644);
+
+struct irq_balance_cpu {
+	u64	last_time;	/* irq + softirq time at the last pass */
+	u64	load;		/* irq + softirq time during the last interval */
+	bool	seen;		/* last_time is valid */
+};
+
+static DEFINE_PER_CPU(struct irq_balance_cpu, irq_balance_cpus);
+static struct cpumask irq_balance_mask;
+
+static void irq_balance_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(irq_balance_work, irq_balance_fn);
+
+static unsigned long irq_balance_interval(void)
+{
+	return msecs_to_jiffies(max(READ_ONCE(irq_balance_interval_ms), 10U));
+}
+
+static void irq_balance_update_load(const struct cpumask *mask)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct irq_balance_cpu *bc = per_cpu_ptr(&irq_balance_cpus, cpu);
+		u64 now;
+
+		if (!cpumask_test_cpu(cpu, mask)) {
+			bc->seen = false;
+			continue;
+		}
+
+		now = kcpustat_cpu(cpu).cpustat[CPUTIME_SOFTIRQ] +
+		      kcpustat_cpu(cpu).cpustat[CPUTIME_IRQ];
+		bc->load = bc->seen ? now - bc->last_time : 0;
+		bc->last_time = now;
+		bc->seen = true;
+	}
+}
+
+/* highclass tasks are latency tenants, keep interrupts away from them */
+static u64 irq_balance_cpu_load(int cpu, u64 interval_ns)
+{
+	if (sched_cpu_highclass_running(cpu))
+		return interval_ns;
+	return per_cpu(irq_balance_cpus, cpu).load;
+}
+
+/*
+ * Whether @desc is left to the balancer, and if so, the CPU it targets.
+ * Called with desc->lock held.
+ */
+static int irq_balance_desc_cpu(struct irq_desc *desc,
+				const struct cpumask *mask)
+{
+	struct irq_data *data = irq_desc_get_irq_data(desc);
+	const struct cpumask *eff;
+
+	if (!desc->action || !irqd_can_balance(data) ||
+	    irqd_affinity_is_managed(data) || !irqd_is_started(data))
+		return -1;
+
+	if (desc->balance_cpu) {
+		/* smp_affinity was written since the last move */
+		if (!cpumask_equal(irq_data_get_affinity_mask(data),
+				   cpumask_of(desc->balance_cpu - 1))) {
+			desc->balance_cpu = 0;
+			return -1;
+		}
+	} else if (!cpumask_subset(mask, irq_data_get_affinity_mask(data))) {
+		return -1;
+	}
+
+	eff = irq_data_get_effective_affinity_mask(data);
+	if (cpumask_weight(eff) != 1)
+		return -1;
+	return cpumask_first(eff);
+}
+
+static void irq_balance_run(const struct cpumask *mask)
+{
+	u64 interval_ns = jiffies_to_nsecs(irq_balance_interval());
+	u64 src_load = 0, dst_load = U64_MAX, src_irqs = 0, best_count = 0;
+	unsigned long hold = irq_balance_interval() * irq_balance_hold;
+	int cpu, src = -1, dst = -1, irq, best_irq = -1;
+	struct irq_desc *desc;
+
+	for_each_cpu(cpu, mask) {
+		u64 load = irq_balance_cpu_load(cpu, interval_ns);
+
+		if (src < 0 || load > src_load) {
+			src = cpu;
+			src_load = load;
+		}
+		if (!sched_cpu_highclass_running(cpu) && load < dst_load) {
+			dst = cpu;
+			dst_load = load;
+		}
+	}
+	if (src < 0 || dst < 0 || src == dst)
+		dst = -1;
+	else if (src_load - dst_load <=
+		 div_u64(interval_ns * irq_balance_threshold, 100))
+		dst = -1;
+
+	/* every interrupt's count is sampled, a move or not */
+	for_each_irq_desc(irq, desc) {
+		unsigned int count;
+
+		if (!irq_can_set_affinity_usr(irq))
+			continue;
+
+		raw_spin_lock_irq(&desc->lock);
+		count = desc->tot_count - desc->balance_count;
+		desc->balance_count = desc->tot_count;
+		if (dst >= 0 && irq_balance_desc_cpu(desc, mask) == src) {
+			src_irqs += count;
+			if (count > best_count &&
+			    time_after(jiffies, desc->balance_moved + hold)) {
+				best_count = count;
+				best_irq = irq;
+			}
+		}
+		raw_spin_unlock_irq(&desc->lock);
+	}
+
+	if (best_irq < 0)
+		return;
+
+	/*
+	 * Moving an interrupt that makes up most of the imbalance just moves
+	 * the imbalance, unless it is moved off a latency tenant's CPU.
+	 */
+	if (!sched_cpu_highclass_running(src) &&
+	    div64_u64(src_load * best_count, src_irqs) >=
+	    src_load - dst_load)
+		return;
+
+	if (irq_set_affinity(best_irq, cpumask_of(dst)))
+		return;
+
+	desc = irq_to_desc(best_irq);
+	raw_spin_lock_irq(&desc->lock);
+	desc->balance_cpu = dst + 1;
+	desc->balance_moved = jiffies;
+	raw_spin_unlock_irq(&desc->lock);
+	pr_debug("moved irq %d from CPU%d to CPU%d\n", best_irq, src, dst);
+}
+
+static void irq_balance_fn(struct work_struct *work)
+{
+	cpus_read_lock();
+	irq_lock_sparse();
+
+	cpumask_and(&irq_balance_mask, cpu_online_mask, irq_default_affinity);
+	cpumask_and(&irq_balance_mask, &irq_balance_mask,
+		    housekeeping_cpumask(HK_FLAG_DOMAIN));
+	irq_balance_update_load(&irq_balance_mask);
+	if (cpumask_weight(&irq_balance_mask) > 1)
+		irq_balance_run(&irq_balance_mask);
+
+	irq_unlock_sparse();
+	cpus_read_unlock();
+
+	if (READ_ONCE(irq_balance_enabled))
+		queue_delayed_work(system_unbound_wq, &irq_balance_work,
+				   irq_balance_interval());
+}
+
+static int irq_balance_set_enabled(const char *val,
+				   const struct kernel_param *kp)
+{
+	int ret = param_set_bool(val, kp);
+
+	if (!ret && irq_balance_enabled && system_unbound_wq)
+		queue_delayed_work(system_unbound_wq, &irq_balance_work, 0);
+	return ret;
+}
+
+static const struct kernel_param_ops irq_balance_enabled_ops = {
+	.set = irq_balance_set_enabled,
+	.get = param_get_bool,
+};
+module_param_cb(enabled, &irq_balance_enabled_ops, &irq_balance_enabled,
+		0644);
+
+static int __init irq_balance_init(void)
+{
+	if (irq_balance_enabled)
+		queue_delayed_work(system_unbound_wq, &irq_balance_work,
+				   irq_balance_interval());
+	return 0;
+}
+late_initcall(irq_balance_init);
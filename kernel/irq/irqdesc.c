@@ -120,6 +120,10 @@ static void desc_set_defaults(unsigned int irq, struct irq_desc *desc, int node,
 	desc->irq_count = 0;
 	desc->irqs_unhandled = 0;
 	desc->tot_count = 0;
+#ifdef CONFIG_IRQ_BALANCE
+	desc->balance_count = 0;
+	desc->balance_cpu = 0;
+#endif
 	desc->name = NULL;
 	desc->owner = owner;
 	for_each_possible_cpu(cpu)
@@ -0,0 +1,354 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * kernel/locking/lock_contention.c
+ *
+ * Lock contention statistics out of the lock:contention_begin/end
+ * tracepoints, cheap enough to keep running in production:
+ *
+ *   echo 1 > /proc/lock_contention	# clear and start
+ *   echo 0 > /proc/lock_contention	# stop
+ *   cat /proc/lock_contention
+ *
+ * Waits are accounted to the lock type and the call site, the first
+ * caller outside of the locking and scheduler functions, in log2(ns)
+ * histograms. Nothing but the tracepoints' static keys is on the lock
+ * paths while stopped, and only the slowpaths pay while running.
+ */
+#include <linux/hash.h>
+#include <linux/interrupt.h>
+#include <linux/percpu.h>
+#include <linux/proc_fs.h>
+#include <linux/sched.h>
+#include <linux/sched/debug.h>
+#include <linux/seq_file.h>
+#include <linux/stacktrace.h>
+#include <linux/timekeeping.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <trace/events/lock.h>
+
+enum {
+	LC_SPIN,
+	LC_READ,
+	LC_WRITE,
+	LC_MUTEX,
+	LC_NR_TYPES,
+};
+
+static const char * const lc_type_names[LC_NR_TYPES] = {
+	[LC_SPIN]	= "spin",
+	[LC_READ]	= "read",
+	[LC_WRITE]	= "write",
+	[LC_MUTEX]	= "mutex",
+};
+
+#define LC_SITE_BITS	8
+#define LC_NR_SITES	(1 << LC_SITE_BITS)	/* per lock type */
+#define LC_SITE_PROBES	8
+#define LC_BUCKETS	32			/* log2 ns, up to 4s */
+#define LC_STACK_DEPTH	16
+
+struct lc_site {
+	unsigned long ip;	/* 0 while unused */
+	atomic64_t total_ns;
+	atomic64_t max_ns;
+	atomic_t hist[LC_BUCKETS];
+};
+
+/* A wait in progress */
+struct lc_wait {
+	void *lock;
+	struct lc_site *site;
+	u64 start;
+};
+
+/* spinning contention per context, task, softirq and hardirq */
+static DEFINE_PER_CPU(struct lc_wait, lc_spin_waits[3]);
+
+static DEFINE_MUTEX(lc_mutex);
+static struct lc_site (*lc_sites)[LC_NR_SITES];
+static atomic_t lc_nr_dropped[LC_NR_TYPES];
+static bool lc_running;
+/* tells waits of an earlier run apart in task_struct */
+static unsigned int lc_epoch;
+
+static int lc_type(unsigned int flags)
+{
+	if (flags & LCB_F_MUTEX)
+		return LC_MUTEX;
+	if (flags & LCB_F_READ)
+		return LC_READ;
+	if (flags & LCB_F_WRITE)
+		return LC_WRITE;
+	return LC_SPIN;
+}
+
+/*
+ * The locking and scheduler functions are either __lock_text or __sched,
+ * so the site is the first frame after them, skipping asm thunks between
+ * two of them such as call_rwsem_down_read_failed.
+ */
+static unsigned long lc_call_site(void)
+{
+	unsigned long entries[LC_STACK_DEPTH];
+	struct stack_trace trace = {
+		.entries	= entries,
+		.max_entries	= LC_STACK_DEPTH,
+	};
+	bool seen = false;
+	unsigned int i;
+
+	save_stack_trace(&trace);
+	for (i = 0; i < trace.nr_entries; i++) {
+		if (entries[i] == ULONG_MAX)
+			break;
+		if (in_sched_functions(entries[i])) {
+			seen = true;
+			continue;
+		}
+		if (!seen)
+			continue;
+		if (i + 1 < trace.nr_entries &&
+		    in_sched_functions(entries[i + 1]))
+			continue;
+		return entries[i];
+	}
+	return 0;
+}
+
+static struct lc_site *lc_find_site(int type, unsigned long ip)
+{
+	struct lc_site *sites = lc_sites[type];
+	unsigned int idx = hash_long(ip, LC_SITE_BITS);
+	unsigned int i;
+
+	if (!ip)
+		goto dropped;
+
+	for (i = 0; i < LC_SITE_PROBES; i++) {
+		struct lc_site *site = &sites[(idx + i) & (LC_NR_SITES - 1)];
+		unsigned long cur = READ_ONCE(site->ip);
+
+		if (!cur)
+			cur = cmpxchg(&site->ip, 0, ip) ?: ip;
+		if (cur == ip)
+			return site;
+	}
+
+dropped:
+	atomic_inc(&lc_nr_dropped[type]);
+	return NULL;
+}
+
+static void lc_account(struct lc_site *site, u64 ns)
+{
+	u64 max = atomic64_read(&site->max_ns);
+
+	atomic_inc(&site->hist[min_t(int, ns ? ilog2(ns) : 0, LC_BUCKETS - 1)]);
+	atomic64_add(ns, &site->total_ns);
+	while (ns > max) {
+		u64 old = atomic64_cmpxchg(&site->max_ns, max, ns);
+
+		if (old == max)
+			break;
+		max = old;
+	}
+}
+
+static struct lc_wait *lc_spin_wait(void)
+{
+	if (in_irq())
+		return this_cpu_ptr(&lc_spin_waits[2]);
+	if (in_serving_softirq())
+		return this_cpu_ptr(&lc_spin_waits[1]);
+	return this_cpu_ptr(&lc_spin_waits[0]);
+}
+
+static void lc_contention_begin(void *data, void *lock, unsigned int flags)
+{
+	struct task_struct *p = current;
+	struct lc_site *site;
+	int type = lc_type(flags);
+
+	/* an NMI could interrupt the accounting of what it contends on */
+	if (in_nmi())
+		return;
+
+	if (type == LC_SPIN) {
+		struct lc_wait *w = lc_spin_wait();
+
+		site = lc_find_site(type, lc_call_site());
+		w->lock = site ? lock : NULL;
+		w->site = site;
+		w->start = ktime_get_mono_fast_ns();
+		return;
+	}
+
+	/* a mutex begins again once it is done spinning; keep the start */
+	if (p->contention_lock == lock &&
+	    p->contention_epoch == READ_ONCE(lc_epoch))
+		return;
+
+	site = lc_find_site(type, lc_call_site());
+	if (!site)
+		return;
+	p->contention_site = site;
+	p->contention_start = ktime_get_mono_fast_ns();
+	p->contention_epoch = READ_ONCE(lc_epoch);
+	WRITE_ONCE(p->contention_lock, lock);
+}
+
+static void lc_contention_end(void *data, void *lock, int ret)
+{
+	struct task_struct *p = current;
+	struct lc_wait *w;
+
+	if (in_nmi())
+		return;
+
+	w = lc_spin_wait();
+	if (w->lock == lock) {
+		w->lock = NULL;
+		lc_account(w->site, ktime_get_mono_fast_ns() - w->start);
+		return;
+	}
+
+	if (p->contention_lock != lock)
+		return;
+	p->contention_lock = NULL;
+	if (p->contention_epoch == READ_ONCE(lc_epoch))
+		lc_account(p->contention_site,
+			   ktime_get_mono_fast_ns() - p->contention_start);
+}
+
+static int lc_start(void)
+{
+	int cpu, i, ret;
+
+	if (lc_running)
+		return 0;
+
+	if (!lc_sites) {
+		lc_sites = vzalloc(sizeof(*lc_sites) * LC_NR_TYPES);
+		if (!lc_sites)
+			return -ENOMEM;
+	} else {
+		memset(lc_sites, 0, sizeof(*lc_sites) * LC_NR_TYPES);
+	}
+	for (i = 0; i < LC_NR_TYPES; i++)
+		atomic_set(&lc_nr_dropped[i], 0);
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(&lc_spin_waits[0], cpu), 0,
+		       sizeof(lc_spin_waits));
+	WRITE_ONCE(lc_epoch, lc_epoch + 1);
+
+	ret = register_trace_contention_begin(lc_contention_begin, NULL);
+	if (ret)
+		return ret;
+	ret = register_trace_contention_end(lc_contention_end, NULL);
+	if (ret) {
+		unregister_trace_contention_begin(lc_contention_begin, NULL);
+		tracepoint_synchronize_unregister();
+		return ret;
+	}
+
+	lc_running = true;
+	return 0;
+}
+
+static void lc_stop(void)
+{
+	if (!lc_running)
+		return;
+
+	unregister_trace_contention_begin(lc_contention_begin, NULL);
+	unregister_trace_contention_end(lc_contention_end, NULL);
+	tracepoint_synchronize_unregister();
+	lc_running = false;
+}
+
+static int lc_show(struct seq_file *m, void *v)
+{
+	int type, i, j;
+
+	mutex_lock(&lc_mutex);
+	seq_printf(m, "# %s, histograms are log2(ns):nr\n",
+		   lc_running ? "running" : "stopped");
+	if (!lc_sites)
+		goto out;
+
+	for (type = 0; type < LC_NR_TYPES; type++) {
+		for (i = 0; i < LC_NR_SITES; i++) {
+			struct lc_site *site = &lc_sites[type][i];
+			u64 nr = 0;
+
+			if (!READ_ONCE(site->ip))
+				continue;
+			for (j = 0; j < LC_BUCKETS; j++)
+				nr += atomic_read(&site->hist[j]);
+			if (!nr)
+				continue;
+
+			seq_printf(m, "%-5s %pS nr %llu total_ns %llu avg_ns %llu max_ns %llu\n",
+				   lc_type_names[type], (void *)site->ip, nr,
+				   (u64)atomic64_read(&site->total_ns),
+				   div64_u64(atomic64_read(&site->total_ns), nr),
+				   (u64)atomic64_read(&site->max_ns));
+			seq_puts(m, "     ");
+			for (j = 0; j < LC_BUCKETS; j++) {
+				if (atomic_read(&site->hist[j]))
+					seq_printf(m, " %d:%d", j,
+						   atomic_read(&site->hist[j]));
+			}
+			seq_puts(m, "\n");
+		}
+		if (atomic_read(&lc_nr_dropped[type]))
+			seq_printf(m, "%-5s dropped %d, sites full or unknown\n",
+				   lc_type_names[type],
+				   atomic_read(&lc_nr_dropped[type]));
+	}
+out:
+	mutex_unlock(&lc_mutex);
+	return 0;
+}
+
+static int lc_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, lc_show, NULL);
+}
+
+static ssize_t lc_write(struct file *file, const char __user *buf,
+			size_t count, loff_t *ppos)
+{
+	bool start;
+	int ret;
+
+	ret = kstrtobool_from_user(buf, count, &start);
+	if (ret)
+		return ret;
+
+	mutex_lock(&lc_mutex);
+	if (start)
+		ret = lc_start();
+	else
+		lc_stop();
+	mutex_unlock(&lc_mutex);
+
+	return ret ? ret : count;
+}
+
+static const struct file_operations proc_lock_contention_operations = {
+	.open		= lc_open,
+	.read		= seq_read,
+	.write		= lc_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init lock_contention_init(void)
+{
+	proc_create("lock_contention", S_IRUSR | S_IWUSR, NULL,
+		    &proc_lock_contention_operations);
+	return 0;
+}
+__initcall(lock_contention_init);
@@ -30,6 +30,10 @@
  *   pv_wait_node	- # of vCPU wait's at a non-head queue node
  *   lock_pending	- # of locking operations via pending code
  *   lock_slowpath	- # of locking operations via MCS lock queue
+ *   cna_intra_node	- # of CNA lock handoffs within a NUMA node
+ *   cna_inter_node	- # of CNA lock handoffs to another NUMA node
+ *   cna_reorder	- # of waiters CNA moved to its secondary queue
+ *   cna_flush		- # of secondary queue flushes on the CNA threshold
  *
  * Writing to the "reset_counters" file will reset all the above counter
  * values.
@@ -55,6 +59,10 @@ enum qlock_stats {
 	qstat_pv_wait_node,
 	qstat_lock_pending,
 	qstat_lock_slowpath,
+	qstat_cna_intra_node,
+	qstat_cna_inter_node,
+	qstat_cna_reorder,
+	qstat_cna_flush,
 	qstat_num,	/* Total number of statistical counters */
 	qstat_reset_cnts = qstat_num,
 };
@@ -82,6 +90,10 @@ static const char * const qstat_names[qstat_num + 1] = {
 	[qstat_pv_wait_node]       = "pv_wait_node",
 	[qstat_lock_pending]       = "lock_pending",
 	[qstat_lock_slowpath]      = "lock_slowpath",
+	[qstat_cna_intra_node]     = "cna_intra_node",
+	[qstat_cna_inter_node]     = "cna_inter_node",
+	[qstat_cna_reorder]        = "cna_reorder",
+	[qstat_cna_flush]          = "cna_flush",
 	[qstat_reset_cnts]         = "reset_counters",
 };
 
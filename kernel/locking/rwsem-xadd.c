@@ -18,6 +18,7 @@
 #include <linux/sched/wake_q.h>
 #include <linux/sched/debug.h>
 #include <linux/osq_lock.h>
+#include <trace/events/lock.h>
 
 #include "rwsem.h"
 
@@ -255,6 +256,8 @@ __rwsem_down_read_failed_common(struct rw_semaphore *sem, int state)
 	waiter.task = current;
 	waiter.type = RWSEM_WAITING_FOR_READ;
 
+	trace_contention_begin(sem, LCB_F_READ);
+
 	raw_spin_lock_irq(&sem->wait_lock);
 	if (list_empty(&sem->wait_list))
 		adjustment += RWSEM_WAITING_BIAS;
@@ -293,6 +296,7 @@ __rwsem_down_read_failed_common(struct rw_semaphore *sem, int state)
 	}
 
 	__set_current_state(TASK_RUNNING);
+	trace_contention_end(sem, 0);
 	return sem;
 out_nolock:
 	list_del(&waiter.list);
@@ -300,6 +304,7 @@ __rwsem_down_read_failed_common(struct rw_semaphore *sem, int state)
 		atomic_long_add(-RWSEM_WAITING_BIAS, &sem->count);
 	raw_spin_unlock_irq(&sem->wait_lock);
 	__set_current_state(TASK_RUNNING);
+	trace_contention_end(sem, -EINTR);
 	return ERR_PTR(-EINTR);
 }
 
@@ -526,9 +531,15 @@ __rwsem_down_write_failed_common(struct rw_semaphore *sem, int state)
 	/* undo write bias from down_write operation, stop active locking */
 	count = atomic_long_sub_return(RWSEM_ACTIVE_WRITE_BIAS, &sem->count);
 
+	trace_contention_begin(sem, LCB_F_WRITE | LCB_F_SPIN);
+
 	/* do optimistic spinning and steal lock if possible */
-	if (rwsem_optimistic_spin(sem))
+	if (rwsem_optimistic_spin(sem)) {
+		trace_contention_end(sem, 0);
 		return sem;
+	}
+
+	trace_contention_begin(sem, LCB_F_WRITE);
 
 	/*
 	 * Optimistic spinning failed, proceed to the slowpath
@@ -595,6 +606,7 @@ __rwsem_down_write_failed_common(struct rw_semaphore *sem, int state)
 	__set_current_state(TASK_RUNNING);
 	list_del(&waiter.list);
 	raw_spin_unlock_irq(&sem->wait_lock);
+	trace_contention_end(sem, 0);
 
 	return ret;
 
@@ -608,6 +620,7 @@ __rwsem_down_write_failed_common(struct rw_semaphore *sem, int state)
 		__rwsem_mark_wake(sem, RWSEM_WAKE_ANY, &wake_q);
 	raw_spin_unlock_irq(&sem->wait_lock);
 	wake_up_q(&wake_q);
+	trace_contention_end(sem, -EINTR);
 
 	return ERR_PTR(-EINTR);
 }
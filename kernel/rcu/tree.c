@@ -62,6 +62,9 @@
 #include <linux/suspend.h>
 #include <linux/ftrace.h>
 #include <linux/fault_event.h>
+#include <linux/gfp.h>
+#include <linux/shrinker.h>
+#include <linux/slab.h>
 
 #include "tree.h"
 #include "rcu.h"
@@ -3102,19 +3105,387 @@ void call_rcu_bh(struct rcu_head *head, rcu_callback_t func)
 EXPORT_SYMBOL_GPL(call_rcu_bh);
 
 /*
- * Queue an RCU callback for lazy invocation after a grace period.
- * This will likely be later named something like "call_rcu_lazy()",
- * but this change will require some way of tagging the lazy RCU
- * callbacks in the list of pending callbacks. Until then, this
- * function may only be called from __kfree_rcu().
+ * kfree_rcu() batching.
+ *
+ * Objects passed to kfree_rcu() are not queued as RCU callbacks one by
+ * one: each CPU collects them in page-sized arrays, or, when no page can
+ * be had, in a list chained through their rcu_heads.  Every
+ * KFREE_DRAIN_JIFFIES the collected objects are handed to a batch that
+ * waits for one grace period through a single rcu_work, and is then
+ * freed with kfree_bulk().  A storm of kfree_rcu() calls thus costs one
+ * callback per batch instead of one per object.
+ *
+ * A CPU has KFREE_N_BATCHES batches.  While all of them are waiting for
+ * their grace period, new objects keep collecting.  Under memory pressure
+ * a shrinker drains the collected objects right away and pushes the
+ * grace period along.
+ */
+#define KFREE_DRAIN_JIFFIES	(HZ / 50)
+#define KFREE_N_BATCHES		2
+
+struct kfree_rcu_bulk_data {
+	unsigned long nr_records;
+	struct kfree_rcu_bulk_data *next;
+	struct rcu_head *records[];
+};
+
+#define KFREE_BULK_MAX_ENTR \
+	((PAGE_SIZE - sizeof(struct kfree_rcu_bulk_data)) / sizeof(void *))
+
+struct kfree_rcu_cpu;
+
+/* A batch of objects waiting for a grace period */
+struct kfree_rcu_cpu_work {
+	struct rcu_work rcu_work;
+	struct rcu_head *head_free;
+	struct kfree_rcu_bulk_data *bhead_free;
+	struct kfree_rcu_cpu *krcp;
+};
+
+/*
+ * @head and @bhead collect the objects of the next batch, @count of them.
+ * @bcached keeps one array page around for reuse.  Protected by @lock,
+ * except for @bcached.
+ */
+struct kfree_rcu_cpu {
+	struct rcu_head *head;
+	struct kfree_rcu_bulk_data *bhead;
+	struct kfree_rcu_bulk_data *bcached;
+	struct kfree_rcu_cpu_work krw_arr[KFREE_N_BATCHES];
+	spinlock_t lock;
+	struct delayed_work monitor_work;
+	bool monitor_todo;
+	bool initialized;
+	int count;
+};
+
+static DEFINE_PER_CPU(struct kfree_rcu_cpu, krc);
+
+static void kfree_rcu_free(struct rcu_head *head)
+{
+	debug_rcu_head_unqueue(head);
+	rcu_lock_acquire(&rcu_callback_map);
+	kfree((void *)head - (unsigned long)head->func);
+	rcu_lock_release(&rcu_callback_map);
+}
+
+/*
+ * Free the objects of a batch whose grace period has elapsed.  The array
+ * pages are kept in @krcp's cache if it has room, @krcp may be NULL.
+ */
+static void kfree_rcu_free_batch(struct kfree_rcu_cpu *krcp,
+				 struct rcu_head *head,
+				 struct kfree_rcu_bulk_data *bhead)
+{
+	struct kfree_rcu_bulk_data *bnext;
+	struct rcu_head *next, *rhp;
+	unsigned long i;
+	void **ptrs;
+
+	for (; bhead; bhead = bnext) {
+		bnext = bhead->next;
+
+		/* Turn the rcu_heads into the objects, in place */
+		ptrs = (void **)bhead->records;
+		for (i = 0; i < bhead->nr_records; i++) {
+			rhp = bhead->records[i];
+			debug_rcu_head_unqueue(rhp);
+			ptrs[i] = (void *)rhp - (unsigned long)rhp->func;
+		}
+		rcu_lock_acquire(&rcu_callback_map);
+		kfree_bulk(bhead->nr_records, ptrs);
+		rcu_lock_release(&rcu_callback_map);
+
+		if (!krcp || cmpxchg(&krcp->bcached, NULL, bhead))
+			free_page((unsigned long)bhead);
+		cond_resched_tasks_rcu_qs();
+	}
+
+	/* Objects that didn't get into an array, see kfree_call_rcu() */
+	for (; head; head = next) {
+		next = head->next;
+		kfree_rcu_free(head);
+		cond_resched_tasks_rcu_qs();
+	}
+}
+
+static void kfree_rcu_work(struct work_struct *work)
+{
+	struct kfree_rcu_cpu_work *krwp = container_of(to_rcu_work(work),
+					struct kfree_rcu_cpu_work, rcu_work);
+	struct kfree_rcu_cpu *krcp = krwp->krcp;
+	struct kfree_rcu_bulk_data *bhead;
+	struct rcu_head *head;
+	unsigned long flags;
+
+	spin_lock_irqsave(&krcp->lock, flags);
+	head = krwp->head_free;
+	krwp->head_free = NULL;
+	bhead = krwp->bhead_free;
+	krwp->bhead_free = NULL;
+	spin_unlock_irqrestore(&krcp->lock, flags);
+
+	kfree_rcu_free_batch(krcp, head, bhead);
+}
+
+/*
+ * Hand the collected objects to an idle batch.  Returns false if all
+ * batches are still waiting for their grace period.
+ */
+static bool queue_kfree_rcu_work(struct kfree_rcu_cpu *krcp)
+{
+	struct kfree_rcu_cpu_work *krwp;
+	int i;
+
+	for (i = 0; i < KFREE_N_BATCHES; i++) {
+		krwp = &krcp->krw_arr[i];
+		if (krwp->head_free || krwp->bhead_free)
+			continue;
+
+		krwp->head_free = krcp->head;
+		krcp->head = NULL;
+		krwp->bhead_free = krcp->bhead;
+		krcp->bhead = NULL;
+		krcp->count = 0;
+		queue_rcu_work(system_wq, &krwp->rcu_work);
+		return true;
+	}
+
+	return false;
+}
+
+static void kfree_rcu_drain_unlock(struct kfree_rcu_cpu *krcp,
+				   unsigned long flags)
+__releases(&krcp->lock)
+{
+	krcp->monitor_todo = false;
+	if (!krcp->head && !krcp->bhead) {
+		spin_unlock_irqrestore(&krcp->lock, flags);
+		return;
+	}
+	if (!queue_kfree_rcu_work(krcp)) {
+		/* Previous batches are still waiting, try again later */
+		krcp->monitor_todo = true;
+		schedule_delayed_work(&krcp->monitor_work, KFREE_DRAIN_JIFFIES);
+	}
+	spin_unlock_irqrestore(&krcp->lock, flags);
+}
+
+static void kfree_rcu_monitor(struct work_struct *work)
+{
+	struct kfree_rcu_cpu *krcp = container_of(work, struct kfree_rcu_cpu,
+						  monitor_work.work);
+	unsigned long flags;
+
+	spin_lock_irqsave(&krcp->lock, flags);
+	if (krcp->monitor_todo)
+		kfree_rcu_drain_unlock(krcp, flags);
+	else
+		spin_unlock_irqrestore(&krcp->lock, flags);
+}
+
+static bool kfree_rcu_bulk_add(struct kfree_rcu_cpu *krcp,
+			       struct rcu_head *head)
+{
+	struct kfree_rcu_bulk_data *bnode = krcp->bhead;
+
+	if (!bnode || bnode->nr_records == KFREE_BULK_MAX_ENTR) {
+		bnode = xchg(&krcp->bcached, NULL);
+		/* We may be in atomic context, and must not recurse */
+		if (!bnode)
+			bnode = (struct kfree_rcu_bulk_data *)
+				__get_free_page(GFP_NOWAIT | __GFP_NOWARN);
+		if (!bnode)
+			return false;
+
+		bnode->nr_records = 0;
+		bnode->next = krcp->bhead;
+		krcp->bhead = bnode;
+	}
+
+	bnode->records[bnode->nr_records++] = head;
+	return true;
+}
+
+/*
+ * Queue an object for kfree() after a grace period, see "kfree_rcu()
+ * batching" above.  May only be called from __kfree_rcu(): @func is the
+ * offset of @head in the object, not a function.
  */
 void kfree_call_rcu(struct rcu_head *head,
 		    rcu_callback_t func)
 {
-	__call_rcu(head, func, rcu_state_p, -1, 1);
+	struct kfree_rcu_cpu *krcp;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	krcp = this_cpu_ptr(&krc);
+	/* Until the workqueues are up, use lazy callbacks */
+	if (unlikely(!smp_load_acquire(&krcp->initialized))) {
+		local_irq_restore(flags);
+		__call_rcu(head, func, rcu_state_p, -1, 1);
+		return;
+	}
+
+	spin_lock(&krcp->lock);
+	if (debug_rcu_head_queue(head)) {
+		/* Probable double kfree_rcu(), just leak. */
+		WARN_ONCE(1, "%s(): Double-freed call. rcu_head %p\n",
+			  __func__, head);
+		goto unlock;
+	}
+
+	head->func = func;
+	if (!kfree_rcu_bulk_add(krcp, head)) {
+		head->next = krcp->head;
+		krcp->head = head;
+	}
+	krcp->count++;
+
+	if (!krcp->monitor_todo) {
+		krcp->monitor_todo = true;
+		schedule_delayed_work(&krcp->monitor_work, KFREE_DRAIN_JIFFIES);
+	}
+unlock:
+	spin_unlock_irqrestore(&krcp->lock, flags);
 }
 EXPORT_SYMBOL_GPL(kfree_call_rcu);
 
+/*
+ * The objects passed to kfree_rcu() are not RCU callbacks, so rcu_barrier()
+ * waits for them in two steps.  Before the callbacks are waited for, the
+ * collected objects are queued as batches, whose rcu_works are callbacks.
+ * Objects that find no idle batch are freed right here after a grace
+ * period.  Once the callbacks are done, kfree_rcu_barrier_end() waits for
+ * the batches to be freed.
+ */
+static void kfree_rcu_barrier_start(void)
+{
+	struct kfree_rcu_bulk_data *bhead = NULL, *btail;
+	struct rcu_head *head = NULL, *tail;
+	struct kfree_rcu_cpu *krcp;
+	unsigned long flags;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		krcp = per_cpu_ptr(&krc, cpu);
+		if (!smp_load_acquire(&krcp->initialized))
+			continue;
+
+		spin_lock_irqsave(&krcp->lock, flags);
+		if ((krcp->head || krcp->bhead) &&
+		    !queue_kfree_rcu_work(krcp)) {
+			for (tail = krcp->head; tail && tail->next;
+			     tail = tail->next)
+				;
+			if (tail) {
+				tail->next = head;
+				head = krcp->head;
+				krcp->head = NULL;
+			}
+			for (btail = krcp->bhead; btail && btail->next;
+			     btail = btail->next)
+				;
+			if (btail) {
+				btail->next = bhead;
+				bhead = krcp->bhead;
+				krcp->bhead = NULL;
+			}
+			krcp->count = 0;
+		}
+		spin_unlock_irqrestore(&krcp->lock, flags);
+	}
+
+	if (head || bhead) {
+		synchronize_rcu();
+		kfree_rcu_free_batch(NULL, head, bhead);
+	}
+}
+
+static void kfree_rcu_barrier_end(void)
+{
+	struct kfree_rcu_cpu *krcp;
+	int cpu, i;
+
+	for_each_possible_cpu(cpu) {
+		krcp = per_cpu_ptr(&krc, cpu);
+		if (!smp_load_acquire(&krcp->initialized))
+			continue;
+		for (i = 0; i < KFREE_N_BATCHES; i++)
+			flush_work(&krcp->krw_arr[i].rcu_work.work);
+	}
+}
+
+static unsigned long
+kfree_rcu_shrink_count(struct shrinker *shrink, struct shrink_control *sc)
+{
+	unsigned long count = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		count += READ_ONCE(per_cpu_ptr(&krc, cpu)->count);
+
+	return count;
+}
+
+static unsigned long
+kfree_rcu_shrink_scan(struct shrinker *shrink, struct shrink_control *sc)
+{
+	struct kfree_rcu_cpu *krcp;
+	unsigned long flags, freed = 0;
+	int cpu, count;
+
+	for_each_possible_cpu(cpu) {
+		krcp = per_cpu_ptr(&krc, cpu);
+		if (!READ_ONCE(krcp->count))
+			continue;
+
+		spin_lock_irqsave(&krcp->lock, flags);
+		count = krcp->count;
+		kfree_rcu_drain_unlock(krcp, flags);
+		freed += count;
+		if (freed >= sc->nr_to_scan)
+			break;
+	}
+
+	/* The batches are only freed after a grace period: hurry it up */
+	if (freed)
+		rcu_force_quiescent_state();
+
+	return freed ?: SHRINK_STOP;
+}
+
+static struct shrinker kfree_rcu_shrinker = {
+	.count_objects = kfree_rcu_shrink_count,
+	.scan_objects = kfree_rcu_shrink_scan,
+	.batch = 0,
+	.seeks = DEFAULT_SEEKS,
+};
+
+static int __init kfree_rcu_batch_init(void)
+{
+	struct kfree_rcu_cpu *krcp;
+	int cpu, i;
+
+	for_each_possible_cpu(cpu) {
+		krcp = per_cpu_ptr(&krc, cpu);
+		spin_lock_init(&krcp->lock);
+		for (i = 0; i < KFREE_N_BATCHES; i++) {
+			INIT_RCU_WORK(&krcp->krw_arr[i].rcu_work,
+				      kfree_rcu_work);
+			krcp->krw_arr[i].krcp = krcp;
+		}
+		INIT_DELAYED_WORK(&krcp->monitor_work, kfree_rcu_monitor);
+		smp_store_release(&krcp->initialized, true);
+	}
+
+	if (register_shrinker(&kfree_rcu_shrinker))
+		pr_err("Failed to register kfree_rcu() shrinker!\n");
+
+	return 0;
+}
+core_initcall(kfree_rcu_batch_init);
+
 /*
  * Because a context switch is a grace period for RCU-sched and RCU-bh,
  * any blocking grace-period wait automatically implies a grace period
@@ -3438,8 +3809,13 @@ static void _rcu_barrier(struct rcu_state *rsp)
 {
 	int cpu;
 	struct rcu_data *rdp;
-	unsigned long s = rcu_seq_snap(&rsp->barrier_sequence);
+	unsigned long s;
 
+	/* kfree_rcu() objects are batched rather than queued as callbacks */
+	if (rsp == rcu_state_p)
+		kfree_rcu_barrier_start();
+
+	s = rcu_seq_snap(&rsp->barrier_sequence);
 	_rcu_barrier_trace(rsp, TPS("Begin"), -1, s);
 
 	/* Take mutex to serialize concurrent rcu_barrier() requests. */
@@ -3510,6 +3886,10 @@ static void _rcu_barrier(struct rcu_state *rsp)
 	/* Wait for all rcu_barrier_callback() callbacks to be invoked. */
 	wait_for_completion(&rsp->barrier_completion);
 
+	/* The batches' rcu_works have been queued by now, wait for them */
+	if (rsp == rcu_state_p)
+		kfree_rcu_barrier_end();
+
 	/* Mark the end of the barrier operation. */
 	_rcu_barrier_trace(rsp, TPS("Inc2"), -1, rsp->barrier_sequence);
 	rcu_seq_end(&rsp->barrier_sequence);
@@ -10,6 +10,7 @@
 #include <linux/nospec.h>
 
 #include <linux/kcov.h>
+#include <linux/resctrl_cgroup.h>
 
 #include <asm/switch_to.h>
 #include <asm/tlb.h>
@@ -728,6 +729,514 @@ static void set_load_weight(struct task_struct *p, bool update_load)
 	}
 }
 
+#ifdef CONFIG_UCLAMP_TASK
+/*
+ * Serializes updates of utilization clamp values
+ *
+ * The (slow-path) user-space triggers utilization clamp value updates which
+ * can require updates on (fast-path) scheduler's data structures used to
+ * support enqueue/dequeue operations.
+ * While the per-CPU rq lock protects fast-path update operations, user-space
+ * requests are serialized using a mutex to reduce the risk of conflicting
+ * updates or API abuses.
+ */
+static DEFINE_MUTEX(uclamp_mutex);
+
+/* Max allowed minimum utilization */
+unsigned int sysctl_sched_uclamp_util_min = SCHED_CAPACITY_SCALE;
+
+/* Max allowed maximum utilization */
+unsigned int sysctl_sched_uclamp_util_max = SCHED_CAPACITY_SCALE;
+
+/* All clamps are required to be less or equal than these values */
+static struct uclamp_se uclamp_default[UCLAMP_CNT];
+
+/* Integer rounded range for each bucket */
+#define UCLAMP_BUCKET_DELTA DIV_ROUND_CLOSEST(SCHED_CAPACITY_SCALE, UCLAMP_BUCKETS)
+
+#define for_each_clamp_id(clamp_id) \
+	for ((clamp_id) = 0; (clamp_id) < UCLAMP_CNT; (clamp_id)++)
+
+static inline unsigned int uclamp_bucket_id(unsigned int clamp_value)
+{
+	return min_t(unsigned int, clamp_value / UCLAMP_BUCKET_DELTA, UCLAMP_BUCKETS - 1);
+}
+
+static inline unsigned int uclamp_none(enum uclamp_id clamp_id)
+{
+	if (clamp_id == UCLAMP_MIN)
+		return 0;
+	return SCHED_CAPACITY_SCALE;
+}
+
+static inline void uclamp_se_set(struct uclamp_se *uc_se,
+				 unsigned int value, bool user_defined)
+{
+	uc_se->value = value;
+	uc_se->bucket_id = uclamp_bucket_id(value);
+	uc_se->user_defined = user_defined;
+}
+
+static inline unsigned int
+uclamp_idle_value(struct rq *rq, enum uclamp_id clamp_id,
+		  unsigned int clamp_value)
+{
+	/*
+	 * Avoid blocked utilization pushing up the frequency when we go
+	 * idle (which drops the max-clamp) by retaining the last known
+	 * max-clamp.
+	 */
+	if (clamp_id == UCLAMP_MAX) {
+		rq->uclamp_flags |= UCLAMP_FLAG_IDLE;
+		return clamp_value;
+	}
+
+	return uclamp_none(UCLAMP_MIN);
+}
+
+static inline void uclamp_idle_reset(struct rq *rq, enum uclamp_id clamp_id,
+				     unsigned int clamp_value)
+{
+	/* Reset max-clamp retention only on idle exit */
+	if (!(rq->uclamp_flags & UCLAMP_FLAG_IDLE))
+		return;
+
+	WRITE_ONCE(rq->uclamp[clamp_id].value, clamp_value);
+}
+
+static inline
+unsigned int uclamp_rq_max_value(struct rq *rq, enum uclamp_id clamp_id,
+				 unsigned int clamp_value)
+{
+	struct uclamp_bucket *bucket = rq->uclamp[clamp_id].bucket;
+	int bucket_id = UCLAMP_BUCKETS - 1;
+
+	/*
+	 * Since both min and max clamps are max aggregated, find the
+	 * top most bucket with tasks in.
+	 */
+	for ( ; bucket_id >= 0; bucket_id--) {
+		if (!bucket[bucket_id].tasks)
+			continue;
+		return bucket[bucket_id].value;
+	}
+
+	/* No tasks -- default clamp values */
+	return uclamp_idle_value(rq, clamp_id, clamp_value);
+}
+
+static inline struct uclamp_se
+uclamp_tg_restrict(struct task_struct *p, enum uclamp_id clamp_id)
+{
+	struct uclamp_se uc_req = p->uclamp_req[clamp_id];
+#ifdef CONFIG_UCLAMP_TASK_GROUP
+	struct uclamp_se uc_max;
+
+	/*
+	 * Tasks in autogroups or root task group will be
+	 * restricted by system defaults.
+	 */
+	if (task_group_is_autogroup(task_group(p)))
+		return uc_req;
+	if (task_group(p) == &root_task_group)
+		return uc_req;
+
+	uc_max = task_group(p)->uclamp[clamp_id];
+	if (uc_req.value > uc_max.value || !uc_req.user_defined)
+		return uc_max;
+#endif
+
+	return uc_req;
+}
+
+/*
+ * The effective clamp bucket index of a task depends on, by increasing
+ * priority:
+ * - the task specific clamp value, when explicitly requested from userspace
+ * - the task group effective clamp value, for tasks not either in the root
+ *   group or in an autogroup
+ * - the system default clamp value, defined by the sysadmin
+ */
+static inline struct uclamp_se
+uclamp_eff_get(struct task_struct *p, enum uclamp_id clamp_id)
+{
+	struct uclamp_se uc_req = uclamp_tg_restrict(p, clamp_id);
+	struct uclamp_se uc_max = uclamp_default[clamp_id];
+
+	/* System default restrictions always apply */
+	if (unlikely(uc_req.value > uc_max.value))
+		return uc_max;
+
+	return uc_req;
+}
+
+unsigned int uclamp_eff_value(struct task_struct *p, enum uclamp_id clamp_id)
+{
+	struct uclamp_se uc_eff;
+
+	/* Task currently refcounted: use back-annotated (effective) value */
+	if (p->uclamp[clamp_id].active)
+		return p->uclamp[clamp_id].value;
+
+	uc_eff = uclamp_eff_get(p, clamp_id);
+
+	return uc_eff.value;
+}
+
+/*
+ * When a task is enqueued on a rq, the clamp bucket currently defined by the
+ * task's uclamp::bucket_id is refcounted on that rq. This also immediately
+ * updates the rq's clamp value if required.
+ *
+ * Tasks can have a task-specific value requested from user-space, track
+ * within each bucket the maximum value for tasks refcounted in it.
+ * This "local max aggregation" allows to track the exact "requested" value
+ * for each bucket when all its RUNNABLE tasks require the same clamp.
+ */
+static inline void uclamp_rq_inc_id(struct rq *rq, struct task_struct *p,
+				    enum uclamp_id clamp_id)
+{
+	struct uclamp_rq *uc_rq = &rq->uclamp[clamp_id];
+	struct uclamp_se *uc_se = &p->uclamp[clamp_id];
+	struct uclamp_bucket *bucket;
+
+	lockdep_assert_held(&rq->lock);
+
+	/* Update task effective clamp */
+	p->uclamp[clamp_id] = uclamp_eff_get(p, clamp_id);
+
+	bucket = &uc_rq->bucket[uc_se->bucket_id];
+	bucket->tasks++;
+	uc_se->active = true;
+
+	uclamp_idle_reset(rq, clamp_id, uc_se->value);
+
+	/*
+	 * Local max aggregation: rq buckets always track the max
+	 * "requested" clamp value of its RUNNABLE tasks.
+	 */
+	if (bucket->tasks == 1 || uc_se->value > bucket->value)
+		bucket->value = uc_se->value;
+
+	if (uc_se->value > READ_ONCE(uc_rq->value))
+		WRITE_ONCE(uc_rq->value, uc_se->value);
+}
+
+/*
+ * When a task is dequeued from a rq, the clamp bucket refcounted by the task
+ * is released. If this is the last task reference counting the rq's max
+ * active clamp value, then the rq's clamp value is updated.
+ *
+ * Both refcounted tasks and rq's cached clamp values are expected to be
+ * always valid. If it's detected they are not, as defensive programming,
+ * enforce the expected state and warn.
+ */
+static inline void uclamp_rq_dec_id(struct rq *rq, struct task_struct *p,
+				    enum uclamp_id clamp_id)
+{
+	struct uclamp_rq *uc_rq = &rq->uclamp[clamp_id];
+	struct uclamp_se *uc_se = &p->uclamp[clamp_id];
+	struct uclamp_bucket *bucket;
+	unsigned int bkt_clamp;
+	unsigned int rq_clamp;
+
+	lockdep_assert_held(&rq->lock);
+
+	bucket = &uc_rq->bucket[uc_se->bucket_id];
+	SCHED_WARN_ON(!bucket->tasks);
+	if (likely(bucket->tasks))
+		bucket->tasks--;
+	uc_se->active = false;
+
+	/*
+	 * Keep "local max aggregation" simple and accept to (possibly)
+	 * overboost some RUNNABLE tasks in the same bucket.
+	 * The rq clamp bucket value is reset to its base value whenever
+	 * there are no more RUNNABLE tasks refcounting it.
+	 */
+	if (likely(bucket->tasks))
+		return;
+
+	rq_clamp = READ_ONCE(uc_rq->value);
+	/*
+	 * Defensive programming: this should never happen. If it happens,
+	 * e.g. due to future modification, warn and fixup the expected value.
+	 */
+	SCHED_WARN_ON(bucket->value > rq_clamp);
+	if (bucket->value >= rq_clamp) {
+		bkt_clamp = uclamp_rq_max_value(rq, clamp_id, uc_se->value);
+		WRITE_ONCE(uc_rq->value, bkt_clamp);
+	}
+}
+
+static inline void uclamp_rq_inc(struct rq *rq, struct task_struct *p)
+{
+	enum uclamp_id clamp_id;
+
+	if (unlikely(!p->sched_class->uclamp_enabled))
+		return;
+
+	for_each_clamp_id(clamp_id)
+		uclamp_rq_inc_id(rq, p, clamp_id);
+
+	/* Reset clamp idle holding when there is one RUNNABLE task */
+	if (rq->uclamp_flags & UCLAMP_FLAG_IDLE)
+		rq->uclamp_flags &= ~UCLAMP_FLAG_IDLE;
+}
+
+static inline void uclamp_rq_dec(struct rq *rq, struct task_struct *p)
+{
+	enum uclamp_id clamp_id;
+
+	if (unlikely(!p->sched_class->uclamp_enabled))
+		return;
+
+	for_each_clamp_id(clamp_id)
+		uclamp_rq_dec_id(rq, p, clamp_id);
+}
+
+static inline void
+uclamp_update_active(struct task_struct *p, enum uclamp_id clamp_id)
+{
+	struct rq_flags rf;
+	struct rq *rq;
+
+	/*
+	 * Lock the task and the rq where the task is (or was) queued.
+	 *
+	 * We might lock the (previous) rq of a !RUNNABLE task, but that's the
+	 * price to pay to safely serialize util_{min,max} updates with
+	 * enqueues, dequeues and migration operations.
+	 * This is the same locking schema used by __set_cpus_allowed_ptr().
+	 */
+	rq = task_rq_lock(p, &rf);
+
+	/*
+	 * Setting the clamp bucket is serialized by task_rq_lock().
+	 * If the task is not yet RUNNABLE and its task_struct is not
+	 * affecting a valid clamp bucket, the next time it's enqueued,
+	 * it will already see the updated clamp bucket value.
+	 */
+	if (p->uclamp[clamp_id].active) {
+		uclamp_rq_dec_id(rq, p, clamp_id);
+		uclamp_rq_inc_id(rq, p, clamp_id);
+	}
+
+	task_rq_unlock(rq, p, &rf);
+}
+
+#ifdef CONFIG_UCLAMP_TASK_GROUP
+static inline void
+uclamp_update_active_tasks(struct cgroup_subsys_state *css,
+			   unsigned int clamps)
+{
+	enum uclamp_id clamp_id;
+	struct css_task_iter it;
+	struct task_struct *p;
+
+	css_task_iter_start(css, 0, &it);
+	while ((p = css_task_iter_next(&it))) {
+		for_each_clamp_id(clamp_id) {
+			if ((0x1 << clamp_id) & clamps)
+				uclamp_update_active(p, clamp_id);
+		}
+	}
+	css_task_iter_end(&it);
+}
+
+static void cpu_util_update_eff(struct cgroup_subsys_state *css);
+static void uclamp_update_root_tg(void)
+{
+	struct task_group *tg = &root_task_group;
+
+	uclamp_se_set(&tg->uclamp_req[UCLAMP_MIN],
+		      sysctl_sched_uclamp_util_min, false);
+	uclamp_se_set(&tg->uclamp_req[UCLAMP_MAX],
+		      sysctl_sched_uclamp_util_max, false);
+
+	rcu_read_lock();
+	cpu_util_update_eff(&root_task_group.css);
+	rcu_read_unlock();
+}
+#else
+static void uclamp_update_root_tg(void) { }
+#endif
+
+int sysctl_sched_uclamp_handler(struct ctl_table *table, int write,
+				void __user *buffer, size_t *lenp,
+				loff_t *ppos)
+{
+	bool update_root_tg = false;
+	int old_min, old_max;
+	int result;
+
+	mutex_lock(&uclamp_mutex);
+	old_min = sysctl_sched_uclamp_util_min;
+	old_max = sysctl_sched_uclamp_util_max;
+
+	result = proc_dointvec(table, write, buffer, lenp, ppos);
+	if (result)
+		goto undo;
+	if (!write)
+		goto done;
+
+	if (sysctl_sched_uclamp_util_min > sysctl_sched_uclamp_util_max ||
+	    sysctl_sched_uclamp_util_max > SCHED_CAPACITY_SCALE) {
+		result = -EINVAL;
+		goto undo;
+	}
+
+	if (old_min != sysctl_sched_uclamp_util_min) {
+		uclamp_se_set(&uclamp_default[UCLAMP_MIN],
+			      sysctl_sched_uclamp_util_min, false);
+		update_root_tg = true;
+	}
+	if (old_max != sysctl_sched_uclamp_util_max) {
+		uclamp_se_set(&uclamp_default[UCLAMP_MAX],
+			      sysctl_sched_uclamp_util_max, false);
+		update_root_tg = true;
+	}
+
+	if (update_root_tg)
+		uclamp_update_root_tg();
+
+	/*
+	 * We update all RUNNABLE tasks only when task groups are in use.
+	 * Otherwise, keep it simple and do just a lazy update at each next
+	 * task enqueue time.
+	 */
+
+	goto done;
+
+undo:
+	sysctl_sched_uclamp_util_min = old_min;
+	sysctl_sched_uclamp_util_max = old_max;
+done:
+	mutex_unlock(&uclamp_mutex);
+
+	return result;
+}
+
+static int uclamp_validate(struct task_struct *p,
+			   const struct sched_attr *attr)
+{
+	unsigned int lower_bound = p->uclamp_req[UCLAMP_MIN].value;
+	unsigned int upper_bound = p->uclamp_req[UCLAMP_MAX].value;
+
+	if (attr->sched_flags & SCHED_FLAG_UTIL_CLAMP_MIN)
+		lower_bound = attr->sched_util_min;
+	if (attr->sched_flags & SCHED_FLAG_UTIL_CLAMP_MAX)
+		upper_bound = attr->sched_util_max;
+
+	if (lower_bound > upper_bound)
+		return -EINVAL;
+	if (upper_bound > SCHED_CAPACITY_SCALE)
+		return -EINVAL;
+
+	return 0;
+}
+
+static void __setscheduler_uclamp(struct task_struct *p,
+				  const struct sched_attr *attr)
+{
+	enum uclamp_id clamp_id;
+
+	/*
+	 * On scheduling class change, reset to default clamps for tasks
+	 * without a task-specific value.
+	 */
+	for_each_clamp_id(clamp_id) {
+		struct uclamp_se *uc_se = &p->uclamp_req[clamp_id];
+		unsigned int clamp_value = uclamp_none(clamp_id);
+
+		/* Keep using defined clamps across class changes */
+		if (uc_se->user_defined)
+			continue;
+
+		/* By default, RT tasks always get 100% boost */
+		if (unlikely(rt_task(p) && clamp_id == UCLAMP_MIN))
+			clamp_value = uclamp_none(UCLAMP_MAX);
+
+		uclamp_se_set(uc_se, clamp_value, false);
+	}
+
+	if (likely(!(attr->sched_flags & SCHED_FLAG_UTIL_CLAMP)))
+		return;
+
+	if (attr->sched_flags & SCHED_FLAG_UTIL_CLAMP_MIN) {
+		uclamp_se_set(&p->uclamp_req[UCLAMP_MIN],
+			      attr->sched_util_min, true);
+	}
+
+	if (attr->sched_flags & SCHED_FLAG_UTIL_CLAMP_MAX) {
+		uclamp_se_set(&p->uclamp_req[UCLAMP_MAX],
+			      attr->sched_util_max, true);
+	}
+}
+
+static void uclamp_fork(struct task_struct *p)
+{
+	enum uclamp_id clamp_id;
+
+	for_each_clamp_id(clamp_id)
+		p->uclamp[clamp_id].active = false;
+
+	if (likely(!p->sched_reset_on_fork))
+		return;
+
+	for_each_clamp_id(clamp_id) {
+		unsigned int clamp_value = uclamp_none(clamp_id);
+
+		/* By default, RT tasks always get 100% boost */
+		if (unlikely(rt_task(p) && clamp_id == UCLAMP_MIN))
+			clamp_value = uclamp_none(UCLAMP_MAX);
+
+		uclamp_se_set(&p->uclamp_req[clamp_id], clamp_value, false);
+	}
+}
+
+static void __init init_uclamp(void)
+{
+	struct uclamp_se uc_max = {};
+	enum uclamp_id clamp_id;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		memset(&cpu_rq(cpu)->uclamp, 0,
+		       sizeof(struct uclamp_rq) * UCLAMP_CNT);
+		cpu_rq(cpu)->uclamp_flags = 0;
+	}
+
+	for_each_clamp_id(clamp_id) {
+		uclamp_se_set(&init_task.uclamp_req[clamp_id],
+			      uclamp_none(clamp_id), false);
+	}
+
+	/* System defaults allow max clamp values for both indexes */
+	uclamp_se_set(&uc_max, uclamp_none(UCLAMP_MAX), false);
+	for_each_clamp_id(clamp_id) {
+		uclamp_default[clamp_id] = uc_max;
+#ifdef CONFIG_UCLAMP_TASK_GROUP
+		root_task_group.uclamp_req[clamp_id] = uc_max;
+		root_task_group.uclamp[clamp_id] = uc_max;
+#endif
+	}
+}
+
+#else /* CONFIG_UCLAMP_TASK */
+static inline void uclamp_rq_inc(struct rq *rq, struct task_struct *p) { }
+static inline void uclamp_rq_dec(struct rq *rq, struct task_struct *p) { }
+static inline int uclamp_validate(struct task_struct *p,
+				  const struct sched_attr *attr)
+{
+	return -EOPNOTSUPP;
+}
+static void __setscheduler_uclamp(struct task_struct *p,
+				  const struct sched_attr *attr) { }
+static inline void uclamp_fork(struct task_struct *p) { }
+static inline void init_uclamp(void) { }
+#endif /* CONFIG_UCLAMP_TASK */
+
 static inline void enqueue_task(struct rq *rq, struct task_struct *p, int flags)
 {
 	if (!(flags & ENQUEUE_NOCLOCK))
@@ -738,6 +1247,7 @@ static inline void enqueue_task(struct rq *rq, struct task_struct *p, int flags)
 		psi_enqueue(p, flags & ENQUEUE_WAKEUP);
 	}
 
+	uclamp_rq_inc(rq, p);
 	p->sched_class->enqueue_task(rq, p, flags);
 }
 
@@ -751,6 +1261,7 @@ static inline void dequeue_task(struct rq *rq, struct task_struct *p, int flags)
 		psi_dequeue(p, flags & DEQUEUE_SLEEP);
 	}
 
+	uclamp_rq_dec(rq, p);
 	p->sched_class->dequeue_task(rq, p, flags);
 }
 
@@ -1772,6 +2283,7 @@ void sched_ttwu_pending(void)
 void scheduler_ipi(void)
 {
 	handle_smt_expeller();
+	sched_core_handle_ipi();
 	/*
 	 * Fold TIF_NEED_RESCHED into the preempt_count; anybody setting
 	 * TIF_NEED_RESCHED remotely (for the first time) will also send
@@ -2297,6 +2809,8 @@ int sched_fork(unsigned long clone_flags, struct task_struct *p)
 	 */
 	p->prio = current->normal_prio;
 
+	uclamp_fork(p);
+
 	/*
 	 * Revert to default priority/policy on fork if requested.
 	 */
@@ -3458,6 +3972,8 @@ static void __sched notrace __schedule(bool preempt)
 	}
 
 	next = pick_next_task(rq, prev, &rf);
+	if (sched_core_enabled())
+		next = sched_core_pick(rq, next, &rf);
 
 	notify_smt_expeller(rq, next);
 
@@ -4127,6 +4643,13 @@ static void __setscheduler_params(struct task_struct *p,
 static void __setscheduler(struct rq *rq, struct task_struct *p,
 			   const struct sched_attr *attr, bool keep_boost)
 {
+	/*
+	 * If params can't change scheduling class changes aren't allowed
+	 * either.
+	 */
+	if (attr->sched_flags & SCHED_FLAG_KEEP_PARAMS)
+		return;
+
 	__setscheduler_params(p, attr);
 
 	/*
@@ -4264,6 +4787,13 @@ static int __sched_setscheduler(struct task_struct *p,
 			return retval;
 	}
 
+	/* Update task specific "requested" clamps */
+	if (attr->sched_flags & SCHED_FLAG_UTIL_CLAMP) {
+		retval = uclamp_validate(p, attr);
+		if (retval)
+			return retval;
+	}
+
 	/*
 	 * Make sure no PI-waiters arrive (or leave) while we are
 	 * changing the priority of the task:
@@ -4293,6 +4823,8 @@ static int __sched_setscheduler(struct task_struct *p,
 			goto change;
 		if (dl_policy(policy) && dl_param_changed(p, attr))
 			goto change;
+		if (attr->sched_flags & SCHED_FLAG_UTIL_CLAMP)
+			goto change;
 
 		p->sched_reset_on_fork = reset_on_fork;
 		task_rq_unlock(rq, p, &rf);
@@ -4374,6 +4906,7 @@ static int __sched_setscheduler(struct task_struct *p,
 
 	prev_class = p->sched_class;
 	__setscheduler(rq, p, attr, pi);
+	__setscheduler_uclamp(p, attr);
 
 	if (queued) {
 		/*
@@ -4612,6 +5145,8 @@ SYSCALL_DEFINE3(sched_setattr, pid_t, pid, struct sched_attr __user *, uattr,
 
 	if ((int)attr.sched_policy < 0)
 		return -EINVAL;
+	if (attr.sched_flags & SCHED_FLAG_KEEP_POLICY)
+		attr.sched_policy = SETPARAM_POLICY;
 
 	rcu_read_lock();
 	retval = -ESRCH;
@@ -4704,24 +5239,13 @@ static int sched_read_attr(struct sched_attr __user *uattr,
 		return -EFAULT;
 
 	/*
-	 * If we're handed a smaller struct than we know of,
-	 * ensure all the unknown bits are 0 - i.e. old
-	 * user-space does not get uncomplete information.
+	 * If we're handed a smaller struct than we know of, only copy as
+	 * much as user-space has room for: sched_util_{min,max} are never
+	 * zero and would otherwise break every caller built against
+	 * SCHED_ATTR_SIZE_VER0.  A bigger struct is left partly untouched,
+	 * attr->size tells user-space what the kernel knows about.
 	 */
-	if (usize < sizeof(*attr)) {
-		unsigned char *addr;
-		unsigned char *end;
-
-		addr = (void *)attr + usize;
-		end  = (void *)attr + sizeof(*attr);
-
-		for (; addr < end; addr++) {
-			if (*addr)
-				return -EFBIG;
-		}
-
-		attr->size = usize;
-	}
+	attr->size = min_t(unsigned int, usize, sizeof(*attr));
 
 	ret = copy_to_user(uattr, attr, attr->size);
 	if (ret)
@@ -4770,6 +5294,11 @@ SYSCALL_DEFINE4(sched_getattr, pid_t, pid, struct sched_attr __user *, uattr,
 	else
 		attr.sched_nice = task_nice(p);
 
+#ifdef CONFIG_UCLAMP_TASK
+	attr.sched_util_min = p->uclamp_req[UCLAMP_MIN].value;
+	attr.sched_util_max = p->uclamp_req[UCLAMP_MAX].value;
+#endif
+
 	rcu_read_unlock();
 
 	retval = sched_read_attr(uattr, &attr, size);
@@ -5044,6 +5573,46 @@ int __cond_resched_lock(spinlock_t *lock)
 }
 EXPORT_SYMBOL(__cond_resched_lock);
 
+int __cond_resched_rwlock_read(rwlock_t *lock)
+{
+	int resched = should_resched(PREEMPT_LOCK_OFFSET);
+	int ret = 0;
+
+	lockdep_assert_held_read(lock);
+
+	if (rwlock_needbreak(lock) || resched) {
+		read_unlock(lock);
+		if (resched)
+			preempt_schedule_common();
+		else
+			cpu_relax();
+		ret = 1;
+		read_lock(lock);
+	}
+	return ret;
+}
+EXPORT_SYMBOL(__cond_resched_rwlock_read);
+
+int __cond_resched_rwlock_write(rwlock_t *lock)
+{
+	int resched = should_resched(PREEMPT_LOCK_OFFSET);
+	int ret = 0;
+
+	lockdep_assert_held_exclusive(lock);
+
+	if (rwlock_needbreak(lock) || resched) {
+		write_unlock(lock);
+		if (resched)
+			preempt_schedule_common();
+		else
+			cpu_relax();
+		ret = 1;
+		write_lock(lock);
+	}
+	return ret;
+}
+EXPORT_SYMBOL(__cond_resched_rwlock_write);
+
 /**
  * yield - yield the current processor to other threads.
  *
@@ -6098,6 +6667,7 @@ void __init sched_init(void)
 #endif
 #endif /* CONFIG_SMP */
 		hrtick_rq_init(rq);
+		init_id_expel_rq(rq);
 		atomic_set(&rq->nr_iowait, 0);
 	}
 
@@ -6128,6 +6698,8 @@ void __init sched_init(void)
 
 	psi_init();
 
+	init_uclamp();
+
 	scheduler_running = 1;
 }
 
@@ -6301,14 +6873,32 @@ static void sched_free_group(struct task_group *tg)
 {
 	free_fair_sched_group(tg);
 	free_rt_sched_group(tg);
+	free_tg_sched_lat(tg);
 	autogroup_free(tg);
+#ifdef CONFIG_CGROUP_RESCTRL
+	kfree(tg->resctrl_name);
+#endif
 	kmem_cache_free(task_group_cache, tg);
 }
 
 /* allocate runqueue etc for a new task group */
-struct task_group *sched_create_group(struct task_group *parent)
+static inline void alloc_uclamp_sched_group(struct task_group *tg,
+					    struct task_group *parent)
 {
-	struct task_group *tg;
+#ifdef CONFIG_UCLAMP_TASK_GROUP
+	enum uclamp_id clamp_id;
+
+	for_each_clamp_id(clamp_id) {
+		uclamp_se_set(&tg->uclamp_req[clamp_id],
+			      uclamp_none(clamp_id), false);
+		tg->uclamp[clamp_id] = parent->uclamp[clamp_id];
+	}
+#endif
+}
+
+struct task_group *sched_create_group(struct task_group *parent)
+{
+	struct task_group *tg;
 
 	tg = kmem_cache_alloc(task_group_cache, GFP_KERNEL | __GFP_ZERO);
 	if (!tg)
@@ -6320,6 +6910,11 @@ struct task_group *sched_create_group(struct task_group *parent)
 	if (!alloc_rt_sched_group(tg, parent))
 		goto err;
 
+	if (!alloc_tg_sched_lat(tg))
+		goto err;
+
+	alloc_uclamp_sched_group(tg, parent);
+
 	return tg;
 
 err:
@@ -6343,6 +6938,7 @@ void sched_online_group(struct task_group *tg, struct task_group *parent)
 	spin_unlock_irqrestore(&task_group_lock, flags);
 
 	online_fair_sched_group(tg);
+	sched_core_online_group(tg);
 }
 
 /* rcu callback to free various structures associated with a task group */
@@ -6371,6 +6967,179 @@ void sched_offline_group(struct task_group *tg)
 	spin_unlock_irqrestore(&task_group_lock, flags);
 }
 
+#ifdef CONFIG_CGROUP_RESCTRL
+/*
+ * Serializes cpu.resctrl_group writes against the resctrl filesystem
+ * removing groups.  The filesystem calls in with its own mutex held, so
+ * writers look their group up first and retry if a removal came in between.
+ */
+static DEFINE_MUTEX(resctrl_cgroup_mutex);
+static unsigned long resctrl_cgroup_gen;
+
+/* The nearest group up the hierarchy bound to a resctrl group */
+static struct task_group *tg_resctrl_bound(struct task_group *tg)
+{
+	for (; tg; tg = tg->parent) {
+		/* pairs with cpu_resctrl_group_write() publishing the ids */
+		if (smp_load_acquire(&tg->resctrl_name))
+			return tg;
+	}
+	return NULL;
+}
+
+/*
+ * @tsk is moving from @from to @to, at fork or attach, under its rq lock.
+ * Tasks leaving a bound group for an unbound one only go back to the
+ * default resctrl group if they still carry the binding's ids: anything
+ * written to the resctrl tasks file in the meantime is left alone.
+ */
+static void sched_resctrl_change_group(struct task_struct *tsk,
+				       struct task_group *from,
+				       struct task_group *to)
+{
+	struct task_group *old = tg_resctrl_bound(from);
+	struct task_group *new = tg_resctrl_bound(to);
+
+	if (new) {
+		WRITE_ONCE(tsk->closid, READ_ONCE(new->resctrl_closid));
+		WRITE_ONCE(tsk->rmid, READ_ONCE(new->resctrl_rmid));
+	} else if (old && tsk->closid == READ_ONCE(old->resctrl_closid) &&
+		   tsk->rmid == READ_ONCE(old->resctrl_rmid)) {
+		WRITE_ONCE(tsk->closid, 0);
+		WRITE_ONCE(tsk->rmid, 0);
+	}
+}
+
+/*
+ * Hand the tasks of @tg and its descendants the ids of their bindings.
+ * With @bind, @tg's binding just changed from @closid/@rmid: every task
+ * under a binding takes its ids, the others go back to the default group
+ * if they still carry the old ones.  Otherwise the resctrl group with
+ * @closid (and @rmid, unless @ctrl) is going away and only its tasks are
+ * touched; those not under a binding any more are left to the filesystem.
+ *
+ * The new ids are picked up at the next context switch.
+ */
+static void tg_resctrl_update_tasks(struct task_group *tg, u32 closid,
+				    u32 rmid, bool ctrl, bool bind)
+{
+	struct cgroup_subsys_state *pos;
+	struct task_group *bound;
+	struct css_task_iter it;
+	struct task_struct *p;
+	bool match;
+
+	lockdep_assert_held(&resctrl_cgroup_mutex);
+
+	/* Wait for sched_resctrl_change_group() callers still on old ids */
+	synchronize_sched();
+
+	rcu_read_lock();
+	css_for_each_descendant_pre(pos, &tg->css) {
+		bound = tg_resctrl_bound(css_tg(pos));
+		css_task_iter_start(pos, 0, &it);
+		while ((p = css_task_iter_next(&it))) {
+			match = p->closid == closid && (ctrl || p->rmid == rmid);
+			if (bound && (bind || match)) {
+				WRITE_ONCE(p->closid, bound->resctrl_closid);
+				WRITE_ONCE(p->rmid, bound->resctrl_rmid);
+			} else if (!bound && bind && match) {
+				WRITE_ONCE(p->closid, 0);
+				WRITE_ONCE(p->rmid, 0);
+			}
+		}
+		css_task_iter_end(&it);
+	}
+	rcu_read_unlock();
+}
+
+void resctrl_cgroup_unbind(u32 closid, u32 rmid, bool ctrl)
+{
+	struct task_group *tg;
+	bool found = false;
+	char *name;
+
+	mutex_lock(&resctrl_cgroup_mutex);
+	resctrl_cgroup_gen++;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(tg, &task_groups, list) {
+		name = tg->resctrl_name;
+		if (!name || tg->resctrl_closid != closid ||
+		    (!ctrl && tg->resctrl_rmid != rmid))
+			continue;
+		WRITE_ONCE(tg->resctrl_name, NULL);
+		kfree(name);
+		found = true;
+	}
+	rcu_read_unlock();
+
+	if (found)
+		tg_resctrl_update_tasks(&root_task_group, closid, rmid, ctrl,
+					false);
+	mutex_unlock(&resctrl_cgroup_mutex);
+}
+#else
+static inline void sched_resctrl_change_group(struct task_struct *tsk,
+					      struct task_group *from,
+					      struct task_group *to)
+{
+}
+#endif /* CONFIG_CGROUP_RESCTRL */
+
+/*
+ * cpu.timer_slack_ns hands the tasks of a group and its descendants a
+ * timer slack, as both their current and their default one, like a
+ * PR_SET_TIMERSLACK the tasks may still override.
+ */
+static DEFINE_MUTEX(timer_slack_cgroup_mutex);
+
+/* The nearest group up the hierarchy with a timer slack set */
+static struct task_group *tg_timer_slack_bound(struct task_group *tg)
+{
+	for (; tg; tg = tg->parent) {
+		if (READ_ONCE(tg->timer_slack_ns))
+			return tg;
+	}
+	return NULL;
+}
+
+/*
+ * Give @p the slack of @bound, or with no @bound, the boot default if it
+ * still carries the @old slack of the group it was under.
+ */
+static void sched_timer_slack_set(struct task_struct *p,
+				  struct task_group *bound, u64 old)
+{
+	u64 slack;
+
+	if (bound)
+		slack = READ_ONCE(bound->timer_slack_ns);
+	else if (old && p->timer_slack_ns == old)
+		slack = init_task.timer_slack_ns;
+	else
+		return;
+
+	WRITE_ONCE(p->timer_slack_ns, slack);
+	p->default_timer_slack_ns = slack;
+}
+
+/* @tsk is moving from @from to @to, at fork or attach, under its rq lock */
+static void sched_timer_slack_change_group(struct task_struct *tsk,
+					   struct task_group *from,
+					   struct task_group *to)
+{
+	struct task_group *old;
+
+	/* forks inherit their parent's slack, overrides included */
+	if (from == to)
+		return;
+
+	old = tg_timer_slack_bound(from);
+	sched_timer_slack_set(tsk, tg_timer_slack_bound(to),
+			      old ? READ_ONCE(old->timer_slack_ns) : 0);
+}
+
 static void sched_change_group(struct task_struct *tsk, int type)
 {
 	struct task_group *tg;
@@ -6383,6 +7152,8 @@ static void sched_change_group(struct task_struct *tsk, int type)
 	tg = container_of(task_css_check(tsk, cpu_cgrp_id, true),
 			  struct task_group, css);
 	tg = autogroup_task_group(tsk, tg);
+	sched_resctrl_change_group(tsk, tsk->sched_task_group, tg);
+	sched_timer_slack_change_group(tsk, tsk->sched_task_group, tg);
 	tsk->sched_task_group = tg;
 
 #ifdef CONFIG_FAIR_GROUP_SCHED
@@ -6469,6 +7240,16 @@ static int cpu_cgroup_css_online(struct cgroup_subsys_state *css)
 
 	if (parent)
 		sched_online_group(tg, parent);
+
+#ifdef CONFIG_UCLAMP_TASK_GROUP
+	/* Propagate the effective uclamp value for the new group */
+	mutex_lock(&uclamp_mutex);
+	rcu_read_lock();
+	cpu_util_update_eff(css);
+	rcu_read_unlock();
+	mutex_unlock(&uclamp_mutex);
+#endif
+
 	return 0;
 }
 
@@ -6476,6 +7257,7 @@ static void cpu_cgroup_css_released(struct cgroup_subsys_state *css)
 {
 	struct task_group *tg = css_tg(css);
 
+	sched_core_offline_group(tg);
 	sched_offline_group(tg);
 }
 
@@ -6565,6 +7347,386 @@ static u64 cpu_ht_stable_read_u64(struct cgroup_subsys_state *css,
 }
 #endif
 
+#ifdef CONFIG_NUMA_BALANCING
+static int cpu_llc_affine_write_u64(struct cgroup_subsys_state *css,
+				    struct cftype *cftype, u64 llc_affine)
+{
+	if (llc_affine > 1)
+		return -EINVAL;
+
+	WRITE_ONCE(css_tg(css)->llc_affine, llc_affine);
+	return 0;
+}
+
+static u64 cpu_llc_affine_read_u64(struct cgroup_subsys_state *css,
+				   struct cftype *cft)
+{
+	return (u64)css_tg(css)->llc_affine;
+}
+#endif
+
+static int cpu_timer_slack_write_u64(struct cgroup_subsys_state *css,
+				     struct cftype *cftype, u64 slack)
+{
+	struct task_group *tg = css_tg(css), *bound, *new;
+	struct cgroup_subsys_state *pos;
+	struct css_task_iter it;
+	struct task_struct *p;
+	u64 old;
+
+	if (slack > ULONG_MAX)
+		return -EINVAL;
+
+	mutex_lock(&timer_slack_cgroup_mutex);
+	bound = tg_timer_slack_bound(tg);
+	old = bound ? bound->timer_slack_ns : 0;
+	WRITE_ONCE(tg->timer_slack_ns, slack);
+	new = tg_timer_slack_bound(tg);
+
+	/* descendants with a slack of their own keep it */
+	rcu_read_lock();
+	css_for_each_descendant_pre(pos, css) {
+		if (tg_timer_slack_bound(css_tg(pos)) != new)
+			continue;
+		css_task_iter_start(pos, 0, &it);
+		while ((p = css_task_iter_next(&it)))
+			sched_timer_slack_set(p, new, old);
+		css_task_iter_end(&it);
+	}
+	rcu_read_unlock();
+	mutex_unlock(&timer_slack_cgroup_mutex);
+
+	return 0;
+}
+
+static u64 cpu_timer_slack_read_u64(struct cgroup_subsys_state *css,
+				    struct cftype *cft)
+{
+	return css_tg(css)->timer_slack_ns;
+}
+
+#ifdef CONFIG_UCLAMP_TASK_GROUP
+static void cpu_util_update_eff(struct cgroup_subsys_state *css)
+{
+	struct cgroup_subsys_state *top_css = css;
+	struct uclamp_se *uc_parent = NULL;
+	struct uclamp_se *uc_se = NULL;
+	unsigned int eff[UCLAMP_CNT];
+	enum uclamp_id clamp_id;
+	unsigned int clamps;
+
+	css_for_each_descendant_pre(css, top_css) {
+		uc_parent = css_tg(css)->parent
+			? css_tg(css)->parent->uclamp : NULL;
+
+		for_each_clamp_id(clamp_id) {
+			/* Assume effective clamps matches requested clamps */
+			eff[clamp_id] = css_tg(css)->uclamp_req[clamp_id].value;
+			/* Cap effective clamps with parent's effective clamps */
+			if (uc_parent &&
+			    eff[clamp_id] > uc_parent[clamp_id].value) {
+				eff[clamp_id] = uc_parent[clamp_id].value;
+			}
+		}
+		/* Ensure protection is always capped by limit */
+		eff[UCLAMP_MIN] = min(eff[UCLAMP_MIN], eff[UCLAMP_MAX]);
+
+		/* Propagate most restrictive effective clamps */
+		clamps = 0x0;
+		uc_se = css_tg(css)->uclamp;
+		for_each_clamp_id(clamp_id) {
+			if (eff[clamp_id] == uc_se[clamp_id].value)
+				continue;
+			uc_se[clamp_id].value = eff[clamp_id];
+			uc_se[clamp_id].bucket_id = uclamp_bucket_id(eff[clamp_id]);
+			clamps |= (0x1 << clamp_id);
+		}
+		if (!clamps) {
+			css = css_rightmost_descendant(css);
+			continue;
+		}
+
+		/* Immediately update descendants RUNNABLE tasks */
+		uclamp_update_active_tasks(css, clamps);
+	}
+}
+
+/* cpu.uclamp.{min,max} take a percentage with two decimals, or "max" */
+#define UCLAMP_PERCENT_SHIFT	2
+#define UCLAMP_PERCENT_POW10	100
+#define UCLAMP_PERCENT_SCALE	(100 * UCLAMP_PERCENT_POW10)
+
+struct uclamp_request {
+	s64 percent;
+	u64 util;
+	int ret;
+};
+
+static inline struct uclamp_request
+capacity_from_percent(char *buf)
+{
+	struct uclamp_request req = {
+		.percent = UCLAMP_PERCENT_SCALE,
+		.util = SCHED_CAPACITY_SCALE,
+		.ret = 0,
+	};
+
+	buf = strim(buf);
+	if (strcmp(buf, "max")) {
+		req.ret = cgroup_parse_float(buf, UCLAMP_PERCENT_SHIFT,
+					     &req.percent);
+		if (req.ret)
+			return req;
+		if ((u64)req.percent > UCLAMP_PERCENT_SCALE) {
+			req.ret = -ERANGE;
+			return req;
+		}
+
+		req.util = req.percent << SCHED_CAPACITY_SHIFT;
+		req.util = DIV_ROUND_CLOSEST_ULL(req.util, UCLAMP_PERCENT_SCALE);
+	}
+
+	return req;
+}
+
+static ssize_t cpu_uclamp_write(struct kernfs_open_file *of, char *buf,
+				size_t nbytes, loff_t off,
+				enum uclamp_id clamp_id)
+{
+	struct uclamp_request req;
+	struct task_group *tg;
+
+	req = capacity_from_percent(buf);
+	if (req.ret)
+		return req.ret;
+
+	mutex_lock(&uclamp_mutex);
+	rcu_read_lock();
+
+	tg = css_tg(of_css(of));
+	if (tg->uclamp_req[clamp_id].value != req.util)
+		uclamp_se_set(&tg->uclamp_req[clamp_id], req.util, false);
+
+	/*
+	 * Because of not recoverable conversion rounding we keep track of the
+	 * exact requested value
+	 */
+	tg->uclamp_pct[clamp_id] = req.percent;
+
+	/* Update effective clamps to track the most restrictive value */
+	cpu_util_update_eff(of_css(of));
+
+	rcu_read_unlock();
+	mutex_unlock(&uclamp_mutex);
+
+	return nbytes;
+}
+
+static ssize_t cpu_uclamp_min_write(struct kernfs_open_file *of,
+				    char *buf, size_t nbytes,
+				    loff_t off)
+{
+	return cpu_uclamp_write(of, buf, nbytes, off, UCLAMP_MIN);
+}
+
+static ssize_t cpu_uclamp_max_write(struct kernfs_open_file *of,
+				    char *buf, size_t nbytes,
+				    loff_t off)
+{
+	return cpu_uclamp_write(of, buf, nbytes, off, UCLAMP_MAX);
+}
+
+static inline void cpu_uclamp_print(struct seq_file *sf,
+				    enum uclamp_id clamp_id)
+{
+	struct task_group *tg;
+	u64 util_clamp;
+	u64 percent;
+	u32 rem;
+
+	rcu_read_lock();
+	tg = css_tg(seq_css(sf));
+	util_clamp = tg->uclamp_req[clamp_id].value;
+	rcu_read_unlock();
+
+	if (util_clamp == SCHED_CAPACITY_SCALE) {
+		seq_puts(sf, "max\n");
+		return;
+	}
+
+	percent = tg->uclamp_pct[clamp_id];
+	percent = div_u64_rem(percent, UCLAMP_PERCENT_POW10, &rem);
+	seq_printf(sf, "%llu.%0*u\n", percent, UCLAMP_PERCENT_SHIFT, rem);
+}
+
+static int cpu_uclamp_min_show(struct seq_file *sf, void *v)
+{
+	cpu_uclamp_print(sf, UCLAMP_MIN);
+	return 0;
+}
+
+static int cpu_uclamp_max_show(struct seq_file *sf, void *v)
+{
+	cpu_uclamp_print(sf, UCLAMP_MAX);
+	return 0;
+}
+#endif /* CONFIG_UCLAMP_TASK_GROUP */
+
+#ifdef CONFIG_CGROUP_RESCTRL
+static int cpu_resctrl_group_show(struct seq_file *sf, void *v)
+{
+	struct task_group *tg = css_tg(seq_css(sf));
+
+	mutex_lock(&resctrl_cgroup_mutex);
+	if (tg->resctrl_name)
+		seq_printf(sf, "%s\n", tg->resctrl_name);
+	mutex_unlock(&resctrl_cgroup_mutex);
+	return 0;
+}
+
+/*
+ * Resctrl groups are named by their path in the filesystem: "/" for the
+ * default group, "<ctrl>" for a control group and "[<ctrl>/]mon_groups/<mon>"
+ * for a monitor group.
+ */
+static int resctrl_parse_group(char *buf, char **ctrl, char **mon)
+{
+	char *sep;
+
+	*ctrl = *mon = NULL;
+	if (!strcmp(buf, "/"))
+		return 0;
+
+	if (strncmp(buf, "mon_groups/", 11)) {
+		*ctrl = buf;
+		sep = strchr(buf, '/');
+		if (!sep)
+			return 0;
+		*sep++ = '\0';
+		buf = sep;
+		if (strncmp(buf, "mon_groups/", 11))
+			return -EINVAL;
+	}
+	*mon = buf + 11;
+	if (!**mon || strchr(*mon, '/') || (*ctrl && !**ctrl))
+		return -EINVAL;
+	return 0;
+}
+
+/* Bind the group to a resctrl group, or unbind it with an empty string */
+static ssize_t cpu_resctrl_group_write(struct kernfs_open_file *of,
+				       char *buf, size_t nbytes, loff_t off)
+{
+	struct task_group *tg = css_tg(of_css(of));
+	u32 closid = 0, rmid = 0, old_closid, old_rmid;
+	char *name = NULL, *ctrl, *mon, *old;
+	unsigned long gen;
+	int ret;
+
+	buf = strstrip(buf);
+	if (*buf) {
+		name = kstrdup(buf, GFP_KERNEL);
+		if (!name)
+			return -ENOMEM;
+		ret = resctrl_parse_group(buf, &ctrl, &mon);
+		if (ret)
+			goto out;
+	}
+
+retry:
+	gen = READ_ONCE(resctrl_cgroup_gen);
+	if (name) {
+		ret = resctrl_group_lookup_ids(ctrl, mon, &closid, &rmid);
+		if (ret)
+			goto out;
+	}
+
+	mutex_lock(&resctrl_cgroup_mutex);
+	if (gen != resctrl_cgroup_gen) {
+		mutex_unlock(&resctrl_cgroup_mutex);
+		goto retry;
+	}
+	old = tg->resctrl_name;
+	old_closid = old ? tg->resctrl_closid : 0;
+	old_rmid = old ? tg->resctrl_rmid : 0;
+	WRITE_ONCE(tg->resctrl_closid, closid);
+	WRITE_ONCE(tg->resctrl_rmid, rmid);
+	smp_store_release(&tg->resctrl_name, name);
+	tg_resctrl_update_tasks(tg, old_closid, old_rmid, false, true);
+	mutex_unlock(&resctrl_cgroup_mutex);
+
+	kfree(old);
+	return nbytes;
+out:
+	kfree(name);
+	return ret;
+}
+#endif
+
+#ifdef CONFIG_SCHED_CORE
+static u64 cpu_core_cookie_read_u64(struct cgroup_subsys_state *css,
+				    struct cftype *cft)
+{
+	return css_tg(css)->core_tag;
+}
+
+static int cpu_core_cookie_write_u64(struct cgroup_subsys_state *css,
+				     struct cftype *cftype, u64 cookie)
+{
+	sched_core_set_tag(css_tg(css), cookie);
+	return 0;
+}
+#endif
+
+#if defined(CONFIG_FAIR_GROUP_SCHED) && defined(CONFIG_GROUP_IDENTITY)
+/*
+ * Identity statistics of @tg and all its descendants, so that a parent
+ * shows what its underclass children lost to the highclass ones.
+ */
+static void cpu_identity_stat_show(struct seq_file *sf, struct task_group *tg,
+				   bool usec)
+{
+	u64 expel_time = 0, nr_high_preempt = 0, under_throttled = 0;
+	struct cgroup_subsys_state *pos;
+	int cpu;
+
+	rcu_read_lock();
+	css_for_each_descendant_pre(pos, &tg->css) {
+		struct task_group *child = css_tg(pos);
+
+		for_each_possible_cpu(cpu) {
+			struct cfs_rq *cfs_rq = child->cfs_rq[cpu];
+
+#ifdef CONFIG_SCHED_SMT
+			expel_time += READ_ONCE(cfs_rq->expel_time);
+#endif
+			nr_high_preempt += READ_ONCE(cfs_rq->nr_high_preempt);
+			under_throttled += READ_ONCE(cfs_rq->under_throttled_time);
+		}
+	}
+	rcu_read_unlock();
+
+	if (usec) {
+		do_div(expel_time, NSEC_PER_USEC);
+		do_div(under_throttled, NSEC_PER_USEC);
+		seq_printf(sf, "id_expel_usec %llu\n"
+			   "id_nr_high_preempt %llu\n"
+			   "id_under_throttled_usec %llu\n",
+			   expel_time, nr_high_preempt, under_throttled);
+	} else {
+		seq_printf(sf, "id_expel_time %llu\n"
+			   "id_nr_high_preempt %llu\n"
+			   "id_under_throttled_time %llu\n",
+			   expel_time, nr_high_preempt, under_throttled);
+	}
+}
+#else
+static inline void cpu_identity_stat_show(struct seq_file *sf,
+					  struct task_group *tg, bool usec)
+{
+}
+#endif
+
 #ifdef CONFIG_FAIR_GROUP_SCHED
 static int cpu_shares_write_u64(struct cgroup_subsys_state *css,
 				struct cftype *cftype, u64 shareval)
@@ -6974,6 +8136,7 @@ static int cpu_cfs_stat_show(struct seq_file *sf, void *v)
 	seq_printf(sf, "current_bw %llu\n", cfs_b->runtime);
 	seq_printf(sf, "nr_burst %d\n", cfs_b->nr_burst);
 	seq_printf(sf, "burst_time %llu\n", cfs_b->burst_time);
+	cpu_identity_stat_show(sf, tg, false);
 
 	return 0;
 }
@@ -7040,6 +8203,27 @@ static s64 cpu_identity_read_s64(struct cgroup_subsys_state *css,
 }
 #endif
 
+#ifdef CONFIG_SCHED_SLI
+static int cpu_loadavg_show(struct seq_file *sf, void *v)
+{
+	return tg_loadavg_show(sf, css_tg(seq_css(sf)));
+}
+
+static int cpu_sched_latency_show(struct seq_file *sf, void *v)
+{
+	return tg_sched_lat_show(sf, css_tg(seq_css(sf)));
+}
+
+static int cpu_sched_latency_write_u64(struct cgroup_subsys_state *css,
+				       struct cftype *cftype, u64 val)
+{
+	if (val != 0)
+		return -EINVAL;
+
+	return tg_sched_lat_reset(css_tg(css));
+}
+#endif
+
 static struct cftype cpu_legacy_files[] = {
 #ifdef CONFIG_FAIR_GROUP_SCHED
 	{
@@ -7128,6 +8312,57 @@ static struct cftype cpu_legacy_files[] = {
 		.read_u64 = cpu_ht_stable_read_u64,
 		.write_u64 = cpu_ht_stable_write_u64,
 	},
+#endif
+#ifdef CONFIG_SCHED_CORE
+	{
+		.name = "core_cookie",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = cpu_core_cookie_read_u64,
+		.write_u64 = cpu_core_cookie_write_u64,
+	},
+#endif
+#ifdef CONFIG_NUMA_BALANCING
+	{
+		.name = "llc_affine",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = cpu_llc_affine_read_u64,
+		.write_u64 = cpu_llc_affine_write_u64,
+	},
+#endif
+	{
+		.name = "timer_slack_ns",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = cpu_timer_slack_read_u64,
+		.write_u64 = cpu_timer_slack_write_u64,
+	},
+#ifdef CONFIG_UCLAMP_TASK_GROUP
+	{
+		.name = "uclamp.min",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = cpu_uclamp_min_show,
+		.write = cpu_uclamp_min_write,
+	},
+	{
+		.name = "uclamp.max",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = cpu_uclamp_max_show,
+		.write = cpu_uclamp_max_write,
+	},
+#endif
+#ifdef CONFIG_CGROUP_RESCTRL
+	{
+		.name = "resctrl_group",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = cpu_resctrl_group_show,
+		.write = cpu_resctrl_group_write,
+	},
+#endif
+#ifdef CONFIG_SCHED_SLI
+	{
+		.name = "loadavg",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = cpu_loadavg_show,
+	},
 #endif
 	{ }	/* Terminate */
 };
@@ -7139,18 +8374,23 @@ static int cpu_extra_stat_show(struct seq_file *sf,
 	{
 		struct task_group *tg = css_tg(css);
 		struct cfs_bandwidth *cfs_b = &tg->cfs_bandwidth;
-		u64 throttled_usec;
+		u64 throttled_usec, burst_usec;
 
 		throttled_usec = cfs_b->throttled_time;
 		do_div(throttled_usec, NSEC_PER_USEC);
+		burst_usec = cfs_b->burst_time;
+		do_div(burst_usec, NSEC_PER_USEC);
 
 		seq_printf(sf, "nr_periods %d\n"
 			   "nr_throttled %d\n"
-			   "throttled_usec %llu\n",
+			   "throttled_usec %llu\n"
+			   "nr_bursts %d\n"
+			   "burst_usec %llu\n",
 			   cfs_b->nr_periods, cfs_b->nr_throttled,
-			   throttled_usec);
+			   throttled_usec, cfs_b->nr_burst, burst_usec);
 	}
 #endif
+	cpu_identity_stat_show(sf, css_tg(css), true);
 	return 0;
 }
 
@@ -7268,9 +8508,26 @@ static ssize_t cpu_max_write(struct kernfs_open_file *of,
 
 	ret = cpu_period_quota_parse(buf, &period, &quota);
 	if (!ret)
-		ret = tg_set_cfs_bandwidth(tg, period, quota, 0, 0);
+		ret = tg_set_cfs_bandwidth(tg, period, quota,
+					   tg->cfs_bandwidth.burst,
+					   tg->cfs_bandwidth.init_buffer);
 	return ret ?: nbytes;
 }
+
+static u64 cpu_max_burst_read_u64(struct cgroup_subsys_state *css,
+				  struct cftype *cft)
+{
+	return tg_get_cfs_burst(css_tg(css));
+}
+
+static int cpu_max_burst_write_u64(struct cgroup_subsys_state *css,
+				   struct cftype *cftype, u64 burst_us)
+{
+	if (burst_us > LONG_MAX)
+		return -ERANGE;
+
+	return tg_set_cfs_burst(css_tg(css), burst_us);
+}
 #endif
 
 static struct cftype cpu_files[] = {
@@ -7295,6 +8552,69 @@ static struct cftype cpu_files[] = {
 		.seq_show = cpu_max_show,
 		.write = cpu_max_write,
 	},
+	{
+		.name = "max.burst",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = cpu_max_burst_read_u64,
+		.write_u64 = cpu_max_burst_write_u64,
+	},
+#endif
+#ifdef CONFIG_SCHED_SLI
+	{
+		.name = "sched_latency",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = cpu_sched_latency_show,
+		.write_u64 = cpu_sched_latency_write_u64,
+	},
+	{
+		.name = "loadavg",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = cpu_loadavg_show,
+	},
+#endif
+#ifdef CONFIG_SCHED_CORE
+	{
+		.name = "core_cookie",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = cpu_core_cookie_read_u64,
+		.write_u64 = cpu_core_cookie_write_u64,
+	},
+#endif
+#ifdef CONFIG_NUMA_BALANCING
+	{
+		.name = "llc_affine",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = cpu_llc_affine_read_u64,
+		.write_u64 = cpu_llc_affine_write_u64,
+	},
+#endif
+	{
+		.name = "timer_slack_ns",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = cpu_timer_slack_read_u64,
+		.write_u64 = cpu_timer_slack_write_u64,
+	},
+#ifdef CONFIG_UCLAMP_TASK_GROUP
+	{
+		.name = "uclamp.min",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = cpu_uclamp_min_show,
+		.write = cpu_uclamp_min_write,
+	},
+	{
+		.name = "uclamp.max",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = cpu_uclamp_max_show,
+		.write = cpu_uclamp_max_write,
+	},
+#endif
+#ifdef CONFIG_CGROUP_RESCTRL
+	{
+		.name = "resctrl_group",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = cpu_resctrl_group_show,
+		.write = cpu_resctrl_group_write,
+	},
 #endif
 	{ }	/* terminate */
 };
@@ -0,0 +1,177 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Core scheduling: let only fair tasks carrying the same cookie share the
+ * SMT siblings of a core, so that tenants which distrust each other do not
+ * share the core's buffers and caches (MDS, L1TF).
+ *
+ * The cookie is set per cpu cgroup through cpu.core_cookie and inherited by
+ * the descendants which have none on their own. Each CPU publishes the
+ * cookie of the fair task it is about to run, then checks its siblings.
+ * When a lower numbered sibling runs a different cookie the CPU goes idle
+ * instead; a CPU that changes what it publishes kicks its siblings, so a
+ * sibling forced idle re-picks and one running a conflicting task yields.
+ *
+ * Tasks of other classes neither carry nor honour a cookie. A conflicting
+ * task on a sibling may keep running until it takes the reschedule IPI.
+ */
+#include "sched.h"
+
+DEFINE_STATIC_KEY_FALSE(__sched_core_enabled);
+
+/* Serializes cookie updates against group creation */
+static DEFINE_MUTEX(sched_core_mutex);
+
+static inline u64 task_core_cookie(struct task_struct *p)
+{
+	return READ_ONCE(task_group(p)->core_cookie);
+}
+
+/*
+ * Whether a sibling of @cpu runs a fair task with a cookie other than
+ * @cookie. With @lower set only the siblings numbered below @cpu count,
+ * they win the conflict.
+ */
+static bool sched_core_conflict(int cpu, u64 cookie, bool lower)
+{
+	int sibling;
+
+	for_each_cpu(sibling, cpu_smt_mask(cpu)) {
+		struct rq *srq = cpu_rq(sibling);
+
+		if (sibling == cpu || (lower && sibling > cpu))
+			continue;
+
+		if (READ_ONCE(srq->core_busy) &&
+		    READ_ONCE(srq->core_cookie) != cookie)
+			return true;
+	}
+
+	return false;
+}
+
+static void sched_core_kick_siblings(int this_cpu)
+{
+	int cpu;
+
+	for_each_cpu(cpu, cpu_smt_mask(this_cpu)) {
+		if (cpu == this_cpu)
+			continue;
+
+		smp_send_reschedule(cpu);
+	}
+}
+
+/*
+ * Called by __schedule() with @next just picked, return the task to run
+ * instead, which is the idle task when @next may not share the core.
+ */
+struct task_struct *
+sched_core_pick(struct rq *rq, struct task_struct *next, struct rq_flags *rf)
+{
+	bool busy = next->sched_class == &fair_sched_class;
+	u64 cookie = busy ? task_core_cookie(next) : 0;
+	bool was_busy = rq->core_busy;
+	u64 was_cookie = rq->core_cookie;
+
+	if (busy) {
+		WRITE_ONCE(rq->core_cookie, cookie);
+		WRITE_ONCE(rq->core_busy, true);
+		/*
+		 * Publish before checking, pairs with the barrier in the
+		 * sibling's pick so that at least one sees the other.
+		 */
+		smp_mb();
+		if (sched_core_conflict(cpu_of(rq), cookie, true)) {
+			WRITE_ONCE(rq->core_busy, false);
+			next = idle_sched_class.pick_next_task(rq, next, rf);
+			rq->core_forceidle++;
+			busy = false;
+		}
+	} else {
+		WRITE_ONCE(rq->core_busy, false);
+	}
+
+	if (busy != was_busy || (busy && cookie != was_cookie))
+		sched_core_kick_siblings(cpu_of(rq));
+
+	return next;
+}
+
+/* A sibling changed what it runs, re-pick if that affects us */
+void sched_core_handle_ipi(void)
+{
+	struct rq *rq = this_rq();
+	struct task_struct *curr = rq->curr;
+	bool resched;
+
+	if (!sched_core_enabled())
+		return;
+
+	if (curr == rq->idle)
+		resched = rq->cfs.h_nr_running;
+	else
+		resched = READ_ONCE(rq->core_busy) &&
+			  sched_core_conflict(cpu_of(rq),
+					      READ_ONCE(rq->core_cookie), true);
+
+	/* Safe since 'current' can't be changed during IPI */
+	if (resched && !test_tsk_need_resched(curr)) {
+		set_tsk_need_resched(curr);
+		set_preempt_need_resched();
+	}
+}
+
+/* Whether @p could run on @cpu without being forced idle by a sibling */
+bool sched_core_cookie_match(struct task_struct *p, int cpu)
+{
+	return !sched_core_conflict(cpu, task_core_cookie(p), false);
+}
+
+void sched_core_online_group(struct task_group *tg)
+{
+	mutex_lock(&sched_core_mutex);
+	tg->core_cookie = tg->parent->core_cookie;
+	mutex_unlock(&sched_core_mutex);
+}
+
+void sched_core_offline_group(struct task_group *tg)
+{
+	mutex_lock(&sched_core_mutex);
+	if (tg->core_tag) {
+		tg->core_tag = 0;
+		static_branch_dec(&__sched_core_enabled);
+	}
+	mutex_unlock(&sched_core_mutex);
+}
+
+/*
+ * Set the cookie of @tg, a zero @cookie makes it inherit the parent's.
+ * Tasks pick up the new cookie the next time they are scheduled.
+ */
+void sched_core_set_tag(struct task_group *tg, u64 cookie)
+{
+	struct task_group *child;
+	struct cgroup_subsys_state *pos;
+
+	mutex_lock(&sched_core_mutex);
+	if (!tg->core_tag != !cookie) {
+		if (cookie)
+			static_branch_inc(&__sched_core_enabled);
+		else
+			static_branch_dec(&__sched_core_enabled);
+	}
+	tg->core_tag = cookie;
+
+	/* Parents are visited first, so the inherited cookie is final */
+	rcu_read_lock();
+	css_for_each_descendant_pre(pos, &tg->css) {
+		child = container_of(pos, struct task_group, css);
+		/* Not online yet, inherits in sched_core_online_group() */
+		if (!child->parent)
+			continue;
+		WRITE_ONCE(child->core_cookie,
+			   child->core_tag ?: child->parent->core_cookie);
+	}
+	rcu_read_unlock();
+	mutex_unlock(&sched_core_mutex);
+}
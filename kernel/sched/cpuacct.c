@@ -6,6 +6,7 @@
  * (balbir@in.ibm.com).
  */
 #include "sched.h"
+#include <trace/events/cgroup.h>
 
 /* Time spent by the tasks of the CPU accounting group executing in ... */
 enum cpuacct_stat_index {
@@ -326,6 +327,7 @@ void cpuacct_update_latency(struct sched_entity *se, u64 delta)
 {
 	int idx;
 	enum sched_lat_stat_item s;
+	struct sched_cgroup_lat_stat_cpu __percpu *lat_stat_cpu;
 	struct cpuacct *ca;
 	unsigned int msecs;
 	struct task_group *tg;
@@ -335,23 +337,48 @@ void cpuacct_update_latency(struct sched_entity *se, u64 delta)
 
 	rcu_read_lock();
 	tg = se->cfs_rq->tg;
-	ca = cgroup_ca(tg->css.cgroup);
-	if (!ca) {
+	/* There is no cpuacct on the default hierarchy, use the group's own */
+	if (cgroup_subsys_on_dfl(cpu_cgrp_subsys)) {
+		lat_stat_cpu = tg->lat_stat_cpu;
+	} else {
+		ca = cgroup_ca(tg->css.cgroup);
+		lat_stat_cpu = ca ? ca->lat_stat_cpu : NULL;
+	}
+	if (!lat_stat_cpu) {
 		rcu_read_unlock();
 		return;
 	}
-	if (entity_is_task(se))
+	if (entity_is_task(se)) {
 		s = SCHED_LAT_WAIT;
-	else
+		trace_cgroup_sli_event(tg->css.cgroup,
+				       container_of(se, struct task_struct, se)->pid,
+				       SLI_EVENT_SCHED_DELAY, SLI_SCHED_WAIT,
+				       delta, 0);
+	} else {
 		s = SCHED_LAT_CGROUP_WAIT;
+		trace_cgroup_sli_event(tg->css.cgroup, 0, SLI_EVENT_SCHED_DELAY,
+				       SLI_SCHED_CGROUP_WAIT, delta, 0);
+	}
 
 	msecs = delta >> 20; /* Proximately to speed up */
 	idx = get_sched_lat_count_idx(msecs);
-	this_cpu_inc(ca->lat_stat_cpu->item[s][idx]);
-	this_cpu_inc(ca->lat_stat_cpu->item[s][SCHED_LAT_NR]);
-	this_cpu_add(ca->lat_stat_cpu->item[s][SCHED_LAT_TOTAL], delta);
+	this_cpu_inc(lat_stat_cpu->item[s][idx]);
+	this_cpu_inc(lat_stat_cpu->item[s][SCHED_LAT_NR]);
+	this_cpu_add(lat_stat_cpu->item[s][SCHED_LAT_TOTAL], delta);
 	rcu_read_unlock();
 }
+
+int alloc_tg_sched_lat(struct task_group *tg)
+{
+	tg->lat_stat_cpu = alloc_percpu(struct sched_cgroup_lat_stat_cpu);
+
+	return tg->lat_stat_cpu != NULL;
+}
+
+void free_tg_sched_lat(struct task_group *tg)
+{
+	free_percpu(tg->lat_stat_cpu);
+}
 #endif
 
 static void cpuacct_clean_up(void **ptr)
@@ -477,12 +504,13 @@ cpuacct_css_alloc(struct cgroup_subsys_state *parent_css)
 	return ERR_PTR(-ENOMEM);
 }
 
-#ifdef CONFIG_SCHED_SLI
 static void cpuacct_css_offline(struct cgroup_subsys_state *css)
 {
+#ifdef CONFIG_SCHED_SLI
 	ca_enable_sli(css_ca(css), false);
-}
 #endif
+	workqueue_cgroup_offline(css);
+}
 
 /* Destroy an existing CPU accounting group */
 static void cpuacct_css_free(struct cgroup_subsys_state *css)
@@ -855,6 +883,33 @@ static inline bool tg_rt_throttled(struct task_group *tg, int cpu)
 }
 #endif
 
+static unsigned long tg_running(struct task_group *tg, int cpu)
+{
+	unsigned long nr_running = 0;
+
+	if (!tg_cfs_throttled(tg, cpu))
+		nr_running += tg->cfs_rq[cpu]->h_nr_running;
+#ifdef CONFIG_RT_GROUP_SCHED
+	if (!tg_rt_throttled(tg, cpu))
+		nr_running += tg->rt_rq[cpu]->rt_nr_running;
+#endif
+	/* SCHED_DEADLINE doesn't support cgroup yet */
+
+	return nr_running;
+}
+
+static unsigned long tg_uninterruptible(struct task_group *tg, int cpu)
+{
+	unsigned long nr;
+
+	nr = tg->cfs_rq[cpu]->nr_uninterruptible;
+#ifdef CONFIG_RT_GROUP_SCHED
+	nr += tg->rt_rq[cpu]->nr_uninterruptible;
+#endif
+
+	return nr;
+}
+
 static unsigned long ca_running(struct cpuacct *ca, int cpu)
 {
 	unsigned long nr_running = 0;
@@ -867,19 +922,10 @@ static unsigned long ca_running(struct cpuacct *ca, int cpu)
 
 	rcu_read_lock();
 	tg = cgroup_tg(cgrp);
-	if (unlikely(!tg))
-		goto out;
-
-	if (!tg_cfs_throttled(tg, cpu))
-		nr_running += tg->cfs_rq[cpu]->h_nr_running;
-#ifdef CONFIG_RT_GROUP_SCHED
-	if (!tg_rt_throttled(tg, cpu))
-		nr_running += tg->rt_rq[cpu]->rt_nr_running;
-#endif
-	/* SCHED_DEADLINE doesn't support cgroup yet */
-
-out:
+	if (likely(tg))
+		nr_running = tg_running(tg, cpu);
 	rcu_read_unlock();
+
 	return nr_running;
 }
 
@@ -895,17 +941,75 @@ static unsigned long ca_uninterruptible(struct cpuacct *ca, int cpu)
 
 	rcu_read_lock();
 	tg = cgroup_tg(cgrp);
-	if (unlikely(!tg))
-		goto out_rcu_unlock;
+	if (likely(tg))
+		nr = tg_uninterruptible(tg, cpu);
+	rcu_read_unlock();
 
-	nr = tg->cfs_rq[cpu]->nr_uninterruptible;
-#ifdef CONFIG_RT_GROUP_SCHED
-	nr += tg->rt_rq[cpu]->nr_uninterruptible;
-#endif
+	return nr;
+}
 
-out_rcu_unlock:
+static unsigned long tg_active(struct task_group *tg)
+{
+	long active = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		active += tg_running(tg, cpu);
+		active += tg_uninterruptible(tg, cpu);
+	}
+
+	return active > 0 ? active * FIXED_1 : 0;
+}
+
+/*
+ * The load averages of the task groups behind cpu.loadavg, which works on
+ * both hierarchies. Like the cpuacct ones they are sampled from the per-cpu
+ * runqueue counters, no task is walked. Only the groups whose cpu.loadavg
+ * has been read are calculated, the others would cost a walk over all the
+ * CPUs for nothing.
+ */
+static void calc_tg_load(void)
+{
+	struct task_group *tg;
+	unsigned long active;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(tg, &task_groups, list) {
+		if (!READ_ONCE(tg->load_calc))
+			continue;
+
+		active = tg_active(tg);
+		tg->avenrun[0] = calc_load(tg->avenrun[0], EXP_1, active);
+		tg->avenrun[1] = calc_load(tg->avenrun[1], EXP_5, active);
+		tg->avenrun[2] = calc_load(tg->avenrun[2], EXP_15, active);
+	}
 	rcu_read_unlock();
-	return nr;
+}
+
+int tg_loadavg_show(struct seq_file *sf, struct task_group *tg)
+{
+	unsigned long nr_running = 0, loads[3];
+	int cpu, i;
+
+	/* Start from the current load rather than from zero */
+	if (!READ_ONCE(tg->load_calc)) {
+		tg->avenrun[0] = tg->avenrun[1] = tg->avenrun[2] = tg_active(tg);
+		WRITE_ONCE(tg->load_calc, true);
+	}
+
+	for (i = 0; i < 3; i++)
+		loads[i] = tg->avenrun[i] + FIXED_1/200;
+
+	for_each_possible_cpu(cpu)
+		nr_running += tg_running(tg, cpu);
+
+	seq_printf(sf, "%lu.%02lu %lu.%02lu %lu.%02lu %lu\n",
+		   LOAD_INT(loads[0]), LOAD_FRAC(loads[0]),
+		   LOAD_INT(loads[1]), LOAD_FRAC(loads[1]),
+		   LOAD_INT(loads[2]), LOAD_FRAC(loads[2]),
+		   nr_running);
+
+	return 0;
 }
 
 static void cpuacct_calc_load(struct cpuacct *acct)
@@ -955,6 +1059,8 @@ void calc_cgroup_load(void)
 	list_for_each_entry_rcu(ca, &sli_ca_list, sli_list)
 		cpuacct_calc_load(ca);
 	rcu_read_unlock();
+
+	calc_tg_load();
 }
 
 static void __cpuacct_get_usage_result(struct cpuacct *ca, int cpu,
@@ -1215,24 +1321,41 @@ static int sched_lat_stat_write(struct cgroup_subsys_state *css,
 	return 0;
 }
 
-static u64 sched_lat_stat_gather(struct cpuacct *ca,
-				 enum sched_lat_stat_item sidx,
-				 enum sched_lat_count_t cidx)
+static void smp_write_tg_sched_lat(void *info)
+{
+	struct task_group *tg = info;
+	int i;
+
+	for (i = SCHED_LAT_0_1; i < SCHED_LAT_NR_COUNT; i++)
+		this_cpu_write(tg->lat_stat_cpu->item[SCHED_LAT_WAIT][i], 0);
+}
+
+int tg_sched_lat_reset(struct task_group *tg)
+{
+	smp_write_tg_sched_lat(tg);
+	smp_call_function(smp_write_tg_sched_lat, tg, 1);
+
+	return 0;
+}
+
+static u64 sched_lat_stat_gather(
+		struct sched_cgroup_lat_stat_cpu __percpu *lat_stat_cpu,
+		enum sched_lat_stat_item sidx,
+		enum sched_lat_count_t cidx)
 {
 	u64 sum = 0;
 	int cpu;
 
 	for_each_possible_cpu(cpu)
-		sum += per_cpu_ptr(ca->lat_stat_cpu, cpu)->item[sidx][cidx];
+		sum += per_cpu_ptr(lat_stat_cpu, cpu)->item[sidx][cidx];
 
 	return sum;
 }
 
-static int sched_lat_stat_show(struct seq_file *sf, void *v)
+static void __sched_lat_stat_show(struct seq_file *sf,
+		struct sched_cgroup_lat_stat_cpu __percpu *ca,
+		enum sched_lat_stat_item s)
 {
-	struct cpuacct *ca = css_ca(seq_css(sf));
-	enum sched_lat_stat_item s = seq_cft(sf)->private;
-
 	/* CFS scheduling latency cgroup and task histgrams */
 	seq_printf(sf, "0-1ms: \t%llu\n",
 		sched_lat_stat_gather(ca, s, SCHED_LAT_0_1));
@@ -1266,7 +1389,19 @@ static int sched_lat_stat_show(struct seq_file *sf, void *v)
 		sched_lat_stat_gather(ca, s, SCHED_LAT_TOTAL) / 1000000);
 	seq_printf(sf, "nr: \t%llu\n",
 		sched_lat_stat_gather(ca, s, SCHED_LAT_NR));
+}
+
+static int sched_lat_stat_show(struct seq_file *sf, void *v)
+{
+	struct cpuacct *ca = css_ca(seq_css(sf));
+
+	__sched_lat_stat_show(sf, ca->lat_stat_cpu, seq_cft(sf)->private);
+	return 0;
+}
 
+int tg_sched_lat_show(struct seq_file *sf, struct task_group *tg)
+{
+	__sched_lat_stat_show(sf, tg->lat_stat_cpu, SCHED_LAT_WAIT);
 	return 0;
 }
 
@@ -1424,6 +1559,24 @@ void cpuacct_account_field(struct task_struct *tsk, int index, u64 val)
 	rcu_read_unlock();
 }
 
+/*
+ * Charge @cputime of system time spent on behalf of @css by a kworker, see
+ * WQ_CGROUP.  The root group has already been charged through the kworker.
+ */
+void cpuacct_charge_css(struct cgroup_subsys_state *css, u64 cputime)
+{
+	unsigned long flags;
+	struct cpuacct *ca;
+
+	/* the tick updates the same counters */
+	local_irq_save(flags);
+	for (ca = css_ca(css); ca != &root_cpuacct; ca = parent_ca(ca)) {
+		this_cpu_ptr(ca->cpuusage)->usages[CPUACCT_STAT_SYSTEM] += cputime;
+		this_cpu_ptr(ca->cpustat)->cpustat[CPUTIME_SYSTEM] += cputime;
+	}
+	local_irq_restore(flags);
+}
+
 static void cpuacct_cgroup_attach(struct cgroup_taskset *tset)
 {
 	struct task_struct *task;
@@ -1437,9 +1590,7 @@ static void cpuacct_cgroup_attach(struct cgroup_taskset *tset)
 struct cgroup_subsys cpuacct_cgrp_subsys = {
 	.css_alloc	= cpuacct_css_alloc,
 	.css_free	= cpuacct_css_free,
-#ifdef CONFIG_SCHED_SLI
 	.css_offline    = cpuacct_css_offline,
-#endif
 	.attach         = cpuacct_cgroup_attach,
 	.legacy_cftypes	= files,
 	.early_init	= true,
@@ -1509,6 +1660,7 @@ int load_calc_func(void *unsed)
 			continue;
 
 		async_calc_cgroup_load();
+		calc_tg_load();
 		next_update += LOAD_FREQ;
 	}
 
@@ -214,7 +214,8 @@ static unsigned long sugov_get_util(struct sugov_cpu *sg_cpu)
 	sg_cpu->max = max = arch_scale_cpu_capacity(NULL, sg_cpu->cpu);
 	sg_cpu->bw_dl = cpu_bw_dl(rq);
 
-	if (rt_rq_is_runnable(&rq->rt))
+	/* with uclamp, RT tasks ask for max through their default boost */
+	if (!IS_BUILTIN(CONFIG_UCLAMP_TASK) && rt_rq_is_runnable(&rq->rt))
 		return max;
 
 	/*
@@ -235,6 +236,9 @@ static unsigned long sugov_get_util(struct sugov_cpu *sg_cpu)
 	util = cpu_util_cfs(rq);
 	util += cpu_util_rt(rq);
 
+	/* Boost latency tenants, cap batch ones, by their RUNNABLE tasks */
+	util = uclamp_util(rq, util);
+
 	/*
 	 * We do not make cpu_util_dl() a permanent part of this sum because we
 	 * want to use cpu_bw_dl() later on, but we need to check if the
@@ -665,6 +665,10 @@ do {									\
 #endif
 	PN(high_exec_sum);
 	PN(under_exec_sum);
+#endif
+#ifdef CONFIG_SCHED_CORE
+	P(core_busy);
+	P(core_forceidle);
 #endif
 	P(nr_switches);
 	P(nr_load_updates);
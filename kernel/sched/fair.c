@@ -155,6 +155,14 @@ int sysctl_sched_expel_idle_balance_delay = -1;
  *  Default: 10, units: ms
  */
 unsigned long sysctl_sched_expel_update_interval = 10;
+
+/*
+ * Share of the time underclass may still run on a CPU whose SMT sibling
+ * runs an expeller, 0 means always expel.
+ *
+ * Default: 0, units: percent
+ */
+unsigned int sysctl_sched_expel_underclass_pct;
 #endif
 #endif
 
@@ -568,6 +576,18 @@ static inline int entity_before(struct sched_entity *a,
 	return (s64)(a->vruntime - b->vruntime) < 0;
 }
 
+/*
+ * A CPU running only SCHED_IDLE tasks is as good as idle for a wakeup,
+ * check_preempt_wakeup() lets any other task preempt them right away.
+ */
+static inline bool sched_idle_cpu(int cpu)
+{
+	struct rq *rq = cpu_rq(cpu);
+
+	return unlikely(rq->nr_running == rq->cfs.idle_h_nr_running &&
+			rq->nr_running);
+}
+
 #ifdef CONFIG_GROUP_IDENTITY
 
 /* legacy bvt type */
@@ -673,10 +693,75 @@ static inline bool need_expel(int this_cpu)
 	return false;
 }
 
+#define EXPEL_BUCKET_PERIOD	(100 * NSEC_PER_MSEC)
+#define EXPEL_TIMER_MIN		NSEC_PER_MSEC
+
+/*
+ * With sysctl_sched_expel_underclass_pct set, expel is relaxed for that share
+ * of the time. Each CPU meters it with a token bucket: tokens accrue at that
+ * rate while expel is wanted and are spent by underclass execution while
+ * expel is relaxed, the bucket holds at most that share of
+ * EXPEL_BUCKET_PERIOD. No IPI comes when the bucket runs dry or refills, so
+ * the expel timer re-evaluates the CPU at the expected time instead.
+ *
+ * Return true if expel is wanted but relaxed.
+ */
+static bool expel_relax(struct rq *rq, bool need)
+{
+	unsigned int pct = READ_ONCE(sysctl_sched_expel_underclass_pct);
+	bool relaxed = rq->expel_relaxed;
+	u64 now, under_sum, delay;
+	s64 cap;
+
+	if (!pct) {
+		if (relaxed)
+			rq->expel_relaxed = false;
+		return false;
+	}
+
+	now = local_clock();
+	under_sum = READ_ONCE(rq->under_exec_sum);
+	cap = div_u64(EXPEL_BUCKET_PERIOD * pct, 100);
+
+	if (rq->expel_wanted)
+		rq->expel_tokens += div_u64((now - rq->expel_token_stamp) * pct,
+					    100);
+	if (relaxed)
+		rq->expel_tokens -= under_sum - rq->expel_under_stamp;
+	rq->expel_tokens = clamp_t(s64, rq->expel_tokens, -cap, cap);
+
+	rq->expel_token_stamp = now;
+	rq->expel_under_stamp = under_sum;
+	rq->expel_wanted = need;
+	rq->expel_relaxed = need && rq->expel_tokens > 0;
+
+	if (!need || pct >= 100)
+		return rq->expel_relaxed;
+
+	/* The estimate still holds unless the state flipped */
+	if (relaxed == rq->expel_relaxed &&
+	    hrtimer_is_queued(&rq->expel_timer))
+		return rq->expel_relaxed;
+
+	if (rq->expel_relaxed)
+		delay = div_u64((u64)rq->expel_tokens * 100, 100 - pct);
+	else
+		delay = div_u64((u64)-rq->expel_tokens * 100, pct);
+
+	hrtimer_start(&rq->expel_timer,
+		      ns_to_ktime(max_t(u64, delay, EXPEL_TIMER_MIN)),
+		      HRTIMER_MODE_REL_PINNED);
+
+	return rq->expel_relaxed;
+}
+
 static inline void __update_rq_on_expel(struct rq *rq)
 {
 	bool ret = need_expel(rq->cpu);
 
+	if (expel_relax(rq, ret))
+		ret = false;
+
 	/*
 	 * Write 'on_expel' as less as possible since
 	 * it's really hot.
@@ -981,9 +1066,14 @@ id_idle_cpu(struct task_struct *p, int cpu, bool expellee, bool *idle)
 	if (need_expel)
 		return false;
 
+	/* A sibling would force it idle, the cookies don't compose */
+	if (sched_core_enabled() && !sched_core_cookie_match(p, cpu))
+		return false;
+
 	/* CPU full of underclass is idle for highclass */
 	if (!is_idle)
-		return is_highclass_task(p) && underclass_only(cpu);
+		return sched_idle_cpu(cpu) ||
+		       (is_highclass_task(p) && underclass_only(cpu));
 
 	if (!is_saver)
 		return true;
@@ -1225,6 +1315,25 @@ int update_identity(struct task_group *tg, s64 val)
 	return 0;
 }
 
+/*
+ * Hints for RFS to keep softirq work of one class off the CPUs busy with
+ * the other, racy by nature.
+ */
+bool sched_current_underclass(void)
+{
+	return is_underclass_task(current);
+}
+
+bool sched_cpu_highclass_running(int cpu)
+{
+	return READ_ONCE(cpu_rq(cpu)->nr_high_running);
+}
+
+bool sched_cpu_underclass_only(int cpu)
+{
+	return underclass_only(cpu);
+}
+
 static inline void identity_init_cfs_rq(struct cfs_rq *cfs_rq)
 {
 	cfs_rq->under_timeline = RB_ROOT_CACHED;
@@ -1286,6 +1395,24 @@ static inline void update_expel_spread(struct cfs_rq *cfs_rq)
 static void
 place_entity(struct cfs_rq *cfs_rq, struct sched_entity *se, int initial);
 
+/*
+ * Expelled time is charged to the group the entity stands for, or to the
+ * task's own group for a task entity, and is reported in cpu.stat.
+ */
+static inline void expel_list_add(struct cfs_rq *cfs_rq, struct sched_entity *se)
+{
+	se->expel_stamp = rq_clock(rq_of(cfs_rq));
+	list_add_tail(&se->expel_node, &cfs_rq->expel_list);
+}
+
+static inline void expel_list_del(struct cfs_rq *cfs_rq, struct sched_entity *se)
+{
+	struct cfs_rq *acct_rq = group_cfs_rq(se) ? : cfs_rq;
+
+	acct_rq->expel_time += rq_clock(rq_of(cfs_rq)) - se->expel_stamp;
+	list_del_init(&se->expel_node);
+}
+
 static inline void check_expellee_se(struct cfs_rq *cfs_rq)
 {
 	struct sched_entity *se, *tmp;
@@ -1294,7 +1421,7 @@ static inline void check_expellee_se(struct cfs_rq *cfs_rq)
 		if (rq_on_expel(rq_of(cfs_rq)) && expellee_se(se))
 			continue;
 
-		list_del_init(&se->expel_node);
+		expel_list_del(cfs_rq, se);
 		place_entity(cfs_rq, se, 0);
 		__enqueue_entity(cfs_rq, se);
 	}
@@ -1314,7 +1441,7 @@ static inline struct rb_node *skip_expellee_se(struct cfs_rq *cfs_rq)
 		left = rb_next(&se->run_node);
 
 		__dequeue_entity(cfs_rq, se);
-		list_add_tail(&se->expel_node, &cfs_rq->expel_list);
+		expel_list_add(cfs_rq, se);
 	}
 
 	return left;
@@ -1585,6 +1712,21 @@ static inline void id_update_exec(struct rq *rq, u64 delta_exec)
 		rq->high_exec_sum += delta_exec;
 }
 
+/* Count the wakeup preemptions only highclass gets to make */
+static inline void
+id_account_preempt(struct task_struct *curr, struct task_struct *p)
+{
+	if (is_highclass_task(p) && !is_highclass_task(curr))
+		task_cfs_rq(p)->nr_high_preempt++;
+}
+
+static inline void
+id_account_throttle(struct cfs_rq *cfs_rq, struct sched_entity *se, u64 delta)
+{
+	if (is_underclass(se))
+		cfs_rq->under_throttled_time += delta;
+}
+
 #ifdef CONFIG_SCHED_SMT
 void notify_smt_expeller(struct rq *rq, struct task_struct *p)
 {
@@ -1646,6 +1788,21 @@ unsigned int id_nr_invalid(struct rq *rq)
 
 	return 0;
 }
+
+/* Pinned to the CPU, acts like the reschedule IPI from the sibling */
+static enum hrtimer_restart expel_timer_fn(struct hrtimer *timer)
+{
+	handle_smt_expeller();
+
+	return HRTIMER_NORESTART;
+}
+
+void init_id_expel_rq(struct rq *rq)
+{
+	hrtimer_init(&rq->expel_timer, CLOCK_MONOTONIC,
+		     HRTIMER_MODE_REL_PINNED);
+	rq->expel_timer.function = expel_timer_fn;
+}
 #else
 void notify_smt_expeller(struct rq *rq, struct task_struct *p)
 {
@@ -1659,6 +1816,10 @@ unsigned int id_nr_invalid(struct rq *rq)
 {
 	return 0;
 }
+
+void init_id_expel_rq(struct rq *rq)
+{
+}
 #endif
 
 #else
@@ -1748,7 +1909,10 @@ id_idle_cpu(struct task_struct *p, int cpu, bool expellee, bool *idle)
 	if (idle)
 		*idle = is_idle;
 
-	return is_idle;
+	if (sched_core_enabled() && !sched_core_cookie_match(p, cpu))
+		return false;
+
+	return is_idle || sched_idle_cpu(cpu);
 }
 
 static inline void identity_init_cfs_rq(struct cfs_rq *cfs_rq)
@@ -1843,6 +2007,16 @@ static inline void update_under_min_vruntime(struct cfs_rq *cfs_rq)
 static inline void id_update_exec(struct rq *rq, u64 delta_exec)
 {
 }
+
+static inline void
+id_account_preempt(struct task_struct *curr, struct task_struct *p)
+{
+}
+
+static inline void
+id_account_throttle(struct cfs_rq *cfs_rq, struct sched_entity *se, u64 delta)
+{
+}
 #endif
 
 static void update_min_vruntime(struct cfs_rq *cfs_rq)
@@ -1920,7 +2094,7 @@ static void __dequeue_entity(struct cfs_rq *cfs_rq, struct sched_entity *se)
 #if defined(CONFIG_GROUP_IDENTITY) && defined(CONFIG_SCHED_SMT)
 	/* Either on list or on rb-tree */
 	if (!list_empty(&se->expel_node)) {
-		list_del_init(&se->expel_node);
+		expel_list_del(cfs_rq, se);
 		return;
 	}
 #endif
@@ -2478,6 +2652,8 @@ struct numa_group {
 	 * more by CPU use than by memory faults.
 	 */
 	unsigned long *faults_cpu;
+	/* sd_llc_id of the LLC the group is homed in, or -1 */
+	int llc_id;
 
 	CK_HOTFIX_RESERVE(1)
 	CK_HOTFIX_RESERVE(2)
@@ -2509,6 +2685,78 @@ static struct numa_group *deref_curr_numa_group(struct task_struct *p)
 static inline unsigned long group_faults_priv(struct numa_group *ng);
 static inline unsigned long group_faults_shared(struct numa_group *ng);
 
+static inline bool task_llc_affine(struct task_struct *p)
+{
+#ifdef CONFIG_FAIR_GROUP_SCHED
+	return READ_ONCE(task_group(p)->llc_affine);
+#else
+	return false;
+#endif
+}
+
+/*
+ * A numa group of LLC affine tasks is homed in an LLC of its preferred
+ * node, wakeups and load balancing then keep the tasks sharing memory
+ * there instead of spreading them over the LLCs of the node. The home is
+ * the LLC of the first task found running on the preferred node.
+ */
+static void numa_group_home_llc(struct numa_group *ng, struct task_struct *p,
+				int nid)
+{
+	int cpu = task_cpu(p);
+	int llc = READ_ONCE(ng->llc_id);
+
+	if (llc >= 0 && cpu_to_node(llc) == nid)
+		return;
+
+	if (cpu_to_node(cpu) != nid)
+		return;
+
+	WRITE_ONCE(ng->llc_id, per_cpu(sd_llc_id, cpu));
+}
+
+/* The home LLC of @p, or -1 if it has none or the group can't fit in it */
+static int task_llc_home(struct task_struct *p)
+{
+	struct numa_group *ng;
+	int llc;
+
+	if (!task_llc_affine(p))
+		return -1;
+
+	ng = deref_task_numa_group(p);
+	if (!ng)
+		return -1;
+
+	llc = READ_ONCE(ng->llc_id);
+	if (llc >= 0 && ng->nr_tasks > per_cpu(sd_llc_size, llc))
+		return -1;
+
+	return llc;
+}
+
+/*
+ * The memcg owning the task's mm may override the scan sysctls, callers
+ * make sure @p->mm is valid.
+ */
+static unsigned int task_numa_scan_size(struct task_struct *p)
+{
+	return mem_cgroup_numa_scan_param(p->mm, MEMCG_NUMA_SCAN_SIZE,
+			READ_ONCE(sysctl_numa_balancing_scan_size));
+}
+
+static unsigned int task_numa_scan_period_min(struct task_struct *p)
+{
+	return mem_cgroup_numa_scan_param(p->mm, MEMCG_NUMA_SCAN_PERIOD_MIN,
+			READ_ONCE(sysctl_numa_balancing_scan_period_min));
+}
+
+static unsigned int task_numa_scan_period_max(struct task_struct *p)
+{
+	return mem_cgroup_numa_scan_param(p->mm, MEMCG_NUMA_SCAN_PERIOD_MAX,
+			READ_ONCE(sysctl_numa_balancing_scan_period_max));
+}
+
 static unsigned int task_nr_scan_windows(struct task_struct *p)
 {
 	unsigned long rss = 0;
@@ -2519,7 +2767,8 @@ static unsigned int task_nr_scan_windows(struct task_struct *p)
 	 * by the PTE scanner and NUMA hinting faults should be trapped based
 	 * on resident pages
 	 */
-	nr_scan_pages = sysctl_numa_balancing_scan_size << (20 - PAGE_SHIFT);
+	nr_scan_pages = (unsigned long)task_numa_scan_size(p) <<
+			(20 - PAGE_SHIFT);
 	rss = get_mm_rss(p->mm);
 	if (!rss)
 		rss = nr_scan_pages;
@@ -2533,7 +2782,7 @@ static unsigned int task_nr_scan_windows(struct task_struct *p)
 
 static unsigned int task_scan_min(struct task_struct *p)
 {
-	unsigned int scan_size = READ_ONCE(sysctl_numa_balancing_scan_size);
+	unsigned int scan_size = task_numa_scan_size(p);
 	unsigned int scan, floor;
 	unsigned int windows = 1;
 
@@ -2541,7 +2790,7 @@ static unsigned int task_scan_min(struct task_struct *p)
 		windows = MAX_SCAN_WINDOW / scan_size;
 	floor = 1000 / windows;
 
-	scan = sysctl_numa_balancing_scan_period_min / task_nr_scan_windows(p);
+	scan = task_numa_scan_period_min(p) / task_nr_scan_windows(p);
 	return max_t(unsigned int, floor, scan);
 }
 
@@ -2574,7 +2823,7 @@ static unsigned int task_scan_max(struct task_struct *p)
 	struct numa_group *ng;
 
 	/* Watch for min being lower than max due to floor calculations */
-	smax = sysctl_numa_balancing_scan_period_max / task_nr_scan_windows(p);
+	smax = task_numa_scan_period_max(p) / task_nr_scan_windows(p);
 
 	/* Scale the maximum scan period with the amount of shared memory. */
 	ng = deref_curr_numa_group(p);
@@ -2859,6 +3108,18 @@ bool should_numa_migrate_memory(struct task_struct *p, struct page * page,
 	int dst_nid = cpu_to_node(dst_cpu);
 	int last_cpupid, this_cpupid;
 
+	/*
+	 * With memory tiering, a page on a slow memory node is promoted
+	 * whenever it is accessed from a top tier node, subject to the
+	 * promotion hotness filter and rate limit.  Moving it between two
+	 * slow nodes buys nothing.
+	 */
+	if (numa_promotion_enabled && !node_is_toptier(src_nid)) {
+		if (!node_is_toptier(dst_nid))
+			return false;
+		return numa_promotion_allowed(page, dst_nid);
+	}
+
 	this_cpupid = cpu_pid_to_cpupid(dst_cpu, current->pid);
 	last_cpupid = page_cpupid_xchg_last(page, this_cpupid);
 
@@ -3689,6 +3950,8 @@ static void task_numa_placement(struct task_struct *p)
 		numa_group_count_active_nodes(ng);
 		spin_unlock_irq(group_lock);
 		max_nid = preferred_group_nid(p, max_nid);
+		if (max_faults && task_llc_affine(p))
+			numa_group_home_llc(ng, p, max_nid);
 	}
 
 	if (max_faults) {
@@ -3731,6 +3994,7 @@ static void task_numa_group(struct task_struct *p, int cpupid, int flags,
 		atomic_set(&grp->refcount, 1);
 		grp->active_nodes = 1;
 		grp->max_faults_cpu = 0;
+		grp->llc_id = -1;
 		spin_lock_init(&grp->lock);
 		grp->gid = p->pid;
 		/* Second half of the array tracks nids where faults happen */
@@ -3988,6 +4252,14 @@ void task_numa_work(struct callback_head *work)
 	if (time_before(now, migrate))
 		return;
 
+	/* NUMA balancing is turned off for the memcg owning this mm */
+	if (!mem_cgroup_numa_balancing_enabled(mm)) {
+		next_scan = now +
+			msecs_to_jiffies(sysctl_numa_balancing_scan_delay);
+		cmpxchg(&mm->numa_next_scan, migrate, next_scan);
+		return;
+	}
+
 	if (p->numa_scan_period == 0) {
 		p->numa_scan_period_max = task_scan_max(p);
 		p->numa_scan_period = task_scan_start(p);
@@ -4004,7 +4276,7 @@ void task_numa_work(struct callback_head *work)
 	p->node_stamp += 2 * TICK_NSEC;
 
 	start = mm->numa_scan_offset;
-	pages = sysctl_numa_balancing_scan_size;
+	pages = task_numa_scan_size(p);
 	pages <<= 20 - PAGE_SHIFT; /* MB in pages */
 	virtpages = pages * 8;	   /* Scan up to this much virtual space */
 	if (!pages)
@@ -4178,6 +4450,11 @@ static inline void update_scan_period(struct task_struct *p, int new_cpu)
 {
 }
 
+static inline int task_llc_home(struct task_struct *p)
+{
+	return -1;
+}
+
 #endif /* CONFIG_NUMA_BALANCING */
 
 static void
@@ -5130,6 +5407,21 @@ static inline unsigned long task_util_est(struct task_struct *p)
 	return max(task_util(p), _task_util_est(p));
 }
 
+#ifdef CONFIG_UCLAMP_TASK
+/* A boosted task asks for a big CPU, a capped one is fine on a small one */
+static inline unsigned long uclamp_task_util(struct task_struct *p)
+{
+	return clamp(task_util_est(p),
+		     (unsigned long)uclamp_eff_value(p, UCLAMP_MIN),
+		     (unsigned long)uclamp_eff_value(p, UCLAMP_MAX));
+}
+#else
+static inline unsigned long uclamp_task_util(struct task_struct *p)
+{
+	return task_util_est(p);
+}
+#endif
+
 static inline void util_est_enqueue(struct cfs_rq *cfs_rq,
 				    struct task_struct *p)
 {
@@ -5820,11 +6112,98 @@ static inline u64 sched_cfs_bandwidth_slice(void)
  *
  * requires cfs_b->lock
  */
+/*
+ * Runtime pulled from the global pool is partly parked per LLC, so that the
+ * CPUs of one LLC can refill their slices under its lock instead of all of
+ * them contending cfs_b->lock. A pool is topped up to CFS_LLC_POOL_SLICES
+ * slices at most, which bounds the runtime other LLCs can't reach within a
+ * period. The pools are flushed back on every refill.
+ */
+#define CFS_LLC_POOL_SLICES	4
+
+static inline struct cfs_llc_pool *
+cfs_llc_pool(struct cfs_bandwidth *cfs_b, int cpu)
+{
+	if (!cfs_b->llc_pool)
+		return NULL;
+#ifdef CONFIG_SMP
+	cpu = per_cpu(sd_llc_id, cpu);
+#endif
+	return per_cpu_ptr(cfs_b->llc_pool, cpu);
+}
+
+/* requires cfs_b->lock */
+static void flush_cfs_llc_pools(struct cfs_bandwidth *cfs_b)
+{
+	int cpu;
+
+	if (!cfs_b->llc_pool)
+		return;
+
+	/* sd_llc_id may have changed, so look at all of them */
+	for_each_possible_cpu(cpu) {
+		struct cfs_llc_pool *pool = per_cpu_ptr(cfs_b->llc_pool, cpu);
+
+		if (!READ_ONCE(pool->runtime))
+			continue;
+
+		raw_spin_lock(&pool->lock);
+		cfs_b->runtime += pool->runtime;
+		pool->runtime = 0;
+		raw_spin_unlock(&pool->lock);
+	}
+}
+
+/* Take @amount from the LLC pool unless the period needs cfs_b->lock */
+static bool take_cfs_llc_runtime(struct cfs_bandwidth *cfs_b,
+				 struct cfs_llc_pool *pool, u64 amount)
+{
+	bool ret = false;
+
+	/* An inactive or idle period timer is restarted under cfs_b->lock */
+	if (!pool || !READ_ONCE(cfs_b->period_active) || READ_ONCE(cfs_b->idle))
+		return false;
+
+	if (READ_ONCE(pool->runtime) < amount)
+		return false;
+
+	raw_spin_lock(&pool->lock);
+	if (pool->runtime >= amount) {
+		pool->runtime -= amount;
+		ret = true;
+	}
+	raw_spin_unlock(&pool->lock);
+
+	return ret;
+}
+
+/* requires cfs_b->lock */
+static void fill_cfs_llc_pool(struct cfs_bandwidth *cfs_b,
+			      struct cfs_llc_pool *pool)
+{
+	u64 target;
+
+	if (!pool || !cfs_b->runtime)
+		return;
+
+	target = min(cfs_b->runtime,
+		     sched_cfs_bandwidth_slice() * CFS_LLC_POOL_SLICES);
+
+	raw_spin_lock(&pool->lock);
+	if (pool->runtime < target) {
+		cfs_b->runtime -= target - pool->runtime;
+		pool->runtime = target;
+	}
+	raw_spin_unlock(&pool->lock);
+}
+
 void __refill_cfs_bandwidth_runtime(struct cfs_bandwidth *cfs_b, u64 overrun)
 {
 	u64 refill, runtime;
 
 	if (cfs_b->quota != RUNTIME_INF) {
+		/* Runtime left in the LLC pools was not used */
+		flush_cfs_llc_pools(cfs_b);
 
 		if (!sysctl_sched_cfs_bw_burst_enabled) {
 			cfs_b->runtime = cfs_b->quota;
@@ -5868,11 +6247,17 @@ static int assign_cfs_rq_runtime(struct cfs_rq *cfs_rq)
 {
 	struct task_group *tg = cfs_rq->tg;
 	struct cfs_bandwidth *cfs_b = tg_cfs_bandwidth(tg);
+	struct cfs_llc_pool *pool = cfs_llc_pool(cfs_b, cpu_of(rq_of(cfs_rq)));
 	u64 amount = 0, min_amount;
 
 	/* note: this is a positive sum as runtime_remaining <= 0 */
 	min_amount = sched_cfs_bandwidth_slice() - cfs_rq->runtime_remaining;
 
+	if (take_cfs_llc_runtime(cfs_b, pool, min_amount)) {
+		cfs_rq->runtime_remaining += min_amount;
+		return 1;
+	}
+
 	raw_spin_lock(&cfs_b->lock);
 	if (cfs_b->quota == RUNTIME_INF)
 		amount = min_amount;
@@ -5883,6 +6268,8 @@ static int assign_cfs_rq_runtime(struct cfs_rq *cfs_rq)
 			amount = min(cfs_b->runtime, min_amount);
 			cfs_b->runtime -= amount;
 			cfs_b->idle = 0;
+			/* park some more for the other CPUs of this LLC */
+			fill_cfs_llc_pool(cfs_b, pool);
 		}
 	}
 	raw_spin_unlock(&cfs_b->lock);
@@ -5989,7 +6376,7 @@ static void throttle_cfs_rq(struct cfs_rq *cfs_rq)
 	struct rq *rq = rq_of(cfs_rq);
 	struct cfs_bandwidth *cfs_b = tg_cfs_bandwidth(tg);
 	struct sched_entity *se;
-	long task_delta, dequeue = 1, ei_delta;
+	long task_delta, idle_task_delta, dequeue = 1, ei_delta;
 	bool empty, immune = true;
 
 	se = tg->se[cpu_of(rq_of(cfs_rq))];
@@ -6001,6 +6388,7 @@ static void throttle_cfs_rq(struct cfs_rq *cfs_rq)
 	rcu_read_unlock();
 
 	task_delta = cfs_rq->h_nr_running;
+	idle_task_delta = cfs_rq->idle_h_nr_running;
 	for_each_sched_entity(se) {
 		struct cfs_rq *qcfs_rq = cfs_rq_of(se);
 		/* throttled entity or throttle-on-deactivate */
@@ -6012,6 +6400,7 @@ static void throttle_cfs_rq(struct cfs_rq *cfs_rq)
 			dequeue_entity(qcfs_rq, se, DEQUEUE_SLEEP);
 		}
 		qcfs_rq->h_nr_running -= task_delta;
+		qcfs_rq->idle_h_nr_running -= idle_task_delta;
 		update_nr_expel_immune(qcfs_rq, se, &immune, -ei_delta);
 
 		if (qcfs_rq->load.weight)
@@ -6055,7 +6444,7 @@ void unthrottle_cfs_rq(struct cfs_rq *cfs_rq)
 	struct rq *rq = rq_of(cfs_rq);
 	struct cfs_bandwidth *cfs_b = tg_cfs_bandwidth(tg);
 	struct sched_entity *se;
-	long task_delta, ei_delta;
+	long task_delta, idle_task_delta, ei_delta;
 
 	se = tg->se[cpu_of(rq)];
 	ei_delta = get_h_nr_expel_immune(se);
@@ -6069,6 +6458,8 @@ void unthrottle_cfs_rq(struct cfs_rq *cfs_rq)
 	list_del_rcu(&cfs_rq->throttled_list);
 	raw_spin_unlock(&cfs_b->lock);
 
+	id_account_throttle(cfs_rq, se, rq_clock(rq) - cfs_rq->throttled_clock);
+
 	/* update hierarchical throttle state */
 	walk_tg_tree_from(tg, tg_nop, tg_unthrottle_up, (void *)rq);
 
@@ -6076,6 +6467,7 @@ void unthrottle_cfs_rq(struct cfs_rq *cfs_rq)
 		return;
 
 	task_delta = cfs_rq->h_nr_running;
+	idle_task_delta = cfs_rq->idle_h_nr_running;
 	for_each_sched_entity(se) {
 		if (se->on_rq)
 			break;
@@ -6084,6 +6476,7 @@ void unthrottle_cfs_rq(struct cfs_rq *cfs_rq)
 		enqueue_entity(cfs_rq, se, ENQUEUE_WAKEUP);
 
 		cfs_rq->h_nr_running += task_delta;
+		cfs_rq->idle_h_nr_running += idle_task_delta;
 		update_nr_expel_immune(cfs_rq, se, &immune, ei_delta);
 
 		/* end evaluation on encountering a throttled cfs_rq */
@@ -6097,6 +6490,7 @@ void unthrottle_cfs_rq(struct cfs_rq *cfs_rq)
 		update_load_avg(cfs_rq, se, UPDATE_TG);
 
 		cfs_rq->h_nr_running += task_delta;
+		cfs_rq->idle_h_nr_running += idle_task_delta;
 		update_nr_expel_immune(cfs_rq, se, &immune, ei_delta);
 
 		/* end evaluation on encountering a throttled cfs_rq */
@@ -6544,6 +6938,23 @@ void start_cfs_bandwidth(struct cfs_bandwidth *cfs_b, int init)
 		__refill_cfs_bandwidth_runtime(cfs_b, overrun + 1);
 }
 
+/*
+ * Not done in init_cfs_bandwidth(), which runs for the root group before
+ * the percpu allocator is usable. The root group has no quota anyway and
+ * a group whose allocation failed just always takes cfs_b->lock.
+ */
+static void init_cfs_llc_pool(struct cfs_bandwidth *cfs_b)
+{
+	int cpu;
+
+	cfs_b->llc_pool = alloc_percpu(struct cfs_llc_pool);
+	if (!cfs_b->llc_pool)
+		return;
+
+	for_each_possible_cpu(cpu)
+		raw_spin_lock_init(&per_cpu_ptr(cfs_b->llc_pool, cpu)->lock);
+}
+
 static void destroy_cfs_bandwidth(struct cfs_bandwidth *cfs_b)
 {
 	/* init_cfs_bandwidth() was not called */
@@ -6552,6 +6963,7 @@ static void destroy_cfs_bandwidth(struct cfs_bandwidth *cfs_b)
 
 	hrtimer_cancel(&cfs_b->period_timer);
 	hrtimer_cancel(&cfs_b->slack_timer);
+	free_percpu(cfs_b->llc_pool);
 }
 
 /*
@@ -6646,6 +7058,7 @@ static inline int throttled_lb_pair(struct task_group *tg,
 }
 
 void init_cfs_bandwidth(struct cfs_bandwidth *cfs_b) {}
+static inline void init_cfs_llc_pool(struct cfs_bandwidth *cfs_b) {}
 
 #ifdef CONFIG_FAIR_GROUP_SCHED
 static void init_cfs_rq_runtime(struct cfs_rq *cfs_rq) {}
@@ -6724,6 +7137,7 @@ enqueue_task_fair(struct rq *rq, struct task_struct *p, int flags)
 	bool immune = true;
 	struct cfs_rq *cfs_rq;
 	struct sched_entity *se = &p->se;
+	int idle_h_nr_running = idle_policy(p->policy);
 
 	/*
 	 * The code below (indirectly) updates schedutil which looks at
@@ -6764,6 +7178,7 @@ enqueue_task_fair(struct rq *rq, struct task_struct *p, int flags)
 			break;
 		}
 		cfs_rq->h_nr_running++;
+		cfs_rq->idle_h_nr_running += idle_h_nr_running;
 		update_nr_expel_immune(cfs_rq, se, &immune, 1);
 
 		flags = ENQUEUE_WAKEUP;
@@ -6772,6 +7187,7 @@ enqueue_task_fair(struct rq *rq, struct task_struct *p, int flags)
 	for_each_sched_entity(se) {
 		cfs_rq = cfs_rq_of(se);
 		cfs_rq->h_nr_running++;
+		cfs_rq->idle_h_nr_running += idle_h_nr_running;
 		update_nr_expel_immune(cfs_rq, se, &immune, 1);
 
 		if (cfs_rq_throttled(cfs_rq))
@@ -6826,6 +7242,7 @@ static void dequeue_task_fair(struct rq *rq, struct task_struct *p, int flags)
 	struct cfs_rq *cfs_rq;
 	struct sched_entity *se = &p->se;
 	int task_sleep = flags & DEQUEUE_SLEEP;
+	int idle_h_nr_running = idle_policy(p->policy);
 
 	for_each_sched_entity(se) {
 		cfs_rq = cfs_rq_of(se);
@@ -6848,6 +7265,7 @@ static void dequeue_task_fair(struct rq *rq, struct task_struct *p, int flags)
 			break;
 		}
 		cfs_rq->h_nr_running--;
+		cfs_rq->idle_h_nr_running -= idle_h_nr_running;
 		update_nr_expel_immune(cfs_rq, se, &immune, -1);
 
 		/* Don't dequeue parent if it has other entities besides us */
@@ -6868,6 +7286,7 @@ static void dequeue_task_fair(struct rq *rq, struct task_struct *p, int flags)
 	for_each_sched_entity(se) {
 		cfs_rq = cfs_rq_of(se);
 		cfs_rq->h_nr_running--;
+		cfs_rq->idle_h_nr_running -= idle_h_nr_running;
 		update_nr_expel_immune(cfs_rq, se, &immune, -1);
 
 		if (cfs_rq_throttled(cfs_rq))
@@ -7546,10 +7965,11 @@ static int select_idle_cpu(struct task_struct *p, struct sched_domain *sd, int t
 		 * Here is the best opportunity to locate a real
 		 * idle CPU for seeker, so consider id idle cpu as
 		 * a backup option, which will be pick only when
-		 * failed to locate a real idle one.
+		 * failed to locate a real idle one. A CPU running
+		 * only SCHED_IDLE tasks is a backup for everyone.
 		 */
 		if (id_idle_cpu(p, cpu, is_expellee, &idle)) {
-			if (idle || !is_seeker)
+			if (idle || (!is_seeker && !sched_idle_cpu(cpu)))
 				break;
 			id_backup = cpu;
 		}
@@ -7780,7 +8200,7 @@ static int wake_cap(struct task_struct *p, int cpu, int prev_cpu)
 	/* Bring task utilization in sync with prev_cpu */
 	sync_entity_load_avg(&p->se);
 
-	return min_cap * 1024 < task_util(p) * capacity_margin;
+	return min_cap * 1024 < uclamp_task_util(p) * capacity_margin;
 }
 
 /*
@@ -7844,6 +8264,12 @@ select_task_rq_fair(struct task_struct *p, int prev_cpu, int sd_flag, int wake_f
 		new_cpu = find_idlest_cpu(sd, p, cpu, prev_cpu, sd_flag);
 	} else if (sd_flag & SD_BALANCE_WAKE) { /* XXX always ? */
 		/* Fast path */
+		int llc = task_llc_home(p);
+
+		/* Affine wakeups must not pull it out of its home LLC */
+		if (llc >= 0 && !cpus_share_cache(new_cpu, llc) &&
+		    cpus_share_cache(prev_cpu, llc))
+			new_cpu = prev_cpu;
 
 		new_cpu = select_idle_sibling(p, prev_cpu, new_cpu);
 
@@ -8080,6 +8506,7 @@ static void check_preempt_wakeup(struct rq *rq, struct task_struct *p, int wake_
 		 */
 		if (!next_buddy_marked)
 			set_next_buddy(pse);
+		id_account_preempt(curr, p);
 		goto preempt;
 	}
 
@@ -8568,12 +8995,39 @@ static int migrate_degrades_locality(struct task_struct *p, struct lb_env *env)
 	return dst_weight < src_weight;
 }
 
+/*
+ * Returns 1, if task migration takes the task out of its home LLC,
+ *	   0, if task migration brings the task back to its home LLC,
+ *	  -1, if the task has no home LLC or it isn't affected.
+ */
+static int migrate_degrades_llc(struct task_struct *p, struct lb_env *env)
+{
+	int llc = task_llc_home(p);
+	bool src_home, dst_home;
+
+	if (llc < 0)
+		return -1;
+
+	src_home = cpus_share_cache(env->src_cpu, llc);
+	dst_home = cpus_share_cache(env->dst_cpu, llc);
+	if (src_home == dst_home)
+		return -1;
+
+	return src_home;
+}
+
 #else
 static inline int migrate_degrades_locality(struct task_struct *p,
 					     struct lb_env *env)
 {
 	return -1;
 }
+
+static inline int migrate_degrades_llc(struct task_struct *p,
+				       struct lb_env *env)
+{
+	return -1;
+}
 #endif
 
 /*
@@ -8641,11 +9095,13 @@ int can_migrate_task(struct task_struct *p, struct lb_env *env)
 
 	/*
 	 * Aggressive migration if:
-	 * 1) destination numa is preferred
+	 * 1) destination numa or LLC is preferred
 	 * 2) task is cache cold, or
 	 * 3) too many balance attempts have failed.
 	 */
 	tsk_cache_hot = migrate_degrades_locality(p, env);
+	if (tsk_cache_hot == -1)
+		tsk_cache_hot = migrate_degrades_llc(p, env);
 	if (tsk_cache_hot == -1)
 		tsk_cache_hot = task_hot(p, env);
 
@@ -11638,6 +12094,7 @@ static void fair_sched_cache_init(struct task_group *tg, struct task_group *pare
 	tg->shares = NICE_0_LOAD;
 
 	init_cfs_bandwidth(tg_cfs_bandwidth(tg));
+	init_cfs_llc_pool(tg_cfs_bandwidth(tg));
 
 	for_each_possible_cpu(i)
 		init_tg_cfs_entry(tg, tg->cfs_rq[i], tg->se[i], i, parent->se[i]);
@@ -11712,6 +12169,7 @@ int alloc_fair_sched_group(struct task_group *tg, struct task_group *parent)
 #endif
 
 	init_cfs_bandwidth(tg_cfs_bandwidth(tg));
+	init_cfs_llc_pool(tg_cfs_bandwidth(tg));
 
 	for_each_possible_cpu(i) {
 		cfs_rq = kzalloc_node(sizeof(struct cfs_rq),
@@ -11946,6 +12404,10 @@ const struct sched_class fair_sched_class = {
 	.update_nr_uninterruptible = update_nr_uninterruptible_fair,
 	.update_nr_iowait	= update_nr_iowait_fair,
 #endif
+
+#ifdef CONFIG_UCLAMP_TASK
+	.uclamp_enabled		= 1,
+#endif
 };
 
 #ifdef CONFIG_SCHED_DEBUG
@@ -13,8 +13,20 @@ EXPORT_SYMBOL_GPL(housekeeping_overriden);
 static cpumask_var_t housekeeping_mask;
 static unsigned int housekeeping_flags;
 
+#ifdef CONFIG_CGROUP_SCHED
+static const struct cpumask *dyn_housekeeping_mask(enum hk_flags flags);
+#endif
+
 int housekeeping_any_cpu(enum hk_flags flags)
 {
+#ifdef CONFIG_CGROUP_SCHED
+	if (static_branch_unlikely(&dyn_isolcpus_enabled)) {
+		const struct cpumask *mask = dyn_housekeeping_mask(flags);
+
+		if (mask)
+			return cpumask_any_and(mask, cpu_online_mask);
+	}
+#endif
 	if (static_branch_unlikely(&housekeeping_overriden))
 		if (housekeeping_flags & flags)
 			return cpumask_any_and(housekeeping_mask, cpu_online_mask);
@@ -29,23 +41,46 @@ EXPORT_SYMBOL_GPL(housekeeping_any_cpu);
  * dyn_isolated -- isolated CPUs for wild tasks.
  *
  * dyn_possible -- possible CPUs for dynamical isolation.
+ *
+ * dyn_partitioned -- CPUs of the isolated cpuset partitions, which are
+ *		      isolated like dyn_isolated and also kept free of
+ *		      timers and other housekeeping work.
+ *
+ * dyn_hk_allowed -- housekeeping CPUs left by the isolated partitions.
  */
 static cpumask_var_t dyn_allowed;
 static cpumask_var_t dyn_isolated;
 static cpumask_var_t dyn_possible;
+static cpumask_var_t dyn_partitioned;
+static cpumask_var_t dyn_hk_allowed;
+static bool dyn_partitions;
 
 static bool dyn_isolcpus_ready;
 
 DEFINE_STATIC_KEY_FALSE(dyn_isolcpus_enabled);
 EXPORT_SYMBOL_GPL(dyn_isolcpus_enabled);
+
+#define DYN_HK_FLAGS	(HK_FLAG_TIMER | HK_FLAG_MISC | HK_FLAG_WQ)
+
+static const struct cpumask *dyn_housekeeping_mask(enum hk_flags flags)
+{
+	if (flags & HK_FLAG_DOMAIN)
+		return dyn_allowed;
+	if ((flags & DYN_HK_FLAGS) && READ_ONCE(dyn_partitions))
+		return dyn_hk_allowed;
+	return NULL;
+}
 #endif
 
 const struct cpumask *housekeeping_cpumask(enum hk_flags flags)
 {
 #ifdef CONFIG_CGROUP_SCHED
-	if (static_branch_unlikely(&dyn_isolcpus_enabled))
-		if (flags & HK_FLAG_DOMAIN)
-			return dyn_allowed;
+	if (static_branch_unlikely(&dyn_isolcpus_enabled)) {
+		const struct cpumask *mask = dyn_housekeeping_mask(flags);
+
+		if (mask)
+			return mask;
+	}
 #endif
 
 	if (static_branch_unlikely(&housekeeping_overriden))
@@ -67,9 +102,12 @@ EXPORT_SYMBOL_GPL(housekeeping_affine);
 bool housekeeping_test_cpu(int cpu, enum hk_flags flags)
 {
 #ifdef CONFIG_CGROUP_SCHED
-	if (static_branch_unlikely(&dyn_isolcpus_enabled))
-		if (flags & HK_FLAG_DOMAIN)
-			return cpumask_test_cpu(cpu, dyn_allowed);
+	if (static_branch_unlikely(&dyn_isolcpus_enabled)) {
+		const struct cpumask *mask = dyn_housekeeping_mask(flags);
+
+		if (mask)
+			return cpumask_test_cpu(cpu, mask);
+	}
 #endif
 
 	if (static_branch_unlikely(&housekeeping_overriden))
@@ -85,6 +123,8 @@ static inline void free_dyn_masks(void)
 	free_cpumask_var(dyn_allowed);
 	free_cpumask_var(dyn_isolated);
 	free_cpumask_var(dyn_possible);
+	free_cpumask_var(dyn_partitioned);
+	free_cpumask_var(dyn_hk_allowed);
 }
 #endif
 
@@ -93,7 +133,9 @@ void __init housekeeping_init(void)
 #ifdef CONFIG_CGROUP_SCHED
 	if (zalloc_cpumask_var(&dyn_allowed, GFP_KERNEL) &&
 	    zalloc_cpumask_var(&dyn_isolated, GFP_KERNEL) &&
-	    zalloc_cpumask_var(&dyn_possible, GFP_KERNEL)) {
+	    zalloc_cpumask_var(&dyn_possible, GFP_KERNEL) &&
+	    zalloc_cpumask_var(&dyn_partitioned, GFP_KERNEL) &&
+	    zalloc_cpumask_var(&dyn_hk_allowed, GFP_KERNEL)) {
 		cpumask_copy(dyn_allowed, cpu_possible_mask);
 		cpumask_copy(dyn_possible, cpu_possible_mask);
 		dyn_isolcpus_ready = true;
@@ -249,74 +291,140 @@ void update_wilds_cpumask(cpumask_var_t new_allowed, cpumask_var_t old_allowed)
 
 static DEFINE_MUTEX(dyn_isolcpus_mutex);
 
-static ssize_t write_dyn_isolcpus(struct file *file, const char __user *buf,
-					size_t count, loff_t *ppos)
+/*
+ * Isolate @isolated, written to /proc/dyn_isolcpus, and @partitioned, the
+ * CPUs of the isolated cpuset partitions, from wild tasks, sched domains
+ * and unbound workqueues.  @partitioned also stops taking timers and other
+ * housekeeping work.  Without @commit only check that some online CPU is
+ * left for all of that.
+ *
+ * The caller rebuilds the sched domains.
+ */
+static int dyn_isolcpus_apply(const struct cpumask *isolated,
+			      const struct cpumask *partitioned, bool commit)
 {
-	int ret = count;
-	cpumask_var_t isolated;
-	cpumask_var_t new_allowed;
-	cpumask_var_t old_allowed;
+	cpumask_var_t new_allowed, old_allowed, hk_allowed;
+	int ret = -ENOMEM;
 
-	mutex_lock(&dyn_isolcpus_mutex);
+	lockdep_assert_held(&dyn_isolcpus_mutex);
 
-	if (!zalloc_cpumask_var(&isolated, GFP_KERNEL)) {
-		ret = -ENOMEM;
-		goto out;
-	}
-
-	if (!zalloc_cpumask_var(&new_allowed, GFP_KERNEL)) {
-		ret = -ENOMEM;
-		goto free_isolated;
-	}
-
-	if (!zalloc_cpumask_var(&old_allowed, GFP_KERNEL)) {
-		ret = -ENOMEM;
+	if (!zalloc_cpumask_var(&new_allowed, GFP_KERNEL))
+		return ret;
+	if (!zalloc_cpumask_var(&old_allowed, GFP_KERNEL))
 		goto free_new_allowed;
-	}
+	if (!zalloc_cpumask_var(&hk_allowed, GFP_KERNEL))
+		goto free_old_allowed;
 
-	if (cpumask_parselist_user(buf, count, isolated)) {
-		ret = -EINVAL;
-		goto free_all;
-	}
+	/* At least reserve one for wild tasks to run */
+	cpumask_or(new_allowed, isolated, partitioned);
+	cpumask_andnot(new_allowed, dyn_possible, new_allowed);
 
-	if (!cpumask_subset(isolated, dyn_possible)) {
-		ret = -EINVAL;
+	/* and one for the housekeeping work */
+	if (static_branch_unlikely(&housekeeping_overriden) &&
+	    (housekeeping_flags & HK_FLAG_TIMER))
+		cpumask_andnot(hk_allowed, housekeeping_mask, partitioned);
+	else
+		cpumask_andnot(hk_allowed, cpu_possible_mask, partitioned);
+
+	ret = -EINVAL;
+	if (!cpumask_intersects(new_allowed, cpu_online_mask) ||
+	    !cpumask_intersects(hk_allowed, cpu_online_mask))
 		goto free_all;
-	}
 
-	/* At least reserve one for wild tasks to run */
-	cpumask_andnot(new_allowed, dyn_possible, isolated);
-	if (!cpumask_intersects(new_allowed, cpu_online_mask)) {
-		ret = -EINVAL;
+	ret = 0;
+	if (!commit)
 		goto free_all;
-	}
 
 	cpumask_copy(old_allowed, dyn_allowed);
 	cpumask_copy(dyn_allowed, new_allowed);
-	cpumask_copy(dyn_isolated, isolated);
-
-	if (cpumask_empty(dyn_isolated))
+	cpumask_copy(dyn_hk_allowed, hk_allowed);
+	if (isolated != dyn_isolated)
+		cpumask_copy(dyn_isolated, isolated);
+	if (partitioned != dyn_partitioned)
+		cpumask_copy(dyn_partitioned, partitioned);
+	WRITE_ONCE(dyn_partitions, !cpumask_empty(dyn_partitioned));
+
+	if (cpumask_empty(dyn_isolated) && cpumask_empty(dyn_partitioned))
 		static_branch_disable(&dyn_isolcpus_enabled);
 	else
 		static_branch_enable(&dyn_isolcpus_enabled);
 
 	update_wilds_cpumask(new_allowed, old_allowed);
-
-	rebuild_sched_domains();
 	workqueue_set_unbound_cpumask(new_allowed);
 
 free_all:
+	free_cpumask_var(hk_allowed);
+free_old_allowed:
 	free_cpumask_var(old_allowed);
 free_new_allowed:
 	free_cpumask_var(new_allowed);
-free_isolated:
-	free_cpumask_var(isolated);
-out:
+	return ret;
+}
+
+/*
+ * Called by the cpuset code with cpuset_mutex held, with all the CPUs of
+ * the isolated partitions.
+ */
+bool dyn_isolcpus_cpuset_check(const struct cpumask *isolated)
+{
+	int ret;
+
+	if (!dyn_isolcpus_ready)
+		return cpumask_empty(isolated);
+
+	mutex_lock(&dyn_isolcpus_mutex);
+	ret = dyn_isolcpus_apply(dyn_isolated, isolated, false);
+	mutex_unlock(&dyn_isolcpus_mutex);
+
+	return !ret;
+}
+
+int dyn_isolcpus_cpuset_update(const struct cpumask *isolated)
+{
+	int ret;
+
+	if (!dyn_isolcpus_ready)
+		return cpumask_empty(isolated) ? 0 : -ENODEV;
+
+	mutex_lock(&dyn_isolcpus_mutex);
+	ret = 0;
+	if (!cpumask_equal(isolated, dyn_partitioned))
+		ret = dyn_isolcpus_apply(dyn_isolated, isolated, true);
 	mutex_unlock(&dyn_isolcpus_mutex);
 
 	return ret;
 }
 
+static ssize_t write_dyn_isolcpus(struct file *file, const char __user *buf,
+					size_t count, loff_t *ppos)
+{
+	int ret = count, err;
+	cpumask_var_t isolated;
+
+	if (!zalloc_cpumask_var(&isolated, GFP_KERNEL))
+		return -ENOMEM;
+
+	if (cpumask_parselist_user(buf, count, isolated) ||
+	    !cpumask_subset(isolated, dyn_possible)) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	mutex_lock(&dyn_isolcpus_mutex);
+	err = dyn_isolcpus_apply(isolated, dyn_partitioned, true);
+	if (err)
+		ret = err;
+	mutex_unlock(&dyn_isolcpus_mutex);
+
+	/* cpuset_mutex nests outside of dyn_isolcpus_mutex */
+	if (ret > 0)
+		rebuild_sched_domains();
+out:
+	free_cpumask_var(isolated);
+
+	return ret;
+}
+
 static const struct file_operations proc_dyn_isolcpus_operations = {
 	.open		= dyn_isolcpus_open,
 	.read		= seq_read,
@@ -139,6 +139,7 @@
 #include <linux/ctype.h>
 #include <linux/file.h>
 #include <linux/poll.h>
+#include <linux/kfifo.h>
 #include <linux/psi.h>
 #include "sched.h"
 
@@ -166,6 +167,7 @@ __setup("psi=", setup_psi);
 
 /* PSI trigger definitions */
 #define WINDOW_MIN_US 500000	/* Min window size is 500ms */
+#define WINDOW_MIN_PRIV_US 50000	/* 50ms with CAP_SYS_RESOURCE */
 #define WINDOW_MAX_US 10000000	/* Max window size is 10s */
 #define UPDATES_PER_WINDOW 10	/* 10 updates per window */
 
@@ -180,6 +182,31 @@ struct psi_group psi_system = {
 
 static void psi_avgs_work(struct work_struct *work);
 
+/*
+ * A monitor is an open /proc/pressure/monitor file. Triggers created with
+ * its fd report the cookie they were given into its ring, so one reader
+ * can watch the triggers of many cgroups without polling each file.
+ */
+#define PSI_MONITOR_RING 1024
+
+struct psi_monitor {
+	struct kref refcount;
+	spinlock_t lock;
+	DECLARE_KFIFO(ring, u64, PSI_MONITOR_RING);
+	wait_queue_head_t wait;
+	/* events lost to a full ring, reported and reset by read */
+	unsigned long dropped;
+};
+
+static void psi_monitor_push(struct psi_monitor *m, u64 cookie)
+{
+	spin_lock(&m->lock);
+	if (!kfifo_put(&m->ring, cookie))
+		m->dropped++;
+	spin_unlock(&m->lock);
+	wake_up_interruptible(&m->wait);
+}
+
 static void group_init(struct psi_group *group)
 {
 	int cpu;
@@ -538,6 +565,8 @@ static u64 update_triggers(struct psi_group *group, u64 now)
 		/* Generate an event */
 		if (cmpxchg(&t->event, 0, 1) == 0)
 			wake_up_interruptible(&t->event_wait);
+		if (t->monitor)
+			psi_monitor_push(t->monitor, t->cookie);
 		t->last_event_time = now;
 	}
 
@@ -1064,28 +1093,73 @@ static int psi_cpu_open(struct inode *inode, struct file *file)
 	return single_open(file, psi_cpu_show, NULL);
 }
 
+static const struct file_operations psi_monitor_fops;
+
+static struct psi_monitor *psi_monitor_get(int fd)
+{
+	struct psi_monitor *m;
+	struct fd f = fdget(fd);
+
+	if (!f.file)
+		return ERR_PTR(-EBADF);
+
+	if (f.file->f_op != &psi_monitor_fops) {
+		fdput(f);
+		return ERR_PTR(-EINVAL);
+	}
+
+	m = f.file->private_data;
+	kref_get(&m->refcount);
+	fdput(f);
+
+	return m;
+}
+
+static void psi_monitor_free(struct kref *ref)
+{
+	kfree(container_of(ref, struct psi_monitor, refcount));
+}
+
+/*
+ * Trigger format: "<some|full> <threshold_us> <window_us> [<fd> <cookie>]",
+ * where the optional <fd> is an open /proc/pressure/monitor file to which
+ * <cookie> is reported on every event.
+ */
 struct psi_trigger *psi_trigger_create(struct psi_group *group,
 			char *buf, size_t nbytes, enum psi_res res)
 {
+	struct psi_monitor *monitor = NULL;
 	struct psi_trigger *t;
 	enum psi_states state;
 	u32 threshold_us;
 	u32 window_us;
+	u64 cookie = 0;
+	int nargs, fd;
 
 	if (static_branch_likely(&psi_disabled))
 		return ERR_PTR(-EOPNOTSUPP);
 
-	if (sscanf(buf, "some %u %u", &threshold_us, &window_us) == 2)
+	nargs = sscanf(buf, "some %u %u %d %llu",
+		       &threshold_us, &window_us, &fd, &cookie);
+	if (nargs >= 2) {
 		state = PSI_IO_SOME + res * 2;
-	else if (sscanf(buf, "full %u %u", &threshold_us, &window_us) == 2)
+	} else {
+		nargs = sscanf(buf, "full %u %u %d %llu",
+			       &threshold_us, &window_us, &fd, &cookie);
+		if (nargs < 2)
+			return ERR_PTR(-EINVAL);
 		state = PSI_IO_FULL + res * 2;
-	else
+	}
+
+	if (nargs == 3)
 		return ERR_PTR(-EINVAL);
 
 	if (state >= PSI_NONIDLE)
 		return ERR_PTR(-EINVAL);
 
-	if (window_us < WINDOW_MIN_US ||
+	/* Short windows poll often, only allow them to privileged users */
+	if (window_us < WINDOW_MIN_PRIV_US ||
+	    (window_us < WINDOW_MIN_US && !capable(CAP_SYS_RESOURCE)) ||
 		window_us > WINDOW_MAX_US)
 		return ERR_PTR(-EINVAL);
 
@@ -1093,9 +1167,21 @@ struct psi_trigger *psi_trigger_create(struct psi_group *group,
 	if (threshold_us == 0 || threshold_us > window_us)
 		return ERR_PTR(-EINVAL);
 
+	if (nargs == 4) {
+		monitor = psi_monitor_get(fd);
+		if (IS_ERR(monitor))
+			return ERR_CAST(monitor);
+	}
+
 	t = kmalloc(sizeof(*t), GFP_KERNEL);
-	if (!t)
+	if (!t) {
+		if (monitor)
+			kref_put(&monitor->refcount, psi_monitor_free);
 		return ERR_PTR(-ENOMEM);
+	}
+
+	t->monitor = monitor;
+	t->cookie = cookie;
 
 	t->group = group;
 	t->state = state;
@@ -1118,6 +1204,8 @@ struct psi_trigger *psi_trigger_create(struct psi_group *group,
 
 		kworker = kthread_create_worker(0, "psimon");
 		if (IS_ERR(kworker)) {
+			if (monitor)
+				kref_put(&monitor->refcount, psi_monitor_free);
 			kfree(t);
 			mutex_unlock(&group->trigger_lock);
 			return ERR_CAST(kworker);
@@ -1203,6 +1291,8 @@ static void psi_trigger_destroy(struct kref *ref)
 
 		kthread_destroy_worker(kworker_to_destroy);
 	}
+	if (t->monitor)
+		kref_put(&t->monitor->refcount, psi_monitor_free);
 	kfree(t);
 }
 
@@ -1251,7 +1341,7 @@ __poll_t psi_trigger_poll(void **trigger_ptr,
 static ssize_t psi_write(struct file *file, const char __user *user_buf,
 			 size_t nbytes, enum psi_res res)
 {
-	char buf[32];
+	char buf[64];
 	size_t buf_size;
 	struct seq_file *seq;
 	struct psi_trigger *new;
@@ -1341,6 +1431,98 @@ static const struct file_operations psi_cpu_fops = {
 	.release        = psi_fop_release,
 };
 
+static int psi_monitor_open(struct inode *inode, struct file *file)
+{
+	struct psi_monitor *m;
+
+	if (static_branch_likely(&psi_disabled))
+		return -EOPNOTSUPP;
+
+	m = kzalloc(sizeof(*m), GFP_KERNEL);
+	if (!m)
+		return -ENOMEM;
+
+	kref_init(&m->refcount);
+	spin_lock_init(&m->lock);
+	INIT_KFIFO(m->ring);
+	init_waitqueue_head(&m->wait);
+	file->private_data = m;
+
+	return nonseekable_open(inode, file);
+}
+
+/*
+ * Read the cookies of the triggers that fired, as an array of u64. If the
+ * ring overflowed, the first value read afterwards is U64_MAX, which is
+ * therefore not a valid cookie.
+ */
+static ssize_t psi_monitor_read(struct file *file, char __user *ubuf,
+				size_t count, loff_t *ppos)
+{
+	struct psi_monitor *m = file->private_data;
+	u64 cookies[64];
+	unsigned int n = 0;
+	int ret;
+
+	count = min(count / sizeof(u64), ARRAY_SIZE(cookies));
+	if (!count)
+		return -EINVAL;
+
+	for (;;) {
+		spin_lock(&m->lock);
+		if (m->dropped) {
+			cookies[n++] = U64_MAX;
+			m->dropped = 0;
+		}
+		n += kfifo_out(&m->ring, cookies + n, count - n);
+		spin_unlock(&m->lock);
+
+		if (n || file->f_flags & O_NONBLOCK)
+			break;
+
+		ret = wait_event_interruptible(m->wait,
+				!kfifo_is_empty(&m->ring) || READ_ONCE(m->dropped));
+		if (ret)
+			return ret;
+	}
+
+	if (!n)
+		return -EAGAIN;
+
+	if (copy_to_user(ubuf, cookies, n * sizeof(u64)))
+		return -EFAULT;
+
+	return n * sizeof(u64);
+}
+
+static __poll_t psi_monitor_poll(struct file *file, poll_table *wait)
+{
+	struct psi_monitor *m = file->private_data;
+
+	poll_wait(file, &m->wait, wait);
+
+	if (!kfifo_is_empty(&m->ring) || READ_ONCE(m->dropped))
+		return EPOLLIN | EPOLLRDNORM;
+
+	return 0;
+}
+
+static int psi_monitor_release(struct inode *inode, struct file *file)
+{
+	struct psi_monitor *m = file->private_data;
+
+	kref_put(&m->refcount, psi_monitor_free);
+	return 0;
+}
+
+static const struct file_operations psi_monitor_fops = {
+	.open           = psi_monitor_open,
+	.read           = psi_monitor_read,
+	.llseek         = no_llseek,
+	.poll           = psi_monitor_poll,
+	.release        = psi_monitor_release,
+};
+
 static int __init psi_proc_init(void)
 {
 	if (psi_enable) {
@@ -1348,6 +1530,7 @@ static int __init psi_proc_init(void)
 		proc_create("pressure/io", 0, NULL, &psi_io_fops);
 		proc_create("pressure/memory", 0, NULL, &psi_memory_fops);
 		proc_create("pressure/cpu", 0, NULL, &psi_cpu_fops);
+		proc_create("pressure/monitor", 0, NULL, &psi_monitor_fops);
 	}
 	return 0;
 }
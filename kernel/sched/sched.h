@@ -49,6 +49,7 @@
 #include <linux/kprobes.h>
 #include <linux/kthread.h>
 #include <linux/membarrier.h>
+#include <linux/memcontrol.h>
 #include <linux/migrate.h>
 #include <linux/mmu_context.h>
 #include <linux/nmi.h>
@@ -357,6 +358,14 @@ struct rt_rq;
 
 extern struct list_head task_groups;
 
+#ifdef CONFIG_CFS_BANDWIDTH
+/* Runtime parked per LLC, see assign_cfs_rq_runtime() */
+struct cfs_llc_pool {
+	raw_spinlock_t		lock;
+	u64			runtime;
+};
+#endif
+
 struct cfs_bandwidth {
 #ifdef CONFIG_CFS_BANDWIDTH
 	raw_spinlock_t		lock;
@@ -378,6 +387,7 @@ struct cfs_bandwidth {
 	struct hrtimer		period_timer;
 	struct hrtimer		slack_timer;
 	struct list_head	throttled_cfs_rq;
+	struct cfs_llc_pool __percpu *llc_pool;
 
 	/* Statistics: */
 	int			nr_periods;
@@ -445,6 +455,38 @@ struct task_group {
 #ifdef CONFIG_HT_STABLE
 	bool			need_ht_stable;
 #endif
+#ifdef CONFIG_NUMA_BALANCING
+	/* keep tasks sharing memory in the LLC their numa group is homed in */
+	bool			llc_affine;
+#endif
+#ifdef CONFIG_SCHED_CORE
+	/* cookie written to the group, and the one its tasks carry */
+	u64			core_tag;
+	u64			core_cookie;
+#endif
+#ifdef CONFIG_CGROUP_RESCTRL
+	/* resctrl group bound through cpu.resctrl_group, NULL if none */
+	char			*resctrl_name;
+	u32			resctrl_closid;
+	u32			resctrl_rmid;
+#endif
+	/* timer slack of the tasks through cpu.timer_slack_ns, 0 if unset */
+	u64			timer_slack_ns;
+#ifdef CONFIG_UCLAMP_TASK_GROUP
+	/* The two decimal precision [%] value requested from user-space */
+	unsigned int		uclamp_pct[UCLAMP_CNT];
+	/* Clamp values requested for a task group */
+	struct uclamp_se	uclamp_req[UCLAMP_CNT];
+	/* Effective clamp values used for a task group */
+	struct uclamp_se	uclamp[UCLAMP_CNT];
+#endif
+#ifdef CONFIG_SCHED_SLI
+	/* run-queue wait histograms, used on the default hierarchy */
+	struct sched_cgroup_lat_stat_cpu __percpu *lat_stat_cpu;
+	/* load averages, calculated once cpu.loadavg has been read */
+	bool			load_calc;
+	unsigned long		avenrun[3];
+#endif
 
 	CK_HOTFIX_RESERVE(1)
 	CK_HOTFIX_RESERVE(2)
@@ -545,11 +587,13 @@ extern void notify_smt_expeller(struct rq *rq, struct task_struct *p);
 extern void handle_smt_expeller(void);
 extern unsigned int id_nr_invalid(struct rq *rq);
 extern void update_id_idle_avg(struct rq *rq, u64 delta);
+extern void init_id_expel_rq(struct rq *rq);
 #else
 static inline void notify_smt_expeller(struct rq *rq, struct task_struct *p) {}
 static inline void handle_smt_expeller(void) {}
 static inline unsigned int id_nr_invalid(struct rq *rq) { return 0; }
 static inline void update_id_idle_avg(struct rq *rq, u64 delta) {}
+static inline void init_id_expel_rq(struct rq *rq) {}
 #endif
 
 /* CFS-related fields in a runqueue */
@@ -558,6 +602,8 @@ struct cfs_rq {
 	unsigned long		runnable_weight;
 	unsigned int		nr_running;
 	unsigned int		h_nr_running;
+	/* SCHED_IDLE tasks among h_nr_running */
+	unsigned int		idle_h_nr_running;
 
 	u64			exec_clock;
 	u64			min_vruntime;
@@ -575,8 +621,14 @@ struct cfs_rq {
 	u64			expel_start;
 	unsigned int		h_nr_expel_immune;
 	struct list_head	expel_list;
+	/* time entities of this group spent expelled, for cpu.stat */
+	u64			expel_time;
 #endif
 	struct rb_root_cached	under_timeline;
+	/* wakeup preemptions by highclass tasks of this group */
+	u64			nr_high_preempt;
+	/* bandwidth throttled time of this group while underclass */
+	u64			under_throttled_time;
 #endif
 
 	/*
@@ -892,6 +944,48 @@ extern void rto_push_irq_work_func(struct irq_work *work);
 #endif
 #endif /* CONFIG_SMP */
 
+#ifdef CONFIG_UCLAMP_TASK
+/*
+ * struct uclamp_bucket - Utilization clamp bucket
+ * @value: utilization clamp value for tasks on this clamp bucket
+ * @tasks: number of RUNNABLE tasks on this clamp bucket
+ *
+ * Keep track of how many tasks are RUNNABLE for a given utilization
+ * clamp value.
+ */
+struct uclamp_bucket {
+	unsigned long value : 11;
+	unsigned long tasks : BITS_PER_LONG - 11;
+};
+
+/*
+ * struct uclamp_rq - rq's utilization clamp
+ * @value: currently active clamp values for a rq
+ * @bucket: utilization clamp buckets affecting a rq
+ *
+ * Keep track of RUNNABLE tasks on a rq to aggregate their clamp values.
+ * A clamp value is affecting a rq when there is at least one task RUNNABLE
+ * (or actually running) with that value.
+ *
+ * There are up to UCLAMP_CNT possible different clamp values, currently there
+ * are only two: minimum utilization and maximum utilization.
+ *
+ * All utilization clamping values are MAX aggregated, since:
+ * - for util_min: we want to run the CPU at least at the max of the minimum
+ *   utilization required by its currently RUNNABLE tasks.
+ * - for util_max: we want to allow the CPU to run up to the max of the
+ *   maximum utilization allowed by its currently RUNNABLE tasks.
+ *
+ * Since on each system we expect only a limited number of different
+ * utilization clamp values (UCLAMP_BUCKETS), use a simple array to track
+ * the metrics required to compute all the per-rq utilization clamp values.
+ */
+struct uclamp_rq {
+	unsigned int value;
+	struct uclamp_bucket bucket[UCLAMP_BUCKETS];
+};
+#endif /* CONFIG_UCLAMP_TASK */
+
 /*
  * This is the main, per-CPU runqueue data structure.
  *
@@ -926,6 +1020,13 @@ struct rq {
 	unsigned long		nr_load_updates;
 	u64			nr_switches;
 
+#ifdef CONFIG_UCLAMP_TASK
+	/* Utilization clamp values based on CPU's RUNNABLE tasks */
+	struct uclamp_rq	uclamp[UCLAMP_CNT] ____cacheline_aligned;
+	unsigned int		uclamp_flags;
+#define UCLAMP_FLAG_IDLE 0x01
+#endif
+
 	struct cfs_rq		cfs;
 	struct rt_rq		rt;
 	struct dl_rq		dl;
@@ -936,6 +1037,13 @@ struct rq {
 	struct list_head	*tmp_alone_branch;
 #endif /* CONFIG_FAIR_GROUP_SCHED */
 
+#ifdef CONFIG_SCHED_CORE
+	/* cookie of the fair task running here, valid if core_busy */
+	u64			core_cookie;
+	bool			core_busy;
+	unsigned long		core_forceidle;
+#endif
+
 #ifdef CONFIG_GROUP_IDENTITY
 	unsigned int		nr_high_running;
 	unsigned int		nr_under_running;
@@ -952,6 +1060,13 @@ struct rq {
 #ifdef CONFIG_SCHED_SMT
 	unsigned long		next_expel_ib;
 	unsigned long		next_expel_update;
+	/* underclass duty cycle under expel, see expel_relax() */
+	bool			expel_wanted;
+	bool			expel_relaxed;
+	s64			expel_tokens;
+	u64			expel_token_stamp;
+	u64			expel_under_stamp;
+	struct hrtimer		expel_timer;
 #endif
 #endif
 
@@ -1779,6 +1894,10 @@ extern const u32		sched_prio_to_wmult[40];
 struct sched_class {
 	const struct sched_class *next;
 
+#ifdef CONFIG_UCLAMP_TASK
+	int uclamp_enabled;
+#endif
+
 	void (*enqueue_task) (struct rq *rq, struct task_struct *p, int flags);
 	void (*dequeue_task) (struct rq *rq, struct task_struct *p, int flags);
 	void (*yield_task)   (struct rq *rq);
@@ -2430,6 +2549,48 @@ static inline unsigned long cpu_util_rt(struct rq *rq)
 }
 #endif
 
+#ifdef CONFIG_UCLAMP_TASK
+unsigned int uclamp_eff_value(struct task_struct *p, enum uclamp_id clamp_id);
+
+/*
+ * Clamp @util with the {min,max} clamps of the RUNNABLE tasks of @rq, and
+ * those of @p if given.  Since the rq clamps are MAX aggregated over tasks
+ * with different clamps, min can end up above max; min wins then.
+ */
+static __always_inline
+unsigned int uclamp_util_with(struct rq *rq, unsigned int util,
+			      struct task_struct *p)
+{
+	unsigned int min_util = READ_ONCE(rq->uclamp[UCLAMP_MIN].value);
+	unsigned int max_util = READ_ONCE(rq->uclamp[UCLAMP_MAX].value);
+
+	if (p) {
+		min_util = max(min_util, uclamp_eff_value(p, UCLAMP_MIN));
+		max_util = max(max_util, uclamp_eff_value(p, UCLAMP_MAX));
+	}
+
+	if (unlikely(min_util >= max_util))
+		return min_util;
+
+	return clamp(util, min_util, max_util);
+}
+
+static inline unsigned int uclamp_util(struct rq *rq, unsigned int util)
+{
+	return uclamp_util_with(rq, util, NULL);
+}
+#else /* CONFIG_UCLAMP_TASK */
+static inline unsigned int uclamp_util_with(struct rq *rq, unsigned int util,
+					    struct task_struct *p)
+{
+	return util;
+}
+static inline unsigned int uclamp_util(struct rq *rq, unsigned int util)
+{
+	return util;
+}
+#endif /* CONFIG_UCLAMP_TASK */
+
 #ifdef CONFIG_HAVE_SCHED_AVG_IRQ
 static inline unsigned long cpu_util_irq(struct rq *rq)
 {
@@ -2466,6 +2627,11 @@ bool async_load_calc_enabled(void);
 extern void task_ca_increase_nr_migrations(struct task_struct *tsk);
 void cpuacct_update_latency(struct sched_entity *se, u64 delta);
 void task_ca_update_block(struct task_struct *tsk, u64 runtime);
+int alloc_tg_sched_lat(struct task_group *tg);
+void free_tg_sched_lat(struct task_group *tg);
+int tg_sched_lat_show(struct seq_file *sf, struct task_group *tg);
+int tg_sched_lat_reset(struct task_group *tg);
+int tg_loadavg_show(struct seq_file *sf, struct task_group *tg);
 #else
 static inline void calc_cgroup_load(void) { }
 static inline bool async_load_calc_enabled(void)
@@ -2477,12 +2643,52 @@ static inline void cpuacct_update_latency(struct sched_entity *se,
 		u64 delta) { }
 static inline void task_ca_update_block(struct task_struct *tsk,
 		u64 runtime) { }
+static inline int alloc_tg_sched_lat(struct task_group *tg)
+{
+	return 1;
+}
+static inline void free_tg_sched_lat(struct task_group *tg) { }
 #endif
 
 #ifdef CONFIG_PSI
 extern struct cftype cgroup_v1_psi_files[];
 #endif
 
+#ifdef CONFIG_SCHED_CORE
+DECLARE_STATIC_KEY_FALSE(__sched_core_enabled);
+
+static inline bool sched_core_enabled(void)
+{
+	return static_branch_unlikely(&__sched_core_enabled);
+}
+
+extern struct task_struct *sched_core_pick(struct rq *rq,
+		struct task_struct *next, struct rq_flags *rf);
+extern void sched_core_handle_ipi(void);
+extern bool sched_core_cookie_match(struct task_struct *p, int cpu);
+extern void sched_core_online_group(struct task_group *tg);
+extern void sched_core_offline_group(struct task_group *tg);
+extern void sched_core_set_tag(struct task_group *tg, u64 cookie);
+#else
+static inline bool sched_core_enabled(void)
+{
+	return false;
+}
+
+static inline struct task_struct *sched_core_pick(struct rq *rq,
+		struct task_struct *next, struct rq_flags *rf)
+{
+	return next;
+}
+static inline void sched_core_handle_ipi(void) { }
+static inline bool sched_core_cookie_match(struct task_struct *p, int cpu)
+{
+	return true;
+}
+static inline void sched_core_online_group(struct task_group *tg) { }
+static inline void sched_core_offline_group(struct task_group *tg) { }
+#endif
+
 #ifndef CONFIG_RICH_CONTAINER_CG_SWITCH
 long tg_get_cfs_quota(struct task_group *tg);
 long tg_get_cfs_period(struct task_group *tg);
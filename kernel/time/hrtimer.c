@@ -1067,6 +1067,29 @@ hrtimer_update_softirq_timer(struct hrtimer_cpu_base *cpu_base, bool reprogram)
 	hrtimer_reprogram(cpu_base->softirq_next_timer, reprogram);
 }
 
+static enum hrtimer_restart hrtimer_wakeup(struct hrtimer *timer);
+
+/*
+ * Underclass (batch) tasks sleeping with a slack have the hard expiry of
+ * their sleep rounded down to a multiple of the largest power of two that
+ * fits in the slack.  Sleeps of similar slack that overlap then expire at
+ * the same instant and take a single interrupt, instead of each waking
+ * the CPU at the end of its own range.  The expiry stays within
+ * [@tim, @tim + @delta_ns].
+ */
+static u64 hrtimer_coalesce_slack(ktime_t tim, u64 delta_ns)
+{
+	u64 grid, hard;
+
+	if (delta_ns < 2 || delta_ns > KTIME_MAX || tim < 0 ||
+	    tim > KTIME_MAX - (s64)delta_ns || !sched_current_underclass())
+		return delta_ns;
+
+	grid = 1ULL << (fls64(delta_ns) - 1);
+	hard = tim + delta_ns;
+	return hard - (hard & (grid - 1)) - tim;
+}
+
 static int __hrtimer_start_range_ns(struct hrtimer *timer, ktime_t tim,
 				    u64 delta_ns, const enum hrtimer_mode mode,
 				    struct hrtimer_clock_base *base)
@@ -1081,6 +1104,9 @@ static int __hrtimer_start_range_ns(struct hrtimer *timer, ktime_t tim,
 
 	tim = hrtimer_update_lowres(timer, tim, mode);
 
+	if (delta_ns && timer->function == hrtimer_wakeup)
+		delta_ns = hrtimer_coalesce_slack(tim, delta_ns);
+
 	hrtimer_set_expires_range_ns(timer, tim, delta_ns);
 
 	/* Switch the timer base, if necessary: */
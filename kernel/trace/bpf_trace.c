@@ -13,6 +13,7 @@
 #include <linux/kprobes.h>
 #include <linux/syscalls.h>
 #include <linux/error-injection.h>
+#include <linux/anon_inodes.h>
 
 #include "trace_probe.h"
 #include "trace.h"
@@ -601,6 +602,12 @@ tracing_func_proto(enum bpf_func_id func_id, const struct bpf_prog *prog)
 		return &bpf_ringbuf_discard_proto;
 	case BPF_FUNC_ringbuf_query:
 		return &bpf_ringbuf_query_proto;
+	case BPF_FUNC_ringbuf_output_batch:
+		return &bpf_ringbuf_output_batch_proto;
+#ifdef CONFIG_MEMCG
+	case BPF_FUNC_memcg_exstat_add:
+		return &bpf_memcg_exstat_add_proto;
+#endif
 	default:
 		return NULL;
 	}
@@ -793,9 +800,9 @@ pe_prog_func_proto(enum bpf_func_id func_id, const struct bpf_prog *prog)
 	case BPF_FUNC_perf_event_output:
 		return &bpf_perf_event_output_proto_tp;
 	case BPF_FUNC_get_stackid:
-		return &bpf_get_stackid_proto_tp;
+		return &bpf_get_stackid_proto_pe;
 	case BPF_FUNC_get_stack:
-		return &bpf_get_stack_proto_tp;
+		return &bpf_get_stack_proto_pe;
 	case BPF_FUNC_perf_prog_read_value:
 		return &bpf_perf_prog_read_value_proto;
 	default:
@@ -923,6 +930,8 @@ raw_tp_prog_func_proto(enum bpf_func_id func_id, const struct bpf_prog *prog)
 		return &bpf_get_stackid_proto_raw_tp;
 	case BPF_FUNC_get_stack:
 		return &bpf_get_stack_proto_raw_tp;
+	case BPF_FUNC_seq_write:
+		return &bpf_seq_write_proto;
 	default:
 		return tracing_func_proto(func_id, prog);
 	}
@@ -1244,6 +1253,126 @@ int bpf_probe_unregister(struct bpf_raw_event_map *btp, struct bpf_prog *prog)
 	return tracepoint_probe_unregister(btp->tp, (void *)btp->bpf_func, prog);
 }
 
+#if defined(CONFIG_DYNAMIC_FTRACE_WITH_REGS) && defined(CONFIG_X86_64)
+/*
+ * Raw tracepoint programs attached straight to a function's fentry call
+ * with an ftrace_ops of their own, as BPF_RAW_TRACEPOINT_OPEN of
+ * "fentry/<function>".  With nothing else tracing the function ftrace
+ * calls bpf_fentry_func() from a trampoline made for the ops, so there's
+ * no int3, no kprobe lookup and no ops list walk on the way.  As for a raw
+ * tracepoint ctx is an array of u64, holding the function's register
+ * arguments.
+ */
+#define BPF_FENTRY_NR_ARGS	6
+
+struct bpf_fentry {
+	struct ftrace_ops ops;
+	struct bpf_prog *prog;
+};
+
+static void notrace bpf_fentry_func(unsigned long ip, unsigned long parent_ip,
+				    struct ftrace_ops *op, struct pt_regs *regs)
+{
+	struct bpf_fentry *fentry = container_of(op, struct bpf_fentry, ops);
+	u64 args[BPF_FENTRY_NR_ARGS];
+
+	preempt_disable_notrace();
+	if (unlikely(__this_cpu_inc_return(bpf_prog_active) != 1))
+		goto out;
+
+	args[0] = regs->di;
+	args[1] = regs->si;
+	args[2] = regs->dx;
+	args[3] = regs->cx;
+	args[4] = regs->r8;
+	args[5] = regs->r9;
+
+	rcu_read_lock();
+	(void) BPF_PROG_RUN(fentry->prog, args);
+	rcu_read_unlock();
+out:
+	__this_cpu_dec(bpf_prog_active);
+	preempt_enable_notrace();
+}
+
+static int bpf_fentry_release(struct inode *inode, struct file *filp)
+{
+	struct bpf_fentry *fentry = filp->private_data;
+
+	/* waits for the trampoline and the callers in it to be gone */
+	unregister_ftrace_function(&fentry->ops);
+	ftrace_free_filter(&fentry->ops);
+	bpf_prog_put(fentry->prog);
+	kfree(fentry);
+	return 0;
+}
+
+static const struct file_operations bpf_fentry_fops = {
+	.release	= bpf_fentry_release,
+};
+
+int bpf_fentry_open(const char *func, u32 prog_fd)
+{
+	struct bpf_fentry *fentry;
+	struct bpf_prog *prog;
+	char name[KSYM_NAME_LEN];
+	int fd, err;
+
+	/* one function: no globs, no module: or command syntax */
+	if (!*func || strpbrk(func, "*?[]!:") ||
+	    strscpy(name, func, sizeof(name)) < 0)
+		return -EINVAL;
+
+	prog = bpf_prog_get_type(prog_fd, BPF_PROG_TYPE_RAW_TRACEPOINT);
+	if (IS_ERR(prog))
+		return PTR_ERR(prog);
+
+	err = -EINVAL;
+	if (prog->aux->max_ctx_offset > BPF_FENTRY_NR_ARGS * sizeof(u64))
+		goto out_put_prog;
+
+	err = -ENOMEM;
+	fentry = kzalloc(sizeof(*fentry), GFP_USER);
+	if (!fentry)
+		goto out_put_prog;
+	fentry->prog = prog;
+	fentry->ops.func = bpf_fentry_func;
+	/* not called where rcu_read_lock() would mean nothing */
+	fentry->ops.flags = FTRACE_OPS_FL_SAVE_REGS | FTRACE_OPS_FL_RCU;
+
+	err = ftrace_set_filter(&fentry->ops, (unsigned char *)name,
+				strlen(name), 1);
+	if (err)
+		goto out_free;
+
+	err = register_ftrace_function(&fentry->ops);
+	if (err)
+		goto out_free_filter;
+
+	fd = anon_inode_getfd("bpf-fentry", &bpf_fentry_fops, fentry,
+			      O_CLOEXEC);
+	if (fd < 0) {
+		err = fd;
+		unregister_ftrace_function(&fentry->ops);
+		goto out_free_filter;
+	}
+	return fd;
+
+out_free_filter:
+	ftrace_free_filter(&fentry->ops);
+out_free:
+	kfree(fentry);
+out_put_prog:
+	bpf_prog_put(prog);
+	return err;
+}
+#else
+int bpf_fentry_open(const char *func, u32 prog_fd)
+{
+	return -EOPNOTSUPP;
+}
+#endif /* CONFIG_DYNAMIC_FTRACE_WITH_REGS && CONFIG_X86_64 */
+
 int bpf_get_perf_event_info(const struct perf_event *event, u32 *prog_id,
 			    u32 *fd_type, const char **buf,
 			    u64 *probe_offset, u64 *probe_addr)
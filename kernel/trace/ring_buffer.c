@@ -24,6 +24,8 @@
 #include <linux/list.h>
 #include <linux/cpu.h>
 #include <linux/oom.h>
+#include <linux/mm.h>
+#include <uapi/linux/trace_mmap.h>
 
 #include <asm/local.h>
 
@@ -330,6 +332,7 @@ struct buffer_page {
 	unsigned	 read;		/* index for next read */
 	local_t		 entries;	/* entries on this page */
 	unsigned long	 real_end;	/* real end of data */
+	unsigned	 id;		/* sub-buffer ID in a mapping */
 	struct buffer_data_page *page;	/* Actual data page */
 };
 
@@ -498,6 +501,12 @@ struct ring_buffer_per_cpu {
 	struct completion		update_done;
 
 	struct rb_irq_work		irq_work;
+
+	/* user space mappings of the buffer, see ring_buffer_map() */
+	struct mutex			mapping_lock;
+	unsigned int			mapped;
+	unsigned long			*subbuf_ids;	/* ID to data page */
+	struct trace_buffer_meta	*meta_page;
 };
 
 struct ring_buffer {
@@ -1280,6 +1289,7 @@ rb_allocate_cpu_buffer(struct ring_buffer *buffer, long nr_pages, int cpu)
 	init_irq_work(&cpu_buffer->irq_work.work, rb_wake_up_waiters);
 	init_waitqueue_head(&cpu_buffer->irq_work.waiters);
 	init_waitqueue_head(&cpu_buffer->irq_work.full_waiters);
+	mutex_init(&cpu_buffer->mapping_lock);
 
 	bpage = kzalloc_node(ALIGN(sizeof(*bpage), cache_line_size()),
 			    GFP_KERNEL, cpu_to_node(cpu));
@@ -1724,6 +1734,12 @@ int ring_buffer_resize(struct ring_buffer *buffer, unsigned long size,
 	/* prevent another thread from changing buffer sizes */
 	mutex_lock(&buffer->mutex);
 
+	/* ring_buffer_map() disables resizing with the mutex held */
+	if (atomic_read(&buffer->resize_disabled)) {
+		mutex_unlock(&buffer->mutex);
+		return -EBUSY;
+	}
+
 	if (cpu_id == RING_BUFFER_ALL_CPUS) {
 		/* calculate the pages to update */
 		for_each_buffer_cpu(buffer, cpu) {
@@ -4325,6 +4341,26 @@ unsigned long ring_buffer_size(struct ring_buffer *buffer, int cpu)
 }
 EXPORT_SYMBOL_GPL(ring_buffer_size);
 
+/*
+ * Publish the reader page and the counters on the meta page.  Called with
+ * the reader_lock held.
+ */
+static void rb_update_meta_page(struct ring_buffer_per_cpu *cpu_buffer)
+{
+	struct trace_buffer_meta *meta = cpu_buffer->meta_page;
+
+	WRITE_ONCE(meta->reader.read, cpu_buffer->reader_page->read);
+	WRITE_ONCE(meta->reader.id, cpu_buffer->reader_page->id);
+	WRITE_ONCE(meta->reader.lost_events, cpu_buffer->lost_events);
+
+	WRITE_ONCE(meta->entries, local_read(&cpu_buffer->entries));
+	WRITE_ONCE(meta->overrun, local_read(&cpu_buffer->overrun));
+	WRITE_ONCE(meta->read, cpu_buffer->read);
+
+	/* some archs don't keep the user's view of the page coherent */
+	flush_dcache_page(virt_to_page(cpu_buffer->reader_page->page));
+}
+
 static void
 rb_reset_cpu(struct ring_buffer_per_cpu *cpu_buffer)
 {
@@ -4399,6 +4435,9 @@ void ring_buffer_reset_cpu(struct ring_buffer *buffer, int cpu)
 
 	arch_spin_unlock(&cpu_buffer->lock);
 
+	if (cpu_buffer->mapped)
+		rb_update_meta_page(cpu_buffer);
+
  out:
 	raw_spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
 
@@ -4506,6 +4545,11 @@ int ring_buffer_swap_cpu(struct ring_buffer *buffer_a,
 	if (cpu_buffer_a->nr_pages != cpu_buffer_b->nr_pages)
 		goto out;
 
+	/* the pages of a mapped buffer must stay where user space sees them */
+	ret = -EBUSY;
+	if (cpu_buffer_a->mapped || cpu_buffer_b->mapped)
+		goto out;
+
 	ret = -EAGAIN;
 
 	if (atomic_read(&buffer_a->record_disabled))
@@ -4725,12 +4769,14 @@ int ring_buffer_read_page(struct ring_buffer *buffer,
 	/*
 	 * If this page has been partially read or
 	 * if len is not big enough to read the rest of the page or
-	 * a writer is still on the page, then
+	 * a writer is still on the page or
+	 * the buffer is mapped to user space, then
 	 * we must copy the data from the page to the buffer.
 	 * Otherwise, we can simply swap the page with the one passed in.
 	 */
 	if (read || (len < (commit - read)) ||
-	    cpu_buffer->reader_page == cpu_buffer->commit_page) {
+	    cpu_buffer->reader_page == cpu_buffer->commit_page ||
+	    cpu_buffer->mapped) {
 		struct buffer_data_page *rpage = cpu_buffer->reader_page->page;
 		unsigned int rpos = read;
 		unsigned int pos = 0;
@@ -4839,6 +4885,267 @@ int ring_buffer_read_page(struct ring_buffer *buffer,
 }
 EXPORT_SYMBOL_GPL(ring_buffer_read_page);
 
+/*
+ * Number the reader page 0 and the pages of the ring from 1 on, the order
+ * they are mapped in.  Resizing is disabled, so this holds for as long as
+ * the buffer is mapped.
+ */
+static void rb_setup_ids_meta_page(struct ring_buffer_per_cpu *cpu_buffer,
+				   unsigned long *subbuf_ids)
+{
+	struct trace_buffer_meta *meta = cpu_buffer->meta_page;
+	struct buffer_page *bpage;
+	unsigned int id = 0;
+
+	subbuf_ids[id] = (unsigned long)cpu_buffer->reader_page->page;
+	cpu_buffer->reader_page->id = id++;
+
+	bpage = cpu_buffer->head_page;
+	do {
+		if (WARN_ON(id > cpu_buffer->nr_pages))
+			break;
+
+		subbuf_ids[id] = (unsigned long)bpage->page;
+		bpage->id = id++;
+
+		rb_inc_page(cpu_buffer, &bpage);
+	} while (bpage != cpu_buffer->head_page);
+
+	cpu_buffer->subbuf_ids = subbuf_ids;
+
+	meta->meta_page_size = PAGE_SIZE;
+	meta->meta_struct_len = sizeof(*meta);
+	meta->nr_subbufs = cpu_buffer->nr_pages + 1;
+	meta->subbuf_size = PAGE_SIZE;
+
+	rb_update_meta_page(cpu_buffer);
+}
+
+static int __rb_map_vma(struct ring_buffer_per_cpu *cpu_buffer,
+			struct vm_area_struct *vma)
+{
+	unsigned long nr_pages, nr_vma_pages, pgoff = vma->vm_pgoff;
+	unsigned long i;
+	void *addr;
+	int err;
+
+	/* user space only ever gets to look at the pages */
+	if (vma->vm_flags & (VM_WRITE | VM_EXEC) ||
+	    !(vma->vm_flags & VM_MAYSHARE))
+		return -EPERM;
+
+	vma->vm_flags &= ~(VM_MAYWRITE | VM_MAYEXEC);
+	vma->vm_flags |= VM_DONTCOPY | VM_DONTEXPAND | VM_DONTDUMP;
+
+	/* the meta page and then the sub-buffers */
+	nr_pages = 1 + cpu_buffer->nr_pages + 1;
+	nr_vma_pages = vma_pages(vma);
+	if (!nr_vma_pages || pgoff >= nr_pages ||
+	    nr_vma_pages > nr_pages - pgoff)
+		return -EINVAL;
+
+	for (i = 0; i < nr_vma_pages; i++, pgoff++) {
+		if (!pgoff)
+			addr = cpu_buffer->meta_page;
+		else
+			addr = (void *)cpu_buffer->subbuf_ids[pgoff - 1];
+
+		err = vm_insert_page(vma, vma->vm_start + i * PAGE_SIZE,
+				     virt_to_page(addr));
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+/**
+ * ring_buffer_map - map a per CPU buffer to user space
+ * @buffer: the buffer
+ * @cpu: the CPU buffer to map
+ * @vma: the mapping to fill, read-only and shared
+ *
+ * The mapping is struct trace_buffer_meta on a page of its own followed by
+ * every data page, the reader page included, see uapi/linux/trace_mmap.h.
+ * While any mapping of the CPU buffer is there, its pages stay where they
+ * are: it can't be resized or swapped, and ring_buffer_read_page() copies
+ * instead of exchanging pages.
+ *
+ * Every successful call needs a ring_buffer_unmap().
+ */
+int ring_buffer_map(struct ring_buffer *buffer, int cpu,
+		    struct vm_area_struct *vma)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+	struct trace_buffer_meta *meta;
+	unsigned long flags, *subbuf_ids;
+	int err;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return -EINVAL;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	mutex_lock(&cpu_buffer->mapping_lock);
+
+	if (cpu_buffer->mapped) {
+		err = __rb_map_vma(cpu_buffer, vma);
+		if (!err)
+			cpu_buffer->mapped++;
+		mutex_unlock(&cpu_buffer->mapping_lock);
+		return err;
+	}
+
+	/* keep resizing out until the pages are numbered */
+	mutex_lock(&buffer->mutex);
+
+	err = -ENOMEM;
+	meta = (void *)get_zeroed_page(GFP_KERNEL);
+	if (!meta)
+		goto unlock;
+
+	subbuf_ids = kcalloc(cpu_buffer->nr_pages + 1, sizeof(*subbuf_ids),
+			     GFP_KERNEL);
+	if (!subbuf_ids) {
+		free_page((unsigned long)meta);
+		goto unlock;
+	}
+
+	atomic_inc(&buffer->resize_disabled);
+
+	raw_spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+	cpu_buffer->meta_page = meta;
+	rb_setup_ids_meta_page(cpu_buffer, subbuf_ids);
+	cpu_buffer->mapped = 1;
+	raw_spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+
+	err = __rb_map_vma(cpu_buffer, vma);
+	if (err) {
+		raw_spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+		cpu_buffer->mapped = 0;
+		cpu_buffer->meta_page = NULL;
+		cpu_buffer->subbuf_ids = NULL;
+		raw_spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+
+		atomic_dec(&buffer->resize_disabled);
+		kfree(subbuf_ids);
+		free_page((unsigned long)meta);
+	}
+
+ unlock:
+	mutex_unlock(&buffer->mutex);
+	mutex_unlock(&cpu_buffer->mapping_lock);
+
+	return err;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_map);
+
+/**
+ * ring_buffer_unmap - drop a mapping of a per CPU buffer
+ * @buffer: the buffer
+ * @cpu: the CPU buffer mapped by ring_buffer_map()
+ *
+ * The last one frees the meta page, which must not be mapped anywhere
+ * anymore, and lets the buffer be resized again.
+ */
+int ring_buffer_unmap(struct ring_buffer *buffer, int cpu)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+	struct trace_buffer_meta *meta;
+	unsigned long flags, *subbuf_ids;
+	int err = 0;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return -EINVAL;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	mutex_lock(&cpu_buffer->mapping_lock);
+
+	if (!cpu_buffer->mapped) {
+		err = -ENODEV;
+		goto out;
+	} else if (cpu_buffer->mapped > 1) {
+		cpu_buffer->mapped--;
+		goto out;
+	}
+
+	mutex_lock(&buffer->mutex);
+
+	raw_spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+	cpu_buffer->mapped = 0;
+	meta = cpu_buffer->meta_page;
+	subbuf_ids = cpu_buffer->subbuf_ids;
+	cpu_buffer->meta_page = NULL;
+	cpu_buffer->subbuf_ids = NULL;
+	raw_spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+
+	atomic_dec(&buffer->resize_disabled);
+
+	mutex_unlock(&buffer->mutex);
+
+	kfree(subbuf_ids);
+	free_page((unsigned long)meta);
+ out:
+	mutex_unlock(&cpu_buffer->mapping_lock);
+
+	return err;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_unmap);
+
+/**
+ * ring_buffer_map_get_reader - move a mapped buffer's reader on
+ * @buffer: the buffer
+ * @cpu: the mapped CPU buffer
+ *
+ * Whatever is left on the reader page is taken as read by user space.  If
+ * that was nothing, the next page with data becomes the reader page.
+ * Either way the meta page is brought up to date.
+ */
+int ring_buffer_map_get_reader(struct ring_buffer *buffer, int cpu)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+	struct buffer_page *reader;
+	unsigned long flags;
+	int err = 0;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return -EINVAL;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	raw_spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+
+	if (!cpu_buffer->mapped) {
+		err = -ENODEV;
+		goto out;
+	}
+
+	reader = cpu_buffer->reader_page;
+	if (reader->read < rb_page_size(reader)) {
+		/*
+		 * User space reads on from where it is up to the commit,
+		 * account all of that as read here.
+		 */
+		while (reader->read < rb_page_size(reader))
+			rb_advance_reader(cpu_buffer);
+		rb_update_meta_page(cpu_buffer);
+		goto out;
+	}
+
+	reader = rb_get_reader_page(cpu_buffer);
+	/* lost_events are those before the new reader page */
+	rb_update_meta_page(cpu_buffer);
+	if (reader)
+		cpu_buffer->lost_events = 0;
+
+ out:
+	raw_spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+
+	return err;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_map_get_reader);
+
 /*
  * We only allocate new buffers, never free them if the CPU goes down.
  * If we were to free the buffer, then the user would lose any trace that was in
@@ -41,6 +41,7 @@
 #include <linux/poll.h>
 #include <linux/nmi.h>
 #include <linux/fs.h>
+#include <uapi/linux/trace_mmap.h>
 #include <linux/trace.h>
 #include <linux/sched/clock.h>
 #include <linux/sched/rt.h>
@@ -957,6 +958,10 @@ int tracing_alloc_snapshot_instance(struct trace_array *tr)
 {
 	int ret;
 
+	/* mapped buffers must stay in place, see tracing_buffers_mmap() */
+	if (tr->mapped)
+		return -EBUSY;
+
 	if (!tr->allocated_snapshot) {
 
 		/* allocate spare buffer */
@@ -6401,6 +6406,7 @@ struct ftrace_buffer_info {
 	void			*spare;
 	unsigned int		spare_cpu;
 	unsigned int		read;
+	unsigned int		mapped;
 };
 
 #ifdef CONFIG_TRACER_SNAPSHOT
@@ -6804,6 +6810,14 @@ static int tracing_buffers_release(struct inode *inode, struct file *file)
 
 	iter->tr->current_trace->ref--;
 
+	/* the file outlives all of its mappings, drop them here */
+	while (info->mapped) {
+		WARN_ON(ring_buffer_unmap(iter->trace_buffer->buffer,
+					  iter->cpu_file));
+		iter->tr->mapped--;
+		info->mapped--;
+	}
+
 	__trace_array_put(iter->tr);
 
 	if (info->spare)
@@ -6983,12 +6997,63 @@ tracing_buffers_splice_read(struct file *file, loff_t *ppos,
 	return ret;
 }
 
+static long tracing_buffers_ioctl(struct file *file, unsigned int cmd,
+				  unsigned long arg)
+{
+	struct ftrace_buffer_info *info = file->private_data;
+	struct trace_iterator *iter = &info->iter;
+
+	if (cmd != TRACE_MMAP_IOCTL_GET_READER)
+		return -ENOTTY;
+
+	return ring_buffer_map_get_reader(iter->trace_buffer->buffer,
+					  iter->cpu_file);
+}
+
+/*
+ * Map the CPU buffer read-only for consuming events in place, see
+ * uapi/linux/trace_mmap.h.  The mappings are accounted to the file rather
+ * than to each vma, so splitting or moving them needs no care, and are
+ * dropped when the file is released.
+ */
+static int tracing_buffers_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct ftrace_buffer_info *info = filp->private_data;
+	struct trace_iterator *iter = &info->iter;
+	int ret;
+
+	if (iter->cpu_file == RING_BUFFER_ALL_CPUS)
+		return -EINVAL;
+
+	mutex_lock(&trace_types_lock);
+
+#ifdef CONFIG_TRACER_MAX_TRACE
+	/* a snapshot would swap the buffer away from under the mapping */
+	if (iter->tr->allocated_snapshot) {
+		mutex_unlock(&trace_types_lock);
+		return -EBUSY;
+	}
+#endif
+
+	ret = ring_buffer_map(iter->trace_buffer->buffer, iter->cpu_file, vma);
+	if (!ret) {
+		iter->tr->mapped++;
+		info->mapped++;
+	}
+
+	mutex_unlock(&trace_types_lock);
+
+	return ret;
+}
+
 static const struct file_operations tracing_buffers_fops = {
 	.open		= tracing_buffers_open,
 	.read		= tracing_buffers_read,
 	.poll		= tracing_buffers_poll,
 	.release	= tracing_buffers_release,
 	.splice_read	= tracing_buffers_splice_read,
+	.unlocked_ioctl	= tracing_buffers_ioctl,
+	.mmap		= tracing_buffers_mmap,
 	.llseek		= no_llseek,
 };
 
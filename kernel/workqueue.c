@@ -48,7 +48,10 @@
 #include <linux/moduleparam.h>
 #include <linux/uaccess.h>
 #include <linux/sched/isolation.h>
+#include <linux/sched/cputime.h>
 #include <linux/nmi.h>
+#include <linux/cgroup.h>
+#include <linux/cpuset.h>
 
 #include "workqueue_internal.h"
 
@@ -208,6 +211,10 @@ struct pool_workqueue {
 	struct list_head	delayed_works;	/* L: delayed works */
 	struct list_head	pwqs_node;	/* WR: node on wq->pwqs */
 	struct list_head	mayday_node;	/* MD: node on wq->maydays */
+#ifdef CONFIG_CGROUP_CPUACCT
+	struct cgroup_subsys_state *css;	/* I: cgroup for WQ_CGROUP */
+	struct hlist_node	cgroup_node;	/* WR: node on wq->cgroup_pwqs */
+#endif
 
 	/*
 	 * Release of unbound pwq is punted to system_wq.  See put_pwq()
@@ -255,6 +262,15 @@ struct workqueue_struct {
 	struct workqueue_attrs	*unbound_attrs;	/* PW: only for unbound wqs */
 	struct pool_workqueue	*dfl_pwq;	/* PW: only for unbound wqs */
 
+#ifdef CONFIG_CGROUP_CPUACCT
+	/* per-cgroup pwqs of WQ_CGROUP wqs, see wq_cgroup_pwq() */
+	struct hlist_head	cgroup_pwqs;	/* WR: pwqs by cgroup */
+	unsigned long		cgroup_pending;	/* creation in progress */
+	struct work_struct	cgroup_work;	/* creates a cgroup pwq */
+	struct cgroup_subsys_state *cgroup_css;	/* ... for this cgroup */
+	cpumask_var_t		cgroup_cpumask;	/* ... on these cpus */
+#endif
+
 #ifdef CONFIG_SYSFS
 	struct wq_device	*wq_dev;	/* I: for sysfs interface */
 #endif
@@ -574,6 +590,63 @@ static struct pool_workqueue *unbound_pwq_by_node(struct workqueue_struct *wq,
 	return rcu_dereference_raw(wq->numa_pwq_tbl[node]);
 }
 
+#ifdef CONFIG_CGROUP_CPUACCT
+/**
+ * wq_cgroup_pwq - find the pwq of the current task's cgroup
+ * @wq: the WQ_CGROUP workqueue to queue on
+ * @pwq: the pwq the work would be queued on otherwise
+ *
+ * Work items a user task queues on @wq go to the pwq of its cpuacct cgroup,
+ * whose pool is restricted to the CPUs of the task's cpuset and whose
+ * execution time process_one_work() charges to the cgroup.  The pwq is
+ * created asynchronously on first use, until then @pwq is used.  Items
+ * queued from kthreads, interrupts and the root cgroup also go to @pwq.
+ *
+ * Must be called with sched-RCU held, like unbound_pwq_by_node().
+ */
+static struct pool_workqueue *wq_cgroup_pwq(struct workqueue_struct *wq,
+					    struct pool_workqueue *pwq)
+{
+	struct cgroup_subsys_state *css;
+	struct pool_workqueue *cg_pwq;
+
+	if (!in_task() || (current->flags & PF_KTHREAD))
+		return pwq;
+
+	rcu_read_lock();
+	css = task_css(current, cpuacct_cgrp_id);
+	if (!css->parent)
+		goto out;
+
+	hlist_for_each_entry_rcu(cg_pwq, &wq->cgroup_pwqs, cgroup_node) {
+		if (cg_pwq->css == css) {
+			pwq = cg_pwq;
+			goto out;
+		}
+	}
+
+	/* One cgroup at a time, others catch up on their next item */
+	if (test_and_set_bit(0, &wq->cgroup_pending))
+		goto out;
+	if (!css_tryget_online(css)) {
+		clear_bit(0, &wq->cgroup_pending);
+		goto out;
+	}
+	wq->cgroup_css = css;
+	cpuset_cpus_allowed(current, wq->cgroup_cpumask);
+	queue_work(system_unbound_wq, &wq->cgroup_work);
+out:
+	rcu_read_unlock();
+	return pwq;
+}
+#else
+static inline struct pool_workqueue *
+wq_cgroup_pwq(struct workqueue_struct *wq, struct pool_workqueue *pwq)
+{
+	return pwq;
+}
+#endif
+
 static unsigned int work_color_to_flags(int color)
 {
 	return color << WORK_STRUCT_COLOR_SHIFT;
@@ -1406,6 +1479,8 @@ static void __queue_work(int cpu, struct workqueue_struct *wq,
 		pwq = per_cpu_ptr(wq->cpu_pwqs, cpu);
 	else
 		pwq = unbound_pwq_by_node(wq, cpu_to_node(cpu));
+	if (unlikely(wq->flags & WQ_CGROUP))
+		pwq = wq_cgroup_pwq(wq, pwq);
 
 	/*
 	 * If @work was previously on a different pool, it might still be
@@ -2066,6 +2141,9 @@ __acquires(&pool->lock)
 	bool cpu_intensive = pwq->wq->flags & WQ_CPU_INTENSIVE;
 	int work_color;
 	struct worker *collision;
+#ifdef CONFIG_CGROUP_CPUACCT
+	u64 runtime = 0;
+#endif
 #ifdef CONFIG_LOCKDEP
 	/*
 	 * It is permissible to free the struct work_struct from
@@ -2164,7 +2242,17 @@ __acquires(&pool->lock)
 	 */
 	lockdep_invariant_state(true);
 	trace_workqueue_execute_start(work);
+#ifdef CONFIG_CGROUP_CPUACCT
+	if (unlikely(pwq->css))
+		runtime = task_sched_runtime(current);
+#endif
 	worker->current_func(work);
+#ifdef CONFIG_CGROUP_CPUACCT
+	/* @pwq is pinned by the work in flight */
+	if (unlikely(pwq->css))
+		cpuacct_charge_css(pwq->css,
+				   task_sched_runtime(current) - runtime);
+#endif
 	/*
 	 * While we must be careful to not use "work" after this, the trace
 	 * point will only record its address.
@@ -3350,6 +3438,10 @@ static void rcu_free_wq(struct rcu_head *rcu)
 	else
 		free_workqueue_attrs(wq->unbound_attrs);
 
+#ifdef CONFIG_CGROUP_CPUACCT
+	if (wq->flags & WQ_CGROUP)
+		free_cpumask_var(wq->cgroup_cpumask);
+#endif
 	kfree(wq->rescuer);
 	kfree(wq);
 }
@@ -3529,6 +3621,10 @@ static void pwq_unbound_release_workfn(struct work_struct *work)
 	put_unbound_pool(pool);
 	mutex_unlock(&wq_pool_mutex);
 
+#ifdef CONFIG_CGROUP_CPUACCT
+	if (pwq->css)
+		css_put(pwq->css);
+#endif
 	call_rcu_sched(&pwq->rcu, rcu_free_pwq);
 
 	/*
@@ -3649,6 +3745,127 @@ static struct pool_workqueue *alloc_unbound_pwq(struct workqueue_struct *wq,
 	return pwq;
 }
 
+#ifdef CONFIG_CGROUP_CPUACCT
+/* Create the pwq of @wq->cgroup_css requested by wq_cgroup_pwq() */
+static void wq_cgroup_pwq_workfn(struct work_struct *work)
+{
+	struct workqueue_struct *wq = container_of(work, struct workqueue_struct,
+						   cgroup_work);
+	struct cgroup_subsys_state *css = wq->cgroup_css;
+	struct workqueue_attrs *attrs;
+	struct pool_workqueue *pwq;
+
+	attrs = alloc_workqueue_attrs(GFP_KERNEL);
+	if (!attrs)
+		goto out;
+
+	mutex_lock(&wq_pool_mutex);
+	/* workqueue_cgroup_offline() runs under wq_pool_mutex after dying */
+	if (css_is_dying(css))
+		goto out_unlock;
+
+	copy_workqueue_attrs(attrs, wq->unbound_attrs);
+	cpumask_and(attrs->cpumask, attrs->cpumask, wq->cgroup_cpumask);
+	cpumask_and(attrs->cpumask, attrs->cpumask, wq_unbound_cpumask);
+	if (cpumask_empty(attrs->cpumask))
+		cpumask_copy(attrs->cpumask, wq->unbound_attrs->cpumask);
+	attrs->no_numa = true;
+
+	pwq = alloc_unbound_pwq(wq, attrs);
+	if (!pwq)
+		goto out_unlock;
+	/* the pwq takes over the reference from wq_cgroup_pwq() */
+	pwq->css = css;
+	css = NULL;
+
+	mutex_lock(&wq->mutex);
+	link_pwq(pwq);
+	hlist_add_head_rcu(&pwq->cgroup_node, &wq->cgroup_pwqs);
+	mutex_unlock(&wq->mutex);
+out_unlock:
+	mutex_unlock(&wq_pool_mutex);
+out:
+	free_workqueue_attrs(attrs);
+	if (css)
+		css_put(css);
+	smp_mb__before_atomic();
+	clear_bit(0, &wq->cgroup_pending);
+}
+
+/* Drop the base refs of @wq's cgroup pwqs of @css, or of all if NULL */
+static void wq_put_cgroup_pwqs(struct workqueue_struct *wq,
+			       struct cgroup_subsys_state *css)
+{
+	struct pool_workqueue *pwq;
+	struct hlist_node *tmp;
+
+	mutex_lock(&wq->mutex);
+	hlist_for_each_entry_safe(pwq, tmp, &wq->cgroup_pwqs, cgroup_node) {
+		if (css && pwq->css != css)
+			continue;
+		/* new work goes elsewhere, queued work keeps @pwq alive */
+		hlist_del_rcu(&pwq->cgroup_node);
+		put_pwq_unlocked(pwq);
+	}
+	mutex_unlock(&wq->mutex);
+}
+
+/**
+ * workqueue_cgroup_offline - stop running work on behalf of a cgroup
+ * @css: the cpuacct css going offline
+ *
+ * Called by the cpuacct controller.  The cgroup pwqs of @css are released,
+ * and their references on @css with them, once the work items queued on
+ * them are done.
+ */
+void workqueue_cgroup_offline(struct cgroup_subsys_state *css)
+{
+	struct workqueue_struct *wq;
+
+	mutex_lock(&wq_pool_mutex);
+	list_for_each_entry(wq, &workqueues, list)
+		if (wq->flags & WQ_CGROUP)
+			wq_put_cgroup_pwqs(wq, css);
+	mutex_unlock(&wq_pool_mutex);
+}
+
+static int wq_cgroup_init(struct workqueue_struct *wq)
+{
+	/* ordering can't hold across several pwqs */
+	if (!(wq->flags & WQ_UNBOUND) || (wq->flags & __WQ_ORDERED)) {
+		wq->flags &= ~WQ_CGROUP;
+		return 0;
+	}
+
+	if (!zalloc_cpumask_var(&wq->cgroup_cpumask, GFP_KERNEL))
+		return -ENOMEM;
+	INIT_HLIST_HEAD(&wq->cgroup_pwqs);
+	INIT_WORK(&wq->cgroup_work, wq_cgroup_pwq_workfn);
+	return 0;
+}
+
+static void wq_cgroup_free(struct workqueue_struct *wq)
+{
+	if (wq->flags & WQ_CGROUP)
+		free_cpumask_var(wq->cgroup_cpumask);
+}
+#else
+static inline void wq_put_cgroup_pwqs(struct workqueue_struct *wq,
+				      struct cgroup_subsys_state *css)
+{
+}
+
+static inline int wq_cgroup_init(struct workqueue_struct *wq)
+{
+	wq->flags &= ~WQ_CGROUP;
+	return 0;
+}
+
+static inline void wq_cgroup_free(struct workqueue_struct *wq)
+{
+}
+#endif
+
 /**
  * wq_calc_node_cpumask - calculate a wq_attrs' cpumask for the specified node
  * @attrs: the wq_attrs of the default pwq of the target workqueue
@@ -4129,9 +4346,12 @@ struct workqueue_struct *__alloc_workqueue_key(const char *fmt,
 	lockdep_init_map(&wq->lockdep_map, lock_name, key, 0);
 	INIT_LIST_HEAD(&wq->list);
 
-	if (alloc_and_link_pwqs(wq) < 0)
+	if ((wq->flags & WQ_CGROUP) && wq_cgroup_init(wq) < 0)
 		goto err_free_wq;
 
+	if (alloc_and_link_pwqs(wq) < 0)
+		goto err_free_cgroup;
+
 	if (wq_online && init_rescuer(wq) < 0)
 		goto err_destroy;
 
@@ -4156,6 +4376,8 @@ struct workqueue_struct *__alloc_workqueue_key(const char *fmt,
 
 	return wq;
 
+err_free_cgroup:
+	wq_cgroup_free(wq);
 err_free_wq:
 	free_workqueue_attrs(wq->unbound_attrs);
 	kfree(wq);
@@ -4186,6 +4408,11 @@ void destroy_workqueue(struct workqueue_struct *wq)
 	/* drain it before proceeding with destruction */
 	drain_workqueue(wq);
 
+#ifdef CONFIG_CGROUP_CPUACCT
+	if (wq->flags & WQ_CGROUP)
+		flush_work(&wq->cgroup_work);
+#endif
+
 	/* kill rescuer, if sanity checks fail, leave it w/o rescuer */
 	if (wq->rescuer) {
 		struct worker *rescuer = wq->rescuer;
@@ -4249,6 +4476,9 @@ void destroy_workqueue(struct workqueue_struct *wq)
 			put_pwq_unlocked(pwq);
 		}
 
+		if (wq->flags & WQ_CGROUP)
+			wq_put_cgroup_pwqs(wq, NULL);
+
 		/*
 		 * Put dfl_pwq.  @wq may be freed any time after dfl_pwq is
 		 * put.  Don't access it afterwards.
@@ -0,0 +1,196 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Distributed and locked lists
+ *
+ * Each possible CPU is mapped to one of nr_dlock_lists lists.  The number
+ * of lists is capped, a set of lists is allocated for every superblock and
+ * the lists of a walk are visited one by one no matter how many are empty.
+ */
+#include <linux/cpumask.h>
+#include <linux/dlock-list.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+
+#define DLOCK_LIST_MAX_LISTS	64
+
+static DEFINE_PER_CPU_READ_MOSTLY(int, cpu2idx);
+static int nr_dlock_lists __read_mostly;
+static DEFINE_SPINLOCK(cpu2idx_lock);
+
+/*
+ * Done on the first allocation rather than from an initcall, the VFS has
+ * superblocks before the initcalls run.  The possible CPUs are known by
+ * then.
+ */
+static void cpu2idx_init(void)
+{
+	int idx = 0, cpu;
+
+	spin_lock(&cpu2idx_lock);
+	if (!nr_dlock_lists) {
+		for_each_possible_cpu(cpu) {
+			per_cpu(cpu2idx, cpu) = idx;
+			if (++idx >= DLOCK_LIST_MAX_LISTS)
+				idx = 0;
+		}
+		smp_store_release(&nr_dlock_lists,
+				  min_t(int, num_possible_cpus(),
+					DLOCK_LIST_MAX_LISTS));
+	}
+	spin_unlock(&cpu2idx_lock);
+}
+
+/**
+ * __alloc_dlock_list_heads - allocate and initialize a set of dlock lists
+ * @dlist: the set to initialize
+ * @key:   the lock class key of the list locks
+ *
+ * Return: 0 if successful, -ENOMEM otherwise.
+ */
+int __alloc_dlock_list_heads(struct dlock_list_heads *dlist,
+			     struct lock_class_key *key)
+{
+	int idx;
+
+	if (unlikely(!smp_load_acquire(&nr_dlock_lists)))
+		cpu2idx_init();
+
+	dlist->heads = kcalloc(nr_dlock_lists, sizeof(struct dlock_list_head),
+			       GFP_KERNEL);
+	if (!dlist->heads)
+		return -ENOMEM;
+
+	for (idx = 0; idx < nr_dlock_lists; idx++) {
+		struct dlock_list_head *head = &dlist->heads[idx];
+
+		INIT_LIST_HEAD(&head->list);
+		spin_lock_init(&head->lock);
+		lockdep_set_class(&head->lock, key);
+	}
+	return 0;
+}
+EXPORT_SYMBOL(__alloc_dlock_list_heads);
+
+/**
+ * free_dlock_list_heads - free a set of dlock lists
+ * @dlist: the set to free
+ *
+ * The lists must be empty.
+ */
+void free_dlock_list_heads(struct dlock_list_heads *dlist)
+{
+	kfree(dlist->heads);
+	dlist->heads = NULL;
+}
+EXPORT_SYMBOL(free_dlock_list_heads);
+
+/**
+ * dlock_lists_empty - check if a set of dlock lists is empty
+ * @dlist: the set to check
+ *
+ * Like list_empty() this is only a snapshot unless the caller makes sure
+ * that no entries are being added.
+ */
+bool dlock_lists_empty(struct dlock_list_heads *dlist)
+{
+	int idx;
+
+	for (idx = 0; idx < nr_dlock_lists; idx++)
+		if (!list_empty(&dlist->heads[idx].list))
+			return false;
+	return true;
+}
+EXPORT_SYMBOL(dlock_lists_empty);
+
+/**
+ * dlock_lists_add - add an entry to the list of the current CPU
+ * @node:  the entry to add
+ * @dlist: the set of lists to add it to
+ */
+void dlock_lists_add(struct dlock_list_node *node,
+		     struct dlock_list_heads *dlist)
+{
+	struct dlock_list_head *head;
+
+	/* a stale CPU only costs some locality */
+	head = &dlist->heads[this_cpu_read(cpu2idx)];
+	spin_lock(&head->lock);
+	list_add(&node->list, &head->list);
+	WRITE_ONCE(node->head, head);
+	spin_unlock(&head->lock);
+}
+EXPORT_SYMBOL(dlock_lists_add);
+
+/**
+ * dlock_lists_del - remove an entry from its dlock list
+ * @node: the entry to remove
+ *
+ * The entry may be added to another list of the set right away.  Removing
+ * entries that are on no list is a bug, as is removing the same entry
+ * from two CPUs at once.
+ */
+void dlock_lists_del(struct dlock_list_node *node)
+{
+	struct dlock_list_head *head;
+	bool retry;
+
+	do {
+		head = READ_ONCE(node->head);
+		if (WARN_ONCE(!head, "%s: node 0x%lx has no associated head\n",
+			      __func__, (unsigned long)node))
+			return;
+
+		spin_lock(&head->lock);
+		if (likely(head == node->head)) {
+			list_del_init(&node->list);
+			WRITE_ONCE(node->head, NULL);
+			retry = false;
+		} else {
+			/* moved to another list meanwhile, chase it */
+			retry = true;
+		}
+		spin_unlock(&head->lock);
+	} while (retry);
+}
+EXPORT_SYMBOL(dlock_lists_del);
+
+/**
+ * __dlock_list_next_entry - find the next entry of a dlock list walk
+ * @curr: the current entry, NULL to start the walk
+ * @iter: the iterator
+ *
+ * Moves on to the next non-empty list, dropping the lock of the current
+ * one and taking that of the next, when @curr is the last entry of its
+ * list.
+ *
+ * Return: the next entry, NULL with no lock held at the end of the walk.
+ */
+struct dlock_list_node *__dlock_list_next_entry(struct dlock_list_node *curr,
+						struct dlock_list_iter *iter)
+{
+	if (curr && curr->list.next != &iter->entry->list)
+		return list_next_entry(curr, list);
+
+	if (iter->entry) {
+		spin_unlock(&iter->entry->lock);
+		iter->entry = NULL;
+	}
+
+	while (++iter->index < nr_dlock_lists) {
+		struct dlock_list_head *head = &iter->head[iter->index];
+
+		if (list_empty(&head->list))
+			continue;
+
+		spin_lock(&head->lock);
+		if (list_empty(&head->list)) {
+			spin_unlock(&head->lock);
+			continue;
+		}
+		iter->entry = head;
+		return list_first_entry(&head->list, struct dlock_list_node,
+					list);
+	}
+	return NULL;
+}
+EXPORT_SYMBOL(__dlock_list_next_entry);
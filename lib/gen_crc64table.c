@@ -20,7 +20,9 @@
 
 #define CRC64_ECMA182_POLY 0x42F0E1EBA9EA3693ULL
 
-static uint64_t crc64_table[256] = {0};
+#define CRC64_TABLE_SLICES 8
+
+static uint64_t crc64_table[CRC64_TABLE_SLICES][256] = {{0}};
 
 static void generate_crc64_table(void)
 {
@@ -38,24 +40,37 @@ static void generate_crc64_table(void)
 			c <<= 1;
 		}
 
-		crc64_table[i] = crc;
+		crc64_table[0][i] = crc;
 	}
+
+	/* crc64_table[k][i] is the CRC of byte i followed by k zero bytes */
+	for (j = 1; j < CRC64_TABLE_SLICES; j++)
+		for (i = 0; i < 256; i++) {
+			crc = crc64_table[j - 1][i];
+			crc64_table[j][i] = (crc << 8) ^
+					    crc64_table[0][crc >> 56];
+		}
 }
 
 static void print_crc64_table(void)
 {
-	int i;
+	int i, j;
 
 	printf("/* this file is generated - do not edit */\n\n");
 	printf("#include <linux/types.h>\n");
 	printf("#include <linux/cache.h>\n\n");
-	printf("static const u64 ____cacheline_aligned crc64table[256] = {\n");
-	for (i = 0; i < 256; i++) {
-		printf("\t0x%016" PRIx64 "ULL", crc64_table[i]);
-		if (i & 0x1)
-			printf(",\n");
-		else
-			printf(", ");
+	printf("static const u64 ____cacheline_aligned crc64table[%d][256] = {\n",
+	       CRC64_TABLE_SLICES);
+	for (j = 0; j < CRC64_TABLE_SLICES; j++) {
+		printf("{\n");
+		for (i = 0; i < 256; i++) {
+			printf("\t0x%016" PRIx64 "ULL", crc64_table[j][i]);
+			if (i & 0x1)
+				printf(",\n");
+			else
+				printf(", ");
+		}
+		printf("},\n");
 	}
 	printf("};\n");
 }
@@ -0,0 +1,272 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Asynchronous fork
+ *
+ * fork() of a process with a lot of anonymous memory spends most of its
+ * time in copy_pte_range(), with the parent's mmap_sem held for write, so
+ * a 100GB database stalls for as long as it takes to walk 25 million
+ * ptes.  With async fork, copy_pmd_range() leaves the pte tables of
+ * private anonymous VMAs behind: it only write-protects the parent's pmd
+ * entry pointing at each of them and returns.  The child's pmd stays
+ * empty until the table is copied, which happens
+ *
+ *  - in the child, through task work, before it first returns to user
+ *    space (or earlier, on whichever fault reaches the child's mm first);
+ *  - in the parent, one pmd at a time, when it writes to memory under a
+ *    write-protected pmd, or otherwise changes the ptes below it (zap,
+ *    mremap, MADV_FREE, khugepaged, UFFDIO_COPY, write GUP).
+ *
+ * Hardware honours _PAGE_RW at every level, so no pte needs to be touched
+ * to catch the parent's writes, and fork latency no longer scales with the
+ * size of the parent.
+ *
+ * Both sides copy with the same copy_pte_range() fork uses, serialized by
+ * the parent's async_fork_mutex.  The parent holds a reference on the
+ * child mm and the other way round until all tables are settled; either
+ * one exiting settles them first.  Copying from the child additionally
+ * holds the parent's mmap_sem for read, which keeps the parent's page
+ * tables from being freed underneath.
+ *
+ * If the child can't be given its copy (out of memory), it is killed before
+ * it gets to run: the parent can't fail a fork that has already returned.
+ */
+#include <linux/async_fork.h>
+#include <linux/mmu_notifier.h>
+#include <linux/sched/mm.h>
+#include <linux/sched/signal.h>
+#include <linux/task_work.h>
+
+#include "internal.h"
+
+int sysctl_async_fork __read_mostly;
+unsigned long sysctl_async_fork_min_rss_mb __read_mostly = 1024;
+
+/* Protects the async_fork_parent/async_fork_child links */
+static DEFINE_SPINLOCK(async_fork_lock);
+
+static void async_fork_unlink(struct mm_struct *parent,
+			      struct mm_struct *child)
+{
+	spin_lock(&async_fork_lock);
+	parent->async_fork_child = NULL;
+	child->async_fork_parent = NULL;
+	spin_unlock(&async_fork_lock);
+}
+
+static void async_fork_restore_pmd(struct mm_struct *parent, pmd_t *pmd)
+{
+	spinlock_t *ptl;
+
+	/*
+	 * Only ever adds permissions: stale read-only TLB entries just cause
+	 * a spurious fault, no flush needed.
+	 */
+	ptl = pmd_lock(parent, pmd);
+	set_pmd(pmd, pmd_mkwrite(*pmd));
+	spin_unlock(ptl);
+}
+
+static pmd_t *async_fork_alloc_pmd(struct mm_struct *mm, unsigned long addr)
+{
+	pgd_t *pgd;
+	p4d_t *p4d;
+	pud_t *pud;
+
+	pgd = pgd_offset(mm, addr);
+	p4d = p4d_alloc(mm, pgd, addr);
+	if (!p4d)
+		return NULL;
+	pud = pud_alloc(mm, p4d, addr);
+	if (!pud)
+		return NULL;
+	return pmd_alloc(mm, pud, addr);
+}
+
+/*
+ * Copy the pte table under the parent's @src_pmd to the child, for every
+ * child VMA fork left it to us for, and make the parent's pmd writable
+ * again.  Called with the parent's async_fork_mutex held.
+ */
+static void async_fork_copy_pmd(struct mm_struct *parent,
+				struct mm_struct *child, pmd_t *src_pmd,
+				unsigned long addr)
+{
+	unsigned long end = addr + PMD_SIZE;
+	struct vm_area_struct *vma;
+	pmd_t *dst_pmd;
+	int err = -ENOMEM;
+
+	/* The copy write-protects the parent's COW ptes */
+	mmu_notifier_invalidate_range_start(parent, addr, end);
+
+	dst_pmd = async_fork_alloc_pmd(child, addr);
+	if (dst_pmd) {
+		err = 0;
+		for (vma = find_vma(child, addr); vma && vma->vm_start < end;
+		     vma = vma->vm_next) {
+			if (!async_fork_vma_eligible(vma))
+				continue;
+			err = copy_pte_range(child, parent, dst_pmd, src_pmd,
+					     vma, max(addr, vma->vm_start),
+					     min(end, vma->vm_end));
+			if (err)
+				break;
+		}
+	}
+
+	async_fork_restore_pmd(parent, src_pmd);
+	mmu_notifier_invalidate_range_end(parent, addr, end);
+
+	if (err)
+		WRITE_ONCE(child->async_fork_failed, true);
+}
+
+/* Settle every pte table still owed to @child. */
+static void async_fork_drain(struct mm_struct *parent,
+			     struct mm_struct *child, bool copy)
+{
+	struct vm_area_struct *vma;
+	unsigned long addr;
+	pmd_t *pmd;
+
+	for (vma = child->mmap; vma; vma = vma->vm_next) {
+		if (!async_fork_vma_eligible(vma))
+			continue;
+		for (addr = vma->vm_start & PMD_MASK; addr < vma->vm_end;
+		     addr += PMD_SIZE) {
+			pmd = mm_find_pmd(parent, addr);
+			if (!pmd || !async_fork_pmd_pending(*pmd))
+				continue;
+			if (copy)
+				async_fork_copy_pmd(parent, child, pmd, addr);
+			else
+				async_fork_restore_pmd(parent, pmd);
+			cond_resched();
+		}
+	}
+}
+
+/*
+ * Finish the asynchronous fork @mm takes part in, from either side.  With
+ * @copy false, the child is going away: the parent's tables are just made
+ * writable again.
+ */
+void __async_fork_finish(struct mm_struct *mm, bool copy)
+{
+	struct mm_struct *parent, *child;
+
+	spin_lock(&async_fork_lock);
+	parent = mm->async_fork_parent ?: mm;
+	child = parent->async_fork_child;
+	if (!child) {
+		spin_unlock(&async_fork_lock);
+		return;
+	}
+	mmgrab(parent);
+	spin_unlock(&async_fork_lock);
+
+	/* The child side may hold its own mmap_sem */
+	if (parent != mm)
+		down_read_nested(&parent->mmap_sem, SINGLE_DEPTH_NESTING);
+	mutex_lock(&parent->async_fork_mutex);
+	if (parent->async_fork_child == child) {
+		async_fork_drain(parent, child, copy);
+		async_fork_unlink(parent, child);
+	} else {
+		child = NULL;
+	}
+	mutex_unlock(&parent->async_fork_mutex);
+	if (parent != mm)
+		up_read(&parent->mmap_sem);
+
+	if (child) {
+		/* Drop the references taken by async_fork_prepare() */
+		mmdrop(child);
+		mmdrop(parent);
+	}
+	mmdrop(parent);
+}
+
+void __async_fork_fixup_pmd(struct mm_struct *mm, pmd_t *pmd,
+			    unsigned long addr)
+{
+	struct mm_struct *child;
+
+	mutex_lock(&mm->async_fork_mutex);
+	child = mm->async_fork_child;
+	if (child && async_fork_pmd_pending(*pmd))
+		async_fork_copy_pmd(mm, child, pmd, addr & PMD_MASK);
+	mutex_unlock(&mm->async_fork_mutex);
+}
+
+/*
+ * Called by copy_pmd_range() for the parent's pte table at @src_pmd, with
+ * both mmap_sems held for write.  Returns true if the table was left for
+ * later.
+ */
+bool __async_fork_defer_pmd(struct mm_struct *src_mm, pmd_t *src_pmd,
+			    struct vm_area_struct *vma)
+{
+	spinlock_t *ptl;
+
+	if (!async_fork_vma_eligible(vma))
+		return false;
+
+	/* Neighbouring VMAs sharing the table may have deferred it already */
+	ptl = pmd_lock(src_mm, src_pmd);
+	if (pmd_write(*src_pmd))
+		set_pmd(src_pmd, pmd_wrprotect(*src_pmd));
+	spin_unlock(ptl);
+
+	/* dup_mmap() flushes the parent's TLB once all VMAs are done */
+	return true;
+}
+
+/*
+ * Called by dup_mmap() before copying @oldmm into @mm.  A previous
+ * asynchronous fork of @oldmm is completed first: a parent only ever
+ * has one child to fill.
+ */
+void async_fork_prepare(struct mm_struct *mm, struct mm_struct *oldmm)
+{
+	if (unlikely(READ_ONCE(oldmm->async_fork_child)))
+		__async_fork_finish(oldmm, true);
+
+	if (!sysctl_async_fork ||
+	    get_mm_counter(oldmm, MM_ANONPAGES) <
+	    sysctl_async_fork_min_rss_mb << (20 - PAGE_SHIFT))
+		return;
+
+	mmgrab(mm);
+	mmgrab(oldmm);
+	spin_lock(&async_fork_lock);
+	mm->async_fork_parent = oldmm;
+	oldmm->async_fork_child = mm;
+	spin_unlock(&async_fork_lock);
+}
+
+static void async_fork_work(struct callback_head *work)
+{
+	struct mm_struct *mm = container_of(work, struct mm_struct,
+					    async_fork_work);
+
+	__async_fork_finish(mm, true);
+	if (READ_ONCE(mm->async_fork_failed))
+		force_sig(SIGKILL, current);
+}
+
+/*
+ * Called by copy_process() for a new task: have it pull in the rest of its
+ * page tables before it runs any user code.
+ */
+void async_fork_queue(struct task_struct *p)
+{
+	struct mm_struct *mm = p->mm;
+
+	if (!mm || (!READ_ONCE(mm->async_fork_parent) &&
+		    !READ_ONCE(mm->async_fork_failed)))
+		return;
+
+	init_task_work(&mm->async_fork_work, async_fork_work);
+	task_work_add(p, &mm->async_fork_work, true);
+}
@@ -0,0 +1,256 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Per-node text replication (duptext)
+ *
+ * A large executable run on both sockets has its text in one node's page
+ * cache, and every instruction fetch from the other socket that misses the
+ * caches pays for remote memory.  For memcgs with memory.allow_duptext
+ * set, a read fault on the text mapping of such an executable maps a copy
+ * of the page cache page allocated on the faulting node instead.
+ *
+ * Copies are only mapped in VM_DENYWRITE mappings, so the file can't be
+ * written while any copy is mapped.  They live in mapping->duptext_pages,
+ * keyed by index and node, and are not on the LRU and not in the page
+ * cache.  page->mapping is NULL so that the rest of the VM treats them like
+ * any other page without a mapping; page->index and page_private(), which
+ * holds the owning mapping, are what's needed to find their ptes again.
+ *
+ * Copies are dropped
+ *  - when somebody gets write access to the file (get_write_access()),
+ *  - when the page cache is truncated or invalidated,
+ *  - by a shrinker, under memory pressure.
+ * Processes then fault in a new copy, or the original page cache page
+ * when the local node has no free memory to spare.
+ */
+#include <linux/duptext.h>
+#include <linux/highmem.h>
+#include <linux/pagemap.h>
+#include <linux/rmap.h>
+#include <linux/shrinker.h>
+#include <linux/vmstat.h>
+
+/* Protects every mapping's duptext_pages and the per-node lists */
+static DEFINE_SPINLOCK(duptext_lock);
+
+struct duptext_node {
+	struct list_head pages;
+	unsigned long nr_pages;
+};
+
+static struct duptext_node duptext_nodes[MAX_NUMNODES];
+
+/*
+ * Never reclaim for a copy: without memory to spare locally, the remote
+ * page cache page is good enough.
+ */
+#define DUPTEXT_GFP	((GFP_HIGHUSER | __GFP_THISNODE | __GFP_NOWARN | \
+			  __GFP_NORETRY) & ~__GFP_DIRECT_RECLAIM)
+
+static inline unsigned long duptext_key(pgoff_t index, int nid)
+{
+	return index * nr_node_ids + nid;
+}
+
+static void duptext_del(struct address_space *mapping, struct page *page)
+{
+	lockdep_assert_held(&duptext_lock);
+
+	radix_tree_delete(&mapping->duptext_pages,
+			  duptext_key(page->index, page_to_nid(page)));
+	mapping->nrduptext--;
+	list_del(&page->lru);
+	duptext_nodes[page_to_nid(page)].nr_pages--;
+	set_page_private(page, 0);
+}
+
+/*
+ * Unmap a copy taken off its mapping and drop the reference the mapping
+ * held.  Faults only map a copy that still has its mapping, under the page
+ * lock, so none can be mapped once we have taken the lock here.
+ */
+static void duptext_release(struct address_space *mapping, struct page *page)
+{
+	lock_page(page);
+	if (page_mapped(page)) {
+		/* just long enough for the rmap walk */
+		page->mapping = mapping;
+		try_to_unmap(page, TTU_IGNORE_MLOCK | TTU_IGNORE_ACCESS);
+		page->mapping = NULL;
+	}
+	unlock_page(page);
+
+	count_vm_event(DUPTEXT_FREE);
+	put_page(page);
+}
+
+void __duptext_drop_mapping(struct address_space *mapping)
+{
+	struct radix_tree_iter iter;
+	struct page *page, *next;
+	void **slot;
+	LIST_HEAD(pages);
+
+	spin_lock(&duptext_lock);
+	radix_tree_for_each_slot(slot, &mapping->duptext_pages, &iter, 0) {
+		page = radix_tree_deref_slot_protected(slot, &duptext_lock);
+		radix_tree_iter_delete(&mapping->duptext_pages, &iter, slot);
+		mapping->nrduptext--;
+		list_move(&page->lru, &pages);
+		duptext_nodes[page_to_nid(page)].nr_pages--;
+		set_page_private(page, 0);
+	}
+	spin_unlock(&duptext_lock);
+
+	list_for_each_entry_safe(page, next, &pages, lru) {
+		list_del(&page->lru);
+		duptext_release(mapping, page);
+	}
+}
+
+/* Look up or make the copy of @page on @nid, with a reference held. */
+static struct page *duptext_get(struct page *page, int nid)
+{
+	struct address_space *mapping = page->mapping;
+	unsigned long key = duptext_key(page->index, nid);
+	struct page *dup;
+	int err;
+
+	spin_lock(&duptext_lock);
+	dup = radix_tree_lookup(&mapping->duptext_pages, key);
+	if (dup)
+		get_page(dup);
+	spin_unlock(&duptext_lock);
+	if (dup)
+		return dup;
+
+	dup = alloc_pages_node(nid, DUPTEXT_GFP, 0);
+	if (!dup)
+		return NULL;
+	copy_highpage(dup, page);
+	dup->index = page->index;
+	SetPageUptodate(dup);
+
+	if (radix_tree_preload(GFP_KERNEL)) {
+		put_page(dup);
+		return NULL;
+	}
+	spin_lock(&duptext_lock);
+	err = radix_tree_insert(&mapping->duptext_pages, key, dup);
+	if (!err) {
+		mapping->nrduptext++;
+		set_page_private(dup, (unsigned long)mapping);
+		list_add(&dup->lru, &duptext_nodes[nid].pages);
+		duptext_nodes[nid].nr_pages++;
+		/* one reference for the mapping, one for the caller */
+		get_page(dup);
+	}
+	spin_unlock(&duptext_lock);
+	radix_tree_preload_end();
+
+	if (err) {
+		/* lost a race with another fault, just use the original */
+		put_page(dup);
+		return NULL;
+	}
+	count_vm_event(DUPTEXT_ALLOC);
+	return dup;
+}
+
+/*
+ * Called by do_read_fault() with the locked page cache page in vmf->page:
+ * switch it for the locked copy on this node, if there is one to be had.
+ */
+void duptext_fault(struct vm_fault *vmf)
+{
+	struct page *page = vmf->page;
+	int nid = numa_node_id();
+	struct page *dup;
+
+	if (page->mapping != vmf->vma->vm_file->f_mapping ||
+	    page_to_nid(page) == nid || PageTransCompound(page) ||
+	    !PageUptodate(page) || PageDirty(page) || PageWriteback(page) ||
+	    page->index > ULONG_MAX / MAX_NUMNODES)
+		return;
+
+	dup = duptext_get(page, nid);
+	if (!dup)
+		return;
+	if (!trylock_page(dup))
+		goto put;
+	/* raced with duptext_release() */
+	if (page_private(dup) != (unsigned long)page->mapping) {
+		unlock_page(dup);
+		goto put;
+	}
+
+	unlock_page(page);
+	put_page(page);
+	vmf->page = dup;
+	count_vm_event(DUPTEXT_FAULT);
+	return;
+put:
+	put_page(dup);
+}
+
+static unsigned long duptext_shrink_count(struct shrinker *shrink,
+					  struct shrink_control *sc)
+{
+	return READ_ONCE(duptext_nodes[sc->nid].nr_pages);
+}
+
+static unsigned long duptext_shrink_scan(struct shrinker *shrink,
+					 struct shrink_control *sc)
+{
+	struct duptext_node *dn = &duptext_nodes[sc->nid];
+	struct address_space *mapping;
+	unsigned long freed = 0;
+	struct inode *inode;
+	struct page *page;
+
+	/* the rmap walk and iput() may need to get into the filesystem */
+	if (!(sc->gfp_mask & __GFP_FS))
+		return SHRINK_STOP;
+
+	while (sc->nr_to_scan--) {
+		spin_lock(&duptext_lock);
+		if (list_empty(&dn->pages)) {
+			spin_unlock(&duptext_lock);
+			break;
+		}
+		page = list_last_entry(&dn->pages, struct page, lru);
+		mapping = (struct address_space *)page_private(page);
+		inode = igrab(mapping->host);
+		if (!inode) {
+			/* being evicted, truncation will take care of it */
+			list_move(&page->lru, &dn->pages);
+			spin_unlock(&duptext_lock);
+			continue;
+		}
+		duptext_del(mapping, page);
+		spin_unlock(&duptext_lock);
+
+		duptext_release(mapping, page);
+		iput(inode);
+		freed++;
+	}
+
+	return freed;
+}
+
+static struct shrinker duptext_shrinker = {
+	.count_objects	= duptext_shrink_count,
+	.scan_objects	= duptext_shrink_scan,
+	.seeks		= DEFAULT_SEEKS,
+	.flags		= SHRINKER_NUMA_AWARE,
+};
+
+static int __init duptext_init(void)
+{
+	int nid;
+
+	for (nid = 0; nid < MAX_NUMNODES; nid++)
+		INIT_LIST_HEAD(&duptext_nodes[nid].pages);
+
+	return register_shrinker(&duptext_shrinker);
+}
+subsys_initcall(duptext_init);
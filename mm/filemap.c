@@ -236,7 +236,7 @@ static void unaccount_page_cache_page(struct address_space *mapping,
 	if (PageSwapBacked(page)) {
 		__mod_lruvec_page_state(page, NR_SHMEM, -nr);
 		if (PageTransHuge(page))
-			__dec_node_page_state(page, NR_SHMEM_THPS);
+			__dec_lruvec_page_state(page, NR_SHMEM_THPS);
 	} else if (PageTransHuge(page)) {
 		__dec_node_page_state(page, NR_FILE_THPS);
 		filemap_nr_thps_dec(mapping);
@@ -2114,6 +2114,48 @@ static void shrink_readahead_size_eio(struct file *filp,
 	ra->ra_pages /= 4;
 }
 
+/*
+ * Sequential buffered reads look up cached pages in batches: one radix tree
+ * walk takes references on up to PAGEVEC_SIZE contiguous pages, and the
+ * read loop consumes them one by one. Pages left over when the loop moves
+ * elsewhere are dropped by filemap_release_batch().
+ */
+static void filemap_release_batch(struct page **pages, unsigned int *idx,
+				  unsigned int *nr)
+{
+	while (*idx < *nr)
+		put_page(pages[(*idx)++]);
+	*idx = *nr = 0;
+}
+
+static struct page *filemap_get_batch_page(struct address_space *mapping,
+		pgoff_t index, pgoff_t nr_wanted, struct page **pages,
+		unsigned int *idx, unsigned int *nr)
+{
+	struct page *page;
+
+	if (*idx < *nr) {
+		page = pages[*idx];
+		/* Still the page we want, and not truncated meanwhile? */
+		if (page_to_pgoff(page) == index &&
+		    compound_head(page)->mapping == mapping) {
+			(*idx)++;
+			return page;
+		}
+	}
+	filemap_release_batch(pages, idx, nr);
+
+	if (nr_wanted <= 1)
+		return find_get_page(mapping, index);
+
+	*nr = find_get_pages_contig(mapping, index,
+			min_t(pgoff_t, nr_wanted, PAGEVEC_SIZE), pages);
+	if (!*nr)
+		return NULL;
+	*idx = 1;
+	return pages[0];
+}
+
 /**
  * generic_file_buffered_read - generic file read routine
  * @iocb:	the iocb to read
@@ -2139,6 +2181,8 @@ static ssize_t generic_file_buffered_read(struct kiocb *iocb,
 	pgoff_t prev_index;
 	unsigned long offset;      /* offset into pagecache page */
 	unsigned int prev_offset;
+	struct page *batch[PAGEVEC_SIZE];
+	unsigned int batch_idx = 0, batch_nr = 0;
 	int error = 0;
 
 	if (unlikely(*ppos >= inode->i_sb->s_maxbytes))
@@ -2172,12 +2216,15 @@ static ssize_t generic_file_buffered_read(struct kiocb *iocb,
 			goto out;
 		}
 
-		page = find_get_page(mapping, index);
+		page = filemap_get_batch_page(mapping, index, last_index - index,
+					      batch, &batch_idx, &batch_nr);
 		if (!page) {
 			page_cache_sync_readahead(mapping,
 					ra, filp,
 					index, last_index - index);
-			page = find_get_page(mapping, index);
+			page = filemap_get_batch_page(mapping, index,
+					last_index - index, batch,
+					&batch_idx, &batch_nr);
 			if (unlikely(page == NULL))
 				goto no_cached_page;
 		}
@@ -2406,6 +2453,8 @@ static ssize_t generic_file_buffered_read(struct kiocb *iocb,
 would_block:
 	error = -EAGAIN;
 out:
+	filemap_release_batch(batch, &batch_idx, &batch_nr);
+
 	ra->prev_pos = prev_index;
 	ra->prev_pos <<= PAGE_SHIFT;
 	ra->prev_pos |= prev_offset;
@@ -3076,7 +3125,8 @@ inline ssize_t generic_write_checks(struct kiocb *iocb, struct iov_iter *from)
 
 	pos = iocb->ki_pos;
 
-	if ((iocb->ki_flags & IOCB_NOWAIT) && !(iocb->ki_flags & IOCB_DIRECT))
+	if ((iocb->ki_flags & IOCB_NOWAIT) &&
+	    !((iocb->ki_flags & IOCB_DIRECT) || (file->f_mode & FMODE_BUF_WASYNC)))
 		return -EINVAL;
 
 	if (limit != RLIM_INFINITY) {
@@ -3220,14 +3270,27 @@ struct page *grab_cache_page_write_begin(struct address_space *mapping,
 {
 	struct page *page;
 	int fgp_flags = FGP_LOCK|FGP_WRITE|FGP_CREAT;
+	gfp_t gfp = mapping_gfp_mask(mapping);
 
 	if (flags & AOP_FLAG_NOFS)
 		fgp_flags |= FGP_NOFS;
+	if (flags & AOP_FLAG_NOWAIT) {
+		fgp_flags |= FGP_NOWAIT;
+		gfp &= ~__GFP_DIRECT_RECLAIM;
+		gfp |= __GFP_NOWARN;
+	}
 
-	page = pagecache_get_page(mapping, index, fgp_flags,
-			mapping_gfp_mask(mapping));
-	if (page)
-		wait_for_stable_page(page);
+	page = pagecache_get_page(mapping, index, fgp_flags, gfp);
+	if (!page)
+		return NULL;
+
+	if ((flags & AOP_FLAG_NOWAIT) && PageWriteback(page) &&
+	    bdi_cap_stable_pages_required(inode_to_bdi(mapping->host))) {
+		unlock_page(page);
+		put_page(page);
+		return NULL;
+	}
+	wait_for_stable_page(page);
 
 	return page;
 }
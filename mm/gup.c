@@ -13,6 +13,7 @@
 #include <linux/sched/signal.h>
 #include <linux/rwsem.h>
 #include <linux/hugetlb.h>
+#include <linux/async_fork.h>
 
 #include <asm/mmu_context.h>
 #include <asm/pgtable.h>
@@ -275,6 +276,9 @@ static struct page *follow_pmd_mask(struct vm_area_struct *vma,
 		if (page)
 			return page;
 	}
+	/* Let the write fault copy the table out to an async-forked child */
+	if ((flags & FOLL_WRITE) && async_fork_pmd_pending(pmdval))
+		return no_page_table(vma, flags);
 	if (likely(!pmd_trans_huge(pmdval)))
 		return follow_page_pte(vma, address, pmd, flags);
 
@@ -1713,6 +1717,9 @@ static int gup_pmd_range(pud_t pud, unsigned long addr, unsigned long end,
 			if (!gup_huge_pd(__hugepd(pmd_val(pmd)), addr,
 					 PMD_SHIFT, next, write, pages, nr))
 				return 0;
+		} else if (unlikely(write && async_fork_pmd_pending(pmd))) {
+			/* The slowpath copies it out to the child first */
+			return 0;
 		} else if (!gup_pte_range(pmd, addr, next, write, pages, nr))
 			return 0;
 	} while (pmdp++, addr = next, addr != end);
@@ -67,6 +67,13 @@ static struct shrinker deferred_split_shrinker;
  */
 int global_thp_reclaim;
 static struct shrinker hugepage_reclaim_shrinker;
+/*
+ * Interval of the background zero subpages reclaim, 0 means it's only
+ * done by memory reclaim or thp_reclaim_ctrl.
+ */
+static unsigned int thp_reclaim_scan_sleep_millisecs __read_mostly;
+static struct delayed_work *thp_reclaim_works;
+static void thp_reclaim_kick(unsigned long delay);
 #endif
 
 static atomic_t huge_zero_refcount;
@@ -404,6 +411,36 @@ static ssize_t reclaim_store(struct kobject *kobj,
 
 static struct kobj_attribute reclaim_attr =
 	__ATTR(reclaim, 0644, reclaim_show, reclaim_store);
+
+static ssize_t reclaim_scan_sleep_millisecs_show(struct kobject *kobj,
+						 struct kobj_attribute *attr,
+						 char *buf)
+{
+	return sprintf(buf, "%u\n", thp_reclaim_scan_sleep_millisecs);
+}
+
+static ssize_t reclaim_scan_sleep_millisecs_store(struct kobject *kobj,
+						  struct kobj_attribute *attr,
+						  const char *buf, size_t count)
+{
+	unsigned int msecs;
+	int err;
+
+	err = kstrtouint(buf, 10, &msecs);
+	if (err)
+		return -EINVAL;
+
+	WRITE_ONCE(thp_reclaim_scan_sleep_millisecs, msecs);
+	if (msecs)
+		thp_reclaim_kick(0);
+
+	return count;
+}
+
+static struct kobj_attribute reclaim_scan_sleep_millisecs_attr =
+	__ATTR(reclaim_scan_sleep_millisecs, 0644,
+	       reclaim_scan_sleep_millisecs_show,
+	       reclaim_scan_sleep_millisecs_store);
 #endif
 
 #ifdef CONFIG_HUGETEXT
@@ -416,6 +453,8 @@ static ssize_t hugetext_enabled_show(struct kobject *kobj,
 		val |= 0x01;
 	if (test_bit(TRANSPARENT_HUGEPAGE_ANON_TEXT_ENABLED_FLAG, &transparent_hugepage_flags))
 		val |= 0x02;
+	if (test_bit(TRANSPARENT_HUGEPAGE_EXEC_PREFAULT_FLAG, &transparent_hugepage_flags))
+		val |= 0x04;
 
 	return sprintf(buf, "%d\n", val);
 }
@@ -430,7 +469,7 @@ static ssize_t hugetext_enabled_store(struct kobject *kobj,
 		return -EINVAL;
 
 	ret = kstrtoul(buf, 0, &val);
-	if (ret < 0 || val > 3)
+	if (ret < 0 || val > 7)
 		return -EINVAL;
 
 	ret = count;
@@ -448,6 +487,14 @@ static ssize_t hugetext_enabled_store(struct kobject *kobj,
 		clear_bit(TRANSPARENT_HUGEPAGE_ANON_TEXT_ENABLED_FLAG,
 			  &transparent_hugepage_flags);
 
+	/* prefault the ELF segments at exec, see load_elf_binary() */
+	if (val & 0x04)
+		set_bit(TRANSPARENT_HUGEPAGE_EXEC_PREFAULT_FLAG,
+			  &transparent_hugepage_flags);
+	else
+		clear_bit(TRANSPARENT_HUGEPAGE_EXEC_PREFAULT_FLAG,
+			  &transparent_hugepage_flags);
+
 	if (ret > 0) {
 		int err = start_stop_khugepaged();
 
@@ -475,6 +522,7 @@ static struct attribute *hugepage_attr[] = {
 	&fast_cow_attr.attr,
 #ifdef CONFIG_MEMCG
 	&reclaim_attr.attr,
+	&reclaim_scan_sleep_millisecs_attr.attr,
 #endif
 #ifdef CONFIG_HUGETEXT
 	&hugetext_enabled_attr.attr,
@@ -573,6 +621,17 @@ static int __init hugepage_init(void)
 	if (err)
 		goto err_hugepage_reclaim;
 	global_thp_reclaim = THP_RECLAIM_MEMCG;
+
+	/* Background reclaim is optional, don't fail when out of memory */
+	thp_reclaim_works = kcalloc(nr_node_ids, sizeof(*thp_reclaim_works),
+				    GFP_KERNEL);
+	if (thp_reclaim_works) {
+		int nid;
+
+		for (nid = 0; nid < nr_node_ids; nid++)
+			INIT_DELAYED_WORK(&thp_reclaim_works[nid],
+					  thp_reclaim_work_fn);
+	}
 #endif
 
 	/*
@@ -648,7 +707,7 @@ static int __init setup_hugetext(char *str)
 		goto out;
 
 	err = kstrtoul(str, 0, &val);
-	if (err < 0 || val > 3)
+	if (err < 0 || val > 7)
 		goto out;
 
 	if (val & 0x01)
@@ -665,6 +724,13 @@ static int __init setup_hugetext(char *str)
 		clear_bit(TRANSPARENT_HUGEPAGE_ANON_TEXT_ENABLED_FLAG,
 			  &transparent_hugepage_flags);
 
+	if (val & 0x04)
+		set_bit(TRANSPARENT_HUGEPAGE_EXEC_PREFAULT_FLAG,
+			  &transparent_hugepage_flags);
+	else
+		clear_bit(TRANSPARENT_HUGEPAGE_EXEC_PREFAULT_FLAG,
+			  &transparent_hugepage_flags);
+
 out:
 	if (err)
 		pr_warn("hugetext= cannot parse, ignored\n");
@@ -919,6 +985,7 @@ vm_fault_t do_huge_pmd_anonymous_page(struct vm_fault *vmf)
 	gfp_t gfp;
 	struct page *page;
 	unsigned long haddr = vmf->address & HPAGE_PMD_MASK;
+	u64 start;
 
 	if (!transhuge_vma_suitable(vma, haddr))
 		return VM_FAULT_FALLBACK;
@@ -966,8 +1033,11 @@ vm_fault_t do_huge_pmd_anonymous_page(struct vm_fault *vmf)
 		return ret;
 	}
 	gfp = vma_thp_gfp_mask(vma);
+	memcg_lat_stat_start(&start);
 	page = alloc_hugepage_vma(gfp, vma, haddr, HPAGE_PMD_ORDER);
 	if (unlikely(!page)) {
+		/* Time wasted on the huge page before falling back */
+		memcg_lat_stat_end(MEM_LAT_THP_FALLBACK, start);
 		count_vm_event(THP_FAULT_FALLBACK);
 		return VM_FAULT_FALLBACK;
 	}
@@ -1837,8 +1907,10 @@ vm_fault_t do_huge_pmd_numa_page(struct vm_fault *vmf, pmd_t pmd)
 	page_nid = page_to_nid(page);
 	last_cpupid = page_cpupid_last(page);
 	count_vm_numa_event(NUMA_HINT_FAULTS);
+	count_memcg_event_mm(vma->vm_mm, NUMA_HINT_FAULTS);
 	if (page_nid == this_nid) {
 		count_vm_numa_event(NUMA_HINT_FAULTS_LOCAL);
+		count_memcg_event_mm(vma->vm_mm, NUMA_HINT_FAULTS_LOCAL);
 		flags |= TNF_FAULT_LOCAL;
 	}
 
@@ -3039,7 +3111,7 @@ int split_huge_page_to_list(struct page *page, struct list_head *list)
 		}
 		if (mapping) {
 			if (PageSwapBacked(page)) {
-				__dec_node_page_state(page, NR_SHMEM_THPS);
+				__dec_lruvec_page_state(head, NR_SHMEM_THPS);
 			} else {
 				__dec_node_page_state(page, NR_FILE_THPS);
 				filemap_nr_thps_dec(mapping);
@@ -3340,18 +3412,31 @@ void set_hugepage_reclaim_shrinker_bit(struct mem_cgroup *memcg, int nid)
 
 static inline bool is_zero_page(struct page *page)
 {
-	void *addr = kmap(page);
-	unsigned long *ul = (unsigned long *)addr;
-	bool ret = true;
+	const unsigned long *ul = kmap(page);
+	bool ret = false;
 	int i;
 
 #define BYTES_PER_LONG (BITS_PER_LONG / BITS_PER_BYTE)
-	BUILD_BUG_ON(PAGE_SIZE % BYTES_PER_LONG);
-	for (i = 0; i < PAGE_SIZE; i += BYTES_PER_LONG, ul++)
-		if (*ul) {
-			ret = false;
-			break;
-		}
+#define LONGS_PER_PAGE (PAGE_SIZE / BYTES_PER_LONG)
+	BUILD_BUG_ON(LONGS_PER_PAGE % 8);
+
+	/*
+	 * Data is most likely found at the head or the tail of a page,
+	 * check both ends first. Then OR 8 words at a time, so there is
+	 * one branch per 64 bytes and the loads can be issued in parallel.
+	 * Vector registers are not used here, saving the FPU state for
+	 * each page would cost more than it wins.
+	 */
+	if (ul[0] || ul[LONGS_PER_PAGE - 1])
+		goto out;
+
+	for (i = 0; i < LONGS_PER_PAGE; i += 8) {
+		if (ul[i] | ul[i + 1] | ul[i + 2] | ul[i + 3] |
+		    ul[i + 4] | ul[i + 5] | ul[i + 6] | ul[i + 7])
+			goto out;
+	}
+	ret = true;
+out:
 	kunmap(page);
 
 	return ret;
@@ -3699,34 +3784,85 @@ static inline int get_reclaim_mode(struct mem_cgroup *memcg)
 					READ_ONCE(memcg->thp_reclaim);
 }
 
-void reclaim_memcg_huge_pages(struct mem_cgroup *memcg)
+static void reclaim_memcg_node_huge_pages(struct mem_cgroup *memcg, int nid,
+					  int thp_reclaim)
 {
-	struct lruvec *lruvec;
+	struct lruvec *lruvec = mem_cgroup_lruvec(memcg, NODE_DATA(nid));
 	struct hugepage_reclaim *hr_queue;
 	struct page *page;
-	int thp_reclaim, threshold, nid;
+	int threshold;
 	bool empty;
 
 	threshold = READ_ONCE(memcg->thp_reclaim_threshold);
-	thp_reclaim = get_reclaim_mode(memcg);
+	hr_queue = &memcg->nodeinfo[nid]->hugepage_reclaim_queue;
+	while (1) {
+		cond_resched();
+		page = get_reclaim_hugepage(hr_queue, threshold,
+			&empty, thp_reclaim == THP_RECLAIM_DISABLE);
 
-	for_each_online_node(nid) {
-		lruvec = mem_cgroup_lruvec(memcg, NODE_DATA(nid));
+		if (empty)
+			break;
+
+		if (!page)
+			continue;
+
+		reclaim_huge_page(hr_queue, lruvec, page, thp_reclaim);
+	}
+}
+
+void reclaim_memcg_huge_pages(struct mem_cgroup *memcg)
+{
+	int thp_reclaim = get_reclaim_mode(memcg);
+	int nid;
+
+	for_each_online_node(nid)
+		reclaim_memcg_node_huge_pages(memcg, nid, thp_reclaim);
+}
+
+/*
+ * Background zero subpages reclaim, one work for each node. It splits
+ * the huge pages queued on this node by the memcgs in "reclaim" mode,
+ * so the memory bloat is fixed before memory reclaim even starts.
+ * Memcgs in "swap" mode are left to memory reclaim, we don't want to
+ * swap out pages when there is no memory pressure.
+ */
+static void thp_reclaim_work_fn(struct work_struct *work)
+{
+	struct delayed_work *dwork = to_delayed_work(work);
+	int nid = dwork - thp_reclaim_works;
+	struct hugepage_reclaim *hr_queue;
+	struct mem_cgroup *memcg;
+	unsigned int msecs;
+
+	for (memcg = mem_cgroup_iter(NULL, NULL, NULL); memcg;
+	     memcg = mem_cgroup_iter(NULL, memcg, NULL)) {
 		hr_queue = &memcg->nodeinfo[nid]->hugepage_reclaim_queue;
-		while (1) {
-			cond_resched();
-			page = get_reclaim_hugepage(hr_queue, threshold,
-				&empty, thp_reclaim == THP_RECLAIM_DISABLE);
+		if (get_reclaim_mode(memcg) == THP_RECLAIM_ZSR &&
+		    READ_ONCE(hr_queue->reclaim_queue_len))
+			reclaim_memcg_node_huge_pages(memcg, nid,
+						      THP_RECLAIM_ZSR);
+	}
 
-			if (empty)
-				break;
+	msecs = READ_ONCE(thp_reclaim_scan_sleep_millisecs);
+	if (msecs)
+		queue_delayed_work_on(dwork->cpu, system_unbound_wq, dwork,
+				      msecs_to_jiffies(msecs));
+}
 
-			if (!page)
-				continue;
+/* Queue the work of each node on a cpu of that node */
+static void thp_reclaim_kick(unsigned long delay)
+{
+	int nid, cpu;
 
-			reclaim_huge_page(hr_queue, lruvec, page, thp_reclaim);
-		}
+	if (!thp_reclaim_works)
+		return;
 
+	for_each_online_node(nid) {
+		cpu = cpumask_any_and(cpumask_of_node(nid), cpu_online_mask);
+		if (cpu >= nr_cpu_ids)
+			cpu = WORK_CPU_UNBOUND;
+		queue_delayed_work_on(cpu, system_unbound_wq,
+				      &thp_reclaim_works[nid], delay);
 	}
 }
 
@@ -25,6 +25,7 @@
 #include <linux/swap.h>
 #include <linux/swapops.h>
 #include <linux/jhash.h>
+#include <linux/kthread.h>
 
 #include <asm/page.h>
 #include <asm/pgtable.h>
@@ -710,6 +711,11 @@ struct resv_map *resv_map_alloc(void)
 	INIT_LIST_HEAD(&resv_map->regions);
 
 	resv_map->adds_in_progress = 0;
+#ifdef CONFIG_CGROUP_HUGETLB
+	resv_map->rsvd_cg = NULL;
+	resv_map->rsvd_counter = NULL;
+	resv_map->rsvd_charged = 0;
+#endif
 
 	INIT_LIST_HEAD(&resv_map->region_cache);
 	list_add(&rg->link, &resv_map->region_cache);
@@ -735,6 +741,7 @@ void resv_map_release(struct kref *ref)
 
 	VM_BUG_ON(resv_map->adds_in_progress);
 
+	hugetlb_cgroup_release_resv(resv_map);
 	kfree(resv_map);
 }
 
@@ -1213,6 +1220,7 @@ static void __update_and_free_page(struct hstate *h, struct page *page)
 				1 << PG_writeback);
 	}
 	VM_BUG_ON_PAGE(hugetlb_cgroup_from_page(page), page);
+	VM_BUG_ON_PAGE(hugetlb_cgroup_from_page_rsvd(page), page);
 	set_compound_page_dtor(page, NULL_COMPOUND_DTOR);
 	set_page_refcounted(page);
 	if (hstate_is_gigantic(h)) {
@@ -1343,6 +1351,8 @@ void free_huge_page(struct page *page)
 	ClearHPageMigratable(page);
 	hugetlb_cgroup_uncharge_page(hstate_index(h),
 				     pages_per_huge_page(h), page);
+	hugetlb_cgroup_uncharge_page_rsvd(hstate_index(h),
+					  pages_per_huge_page(h), page);
 	if (restore_reserve)
 		h->resv_huge_pages++;
 
@@ -1371,6 +1381,7 @@ static void prep_new_huge_page(struct hstate *h, struct page *page, int nid)
 	hugetlb_set_page_subpool(page, NULL);
 	spin_lock(&hugetlb_lock);
 	set_hugetlb_cgroup(page, NULL);
+	set_hugetlb_cgroup_rsvd(page, NULL);
 	h->nr_huge_pages++;
 	h->nr_huge_pages_node[nid]++;
 	spin_unlock(&hugetlb_lock);
@@ -2111,7 +2122,8 @@ struct page *alloc_huge_page(struct vm_area_struct *vma,
 	long map_chg, map_commit;
 	long gbl_chg;
 	int ret, idx;
-	struct hugetlb_cgroup *h_cg;
+	struct hugetlb_cgroup *h_cg, *h_cg_rsvd = NULL;
+	bool deferred_reserve;
 
 	idx = hstate_index(h);
 	/*
@@ -2149,9 +2161,21 @@ struct page *alloc_huge_page(struct vm_area_struct *vma,
 			gbl_chg = 1;
 	}
 
+	/*
+	 * A page without a reservation is charged to the rsvd counter now,
+	 * as the ones with a reservation were when it was made.
+	 */
+	deferred_reserve = map_chg || avoid_reserve;
+	if (deferred_reserve) {
+		ret = hugetlb_cgroup_charge_cgroup_rsvd(idx,
+				pages_per_huge_page(h), &h_cg_rsvd);
+		if (ret)
+			goto out_subpool_put;
+	}
+
 	ret = hugetlb_cgroup_charge_cgroup(idx, pages_per_huge_page(h), &h_cg);
 	if (ret)
-		goto out_subpool_put;
+		goto out_uncharge_cgroup_rsvd;
 
 	spin_lock(&hugetlb_lock);
 	/*
@@ -2174,6 +2198,9 @@ struct page *alloc_huge_page(struct vm_area_struct *vma,
 		/* Fall through */
 	}
 	hugetlb_cgroup_commit_charge(idx, pages_per_huge_page(h), h_cg, page);
+	if (deferred_reserve)
+		hugetlb_cgroup_commit_charge_rsvd(idx, pages_per_huge_page(h),
+						  h_cg_rsvd, page);
 	spin_unlock(&hugetlb_lock);
 
 	hugetlb_set_page_subpool(page, spool);
@@ -2193,11 +2220,21 @@ struct page *alloc_huge_page(struct vm_area_struct *vma,
 
 		rsv_adjust = hugepage_subpool_put_pages(spool, 1);
 		hugetlb_acct_memory(h, -rsv_adjust);
+		if (deferred_reserve) {
+			spin_lock(&hugetlb_lock);
+			hugetlb_cgroup_uncharge_page_rsvd(idx,
+					pages_per_huge_page(h), page);
+			spin_unlock(&hugetlb_lock);
+		}
 	}
 	return page;
 
 out_uncharge_cgroup:
 	hugetlb_cgroup_uncharge_cgroup(idx, pages_per_huge_page(h), h_cg);
+out_uncharge_cgroup_rsvd:
+	if (deferred_reserve)
+		hugetlb_cgroup_uncharge_cgroup_rsvd(idx, pages_per_huge_page(h),
+						    h_cg_rsvd);
 out_subpool_put:
 	if (map_chg || avoid_reserve)
 		hugepage_subpool_put_pages(spool, 1);
@@ -2390,6 +2427,107 @@ static int adjust_pool_surplus(struct hstate *h, nodemask_t *nodes_allowed,
 }
 
 #define persistent_huge_pages(h) (h->nr_huge_pages - h->surplus_huge_pages)
+/*
+ * Growing the pool by many pages allocates each node's share from a thread
+ * running on that node, in parallel, rather than one page at a time from
+ * alternating nodes. The direct compaction and vmemmap freeing of a page
+ * stay node local, and the vmemmap TLB flushes of all threads still go in
+ * the one batch set_max_huge_pages() has open.
+ */
+#define HUGETLB_GROW_PARALLEL_MIN	64	/* pages, less are not worth it */
+
+struct hugetlb_grow_ctl {
+	struct hstate *h;
+	atomic_t nr_running;
+	struct completion done;
+	bool stop;
+};
+
+struct hugetlb_grow_node {
+	struct hugetlb_grow_ctl *ctl;
+	int nid;
+	unsigned long nr_pages;
+};
+
+static int hugetlb_grow_node_fn(void *arg)
+{
+	struct hugetlb_grow_node *gn = arg;
+	struct hugetlb_grow_ctl *ctl = gn->ctl;
+	struct hstate *h = ctl->h;
+	gfp_t gfp_mask = htlb_alloc_mask(h) | __GFP_THISNODE;
+	nodemask_t nodes = nodemask_of_node(gn->nid);
+	struct page *page;
+
+	while (gn->nr_pages && !READ_ONCE(ctl->stop)) {
+		page = alloc_fresh_huge_page(h, gfp_mask, gn->nid, &nodes);
+		if (!page)
+			break;
+		put_page(page); /* free it into the hugepage allocator */
+		gn->nr_pages--;
+		cond_resched();
+	}
+
+	if (atomic_dec_and_test(&ctl->nr_running))
+		complete(&ctl->done);
+	return 0;
+}
+
+/*
+ * Try to add @nr_pages to the pool, spread evenly over @nodes_allowed.
+ * Whatever a node could not provide is left to the caller's serial loop,
+ * which falls back to the other nodes.
+ */
+static void hugetlb_grow_pool_parallel(struct hstate *h, unsigned long nr_pages,
+				       nodemask_t *nodes_allowed)
+{
+	struct hugetlb_grow_ctl ctl = { .h = h };
+	struct hugetlb_grow_node *gn;
+	int nid, nr_nodes = 0, i = 0;
+
+	for_each_node_mask(nid, *nodes_allowed) {
+		if (node_state(nid, N_MEMORY))
+			nr_nodes++;
+	}
+	if (nr_nodes < 2 || nr_pages < HUGETLB_GROW_PARALLEL_MIN)
+		return;
+
+	gn = kcalloc(nr_nodes, sizeof(*gn), GFP_KERNEL);
+	if (!gn)
+		return;
+
+	init_completion(&ctl.done);
+	/* one for ourselves, so that no thread completes before all run */
+	atomic_set(&ctl.nr_running, 1);
+	for_each_node_mask(nid, *nodes_allowed) {
+		const struct cpumask *cpus = cpumask_of_node(nid);
+		struct task_struct *tsk;
+
+		if (!node_state(nid, N_MEMORY) || i == nr_nodes)
+			continue;
+
+		gn[i].ctl = &ctl;
+		gn[i].nid = nid;
+		gn[i].nr_pages = nr_pages / nr_nodes + (i < nr_pages % nr_nodes);
+		tsk = kthread_create_on_node(hugetlb_grow_node_fn, &gn[i], nid,
+					     "hugetlb_grow/%d", nid);
+		i++;
+		if (IS_ERR(tsk))
+			continue;
+		if (cpumask_intersects(cpus, cpu_online_mask))
+			set_cpus_allowed_ptr(tsk, cpus);
+		atomic_inc(&ctl.nr_running);
+		wake_up_process(tsk);
+	}
+
+	if (!atomic_dec_and_test(&ctl.nr_running) &&
+	    wait_for_completion_interruptible(&ctl.done)) {
+		/* Bail for signals, once the threads are done with ctl */
+		WRITE_ONCE(ctl.stop, true);
+		wait_for_completion(&ctl.done);
+	}
+	kfree(gn);
+}
+
 static unsigned long set_max_huge_pages(struct hstate *h, unsigned long count,
 						nodemask_t *nodes_allowed)
 {
@@ -2399,6 +2537,7 @@ static unsigned long set_max_huge_pages(struct hstate *h, unsigned long count,
 		return h->max_huge_pages;
 
 	flush_free_hpage_work(h);
+	hugetlb_vmemmap_batch_begin(h);
 
 	/*
 	 * Increase the pool size
@@ -2417,6 +2556,16 @@ static unsigned long set_max_huge_pages(struct hstate *h, unsigned long count,
 			break;
 	}
 
+	if (count > persistent_huge_pages(h)) {
+		unsigned long nr_pages = count - persistent_huge_pages(h);
+
+		spin_unlock(&hugetlb_lock);
+		hugetlb_grow_pool_parallel(h, nr_pages, nodes_allowed);
+		spin_lock(&hugetlb_lock);
+		if (signal_pending(current))
+			goto out;
+	}
+
 	while (count > persistent_huge_pages(h)) {
 		/*
 		 * If this allocation races such that we no longer need the
@@ -2471,6 +2620,7 @@ static unsigned long set_max_huge_pages(struct hstate *h, unsigned long count,
 out:
 	ret = persistent_huge_pages(h);
 	spin_unlock(&hugetlb_lock);
+	hugetlb_vmemmap_batch_end(h);
 	return ret;
 }
 
@@ -2680,6 +2830,42 @@ static ssize_t surplus_hugepages_show(struct kobject *kobj,
 }
 HSTATE_ATTR_RO(surplus_hugepages);
 
+#ifdef CONFIG_HUGETLB_PAGE_FREE_VMEMMAP
+static ssize_t free_vmemmap_show(struct kobject *kobj,
+					struct kobj_attribute *attr, char *buf)
+{
+	struct hstate *h = kobj_to_hstate(kobj, NULL);
+
+	return sprintf(buf, "%d\n", free_vmemmap_pages_per_hpage(h) &&
+		       !READ_ONCE(h->free_vmemmap_disabled));
+}
+
+/*
+ * Only affects huge pages allocated from now on, pages whose vmemmap is
+ * already freed get it back when they are released to the buddy allocator.
+ * Enabling needs vmemmap freeing to be set up at boot (hugetlb_free_vmemmap=on)
+ * because the vmemmap of huge pages must be mapped by base pages.
+ */
+static ssize_t free_vmemmap_store(struct kobject *kobj,
+		struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	struct hstate *h = kobj_to_hstate(kobj, NULL);
+	bool enable;
+	int err;
+
+	err = kstrtobool(buf, &enable);
+	if (err)
+		return err;
+
+	if (enable && !free_vmemmap_pages_per_hpage(h))
+		return -EINVAL;
+
+	WRITE_ONCE(h->free_vmemmap_disabled, !enable);
+	return count;
+}
+HSTATE_ATTR(free_vmemmap);
+#endif
+
 static struct attribute *hstate_attrs[] = {
 	&nr_hugepages_attr.attr,
 	&nr_overcommit_hugepages_attr.attr,
@@ -2688,6 +2874,9 @@ static struct attribute *hstate_attrs[] = {
 	&surplus_hugepages_attr.attr,
 #ifdef CONFIG_NUMA
 	&nr_hugepages_mempolicy_attr.attr,
+#endif
+#ifdef CONFIG_HUGETLB_PAGE_FREE_VMEMMAP
+	&free_vmemmap_attr.attr,
 #endif
 	NULL,
 };
@@ -3260,6 +3449,8 @@ static void hugetlb_vm_op_close(struct vm_area_struct *vma)
 
 	reserve = (end - start) - region_count(resv, start, end);
 
+	/* the faulted in part of the reservation was charged until now too */
+	hugetlb_cgroup_uncharge_resv(resv, h, end - start);
 	kref_put(&resv->refs, resv_map_release);
 
 	if (reserve) {
@@ -4638,6 +4829,14 @@ int hugetlb_reserve_pages(struct inode *inode,
 		goto out_err;
 	}
 
+	/*
+	 * Charge the reservation to the hugetlb cgroup, so that going over
+	 * its rsvd limit fails the mmap() rather than a later fault.
+	 */
+	ret = hugetlb_cgroup_charge_resv(resv_map, h, chg);
+	if (ret)
+		goto out_err;
+
 	/*
 	 * There must be enough pages in the subpool for the mapping. If
 	 * the subpool has a minimum size, there may be some global
@@ -4646,7 +4845,7 @@ int hugetlb_reserve_pages(struct inode *inode,
 	gbl_reserve = hugepage_subpool_get_pages(spool, chg);
 	if (gbl_reserve < 0) {
 		ret = -ENOSPC;
-		goto out_err;
+		goto out_uncharge_cgroup;
 	}
 
 	/*
@@ -4657,7 +4856,7 @@ int hugetlb_reserve_pages(struct inode *inode,
 	if (ret < 0) {
 		/* put back original number of pages, chg */
 		(void)hugepage_subpool_put_pages(spool, chg);
-		goto out_err;
+		goto out_uncharge_cgroup;
 	}
 
 	/*
@@ -4687,9 +4886,12 @@ int hugetlb_reserve_pages(struct inode *inode,
 			rsv_adjust = hugepage_subpool_put_pages(spool,
 								chg - add);
 			hugetlb_acct_memory(h, -rsv_adjust);
+			hugetlb_cgroup_uncharge_resv(resv_map, h, chg - add);
 		}
 	}
 	return 0;
+out_uncharge_cgroup:
+	hugetlb_cgroup_uncharge_resv(resv_map, h, chg);
 out_err:
 	if (!vma || vma->vm_flags & VM_MAYSHARE)
 		/* Don't call region_abort if region_chg failed */
@@ -4718,6 +4920,7 @@ long hugetlb_unreserve_pages(struct inode *inode, long start, long end,
 		 */
 		if (chg < 0)
 			return chg;
+		hugetlb_cgroup_uncharge_resv(resv_map, h, chg);
 	}
 
 	spin_lock(&inode->i_lock);
@@ -25,6 +25,12 @@ struct hugetlb_cgroup {
 	 * the counter to account for hugepages from hugetlb.
 	 */
 	struct page_counter hugepage[HUGE_MAX_HSTATE];
+
+	/*
+	 * the counter to account for hugepage reservations, and for the
+	 * hugepages faulted in without one.
+	 */
+	struct page_counter rsvd_hugepage[HUGE_MAX_HSTATE];
 };
 
 #define MEMFILE_PRIVATE(x, val)	(((x) << 16) | (val))
@@ -56,6 +62,16 @@ parent_hugetlb_cgroup(struct hugetlb_cgroup *h_cg)
 	return hugetlb_cgroup_from_css(h_cg->css.parent);
 }
 
+static inline struct page_counter *
+hugetlb_cgroup_counter(struct hugetlb_cgroup *h_cg, int idx, bool rsvd)
+{
+	return rsvd ? &h_cg->rsvd_hugepage[idx] : &h_cg->hugepage[idx];
+}
+
+/*
+ * Only the fault charges are moved to the parent on offline, reservations
+ * pin the css until they are released instead.
+ */
 static inline bool hugetlb_cgroup_have_usage(struct hugetlb_cgroup *h_cg)
 {
 	int idx;
@@ -70,22 +86,26 @@ static inline bool hugetlb_cgroup_have_usage(struct hugetlb_cgroup *h_cg)
 static void hugetlb_cgroup_init(struct hugetlb_cgroup *h_cgroup,
 				struct hugetlb_cgroup *parent_h_cgroup)
 {
-	int idx;
+	int idx, rsvd;
 
 	for (idx = 0; idx < HUGE_MAX_HSTATE; idx++) {
-		struct page_counter *counter = &h_cgroup->hugepage[idx];
-		struct page_counter *parent = NULL;
-		unsigned long limit;
-		int ret;
-
-		if (parent_h_cgroup)
-			parent = &parent_h_cgroup->hugepage[idx];
-		page_counter_init(counter, parent);
-
-		limit = round_down(PAGE_COUNTER_MAX,
-				   1 << huge_page_order(&hstates[idx]));
-		ret = page_counter_set_max(counter, limit);
-		VM_BUG_ON(ret);
+		for (rsvd = 0; rsvd < 2; rsvd++) {
+			struct page_counter *counter;
+			struct page_counter *parent = NULL;
+			unsigned long limit;
+			int ret;
+
+			counter = hugetlb_cgroup_counter(h_cgroup, idx, rsvd);
+			if (parent_h_cgroup)
+				parent = hugetlb_cgroup_counter(parent_h_cgroup,
+								idx, rsvd);
+			page_counter_init(counter, parent);
+
+			limit = round_down(PAGE_COUNTER_MAX,
+					   1 << huge_page_order(&hstates[idx]));
+			ret = page_counter_set_max(counter, limit);
+			VM_BUG_ON(ret);
+		}
 	}
 }
 
@@ -178,8 +198,24 @@ static void hugetlb_cgroup_css_offline(struct cgroup_subsys_state *css)
 	} while (hugetlb_cgroup_have_usage(h_cg));
 }
 
-int hugetlb_cgroup_charge_cgroup(int idx, unsigned long nr_pages,
-				 struct hugetlb_cgroup **ptr)
+static struct hugetlb_cgroup *hugetlb_cgroup_get_current(void)
+{
+	struct hugetlb_cgroup *h_cg;
+
+again:
+	rcu_read_lock();
+	h_cg = hugetlb_cgroup_from_task(current);
+	if (!css_tryget(&h_cg->css)) {
+		rcu_read_unlock();
+		goto again;
+	}
+	rcu_read_unlock();
+	return h_cg;
+}
+
+static int __hugetlb_cgroup_charge_cgroup(int idx, unsigned long nr_pages,
+					  struct hugetlb_cgroup **ptr,
+					  bool rsvd)
 {
 	int ret = 0;
 	struct page_counter *counter;
@@ -193,23 +229,34 @@ int hugetlb_cgroup_charge_cgroup(int idx, unsigned long nr_pages,
 	 */
 	if (huge_page_order(&hstates[idx]) < HUGETLB_CGROUP_MIN_ORDER)
 		goto done;
-again:
-	rcu_read_lock();
-	h_cg = hugetlb_cgroup_from_task(current);
-	if (!css_tryget(&h_cg->css)) {
-		rcu_read_unlock();
-		goto again;
-	}
-	rcu_read_unlock();
 
-	if (!page_counter_try_charge(&h_cg->hugepage[idx], nr_pages, &counter))
+	h_cg = hugetlb_cgroup_get_current();
+	if (!page_counter_try_charge(hugetlb_cgroup_counter(h_cg, idx, rsvd),
+				     nr_pages, &counter)) {
 		ret = -ENOMEM;
-	css_put(&h_cg->css);
+		css_put(&h_cg->css);
+		h_cg = NULL;
+	} else if (!rsvd) {
+		css_put(&h_cg->css);
+	}
+	/* rsvd charges keep the css reference, they are not reparented */
 done:
 	*ptr = h_cg;
 	return ret;
 }
 
+int hugetlb_cgroup_charge_cgroup(int idx, unsigned long nr_pages,
+				 struct hugetlb_cgroup **ptr)
+{
+	return __hugetlb_cgroup_charge_cgroup(idx, nr_pages, ptr, false);
+}
+
+int hugetlb_cgroup_charge_cgroup_rsvd(int idx, unsigned long nr_pages,
+				      struct hugetlb_cgroup **ptr)
+{
+	return __hugetlb_cgroup_charge_cgroup(idx, nr_pages, ptr, true);
+}
+
 /* Should be called with hugetlb_lock held */
 void hugetlb_cgroup_commit_charge(int idx, unsigned long nr_pages,
 				  struct hugetlb_cgroup *h_cg,
@@ -222,6 +269,16 @@ void hugetlb_cgroup_commit_charge(int idx, unsigned long nr_pages,
 	return;
 }
 
+void hugetlb_cgroup_commit_charge_rsvd(int idx, unsigned long nr_pages,
+				       struct hugetlb_cgroup *h_cg,
+				       struct page *page)
+{
+	if (hugetlb_cgroup_disabled() || !h_cg)
+		return;
+
+	set_hugetlb_cgroup_rsvd(page, h_cg);
+}
+
 /*
  * Should be called with hugetlb_lock held
  */
@@ -241,6 +298,25 @@ void hugetlb_cgroup_uncharge_page(int idx, unsigned long nr_pages,
 	return;
 }
 
+/*
+ * Should be called with hugetlb_lock held
+ */
+void hugetlb_cgroup_uncharge_page_rsvd(int idx, unsigned long nr_pages,
+				       struct page *page)
+{
+	struct hugetlb_cgroup *h_cg;
+
+	if (hugetlb_cgroup_disabled())
+		return;
+	lockdep_assert_held(&hugetlb_lock);
+	h_cg = hugetlb_cgroup_from_page_rsvd(page);
+	if (!h_cg)
+		return;
+	set_hugetlb_cgroup_rsvd(page, NULL);
+	page_counter_uncharge(&h_cg->rsvd_hugepage[idx], nr_pages);
+	css_put(&h_cg->css);
+}
+
 void hugetlb_cgroup_uncharge_cgroup(int idx, unsigned long nr_pages,
 				    struct hugetlb_cgroup *h_cg)
 {
@@ -254,29 +330,137 @@ void hugetlb_cgroup_uncharge_cgroup(int idx, unsigned long nr_pages,
 	return;
 }
 
+void hugetlb_cgroup_uncharge_cgroup_rsvd(int idx, unsigned long nr_pages,
+					 struct hugetlb_cgroup *h_cg)
+{
+	if (hugetlb_cgroup_disabled() || !h_cg)
+		return;
+
+	if (huge_page_order(&hstates[idx]) < HUGETLB_CGROUP_MIN_ORDER)
+		return;
+
+	page_counter_uncharge(&h_cg->rsvd_hugepage[idx], nr_pages);
+	css_put(&h_cg->css);
+}
+
+/*
+ * Reservations made by hugetlb_reserve_pages() are charged to the rsvd
+ * counter of the resv_map's cgroup, which is the cgroup of the task that
+ * made the first one. For a private mapping that is the mapping task, a
+ * hugetlbfs file is charged as a whole to the cgroup that reserved in it
+ * first. @resv remembers how much it has charged, so that it never gives
+ * back more, and gives back what is left when it is released.
+ */
+int hugetlb_cgroup_charge_resv(struct resv_map *resv, struct hstate *h,
+			       long nr)
+{
+	struct page_counter *rsvd_counter, *counter;
+	struct hugetlb_cgroup *h_cg;
+	unsigned long nr_pages;
+
+	if (hugetlb_cgroup_disabled() || nr <= 0 ||
+	    huge_page_order(h) < HUGETLB_CGROUP_MIN_ORDER)
+		return 0;
+
+	spin_lock(&resv->lock);
+	rsvd_counter = resv->rsvd_counter;
+	spin_unlock(&resv->lock);
+	if (!rsvd_counter) {
+		h_cg = hugetlb_cgroup_get_current();
+		spin_lock(&resv->lock);
+		if (!resv->rsvd_cg) {
+			resv->rsvd_cg = h_cg;
+			resv->rsvd_counter = &h_cg->rsvd_hugepage[hstate_index(h)];
+			h_cg = NULL;
+		}
+		rsvd_counter = resv->rsvd_counter;
+		spin_unlock(&resv->lock);
+		if (h_cg)
+			css_put(&h_cg->css);
+	}
+
+	nr_pages = nr * pages_per_huge_page(h);
+	if (!page_counter_try_charge(rsvd_counter, nr_pages, &counter))
+		return -ENOMEM;
+
+	spin_lock(&resv->lock);
+	resv->rsvd_charged += nr_pages;
+	spin_unlock(&resv->lock);
+	return 0;
+}
+
+void hugetlb_cgroup_uncharge_resv(struct resv_map *resv, struct hstate *h,
+				  long nr)
+{
+	struct page_counter *rsvd_counter;
+	unsigned long nr_pages;
+
+	if (nr <= 0)
+		return;
+
+	spin_lock(&resv->lock);
+	rsvd_counter = resv->rsvd_counter;
+	nr_pages = min_t(unsigned long, nr * pages_per_huge_page(h),
+			 resv->rsvd_charged);
+	resv->rsvd_charged -= nr_pages;
+	spin_unlock(&resv->lock);
+
+	if (nr_pages)
+		page_counter_uncharge(rsvd_counter, nr_pages);
+}
+
+/* @resv is going away, nobody else can charge it */
+void hugetlb_cgroup_release_resv(struct resv_map *resv)
+{
+	if (!resv->rsvd_cg)
+		return;
+
+	if (resv->rsvd_charged)
+		page_counter_uncharge(resv->rsvd_counter, resv->rsvd_charged);
+	css_put(&resv->rsvd_cg->css);
+	resv->rsvd_cg = NULL;
+	resv->rsvd_charged = 0;
+}
+
 enum {
 	RES_USAGE,
+	RES_RSVD_USAGE,
 	RES_LIMIT,
+	RES_RSVD_LIMIT,
 	RES_MAX_USAGE,
+	RES_RSVD_MAX_USAGE,
 	RES_FAILCNT,
+	RES_RSVD_FAILCNT,
 };
 
+static bool hugetlb_cgroup_attr_rsvd(int attr)
+{
+	return attr == RES_RSVD_USAGE || attr == RES_RSVD_LIMIT ||
+	       attr == RES_RSVD_MAX_USAGE || attr == RES_RSVD_FAILCNT;
+}
+
 static u64 hugetlb_cgroup_read_u64(struct cgroup_subsys_state *css,
 				   struct cftype *cft)
 {
 	struct page_counter *counter;
 	struct hugetlb_cgroup *h_cg = hugetlb_cgroup_from_css(css);
+	int attr = MEMFILE_ATTR(cft->private);
 
-	counter = &h_cg->hugepage[MEMFILE_IDX(cft->private)];
+	counter = hugetlb_cgroup_counter(h_cg, MEMFILE_IDX(cft->private),
+					 hugetlb_cgroup_attr_rsvd(attr));
 
-	switch (MEMFILE_ATTR(cft->private)) {
+	switch (attr) {
 	case RES_USAGE:
+	case RES_RSVD_USAGE:
 		return (u64)page_counter_read(counter) * PAGE_SIZE;
 	case RES_LIMIT:
+	case RES_RSVD_LIMIT:
 		return (u64)counter->max * PAGE_SIZE;
 	case RES_MAX_USAGE:
+	case RES_RSVD_MAX_USAGE:
 		return (u64)counter->watermark * PAGE_SIZE;
 	case RES_FAILCNT:
+	case RES_RSVD_FAILCNT:
 		return counter->failcnt;
 	default:
 		BUG();
@@ -305,8 +489,11 @@ static ssize_t hugetlb_cgroup_write(struct kernfs_open_file *of,
 
 	switch (MEMFILE_ATTR(of_cft(of)->private)) {
 	case RES_LIMIT:
+	case RES_RSVD_LIMIT:
 		mutex_lock(&hugetlb_limit_mutex);
-		ret = page_counter_set_max(&h_cg->hugepage[idx], nr_pages);
+		ret = page_counter_set_max(hugetlb_cgroup_counter(h_cg, idx,
+				MEMFILE_ATTR(of_cft(of)->private) == RES_RSVD_LIMIT),
+				nr_pages);
 		mutex_unlock(&hugetlb_limit_mutex);
 		break;
 	default:
@@ -322,14 +509,18 @@ static ssize_t hugetlb_cgroup_reset(struct kernfs_open_file *of,
 	int ret = 0;
 	struct page_counter *counter;
 	struct hugetlb_cgroup *h_cg = hugetlb_cgroup_from_css(of_css(of));
+	int attr = MEMFILE_ATTR(of_cft(of)->private);
 
-	counter = &h_cg->hugepage[MEMFILE_IDX(of_cft(of)->private)];
+	counter = hugetlb_cgroup_counter(h_cg, MEMFILE_IDX(of_cft(of)->private),
+					 hugetlb_cgroup_attr_rsvd(attr));
 
-	switch (MEMFILE_ATTR(of_cft(of)->private)) {
+	switch (attr) {
 	case RES_MAX_USAGE:
+	case RES_RSVD_MAX_USAGE:
 		page_counter_reset_watermark(counter);
 		break;
 	case RES_FAILCNT:
+	case RES_RSVD_FAILCNT:
 		counter->failcnt = 0;
 		break;
 	default:
@@ -386,8 +577,35 @@ static void __init __hugetlb_cgroup_file_init(int idx)
 	cft->write = hugetlb_cgroup_reset;
 	cft->read_u64 = hugetlb_cgroup_read_u64;
 
-	/* NULL terminate the last cft */
+	/* Add the reservation limit file */
 	cft = &h->cgroup_files[4];
+	snprintf(cft->name, MAX_CFTYPE_NAME, "%s.rsvd.limit_in_bytes", buf);
+	cft->private = MEMFILE_PRIVATE(idx, RES_RSVD_LIMIT);
+	cft->read_u64 = hugetlb_cgroup_read_u64;
+	cft->write = hugetlb_cgroup_write;
+
+	/* Add the reservation usage file */
+	cft = &h->cgroup_files[5];
+	snprintf(cft->name, MAX_CFTYPE_NAME, "%s.rsvd.usage_in_bytes", buf);
+	cft->private = MEMFILE_PRIVATE(idx, RES_RSVD_USAGE);
+	cft->read_u64 = hugetlb_cgroup_read_u64;
+
+	/* Add the reservation MAX usage file */
+	cft = &h->cgroup_files[6];
+	snprintf(cft->name, MAX_CFTYPE_NAME, "%s.rsvd.max_usage_in_bytes", buf);
+	cft->private = MEMFILE_PRIVATE(idx, RES_RSVD_MAX_USAGE);
+	cft->write = hugetlb_cgroup_reset;
+	cft->read_u64 = hugetlb_cgroup_read_u64;
+
+	/* Add the reservation failcnt file */
+	cft = &h->cgroup_files[7];
+	snprintf(cft->name, MAX_CFTYPE_NAME, "%s.rsvd.failcnt", buf);
+	cft->private  = MEMFILE_PRIVATE(idx, RES_RSVD_FAILCNT);
+	cft->write = hugetlb_cgroup_reset;
+	cft->read_u64 = hugetlb_cgroup_read_u64;
+
+	/* NULL terminate the last cft */
+	cft = &h->cgroup_files[8];
 	memset(cft, 0, sizeof(*cft));
 
 	WARN_ON(cgroup_add_legacy_cftypes(&hugetlb_cgrp_subsys,
@@ -428,6 +646,10 @@ void hugetlb_cgroup_migrate(struct page *oldhpage, struct page *newhpage)
 
 	/* move the h_cg details to new cgroup */
 	set_hugetlb_cgroup(newhpage, h_cg);
+
+	h_cg = hugetlb_cgroup_from_page_rsvd(oldhpage);
+	set_hugetlb_cgroup_rsvd(oldhpage, NULL);
+	set_hugetlb_cgroup_rsvd(newhpage, h_cg);
 	list_move(&newhpage->lru, &h->hugepage_activelist);
 	spin_unlock(&hugetlb_lock);
 	return;
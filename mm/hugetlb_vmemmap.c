@@ -246,7 +246,8 @@ void free_huge_page_vmemmap(struct hstate *h, struct page *head)
 	unsigned long vmemmap_addr = (unsigned long)head;
 	unsigned long vmemmap_end, vmemmap_reuse;
 
-	if (!free_vmemmap_pages_per_hpage(h))
+	if (!free_vmemmap_pages_per_hpage(h) ||
+	    READ_ONCE(h->free_vmemmap_disabled))
 		return;
 
 	vmemmap_addr += RESERVE_VMEMMAP_SIZE;
@@ -257,12 +258,83 @@ void free_huge_page_vmemmap(struct hstate *h, struct page *head)
 	 * Remap the vmemmap virtual address range [@vmemmap_addr, @vmemmap_end)
 	 * to the page which @vmemmap_reuse is mapped to, then free the pages
 	 * which the range [@vmemmap_addr, @vmemmap_end] is mapped to.
+	 *
+	 * While a pool resize is in progress, the TLB flush and the freeing
+	 * are deferred to hugetlb_vmemmap_batch_end(), so that growing the
+	 * pool by many pages costs a single flush instead of one per page.
 	 */
-	vmemmap_remap_free(vmemmap_addr, vmemmap_end, vmemmap_reuse);
+	if (READ_ONCE(h->vmemmap_batch_depth)) {
+		LIST_HEAD(vmemmap_pages);
+
+		vmemmap_remap_free_batch(vmemmap_addr, vmemmap_end,
+					 vmemmap_reuse, &vmemmap_pages);
+
+		spin_lock(&h->vmemmap_batch_lock);
+		if (h->vmemmap_batch_depth) {
+			list_splice(&vmemmap_pages, &h->vmemmap_batch_pages);
+			h->vmemmap_batch_start = min(h->vmemmap_batch_start,
+						     vmemmap_addr);
+			h->vmemmap_batch_end = max(h->vmemmap_batch_end,
+						   vmemmap_end);
+			vmemmap_addr = 0;
+		}
+		spin_unlock(&h->vmemmap_batch_lock);
+
+		/* The batch was closed under us, flush on our own. */
+		if (vmemmap_addr)
+			vmemmap_free_batch(vmemmap_addr, vmemmap_end,
+					   &vmemmap_pages);
+	} else {
+		vmemmap_remap_free(vmemmap_addr, vmemmap_end, vmemmap_reuse);
+	}
 
 	SetHPageVmemmapOptimized(head);
 }
 
+/*
+ * Open a batch of free_huge_page_vmemmap() calls. Batches may nest, the
+ * TLB is flushed and the gathered vmemmap pages are freed when the last
+ * one is closed by hugetlb_vmemmap_batch_end().
+ *
+ * Only freeing of vmemmap is batched. alloc_huge_page_vmemmap() flushes its
+ * own range before it returns, which also covers any stale entry left by a
+ * still open batch, so restoring a page in the middle of a batch is safe.
+ */
+void hugetlb_vmemmap_batch_begin(struct hstate *h)
+{
+	if (!free_vmemmap_pages_per_hpage(h))
+		return;
+
+	spin_lock(&h->vmemmap_batch_lock);
+	if (!h->vmemmap_batch_depth++) {
+		h->vmemmap_batch_start = ULONG_MAX;
+		h->vmemmap_batch_end = 0;
+	}
+	spin_unlock(&h->vmemmap_batch_lock);
+}
+
+void hugetlb_vmemmap_batch_end(struct hstate *h)
+{
+	LIST_HEAD(vmemmap_pages);
+	unsigned long start, end;
+
+	if (!free_vmemmap_pages_per_hpage(h))
+		return;
+
+	spin_lock(&h->vmemmap_batch_lock);
+	if (--h->vmemmap_batch_depth) {
+		spin_unlock(&h->vmemmap_batch_lock);
+		return;
+	}
+	list_splice_init(&h->vmemmap_batch_pages, &vmemmap_pages);
+	start = h->vmemmap_batch_start;
+	end = h->vmemmap_batch_end;
+	spin_unlock(&h->vmemmap_batch_lock);
+
+	if (!list_empty(&vmemmap_pages))
+		vmemmap_free_batch(start, end, &vmemmap_pages);
+}
+
 void __init hugetlb_vmemmap_init(struct hstate *h)
 {
 	unsigned int nr_pages = pages_per_huge_page(h);
@@ -276,6 +348,9 @@ void __init hugetlb_vmemmap_init(struct hstate *h)
 	BUILD_BUG_ON(__NR_USED_SUBPAGE >=
 		     RESERVE_VMEMMAP_SIZE / sizeof(struct page));
 
+	spin_lock_init(&h->vmemmap_batch_lock);
+	INIT_LIST_HEAD(&h->vmemmap_batch_pages);
+
 	if (!hugetlb_free_vmemmap_enabled)
 		return;
 
@@ -14,6 +14,8 @@
 int alloc_huge_page_vmemmap(struct hstate *h, struct page *head);
 void free_huge_page_vmemmap(struct hstate *h, struct page *head);
 void hugetlb_vmemmap_init(struct hstate *h);
+void hugetlb_vmemmap_batch_begin(struct hstate *h);
+void hugetlb_vmemmap_batch_end(struct hstate *h);
 
 /*
  * How many vmemmap pages associated with a HugeTLB page that can be freed
@@ -37,6 +39,14 @@ static inline void hugetlb_vmemmap_init(struct hstate *h)
 {
 }
 
+static inline void hugetlb_vmemmap_batch_begin(struct hstate *h)
+{
+}
+
+static inline void hugetlb_vmemmap_batch_end(struct hstate *h)
+{
+}
+
 static inline unsigned int free_vmemmap_pages_per_hpage(struct hstate *h)
 {
 	return 0;
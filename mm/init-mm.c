@@ -31,6 +31,12 @@ struct mm_struct init_mm = {
 	.mm_users	= ATOMIC_INIT(2),
 	.mm_count	= ATOMIC_INIT(1),
 	.mmap_sem	= __RWSEM_INITIALIZER(init_mm.mmap_sem),
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	.mmap_seq	= SEQCNT_ZERO(init_mm.mmap_seq),
+#endif
+#ifdef CONFIG_ASYNC_FORK
+	.async_fork_mutex = __MUTEX_INITIALIZER(init_mm.async_fork_mutex),
+#endif
 	.page_table_lock =  __SPIN_LOCK_UNLOCKED(init_mm.page_table_lock),
 	.arg_lock	=  __SPIN_LOCK_UNLOCKED(init_mm.arg_lock),
 	.mmlist		= LIST_HEAD_INIT(init_mm.mmlist),
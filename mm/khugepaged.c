@@ -18,6 +18,7 @@
 #include <linux/page_idle.h>
 #include <linux/swapops.h>
 #include <linux/shmem_fs.h>
+#include <linux/async_fork.h>
 
 #include <asm/tlb.h>
 #include <asm/pgalloc.h>
@@ -50,6 +51,8 @@ enum scan_result {
 	SCAN_CGROUP_CHARGE_FAIL,
 	SCAN_TRUNCATED,
 	SCAN_PAGE_HAS_PRIVATE,
+	SCAN_COLD_PAGE,
+	SCAN_MEMCG_BUDGET,
 };
 
 #define CREATE_TRACE_POINTS
@@ -59,6 +62,13 @@ enum scan_result {
 static unsigned int khugepaged_pages_to_scan __read_mostly;
 static unsigned int khugepaged_pages_collapsed;
 static unsigned int khugepaged_full_scans;
+/*
+ * Skip a pmd range when more than half of its pages have been idle for
+ * at least this many kidled scan periods, 0 means kidled ages are not
+ * checked. Collapsing cold memory wins nothing in TLB and only costs
+ * memory.
+ */
+static unsigned int khugepaged_max_idle_age __read_mostly;
 static unsigned int khugepaged_scan_sleep_millisecs __read_mostly = 10000;
 /* during fragmentation poll the hugepage allocator once every minute */
 static unsigned int khugepaged_alloc_sleep_millisecs __read_mostly = 60000;
@@ -332,11 +342,39 @@ static struct kobj_attribute khugepaged_max_ptes_shared_attr =
 	__ATTR(max_ptes_shared, 0644, khugepaged_max_ptes_shared_show,
 	       khugepaged_max_ptes_shared_store);
 
+static ssize_t khugepaged_max_idle_age_show(struct kobject *kobj,
+					    struct kobj_attribute *attr,
+					    char *buf)
+{
+	return sprintf(buf, "%u\n", khugepaged_max_idle_age);
+}
+
+static ssize_t khugepaged_max_idle_age_store(struct kobject *kobj,
+					     struct kobj_attribute *attr,
+					     const char *buf, size_t count)
+{
+	int err;
+	unsigned long max_idle_age;
+
+	err  = kstrtoul(buf, 10, &max_idle_age);
+	if (err || max_idle_age > U8_MAX)
+		return -EINVAL;
+
+	khugepaged_max_idle_age = max_idle_age;
+
+	return count;
+}
+
+static struct kobj_attribute khugepaged_max_idle_age_attr =
+	__ATTR(max_idle_age, 0644, khugepaged_max_idle_age_show,
+	       khugepaged_max_idle_age_store);
+
 static struct attribute *khugepaged_attr[] = {
 	&khugepaged_defrag_attr.attr,
 	&khugepaged_max_ptes_none_attr.attr,
 	&khugepaged_max_ptes_swap_attr.attr,
 	&khugepaged_max_ptes_shared_attr.attr,
+	&khugepaged_max_idle_age_attr.attr,
 	&pages_to_scan_attr.attr,
 	&pages_collapsed_attr.attr,
 	&full_scans_attr.attr,
@@ -1177,6 +1215,8 @@ static void collapse_huge_page(struct mm_struct *mm,
 	/* check if the pmd is still valid */
 	if (mm_find_pmd(mm, address) != pmd)
 		goto out;
+	/* the ptes are going away: an async-forked child needs them first */
+	async_fork_fixup_pmd(mm, pmd, address);
 
 	anon_vma_lock_write(vma->anon_vma);
 
@@ -1186,6 +1226,7 @@ static void collapse_huge_page(struct mm_struct *mm,
 	mmun_start = address;
 	mmun_end   = address + HPAGE_PMD_SIZE;
 	mmu_notifier_invalidate_range_start(mm, mmun_start, mmun_end);
+	mmap_seq_write_begin(mm);
 	pmd_ptl = pmd_lock(mm, pmd); /* probably unnecessary */
 	/*
 	 * After this gup_fast can't run anymore. This also removes
@@ -1195,6 +1236,7 @@ static void collapse_huge_page(struct mm_struct *mm,
 	 */
 	_pmd = pmdp_collapse_flush(vma, address, pmd);
 	spin_unlock(pmd_ptl);
+	mmap_seq_write_end(mm);
 	mmu_notifier_invalidate_range_end(mm, mmun_start, mmun_end);
 
 	spin_lock(pte_ptl);
@@ -1272,7 +1314,8 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 	pmd_t *pmd;
 	pte_t *pte, *_pte;
 	int ret = 0, result = 0, referenced = 0;
-	int none_or_zero = 0, shared = 0;
+	int none_or_zero = 0, shared = 0, idle = 0;
+	unsigned int max_idle_age = READ_ONCE(khugepaged_max_idle_age);
 	struct page *page = NULL;
 	unsigned long _address;
 	spinlock_t *ptl;
@@ -1380,11 +1423,19 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 		    page_is_young(page) || PageReferenced(page) ||
 		    mmu_notifier_test_young(vma->vm_mm, address))
 			referenced++;
+		if (max_idle_age &&
+		    kidled_get_page_age(page_pgdat(page), page_to_pfn(page)) >=
+		    (int)max_idle_age)
+			idle++;
 	}
 	if (!writable) {
 		result = SCAN_PAGE_RO;
 	} else if (!referenced || (unmapped && referenced < HPAGE_PMD_NR/2)) {
 		result = SCAN_LACK_REFERENCED_PAGE;
+	} else if (idle > HPAGE_PMD_NR / 2) {
+		result = SCAN_COLD_PAGE;
+	} else if (!mem_cgroup_khugepaged_charge(mm)) {
+		result = SCAN_MEMCG_BUDGET;
 	} else {
 		result = SCAN_SUCCEED;
 		ret = 1;
@@ -1539,11 +1590,13 @@ void collapse_pte_mapped_thp(struct mm_struct *mm, unsigned long addr)
 	}
 
 	/* step 4: collapse pmd */
+	mmap_seq_write_begin(mm);
 	ptl = pmd_lock(vma->vm_mm, pmd);
 	_pmd = pmdp_collapse_flush(vma, haddr, pmd);
 	spin_unlock(ptl);
 	mm_dec_nr_ptes(mm);
 	pte_free(mm, pmd_pgtable(_pmd));
+	mmap_seq_write_end(mm);
 
 drop_hpage:
 	unlock_page(hpage);
@@ -1623,12 +1676,16 @@ static void retract_page_tables(struct address_space *mapping, pgoff_t pgoff)
 		 */
 		if (down_write_trylock(&mm->mmap_sem)) {
 			if (!khugepaged_test_exit(mm)) {
-				spinlock_t *ptl = pmd_lock(mm, pmd);
+				spinlock_t *ptl;
+
+				mmap_seq_write_begin(mm);
+				ptl = pmd_lock(mm, pmd);
 				/* assume page table is clear */
 				_pmd = pmdp_collapse_flush(vma, addr, pmd);
 				spin_unlock(ptl);
 				mm_dec_nr_ptes(mm);
 				pte_free(mm, pmd_pgtable(_pmd));
+				mmap_seq_write_end(mm);
 			}
 			up_write(&mm->mmap_sem);
 		} else {
@@ -1890,7 +1947,7 @@ static void collapse_file(struct mm_struct *mm,
 	}
 
 	if (is_shmem)
-		__inc_node_page_state(new_page, NR_SHMEM_THPS);
+		__inc_lruvec_page_state(new_page, NR_SHMEM_THPS);
 	else {
 		__inc_node_page_state(new_page, NR_FILE_THPS);
 		filemap_nr_thps_inc(mapping);
@@ -2081,6 +2138,8 @@ static void khugepaged_scan_file(struct mm_struct *mm,
 	if (result == SCAN_SUCCEED) {
 		if (present < HPAGE_PMD_NR - khugepaged_max_ptes_none) {
 			result = SCAN_EXCEED_NONE_PTE;
+		} else if (!mem_cgroup_khugepaged_charge(mm)) {
+			result = SCAN_MEMCG_BUDGET;
 		} else {
 			node = khugepaged_find_target_node();
 			collapse_file(mm, file, start, hpage, node);
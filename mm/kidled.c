@@ -8,6 +8,8 @@
 #include <linux/pagemap.h>
 #include <linux/page-flags.h>
 #include <linux/page_idle.h>
+#include <linux/seq_file.h>
+#include <linux/swap.h>
 #include <linux/vmalloc.h>
 #include <linux/wait.h>
 #include <linux/kidled.h>
@@ -72,6 +74,14 @@ const int kidled_default_buckets[NUM_KIDLED_BUCKETS] = {
 	1, 2, 5, 15, 30, 60, 120, 240 };
 static DECLARE_WAIT_QUEUE_HEAD(kidled_wait);
 static unsigned long kidled_scan_rounds __read_mostly;
+/*
+ * CPU budget of kidled in percentage of one CPU. Zero means no budget,
+ * kidled then scans (node_spanned_pages / scan_period) pages per second
+ * and relies on the emergency throttle only. Otherwise each one second
+ * slice is cut short once the budget is consumed, and scanning resumes
+ * from the per-node cursor in the next slice.
+ */
+static unsigned int kidled_scan_cpu_pct __read_mostly;
 
 static inline int kidled_get_bucket(int *idle_buckets, int age)
 {
@@ -146,23 +156,29 @@ EXPORT_SYMBOL_GPL(kidled_set_page_age);
 #endif /* !KIDLED_AGE_NOT_IN_PAGE_FLAGS */
 
 #ifdef CONFIG_MEMCG
-static inline void kidled_mem_cgroup_account(struct page *page,
+/*
+ * Account the idle page to its memory cgroup. Return true if the page
+ * has been idle for at least memory.cold_reclaim_age scan periods, so
+ * the caller should try to reclaim it.
+ */
+static inline bool kidled_mem_cgroup_account(struct page *page,
 					     int age,
 					     int nr_pages)
 {
 	struct mem_cgroup *memcg;
 	struct idle_page_stats *stats;
-	int type, bucket;
+	int type, bucket, cold_age;
+	bool cold;
 
 	if (mem_cgroup_disabled())
-		return;
+		return false;
 
 	type = kidled_get_idle_type(page);
 
 	memcg = lock_page_memcg(page);
 	if (unlikely(!memcg)) {
 		unlock_page_memcg(page);
-		return;
+		return false;
 	}
 
 	stats = mem_cgroup_get_unstable_idle_stats(memcg);
@@ -170,7 +186,11 @@ static inline void kidled_mem_cgroup_account(struct page *page,
 	if (bucket >= 0)
 		stats->count[type][bucket] += nr_pages;
 
+	cold_age = READ_ONCE(memcg->cold_reclaim_age);
+	cold = cold_age && age >= cold_age && !(type & KIDLE_UNEVICT);
+
 	unlock_page_memcg(page);
+	return cold;
 }
 
 void kidled_mem_cgroup_move_stats(struct mem_cgroup *from,
@@ -293,10 +313,11 @@ static inline void kidled_mem_cgroup_reset(void)
 	}
 }
 #else /* !CONFIG_MEMCG */
-static inline void kidled_mem_cgroup_account(struct page *page,
+static inline bool kidled_mem_cgroup_account(struct page *page,
 					     int age,
 					     int nr_pages)
 {
+	return false;
 }
 static inline void kidled_mem_cgroup_scan_done(struct kidled_scan_period
 					       scan_period)
@@ -356,7 +377,54 @@ static inline bool kidled_need_check_idle(pg_data_t *pgdat, unsigned long pfn)
 		return (pseudo_random & 0x7UL) == 0x7UL;
 }
 
-static inline int kidled_scan_page(pg_data_t *pgdat, unsigned long pfn)
+/*
+ * Return the number of pages from @pfn to the end of the compound page
+ * it belongs to. We don't hold a reference, the compound page might be
+ * freed or split under us, so never return less than one page.
+ */
+static inline int kidled_compound_nr_left(struct page *page,
+					  unsigned long pfn)
+{
+	struct page *head = compound_head(page);
+	long nr;
+
+	nr = (1L << compound_order(head)) - (pfn - page_to_pfn(head));
+	return nr > 0 ? nr : 1;
+}
+
+/*
+ * Take the cold page off LRU so that it can be reclaimed in a batch by
+ * kidled_reclaim_cold_pages(). We don't hold any reference on the page
+ * at this point, so pin it before isolating.
+ */
+static inline void kidled_isolate_cold_page(struct page *page,
+					    struct list_head *cold,
+					    unsigned int *nr_cold)
+{
+	if (!get_page_unless_zero(page))
+		return;
+
+	if (likely(PageLRU(page)) && !PageUnevictable(page) &&
+	    !isolate_lru_page(page)) {
+		list_add(&page->lru, cold);
+		(*nr_cold)++;
+	}
+	put_page(page);
+}
+
+static inline void kidled_reclaim_cold_pages(struct list_head *cold,
+					     unsigned int *nr_cold)
+{
+	if (!*nr_cold)
+		return;
+
+	reclaim_pages(cold);
+	*nr_cold = 0;
+}
+
+static inline int kidled_scan_page(pg_data_t *pgdat, unsigned long pfn,
+				   struct list_head *cold,
+				   unsigned int *nr_cold)
 {
 	struct page *page;
 	int age, nr_pages = 1, idx;
@@ -366,8 +434,24 @@ static inline int kidled_scan_page(pg_data_t *pgdat, unsigned long pfn)
 		goto out;
 
 	page = pfn_to_page(pfn);
-	if (!page || !PageLRU(page)) {
+	if (!page)
+		goto out;
+
+	/*
+	 * A compound page is aged as a whole through its head page, which
+	 * needs only one rmap walk. Skip the tail pages in one step, it's
+	 * important for hugetlb pages which are never on LRU, otherwise
+	 * we would visit each of the 262144 pfns of a 1GB page.
+	 */
+	if (PageTail(page)) {
+		nr_pages = kidled_compound_nr_left(page, pfn);
+		goto out;
+	}
+
+	if (!PageLRU(page)) {
 		kidled_set_page_age(pgdat, pfn, 0);
+		if (PageCompound(page))
+			nr_pages = kidled_compound_nr_left(page, pfn);
 		goto out;
 	}
 
@@ -416,10 +500,10 @@ static inline int kidled_scan_page(pg_data_t *pgdat, unsigned long pfn)
 
 	if (idle) {
 		age = kidled_inc_page_age(pgdat, pfn);
-		if (age > 0)
-			kidled_mem_cgroup_account(page, age, nr_pages);
-		else
+		if (age <= 0)
 			age = 0;
+		else if (kidled_mem_cgroup_account(page, age, nr_pages))
+			kidled_isolate_cold_page(page, cold, nr_cold);
 	} else {
 		age = 0;
 		kidled_set_page_age(pgdat, pfn, 0);
@@ -439,9 +523,12 @@ static inline int kidled_scan_page(pg_data_t *pgdat, unsigned long pfn)
 
 static bool kidled_scan_node(pg_data_t *pgdat,
 			     struct kidled_scan_period scan_period,
-			     bool restart)
+			     bool restart, unsigned long budget)
 {
 	unsigned long pfn, end, node_end;
+	unsigned long deadline = jiffies + budget;
+	unsigned int nr_cold = 0;
+	LIST_HEAD(cold);
 
 #ifdef KIDLED_AGE_NOT_IN_PAGE_FLAGS
 	if (unlikely(!pgdat->node_page_age)) {
@@ -469,9 +556,16 @@ static bool kidled_scan_node(pg_data_t *pgdat,
 		if (unlikely(!kidled_is_scan_period_equal(&scan_period)))
 			break;
 
+		/* Resume from here in next slice when running out of budget */
+		if (budget && time_after_eq(jiffies, deadline))
+			break;
+
 		cond_resched();
-		pfn += kidled_scan_page(pgdat, pfn);
+		pfn += kidled_scan_page(pgdat, pfn, &cold, &nr_cold);
+		if (nr_cold >= SWAP_CLUSTER_MAX)
+			kidled_reclaim_cold_pages(&cold, &nr_cold);
 	}
+	kidled_reclaim_cold_pages(&cold, &nr_cold);
 
 	pgdat->node_idle_scan_pfn = pfn;
 	return pfn >= node_end;
@@ -570,6 +664,8 @@ static int kidled(void *dummy)
 	while (!kthread_should_stop()) {
 		pg_data_t *pgdat;
 		u64 start_jiffies, elapsed;
+		unsigned long budget = 0;
+		unsigned int cpu_pct;
 		bool new, scan_done = true;
 
 		wait_event_interruptible(kidled_wait,
@@ -582,12 +678,21 @@ static int kidled(void *dummy)
 		if (unlikely(scan_period.duration == 0))
 			continue;
 
+		/*
+		 * Share the budget of this slice among the nodes, so a busy
+		 * node can't starve the nodes behind it.
+		 */
+		cpu_pct = READ_ONCE(kidled_scan_cpu_pct);
+		if (cpu_pct)
+			budget = max_t(unsigned long, 1,
+				       HZ * cpu_pct / 100 / num_online_nodes());
+
 		start_jiffies = jiffies_64;
 		get_online_mems();
 		for_each_online_pgdat(pgdat) {
 			scan_done &= kidled_scan_node(pgdat,
 						      scan_period,
-						      restart);
+						      restart, budget);
 		}
 		put_online_mems();
 
@@ -644,6 +749,177 @@ static int kidled(void *dummy)
 	return 0;
 }
 
+static void kidled_mm_account(struct idle_page_stats *stats,
+			      struct page *page, int nr_pages)
+{
+	int age, bucket;
+
+	if (!PageLRU(page))
+		return;
+
+	age = kidled_get_page_age(page_pgdat(page), page_to_pfn(page));
+	bucket = kidled_get_bucket(stats->buckets, age);
+	if (bucket >= 0)
+		stats->count[kidled_get_idle_type(page)][bucket] += nr_pages;
+}
+
+static int kidled_mm_pte_range(pmd_t *pmd, unsigned long addr,
+			       unsigned long end, struct mm_walk *walk)
+{
+	struct idle_page_stats *stats = walk->private;
+	struct vm_area_struct *vma = walk->vma;
+	struct page *page;
+	spinlock_t *ptl;
+	pte_t *pte;
+
+	ptl = pmd_trans_huge_lock(pmd, vma);
+	if (ptl) {
+		if (pmd_present(*pmd)) {
+			page = vm_normal_page_pmd(vma, addr, *pmd);
+			if (page)
+				kidled_mm_account(stats, page, HPAGE_PMD_NR);
+		}
+		spin_unlock(ptl);
+		goto out;
+	}
+
+	if (pmd_trans_unstable(pmd))
+		goto out;
+
+	pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
+	for (; addr != end; pte++, addr += PAGE_SIZE) {
+		if (!pte_present(*pte))
+			continue;
+
+		page = vm_normal_page(vma, addr, *pte);
+		if (!page)
+			continue;
+
+		kidled_mm_account(stats, page, 1);
+	}
+	pte_unmap_unlock(pte - 1, ptl);
+out:
+	cond_resched();
+	return 0;
+}
+
+/*
+ * Build the idle page histogram of the pages mapped by @mm. Nothing is
+ * accumulated for a process while scanning, the page ages recorded by
+ * kidled in last rounds are collected by walking the page tables here.
+ * The buckets of the memory cgroup which @mm belongs to are used, so
+ * the result is comparable with memory.idle_page_stats. Pages shared
+ * by several processes are accounted to each of them.
+ */
+int kidled_mm_idle_page_stats(struct mm_struct *mm,
+			      struct idle_page_stats *stats)
+{
+	struct mm_walk walk = {
+		.pmd_entry	= kidled_mm_pte_range,
+		.mm		= mm,
+		.private	= stats,
+	};
+#ifdef CONFIG_MEMCG
+	struct mem_cgroup *memcg;
+#endif
+	int ret;
+
+	memset(stats, 0, sizeof(*stats));
+	memcpy(stats->buckets, kidled_default_buckets,
+	       sizeof(kidled_default_buckets));
+#ifdef CONFIG_MEMCG
+	memcg = get_mem_cgroup_from_mm(mm);
+	if (memcg) {
+		down_read(&memcg->idle_stats_rwsem);
+		memcpy(stats->buckets,
+		       mem_cgroup_get_stable_idle_stats(memcg)->buckets,
+		       sizeof(stats->buckets));
+		up_read(&memcg->idle_stats_rwsem);
+		css_put(&memcg->css);
+	}
+#endif
+	if (KIDLED_IS_BUCKET_INVALID(stats->buckets))
+		return 0;
+
+	ret = down_read_killable(&mm->mmap_sem);
+	if (ret)
+		return ret;
+	ret = walk_page_range(0, mm->highest_vm_end, &walk);
+	up_read(&mm->mmap_sem);
+
+	return ret;
+}
+
+/*
+ * Show the buckets and the histogram of @stats, which is shared by
+ * memory.idle_page_stats and /proc/<pid>/idle_page_stats.
+ */
+void kidled_show_idle_page_stats(struct seq_file *m,
+				 struct idle_page_stats *stats)
+{
+	int i, j = 0, t;
+
+	seq_puts(m, "# buckets: ");
+	if (KIDLED_IS_BUCKET_INVALID(stats->buckets)) {
+		seq_puts(m, "no valid bucket available\n");
+		return;
+	}
+
+	for (i = 0; i < NUM_KIDLED_BUCKETS; i++) {
+		seq_printf(m, "%d", stats->buckets[i]);
+
+		if ((i == NUM_KIDLED_BUCKETS - 1) ||
+		    !stats->buckets[i + 1]) {
+			seq_puts(m, "\n");
+			j = i + 1;
+			break;
+		}
+		seq_puts(m, ",");
+	}
+	seq_puts(m, "#\n");
+
+	seq_puts(m, "#   _-----=> clean/dirty\n");
+	seq_puts(m, "#  / _----=> swap/file\n");
+	seq_puts(m, "# | / _---=> evict/unevict\n");
+	seq_puts(m, "# || / _--=> inactive/active\n");
+	seq_puts(m, "# ||| /\n");
+
+	seq_printf(m, "# %-8s", "||||");
+	for (i = 0; i < j; i++) {
+		char region[20];
+
+		if (i == j - 1) {
+			snprintf(region, sizeof(region), "[%d,+inf)",
+				 stats->buckets[i]);
+		} else {
+			snprintf(region, sizeof(region), "[%d,%d)",
+				 stats->buckets[i],
+				 stats->buckets[i + 1]);
+		}
+
+		seq_printf(m, " %14s", region);
+	}
+	seq_puts(m, "\n");
+
+	for (t = 0; t < KIDLE_NR_TYPE; t++) {
+		char kidled_type_str[5];
+
+		kidled_type_str[0] = t & KIDLE_DIRTY   ? 'd' : 'c';
+		kidled_type_str[1] = t & KIDLE_FILE    ? 'f' : 's';
+		kidled_type_str[2] = t & KIDLE_UNEVICT ? 'u' : 'e';
+		kidled_type_str[3] = t & KIDLE_ACTIVE  ? 'a' : 'i';
+		kidled_type_str[4] = '\0';
+		seq_printf(m, "  %-8s", kidled_type_str);
+
+		for (i = 0; i < j; i++) {
+			seq_printf(m, " %14lu",
+				   stats->count[t][i] << PAGE_SHIFT);
+		}
+
+		seq_puts(m, "\n");
+	}
+}
+
 bool kidled_use_hierarchy(void)
 {
 	return use_hierarchy;
@@ -676,6 +952,28 @@ static ssize_t kidled_scan_period_store(struct kobject *kobj,
 	return count;
 }
 
+static ssize_t kidled_scan_cpu_pct_show(struct kobject *kobj,
+					struct kobj_attribute *attr,
+					char *buf)
+{
+	return sprintf(buf, "%u\n", kidled_scan_cpu_pct);
+}
+
+static ssize_t kidled_scan_cpu_pct_store(struct kobject *kobj,
+					 struct kobj_attribute *attr,
+					 const char *buf, size_t count)
+{
+	unsigned long val;
+	int ret;
+
+	ret = kstrtoul(buf, 10, &val);
+	if (ret || val > 100)
+		return -EINVAL;
+
+	WRITE_ONCE(kidled_scan_cpu_pct, val);
+	return count;
+}
+
 static ssize_t kidled_use_hierarchy_show(struct kobject *kobj,
 					 struct kobj_attribute *attr,
 					 char *buf)
@@ -719,12 +1017,16 @@ static ssize_t kidled_use_hierarchy_store(struct kobject *kobj,
 static struct kobj_attribute kidled_scan_period_attr =
 	__ATTR(scan_period_in_seconds, 0644,
 	       kidled_scan_period_show, kidled_scan_period_store);
+static struct kobj_attribute kidled_scan_cpu_pct_attr =
+	__ATTR(scan_cpu_pct, 0644,
+	       kidled_scan_cpu_pct_show, kidled_scan_cpu_pct_store);
 static struct kobj_attribute kidled_use_hierarchy_attr =
 	__ATTR(use_hierarchy, 0644,
 	       kidled_use_hierarchy_show, kidled_use_hierarchy_store);
 
 static struct attribute *kidled_attrs[] = {
 	&kidled_scan_period_attr.attr,
+	&kidled_scan_cpu_pct_attr.attr,
 	&kidled_use_hierarchy_attr.attr,
 	NULL
 };
@@ -55,16 +55,6 @@ list_lru_from_memcg_idx(struct list_lru_node *nlru, int idx)
 	return &nlru->lru;
 }
 
-static __always_inline struct mem_cgroup *mem_cgroup_from_kmem(void *ptr)
-{
-	struct page *page;
-
-	if (!memcg_kmem_enabled())
-		return NULL;
-	page = virt_to_head_page(ptr);
-	return page->mem_cgroup;
-}
-
 static inline struct list_lru_one *
 list_lru_from_kmem(struct list_lru_node *nlru, void *ptr,
 		   struct mem_cgroup **memcg_ptr)
@@ -75,7 +65,10 @@ list_lru_from_kmem(struct list_lru_node *nlru, void *ptr,
 	if (!nlru->memcg_lrus)
 		goto out;
 
-	memcg = mem_cgroup_from_kmem(ptr);
+	if (!memcg_kmem_enabled())
+		goto out;
+
+	memcg = mem_cgroup_from_obj(ptr);
 	if (!memcg)
 		goto out;
 
@@ -126,7 +119,10 @@ bool list_lru_add(struct list_lru *lru, struct list_head *item)
 	struct list_lru_node *nlru = &lru->node[nid];
 	struct mem_cgroup *memcg;
 	struct list_lru_one *l;
+	bool ret = false;
 
+	/* the memcg of a slab object may be switched to its parent */
+	rcu_read_lock();
 	spin_lock(&nlru->lock);
 	if (list_empty(item)) {
 		l = list_lru_from_kmem(nlru, item, &memcg);
@@ -136,11 +132,11 @@ bool list_lru_add(struct list_lru *lru, struct list_head *item)
 			memcg_set_shrinker_bit(memcg, nid,
 					       lru_shrinker_id(lru));
 		nlru->nr_items++;
-		spin_unlock(&nlru->lock);
-		return true;
+		ret = true;
 	}
 	spin_unlock(&nlru->lock);
-	return false;
+	rcu_read_unlock();
+	return ret;
 }
 EXPORT_SYMBOL_GPL(list_lru_add);
 
@@ -149,18 +145,20 @@ bool list_lru_del(struct list_lru *lru, struct list_head *item)
 	int nid = page_to_nid(virt_to_page(item));
 	struct list_lru_node *nlru = &lru->node[nid];
 	struct list_lru_one *l;
+	bool ret = false;
 
+	rcu_read_lock();
 	spin_lock(&nlru->lock);
 	if (!list_empty(item)) {
 		l = list_lru_from_kmem(nlru, item, NULL);
 		list_del_init(item);
 		l->nr_items--;
 		nlru->nr_items--;
-		spin_unlock(&nlru->lock);
-		return true;
+		ret = true;
 	}
 	spin_unlock(&nlru->lock);
-	return false;
+	rcu_read_unlock();
+	return ret;
 }
 EXPORT_SYMBOL_GPL(list_lru_del);
 
@@ -25,6 +25,7 @@
 #include <linux/swapops.h>
 #include <linux/shmem_fs.h>
 #include <linux/mmu_notifier.h>
+#include <linux/async_fork.h>
 
 #include <asm/tlb.h>
 
@@ -192,7 +193,9 @@ static long madvise_behavior(struct vm_area_struct *vma,
 	/*
 	 * vm_flags is protected by the mmap_sem held in write mode.
 	 */
+	mmap_seq_write_begin(mm);
 	vma->vm_flags = new_flags;
+	mmap_seq_write_end(mm);
 out:
 	return error;
 }
@@ -606,6 +609,9 @@ static int madvise_free_pte_range(pmd_t *pmd, unsigned long addr,
 	if (pmd_trans_unstable(pmd))
 		return 0;
 
+	/* reclaim may drop lazy-free pages before a child copied them */
+	async_fork_fixup_pmd(mm, pmd, addr);
+
 	tlb_remove_check_page_size_change(tlb, PAGE_SIZE);
 	orig_pte = pte = pte_offset_map_lock(mm, pmd, addr, &ptl);
 	flush_tlb_batched_pending(mm);
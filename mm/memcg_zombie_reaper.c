@@ -4,6 +4,8 @@
  *   echo 1 > /sys/kernel/mm/memcg_reaper/reap_background
  * - one-shot reap triggerred by users
  *   echo 1 > /sys/kernel/mm/memcg_reaper/reap
+ * - statistics of the last round
+ *   cat /sys/kernel/mm/memcg_reaper/stat
  *
  * Copyright (C) 2019 Alibaba
  * Author: Xunlei Pang <xlpang@linux.alibaba.com>
@@ -27,6 +29,9 @@
 #include <linux/delay.h>
 #include <linux/memcontrol.h>
 #include <linux/swap.h> /* try_to_free_mem_cgroup_pages */
+#include <linux/sort.h>
+#include <linux/workqueue.h>
+#include <linux/mm.h>
 
 #define for_each_mem_cgroup_tree(iter, root)		\
 	for (iter = mem_cgroup_iter(root, NULL, NULL);	\
@@ -40,6 +45,12 @@ static unsigned int reaper_scan_interval = 5; /* in seconds */
 /* pages one scan, 5GiB for 4KiB page size */
 static unsigned int reaper_pages_scan = 1310720;
 
+/* Statistics of the last completed round, see the "stat" file */
+static unsigned long reaper_rounds;
+static unsigned int reaper_last_zombies;
+static unsigned int reaper_last_emptied;
+static unsigned long reaper_last_reclaimed;
+
 static DECLARE_WAIT_QUEUE_HEAD(reaper_waitq);
 
 #ifdef CONFIG_SYSFS
@@ -166,12 +177,22 @@ static ssize_t reap_store(struct kobject *kobj,
 }
 REAPER_ATTR(reap);
 
+static ssize_t stat_show(struct kobject *kobj,
+			 struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "rounds %lu\nzombies %u\nemptied %u\nreclaimed %lu\n",
+		       reaper_rounds, reaper_last_zombies,
+		       reaper_last_emptied, reaper_last_reclaimed);
+}
+static struct kobj_attribute stat_attr = __ATTR_RO(stat);
+
 static struct attribute *reaper_attrs[] = {
 	&pages_scan_attr.attr,
 	&scan_interval_attr.attr,
 	&verbose_attr.attr,
 	&reap_background_attr.attr,
 	&reap_attr.attr,
+	&stat_attr.attr,
 	NULL,
 };
 
@@ -181,9 +202,41 @@ static struct attribute_group reaper_attr_group = {
 };
 #endif
 
-static char name_buf[1024];
+/*
+ * Zombies are reaped largest first: the ones with the biggest residual
+ * charge pin the most memory, and among equals the ones holding more
+ * kernel memory are preferred since that is usually what keeps them alive.
+ */
+struct zombie_memcg {
+	struct mem_cgroup *memcg;
+	unsigned long usage;
+	unsigned long kmem;
+};
+
+/* One reap round, shared by the per-node workers */
+struct reaper_control {
+	struct zombie_memcg *zombies;
+	unsigned int nr_zombies;
+	atomic_t next;
+	bool background;
+	unsigned long budget;
+	atomic_long_t reclaimed;
+	atomic_t emptied;
+};
+
+struct reaper_work {
+	struct work_struct work;
+	struct reaper_control *rc;
+	char name_buf[1024];
+};
+
+static struct workqueue_struct *reaper_wq;
+/* Per-node workers, serialized across rounds by reaper_mutex */
+static struct reaper_work *reaper_works;
+static DEFINE_MUTEX(reaper_mutex);
+
 static unsigned long
-do_reap_zombie_memcg(struct mem_cgroup *memcg, bool background)
+do_reap_zombie_memcg(struct mem_cgroup *memcg, bool background, char *name_buf)
 {
 	unsigned long did_some = 0;
 	bool drained = false;
@@ -214,7 +267,7 @@ do_reap_zombie_memcg(struct mem_cgroup *memcg, bool background)
 	}
 
 	if (reaper_verbose) {
-		cgroup_name(memcg->css.cgroup, name_buf, sizeof(name_buf));
+		cgroup_name(memcg->css.cgroup, name_buf, 1024);
 		if (page_counter_read(&memcg->memory) == 0) {
 			printk_ratelimited("empty zombie memcg: 0x%lx: %s\n",
 				(unsigned long)memcg, name_buf);
@@ -229,24 +282,134 @@ do_reap_zombie_memcg(struct mem_cgroup *memcg, bool background)
 	return did_some;
 }
 
-static void reap_zombie_memcgs(bool background)
+static void reap_zombie_workfn(struct work_struct *work)
+{
+	struct reaper_work *rw = container_of(work, struct reaper_work, work);
+	struct reaper_control *rc = rw->rc;
+	struct mem_cgroup *memcg;
+	unsigned int i;
+
+	while ((i = atomic_inc_return(&rc->next) - 1) < rc->nr_zombies) {
+		if (rc->background &&
+		    atomic_long_read(&rc->reclaimed) >= rc->budget)
+			break;
+
+		memcg = rc->zombies[i].memcg;
+		atomic_long_add(do_reap_zombie_memcg(memcg, rc->background,
+						     rw->name_buf),
+				&rc->reclaimed);
+		if (!page_counter_read(&memcg->memory))
+			atomic_inc(&rc->emptied);
+		cond_resched();
+	}
+}
+
+static int zombie_memcg_cmp(const void *a, const void *b)
+{
+	const struct zombie_memcg *za = a, *zb = b;
+
+	if (za->usage != zb->usage)
+		return za->usage > zb->usage ? -1 : 1;
+	if (za->kmem != zb->kmem)
+		return za->kmem > zb->kmem ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Take a reference on every dying memcg and record its residual charge.
+ * The array is sized by a first pass; zombies showing up in between are
+ * simply left for the next round.
+ */
+static unsigned int collect_zombie_memcgs(struct zombie_memcg **zombiesp)
 {
-	unsigned long reclaimed;
-	unsigned long reclaimed_threshold;
+	struct zombie_memcg *zombies;
 	struct mem_cgroup *iter;
+	unsigned int nr = 0, max = 0;
 
-	reclaimed = 0;
-	reclaimed_threshold = reaper_pages_scan;
 	for_each_mem_cgroup_tree(iter, NULL) {
-		if (background && reclaimed >= reclaimed_threshold) {
+		if (!mem_cgroup_online(iter))
+			max++;
+	}
+	if (!max)
+		return 0;
+
+	zombies = kvmalloc_array(max, sizeof(*zombies), GFP_KERNEL);
+	if (!zombies)
+		return 0;
+
+	for_each_mem_cgroup_tree(iter, NULL) {
+		if (mem_cgroup_online(iter))
+			continue;
+		if (nr >= max) {
 			mem_cgroup_iter_break(NULL, iter);
 			break;
 		}
-		if (mem_cgroup_online(iter))
+		if (!css_tryget(&iter->css))
 			continue;
-		reclaimed += do_reap_zombie_memcg(iter, background);
-		cond_resched();
+		zombies[nr].memcg = iter;
+		zombies[nr].usage = page_counter_read(&iter->memory);
+		zombies[nr].kmem = page_counter_read(&iter->kmem);
+		nr++;
+	}
+
+	sort(zombies, nr, sizeof(*zombies), zombie_memcg_cmp, NULL);
+	*zombiesp = zombies;
+
+	return nr;
+}
+
+static void reap_zombie_memcgs(bool background)
+{
+	struct reaper_control rc = {
+		.background = background,
+		.budget = reaper_pages_scan,
+		.next = ATOMIC_INIT(0),
+		.reclaimed = ATOMIC_LONG_INIT(0),
+		.emptied = ATOMIC_INIT(0),
+	};
+	unsigned int i;
+	int nid, cpu;
+
+	mutex_lock(&reaper_mutex);
+
+	rc.nr_zombies = collect_zombie_memcgs(&rc.zombies);
+	if (!rc.nr_zombies)
+		goto out;
+
+	/*
+	 * One worker per memory node, each running on the node's unbound
+	 * pool so that reclaim starts from node-local lruvecs. The workers
+	 * pull zombies off the ranked array, largest first.
+	 */
+	for_each_node_state(nid, N_MEMORY) {
+		cpu = cpumask_any_and(cpumask_of_node(nid), cpu_online_mask);
+		if (cpu >= nr_cpu_ids)
+			cpu = WORK_CPU_UNBOUND;
+		reaper_works[nid].rc = &rc;
+		queue_work_on(cpu, reaper_wq, &reaper_works[nid].work);
 	}
+	for_each_node(nid) {
+		if (!reaper_works[nid].rc)
+			continue;
+		flush_work(&reaper_works[nid].work);
+		reaper_works[nid].rc = NULL;
+	}
+
+	for (i = 0; i < rc.nr_zombies; i++)
+		css_put(&rc.zombies[i].memcg->css);
+	kvfree(rc.zombies);
+
+out:
+	reaper_rounds++;
+	reaper_last_zombies = rc.nr_zombies;
+	reaper_last_emptied = atomic_read(&rc.emptied);
+	reaper_last_reclaimed = atomic_long_read(&rc.reclaimed);
+	mutex_unlock(&reaper_mutex);
+
+	if (reaper_verbose && rc.nr_zombies)
+		pr_info("memcg_reaper: %u zombies, %u emptied, %lu pages reclaimed\n",
+			rc.nr_zombies, reaper_last_emptied,
+			reaper_last_reclaimed);
 
 	if (background && reaper_scan_interval)
 		msleep_interruptible(reaper_scan_interval*1000);
@@ -276,13 +439,30 @@ static int zombie_reaper_thread(void *unused)
 static int __init memcg_zombie_reaper_init(void)
 {
 	static struct task_struct *zombie_reaper;
-	int err;
+	int err, nid;
+
+	reaper_wq = alloc_workqueue("memcg_reaper",
+				    WQ_UNBOUND | WQ_FREEZABLE, 0);
+	if (!reaper_wq) {
+		pr_err("%s: Unable to allocate reaper workqueue\n", __func__);
+		return -ENOMEM;
+	}
+
+	reaper_works = kcalloc(nr_node_ids, sizeof(*reaper_works), GFP_KERNEL);
+	if (!reaper_works) {
+		destroy_workqueue(reaper_wq);
+		pr_err("%s: Unable to allocate reaper works\n", __func__);
+		return -ENOMEM;
+	}
+	for_each_node(nid)
+		INIT_WORK(&reaper_works[nid].work, reap_zombie_workfn);
 
 	zombie_reaper = kthread_run(zombie_reaper_thread,
 			NULL, "zombie_memcg_reaper");
 	if (IS_ERR(zombie_reaper)) {
 		pr_err("%s: Unable to start reaper kthread\n", __func__);
-		return PTR_ERR(zombie_reaper);
+		err = PTR_ERR(zombie_reaper);
+		goto out_free;
 	}
 
 #ifdef CONFIG_SYSFS
@@ -290,11 +470,16 @@ static int __init memcg_zombie_reaper_init(void)
 	if (err) {
 		kthread_stop(zombie_reaper);
 		pr_err("%s: Unable to populate sysfs files\n", __func__);
-		return err;
+		goto out_free;
 	}
 #endif
 
 	return 0;
+
+out_free:
+	kfree(reaper_works);
+	destroy_workqueue(reaper_wq);
+	return err;
 }
 
 module_init(memcg_zombie_reaper_init);
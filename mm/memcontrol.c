@@ -67,6 +67,8 @@
 #include <linux/lockdep.h>
 #include <linux/file.h>
 #include <linux/tracehook.h>
+#include <linux/kmemleak.h>
+#include <linux/filter.h>
 #include "internal.h"
 #include <net/sock.h>
 #include <net/ip.h>
@@ -77,6 +79,10 @@
 #include <linux/uaccess.h>
 
 #include <trace/events/vmscan.h>
+#include <trace/events/cgroup.h>
+
+#define CREATE_TRACE_POINTS
+#include <trace/events/memcg.h>
 
 struct cgroup_subsys memory_cgrp_subsys __read_mostly;
 EXPORT_SYMBOL(memory_cgrp_subsys);
@@ -102,7 +108,14 @@ bool cgroup_memory_noswap __read_mostly;
 #define cgroup_memory_noswap		1
 #endif
 
+/*
+ * Background reclaim of memcgs which have memory.priority set runs on a
+ * separate WQ_HIGHPRI workqueue, so it doesn't queue up behind the
+ * reclaim of the low priority memcgs when lots of them cross wmark_high
+ * at the same time.
+ */
 static struct workqueue_struct *memcg_wmark_wq;
+static struct workqueue_struct *memcg_wmark_hipri_wq;
 
 /* Whether legacy memory+swap accounting is active */
 static bool do_memsw_account(void)
@@ -298,6 +311,9 @@ static int swap_high_show(struct seq_file *m, void *v);
 static ssize_t swap_high_write(struct kernfs_open_file *of,
 					char *buf, size_t nbytes, loff_t off);
 static int swap_events_show(struct seq_file *m, void *v);
+static int swap_tier_show(struct seq_file *m, void *v);
+static ssize_t swap_tier_write(struct kernfs_open_file *of,
+					char *buf, size_t nbytes, loff_t off);
 
 void memcg_get_cache_ids(void)
 {
@@ -506,6 +522,9 @@ ino_t page_cgroup_ino(struct page *page)
 
 	rcu_read_lock();
 	memcg = READ_ONCE(page->mem_cgroup);
+	/* shared slab pages are not charged to any single cgroup */
+	if ((unsigned long)memcg & 0x1UL)
+		memcg = NULL;
 	while (memcg && !(memcg->css.flags & CSS_ONLINE))
 		memcg = parent_mem_cgroup(memcg);
 	if (memcg)
@@ -1331,6 +1350,127 @@ int mem_cgroup_scan_tasks(struct mem_cgroup *memcg,
 	return ret;
 }
 
+/*
+ * A full scan of the tasks in a memcg is expensive when the memcg has
+ * lots of tasks. It could be repeated many times in a short while once
+ * the memcg runs out of memory, and the tasks are ranked almost the
+ * same each time. So we save the tasks chosen one after another by a
+ * full scan in oom_rank[], the final victim first. Each of them has
+ * more points than all the tasks scanned before it. In the next OOM
+ * within MEMCG_OOM_RANK_TTL, only these candidates are evaluated.
+ */
+#define MEMCG_OOM_RANK_TTL	HZ
+
+struct mem_cgroup_oom_rank_arg {
+	struct oom_control *oc;
+	struct mem_cgroup *memcg;
+};
+
+static void mem_cgroup_oom_rank_reset(struct mem_cgroup *memcg)
+{
+	int i;
+
+	for (i = 0; i < MEMCG_OOM_RANK_NR; i++) {
+		put_pid(memcg->oom_rank[i]);
+		memcg->oom_rank[i] = NULL;
+	}
+}
+
+static int mem_cgroup_oom_rank_task(struct task_struct *task, void *arg)
+{
+	struct mem_cgroup_oom_rank_arg *rank = arg;
+	struct mem_cgroup *memcg = rank->memcg;
+	struct task_struct *chosen = rank->oc->chosen;
+	int ret;
+
+	ret = oom_evaluate_task(task, rank->oc);
+	if (!ret && rank->oc->chosen != chosen) {
+		put_pid(memcg->oom_rank[MEMCG_OOM_RANK_NR - 1]);
+		memmove(&memcg->oom_rank[1], &memcg->oom_rank[0],
+			sizeof(memcg->oom_rank[0]) * (MEMCG_OOM_RANK_NR - 1));
+		memcg->oom_rank[0] = get_task_pid(task, PIDTYPE_PID);
+	}
+
+	return ret;
+}
+
+/*
+ * Choose the victim from the saved candidates of @memcg. Return false
+ * if the candidates are stale or none of them can be chosen, then the
+ * caller should do a full scan.
+ */
+static bool mem_cgroup_oom_rank_select(struct mem_cgroup *memcg,
+				       struct oom_control *oc)
+{
+	struct task_struct *task;
+	unsigned long points;
+	bool in_memcg;
+	int i;
+
+	/* sysrq doesn't wait for existing victims, leave it to full scan */
+	if (oc->order == -1 || !memcg->oom_rank[0] ||
+	    time_after(jiffies, memcg->oom_rank_stamp + MEMCG_OOM_RANK_TTL))
+		return false;
+
+	for (i = 0; i < MEMCG_OOM_RANK_NR && memcg->oom_rank[i]; i++) {
+		task = get_pid_task(memcg->oom_rank[i], PIDTYPE_PID);
+		if (!task)
+			continue;
+
+		rcu_read_lock();
+		in_memcg = mem_cgroup_is_descendant(mem_cgroup_from_task(task),
+						    memcg);
+		rcu_read_unlock();
+		if (!in_memcg)
+			goto next;
+
+		/* Same as oom_evaluate_task(), wait for the exiting victim */
+		if (tsk_is_oom_victim(task)) {
+			if (test_bit(MMF_OOM_SKIP, &task->signal->oom_mm->flags))
+				goto next;
+			put_task_struct(task);
+			if (oc->chosen)
+				put_task_struct(oc->chosen);
+			oc->chosen = (void *)-1UL;
+			return true;
+		}
+
+		if (oom_task_origin(task))
+			points = ULONG_MAX;
+		else
+			points = oom_badness(task, NULL, oc->nodemask,
+					     oc->totalpages);
+		if (!points || points < oc->chosen_points)
+			goto next;
+
+		if (oc->chosen)
+			put_task_struct(oc->chosen);
+		oc->chosen = task;
+		oc->chosen_points = points;
+		continue;
+next:
+		put_task_struct(task);
+	}
+
+	return oc->chosen != NULL;
+}
+
+static void mem_cgroup_oom_rank_scan(struct mem_cgroup *memcg,
+				     struct oom_control *oc)
+{
+	struct mem_cgroup_oom_rank_arg arg = {
+		.oc = oc,
+		.memcg = memcg,
+	};
+
+	if (mem_cgroup_oom_rank_select(memcg, oc))
+		return;
+
+	mem_cgroup_oom_rank_reset(memcg);
+	mem_cgroup_scan_tasks(memcg, mem_cgroup_oom_rank_task, &arg);
+	memcg->oom_rank_stamp = jiffies;
+}
+
 void mem_cgroup_select_bad_process(struct oom_control *oc)
 {
 	struct mem_cgroup *memcg, *victim, *iter;
@@ -1353,7 +1493,7 @@ void mem_cgroup_select_bad_process(struct oom_control *oc)
 		}
 	}
 
-	mem_cgroup_scan_tasks(victim, oom_evaluate_task, oc);
+	mem_cgroup_oom_rank_scan(victim, oc);
 	if (oc->use_priority_oom) {
 		css_put(&victim->css);
 		if (oc->chosen == (void *)-1UL)
@@ -1560,6 +1700,9 @@ static const unsigned int memcg1_stats[] = {
 	NR_ANON_THPS,
 #endif
 	NR_SHMEM,
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	NR_SHMEM_THPS,
+#endif
 	NR_FILE_MAPPED,
 	NR_FILE_DIRTY,
 	NR_WRITEBACK,
@@ -1580,6 +1723,9 @@ static const char *const memcg1_stat_names[] = {
 	"rss_huge",
 #endif
 	"shmem",
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	"shmem_huge",
+#endif
 	"mapped_file",
 	"dirty",
 	"writeback",
@@ -1644,7 +1790,8 @@ void mem_cgroup_print_oom_info(struct mem_cgroup *memcg, struct task_struct *p)
 				continue;
 			nr = memcg_page_state_local(iter, memcg1_stats[i]);
 #ifdef CONFIG_TRANSPARENT_HUGEPAGE
-			if (memcg1_stats[i] == NR_ANON_THPS)
+			if (memcg1_stats[i] == NR_ANON_THPS ||
+			    memcg1_stats[i] == NR_SHMEM_THPS)
 				nr *= HPAGE_PMD_NR;
 #endif
 			pr_cont(" %s:%luKB", memcg1_stat_names[i], K(nr));
@@ -1996,6 +2143,7 @@ static enum oom_status mem_cgroup_oom(struct mem_cgroup *memcg, gfp_t mask, int
 		return OOM_SKIPPED;
 
 	memcg_memory_event(memcg, MEMCG_OOM);
+	trace_memcg_oom(memcg, order);
 
 	/*
 	 * We are in the middle of the charge context here, so we
@@ -2261,6 +2409,13 @@ EXPORT_SYMBOL(unlock_page_memcg);
 struct memcg_stock_pcp {
 	struct mem_cgroup *cached; /* this never be root cgroup */
 	unsigned int nr_pages;
+
+#ifdef CONFIG_MEMCG_KMEM
+	struct obj_cgroup *cached_objcg;
+	unsigned int nr_bytes;
+	int nr_slab_bytes[2];
+#endif
+
 	struct work_struct work;
 	unsigned long flags;
 #define FLUSHING_CACHED_CHARGE	0
@@ -2268,6 +2423,22 @@ struct memcg_stock_pcp {
 static DEFINE_PER_CPU(struct memcg_stock_pcp, memcg_stock);
 static DEFINE_MUTEX(percpu_charge_mutex);
 
+#ifdef CONFIG_MEMCG_KMEM
+static void drain_obj_stock(struct memcg_stock_pcp *stock);
+static bool obj_stock_flush_required(struct memcg_stock_pcp *stock,
+				     struct mem_cgroup *root_memcg);
+
+#else
+static inline void drain_obj_stock(struct memcg_stock_pcp *stock)
+{
+}
+static inline bool obj_stock_flush_required(struct memcg_stock_pcp *stock,
+				     struct mem_cgroup *root_memcg)
+{
+	return false;
+}
+#endif
+
 /**
  * consume_stock: Try to consume stocked charge on this cpu.
  * @memcg: memcg to consume from.
@@ -2330,6 +2501,7 @@ static void drain_local_stock(struct work_struct *dummy)
 	local_irq_save(flags);
 
 	stock = this_cpu_ptr(&memcg_stock);
+	drain_obj_stock(stock);
 	drain_stock(stock);
 	clear_bit(FLUSHING_CACHED_CHARGE, &stock->flags);
 
@@ -2381,21 +2553,24 @@ void drain_all_stock(struct mem_cgroup *root_memcg)
 	for_each_online_cpu(cpu) {
 		struct memcg_stock_pcp *stock = &per_cpu(memcg_stock, cpu);
 		struct mem_cgroup *memcg;
+		bool flush = false;
 
+		rcu_read_lock();
 		memcg = stock->cached;
-		if (!memcg || !stock->nr_pages || !css_tryget(&memcg->css))
-			continue;
-		if (!mem_cgroup_is_descendant(memcg, root_memcg)) {
-			css_put(&memcg->css);
-			continue;
-		}
-		if (!test_and_set_bit(FLUSHING_CACHED_CHARGE, &stock->flags)) {
+		if (memcg && stock->nr_pages &&
+		    mem_cgroup_is_descendant(memcg, root_memcg))
+			flush = true;
+		if (obj_stock_flush_required(stock, root_memcg))
+			flush = true;
+		rcu_read_unlock();
+
+		if (flush &&
+		    !test_and_set_bit(FLUSHING_CACHED_CHARGE, &stock->flags)) {
 			if (cpu == curcpu)
 				drain_local_stock(&stock->work);
 			else
 				schedule_work_on(cpu, &stock->work);
 		}
-		css_put(&memcg->css);
 	}
 	put_cpu();
 	mutex_unlock(&percpu_charge_mutex);
@@ -2407,6 +2582,7 @@ static int memcg_hotplug_cpu_dead(unsigned int cpu)
 	struct mem_cgroup *memcg, *mi;
 
 	stock = &per_cpu(memcg_stock, cpu);
+	drain_obj_stock(stock);
 	drain_stock(stock);
 
 	for_each_mem_cgroup(memcg) {
@@ -2486,6 +2662,47 @@ static void reclaim_wmark(struct mem_cgroup *memcg)
 	css_put(&memcg->css);
 }
 
+/* Page cache of @memcg which reclaim without swap can drop */
+static unsigned long memcg_pagecache_pages(struct mem_cgroup *memcg)
+{
+	unsigned long file = memcg_page_state(memcg, NR_FILE_PAGES);
+
+	return file - min(file, memcg_page_state(memcg, NR_SHMEM));
+}
+
+static bool memcg_pagecache_over_limit(struct mem_cgroup *memcg)
+{
+	return memcg_pagecache_pages(memcg) > READ_ONCE(memcg->pagecache_limit);
+}
+
+/*
+ * Shrink the page cache of @memcg back below memory.pagecache_limit,
+ * leaving a gap of wmark_scale_factor like reclaim_wmark(). Anon is not
+ * touched, so the tenant's own allocations never pay for its cache.
+ */
+static void reclaim_pagecache(struct mem_cgroup *memcg)
+{
+	unsigned long limit = READ_ONCE(memcg->pagecache_limit);
+	unsigned long target, cache, reclaimed;
+	int nr_retries = MAX_RECLAIM_RETRIES;
+	unsigned long pflags;
+
+	if (limit == PAGE_COUNTER_MAX)
+		return;
+
+	target = limit - mult_frac(limit, memcg->wmark_scale_factor, 10000);
+	psi_memstall_enter(&pflags);
+	while ((cache = memcg_pagecache_pages(memcg)) > target) {
+		reclaimed = try_to_free_mem_cgroup_pages(memcg,
+				max(SWAP_CLUSTER_MAX, cache - target),
+				GFP_KERNEL, false);
+		if (!reclaimed && !--nr_retries)
+			break;
+		cond_resched();
+	}
+	psi_memstall_leave(&pflags);
+}
+
 static void wmark_work_func(struct work_struct *work)
 {
 	struct mem_cgroup *memcg;
@@ -2494,9 +2711,36 @@ static void wmark_work_func(struct work_struct *work)
 
 	current->flags |= PF_SWAPWRITE | PF_MEMALLOC | PF_KSWAPD;
 	reclaim_wmark(memcg);
+	reclaim_pagecache(memcg);
 	current->flags &= ~(PF_SWAPWRITE | PF_MEMALLOC | PF_KSWAPD);
 }
 
+/*
+ * Kick background reclaim of @memcg. Both workqueues are unbound, the
+ * work runs on a pool of the node it's queued on, so queue it on a cpu
+ * of the node the reclaim will start from, and the reclaimer stays
+ * close to the pages of the memcg.  Work queued by a task of a child
+ * cpuacct cgroup runs on that cgroup's cpuset instead, see WQ_CGROUP.
+ */
+static void memcg_wmark_queue(struct mem_cgroup *memcg)
+{
+	struct workqueue_struct *wq = memcg_wmark_wq;
+	int cpu = WORK_CPU_UNBOUND;
+
+	if (memcg->priority)
+		wq = memcg_wmark_hipri_wq;
+
+	if (nr_node_ids > 1) {
+		int nid = mem_cgroup_select_victim_node(memcg);
+
+		cpu = cpumask_any_and(cpumask_of_node(nid), cpu_online_mask);
+		if (cpu >= nr_cpu_ids)
+			cpu = WORK_CPU_UNBOUND;
+	}
+
+	queue_work_on(cpu, wq, &memcg->wmark_work);
+}
+
 static unsigned long reclaim_high(struct mem_cgroup *memcg,
 				  unsigned int nr_pages,
 				  gfp_t gfp_mask)
@@ -2922,8 +3166,10 @@ static int try_charge(struct mem_cgroup *memcg, gfp_t gfp_mask,
 		goto nomem;
 	}
 nomem:
-	if (!(gfp_mask & __GFP_NOFAIL))
+	if (!(gfp_mask & __GFP_NOFAIL)) {
+		trace_memcg_charge_fail(mem_over_limit, nr_pages, gfp_mask);
 		return -ENOMEM;
+	}
 force:
 	/*
 	 * The allocation either can't fail or will lead to more memory
@@ -2954,8 +3200,11 @@ static int try_charge(struct mem_cgroup *memcg, gfp_t gfp_mask,
 	do {
 		bool mem_high, swap_high;
 
+		if (memcg_pagecache_over_limit(memcg))
+			memcg_wmark_queue(memcg);
+
 		if (!is_wmark_ok(memcg, true)) {
-			queue_work(memcg_wmark_wq, &memcg->wmark_work);
+			memcg_wmark_queue(memcg);
 			break;
 		}
 
@@ -3210,19 +3459,13 @@ void memcg_kmem_put_cache(struct kmem_cache *cachep)
 		css_put(&cachep->memcg_params.memcg->css);
 }
 
-/**
- * memcg_kmem_charge_memcg: charge a kmem page
- * @page: page to charge
- * @gfp: reclaim mode
- * @order: allocation order
- * @memcg: memory cgroup to charge
- *
- * Returns 0 on success, an error code on failure.
+/*
+ * Charge @nr_pages to @memcg and, on cgroup1, to its kmem counter.
+ * Like try_charge(), this takes a css reference per charged page.
  */
-int memcg_kmem_charge_memcg(struct page *page, gfp_t gfp, int order,
-			    struct mem_cgroup *memcg)
+static int __memcg_kmem_charge(struct mem_cgroup *memcg, gfp_t gfp,
+			       unsigned int nr_pages)
 {
-	unsigned int nr_pages = 1 << order;
 	struct page_counter *counter;
 	int ret;
 
@@ -3245,10 +3488,42 @@ int memcg_kmem_charge_memcg(struct page *page, gfp_t gfp, int order,
 		cancel_charge(memcg, nr_pages);
 		return -ENOMEM;
 	}
+	return 0;
+}
 
-	page->mem_cgroup = memcg;
+/*
+ * Reverse of __memcg_kmem_charge() for the page counters only, the
+ * caller deals with the css references.
+ */
+static void __memcg_kmem_uncharge(struct mem_cgroup *memcg,
+				  unsigned int nr_pages)
+{
+	if (!cgroup_subsys_on_dfl(memory_cgrp_subsys))
+		page_counter_uncharge(&memcg->kmem, nr_pages);
 
-	return 0;
+	page_counter_uncharge(&memcg->memory, nr_pages);
+	if (do_memsw_account())
+		page_counter_uncharge(&memcg->memsw, nr_pages);
+}
+
+/**
+ * memcg_kmem_charge_memcg: charge a kmem page
+ * @page: page to charge
+ * @gfp: reclaim mode
+ * @order: allocation order
+ * @memcg: memory cgroup to charge
+ *
+ * Returns 0 on success, an error code on failure.
+ */
+int memcg_kmem_charge_memcg(struct page *page, gfp_t gfp, int order,
+			    struct mem_cgroup *memcg)
+{
+	int ret;
+
+	ret = __memcg_kmem_charge(memcg, gfp, 1 << order);
+	if (!ret)
+		page->mem_cgroup = memcg;
+	return ret;
 }
 
 /**
@@ -3291,12 +3566,7 @@ void memcg_kmem_uncharge(struct page *page, int order)
 
 	VM_BUG_ON_PAGE(mem_cgroup_is_root(memcg), page);
 
-	if (!cgroup_subsys_on_dfl(memory_cgrp_subsys))
-		page_counter_uncharge(&memcg->kmem, nr_pages);
-
-	page_counter_uncharge(&memcg->memory, nr_pages);
-	if (do_memsw_account())
-		page_counter_uncharge(&memcg->memsw, nr_pages);
+	__memcg_kmem_uncharge(memcg, nr_pages);
 
 	page->mem_cgroup = NULL;
 
@@ -3306,94 +3576,515 @@ void memcg_kmem_uncharge(struct page *page, int order)
 
 	css_put_many(&memcg->css, nr_pages);
 }
-#endif /* CONFIG_MEMCG_KMEM */
 
-#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * Protects memcg->objcg_list and the objcg->memcg switch on reparenting.
+ */
+static DEFINE_SPINLOCK(objcg_lock);
 
 /*
- * Because tail pages are not marked as "used", set it. We're under
- * zone_lru_lock and migration entries setup in all page mappings.
+ * Page charges made on behalf of an obj_cgroup do not pin the css: the
+ * obj_cgroup holds one reference on its memcg instead, and hands the
+ * charges over to the parent together with itself when the memcg goes
+ * offline.
  */
-void mem_cgroup_split_huge_fixup(struct page *head)
+static void obj_cgroup_uncharge_pages(struct obj_cgroup *objcg,
+				      unsigned int nr_pages)
 {
-	int i;
-
-	if (mem_cgroup_disabled())
-		return;
+	struct mem_cgroup *memcg;
 
-	for (i = 1; i < HPAGE_PMD_NR; i++)
-		head[i].mem_cgroup = head->mem_cgroup;
+	rcu_read_lock();
+	memcg = obj_cgroup_memcg(objcg);
+	if (!mem_cgroup_is_root(memcg))
+		__memcg_kmem_uncharge(memcg, nr_pages);
+	rcu_read_unlock();
 }
-#endif /* CONFIG_TRANSPARENT_HUGEPAGE */
 
-#ifdef CONFIG_MEMCG_SWAP
-/**
- * mem_cgroup_move_swap_account - move swap charge and swap_cgroup's record.
- * @entry: swap entry to be moved
- * @from:  mem_cgroup which the entry is moved from
- * @to:  mem_cgroup which the entry is moved to
- *
- * It succeeds only when the swap_cgroup's record for this entry is the same
- * as the mem_cgroup's id of @from.
- *
- * Returns 0 on success, -EINVAL on failure.
- *
- * The caller must have charged to @to, IOW, called page_counter_charge() about
- * both res and memsw, and called css_get().
- */
-static int mem_cgroup_move_swap_account(swp_entry_t entry,
-				struct mem_cgroup *from, struct mem_cgroup *to)
+static void obj_cgroup_release(struct percpu_ref *ref)
 {
-	unsigned short old_id, new_id;
+	struct obj_cgroup *objcg = container_of(ref, struct obj_cgroup, refcnt);
+	struct mem_cgroup *memcg;
+	unsigned int nr_bytes;
+	unsigned int nr_pages;
+	unsigned long flags;
 
-	old_id = mem_cgroup_id(from);
-	new_id = mem_cgroup_id(to);
+	/*
+	 * At this point all allocated objects are freed, and
+	 * objcg->nr_charged_bytes can't have an arbitrary byte value.
+	 * However, it can be PAGE_SIZE or (x * PAGE_SIZE).
+	 *
+	 * The following sequence can lead to it:
+	 * 1) CPU0: objcg == stock->cached_objcg
+	 * 2) CPU1: we do a small allocation (e.g. 92 bytes),
+	 *          PAGE_SIZE bytes are charged
+	 * 3) CPU1: a process from another memcg is allocating something,
+	 *          the stock is flushed,
+	 *          objcg->nr_charged_bytes = PAGE_SIZE - 92
+	 * 4) CPU0: we do release this object,
+	 *          92 bytes are added to stock->nr_bytes
+	 * 5) CPU0: stock is flushed,
+	 *          92 bytes are added to objcg->nr_charged_bytes
+	 *
+	 * In the result, nr_charged_bytes == PAGE_SIZE.
+	 * This page will be uncharged in obj_cgroup_release().
+	 */
+	nr_bytes = atomic_read(&objcg->nr_charged_bytes);
+	WARN_ON_ONCE(nr_bytes & (PAGE_SIZE - 1));
+	nr_pages = nr_bytes >> PAGE_SHIFT;
+
+	spin_lock_irqsave(&objcg_lock, flags);
+	memcg = obj_cgroup_memcg(objcg);
+	if (nr_pages && !mem_cgroup_is_root(memcg))
+		__memcg_kmem_uncharge(memcg, nr_pages);
+	list_del(&objcg->list);
+	css_put(&memcg->css);
+	spin_unlock_irqrestore(&objcg_lock, flags);
 
-	if (swap_cgroup_cmpxchg(entry, old_id, new_id) == old_id) {
-		mod_memcg_state(from, MEMCG_SWAP, -1);
-		mod_memcg_state(to, MEMCG_SWAP, 1);
-		return 0;
-	}
-	return -EINVAL;
+	percpu_ref_exit(ref);
+	kfree_rcu(objcg, rcu);
 }
-#else
-static inline int mem_cgroup_move_swap_account(swp_entry_t entry,
-				struct mem_cgroup *from, struct mem_cgroup *to)
+
+static struct obj_cgroup *obj_cgroup_alloc(void)
 {
-	return -EINVAL;
+	struct obj_cgroup *objcg;
+	int ret;
+
+	objcg = kzalloc(sizeof(struct obj_cgroup), GFP_KERNEL);
+	if (!objcg)
+		return NULL;
+
+	ret = percpu_ref_init(&objcg->refcnt, obj_cgroup_release, 0,
+			      GFP_KERNEL);
+	if (ret) {
+		kfree(objcg);
+		return NULL;
+	}
+	INIT_LIST_HEAD(&objcg->list);
+	return objcg;
 }
-#endif
 
-static void setup_memcg_wmark(struct mem_cgroup *memcg)
+static void memcg_reparent_objcgs(struct mem_cgroup *memcg,
+				  struct mem_cgroup *parent)
 {
-	unsigned long high_wmark;
-	unsigned long low_wmark;
-	unsigned long max = memcg->memory.high > memcg->memory.max ?
-			    memcg->memory.max : memcg->memory.high;
-	unsigned int wmark_ratio = memcg->wmark_ratio;
-	unsigned int wmark_scale_factor = memcg->wmark_scale_factor;
-	unsigned long gap;
+	struct obj_cgroup *objcg, *iter;
 
-	if (wmark_ratio) {
-		high_wmark = (max * wmark_ratio) / 100;
+	objcg = rcu_replace_pointer(memcg->objcg, NULL, true);
 
-		/*
-		 * Set the memcg watermark distance according to the
-		 * scale factor in proportion to max limit.
-		 */
-		gap = mult_frac(max, wmark_scale_factor, 10000);
+	spin_lock_irq(&objcg_lock);
 
-		low_wmark = high_wmark - gap;
+	/*
+	 * The active objcg relies on the memcg being online and holds
+	 * no reference of its own, the inherited ones each hold one.
+	 */
+	css_get(&parent->css);
+	WRITE_ONCE(objcg->memcg, parent);
 
-		page_counter_set_wmark_low(&memcg->memory, low_wmark);
-		page_counter_set_wmark_high(&memcg->memory, high_wmark);
-	} else {
-		page_counter_set_wmark_low(&memcg->memory, PAGE_COUNTER_MAX);
-		page_counter_set_wmark_high(&memcg->memory, PAGE_COUNTER_MAX);
+	list_for_each_entry(iter, &memcg->objcg_list, list) {
+		css_get(&parent->css);
+		css_put(&memcg->css);
+		WRITE_ONCE(iter->memcg, parent);
 	}
+	list_add(&objcg->list, &memcg->objcg_list);
+	list_splice_init(&memcg->objcg_list, &parent->objcg_list);
+
+	spin_unlock_irq(&objcg_lock);
+
+	percpu_ref_kill(&objcg->refcnt);
 }
 
-static DEFINE_MUTEX(memcg_max_mutex);
+/**
+ * get_obj_cgroup_from_current: get the obj_cgroup to charge for a kmem object
+ *
+ * Returns a referenced obj_cgroup of the closest kmem-online ancestor of the
+ * current task's memory cgroup, or NULL if the allocation should not be
+ * accounted.
+ */
+struct obj_cgroup *get_obj_cgroup_from_current(void)
+{
+	struct obj_cgroup *objcg = NULL;
+	struct mem_cgroup *memcg;
+
+	if (memcg_kmem_bypass())
+		return NULL;
+
+	rcu_read_lock();
+	if (unlikely(current->active_memcg))
+		memcg = current->active_memcg;
+	else
+		memcg = mem_cgroup_from_task(rcu_dereference(current->mm->owner));
+
+	for (; memcg && memcg != root_mem_cgroup;
+	     memcg = parent_mem_cgroup(memcg)) {
+		objcg = rcu_dereference(memcg->objcg);
+		if (objcg && obj_cgroup_tryget(objcg))
+			break;
+		objcg = NULL;
+	}
+	rcu_read_unlock();
+
+	return objcg;
+}
+
+static bool consume_obj_stock(struct obj_cgroup *objcg, unsigned int nr_bytes)
+{
+	struct memcg_stock_pcp *stock;
+	unsigned long flags;
+	bool ret = false;
+
+	local_irq_save(flags);
+
+	stock = this_cpu_ptr(&memcg_stock);
+	if (objcg == stock->cached_objcg && stock->nr_bytes >= nr_bytes) {
+		stock->nr_bytes -= nr_bytes;
+		ret = true;
+	}
+
+	local_irq_restore(flags);
+
+	return ret;
+}
+
+/*
+ * Fold @nr_bytes of slab into the objcg's byte counter, and forward the
+ * whole pages crossed on the way to the memcg's page-sized NR_SLAB_* stats.
+ */
+static void __mod_objcg_slab_state(struct obj_cgroup *objcg, bool reclaimable,
+				   long nr_bytes)
+{
+	long new, old, nr_pages;
+
+	new = atomic_long_add_return(nr_bytes, &objcg->nr_slab_bytes[reclaimable]);
+	old = new - nr_bytes;
+	nr_pages = (new >> PAGE_SHIFT) - (old >> PAGE_SHIFT);
+	if (!nr_pages)
+		return;
+
+	rcu_read_lock();
+	mod_memcg_state(obj_cgroup_memcg(objcg),
+			reclaimable ? NR_SLAB_RECLAIMABLE : NR_SLAB_UNRECLAIMABLE,
+			nr_pages);
+	rcu_read_unlock();
+}
+
+static void drain_obj_stock(struct memcg_stock_pcp *stock)
+{
+	struct obj_cgroup *old = stock->cached_objcg;
+	int i;
+
+	if (!old)
+		return;
+
+	if (stock->nr_bytes) {
+		unsigned int nr_pages = stock->nr_bytes >> PAGE_SHIFT;
+		unsigned int nr_bytes = stock->nr_bytes & (PAGE_SIZE - 1);
+
+		if (nr_pages)
+			obj_cgroup_uncharge_pages(old, nr_pages);
+
+		/*
+		 * The leftover is flushed to the centralized per-objcg
+		 * counter; it can be used by another CPU or returned as
+		 * whole pages in obj_cgroup_release().
+		 */
+		atomic_add(nr_bytes, &old->nr_charged_bytes);
+		stock->nr_bytes = 0;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(stock->nr_slab_bytes); i++) {
+		if (stock->nr_slab_bytes[i]) {
+			__mod_objcg_slab_state(old, i, stock->nr_slab_bytes[i]);
+			stock->nr_slab_bytes[i] = 0;
+		}
+	}
+
+	obj_cgroup_put(old);
+	stock->cached_objcg = NULL;
+}
+
+static bool obj_stock_flush_required(struct memcg_stock_pcp *stock,
+				     struct mem_cgroup *root_memcg)
+{
+	struct mem_cgroup *memcg;
+
+	if (stock->cached_objcg) {
+		memcg = obj_cgroup_memcg(stock->cached_objcg);
+		if (memcg && mem_cgroup_is_descendant(memcg, root_memcg))
+			return true;
+	}
+
+	return false;
+}
+
+/* Must be called with irqs disabled */
+static void __switch_obj_stock(struct memcg_stock_pcp *stock,
+			       struct obj_cgroup *objcg)
+{
+	drain_obj_stock(stock);
+	obj_cgroup_get(objcg);
+	stock->cached_objcg = objcg;
+	stock->nr_bytes = atomic_xchg(&objcg->nr_charged_bytes, 0);
+}
+
+static void refill_obj_stock(struct obj_cgroup *objcg, unsigned int nr_bytes)
+{
+	struct memcg_stock_pcp *stock;
+	unsigned long flags;
+
+	local_irq_save(flags);
+
+	stock = this_cpu_ptr(&memcg_stock);
+	if (stock->cached_objcg != objcg) /* reset if necessary */
+		__switch_obj_stock(stock, objcg);
+	stock->nr_bytes += nr_bytes;
+
+	if (stock->nr_bytes > PAGE_SIZE)
+		drain_obj_stock(stock);
+
+	local_irq_restore(flags);
+}
+
+/**
+ * mod_objcg_slab_state: account slab bytes allocated or freed by @objcg
+ * @objcg: object cgroup
+ * @reclaimable: whether the objects come from a SLAB_RECLAIM_ACCOUNT cache
+ * @nr_bytes: bytes allocated (positive) or freed (negative)
+ *
+ * The bytes are batched in the per-cpu stock of the cached objcg and
+ * only reach the memcg statistics in page-sized steps.
+ */
+void mod_objcg_slab_state(struct obj_cgroup *objcg, bool reclaimable,
+			  int nr_bytes)
+{
+	struct memcg_stock_pcp *stock;
+	unsigned long flags;
+	int *bytes;
+
+	local_irq_save(flags);
+
+	stock = this_cpu_ptr(&memcg_stock);
+	if (stock->cached_objcg != objcg) {
+		__mod_objcg_slab_state(objcg, reclaimable, nr_bytes);
+		goto out;
+	}
+
+	bytes = &stock->nr_slab_bytes[reclaimable];
+	*bytes += nr_bytes;
+	if (abs(*bytes) > PAGE_SIZE) {
+		__mod_objcg_slab_state(objcg, reclaimable, *bytes);
+		*bytes = 0;
+	}
+out:
+	local_irq_restore(flags);
+}
+
+/**
+ * obj_cgroup_charge: charge a byte-sized kmem object
+ * @objcg: object cgroup to charge
+ * @gfp: reclaim mode
+ * @size: number of bytes
+ *
+ * Returns 0 on success, an error code on failure.
+ */
+int obj_cgroup_charge(struct obj_cgroup *objcg, gfp_t gfp, size_t size)
+{
+	struct mem_cgroup *memcg;
+	unsigned int nr_pages, nr_bytes;
+	int ret = 0;
+
+	if (consume_obj_stock(objcg, size))
+		return 0;
+
+	/*
+	 * objcg->nr_charged_bytes may hold enough pre-charged bytes, but
+	 * flushing it costs two atomic operations and it can't be big, so
+	 * grab some new pages instead. The bytes get flushed in
+	 * refill_obj_stock(), called from this function or later.
+	 */
+	rcu_read_lock();
+retry:
+	memcg = obj_cgroup_memcg(objcg);
+	if (unlikely(!css_tryget(&memcg->css)))
+		goto retry;
+	rcu_read_unlock();
+
+	nr_pages = size >> PAGE_SHIFT;
+	nr_bytes = size & (PAGE_SIZE - 1);
+
+	if (nr_bytes)
+		nr_pages += 1;
+
+	if (!mem_cgroup_is_root(memcg)) {
+		ret = __memcg_kmem_charge(memcg, gfp, nr_pages);
+		/* the charge is pinned by objcg, not the css */
+		if (!ret)
+			css_put_many(&memcg->css, nr_pages);
+	}
+	if (!ret && nr_bytes)
+		refill_obj_stock(objcg, PAGE_SIZE - nr_bytes);
+
+	css_put(&memcg->css);
+	return ret;
+}
+
+/**
+ * obj_cgroup_uncharge: uncharge a byte-sized kmem object
+ * @objcg: object cgroup to uncharge
+ * @size: number of bytes
+ */
+void obj_cgroup_uncharge(struct obj_cgroup *objcg, size_t size)
+{
+	refill_obj_stock(objcg, size);
+}
+
+/**
+ * memcg_alloc_page_obj_cgroups: attach an obj_cgroup vector to a slab page
+ * @page: slab page
+ * @s: cache the page belongs to
+ * @gfp: allocation mode
+ *
+ * Returns 0 on success, -ENOMEM if the vector could not be allocated.
+ */
+int memcg_alloc_page_obj_cgroups(struct page *page, struct kmem_cache *s,
+				 gfp_t gfp)
+{
+	unsigned int objects = objs_per_slab_page(s, page);
+	void *vec;
+
+	vec = kcalloc_node(objects, sizeof(struct obj_cgroup *), gfp,
+			   page_to_nid(page));
+	if (!vec)
+		return -ENOMEM;
+
+	if (cmpxchg(&page->obj_cgroups, NULL,
+		    (struct obj_cgroup **) ((unsigned long)vec | 0x1UL)))
+		kfree(vec);
+	else
+		kmemleak_not_leak(vec);
+
+	return 0;
+}
+
+/**
+ * mem_cgroup_from_obj: find the memcg a kmem object is charged to
+ * @p: pointer to the object
+ *
+ * The caller must ensure the returned memcg won't be released, e.g. by
+ * holding the rcu_read_lock.
+ */
+struct mem_cgroup *mem_cgroup_from_obj(void *p)
+{
+	struct page *page;
+
+	if (mem_cgroup_disabled())
+		return NULL;
+
+	page = virt_to_head_page(p);
+
+	/*
+	 * Slab objects are accounted individually, not per-page.
+	 * Memcg membership data for each individual object is saved in
+	 * the page->obj_cgroups.
+	 */
+	if (page_has_obj_cgroups(page)) {
+		struct obj_cgroup *objcg;
+		unsigned int off;
+
+		off = obj_to_index(page->slab_cache, page, p);
+		objcg = page_obj_cgroups(page)[off];
+		return objcg ? obj_cgroup_memcg(objcg) : NULL;
+	}
+
+	/* All other pages use page->mem_cgroup */
+	return page->mem_cgroup;
+}
+#endif /* CONFIG_MEMCG_KMEM */
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+
+/*
+ * Because tail pages are not marked as "used", set it. We're under
+ * zone_lru_lock and migration entries setup in all page mappings.
+ */
+void mem_cgroup_split_huge_fixup(struct page *head)
+{
+	int i;
+
+	if (mem_cgroup_disabled())
+		return;
+
+	for (i = 1; i < HPAGE_PMD_NR; i++)
+		head[i].mem_cgroup = head->mem_cgroup;
+}
+#endif /* CONFIG_TRANSPARENT_HUGEPAGE */
+
+#ifdef CONFIG_MEMCG_SWAP
+/**
+ * mem_cgroup_move_swap_account - move swap charge and swap_cgroup's record.
+ * @entry: swap entry to be moved
+ * @from:  mem_cgroup which the entry is moved from
+ * @to:  mem_cgroup which the entry is moved to
+ *
+ * It succeeds only when the swap_cgroup's record for this entry is the same
+ * as the mem_cgroup's id of @from.
+ *
+ * Returns 0 on success, -EINVAL on failure.
+ *
+ * The caller must have charged to @to, IOW, called page_counter_charge() about
+ * both res and memsw, and called css_get().
+ */
+static int mem_cgroup_move_swap_account(swp_entry_t entry,
+				struct mem_cgroup *from, struct mem_cgroup *to)
+{
+	unsigned short old_id, new_id;
+
+	old_id = mem_cgroup_id(from);
+	new_id = mem_cgroup_id(to);
+
+	if (swap_cgroup_cmpxchg(entry, old_id, new_id) == old_id) {
+		mod_memcg_state(from, MEMCG_SWAP, -1);
+		mod_memcg_state(to, MEMCG_SWAP, 1);
+		return 0;
+	}
+	return -EINVAL;
+}
+#else
+static inline int mem_cgroup_move_swap_account(swp_entry_t entry,
+				struct mem_cgroup *from, struct mem_cgroup *to)
+{
+	return -EINVAL;
+}
+#endif
+
+static void setup_memcg_wmark(struct mem_cgroup *memcg)
+{
+	unsigned long high_wmark;
+	unsigned long low_wmark;
+	unsigned long max = memcg->memory.high > memcg->memory.max ?
+			    memcg->memory.max : memcg->memory.high;
+	unsigned int wmark_ratio = memcg->wmark_ratio;
+	unsigned int wmark_scale_factor = memcg->wmark_scale_factor;
+	unsigned long gap;
+
+	if (wmark_ratio) {
+		high_wmark = (max * wmark_ratio) / 100;
+
+		/*
+		 * Set the memcg watermark distance according to the
+		 * scale factor in proportion to max limit.
+		 */
+		gap = mult_frac(max, wmark_scale_factor, 10000);
+
+		low_wmark = high_wmark - gap;
+
+		page_counter_set_wmark_low(&memcg->memory, low_wmark);
+		page_counter_set_wmark_high(&memcg->memory, high_wmark);
+	} else {
+		page_counter_set_wmark_low(&memcg->memory, PAGE_COUNTER_MAX);
+		page_counter_set_wmark_high(&memcg->memory, PAGE_COUNTER_MAX);
+	}
+}
+
+static DEFINE_MUTEX(memcg_max_mutex);
 
 static int mem_cgroup_resize_max(struct mem_cgroup *memcg,
 				 unsigned long max, bool memsw)
@@ -3447,7 +4138,7 @@ static int mem_cgroup_resize_max(struct mem_cgroup *memcg,
 		setup_memcg_wmark(memcg);
 
 		if (!is_wmark_ok(memcg, true))
-			queue_work(memcg_wmark_wq, &memcg->wmark_work);
+			memcg_wmark_queue(memcg);
 
 		if (enlarge)
 			memcg_oom_recover(memcg);
@@ -3789,6 +4480,7 @@ static void memcg_flush_percpu_vmevents(struct mem_cgroup *memcg)
 #ifdef CONFIG_MEMCG_KMEM
 static int memcg_online_kmem(struct mem_cgroup *memcg)
 {
+	struct obj_cgroup *objcg;
 	int memcg_id;
 
 	if (cgroup_memory_nokmem)
@@ -3801,6 +4493,14 @@ static int memcg_online_kmem(struct mem_cgroup *memcg)
 	if (memcg_id < 0)
 		return memcg_id;
 
+	objcg = obj_cgroup_alloc();
+	if (!objcg) {
+		memcg_free_cache_id(memcg_id);
+		return -ENOMEM;
+	}
+	objcg->memcg = memcg;
+	rcu_assign_pointer(memcg->objcg, objcg);
+
 	static_branch_inc(&memcg_kmem_enabled_key);
 	/*
 	 * A memory cgroup is considered kmem-online as soon as it gets
@@ -3840,6 +4540,8 @@ static void memcg_offline_kmem(struct mem_cgroup *memcg)
 	if (!parent)
 		parent = root_mem_cgroup;
 
+	memcg_reparent_objcgs(memcg, parent);
+
 	/*
 	 * Change kmemcg_id of this cgroup and all its descendants to the
 	 * parent's id, and then move all entries from this cgroup's list_lrus
@@ -3872,7 +4574,6 @@ static void memcg_free_kmem(struct mem_cgroup *memcg)
 	if (memcg->kmem_state == KMEM_ALLOCATED) {
 		memcg_destroy_kmem_caches(memcg);
 		static_branch_dec(&memcg_kmem_enabled_key);
-		WARN_ON(page_counter_read(&memcg->kmem));
 	}
 }
 #else
@@ -4024,7 +4725,6 @@ static int mem_cgroup_idle_page_stats_show(struct seq_file *m, void *v)
 	struct idle_page_stats *stats, *cache;
 	unsigned long scans;
 	bool has_hierarchy = kidled_use_hierarchy();
-	bool no_buckets = false;
 	int i, j, t;
 
 	stats = kmalloc(sizeof(struct idle_page_stats) * 2, GFP_KERNEL);
@@ -4040,7 +4740,6 @@ static int mem_cgroup_idle_page_stats_show(struct seq_file *m, void *v)
 
 	/* Nothing will be outputed with invalid buckets */
 	if (KIDLED_IS_BUCKET_INVALID(stats->buckets)) {
-		no_buckets = true;
 		scans = 0;
 		goto output;
 	}
@@ -4100,67 +4799,8 @@ static int mem_cgroup_idle_page_stats_show(struct seq_file *m, void *v)
 	seq_printf(m, "# scans: %lu\n", scans);
 	seq_printf(m, "# scan_period_in_seconds: %u\n", scan_period.duration);
 	seq_printf(m, "# use_hierarchy: %u\n", kidled_use_hierarchy());
-	seq_puts(m, "# buckets: ");
-	if (no_buckets) {
-		seq_puts(m, "no valid bucket available\n");
-		goto out;
-	}
-
-	for (i = 0; i < NUM_KIDLED_BUCKETS; i++) {
-		seq_printf(m, "%d", stats->buckets[i]);
-
-		if ((i == NUM_KIDLED_BUCKETS - 1) ||
-		    !stats->buckets[i + 1]) {
-			seq_puts(m, "\n");
-			j = i + 1;
-			break;
-		}
-		seq_puts(m, ",");
-	}
-	seq_puts(m, "#\n");
-
-	seq_puts(m, "#   _-----=> clean/dirty\n");
-	seq_puts(m, "#  / _----=> swap/file\n");
-	seq_puts(m, "# | / _---=> evict/unevict\n");
-	seq_puts(m, "# || / _--=> inactive/active\n");
-	seq_puts(m, "# ||| /\n");
-
-	seq_printf(m, "# %-8s", "||||");
-	for (i = 0; i < j; i++) {
-		char region[20];
-
-		if (i == j - 1) {
-			snprintf(region, sizeof(region), "[%d,+inf)",
-				 stats->buckets[i]);
-		} else {
-			snprintf(region, sizeof(region), "[%d,%d)",
-				 stats->buckets[i],
-				 stats->buckets[i + 1]);
-		}
-
-		seq_printf(m, " %14s", region);
-	}
-	seq_puts(m, "\n");
+	kidled_show_idle_page_stats(m, stats);
 
-	for (t = 0; t < KIDLE_NR_TYPE; t++) {
-		char kidled_type_str[5];
-
-		kidled_type_str[0] = t & KIDLE_DIRTY   ? 'd' : 'c';
-		kidled_type_str[1] = t & KIDLE_FILE    ? 'f' : 's';
-		kidled_type_str[2] = t & KIDLE_UNEVICT ? 'u' : 'e';
-		kidled_type_str[3] = t & KIDLE_ACTIVE  ? 'a' : 'i';
-		kidled_type_str[4] = '\0';
-		seq_printf(m, "  %-8s", kidled_type_str);
-
-		for (i = 0; i < j; i++) {
-			seq_printf(m, " %14lu",
-				   stats->count[t][i] << PAGE_SHIFT);
-		}
-
-		seq_puts(m, "\n");
-	}
-
-out:
 	kfree(stats);
 	return 0;
 }
@@ -4224,6 +4864,22 @@ static ssize_t mem_cgroup_idle_page_stats_write(struct kernfs_open_file *of,
 	return nbytes;
 }
 
+static u64 mem_cgroup_cold_reclaim_age_read(struct cgroup_subsys_state *css,
+					    struct cftype *cft)
+{
+	return READ_ONCE(mem_cgroup_from_css(css)->cold_reclaim_age);
+}
+
+static int mem_cgroup_cold_reclaim_age_write(struct cgroup_subsys_state *css,
+					     struct cftype *cft, u64 val)
+{
+	if (val > KIDLED_MAX_IDLE_AGE)
+		return -EINVAL;
+
+	WRITE_ONCE(mem_cgroup_from_css(css)->cold_reclaim_age, val);
+	return 0;
+}
+
 static void kidled_memcg_init(struct mem_cgroup *memcg)
 {
 	int type;
@@ -4389,6 +5045,16 @@ static const unsigned int memcg1_events[] = {
 	PGPGOUT,
 	PGFAULT,
 	PGMAJFAULT,
+#ifdef CONFIG_NUMA_BALANCING
+	NUMA_HINT_FAULTS,
+	NUMA_HINT_FAULTS_LOCAL,
+	NUMA_PAGE_MIGRATE,
+	PGPROMOTE_SUCCESS,
+#endif
+#if defined(CONFIG_MIGRATION) && defined(CONFIG_NUMA)
+	PGDEMOTE_KSWAPD,
+	PGDEMOTE_DIRECT,
+#endif
 };
 
 static const char *const memcg1_event_names[] = {
@@ -4396,6 +5062,16 @@ static const char *const memcg1_event_names[] = {
 	"pgpgout",
 	"pgfault",
 	"pgmajfault",
+#ifdef CONFIG_NUMA_BALANCING
+	"numa_hint_faults",
+	"numa_hint_faults_local",
+	"numa_pages_migrated",
+	"pgpromote_success",
+#endif
+#if defined(CONFIG_MIGRATION) && defined(CONFIG_NUMA)
+	"pgdemote_kswapd",
+	"pgdemote_direct",
+#endif
 };
 
 static int memcg_stat_show(struct seq_file *m, void *v)
@@ -4415,7 +5091,8 @@ static int memcg_stat_show(struct seq_file *m, void *v)
 			continue;
 		nr = memcg_page_state_local(memcg, memcg1_stats[i]);
 #ifdef CONFIG_TRANSPARENT_HUGEPAGE
-		if (memcg1_stats[i] == NR_ANON_THPS)
+		if (memcg1_stats[i] == NR_ANON_THPS ||
+		    memcg1_stats[i] == NR_SHMEM_THPS)
 			nr *= HPAGE_PMD_NR;
 #endif
 		seq_printf(m, "%s %lu\n", memcg1_stat_names[i], nr * PAGE_SIZE);
@@ -4449,7 +5126,8 @@ static int memcg_stat_show(struct seq_file *m, void *v)
 			continue;
 		nr = memcg_page_state(memcg, memcg1_stats[i]);
 #ifdef CONFIG_TRANSPARENT_HUGEPAGE
-		if (memcg1_stats[i] == NR_ANON_THPS)
+		if (memcg1_stats[i] == NR_ANON_THPS ||
+		    memcg1_stats[i] == NR_SHMEM_THPS)
 			nr *= HPAGE_PMD_NR;
 #endif
 		seq_printf(m, "total_%s %llu\n", memcg1_stat_names[i],
@@ -4501,15 +5179,55 @@ static u64 memcg_exstat_gather(struct mem_cgroup *memcg,
 static int memcg_exstat_show(struct seq_file *m, void *v)
 {
 	struct mem_cgroup *memcg = mem_cgroup_from_css(seq_css(m));
+	int i;
 
 	seq_printf(m, "wmark_min_throttled_ms %llu\n",
 		   memcg_exstat_gather(memcg, MEMCG_WMARK_MIN));
 	seq_printf(m, "wmark_reclaim_work_ms %llu\n",
 		   memcg_exstat_gather(memcg, MEMCG_WMARK_RECLAIM) >> 20);
+	for (i = 0; i < MEMCG_EXSTAT_BPF_NR; i++)
+		seq_printf(m, "bpf_%d %llu\n", i,
+			   memcg_exstat_gather(memcg, MEMCG_EXSTAT_BPF + i));
+
+	return 0;
+}
+
+#ifdef CONFIG_BPF_SYSCALL
+/*
+ * Counters of memory.exstat for BPF programs to keep, e.g. from the memcg
+ * tracepoints.  Id 0 stands for the memcg of the current task.
+ */
+BPF_CALL_3(bpf_memcg_exstat_add, u32, id, u32, slot, u64, delta)
+{
+	struct mem_cgroup *memcg;
 
+	if (slot >= MEMCG_EXSTAT_BPF_NR)
+		return -EINVAL;
+	if (mem_cgroup_disabled())
+		return -ENOENT;
+
+	/* BPF programs run under rcu_read_lock() */
+	if (id)
+		memcg = mem_cgroup_from_id(id);
+	else
+		memcg = mem_cgroup_from_task(current);
+	if (!memcg)
+		return -ENOENT;
+
+	this_cpu_add(memcg->exstat_cpu->item[MEMCG_EXSTAT_BPF + slot], delta);
 	return 0;
 }
 
+const struct bpf_func_proto bpf_memcg_exstat_add_proto = {
+	.func		= bpf_memcg_exstat_add,
+	.gpl_only	= false,
+	.ret_type	= RET_INTEGER,
+	.arg1_type	= ARG_ANYTHING,
+	.arg2_type	= ARG_ANYTHING,
+	.arg3_type	= ARG_ANYTHING,
+};
+#endif
+
 static s64 mem_cgroup_swappiness_read(struct cgroup_subsys_state *css,
 				      struct cftype *cft)
 {
@@ -4555,6 +5273,34 @@ static int mem_cgroup_priority_write(struct cgroup_subsys_state *css,
 	return 0;
 }
 
+static u64 mem_cgroup_pagecache_limit_read(struct cgroup_subsys_state *css,
+					   struct cftype *cft)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(css);
+
+	return (u64)READ_ONCE(memcg->pagecache_limit) * PAGE_SIZE;
+}
+
+static ssize_t mem_cgroup_pagecache_limit_write(struct kernfs_open_file *of,
+				char *buf, size_t nbytes, loff_t off)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(of_css(of));
+	unsigned long nr_pages;
+	int ret;
+
+	buf = strstrip(buf);
+	ret = page_counter_memparse(buf, "-1", &nr_pages);
+	if (ret)
+		return ret;
+
+	xchg(&memcg->pagecache_limit, nr_pages);
+
+	if (memcg_pagecache_over_limit(memcg))
+		memcg_wmark_queue(memcg);
+
+	return nbytes;
+}
+
 static int memory_wmark_ratio_show(struct seq_file *m, void *v)
 {
 	struct mem_cgroup *memcg = mem_cgroup_from_css(seq_css(m));
@@ -4587,7 +5333,7 @@ static ssize_t memory_wmark_ratio_write(struct kernfs_open_file *of,
 	setup_memcg_wmark(memcg);
 
 	if (!is_wmark_ok(memcg, true))
-		queue_work(memcg_wmark_wq, &memcg->wmark_work);
+		memcg_wmark_queue(memcg);
 
 	return nbytes;
 }
@@ -4815,6 +5561,8 @@ MEMCG_LAT_STAT_SMP_WRITE(global_direct_swapout, MEM_LAT_GLOBAL_DIRECT_SWAPOUT)
 MEMCG_LAT_STAT_SMP_WRITE(memcg_direct_swapout, MEM_LAT_MEMCG_DIRECT_SWAPOUT)
 MEMCG_LAT_STAT_SMP_WRITE(direct_swapin, MEM_LAT_DIRECT_SWAPIN)
 MEMCG_LAT_STAT_SMP_WRITE(dirty_throttle, MEM_LAT_DIRTY_THROTTLE)
+MEMCG_LAT_STAT_SMP_WRITE(major_fault, MEM_LAT_MAJOR_FAULT)
+MEMCG_LAT_STAT_SMP_WRITE(thp_fallback, MEM_LAT_THP_FALLBACK)
 
 smp_call_func_t smp_memcg_lat_write_funcs[] = {
 	smp_write_global_direct_reclaim,
@@ -4824,6 +5572,8 @@ smp_call_func_t smp_memcg_lat_write_funcs[] = {
 	smp_write_memcg_direct_swapout,
 	smp_write_direct_swapin,
 	smp_write_dirty_throttle,
+	smp_write_major_fault,
+	smp_write_thp_fallback,
 };
 
 static int memcg_lat_stat_write(struct cgroup_subsys_state *css,
@@ -4933,6 +5683,10 @@ void memcg_lat_stat_end(enum mem_lat_stat_item sidx, u64 start)
 	duration = end - start;
 	cidx = get_mem_lat_count_idx(duration);
 	memcg = get_mem_cgroup_from_mm(current->mm);
+	/* SLI_MEM_* follow mem_lat_stat_item */
+	BUILD_BUG_ON(MEM_LAT_THP_FALLBACK != SLI_MEM_THP_FALLBACK);
+	trace_cgroup_sli_event(memcg->css.cgroup, current->pid,
+			       SLI_EVENT_MEM_STALL, sidx, duration, 0);
 	for (iter = memcg; iter; iter = parent_mem_cgroup(iter)) {
 		this_cpu_inc(iter->lat_stat_cpu->item[sidx][cidx]);
 		this_cpu_add(iter->lat_stat_cpu->item[sidx][MEM_LAT_TOTAL],
@@ -5406,6 +6160,56 @@ void mem_cgroup_wb_stats(struct bdi_writeback *wb, unsigned long *pfilepages,
 	}
 }
 
+/**
+ * mem_cgroup_wb_dirty_limits - retrieve the dirty limits of @wb's memcg
+ * @wb: bdi_writeback in question
+ * @pratio: out parameter for memory.dirty_ratio, -1 if not set
+ * @pbg_bytes: out parameter for memory.dirty_background_bytes, 0 if not set
+ *
+ * A memcg which sets these is throttled against its own dirty budget
+ * rather than its share of the global vm.dirty_* limits.
+ */
+void mem_cgroup_wb_dirty_limits(struct bdi_writeback *wb, int *pratio,
+				unsigned long *pbg_bytes)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(wb->memcg_css);
+
+	*pratio = READ_ONCE(memcg->dirty_ratio);
+	*pbg_bytes = READ_ONCE(memcg->dirty_background_bytes);
+}
+
+static s64 mem_cgroup_dirty_ratio_read(struct cgroup_subsys_state *css,
+				       struct cftype *cft)
+{
+	return mem_cgroup_from_css(css)->dirty_ratio;
+}
+
+static int mem_cgroup_dirty_ratio_write(struct cgroup_subsys_state *css,
+					struct cftype *cft, s64 val)
+{
+	if (val > 100 || val < -1)
+		return -EINVAL;
+
+	WRITE_ONCE(mem_cgroup_from_css(css)->dirty_ratio, val);
+	return 0;
+}
+
+static u64 mem_cgroup_dirty_background_bytes_read(struct cgroup_subsys_state *css,
+						  struct cftype *cft)
+{
+	return mem_cgroup_from_css(css)->dirty_background_bytes;
+}
+
+static int mem_cgroup_dirty_background_bytes_write(struct cgroup_subsys_state *css,
+						   struct cftype *cft, u64 val)
+{
+	if (val > ULONG_MAX)
+		return -EINVAL;
+
+	WRITE_ONCE(mem_cgroup_from_css(css)->dirty_background_bytes, val);
+	return 0;
+}
+
 #else	/* CONFIG_CGROUP_WRITEBACK */
 
 static int memcg_wb_domain_init(struct mem_cgroup *memcg, gfp_t gfp)
@@ -5761,7 +6565,7 @@ static ssize_t memory_high_write(struct kernfs_open_file *of,
 	setup_memcg_wmark(memcg);
 
 	if (!is_wmark_ok(memcg, true))
-		queue_work(memcg_wmark_wq, &memcg->wmark_work);
+		memcg_wmark_queue(memcg);
 
 	memcg_wb_domain_size_changed(memcg);
 
@@ -5826,120 +6630,382 @@ static ssize_t memcg_thp_reclaim_write(struct kernfs_open_file *of, char *buf,
 	else
 		return -EINVAL;
 
-	return nbytes;
+	return nbytes;
+}
+
+static int memcg_thp_reclaim_stat_show(struct seq_file *m, void *v)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(seq_css(m));
+	struct mem_cgroup_per_node *mz;
+	int node;
+	unsigned long len;
+
+	seq_puts(m, "queue_length\t");
+	for_each_node(node) {
+		mz = mem_cgroup_nodeinfo(memcg, node);
+		len = READ_ONCE(mz->hugepage_reclaim_queue.reclaim_queue_len);
+		seq_printf(m, "%-24lu", len);
+	}
+
+	seq_puts(m, "\n");
+	seq_puts(m, "split_hugepage\t");
+	for_each_node(node) {
+		mz = mem_cgroup_nodeinfo(memcg, node);
+		len = atomic_long_read(&mz->hugepage_reclaim_queue.split_hugepage);
+		seq_printf(m, "%-24lu", len);
+	}
+
+	seq_puts(m, "\n");
+	seq_puts(m, "reclaim_subpage\t");
+	for_each_node(node) {
+		mz = mem_cgroup_nodeinfo(memcg, node);
+		len = atomic_long_read(&mz->hugepage_reclaim_queue.reclaim_subpage);
+		seq_printf(m, "%-24lu", len);
+	}
+	seq_puts(m, "\n");
+
+	return 0;
+}
+
+static inline char *strsep_s(char **s, const char *ct)
+{
+	char *p;
+
+	while ((p = strsep(s, ct))) {
+		if (*p)
+			return p;
+	}
+	return NULL;
+}
+
+static int memcg_thp_reclaim_ctrl_show(struct seq_file *m, void *v)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(seq_css(m));
+	int thp_reclaim_threshold = READ_ONCE(memcg->thp_reclaim_threshold);
+
+	seq_printf(m, "threshold\t%d\n", thp_reclaim_threshold);
+
+	return 0;
+}
+
+static u64 memcg_khugepaged_budget_read(struct cgroup_subsys_state *css,
+					struct cftype *cft)
+{
+	return READ_ONCE(mem_cgroup_from_css(css)->khugepaged_budget);
+}
+
+static int memcg_khugepaged_budget_write(struct cgroup_subsys_state *css,
+					 struct cftype *cft, u64 val)
+{
+	if (val > UINT_MAX)
+		return -EINVAL;
+
+	WRITE_ONCE(mem_cgroup_from_css(css)->khugepaged_budget, val);
+	return 0;
+}
+
+/*
+ * Called by khugepaged before collapsing a huge page for @mm. Return
+ * false if the memcg of @mm has used up its memory.khugepaged_budget
+ * in the current one minute window. Only khugepaged updates the
+ * window, so no lock is needed.
+ */
+bool mem_cgroup_khugepaged_charge(struct mm_struct *mm)
+{
+	struct mem_cgroup *memcg;
+	unsigned int budget;
+	bool ret = true;
+
+	if (mem_cgroup_disabled())
+		return true;
+
+	memcg = get_mem_cgroup_from_mm(mm);
+	budget = READ_ONCE(memcg->khugepaged_budget);
+	if (budget) {
+		if (time_after(jiffies, memcg->khugepaged_window + 60 * HZ)) {
+			memcg->khugepaged_window = jiffies;
+			memcg->khugepaged_collapsed = 0;
+		}
+
+		if (memcg->khugepaged_collapsed < budget)
+			memcg->khugepaged_collapsed++;
+		else
+			ret = false;
+	}
+	css_put(&memcg->css);
+
+	return ret;
+}
+
+#define CTRL_RECLAIM_MEMCG 1 /* only relciam current memcg*/
+#define CTRL_RECLAIM_ALL   2 /* reclaim current memcg and all the child memcg */
+static ssize_t memcg_thp_reclaim_ctrl_write(struct kernfs_open_file *of,
+					char *buf, size_t nbytes, loff_t off)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(of_css(of));
+	int ret, threshold, mode;
+	char *key, *value;
+
+	key = strsep_s(&buf, " \t\n");
+	if (!key)
+		return -EINVAL;
+
+	if (!strcmp(key, "threshold")) {
+		value = strsep_s(&buf, " \t\n");
+		if (!value)
+			return -EINVAL;
+
+		ret = kstrtouint(value, 0, &threshold);
+		if (ret)
+			return ret;
+
+		if (threshold > HPAGE_PMD_NR || threshold < 1)
+			return -EINVAL;
+
+		xchg(&memcg->thp_reclaim_threshold, threshold);
+	} else if (!strcmp(key, "reclaim")) {
+		struct mem_cgroup *iter;
+
+		value = strsep_s(&buf, " \t\n");
+		if (!value)
+			return -EINVAL;
+
+		ret = kstrtouint(value, 0, &mode);
+		if (ret)
+			return ret;
+
+		switch (mode) {
+		case CTRL_RECLAIM_MEMCG:
+			reclaim_memcg_huge_pages(memcg);
+			break;
+		case CTRL_RECLAIM_ALL:
+			iter = mem_cgroup_iter(memcg, NULL, NULL);
+			do {
+				reclaim_memcg_huge_pages(iter);
+			} while ((iter = mem_cgroup_iter(memcg, iter, NULL)));
+			break;
+		default:
+			return -EINVAL;
+		}
+	} else
+		return -EINVAL;
+
+	return nbytes;
+}
+#endif
+
+#ifdef CONFIG_NUMA_BALANCING
+static u64 memcg_numa_balancing_read(struct cgroup_subsys_state *css,
+				     struct cftype *cft)
+{
+	return READ_ONCE(mem_cgroup_from_css(css)->numa_balancing);
+}
+
+static int memcg_numa_balancing_write(struct cgroup_subsys_state *css,
+				      struct cftype *cft, u64 val)
+{
+	if (val > 1)
+		return -EINVAL;
+
+	WRITE_ONCE(mem_cgroup_from_css(css)->numa_balancing, val);
+	return 0;
+}
+
+static u64 memcg_numa_scan_param_read(struct cgroup_subsys_state *css,
+				      struct cftype *cft)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(css);
+
+	return READ_ONCE(memcg->numa_scan_params[cft->private]);
+}
+
+static int memcg_numa_scan_param_write(struct cgroup_subsys_state *css,
+				       struct cftype *cft, u64 val)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(css);
+
+	if (val > UINT_MAX)
+		return -EINVAL;
+
+	WRITE_ONCE(memcg->numa_scan_params[cft->private], val);
+	return 0;
+}
+
+/*
+ * The NUMA scanner works on mms, so the settings of the memcg owning
+ * @mm apply to every task sharing it.  kernel.numa_balancing still has
+ * to be enabled for any scanning to happen.
+ */
+bool mem_cgroup_numa_balancing_enabled(struct mm_struct *mm)
+{
+	struct mem_cgroup *memcg;
+	bool ret = true;
+
+	if (mem_cgroup_disabled())
+		return true;
+
+	rcu_read_lock();
+	memcg = mem_cgroup_from_task(rcu_dereference(mm->owner));
+	if (memcg)
+		ret = READ_ONCE(memcg->numa_balancing);
+	rcu_read_unlock();
+
+	return ret;
+}
+
+/*
+ * Return the @param setting of the memcg owning @mm, or @dflt if that
+ * memcg leaves it to the sysctl.
+ */
+unsigned int mem_cgroup_numa_scan_param(struct mm_struct *mm,
+					enum memcg_numa_scan_param param,
+					unsigned int dflt)
+{
+	struct mem_cgroup *memcg;
+	unsigned int val = 0;
+
+	if (mem_cgroup_disabled())
+		return dflt;
+
+	rcu_read_lock();
+	memcg = mem_cgroup_from_task(rcu_dereference(mm->owner));
+	if (memcg)
+		val = READ_ONCE(memcg->numa_scan_params[param]);
+	rcu_read_unlock();
+
+	return val ? : dflt;
+}
+#endif
+
+#ifdef CONFIG_DUPTEXT
+static u64 memcg_allow_duptext_read(struct cgroup_subsys_state *css,
+				    struct cftype *cft)
+{
+	return READ_ONCE(mem_cgroup_from_css(css)->allow_duptext);
+}
+
+static int memcg_allow_duptext_write(struct cgroup_subsys_state *css,
+				     struct cftype *cft, u64 val)
+{
+	if (val > 1)
+		return -EINVAL;
+
+	WRITE_ONCE(mem_cgroup_from_css(css)->allow_duptext, val);
+	return 0;
 }
 
-static int memcg_thp_reclaim_stat_show(struct seq_file *m, void *v)
+/* Whether text faults of @mm may map node-local copies, see duptext.c */
+bool mem_cgroup_duptext_enabled(struct mm_struct *mm)
 {
-	struct mem_cgroup *memcg = mem_cgroup_from_css(seq_css(m));
-	struct mem_cgroup_per_node *mz;
-	int node;
-	unsigned long len;
+	struct mem_cgroup *memcg;
+	bool ret = false;
 
-	seq_puts(m, "queue_length\t");
-	for_each_node(node) {
-		mz = mem_cgroup_nodeinfo(memcg, node);
-		len = READ_ONCE(mz->hugepage_reclaim_queue.reclaim_queue_len);
-		seq_printf(m, "%-24lu", len);
-	}
+	if (mem_cgroup_disabled())
+		return false;
 
-	seq_puts(m, "\n");
-	seq_puts(m, "split_hugepage\t");
-	for_each_node(node) {
-		mz = mem_cgroup_nodeinfo(memcg, node);
-		len = atomic_long_read(&mz->hugepage_reclaim_queue.split_hugepage);
-		seq_printf(m, "%-24lu", len);
+	rcu_read_lock();
+	memcg = mem_cgroup_from_task(rcu_dereference(mm->owner));
+	if (memcg)
+		ret = READ_ONCE(memcg->allow_duptext);
+	rcu_read_unlock();
+
+	return ret;
+}
+#endif
+
+/**
+ * mem_cgroup_charge_zram - charge compressed zram storage
+ * @page: page being stored
+ * @size: compressed size in bytes
+ * @memcgp: charged memcg, with a reference held, or NULL
+ *
+ * The storage is charged to the memcg owning @page, which for swap-out is
+ * the one swap_cgroup records for the slot. Pass *@memcgp to
+ * mem_cgroup_uncharge_zram() and drop its reference when the storage is
+ * freed.
+ *
+ * Returns 0 on success, -ENOMEM if it would exceed a memory.zram.max.
+ */
+int mem_cgroup_charge_zram(struct page *page, unsigned int size,
+			   struct mem_cgroup **memcgp)
+{
+	struct page_counter *counter;
+	struct mem_cgroup *memcg;
+
+	*memcgp = NULL;
+	memcg = get_mem_cgroup_from_page(page);
+	if (!memcg)
+		return 0;
+	if (mem_cgroup_is_root(memcg)) {
+		css_put(&memcg->css);
+		return 0;
 	}
 
-	seq_puts(m, "\n");
-	seq_puts(m, "reclaim_subpage\t");
-	for_each_node(node) {
-		mz = mem_cgroup_nodeinfo(memcg, node);
-		len = atomic_long_read(&mz->hugepage_reclaim_queue.reclaim_subpage);
-		seq_printf(m, "%-24lu", len);
+	if (!page_counter_try_charge(&memcg->zram, size, &counter)) {
+		css_put(&memcg->css);
+		return -ENOMEM;
 	}
-	seq_puts(m, "\n");
 
+	*memcgp = memcg;
 	return 0;
 }
+EXPORT_SYMBOL(mem_cgroup_charge_zram);
 
-static inline char *strsep_s(char **s, const char *ct)
+/**
+ * mem_cgroup_uncharge_zram - uncharge compressed zram storage
+ * @memcg: memcg returned by mem_cgroup_charge_zram()
+ * @size: bytes to uncharge
+ */
+void mem_cgroup_uncharge_zram(struct mem_cgroup *memcg, unsigned int size)
 {
-	char *p;
+	page_counter_uncharge(&memcg->zram, size);
+}
+EXPORT_SYMBOL(mem_cgroup_uncharge_zram);
 
-	while ((p = strsep(s, ct))) {
-		if (*p)
-			return p;
-	}
-	return NULL;
+static u64 memory_zram_current_read(struct cgroup_subsys_state *css,
+				    struct cftype *cft)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(css);
+
+	return page_counter_read(&memcg->zram);
 }
 
-static int memcg_thp_reclaim_ctrl_show(struct seq_file *m, void *v)
+static int memory_zram_max_show(struct seq_file *m, void *v)
 {
 	struct mem_cgroup *memcg = mem_cgroup_from_css(seq_css(m));
-	int thp_reclaim_threshold = READ_ONCE(memcg->thp_reclaim_threshold);
+	unsigned long max = READ_ONCE(memcg->zram.max);
 
-	seq_printf(m, "threshold\t%d\n", thp_reclaim_threshold);
+	if (max == PAGE_COUNTER_MAX)
+		seq_puts(m, "max\n");
+	else
+		seq_printf(m, "%lu\n", max);
 
 	return 0;
 }
 
-#define CTRL_RECLAIM_MEMCG 1 /* only relciam current memcg*/
-#define CTRL_RECLAIM_ALL   2 /* reclaim current memcg and all the child memcg */
-static ssize_t memcg_thp_reclaim_ctrl_write(struct kernfs_open_file *of,
-					char *buf, size_t nbytes, loff_t off)
+static ssize_t memory_zram_max_write(struct kernfs_open_file *of,
+				     char *buf, size_t nbytes, loff_t off)
 {
 	struct mem_cgroup *memcg = mem_cgroup_from_css(of_css(of));
-	int ret, threshold, mode;
-	char *key, *value;
-
-	key = strsep_s(&buf, " \t\n");
-	if (!key)
-		return -EINVAL;
-
-	if (!strcmp(key, "threshold")) {
-		value = strsep_s(&buf, " \t\n");
-		if (!value)
-			return -EINVAL;
-
-		ret = kstrtouint(value, 0, &threshold);
-		if (ret)
-			return ret;
-
-		if (threshold > HPAGE_PMD_NR || threshold < 1)
-			return -EINVAL;
-
-		xchg(&memcg->thp_reclaim_threshold, threshold);
-	} else if (!strcmp(key, "reclaim")) {
-		struct mem_cgroup *iter;
+	unsigned long long bytes;
+	unsigned long max;
+	char *end;
 
-		value = strsep_s(&buf, " \t\n");
-		if (!value)
+	/* The counter is in bytes, so page_counter_memparse() won't do */
+	buf = strstrip(buf);
+	if (!strcmp(buf, "max")) {
+		max = PAGE_COUNTER_MAX;
+	} else {
+		bytes = memparse(buf, &end);
+		if (*end != '\0')
 			return -EINVAL;
+		max = min_t(unsigned long long, bytes, PAGE_COUNTER_MAX);
+	}
 
-		ret = kstrtouint(value, 0, &mode);
-		if (ret)
-			return ret;
-
-		switch (mode) {
-		case CTRL_RECLAIM_MEMCG:
-			reclaim_memcg_huge_pages(memcg);
-			break;
-		case CTRL_RECLAIM_ALL:
-			iter = mem_cgroup_iter(memcg, NULL, NULL);
-			do {
-				reclaim_memcg_huge_pages(iter);
-			} while ((iter = mem_cgroup_iter(memcg, iter, NULL)));
-			break;
-		default:
-			return -EINVAL;
-		}
-	} else
-		return -EINVAL;
+	xchg(&memcg->zram.max, max);
 
 	return nbytes;
 }
-#endif
 
 static struct cftype mem_cgroup_legacy_files[] = {
 	{
@@ -5985,6 +7051,12 @@ static struct cftype mem_cgroup_legacy_files[] = {
 		.seq_show = memory_wmark_ratio_show,
 		.write = memory_wmark_ratio_write,
 	},
+	{
+		.name = "pagecache_limit",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = mem_cgroup_pagecache_limit_read,
+		.write = mem_cgroup_pagecache_limit_write,
+	},
 	{
 		.name = "wmark_high",
 		.flags = CFTYPE_NOT_ON_ROOT,
@@ -6052,6 +7124,18 @@ static struct cftype mem_cgroup_legacy_files[] = {
 		.write_u64 = memcg_lat_stat_write,
 		.seq_show =  memcg_lat_stat_show,
 	},
+	{
+		.name = "major_fault_latency",
+		.private = MEM_LAT_MAJOR_FAULT,
+		.write_u64 = memcg_lat_stat_write,
+		.seq_show =  memcg_lat_stat_show,
+	},
+	{
+		.name = "thp_fallback_latency",
+		.private = MEM_LAT_THP_FALLBACK,
+		.write_u64 = memcg_lat_stat_write,
+		.seq_show =  memcg_lat_stat_show,
+	},
 
 #endif /* CONFIG_MEMSLI */
 	{
@@ -6078,6 +7162,20 @@ static struct cftype mem_cgroup_legacy_files[] = {
 		.read_s64 = mem_cgroup_swappiness_read,
 		.write_s64 = mem_cgroup_swappiness_write,
 	},
+#ifdef CONFIG_CGROUP_WRITEBACK
+	{
+		.name = "dirty_ratio",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_s64 = mem_cgroup_dirty_ratio_read,
+		.write_s64 = mem_cgroup_dirty_ratio_write,
+	},
+	{
+		.name = "dirty_background_bytes",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = mem_cgroup_dirty_background_bytes_read,
+		.write_u64 = mem_cgroup_dirty_background_bytes_write,
+	},
+#endif
 	{
 		.name = "priority",
 		.read_u64 = mem_cgroup_priority_read,
@@ -6176,6 +7274,12 @@ static struct cftype mem_cgroup_legacy_files[] = {
 		.seq_show = mem_cgroup_idle_page_stats_show,
 		.write = mem_cgroup_idle_page_stats_write,
 	},
+	{
+		.name = "cold_reclaim_age",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = mem_cgroup_cold_reclaim_age_read,
+		.write_u64 = mem_cgroup_cold_reclaim_age_write,
+	},
 #endif
 	{
 		.name = "min",
@@ -6219,6 +7323,12 @@ static struct cftype mem_cgroup_legacy_files[] = {
 		.file_offset = offsetof(struct mem_cgroup, swap_events_file),
 		.seq_show = swap_events_show,
 	},
+	{
+		.name = "swap.tier",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = swap_tier_show,
+		.write = swap_tier_write,
+	},
 #ifdef CONFIG_TRANSPARENT_HUGEPAGE
 	{
 		.name = "thp_reclaim",
@@ -6234,7 +7344,56 @@ static struct cftype mem_cgroup_legacy_files[] = {
 		.seq_show = memcg_thp_reclaim_ctrl_show,
 		.write = memcg_thp_reclaim_ctrl_write,
 	},
+	{
+		.name = "khugepaged_budget",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = memcg_khugepaged_budget_read,
+		.write_u64 = memcg_khugepaged_budget_write,
+	},
+#endif
+#ifdef CONFIG_NUMA_BALANCING
+	{
+		.name = "numa_balancing",
+		.read_u64 = memcg_numa_balancing_read,
+		.write_u64 = memcg_numa_balancing_write,
+	},
+	{
+		.name = "numa_balancing_scan_period_min_ms",
+		.private = MEMCG_NUMA_SCAN_PERIOD_MIN,
+		.read_u64 = memcg_numa_scan_param_read,
+		.write_u64 = memcg_numa_scan_param_write,
+	},
+	{
+		.name = "numa_balancing_scan_period_max_ms",
+		.private = MEMCG_NUMA_SCAN_PERIOD_MAX,
+		.read_u64 = memcg_numa_scan_param_read,
+		.write_u64 = memcg_numa_scan_param_write,
+	},
+	{
+		.name = "numa_balancing_scan_size_mb",
+		.private = MEMCG_NUMA_SCAN_SIZE,
+		.read_u64 = memcg_numa_scan_param_read,
+		.write_u64 = memcg_numa_scan_param_write,
+	},
+#endif
+#ifdef CONFIG_DUPTEXT
+	{
+		.name = "allow_duptext",
+		.read_u64 = memcg_allow_duptext_read,
+		.write_u64 = memcg_allow_duptext_write,
+	},
 #endif
+	{
+		.name = "zram.current",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = memory_zram_current_read,
+	},
+	{
+		.name = "zram.max",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = memory_zram_max_show,
+		.write = memory_zram_max_write,
+	},
 	{ },	/* terminate */
 };
 
@@ -6427,6 +7586,7 @@ static bool __mem_cgroup_init(struct mem_cgroup *memcg)
 	memcg->socket_pressure = jiffies;
 #ifdef CONFIG_MEMCG_KMEM
 	memcg->kmemcg_id = -1;
+	INIT_LIST_HEAD(&memcg->objcg_list);
 #endif
 #ifdef CONFIG_CGROUP_WRITEBACK
 	INIT_LIST_HEAD(&memcg->cgwb_list);
@@ -6493,6 +7653,7 @@ static void __mem_cgroup_free(void **ptr)
 	struct mem_cgroup *memcg = *ptr;
 	int node;
 
+	mem_cgroup_oom_rank_reset(memcg);
 	for_each_node(node)
 		free_mem_cgroup_per_node_info(memcg, node);
 	free_percpu(memcg->vmstats_percpu);
@@ -6596,8 +7757,17 @@ mem_cgroup_css_alloc(struct cgroup_subsys_state *parent_css)
 	memcg->soft_limit = PAGE_COUNTER_MAX;
 	page_counter_set_high(&memcg->swap, PAGE_COUNTER_MAX);
 	page_counter_set_high(&memcg->memsw, PAGE_COUNTER_MAX);
+	memcg->pagecache_limit = PAGE_COUNTER_MAX;
+	memcg->swap_tier = SWAP_TIER_ALL;
+#ifdef CONFIG_CGROUP_WRITEBACK
+	memcg->dirty_ratio = -1;
+#endif
+#ifdef CONFIG_NUMA_BALANCING
+	memcg->numa_balancing = true;
+#endif
 	if (parent) {
 		memcg->swappiness = max(mem_cgroup_swappiness(parent), 0);
+		memcg->swap_tier = parent->swap_tier;
 		memcg->oom_kill_disable = parent->oom_kill_disable;
 		memcg->wmark_ratio = parent->wmark_ratio;
 		/* Default gap is 0.5% max limit */
@@ -6606,19 +7776,33 @@ mem_cgroup_css_alloc(struct cgroup_subsys_state *parent_css)
 #ifdef CONFIG_TRANSPARENT_HUGEPAGE
 		memcg->thp_reclaim = parent->thp_reclaim;
 		memcg->thp_reclaim_threshold = parent->thp_reclaim_threshold;
+#endif
+#ifdef CONFIG_NUMA_BALANCING
+		memcg->numa_balancing = parent->numa_balancing;
+		memcpy(memcg->numa_scan_params, parent->numa_scan_params,
+		       sizeof(memcg->numa_scan_params));
+#endif
+#ifdef CONFIG_DUPTEXT
+		memcg->allow_duptext = parent->allow_duptext;
 #endif
 		kidled_memcg_inherit_parent_buckets(parent, memcg);
+#ifdef CONFIG_CGROUP_WRITEBACK
+		memcg->dirty_ratio = parent->dirty_ratio;
+		memcg->dirty_background_bytes = parent->dirty_background_bytes;
+#endif
 	}
 	if (parent && parent->use_hierarchy) {
 		memcg->use_hierarchy = true;
 		page_counter_init(&memcg->memory, &parent->memory);
 		page_counter_init(&memcg->swap, &parent->swap);
+		page_counter_init(&memcg->zram, &parent->zram);
 		page_counter_init(&memcg->memsw, &parent->memsw);
 		page_counter_init(&memcg->kmem, &parent->kmem);
 		page_counter_init(&memcg->tcpmem, &parent->tcpmem);
 	} else {
 		page_counter_init(&memcg->memory, NULL);
 		page_counter_init(&memcg->swap, NULL);
+		page_counter_init(&memcg->zram, NULL);
 		page_counter_init(&memcg->memsw, NULL);
 		page_counter_init(&memcg->kmem, NULL);
 		page_counter_init(&memcg->tcpmem, NULL);
@@ -6754,6 +7938,7 @@ static void mem_cgroup_css_reset(struct cgroup_subsys_state *css)
 
 	page_counter_set_max(&memcg->memory, PAGE_COUNTER_MAX);
 	page_counter_set_max(&memcg->swap, PAGE_COUNTER_MAX);
+	page_counter_set_max(&memcg->zram, PAGE_COUNTER_MAX);
 	page_counter_set_max(&memcg->memsw, PAGE_COUNTER_MAX);
 	page_counter_set_max(&memcg->kmem, PAGE_COUNTER_MAX);
 	page_counter_set_max(&memcg->tcpmem, PAGE_COUNTER_MAX);
@@ -6967,6 +8152,10 @@ static int mem_cgroup_move_account(struct page *page,
 		if (PageSwapBacked(page)) {
 			__mod_lruvec_state(from_vec, NR_SHMEM, -nr_pages);
 			__mod_lruvec_state(to_vec, NR_SHMEM, nr_pages);
+			if (PageTransHuge(page)) {
+				__dec_lruvec_state(from_vec, NR_SHMEM_THPS);
+				__inc_lruvec_state(to_vec, NR_SHMEM_THPS);
+			}
 		}
 
 		if (page_mapped(page)) {
@@ -7627,7 +8816,7 @@ static ssize_t memory_max_write(struct kernfs_open_file *of,
 	setup_memcg_wmark(memcg);
 
 	if (!is_wmark_ok(memcg, true))
-		queue_work(memcg_wmark_wq, &memcg->wmark_work);
+		memcg_wmark_queue(memcg);
 
 	memcg_wb_domain_size_changed(memcg);
 	return nbytes;
@@ -7664,6 +8853,11 @@ static int memory_stat_show(struct seq_file *m, void *v)
 
 	seq_printf(m, "shmem %llu\n",
 		   (u64)memcg_page_state(memcg, NR_SHMEM) * PAGE_SIZE);
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	seq_printf(m, "shmem_thp %llu\n",
+		   (u64)memcg_page_state(memcg, NR_SHMEM_THPS) *
+		   HPAGE_PMD_SIZE);
+#endif
 	seq_printf(m, "file_mapped %llu\n",
 		   (u64)memcg_page_state(memcg, NR_FILE_MAPPED) * PAGE_SIZE);
 	seq_printf(m, "file_dirty %llu\n",
@@ -7712,6 +8906,22 @@ static int memory_stat_show(struct seq_file *m, void *v)
 	seq_printf(m, "pgdeactivate %lu\n", memcg_events(memcg, PGDEACTIVATE));
 	seq_printf(m, "pglazyfree %lu\n", memcg_events(memcg, PGLAZYFREE));
 	seq_printf(m, "pglazyfreed %lu\n", memcg_events(memcg, PGLAZYFREED));
+#ifdef CONFIG_NUMA_BALANCING
+	seq_printf(m, "numa_hint_faults %lu\n",
+		   memcg_events(memcg, NUMA_HINT_FAULTS));
+	seq_printf(m, "numa_hint_faults_local %lu\n",
+		   memcg_events(memcg, NUMA_HINT_FAULTS_LOCAL));
+	seq_printf(m, "numa_pages_migrated %lu\n",
+		   memcg_events(memcg, NUMA_PAGE_MIGRATE));
+	seq_printf(m, "pgpromote_success %lu\n",
+		   memcg_events(memcg, PGPROMOTE_SUCCESS));
+#endif
+#if defined(CONFIG_MIGRATION) && defined(CONFIG_NUMA)
+	seq_printf(m, "pgdemote_kswapd %lu\n",
+		   memcg_events(memcg, PGDEMOTE_KSWAPD));
+	seq_printf(m, "pgdemote_direct %lu\n",
+		   memcg_events(memcg, PGDEMOTE_DIRECT));
+#endif
 
 	return 0;
 }
@@ -7779,6 +8989,38 @@ static struct cftype memory_files[] = {
 		.write_u64 = mem_cgroup_priority_oom_write,
 		.read_u64 = mem_cgroup_priority_oom_read,
 	},
+#ifdef CONFIG_NUMA_BALANCING
+	{
+		.name = "numa_balancing",
+		.read_u64 = memcg_numa_balancing_read,
+		.write_u64 = memcg_numa_balancing_write,
+	},
+	{
+		.name = "numa_balancing_scan_period_min_ms",
+		.private = MEMCG_NUMA_SCAN_PERIOD_MIN,
+		.read_u64 = memcg_numa_scan_param_read,
+		.write_u64 = memcg_numa_scan_param_write,
+	},
+	{
+		.name = "numa_balancing_scan_period_max_ms",
+		.private = MEMCG_NUMA_SCAN_PERIOD_MAX,
+		.read_u64 = memcg_numa_scan_param_read,
+		.write_u64 = memcg_numa_scan_param_write,
+	},
+	{
+		.name = "numa_balancing_scan_size_mb",
+		.private = MEMCG_NUMA_SCAN_SIZE,
+		.read_u64 = memcg_numa_scan_param_read,
+		.write_u64 = memcg_numa_scan_param_write,
+	},
+#endif
+#ifdef CONFIG_DUPTEXT
+	{
+		.name = "allow_duptext",
+		.read_u64 = memcg_allow_duptext_read,
+		.write_u64 = memcg_allow_duptext_write,
+	},
+#endif
 	{
 		.name = "events",
 		.flags = CFTYPE_NOT_ON_ROOT,
@@ -7802,12 +9044,29 @@ static struct cftype memory_files[] = {
 		.seq_show = memory_oom_group_show,
 		.write = memory_oom_group_write,
 	},
+	{
+		.name = "zram.current",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = memory_zram_current_read,
+	},
+	{
+		.name = "zram.max",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = memory_zram_max_show,
+		.write = memory_zram_max_write,
+	},
 #ifdef CONFIG_KIDLED
 	{
 		.name = "idle_page_stats",
 		.seq_show = mem_cgroup_idle_page_stats_show,
 		.write = mem_cgroup_idle_page_stats_write,
 	},
+	{
+		.name = "cold_reclaim_age",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = mem_cgroup_cold_reclaim_age_read,
+		.write_u64 = mem_cgroup_cold_reclaim_age_write,
+	},
 #endif
 	{ }	/* terminate */
 };
@@ -8437,12 +9696,21 @@ static int __init mem_cgroup_init(void)
 #endif /* CONFIG_MEMSLI */
 
 	memcg_wmark_wq = alloc_workqueue("memcg_wmark", WQ_MEM_RECLAIM |
-				WQ_UNBOUND | WQ_FREEZABLE,
+				WQ_UNBOUND | WQ_FREEZABLE | WQ_CGROUP,
 				WQ_UNBOUND_MAX_ACTIVE);
 
 	if (!memcg_wmark_wq)
 		return -ENOMEM;
 
+	memcg_wmark_hipri_wq = alloc_workqueue("memcg_wmark_hipri",
+				WQ_MEM_RECLAIM | WQ_UNBOUND | WQ_FREEZABLE |
+				WQ_HIGHPRI, WQ_UNBOUND_MAX_ACTIVE);
+
+	if (!memcg_wmark_hipri_wq) {
+		destroy_workqueue(memcg_wmark_wq);
+		return -ENOMEM;
+	}
+
 #ifdef CONFIG_MEMCG_KMEM
 	/*
 	 * Kmem cache creation is mostly done with the slab_mutex held,
@@ -8641,9 +9909,44 @@ void mem_cgroup_uncharge_swap(swp_entry_t entry, unsigned int nr_pages)
 	rcu_read_unlock();
 }
 
+/* A memcg can't use swap devices its ancestors are kept off */
+static int mem_cgroup_effective_swap_tier(struct mem_cgroup *memcg)
+{
+	int tier = SWAP_TIER_ALL;
+
+	for (; memcg && memcg != root_mem_cgroup;
+	     memcg = parent_mem_cgroup(memcg))
+		tier = max(tier, READ_ONCE(memcg->swap_tier));
+
+	return tier;
+}
+
+/**
+ * mem_cgroup_swap_tier - lowest swap device priority a page may go to
+ * @page: page being swapped out
+ *
+ * Returns SWAP_TIER_ALL if the page's memcg may use all swap devices.
+ */
+int mem_cgroup_swap_tier(struct page *page)
+{
+	int tier;
+
+	if (mem_cgroup_disabled())
+		return SWAP_TIER_ALL;
+
+	rcu_read_lock();
+	tier = mem_cgroup_effective_swap_tier(page->mem_cgroup);
+	rcu_read_unlock();
+
+	return tier;
+}
+
 long mem_cgroup_get_nr_swap_pages(struct mem_cgroup *memcg)
 {
-	long nr_swap_pages = get_nr_swap_pages();
+	long nr_swap_pages;
+
+	nr_swap_pages = get_nr_swap_pages_tier(
+			mem_cgroup_effective_swap_tier(memcg));
 
 	if (cgroup_memory_noswap || !cgroup_subsys_on_dfl(memory_cgrp_subsys))
 		return nr_swap_pages;
@@ -8764,6 +10067,46 @@ static ssize_t swap_max_write(struct kernfs_open_file *of,
 	return nbytes;
 }
 
+static int swap_tier_show(struct seq_file *m, void *v)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(seq_css(m));
+	int tier = READ_ONCE(memcg->swap_tier);
+
+	if (tier == SWAP_TIER_ALL)
+		seq_puts(m, "all\n");
+	else
+		seq_printf(m, "%d\n", tier);
+
+	return 0;
+}
+
+/*
+ * Keep the memcg on the swap devices with at least the given priority,
+ * e.g. on zram only when that has the top priority. "all" lifts it.
+ */
+static ssize_t swap_tier_write(struct kernfs_open_file *of,
+			       char *buf, size_t nbytes, loff_t off)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(of_css(of));
+	int tier;
+	int err;
+
+	buf = strstrip(buf);
+	if (!strcmp(buf, "all")) {
+		tier = SWAP_TIER_ALL;
+	} else {
+		err = kstrtoint(buf, 0, &tier);
+		if (err)
+			return err;
+		if (tier < SHRT_MIN || tier > SHRT_MAX)
+			return -EINVAL;
+	}
+
+	WRITE_ONCE(memcg->swap_tier, tier);
+
+	return nbytes;
+}
+
 static int swap_events_show(struct seq_file *m, void *v)
 {
 	struct mem_cgroup *memcg = mem_cgroup_from_css(seq_css(m));
@@ -8796,6 +10139,12 @@ static struct cftype swap_files[] = {
 		.seq_show = swap_max_show,
 		.write = swap_max_write,
 	},
+	{
+		.name = "swap.tier",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = swap_tier_show,
+		.write = swap_tier_write,
+	},
 	{
 		.name = "swap.events",
 		.flags = CFTYPE_NOT_ON_ROOT,
@@ -8917,8 +10266,10 @@ void memcg_meminfo(struct mem_cgroup *memcg,
 	ext->writeback_temp = 0;
 #ifdef CONFIG_TRANSPARENT_HUGEPAGE
 	ext->anon_thps = memcg_page_state(memcg, NR_ANON_THPS);
-#endif
+	ext->shmem_thps = memcg_page_state(memcg, NR_SHMEM_THPS);
+#else
 	ext->shmem_thps = 0;
+#endif
 	ext->shmem_pmd_mapped = 0;
 
 	swap_size = memcg_page_state(memcg, MEMCG_SWAP);
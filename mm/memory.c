@@ -70,6 +70,8 @@
 #include <linux/dax.h>
 #include <linux/oom.h>
 #include <linux/khugepaged.h>
+#include <linux/async_fork.h>
+#include <linux/duptext.h>
 
 #include <asm/io.h>
 #include <asm/mmu_context.h>
@@ -1087,7 +1089,7 @@ copy_one_pte(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 	return 0;
 }
 
-static int copy_pte_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
+int copy_pte_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		   pmd_t *dst_pmd, pmd_t *src_pmd, struct vm_area_struct *vma,
 		   unsigned long addr, unsigned long end)
 {
@@ -1177,6 +1179,8 @@ static inline int copy_pmd_range(struct mm_struct *dst_mm, struct mm_struct *src
 		}
 		if (pmd_none_or_clear_bad(src_pmd))
 			continue;
+		if (async_fork_defer_pmd(dst_mm, src_mm, src_pmd, vma))
+			continue;
 		if (copy_pte_range(dst_mm, src_mm, dst_pmd, src_pmd,
 						vma, addr, next))
 			return -ENOMEM;
@@ -1464,6 +1468,7 @@ static inline unsigned long zap_pmd_range(struct mmu_gather *tlb,
 		 */
 		if (pmd_none_or_trans_huge_or_clear_bad(pmd))
 			goto next;
+		async_fork_fixup_pmd(tlb->mm, pmd, addr);
 		next = zap_pte_range(tlb, vma, pmd, addr, next, details);
 next:
 		cond_resched();
@@ -3287,6 +3292,7 @@ static vm_fault_t __do_fault(struct vm_fault *vmf)
 {
 	struct vm_area_struct *vma = vmf->vma;
 	vm_fault_t ret;
+	u64 start;
 
 	/*
 	 * Preallocate pte before we take page_lock because this might lead to
@@ -3311,7 +3317,11 @@ static vm_fault_t __do_fault(struct vm_fault *vmf)
 		smp_wmb(); /* See comment in __pte_alloc() */
 	}
 
+	memcg_lat_stat_start(&start);
 	ret = vma->vm_ops->fault(vmf);
+	/* Swapin has its own histogram, only file faults get here */
+	if (ret & VM_FAULT_MAJOR)
+		memcg_lat_stat_end(MEM_LAT_MAJOR_FAULT, start);
 	if (unlikely(ret & (VM_FAULT_ERROR | VM_FAULT_NOPAGE | VM_FAULT_RETRY |
 			    VM_FAULT_DONE_COW)))
 		return ret;
@@ -3692,6 +3702,7 @@ static vm_fault_t do_read_fault(struct vm_fault *vmf)
 {
 	struct vm_area_struct *vma = vmf->vma;
 	vm_fault_t ret = 0;
+	bool dup;
 
 #ifdef CONFIG_HUGETEXT
 	/* Add the candidate hugetext vma into khugepaged scan list */
@@ -3707,9 +3718,12 @@ static vm_fault_t do_read_fault(struct vm_fault *vmf)
 	/*
 	 * Let's call ->map_pages() first and use ->fault() as fallback
 	 * if page by the offset is not ready to be mapped (cold cache or
-	 * something).
+	 * something).  Fault-around would map the shared page cache pages
+	 * of a text mapping we'd rather give node-local copies.
 	 */
-	if (vma->vm_ops->map_pages && fault_around_bytes >> PAGE_SHIFT > 1) {
+	dup = duptext_vma(vma);
+	if (vma->vm_ops->map_pages && fault_around_bytes >> PAGE_SHIFT > 1 &&
+	    !dup) {
 		ret = do_fault_around(vmf);
 		if (ret)
 			return ret;
@@ -3718,6 +3732,8 @@ static vm_fault_t do_read_fault(struct vm_fault *vmf)
 	ret = __do_fault(vmf);
 	if (unlikely(ret & (VM_FAULT_ERROR | VM_FAULT_NOPAGE | VM_FAULT_RETRY)))
 		return ret;
+	if (dup)
+		duptext_fault(vmf);
 
 	ret |= finish_fault(vmf);
 	unlock_page(vmf->page);
@@ -3864,8 +3880,10 @@ static int numa_migrate_prep(struct page *page, struct vm_area_struct *vma,
 	get_page(page);
 
 	count_vm_numa_event(NUMA_HINT_FAULTS);
+	count_memcg_event_mm(vma->vm_mm, NUMA_HINT_FAULTS);
 	if (page_nid == numa_node_id()) {
 		count_vm_numa_event(NUMA_HINT_FAULTS_LOCAL);
+		count_memcg_event_mm(vma->vm_mm, NUMA_HINT_FAULTS_LOCAL);
 		*flags |= TNF_FAULT_LOCAL;
 	}
 
@@ -4208,6 +4226,10 @@ static vm_fault_t __handle_mm_fault(struct vm_area_struct *vma,
 		}
 	}
 
+	/* The pmd may still be write-protected for an async-forked child */
+	if (dirty)
+		async_fork_fixup_pmd(mm, vmf.pmd, address);
+
 	return handle_pte_fault(&vmf);
 }
 
@@ -4217,6 +4239,214 @@ static vm_fault_t __handle_mm_fault(struct vm_area_struct *vma,
  * The mmap_sem may have been released depending on flags and our
  * return value.  See filemap_fault() and __lock_page_or_retry().
  */
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+int sysctl_speculative_page_fault __read_mostly = 1;
+
+/*
+ * Lockless find_vma() under rcu_read_lock().  The VMA tree may change
+ * underneath, which can make the walk miss but never loop; a hit is only
+ * trusted once mm->mmap_seq has been revalidated.
+ */
+static struct vm_area_struct *spf_find_vma(struct mm_struct *mm,
+					   unsigned long addr)
+{
+	struct rb_node *node = READ_ONCE(mm->mm_rb.rb_node);
+
+	while (node) {
+		struct vm_area_struct *vma;
+
+		vma = rb_entry(node, struct vm_area_struct, vm_rb);
+		if (addr < READ_ONCE(vma->vm_start))
+			node = READ_ONCE(node->rb_left);
+		else if (addr >= READ_ONCE(vma->vm_end))
+			node = READ_ONCE(node->rb_right);
+		else
+			return vma;
+	}
+
+	return NULL;
+}
+
+/*
+ * Find the pte table mapping @address.  Must be called with interrupts
+ * disabled: like gup_fast, that holds off the TLB shootdown which has to
+ * come before a page table is freed.  Huge and missing pmds are left to
+ * the regular fault path.
+ */
+static pmd_t *spf_find_pmd(struct mm_struct *mm, unsigned long address,
+			   pmd_t *pmdval)
+{
+	pgd_t *pgd;
+	p4d_t *p4d;
+	pud_t *pud;
+	pmd_t *pmd;
+
+	pgd = pgd_offset(mm, address);
+	if (pgd_none(*pgd) || unlikely(pgd_bad(*pgd)))
+		return NULL;
+	p4d = p4d_offset(pgd, address);
+	if (p4d_none(*p4d) || unlikely(p4d_bad(*p4d)))
+		return NULL;
+	pud = pud_offset(p4d, address);
+	if (pud_none(*pud) || unlikely(pud_bad(*pud)))
+		return NULL;
+	pmd = pmd_offset(pud, address);
+	*pmdval = pmd_read_atomic(pmd);
+	barrier();
+	if (!pmd_present(*pmdval) || pmd_trans_huge(*pmdval) ||
+	    pmd_devmap(*pmdval) || unlikely(pmd_bad(*pmdval)))
+		return NULL;
+
+	return pmd;
+}
+
+static bool spf_vma_suitable(struct vm_area_struct *vma, unsigned int flags)
+{
+	unsigned long vm_flags = vma->vm_flags;
+	bool write = flags & FAULT_FLAG_WRITE;
+
+	if (!vma_is_anonymous(vma) || (vm_flags & VM_SHARED) ||
+	    !vma->anon_vma || vma_policy(vma) || userfaultfd_missing(vma))
+		return false;
+	if (!(vm_flags & (write ? VM_WRITE : VM_READ)))
+		return false;
+
+	return arch_vma_access_permitted(vma, write, false, false);
+}
+
+/*
+ * Handle a not-present fault on private anonymous memory without taking
+ * mmap_sem, so faulting threads don't queue up behind an mmap, munmap or
+ * mprotect of an unrelated range.
+ *
+ * The VMA is looked up locklessly and copied; the fault is then completed
+ * on that copy and committed under the pte lock only if no mmap_sem writer
+ * has touched the VMA tree, VMA fields or page tables in the meantime,
+ * see mmap_seq_write_begin().  Everything else, including missing page
+ * tables, swap, COW and file pages, returns VM_FAULT_RETRY for the caller
+ * to go through handle_mm_fault() under mmap_sem.
+ */
+vm_fault_t handle_speculative_fault(struct mm_struct *mm,
+				    unsigned long address, unsigned int flags)
+{
+	struct vm_area_struct *vma, vma_copy;
+	struct page *page = NULL;
+	pmd_t *pmd, pmdval;
+	spinlock_t *ptl;
+	pte_t *pte, entry;
+	unsigned int seq;
+
+	if (!READ_ONCE(sysctl_speculative_page_fault) ||
+	    (flags & (FAULT_FLAG_INSTRUCTION | FAULT_FLAG_REMOTE)) ||
+	    mm_async_fork_pending(mm))
+		return VM_FAULT_RETRY;
+
+	seq = raw_read_seqcount(&mm->mmap_seq);
+	if (seq & 1)
+		goto abort;
+
+	rcu_read_lock();
+	vma = spf_find_vma(mm, address);
+	if (!vma || !spf_vma_suitable(vma, flags)) {
+		rcu_read_unlock();
+		return VM_FAULT_RETRY;
+	}
+	vma_copy = *vma;
+	rcu_read_unlock();
+	if (read_seqcount_retry(&mm->mmap_seq, seq))
+		goto abort;
+	vma = &vma_copy;
+
+	/* Leave page table allocation to the regular path */
+	local_irq_disable();
+	pmd = spf_find_pmd(mm, address, &pmdval);
+	if (!pmd) {
+		local_irq_enable();
+		return VM_FAULT_RETRY;
+	}
+	pte = pte_offset_map(&pmdval, address);
+	entry = *pte;
+	pte_unmap(pte);
+	local_irq_enable();
+	if (!pte_none(entry))
+		return VM_FAULT_RETRY;
+
+	if (flags & FAULT_FLAG_WRITE) {
+		page = alloc_page(GFP_HIGHUSER_MOVABLE);
+		if (!page)
+			goto abort;
+		clear_user_highpage(page, address);
+		if (mem_cgroup_charge(page, mm, GFP_KERNEL))
+			goto abort_free;
+		cgroup_throttle_swaprate(page, GFP_KERNEL);
+		/* Order the clearing stores before set_pte_at() */
+		__SetPageUptodate(page);
+
+		entry = mk_pte(page, vma->vm_page_prot);
+		if (vma->vm_flags & VM_WRITE)
+			entry = pte_mkwrite(pte_mkdirty(entry));
+	} else {
+		if (mm_forbids_zeropage(mm))
+			return VM_FAULT_RETRY;
+		entry = pte_mkspecial(pfn_pte(my_zero_pfn(address),
+					      vma->vm_page_prot));
+	}
+
+	/*
+	 * Revalidate with the pte lock held and interrupts still off: from
+	 * here on, any writer that unmaps the range or changes this VMA
+	 * opened its mmap_seq section after us, and has to take this pte
+	 * lock before it can zap, reprotect or free the page table.
+	 */
+	local_irq_disable();
+	pmd = spf_find_pmd(mm, address, &pmdval);
+	if (!pmd)
+		goto abort_irq;
+	ptl = pte_lockptr(mm, &pmdval);
+	pte = pte_offset_map(&pmdval, address);
+	if (!spin_trylock(ptl)) {
+		pte_unmap(pte);
+		goto abort_irq;
+	}
+	if (!pmd_same(pmdval, *pmd) || read_seqcount_retry(&mm->mmap_seq, seq)) {
+		pte_unmap_unlock(pte, ptl);
+		goto abort_irq;
+	}
+	local_irq_enable();
+
+	if (!pte_none(*pte) || check_stable_address_space(mm)) {
+		pte_unmap_unlock(pte, ptl);
+		goto abort_free;
+	}
+
+	if (page) {
+		inc_mm_counter_fast(mm, MM_ANONPAGES);
+		page_add_new_anon_rmap(page, vma, address, false);
+		lru_cache_add_inactive_or_unevictable(page, vma);
+	}
+	set_pte_at(mm, address, pte, entry);
+	/* No need to invalidate - it was non-present before */
+	update_mmu_cache(vma, address, pte);
+	pte_unmap_unlock(pte, ptl);
+
+	count_vm_event(PGFAULT);
+	count_memcg_event_mm(mm, PGFAULT);
+	count_vm_event(SPECULATIVE_PGFAULT);
+	check_sync_rss_stat(current);
+
+	return 0;
+
+abort_irq:
+	local_irq_enable();
+abort_free:
+	if (page)
+		put_page(page);
+abort:
+	count_vm_event(SPECULATIVE_PGFAULT_ABORT);
+	return VM_FAULT_RETRY;
+}
+#endif /* CONFIG_SPECULATIVE_PAGE_FAULT */
+
 vm_fault_t handle_mm_fault(struct vm_area_struct *vma, unsigned long address,
 		unsigned int flags)
 {
@@ -4235,6 +4465,9 @@ vm_fault_t handle_mm_fault(struct vm_area_struct *vma, unsigned long address,
 					    flags & FAULT_FLAG_REMOTE))
 		return VM_FAULT_SIGSEGV;
 
+	/* An async-forked child gets all its page tables before any fault */
+	async_fork_sync(vma->vm_mm);
+
 	/*
 	 * Enable the memcg OOM handling for faults triggered in user
 	 * space.  Kernel faults are handled more gracefully.
@@ -12,6 +12,7 @@
 #include <linux/pagemap.h>
 #include <linux/compiler.h>
 #include <linux/export.h>
+#include <linux/moduleparam.h>
 #include <linux/pagevec.h>
 #include <linux/writeback.h>
 #include <linux/slab.h>
@@ -84,6 +85,17 @@ static int __init setup_memhp_default_state(char *str)
 }
 __setup("memhp_default_state=", setup_memhp_default_state);
 
+#ifdef MODULE_PARAM_PREFIX
+#undef MODULE_PARAM_PREFIX
+#endif
+#define MODULE_PARAM_PREFIX "memory_hotplug."
+
+static bool memmap_on_memory __ro_after_init;
+#ifdef CONFIG_MHP_MEMMAP_ON_MEMORY
+module_param(memmap_on_memory, bool, 0444);
+MODULE_PARM_DESC(memmap_on_memory, "Enable memmap on memory for memory hotplug");
+#endif
+
 void mem_hotplug_begin(void)
 {
 	cpus_read_lock();
@@ -751,6 +763,7 @@ int __ref online_pages(unsigned long pfn, unsigned long nr_pages, int online_typ
 	unsigned long flags;
 	unsigned long onlined_pages = 0;
 	struct zone *zone;
+	unsigned long nr_vmemmap_pages;
 	int need_zonelists_rebuild = 0;
 	int nid;
 	int ret;
@@ -765,6 +778,7 @@ int __ref online_pages(unsigned long pfn, unsigned long nr_pages, int online_typ
 	 */
 	mem = find_memory_block(__pfn_to_section(pfn));
 	nid = mem->nid;
+	nr_vmemmap_pages = mem->nr_vmemmap_pages;
 	put_device(&mem->dev);
 
 	/* associate pfn range with the zone */
@@ -789,8 +803,10 @@ int __ref online_pages(unsigned long pfn, unsigned long nr_pages, int online_typ
 		setup_zone_pageset(zone);
 	}
 
-	ret = walk_system_ram_range(pfn, nr_pages, &onlined_pages,
-		online_pages_range);
+	/* the memmap of the block stays reserved, it is in use */
+	ret = walk_system_ram_range(pfn + nr_vmemmap_pages,
+				    nr_pages - nr_vmemmap_pages,
+				    &onlined_pages, online_pages_range);
 	if (ret) {
 		if (need_zonelists_rebuild)
 			zone_pcp_reset(zone);
@@ -983,8 +999,13 @@ static int online_memory_block(struct memory_block *mem, void *arg)
  *
  * we are OK calling __meminit stuff here - we have CONFIG_MEMORY_HOTPLUG
  */
-int __ref add_memory_resource(int nid, struct resource *res, bool online)
+int __ref add_memory_resource(int nid, struct resource *res, mhp_t mhp_flags)
 {
+	struct vmem_altmap mhp_altmap = {
+		.base_pfn = PHYS_PFN(res->start),
+		.free = PHYS_PFN(resource_size(res)),
+	};
+	struct vmem_altmap *altmap = NULL;
 	u64 start, size;
 	bool new_node = false;
 	int ret;
@@ -1011,11 +1032,31 @@ int __ref add_memory_resource(int nid, struct resource *res, bool online)
 		goto error;
 	new_node = ret;
 
+	/*
+	 * Self host the memmap: the altmap hands the vmemmap population the
+	 * pages at the start of the range.
+	 */
+	if (mhp_flags & MHP_MEMMAP_ON_MEMORY) {
+		if (!mhp_supports_memmap_on_memory(size)) {
+			ret = -EINVAL;
+			goto error;
+		}
+		altmap = &mhp_altmap;
+	}
+
 	/* call arch's memory hotadd */
-	ret = arch_add_memory(nid, start, size, NULL, true);
+	ret = arch_add_memory(nid, start, size, altmap, true);
 	if (ret < 0)
 		goto error;
 
+	if (altmap && mhp_altmap.alloc) {
+		struct memory_block *mem;
+
+		mem = find_memory_block(__pfn_to_section(PHYS_PFN(start)));
+		mem->nr_vmemmap_pages = mhp_altmap.alloc;
+		put_device(&mem->dev);
+	}
+
 	if (new_node) {
 		/* If sysfs file of new node can't be created, cpu on the node
 		 * can't be hot-added. There is no rollback way now.
@@ -1038,7 +1079,7 @@ int __ref add_memory_resource(int nid, struct resource *res, bool online)
 	mem_hotplug_done();
 
 	/* online pages if requested */
-	if (online)
+	if (memhp_auto_online)
 		walk_memory_range(PFN_DOWN(start), PFN_UP(start + size - 1),
 				  NULL, online_memory_block);
 
@@ -1053,7 +1094,7 @@ int __ref add_memory_resource(int nid, struct resource *res, bool online)
 }
 
 /* requires device_hotplug_lock, see add_memory_resource() */
-int __ref __add_memory(int nid, u64 start, u64 size)
+int __ref __add_memory(int nid, u64 start, u64 size, mhp_t mhp_flags)
 {
 	struct resource *res;
 	int ret;
@@ -1062,24 +1103,46 @@ int __ref __add_memory(int nid, u64 start, u64 size)
 	if (IS_ERR(res))
 		return PTR_ERR(res);
 
-	ret = add_memory_resource(nid, res, memhp_auto_online);
+	ret = add_memory_resource(nid, res, mhp_flags);
 	if (ret < 0)
 		release_memory_resource(res);
 	return ret;
 }
 
-int add_memory(int nid, u64 start, u64 size)
+int add_memory(int nid, u64 start, u64 size, mhp_t mhp_flags)
 {
 	int rc;
 
 	lock_device_hotplug();
-	rc = __add_memory(nid, start, size);
+	rc = __add_memory(nid, start, size, mhp_flags);
 	unlock_device_hotplug();
 
 	return rc;
 }
 EXPORT_SYMBOL_GPL(add_memory);
 
+/**
+ * mhp_supports_memmap_on_memory - check whether MHP_MEMMAP_ON_MEMORY can be used
+ * @size: size of the memory to add
+ *
+ * The memmap must fill whole PMDs, so that the vmemmap is mapped with huge
+ * pages taken from the added memory alone, and leave the remainder of the
+ * memory pageblock aligned.  Only single memory blocks are supported, so
+ * that onlining, offlining and removal find the memmap at the start of the
+ * block.
+ */
+bool mhp_supports_memmap_on_memory(unsigned long size)
+{
+	unsigned long vmemmap_size = PHYS_PFN(size) * sizeof(struct page);
+	unsigned long remaining_size = size - vmemmap_size;
+
+	return IS_ENABLED(CONFIG_MHP_MEMMAP_ON_MEMORY) && memmap_on_memory &&
+	       size == memory_block_size_bytes() &&
+	       IS_ALIGNED(vmemmap_size, PMD_SIZE) &&
+	       IS_ALIGNED(remaining_size, pageblock_nr_pages << PAGE_SHIFT);
+}
+EXPORT_SYMBOL_GPL(mhp_supports_memmap_on_memory);
+
 #ifdef CONFIG_MEMORY_HOTREMOVE
 /*
  * A free page on the buddy free lists (not the per-cpu lists) has PageBuddy
@@ -1516,6 +1579,21 @@ static void node_states_clear_node(int node, struct memory_notify *arg)
 		node_clear_state(node, N_MEMORY);
 }
 
+/* memmap pages at the start of the memory block starting at @pfn */
+static unsigned long memblock_nr_vmemmap_pages(unsigned long pfn)
+{
+	unsigned long nr_vmemmap_pages = 0;
+	struct memory_block *mem;
+
+	mem = find_memory_block(__pfn_to_section(pfn));
+	if (!mem)
+		return 0;
+	if (section_nr_to_pfn(mem->start_section_nr) == pfn)
+		nr_vmemmap_pages = mem->nr_vmemmap_pages;
+	put_device(&mem->dev);
+	return nr_vmemmap_pages;
+}
+
 static int __ref __offline_pages(unsigned long start_pfn,
 		  unsigned long end_pfn)
 {
@@ -1536,6 +1614,15 @@ static int __ref __offline_pages(unsigned long start_pfn,
 
 	mem_hotplug_begin();
 
+	/*
+	 * The notifiers are told about the whole range.  A memmap at its
+	 * start stays until the memory is removed, only the pages after it
+	 * are isolated and taken out of the zone.
+	 */
+	arg.start_pfn = start_pfn;
+	arg.nr_pages = end_pfn - start_pfn;
+	start_pfn += memblock_nr_vmemmap_pages(start_pfn);
+
 	/* This makes hotplug much easier...and readable.
 	   we assume this for now. .*/
 	if (!test_pages_in_a_zone(start_pfn, end_pfn, &valid_start,
@@ -1558,8 +1645,6 @@ static int __ref __offline_pages(unsigned long start_pfn,
 		goto failed_removal;
 	}
 
-	arg.start_pfn = start_pfn;
-	arg.nr_pages = nr_pages;
 	node_states_check_changes_offline(nr_pages, zone, &arg);
 
 	ret = memory_notify(MEM_GOING_OFFLINE, &arg);
@@ -1824,8 +1909,19 @@ void try_offline_node(int nid)
 }
 EXPORT_SYMBOL(try_offline_node);
 
+static int get_nr_vmemmap_pages_cb(struct memory_block *mem, void *arg)
+{
+	*(unsigned long *)arg += mem->nr_vmemmap_pages;
+	return 0;
+}
+
 static int __ref try_remove_memory(int nid, u64 start, u64 size)
 {
+	struct vmem_altmap mhp_altmap = {
+		.base_pfn = PHYS_PFN(start),
+	};
+	struct vmem_altmap *altmap = NULL;
+	unsigned long nr_vmemmap_pages = 0;
 	int rc = 0;
 
 	BUG_ON(check_hotplug_memory_range(start, size));
@@ -1842,12 +1938,26 @@ static int __ref try_remove_memory(int nid, u64 start, u64 size)
 	if (rc)
 		goto done;
 
+	/* a memmap on the memory goes with it, see MHP_MEMMAP_ON_MEMORY */
+	walk_memory_range(PFN_DOWN(start), PFN_UP(start + size - 1),
+			  &nr_vmemmap_pages, get_nr_vmemmap_pages_cb);
+	if (nr_vmemmap_pages) {
+		if (size != memory_block_size_bytes()) {
+			pr_warn("Refuse to remove %#llx - %#llx, wrong granularity\n",
+				start, start + size);
+			rc = -EINVAL;
+			goto done;
+		}
+		mhp_altmap.alloc = nr_vmemmap_pages;
+		altmap = &mhp_altmap;
+	}
+
 	/* remove memmap entry */
 	firmware_map_remove(start, start + size, "System RAM");
 	memblock_free(start, size);
 	memblock_remove(start, size);
 
-	arch_remove_memory(start, size, NULL);
+	arch_remove_memory(start, size, altmap);
 
 	try_offline_node(nid);
 
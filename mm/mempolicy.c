@@ -719,7 +719,9 @@ static int vma_replace_policy(struct vm_area_struct *vma,
 	}
 
 	old = vma->vm_policy;
+	mmap_seq_write_begin(vma->vm_mm);
 	vma->vm_policy = new; /* protected by mmap_sem */
+	mmap_seq_write_end(vma->vm_mm);
 	mpol_put(old);
 
 	return 0;
@@ -2622,6 +2624,49 @@ void mpol_shared_policy_init(struct shared_policy *sp, struct mempolicy *mpol)
 	}
 }
 
+/**
+ * mpol_shared_policy_set_all - set the policy of a whole shared object
+ * @sp:    the shared policy of the object, e.g. of a tmpfs inode
+ * @mode:  the new policy mode, MPOL_DEFAULT to drop the current one
+ * @nodes: the nodes of the new policy, NULL for MPOL_DEFAULT
+ *
+ * Like mbind() on a mapping of all of the object, without needing one.
+ * @nodes is contextualized with the cpuset of the calling task.
+ */
+int mpol_shared_policy_set_all(struct shared_policy *sp, unsigned short mode,
+			       nodemask_t *nodes)
+{
+	struct vm_area_struct pvma;
+	struct mempolicy *new;
+	int ret;
+	NODEMASK_SCRATCH(scratch);
+
+	if (!scratch)
+		return -ENOMEM;
+
+	new = mpol_new(mode, 0, nodes);
+	if (IS_ERR(new)) {
+		ret = PTR_ERR(new);
+		goto free_scratch;
+	}
+
+	task_lock(current);
+	ret = mpol_set_nodemask(new, nodes, scratch);
+	task_unlock(current);
+	if (ret)
+		goto put_new;
+
+	vma_init(&pvma, NULL);
+	pvma.vm_end = TASK_SIZE;	/* policy covers entire file */
+	ret = mpol_set_shared_policy(sp, &pvma, new);	/* adds ref */
+
+put_new:
+	mpol_put(new);
+free_scratch:
+	NODEMASK_SCRATCH_FREE(scratch);
+	return ret;
+}
+
 int mpol_set_shared_policy(struct shared_policy *info,
 			struct vm_area_struct *vma, struct mempolicy *npol)
 {
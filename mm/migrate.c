@@ -47,6 +47,8 @@
 #include <linux/page_owner.h>
 #include <linux/sched/mm.h>
 #include <linux/ptrace.h>
+#include <linux/memory.h>
+#include <linux/kidled.h>
 
 #include <asm/tlbflush.h>
 
@@ -1164,6 +1166,41 @@ static int __unmap_and_move(struct page *page, struct page *newpage,
 #define ICE_noinline
 #endif
 
+#ifdef CONFIG_NUMA
+static void count_tiering_event(struct page *page, enum vm_event_item item,
+				int nr)
+{
+	count_vm_events(item, nr);
+#ifdef CONFIG_MEMCG
+	if (page->mem_cgroup)
+		count_memcg_events(page->mem_cgroup, item, nr);
+#endif
+}
+
+/* Account demotions and promotions, @newpage carries the memcg by now */
+static void count_tiering_migration(struct page *page, struct page *newpage,
+				    enum migrate_reason reason)
+{
+	int nr = hpage_nr_pages(newpage);
+
+	if (reason == MR_DEMOTION)
+		count_tiering_event(newpage, current_is_kswapd() ?
+				    PGDEMOTE_KSWAPD : PGDEMOTE_DIRECT, nr);
+#ifdef CONFIG_NUMA_BALANCING
+	else if (reason == MR_NUMA_MISPLACED &&
+		 !node_is_toptier(page_to_nid(page)) &&
+		 node_is_toptier(page_to_nid(newpage)))
+		count_tiering_event(newpage, PGPROMOTE_SUCCESS, nr);
+#endif
+}
+#else
+static inline void count_tiering_migration(struct page *page,
+					   struct page *newpage,
+					   enum migrate_reason reason)
+{
+}
+#endif
+
 /*
  * Obtain the lock on page, remove all ptes and migrate the page
  * to the newly allocated page in newpage.
@@ -1202,8 +1239,10 @@ static ICE_noinline int unmap_and_move(new_page_t get_new_page,
 	}
 
 	rc = __unmap_and_move(page, newpage, force, mode);
-	if (rc == MIGRATEPAGE_SUCCESS)
+	if (rc == MIGRATEPAGE_SUCCESS) {
 		set_page_owner_migrate_reason(newpage, reason);
+		count_tiering_migration(page, newpage, reason);
+	}
 
 out:
 	if (rc != -EAGAIN) {
@@ -1899,8 +1938,26 @@ static int numamigrate_isolate_page(pg_data_t *pgdat, struct page *page)
 	VM_BUG_ON_PAGE(compound_order(page) && !PageTransHuge(page), page);
 
 	/* Avoid migrating to a node that is nearly full */
-	if (!migrate_balanced_pgdat(pgdat, 1UL << compound_order(page)))
+	if (!migrate_balanced_pgdat(pgdat, 1UL << compound_order(page))) {
+		int z;
+
+		/*
+		 * A full top tier node blocks promotion. Wake its kswapd,
+		 * which makes room by demoting cold pages.
+		 */
+		if (!numa_promotion_enabled || !numa_demotion_enabled ||
+		    node_is_toptier(page_to_nid(page)))
+			return 0;
+
+		for (z = pgdat->nr_zones - 1; z >= 0; z--) {
+			if (populated_zone(pgdat->node_zones + z))
+				break;
+		}
+		if (z >= 0)
+			wakeup_kswapd(pgdat->node_zones + z, 0,
+				      compound_order(page), ZONE_MOVABLE);
 		return 0;
+	}
 
 	if (isolate_lru_page(page))
 		return 0;
@@ -1980,8 +2037,10 @@ int migrate_misplaced_page(struct page *page, struct vm_area_struct *vma,
 			putback_lru_page(page);
 		}
 		isolated = 0;
-	} else
+	} else {
 		count_vm_numa_event(NUMA_PAGE_MIGRATE);
+		count_memcg_event_mm(vma->vm_mm, NUMA_PAGE_MIGRATE);
+	}
 	BUG_ON(!list_empty(&migratepages));
 	return isolated;
 
@@ -2109,6 +2168,8 @@ int migrate_misplaced_transhuge_page(struct mm_struct *mm,
 
 	count_vm_events(PGMIGRATE_SUCCESS, HPAGE_PMD_NR);
 	count_vm_numa_events(NUMA_PAGE_MIGRATE, HPAGE_PMD_NR);
+	count_memcg_events_mm(mm, NUMA_PAGE_MIGRATE, HPAGE_PMD_NR);
+	count_tiering_migration(page, new_page, MR_NUMA_MISPLACED);
 
 	mod_node_page_state(page_pgdat(page),
 			NR_ISOLATED_ANON + page_lru,
@@ -2989,3 +3050,237 @@ int migrate_vma(const struct migrate_vma_ops *ops,
 }
 EXPORT_SYMBOL(migrate_vma);
 #endif /* defined(MIGRATE_VMA_HELPER) */
+
+#ifdef CONFIG_NUMA
+/*
+ * Memory tiering: memory-only nodes, e.g. PMEM or CXL memory exposed as
+ * NUMA nodes, form a slower tier below the nodes with CPUs.  With
+ * demotion enabled, reclaim on a top tier node migrates cold pages to
+ * the nearest slower node instead of dropping or swapping them.  With
+ * promotion enabled, NUMA balancing hint faults on slow node pages move
+ * them back up.
+ */
+bool numa_demotion_enabled __read_mostly;
+
+static int node_demotion[MAX_NUMNODES] __read_mostly = {
+	[0 ... MAX_NUMNODES - 1] = NUMA_NO_NODE,
+};
+
+int next_demotion_node(int node)
+{
+	return READ_ONCE(node_demotion[node]);
+}
+
+bool node_is_toptier(int node)
+{
+	return node_state(node, N_CPU);
+}
+
+/*
+ * Point every node with CPUs at its nearest memory-only node.  Slow nodes
+ * get no target of their own, pages demoted there are reclaimed as usual.
+ */
+static void set_migration_target_nodes(void)
+{
+	int node, target, best, distance, best_distance;
+
+	for_each_node(node) {
+		best = NUMA_NO_NODE;
+		best_distance = INT_MAX;
+
+		if (node_state(node, N_MEMORY) && node_state(node, N_CPU)) {
+			for_each_node_state(target, N_MEMORY) {
+				if (node_state(target, N_CPU))
+					continue;
+				distance = node_distance(node, target);
+				if (distance < best_distance) {
+					best = target;
+					best_distance = distance;
+				}
+			}
+		}
+		WRITE_ONCE(node_demotion[node], best);
+	}
+}
+
+#ifdef CONFIG_MEMORY_HOTPLUG
+static int migrate_on_reclaim_callback(struct notifier_block *self,
+				       unsigned long action, void *arg)
+{
+	switch (action) {
+	case MEM_ONLINE:
+	case MEM_OFFLINE:
+		set_migration_target_nodes();
+		break;
+	}
+
+	return notifier_from_errno(0);
+}
+#endif
+
+#ifdef CONFIG_NUMA_BALANCING
+bool numa_promotion_enabled __read_mostly;
+/* Per target node, in MB/s */
+static unsigned int numa_promote_rate_limit_mbps = 65536;
+/* Pages kidled saw idle for longer than this are not promoted, 0 = off */
+static unsigned int numa_promote_max_idle_age;
+
+/*
+ * Called on a NUMA hint fault for a page on a slow node.  A single touch
+ * of a page that kidled has found idle for a long time does not make it
+ * hot, so with kidled running such pages wait for a later fault.
+ * Promotion into @dst_nid is also capped at numa_promote_rate_limit_mbps.
+ */
+bool numa_promotion_allowed(struct page *page, int dst_nid)
+{
+	pg_data_t *pgdat = NODE_DATA(dst_nid);
+	unsigned long rate_limit, start, now = jiffies;
+	int nr = hpage_nr_pages(page);
+
+#ifdef CONFIG_KIDLED
+	if (numa_promote_max_idle_age && kidled_get_current_scan_duration()) {
+		int age = kidled_get_page_age(page_pgdat(page),
+					      page_to_pfn(page));
+
+		if (age > (int)numa_promote_max_idle_age)
+			return false;
+	}
+#endif
+
+	rate_limit = (unsigned long)numa_promote_rate_limit_mbps <<
+		     (20 - PAGE_SHIFT);
+	start = READ_ONCE(pgdat->numa_promote_rl_start);
+	if (time_after(now, start + HZ) &&
+	    cmpxchg(&pgdat->numa_promote_rl_start, start, now) == start)
+		atomic_long_set(&pgdat->numa_promote_rl_nr, 0);
+
+	if (atomic_long_add_return(nr, &pgdat->numa_promote_rl_nr) >
+	    rate_limit) {
+		count_tiering_event(page, PGPROMOTE_RATE_LIMITED, nr);
+		return false;
+	}
+
+	return true;
+}
+#endif /* CONFIG_NUMA_BALANCING */
+
+#ifdef CONFIG_SYSFS
+static ssize_t demotion_enabled_show(struct kobject *kobj,
+				     struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%s\n", numa_demotion_enabled ? "true" : "false");
+}
+
+static ssize_t demotion_enabled_store(struct kobject *kobj,
+				      struct kobj_attribute *attr,
+				      const char *buf, size_t count)
+{
+	if (kstrtobool(buf, &numa_demotion_enabled))
+		return -EINVAL;
+
+	return count;
+}
+
+static struct kobj_attribute numa_demotion_enabled_attr =
+	__ATTR(demotion_enabled, 0644, demotion_enabled_show,
+	       demotion_enabled_store);
+
+#ifdef CONFIG_NUMA_BALANCING
+static ssize_t promotion_enabled_show(struct kobject *kobj,
+				      struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%s\n", numa_promotion_enabled ? "true" : "false");
+}
+
+static ssize_t promotion_enabled_store(struct kobject *kobj,
+				       struct kobj_attribute *attr,
+				       const char *buf, size_t count)
+{
+	if (kstrtobool(buf, &numa_promotion_enabled))
+		return -EINVAL;
+
+	return count;
+}
+
+static struct kobj_attribute numa_promotion_enabled_attr =
+	__ATTR(promotion_enabled, 0644, promotion_enabled_show,
+	       promotion_enabled_store);
+
+static ssize_t promote_rate_limit_MBps_show(struct kobject *kobj,
+					    struct kobj_attribute *attr,
+					    char *buf)
+{
+	return sprintf(buf, "%u\n", numa_promote_rate_limit_mbps);
+}
+
+static ssize_t promote_rate_limit_MBps_store(struct kobject *kobj,
+					     struct kobj_attribute *attr,
+					     const char *buf, size_t count)
+{
+	unsigned int val;
+
+	if (kstrtouint(buf, 10, &val) || !val)
+		return -EINVAL;
+
+	numa_promote_rate_limit_mbps = val;
+	return count;
+}
+
+static struct kobj_attribute numa_promote_rate_limit_attr =
+	__ATTR(promote_rate_limit_MBps, 0644, promote_rate_limit_MBps_show,
+	       promote_rate_limit_MBps_store);
+
+static ssize_t promote_max_idle_age_show(struct kobject *kobj,
+					 struct kobj_attribute *attr,
+					 char *buf)
+{
+	return sprintf(buf, "%u\n", numa_promote_max_idle_age);
+}
+
+static ssize_t promote_max_idle_age_store(struct kobject *kobj,
+					  struct kobj_attribute *attr,
+					  const char *buf, size_t count)
+{
+	unsigned int val;
+
+	if (kstrtouint(buf, 10, &val) || val > U8_MAX)
+		return -EINVAL;
+
+	numa_promote_max_idle_age = val;
+	return count;
+}
+
+static struct kobj_attribute numa_promote_max_idle_age_attr =
+	__ATTR(promote_max_idle_age, 0644, promote_max_idle_age_show,
+	       promote_max_idle_age_store);
+#endif /* CONFIG_NUMA_BALANCING */
+
+static struct attribute *numa_attrs[] = {
+	&numa_demotion_enabled_attr.attr,
+#ifdef CONFIG_NUMA_BALANCING
+	&numa_promotion_enabled_attr.attr,
+	&numa_promote_rate_limit_attr.attr,
+	&numa_promote_max_idle_age_attr.attr,
+#endif
+	NULL,
+};
+
+static const struct attribute_group numa_attr_group = {
+	.attrs = numa_attrs,
+	.name = "numa",
+};
+#endif /* CONFIG_SYSFS */
+
+static int __init numa_tiering_init(void)
+{
+	set_migration_target_nodes();
+	hotplug_memory_notifier(migrate_on_reclaim_callback, 100);
+
+#ifdef CONFIG_SYSFS
+	if (sysfs_create_group(mm_kobj, &numa_attr_group))
+		pr_err("numa: failed to register sysfs interface\n");
+#endif
+	return 0;
+}
+late_initcall(numa_tiering_init);
+#endif /* CONFIG_NUMA */
@@ -570,9 +570,11 @@ int mlock_fixup(struct vm_area_struct *vma, struct vm_area_struct **prev,
 	 * set VM_LOCKED, populate_vma_page_range will bring it back.
 	 */
 
-	if (lock)
+	if (lock) {
+		mmap_seq_write_begin(mm);
 		vma->vm_flags = newflags;
-	else
+		mmap_seq_write_end(mm);
+	} else
 		munlock_vma_pages_range(vma, start, end);
 
 out:
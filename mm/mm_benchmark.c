@@ -0,0 +1,336 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * In-kernel microbenchmarks of the fault, reclaim, compaction and hugetlb
+ * paths, driven through /sys/kernel/debug/mm_benchmark/.
+ *
+ * Writing to a benchmark's file runs it nr_iterations times in the context
+ * of the writer, reading it shows the latency histograms of the last run:
+ *
+ *   fault_anon	 write faults on private anonymous memory
+ *   fault_file	 write faults on shared shmem memory
+ *   fault_thp	 write faults on MADV_HUGEPAGE memory, one per PMD
+ *   reclaim	 SWAP_CLUSTER_MAX page reclaims from the writer's memcg
+ *   compaction	 pageblock_order allocations, which compact when needed
+ *   hugetlb	 default size hugetlb page allocations and frees
+ *
+ * The memory is faulted into the writer's address space, so it is charged
+ * to the writer's memcg. Run reclaim in a memcg that has memory to give.
+ */
+
+#include <linux/debugfs.h>
+#include <linux/gfp.h>
+#include <linux/hugetlb.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/memcontrol.h>
+#include <linux/mm.h>
+#include <linux/mman.h>
+#include <linux/seq_file.h>
+#include <linux/shmem_fs.h>
+#include <linux/swap.h>
+
+#define MM_BENCH_BUCKETS	32	/* log2 ns, up to 2s */
+
+struct mm_bench_hist {
+	const char *name;
+	u64 count[MM_BENCH_BUCKETS];
+	u64 nr, sum, min, max;
+};
+
+struct mm_bench {
+	const char *name;
+	int (*run)(struct mm_bench *b);
+	struct mm_bench_hist hist[2];
+	unsigned long nr_failed;
+	unsigned long nr_pages;		/* pages faulted or reclaimed */
+	u64 runtime_ns;
+};
+
+static DEFINE_MUTEX(mm_bench_mutex);
+static u32 nr_iterations = 512;
+
+static void mm_bench_record(struct mm_bench_hist *h, u64 ns)
+{
+	h->count[min_t(int, ns ? ilog2(ns) : 0, MM_BENCH_BUCKETS - 1)]++;
+	if (!h->nr++ || ns < h->min)
+		h->min = ns;
+	h->max = max(h->max, ns);
+	h->sum += ns;
+}
+
+/*
+ * Fault in nr_iterations ranges of @step bytes each of a fresh mapping,
+ * timing the faults alone.
+ */
+static int mm_bench_fault(struct mm_bench *b, struct file *file,
+			  unsigned long step, bool thp)
+{
+	struct mm_struct *mm = current->mm;
+	unsigned long len = (unsigned long)nr_iterations * step;
+	unsigned long map, addr, i;
+	struct vm_area_struct *vma;
+	vm_fault_t ret;
+	u64 start;
+	int err = 0;
+
+	if (!mm)
+		return -EINVAL;
+
+	map = vm_mmap(file, 0, len + step, PROT_READ | PROT_WRITE,
+		      file ? MAP_SHARED : MAP_PRIVATE | MAP_ANONYMOUS, 0);
+	if (IS_ERR_VALUE(map))
+		return map;
+	addr = ALIGN(map, step);
+	if (thp) {
+		err = do_madvise(addr, len, MADV_HUGEPAGE);
+		if (err)
+			goto out;
+	}
+
+	down_read(&mm->mmap_sem);
+	for (i = 0; i < nr_iterations; i++, addr += step) {
+		vma = find_vma(mm, addr);
+		if (!vma || vma->vm_start > addr) {
+			err = -EFAULT;
+			break;
+		}
+
+		start = ktime_get_ns();
+		ret = handle_mm_fault(vma, addr, FAULT_FLAG_WRITE);
+		if (ret & VM_FAULT_ERROR) {
+			b->nr_failed++;
+			continue;
+		}
+		mm_bench_record(&b->hist[0], ktime_get_ns() - start);
+		b->nr_pages += step >> PAGE_SHIFT;
+
+		if (fatal_signal_pending(current)) {
+			err = -EINTR;
+			break;
+		}
+	}
+	up_read(&mm->mmap_sem);
+out:
+	vm_munmap(map, len + step);
+	return err;
+}
+
+static int mm_bench_fault_anon(struct mm_bench *b)
+{
+	return mm_bench_fault(b, NULL, PAGE_SIZE, false);
+}
+
+static int mm_bench_fault_file(struct mm_bench *b)
+{
+	unsigned long len = (unsigned long)(nr_iterations + 1) * PAGE_SIZE;
+	struct file *file;
+	int err;
+
+	file = shmem_file_setup("mm_benchmark", len, VM_NORESERVE);
+	if (IS_ERR(file))
+		return PTR_ERR(file);
+	err = mm_bench_fault(b, file, PAGE_SIZE, false);
+	fput(file);
+	return err;
+}
+
+static int mm_bench_fault_thp(struct mm_bench *b)
+{
+	if (!IS_ENABLED(CONFIG_TRANSPARENT_HUGEPAGE))
+		return -EOPNOTSUPP;
+	return mm_bench_fault(b, NULL, HPAGE_PMD_SIZE, true);
+}
+
+static int mm_bench_reclaim(struct mm_bench *b)
+{
+#ifdef CONFIG_MEMCG
+	struct mem_cgroup *memcg;
+	unsigned long nr;
+	u64 start;
+	u32 i;
+
+	memcg = get_mem_cgroup_from_mm(current->mm);
+	if (!memcg)
+		return -EINVAL;
+
+	for (i = 0; i < nr_iterations; i++) {
+		start = ktime_get_ns();
+		nr = try_to_free_mem_cgroup_pages(memcg, SWAP_CLUSTER_MAX,
+						  GFP_KERNEL, true);
+		mm_bench_record(&b->hist[0], ktime_get_ns() - start);
+		if (!nr)
+			b->nr_failed++;
+		b->nr_pages += nr;
+
+		if (fatal_signal_pending(current))
+			break;
+		cond_resched();
+	}
+
+	mem_cgroup_put(memcg);
+	return 0;
+#else
+	return -EOPNOTSUPP;
+#endif
+}
+
+static int mm_bench_compaction(struct mm_bench *b)
+{
+	const gfp_t gfp = GFP_HIGHUSER_MOVABLE | __GFP_NORETRY | __GFP_NOWARN;
+	struct page *page;
+	u64 start;
+	u32 i;
+
+	for (i = 0; i < nr_iterations; i++) {
+		start = ktime_get_ns();
+		page = alloc_pages(gfp, pageblock_order);
+		if (!page) {
+			b->nr_failed++;
+			mm_bench_record(&b->hist[1],
+					ktime_get_ns() - start);
+		} else {
+			mm_bench_record(&b->hist[0],
+					ktime_get_ns() - start);
+			__free_pages(page, pageblock_order);
+			b->nr_pages += 1UL << pageblock_order;
+		}
+
+		if (fatal_signal_pending(current))
+			break;
+		cond_resched();
+	}
+	return 0;
+}
+
+static int mm_bench_hugetlb(struct mm_bench *b)
+{
+#ifdef CONFIG_HUGETLB_PAGE
+	struct hstate *h;
+	struct page *page;
+	u64 start;
+	u32 i;
+
+	if (!hugepages_supported())
+		return -EOPNOTSUPP;
+	h = &default_hstate;
+
+	for (i = 0; i < nr_iterations; i++) {
+		start = ktime_get_ns();
+		page = alloc_huge_page_node(h, numa_node_id());
+		if (!page) {
+			b->nr_failed++;
+			continue;
+		}
+		mm_bench_record(&b->hist[0], ktime_get_ns() - start);
+
+		start = ktime_get_ns();
+		put_page(page);
+		mm_bench_record(&b->hist[1], ktime_get_ns() - start);
+		b->nr_pages += pages_per_huge_page(h);
+
+		if (fatal_signal_pending(current))
+			break;
+		cond_resched();
+	}
+	return 0;
+#else
+	return -EOPNOTSUPP;
+#endif
+}
+
+static struct mm_bench mm_benches[] = {
+	{ "fault_anon",	mm_bench_fault_anon,	{ { "fault" } } },
+	{ "fault_file",	mm_bench_fault_file,	{ { "fault" } } },
+	{ "fault_thp",	mm_bench_fault_thp,	{ { "fault" } } },
+	{ "reclaim",	mm_bench_reclaim,	{ { "reclaim" } } },
+	{ "compaction",	mm_bench_compaction,	{ { "success" }, { "failure" } } },
+	{ "hugetlb",	mm_bench_hugetlb,	{ { "alloc" }, { "free" } } },
+};
+
+static int mm_bench_show(struct seq_file *m, void *v)
+{
+	struct mm_bench *b = m->private;
+	int i, j;
+
+	mutex_lock(&mm_bench_mutex);
+	seq_printf(m, "runtime_ns %llu\nfailed %lu\npages %lu\n",
+		   b->runtime_ns, b->nr_failed, b->nr_pages);
+	for (i = 0; i < ARRAY_SIZE(b->hist); i++) {
+		struct mm_bench_hist *h = &b->hist[i];
+
+		if (!h->name)
+			break;
+		seq_printf(m, "%s: nr %llu min %llu avg %llu max %llu\n",
+			   h->name, h->nr, h->min,
+			   h->nr ? div64_u64(h->sum, h->nr) : 0, h->max);
+		for (j = 0; j < MM_BENCH_BUCKETS; j++) {
+			if (!h->count[j])
+				continue;
+			seq_printf(m, "  [%llu, %llu) ns: %llu\n",
+				   j ? 1ULL << j : 0, 1ULL << (j + 1),
+				   h->count[j]);
+		}
+	}
+	mutex_unlock(&mm_bench_mutex);
+	return 0;
+}
+
+static int mm_bench_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mm_bench_show, inode->i_private);
+}
+
+static ssize_t mm_bench_write(struct file *file, const char __user *buf,
+			      size_t count, loff_t *ppos)
+{
+	struct mm_bench *b = file_inode(file)->i_private;
+	u64 start;
+	int i, err;
+
+	if (mutex_lock_interruptible(&mm_bench_mutex))
+		return -EINTR;
+
+	for (i = 0; i < ARRAY_SIZE(b->hist); i++) {
+		const char *name = b->hist[i].name;
+
+		memset(&b->hist[i], 0, sizeof(b->hist[i]));
+		b->hist[i].name = name;
+	}
+	b->nr_failed = 0;
+	b->nr_pages = 0;
+
+	start = ktime_get_ns();
+	err = b->run(b);
+	b->runtime_ns = ktime_get_ns() - start;
+	mutex_unlock(&mm_bench_mutex);
+
+	return err ? err : count;
+}
+
+static const struct file_operations mm_bench_fops = {
+	.open		= mm_bench_open,
+	.read		= seq_read,
+	.write		= mm_bench_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init mm_bench_init(void)
+{
+	struct dentry *dir;
+	int i;
+
+	dir = debugfs_create_dir("mm_benchmark", NULL);
+	if (!dir) {
+		pr_warn("Failed to create mm_benchmark in debugfs");
+		return 0;
+	}
+
+	debugfs_create_u32("nr_iterations", 0600, dir, &nr_iterations);
+	for (i = 0; i < ARRAY_SIZE(mm_benches); i++)
+		debugfs_create_file(mm_benches[i].name, 0600, dir,
+				    &mm_benches[i], &mm_bench_fops);
+	return 0;
+}
+late_initcall(mm_bench_init);
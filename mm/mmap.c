@@ -46,6 +46,7 @@
 #include <linux/pkeys.h>
 #include <linux/oom.h>
 #include <linux/sched/mm.h>
+#include <linux/async_fork.h>
 
 #include <linux/uaccess.h>
 #include <asm/cacheflush.h>
@@ -135,7 +136,9 @@ void vma_set_page_prot(struct vm_area_struct *vma)
 		vm_page_prot = vm_pgprot_modify(vm_page_prot, vm_flags);
 	}
 	/* remove_protection_ptes reads vma->vm_page_prot without mmap_sem */
+	mmap_seq_write_begin(vma->vm_mm);
 	WRITE_ONCE(vma->vm_page_prot, vm_page_prot);
+	mmap_seq_write_end(vma->vm_mm);
 }
 
 /*
@@ -607,8 +610,10 @@ __vma_link(struct mm_struct *mm, struct vm_area_struct *vma,
 	struct vm_area_struct *prev, struct rb_node **rb_link,
 	struct rb_node *rb_parent)
 {
+	mmap_seq_write_begin(mm);
 	__vma_link_list(mm, vma, prev, rb_parent);
 	__vma_link_rb(mm, vma, rb_link, rb_parent);
+	mmap_seq_write_end(mm);
 }
 
 static void vma_link(struct mm_struct *mm, struct vm_area_struct *vma,
@@ -656,6 +661,7 @@ static __always_inline void __vma_unlink_common(struct mm_struct *mm,
 {
 	struct vm_area_struct *next;
 
+	mmap_seq_write_begin(mm);
 	vma_rb_erase_ignore(vma, &mm->mm_rb, ignore);
 	next = vma->vm_next;
 	if (has_prev)
@@ -672,6 +678,7 @@ static __always_inline void __vma_unlink_common(struct mm_struct *mm,
 
 	/* Kill the cache */
 	vmacache_invalidate(mm);
+	mmap_seq_write_end(mm);
 }
 
 static inline void __vma_unlink_prev(struct mm_struct *mm,
@@ -786,6 +793,8 @@ int __vma_adjust(struct vm_area_struct *vma, unsigned long start,
 				return error;
 		}
 	}
+
+	mmap_seq_write_begin(mm);
 again:
 	vma_adjust_trans_huge(orig_vma, start, end, adjust_next);
 
@@ -972,6 +981,7 @@ int __vma_adjust(struct vm_area_struct *vma, unsigned long start,
 	if (insert && file)
 		uprobe_mmap(insert);
 
+	mmap_seq_write_end(mm);
 	validate_mm(mm);
 
 	return 0;
@@ -2608,6 +2618,7 @@ detach_vmas_to_be_unmapped(struct mm_struct *mm, struct vm_area_struct *vma,
 	struct vm_area_struct *tail_vma = NULL;
 
 	insertion_point = (prev ? &prev->vm_next : &mm->mmap);
+	mmap_seq_write_begin(mm);
 	vma->vm_prev = NULL;
 	do {
 		vma_rb_erase(vma, &mm->mm_rb);
@@ -2625,6 +2636,7 @@ detach_vmas_to_be_unmapped(struct mm_struct *mm, struct vm_area_struct *vma,
 
 	/* Kill the cache */
 	vmacache_invalidate(mm);
+	mmap_seq_write_end(mm);
 
 	/*
 	 * Do not downgrade mmap_lock if we are next to VM_GROWSDOWN or
@@ -3106,6 +3118,8 @@ void exit_mmap(struct mm_struct *mm)
 	struct vm_area_struct *vma;
 	unsigned long nr_accounted = 0;
 
+	async_fork_exit(mm);
+
 	/* mm's last user has gone, and its about to be pulled down */
 	mmu_notifier_release(mm);
 
@@ -424,9 +424,11 @@ mprotect_fixup(struct vm_area_struct *vma, struct vm_area_struct **pprev,
 	 * vm_flags and vm_page_prot are protected by the mmap_sem
 	 * held in write mode.
 	 */
+	mmap_seq_write_begin(mm);
 	vma->vm_flags = newflags;
 	dirty_accountable = vma_wants_writenotify(vma, vma->vm_page_prot);
 	vma_set_page_prot(vma);
+	mmap_seq_write_end(mm);
 
 	change_protection(vma, start, end, vma->vm_page_prot,
 			  dirty_accountable, 0);
@@ -24,6 +24,7 @@
 #include <linux/uaccess.h>
 #include <linux/mm-arch-hooks.h>
 #include <linux/userfaultfd_k.h>
+#include <linux/async_fork.h>
 
 #include <asm/cacheflush.h>
 #include <asm/tlbflush.h>
@@ -240,6 +241,7 @@ unsigned long move_page_tables(struct vm_area_struct *vma,
 		}
 		if (pte_alloc(new_vma->vm_mm, new_pmd, new_addr))
 			break;
+		async_fork_fixup_pmd(vma->vm_mm, old_pmd, old_addr);
 		next = (new_addr + PMD_SIZE) & PMD_MASK;
 		if (extent > next - new_addr)
 			extent = next - new_addr;
@@ -294,6 +296,11 @@ static unsigned long move_vma(struct vm_area_struct *vma,
 	if (!new_vma)
 		return -ENOMEM;
 
+	/*
+	 * Keep speculative faults off the old range until it is unmapped,
+	 * they would fill it behind move_page_tables().
+	 */
+	mmap_seq_write_begin(mm);
 	moved_len = move_page_tables(vma, old_addr, new_vma, new_addr, old_len,
 				     need_rmap_locks);
 	if (moved_len < old_len) {
@@ -350,6 +357,7 @@ static unsigned long move_vma(struct vm_area_struct *vma,
 		vm_unacct_memory(excess >> PAGE_SHIFT);
 		excess = 0;
 	}
+	mmap_seq_write_end(mm);
 	mm->hiwater_vm = hiwater_vm;
 
 	/* Restore VM_ACCOUNT if one or two pieces of vma left */
@@ -41,6 +41,7 @@
 #include <linux/kthread.h>
 #include <linux/init.h>
 #include <linux/mmu_notifier.h>
+#include <linux/async_fork.h>
 #include <linux/fault_event.h>
 
 #include <asm/tlb.h>
@@ -519,6 +520,13 @@ bool __oom_reap_task_mm(struct mm_struct *mm)
 	struct vm_area_struct *vma;
 	bool ret = true;
 
+	/*
+	 * Page tables still owed to or by an async fork are settled under a
+	 * sleeping lock, with allocations; leave them to exit_mmap().
+	 */
+	if (mm_async_fork_pending(mm))
+		return false;
+
 	/*
 	 * Tell all users of get_user/copy_from_user etc... that the content
 	 * is no longer stable. No barriers really needed because unmapping
@@ -384,7 +384,9 @@ static unsigned long global_dirtyable_memory(void)
  * @dtc: dirty_throttle_control of interest
  *
  * Calculate @dtc->thresh and ->bg_thresh considering
- * vm_dirty_{bytes|ratio} and dirty_background_{bytes|ratio}.  The caller
+ * vm_dirty_{bytes|ratio} and dirty_background_{bytes|ratio}, or for a memcg
+ * domain the memory.dirty_ratio and memory.dirty_background_bytes of the
+ * memcg where set.  The caller
  * must ensure that @dtc->avail is set before calling this function.  The
  * dirty limits will be lifted by 1/4 for PF_LESS_THROTTLE (ie. nfsd) and
  * real-time tasks.
@@ -405,6 +407,15 @@ static void domain_dirty_limits(struct dirty_throttle_control *dtc)
 	/* gdtc is !NULL iff @dtc is for memcg domain */
 	if (gdtc) {
 		unsigned long global_avail = gdtc->avail;
+		unsigned long memcg_bg_bytes;
+		int memcg_ratio;
+
+		mem_cgroup_wb_dirty_limits(dtc->wb, &memcg_ratio,
+					   &memcg_bg_bytes);
+		if (memcg_ratio >= 0) {
+			ratio = (memcg_ratio * PAGE_SIZE) / 100;
+			bytes = 0;
+		}
 
 		/*
 		 * The byte settings can't be applied directly to memcg
@@ -419,7 +430,9 @@ static void domain_dirty_limits(struct dirty_throttle_control *dtc)
 		if (bg_bytes)
 			bg_ratio = min(DIV_ROUND_UP(bg_bytes, global_avail),
 				       PAGE_SIZE);
-		bytes = bg_bytes = 0;
+		bytes = 0;
+		/* the memcg's own budget is not scaled */
+		bg_bytes = memcg_bg_bytes;
 	}
 
 	if (bytes)
@@ -1556,9 +1569,11 @@ static inline void wb_dirty_limits(struct dirty_throttle_control *dtc)
  * the caller to wait once crossing the (background_thresh + dirty_thresh) / 2.
  * If we're over `background_thresh' then the writeback threads are woken to
  * perform some writeout.
+ *
+ * With BDP_ASYNC, returns -EAGAIN instead of making the caller wait.
  */
-static void balance_dirty_pages(struct bdi_writeback *wb,
-				unsigned long pages_dirtied)
+static int balance_dirty_pages(struct bdi_writeback *wb,
+			       unsigned long pages_dirtied, unsigned int flags)
 {
 	struct dirty_throttle_control gdtc_stor = { GDTC_INIT(wb) };
 	struct dirty_throttle_control mdtc_stor = { MDTC_INIT(wb, &gdtc_stor) };
@@ -1578,6 +1593,7 @@ static void balance_dirty_pages(struct bdi_writeback *wb,
 	struct backing_dev_info *bdi = wb->bdi;
 	bool strictlimit = bdi->capabilities & BDI_CAP_STRICTLIMIT;
 	unsigned long start_time = jiffies;
+	int ret = 0;
 
 	for (;;) {
 		unsigned long now = jiffies;
@@ -1775,6 +1791,10 @@ static void balance_dirty_pages(struct bdi_writeback *wb,
 					  period,
 					  pause,
 					  start_time);
+		if (flags & BDP_ASYNC) {
+			ret = -EAGAIN;
+			break;
+		}
 		__set_current_state(TASK_KILLABLE);
 		wb->dirty_sleep = now;
 		memcg_lat_stat_start(&start);
@@ -1813,7 +1833,7 @@ static void balance_dirty_pages(struct bdi_writeback *wb,
 		wb->dirty_exceeded = 0;
 
 	if (writeback_in_progress(wb))
-		return;
+		return ret;
 
 	/*
 	 * In laptop mode, we wait until hitting the higher threshold before
@@ -1824,10 +1844,11 @@ static void balance_dirty_pages(struct bdi_writeback *wb,
 	 * background_thresh, to keep the amount of dirty memory low.
 	 */
 	if (laptop_mode)
-		return;
+		return ret;
 
 	if (nr_reclaimable > gdtc->bg_thresh)
 		wb_start_background_writeback(wb);
+	return ret;
 }
 
 static DEFINE_PER_CPU(int, bdp_ratelimits);
@@ -1849,8 +1870,9 @@ static DEFINE_PER_CPU(int, bdp_ratelimits);
 DEFINE_PER_CPU(int, dirty_throttle_leaks) = 0;
 
 /**
- * balance_dirty_pages_ratelimited - balance dirty memory state
+ * balance_dirty_pages_ratelimited_flags - balance dirty memory state
  * @mapping: address_space which was dirtied
+ * @flags: BDP flags
  *
  * Processes which are dirtying memory should call in here once for each page
  * which was newly dirtied.  The function will periodically check the system's
@@ -1860,17 +1882,22 @@ DEFINE_PER_CPU(int, dirty_throttle_leaks) = 0;
  * calling it too often (ratelimiting).  But once we're over the dirty memory
  * limit we decrease the ratelimiting by a lot, to prevent individual processes
  * from overshooting the limit by (ratelimit_pages) each.
+ *
+ * With BDP_ASYNC the caller is not throttled, -EAGAIN is returned when it
+ * would have been.
  */
-void balance_dirty_pages_ratelimited(struct address_space *mapping)
+int balance_dirty_pages_ratelimited_flags(struct address_space *mapping,
+					  unsigned int flags)
 {
 	struct inode *inode = mapping->host;
 	struct backing_dev_info *bdi = inode_to_bdi(inode);
 	struct bdi_writeback *wb = NULL;
 	int ratelimit;
+	int ret = 0;
 	int *p;
 
 	if (!bdi_cap_account_dirty(bdi))
-		return;
+		return ret;
 
 	if (inode_cgwb_enabled(inode))
 		wb = wb_get_create_current(bdi, GFP_KERNEL);
@@ -1910,9 +1937,22 @@ void balance_dirty_pages_ratelimited(struct address_space *mapping)
 	preempt_enable();
 
 	if (unlikely(current->nr_dirtied >= ratelimit))
-		balance_dirty_pages(wb, current->nr_dirtied);
+		ret = balance_dirty_pages(wb, current->nr_dirtied, flags);
 
 	wb_put(wb);
+	return ret;
+}
+EXPORT_SYMBOL(balance_dirty_pages_ratelimited_flags);
+
+/**
+ * balance_dirty_pages_ratelimited - balance dirty memory state
+ * @mapping: address_space which was dirtied
+ *
+ * Throttling variant of balance_dirty_pages_ratelimited_flags().
+ */
+void balance_dirty_pages_ratelimited(struct address_space *mapping)
+{
+	balance_dirty_pages_ratelimited_flags(mapping, 0);
 }
 EXPORT_SYMBOL(balance_dirty_pages_ratelimited);
 
@@ -68,6 +68,8 @@
 #include <linux/nmi.h>
 #include <linux/psi.h>
 #include <linux/fault_event.h>
+#include <linux/padata.h>
+#include <linux/list_sort.h>
 
 #include <asm/sections.h>
 #include <asm/tlbflush.h>
@@ -132,6 +134,7 @@ unsigned long totalreserve_pages __read_mostly;
 unsigned long totalcma_pages __read_mostly;
 
 int percpu_pagelist_fraction;
+int percpu_pagelist_high_order_fraction;
 gfp_t gfp_allowed_mask __read_mostly = GFP_BOOT_MASK;
 
 /*
@@ -196,6 +199,44 @@ unsigned int pageblock_order __read_mostly;
 
 static void __free_pages_ok(struct page *page, unsigned int order);
 
+static inline unsigned int order_to_pindex(int migratetype, unsigned int order)
+{
+	unsigned int slot = order;
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	if (order > PAGE_ALLOC_COSTLY_ORDER) {
+		VM_BUG_ON(order != pageblock_order);
+		slot = PAGE_ALLOC_COSTLY_ORDER + 1;
+	}
+#else
+	VM_BUG_ON(order > PAGE_ALLOC_COSTLY_ORDER);
+#endif
+	return MIGRATE_PCPTYPES * slot + migratetype;
+}
+
+static inline unsigned int pindex_to_order(unsigned int pindex)
+{
+	unsigned int order = pindex / MIGRATE_PCPTYPES;
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	if (order > PAGE_ALLOC_COSTLY_ORDER)
+		order = pageblock_order;
+#endif
+	return order;
+}
+
+/* Orders that are cached on the pcp-lists */
+static inline bool pcp_allowed_order(unsigned int order)
+{
+	if (order <= PAGE_ALLOC_COSTLY_ORDER)
+		return true;
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	if (order == pageblock_order)
+		return true;
+#endif
+	return false;
+}
+
 /*
  * results with 256, 32 in the lowmem_reserve sysctl:
  *	1G machine -> (16M dma, 800M-16M normal, 1G-800M high)
@@ -621,10 +662,18 @@ static void bad_page(struct page *page, const char *reason,
  * This usage means that zero-order pages may not be compound.
  */
 
+static inline void free_the_page(struct page *page, unsigned int order)
+{
+	if (pcp_allowed_order(order))		/* Via pcp? */
+		free_unref_page(page, order);
+	else
+		__free_pages_ok(page, order);
+}
+
 void free_compound_page(struct page *page)
 {
 	mem_cgroup_uncharge(page);
-	__free_pages_ok(page, compound_order(page));
+	free_the_page(page, compound_order(page));
 }
 
 void prep_compound_page(struct page *page, unsigned int order)
@@ -832,8 +881,10 @@ static inline void del_page_from_free_list(struct page *page, struct zone *zone,
 					   unsigned int order)
 {
 	/* clear reported state and update reported page count */
-	if (page_reported(page))
+	if (page_reported(page)) {
 		__ClearPageReported(page);
+		zone->reported_pages -= 1UL << order;
+	}
 
 	list_del(&page->lru);
 	__ClearPageBuddy(page);
@@ -1207,9 +1258,9 @@ static __always_inline bool free_pages_prepare(struct page *page,
 }
 
 #ifdef CONFIG_DEBUG_VM
-static inline bool free_pcp_prepare(struct page *page)
+static inline bool free_pcp_prepare(struct page *page, unsigned int order)
 {
-	return free_pages_prepare(page, 0, true);
+	return free_pages_prepare(page, order, true);
 }
 
 static inline bool bulkfree_pcp_prepare(struct page *page)
@@ -1217,9 +1268,9 @@ static inline bool bulkfree_pcp_prepare(struct page *page)
 	return false;
 }
 #else
-static bool free_pcp_prepare(struct page *page)
+static bool free_pcp_prepare(struct page *page, unsigned int order)
 {
-	return free_pages_prepare(page, 0, false);
+	return free_pages_prepare(page, order, false);
 }
 
 static bool bulkfree_pcp_prepare(struct page *page)
@@ -1237,10 +1288,60 @@ static inline void prefetch_buddy(struct page *page)
 	prefetch(buddy);
 }
 
+static int pcp_page_pfn_cmp(void *priv, struct list_head *a,
+			    struct list_head *b)
+{
+	unsigned long pfn_a = page_to_pfn(list_entry(a, struct page, lru));
+	unsigned long pfn_b = page_to_pfn(list_entry(b, struct page, lru));
+
+	return pfn_a > pfn_b;
+}
+
+/*
+ * Merge the buddies within a batch of pages taken off the PCP lists, before
+ * zone->lock is taken.  Nobody else can see these pages, so combining them
+ * needs no lock and leaves fewer and larger pages for the merging done
+ * under zone->lock.  The batch must be sorted by pfn, which puts a page
+ * right after its lower buddy.  Blocks are not merged past pageblock_order
+ * nor across PCP migrate types, so the result is the same as freeing the
+ * pages one at a time.  The page order is in page_private().
+ */
+static void pcp_merge_batch(struct list_head *head)
+{
+	struct page *page, *tmp, *prev;
+	LIST_HEAD(merged);
+
+	list_for_each_entry_safe(page, tmp, head, lru) {
+		unsigned int order = page_private(page);
+
+		list_move_tail(&page->lru, &merged);
+
+		while (order < pageblock_order &&
+		       !list_is_first(&page->lru, &merged)) {
+			prev = list_prev_entry(page, lru);
+			if (page_private(prev) != order ||
+			    page_to_pfn(prev) !=
+			    __find_buddy_pfn(page_to_pfn(page), order) ||
+			    get_pcppage_migratetype(prev) !=
+			    get_pcppage_migratetype(page))
+				break;
+
+			/* page is the upper buddy, it goes with prev */
+			list_del(&page->lru);
+			set_page_private(page, 0);
+			page = prev;
+			set_page_private(page, ++order);
+		}
+	}
+	list_splice(&merged, head);
+}
+
 /*
  * Frees a number of pages from the PCP lists
- * Assumes all pages on list are in same zone, and of same order.
- * count is the number of pages to free.
+ * Assumes all pages on list are in same zone.  Only the lists from start to
+ * end - 1 are trimmed, depending on which of the order-0 and the high order
+ * limits was hit.
+ * count is the number of base pages to free.
  *
  * If the zone was previously in an "all pages pinned" state then look to
  * see if this freeing clears that state.
@@ -1249,17 +1350,20 @@ static inline void prefetch_buddy(struct page *page)
  * pinned" detection logic.
  */
 static void free_pcppages_bulk(struct zone *zone, int count,
-					struct per_cpu_pages *pcp)
+					struct per_cpu_pages *pcp,
+					unsigned int start, unsigned int end)
 {
-	int migratetype = 0;
+	unsigned int pindex = end - 1;
+	unsigned int order;
 	int batch_free = 0;
 	int prefetch_nr = 0;
 	bool isolated_pageblocks;
 	struct page *page, *tmp;
 	LIST_HEAD(head);
 
-	while (count) {
+	while (count > 0) {
 		struct list_head *list;
+		int nr_pages;
 
 		/*
 		 * Remove pages from lists in a round-robin fashion. A
@@ -1270,24 +1374,32 @@ static void free_pcppages_bulk(struct zone *zone, int count,
 		 */
 		do {
 			batch_free++;
-			if (++migratetype == MIGRATE_PCPTYPES)
-				migratetype = 0;
-			list = &pcp->lists[migratetype];
+			if (++pindex == end)
+				pindex = start;
+			list = &pcp->lists[pindex];
 		} while (list_empty(list));
 
 		/* This is the only non-empty list. Free them all. */
-		if (batch_free == MIGRATE_PCPTYPES)
+		if (batch_free == end - start)
 			batch_free = count;
 
+		order = pindex_to_order(pindex);
+		nr_pages = 1 << order;
 		do {
 			page = list_last_entry(list, struct page, lru);
 			/* must delete to avoid corrupting pcp list */
 			list_del(&page->lru);
-			pcp->count--;
+			pcp->count -= nr_pages;
+			if (order)
+				pcp->high_order_count -= nr_pages;
+			count -= nr_pages;
+			batch_free -= nr_pages;
 
 			if (bulkfree_pcp_prepare(page))
 				continue;
 
+			/* Remember the order until the page is merged below */
+			set_page_private(page, order);
 			list_add_tail(&page->lru, &head);
 
 			/*
@@ -1301,9 +1413,13 @@ static void free_pcppages_bulk(struct zone *zone, int count,
 			 */
 			if (prefetch_nr++ < pcp->batch)
 				prefetch_buddy(page);
-		} while (--count && --batch_free && !list_empty(list));
+		} while (count > 0 && batch_free > 0 && !list_empty(list));
 	}
 
+	/* Leave only the list splicing and merging with free pages to the lock */
+	list_sort(NULL, &head, pcp_page_pfn_cmp);
+	pcp_merge_batch(&head);
+
 	spin_lock(&zone->lock);
 	isolated_pageblocks = has_isolate_pageblock(zone);
 
@@ -1313,14 +1429,17 @@ static void free_pcppages_bulk(struct zone *zone, int count,
 	 */
 	list_for_each_entry_safe(page, tmp, &head, lru) {
 		int mt = get_pcppage_migratetype(page);
+
+		order = page_private(page);
+		set_page_private(page, 0);
 		/* MIGRATE_ISOLATE page should not go to pcplists */
 		VM_BUG_ON_PAGE(is_migrate_isolate(mt), page);
 		/* Pageblock could have been isolated meanwhile */
 		if (unlikely(isolated_pageblocks))
 			mt = get_pageblock_migratetype(page);
 
-		__free_one_page(page, page_to_pfn(page), zone, 0, mt, true);
-		trace_mm_page_pcpu_drain(page, 0, mt);
+		__free_one_page(page, page_to_pfn(page), zone, order, mt, true);
+		trace_mm_page_pcpu_drain(page, order, mt);
 	}
 	spin_unlock(&zone->lock);
 }
@@ -1760,27 +1879,46 @@ deferred_init_maxorder(u64 *i, struct zone *zone, unsigned long *start_pfn,
 }
 
 /*
- * Release the pending interrupts for every TICK_PAGE_COUNT pages.
+ * padata thread function: initialise and free the deferred pages of the
+ * zone in [start_pfn, end_pfn).  The chunks are section aligned, so
+ * MAX_ORDER blocks are never shared between threads.
  */
-#define TICK_PAGE_COUNT	(32 * 1024)
+static void __init
+deferred_init_memmap_chunk(unsigned long start_pfn, unsigned long end_pfn,
+			   void *arg)
+{
+	unsigned long spfn, epfn;
+	struct zone *zone = arg;
+	u64 i;
+
+	deferred_init_mem_pfn_range_in_zone(&i, zone, &spfn, &epfn, start_pfn);
+
+	/*
+	 * Initialize and free pages in MAX_ORDER sized increments so that we
+	 * can avoid introducing any issues with the buddy allocator.
+	 */
+	while (spfn < end_pfn) {
+		deferred_init_maxorder(&i, zone, &spfn, &epfn);
+		cond_resched();
+	}
+}
 
 /* Initialise remaining memory on a node */
 static int __init deferred_init_memmap(void *data)
 {
 	pg_data_t *pgdat = data;
 	const struct cpumask *cpumask = cpumask_of_node(pgdat->node_id);
-	unsigned long spfn = 0, epfn = 0, nr_pages = 0, prev_nr_pages = 0;
+	unsigned long spfn = 0, epfn = 0;
 	unsigned long first_init_pfn, flags;
 	unsigned long start = jiffies;
 	struct zone *zone;
-	int zid;
+	int zid, max_threads;
 	u64 i;
 
 	/* Bind memory initialisation thread to a local node if possible */
 	if (!cpumask_empty(cpumask))
 		set_cpus_allowed_ptr(current, cpumask);
 
-again:
 	pgdat_resize_lock(pgdat, &flags);
 	first_init_pfn = pgdat->first_deferred_pfn;
 	if (first_init_pfn == ULONG_MAX) {
@@ -1792,6 +1930,14 @@ static int __init deferred_init_memmap(void *data)
 	/* Sanity check boundaries */
 	BUG_ON(pgdat->first_deferred_pfn < pgdat->node_start_pfn);
 	BUG_ON(pgdat->first_deferred_pfn > pgdat_end_pfn(pgdat));
+	pgdat->first_deferred_pfn = ULONG_MAX;
+
+	/*
+	 * Once we unlock here, the zone cannot be grown anymore, thus if an
+	 * interrupt thread must allocate this early in boot, zone must be
+	 * pre-grown prior to start of deferred page initialization.
+	 */
+	pgdat_resize_unlock(pgdat, &flags);
 
 	/* Only the highest zone is deferred so find it */
 	for (zid = 0; zid < MAX_NR_ZONES; zid++) {
@@ -1805,35 +1951,32 @@ static int __init deferred_init_memmap(void *data)
 						 first_init_pfn))
 		goto zone_empty;
 
-	/*
-	 * Initialize and free pages in MAX_ORDER sized increments so
-	 * that we can avoid introducing any issues with the buddy
-	 * allocator.
-	 */
+	max_threads = max(cpumask_weight(cpumask), 1u);
+
+	/* Split each range of the zone between the CPUs of the node */
 	while (spfn < epfn) {
-		nr_pages += deferred_init_maxorder(&i, zone, &spfn, &epfn);
-		/*
-		 * Release the interrupts for every TICK_PAGE_COUNT pages
-		 * (128MB) to give tick timer the chance to update the
-		 * system jiffies.
-		 */
-		if ((nr_pages - prev_nr_pages) > TICK_PAGE_COUNT) {
-			prev_nr_pages = nr_pages;
-			pgdat->first_deferred_pfn = spfn;
-			pgdat_resize_unlock(pgdat, &flags);
-			goto again;
-		}
+		unsigned long epfn_align = ALIGN(epfn, PAGES_PER_SECTION);
+		struct padata_mt_job job = {
+			.thread_fn   = deferred_init_memmap_chunk,
+			.fn_arg      = zone,
+			.start       = spfn,
+			.size        = epfn_align - spfn,
+			.align       = PAGES_PER_SECTION,
+			.min_chunk   = PAGES_PER_SECTION,
+			.max_threads = max_threads,
+		};
+
+		padata_do_multithreaded(&job);
+		deferred_init_mem_pfn_range_in_zone(&i, zone, &spfn, &epfn,
+						    epfn_align);
 	}
 
 zone_empty:
-	pgdat->first_deferred_pfn = ULONG_MAX;
-	pgdat_resize_unlock(pgdat, &flags);
-
 	/* Sanity check that the next zone really is unpopulated */
 	WARN_ON(++zid < MAX_NR_ZONES && populated_zone(++zone));
 
-	pr_info("node %d initialised, %lu pages in %ums\n",
-		pgdat->node_id,	nr_pages, jiffies_to_msecs(jiffies - start));
+	pr_info("node %d deferred pages initialised in %ums\n",
+		pgdat->node_id, jiffies_to_msecs(jiffies - start));
 
 	pgdat_init_report_one_done();
 	return 0;
@@ -2098,40 +2241,40 @@ static inline bool free_pages_prezeroed(void)
 		page_poisoning_enabled();
 }
 
+static bool check_new_pages(struct page *page, unsigned int order)
+{
+	int i;
+	for (i = 0; i < (1 << order); i++) {
+		struct page *p = page + i;
+
+		if (unlikely(check_new_page(p)))
+			return true;
+	}
+
+	return false;
+}
+
 #ifdef CONFIG_DEBUG_VM
-static bool check_pcp_refill(struct page *page)
+static bool check_pcp_refill(struct page *page, unsigned int order)
 {
 	return false;
 }
 
-static bool check_new_pcp(struct page *page)
+static bool check_new_pcp(struct page *page, unsigned int order)
 {
-	return check_new_page(page);
+	return check_new_pages(page, order);
 }
 #else
-static bool check_pcp_refill(struct page *page)
+static bool check_pcp_refill(struct page *page, unsigned int order)
 {
-	return check_new_page(page);
+	return check_new_pages(page, order);
 }
-static bool check_new_pcp(struct page *page)
+static bool check_new_pcp(struct page *page, unsigned int order)
 {
 	return false;
 }
 #endif /* CONFIG_DEBUG_VM */
 
-static bool check_new_pages(struct page *page, unsigned int order)
-{
-	int i;
-	for (i = 0; i < (1 << order); i++) {
-		struct page *p = page + i;
-
-		if (unlikely(check_new_page(p)))
-			return true;
-	}
-
-	return false;
-}
-
 inline void post_alloc_hook(struct page *page, unsigned int order,
 				gfp_t gfp_flags)
 {
@@ -2189,6 +2332,9 @@ struct page *__rmqueue_smallest(struct zone *zone, unsigned int order,
 		page = get_page_from_free_area(area, migratetype);
 		if (!page)
 			continue;
+		/* the host has to fault a reported page back in */
+		if (page_reported(page))
+			zone->reported_refaults += 1UL << current_order;
 		del_page_from_free_list(page, zone, current_order);
 		expand(zone, page, order, current_order, migratetype);
 		set_pcppage_migratetype(page, migratetype);
@@ -2759,7 +2905,7 @@ static int rmqueue_bulk(struct zone *zone, unsigned int order,
 		if (unlikely(page == NULL))
 			break;
 
-		if (unlikely(check_pcp_refill(page)))
+		if (unlikely(check_pcp_refill(page, order)))
 			continue;
 
 		/*
@@ -2808,11 +2954,51 @@ void drain_zone_pages(struct zone *zone, struct per_cpu_pages *pcp)
 	batch = READ_ONCE(pcp->batch);
 	to_drain = min(pcp->count, batch);
 	if (to_drain > 0)
-		free_pcppages_bulk(zone, to_drain, pcp);
+		free_pcppages_bulk(zone, to_drain, pcp, 0, NR_PCP_LISTS);
 	local_irq_restore(flags);
 }
 #endif
 
+/*
+ * The pages freed to a CPU in one vmstat interval, shifted by
+ * PCP_FREE_RATE_SHIFT, is the pcp->high it asks for.  By default that can
+ * go up to PCP_HIGH_SCALE times the configured value.
+ */
+#define PCP_FREE_RATE_SHIFT	4
+#define PCP_HIGH_SCALE		8
+
+/*
+ * Called from the vmstat counter updater to move pcp->high of the currently
+ * executing processor towards what its recent free rate asks for, within
+ * [pcp->high_min, pcp->high_max].  It grows at once for a burst and shrinks
+ * back an eighth at a time, trimming the order-0 lists as it goes.
+ *
+ * Note that this function must be called with the thread pinned to
+ * a single processor.
+ */
+void decay_pcp_high(struct zone *zone, struct per_cpu_pages *pcp)
+{
+	unsigned long flags;
+	int high, target, excess;
+
+	local_irq_save(flags);
+	high = pcp->high;
+	target = clamp(pcp->free_count >> PCP_FREE_RATE_SHIFT,
+		       pcp->high_min, pcp->high_max);
+	pcp->free_count = 0;
+	if (target > high)
+		high = target;
+	else
+		high -= DIV_ROUND_UP(high - target, 8);
+	pcp->high = high;
+
+	excess = pcp->count - pcp->high_order_count - high;
+	if (excess > 0)
+		free_pcppages_bulk(zone, min(excess, READ_ONCE(pcp->batch)),
+				   pcp, 0, MIGRATE_PCPTYPES);
+	local_irq_restore(flags);
+}
+
 /*
  * Drain pcplists of the indicated processor and zone.
  *
@@ -2831,7 +3017,7 @@ static void drain_pages_zone(unsigned int cpu, struct zone *zone)
 
 	pcp = &pset->pcp;
 	if (pcp->count)
-		free_pcppages_bulk(zone, pcp->count, pcp);
+		free_pcppages_bulk(zone, pcp->count, pcp, 0, NR_PCP_LISTS);
 	local_irq_restore(flags);
 }
 
@@ -3013,11 +3199,12 @@ void mark_free_pages(struct zone *zone)
 }
 #endif /* CONFIG_PM */
 
-static bool free_unref_page_prepare(struct page *page, unsigned long pfn)
+static bool free_unref_page_prepare(struct page *page, unsigned long pfn,
+				    unsigned int order)
 {
 	int migratetype;
 
-	if (!free_pcp_prepare(page))
+	if (!free_pcp_prepare(page, order))
 		return false;
 
 	migratetype = get_pfnblock_migratetype(page, pfn);
@@ -3025,14 +3212,15 @@ static bool free_unref_page_prepare(struct page *page, unsigned long pfn)
 	return true;
 }
 
-static void free_unref_page_commit(struct page *page, unsigned long pfn)
+static void free_unref_page_commit(struct page *page, unsigned long pfn,
+				   unsigned int order)
 {
 	struct zone *zone = page_zone(page);
 	struct per_cpu_pages *pcp;
 	int migratetype;
 
 	migratetype = get_pcppage_migratetype(page);
-	__count_vm_event(PGFREE);
+	__count_vm_events(PGFREE, 1 << order);
 
 	/*
 	 * We only track unmovable, reclaimable and movable on pcp lists.
@@ -3043,34 +3231,49 @@ static void free_unref_page_commit(struct page *page, unsigned long pfn)
 	 */
 	if (migratetype >= MIGRATE_PCPTYPES) {
 		if (unlikely(is_migrate_isolate(migratetype))) {
-			free_one_page(zone, page, pfn, 0, migratetype);
+			free_one_page(zone, page, pfn, order, migratetype);
 			return;
 		}
 		migratetype = MIGRATE_MOVABLE;
 	}
 
 	pcp = &this_cpu_ptr(zone->pageset)->pcp;
-	list_add(&page->lru, &pcp->lists[migratetype]);
-	pcp->count++;
-	if (pcp->count >= pcp->high) {
-		unsigned long batch = READ_ONCE(pcp->batch);
-		free_pcppages_bulk(zone, batch, pcp);
+	list_add(&page->lru, &pcp->lists[order_to_pindex(migratetype, order)]);
+	pcp->count += 1 << order;
+	if (!order) {
+		pcp->free_count++;
+		if (pcp->count - pcp->high_order_count >= pcp->high) {
+			int batch = READ_ONCE(pcp->batch);
+
+			free_pcppages_bulk(zone, min(batch, pcp->count -
+					   pcp->high_order_count), pcp,
+					   0, MIGRATE_PCPTYPES);
+		}
+		return;
+	}
+
+	pcp->high_order_count += 1 << order;
+	if (pcp->high_order_count >= pcp->high_order_high) {
+		int batch = READ_ONCE(pcp->high_order_batch);
+
+		free_pcppages_bulk(zone, min(batch, pcp->high_order_count),
+				   pcp, MIGRATE_PCPTYPES, NR_PCP_LISTS);
 	}
 }
 
 /*
- * Free a 0-order page
+ * Free a page of an order that is cached on the pcp-lists
  */
-void free_unref_page(struct page *page)
+void free_unref_page(struct page *page, unsigned int order)
 {
 	unsigned long flags;
 	unsigned long pfn = page_to_pfn(page);
 
-	if (!free_unref_page_prepare(page, pfn))
+	if (!free_unref_page_prepare(page, pfn, order))
 		return;
 
 	local_irq_save(flags);
-	free_unref_page_commit(page, pfn);
+	free_unref_page_commit(page, pfn, order);
 	local_irq_restore(flags);
 }
 
@@ -3086,7 +3289,7 @@ void free_unref_page_list(struct list_head *list)
 	/* Prepare pages for freeing */
 	list_for_each_entry_safe(page, next, list, lru) {
 		pfn = page_to_pfn(page);
-		if (!free_unref_page_prepare(page, pfn))
+		if (!free_unref_page_prepare(page, pfn, 0))
 			list_del(&page->lru);
 		set_page_private(page, pfn);
 	}
@@ -3097,7 +3300,7 @@ void free_unref_page_list(struct list_head *list)
 
 		set_page_private(page, 0);
 		trace_mm_page_free_batched(page);
-		free_unref_page_commit(page, pfn);
+		free_unref_page_commit(page, pfn, 0);
 
 		/*
 		 * Guard against excessive IRQ disabled times when we get
@@ -3228,26 +3431,41 @@ static inline void zone_statistics(struct zone *preferred_zone, struct zone *z)
 }
 
 /* Remove page from the per-cpu list, caller must protect the list */
-static struct page *__rmqueue_pcplist(struct zone *zone, int migratetype,
-			unsigned int alloc_flags,
+static struct page *__rmqueue_pcplist(struct zone *zone, unsigned int order,
+			int migratetype, unsigned int alloc_flags,
 			struct per_cpu_pages *pcp,
 			struct list_head *list)
 {
+	int nr_pages = 1 << order;
 	struct page *page;
 
 	do {
 		if (list_empty(list)) {
-			pcp->count += rmqueue_bulk(zone, 0,
-					pcp->batch, list,
-					migratetype, alloc_flags);
+			int batch = READ_ONCE(pcp->batch);
+			int alloced;
+
+			/*
+			 * Refill a batch worth of base pages, but at least
+			 * one page of the order asked for.
+			 */
+			if (order)
+				batch = max(READ_ONCE(pcp->high_order_batch) >>
+					    order, 1);
+			alloced = rmqueue_bulk(zone, order, batch, list,
+					       migratetype, alloc_flags);
+			pcp->count += alloced << order;
+			if (order)
+				pcp->high_order_count += alloced << order;
 			if (unlikely(list_empty(list)))
 				return NULL;
 		}
 
 		page = list_first_entry(list, struct page, lru);
 		list_del(&page->lru);
-		pcp->count--;
-	} while (check_new_pcp(page));
+		pcp->count -= nr_pages;
+		if (order)
+			pcp->high_order_count -= nr_pages;
+	} while (check_new_pcp(page, order));
 
 	return page;
 }
@@ -3265,8 +3483,9 @@ static struct page *rmqueue_pcplist(struct zone *preferred_zone,
 
 	local_irq_save(flags);
 	pcp = &this_cpu_ptr(zone->pageset)->pcp;
-	list = &pcp->lists[migratetype];
-	page = __rmqueue_pcplist(zone,  migratetype, alloc_flags, pcp, list);
+	list = &pcp->lists[order_to_pindex(migratetype, order)];
+	page = __rmqueue_pcplist(zone, order, migratetype, alloc_flags,
+				 pcp, list);
 	if (page) {
 		__count_zid_vm_events(PGALLOC, page_zonenum(page), 1 << order);
 		zone_statistics(preferred_zone, zone);
@@ -3276,7 +3495,8 @@ static struct page *rmqueue_pcplist(struct zone *preferred_zone,
 }
 
 /*
- * Allocate a page from the given zone. Use pcplists for order-0 allocations.
+ * Allocate a page from the given zone. Use pcplists for the orders they
+ * cache.
  */
 static inline
 struct page *rmqueue(struct zone *preferred_zone,
@@ -3287,17 +3507,20 @@ struct page *rmqueue(struct zone *preferred_zone,
 	unsigned long flags;
 	struct page *page;
 
-	if (likely(order == 0)) {
-		page = rmqueue_pcplist(preferred_zone, zone, order,
-				gfp_flags, migratetype, alloc_flags);
-		goto out;
-	}
-
 	/*
 	 * We most definitely don't want callers attempting to
 	 * allocate greater than order-1 page units with __GFP_NOFAIL.
 	 */
 	WARN_ON_ONCE((gfp_flags & __GFP_NOFAIL) && (order > 1));
+
+	if (likely(pcp_allowed_order(order))) {
+		page = rmqueue_pcplist(preferred_zone, zone, order,
+				gfp_flags, migratetype, alloc_flags);
+		/* High-order requests may still get the highatomic reserve */
+		if (page || !order)
+			goto out;
+	}
+
 	spin_lock_irqsave(&zone->lock, flags);
 
 	do {
@@ -4884,14 +5107,6 @@ unsigned long get_zeroed_page(gfp_t gfp_mask)
 }
 EXPORT_SYMBOL(get_zeroed_page);
 
-static inline void free_the_page(struct page *page, unsigned int order)
-{
-	if (order == 0)		/* Via pcp? */
-		free_unref_page(page);
-	else
-		__free_pages_ok(page, order);
-}
-
 void __free_pages(struct page *page, unsigned int order)
 {
 	if (put_page_testzero(page))
@@ -6087,42 +6302,74 @@ static int zone_batchsize(struct zone *zone)
  * exist).
  */
 static void pageset_update(struct per_cpu_pages *pcp, unsigned long high,
-		unsigned long batch)
+		unsigned long high_max, unsigned long batch)
 {
        /* start with a fail safe value for batch */
 	pcp->batch = 1;
 	smp_wmb();
 
        /* Update high, then batch, in order */
+	pcp->high_min = high;
+	pcp->high_max = high_max;
 	pcp->high = high;
 	smp_wmb();
 
 	pcp->batch = batch;
 }
 
+/* The same for the order > 0 lists, under the same rules */
+static void pageset_update_high_order(struct per_cpu_pages *pcp,
+		unsigned long high, unsigned long batch)
+{
+	pcp->high_order_batch = 1;
+	smp_wmb();
+
+	pcp->high_order_high = high;
+	smp_wmb();
+
+	pcp->high_order_batch = batch;
+}
+
 /* a companion to pageset_set_high() */
 static void pageset_set_batch(struct per_cpu_pageset *p, unsigned long batch)
 {
-	pageset_update(&p->pcp, 6 * batch, max(1UL, 1 * batch));
+	pageset_update(&p->pcp, 6 * batch, PCP_HIGH_SCALE * 6 * batch,
+		       max(1UL, 1 * batch));
+}
+
+/*
+ * a companion to pageset_set_high_order_high(): by default the high order
+ * lists get as much room as the order-0 ones, plus a THP on top.
+ */
+static void pageset_set_high_order_batch(struct per_cpu_pageset *p,
+					 unsigned long batch)
+{
+	unsigned long high = 0;
+
+	/* The boot pagesets must not cache anything */
+	if (batch)
+		high = 6 * batch + NR_PCP_THP * pageblock_nr_pages;
+	pageset_update_high_order(&p->pcp, high, max(1UL, 1 * batch));
 }
 
 static void pageset_init(struct per_cpu_pageset *p)
 {
 	struct per_cpu_pages *pcp;
-	int migratetype;
+	int pindex;
 
 	memset(p, 0, sizeof(*p));
 
 	pcp = &p->pcp;
 	pcp->count = 0;
-	for (migratetype = 0; migratetype < MIGRATE_PCPTYPES; migratetype++)
-		INIT_LIST_HEAD(&pcp->lists[migratetype]);
+	for (pindex = 0; pindex < NR_PCP_LISTS; pindex++)
+		INIT_LIST_HEAD(&pcp->lists[pindex]);
 }
 
 static void setup_pageset(struct per_cpu_pageset *p, unsigned long batch)
 {
 	pageset_init(p);
 	pageset_set_batch(p, batch);
+	pageset_set_high_order_batch(p, batch);
 }
 
 /*
@@ -6136,7 +6383,22 @@ static void pageset_set_high(struct per_cpu_pageset *p,
 	if ((high / 4) > (PAGE_SHIFT * 8))
 		batch = PAGE_SHIFT * 8;
 
-	pageset_update(&p->pcp, high, batch);
+	/* An explicitly configured high is not adapted */
+	pageset_update(&p->pcp, high, high, batch);
+}
+
+/*
+ * pageset_set_high_order_high() sets the high water mark of the order > 0
+ * lists of the pageset p, in base pages.
+ */
+static void pageset_set_high_order_high(struct per_cpu_pageset *p,
+					unsigned long high)
+{
+	unsigned long batch = max(1UL, high / 4);
+	if ((high / 4) > (PAGE_SHIFT * 8))
+		batch = PAGE_SHIFT * 8;
+
+	pageset_update_high_order(&p->pcp, high, batch);
 }
 
 static void pageset_set_high_and_batch(struct zone *zone,
@@ -6148,6 +6410,13 @@ static void pageset_set_high_and_batch(struct zone *zone,
 				percpu_pagelist_fraction));
 	else
 		pageset_set_batch(pcp, zone_batchsize(zone));
+
+	if (percpu_pagelist_high_order_fraction)
+		pageset_set_high_order_high(pcp,
+			(zone->managed_pages /
+				percpu_pagelist_high_order_fraction));
+	else
+		pageset_set_high_order_batch(pcp, zone_batchsize(zone));
 }
 
 static void __meminit zone_pageset_init(struct zone *zone, int cpu)
@@ -7964,31 +8233,34 @@ int lowmem_reserve_ratio_sysctl_handler(struct ctl_table *table, int write,
  * percpu_pagelist_fraction - changes the pcp->high for each zone on each
  * cpu.  It is the fraction of total pages in each zone that a hot per cpu
  * pagelist can have before it gets flushed back to buddy allocator.
+ *
+ * percpu_pagelist_high_order_fraction is the same for the order > 0 pages
+ * held on the per cpu pagelists, and shares this handler.
  */
 int percpu_pagelist_fraction_sysctl_handler(struct ctl_table *table, int write,
 	void __user *buffer, size_t *length, loff_t *ppos)
 {
+	int *fraction = table->data;
 	struct zone *zone;
-	int old_percpu_pagelist_fraction;
+	int old_fraction;
 	int ret;
 
 	mutex_lock(&pcp_batch_high_lock);
-	old_percpu_pagelist_fraction = percpu_pagelist_fraction;
+	old_fraction = *fraction;
 
 	ret = proc_dointvec_minmax(table, write, buffer, length, ppos);
 	if (!write || ret < 0)
 		goto out;
 
 	/* Sanity checking to avoid pcp imbalance */
-	if (percpu_pagelist_fraction &&
-	    percpu_pagelist_fraction < MIN_PERCPU_PAGELIST_FRACTION) {
-		percpu_pagelist_fraction = old_percpu_pagelist_fraction;
+	if (*fraction && *fraction < MIN_PERCPU_PAGELIST_FRACTION) {
+		*fraction = old_fraction;
 		ret = -EINVAL;
 		goto out;
 	}
 
 	/* No change? */
-	if (percpu_pagelist_fraction == old_percpu_pagelist_fraction)
+	if (*fraction == old_fraction)
 		goto out;
 
 	for_each_populated_zone(zone) {
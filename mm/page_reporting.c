@@ -6,13 +6,26 @@
 #include <linux/export.h>
 #include <linux/delay.h>
 #include <linux/scatterlist.h>
+#include <linux/vmstat.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
 
 #include "page_reporting.h"
 #include "internal.h"
 
-#define PAGE_REPORTING_DELAY	(2 * HZ)
+#define PAGE_REPORTING_DELAY		(2 * HZ)
+#define PAGE_REPORTING_DELAY_MAX	(32 * HZ)
 static struct page_reporting_dev_info __rcu *pr_dev_info __read_mostly;
 
+/* Lowest order any zone is currently reported at */
+unsigned int page_reporting_order __read_mostly = MAX_ORDER;
+
+/* Delay between passes, adapted to the allocation rate after each pass */
+static unsigned long page_reporting_delay = PAGE_REPORTING_DELAY;
+static unsigned long page_reporting_nr_alloc;
+static unsigned long page_reporting_stamp;
+static unsigned long page_reporting_events[NR_VM_EVENT_ITEMS];
+
 enum {
 	PAGE_REPORTING_IDLE = 0,
 	PAGE_REPORTING_REQUESTED,
@@ -39,11 +52,11 @@ __page_reporting_request(struct page_reporting_dev_info *prdev)
 		return;
 
 	/*
-	 * Delay the start of work to allow a sizable queue to build. For
-	 * now we are limiting this to running no more than once every
-	 * couple of seconds.
+	 * Delay the start of work to allow a sizable queue to build. We
+	 * run no more than once every couple of seconds, and back off
+	 * further when the pages are likely to be allocated again soon.
 	 */
-	schedule_delayed_work(&prdev->work, PAGE_REPORTING_DELAY);
+	schedule_delayed_work(&prdev->work, READ_ONCE(page_reporting_delay));
 }
 
 /* notify prdev of free page reporting request */
@@ -92,8 +105,10 @@ page_reporting_drain(struct page_reporting_dev_info *prdev,
 		 * report on the new larger page when we make our way
 		 * up to that higher order.
 		 */
-		if (PageBuddy(page) && page_order(page) == order)
+		if (PageBuddy(page) && page_order(page) == order) {
 			__SetPageReported(page);
+			page_zone(page)->reported_pages += 1UL << order;
+		}
 	} while ((sg = sg_next(sg)));
 
 	/* reinitialize scatterlist now that it is empty */
@@ -219,6 +234,35 @@ page_reporting_cycle(struct page_reporting_dev_info *prdev, struct zone *zone,
 	return err;
 }
 
+/*
+ * Pick the order to report @zone at. We prefer PAGE_REPORTING_MIN_ORDER, but
+ * if less than half of the reportable free memory sits in blocks of that
+ * order or above, the zone is fragmented and waiting for the blocks to merge
+ * would keep the memory pinned on the host. Go down to the highest order that
+ * covers at least half of it instead, no lower than PAGE_REPORTING_FLOOR_ORDER.
+ *
+ * The free counts are read without the zone lock, this is only a heuristic.
+ */
+static unsigned int page_reporting_zone_order(struct zone *zone)
+{
+	unsigned long nr_free = 0, nr_high = 0;
+	unsigned int order;
+
+	for (order = PAGE_REPORTING_FLOOR_ORDER; order < MAX_ORDER; order++)
+		nr_free += READ_ONCE(zone->free_area[order].nr_free) << order;
+
+	if (!nr_free)
+		return PAGE_REPORTING_MIN_ORDER;
+
+	for (order = MAX_ORDER - 1; order > PAGE_REPORTING_FLOOR_ORDER; order--) {
+		nr_high += READ_ONCE(zone->free_area[order].nr_free) << order;
+		if (order <= PAGE_REPORTING_MIN_ORDER && nr_high * 2 >= nr_free)
+			return order;
+	}
+
+	return PAGE_REPORTING_FLOOR_ORDER;
+}
+
 static int
 page_reporting_process_zone(struct page_reporting_dev_info *prdev,
 			    struct scatterlist *sgl, struct zone *zone)
@@ -227,9 +271,11 @@ page_reporting_process_zone(struct page_reporting_dev_info *prdev,
 	unsigned long watermark;
 	int err = 0;
 
+	order = page_reporting_zone_order(zone);
+	WRITE_ONCE(zone->reporting_order, order);
+
 	/* Generate minimum watermark to be able to guarantee progress */
-	watermark = low_wmark_pages(zone) +
-		    (PAGE_REPORTING_CAPACITY << PAGE_REPORTING_MIN_ORDER);
+	watermark = low_wmark_pages(zone) + (PAGE_REPORTING_CAPACITY << order);
 
 	/*
 	 * Cancel request if insufficient free memory or if we failed
@@ -239,7 +285,7 @@ page_reporting_process_zone(struct page_reporting_dev_info *prdev,
 		return err;
 
 	/* Process each free list starting from lowest order/mt */
-	for (order = PAGE_REPORTING_MIN_ORDER; order < MAX_ORDER; order++) {
+	for (; order < MAX_ORDER; order++) {
 		for (mt = 0; mt < MIGRATE_TYPES; mt++) {
 			/* We do not pull pages from the isolate free list */
 			if (is_migrate_isolate(mt))
@@ -267,12 +313,42 @@ page_reporting_process_zone(struct page_reporting_dev_info *prdev,
 	return err;
 }
 
+/*
+ * Scale the delay between two passes with the page allocation rate. Every
+ * sixteenth of the free memory allocated per second adds another
+ * PAGE_REPORTING_DELAY, as pages reported on a busy guest are likely to be
+ * allocated and faulted back in by the host right away.
+ */
+static void page_reporting_update_delay(void)
+{
+	unsigned long nr_alloc = 0, elapsed, rate, nr_free;
+	int i;
+
+	all_vm_events(page_reporting_events);
+	for (i = 0; i < MAX_NR_ZONES; i++)
+		nr_alloc += page_reporting_events[PGALLOC_NORMAL - ZONE_NORMAL + i];
+
+	elapsed = jiffies - page_reporting_stamp;
+	if (page_reporting_stamp && elapsed) {
+		rate = (nr_alloc - page_reporting_nr_alloc) * HZ / elapsed;
+		nr_free = global_zone_page_state(NR_FREE_PAGES) / 16 + 1;
+		rate = min_t(unsigned long, rate / nr_free,
+			     PAGE_REPORTING_DELAY_MAX / PAGE_REPORTING_DELAY - 1);
+		WRITE_ONCE(page_reporting_delay,
+			   PAGE_REPORTING_DELAY * (rate + 1));
+	}
+
+	page_reporting_nr_alloc = nr_alloc;
+	page_reporting_stamp = jiffies;
+}
+
 static void page_reporting_process(struct work_struct *work)
 {
 	struct delayed_work *d_work = to_delayed_work(work);
 	struct page_reporting_dev_info *prdev =
 		container_of(d_work, struct page_reporting_dev_info, work);
 	int err = 0, state = PAGE_REPORTING_ACTIVE;
+	unsigned int order = PAGE_REPORTING_MIN_ORDER;
 	struct scatterlist *sgl;
 	struct zone *zone;
 
@@ -293,20 +369,27 @@ static void page_reporting_process(struct work_struct *work)
 
 	for_each_zone(zone) {
 		err = page_reporting_process_zone(prdev, sgl, zone);
+		order = min(order, READ_ONCE(zone->reporting_order));
 		if (err)
 			break;
 	}
 
+	/* Let frees of the lowered order kick off the next pass */
+	WRITE_ONCE(page_reporting_order, order);
+
 	kfree(sgl);
 err_out:
+	page_reporting_update_delay();
+
 	/*
 	 * If the state has reverted back to requested then there may be
-	 * additional pages to be processed. We will defer for 2s to allow
-	 * more pages to accumulate.
+	 * additional pages to be processed. We will defer for a while to
+	 * allow more pages to accumulate.
 	 */
 	state = atomic_cmpxchg(&prdev->state, state, PAGE_REPORTING_IDLE);
 	if (state == PAGE_REPORTING_REQUESTED)
-		schedule_delayed_work(&prdev->work, PAGE_REPORTING_DELAY);
+		schedule_delayed_work(&prdev->work,
+				      READ_ONCE(page_reporting_delay));
 }
 
 static DEFINE_MUTEX(page_reporting_mutex);
@@ -314,6 +397,7 @@ DEFINE_STATIC_KEY_FALSE(page_reporting_enabled);
 
 int page_reporting_register(struct page_reporting_dev_info *prdev)
 {
+	struct zone *zone;
 	int err = 0;
 
 	mutex_lock(&page_reporting_mutex);
@@ -326,6 +410,9 @@ int page_reporting_register(struct page_reporting_dev_info *prdev)
 
 	/* initialize state and work structures */
 	atomic_set(&prdev->state, PAGE_REPORTING_IDLE);
+	WRITE_ONCE(page_reporting_order, PAGE_REPORTING_MIN_ORDER);
+	for_each_zone(zone)
+		WRITE_ONCE(zone->reporting_order, PAGE_REPORTING_MIN_ORDER);
 	INIT_DELAYED_WORK(&prdev->work, &page_reporting_process);
 
 	/* Begin initial flush of zones */
@@ -362,3 +449,28 @@ void page_reporting_unregister(struct page_reporting_dev_info *prdev)
 	mutex_unlock(&page_reporting_mutex);
 }
 EXPORT_SYMBOL_GPL(page_reporting_unregister);
+
+static int page_reporting_stat_show(struct seq_file *m, void *v)
+{
+	struct zone *zone;
+
+	seq_printf(m, "delay_ms %u\n",
+		   jiffies_to_msecs(READ_ONCE(page_reporting_delay)));
+
+	for_each_populated_zone(zone)
+		seq_printf(m, "Node %d, zone %8s order %2u reported %lu refaulted %lu\n",
+			   zone_to_nid(zone), zone->name,
+			   READ_ONCE(zone->reporting_order),
+			   READ_ONCE(zone->reported_pages),
+			   READ_ONCE(zone->reported_refaults));
+
+	return 0;
+}
+
+static int __init page_reporting_stat_init(void)
+{
+	proc_create_single("pagereportinfo", 0444, NULL,
+			   page_reporting_stat_show);
+	return 0;
+}
+module_init(page_reporting_stat_init);
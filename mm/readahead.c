@@ -21,12 +21,16 @@
 #include <linux/mm_inline.h>
 #include <linux/blk-cgroup.h>
 #include <linux/fadvise.h>
+#include <linux/slab.h>
 
 #include "internal.h"
 
 /* enable context readahead default */
 int sysctl_enable_context_readahead = 1;
 
+/* enable readahead stream tracking default */
+int sysctl_enable_stream_readahead = 1;
+
 /*
  * Initialise a struct file's readahead state.  Assumes that the caller has
  * memset *ra to zero.
@@ -379,6 +383,208 @@ static int try_context_readahead(struct address_space *mapping,
 	return 1;
 }
 
+/*
+ * Readahead streams of an inode.
+ *
+ * The readahead state of a struct file follows a single sequential
+ * stream. Threads reading one file through a shared fd keep resetting it,
+ * and strided readers (columnar formats picking one column chunk out of
+ * each row group) never look sequential to it. Cache misses it can't
+ * explain are matched against a small table of streams hung off the
+ * address_space: a stream which continues where it stopped is sequential
+ * and restarts the file's readahead window, one which advanced by the
+ * same stride three times gets the next chunks along the stride read
+ * ahead, with a readahead mark in the middle to keep it going.
+ */
+#define RA_NR_STREAMS		8
+#define RA_STRIDE_MAX_WINDOWS	1024	/* longest stride, in ra windows */
+#define RA_STRIDE_MAX_DEPTH	16	/* most chunks read ahead */
+
+struct ra_stream {
+	pgoff_t		prev;		/* start of the last access */
+	pgoff_t		ahead;		/* last chunk read ahead */
+	unsigned long	stride;		/* pages between accesses, 0 if unknown */
+	unsigned long	len;		/* pages per access */
+	unsigned int	hits;		/* accesses which followed the stride */
+	unsigned long	stamp;		/* jiffies of the last access, 0 if free */
+};
+
+struct ra_streams {
+	spinlock_t	lock;
+	struct ra_stream stream[RA_NR_STREAMS];
+};
+
+enum {
+	RA_STREAM_NONE,
+	RA_STREAM_SEQ,
+	RA_STREAM_STRIDE,
+};
+
+/* Chunks a strided stream reads ahead: @len pages every @stride from @from */
+struct ra_stride {
+	pgoff_t		from;
+	pgoff_t		to;
+	pgoff_t		mark;
+	unsigned long	stride;
+	unsigned long	len;
+};
+
+static struct ra_streams *ra_streams_get(struct address_space *mapping)
+{
+	struct ra_streams *rs = READ_ONCE(mapping->ra_streams);
+
+	if (rs)
+		return rs;
+
+	/* Freed with the inode, see __destroy_inode() */
+	if (!mapping->host || mapping != &mapping->host->i_data)
+		return NULL;
+
+	rs = kzalloc(sizeof(*rs), GFP_NOWAIT | __GFP_NOWARN);
+	if (!rs)
+		return NULL;
+	spin_lock_init(&rs->lock);
+
+	if (cmpxchg(&mapping->ra_streams, NULL, rs)) {
+		kfree(rs);
+		rs = READ_ONCE(mapping->ra_streams);
+	}
+	return rs;
+}
+
+void ra_streams_free(struct address_space *mapping)
+{
+	kfree(mapping->ra_streams);
+	mapping->ra_streams = NULL;
+}
+
+/*
+ * Account an access of @req_size pages at @offset to the stream of
+ * @mapping it continues, or start a new stream with it. Fills @rst with
+ * what is left to read ahead of a strided stream.
+ */
+static int ra_stream_update(struct address_space *mapping,
+			    bool hit_readahead_marker, pgoff_t offset,
+			    unsigned long req_size, unsigned long max_pages,
+			    struct ra_stride *rst)
+{
+	unsigned long max_stride = max_pages * RA_STRIDE_MAX_WINDOWS;
+	struct ra_stream *s, *match = NULL, *near = NULL, *victim;
+	unsigned long dist, near_dist = ULONG_MAX;
+	unsigned long depth;
+	struct ra_streams *rs;
+	int ret = RA_STREAM_NONE;
+	int i;
+
+	/* A mark can only be one of ours if there is a table already */
+	if (hit_readahead_marker)
+		rs = READ_ONCE(mapping->ra_streams);
+	else
+		rs = ra_streams_get(mapping);
+	if (!rs)
+		return RA_STREAM_NONE;
+
+	spin_lock(&rs->lock);
+	victim = &rs->stream[0];
+	for (i = 0; i < RA_NR_STREAMS; i++) {
+		s = &rs->stream[i];
+		if (!s->stamp) {
+			victim = s;
+			continue;
+		}
+		if (victim->stamp && time_before(s->stamp, victim->stamp))
+			victim = s;
+		if (offset < s->prev)
+			continue;
+		dist = offset - s->prev;
+
+		if (hit_readahead_marker) {
+			/* Our own mark, on one of the chunks read ahead */
+			if (s->stride > s->len && offset <= s->ahead &&
+			    !(dist % s->stride)) {
+				match = s;
+				break;
+			}
+			continue;
+		}
+
+		if (dist <= s->len || (s->stride && dist == s->stride)) {
+			match = s;
+			break;
+		}
+		if (!s->stride && dist <= max_stride && dist < near_dist) {
+			near = s;
+			near_dist = dist;
+		}
+	}
+
+	if (match) {
+		s = match;
+		if (!hit_readahead_marker && offset - s->prev <= s->len) {
+			ret = RA_STREAM_SEQ;
+			s->stride = 0;
+			s->hits = 0;
+		} else {
+			s->hits++;
+		}
+	} else if (near && !hit_readahead_marker) {
+		/* Second access of a stream, guess its stride */
+		s = near;
+		s->stride = near_dist;
+		s->hits = 1;
+	} else if (!hit_readahead_marker) {
+		s = victim;
+		s->stride = 0;
+		s->hits = 0;
+		s->ahead = offset;
+	} else {
+		goto out;
+	}
+	s->ahead = max(s->ahead, offset);
+	s->prev = offset;
+	s->len = max(req_size, 1UL);
+	s->stamp = jiffies ?: 1;
+
+	if (ret == RA_STREAM_NONE && s->hits >= 2 && s->stride > s->len) {
+		depth = clamp(max_pages / s->len, 2UL,
+			      (unsigned long)RA_STRIDE_MAX_DEPTH);
+		rst->from = s->ahead + s->stride;
+		rst->to = offset + depth * s->stride;
+		if (rst->from <= rst->to) {
+			rst->stride = s->stride;
+			rst->len = s->len;
+			rst->mark = rst->from +
+				(rst->to - rst->from) / s->stride / 2 *
+				s->stride;
+			s->ahead = rst->to;
+			ret = RA_STREAM_STRIDE;
+		}
+	}
+out:
+	spin_unlock(&rs->lock);
+	return ret;
+}
+
+static unsigned long ra_stride_submit(struct address_space *mapping,
+				      struct file *filp, struct ra_stride *rst)
+{
+	loff_t isize = i_size_read(mapping->host);
+	unsigned long nr_pages = 0;
+	pgoff_t index;
+
+	if (!isize)
+		return 0;
+
+	for (index = rst->from; index <= rst->to; index += rst->stride) {
+		if (index > (isize - 1) >> PAGE_SHIFT)
+			break;
+		nr_pages += __do_page_cache_readahead(mapping, filp, index,
+				rst->len, index == rst->mark ? rst->len : 0);
+	}
+	count_vm_events(READAHEAD_STRIDE, nr_pages);
+	return nr_pages;
+}
+
 /*
  * A minimal readahead algorithm for trivial sequential/random reads.
  */
@@ -391,6 +597,7 @@ ondemand_readahead(struct address_space *mapping,
 	struct backing_dev_info *bdi = inode_to_bdi(mapping->host);
 	unsigned long max_pages = ra->ra_pages;
 	unsigned long add_pages;
+	struct ra_stride rst;
 	pgoff_t prev_offset;
 
 	/*
@@ -418,6 +625,24 @@ ondemand_readahead(struct address_space *mapping,
 		goto readit;
 	}
 
+	/*
+	 * Not the stream the file state follows, maybe another one of the
+	 * inode's.
+	 */
+	if (sysctl_enable_stream_readahead) {
+		switch (ra_stream_update(mapping, hit_readahead_marker, offset,
+					 req_size, max_pages, &rst)) {
+		case RA_STREAM_SEQ:
+			goto initial_readahead;
+		case RA_STREAM_STRIDE:
+			/* The chunk at @offset itself is read as is */
+			if (!hit_readahead_marker)
+				__do_page_cache_readahead(mapping, filp, offset,
+							  req_size, 0);
+			return ra_stride_submit(mapping, filp, &rst);
+		}
+	}
+
 	/*
 	 * Hit a marked page without valid readahead state.
 	 * E.g. interleaved reads.
@@ -524,6 +749,8 @@ void page_cache_sync_readahead(struct address_space *mapping,
 	if (blk_cgroup_congested())
 		return;
 
+	count_vm_event(READAHEAD_MISS);
+
 	/* be dumb */
 	if (filp && (filp->f_mode & FMODE_RANDOM)) {
 		force_page_cache_readahead(mapping, filp, offset, req_size);
@@ -567,6 +794,7 @@ page_cache_async_readahead(struct address_space *mapping,
 		return;
 
 	ClearPageReadahead(page);
+	count_vm_event(READAHEAD_HIT);
 
 	/*
 	 * Defer asynchronous read-ahead on IO congestion.
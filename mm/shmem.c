@@ -576,10 +576,21 @@ static unsigned long shmem_unused_huge_shrink(struct shmem_sb_info *sbinfo,
 }
 #endif /* CONFIG_TRANSPARENT_HUGE_PAGECACHE */
 
-static inline bool is_huge_enabled(struct shmem_sb_info *sbinfo)
+/*
+ * The huge= policy of an inode: its own if set by F_SET_SHMEM_HUGE, kept
+ * as the SHMEM_HUGE_* value plus one, else that of its mount.
+ */
+static inline int shmem_inode_huge(struct inode *inode)
+{
+	unsigned char huge = READ_ONCE(SHMEM_I(inode)->huge);
+
+	return huge ? huge - 1 : SHMEM_SB(inode->i_sb)->huge;
+}
+
+static inline bool is_huge_enabled(struct inode *inode)
 {
 	if (IS_ENABLED(CONFIG_TRANSPARENT_HUGE_PAGECACHE) &&
-	    (shmem_huge == SHMEM_HUGE_FORCE || sbinfo->huge) &&
+	    (shmem_huge == SHMEM_HUGE_FORCE || shmem_inode_huge(inode)) &&
 	    shmem_huge != SHMEM_HUGE_DENY)
 		return true;
 	return false;
@@ -646,7 +657,7 @@ static int shmem_add_to_page_cache(struct page *page,
 	if (!error) {
 		mapping->nrpages += nr;
 		if (PageTransHuge(page))
-			__inc_node_page_state(page, NR_SHMEM_THPS);
+			__inc_lruvec_page_state(page, NR_SHMEM_THPS);
 		__mod_lruvec_page_state(page, NR_FILE_PAGES, nr);
 		__mod_lruvec_page_state(page, NR_SHMEM, nr);
 		xa_unlock_irq(&mapping->i_pages);
@@ -1013,7 +1024,6 @@ static int shmem_getattr(const struct path *path, struct kstat *stat,
 {
 	struct inode *inode = path->dentry->d_inode;
 	struct shmem_inode_info *info = SHMEM_I(inode);
-	struct shmem_sb_info *sb_info = SHMEM_SB(inode->i_sb);
 
 	if (info->alloced - info->swapped != inode->i_mapping->nrpages) {
 		spin_lock_irq(&info->lock);
@@ -1022,7 +1032,7 @@ static int shmem_getattr(const struct path *path, struct kstat *stat,
 	}
 	generic_fillattr(inode, stat);
 
-	if (is_huge_enabled(sb_info))
+	if (is_huge_enabled(inode))
 		stat->blksize = HPAGE_PMD_SIZE;
 
 	return 0;
@@ -1785,7 +1795,7 @@ static int shmem_getpage_gfp(struct inode *inode, pgoff_t index,
 			goto alloc_nohuge;
 		if (shmem_huge == SHMEM_HUGE_FORCE)
 			goto alloc_huge;
-		switch (sbinfo->huge) {
+		switch (shmem_inode_huge(inode)) {
 			loff_t i_size;
 			pgoff_t off;
 		case SHMEM_HUGE_NEVER:
@@ -2086,11 +2096,11 @@ unsigned long shmem_get_unmapped_area(struct file *file,
 		return addr;
 
 	if (shmem_huge != SHMEM_HUGE_FORCE) {
-		struct super_block *sb;
+		int huge;
 
 		if (file) {
 			VM_BUG_ON(file->f_op != &shmem_file_operations);
-			sb = file_inode(file)->i_sb;
+			huge = shmem_inode_huge(file_inode(file));
 		} else {
 			/*
 			 * Called directly from mm/mmap.c, or drivers/char/mem.c
@@ -2098,9 +2108,9 @@ unsigned long shmem_get_unmapped_area(struct file *file,
 			 */
 			if (IS_ERR(shm_mnt))
 				return addr;
-			sb = shm_mnt->mnt_sb;
+			huge = SHMEM_SB(shm_mnt->mnt_sb)->huge;
 		}
-		if (SHMEM_SB(sb)->huge == SHMEM_HUGE_NEVER)
+		if (huge == SHMEM_HUGE_NEVER)
 			return addr;
 	}
 
@@ -3832,11 +3842,70 @@ struct kobj_attribute shmem_enabled_attr =
 	__ATTR(shmem_enabled, 0644, shmem_enabled_show, shmem_enabled_store);
 #endif /* CONFIG_TRANSPARENT_HUGE_PAGECACHE && CONFIG_SYSFS */
 
+/*
+ * Per-file placement for large tmpfs files, e.g. POSIX shm segments,
+ * that would otherwise get the policies of their mount: F_SET_SHMEM_HUGE
+ * overrides huge= and F_SET_SHMEM_INTERLEAVE spreads the pages over the
+ * memory nodes the caller may use.  Both apply to pages allocated later.
+ */
+long shmem_fcntl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	struct inode *inode = file_inode(file);
+	struct shmem_inode_info *info = SHMEM_I(inode);
+	long error = 0;
+
+	BUILD_BUG_ON(F_SHMEM_HUGE_NEVER != SHMEM_HUGE_NEVER + 1 ||
+		     F_SHMEM_HUGE_ALWAYS != SHMEM_HUGE_ALWAYS + 1 ||
+		     F_SHMEM_HUGE_WITHIN_SIZE != SHMEM_HUGE_WITHIN_SIZE + 1 ||
+		     F_SHMEM_HUGE_ADVISE != SHMEM_HUGE_ADVISE + 1);
+
+	if (file->f_op != &shmem_file_operations)
+		return -EINVAL;
+
+	switch (cmd) {
+	case F_GET_SHMEM_HUGE:
+		error = READ_ONCE(info->huge);
+		break;
+	case F_SET_SHMEM_HUGE:
+		if (!(file->f_mode & FMODE_WRITE))
+			return -EBADF;
+		if (arg > F_SHMEM_HUGE_ADVISE)
+			return -EINVAL;
+		if (arg != F_SHMEM_HUGE_MOUNT && arg != F_SHMEM_HUGE_NEVER &&
+		    !IS_ENABLED(CONFIG_TRANSPARENT_HUGE_PAGECACHE))
+			return -EINVAL;
+		inode_lock(inode);
+		WRITE_ONCE(info->huge, arg);
+		inode_unlock(inode);
+		break;
+	case F_SET_SHMEM_INTERLEAVE:
+		if (!(file->f_mode & FMODE_WRITE))
+			return -EBADF;
+		if (arg > 1)
+			return -EINVAL;
+		if (arg) {
+			nodemask_t nodes = node_states[N_MEMORY];
+
+			error = mpol_shared_policy_set_all(&info->policy,
+							   MPOL_INTERLEAVE,
+							   &nodes);
+		} else {
+			error = mpol_shared_policy_set_all(&info->policy,
+							   MPOL_DEFAULT, NULL);
+		}
+		break;
+	default:
+		error = -EINVAL;
+		break;
+	}
+
+	return error;
+}
+
 #ifdef CONFIG_TRANSPARENT_HUGE_PAGECACHE
 bool shmem_huge_enabled(struct vm_area_struct *vma)
 {
 	struct inode *inode = file_inode(vma->vm_file);
-	struct shmem_sb_info *sbinfo = SHMEM_SB(inode->i_sb);
 	loff_t i_size;
 	pgoff_t off;
 
@@ -3846,7 +3915,7 @@ bool shmem_huge_enabled(struct vm_area_struct *vma)
 		return true;
 	if (shmem_huge == SHMEM_HUGE_DENY)
 		return false;
-	switch (sbinfo->huge) {
+	switch (shmem_inode_huge(inode)) {
 		case SHMEM_HUGE_NEVER:
 			return false;
 		case SHMEM_HUGE_ALWAYS:
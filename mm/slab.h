@@ -146,7 +146,7 @@ static inline slab_flags_t kmem_cache_flags(unsigned int object_size,
 			  SLAB_ACCOUNT)
 #elif defined(CONFIG_SLUB)
 #define SLAB_CACHE_FLAGS (SLAB_NOLEAKTRACE | SLAB_RECLAIM_ACCOUNT | \
-			  SLAB_TEMPORARY | SLAB_ACCOUNT)
+			  SLAB_TEMPORARY | SLAB_ACCOUNT | SLAB_SHEAVES)
 #else
 #define SLAB_CACHE_FLAGS (0)
 #endif
@@ -165,7 +165,8 @@ static inline slab_flags_t kmem_cache_flags(unsigned int object_size,
 			      SLAB_NOLEAKTRACE | \
 			      SLAB_RECLAIM_ACCOUNT | \
 			      SLAB_TEMPORARY | \
-			      SLAB_ACCOUNT)
+			      SLAB_ACCOUNT | \
+			      SLAB_SHEAVES)
 
 bool __kmem_cache_empty(struct kmem_cache *);
 int __kmem_cache_shutdown(struct kmem_cache *);
@@ -292,6 +293,131 @@ static __always_inline void memcg_uncharge_slab(struct page *page, int order,
 	memcg_kmem_uncharge(page, order);
 }
 
+/*
+ * Accounted objects are charged together with their slot in the
+ * page's obj_cgroup vector.
+ */
+static inline size_t obj_full_size(struct kmem_cache *s)
+{
+	return s->size + sizeof(struct obj_cgroup *);
+}
+
+static inline struct obj_cgroup *memcg_slab_pre_alloc_hook(struct kmem_cache *s,
+							    size_t objects,
+							    gfp_t flags,
+							    bool *failed)
+{
+	struct obj_cgroup *objcg;
+
+	objcg = get_obj_cgroup_from_current();
+	if (!objcg)
+		return NULL;
+
+	if (obj_cgroup_charge(objcg, flags, objects * obj_full_size(s))) {
+		obj_cgroup_put(objcg);
+		*failed = true;
+		return NULL;
+	}
+
+	return objcg;
+}
+
+/* Don't let the vector allocation inherit the object's placement flags */
+#define OBJCGS_CLEAR_MASK	(__GFP_DMA | __GFP_RECLAIMABLE | __GFP_ACCOUNT)
+
+static inline void memcg_slab_post_alloc_hook(struct kmem_cache *s,
+					      struct obj_cgroup *objcg,
+					      gfp_t flags, size_t size,
+					      void **p)
+{
+	bool reclaimable = s->flags & SLAB_RECLAIM_ACCOUNT;
+	struct page *page;
+	unsigned int off;
+	size_t i;
+
+	if (!objcg)
+		return;
+
+	flags &= ~OBJCGS_CLEAR_MASK;
+	for (i = 0; i < size; i++) {
+		if (likely(p[i])) {
+			page = virt_to_head_page(p[i]);
+
+			if (!page_has_obj_cgroups(page) &&
+			    memcg_alloc_page_obj_cgroups(page, s, flags)) {
+				obj_cgroup_uncharge(objcg, obj_full_size(s));
+				continue;
+			}
+
+			off = obj_to_index(s, page, p[i]);
+			obj_cgroup_get(objcg);
+			page_obj_cgroups(page)[off] = objcg;
+			mod_objcg_slab_state(objcg, reclaimable,
+					     obj_full_size(s));
+		} else {
+			obj_cgroup_uncharge(objcg, obj_full_size(s));
+		}
+	}
+	obj_cgroup_put(objcg);
+}
+
+/* Return the charge of bulk slots that were never filled */
+static inline void memcg_slab_alloc_abort(struct kmem_cache *s,
+					  struct obj_cgroup *objcg,
+					  size_t objects)
+{
+	if (objcg && objects)
+		obj_cgroup_uncharge(objcg, objects * obj_full_size(s));
+}
+
+static inline void memcg_slab_free_hook(struct kmem_cache *s_orig,
+					void **p, int objects)
+{
+	struct kmem_cache *s;
+	struct obj_cgroup *objcg;
+	struct page *page;
+	unsigned int off;
+	int i;
+
+	if (!memcg_kmem_enabled())
+		return;
+
+	for (i = 0; i < objects; i++) {
+		if (unlikely(!p[i]))
+			continue;
+
+		page = virt_to_head_page(p[i]);
+		if (!page_has_obj_cgroups(page))
+			continue;
+
+		if (!s_orig)
+			s = page->slab_cache;
+		else
+			s = s_orig;
+
+		off = obj_to_index(s, page, p[i]);
+		objcg = page_obj_cgroups(page)[off];
+		if (!objcg)
+			continue;
+
+		page_obj_cgroups(page)[off] = NULL;
+		obj_cgroup_uncharge(objcg, obj_full_size(s));
+		mod_objcg_slab_state(objcg, s->flags & SLAB_RECLAIM_ACCOUNT,
+				     -obj_full_size(s));
+		obj_cgroup_put(objcg);
+	}
+}
+
+/* Called before the slab page goes back, ahead of any page->mem_cgroup use */
+static inline void memcg_free_page_obj_cgroups(struct page *page)
+{
+	if (!page_has_obj_cgroups(page))
+		return;
+
+	kfree(page_obj_cgroups(page));
+	page->obj_cgroups = NULL;
+}
+
 extern void slab_init_memcg_params(struct kmem_cache *);
 extern void memcg_link_cache(struct kmem_cache *s);
 extern void slab_deactivate_memcg_cache_rcu_sched(struct kmem_cache *s,
@@ -344,6 +470,36 @@ static inline void memcg_uncharge_slab(struct page *page, int order,
 {
 }
 
+static inline struct obj_cgroup *memcg_slab_pre_alloc_hook(struct kmem_cache *s,
+							    size_t objects,
+							    gfp_t flags,
+							    bool *failed)
+{
+	return NULL;
+}
+
+static inline void memcg_slab_post_alloc_hook(struct kmem_cache *s,
+					      struct obj_cgroup *objcg,
+					      gfp_t flags, size_t size,
+					      void **p)
+{
+}
+
+static inline void memcg_slab_alloc_abort(struct kmem_cache *s,
+					  struct obj_cgroup *objcg,
+					  size_t objects)
+{
+}
+
+static inline void memcg_slab_free_hook(struct kmem_cache *s,
+					void **p, int objects)
+{
+}
+
+static inline void memcg_free_page_obj_cgroups(struct page *page)
+{
+}
+
 static inline void slab_init_memcg_params(struct kmem_cache *s)
 {
 }
@@ -411,9 +567,17 @@ static inline size_t slab_ksize(const struct kmem_cache *s)
 #endif
 }
 
+/*
+ * Accounted allocations are charged per object to the current task's
+ * obj_cgroup and served from the shared root cache, so no per-memcg
+ * cache is created any more.
+ */
 static inline struct kmem_cache *slab_pre_alloc_hook(struct kmem_cache *s,
-						     gfp_t flags)
+						     struct obj_cgroup **objcgp,
+						     size_t size, gfp_t flags)
 {
+	bool failed = false;
+
 	flags &= gfp_allowed_mask;
 
 	fs_reclaim_acquire(flags);
@@ -424,14 +588,19 @@ static inline struct kmem_cache *slab_pre_alloc_hook(struct kmem_cache *s,
 	if (should_failslab(s, flags))
 		return NULL;
 
+	*objcgp = NULL;
 	if (memcg_kmem_enabled() &&
-	    ((flags & __GFP_ACCOUNT) || (s->flags & SLAB_ACCOUNT)))
-		return memcg_kmem_get_cache(s);
+	    ((flags & __GFP_ACCOUNT) || (s->flags & SLAB_ACCOUNT))) {
+		*objcgp = memcg_slab_pre_alloc_hook(s, size, flags, &failed);
+		if (failed)
+			return NULL;
+	}
 
 	return s;
 }
 
-static inline void slab_post_alloc_hook(struct kmem_cache *s, gfp_t flags,
+static inline void slab_post_alloc_hook(struct kmem_cache *s,
+					struct obj_cgroup *objcg, gfp_t flags,
 					size_t size, void **p)
 {
 	size_t i;
@@ -445,11 +614,24 @@ static inline void slab_post_alloc_hook(struct kmem_cache *s, gfp_t flags,
 		kasan_slab_alloc(s, object, flags);
 	}
 
-	if (memcg_kmem_enabled())
-		memcg_kmem_put_cache(s);
+	memcg_slab_post_alloc_hook(s, objcg, flags, size, p);
 }
 
 #ifndef CONFIG_SLOB
+#ifdef CONFIG_SLUB_SHEAVES
+/*
+ * Per-node store of full and empty sheaves, so that a cpu running out
+ * of objects can take over the ones freed by another cpu of the node.
+ */
+struct node_barn {
+	spinlock_t lock;
+	struct list_head sheaves_full;
+	struct list_head sheaves_empty;
+	unsigned int nr_full;
+	unsigned int nr_empty;
+};
+#endif
+
 /*
  * The slab lists for all objects.
  */
@@ -479,6 +661,9 @@ struct kmem_cache_node {
 	atomic_long_t total_objects;
 	struct list_head full;
 #endif
+#ifdef CONFIG_SLUB_SHEAVES
+	struct node_barn barn;
+#endif
 #endif
 
 };
@@ -236,6 +236,43 @@ static inline void stat(const struct kmem_cache *s, enum stat_item si)
 #endif
 }
 
+#ifdef CONFIG_SLUB_SHEAVES
+static inline bool slub_has_sheaves(struct kmem_cache *s)
+{
+	return s->cpu_sheaves;
+}
+
+static void *alloc_from_pcs(struct kmem_cache *s, gfp_t gfp);
+static bool free_to_pcs(struct kmem_cache *s, struct page *page, void *object);
+static bool pcs_has_objects(struct kmem_cache *s, int cpu);
+static void pcs_flush_cpu(struct kmem_cache *s, int cpu);
+#else
+static inline bool slub_has_sheaves(struct kmem_cache *s)
+{
+	return false;
+}
+
+static inline void *alloc_from_pcs(struct kmem_cache *s, gfp_t gfp)
+{
+	return NULL;
+}
+
+static inline bool free_to_pcs(struct kmem_cache *s, struct page *page,
+			       void *object)
+{
+	return false;
+}
+
+static inline bool pcs_has_objects(struct kmem_cache *s, int cpu)
+{
+	return false;
+}
+
+static inline void pcs_flush_cpu(struct kmem_cache *s, int cpu)
+{
+}
+#endif
+
 /********************************************************************
  * 			Core slab cache functions
  *******************************************************************/
@@ -1688,6 +1725,7 @@ static void __free_slab(struct kmem_cache *s, struct page *page)
 			check_object(s, page, p, SLUB_RED_INACTIVE);
 	}
 
+	memcg_free_page_obj_cgroups(page);
 	mod_lruvec_page_state(page,
 		(s->flags & SLAB_RECLAIM_ACCOUNT) ?
 		NR_SLAB_RECLAIMABLE : NR_SLAB_UNRECLAIMABLE,
@@ -2314,6 +2352,8 @@ static void flush_cpu_slab(void *d)
 {
 	struct kmem_cache *s = d;
 
+	/* sheaves first, their objects may land in the cpu slab */
+	pcs_flush_cpu(s, smp_processor_id());
 	__flush_cpu_slab(s, smp_processor_id());
 }
 
@@ -2322,7 +2362,7 @@ static bool has_cpu_slab(int cpu, void *info)
 	struct kmem_cache *s = info;
 	struct kmem_cache_cpu *c = per_cpu_ptr(s->cpu_slab, cpu);
 
-	return c->page || slub_percpu_partial(c);
+	return c->page || slub_percpu_partial(c) || pcs_has_objects(s, cpu);
 }
 
 static void flush_all(struct kmem_cache *s)
@@ -2342,6 +2382,7 @@ static int slub_cpu_dead(unsigned int cpu)
 	mutex_lock(&slab_mutex);
 	list_for_each_entry(s, &slab_caches, list) {
 		local_irq_save(flags);
+		pcs_flush_cpu(s, cpu);
 		__flush_cpu_slab(s, cpu);
 		local_irq_restore(flags);
 	}
@@ -2655,10 +2696,18 @@ static __always_inline void *slab_alloc_node(struct kmem_cache *s,
 	struct kmem_cache_cpu *c;
 	struct page *page;
 	unsigned long tid;
+	struct obj_cgroup *objcg;
 
-	s = slab_pre_alloc_hook(s, gfpflags);
+	s = slab_pre_alloc_hook(s, &objcg, 1, gfpflags);
 	if (!s)
 		return NULL;
+
+	if (slub_has_sheaves(s) &&
+	    (node == NUMA_NO_NODE || node == numa_mem_id())) {
+		object = alloc_from_pcs(s, gfpflags);
+		if (object)
+			goto out;
+	}
 redo:
 	/*
 	 * Must read kmem_cache cpu data via this cpu ptr. Preemption is
@@ -2727,10 +2776,11 @@ static __always_inline void *slab_alloc_node(struct kmem_cache *s,
 		stat(s, ALLOC_FASTPATH);
 	}
 
+out:
 	if (unlikely(gfpflags & __GFP_ZERO) && object)
 		memset(object, 0, s->object_size);
 
-	slab_post_alloc_hook(s, gfpflags, 1, &object);
+	slab_post_alloc_hook(s, objcg, gfpflags, 1, &object);
 
 	return object;
 }
@@ -2977,8 +3027,12 @@ static __always_inline void slab_free(struct kmem_cache *s, struct page *page,
 	 * With KASAN enabled slab_free_freelist_hook modifies the freelist
 	 * to remove objects, whose reuse must be delayed.
 	 */
-	if (slab_free_freelist_hook(s, &head, &tail))
+	if (slab_free_freelist_hook(s, &head, &tail)) {
+		if (cnt == 1 && !tail && slub_has_sheaves(s) &&
+		    free_to_pcs(s, page, head))
+			return;
 		do_slab_free(s, page, head, tail, cnt, addr);
+	}
 }
 
 #ifdef CONFIG_KASAN
@@ -2993,6 +3047,7 @@ void kmem_cache_free(struct kmem_cache *s, void *x)
 	s = cache_from_obj(s, x);
 	if (!s)
 		return;
+	memcg_slab_free_hook(s, &x, 1);
 	slab_free(s, virt_to_head_page(x), x, NULL, 1, _RET_IP_);
 	trace_kmem_cache_free(_RET_IP_, x);
 }
@@ -3089,12 +3144,479 @@ int build_detached_freelist(struct kmem_cache *s, size_t size,
 	return first_skipped_index;
 }
 
+#ifdef CONFIG_SLUB_SHEAVES
+/*
+ * Sheaves are per-cpu arrays of free objects in front of the cpu slab.
+ * Each cpu has a main sheaf that allocations and frees operate on and an
+ * optional spare one. When both are exhausted (or full), the cpu swaps
+ * a sheaf with the barn of its node, so objects freed on one cpu are
+ * reused by another cpu of the same node without going through the
+ * slab freelists. Only objects of the local node enter the sheaves.
+ *
+ * The per-cpu sheaves are protected by disabling interrupts, the barn
+ * by its own lock.
+ */
+struct slab_sheaf {
+	struct list_head barn_list;
+	unsigned int size;
+	void *objects[];
+};
+
+#define MAX_FULL_SHEAVES	10
+#define MAX_EMPTY_SHEAVES	10
+
+static struct slab_sheaf *alloc_empty_sheaf(struct kmem_cache *s, gfp_t gfp)
+{
+	struct slab_sheaf *sheaf;
+
+	sheaf = kmalloc(struct_size(sheaf, objects, s->sheaf_capacity), gfp);
+	if (sheaf) {
+		INIT_LIST_HEAD(&sheaf->barn_list);
+		sheaf->size = 0;
+	}
+	return sheaf;
+}
+
+static inline struct node_barn *get_barn(struct kmem_cache *s)
+{
+	return &get_node(s, numa_mem_id())->barn;
+}
+
+static void barn_init(struct node_barn *barn)
+{
+	spin_lock_init(&barn->lock);
+	INIT_LIST_HEAD(&barn->sheaves_full);
+	INIT_LIST_HEAD(&barn->sheaves_empty);
+	barn->nr_full = 0;
+	barn->nr_empty = 0;
+}
+
+static struct slab_sheaf *barn_get_full_sheaf(struct node_barn *barn)
+{
+	struct slab_sheaf *sheaf = NULL;
+
+	if (!READ_ONCE(barn->nr_full))
+		return NULL;
+
+	spin_lock(&barn->lock);
+	if (barn->nr_full) {
+		sheaf = list_first_entry(&barn->sheaves_full,
+					 struct slab_sheaf, barn_list);
+		list_del(&sheaf->barn_list);
+		barn->nr_full--;
+	}
+	spin_unlock(&barn->lock);
+
+	return sheaf;
+}
+
+static bool barn_put_full_sheaf(struct node_barn *barn,
+				struct slab_sheaf *sheaf)
+{
+	bool ret = false;
+
+	spin_lock(&barn->lock);
+	if (barn->nr_full < MAX_FULL_SHEAVES) {
+		list_add(&sheaf->barn_list, &barn->sheaves_full);
+		barn->nr_full++;
+		ret = true;
+	}
+	spin_unlock(&barn->lock);
+
+	return ret;
+}
+
+static struct slab_sheaf *barn_get_empty_sheaf(struct node_barn *barn)
+{
+	struct slab_sheaf *sheaf = NULL;
+
+	if (!READ_ONCE(barn->nr_empty))
+		return NULL;
+
+	spin_lock(&barn->lock);
+	if (barn->nr_empty) {
+		sheaf = list_first_entry(&barn->sheaves_empty,
+					 struct slab_sheaf, barn_list);
+		list_del(&sheaf->barn_list);
+		barn->nr_empty--;
+	}
+	spin_unlock(&barn->lock);
+
+	return sheaf;
+}
+
+static void barn_put_empty_sheaf(struct node_barn *barn,
+				 struct slab_sheaf *sheaf)
+{
+	spin_lock(&barn->lock);
+	if (barn->nr_empty < MAX_EMPTY_SHEAVES) {
+		list_add(&sheaf->barn_list, &barn->sheaves_empty);
+		barn->nr_empty++;
+		sheaf = NULL;
+	}
+	spin_unlock(&barn->lock);
+
+	kfree(sheaf);
+}
+
+/*
+ * Return the objects of @sheaf to their slabs. The slab free hooks have
+ * already run when the objects entered the sheaf.
+ */
+static void sheaf_flush(struct kmem_cache *s, struct slab_sheaf *sheaf)
+{
+	size_t size = sheaf->size;
+
+	if (!size)
+		return;
+
+	while (size) {
+		struct detached_freelist df;
+
+		size = build_detached_freelist(s, size, sheaf->objects, &df);
+		if (!df.page)
+			continue;
+
+		do_slab_free(df.s, df.page, df.freelist, df.tail, df.cnt,
+			     _RET_IP_);
+	}
+	sheaf->size = 0;
+	stat(s, SHEAF_FLUSH);
+}
+
+/*
+ * Fill @sheaf from the cpu slab and the partial lists. Called with
+ * interrupts disabled, so the page allocator must not be allowed to
+ * block and enable them.
+ */
+static bool refill_sheaf(struct kmem_cache *s, struct slab_sheaf *sheaf,
+			 gfp_t gfp)
+{
+	struct kmem_cache_cpu *c = this_cpu_ptr(s->cpu_slab);
+
+	gfp &= ~(__GFP_DIRECT_RECLAIM | __GFP_ZERO);
+	gfp |= __GFP_NOWARN;
+
+	while (sheaf->size < s->sheaf_capacity) {
+		void *object = c->freelist;
+
+		if (unlikely(!object)) {
+			object = ___slab_alloc(s, gfp, NUMA_NO_NODE,
+					       _RET_IP_, c);
+			if (unlikely(!object))
+				break;
+
+			c = this_cpu_ptr(s->cpu_slab);
+		} else {
+			c->freelist = get_freepointer(s, object);
+		}
+		sheaf->objects[sheaf->size++] = object;
+	}
+	c->tid = next_tid(c->tid);
+
+	stat(s, SHEAF_REFILL);
+	return sheaf->size;
+}
+
+/*
+ * Replace the empty main sheaf by the spare, a full sheaf from the barn
+ * or, failing that, refill it. Called with interrupts disabled.
+ */
+static bool __pcs_replace_empty_main(struct kmem_cache *s,
+				     struct slub_percpu_sheaves *pcs, gfp_t gfp)
+{
+	struct node_barn *barn = get_barn(s);
+	struct slab_sheaf *full;
+
+	if (pcs->spare && pcs->spare->size) {
+		swap(pcs->main, pcs->spare);
+		return true;
+	}
+
+	full = barn_get_full_sheaf(barn);
+	if (full) {
+		if (!pcs->spare)
+			pcs->spare = pcs->main;
+		else
+			barn_put_empty_sheaf(barn, pcs->main);
+		pcs->main = full;
+		stat(s, BARN_GET);
+		return true;
+	}
+
+	return refill_sheaf(s, pcs->main, gfp);
+}
+
+/*
+ * Make room in the full main sheaf: swap in the spare or an empty sheaf
+ * and store the full one in the barn. When the barn is stocked enough,
+ * flush the main sheaf back to the slabs instead. Called with interrupts
+ * disabled.
+ */
+static void __pcs_replace_full_main(struct kmem_cache *s,
+				    struct slub_percpu_sheaves *pcs)
+{
+	struct node_barn *barn = get_barn(s);
+	struct slab_sheaf *empty;
+
+	if (pcs->spare && pcs->spare->size < s->sheaf_capacity) {
+		swap(pcs->main, pcs->spare);
+		return;
+	}
+
+	empty = barn_get_empty_sheaf(barn);
+	if (!empty)
+		empty = alloc_empty_sheaf(s, GFP_NOWAIT | __GFP_NOWARN);
+	if (empty) {
+		if (barn_put_full_sheaf(barn, pcs->main)) {
+			pcs->main = empty;
+			stat(s, BARN_PUT);
+			return;
+		}
+		barn_put_empty_sheaf(barn, empty);
+	}
+
+	sheaf_flush(s, pcs->main);
+}
+
+static void *alloc_from_pcs(struct kmem_cache *s, gfp_t gfp)
+{
+	struct slub_percpu_sheaves *pcs;
+	unsigned long flags;
+	void *object = NULL;
+
+	local_irq_save(flags);
+	pcs = this_cpu_ptr(s->cpu_sheaves);
+	if (likely(pcs->main->size) || __pcs_replace_empty_main(s, pcs, gfp))
+		object = pcs->main->objects[--pcs->main->size];
+	local_irq_restore(flags);
+
+	if (object)
+		stat(s, ALLOC_PCS);
+	return object;
+}
+
+static unsigned int alloc_from_pcs_bulk(struct kmem_cache *s, gfp_t gfp,
+					size_t size, void **p)
+{
+	struct slub_percpu_sheaves *pcs;
+	struct slab_sheaf *main;
+	unsigned int allocated = 0;
+	unsigned int batch;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	pcs = this_cpu_ptr(s->cpu_sheaves);
+	while (allocated < size) {
+		if (!pcs->main->size && !__pcs_replace_empty_main(s, pcs, gfp))
+			break;
+
+		main = pcs->main;
+		batch = min_t(size_t, size - allocated, main->size);
+		main->size -= batch;
+		memcpy(p + allocated, main->objects + main->size,
+		       batch * sizeof(void *));
+		allocated += batch;
+	}
+	local_irq_restore(flags);
+
+	return allocated;
+}
+
+/*
+ * Only objects of the local node go to the sheaves, so that allocations
+ * served from them stay node-local.
+ */
+static inline bool pcs_free_allowed(struct page *page)
+{
+	return page_to_nid(page) == numa_mem_id() &&
+	       !PageSlabPfmemalloc(page);
+}
+
+static bool free_to_pcs(struct kmem_cache *s, struct page *page, void *object)
+{
+	struct slub_percpu_sheaves *pcs;
+	unsigned long flags;
+
+	if (!pcs_free_allowed(page))
+		return false;
+
+	local_irq_save(flags);
+	pcs = this_cpu_ptr(s->cpu_sheaves);
+	if (unlikely(pcs->main->size == s->sheaf_capacity))
+		__pcs_replace_full_main(s, pcs);
+	pcs->main->objects[pcs->main->size++] = object;
+	local_irq_restore(flags);
+
+	stat(s, FREE_PCS);
+	return true;
+}
+
+/*
+ * Move the local-node objects of @p to the sheaves and clear their slots,
+ * the remaining ones are left to the regular bulk free.
+ */
+static void free_to_pcs_bulk(struct kmem_cache *s, size_t size, void **p)
+{
+	struct slub_percpu_sheaves *pcs;
+	unsigned long flags;
+	size_t i;
+
+	local_irq_save(flags);
+	pcs = this_cpu_ptr(s->cpu_sheaves);
+	for (i = 0; i < size; i++) {
+		void *object = p[i];
+
+		if (!object || !pcs_free_allowed(virt_to_head_page(object)))
+			continue;
+
+		p[i] = NULL;
+		/* KASAN might put object into memory quarantine */
+		if (slab_free_hook(s, object))
+			continue;
+
+		if (unlikely(pcs->main->size == s->sheaf_capacity))
+			__pcs_replace_full_main(s, pcs);
+		pcs->main->objects[pcs->main->size++] = object;
+		stat(s, FREE_PCS);
+	}
+	local_irq_restore(flags);
+}
+
+static bool pcs_has_objects(struct kmem_cache *s, int cpu)
+{
+	struct slub_percpu_sheaves *pcs;
+
+	if (!slub_has_sheaves(s))
+		return false;
+
+	pcs = per_cpu_ptr(s->cpu_sheaves, cpu);
+	return pcs->main->size || (pcs->spare && pcs->spare->size);
+}
+
+/*
+ * Flush the sheaves of @cpu back to the slabs. Called with interrupts
+ * disabled on @cpu itself, or for a dead cpu.
+ */
+static void pcs_flush_cpu(struct kmem_cache *s, int cpu)
+{
+	struct slub_percpu_sheaves *pcs;
+
+	if (!slub_has_sheaves(s))
+		return;
+
+	pcs = per_cpu_ptr(s->cpu_sheaves, cpu);
+	sheaf_flush(s, pcs->main);
+	if (pcs->spare)
+		sheaf_flush(s, pcs->spare);
+}
+
+/* Flush and free all sheaves stored in the barn of @n */
+static void barn_shrink(struct kmem_cache *s, struct kmem_cache_node *n)
+{
+	struct node_barn *barn = &n->barn;
+	struct slab_sheaf *sheaf, *next;
+	unsigned long flags;
+	LIST_HEAD(full);
+	LIST_HEAD(empty);
+
+	if (!slub_has_sheaves(s))
+		return;
+
+	spin_lock_irqsave(&barn->lock, flags);
+	list_splice_init(&barn->sheaves_full, &full);
+	list_splice_init(&barn->sheaves_empty, &empty);
+	barn->nr_full = 0;
+	barn->nr_empty = 0;
+	spin_unlock_irqrestore(&barn->lock, flags);
+
+	list_for_each_entry_safe(sheaf, next, &full, barn_list) {
+		sheaf_flush(s, sheaf);
+		kfree(sheaf);
+	}
+	list_for_each_entry_safe(sheaf, next, &empty, barn_list)
+		kfree(sheaf);
+}
+
+/*
+ * Bigger sheaves for smaller objects, with the sheaf itself sized to
+ * fill its kmalloc bucket.
+ */
+static unsigned int calculate_sheaf_capacity(struct kmem_cache *s)
+{
+	size_t bytes = s->size >= PAGE_SIZE / 4 ? 256 : 512;
+
+	return (bytes - sizeof(struct slab_sheaf)) / sizeof(void *);
+}
+
+static void free_percpu_sheaves(struct kmem_cache *s)
+{
+	int cpu;
+
+	if (!s->cpu_sheaves)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct slub_percpu_sheaves *pcs;
+
+		pcs = per_cpu_ptr(s->cpu_sheaves, cpu);
+		kfree(pcs->main);
+		kfree(pcs->spare);
+	}
+	free_percpu(s->cpu_sheaves);
+	s->cpu_sheaves = NULL;
+}
+
+static int init_percpu_sheaves(struct kmem_cache *s)
+{
+	int cpu;
+
+	s->sheaf_capacity = calculate_sheaf_capacity(s);
+	s->cpu_sheaves = alloc_percpu(struct slub_percpu_sheaves);
+	if (!s->cpu_sheaves)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct slub_percpu_sheaves *pcs;
+
+		pcs = per_cpu_ptr(s->cpu_sheaves, cpu);
+		pcs->main = alloc_empty_sheaf(s, GFP_KERNEL);
+		if (!pcs->main) {
+			free_percpu_sheaves(s);
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+#else
+static inline void barn_shrink(struct kmem_cache *s,
+			       struct kmem_cache_node *n)
+{
+}
+
+static inline unsigned int alloc_from_pcs_bulk(struct kmem_cache *s,
+					       gfp_t gfp, size_t size,
+					       void **p)
+{
+	return 0;
+}
+
+static inline void free_to_pcs_bulk(struct kmem_cache *s, size_t size,
+				    void **p)
+{
+}
+#endif /* CONFIG_SLUB_SHEAVES */
+
 /* Note that interrupts must be enabled when calling this function. */
 void kmem_cache_free_bulk(struct kmem_cache *s, size_t size, void **p)
 {
 	if (WARN_ON(!size))
 		return;
 
+	memcg_slab_free_hook(s, p, size);
+	if (s && slub_has_sheaves(s))
+		free_to_pcs_bulk(s, size, p);
 	do {
 		struct detached_freelist df;
 
@@ -3112,12 +3634,20 @@ int kmem_cache_alloc_bulk(struct kmem_cache *s, gfp_t flags, size_t size,
 			  void **p)
 {
 	struct kmem_cache_cpu *c;
+	struct obj_cgroup *objcg;
 	int i;
 
 	/* memcg and kmem_cache debug support */
-	s = slab_pre_alloc_hook(s, flags);
+	s = slab_pre_alloc_hook(s, &objcg, size, flags);
 	if (unlikely(!s))
 		return false;
+
+	i = 0;
+	if (slub_has_sheaves(s)) {
+		i = alloc_from_pcs_bulk(s, flags, size, p);
+		if (i == size)
+			goto zero;
+	}
 	/*
 	 * Drain objects in the per cpu slab, while disabling local
 	 * IRQs, which protects against PREEMPT and interrupts
@@ -3126,7 +3656,7 @@ int kmem_cache_alloc_bulk(struct kmem_cache *s, gfp_t flags, size_t size,
 	local_irq_disable();
 	c = this_cpu_ptr(s->cpu_slab);
 
-	for (i = 0; i < size; i++) {
+	for (; i < size; i++) {
 		void *object = c->freelist;
 
 		if (unlikely(!object)) {
@@ -3148,6 +3678,7 @@ int kmem_cache_alloc_bulk(struct kmem_cache *s, gfp_t flags, size_t size,
 	c->tid = next_tid(c->tid);
 	local_irq_enable();
 
+zero:
 	/* Clear memory outside IRQ disabled fastpath loop */
 	if (unlikely(flags & __GFP_ZERO)) {
 		int j;
@@ -3157,11 +3688,12 @@ int kmem_cache_alloc_bulk(struct kmem_cache *s, gfp_t flags, size_t size,
 	}
 
 	/* memcg and kmem_cache debug support */
-	slab_post_alloc_hook(s, flags, size, p);
+	slab_post_alloc_hook(s, objcg, flags, size, p);
 	return i;
 error:
 	local_irq_enable();
-	slab_post_alloc_hook(s, flags, i, p);
+	memcg_slab_alloc_abort(s, objcg, size - i);
+	slab_post_alloc_hook(s, objcg, flags, i, p);
 	__kmem_cache_free_bulk(s, i, p);
 	return 0;
 }
@@ -3303,6 +3835,9 @@ init_kmem_cache_node(struct kmem_cache_node *n)
 	atomic_long_set(&n->total_objects, 0);
 	INIT_LIST_HEAD(&n->full);
 #endif
+#ifdef CONFIG_SLUB_SHEAVES
+	barn_init(&n->barn);
+#endif
 }
 
 static inline int alloc_kmem_cache_cpus(struct kmem_cache *s)
@@ -3387,6 +3922,9 @@ static void free_kmem_cache_nodes(struct kmem_cache *s)
 void __kmem_cache_release(struct kmem_cache *s)
 {
 	cache_random_seq_destroy(s);
+#ifdef CONFIG_SLUB_SHEAVES
+	free_percpu_sheaves(s);
+#endif
 	free_percpu(s->cpu_slab);
 	free_kmem_cache_nodes(s);
 }
@@ -3551,6 +4089,7 @@ static int calculate_sizes(struct kmem_cache *s, int forced_order)
 	 */
 	size = ALIGN(size, s->align);
 	s->size = size;
+	s->reciprocal_size = reciprocal_value(size);
 	if (forced_order >= 0)
 		order = forced_order;
 	else
@@ -3633,9 +4172,24 @@ static int kmem_cache_open(struct kmem_cache *s, slab_flags_t flags)
 	if (!init_kmem_cache_nodes(s))
 		goto error;
 
-	if (alloc_kmem_cache_cpus(s))
-		return 0;
+	if (!alloc_kmem_cache_cpus(s))
+		goto error_nodes;
+
+#ifdef CONFIG_SLUB_SHEAVES
+	/*
+	 * Sheaves bypass the debug checks and need kmalloc for themselves,
+	 * so only caches created later and without debugging get them.
+	 */
+	if (kmem_cache_debug(s) || slab_state < UP)
+		s->flags &= ~SLAB_SHEAVES;
+	if ((s->flags & SLAB_SHEAVES) && init_percpu_sheaves(s)) {
+		free_percpu(s->cpu_slab);
+		goto error_nodes;
+	}
+#endif
+	return 0;
 
+error_nodes:
 	free_kmem_cache_nodes(s);
 error:
 	if (flags & SLAB_PANIC)
@@ -3721,6 +4275,7 @@ int __kmem_cache_shutdown(struct kmem_cache *s)
 	flush_all(s);
 	/* Attempt to free all objects */
 	for_each_kmem_cache_node(s, node, n) {
+		barn_shrink(s, n);
 		free_partial(s, n);
 		if (n->nr_partial || slabs_node(s, node))
 			return 1;
@@ -3933,6 +4488,7 @@ void kfree(const void *x)
 		__free_pages(page, compound_order(page));
 		return;
 	}
+	memcg_slab_free_hook(page->slab_cache, &object, 1);
 	slab_free(page->slab_cache, page, object, NULL, 1, _RET_IP_);
 }
 EXPORT_SYMBOL(kfree);
@@ -3962,6 +4518,7 @@ int __kmem_cache_shrink(struct kmem_cache *s)
 
 	flush_all(s);
 	for_each_kmem_cache_node(s, node, n) {
+		barn_shrink(s, n);
 		INIT_LIST_HEAD(&discard);
 		for (i = 0; i < SHRINK_PROMOTE_MAX; i++)
 			INIT_LIST_HEAD(promote + i);
@@ -5000,6 +5557,16 @@ static ssize_t cpu_partial_store(struct kmem_cache *s, const char *buf,
 }
 SLAB_ATTR(cpu_partial);
 
+static ssize_t sheaf_capacity_show(struct kmem_cache *s, char *buf)
+{
+#ifdef CONFIG_SLUB_SHEAVES
+	if (slub_has_sheaves(s))
+		return sprintf(buf, "%u\n", s->sheaf_capacity);
+#endif
+	return sprintf(buf, "0\n");
+}
+SLAB_ATTR_RO(sheaf_capacity);
+
 static ssize_t ctor_show(struct kmem_cache *s, char *buf)
 {
 	if (!s->ctor)
@@ -5406,6 +5973,12 @@ STAT_ATTR(CPU_PARTIAL_ALLOC, cpu_partial_alloc);
 STAT_ATTR(CPU_PARTIAL_FREE, cpu_partial_free);
 STAT_ATTR(CPU_PARTIAL_NODE, cpu_partial_node);
 STAT_ATTR(CPU_PARTIAL_DRAIN, cpu_partial_drain);
+STAT_ATTR(ALLOC_PCS, alloc_cpu_sheaf);
+STAT_ATTR(FREE_PCS, free_cpu_sheaf);
+STAT_ATTR(SHEAF_REFILL, sheaf_refill);
+STAT_ATTR(SHEAF_FLUSH, sheaf_flush);
+STAT_ATTR(BARN_GET, barn_get);
+STAT_ATTR(BARN_PUT, barn_put);
 #endif
 
 static struct attribute *slab_attrs[] = {
@@ -5415,6 +5988,7 @@ static struct attribute *slab_attrs[] = {
 	&order_attr.attr,
 	&min_partial_attr.attr,
 	&cpu_partial_attr.attr,
+	&sheaf_capacity_attr.attr,
 	&objects_attr.attr,
 	&objects_partial_attr.attr,
 	&partial_attr.attr,
@@ -5472,6 +6046,12 @@ static struct attribute *slab_attrs[] = {
 	&cpu_partial_free_attr.attr,
 	&cpu_partial_node_attr.attr,
 	&cpu_partial_drain_attr.attr,
+	&alloc_cpu_sheaf_attr.attr,
+	&free_cpu_sheaf_attr.attr,
+	&sheaf_refill_attr.attr,
+	&sheaf_flush_attr.attr,
+	&barn_get_attr.attr,
+	&barn_put_attr.attr,
 #endif
 #ifdef CONFIG_FAILSLAB
 	&failslab_attr.attr,
@@ -43,6 +43,7 @@
  * @reuse_addr:		the virtual address of the @reuse_page page.
  * @vmemmap_pages:	the list head of the vmemmap pages that can be freed
  *			or is mapped from.
+ * @no_tlb_flush:	leave the TLB flush to the caller, who batches it.
  */
 struct vmemmap_remap_walk {
 	void (*remap_pte)(pte_t *pte, unsigned long addr,
@@ -50,6 +51,7 @@ struct vmemmap_remap_walk {
 	struct page *reuse_page;
 	unsigned long reuse_addr;
 	struct list_head *vmemmap_pages;
+	bool no_tlb_flush;
 };
 
 static void vmemmap_pte_range(pmd_t *pmd, unsigned long addr,
@@ -136,6 +138,9 @@ static void vmemmap_remap_range(unsigned long start, unsigned long end,
 		vmemmap_p4d_range(pgd, addr, next, walk);
 	} while (pgd++, addr = next, addr != end);
 
+	if (walk->no_tlb_flush)
+		return;
+
 	/*
 	 * We only change the mapping of the vmemmap virtual address range
 	 * [@start + PAGE_SIZE, end), so we only need to flush the TLB which
@@ -226,6 +231,52 @@ void vmemmap_remap_free(unsigned long start, unsigned long end,
 	free_vmemmap_page_list(&vmemmap_pages);
 }
 
+/**
+ * vmemmap_remap_free_batch - same as vmemmap_remap_free(), but neither flush
+ *			      the TLB nor free the vmemmap pages.
+ * @start:	start address of the vmemmap virtual address range that we want
+ *		to remap.
+ * @end:	end address of the vmemmap virtual address range that we want to
+ *		remap.
+ * @reuse:	reuse address.
+ * @vmemmap_pages: list the vmemmap pages which the range was mapped to are
+ *		added to.
+ *
+ * The old pages may still be reached through stale TLB entries, so the caller
+ * must hand @vmemmap_pages to vmemmap_free_batch() together with a range
+ * covering [@start, @end) before they can be reused.
+ */
+void vmemmap_remap_free_batch(unsigned long start, unsigned long end,
+			      unsigned long reuse,
+			      struct list_head *vmemmap_pages)
+{
+	struct vmemmap_remap_walk walk = {
+		.remap_pte	= vmemmap_remap_pte,
+		.reuse_addr	= reuse,
+		.vmemmap_pages	= vmemmap_pages,
+		.no_tlb_flush	= true,
+	};
+
+	BUG_ON(start - reuse != PAGE_SIZE);
+
+	vmemmap_remap_range(reuse, end, &walk);
+}
+
+/**
+ * vmemmap_free_batch - flush the TLB of the vmemmap virtual address range
+ *			[@start, @end) once, then free @vmemmap_pages gathered
+ *			by vmemmap_remap_free_batch().
+ * @start:	lowest start address passed to vmemmap_remap_free_batch().
+ * @end:	highest end address passed to vmemmap_remap_free_batch().
+ * @vmemmap_pages: the list of the vmemmap pages to free.
+ */
+void vmemmap_free_batch(unsigned long start, unsigned long end,
+			struct list_head *vmemmap_pages)
+{
+	flush_tlb_kernel_range(start, end);
+	free_vmemmap_page_list(vmemmap_pages);
+}
+
 static void vmemmap_restore_pte(pte_t *pte, unsigned long addr,
 				struct vmemmap_remap_walk *walk)
 {
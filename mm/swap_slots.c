@@ -270,7 +270,7 @@ static int refill_swap_slots_cache(struct swap_slots_cache *cache)
 	cache->cur = 0;
 	if (swap_slot_cache_active)
 		cache->nr = get_swap_pages(SWAP_SLOTS_CACHE_SIZE,
-					   cache->slots, 1);
+					   cache->slots, 1, SWAP_TIER_ALL);
 
 	return cache->nr;
 }
@@ -311,12 +311,14 @@ swp_entry_t get_swap_page(struct page *page)
 {
 	swp_entry_t entry, *pentry;
 	struct swap_slots_cache *cache;
+	int tier;
 
 	entry.val = 0;
+	tier = mem_cgroup_swap_tier(page);
 
 	if (PageTransHuge(page)) {
 		if (IS_ENABLED(CONFIG_THP_SWAP))
-			get_swap_pages(1, &entry, HPAGE_PMD_NR);
+			get_swap_pages(1, &entry, HPAGE_PMD_NR, tier);
 		goto out;
 	}
 
@@ -328,6 +330,11 @@ swp_entry_t get_swap_page(struct page *page)
 	 *
 	 * The alloc path here does not touch cache->slots_ret
 	 * so cache->free_lock is not taken.
+	 *
+	 * The cache is refilled from the highest priority devices
+	 * first, so it holds slots of the top tier for as long as that
+	 * has room. A memcg kept off the lower tiers only takes a slot
+	 * from its own tier and goes to the devices directly otherwise.
 	 */
 	cache = raw_cpu_ptr(&swp_slots);
 
@@ -336,7 +343,11 @@ swp_entry_t get_swap_page(struct page *page)
 		if (cache->slots) {
 repeat:
 			if (cache->nr) {
-				pentry = &cache->slots[cache->cur++];
+				pentry = &cache->slots[cache->cur];
+				if (tier != SWAP_TIER_ALL &&
+				    swp_swap_info(*pentry)->prio < tier)
+					goto unlock;
+				cache->cur++;
 				entry = *pentry;
 				pentry->val = 0;
 				cache->nr--;
@@ -345,12 +356,13 @@ swp_entry_t get_swap_page(struct page *page)
 					goto repeat;
 			}
 		}
+unlock:
 		mutex_unlock(&cache->alloc_lock);
 		if (entry.val)
 			goto out;
 	}
 
-	get_swap_pages(1, &entry, 1);
+	get_swap_pages(1, &entry, 1, tier);
 out:
 	if (mem_cgroup_try_charge_swap(page, entry)) {
 		put_swap_page(page, entry);
@@ -791,6 +791,53 @@ static inline void swap_ra_clamp_pfn(struct vm_area_struct *vma,
 		    PFN_DOWN((faddr & PMD_MASK) + PMD_SIZE));
 }
 
+#if defined(CONFIG_THP_SWAP) && defined(CONFIG_64BIT)
+static bool swap_ra_pte_is(pte_t pte, swp_entry_t fentry, pgoff_t offset)
+{
+	swp_entry_t entry;
+
+	if (!is_swap_pte(pte))
+		return false;
+	entry = pte_to_swp_entry(pte);
+	return !non_swap_entry(entry) &&
+	       swp_type(entry) == swp_type(fentry) &&
+	       swp_offset(entry) == offset;
+}
+
+/*
+ * A THP swapped out as a whole went to one aligned swap cluster, so its
+ * PTEs map consecutive entries from the start of that cluster. Check the
+ * ends of the PMD range around the fault for that layout, in which case
+ * the whole unit is worth reading in one go.
+ */
+static bool swap_ra_thp_unit(struct vm_area_struct *vma, unsigned long faddr,
+			     pte_t *fpte, swp_entry_t fentry)
+{
+	unsigned long haddr = faddr & HPAGE_PMD_MASK;
+	unsigned long idx = (faddr - haddr) >> PAGE_SHIFT;
+	pgoff_t base;
+
+	if (haddr < vma->vm_start || haddr + HPAGE_PMD_SIZE > vma->vm_end)
+		return false;
+	if (swp_offset(fentry) < idx)
+		return false;
+
+	base = swp_offset(fentry) - idx;
+	if (!IS_ALIGNED(base, HPAGE_PMD_NR))
+		return false;
+
+	return swap_ra_pte_is(fpte[-idx], fentry, base) &&
+	       swap_ra_pte_is(fpte[HPAGE_PMD_NR - 1 - idx], fentry,
+			      base + HPAGE_PMD_NR - 1);
+}
+#else
+static inline bool swap_ra_thp_unit(struct vm_area_struct *vma, unsigned long faddr,
+			     pte_t *fpte, swp_entry_t fentry)
+{
+	return false;
+}
+#endif
+
 static void swap_ra_info(struct vm_fault *vmf,
 			struct vma_swap_readahead *ra_info)
 {
@@ -830,13 +877,16 @@ static void swap_ra_info(struct vm_fault *vmf,
 	atomic_long_set(&vma->swap_readahead_info,
 			SWAP_RA_VAL(faddr, win, 0));
 
-	if (win == 1) {
+	/* Copy the PTEs because the page table may be unmapped */
+	if (swap_ra_thp_unit(vma, faddr, pte, entry)) {
+		/* Not recorded, the window field has no room for it */
+		ra_info->win = HPAGE_PMD_NR;
+		start = PFN_DOWN(faddr & HPAGE_PMD_MASK);
+		end = start + HPAGE_PMD_NR;
+	} else if (win == 1) {
 		pte_unmap(orig_pte);
 		return;
-	}
-
-	/* Copy the PTEs because the page table may be unmapped */
-	if (fpfn == pfn + 1)
+	} else if (fpfn == pfn + 1)
 		swap_ra_clamp_pfn(vma, faddr, fpfn, fpfn + win, &start, &end);
 	else if (pfn == fpfn + 1)
 		swap_ra_clamp_pfn(vma, faddr, fpfn - win + 1, fpfn + 1,
@@ -951,7 +951,12 @@ static unsigned long scan_swap_map(struct swap_info_struct *si,
 
 }
 
-int get_swap_pages(int n_goal, swp_entry_t swp_entries[], int entry_size)
+/*
+ * Allocate up to @n_goal entries from the swap devices whose priority is at
+ * least @min_prio, which keeps a memcg on its swap tier.
+ */
+int get_swap_pages(int n_goal, swp_entry_t swp_entries[], int entry_size,
+		   int min_prio)
 {
 	unsigned long size = swap_entry_size(entry_size);
 	struct swap_info_struct *si, *next;
@@ -979,6 +984,9 @@ int get_swap_pages(int n_goal, swp_entry_t swp_entries[], int entry_size)
 start_over:
 	node = numa_node_id();
 	plist_for_each_entry_safe(si, next, &swap_avail_heads[node], avail_lists[node]) {
+		/* the list is sorted by priority, the rest is below the tier */
+		if (si->prio < min_prio)
+			break;
 		/* requeue si to after same-priority siblings */
 		plist_requeue(&si->avail_lists[node], &swap_avail_heads[node]);
 		spin_unlock(&swap_avail_lock);
@@ -1038,6 +1046,31 @@ int get_swap_pages(int n_goal, swp_entry_t swp_entries[], int entry_size)
 	return n_ret;
 }
 
+/*
+ * Free swap space on the devices whose priority is at least @min_prio. It
+ * is read locklessly, so only good as a hint for reclaim.
+ */
+long get_nr_swap_pages_tier(int min_prio)
+{
+	struct swap_info_struct *si;
+	long nr = 0;
+	int node;
+
+	if (min_prio == SWAP_TIER_ALL)
+		return get_nr_swap_pages();
+
+	spin_lock(&swap_avail_lock);
+	node = numa_node_id();
+	plist_for_each_entry(si, &swap_avail_heads[node], avail_lists[node]) {
+		if (si->prio < min_prio)
+			break;
+		nr += READ_ONCE(si->pages) - READ_ONCE(si->inuse_pages);
+	}
+	spin_unlock(&swap_avail_lock);
+
+	return nr;
+}
+
 /* The only caller of this function is now suspend routine */
 swp_entry_t get_swap_page_of_type(int type)
 {
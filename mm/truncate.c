@@ -23,6 +23,7 @@
 #include <linux/shmem_fs.h>
 #include <linux/cleancache.h>
 #include <linux/rmap.h>
+#include <linux/duptext.h>
 #include "internal.h"
 
 /*
@@ -302,6 +303,9 @@ void truncate_inode_pages_range(struct address_space *mapping,
 	pgoff_t		index;
 	int		i;
 
+	/* Text copies may outlive the page cache pages they were made from */
+	duptext_drop_mapping(mapping);
+
 	if (mapping->nrpages == 0 && mapping->nrexceptional == 0)
 		goto out;
 
@@ -718,6 +722,8 @@ int invalidate_inode_pages2_range(struct address_space *mapping,
 	int ret2 = 0;
 	int did_range_unmap = 0;
 
+	duptext_drop_mapping(mapping);
+
 	if (mapping->nrpages == 0 && mapping->nrexceptional == 0)
 		goto out;
 
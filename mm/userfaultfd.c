@@ -17,6 +17,7 @@
 #include <linux/mmu_notifier.h>
 #include <linux/hugetlb.h>
 #include <linux/shmem_fs.h>
+#include <linux/async_fork.h>
 #include <asm/tlbflush.h>
 #include "internal.h"
 
@@ -552,6 +553,9 @@ static __always_inline ssize_t __mcopy_atomic(struct mm_struct *dst_mm,
 		BUG_ON(pmd_none(*dst_pmd));
 		BUG_ON(pmd_trans_huge(*dst_pmd));
 
+		/* Don't let an async-forked child pick up the new page */
+		async_fork_fixup_pmd(dst_mm, dst_pmd, dst_addr);
+
 		err = mfill_atomic_pte(dst_mm, dst_pmd, dst_vma, dst_addr,
 				       src_addr, &page, zeropage);
 		cond_resched();
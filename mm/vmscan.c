@@ -56,11 +56,13 @@
 
 #include <linux/swapops.h>
 #include <linux/balloon_compaction.h>
+#include <linux/migrate.h>
 
 #include "internal.h"
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/vmscan.h>
+#include <trace/events/memcg.h>
 
 struct scan_control {
 	/* How many pages shrink_list() should reclaim */
@@ -119,6 +121,9 @@ struct scan_control {
 	/* The file pages on the current node are dangerously low */
 	unsigned int file_is_tiny:1;
 
+	/* Do not migrate cold pages to a slower memory tier */
+	unsigned int no_demotion:1;
+
 	/* Allocation order */
 	s8 order;
 
@@ -937,6 +942,9 @@ static int __remove_mapping(struct address_space *mapping, struct page *page,
 		if (reclaimed && page_is_file_cache(page) &&
 		    !mapping_exiting(mapping) && !dax_mapping(mapping))
 			shadow = workingset_eviction(page, target_memcg);
+		/* Not under writeback, so PG_reclaim is the readahead mark */
+		if (reclaimed && PageReadahead(page))
+			count_vm_event(READAHEAD_WASTED);
 		__delete_from_page_cache(page, shadow);
 		xa_unlock_irqrestore(&mapping->i_pages, flags);
 
@@ -1076,6 +1084,99 @@ static void page_check_dirty_writeback(struct page *page,
 		mapping->a_ops->is_dirty_writeback(page, dirty, writeback);
 }
 
+static bool can_demote(int nid, struct scan_control *sc)
+{
+	if (!numa_demotion_enabled || sc->no_demotion)
+		return false;
+	/*
+	 * Demotion moves a page without changing its memcg charge, so it
+	 * does nothing for a memcg over its limit.
+	 */
+	if (cgroup_reclaim(sc))
+		return false;
+
+	return next_demotion_node(nid) != NUMA_NO_NODE;
+}
+
+struct demotion_control {
+	int nid;
+	unsigned long nr_demoted;
+};
+
+static struct page *alloc_demote_page(struct page *page, unsigned long private)
+{
+	struct demotion_control *dc = (struct demotion_control *)private;
+	struct page *newpage;
+
+	/*
+	 * The target node is allowed to fail quietly: the page is then
+	 * reclaimed the usual way instead of pushing the slow node into
+	 * reclaim of its own from here.
+	 */
+	if (thp_migration_supported() && PageTransHuge(page)) {
+		newpage = alloc_pages_node(dc->nid,
+				GFP_TRANSHUGE_LIGHT | __GFP_THISNODE,
+				HPAGE_PMD_ORDER);
+		if (newpage)
+			prep_transhuge_page(newpage);
+	} else {
+		newpage = __alloc_pages_node(dc->nid,
+				(GFP_HIGHUSER_MOVABLE & ~__GFP_RECLAIM) |
+				__GFP_THISNODE | __GFP_NOWARN |
+				__GFP_NOMEMALLOC | __GFP_NORETRY, 0);
+	}
+
+	if (newpage)
+		dc->nr_demoted += hpage_nr_pages(newpage);
+	return newpage;
+}
+
+static void free_demote_page(struct page *newpage, unsigned long private)
+{
+	struct demotion_control *dc = (struct demotion_control *)private;
+
+	dc->nr_demoted -= hpage_nr_pages(newpage);
+	put_page(newpage);
+}
+
+/*
+ * Migrate the pages on @demote_pages to the next memory tier.  Pages that
+ * could not be moved are left on the list for the caller to reclaim.
+ * Returns the number of base pages that left @pgdat.
+ */
+static unsigned long demote_page_list(struct list_head *demote_pages,
+				      struct pglist_data *pgdat)
+{
+	struct demotion_control dc = {
+		.nid = next_demotion_node(pgdat->node_id),
+	};
+	struct page *page;
+
+	if (list_empty(demote_pages) || dc.nid == NUMA_NO_NODE)
+		return 0;
+
+	/*
+	 * The caller settles NR_ISOLATED_* for the whole isolated batch
+	 * itself, while migrate_pages() also drops it for every page it
+	 * consumes.  Take an extra count for the demotion candidates and
+	 * return what remains for the pages handed back to reclaim.
+	 */
+	list_for_each_entry(page, demote_pages, lru)
+		mod_node_page_state(pgdat, NR_ISOLATED_ANON +
+				    page_is_file_cache(page),
+				    hpage_nr_pages(page));
+
+	migrate_pages(demote_pages, alloc_demote_page, free_demote_page,
+		      (unsigned long)&dc, MIGRATE_ASYNC, MR_DEMOTION);
+
+	list_for_each_entry(page, demote_pages, lru)
+		mod_node_page_state(pgdat, NR_ISOLATED_ANON +
+				    page_is_file_cache(page),
+				    -hpage_nr_pages(page));
+
+	return dc.nr_demoted;
+}
+
 /*
  * shrink_page_list() returns the number of reclaimed pages
  */
@@ -1098,11 +1199,15 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 	unsigned nr_ref_keep = 0;
 	unsigned nr_unmap_fail = 0;
 	struct lruvec *target_lruvec;
+	LIST_HEAD(demote_pages);
+	bool do_demote_pass;
 
 	target_lruvec = mem_cgroup_lruvec(sc->target_mem_cgroup, pgdat);
+	do_demote_pass = can_demote(pgdat->node_id, sc);
 
 	cond_resched();
 
+retry:
 	while (!list_empty(page_list)) {
 		struct address_space *mapping;
 		struct page *page;
@@ -1253,6 +1358,18 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			; /* try to reclaim the page below */
 		}
 
+		/*
+		 * Before reclaiming the page, try to relocate its contents
+		 * to a slower memory tier.  Pages that can't be moved come
+		 * back through this loop once more without demotion.
+		 */
+		if (do_demote_pass &&
+		    (thp_migration_supported() || !PageTransHuge(page))) {
+			list_add(&page->lru, &demote_pages);
+			unlock_page(page);
+			continue;
+		}
+
 		/*
 		 * Anonymous process memory has backing store?
 		 * Try to allocate it some swap space here.
@@ -1477,6 +1594,15 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 		VM_BUG_ON_PAGE(PageLRU(page) || PageUnevictable(page), page);
 	}
 
+	/* Migrate pages selected for demotion */
+	nr_reclaimed += demote_page_list(&demote_pages, pgdat);
+	/* Pages that could not be demoted are reclaimed instead */
+	if (!list_empty(&demote_pages)) {
+		list_splice_init(&demote_pages, page_list);
+		do_demote_pass = false;
+		goto retry;
+	}
+
 	mem_cgroup_uncharge_list(&free_pages);
 	try_to_unmap_flush();
 	free_unref_page_list(&free_pages);
@@ -1504,6 +1630,7 @@ unsigned long reclaim_clean_pages_from_list(struct zone *zone,
 		.gfp_mask = GFP_KERNEL,
 		.priority = DEF_PRIORITY,
 		.may_unmap = 1,
+		.no_demotion = 1,
 	};
 	unsigned long ret;
 	struct page *page, *next;
@@ -2162,6 +2289,7 @@ unsigned long reclaim_pages(struct list_head *page_list)
 		.may_writepage = 1,
 		.may_unmap = 1,
 		.may_swap = 1,
+		.no_demotion = 1,
 	};
 
 	while (!list_empty(page_list)) {
@@ -3379,12 +3507,14 @@ unsigned long try_to_free_mem_cgroup_pages(struct mem_cgroup *memcg,
 					    sc.may_writepage,
 					    sc.gfp_mask,
 					    sc.reclaim_idx);
+	trace_memcg_reclaim_begin(memcg, nr_pages);
 	noreclaim_flag = memalloc_noreclaim_save();
 
 	nr_reclaimed = do_try_to_free_pages(zonelist, &sc);
 
 	memalloc_noreclaim_restore(noreclaim_flag);
 	trace_mm_vmscan_memcg_reclaim_end(nr_reclaimed);
+	trace_memcg_reclaim_end(memcg, nr_reclaimed);
 
 	return nr_reclaimed;
 }
@@ -756,6 +756,9 @@ static int refresh_cpu_vm_stats(bool do_pagesets)
 	for_each_populated_zone(zone) {
 		struct per_cpu_pageset __percpu *p = zone->pageset;
 
+		if (do_pagesets)
+			decay_pcp_high(zone, this_cpu_ptr(&p->pcp));
+
 		for (i = 0; i < NR_VM_ZONE_STAT_ITEMS; i++) {
 			int v;
 
@@ -1237,6 +1240,10 @@ const char * const vmstat_text[] = {
 	"drop_pagecache",
 	"drop_slab",
 	"oom_kill",
+	"readahead_hit",
+	"readahead_miss",
+	"readahead_wasted",
+	"readahead_stride",
 
 #ifdef CONFIG_NUMA_BALANCING
 	"numa_pte_updates",
@@ -1244,10 +1251,16 @@ const char * const vmstat_text[] = {
 	"numa_hint_faults",
 	"numa_hint_faults_local",
 	"numa_pages_migrated",
+	"pgpromote_success",
+	"pgpromote_rate_limited",
 #endif
 #ifdef CONFIG_MIGRATION
 	"pgmigrate_success",
 	"pgmigrate_fail",
+#ifdef CONFIG_NUMA
+	"pgdemote_kswapd",
+	"pgdemote_direct",
+#endif
 #endif
 #ifdef CONFIG_COMPACTION
 	"compact_migrate_scanned",
@@ -1314,6 +1327,15 @@ const char * const vmstat_text[] = {
 	"swap_ra",
 	"swap_ra_hit",
 #endif
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	"speculative_pgfault",
+	"speculative_pgfault_abort",
+#endif
+#ifdef CONFIG_DUPTEXT
+	"duptext_alloc",
+	"duptext_free",
+	"duptext_fault",
+#endif
 #endif /* CONFIG_VM_EVENTS_COUNTERS */
 };
 #endif /* CONFIG_PROC_FS || CONFIG_SYSFS || CONFIG_NUMA */
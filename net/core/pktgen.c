@@ -233,6 +233,34 @@ static char *pkt_flag_names[] = {
 #define M_START_XMIT		0	/* Default normal TX */
 #define M_NETIF_RECEIVE 	1	/* Inject packets into stack */
 #define M_QUEUE_XMIT		2	/* Inject packet into qdisc */
+#define M_NAPI_RECEIVE		3	/* Inject packets into stack through GRO */
+
+/* Receive path stages timed in M_NAPI_RECEIVE */
+enum {
+	PG_RX_GRO,		/* napi_gro_receive() */
+	PG_RX_FLUSH,		/* napi_gro_flush() at the end of a burst */
+	PG_RX_NR_STAGES,
+};
+
+static const char * const pg_rx_stage_names[PG_RX_NR_STAGES] = {
+	[PG_RX_GRO]	= "gro",
+	[PG_RX_FLUSH]	= "flush",
+};
+
+static const char * const pg_gro_result_names[] = {
+	[GRO_MERGED]		= "merged",
+	[GRO_MERGED_FREE]	= "merged_free",
+	[GRO_HELD]		= "held",
+	[GRO_NORMAL]		= "normal",
+	[GRO_DROP]		= "drop",
+	[GRO_CONSUMED]		= "consumed",
+};
+
+struct pktgen_rx_stage {
+	__u64 calls;
+	__u64 ns;		/* nano-seconds spent in the stage */
+	__u64 max_ns;		/* longest single call */
+};
 
 /* If lock -- protects updating of if_list */
 #define   if_lock(t)           mutex_lock(&(t->if_lock));
@@ -414,6 +442,13 @@ struct pktgen_dev {
 	unsigned int burst;	/* number of duplicated packets to burst */
 	int node;               /* Memory node */
 
+	/* M_NAPI_RECEIVE: a NAPI context of our own on odev, which a burst
+	 * of packets is received through as if by a driver's poll.
+	 */
+	struct napi_struct napi;
+	__u64 gro_results[ARRAY_SIZE(pg_gro_result_names)];
+	struct pktgen_rx_stage rx_stages[PG_RX_NR_STAGES];
+
 #ifdef CONFIG_XFRM
 	__u8	ipsmode;		/* IPSEC mode (config) */
 	__u8	ipsproto;		/* IPSEC type (config) */
@@ -647,6 +682,8 @@ static int pktgen_if_show(struct seq_file *seq, void *v)
 		seq_puts(seq, "     xmit_mode: netif_receive\n");
 	else if (pkt_dev->xmit_mode == M_QUEUE_XMIT)
 		seq_puts(seq, "     xmit_mode: xmit_queue\n");
+	else if (pkt_dev->xmit_mode == M_NAPI_RECEIVE)
+		seq_puts(seq, "     xmit_mode: napi_receive\n");
 
 	seq_puts(seq, "     Flags: ");
 
@@ -704,6 +741,25 @@ static int pktgen_if_show(struct seq_file *seq, void *v)
 
 	seq_printf(seq, "     flows: %u\n", pkt_dev->nflows);
 
+	if (pkt_dev->xmit_mode == M_NAPI_RECEIVE) {
+		seq_puts(seq, "     gro:");
+		for (i = 0; i < ARRAY_SIZE(pg_gro_result_names); i++)
+			seq_printf(seq, " %s: %llu", pg_gro_result_names[i],
+				   (unsigned long long)pkt_dev->gro_results[i]);
+		seq_puts(seq, "\n");
+
+		for (i = 0; i < PG_RX_NR_STAGES; i++) {
+			const struct pktgen_rx_stage *s = &pkt_dev->rx_stages[i];
+
+			seq_printf(seq,
+				   "     %s: calls: %llu  avg: %lluns  max: %lluns\n",
+				   pg_rx_stage_names[i],
+				   (unsigned long long)s->calls,
+				   s->calls ? div64_u64(s->ns, s->calls) : 0,
+				   (unsigned long long)s->max_ns);
+		}
+	}
+
 	if (pkt_dev->result[0])
 		seq_printf(seq, "Result: %s\n", pkt_dev->result);
 	else
@@ -859,6 +915,12 @@ static __u32 pktgen_read_flag(const char *f, bool *disable)
 	return 0;
 }
 
+/* Never scheduled, but netpoll polls every NAPI context of a device */
+static int pktgen_napi_poll(struct napi_struct *napi, int budget)
+{
+	return 0;
+}
+
 static ssize_t pktgen_if_write(struct file *file,
 			       const char __user * user_buffer, size_t count,
 			       loff_t * offset)
@@ -1093,6 +1155,7 @@ static ssize_t pktgen_if_write(struct file *file,
 			return len;
 		if ((value > 0) &&
 		    ((pkt_dev->xmit_mode == M_NETIF_RECEIVE) ||
+		     (pkt_dev->xmit_mode == M_NAPI_RECEIVE) ||
 		     !(pkt_dev->odev->priv_flags & IFF_TX_SKB_SHARING)))
 			return -ENOTSUPP;
 		i += len;
@@ -1207,10 +1270,25 @@ static ssize_t pktgen_if_write(struct file *file,
 		} else if (strcmp(f, "queue_xmit") == 0) {
 			pkt_dev->xmit_mode = M_QUEUE_XMIT;
 			pkt_dev->last_ok = 1;
+		} else if (strcmp(f, "napi_receive") == 0) {
+			/* GRO can hold or merge the skbs, so never reuse them */
+			if (pkt_dev->clone_skb > 0)
+				return -ENOTSUPP;
+			if (pkt_dev->running)
+				return -EBUSY;
+
+			/* left disabled, nobody but us must touch it */
+			if (!pkt_dev->napi.dev)
+				netif_napi_add(pkt_dev->odev, &pkt_dev->napi,
+					       pktgen_napi_poll,
+					       NAPI_POLL_WEIGHT);
+			pkt_dev->xmit_mode = M_NAPI_RECEIVE;
+			pkt_dev->last_ok = 1;
+			pkt_dev->clone_skb = 0;
 		} else {
 			sprintf(pg_result,
 				"xmit_mode -:%s:- unknown\nAvailable modes: %s",
-				f, "start_xmit, netif_receive\n");
+				f, "start_xmit, netif_receive, queue_xmit, napi_receive\n");
 			return count;
 		}
 		sprintf(pg_result, "OK: xmit_mode=%s", f);
@@ -2996,6 +3074,18 @@ static void pktgen_clear_counters(struct pktgen_dev *pkt_dev)
 	pkt_dev->sofar = 0;
 	pkt_dev->tx_bytes = 0;
 	pkt_dev->errors = 0;
+	memset(pkt_dev->gro_results, 0, sizeof(pkt_dev->gro_results));
+	memset(pkt_dev->rx_stages, 0, sizeof(pkt_dev->rx_stages));
+}
+
+static void pktgen_rx_stage_add(struct pktgen_dev *pkt_dev, int stage, u64 ns)
+{
+	struct pktgen_rx_stage *s = &pkt_dev->rx_stages[stage];
+
+	s->calls++;
+	s->ns += ns;
+	if (ns > s->max_ns)
+		s->max_ns = ns;
 }
 
 /* Set up structure for sending pkts, clear counters */
@@ -3371,6 +3461,40 @@ static void pktgen_xmit(struct pktgen_dev *pkt_dev)
 			skb_reset_tc(skb);
 		} while (--burst > 0);
 		goto out; /* Skips xmit_mode M_START_XMIT */
+	} else if (pkt_dev->xmit_mode == M_NAPI_RECEIVE) {
+		gro_result_t gro;
+		u64 start;
+
+		local_bh_disable();
+		do {
+			skb = pkt_dev->skb;
+			/* the stack owns it from here on */
+			pkt_dev->skb = NULL;
+			skb->protocol = eth_type_trans(skb, skb->dev);
+
+			start = ktime_get_ns();
+			gro = napi_gro_receive(&pkt_dev->napi, skb);
+			pktgen_rx_stage_add(pkt_dev, PG_RX_GRO,
+					    ktime_get_ns() - start);
+
+			pkt_dev->gro_results[gro]++;
+			if (gro == GRO_DROP)
+				pkt_dev->errors++;
+			pkt_dev->sofar++;
+			pkt_dev->seq_num++;
+
+			if (--burst == 0 || (pkt_dev->count &&
+					     pkt_dev->sofar >= pkt_dev->count))
+				break;
+			pkt_dev->skb = fill_packet(odev, pkt_dev);
+		} while (pkt_dev->skb);
+
+		/* what a driver does when its poll is done */
+		start = ktime_get_ns();
+		napi_gro_flush(&pkt_dev->napi, false);
+		pktgen_rx_stage_add(pkt_dev, PG_RX_FLUSH,
+				    ktime_get_ns() - start);
+		goto out;
 	} else if (pkt_dev->xmit_mode == M_QUEUE_XMIT) {
 		local_bh_disable();
 		refcount_inc(&pkt_dev->skb->users);
@@ -3453,7 +3577,8 @@ static void pktgen_xmit(struct pktgen_dev *pkt_dev)
 
 	/* If pkt_dev->count is zero, then run forever */
 	if ((pkt_dev->count != 0) && (pkt_dev->sofar >= pkt_dev->count)) {
-		pktgen_wait_for_skb(pkt_dev);
+		if (pkt_dev->skb)
+			pktgen_wait_for_skb(pkt_dev);
 
 		/* Done with this */
 		pktgen_stop_device(pkt_dev);
@@ -3763,6 +3888,9 @@ static int pktgen_remove_device(struct pktgen_thread *t,
 
 	/* Dis-associate from the interface */
 
+	if (pkt_dev->napi.dev)
+		netif_napi_del(&pkt_dev->napi);
+
 	if (pkt_dev->odev) {
 		dev_put(pkt_dev->odev);
 		pkt_dev->odev = NULL;
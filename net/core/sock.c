@@ -2385,6 +2385,31 @@ int sk_wait_data(struct sock *sk, long *timeo, const struct sk_buff *skb)
 }
 EXPORT_SYMBOL(sk_wait_data);
 
+/*
+ * A memcg with a cgroup v1 memory.kmem.tcp limit has a memory pressure
+ * state of its own: it is entered once the memcg uses the same share of
+ * its limit as tcp_mem[1] is of tcp_mem[2].  Its sockets don't push all of
+ * the others into pressure then, until the host wide hard limit is hit.
+ * Returns false if the host wide state applies to sk.
+ */
+static bool sk_memcg_local_pressure(struct sock *sk, long allocated)
+{
+	long pressure = sk_prot_mem_limits(sk, 1);
+	long hard = sk_prot_mem_limits(sk, 2);
+	unsigned long usage, max;
+
+	if (!mem_cgroup_sockets_enabled || !sk->sk_memcg ||
+	    !mem_cgroup_tcpmem_usage(sk->sk_memcg, &usage, &max))
+		return false;
+
+	if (allocated > hard || pressure <= 0 || hard <= pressure)
+		return false;
+
+	if (usage > mult_frac(max, pressure, hard))
+		mem_cgroup_enter_tcpmem_pressure(sk->sk_memcg);
+	return true;
+}
+
 /**
  *	__sk_mem_raise_allocated - increase memory_allocated
  *	@sk: socket
@@ -2397,13 +2422,18 @@ EXPORT_SYMBOL(sk_wait_data);
 int __sk_mem_raise_allocated(struct sock *sk, int size, int amt, int kind)
 {
 	struct proto *prot = sk->sk_prot;
-	long allocated = sk_memory_allocated_add(sk, amt);
-	bool charged = true;
+	bool charged = true, local;
+	long allocated;
+
+	sk_memory_allocated_add(sk, amt);
+	allocated = sk_memory_allocated(sk);
 
 	if (mem_cgroup_sockets_enabled && sk->sk_memcg &&
 	    !(charged = mem_cgroup_charge_skmem(sk->sk_memcg, amt)))
 		goto suppress_allocation;
 
+	local = sk_memcg_local_pressure(sk, allocated);
+
 	/* Under limit. */
 	if (allocated <= sk_prot_mem_limits(sk, 0)) {
 		sk_leave_memory_pressure(sk);
@@ -2411,7 +2441,7 @@ int __sk_mem_raise_allocated(struct sock *sk, int size, int amt, int kind)
 	}
 
 	/* Under pressure. */
-	if (allocated > sk_prot_mem_limits(sk, 1))
+	if (allocated > sk_prot_mem_limits(sk, 1) && !local)
 		sk_enter_memory_pressure(sk);
 
 	/* Over hard limit. */
@@ -1340,6 +1340,10 @@ struct sk_buff *inet_gso_segment(struct sk_buff *skb,
 			goto out;
 	}
 
+	/* fraglist segments are the original datagrams, keep their IDs */
+	if (skb_shinfo(skb)->gso_type & SKB_GSO_FRAGLIST)
+		fixedid = true;
+
 	ops = rcu_dereference(inet_offloads[proto]);
 	if (likely(ops && ops->callbacks.gso_segment))
 		segs = ops->callbacks.gso_segment(skb, features);
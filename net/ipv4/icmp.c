@@ -1017,6 +1017,7 @@ int icmp_rcv(struct sk_buff *skb)
 	    skb_pingtrace_check(skb, PINGTRACE_F_ECHO)) {
 		skb->icmp_pingtrace = 1;
 		__ICMP_INC_STATS(net, ICMP_MIB_INPINGTRACEMSG);
+		skb_pingtrace_add_rx_ts(skb, net);
 		skb_pingtrace_add_ts(skb, net, P_R_RX_ICMPRCV,
 				     PINGTRACE_F_CALCULATE_CHECKSUM);
 	}
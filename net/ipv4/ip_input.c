@@ -241,6 +241,32 @@ static int ip_local_deliver_finish(struct net *net, struct sock *sk, struct sk_b
 /*
  * 	Deliver IP Packets to the higher protocol layers.
  */
+/*
+ * Fraglist GRO chains datagrams it guesses are forwarded, hand the ones
+ * that turn out to be local to the protocols one by one.
+ */
+static int ip_local_deliver_list(struct net *net, struct sk_buff *skb)
+{
+	struct sk_buff *segs, *next;
+
+	segs = __skb_gso_segment(skb, NETIF_F_SG, false);
+	if (IS_ERR_OR_NULL(segs)) {
+		kfree_skb(skb);
+		return 0;
+	}
+	consume_skb(skb);
+
+	for (; segs; segs = next) {
+		next = segs->next;
+		segs->next = NULL;
+		NF_HOOK(NFPROTO_IPV4, NF_INET_LOCAL_IN,
+			net, NULL, segs, segs->dev, NULL,
+			ip_local_deliver_finish);
+	}
+
+	return 0;
+}
+
 int ip_local_deliver(struct sk_buff *skb)
 {
 	/*
@@ -253,6 +279,10 @@ int ip_local_deliver(struct sk_buff *skb)
 			return 0;
 	}
 
+	if (unlikely(skb_is_gso(skb) &&
+		     (skb_shinfo(skb)->gso_type & SKB_GSO_FRAGLIST)))
+		return ip_local_deliver_list(net, skb);
+
 	return NF_HOOK(NFPROTO_IPV4, NF_INET_LOCAL_IN,
 		       net, NULL, skb, skb->dev, NULL,
 		       ip_local_deliver_finish);
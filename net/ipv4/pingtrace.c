@@ -7,6 +7,7 @@
 #include <linux/ip.h>
 #include <linux/icmp.h>
 #include <linux/types.h>
+#include <linux/timekeeping.h>
 #include <net/pingtrace.h>
 #include <linux/sysctl.h>
 #include <net/net_namespace.h>
@@ -41,9 +42,19 @@ static inline u32 truncate_ts_usec(u64 usec)
 	return usec & ((1UL << 31) - 1);
 }
 
-static inline u32 get_current_usec(void)
+static inline bool is_nsec_flag_set(struct pingtrace_pkt *pt)
 {
-	return truncate_ts_usec(ktime_get_mono_fast_ns() / 1000);
+	u16 flags = ntohs(pt->hdr.flags);
+
+	return flags & PINGTRACE_F_NSEC;
+}
+
+/* @ns in the resolution the prober asked for */
+static inline u32 pingtrace_ts(struct pingtrace_pkt *pt, u64 ns)
+{
+	if (is_nsec_flag_set(pt))
+		return (u32)ns;
+	return truncate_ts_usec(div_u64(ns, NSEC_PER_USEC));
 }
 
 static inline void
@@ -137,7 +148,7 @@ int skb_pingtrace_add_ts(struct sk_buff *skb, struct net *net, u32 function_id,
 	struct iphdr *iph;
 	struct pingtrace_timestamp entry;
 	int ret = 0, pt_size, icmp_size;
-	u32 usec;
+	u32 ts;
 
 	header_pointer_set(skb, &iph, &icmph, &pt);
 	icmp_size = icmp_packet_size(icmph, iph);
@@ -146,8 +157,8 @@ int skb_pingtrace_add_ts(struct sk_buff *skb, struct net *net, u32 function_id,
 	if (is_dontadd_flag_set(pt))
 		goto out;
 
-	usec = truncate_ts_usec(get_current_usec());
-	build_pingtrace_timestamp(&entry, net, function_id, usec);
+	ts = pingtrace_ts(pt, ktime_get_mono_fast_ns());
+	build_pingtrace_timestamp(&entry, net, function_id, ts);
 	ret = pingtrace_add_ts(skb, pt, pt_size, &entry);
 
 out:
@@ -155,6 +166,43 @@ int skb_pingtrace_add_ts(struct sk_buff *skb, struct net *net, u32 function_id,
 	return ret;
 }
 
+/*
+ * Add the stamps the driver and the stack took before icmp_rcv(), if any.
+ * The checksum is left to the P_R_RX_ICMPRCV stamp which follows.
+ */
+void skb_pingtrace_add_rx_ts(struct sk_buff *skb, struct net *net)
+{
+	struct skb_shared_hwtstamps *hwts = skb_hwtstamps(skb);
+	struct pingtrace_pkt *pt;
+	struct icmphdr *icmph;
+	struct iphdr *iph;
+	struct pingtrace_timestamp entry;
+	int pt_size;
+	u64 ns;
+
+	header_pointer_set(skb, &iph, &icmph, &pt);
+	pt_size = icmp_packet_size(icmph, iph) - sizeof(*icmph);
+
+	if (is_dontadd_flag_set(pt))
+		return;
+
+	if (hwts->hwtstamp) {
+		ns = ktime_to_ns(hwts->hwtstamp);
+		build_pingtrace_timestamp(&entry, net, P_R_RX_HWTS,
+					  pingtrace_ts(pt, ns));
+		if (pingtrace_add_ts(skb, pt, pt_size, &entry))
+			return;
+	}
+
+	/* skb->tstamp is CLOCK_REALTIME, the other stamps are monotonic */
+	if (skb->tstamp) {
+		ns = ktime_to_ns(ktime_sub(skb->tstamp, ktime_mono_to_real(0)));
+		build_pingtrace_timestamp(&entry, net, P_R_RX_NETIF,
+					  pingtrace_ts(pt, ns));
+		pingtrace_add_ts(skb, pt, pt_size, &entry);
+	}
+}
+
 static int pingtrace_sysctl_proc(struct ctl_table *table, int write,
 				 void __user *buffer, size_t *lenp,
 				 loff_t *ppos)
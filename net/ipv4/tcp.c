@@ -291,6 +291,8 @@ EXPORT_SYMBOL(sysctl_tcp_mem);
 
 atomic_long_t tcp_memory_allocated;	/* Current allocated memory. */
 EXPORT_SYMBOL(tcp_memory_allocated);
+DEFINE_PER_CPU(int, tcp_memory_per_cpu_fw_alloc);
+EXPORT_PER_CPU_SYMBOL_GPL(tcp_memory_per_cpu_fw_alloc);
 
 #if IS_ENABLED(CONFIG_SMC)
 DEFINE_STATIC_KEY_FALSE(tcp_have_smc);
@@ -1203,7 +1205,13 @@ int tcp_sendmsg_locked(struct sock *sk, struct msghdr *msg, size_t size)
 
 	flags = msg->msg_flags;
 
-	if (flags & MSG_ZEROCOPY && size && sock_flag(sk, SOCK_ZEROCOPY)) {
+	if (flags & MSG_ZEROCOPY && size && msg->msg_ubuf) {
+		/* pinned by the caller, we don't take extra references */
+		uarg = msg->msg_ubuf;
+		zc = sk->sk_route_caps & NETIF_F_SG;
+		if (!zc)
+			uarg->zerocopy = 0;
+	} else if (flags & MSG_ZEROCOPY && size && sock_flag(sk, SOCK_ZEROCOPY)) {
 		if ((1 << sk->sk_state) & ~(TCPF_ESTABLISHED | TCPF_CLOSE_WAIT)) {
 			err = -EINVAL;
 			goto out_err;
@@ -1424,7 +1432,8 @@ int tcp_sendmsg_locked(struct sock *sk, struct msghdr *msg, size_t size)
 		tcp_push(sk, flags, mss_now, tp->nonagle, size_goal);
 	}
 out_nopush:
-	sock_zerocopy_put(uarg);
+	if (uarg && !msg->msg_ubuf)
+		sock_zerocopy_put(uarg);
 	return copied + copied_syn;
 
 do_error:
@@ -1435,7 +1444,8 @@ int tcp_sendmsg_locked(struct sock *sk, struct msghdr *msg, size_t size)
 	if (copied + copied_syn)
 		goto out;
 out_err:
-	sock_zerocopy_put_abort(uarg);
+	if (uarg && !msg->msg_ubuf)
+		sock_zerocopy_put_abort(uarg);
 	err = sk_stream_error(sk, flags, err);
 	/* make sure we wake any epoll edge trigger waiter */
 	if (unlikely(skb_queue_len(&sk->sk_write_queue) == 0 &&
@@ -1756,12 +1766,52 @@ int tcp_mmap(struct file *file, struct socket *sock,
 }
 EXPORT_SYMBOL(tcp_mmap);
 
+/*
+ * Copy up to @len bytes at @seq, which could not be mapped, into the copy
+ * buffer of @zc. Return the number of bytes copied or an error.
+ */
+static int tcp_zerocopy_copy_tail(struct sock *sk,
+				  struct tcp_zerocopy_receive *zc,
+				  u32 seq, u32 len)
+{
+	unsigned long address = (unsigned long)zc->copybuf_address;
+	struct msghdr msg = {};
+	struct sk_buff *skb;
+	u32 copied = 0, n;
+	struct iovec iov;
+	u32 offset;
+	int err;
+
+	if (address != zc->copybuf_address)
+		return -EINVAL;
+
+	err = import_single_range(READ, (void __user *)address, len,
+				  &iov, &msg.msg_iter);
+	if (err)
+		return err;
+
+	while (copied < len) {
+		skb = tcp_recv_skb(sk, seq + copied, &offset);
+		if (!skb)
+			break;
+		n = min_t(u32, len - copied, skb->len - offset);
+		if (!n)
+			break;
+		err = skb_copy_datagram_msg(skb, offset, &msg, n);
+		if (err)
+			return copied ? : err;
+		copied += n;
+	}
+
+	return copied;
+}
+
 static int tcp_zerocopy_receive(struct sock *sk,
 				struct tcp_zerocopy_receive *zc)
 {
 	unsigned long address = (unsigned long)zc->address;
+	u32 length = 0, seq, offset, inq, copylen = 0;
 	const skb_frag_t *frags = NULL;
-	u32 length = 0, seq, offset;
 	struct vm_area_struct *vma;
 	struct sk_buff *skb = NULL;
 	struct tcp_sock *tp;
@@ -1785,12 +1835,14 @@ static int tcp_zerocopy_receive(struct sock *sk,
 
 	tp = tcp_sk(sk);
 	seq = tp->copied_seq;
-	zc->length = min_t(u32, zc->length, tcp_inq(sk));
+	inq = tcp_inq(sk);
+	zc->length = min_t(u32, zc->length, inq);
 	zc->length &= ~(PAGE_SIZE - 1);
 
 	zap_page_range(vma, address, zc->length);
 
-	zc->recv_skip_hint = 0;
+	/* Nothing to map, all of it is to be read by copy */
+	zc->recv_skip_hint = zc->length ? 0 : inq;
 	ret = 0;
 	while (length + PAGE_SIZE <= zc->length) {
 		if (zc->recv_skip_hint < PAGE_SIZE) {
@@ -1826,13 +1878,34 @@ static int tcp_zerocopy_receive(struct sock *sk,
 	}
 out:
 	up_read(&current->mm->mmap_sem);
-	if (length) {
+
+	/*
+	 * Unless only the VMA was too short, what is left up to the next
+	 * page boundary cannot be mapped: copy it in the same call.
+	 */
+	if (!ret && zc->copybuf_len > 0 &&
+	    (length < zc->length || inq - length < PAGE_SIZE)) {
+		ret = tcp_zerocopy_copy_tail(sk, zc, seq,
+					     min_t(u32, zc->copybuf_len,
+						   inq - length));
+		zc->copybuf_len = ret;
+		if (ret > 0) {
+			copylen = ret;
+			seq += copylen;
+			zc->recv_skip_hint -= min(zc->recv_skip_hint, copylen);
+		}
+		ret = 0;
+	} else {
+		zc->copybuf_len = 0;
+	}
+
+	if (length + copylen) {
 		tp->copied_seq = seq;
 		tcp_rcv_space_adjust(sk);
 
 		/* Clean up data we have read: This will do ACK frames. */
 		tcp_recv_skb(sk, seq, &offset);
-		tcp_cleanup_rbuf(sk, length);
+		tcp_cleanup_rbuf(sk, length + copylen);
 		ret = 0;
 		if (length == zc->length)
 			zc->recv_skip_hint = 0;
@@ -3580,13 +3653,25 @@ static int do_tcp_getsockopt(struct sock *sk, int level,
 
 		if (get_user(len, optlen))
 			return -EFAULT;
-		if (len != sizeof(zc))
+		if (len < offsetofend(struct tcp_zerocopy_receive, length))
 			return -EINVAL;
+		if (len > sizeof(zc)) {
+			len = sizeof(zc);
+			if (put_user(len, optlen))
+				return -EFAULT;
+		}
+		memset(&zc, 0, sizeof(zc));
 		if (copy_from_user(&zc, optval, len))
 			return -EFAULT;
+		if (zc.reserved)
+			return -EINVAL;
 		lock_sock(sk);
 		err = tcp_zerocopy_receive(sk, &zc);
 		release_sock(sk);
+		if (!err) {
+			zc.err = sock_error(sk);
+			zc.inq = tcp_inq_hint(sk);
+		}
 		if (!err && copy_to_user(optval, &zc, len))
 			err = -EFAULT;
 		return err;
@@ -0,0 +1,1283 @@
+/* BBR v2 (BBR2) congestion control
+ *
+ * BBR2 keeps the path model of BBR (see tcp_bbr.c): a max filter of the
+ * delivery rate and a min filter of the RTT. On top of that it learns
+ * explicit bounds on how much it may keep in flight from packet loss and
+ * ECN marks, the two signals BBR largely ignores:
+ *
+ *   inflight_hi: long-term upper bound on in-flight data. Set when a bw
+ *                probe pushes the loss rate or the ECN mark rate of a round
+ *                above a threshold; raised again, slowly at first, by
+ *                later probes that find the path can take more.
+ *   bw_lo, inflight_lo:
+ *                short-term lower bounds. Cut multiplicatively at the end of
+ *                every round with loss or ECN marks, and forgotten at the
+ *                start of every bw probe.
+ *
+ *   pacing_rate = pacing_gain * min(max_bw, bw_lo)
+ *   cwnd = min(cwnd_gain * BDP, inflight_hi (less headroom), inflight_lo)
+ *
+ * PROBE_BW becomes a cycle of four phases:
+ *
+ *   DOWN ---> CRUISE ---> REFILL ---> UP ---+
+ *    ^                                      |
+ *    +--------------------------------------+
+ *
+ * DOWN drains the queue left by the last probe. CRUISE paces at the
+ * estimated bw and leaves some headroom below inflight_hi for other flows.
+ * REFILL spends one round refilling the pipe with the lower bounds reset,
+ * and UP then probes for more bw, growing inflight_hi until loss or ECN
+ * says the probe went too far. The next probe comes after 2 to 3 seconds, or
+ * sooner if a Reno or CUBIC flow with the same BDP would have had time to
+ * grow its cwnd by one BDP: this bounds how long BBR2 can hold back
+ * loss-based flows sharing the bottleneck.
+ *
+ * ECN is used if the connection negotiated it and min_rtt is small enough
+ * for the path to be inside a datacenter. A round whose ECN mark rate is
+ * above bbr_ecn_thresh is treated like a round with excess loss, and in
+ * every round with marks inflight_lo is cut in proportion to ecn_alpha, the
+ * EWMA of the per-round mark fraction, the way DCTCP scales its cwnd. That
+ * suits switches configured to mark for DCTCP at a shallow queue threshold.
+ *
+ * Unlike the original BBR2, loss and marks are not tracked per skb: the
+ * tcp_skb_cb has no room for it. They are instead counted from the start of
+ * the current packet-timed round, and compared with the number of packets
+ * in flight when the newest acknowledged packet was sent, which is about
+ * one round earlier. The long-term ("LT") policer estimator of BBR is left
+ * out; bw_lo already follows a persistently lossy path.
+ *
+ * Like BBR, BBR2 should be used with the fq qdisc for pacing.
+ */
+#include <linux/module.h>
+#include <net/tcp.h>
+#include <linux/inet_diag.h>
+#include <linux/inet.h>
+#include <linux/random.h>
+
+/* Scale factor for rate in pkt/uSec unit to avoid truncation in bandwidth
+ * estimation. See tcp_bbr.c.
+ */
+#define BW_SCALE 24
+#define BW_UNIT (1 << BW_SCALE)
+
+#define BBR_SCALE 8	/* scaling factor for fractions in BBR (e.g. gains) */
+#define BBR_UNIT (1 << BBR_SCALE)
+
+/* BBR2 has the following modes for deciding how fast to send: */
+enum bbr_mode {
+	BBR_STARTUP,	/* ramp up sending rate rapidly to fill pipe */
+	BBR_DRAIN,	/* drain any queue created during startup */
+	BBR_PROBE_BW,	/* discover, share bw: pace around estimated bw */
+	BBR_PROBE_RTT,	/* cut inflight to min to probe min_rtt */
+};
+
+/* The phases of the PROBE_BW cycle: */
+enum bbr_pacing_gain_phase {
+	BBR_BW_PROBE_UP		= 0,  /* push up inflight to probe for bw/vol */
+	BBR_BW_PROBE_DOWN	= 1,  /* drain excess inflight from the queue */
+	BBR_BW_PROBE_CRUISE	= 2,  /* use pipe, w/ headroom in queue/pipe */
+	BBR_BW_PROBE_REFILL	= 3,  /* v2: refill the pipe again to 100% */
+};
+
+/* BBR2 congestion control block */
+struct bbr {
+	u32	min_rtt_us;	        /* min RTT in min_rtt_win_sec window */
+	u32	min_rtt_stamp;	        /* timestamp of min_rtt_us */
+	u32	probe_rtt_done_stamp;   /* end time for BBR_PROBE_RTT mode */
+	u32	probe_rtt_min_us;	/* min RTT in probe_rtt_win_ms window */
+	u32	probe_rtt_min_stamp;	/* timestamp of probe_rtt_min_us */
+	u32     next_rtt_delivered; /* scb->tx.delivered at end of round */
+	u64	cycle_mstamp;	     /* time of this cycle phase start */
+	u32     mode:3,		     /* current bbr_mode in state machine */
+		prev_ca_state:3,     /* CA state on previous ACK */
+		packet_conservation:1,  /* use packet conservation? */
+		round_start:1,	     /* start of packet-timed tx->ack round? */
+		idle_restart:1,	     /* restarting after idle? */
+		probe_rtt_round_done:1,  /* a BBR_PROBE_RTT round done? */
+		cycle_idx:2,	     /* current bbr_pacing_gain_phase */
+		loss_in_round:1,     /* packet loss in this round? */
+		ecn_in_round:1,	     /* ECN marks in this round? */
+		loss_events:4,	     /* losing ACKs in this round, saturating */
+		bw_probe_samples:1,  /* rate samples reflect a bw probe? */
+		rounds_since_probe:8,  /* rounds since the last bw probe */
+		bw_probe_up_rounds:4,  /* log2 of inflight_hi growth per round */
+		unused:1;
+	u32	pacing_gain:10,	/* current gain for setting pacing rate */
+		cwnd_gain:10,	/* current gain for setting cwnd */
+		full_bw_reached:1,   /* reached full bw in Startup? */
+		full_bw_cnt:2,	/* number of rounds without large bw gains */
+		startup_ecn_rounds:2,	/* rounds with high ECN in Startup */
+		has_seen_rtt:1, /* have we seen an RTT sample yet? */
+		unused_b:6;
+	u32	prior_cwnd;	/* prior cwnd upon entering loss recovery */
+	u32	full_bw;	/* recent bw, to estimate if pipe is full */
+	u32	bw_hi[2];	/* max bw of the previous and this probe cycle */
+	u32	bw_lo;		/* short-term lower bound on bw */
+	u32	bw_latest;	/* max delivered bw in this round */
+	u32	inflight_lo;	/* short-term lower bound on inflight */
+	u32	inflight_latest; /* max delivered data in this round */
+	u32	inflight_hi;	/* long-term upper bound on inflight */
+	u32	bw_probe_up_cnt; /* packets acked per inflight_hi increment */
+	u32	bw_probe_up_acks; /* packets acked since last increment */
+	u32	probe_wait_us;	/* PROBE_DOWN until next clock-driven probe */
+	u32	ecn_alpha;	/* EWMA of the per-round ECN mark fraction */
+	u32	round_delivered; /* tp->delivered at start of this round */
+	u32	round_lost;	/* tp->lost at start of this round */
+	u32	round_ce;	/* tp->delivered_ce at start of this round */
+};
+
+/* Window length of min_rtt filter (in sec): */
+static const u32 bbr_min_rtt_win_sec = 10;
+/* Minimum time (in ms) spent at the probe_rtt cwnd in BBR_PROBE_RTT mode: */
+static const u32 bbr_probe_rtt_mode_ms = 200;
+/* Enter PROBE_RTT if min_rtt was not seen again for this long (in ms): */
+static const u32 bbr_probe_rtt_win_ms = 5000;
+/* The cwnd in PROBE_RTT is this fraction of the BDP: */
+static const u32 bbr_probe_rtt_cwnd_gain = BBR_UNIT * 1 / 2;
+/* Skip TSO below the following bandwidth (bits/sec): */
+static const int bbr_min_tso_rate = 1200000;
+
+/* The pacing gain of 2/ln(2) in STARTUP, and its inverse in DRAIN, are as in
+ * tcp_bbr.c:
+ */
+static const int bbr_high_gain  = BBR_UNIT * 2885 / 1000 + 1;
+static const int bbr_drain_gain = BBR_UNIT * 1000 / 2885;
+/* The gain for deriving steady-state cwnd tolerates delayed/stretched ACKs: */
+static const int bbr_cwnd_gain  = BBR_UNIT * 2;
+/* The pacing_gain values for the PROBE_BW phases, by bbr_pacing_gain_phase: */
+static const int bbr_pacing_gain[] = {
+	BBR_UNIT * 5 / 4,	/* UP: probe for more available bw */
+	BBR_UNIT * 91 / 100,	/* DOWN: drain queue and/or yield bw */
+	BBR_UNIT,		/* CRUISE: try to use pipe w/ some headroom */
+	BBR_UNIT,		/* REFILL: refill pipe to estimated 100% */
+};
+
+/* Try to keep at least this many packets in flight, if things go smoothly. For
+ * smooth functioning, a sliding window protocol ACKing every other packet
+ * needs at least 4 packets in flight:
+ */
+static const u32 bbr_cwnd_min_target = 4;
+
+/* To estimate if BBR_STARTUP mode (i.e. high_gain) has filled pipe... */
+/* If bw has increased significantly (1.25x), there may be more bw available: */
+static const u32 bbr_full_bw_thresh = BBR_UNIT * 5 / 4;
+/* But after 3 rounds w/o significant bw growth, estimate pipe is full: */
+static const u32 bbr_full_bw_cnt = 3;
+/* Or after a round with this many losing ACKs and excess loss: */
+static const u32 bbr_full_loss_cnt = 8;
+/* Or after this many rounds in a row with excess ECN marks: */
+static const u32 bbr_full_ecn_cnt = 2;
+
+/* Loss and ECN thresholds for "inflight too high"... */
+/* A bw probe stops if more than 2% of what was in flight is lost: */
+static const u32 bbr_loss_thresh = BBR_UNIT * 2 / 100;
+/* Or if more than 50% of what was delivered in the round was CE marked: */
+static const u32 bbr_ecn_thresh = BBR_UNIT * 1 / 2;
+/* On excess loss, inflight_hi and the lower bounds are cut to 70%: */
+static const u32 bbr_beta = BBR_UNIT * 30 / 100;
+/* CRUISE leaves this fraction of inflight_hi as headroom for other flows: */
+static const u32 bbr_inflight_headroom = BBR_UNIT * 15 / 100;
+
+/* ECN parameters... */
+/* Only use ECN on paths with a min_rtt below this (in usec): */
+static const u32 bbr_ecn_max_rtt_us = 5000;
+/* Gain of the ecn_alpha EWMA, and the initial ecn_alpha: */
+static const u32 bbr_ecn_alpha_gain = BBR_UNIT * 1 / 16;
+static const u32 bbr_ecn_alpha_init = BBR_UNIT;
+/* In a round with marks, inflight_lo shrinks by ecn_alpha * ecn_factor: */
+static const u32 bbr_ecn_factor = BBR_UNIT * 1 / 3;
+
+/* Bandwidth probing parameters... */
+/* Probe for bw every bbr_bw_probe_base_us + [0, bbr_bw_probe_rand_us): */
+static const u32 bbr_bw_probe_base_us = 2 * USEC_PER_SEC;
+static const u32 bbr_bw_probe_rand_us = 1 * USEC_PER_SEC;
+/* Never wait more than this many rounds between probes: */
+static const u32 bbr_bw_probe_max_rounds = 63;
+/* The start of the round count between probes is randomized over: */
+static const u32 bbr_bw_probe_rand_rounds = 2;
+/* inflight_hi grows by at most 2^bbr_bw_probe_up_max_rounds per round: */
+static const u32 bbr_bw_probe_up_max_rounds = 10;
+
+static void bbr_check_probe_rtt_done(struct sock *sk);
+
+/* Do we estimate that STARTUP filled the pipe? */
+static bool bbr_full_bw_reached(const struct sock *sk)
+{
+	const struct bbr *bbr = inet_csk_ca(sk);
+
+	return bbr->full_bw_reached;
+}
+
+/* Return the max bw of the last two probe cycles, in pkts/uS << BW_SCALE. */
+static u32 bbr_max_bw(const struct sock *sk)
+{
+	const struct bbr *bbr = inet_csk_ca(sk);
+
+	return max(bbr->bw_hi[0], bbr->bw_hi[1]);
+}
+
+/* Return the estimated bandwidth of the path, in pkts/uS << BW_SCALE. */
+static u32 bbr_bw(const struct sock *sk)
+{
+	const struct bbr *bbr = inet_csk_ca(sk);
+
+	return min(bbr_max_bw(sk), bbr->bw_lo);
+}
+
+/* Start a new probe cycle in the max bw filter. */
+static void bbr_advance_max_bw_filter(struct sock *sk)
+{
+	struct bbr *bbr = inet_csk_ca(sk);
+
+	if (!bbr->bw_hi[1])
+		return;  /* no samples in this cycle; keep the older ones */
+	bbr->bw_hi[0] = bbr->bw_hi[1];
+	bbr->bw_hi[1] = 0;
+}
+
+/* Return rate in bytes per second, optionally with a gain.
+ * The order here is chosen carefully to avoid overflow of u64. This should
+ * work for input rates of up to 2.9Tbit/sec and gain of 2.89x.
+ */
+static u64 bbr_rate_bytes_per_sec(struct sock *sk, u64 rate, int gain)
+{
+	unsigned int mss = tcp_sk(sk)->mss_cache;
+
+	if (!tcp_needs_internal_pacing(sk))
+		mss = tcp_mss_to_mtu(sk, mss);
+	rate *= mss;
+	rate *= gain;
+	rate >>= BBR_SCALE;
+	rate *= USEC_PER_SEC;
+	return rate >> BW_SCALE;
+}
+
+/* Convert a BBR bw and gain factor to a pacing rate in bytes per second. */
+static u32 bbr_bw_to_pacing_rate(struct sock *sk, u32 bw, int gain)
+{
+	u64 rate = bw;
+
+	rate = bbr_rate_bytes_per_sec(sk, rate, gain);
+	rate = min_t(u64, rate, sk->sk_max_pacing_rate);
+	return rate;
+}
+
+/* Initialize pacing rate to: high_gain * init_cwnd / RTT. */
+static void bbr_init_pacing_rate_from_rtt(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr *bbr = inet_csk_ca(sk);
+	u64 bw;
+	u32 rtt_us;
+
+	if (tp->srtt_us) {		/* any RTT sample yet? */
+		rtt_us = max(tp->srtt_us >> 3, 1U);
+		bbr->has_seen_rtt = 1;
+	} else {			 /* no RTT sample yet */
+		rtt_us = USEC_PER_MSEC;	 /* use nominal default RTT */
+	}
+	bw = (u64)tp->snd_cwnd * BW_UNIT;
+	do_div(bw, rtt_us);
+	sk->sk_pacing_rate = bbr_bw_to_pacing_rate(sk, bw, bbr_high_gain);
+}
+
+/* Pace using current bw estimate and a gain factor. As in BBR, the average
+ * pacing rate aims to be slightly lower than the estimated bandwidth, by not
+ * including link-layer headers in the packet size used for the pacing rate.
+ */
+static void bbr_set_pacing_rate(struct sock *sk, u32 bw, int gain)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr *bbr = inet_csk_ca(sk);
+	u32 rate = bbr_bw_to_pacing_rate(sk, bw, gain);
+
+	if (unlikely(!bbr->has_seen_rtt && tp->srtt_us))
+		bbr_init_pacing_rate_from_rtt(sk);
+	if (bbr_full_bw_reached(sk) || rate > sk->sk_pacing_rate)
+		sk->sk_pacing_rate = rate;
+}
+
+/* override sysctl_tcp_min_tso_segs */
+static u32 bbr_min_tso_segs(struct sock *sk)
+{
+	return sk->sk_pacing_rate < (bbr_min_tso_rate >> 3) ? 1 : 2;
+}
+
+static u32 bbr_tso_segs_goal(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	u32 segs, bytes;
+
+	/* Sort of tcp_tso_autosize() but ignoring
+	 * driver provided sk_gso_max_size.
+	 */
+	bytes = min_t(u32, sk->sk_pacing_rate >> sk->sk_pacing_shift,
+		      GSO_MAX_SIZE - 1 - MAX_TCP_HEADER);
+	segs = max_t(u32, bytes / tp->mss_cache, bbr_min_tso_segs(sk));
+
+	return min(segs, 0x7FU);
+}
+
+/* Save "last known good" cwnd so we can restore it after losses or PROBE_RTT */
+static void bbr_save_cwnd(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr *bbr = inet_csk_ca(sk);
+
+	if (bbr->prev_ca_state < TCP_CA_Recovery && bbr->mode != BBR_PROBE_RTT)
+		bbr->prior_cwnd = tp->snd_cwnd;  /* this cwnd is good enough */
+	else  /* loss recovery or BBR_PROBE_RTT have temporarily cut cwnd */
+		bbr->prior_cwnd = max(bbr->prior_cwnd, tp->snd_cwnd);
+}
+
+static void bbr_cwnd_event(struct sock *sk, enum tcp_ca_event event)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr *bbr = inet_csk_ca(sk);
+
+	if (event == CA_EVENT_TX_START && tp->app_limited) {
+		bbr->idle_restart = 1;
+		/* Avoid pointless buffer overflows: pace at est. bw if we don't
+		 * need more speed (we're restarting from idle and app-limited).
+		 */
+		if (bbr->mode == BBR_PROBE_BW)
+			bbr_set_pacing_rate(sk, bbr_bw(sk), BBR_UNIT);
+		else if (bbr->mode == BBR_PROBE_RTT)
+			bbr_check_probe_rtt_done(sk);
+	}
+}
+
+/* Return BDP * gain in packets, rounded up. */
+static u32 bbr_bdp(struct sock *sk, u32 bw, int gain)
+{
+	struct bbr *bbr = inet_csk_ca(sk);
+	u64 w;
+
+	/* If we've never had a valid RTT sample, cap cwnd at the initial
+	 * default: see bbr_target_cwnd() in tcp_bbr.c.
+	 */
+	if (unlikely(bbr->min_rtt_us == ~0U))	 /* no valid RTT samples yet? */
+		return TCP_INIT_CWND;  /* be safe: cap at default initial cwnd*/
+
+	w = (u64)bw * bbr->min_rtt_us;
+
+	/* Apply a gain to the given value, then remove the BW_SCALE shift. */
+	return (((w * gain) >> BBR_SCALE) + BW_UNIT - 1) / BW_UNIT;
+}
+
+/* Find target inflight: BDP * gain, plus enough full-sized skbs in flight to
+ * utilize the end systems, as BBR does.
+ */
+static u32 bbr_inflight(struct sock *sk, u32 bw, int gain)
+{
+	struct bbr *bbr = inet_csk_ca(sk);
+	u32 cwnd = bbr_bdp(sk, bw, gain);
+
+	/* Allow enough full-sized skbs in flight to utilize end systems. */
+	cwnd += 3 * bbr_tso_segs_goal(sk);
+
+	/* Reduce delayed ACKs by rounding up cwnd to the next even number. */
+	cwnd = (cwnd + 1) & ~1U;
+
+	/* Ensure gain cycling gets inflight above BDP even for small BDPs. */
+	if (bbr->mode == BBR_PROBE_BW && gain > BBR_UNIT)
+		cwnd += 2;
+
+	return cwnd;
+}
+
+/* What a Reno or CUBIC flow would grow its cwnd toward: one BDP, or the
+ * current cwnd if it is smaller.
+ */
+static u32 bbr_target_inflight(struct sock *sk)
+{
+	u32 bdp = bbr_inflight(sk, bbr_bw(sk), BBR_UNIT);
+
+	return min(bdp, tcp_sk(sk)->snd_cwnd);
+}
+
+/* inflight_hi less the headroom CRUISE leaves for other flows. */
+static u32 bbr_inflight_with_headroom(const struct sock *sk)
+{
+	const struct bbr *bbr = inet_csk_ca(sk);
+	u32 headroom;
+
+	if (bbr->inflight_hi == ~0U)
+		return ~0U;
+
+	headroom = max(1U, (bbr->inflight_hi * bbr_inflight_headroom) >>
+			   BBR_SCALE);
+	return max(bbr->inflight_hi - headroom, bbr_cwnd_min_target);
+}
+
+/* Is the sending rate being probed up, so the lower bounds should not be
+ * enforced or adapted?
+ */
+static bool bbr_is_probing_bandwidth(const struct sock *sk)
+{
+	const struct bbr *bbr = inet_csk_ca(sk);
+
+	return bbr->mode == BBR_STARTUP ||
+	       (bbr->mode == BBR_PROBE_BW &&
+		(bbr->cycle_idx == BBR_BW_PROBE_REFILL ||
+		 bbr->cycle_idx == BBR_BW_PROBE_UP));
+}
+
+/* Packets may be ECN marked by the path and the mark rate may be trusted. */
+static bool bbr_ecn_eligible(const struct sock *sk)
+{
+	const struct bbr *bbr = inet_csk_ca(sk);
+
+	return (tcp_sk(sk)->ecn_flags & TCP_ECN_OK) &&
+	       bbr->min_rtt_us <= bbr_ecn_max_rtt_us;
+}
+
+/* Did we lose or ECN mark too much of what was in flight? Losses and marks
+ * are counted since the start of the round, and loss is compared with what
+ * was in flight when the newest packet acked was sent, about a round ago.
+ */
+static bool bbr_is_inflight_too_high(const struct sock *sk,
+				     const struct rate_sample *rs)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+	const struct bbr *bbr = inet_csk_ca(sk);
+	u32 lost, ce;
+
+	lost = tp->lost - bbr->round_lost;
+	if (lost && rs->tx_in_flight &&
+	    (u64)lost * BBR_UNIT > (u64)rs->tx_in_flight * bbr_loss_thresh)
+		return true;
+
+	ce = tp->delivered_ce - bbr->round_ce;
+	if (ce && rs->delivered > 0 && bbr_ecn_eligible(sk) &&
+	    (u64)ce * BBR_UNIT > (u64)rs->delivered * bbr_ecn_thresh)
+		return true;
+
+	return false;
+}
+
+/* An optimization in BBR to reduce losses: On the first round of recovery, we
+ * follow the packet conservation principle: send P packets per P packets acked.
+ * After that, we slow-start and send at most 2*P packets per P packets acked.
+ * After recovery finishes, or upon undo, we restore the cwnd we had when
+ * recovery started (capped by the target cwnd based on estimated BDP).
+ */
+static bool bbr_set_cwnd_to_recover_or_restore(
+	struct sock *sk, const struct rate_sample *rs, u32 acked, u32 *new_cwnd)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr *bbr = inet_csk_ca(sk);
+	u8 prev_state = bbr->prev_ca_state, state = inet_csk(sk)->icsk_ca_state;
+	u32 cwnd = tp->snd_cwnd;
+
+	/* An ACK for P pkts should release at most 2*P packets. We do this
+	 * in two steps. First, here we deduct the number of lost packets.
+	 * Then, in bbr_set_cwnd() we slow start up toward the target cwnd.
+	 */
+	if (rs->losses > 0)
+		cwnd = max_t(s32, cwnd - rs->losses, 1);
+
+	if (state == TCP_CA_Recovery && prev_state != TCP_CA_Recovery) {
+		/* Starting 1st round of Recovery, so do packet conservation. */
+		bbr->packet_conservation = 1;
+		bbr->next_rtt_delivered = tp->delivered;  /* start round now */
+		/* Cut unused cwnd from app behavior, TSQ, or TSO deferral: */
+		cwnd = tcp_packets_in_flight(tp) + acked;
+	} else if (prev_state >= TCP_CA_Recovery && state < TCP_CA_Recovery) {
+		/* Exiting loss recovery; restore cwnd saved before recovery. */
+		cwnd = max(cwnd, bbr->prior_cwnd);
+		bbr->packet_conservation = 0;
+	}
+	bbr->prev_ca_state = state;
+
+	if (bbr->packet_conservation) {
+		*new_cwnd = max(cwnd, tcp_packets_in_flight(tp) + acked);
+		return true;	/* yes, using packet conservation */
+	}
+	*new_cwnd = cwnd;
+	return false;
+}
+
+/* Cap cwnd by the bounds of the inflight model. */
+static void bbr_bound_cwnd_for_inflight_model(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr *bbr = inet_csk_ca(sk);
+	u32 cap = ~0U;
+
+	if (bbr->mode == BBR_PROBE_BW &&
+	    bbr->cycle_idx != BBR_BW_PROBE_CRUISE) {
+		/* Probe without ever exceeding inflight_hi. */
+		cap = bbr->inflight_hi;
+	} else if (bbr->mode == BBR_PROBE_RTT ||
+		   (bbr->mode == BBR_PROBE_BW &&
+		    bbr->cycle_idx == BBR_BW_PROBE_CRUISE)) {
+		/* Leave headroom for other flows to grab bw. */
+		cap = bbr_inflight_with_headroom(sk);
+	}
+	/* Adapt to any loss or ECN since our last bw probe. */
+	cap = min(cap, bbr->inflight_lo);
+
+	cap = max(cap, bbr_cwnd_min_target);
+	tp->snd_cwnd = min(cap, tp->snd_cwnd);
+}
+
+/* The cwnd used in PROBE_RTT: half a BDP, to drain the queue in one round
+ * while keeping some of the pipe busy.
+ */
+static u32 bbr_probe_rtt_cwnd(struct sock *sk)
+{
+	return max(bbr_bdp(sk, bbr_bw(sk), bbr_probe_rtt_cwnd_gain),
+		   bbr_cwnd_min_target);
+}
+
+/* Slow-start up toward target cwnd (if bw estimate is growing, or packet loss
+ * has drawn us down below target), or snap down to target if we're above it,
+ * then apply the bounds learned from loss and ECN.
+ */
+static void bbr_set_cwnd(struct sock *sk, const struct rate_sample *rs,
+			 u32 acked, u32 bw, int gain)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr *bbr = inet_csk_ca(sk);
+	u32 cwnd = tp->snd_cwnd, target_cwnd = 0;
+
+	if (!acked)
+		goto done;  /* no packet fully ACKed; just apply caps */
+
+	if (bbr_set_cwnd_to_recover_or_restore(sk, rs, acked, &cwnd))
+		goto done;
+
+	/* If we're below target cwnd, slow start cwnd toward target cwnd. */
+	target_cwnd = bbr_inflight(sk, bw, gain);
+	if (bbr_full_bw_reached(sk))  /* only cut cwnd if we filled the pipe */
+		cwnd = min(cwnd + acked, target_cwnd);
+	else if (cwnd < target_cwnd || tp->delivered < TCP_INIT_CWND)
+		cwnd = cwnd + acked;
+	cwnd = max(cwnd, bbr_cwnd_min_target);
+
+done:
+	tp->snd_cwnd = min(cwnd, tp->snd_cwnd_clamp);	/* apply global cap */
+	if (bbr->mode == BBR_PROBE_RTT)  /* drain queue, refresh min_rtt */
+		tp->snd_cwnd = min(tp->snd_cwnd, bbr_probe_rtt_cwnd(sk));
+
+	bbr_bound_cwnd_for_inflight_model(sk);
+}
+
+/* Have we spent at least interval_us in this phase of the cycle? */
+static bool bbr_has_elapsed_in_phase(const struct sock *sk, u32 interval_us)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+	const struct bbr *bbr = inet_csk_ca(sk);
+
+	return tcp_stamp_us_delta(tp->tcp_mstamp,
+				  bbr->cycle_mstamp + interval_us) > 0;
+}
+
+static void bbr_set_cycle_idx(struct sock *sk, int cycle_idx)
+{
+	struct bbr *bbr = inet_csk_ca(sk);
+
+	bbr->cycle_idx = cycle_idx;
+	bbr->pacing_gain = bbr_pacing_gain[cycle_idx];
+}
+
+/* Forget the lower bounds, e.g. to probe for bw or after an undo. */
+static void bbr_reset_lower_bounds(struct sock *sk)
+{
+	struct bbr *bbr = inet_csk_ca(sk);
+
+	bbr->bw_lo = ~0U;
+	bbr->inflight_lo = ~0U;
+}
+
+/* Start a new round of loss and ECN accounting. */
+static void bbr_reset_congestion_signals(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr *bbr = inet_csk_ca(sk);
+
+	bbr->loss_in_round = 0;
+	bbr->ecn_in_round = 0;
+	bbr->loss_events = 0;
+	bbr->bw_latest = 0;
+	bbr->inflight_latest = 0;
+	bbr->round_delivered = tp->delivered;
+	bbr->round_lost = tp->lost;
+	bbr->round_ce = tp->delivered_ce;
+}
+
+/* Each probe cycle waits 2-3 seconds, randomized so that flows sharing a
+ * bottleneck do not synchronize their probes.
+ */
+static void bbr_pick_probe_wait(struct sock *sk)
+{
+	struct bbr *bbr = inet_csk_ca(sk);
+
+	bbr->rounds_since_probe = prandom_u32_max(bbr_bw_probe_rand_rounds);
+	bbr->probe_wait_us = bbr_bw_probe_base_us +
+			     prandom_u32_max(bbr_bw_probe_rand_us);
+}
+
+/* Grow inflight_hi exponentially while probing: the number of packets
+ * acked per inflight_hi increment halves every round.
+ */
+static void bbr_raise_inflight_hi_slope(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr *bbr = inet_csk_ca(sk);
+	u32 growth_this_round, cnt;
+
+	growth_this_round = 1 << bbr->bw_probe_up_rounds;
+	bbr->bw_probe_up_rounds = min_t(u32, bbr->bw_probe_up_rounds + 1,
+					bbr_bw_probe_up_max_rounds);
+	cnt = tp->snd_cwnd / growth_this_round;
+	bbr->bw_probe_up_cnt = max(cnt, 1U);
+}
+
+/* In BBR_BW_PROBE_UP, raise inflight_hi while the path takes it. */
+static void bbr_probe_inflight_hi_upward(struct sock *sk,
+					 const struct rate_sample *rs)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr *bbr = inet_csk_ca(sk);
+	u32 delta;
+
+	if (!tcp_is_cwnd_limited(sk) || tp->snd_cwnd < bbr->inflight_hi)
+		return;  /* not fully using inflight_hi, so don't grow it */
+
+	bbr->bw_probe_up_acks += rs->acked_sacked;
+	if (bbr->bw_probe_up_acks >= bbr->bw_probe_up_cnt) {
+		delta = bbr->bw_probe_up_acks / bbr->bw_probe_up_cnt;
+		bbr->bw_probe_up_acks -= delta * bbr->bw_probe_up_cnt;
+		bbr->inflight_hi += delta;
+	}
+
+	if (bbr->round_start)
+		bbr_raise_inflight_hi_slope(sk);
+}
+
+static void bbr_start_bw_probe_up(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr *bbr = inet_csk_ca(sk);
+
+	bbr->bw_probe_samples = 1;
+	bbr->next_rtt_delivered = tp->delivered;
+	bbr->cycle_mstamp = tp->tcp_mstamp;
+	bbr_set_cycle_idx(sk, BBR_BW_PROBE_UP);
+	bbr_raise_inflight_hi_slope(sk);
+}
+
+/* Refill the pipe for one round with the lower bounds reset, so the probe
+ * in BBR_BW_PROBE_UP starts from a full pipe.
+ */
+static void bbr_start_bw_probe_refill(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr *bbr = inet_csk_ca(sk);
+
+	bbr_reset_lower_bounds(sk);
+	bbr->bw_probe_up_rounds = 0;
+	bbr->bw_probe_up_acks = 0;
+	bbr->next_rtt_delivered = tp->delivered;  /* start round now */
+	bbr_set_cycle_idx(sk, BBR_BW_PROBE_REFILL);
+}
+
+static void bbr_start_bw_probe_down(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr *bbr = inet_csk_ca(sk);
+
+	bbr_reset_congestion_signals(sk);
+	bbr->bw_probe_up_cnt = ~0U;	/* not growing inflight_hi any more */
+	bbr->bw_probe_samples = 0;
+	bbr_pick_probe_wait(sk);
+	bbr->cycle_mstamp = tp->tcp_mstamp;
+	bbr_advance_max_bw_filter(sk);
+	bbr_set_cycle_idx(sk, BBR_BW_PROBE_DOWN);
+}
+
+static void bbr_start_bw_probe_cruise(struct sock *sk)
+{
+	struct bbr *bbr = inet_csk_ca(sk);
+
+	/* Never let the short-term bound exceed the long-term one. */
+	if (bbr->inflight_lo != ~0U)
+		bbr->inflight_lo = min(bbr->inflight_lo, bbr->inflight_hi);
+
+	bbr_set_cycle_idx(sk, BBR_BW_PROBE_CRUISE);
+}
+
+/* Loss or ECN says inflight was too high: remember the safe level in
+ * inflight_hi and stop probing.
+ */
+static void bbr_handle_inflight_too_high(struct sock *sk,
+					 const struct rate_sample *rs)
+{
+	struct bbr *bbr = inet_csk_ca(sk);
+
+	bbr->bw_probe_samples = 0;  /* only react once per probe */
+	if (!rs->is_app_limited)
+		bbr->inflight_hi = max_t(u32, rs->tx_in_flight,
+					 (u64)bbr_target_inflight(sk) *
+					 (BBR_UNIT - bbr_beta) >> BBR_SCALE);
+	if (bbr->mode == BBR_PROBE_BW && bbr->cycle_idx == BBR_BW_PROBE_UP)
+		bbr_start_bw_probe_down(sk);
+}
+
+/* Update inflight_hi from what the probe found. Returns true if the probe
+ * was stopped for driving inflight too high.
+ */
+static bool bbr_adapt_upper_bounds(struct sock *sk,
+				   const struct rate_sample *rs)
+{
+	struct bbr *bbr = inet_csk_ca(sk);
+
+	if (bbr->bw_probe_samples && bbr_is_inflight_too_high(sk, rs)) {
+		bbr_handle_inflight_too_high(sk, rs);
+		return true;
+	}
+
+	if (bbr->inflight_hi == ~0U || rs->is_app_limited)
+		return false;
+
+	/* Loss or marks were fine, so what was in flight is a safe level. */
+	if (rs->tx_in_flight > bbr->inflight_hi)
+		bbr->inflight_hi = rs->tx_in_flight;
+
+	if (bbr->mode == BBR_PROBE_BW && bbr->cycle_idx == BBR_BW_PROBE_UP)
+		bbr_probe_inflight_hi_upward(sk, rs);
+	return false;
+}
+
+/* Is it time to probe for bw again? Either the wall clock wait has passed,
+ * or, so as to be fair to a Reno or CUBIC flow with the same BDP, as many
+ * rounds have gone by as such a flow would need to regrow one BDP after a
+ * loss.
+ */
+static bool bbr_is_time_to_probe_bw(struct sock *sk)
+{
+	struct bbr *bbr = inet_csk_ca(sk);
+	u32 rounds;
+
+	if (bbr_has_elapsed_in_phase(sk, bbr->probe_wait_us)) {
+		bbr_start_bw_probe_refill(sk);
+		return true;
+	}
+
+	rounds = min(bbr_target_inflight(sk), bbr_bw_probe_max_rounds);
+	if (bbr->rounds_since_probe >= rounds) {
+		bbr_start_bw_probe_refill(sk);
+		return true;
+	}
+	return false;
+}
+
+/* In DOWN, cruise once the queue of the last probe seems drained, and the
+ * headroom below inflight_hi is free.
+ */
+static bool bbr_check_time_to_cruise(struct sock *sk, u32 inflight, u32 bw)
+{
+	if (inflight > bbr_inflight_with_headroom(sk))
+		return false;
+
+	return inflight <= bbr_inflight(sk, bw, BBR_UNIT);
+}
+
+/* Move through the phases of the PROBE_BW cycle. */
+static void bbr_update_cycle_phase(struct sock *sk,
+				   const struct rate_sample *rs)
+{
+	struct bbr *bbr = inet_csk_ca(sk);
+	u32 inflight, bw;
+
+	if (!bbr_full_bw_reached(sk))
+		return;
+
+	if (bbr_adapt_upper_bounds(sk, rs))
+		return;  /* already moved to BBR_BW_PROBE_DOWN */
+
+	if (bbr->mode != BBR_PROBE_BW)
+		return;
+
+	inflight = rs->prior_in_flight;  /* what was in-flight before ACK? */
+	bw = bbr_max_bw(sk);
+
+	switch (bbr->cycle_idx) {
+	case BBR_BW_PROBE_DOWN:
+		if (bbr_is_time_to_probe_bw(sk))
+			return;  /* already moved to BBR_BW_PROBE_REFILL */
+		if (bbr_check_time_to_cruise(sk, inflight, bw))
+			bbr_start_bw_probe_cruise(sk);
+		break;
+	case BBR_BW_PROBE_CRUISE:
+		bbr_is_time_to_probe_bw(sk);
+		break;
+	case BBR_BW_PROBE_REFILL:
+		/* After one round of refilling, start probing up. */
+		if (bbr->round_start)
+			bbr_start_bw_probe_up(sk);
+		break;
+	case BBR_BW_PROBE_UP:
+		/* Go down once inflight reached its target for the probe, and
+		 * the probe had at least a min_rtt to show bw growth.
+		 */
+		if (bbr_has_elapsed_in_phase(sk, bbr->min_rtt_us) &&
+		    inflight > bbr_inflight(sk, bw,
+					    bbr_pacing_gain[BBR_BW_PROBE_UP]))
+			bbr_start_bw_probe_down(sk);
+		break;
+	}
+}
+
+static void bbr_reset_startup_mode(struct sock *sk)
+{
+	struct bbr *bbr = inet_csk_ca(sk);
+
+	bbr->mode = BBR_STARTUP;
+	bbr->pacing_gain = bbr_high_gain;
+	bbr->cwnd_gain	 = bbr_high_gain;
+}
+
+static void bbr_reset_probe_bw_mode(struct sock *sk)
+{
+	struct bbr *bbr = inet_csk_ca(sk);
+
+	bbr->mode = BBR_PROBE_BW;
+	bbr->cwnd_gain = bbr_cwnd_gain;
+	bbr_start_bw_probe_down(sk);
+}
+
+/* At the end of a round with loss or ECN marks, cut the lower bounds. */
+static void bbr_adapt_lower_bounds(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr *bbr = inet_csk_ca(sk);
+	u32 ecn_inflight_lo = ~0U;
+
+	/* Probing is about raising inflight; the bounds would undo it. */
+	if (bbr_is_probing_bandwidth(sk))
+		return;
+
+	if (bbr->ecn_in_round && bbr_ecn_eligible(sk)) {
+		if (bbr->inflight_lo == ~0U)
+			bbr->inflight_lo = tp->snd_cwnd;
+		ecn_inflight_lo = (u64)bbr->inflight_lo *
+				  (BBR_UNIT - ((bbr->ecn_alpha *
+						bbr_ecn_factor) >> BBR_SCALE))
+				  >> BBR_SCALE;
+	}
+
+	if (bbr->loss_in_round) {
+		if (bbr->bw_lo == ~0U)
+			bbr->bw_lo = bbr_max_bw(sk);
+		if (bbr->inflight_lo == ~0U)
+			bbr->inflight_lo = tp->snd_cwnd;
+		bbr->bw_lo = max_t(u32, bbr->bw_latest,
+				   (u64)bbr->bw_lo * (BBR_UNIT - bbr_beta) >>
+				   BBR_SCALE);
+		bbr->inflight_lo = max_t(u32, bbr->inflight_latest,
+					 (u64)bbr->inflight_lo *
+					 (BBR_UNIT - bbr_beta) >> BBR_SCALE);
+	}
+
+	bbr->inflight_lo = min(bbr->inflight_lo, ecn_inflight_lo);
+}
+
+/* Update ecn_alpha with the fraction of delivered packets marked this round,
+ * as DCTCP does once per window of data.
+ */
+static void bbr_update_ecn_alpha(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr *bbr = inet_csk_ca(sk);
+	u32 delivered, ce, ce_ratio;
+
+	if (!bbr_ecn_eligible(sk))
+		return;
+
+	delivered = tp->delivered - bbr->round_delivered;
+	if (!delivered)
+		return;
+	ce = tp->delivered_ce - bbr->round_ce;
+	ce_ratio = min_t(u64, div_u64((u64)ce * BBR_UNIT, delivered), BBR_UNIT);
+	bbr->ecn_alpha = ((BBR_UNIT - bbr_ecn_alpha_gain) * bbr->ecn_alpha +
+			  bbr_ecn_alpha_gain * ce_ratio) >> BBR_SCALE;
+}
+
+/* In STARTUP, a round with excess loss or ECN marks also means the pipe is
+ * full: stop there and remember how much fit.
+ */
+static void bbr_check_queue_too_high_in_startup(struct sock *sk,
+						const struct rate_sample *rs)
+{
+	struct bbr *bbr = inet_csk_ca(sk);
+	bool too_high = false;
+
+	if (bbr_full_bw_reached(sk))
+		return;
+
+	if (bbr->loss_in_round && bbr->loss_events >= bbr_full_loss_cnt &&
+	    bbr_is_inflight_too_high(sk, rs))
+		too_high = true;
+
+	if (bbr->ecn_in_round && bbr_ecn_eligible(sk) &&
+	    bbr_is_inflight_too_high(sk, rs)) {
+		if (++bbr->startup_ecn_rounds >= bbr_full_ecn_cnt)
+			too_high = true;
+	} else {
+		bbr->startup_ecn_rounds = 0;
+	}
+
+	if (too_high) {
+		bbr->full_bw_reached = 1;
+		bbr->inflight_hi = bbr_inflight(sk, bbr_max_bw(sk), BBR_UNIT);
+	}
+}
+
+/* Note loss and ECN marks reported by this ACK. */
+static void bbr_note_congestion_signals(struct sock *sk,
+					const struct rate_sample *rs)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr *bbr = inet_csk_ca(sk);
+
+	if (rs->losses) {
+		bbr->loss_in_round = 1;
+		if (bbr->loss_events < 0xf)
+			bbr->loss_events++;
+	}
+	if (tp->delivered_ce != bbr->round_ce)
+		bbr->ecn_in_round = 1;
+}
+
+/* At the end of each round, act on its loss and ECN marks. */
+static void bbr_update_congestion_signals(struct sock *sk,
+					  const struct rate_sample *rs)
+{
+	struct bbr *bbr = inet_csk_ca(sk);
+
+	if (!bbr->round_start)
+		return;
+
+	bbr_check_queue_too_high_in_startup(sk, rs);
+	bbr_update_ecn_alpha(sk);
+	bbr_adapt_lower_bounds(sk);
+	bbr_reset_congestion_signals(sk);
+}
+
+/* Estimate the bandwidth based on how fast packets are delivered */
+static void bbr_update_bw(struct sock *sk, const struct rate_sample *rs)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr *bbr = inet_csk_ca(sk);
+	u64 bw;
+
+	bbr->round_start = 0;
+	bbr_note_congestion_signals(sk, rs);
+	if (rs->delivered < 0 || rs->interval_us <= 0)
+		return; /* Not a valid observation */
+
+	/* See if we've reached the next RTT */
+	if (!before(rs->prior_delivered, bbr->next_rtt_delivered)) {
+		bbr->next_rtt_delivered = tp->delivered;
+		bbr->round_start = 1;
+		bbr->packet_conservation = 0;
+		if (bbr->rounds_since_probe < 0xff)
+			bbr->rounds_since_probe++;
+	}
+
+	/* Divide delivered by the interval to find a (lower bound) bottleneck
+	 * bandwidth sample. Delivered is in packets and interval_us in uS and
+	 * ratio will be <<1 for most connections. So delivered is first scaled.
+	 */
+	bw = (u64)rs->delivered * BW_UNIT;
+	do_div(bw, rs->interval_us);
+
+	/* Let the end of round see this round's latest values. */
+	bbr_update_congestion_signals(sk, rs);
+	bbr->bw_latest = max_t(u32, bbr->bw_latest, bw);
+	bbr->inflight_latest = max_t(u32, bbr->inflight_latest, rs->delivered);
+
+	/* As in BBR, app-limited samples only count if they are no lower than
+	 * the current model.
+	 */
+	if (!rs->is_app_limited || bw >= bbr_max_bw(sk))
+		bbr->bw_hi[1] = max_t(u32, bbr->bw_hi[1], bw);
+}
+
+/* Estimate when the pipe is full, using the change in delivery rate: BBR
+ * estimates that STARTUP filled the pipe if the estimated bw hasn't changed by
+ * at least bbr_full_bw_thresh (25%) after bbr_full_bw_cnt (3) non-app-limited
+ * rounds. See tcp_bbr.c.
+ */
+static void bbr_check_full_bw_reached(struct sock *sk,
+				      const struct rate_sample *rs)
+{
+	struct bbr *bbr = inet_csk_ca(sk);
+	u32 bw_thresh;
+
+	if (bbr_full_bw_reached(sk) || !bbr->round_start || rs->is_app_limited)
+		return;
+
+	bw_thresh = (u64)bbr->full_bw * bbr_full_bw_thresh >> BBR_SCALE;
+	if (bbr_max_bw(sk) >= bw_thresh) {
+		bbr->full_bw = bbr_max_bw(sk);
+		bbr->full_bw_cnt = 0;
+		return;
+	}
+	++bbr->full_bw_cnt;
+	bbr->full_bw_reached = bbr->full_bw_cnt >= bbr_full_bw_cnt;
+}
+
+/* If pipe is probably full, drain the queue and then enter steady-state. */
+static void bbr_check_drain(struct sock *sk, const struct rate_sample *rs)
+{
+	struct bbr *bbr = inet_csk_ca(sk);
+
+	if (bbr->mode == BBR_STARTUP && bbr_full_bw_reached(sk)) {
+		bbr->mode = BBR_DRAIN;	/* drain queue we created */
+		bbr->pacing_gain = bbr_drain_gain;	/* pace slow to drain */
+		bbr->cwnd_gain = bbr_high_gain;	/* maintain cwnd */
+		tcp_sk(sk)->snd_ssthresh =
+				bbr_inflight(sk, bbr_max_bw(sk), BBR_UNIT);
+	}	/* fall through to check if in-flight is already small: */
+	if (bbr->mode == BBR_DRAIN &&
+	    tcp_packets_in_flight(tcp_sk(sk)) <=
+	    bbr_inflight(sk, bbr_max_bw(sk), BBR_UNIT)) {
+		bbr_reset_probe_bw_mode(sk);  /* we estimate queue is drained */
+		bbr_start_bw_probe_cruise(sk);
+	}
+}
+
+static void bbr_check_probe_rtt_done(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr *bbr = inet_csk_ca(sk);
+
+	if (!(bbr->probe_rtt_done_stamp &&
+	      after(tcp_jiffies32, bbr->probe_rtt_done_stamp)))
+		return;
+
+	/* wait a while until PROBE_RTT */
+	bbr->probe_rtt_min_stamp = tcp_jiffies32;
+	tp->snd_cwnd = max(tp->snd_cwnd, bbr->prior_cwnd);
+
+	/* The lower bounds were made with a different cwnd; start afresh. */
+	bbr_reset_lower_bounds(sk);
+	if (!bbr_full_bw_reached(sk)) {
+		bbr_reset_startup_mode(sk);
+	} else {
+		bbr_reset_probe_bw_mode(sk);
+		bbr_start_bw_probe_cruise(sk);
+	}
+}
+
+/* The goal of PROBE_RTT mode is to have flows cooperatively and periodically
+ * drain the bottleneck queue, to converge to measure the true min_rtt. See
+ * tcp_bbr.c. BBR2 enters PROBE_RTT more often than BBR, when min_rtt has not
+ * been seen again for bbr_probe_rtt_win_ms (5 s), but it only cuts cwnd to
+ * half the BDP rather than to 4 packets, so the cost stays about as low.
+ * min_rtt itself still comes from a bbr_min_rtt_win_sec (10 s) window.
+ */
+static void bbr_update_min_rtt(struct sock *sk, const struct rate_sample *rs)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr *bbr = inet_csk_ca(sk);
+	bool probe_rtt_expired, min_rtt_expired;
+
+	/* Track min RTT in probe_rtt_win_ms to time probing for min_rtt. */
+	probe_rtt_expired = after(tcp_jiffies32,
+				  bbr->probe_rtt_min_stamp +
+				  msecs_to_jiffies(bbr_probe_rtt_win_ms));
+	if (rs->rtt_us >= 0 &&
+	    (rs->rtt_us <= bbr->probe_rtt_min_us ||
+	     (probe_rtt_expired && !rs->is_ack_delayed))) {
+		bbr->probe_rtt_min_us = rs->rtt_us;
+		bbr->probe_rtt_min_stamp = tcp_jiffies32;
+	}
+	/* Track min RTT seen in the min_rtt_win_sec filter window: */
+	min_rtt_expired = after(tcp_jiffies32,
+				bbr->min_rtt_stamp + bbr_min_rtt_win_sec * HZ);
+	if (bbr->probe_rtt_min_us <= bbr->min_rtt_us || min_rtt_expired) {
+		bbr->min_rtt_us = bbr->probe_rtt_min_us;
+		bbr->min_rtt_stamp = bbr->probe_rtt_min_stamp;
+	}
+
+	if (bbr_probe_rtt_mode_ms > 0 && probe_rtt_expired &&
+	    !bbr->idle_restart && bbr->mode != BBR_PROBE_RTT) {
+		bbr->mode = BBR_PROBE_RTT;  /* dip, drain queue */
+		bbr->pacing_gain = BBR_UNIT;
+		bbr->cwnd_gain = BBR_UNIT;
+		bbr_save_cwnd(sk);  /* note cwnd so we can restore it */
+		bbr->probe_rtt_done_stamp = 0;
+	}
+
+	if (bbr->mode == BBR_PROBE_RTT) {
+		/* Ignore low rate samples during this mode. */
+		tp->app_limited =
+			(tp->delivered + tcp_packets_in_flight(tp)) ? : 1;
+		/* Maintain reduced inflight for max(200 ms, 1 round). */
+		if (!bbr->probe_rtt_done_stamp &&
+		    tcp_packets_in_flight(tp) <= bbr_probe_rtt_cwnd(sk)) {
+			bbr->probe_rtt_done_stamp = tcp_jiffies32 +
+				msecs_to_jiffies(bbr_probe_rtt_mode_ms);
+			bbr->probe_rtt_round_done = 0;
+			bbr->next_rtt_delivered = tp->delivered;
+		} else if (bbr->probe_rtt_done_stamp) {
+			if (bbr->round_start)
+				bbr->probe_rtt_round_done = 1;
+			if (bbr->probe_rtt_round_done)
+				bbr_check_probe_rtt_done(sk);
+		}
+	}
+	/* Restart after idle ends only once we process a new S/ACK for data */
+	if (rs->delivered > 0)
+		bbr->idle_restart = 0;
+}
+
+static void bbr_update_model(struct sock *sk, const struct rate_sample *rs)
+{
+	bbr_update_bw(sk, rs);
+	bbr_update_cycle_phase(sk, rs);
+	bbr_check_full_bw_reached(sk, rs);
+	bbr_check_drain(sk, rs);
+	bbr_update_min_rtt(sk, rs);
+}
+
+static void bbr_main(struct sock *sk, const struct rate_sample *rs)
+{
+	struct bbr *bbr = inet_csk_ca(sk);
+	u32 bw;
+
+	bbr_update_model(sk, rs);
+
+	bw = bbr_bw(sk);
+	bbr_set_pacing_rate(sk, bw, bbr->pacing_gain);
+	bbr_set_cwnd(sk, rs, rs->acked_sacked, bw, bbr->cwnd_gain);
+}
+
+static void bbr_init(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr *bbr = inet_csk_ca(sk);
+
+	memset(bbr, 0, sizeof(*bbr));
+	tp->snd_ssthresh = TCP_INFINITE_SSTHRESH;
+	bbr->prev_ca_state = TCP_CA_Open;
+
+	bbr->min_rtt_us = tcp_min_rtt(tp);
+	bbr->min_rtt_stamp = tcp_jiffies32;
+	bbr->probe_rtt_min_us = bbr->min_rtt_us;
+	bbr->probe_rtt_min_stamp = tcp_jiffies32;
+
+	bbr_init_pacing_rate_from_rtt(sk);
+
+	bbr->inflight_hi = ~0U;
+	bbr_reset_lower_bounds(sk);
+	bbr->bw_probe_up_cnt = ~0U;
+	bbr->ecn_alpha = bbr_ecn_alpha_init;
+	bbr_reset_congestion_signals(sk);
+	bbr_reset_startup_mode(sk);
+
+	cmpxchg(&sk->sk_pacing_status, SK_PACING_NONE, SK_PACING_NEEDED);
+}
+
+static u32 bbr_sndbuf_expand(struct sock *sk)
+{
+	/* Provision 3 * cwnd since BBR may slow-start even during recovery. */
+	return 3;
+}
+
+/* The loss episode was spurious: the lower bounds it caused are too. */
+static u32 bbr_undo_cwnd(struct sock *sk)
+{
+	struct bbr *bbr = inet_csk_ca(sk);
+
+	bbr->full_bw = 0;   /* spurious slow-down; reset full pipe detection */
+	bbr->full_bw_cnt = 0;
+	bbr->loss_in_round = 0;
+	bbr_reset_lower_bounds(sk);
+	return tcp_sk(sk)->snd_cwnd;
+}
+
+/* Entering loss recovery, so save cwnd for when we exit or undo recovery. */
+static u32 bbr_ssthresh(struct sock *sk)
+{
+	bbr_save_cwnd(sk);
+	return tcp_sk(sk)->snd_ssthresh;
+}
+
+static size_t bbr_get_info(struct sock *sk, u32 ext, int *attr,
+			   union tcp_cc_info *info)
+{
+	if (ext & (1 << (INET_DIAG_BBRINFO - 1)) ||
+	    ext & (1 << (INET_DIAG_VEGASINFO - 1))) {
+		struct tcp_sock *tp = tcp_sk(sk);
+		struct bbr *bbr = inet_csk_ca(sk);
+		u64 bw = bbr_bw(sk);
+
+		bw = bw * tp->mss_cache * USEC_PER_SEC >> BW_SCALE;
+		memset(&info->bbr, 0, sizeof(info->bbr));
+		info->bbr.bbr_bw_lo		= (u32)bw;
+		info->bbr.bbr_bw_hi		= (u32)(bw >> 32);
+		info->bbr.bbr_min_rtt		= bbr->min_rtt_us;
+		info->bbr.bbr_pacing_gain	= bbr->pacing_gain;
+		info->bbr.bbr_cwnd_gain		= bbr->cwnd_gain;
+		*attr = INET_DIAG_BBRINFO;
+		return sizeof(info->bbr);
+	}
+	return 0;
+}
+
+static void bbr_set_state(struct sock *sk, u8 new_state)
+{
+	struct bbr *bbr = inet_csk_ca(sk);
+
+	if (new_state == TCP_CA_Loss) {
+		bbr->prev_ca_state = TCP_CA_Loss;
+		bbr->full_bw = 0;
+		/* An RTO is the strongest loss signal: bound inflight by what
+		 * was in flight before it, unless we were probing.
+		 */
+		if (!bbr_is_probing_bandwidth(sk) && bbr->inflight_lo == ~0U)
+			bbr->inflight_lo = bbr->prior_cwnd;
+	}
+}
+
+static struct tcp_congestion_ops tcp_bbr2_cong_ops __read_mostly = {
+	.flags		= TCP_CONG_NON_RESTRICTED,
+	.name		= "bbr2",
+	.owner		= THIS_MODULE,
+	.init		= bbr_init,
+	.cong_control	= bbr_main,
+	.sndbuf_expand	= bbr_sndbuf_expand,
+	.undo_cwnd	= bbr_undo_cwnd,
+	.cwnd_event	= bbr_cwnd_event,
+	.ssthresh	= bbr_ssthresh,
+	.min_tso_segs	= bbr_min_tso_segs,
+	.get_info	= bbr_get_info,
+	.set_state	= bbr_set_state,
+};
+
+static int __init bbr_register(void)
+{
+	BUILD_BUG_ON(sizeof(struct bbr) > ICSK_CA_PRIV_SIZE);
+	return tcp_register_congestion_control(&tcp_bbr2_cong_ops);
+}
+
+static void __exit bbr_unregister(void)
+{
+	tcp_unregister_congestion_control(&tcp_bbr2_cong_ops);
+}
+
+module_init(bbr_register);
+module_exit(bbr_unregister);
+
+MODULE_AUTHOR("Van Jacobson <vanj@google.com>");
+MODULE_AUTHOR("Neal Cardwell <ncardwell@google.com>");
+MODULE_AUTHOR("Yuchung Cheng <ycheng@google.com>");
+MODULE_AUTHOR("Soheil Hassas Yeganeh <soheil@google.com>");
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("TCP BBR2 (Bottleneck Bandwidth and RTT, version 2)");
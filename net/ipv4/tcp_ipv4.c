@@ -81,6 +81,7 @@
 #include <linux/proc_fs.h>
 #include <linux/seq_file.h>
 #include <linux/inetdevice.h>
+#include <linux/bpf.h>
 
 #include <crypto/hash.h>
 #include <linux/scatterlist.h>
@@ -1745,13 +1746,19 @@ int tcp_v4_rcv(struct sk_buff *skb)
 			goto csum_error;
 		}
 		if (unlikely(sk->sk_state != TCP_LISTEN)) {
-			inet_csk_reqsk_queue_drop_and_put(sk, req);
-			goto lookup;
+			nsk = reuseport_migrate_sock(sk, req_to_sk(req), skb);
+			if (!nsk) {
+				inet_csk_reqsk_queue_drop_and_put(sk, req);
+				goto lookup;
+			}
+			/* migrated to nsk, which is held already */
+			sk = nsk;
+		} else {
+			/* We own a reference on the listener, increase it again
+			 * as we might lose it too soon.
+			 */
+			sock_hold(sk);
 		}
-		/* We own a reference on the listener, increase it again
-		 * as we might lose it too soon.
-		 */
-		sock_hold(sk);
 		refcounted = true;
 		nsk = NULL;
 		if (!tcp_filter(sk, skb)) {
@@ -2011,6 +2018,23 @@ EXPORT_SYMBOL(tcp_v4_destroy_sock);
 #ifdef CONFIG_PROC_FS
 /* Proc filesystem TCP sock list dumping. */
 
+static struct tcp_seq_afinfo *tcp_seq_afinfo(struct seq_file *seq)
+{
+#ifdef CONFIG_BPF_SYSCALL
+	struct tcp_iter_state *st = seq->private;
+
+	if (st->bpf_seq_afinfo)
+		return st->bpf_seq_afinfo;
+#endif
+	return PDE_DATA(file_inode(seq->file));
+}
+
+static bool tcp_seq_family_match(const struct tcp_seq_afinfo *afinfo,
+				 const struct sock *sk)
+{
+	return afinfo->family == AF_UNSPEC || sk->sk_family == afinfo->family;
+}
+
 /*
  * Get next listener socket follow cur.  If cur is NULL, get first socket
  * starting from bucket given in st->bucket; when st->bucket is zero the
@@ -2018,7 +2042,7 @@ EXPORT_SYMBOL(tcp_v4_destroy_sock);
  */
 static void *listening_get_next(struct seq_file *seq, void *cur)
 {
-	struct tcp_seq_afinfo *afinfo = PDE_DATA(file_inode(seq->file));
+	struct tcp_seq_afinfo *afinfo = tcp_seq_afinfo(seq);
 	struct tcp_iter_state *st = seq->private;
 	struct net *net = seq_file_net(seq);
 	struct inet_listen_hashbucket *ilb;
@@ -2041,7 +2065,7 @@ static void *listening_get_next(struct seq_file *seq, void *cur)
 	sk_for_each_from(sk) {
 		if (!net_eq(sock_net(sk), net))
 			continue;
-		if (sk->sk_family == afinfo->family)
+		if (tcp_seq_family_match(afinfo, sk))
 			return sk;
 	}
 	spin_unlock(&ilb->lock);
@@ -2078,7 +2102,7 @@ static inline bool empty_bucket(const struct tcp_iter_state *st)
  */
 static void *established_get_first(struct seq_file *seq)
 {
-	struct tcp_seq_afinfo *afinfo = PDE_DATA(file_inode(seq->file));
+	struct tcp_seq_afinfo *afinfo = tcp_seq_afinfo(seq);
 	struct tcp_iter_state *st = seq->private;
 	struct net *net = seq_file_net(seq);
 	void *rc = NULL;
@@ -2095,7 +2119,7 @@ static void *established_get_first(struct seq_file *seq)
 
 		spin_lock_bh(lock);
 		sk_nulls_for_each(sk, node, &tcp_hashinfo.ehash[st->bucket].chain) {
-			if (sk->sk_family != afinfo->family ||
+			if (!tcp_seq_family_match(afinfo, sk) ||
 			    !net_eq(sock_net(sk), net)) {
 				continue;
 			}
@@ -2110,7 +2134,7 @@ static void *established_get_first(struct seq_file *seq)
 
 static void *established_get_next(struct seq_file *seq, void *cur)
 {
-	struct tcp_seq_afinfo *afinfo = PDE_DATA(file_inode(seq->file));
+	struct tcp_seq_afinfo *afinfo = tcp_seq_afinfo(seq);
 	struct sock *sk = cur;
 	struct hlist_nulls_node *node;
 	struct tcp_iter_state *st = seq->private;
@@ -2122,7 +2146,7 @@ static void *established_get_next(struct seq_file *seq, void *cur)
 	sk = sk_nulls_next(sk);
 
 	sk_nulls_for_each_from(sk, node) {
-		if (sk->sk_family == afinfo->family &&
+		if (tcp_seq_family_match(afinfo, sk) &&
 		    net_eq(sock_net(sk), net))
 			return sk;
 	}
@@ -2438,6 +2462,81 @@ void tcp4_proc_exit(void)
 {
 	unregister_pernet_subsys(&tcp4_net_ops);
 }
+
+#ifdef CONFIG_BPF_SYSCALL
+/*
+ * bpf_iter_tcp: the listening, established and time-wait TCP sockets of
+ * both families in the opener's netns, the same walk as /proc/net/tcp.
+ * ctx[2] is the struct sock_common * and ctx[3] the owner's uid, 0 for
+ * time-wait sockets; skc_state tells what the socket really is.
+ */
+static struct tcp_seq_afinfo bpf_iter_tcp_afinfo = {
+	.family		= AF_UNSPEC,
+};
+
+static int bpf_iter_tcp_seq_show(struct seq_file *seq, void *v)
+{
+	struct sock_common *skc = v;
+	uid_t uid = 0;
+	u64 args[4];
+
+	if (v == SEQ_START_TOKEN)
+		return 0;
+
+	if (skc->skc_state == TCP_NEW_SYN_RECV) {
+		const struct request_sock *req = v;
+
+		uid = from_kuid_munged(seq_user_ns(seq),
+				       sock_i_uid(req->rsk_listener));
+	} else if (skc->skc_state != TCP_TIME_WAIT) {
+		uid = from_kuid_munged(seq_user_ns(seq), sock_i_uid(v));
+	}
+
+	args[2] = (unsigned long)skc;
+	args[3] = uid;
+	return bpf_iter_run_prog(seq, args, false);
+}
+
+static void bpf_iter_tcp_seq_stop(struct seq_file *seq, void *v)
+{
+	if (!v) {
+		u64 args[4] = {};
+
+		bpf_iter_run_prog(seq, args, true);
+	}
+	tcp_seq_stop(seq, v);
+}
+
+static const struct seq_operations bpf_iter_tcp_seq_ops = {
+	.show		= bpf_iter_tcp_seq_show,
+	.start		= tcp_seq_start,
+	.next		= tcp_seq_next,
+	.stop		= bpf_iter_tcp_seq_stop,
+};
+
+static int bpf_iter_init_tcp(void *priv_data)
+{
+	struct tcp_iter_state *st = priv_data;
+
+	st->bpf_seq_afinfo = &bpf_iter_tcp_afinfo;
+	return bpf_iter_init_seq_net(priv_data);
+}
+
+static struct bpf_iter_reg tcp_reg_info = {
+	.target			= "tcp",
+	.seq_ops		= &bpf_iter_tcp_seq_ops,
+	.init_seq_private	= bpf_iter_init_tcp,
+	.fini_seq_private	= bpf_iter_fini_seq_net,
+	.seq_priv_size		= sizeof(struct tcp_iter_state),
+	.num_args		= 4,
+};
+
+static void __init bpf_iter_register(void)
+{
+	if (bpf_iter_reg_target(&tcp_reg_info))
+		pr_warn("Warning: could not register bpf iterator tcp\n");
+}
+#endif /* CONFIG_BPF_SYSCALL */
 #endif /* CONFIG_PROC_FS */
 
 struct proto tcp_prot = {
@@ -2469,6 +2568,7 @@ struct proto tcp_prot = {
 	.sockets_allocated	= &tcp_sockets_allocated,
 	.orphan_count		= &tcp_orphan_count,
 	.memory_allocated	= &tcp_memory_allocated,
+	.per_cpu_fw_alloc	= &tcp_memory_per_cpu_fw_alloc,
 	.memory_pressure	= &tcp_memory_pressure,
 	.sysctl_mem		= sysctl_tcp_mem,
 	.sysctl_wmem_offset	= offsetof(struct net, ipv4.sysctl_tcp_wmem),
@@ -2595,7 +2695,10 @@ static int __net_init tcp_sk_init(struct net *net)
 		       sizeof(init_net.ipv4.sysctl_tcp_wmem));
 	}
 	net->ipv4.sysctl_tcp_comp_sack_delay_ns = NSEC_PER_MSEC;
+	net->ipv4.sysctl_tcp_comp_sack_slack_ns = 100 * NSEC_PER_USEC;
+	net->ipv4.sysctl_tcp_pacing_slack_ns = 10 * NSEC_PER_USEC;
 	net->ipv4.sysctl_tcp_comp_sack_nr = 44;
+	net->ipv4.sysctl_tcp_migrate_req = 0;
 	net->ipv4.sysctl_tcp_fastopen = TFO_CLIENT_ENABLE;
 	spin_lock_init(&net->ipv4.tcp_fastopen_ctx_lock);
 	net->ipv4.sysctl_tcp_fastopen_blackhole_timeout = 60 * 60;
@@ -2636,4 +2739,8 @@ void __init tcp_v4_init(void)
 {
 	if (register_pernet_subsys(&tcp_sk_ops))
 		panic("Failed to create the TCP control socket.\n");
+
+#if defined(CONFIG_BPF_SYSCALL) && defined(CONFIG_PROC_FS)
+	bpf_iter_register();
+#endif
 }
@@ -977,9 +977,11 @@ static void tcp_internal_pacing(struct sock *sk, const struct sk_buff *skb)
 
 	len_ns = (u64)skb->len * NSEC_PER_SEC;
 	do_div(len_ns, rate);
-	hrtimer_start(&tcp_sk(sk)->pacing_timer,
-		      ktime_add_ns(ktime_get(), len_ns),
-		      HRTIMER_MODE_ABS_PINNED_SOFT);
+	/* Batch the pacing timers of this cpu within a small slack. */
+	hrtimer_start_range_ns(&tcp_sk(sk)->pacing_timer,
+			       ktime_add_ns(ktime_get(), len_ns),
+			       sock_net(sk)->ipv4.sysctl_tcp_pacing_slack_ns,
+			       HRTIMER_MODE_ABS_PINNED_SOFT);
 	sock_hold(sk);
 }
 
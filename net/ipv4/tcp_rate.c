@@ -87,6 +87,8 @@ void tcp_rate_skb_delivered(struct sock *sk, struct sk_buff *skb,
 		rs->prior_mstamp     = scb->tx.delivered_mstamp;
 		rs->is_app_limited   = scb->tx.is_app_limited;
 		rs->is_retrans	     = scb->sacked & TCPCB_RETRANS;
+		rs->tx_in_flight     = DIV_ROUND_UP(scb->tx.in_flight,
+						    tp->mss_cache);
 
 		/* Find the duration of the "send phase" of this window: */
 		rs->interval_us      = tcp_stamp_us_delta(
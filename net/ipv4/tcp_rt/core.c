@@ -17,6 +17,8 @@ static int stats_buf_num = 2;
 
 static int stats;
 static int stats_interval = 60;
+static bool binary;
+static bool hist;
 
 module_param(stats, int, 0644);
 MODULE_PARM_DESC(stats, "stats is enable");
@@ -40,6 +42,10 @@ module_param(log_buf_num, int, 0644);
 MODULE_PARM_DESC(log_buf_num, "the num of buffers for every cpu log buffer. unit is 256k. just work when module load.");
 module_param(stats_buf_num, int, 0644);
 MODULE_PARM_DESC(stats_buf_num, "the num of buffers for every cpu stats buffer. unit is 16k. just work when module load.");
+module_param(binary, bool, 0444);
+MODULE_PARM_DESC(binary, "output fixed layout records of uapi/linux/tcp_rt.h instead of text. just work when module load.");
+module_param(hist, bool, 0444);
+MODULE_PARM_DESC(hist, "aggregate complete requests into per port histograms read from tcp-rt/hist instead of logging them. just work when module load.");
 
 struct timer_list tcp_rt_timer;
 
@@ -379,6 +385,41 @@ static int tcp_rt_sk_init(struct sock *sk)
 	return 0;
 }
 
+/* Describe the ports of histogram slot @type/@index, false if unused */
+bool tcp_rt_slot_desc(enum tcp_rt_type type, int index, char *buf, int len)
+{
+	switch (type) {
+	case TCPRT_TYPE_LOCAL_PORT:
+		if (index >= lports_number)
+			return false;
+		snprintf(buf, len, "lport %d", lports[index]);
+		return true;
+
+	case TCPRT_TYPE_LOCAL_PORT_RANG:
+		if (index >= lports_range_number / 2)
+			return false;
+		snprintf(buf, len, "lport %d-%d", lports_range[index * 2],
+			 lports_range[index * 2 + 1]);
+		return true;
+
+	case TCPRT_TYPE_PEER_PORT:
+		if (index >= pports_number)
+			return false;
+		snprintf(buf, len, "pport %d", pports[index]);
+		return true;
+
+	case TCPRT_TYPE_PEER_PORT_RANG:
+		if (index >= pports_range_number / 2)
+			return false;
+		snprintf(buf, len, "pport %d-%d", pports_range[index * 2],
+			 pports_range[index * 2 + 1]);
+		return true;
+
+	default:
+		return false;
+	}
+}
+
 static struct tcp_rt_ops rt_ops __read_mostly = {
 	.owner      = THIS_MODULE,
 	.init       = tcp_rt_sk_init,
@@ -405,7 +446,7 @@ static int __init tcp_rt_module_init(void)
 {
 	int ret;
 
-	ret = tcp_rt_output_init(log_buf_num, stats_buf_num, &fops);
+	ret = tcp_rt_output_init(log_buf_num, stats_buf_num, binary, hist, &fops);
 	if (ret)
 		return ret;
 
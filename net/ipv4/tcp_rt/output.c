@@ -1,6 +1,8 @@
 // SPDX-License-Identifier: GPL-2.0
 
 #include <linux/relay.h>
+#include <linux/seq_file.h>
+#include <trace/events/cgroup.h>
 #include "tcp_rt.h"
 
 #define CHUNK_SIZE      (4096)
@@ -11,6 +13,36 @@
 static struct rchan *relay_log;
 static struct rchan *relay_stats;
 static struct dentry *tcprt_dir;
+static bool binary_output;
+
+/*
+ * Log-linear histograms: values below HIST_SUB have a bucket each, above
+ * that every power of 2 is split into HIST_SUB buckets. That keeps the
+ * error below 25% over the whole u32 range of microseconds.
+ */
+#define HIST_SUB_BITS	2
+#define HIST_SUB	(1 << HIST_SUB_BITS)
+#define HIST_BUCKETS	((32 - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+#define HIST_SLOTS	(TCPRT_TYPE_PEER_PORT_RANG * PORT_MAX_NUM)
+
+enum {
+	HIST_RT,
+	HIST_SERVER_TIME,
+	HIST_RECV_TIME,
+	NR_HIST,
+};
+
+static const char * const hist_names[NR_HIST] = {
+	"rt", "server_time", "recv_time",
+};
+
+struct tcp_rt_hist {
+	u32 buckets[NR_HIST][HIST_BUCKETS];
+};
+
+/* One per configured port or range, indexed by tcp_rt type and index */
+static struct tcp_rt_hist __percpu *hist[HIST_SLOTS];
+static bool hist_output;
 
 static struct tcp_rt_stats *stats_local[CHUNK_COUNT];
 static struct tcp_rt_stats *stats_peer[CHUNK_COUNT];
@@ -104,6 +136,63 @@ static struct tcp_rt_stats *tcp_rt_get_stats(struct tcp_rt_stats **stats,
 	return p + (port - chunkid * PORTS_PER_CHUNK);
 }
 
+static int hist_idx(u32 v)
+{
+	int msb;
+
+	if (v < HIST_SUB)
+		return v;
+
+	msb = fls(v) - 1;
+	return ((msb - HIST_SUB_BITS + 1) << HIST_SUB_BITS) +
+	       ((v >> (msb - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+/* The largest value of bucket @idx */
+static u64 hist_upper(int idx)
+{
+	int msb, sub;
+
+	if (idx < HIST_SUB)
+		return idx;
+
+	msb = (idx >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+	sub = idx & (HIST_SUB - 1);
+	return ((u64)(HIST_SUB + sub + 1) << (msb - HIST_SUB_BITS)) - 1;
+}
+
+static inline int hist_slot(const struct tcp_rt *rt)
+{
+	return (rt->type - 1) * PORT_MAX_NUM + rt->index;
+}
+
+static void tcp_rt_hist_add(const struct tcp_rt *rt, u32 t_rt)
+{
+	struct tcp_rt_hist __percpu *h = hist[hist_slot(rt)];
+
+	this_cpu_inc(h->buckets[HIST_RT][hist_idx(t_rt)]);
+	this_cpu_inc(h->buckets[HIST_SERVER_TIME]
+			       [hist_idx(max(rt->server_time, 0))]);
+	this_cpu_inc(h->buckets[HIST_RECV_TIME]
+			       [hist_idx(max(rt->recv_time, 0))]);
+}
+
+/* Complete requests also go to the cgroup sli event stream */
+static void tcp_rt_sli_event(const struct sock *sk, char flag, u32 t_rt,
+			     u32 bytes)
+{
+#ifdef CONFIG_SOCK_CGROUP_DATA
+	struct cgroup *cgrp;
+
+	if (!trace_cgroup_sli_event_enabled())
+		return;
+
+	cgrp = sock_cgroup_ptr((struct sock_cgroup_data *)&sk->sk_cgrp_data);
+	trace_cgroup_sli_event(cgrp, 0, SLI_EVENT_NET_RT, flag,
+			       (u64)t_rt * NSEC_PER_USEC, bytes);
+#endif
+}
+
 #define  bufappend(buf, size, v)  \
 	ulong_format2((buf) + (size), (unsigned long)(v))
 
@@ -129,6 +218,31 @@ static int bufheader(char *buf, int size, char flag,
 	return n;
 }
 
+static void tcp_rt_log_binary(const struct sock *sk, char flag,
+			      unsigned long *vals, int n)
+{
+	struct tcp_rt *rt = TCP_SK_RT(sk);
+	struct tcp_rt_log_record rec = {
+		.hdr = {
+			.version = TCP_RT_RECORD_VERSION,
+			.flag    = flag,
+			.len     = sizeof(rec),
+		},
+		.start_sec  = rt->start_time.tv_sec,
+		.start_usec = rt->start_time.tv_nsec / 1000,
+		.daddr      = inet_sk(sk)->inet_daddr,
+		.saddr      = inet_sk(sk)->inet_saddr,
+		.dport      = ntohs(inet_sk(sk)->inet_dport),
+		.sport      = ntohs(inet_sk(sk)->inet_sport),
+	};
+	int i;
+
+	for (i = 0; i < n; i++)
+		rec.vals[i] = vals[i];
+
+	relay_write(relay_log, &rec, sizeof(rec));
+}
+
 void tcp_rt_log_printk(const struct sock *sk, char flag, bool fin, bool stats)
 {
 #define MAX_BUF_SIZE 512
@@ -136,9 +250,10 @@ void tcp_rt_log_printk(const struct sock *sk, char flag, bool fin, bool stats)
 	struct tcp_rt_stats *r;
 	struct tcp_sock *tp = tcp_sk(sk);
 	struct tcp_rt *rt = TCP_SK_RT(sk);
+	unsigned long vals[TCP_RT_LOG_NR_VALS];
 	char buf[MAX_BUF_SIZE];
-	int size = 0;
-	u32 t_rt;
+	int size, i, n = 0;
+	u32 t_rt = 0;
 	u32 t_seq, t_retrans, recv;
 	struct timespec64 now;
 	u32 mrtt;
@@ -160,19 +275,18 @@ void tcp_rt_log_printk(const struct sock *sk, char flag, bool fin, bool stats)
 
 		t_retrans = tp->total_retrans - rt->last_total_retrans;
 
-		size = bufheader(buf, size, flag, sk);
+		vals[n++] = t_seq;
+		vals[n++] = t_rt;
+		vals[n++] = mrtt;
+		vals[n++] = t_retrans;
+		vals[n++] = rt->request_num;
+		vals[n++] = rt->server_time;
+		vals[n++] = rt->recv_time;
+		vals[n++] = rt->recv_data;
+		vals[n++] = rt->rcv_reorder;
+		vals[n++] = tp->mss_cache;
 
-		size += bufappend(buf, size, t_seq);
-		size += bufappend(buf, size, t_rt);
-		size += bufappend(buf, size, mrtt);
-		size += bufappend(buf, size, t_retrans);
-		size += bufappend(buf, size, rt->request_num);
-		size += bufappend(buf, size, rt->server_time);
-		size += bufappend(buf, size, rt->recv_time);
-		size += bufappend(buf, size, rt->recv_data);
-		size += bufappend(buf, size, rt->rcv_reorder);
-		size += bufappend(buf, size, tp->mss_cache);
-		buf[size++] = '\n';
+		tcp_rt_sli_event(sk, flag, t_rt, t_seq);
 
 		if (stats && t_seq > 0) {
 			r = tcp_rt_get_local_stats_sk(sk);
@@ -196,20 +310,16 @@ void tcp_rt_log_printk(const struct sock *sk, char flag, bool fin, bool stats)
 		ktime_get_real_ts64(&now);
 		t_rt =	timespec64_dec(now, rt->start_time);
 
-		size = bufheader(buf, size, flag, sk);
-
-		size += bufappend(buf, size, tp->snd_nxt - rt->start_seq);
-		size += bufappend(buf, size, t_rt);
-		size += bufappend(buf, size, mrtt);
-		size += bufappend(buf, size,
-				  tp->total_retrans - rt->last_total_retrans);
-		size += bufappend(buf, size, rt->request_num);
-		size += bufappend(buf, size, rt->server_time);
-		size += bufappend(buf, size, rt->recv_time);
-		size += bufappend(buf, size, tp->snd_nxt - tp->snd_una);
-		size += bufappend(buf, size, rt->rcv_reorder);
-		size += bufappend(buf, size, tp->mss_cache);
-		buf[size++] = '\n';
+		vals[n++] = tp->snd_nxt - rt->start_seq;
+		vals[n++] = t_rt;
+		vals[n++] = mrtt;
+		vals[n++] = tp->total_retrans - rt->last_total_retrans;
+		vals[n++] = rt->request_num;
+		vals[n++] = rt->server_time;
+		vals[n++] = rt->recv_time;
+		vals[n++] = tp->snd_nxt - tp->snd_una;
+		vals[n++] = rt->rcv_reorder;
+		vals[n++] = tp->mss_cache;
 
 		if (stats && t_rt > HZ / 10) {
 			r = tcp_rt_get_local_stats_sk(sk);
@@ -224,26 +334,20 @@ void tcp_rt_log_printk(const struct sock *sk, char flag, bool fin, bool stats)
 		ktime_get_real_ts64(&now);
 		t_rt = timespec64_dec(now, rt->start_time);
 
-		size = bufheader(buf, size, flag, sk);
-
-		size += bufappend(buf, size, rt->request_num);
-		size += bufappend(buf, size, t_rt);
-		size += bufappend(buf, size, tp->rcv_nxt - rt->start_rcv_nxt);
-		size += bufappend(buf, size, rt->rcv_reorder);
-		size += bufappend(buf, size, tp->mss_cache);
-		buf[size++] = '\n';
+		vals[n++] = rt->request_num;
+		vals[n++] = t_rt;
+		vals[n++] = tp->rcv_nxt - rt->start_rcv_nxt;
+		vals[n++] = rt->rcv_reorder;
+		vals[n++] = tp->mss_cache;
 		break;
 
 	case LOG_STATUS_E:
-		size = bufheader(buf, size, flag, sk);
-
-		size += bufappend(buf, size, rt->request_num);
-		size += bufappend(buf, size, tp->snd_nxt - rt->con_start_seq);
-		size += bufappend(buf, size, tp->snd_nxt - tp->snd_una);
-		size += bufappend(buf, size, tp->rcv_nxt - rt->con_rcv_nxt);
-		size += bufappend(buf, size, tp->total_retrans);
-		size += bufappend(buf, size, mrtt);
-		buf[size++] = '\n';
+		vals[n++] = rt->request_num;
+		vals[n++] = tp->snd_nxt - rt->con_start_seq;
+		vals[n++] = tp->snd_nxt - tp->snd_una;
+		vals[n++] = tp->rcv_nxt - rt->con_rcv_nxt;
+		vals[n++] = tp->total_retrans;
+		vals[n++] = mrtt;
 		break;
 
 	case LOG_STATUS_P:
@@ -253,19 +357,18 @@ void tcp_rt_log_printk(const struct sock *sk, char flag, bool fin, bool stats)
 		t_retrans = tp->total_retrans - rt->last_total_retrans;
 		recv = tp->rcv_nxt - rt->start_rcv_nxt;
 
-		size = bufheader(buf, size, flag, sk);
+		vals[n++] = t_seq;
+		vals[n++] = t_rt;
+		vals[n++] = mrtt;
+		vals[n++] = t_retrans;
+		vals[n++] = rt->request_num;
+		vals[n++] = rt->server_time;
+		vals[n++] = rt->recv_time;
+		vals[n++] = recv;
+		vals[n++] = rt->rcv_reorder;
+		vals[n++] = tp->mss_cache;
 
-		size += bufappend(buf, size, t_seq);
-		size += bufappend(buf, size, t_rt);
-		size += bufappend(buf, size, mrtt);
-		size += bufappend(buf, size, t_retrans);
-		size += bufappend(buf, size, rt->request_num);
-		size += bufappend(buf, size, rt->server_time);
-		size += bufappend(buf, size, rt->recv_time);
-		size += bufappend(buf, size, recv);
-		size += bufappend(buf, size, rt->rcv_reorder);
-		size += bufappend(buf, size, tp->mss_cache);
-		buf[size++] = '\n';
+		tcp_rt_sli_event(sk, flag, t_rt, t_seq);
 
 		if (stats) {
 			r = tcp_rt_get_peer_stats_sk(sk);
@@ -284,10 +387,56 @@ void tcp_rt_log_printk(const struct sock *sk, char flag, bool fin, bool stats)
 			stats_add(r->rtt,         mrtt);
 		}
 		break;
+
+	default:
+		return;
 	}
 
-	if (relay_log)
-		relay_write(relay_log, buf, size);
+	/* Complete requests are aggregated instead of logged */
+	if (hist_output && (flag == LOG_STATUS_R || flag == LOG_STATUS_P)) {
+		tcp_rt_hist_add(rt, t_rt);
+		return;
+	}
+
+	if (!relay_log)
+		return;
+
+	if (binary_output) {
+		tcp_rt_log_binary(sk, flag, vals, n);
+		return;
+	}
+
+	size = bufheader(buf, 0, flag, sk);
+	for (i = 0; i < n; i++)
+		size += bufappend(buf, size, vals[i]);
+	buf[size++] = '\n';
+
+	relay_write(relay_log, buf, size);
+}
+
+static void tcp_rt_stats_binary(int port, char flag, struct _tcp_rt_stats *avg,
+				u64 number)
+{
+	struct tcp_rt_stats_record rec = {
+		.hdr = {
+			.version = TCP_RT_RECORD_VERSION,
+			.flag    = flag,
+			.len     = sizeof(rec),
+		},
+		.port        = port,
+		.time        = ktime_get_real_seconds(),
+		.rt          = avg->rt,
+		.server_time = avg->server_time,
+		.drop        = avg->drop,
+		.rtt         = avg->rtt,
+		.fail        = avg->fail,
+		.bytes       = avg->bytes,
+		.recv_time   = avg->recv_time,
+		.recv_data   = avg->recv_data,
+		.number      = number,
+	};
+
+	relay_write(relay_stats, &rec, sizeof(rec));
 }
 
 void tcp_rt_timer_output(int port, char *flag, bool alloc)
@@ -296,6 +445,7 @@ void tcp_rt_timer_output(int port, char *flag, bool alloc)
 	struct tcp_rt_stats **stats;
 	struct _tcp_rt_stats t;
 	struct _tcp_rt_stats avg = {0};
+	char kind = *flag;
 	int size;
 
 	char buf[MAX_BUF_SIZE];
@@ -338,14 +488,142 @@ void tcp_rt_timer_output(int port, char *flag, bool alloc)
 			avg.drop = 1000 * t.drop / t.packets;
 	}
 
+	if (!relay_stats)
+		return;
+
+	if (binary_output) {
+		tcp_rt_stats_binary(port, kind, &avg, t.number);
+		return;
+	}
+
 	size = snprintf(buf, sizeof(buf),
 			"%llu all %s%u %llu %llu %llu %llu %llu %llu %llu %llu %llu\n",
 			ktime_get_real_seconds(), flag, port, avg.rt,
 			avg.server_time, avg.drop, avg.rtt, avg.fail, avg.bytes,
 			avg.recv_time, avg.recv_data, t.number);
 
-	if (relay_stats)
-		relay_write(relay_stats, buf, size);
+	relay_write(relay_stats, buf, size);
+}
+
+static void hist_percentiles(struct seq_file *m, u64 *buckets)
+{
+	static const int permille[] = { 500, 900, 990, 999 };
+	u64 count = 0, sum = 0;
+	int i, p = 0;
+
+	for (i = 0; i < HIST_BUCKETS; i++)
+		count += buckets[i];
+
+	seq_printf(m, " count %llu", count);
+	if (!count) {
+		seq_puts(m, "\n");
+		return;
+	}
+
+	for (i = 0; i < HIST_BUCKETS && p < ARRAY_SIZE(permille); i++) {
+		sum += buckets[i];
+		while (p < ARRAY_SIZE(permille) &&
+		       sum * 1000 >= count * permille[p]) {
+			seq_printf(m, " p%d %llu", permille[p] % 100 ?
+				   permille[p] : permille[p] / 10,
+				   hist_upper(i));
+			p++;
+		}
+	}
+	seq_puts(m, "\n");
+}
+
+static int tcp_rt_hist_show(struct seq_file *m, void *v)
+{
+	char desc[32];
+	u64 *buckets;
+	int slot, i, j, cpu;
+
+	buckets = kmalloc_array(HIST_BUCKETS, sizeof(*buckets), GFP_KERNEL);
+	if (!buckets)
+		return -ENOMEM;
+
+	for (slot = 0; slot < HIST_SLOTS; slot++) {
+		if (!tcp_rt_slot_desc(slot / PORT_MAX_NUM + 1,
+				      slot % PORT_MAX_NUM, desc, sizeof(desc)))
+			continue;
+
+		for (i = 0; i < NR_HIST; i++) {
+			memset(buckets, 0, HIST_BUCKETS * sizeof(*buckets));
+			for_each_possible_cpu(cpu) {
+				struct tcp_rt_hist *h = per_cpu_ptr(hist[slot],
+								    cpu);
+
+				for (j = 0; j < HIST_BUCKETS; j++)
+					buckets[j] += h->buckets[i][j];
+			}
+
+			seq_printf(m, "%s %s", desc, hist_names[i]);
+			hist_percentiles(m, buckets);
+		}
+	}
+
+	kfree(buckets);
+	return 0;
+}
+
+static int tcp_rt_hist_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, tcp_rt_hist_show, NULL);
+}
+
+/* Any write clears the histograms */
+static ssize_t tcp_rt_hist_write(struct file *file, const char __user *buff,
+				 size_t count, loff_t *offset)
+{
+	int slot, cpu;
+
+	for (slot = 0; slot < HIST_SLOTS; slot++)
+		for_each_possible_cpu(cpu)
+			memset(per_cpu_ptr(hist[slot], cpu), 0,
+			       sizeof(struct tcp_rt_hist));
+
+	return count;
+}
+
+static const struct file_operations hist_fops = {
+	.owner      = THIS_MODULE,
+	.open       = tcp_rt_hist_open,
+	.read       = seq_read,
+	.write      = tcp_rt_hist_write,
+	.llseek     = seq_lseek,
+	.release    = single_release,
+};
+
+static void tcp_rt_hist_free(void)
+{
+	int slot;
+
+	for (slot = 0; slot < HIST_SLOTS; slot++) {
+		free_percpu(hist[slot]);
+		hist[slot] = NULL;
+	}
+}
+
+static int tcp_rt_hist_init(void)
+{
+	int slot;
+
+	for (slot = 0; slot < HIST_SLOTS; slot++) {
+		hist[slot] = alloc_percpu(struct tcp_rt_hist);
+		if (!hist[slot])
+			goto err;
+	}
+
+	if (!debugfs_create_file("hist", 0600, tcprt_dir, NULL, &hist_fops))
+		goto err;
+
+	hist_output = true;
+	return 0;
+
+err:
+	tcp_rt_hist_free();
+	return -1;
 }
 
 static struct dentry *create_buf_file_handler(const char *filename,
@@ -383,9 +661,11 @@ static struct rchan_callbacks relay_callbacks = {
 	.subbuf_start    = subbuf_start,
 };
 
-int tcp_rt_output_init(int log_buf_num, int stats_buf_num,
-		       const struct file_operations *fops)
+int tcp_rt_output_init(int log_buf_num, int stats_buf_num, bool binary,
+		       bool aggregate, const struct file_operations *fops)
 {
+	binary_output = binary;
+
 	tcprt_dir = debugfs_create_dir("tcp-rt", NULL);
 	if (!tcprt_dir)
 		return -1;
@@ -396,9 +676,17 @@ int tcp_rt_output_init(int log_buf_num, int stats_buf_num,
 		return -1;
 	}
 
+	if (aggregate && tcp_rt_hist_init()) {
+		debugfs_remove_recursive(tcprt_dir);
+		tcprt_dir = NULL;
+		pr_err("tcp-rt: create hist failed!\n");
+		return -1;
+	}
+
 	relay_log = relay_open("rt-network-log", tcprt_dir, LOG_SUBBUF_SIZE,
 			       log_buf_num, &relay_callbacks, NULL);
 	if (!relay_log) {
+		tcp_rt_hist_free();
 		debugfs_remove_recursive(tcprt_dir);
 		tcprt_dir = NULL;
 		pr_err("tcp-rt: create relay_log failed!\n");
@@ -412,6 +700,7 @@ int tcp_rt_output_init(int log_buf_num, int stats_buf_num,
 	if (!relay_stats) {
 		relay_close(relay_log);
 		relay_log = NULL;
+		tcp_rt_hist_free();
 		debugfs_remove_recursive(tcprt_dir);
 		tcprt_dir = NULL;
 		pr_err("tcp-rt: create relay_stats failed!\n");
@@ -429,6 +718,7 @@ void tcp_rt_output_released(void)
 	relay_close(relay_log);
 	relay_close(relay_stats);
 	debugfs_remove_recursive(tcprt_dir);
+	tcp_rt_hist_free();
 
 	for (i = 0; i < ARRAY_SIZE(stats_local); ++i)
 		kfree(stats_local[i]);
@@ -16,6 +16,7 @@
 #include <linux/relay.h>
 #include <linux/module.h>
 #include <net/tcp.h>
+#include <uapi/linux/tcp_rt.h>
 
 #define TCP_SK_RT(sk)  (inet_csk(sk)->icsk_tcp_rt_priv)
 
@@ -113,8 +114,9 @@ struct _tcp_rt_stats {
 	u64 recv_data;
 };
 
-int tcp_rt_output_init(int log_buf_num, int stats_buf_num,
-		       const struct file_operations *fops);
+int tcp_rt_output_init(int log_buf_num, int stats_buf_num, bool binary,
+		       bool aggregate, const struct file_operations *fops);
+bool tcp_rt_slot_desc(enum tcp_rt_type type, int index, char *buf, int len);
 void tcp_rt_output_released(void);
 void tcp_rt_log_printk(const struct sock *sk, char flag, bool fin, bool check);
 void tcp_rt_timer_output(int port, char *flag, bool alloc);
@@ -102,6 +102,7 @@
 #include <linux/skbuff.h>
 #include <linux/proc_fs.h>
 #include <linux/seq_file.h>
+#include <linux/bpf.h>
 #include <net/net_namespace.h>
 #include <net/icmp.h>
 #include <net/inet_hashtables.h>
@@ -1745,6 +1746,9 @@ int udp_recvmsg(struct sock *sk, struct msghdr *msg, size_t len, int noblock,
 			BPF_CGROUP_RUN_PROG_UDP4_RECVMSG_LOCK(sk,
 							(struct sockaddr *)sin);
 	}
+	if (udp_sk(sk)->gro_enabled)
+		udp_cmsg_recv(msg, sk, skb);
+
 	if (inet->cmsg_flags)
 		ip_cmsg_recv_offset(msg, sk, skb, sizeof(struct udphdr), off);
 
@@ -1936,7 +1940,7 @@ EXPORT_SYMBOL(udp_encap_enable);
  * Note that in the success and error cases, the skb is assumed to
  * have either been requeued or freed.
  */
-static int udp_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
+static int udp_queue_rcv_one_skb(struct sock *sk, struct sk_buff *skb)
 {
 	struct udp_sock *up = udp_sk(sk);
 	int is_udplite = IS_UDPLITE(sk);
@@ -2039,6 +2043,30 @@ static int udp_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
 	return -1;
 }
 
+static int udp_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
+{
+	struct sk_buff *next, *segs;
+	int ret;
+
+	if (likely(!udp_unexpected_gso(sk, skb)))
+		return udp_queue_rcv_one_skb(sk, skb);
+
+	BUILD_BUG_ON(sizeof(struct udp_skb_cb) > SKB_SGO_CB_OFFSET);
+	__skb_push(skb, -skb_mac_offset(skb));
+	segs = udp_rcv_segment(sk, skb, true);
+	for (skb = segs; skb; skb = next) {
+		next = skb->next;
+		skb_mark_not_on_list(skb);
+		__skb_pull(skb, skb_transport_offset(skb));
+
+		ret = udp_queue_rcv_one_skb(sk, skb);
+		/* a segment can't be resubmitted to another protocol */
+		if (ret > 0)
+			kfree_skb(skb);
+	}
+	return 0;
+}
+
 /* For TCP sockets, sk_rx_dst is protected by socket lock
  * For UDP, we use xchg() to guard against concurrent changes.
  */
@@ -2501,6 +2529,18 @@ int udp_lib_setsockopt(struct sock *sk, int level, int optname,
 		up->gso_size = val;
 		break;
 
+	/* 0 turns GRO off, 1 aggregates up to the default segment count and
+	 * anything above caps the datagrams merged into one GRO packet.
+	 */
+	case UDP_GRO:
+		if (val < 0)
+			return -EINVAL;
+		lock_sock(sk);
+		up->gro_enabled = valbool;
+		up->gro_max_segs = (val > 1 && val < UDP_MAX_SEGMENTS) ? val : 0;
+		release_sock(sk);
+		break;
+
 	/*
 	 * 	UDP-Lite's partial checksum coverage (RFC 3828).
 	 */
@@ -2595,6 +2635,10 @@ int udp_lib_getsockopt(struct sock *sk, int level, int optname,
 		val = up->gso_size;
 		break;
 
+	case UDP_GRO:
+		val = up->gro_enabled ? (up->gro_max_segs ? : 1) : 0;
+		break;
+
 	/* The following two cannot be changed on UDP sockets, the return is
 	 * always 0 (which corresponds to the full checksum coverage of UDP). */
 	case UDPLITE_SEND_CSCOV:
@@ -2716,10 +2760,27 @@ EXPORT_SYMBOL(udp_prot);
 /* ------------------------------------------------------------------------ */
 #ifdef CONFIG_PROC_FS
 
+static struct udp_seq_afinfo *udp_seq_afinfo(struct seq_file *seq)
+{
+#ifdef CONFIG_BPF_SYSCALL
+	struct udp_iter_state *state = seq->private;
+
+	if (state->bpf_seq_afinfo)
+		return state->bpf_seq_afinfo;
+#endif
+	return PDE_DATA(file_inode(seq->file));
+}
+
+static bool udp_seq_family_match(const struct udp_seq_afinfo *afinfo,
+				 const struct sock *sk)
+{
+	return afinfo->family == AF_UNSPEC || sk->sk_family == afinfo->family;
+}
+
 static struct sock *udp_get_first(struct seq_file *seq, int start)
 {
 	struct sock *sk;
-	struct udp_seq_afinfo *afinfo = PDE_DATA(file_inode(seq->file));
+	struct udp_seq_afinfo *afinfo = udp_seq_afinfo(seq);
 	struct udp_iter_state *state = seq->private;
 	struct net *net = seq_file_net(seq);
 
@@ -2734,7 +2795,7 @@ static struct sock *udp_get_first(struct seq_file *seq, int start)
 		sk_for_each(sk, &hslot->head) {
 			if (!net_eq(sock_net(sk), net))
 				continue;
-			if (sk->sk_family == afinfo->family)
+			if (udp_seq_family_match(afinfo, sk))
 				goto found;
 		}
 		spin_unlock_bh(&hslot->lock);
@@ -2746,13 +2807,14 @@ static struct sock *udp_get_first(struct seq_file *seq, int start)
 
 static struct sock *udp_get_next(struct seq_file *seq, struct sock *sk)
 {
-	struct udp_seq_afinfo *afinfo = PDE_DATA(file_inode(seq->file));
+	struct udp_seq_afinfo *afinfo = udp_seq_afinfo(seq);
 	struct udp_iter_state *state = seq->private;
 	struct net *net = seq_file_net(seq);
 
 	do {
 		sk = sk_next(sk);
-	} while (sk && (!net_eq(sock_net(sk), net) || sk->sk_family != afinfo->family));
+	} while (sk && (!net_eq(sock_net(sk), net) ||
+			!udp_seq_family_match(afinfo, sk)));
 
 	if (!sk) {
 		if (state->bucket <= afinfo->udp_table->mask)
@@ -2797,7 +2859,7 @@ EXPORT_SYMBOL(udp_seq_next);
 
 void udp_seq_stop(struct seq_file *seq, void *v)
 {
-	struct udp_seq_afinfo *afinfo = PDE_DATA(file_inode(seq->file));
+	struct udp_seq_afinfo *afinfo = udp_seq_afinfo(seq);
 	struct udp_iter_state *state = seq->private;
 
 	if (state->bucket <= afinfo->udp_table->mask)
@@ -2883,6 +2945,72 @@ void udp4_proc_exit(void)
 {
 	unregister_pernet_subsys(&udp4_net_ops);
 }
+
+#ifdef CONFIG_BPF_SYSCALL
+/*
+ * bpf_iter_udp: the UDP sockets of both families in the opener's netns,
+ * the same walk as /proc/net/udp.  ctx[2] is the struct sock *, ctx[3] the
+ * owner's uid and ctx[4] the hash bucket.
+ */
+static struct udp_seq_afinfo bpf_iter_udp_afinfo = {
+	.family		= AF_UNSPEC,
+	.udp_table	= &udp_table,
+};
+
+static int bpf_iter_udp_seq_show(struct seq_file *seq, void *v)
+{
+	struct udp_iter_state *state = seq->private;
+	u64 args[5];
+
+	if (v == SEQ_START_TOKEN)
+		return 0;
+
+	args[2] = (unsigned long)v;
+	args[3] = from_kuid_munged(seq_user_ns(seq), sock_i_uid(v));
+	args[4] = state->bucket;
+	return bpf_iter_run_prog(seq, args, false);
+}
+
+static void bpf_iter_udp_seq_stop(struct seq_file *seq, void *v)
+{
+	if (!v) {
+		u64 args[5] = {};
+
+		bpf_iter_run_prog(seq, args, true);
+	}
+	udp_seq_stop(seq, v);
+}
+
+static const struct seq_operations bpf_iter_udp_seq_ops = {
+	.start		= udp_seq_start,
+	.next		= udp_seq_next,
+	.stop		= bpf_iter_udp_seq_stop,
+	.show		= bpf_iter_udp_seq_show,
+};
+
+static int bpf_iter_init_udp(void *priv_data)
+{
+	struct udp_iter_state *state = priv_data;
+
+	state->bpf_seq_afinfo = &bpf_iter_udp_afinfo;
+	return bpf_iter_init_seq_net(priv_data);
+}
+
+static struct bpf_iter_reg udp_reg_info = {
+	.target			= "udp",
+	.seq_ops		= &bpf_iter_udp_seq_ops,
+	.init_seq_private	= bpf_iter_init_udp,
+	.fini_seq_private	= bpf_iter_fini_seq_net,
+	.seq_priv_size		= sizeof(struct udp_iter_state),
+	.num_args		= 5,
+};
+
+static void __init bpf_iter_register(void)
+{
+	if (bpf_iter_reg_target(&udp_reg_info))
+		pr_warn("Warning: could not register bpf iterator udp\n");
+}
+#endif /* CONFIG_BPF_SYSCALL */
 #endif /* CONFIG_PROC_FS */
 
 static __initdata unsigned long uhash_entries;
@@ -2985,4 +3113,8 @@ void __init udp_init(void)
 
 	if (register_pernet_subsys(&udp_sysctl_ops))
 		panic("UDP: failed to init sysctl parameters.\n");
+
+#if defined(CONFIG_BPF_SYSCALL) && defined(CONFIG_PROC_FS)
+	bpf_iter_register();
+#endif
 }
@@ -187,6 +187,66 @@ struct sk_buff *skb_udp_tunnel_segment(struct sk_buff *skb,
 }
 EXPORT_SYMBOL(skb_udp_tunnel_segment);
 
+static void __udpv4_gso_segment_csum(struct sk_buff *seg,
+				     __be32 *oldip, __be32 *newip,
+				     __be16 *oldport, __be16 *newport)
+{
+	struct udphdr *uh = udp_hdr(seg);
+
+	if (*oldip == *newip && *oldport == *newport)
+		return;
+
+	inet_proto_csum_replace4(&uh->check, seg, *oldip, *newip, true);
+	inet_proto_csum_replace2(&uh->check, seg, *oldport, *newport, false);
+	if (!uh->check)
+		uh->check = CSUM_MANGLED_0;
+
+	*oldip = *newip;
+	*oldport = *newport;
+}
+
+/*
+ * Forwarding only touched the headers of the first datagram, bring the
+ * others in line: TTL, TOS and whatever NAT rewrote. The IP checksums are
+ * redone by inet_gso_segment().
+ */
+static void __udpv4_gso_segment_list_csum(struct sk_buff *segs)
+{
+	struct iphdr *iph = ip_hdr(segs);
+	struct udphdr *uh = udp_hdr(segs);
+	struct sk_buff *seg;
+	struct iphdr *iph2;
+	struct udphdr *uh2;
+
+	for (seg = segs->next; seg; seg = seg->next) {
+		iph2 = ip_hdr(seg);
+		uh2 = udp_hdr(seg);
+
+		__udpv4_gso_segment_csum(seg, &iph2->saddr, &iph->saddr,
+					 &uh2->source, &uh->source);
+		__udpv4_gso_segment_csum(seg, &iph2->daddr, &iph->daddr,
+					 &uh2->dest, &uh->dest);
+		iph2->ttl = iph->ttl;
+		iph2->tos = iph->tos;
+	}
+}
+
+static struct sk_buff *__udp_gso_segment_list(struct sk_buff *skb,
+					      netdev_features_t features)
+{
+	unsigned int mss = skb_shinfo(skb)->gso_size;
+
+	skb = skb_segment_list(skb, features, skb_mac_header_len(skb));
+	if (IS_ERR(skb))
+		return skb;
+
+	udp_hdr(skb)->len = htons(sizeof(struct udphdr) + mss);
+	if (ip_hdr(skb)->version == 4)
+		__udpv4_gso_segment_list_csum(skb);
+
+	return skb;
+}
+
 struct sk_buff *__udp_gso_segment(struct sk_buff *gso_skb,
 				  netdev_features_t features)
 {
@@ -203,6 +263,9 @@ struct sk_buff *__udp_gso_segment(struct sk_buff *gso_skb,
 	if (gso_skb->len <= sizeof(*uh) + mss)
 		return ERR_PTR(-EINVAL);
 
+	if (skb_shinfo(gso_skb)->gso_type & SKB_GSO_FRAGLIST)
+		return __udp_gso_segment_list(gso_skb, features);
+
 	skb_pull(gso_skb, sizeof(*uh));
 
 	/* clear destructor to avoid skb_segment assigning it to tail */
@@ -343,6 +406,85 @@ static struct sk_buff *udp4_ufo_fragment(struct sk_buff *skb,
 	return segs;
 }
 
+#define UDP_GRO_CNT_MAX 64
+
+/*
+ * Add a datagram which is not for a tunnel socket to the held one of its
+ * flow: chained for forwarding, see skb_gro_receive_list(), or merged into
+ * a UDP GSO packet for a UDP_GRO socket. The flow ends with the first
+ * shorter datagram, as with UDP GSO where only the last segment may be,
+ * or after @max_segs of them.
+ */
+static struct sk_buff *udp_gro_receive_segment(struct list_head *head,
+					       struct sk_buff *skb,
+					       struct udphdr *uh,
+					       unsigned int max_segs)
+{
+	unsigned int off = skb_gro_offset(skb);
+	struct sk_buff *pp = NULL;
+	struct udphdr *uh2;
+	struct sk_buff *p;
+	unsigned int ulen;
+	int ret = 0;
+
+	/* requires non zero csum, for symmetry with GSO */
+	if (!uh->check) {
+		NAPI_GRO_CB(skb)->flush = 1;
+		return NULL;
+	}
+
+	/* Do not deal with padded or malicious packets, sorry ! */
+	ulen = ntohs(uh->len);
+	if (ulen <= sizeof(*uh) || ulen != skb_gro_len(skb)) {
+		NAPI_GRO_CB(skb)->flush = 1;
+		return NULL;
+	}
+	/* pull encapsulating udp header */
+	skb_gro_pull(skb, sizeof(struct udphdr));
+
+	list_for_each_entry(p, head, list) {
+		if (!NAPI_GRO_CB(p)->same_flow)
+			continue;
+
+		uh2 = (struct udphdr *)(p->data + off);
+
+		/* Match ports only, as csum is always non zero */
+		if ((*(u32 *)&uh->source != *(u32 *)&uh2->source)) {
+			NAPI_GRO_CB(p)->same_flow = 0;
+			continue;
+		}
+
+		/* Terminate the flow on len mismatch or if it grow "too much".
+		 * On len mismatch merge the first packet shorter than gso_size,
+		 * otherwise complete the GRO packet.
+		 */
+		if (ulen > ntohs(uh2->len) || NAPI_GRO_CB(p)->flush ||
+		    NAPI_GRO_CB(p)->is_flist != NAPI_GRO_CB(skb)->is_flist) {
+			pp = p;
+		} else if (NAPI_GRO_CB(skb)->is_flist) {
+			/* the headers travel with the datagram */
+			if (!pskb_may_pull(skb, skb_gro_offset(skb)) ||
+			    skb->ip_summed != p->ip_summed ||
+			    skb->csum_level != p->csum_level) {
+				NAPI_GRO_CB(skb)->flush = 1;
+				return NULL;
+			}
+			ret = skb_gro_receive_list(p, skb);
+		} else {
+			ret = skb_gro_receive(p, skb);
+		}
+
+		if (ret || ulen != ntohs(uh2->len) ||
+		    NAPI_GRO_CB(p)->count >= max_segs)
+			pp = p;
+
+		return pp;
+	}
+
+	/* mismatch, but we never need to flush */
+	return NULL;
+}
+
 struct sk_buff *udp_gro_receive(struct list_head *head, struct sk_buff *skb,
 				struct udphdr *uh, udp_lookup_t lookup)
 {
@@ -367,6 +509,26 @@ struct sk_buff *udp_gro_receive(struct list_head *head, struct sk_buff *skb,
 
 	if (sk && udp_sk(sk)->gro_receive)
 		goto unflush;
+
+	/* A UDP_GRO socket takes its datagrams as one UDP GSO packet */
+	if (sk && udp_sk(sk)->gro_enabled) {
+		pp = udp_gro_receive_segment(head, skb, uh,
+					     udp_sk(sk)->gro_max_segs ? :
+					     UDP_GRO_CNT_MAX);
+		rcu_read_unlock();
+		return pp;
+	}
+
+	/* Not for a local socket, likely forwarded: chain it for re-segmentation
+	 * on egress, which gets the datagrams back bit for bit.
+	 */
+	if (!sk && !NAPI_GRO_CB(skb)->is_ipv6 &&
+	    (skb->dev->features & NETIF_F_GRO_FRAGLIST)) {
+		NAPI_GRO_CB(skb)->is_flist = 1;
+		pp = udp_gro_receive_segment(head, skb, uh, UDP_GRO_CNT_MAX);
+		rcu_read_unlock();
+		return pp;
+	}
 	goto out_unlock;
 
 unflush:
@@ -427,6 +589,20 @@ static struct sk_buff *udp4_gro_receive(struct list_head *head,
 	return NULL;
 }
 
+/* The datagrams merged for a UDP_GRO socket, as if built by UDP GSO */
+static int udp_gro_complete_segment(struct sk_buff *skb)
+{
+	struct udphdr *uh = udp_hdr(skb);
+
+	skb->csum_start = (unsigned char *)uh - skb->head;
+	skb->csum_offset = offsetof(struct udphdr, check);
+	skb->ip_summed = CHECKSUM_PARTIAL;
+
+	skb_shinfo(skb)->gso_segs = NAPI_GRO_CB(skb)->count;
+	skb_shinfo(skb)->gso_type |= SKB_GSO_UDP_L4;
+	return 0;
+}
+
 int udp_gro_complete(struct sk_buff *skb, int nhoff,
 		     udp_lookup_t lookup)
 {
@@ -437,16 +613,23 @@ int udp_gro_complete(struct sk_buff *skb, int nhoff,
 
 	uh->len = newlen;
 
-	/* Set encapsulation before calling into inner gro_complete() functions
-	 * to make them set up the inner offsets.
-	 */
-	skb->encapsulation = 1;
-
 	rcu_read_lock();
 	sk = (*lookup)(skb, uh->source, uh->dest);
-	if (sk && udp_sk(sk)->gro_complete)
+	if (sk && udp_sk(sk)->gro_complete) {
+		skb_shinfo(skb)->gso_type |= uh->check ?
+					     SKB_GSO_UDP_TUNNEL_CSUM :
+					     SKB_GSO_UDP_TUNNEL;
+
+		/* Set encapsulation before calling into inner gro_complete()
+		 * functions to make them set up the inner offsets.
+		 */
+		skb->encapsulation = 1;
 		err = udp_sk(sk)->gro_complete(sk, skb,
 				nhoff + sizeof(struct udphdr));
+	} else if (sk && udp_sk(sk)->gro_enabled) {
+		skb_set_transport_header(skb, nhoff);
+		err = udp_gro_complete_segment(skb);
+	}
 	rcu_read_unlock();
 
 	if (skb->remcsum_offload)
@@ -461,13 +644,24 @@ static int udp4_gro_complete(struct sk_buff *skb, int nhoff)
 	const struct iphdr *iph = ip_hdr(skb);
 	struct udphdr *uh = (struct udphdr *)(skb->data + nhoff);
 
-	if (uh->check) {
-		skb_shinfo(skb)->gso_type |= SKB_GSO_UDP_TUNNEL_CSUM;
+	if (NAPI_GRO_CB(skb)->is_flist) {
+		uh->len = htons(skb->len - nhoff);
+
+		skb_shinfo(skb)->gso_type |= (SKB_GSO_FRAGLIST|SKB_GSO_UDP_L4);
+		skb_shinfo(skb)->gso_segs = NAPI_GRO_CB(skb)->count;
+
+		/* every datagram had its checksum verified on receive */
+		if (skb->ip_summed != CHECKSUM_UNNECESSARY) {
+			skb->ip_summed = CHECKSUM_UNNECESSARY;
+			skb->csum_level = 0;
+		}
+
+		return 0;
+	}
+
+	if (uh->check)
 		uh->check = ~udp_v4_check(skb->len - nhoff, iph->saddr,
 					  iph->daddr, 0);
-	} else {
-		skb_shinfo(skb)->gso_type |= SKB_GSO_UDP_TUNNEL;
-	}
 
 	return udp_gro_complete(skb, nhoff, udp4_lib_lookup_skb);
 }
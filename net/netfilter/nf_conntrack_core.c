@@ -59,9 +59,12 @@
 
 #include "nf_internals.h"
 
-__cacheline_aligned_in_smp spinlock_t nf_conntrack_locks[CONNTRACK_LOCKS];
+spinlock_t *nf_conntrack_locks __read_mostly;
 EXPORT_SYMBOL_GPL(nf_conntrack_locks);
 
+unsigned int nf_conntrack_locks_mask __read_mostly;
+EXPORT_SYMBOL_GPL(nf_conntrack_locks_mask);
+
 __cacheline_aligned_in_smp DEFINE_SPINLOCK(nf_conntrack_expect_lock);
 EXPORT_SYMBOL_GPL(nf_conntrack_expect_lock);
 
@@ -117,8 +120,8 @@ EXPORT_SYMBOL_GPL(nf_conntrack_lock);
 
 static void nf_conntrack_double_unlock(unsigned int h1, unsigned int h2)
 {
-	h1 %= CONNTRACK_LOCKS;
-	h2 %= CONNTRACK_LOCKS;
+	h1 &= nf_conntrack_locks_mask;
+	h2 &= nf_conntrack_locks_mask;
 	spin_unlock(&nf_conntrack_locks[h1]);
 	if (h1 != h2)
 		spin_unlock(&nf_conntrack_locks[h2]);
@@ -128,8 +131,8 @@ static void nf_conntrack_double_unlock(unsigned int h1, unsigned int h2)
 static bool nf_conntrack_double_lock(struct net *net, unsigned int h1,
 				     unsigned int h2, unsigned int sequence)
 {
-	h1 %= CONNTRACK_LOCKS;
-	h2 %= CONNTRACK_LOCKS;
+	h1 &= nf_conntrack_locks_mask;
+	h2 &= nf_conntrack_locks_mask;
 	if (h1 <= h2) {
 		nf_conntrack_lock(&nf_conntrack_locks[h1]);
 		if (h1 != h2)
@@ -155,7 +158,7 @@ static void nf_conntrack_all_lock(void)
 
 	nf_conntrack_locks_all = true;
 
-	for (i = 0; i < CONNTRACK_LOCKS; i++) {
+	for (i = 0; i <= nf_conntrack_locks_mask; i++) {
 		spin_lock(&nf_conntrack_locks[i]);
 
 		/* This spin_unlock provides the "release" to ensure that
@@ -1912,7 +1915,7 @@ get_next_corpse(int (*iter)(struct nf_conn *i, void *data),
 	spinlock_t *lockp;
 
 	for (; *bucket < nf_conntrack_htable_size; (*bucket)++) {
-		lockp = &nf_conntrack_locks[*bucket % CONNTRACK_LOCKS];
+		lockp = nf_conntrack_bucket_lock(*bucket);
 		local_bh_disable();
 		nf_conntrack_lock(lockp);
 		if (*bucket < nf_conntrack_htable_size) {
@@ -2106,6 +2109,7 @@ void nf_conntrack_cleanup_end(void)
 	RCU_INIT_POINTER(nf_ct_hook, NULL);
 	cancel_delayed_work_sync(&conntrack_gc_work.dwork);
 	kvfree(nf_conntrack_hash);
+	kvfree(nf_conntrack_locks);
 
 	nf_conntrack_proto_fini();
 	nf_conntrack_seqadj_fini();
@@ -2296,19 +2300,36 @@ static __always_inline unsigned int total_extension_size(void)
 	;
 };
 
+/* Enough locks that confirming cpus rarely meet on one, see CONNTRACK_LOCKS */
+static int nf_conntrack_locks_init(void)
+{
+	unsigned int i, nr;
+
+	nr = roundup_pow_of_two(num_possible_cpus() * 64);
+	nr = clamp_t(unsigned int, nr, CONNTRACK_LOCKS, CONNTRACK_LOCKS_MAX);
+
+	nf_conntrack_locks = kvmalloc_array(nr, sizeof(spinlock_t), GFP_KERNEL);
+	if (!nf_conntrack_locks)
+		return -ENOMEM;
+
+	for (i = 0; i < nr; i++)
+		spin_lock_init(&nf_conntrack_locks[i]);
+	nf_conntrack_locks_mask = nr - 1;
+	return 0;
+}
+
 int nf_conntrack_init_start(void)
 {
 	int max_factor = 8;
 	int ret = -ENOMEM;
-	int i;
 
 	/* struct nf_ct_ext uses u8 to store offsets/size */
 	BUILD_BUG_ON(total_extension_size() > 255u);
 
 	seqcount_init(&nf_conntrack_generation);
 
-	for (i = 0; i < CONNTRACK_LOCKS; i++)
-		spin_lock_init(&nf_conntrack_locks[i]);
+	if (nf_conntrack_locks_init())
+		return -ENOMEM;
 
 	if (!nf_conntrack_htable_size) {
 		/* Idea from tcp.c: use 1/16384 of memory.
@@ -2335,7 +2356,7 @@ int nf_conntrack_init_start(void)
 
 	nf_conntrack_hash = nf_ct_alloc_hashtable(&nf_conntrack_htable_size, 1);
 	if (!nf_conntrack_hash)
-		return -ENOMEM;
+		goto err_hash;
 
 	nf_conntrack_max = max_factor * nf_conntrack_htable_size;
 
@@ -2407,6 +2428,8 @@ int nf_conntrack_init_start(void)
 	kmem_cache_destroy(nf_conntrack_cachep);
 err_cachep:
 	kvfree(nf_conntrack_hash);
+err_hash:
+	kvfree(nf_conntrack_locks);
 	return ret;
 }
 
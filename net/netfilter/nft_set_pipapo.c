@@ -0,0 +1,904 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * PIPAPO: PIle PAcket POlicies, set backend for ranges of concatenated fields
+ *
+ * Every element is a range per field, say address, port and address ranges
+ * for "10.0.0.0-10.0.0.9 . 1024-65535 . 192.168.1.0/24".  Each range is split
+ * into netmask-like prefixes, and each prefix of each field becomes a rule.
+ *
+ * A field is looked up in groups of four bits: the lookup table of a field
+ * has one row per group and bucket (value of those four bits), each row a
+ * bitmap of the rules matching that value.  ANDing the rows picked by the
+ * groups of the key gives the rules of the field the key matches.  The
+ * mapping table then turns each matching rule into the block of rules in
+ * the next field that belong to the same element, which is where the next
+ * field starts from, and the rules of the last field map to elements.
+ *
+ * So a lookup takes a fixed number of bitmap operations on the size of the
+ * rule bitmaps, whatever the ranges look like, which is fit for sets of a
+ * few thousand range elements.  Elements can't overlap, and there's no
+ * support for timeouts.
+ *
+ * Updates go to a copy of the lookup and mapping tables, made on the first
+ * change in a transaction, that replaces the live copy once the transaction
+ * is committed, see nft_pipapo_commit().  Lookups never see half of an
+ * update.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/bitmap.h>
+#include <linux/netlink.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nf_tables.h>
+#include <net/netfilter/nf_tables.h>
+
+#define NFT_PIPAPO_GROUP_BITS	4
+#define NFT_PIPAPO_BUCKETS	(1 << NFT_PIPAPO_GROUP_BITS)
+#define NFT_PIPAPO_GROUPS_PER_BYTE	(BITS_PER_BYTE / NFT_PIPAPO_GROUP_BITS)
+
+/* Longest field, the lookup table size grows with it */
+#define NFT_PIPAPO_MAX_BYTES	16
+
+/**
+ * union nft_pipapo_map_bucket - what a rule maps to
+ * @to: first rule in the next field of the same element
+ * @n: number of rules in the next field of the same element
+ * @e: for the last field, the element
+ */
+union nft_pipapo_map_bucket {
+	struct {
+		u32 to;
+		u32 n;
+	};
+	struct nft_pipapo_elem *e;
+};
+
+/**
+ * struct nft_pipapo_field - lookup and mapping tables of a field
+ * @groups: number of 4-bit groups in the field
+ * @rules: number of rules in the field
+ * @bsize: size of each bucket row in longs, room for BITS_PER_LONG rules each
+ * @lt: lookup table, @groups * NFT_PIPAPO_BUCKETS rows of @bsize longs
+ * @mt: mapping table, one entry per rule
+ */
+struct nft_pipapo_field {
+	int groups;
+	unsigned long rules;
+	size_t bsize;
+	unsigned long *lt;
+	union nft_pipapo_map_bucket *mt;
+};
+
+/**
+ * struct nft_pipapo_match - data used in lookups
+ * @field_count: number of fields in the key
+ * @bsize_max: longs in the largest rule bitmap in use, size of scratch maps
+ * @scratch: per-cpu result and fill maps for lookups, kept all zero
+ * @rcu: for freeing once replaced
+ * @f: fields
+ */
+struct nft_pipapo_match {
+	int field_count;
+	size_t bsize_max;
+	unsigned long * __percpu *scratch;
+	struct rcu_head rcu;
+	struct nft_pipapo_field f[];
+};
+
+/**
+ * struct nft_pipapo - private data of the set
+ * @match: live copy, used by lookups
+ * @clone: copy being updated in the current transaction, if any
+ */
+struct nft_pipapo {
+	struct nft_pipapo_match __rcu *match;
+	struct nft_pipapo_match *clone;
+};
+
+struct nft_pipapo_elem {
+	struct nft_set_ext	ext;
+};
+
+static unsigned long *pipapo_lt_row(const struct nft_pipapo_field *f,
+				    int group, int bucket)
+{
+	return f->lt + (group * NFT_PIPAPO_BUCKETS + bucket) * f->bsize;
+}
+
+static int pipapo_field_len(const struct nft_pipapo_field *f)
+{
+	return f->groups / NFT_PIPAPO_GROUPS_PER_BYTE;
+}
+
+/* Narrow @dst down to the rules of @f matching the field value @data */
+static void pipapo_and_field_buckets(const struct nft_pipapo_field *f,
+				     unsigned long *dst, const u8 *data)
+{
+	int group;
+
+	for (group = 0; group < f->groups; group += 2, data++) {
+		bitmap_and(dst, dst, pipapo_lt_row(f, group, *data >> 4),
+			   f->rules);
+		bitmap_and(dst, dst, pipapo_lt_row(f, group + 1, *data & 0x0f),
+			   f->rules);
+	}
+}
+
+/* Mark in @dst the rules of the next field that rules in @map map to */
+static bool pipapo_refill(const unsigned long *map,
+			  const struct nft_pipapo_field *f, unsigned long *dst)
+{
+	bool found = false;
+	unsigned long r;
+
+	for_each_set_bit(r, map, f->rules) {
+		bitmap_set(dst, f->mt[r].to, f->mt[r].n);
+		found = true;
+	}
+
+	return found;
+}
+
+/**
+ * pipapo_get() - find the element matching a key
+ * @set: nftables set
+ * @m: copy of the tables to look up in
+ * @data: key
+ * @data_end: closing key to match exactly along with @data, or NULL
+ * @genmask: generation the element needs to be active in
+ * @res_map: zeroed map of at least @m->bsize_max longs
+ * @fill_map: zeroed map of at least @m->bsize_max longs
+ *
+ * Without @data_end, returns the element whose ranges contain @data.  Both
+ * maps are all zero again on return.
+ */
+static struct nft_pipapo_elem *pipapo_get(const struct nft_set *set,
+					  const struct nft_pipapo_match *m,
+					  const u8 *data, const u8 *data_end,
+					  u8 genmask, unsigned long *res_map,
+					  unsigned long *fill_map)
+{
+	const struct nft_pipapo_field *f = m->f;
+	struct nft_pipapo_elem *e;
+	const u8 *p = data;
+	unsigned long r;
+	int i;
+
+	if (!f->rules)
+		return NULL;
+
+	bitmap_fill(res_map, f->rules);
+
+	for (i = 0; i < m->field_count - 1; i++, f++) {
+		bool found;
+
+		pipapo_and_field_buckets(f, res_map, p);
+		p += round_up(pipapo_field_len(f), NFT_REG32_SIZE);
+
+		found = pipapo_refill(res_map, f, fill_map);
+		bitmap_zero(res_map, f->rules);
+		if (!found)
+			return NULL;
+
+		swap(res_map, fill_map);
+	}
+
+	/* Last field, rules map to elements */
+	pipapo_and_field_buckets(f, res_map, p);
+
+	for_each_set_bit(r, res_map, f->rules) {
+		e = f->mt[r].e;
+
+		if (!nft_set_elem_active(&e->ext, genmask))
+			continue;
+		if (data_end &&
+		    (memcmp(nft_set_ext_key(&e->ext), data, set->klen) ||
+		     memcmp(nft_set_ext_key_end(&e->ext), data_end, set->klen)))
+			continue;
+
+		bitmap_zero(res_map, f->rules);
+		return e;
+	}
+
+	bitmap_zero(res_map, f->rules);
+	return NULL;
+}
+
+static bool nft_pipapo_lookup(const struct net *net, const struct nft_set *set,
+			      const u32 *key, const struct nft_set_ext **ext)
+{
+	struct nft_pipapo *priv = nft_set_priv(set);
+	const struct nft_pipapo_match *m;
+	struct nft_pipapo_elem *e;
+	unsigned long *scratch;
+
+	/* The scratch maps of this cpu are ours until we're done */
+	local_bh_disable();
+	m = rcu_dereference(priv->match);
+	scratch = *this_cpu_ptr(m->scratch);
+	e = pipapo_get(set, m, (const u8 *)key, NULL, nft_genmask_cur(net),
+		       scratch, scratch + m->bsize_max);
+	local_bh_enable();
+
+	if (!e)
+		return false;
+
+	*ext = &e->ext;
+	return true;
+}
+
+/* Lookups from the control plane, with maps of their own */
+static struct nft_pipapo_elem *pipapo_get_alloc(const struct nft_set *set,
+						const struct nft_pipapo_match *m,
+						const u8 *data,
+						const u8 *data_end,
+						u8 genmask, gfp_t gfp)
+{
+	struct nft_pipapo_elem *e;
+	unsigned long *maps;
+
+	maps = kcalloc(m->bsize_max * 2, sizeof(*maps), gfp);
+	if (!maps)
+		return ERR_PTR(-ENOMEM);
+
+	e = pipapo_get(set, m, data, data_end, genmask, maps,
+		       maps + m->bsize_max);
+	kfree(maps);
+
+	return e;
+}
+
+static void *nft_pipapo_get(const struct net *net, const struct nft_set *set,
+			    const struct nft_set_elem *elem, unsigned int flags)
+{
+	struct nft_pipapo *priv = nft_set_priv(set);
+	struct nft_pipapo_elem *e;
+
+	e = pipapo_get_alloc(set, rcu_dereference(priv->match),
+			     (const u8 *)elem->key.val.data, NULL,
+			     nft_genmask_cur(net), GFP_ATOMIC);
+
+	return e ?: ERR_PTR(-ENOENT);
+}
+
+static void pipapo_free_scratch(struct nft_pipapo_match *m)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		kfree(*per_cpu_ptr(m->scratch, cpu));
+	free_percpu(m->scratch);
+}
+
+static void pipapo_free_match(struct nft_pipapo_match *m)
+{
+	int i;
+
+	for (i = 0; i < m->field_count; i++) {
+		kvfree(m->f[i].lt);
+		kvfree(m->f[i].mt);
+	}
+	pipapo_free_scratch(m);
+	kfree(m);
+}
+
+static void pipapo_reclaim_match(struct rcu_head *rcu)
+{
+	pipapo_free_match(container_of(rcu, struct nft_pipapo_match, rcu));
+}
+
+/*
+ * Make the scratch maps big enough for @bsize longs.  On failure, the maps
+ * already replaced are bigger than needed, which is harmless.
+ */
+static int pipapo_realloc_scratch(struct nft_pipapo_match *m, size_t bsize)
+{
+	unsigned long *scratch;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		scratch = kcalloc_node(bsize * 2, sizeof(*scratch), GFP_KERNEL,
+				       cpu_to_node(cpu));
+		if (!scratch)
+			return -ENOMEM;
+
+		kfree(*per_cpu_ptr(m->scratch, cpu));
+		*per_cpu_ptr(m->scratch, cpu) = scratch;
+	}
+
+	m->bsize_max = bsize;
+	return 0;
+}
+
+static struct nft_pipapo_match *pipapo_alloc_match(int field_count)
+{
+	struct nft_pipapo_match *m;
+
+	m = kzalloc(struct_size(m, f, field_count), GFP_KERNEL);
+	if (!m)
+		return NULL;
+
+	m->field_count = field_count;
+	m->scratch = alloc_percpu(unsigned long *);
+	if (!m->scratch) {
+		kfree(m);
+		return NULL;
+	}
+
+	return m;
+}
+
+/* Copy of @old for updates, with the bucket rows trimmed to the rules */
+static struct nft_pipapo_match *pipapo_clone(const struct nft_pipapo_match *old)
+{
+	const struct nft_pipapo_field *src;
+	struct nft_pipapo_field *dst;
+	struct nft_pipapo_match *m;
+	int i, row;
+
+	m = pipapo_alloc_match(old->field_count);
+	if (!m)
+		return ERR_PTR(-ENOMEM);
+
+	for (i = 0; i < old->field_count; i++) {
+		src = &old->f[i];
+		dst = &m->f[i];
+
+		dst->groups = src->groups;
+		dst->rules = src->rules;
+		dst->bsize = BITS_TO_LONGS(src->rules);
+		if (!dst->bsize)
+			continue;
+
+		dst->lt = kvmalloc_array(src->groups * NFT_PIPAPO_BUCKETS *
+					 dst->bsize, sizeof(*dst->lt),
+					 GFP_KERNEL);
+		dst->mt = kvmalloc_array(dst->bsize * BITS_PER_LONG,
+					 sizeof(*dst->mt), GFP_KERNEL);
+		if (!dst->lt || !dst->mt)
+			goto err;
+
+		for (row = 0; row < src->groups * NFT_PIPAPO_BUCKETS; row++)
+			memcpy(dst->lt + row * dst->bsize,
+			       src->lt + row * src->bsize,
+			       dst->bsize * sizeof(*dst->lt));
+		memcpy(dst->mt, src->mt, src->rules * sizeof(*dst->mt));
+	}
+
+	if (pipapo_realloc_scratch(m, old->bsize_max))
+		goto err;
+
+	return m;
+
+err:
+	pipapo_free_match(m);
+	return ERR_PTR(-ENOMEM);
+}
+
+static struct nft_pipapo_match *pipapo_match_protected(const struct nft_set *set)
+{
+	struct nft_pipapo *priv = nft_set_priv(set);
+
+	return rcu_dereference_protected(priv->match,
+		lockdep_is_held(&read_pnet(&set->net)->nft.commit_mutex));
+}
+
+/* The copy to update in this transaction, made on the first change */
+static struct nft_pipapo_match *pipapo_maybe_clone(const struct nft_set *set)
+{
+	struct nft_pipapo *priv = nft_set_priv(set);
+	struct nft_pipapo_match *m;
+
+	if (priv->clone)
+		return priv->clone;
+
+	m = pipapo_clone(pipapo_match_protected(set));
+	if (!IS_ERR(m))
+		priv->clone = m;
+
+	return m;
+}
+
+/* Double the room for rules in @f */
+static int pipapo_resize(struct nft_pipapo_field *f)
+{
+	size_t bsize = f->bsize ? f->bsize * 2 : 1;
+	union nft_pipapo_map_bucket *mt;
+	unsigned long *lt;
+	int row;
+
+	lt = kvcalloc(f->groups * NFT_PIPAPO_BUCKETS * bsize, sizeof(*lt),
+		      GFP_KERNEL);
+	if (!lt)
+		return -ENOMEM;
+
+	mt = kvmalloc_array(bsize * BITS_PER_LONG, sizeof(*mt), GFP_KERNEL);
+	if (!mt) {
+		kvfree(lt);
+		return -ENOMEM;
+	}
+
+	for (row = 0; f->bsize && row < f->groups * NFT_PIPAPO_BUCKETS; row++)
+		memcpy(lt + row * bsize, f->lt + row * f->bsize,
+		       f->bsize * sizeof(*lt));
+	if (f->rules)
+		memcpy(mt, f->mt, f->rules * sizeof(*mt));
+
+	kvfree(f->lt);
+	kvfree(f->mt);
+	f->lt = lt;
+	f->mt = mt;
+	f->bsize = bsize;
+
+	return 0;
+}
+
+/* Add a rule matching the first @plen bits of @base to @f */
+static int pipapo_insert_rule(struct nft_pipapo_field *f, const u8 *base,
+			      int plen)
+{
+	int group, bucket, fixed, err;
+	unsigned long r;
+	u8 v;
+
+	if (f->rules == f->bsize * BITS_PER_LONG) {
+		err = pipapo_resize(f);
+		if (err)
+			return err;
+	}
+
+	r = f->rules++;
+	for (group = 0; group < f->groups; group++) {
+		v = base[group / NFT_PIPAPO_GROUPS_PER_BYTE];
+		v = group & 1 ? v & 0x0f : v >> 4;
+		fixed = clamp(plen - group * NFT_PIPAPO_GROUP_BITS, 0,
+			      NFT_PIPAPO_GROUP_BITS);
+
+		/* every bucket sharing the bits covered by the prefix */
+		for (bucket = 0; bucket < NFT_PIPAPO_BUCKETS; bucket++) {
+			if ((bucket ^ v) >> (NFT_PIPAPO_GROUP_BITS - fixed))
+				continue;
+			__set_bit(r, pipapo_lt_row(f, group, bucket));
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Cover the range [@start, @end] of @f with rules, one for each of the
+ * largest aligned blocks fitting in it, like netmasks.
+ */
+static int pipapo_expand(struct nft_pipapo_field *f, const u8 *start,
+			 const u8 *end)
+{
+	u8 base[NFT_PIPAPO_MAX_BYTES], last[NFT_PIPAPO_MAX_BYTES];
+	int len = pipapo_field_len(f), bits = len * BITS_PER_BYTE;
+	int byte, k, i, err;
+	u8 bit;
+
+	memcpy(base, start, len);
+	for (;;) {
+		memcpy(last, base, len);
+		for (k = 0; k < bits; k++) {
+			byte = len - 1 - k / BITS_PER_BYTE;
+			bit = 1 << (k % BITS_PER_BYTE);
+
+			if (base[byte] & bit)
+				break;
+
+			last[byte] |= bit;
+			if (memcmp(last, end, len) > 0) {
+				last[byte] &= ~bit;
+				break;
+			}
+		}
+
+		err = pipapo_insert_rule(f, base, bits - k);
+		if (err)
+			return err;
+
+		if (!memcmp(last, end, len))
+			return 0;
+
+		memcpy(base, last, len);
+		for (i = len - 1; i >= 0 && !++base[i]; i--)
+			;
+	}
+}
+
+/* Drop rules from @rules on, after a failed insertion */
+static void pipapo_truncate(struct nft_pipapo_field *f, unsigned long rules)
+{
+	int row;
+
+	for (row = 0; row < f->groups * NFT_PIPAPO_BUCKETS; row++)
+		bitmap_clear(f->lt + row * f->bsize, rules, f->rules - rules);
+	f->rules = rules;
+}
+
+static unsigned long pipapo_rules_bsize_max(const struct nft_pipapo_match *m)
+{
+	unsigned long bsize = 0;
+	int i;
+
+	for (i = 0; i < m->field_count; i++)
+		bsize = max_t(unsigned long, bsize,
+			      BITS_TO_LONGS(m->f[i].rules));
+
+	return bsize;
+}
+
+static int nft_pipapo_insert(const struct net *net, const struct nft_set *set,
+			     const struct nft_set_elem *elem,
+			     struct nft_set_ext **ext2)
+{
+	const struct nft_set_ext *ext = nft_set_elem_ext(set, elem->priv);
+	const u8 *start = (const u8 *)nft_set_ext_key(ext)->data;
+	const u8 *end = (const u8 *)nft_set_ext_key_end(ext)->data;
+	union nft_pipapo_map_bucket rulemap[NFT_REG32_COUNT];
+	struct nft_pipapo_elem *e = elem->priv, *dup;
+	u8 genmask = nft_genmask_next(net);
+	struct nft_pipapo_field *f;
+	struct nft_pipapo_match *m;
+	unsigned long r, bsize;
+	int i, off, len, err;
+
+	m = pipapo_maybe_clone(set);
+	if (IS_ERR(m))
+		return PTR_ERR(m);
+
+	for (i = 0, off = 0; i < m->field_count; i++) {
+		len = pipapo_field_len(&m->f[i]);
+		if (memcmp(start + off, end + off, len) > 0)
+			return -EINVAL;
+		off += round_up(len, NFT_REG32_SIZE);
+	}
+
+	dup = pipapo_get_alloc(set, m, start, end, genmask, GFP_KERNEL);
+	if (IS_ERR(dup))
+		return PTR_ERR(dup);
+	if (dup) {
+		*ext2 = &dup->ext;
+		return -EEXIST;
+	}
+
+	/* No overlaps: neither end may fall within another element */
+	dup = pipapo_get_alloc(set, m, start, NULL, genmask, GFP_KERNEL);
+	if (!dup)
+		dup = pipapo_get_alloc(set, m, end, NULL, genmask, GFP_KERNEL);
+	if (IS_ERR(dup))
+		return PTR_ERR(dup);
+	if (dup)
+		return -ENOTEMPTY;
+
+	for (i = 0, off = 0; i < m->field_count; i++) {
+		f = &m->f[i];
+
+		rulemap[i].to = f->rules;
+		err = pipapo_expand(f, start + off, end + off);
+		if (err)
+			goto err_truncate;
+		rulemap[i].n = f->rules - rulemap[i].to;
+
+		off += round_up(pipapo_field_len(f), NFT_REG32_SIZE);
+	}
+
+	bsize = pipapo_rules_bsize_max(m);
+	if (bsize > m->bsize_max) {
+		err = pipapo_realloc_scratch(m, bsize);
+		if (err) {
+			i = m->field_count - 1;
+			goto err_truncate;
+		}
+	}
+
+	for (i = 0; i < m->field_count; i++) {
+		f = &m->f[i];
+
+		for (r = rulemap[i].to; r < f->rules; r++) {
+			if (i == m->field_count - 1)
+				f->mt[r].e = e;
+			else
+				f->mt[r] = rulemap[i + 1];
+		}
+	}
+
+	return 0;
+
+err_truncate:
+	for (; i >= 0; i--)
+		pipapo_truncate(&m->f[i], rulemap[i].to);
+	return err;
+}
+
+/* Remove bits [@first, @first + @n) out of @map, shifting down the rest */
+static void pipapo_bitmap_cut(unsigned long *map, unsigned long first,
+			      unsigned long n, unsigned long nbits)
+{
+	unsigned long i;
+
+	for (i = first; i + n < nbits; i++)
+		__assign_bit(i, map, test_bit(i + n, map));
+	bitmap_clear(map, nbits - n, n);
+}
+
+static void pipapo_drop_rules(struct nft_pipapo_field *f, unsigned long first,
+			      unsigned long n)
+{
+	int row;
+
+	for (row = 0; row < f->groups * NFT_PIPAPO_BUCKETS; row++)
+		pipapo_bitmap_cut(f->lt + row * f->bsize, first, n, f->rules);
+
+	memmove(f->mt + first, f->mt + first + n,
+		(f->rules - first - n) * sizeof(*f->mt));
+	f->rules -= n;
+}
+
+static void nft_pipapo_remove(const struct net *net, const struct nft_set *set,
+			      const struct nft_set_elem *elem)
+{
+	struct nft_pipapo *priv = nft_set_priv(set);
+	union nft_pipapo_map_bucket rulemap[NFT_REG32_COUNT];
+	struct nft_pipapo_match *m = priv->clone;
+	struct nft_pipapo_elem *e = elem->priv;
+	struct nft_pipapo_field *f;
+	unsigned long r, n;
+	int i;
+
+	/* insertion and deactivation made the copy already */
+	if (WARN_ON_ONCE(!m))
+		return;
+
+	/* Find the block of rules of the element, field by field backwards */
+	i = m->field_count - 1;
+	f = &m->f[i];
+	for (r = 0; r < f->rules && f->mt[r].e != e; r++)
+		;
+	for (n = 0; r + n < f->rules && f->mt[r + n].e == e; n++)
+		;
+	if (WARN_ON_ONCE(!n))
+		return;
+	rulemap[i].to = r;
+	rulemap[i].n = n;
+
+	for (i--; i >= 0; i--) {
+		f = &m->f[i];
+		for (r = 0; r < f->rules; r++) {
+			if (f->mt[r].to == rulemap[i + 1].to &&
+			    f->mt[r].n == rulemap[i + 1].n)
+				break;
+		}
+		for (n = 0; r + n < f->rules &&
+			    f->mt[r + n].to == rulemap[i + 1].to &&
+			    f->mt[r + n].n == rulemap[i + 1].n; n++)
+			;
+		rulemap[i].to = r;
+		rulemap[i].n = n;
+	}
+
+	for (i = 0; i < m->field_count; i++) {
+		pipapo_drop_rules(&m->f[i], rulemap[i].to, rulemap[i].n);
+		if (!i)
+			continue;
+
+		/* rules of the previous field mapping past the cut move down */
+		f = &m->f[i - 1];
+		for (r = 0; r < f->rules; r++) {
+			if (f->mt[r].to > rulemap[i].to)
+				f->mt[r].to -= rulemap[i].n;
+		}
+	}
+}
+
+static void nft_pipapo_activate(const struct net *net,
+				const struct nft_set *set,
+				const struct nft_set_elem *elem)
+{
+	struct nft_pipapo_elem *e = elem->priv;
+
+	nft_set_elem_change_active(net, set, &e->ext);
+	nft_set_elem_clear_busy(&e->ext);
+}
+
+static bool nft_pipapo_flush(const struct net *net, const struct nft_set *set,
+			     void *priv)
+{
+	struct nft_pipapo_elem *e = priv;
+
+	/* the element is dropped from the copy on commit */
+	if (IS_ERR(pipapo_maybe_clone(set)))
+		return false;
+
+	if (!nft_set_elem_mark_busy(&e->ext) || !nft_is_active(net, &e->ext)) {
+		nft_set_elem_change_active(net, set, &e->ext);
+		return true;
+	}
+	return false;
+}
+
+static void *nft_pipapo_deactivate(const struct net *net,
+				   const struct nft_set *set,
+				   const struct nft_set_elem *elem)
+{
+	struct nft_pipapo_match *m;
+	struct nft_pipapo_elem *e;
+
+	m = pipapo_maybe_clone(set);
+	if (IS_ERR(m))
+		return NULL;
+
+	e = pipapo_get_alloc(set, m, (const u8 *)elem->key.val.data,
+			     (const u8 *)elem->key_end.val.data,
+			     nft_genmask_next(net), GFP_KERNEL);
+	if (IS_ERR_OR_NULL(e))
+		return NULL;
+
+	nft_pipapo_flush(net, set, e);
+	return e;
+}
+
+/* Publish the copy updated in this transaction, if any */
+static void nft_pipapo_commit(const struct nft_set *set)
+{
+	struct nft_pipapo *priv = nft_set_priv(set);
+	struct nft_pipapo_match *old;
+
+	if (!priv->clone)
+		return;
+
+	old = pipapo_match_protected(set);
+	rcu_assign_pointer(priv->match, priv->clone);
+	call_rcu(&old->rcu, pipapo_reclaim_match);
+	priv->clone = NULL;
+}
+
+static void nft_pipapo_walk(const struct nft_ctx *ctx, struct nft_set *set,
+			    struct nft_set_iter *iter)
+{
+	struct nft_pipapo *priv = nft_set_priv(set);
+	const struct nft_pipapo_match *m;
+	const struct nft_pipapo_field *f;
+	struct nft_pipapo_elem *e;
+	struct nft_set_elem elem;
+	bool next_gen;
+	unsigned long r;
+
+	/*
+	 * The next generation is only walked with the commit mutex held,
+	 * where the tables can't change under us and ->flush() may have to
+	 * make a copy.
+	 */
+	next_gen = iter->genmask == nft_genmask_next(ctx->net);
+	if (next_gen) {
+		m = priv->clone ?: pipapo_match_protected(set);
+	} else {
+		rcu_read_lock();
+		m = rcu_dereference(priv->match);
+	}
+
+	f = &m->f[m->field_count - 1];
+	for (r = 0; r < f->rules; r++) {
+		/* elements own a block of consecutive rules */
+		if (r && f->mt[r].e == f->mt[r - 1].e)
+			continue;
+
+		if (iter->count < iter->skip)
+			goto cont;
+
+		e = f->mt[r].e;
+		if (!nft_set_elem_active(&e->ext, iter->genmask))
+			goto cont;
+
+		elem.priv = e;
+
+		iter->err = iter->fn(ctx, set, iter, &elem);
+		if (iter->err < 0)
+			break;
+cont:
+		iter->count++;
+	}
+
+	if (!next_gen)
+		rcu_read_unlock();
+}
+
+static u64 nft_pipapo_privsize(const struct nlattr * const nla[],
+			       const struct nft_set_desc *desc)
+{
+	return sizeof(struct nft_pipapo);
+}
+
+static int nft_pipapo_init(const struct nft_set *set,
+			   const struct nft_set_desc *desc,
+			   const struct nlattr * const nla[])
+{
+	struct nft_pipapo *priv = nft_set_priv(set);
+	struct nft_pipapo_match *m;
+	int i;
+
+	m = pipapo_alloc_match(desc->field_count);
+	if (!m)
+		return -ENOMEM;
+
+	for (i = 0; i < desc->field_count; i++)
+		m->f[i].groups = desc->field_len[i] * NFT_PIPAPO_GROUPS_PER_BYTE;
+
+	rcu_assign_pointer(priv->match, m);
+	priv->clone = NULL;
+
+	return 0;
+}
+
+static void nft_pipapo_destroy(const struct nft_set *set)
+{
+	struct nft_pipapo *priv = nft_set_priv(set);
+	struct nft_pipapo_match *m;
+	struct nft_pipapo_field *f;
+	unsigned long r;
+
+	rcu_barrier();
+
+	m = rcu_dereference_protected(priv->match, true);
+	f = priv->clone ? &priv->clone->f[m->field_count - 1] :
+			  &m->f[m->field_count - 1];
+	for (r = 0; r < f->rules; r++) {
+		if (r && f->mt[r].e == f->mt[r - 1].e)
+			continue;
+		nft_set_elem_destroy(set, f->mt[r].e, true);
+	}
+
+	if (priv->clone)
+		pipapo_free_match(priv->clone);
+	pipapo_free_match(m);
+}
+
+static bool nft_pipapo_estimate(const struct nft_set_desc *desc, u32 features,
+				struct nft_set_estimate *est)
+{
+	int i;
+
+	if (!(features & NFT_SET_CONCAT) || !desc->field_count)
+		return false;
+
+	for (i = 0; i < desc->field_count; i++) {
+		if (desc->field_len[i] > NFT_PIPAPO_MAX_BYTES)
+			return false;
+	}
+
+	if (desc->size)
+		est->size = sizeof(struct nft_pipapo) +
+			    desc->size * sizeof(struct nft_pipapo_elem);
+	else
+		est->size = ~0;
+
+	est->lookup = NFT_SET_CLASS_O_LOG_N;
+	est->space  = NFT_SET_CLASS_O_N;
+
+	return true;
+}
+
+struct nft_set_type nft_set_pipapo_type __read_mostly = {
+	.owner		= THIS_MODULE,
+	.features	= NFT_SET_INTERVAL | NFT_SET_MAP | NFT_SET_OBJECT |
+			  NFT_SET_CONCAT,
+	.ops		= {
+		.privsize	= nft_pipapo_privsize,
+		.elemsize	= offsetof(struct nft_pipapo_elem, ext),
+		.estimate	= nft_pipapo_estimate,
+		.init		= nft_pipapo_init,
+		.destroy	= nft_pipapo_destroy,
+		.insert		= nft_pipapo_insert,
+		.remove		= nft_pipapo_remove,
+		.deactivate	= nft_pipapo_deactivate,
+		.flush		= nft_pipapo_flush,
+		.activate	= nft_pipapo_activate,
+		.lookup		= nft_pipapo_lookup,
+		.walk		= nft_pipapo_walk,
+		.get		= nft_pipapo_get,
+		.commit		= nft_pipapo_commit,
+	},
+};
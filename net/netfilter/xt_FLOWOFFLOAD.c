@@ -0,0 +1,445 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * FLOWOFFLOAD target: put established, forwarded conntrack flows into a
+ * software flow table, so that their later packets skip the forwarding
+ * path and the rule traversal.  This is the flow_offload expression of
+ * nf_tables for iptables rulesets.
+ *
+ * Each netns has one flow table.  Its ingress hooks are registered on the
+ * devices the offloaded flows are routed through, which includes bridge
+ * and VLAN devices since those see the packets again once they have been
+ * received on the port or the lower device.  A hook is added, from a work
+ * item, when a flow first uses the device and removed once no flow does.
+ */
+#include <linux/module.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/x_tables.h>
+#include <linux/netfilter/xt_FLOWOFFLOAD.h>
+#include <linux/rtnetlink.h>
+#include <linux/tcp.h>
+#include <linux/workqueue.h>
+#include <net/ip.h>
+#include <net/net_namespace.h>
+#include <net/netns/generic.h>
+#include <net/netfilter/nf_conntrack.h>
+#include <net/netfilter/nf_conntrack_extend.h>
+#include <net/netfilter/nf_flow_table.h>
+
+struct xt_flowoffload_hook {
+	struct hlist_node	list;
+	struct nf_hook_ops	ops;
+	bool			registered;
+	bool			used;
+};
+
+struct xt_flowoffload_net {
+	struct net		*net;
+	struct nf_flowtable	flowtable;
+	/* hooks are added from the packet path under hooks_lock, and only
+	 * removed or registered with rtnl held
+	 */
+	struct hlist_head	hooks;
+	spinlock_t		hooks_lock;
+	struct delayed_work	hook_work;
+};
+
+static unsigned int xt_flowoffload_net_id __read_mostly;
+
+static unsigned int
+xt_flowoffload_net_hook(void *priv, struct sk_buff *skb,
+			const struct nf_hook_state *state)
+{
+	switch (skb->protocol) {
+	case htons(ETH_P_IP):
+		return nf_flow_offload_ip_hook(priv, skb, state);
+	case htons(ETH_P_IPV6):
+		return nf_flow_offload_ipv6_hook(priv, skb, state);
+	}
+
+	return NF_ACCEPT;
+}
+
+static struct xt_flowoffload_hook *
+xt_flowoffload_find_hook(struct xt_flowoffload_net *fnet,
+			 const struct net_device *dev)
+{
+	struct xt_flowoffload_hook *hook;
+
+	hlist_for_each_entry(hook, &fnet->hooks, list) {
+		if (hook->ops.dev == dev)
+			return hook;
+	}
+
+	return NULL;
+}
+
+static void xt_flowoffload_add_hook(struct xt_flowoffload_net *fnet,
+				    struct net_device *dev)
+{
+	struct xt_flowoffload_hook *hook;
+
+	spin_lock_bh(&fnet->hooks_lock);
+	if (xt_flowoffload_find_hook(fnet, dev))
+		goto out;
+
+	hook = kzalloc(sizeof(*hook), GFP_ATOMIC);
+	if (!hook)
+		goto out;
+
+	hook->ops.pf		= NFPROTO_NETDEV;
+	hook->ops.hooknum	= NF_NETDEV_INGRESS;
+	hook->ops.priority	= 10;
+	hook->ops.priv		= &fnet->flowtable;
+	hook->ops.hook		= xt_flowoffload_net_hook;
+	hook->ops.dev		= dev;
+	dev_hold(dev);
+
+	hlist_add_head(&hook->list, &fnet->hooks);
+	mod_delayed_work(system_power_efficient_wq, &fnet->hook_work, 0);
+out:
+	spin_unlock_bh(&fnet->hooks_lock);
+}
+
+/* called with rtnl held, @hook already off the list */
+static void xt_flowoffload_free_hook(struct xt_flowoffload_net *fnet,
+				     struct xt_flowoffload_hook *hook)
+{
+	if (hook->registered)
+		nf_unregister_net_hook(fnet->net, &hook->ops);
+	dev_put(hook->ops.dev);
+	kfree(hook);
+}
+
+static void xt_flowoffload_mark_used(struct flow_offload *flow, void *data)
+{
+	struct xt_flowoffload_net *fnet = data;
+	struct xt_flowoffload_hook *hook;
+	int iifidx, oifidx;
+
+	iifidx = flow->tuplehash[FLOW_OFFLOAD_DIR_ORIGINAL].tuple.iifidx;
+	oifidx = flow->tuplehash[FLOW_OFFLOAD_DIR_ORIGINAL].tuple.oifidx;
+
+	spin_lock_bh(&fnet->hooks_lock);
+	hlist_for_each_entry(hook, &fnet->hooks, list) {
+		if (hook->ops.dev->ifindex == iifidx ||
+		    hook->ops.dev->ifindex == oifidx)
+			hook->used = true;
+	}
+	spin_unlock_bh(&fnet->hooks_lock);
+}
+
+static void xt_flowoffload_hook_work(struct work_struct *work)
+{
+	struct xt_flowoffload_net *fnet;
+	struct xt_flowoffload_hook *hook;
+	struct hlist_node *tmp;
+	HLIST_HEAD(stale);
+	bool more;
+	int err;
+
+	fnet = container_of(to_delayed_work(work), struct xt_flowoffload_net,
+			    hook_work);
+
+	rtnl_lock();
+
+	spin_lock_bh(&fnet->hooks_lock);
+	hlist_for_each_entry(hook, &fnet->hooks, list)
+		hook->used = false;
+	spin_unlock_bh(&fnet->hooks_lock);
+
+	err = nf_flow_table_iterate(&fnet->flowtable, xt_flowoffload_mark_used,
+				    fnet);
+
+	/* an incomplete walk keeps every hook for now */
+	spin_lock_bh(&fnet->hooks_lock);
+	hlist_for_each_entry_safe(hook, tmp, &fnet->hooks, list) {
+		if (hook->ops.dev->reg_state == NETREG_REGISTERED &&
+		    (hook->used || !hook->registered || err))
+			continue;
+		hlist_del(&hook->list);
+		hlist_add_head(&hook->list, &stale);
+	}
+	spin_unlock_bh(&fnet->hooks_lock);
+
+	hlist_for_each_entry_safe(hook, tmp, &stale, list)
+		xt_flowoffload_free_hook(fnet, hook);
+
+	for (;;) {
+		spin_lock_bh(&fnet->hooks_lock);
+		hlist_for_each_entry(hook, &fnet->hooks, list) {
+			if (!hook->registered)
+				break;
+		}
+		if (hook)
+			hook->registered = true;
+		spin_unlock_bh(&fnet->hooks_lock);
+
+		if (!hook)
+			break;
+
+		if (nf_register_net_hook(fnet->net, &hook->ops) < 0) {
+			spin_lock_bh(&fnet->hooks_lock);
+			hlist_del(&hook->list);
+			spin_unlock_bh(&fnet->hooks_lock);
+			hook->registered = false;
+			xt_flowoffload_free_hook(fnet, hook);
+		}
+	}
+
+	rtnl_unlock();
+
+	spin_lock_bh(&fnet->hooks_lock);
+	more = !hlist_empty(&fnet->hooks);
+	spin_unlock_bh(&fnet->hooks_lock);
+
+	if (more)
+		queue_delayed_work(system_power_efficient_wq,
+				   &fnet->hook_work, HZ);
+}
+
+static bool xt_flowoffload_skip(struct sk_buff *skb, u8 family)
+{
+	if (skb_sec_path(skb))
+		return true;
+
+	if (family == NFPROTO_IPV4) {
+		const struct ip_options *opt = &(IPCB(skb)->opt);
+
+		if (unlikely(opt->optlen))
+			return true;
+	}
+
+	return false;
+}
+
+static int xt_flowoffload_route(struct sk_buff *skb, const struct nf_conn *ct,
+				const struct xt_action_param *par,
+				struct nf_flow_route *route,
+				enum ip_conntrack_dir dir)
+{
+	struct dst_entry *this_dst = skb_dst(skb);
+	struct dst_entry *other_dst = NULL;
+	struct flowi fl;
+
+	memset(&fl, 0, sizeof(fl));
+	switch (xt_family(par)) {
+	case NFPROTO_IPV4:
+		fl.u.ip4.daddr = ct->tuplehash[dir].tuple.src.u3.ip;
+		fl.u.ip4.flowi4_oif = xt_in(par)->ifindex;
+		break;
+	case NFPROTO_IPV6:
+		fl.u.ip6.daddr = ct->tuplehash[dir].tuple.src.u3.in6;
+		fl.u.ip6.flowi6_oif = xt_in(par)->ifindex;
+		break;
+	}
+
+	nf_route(xt_net(par), &other_dst, &fl, false, xt_family(par));
+	if (!other_dst)
+		return -ENOENT;
+
+	route->tuple[dir].dst		= this_dst;
+	route->tuple[!dir].dst		= other_dst;
+
+	return 0;
+}
+
+static unsigned int
+flowoffload_tg(struct sk_buff *skb, const struct xt_action_param *par)
+{
+	struct xt_flowoffload_net *fnet;
+	struct tcphdr _tcph, *tcph = NULL;
+	enum ip_conntrack_info ctinfo;
+	struct nf_flow_route route;
+	struct flow_offload *flow;
+	enum ip_conntrack_dir dir;
+	struct nf_conn *ct;
+
+	if (xt_flowoffload_skip(skb, xt_family(par)))
+		return XT_CONTINUE;
+
+	ct = nf_ct_get(skb, &ctinfo);
+	if (!ct)
+		return XT_CONTINUE;
+
+	switch (ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple.dst.protonum) {
+	case IPPROTO_TCP:
+		tcph = skb_header_pointer(skb, par->thoff,
+					  sizeof(_tcph), &_tcph);
+		if (unlikely(!tcph || tcph->fin || tcph->rst))
+			return XT_CONTINUE;
+		break;
+	case IPPROTO_UDP:
+		break;
+	default:
+		return XT_CONTINUE;
+	}
+
+	if (nf_ct_ext_exist(ct, NF_CT_EXT_HELPER) ||
+	    ct->status & IPS_SEQ_ADJUST)
+		return XT_CONTINUE;
+
+	if (ctinfo == IP_CT_NEW ||
+	    ctinfo == IP_CT_RELATED)
+		return XT_CONTINUE;
+
+	if (test_and_set_bit(IPS_OFFLOAD_BIT, &ct->status))
+		return XT_CONTINUE;
+
+	dir = CTINFO2DIR(ctinfo);
+	if (xt_flowoffload_route(skb, ct, par, &route, dir) < 0)
+		goto err_flow_route;
+
+	flow = flow_offload_alloc(ct, &route);
+	if (!flow)
+		goto err_flow_alloc;
+
+	if (tcph) {
+		ct->proto.tcp.seen[0].flags |= IP_CT_TCP_FLAG_BE_LIBERAL;
+		ct->proto.tcp.seen[1].flags |= IP_CT_TCP_FLAG_BE_LIBERAL;
+	}
+
+	fnet = net_generic(xt_net(par), xt_flowoffload_net_id);
+	if (flow_offload_add(&fnet->flowtable, flow) < 0)
+		goto err_flow_add;
+
+	xt_flowoffload_add_hook(fnet, route.tuple[dir].dst->dev);
+	xt_flowoffload_add_hook(fnet, route.tuple[!dir].dst->dev);
+
+	dst_release(route.tuple[!dir].dst);
+	return XT_CONTINUE;
+
+err_flow_add:
+	flow_offload_free(flow);
+err_flow_alloc:
+	dst_release(route.tuple[!dir].dst);
+err_flow_route:
+	clear_bit(IPS_OFFLOAD_BIT, &ct->status);
+	return XT_CONTINUE;
+}
+
+static int flowoffload_chk(const struct xt_tgchk_param *par)
+{
+	struct xt_flowoffload_target_info *info = par->targinfo;
+
+	if (info->flags)
+		return -EINVAL;
+
+	return nf_ct_netns_get(par->net, par->family);
+}
+
+static void flowoffload_destroy(const struct xt_tgdtor_param *par)
+{
+	nf_ct_netns_put(par->net, par->family);
+}
+
+static struct xt_target flowoffload_tg_reg __read_mostly = {
+	.name		= "FLOWOFFLOAD",
+	.revision	= 0,
+	.family		= NFPROTO_UNSPEC,
+	.targetsize	= sizeof(struct xt_flowoffload_target_info),
+	.hooks		= 1 << NF_INET_FORWARD,
+	.checkentry	= flowoffload_chk,
+	.destroy	= flowoffload_destroy,
+	.target		= flowoffload_tg,
+	.me		= THIS_MODULE,
+};
+
+static int xt_flowoffload_netdev_event(struct notifier_block *this,
+				       unsigned long event, void *ptr)
+{
+	struct net_device *dev = netdev_notifier_info_to_dev(ptr);
+	struct xt_flowoffload_net *fnet;
+	struct xt_flowoffload_hook *hook;
+
+	if (event != NETDEV_DOWN && event != NETDEV_UNREGISTER)
+		return NOTIFY_DONE;
+
+	fnet = net_generic(dev_net(dev), xt_flowoffload_net_id);
+
+	spin_lock_bh(&fnet->hooks_lock);
+	hook = xt_flowoffload_find_hook(fnet, dev);
+	if (hook)
+		hlist_del(&hook->list);
+	spin_unlock_bh(&fnet->hooks_lock);
+
+	if (hook)
+		xt_flowoffload_free_hook(fnet, hook);
+
+	nf_flow_table_cleanup(dev_net(dev), dev);
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block xt_flowoffload_netdev_notifier = {
+	.notifier_call	= xt_flowoffload_netdev_event,
+};
+
+static int __net_init xt_flowoffload_net_init(struct net *net)
+{
+	struct xt_flowoffload_net *fnet = net_generic(net, xt_flowoffload_net_id);
+
+	fnet->net = net;
+	INIT_HLIST_HEAD(&fnet->hooks);
+	spin_lock_init(&fnet->hooks_lock);
+	INIT_DELAYED_WORK(&fnet->hook_work, xt_flowoffload_hook_work);
+
+	return nf_flow_table_init(&fnet->flowtable);
+}
+
+static void __net_exit xt_flowoffload_net_exit(struct net *net)
+{
+	struct xt_flowoffload_net *fnet = net_generic(net, xt_flowoffload_net_id);
+
+	/* the devices are gone, and their hooks with them */
+	cancel_delayed_work_sync(&fnet->hook_work);
+	WARN_ON_ONCE(!hlist_empty(&fnet->hooks));
+
+	nf_flow_table_free(&fnet->flowtable);
+}
+
+static struct pernet_operations xt_flowoffload_net_ops = {
+	.init	= xt_flowoffload_net_init,
+	.exit	= xt_flowoffload_net_exit,
+	.id	= &xt_flowoffload_net_id,
+	.size	= sizeof(struct xt_flowoffload_net),
+};
+
+static int __init flowoffload_tg_init(void)
+{
+	int err;
+
+	err = register_pernet_subsys(&xt_flowoffload_net_ops);
+	if (err)
+		return err;
+
+	err = register_netdevice_notifier(&xt_flowoffload_netdev_notifier);
+	if (err)
+		goto err_notifier;
+
+	err = xt_register_target(&flowoffload_tg_reg);
+	if (err)
+		goto err_target;
+
+	return 0;
+
+err_target:
+	unregister_netdevice_notifier(&xt_flowoffload_netdev_notifier);
+err_notifier:
+	unregister_pernet_subsys(&xt_flowoffload_net_ops);
+	return err;
+}
+
+static void __exit flowoffload_tg_exit(void)
+{
+	xt_unregister_target(&flowoffload_tg_reg);
+	unregister_netdevice_notifier(&xt_flowoffload_netdev_notifier);
+	unregister_pernet_subsys(&xt_flowoffload_net_ops);
+}
+
+module_init(flowoffload_tg_init);
+module_exit(flowoffload_tg_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Xtables: software flow table offload of forwarded flows");
+MODULE_ALIAS("ipt_FLOWOFFLOAD");
+MODULE_ALIAS("ip6t_FLOWOFFLOAD");
@@ -37,6 +37,8 @@
 #include <linux/rbtree.h>
 #include <linux/workqueue.h>
 #include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/rtnetlink.h>
 #include <net/netlink.h>
 #include <net/sch_generic.h>
 #include <net/pkt_sched.h>
@@ -53,6 +55,19 @@
     Each class is assigned level. Leaf has ALWAYS level 0 and root
     classes have level TC_HTB_MAXDEPTH-1. Interior nodes has level
     one less than their parent.
+
+    Offload mode:
+    With TCA_HTB_OFFLOAD the root qdisc of a multiqueue device works like
+    mq. Every leaf gets a TX queue of its own, taken from the top of the
+    real ones down, and its packets are shaped there by htb_txq_qdisc_ops
+    under that queue's lock, so leaves dequeue on different CPUs at once.
+    netdev_pick_tx() picks the queue from skb->priority (see struct
+    tc_txq_map), the queues below the lowest leaf's carry direct traffic.
+    Inner classes have their tokens under cl->lock. Leaves within their
+    rate charge them after every quantum of bytes, leaves over it borrow a
+    quantum at a time, so each ancestor's lock is taken once per quantum.
+    There are no filters, no priorities and no DRR among the leaves that
+    borrow from the same parent: whichever asks first gets the tokens.
 */
 
 static int htb_hysteresis __read_mostly = 0; /* whether to use mode hysteresis for speedup */
@@ -123,11 +138,20 @@ struct htb_class {
 	/* token bucket parameters */
 	s64			tokens, ctokens;/* current number of tokens */
 	s64			t_c;		/* checkpoint time */
+	spinlock_t		lock;		/* offload: inner class tokens */
 
 	union {
 		struct htb_class_leaf {
 			int		deficit[TC_HTB_MAXDEPTH];
 			struct Qdisc	*q;
+
+			/* offload mode */
+			struct Qdisc	*txq_q;		/* shaper on our queue */
+			unsigned int	queue;
+			s64		credit;		/* bytes lent, prepaid */
+			u32		pending;	/* bytes not charged yet */
+			u32		sent_bytes;	/* not in ancestors' stats */
+			u32		sent_pkts;
 		} leaf;
 		struct htb_class_inner {
 			struct htb_prio clprio[TC_HTB_NUMPRIO];
@@ -177,6 +201,16 @@ struct htb_sched {
 	int			row_mask[TC_HTB_MAXDEPTH];
 
 	struct htb_level	hlevel[TC_HTB_MAXDEPTH];
+
+	bool			offload;
+	struct Qdisc		**direct_qdiscs;	/* until attached */
+	unsigned long		*leaf_queues;		/* taken by leaves */
+};
+
+/* offload mode: the qdisc of a leaf's TX queue */
+struct htb_txq_sched {
+	struct htb_class	*cl;	/* NULL once the class lets go */
+	struct qdisc_watchdog	watchdog;
 };
 
 /* find class in global hash table using given handle */
@@ -989,6 +1023,371 @@ static void htb_reset(struct Qdisc *sch)
 	memset(q->row_mask, 0, sizeof(q->row_mask));
 }
 
+/* offload mode: inner class tokens up to @now, under cl->lock */
+static void htb_offload_refill(struct htb_class *cl, s64 now)
+{
+	s64 diff = min_t(s64, now - cl->t_c, cl->mbuffer);
+
+	if (diff <= 0)
+		return;
+	cl->tokens = min_t(s64, cl->tokens + diff, cl->buffer);
+	cl->ctokens = min_t(s64, cl->ctokens + diff, cl->cbuffer);
+	cl->t_c = now;
+}
+
+/* charge the ancestors of leaf @cl with what it sent within its rate */
+static void htb_offload_flush(struct htb_class *cl, s64 now)
+{
+	u32 pending = cl->un.leaf.pending;
+	struct htb_class *p;
+
+	if (!cl->un.leaf.sent_pkts)
+		return;
+
+	for (p = cl->parent; p; p = p->parent) {
+		spin_lock(&p->lock);
+		htb_offload_refill(p, now);
+		if (pending) {
+			htb_accnt_tokens(p, pending, 0);
+			htb_accnt_ctokens(p, pending, 0);
+		}
+		p->bstats.bytes += cl->un.leaf.sent_bytes;
+		p->bstats.packets += cl->un.leaf.sent_pkts;
+		spin_unlock(&p->lock);
+	}
+	cl->un.leaf.pending = 0;
+	cl->un.leaf.sent_bytes = 0;
+	cl->un.leaf.sent_pkts = 0;
+}
+
+/**
+ * htb_offload_borrow - lends leaf cl a quantum from its ancestors
+ *
+ * The nearest ancestor within its rate lends, all of those in between
+ * must be within their ceil, and they are all charged up front like
+ * htb_charge_class() would. If there's no such ancestor *wait is cut
+ * down to when one on the way might change its mode.
+ */
+static bool htb_offload_borrow(struct htb_class *cl, int len, s64 now,
+			       s64 *wait)
+{
+	int chunk = max(cl->quantum, len);
+	struct htb_class *p, *lender = NULL;
+	enum htb_cmode mode;
+	bool lent = false;
+	s64 diff;
+
+	htb_offload_flush(cl, now);
+
+	for (p = cl->parent; p && !lender; p = p->parent) {
+		spin_lock(&p->lock);
+		htb_offload_refill(p, now);
+		diff = 0;
+		mode = htb_class_mode(p, &diff);
+		spin_unlock(&p->lock);
+
+		if (mode == HTB_CAN_SEND) {
+			lender = p;
+			continue;
+		}
+		*wait = min(*wait, diff);
+		if (mode == HTB_CANT_SEND)
+			return false;
+	}
+	if (!lender)
+		return false;
+
+	for (p = cl->parent; p; p = p->parent) {
+		spin_lock(&p->lock);
+		if (p == lender) {
+			p->xstats.lends++;
+			lent = true;
+		}
+		if (lent)
+			htb_accnt_tokens(p, chunk, 0);
+		htb_accnt_ctokens(p, chunk, 0);
+		spin_unlock(&p->lock);
+	}
+	cl->un.leaf.credit += chunk;
+	return true;
+}
+
+static int htb_txq_enqueue(struct sk_buff *skb, struct Qdisc *sch,
+			   struct sk_buff **to_free)
+{
+	struct htb_txq_sched *q = qdisc_priv(sch);
+	struct htb_class *cl = q->cl;
+	int ret;
+
+	if (unlikely(!cl))
+		return qdisc_drop(skb, sch, to_free);
+
+	ret = qdisc_enqueue(skb, cl->un.leaf.q, to_free);
+	if (ret != NET_XMIT_SUCCESS && net_xmit_drop_count(ret))
+		cl->drops++;
+	return ret;
+}
+
+/* The counters of the leaf's qdisc are what HTB reports, see
+ * htb_offload_stats(), so there are none kept here.
+ */
+static struct sk_buff *htb_txq_dequeue(struct Qdisc *sch)
+{
+	struct htb_txq_sched *q = qdisc_priv(sch);
+	struct htb_class *cl = q->cl;
+	enum htb_cmode mode;
+	struct sk_buff *skb;
+	s64 now, diff, wait;
+	int len;
+
+	if (unlikely(!cl))
+		return NULL;
+
+	skb = cl->un.leaf.q->ops->peek(cl->un.leaf.q);
+	if (!skb)
+		return NULL;
+	len = qdisc_pkt_len(skb);
+
+	now = ktime_get_ns();
+	diff = min_t(s64, now - cl->t_c, cl->mbuffer);
+	wait = diff;
+	mode = htb_class_mode(cl, &wait);
+	if (mode != cl->cmode) {
+		if (mode == HTB_CANT_SEND)
+			cl->overlimits++;
+		cl->cmode = mode;
+	}
+	if (mode == HTB_CANT_SEND)
+		goto throttle;
+	if (mode == HTB_MAY_BORROW && cl->un.leaf.credit < len &&
+	    !htb_offload_borrow(cl, len, now, &wait))
+		goto throttle;
+
+	skb = qdisc_dequeue_peeked(cl->un.leaf.q);
+	if (unlikely(!skb))
+		return NULL;
+
+	if (mode == HTB_CAN_SEND) {
+		cl->xstats.lends++;
+		htb_accnt_tokens(cl, len, diff);
+		cl->un.leaf.pending += len;
+	} else {
+		cl->xstats.borrows++;
+		cl->tokens += diff;
+		cl->un.leaf.credit -= len;
+	}
+	htb_accnt_ctokens(cl, len, diff);
+	cl->t_c = now;
+	bstats_update(&cl->bstats, skb);
+
+	cl->un.leaf.sent_bytes += len;
+	cl->un.leaf.sent_pkts++;
+	if (cl->un.leaf.sent_bytes >= cl->quantum)
+		htb_offload_flush(cl, now);
+	return skb;
+
+throttle:
+	qdisc_watchdog_schedule_ns(&q->watchdog, now + wait);
+	return NULL;
+}
+
+static int htb_txq_init(struct Qdisc *sch, struct nlattr *opt,
+			struct netlink_ext_ack *extack)
+{
+	struct htb_txq_sched *q = qdisc_priv(sch);
+
+	qdisc_watchdog_init(&q->watchdog, sch);
+	return 0;
+}
+
+static void htb_txq_reset(struct Qdisc *sch)
+{
+	struct htb_txq_sched *q = qdisc_priv(sch);
+
+	if (q->cl)
+		qdisc_reset(q->cl->un.leaf.q);
+	qdisc_watchdog_cancel(&q->watchdog);
+}
+
+static void htb_txq_destroy(struct Qdisc *sch)
+{
+	struct htb_txq_sched *q = qdisc_priv(sch);
+
+	qdisc_watchdog_cancel(&q->watchdog);
+}
+
+static struct Qdisc_ops htb_txq_qdisc_ops __read_mostly = {
+	.id		=	"htb_txq",
+	.priv_size	=	sizeof(struct htb_txq_sched),
+	.enqueue	=	htb_txq_enqueue,
+	.dequeue	=	htb_txq_dequeue,
+	.peek		=	qdisc_peek_dequeued,
+	.init		=	htb_txq_init,
+	.reset		=	htb_txq_reset,
+	.destroy	=	htb_txq_destroy,
+	.owner		=	THIS_MODULE,
+};
+
+/* The class takes a reference of its own on the qdisc of its TX queue,
+ * so whichever of the two lets go last frees it.
+ */
+static void htb_offload_bind(struct htb_class *cl, struct Qdisc *txq_q,
+			     unsigned int queue)
+{
+	struct htb_txq_sched *tq = qdisc_priv(txq_q);
+
+	qdisc_refcount_inc(txq_q);
+	cl->un.leaf.txq_q = txq_q;
+	cl->un.leaf.queue = queue;
+	cl->un.leaf.credit = 0;
+	cl->un.leaf.pending = 0;
+	cl->un.leaf.sent_bytes = 0;
+	cl->un.leaf.sent_pkts = 0;
+	tq->cl = cl;
+}
+
+/* only with the device deactivated or the qdisc off its queue */
+static void htb_offload_unbind(struct htb_class *cl)
+{
+	struct Qdisc *txq_q = cl->un.leaf.txq_q;
+	struct htb_txq_sched *tq;
+
+	if (!txq_q)
+		return;
+	tq = qdisc_priv(txq_q);
+	tq->cl = NULL;
+	cl->un.leaf.txq_q = NULL;
+	qdisc_destroy(txq_q);
+}
+
+/* a TX queue for a new leaf, from the top down; queue 0 stays direct */
+static int htb_offload_get_queue(struct Qdisc *sch)
+{
+	struct htb_sched *q = qdisc_priv(sch);
+	unsigned int ntx = qdisc_dev(sch)->real_num_tx_queues;
+
+	while (--ntx > 0) {
+		if (!test_bit(ntx, q->leaf_queues))
+			return ntx;
+	}
+	return -ENOSPC;
+}
+
+static void htb_offload_free_map(struct rcu_head *head)
+{
+	kfree(container_of(head, struct tc_txq_map, rcu));
+}
+
+static void htb_offload_replace_map(struct net_device *dev,
+				    struct tc_txq_map *map)
+{
+	struct tc_txq_map *old = rtnl_dereference(dev->tc_txq_map);
+
+	rcu_assign_pointer(dev->tc_txq_map, map);
+	if (old)
+		call_rcu_bh(&old->rcu, htb_offload_free_map);
+}
+
+static int htb_offload_map_cmp(const void *a, const void *b)
+{
+	const struct tc_txq_map_entry *x = a, *y = b;
+
+	if (x->classid == y->classid)
+		return 0;
+	return x->classid < y->classid ? -1 : 1;
+}
+
+/* Tells netdev_pick_tx() where the leaves are. Should there be no memory
+ * for it the old map stays, which sends a new leaf's packets to the
+ * direct queues and a deleted one's to a queue no leaf has.
+ */
+static void htb_offload_update_map(struct Qdisc *sch)
+{
+	struct net_device *dev = qdisc_dev(sch);
+	struct htb_sched *q = qdisc_priv(sch);
+	struct tc_txq_map *map;
+	struct htb_class *cl;
+	unsigned int i, n = 0;
+
+	for (i = 0; i < q->clhash.hashsize; i++) {
+		hlist_for_each_entry(cl, &q->clhash.hash[i], common.hnode)
+			n += !cl->level;
+	}
+
+	map = kzalloc(struct_size(map, entries, n), GFP_KERNEL);
+	if (!map)
+		return;
+
+	n = 0;
+	for (i = 0; i < q->clhash.hashsize; i++) {
+		hlist_for_each_entry(cl, &q->clhash.hash[i], common.hnode) {
+			if (cl->level)
+				continue;
+			map->entries[n].classid = cl->common.classid;
+			map->entries[n].queue = cl->un.leaf.queue;
+			n++;
+		}
+	}
+	sort(map->entries, n, sizeof(map->entries[0]), htb_offload_map_cmp,
+	     NULL);
+	map->num_entries = n;
+
+	map->handle = sch->handle;
+	map->num_direct = min_t(unsigned int, dev->real_num_tx_queues,
+				find_first_bit(q->leaf_queues,
+					       dev->num_tx_queues));
+	cl = htb_find(TC_H_MAKE(TC_H_MAJ(sch->handle), q->defcls), sch);
+	map->default_queue = cl && !cl->level ? cl->un.leaf.queue : -1;
+
+	htb_offload_replace_map(dev, map);
+}
+
+/* what the tc stats of the root are made of, as for mq */
+static void htb_offload_stats(struct Qdisc *sch)
+{
+	struct net_device *dev = qdisc_dev(sch);
+	struct htb_txq_sched *tq;
+	struct Qdisc *qdisc, *leaf;
+	unsigned int ntx;
+	__u32 qlen;
+
+	sch->q.qlen = 0;
+	memset(&sch->bstats, 0, sizeof(sch->bstats));
+	memset(&sch->qstats, 0, sizeof(sch->qstats));
+
+	for (ntx = 0; ntx < dev->num_tx_queues; ntx++) {
+		qdisc = netdev_get_tx_queue(dev, ntx)->qdisc_sleeping;
+		spin_lock_bh(qdisc_lock(qdisc));
+
+		leaf = qdisc;
+		if (qdisc->ops == &htb_txq_qdisc_ops) {
+			tq = qdisc_priv(qdisc);
+			leaf = tq->cl ? tq->cl->un.leaf.q : NULL;
+		}
+		if (leaf && qdisc_is_percpu_stats(leaf)) {
+			qlen = qdisc_qlen_sum(leaf);
+			__gnet_stats_copy_basic(NULL, &sch->bstats,
+						leaf->cpu_bstats,
+						&leaf->bstats);
+			__gnet_stats_copy_queue(&sch->qstats,
+						leaf->cpu_qstats,
+						&leaf->qstats, qlen);
+			sch->q.qlen		+= qlen;
+		} else if (leaf) {
+			sch->q.qlen		+= leaf->q.qlen;
+			sch->bstats.bytes	+= leaf->bstats.bytes;
+			sch->bstats.packets	+= leaf->bstats.packets;
+			sch->qstats.qlen	+= leaf->qstats.qlen;
+			sch->qstats.backlog	+= leaf->qstats.backlog;
+			sch->qstats.drops	+= leaf->qstats.drops;
+			sch->qstats.requeues	+= leaf->qstats.requeues;
+			sch->qstats.overlimits	+= leaf->qstats.overlimits;
+		}
+
+		spin_unlock_bh(qdisc_lock(qdisc));
+	}
+}
+
 static const struct nla_policy htb_policy[TCA_HTB_MAX + 1] = {
 	[TCA_HTB_PARMS]	= { .len = sizeof(struct tc_htb_opt) },
 	[TCA_HTB_INIT]	= { .len = sizeof(struct tc_htb_glob) },
@@ -997,6 +1396,7 @@ static const struct nla_policy htb_policy[TCA_HTB_MAX + 1] = {
 	[TCA_HTB_DIRECT_QLEN] = { .type = NLA_U32 },
 	[TCA_HTB_RATE64] = { .type = NLA_U64 },
 	[TCA_HTB_CEIL64] = { .type = NLA_U64 },
+	[TCA_HTB_OFFLOAD] = { .type = NLA_FLAG },
 };
 
 static void htb_work_func(struct work_struct *work)
@@ -1009,6 +1409,48 @@ static void htb_work_func(struct work_struct *work)
 	rcu_read_unlock();
 }
 
+static int htb_init_offload(struct Qdisc *sch, struct netlink_ext_ack *extack)
+{
+	struct net_device *dev = qdisc_dev(sch);
+	struct htb_sched *q = qdisc_priv(sch);
+	struct netdev_queue *dev_queue;
+	struct Qdisc *qdisc;
+	unsigned int ntx;
+
+	if (sch->parent != TC_H_ROOT || !netif_is_multiqueue(dev)) {
+		NL_SET_ERR_MSG(extack, "HTB offload needs to be the root qdisc of a multiqueue device");
+		return -EOPNOTSUPP;
+	}
+
+	q->offload = true;
+	net_inc_tc_txq_map();
+
+	q->leaf_queues = kcalloc(BITS_TO_LONGS(dev->num_tx_queues),
+				 sizeof(unsigned long), GFP_KERNEL);
+	if (!q->leaf_queues)
+		return -ENOMEM;
+
+	/* pre-allocate qdiscs, attachment can't fail */
+	q->direct_qdiscs = kcalloc(dev->num_tx_queues,
+				   sizeof(q->direct_qdiscs[0]), GFP_KERNEL);
+	if (!q->direct_qdiscs)
+		return -ENOMEM;
+
+	for (ntx = 0; ntx < dev->num_tx_queues; ntx++) {
+		dev_queue = netdev_get_tx_queue(dev, ntx);
+		qdisc = qdisc_create_dflt(dev_queue,
+					  get_default_qdisc_ops(dev, ntx),
+					  sch->handle, extack);
+		if (!qdisc)
+			return -ENOMEM;
+		q->direct_qdiscs[ntx] = qdisc;
+		qdisc->flags |= TCQ_F_ONETXQUEUE | TCQ_F_NOPARENT;
+	}
+
+	sch->flags |= TCQ_F_MQROOT;
+	return 0;
+}
+
 static int htb_init(struct Qdisc *sch, struct nlattr *opt,
 		    struct netlink_ext_ack *extack)
 {
@@ -1053,9 +1495,56 @@ static int htb_init(struct Qdisc *sch, struct nlattr *opt,
 		q->rate2quantum = 1;
 	q->defcls = gopt->defcls;
 
+	if (tb[TCA_HTB_OFFLOAD])
+		return htb_init_offload(sch, extack);
+
 	return 0;
 }
 
+static void htb_attach_offload(struct Qdisc *sch)
+{
+	struct net_device *dev = qdisc_dev(sch);
+	struct htb_sched *q = qdisc_priv(sch);
+	struct Qdisc *qdisc, *old;
+	unsigned int ntx;
+
+	for (ntx = 0; ntx < dev->num_tx_queues; ntx++) {
+		qdisc = q->direct_qdiscs[ntx];
+		old = dev_graft_qdisc(qdisc->dev_queue, qdisc);
+		if (old)
+			qdisc_destroy(old);
+	}
+	kfree(q->direct_qdiscs);
+	q->direct_qdiscs = NULL;
+
+	htb_offload_update_map(sch);
+}
+
+static void htb_attach_software(struct Qdisc *sch)
+{
+	struct net_device *dev = qdisc_dev(sch);
+	unsigned int ntx;
+
+	/* what qdisc_graft() does for qdiscs without ->attach() */
+	for (ntx = 0; ntx < dev->num_tx_queues; ntx++) {
+		struct netdev_queue *dev_queue = netdev_get_tx_queue(dev, ntx);
+		struct Qdisc *old = dev_graft_qdisc(dev_queue, sch);
+
+		qdisc_refcount_inc(sch);
+		qdisc_destroy(old);
+	}
+}
+
+static void htb_attach(struct Qdisc *sch)
+{
+	struct htb_sched *q = qdisc_priv(sch);
+
+	if (q->offload)
+		htb_attach_offload(sch);
+	else
+		htb_attach_software(sch);
+}
+
 static int htb_dump(struct Qdisc *sch, struct sk_buff *skb)
 {
 	struct htb_sched *q = qdisc_priv(sch);
@@ -1066,6 +1555,9 @@ static int htb_dump(struct Qdisc *sch, struct sk_buff *skb)
 	 * no change can happen on the qdisc parameters.
 	 */
 
+	if (q->offload)
+		htb_offload_stats(sch);
+
 	gopt.direct_pkts = q->direct_pkts;
 	gopt.version = HTB_VER;
 	gopt.rate2quantum = q->rate2quantum;
@@ -1078,6 +1570,8 @@ static int htb_dump(struct Qdisc *sch, struct sk_buff *skb)
 	if (nla_put(skb, TCA_HTB_INIT, sizeof(gopt), &gopt) ||
 	    nla_put_u32(skb, TCA_HTB_DIRECT_QLEN, q->direct_qlen))
 		goto nla_put_failure;
+	if (q->offload && nla_put_flag(skb, TCA_HTB_OFFLOAD))
+		goto nla_put_failure;
 
 	return nla_nest_end(skb, nest);
 
@@ -1163,19 +1657,45 @@ htb_dump_class_stats(struct Qdisc *sch, unsigned long arg, struct gnet_dump *d)
 static int htb_graft(struct Qdisc *sch, unsigned long arg, struct Qdisc *new,
 		     struct Qdisc **old, struct netlink_ext_ack *extack)
 {
+	struct htb_sched *q = qdisc_priv(sch);
 	struct htb_class *cl = (struct htb_class *)arg;
+	struct netdev_queue *dev_queue = sch->dev_queue;
 
 	if (cl->level)
 		return -EINVAL;
+	if (q->offload)
+		dev_queue = cl->un.leaf.txq_q->dev_queue;
 	if (new == NULL &&
-	    (new = qdisc_create_dflt(sch->dev_queue, &pfifo_qdisc_ops,
+	    (new = qdisc_create_dflt(dev_queue, &pfifo_qdisc_ops,
 				     cl->common.classid, extack)) == NULL)
 		return -ENOBUFS;
 
+	if (q->offload) {
+		/* the qdisc of the TX queue is its root, not us */
+		new->flags |= TCQ_F_NOPARENT;
+		*old = qdisc_replace(cl->un.leaf.txq_q, new, &cl->un.leaf.q);
+		return 0;
+	}
+
 	*old = qdisc_replace(sch, new, &cl->un.leaf.q);
 	return 0;
 }
 
+static struct netdev_queue *htb_select_queue(struct Qdisc *sch,
+					     struct tcmsg *tcm)
+{
+	struct htb_sched *q = qdisc_priv(sch);
+	struct htb_class *cl;
+
+	if (!q->offload)
+		return sch->dev_queue;
+
+	cl = htb_find(tcm->tcm_parent, sch);
+	if (!cl || cl->level)
+		return sch->dev_queue;
+	return cl->un.leaf.txq_q->dev_queue;
+}
+
 static struct Qdisc *htb_leaf(struct Qdisc *sch, unsigned long arg)
 {
 	struct htb_class *cl = (struct htb_class *)arg;
@@ -1224,6 +1744,7 @@ static void htb_destroy_class(struct Qdisc *sch, struct htb_class *cl)
 {
 	if (!cl->level) {
 		WARN_ON(!cl->un.leaf.q);
+		htb_offload_unbind(cl);
 		qdisc_destroy(cl->un.leaf.q);
 	}
 	gen_kill_estimator(&cl->rate_est);
@@ -1233,11 +1754,15 @@ static void htb_destroy_class(struct Qdisc *sch, struct htb_class *cl)
 
 static void htb_destroy(struct Qdisc *sch)
 {
+	struct net_device *dev = qdisc_dev(sch);
 	struct htb_sched *q = qdisc_priv(sch);
 	struct hlist_node *next;
 	struct htb_class *cl;
 	unsigned int i;
 
+	if (q->offload)
+		htb_offload_replace_map(dev, NULL);
+
 	cancel_work_sync(&q->work);
 	qdisc_watchdog_cancel(&q->watchdog);
 	/* This line used to be after htb_destroy_class call below
@@ -1260,13 +1785,24 @@ static void htb_destroy(struct Qdisc *sch)
 	}
 	qdisc_class_hash_destroy(&q->clhash);
 	__qdisc_reset_queue(&q->direct_queue);
+
+	if (q->direct_qdiscs) {
+		for (i = 0; i < dev->num_tx_queues && q->direct_qdiscs[i]; i++)
+			qdisc_destroy(q->direct_qdiscs[i]);
+		kfree(q->direct_qdiscs);
+	}
+	kfree(q->leaf_queues);
+	if (q->offload)
+		net_dec_tc_txq_map();
 }
 
 static int htb_delete(struct Qdisc *sch, unsigned long arg)
 {
+	struct net_device *dev = qdisc_dev(sch);
 	struct htb_sched *q = qdisc_priv(sch);
 	struct htb_class *cl = (struct htb_class *)arg;
-	struct Qdisc *new_q = NULL;
+	struct netdev_queue *dev_queue = sch->dev_queue;
+	struct Qdisc *new_q = NULL, *txq_q = NULL;
 	int last_child = 0;
 
 	/* TODO: why don't allow to delete subtree ? references ? does
@@ -1276,14 +1812,43 @@ static int htb_delete(struct Qdisc *sch, unsigned long arg)
 	if (cl->children || cl->filter_cnt)
 		return -EBUSY;
 
+	if (q->offload && !cl->level)
+		dev_queue = cl->un.leaf.txq_q->dev_queue;
+
 	if (!cl->level && htb_parent_last_child(cl)) {
-		new_q = qdisc_create_dflt(sch->dev_queue, &pfifo_qdisc_ops,
+		new_q = qdisc_create_dflt(dev_queue, &pfifo_qdisc_ops,
 					  cl->parent->common.classid,
 					  NULL);
 		last_child = 1;
 	}
 
-	sch_tree_lock(sch);
+	if (q->offload && !cl->level) {
+		/* the parent takes the TX queue over, or it goes direct */
+		if (last_child)
+			txq_q = qdisc_create_dflt(dev_queue, &htb_txq_qdisc_ops,
+						  cl->parent->common.classid,
+						  NULL);
+		else
+			txq_q = qdisc_create_dflt(dev_queue,
+						  get_default_qdisc_ops(dev,
+							cl->un.leaf.queue),
+						  sch->handle, NULL);
+		if (!txq_q) {
+			qdisc_destroy(new_q);
+			return -ENOBUFS;
+		}
+		txq_q->flags |= TCQ_F_ONETXQUEUE | TCQ_F_NOPARENT;
+		if (new_q)
+			new_q->flags |= TCQ_F_NOPARENT;
+
+		if (dev->flags & IFF_UP)
+			dev_deactivate(dev);
+		qdisc_destroy(dev_graft_qdisc(dev_queue, txq_q));
+		if (!last_child)
+			clear_bit(cl->un.leaf.queue, q->leaf_queues);
+	} else {
+		sch_tree_lock(sch);
+	}
 
 	if (!cl->level) {
 		unsigned int qlen = cl->un.leaf.q->q.qlen;
@@ -1301,30 +1866,58 @@ static int htb_delete(struct Qdisc *sch, unsigned long arg)
 	if (cl->prio_activity)
 		htb_deactivate(q, cl);
 
-	if (cl->cmode != HTB_CAN_SEND)
+	if (cl->cmode != HTB_CAN_SEND && !q->offload)
 		htb_safe_rb_erase(&cl->pq_node,
 				  &q->hlevel[cl->level].wait_pq);
 
 	if (last_child)
 		htb_parent_to_leaf(q, cl, new_q);
 
-	sch_tree_unlock(sch);
+	if (txq_q) {
+		if (last_child)
+			htb_offload_bind(cl->parent, txq_q, cl->un.leaf.queue);
+		htb_offload_update_map(sch);
+		if (dev->flags & IFF_UP)
+			dev_activate(dev);
+	} else {
+		sch_tree_unlock(sch);
+	}
 
 	htb_destroy_class(sch, cl);
 	return 0;
 }
 
+/* What keeps the datapath off the parameters of @cl while they change:
+ * the root lock or, in offload mode, the lock of the qdisc of a leaf's TX
+ * queue or an inner class' own.
+ */
+static spinlock_t *htb_params_lock(struct Qdisc *sch, struct htb_class *cl)
+{
+	struct htb_sched *q = qdisc_priv(sch);
+
+	if (!q->offload)
+		return qdisc_root_sleeping_lock(sch);
+	if (cl->level)
+		return &cl->lock;
+	return qdisc_lock(cl->un.leaf.txq_q);
+}
+
 static int htb_change_class(struct Qdisc *sch, u32 classid,
 			    u32 parentid, struct nlattr **tca,
 			    unsigned long *arg, struct netlink_ext_ack *extack)
 {
 	int err = -EINVAL;
+	struct net_device *dev = qdisc_dev(sch);
 	struct htb_sched *q = qdisc_priv(sch);
 	struct htb_class *cl = (struct htb_class *)*arg, *parent;
+	struct netdev_queue *dev_queue = sch->dev_queue;
 	struct nlattr *opt = tca[TCA_OPTIONS];
 	struct nlattr *tb[TCA_HTB_MAX + 1];
+	struct Qdisc *txq_q = NULL;
 	struct tc_htb_opt *hopt;
+	spinlock_t *lock = NULL;
 	u64 rate64, ceil64;
+	int queue = -1;
 	int warn = 0;
 
 	/* extract all subattrs from opt attr */
@@ -1382,6 +1975,28 @@ static int htb_change_class(struct Qdisc *sch, u32 classid,
 			pr_err("htb: tree is too deep\n");
 			goto failure;
 		}
+
+		/* a leaf made inner hands its TX queue down */
+		if (q->offload) {
+			if (parent && !parent->level)
+				queue = parent->un.leaf.queue;
+			else
+				queue = htb_offload_get_queue(sch);
+			if (queue < 0) {
+				NL_SET_ERR_MSG(extack, "No TX queue left for another HTB leaf");
+				err = queue;
+				goto failure;
+			}
+			dev_queue = netdev_get_tx_queue(dev, queue);
+
+			err = -ENOBUFS;
+			txq_q = qdisc_create_dflt(dev_queue, &htb_txq_qdisc_ops,
+						  classid, extack);
+			if (!txq_q)
+				goto failure;
+			txq_q->flags |= TCQ_F_ONETXQUEUE | TCQ_F_NOPARENT;
+		}
+
 		err = -ENOBUFS;
 		cl = kzalloc(sizeof(*cl), GFP_KERNEL);
 		if (!cl)
@@ -1406,6 +2021,7 @@ static int htb_change_class(struct Qdisc *sch, u32 classid,
 		}
 
 		cl->children = 0;
+		spin_lock_init(&cl->lock);
 		RB_CLEAR_NODE(&cl->pq_node);
 
 		for (prio = 0; prio < TC_HTB_NUMPRIO; prio++)
@@ -1415,14 +2031,24 @@ static int htb_change_class(struct Qdisc *sch, u32 classid,
 		 * so that can't be used inside of sch_tree_lock
 		 * -- thanks to Karlis Peisenieks
 		 */
-		new_q = qdisc_create_dflt(sch->dev_queue, &pfifo_qdisc_ops,
+		new_q = qdisc_create_dflt(dev_queue, &pfifo_qdisc_ops,
 					  classid, NULL);
-		sch_tree_lock(sch);
+		if (q->offload) {
+			if (new_q)
+				new_q->flags |= TCQ_F_NOPARENT;
+			/* the queues are switched over with nothing running */
+			if (dev->flags & IFF_UP)
+				dev_deactivate(dev);
+		} else {
+			lock = qdisc_root_sleeping_lock(sch);
+			spin_lock_bh(lock);
+		}
 		if (parent && !parent->level) {
 			unsigned int qlen = parent->un.leaf.q->q.qlen;
 			unsigned int backlog = parent->un.leaf.q->qstats.backlog;
 
 			/* turn parent into inner node */
+			htb_offload_unbind(parent);
 			qdisc_reset(parent->un.leaf.q);
 			qdisc_tree_reduce_backlog(parent->un.leaf.q, qlen, backlog);
 			qdisc_destroy(parent->un.leaf.q);
@@ -1431,7 +2057,9 @@ static int htb_change_class(struct Qdisc *sch, u32 classid,
 
 			/* remove from evt list because of level change */
 			if (parent->cmode != HTB_CAN_SEND) {
-				htb_safe_rb_erase(&parent->pq_node, &q->hlevel[0].wait_pq);
+				if (!q->offload)
+					htb_safe_rb_erase(&parent->pq_node,
+							  &q->hlevel[0].wait_pq);
 				parent->cmode = HTB_CAN_SEND;
 			}
 			parent->level = (parent->parent ? parent->parent->level
@@ -1467,7 +2095,8 @@ static int htb_change_class(struct Qdisc *sch, u32 classid,
 			if (err)
 				return err;
 		}
-		sch_tree_lock(sch);
+		lock = htb_params_lock(sch, cl);
+		spin_lock_bh(lock);
 	}
 
 	rate64 = tb[TCA_HTB_RATE64] ? nla_get_u64(tb[TCA_HTB_RATE64]) : 0;
@@ -1503,7 +2132,17 @@ static int htb_change_class(struct Qdisc *sch, u32 classid,
 	cl->buffer = PSCHED_TICKS2NS(hopt->buffer);
 	cl->cbuffer = PSCHED_TICKS2NS(hopt->cbuffer);
 
-	sch_tree_unlock(sch);
+	if (lock)
+		spin_unlock_bh(lock);
+
+	if (txq_q) {
+		qdisc_destroy(dev_graft_qdisc(dev_queue, txq_q));
+		htb_offload_bind(cl, txq_q, queue);
+		set_bit(queue, q->leaf_queues);
+		htb_offload_update_map(sch);
+		if (dev->flags & IFF_UP)
+			dev_activate(dev);
+	}
 
 	if (warn)
 		pr_warn("HTB: quantum of class %X is %s. Consider r2q change.\n",
@@ -1515,6 +2154,7 @@ static int htb_change_class(struct Qdisc *sch, u32 classid,
 	return 0;
 
 failure:
+	qdisc_destroy(txq_q);
 	return err;
 }
 
@@ -1579,6 +2219,7 @@ static void htb_walk(struct Qdisc *sch, struct qdisc_walker *arg)
 }
 
 static const struct Qdisc_class_ops htb_class_ops = {
+	.select_queue	=	htb_select_queue,
 	.graft		=	htb_graft,
 	.leaf		=	htb_leaf,
 	.qlen_notify	=	htb_qlen_notify,
@@ -1601,6 +2242,7 @@ static struct Qdisc_ops htb_qdisc_ops __read_mostly = {
 	.dequeue	=	htb_dequeue,
 	.peek		=	qdisc_peek_dequeued,
 	.init		=	htb_init,
+	.attach		=	htb_attach,
 	.reset		=	htb_reset,
 	.destroy	=	htb_destroy,
 	.dump		=	htb_dump,
@@ -1614,6 +2256,8 @@ static int __init htb_module_init(void)
 static void __exit htb_module_exit(void)
 {
 	unregister_qdisc(&htb_qdisc_ops);
+	/* tc_txq_maps on their way out */
+	rcu_barrier_bh();
 }
 
 module_init(htb_module_init)
@@ -41,6 +41,7 @@
 #include "smc_tx.h"
 #include "smc_rx.h"
 #include "smc_close.h"
+#include "smc_loopback.h"
 
 static DEFINE_MUTEX(smc_create_lgr_pending);	/* serialize link group
 						 * creation
@@ -1985,9 +1986,17 @@ static int __init smc_init(void)
 		goto out_sock;
 	}
 
+	rc = smc_lo_init();
+	if (rc) {
+		pr_err("%s: smc_lo_init fails with %d\n", __func__, rc);
+		goto out_ib;
+	}
+
 	static_branch_enable(&tcp_have_smc);
 	return 0;
 
+out_ib:
+	smc_ib_unregister_client();
 out_sock:
 	sock_unregister(PF_SMC);
 out_proto6:
@@ -2001,6 +2010,7 @@ static int __init smc_init(void)
 
 static void __exit smc_exit(void)
 {
+	smc_lo_exit();
 	smc_core_exit();
 	static_branch_disable(&tcp_have_smc);
 	smc_ib_unregister_client();
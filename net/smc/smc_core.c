@@ -559,11 +559,39 @@ int smc_vlan_by_tcpsk(struct socket *clcsock, unsigned short *vlan_id)
 	return rc;
 }
 
+/* Number of connections on the SMC-R link groups using a RoCE port, an idle
+ * link group counts as one. Used to spread new link groups over the ports
+ * serving a network device.
+ */
+int smc_lgr_port_conns(struct smc_ib_device *smcibdev, u8 ibport)
+{
+	struct smc_link_group *lgr;
+	struct smc_link *lnk;
+	int conns = 0;
+
+	spin_lock_bh(&smc_lgr_list.lock);
+	list_for_each_entry(lgr, &smc_lgr_list.list, list) {
+		if (lgr->is_smcd)
+			continue;
+		lnk = &lgr->lnk[SMC_SINGLE_LINK];
+		if (lnk->smcibdev == smcibdev && lnk->ibport == ibport)
+			conns += READ_ONCE(lgr->conns_num) ?: 1;
+	}
+	spin_unlock_bh(&smc_lgr_list.lock);
+	return conns;
+}
+
+/* with several local ports towards a peer, a link group is only reused on
+ * the port chosen for the new connection, so both sides agree on it
+ */
 static bool smcr_lgr_match(struct smc_link_group *lgr,
 			   struct smc_clc_msg_local *lcl,
-			   enum smc_lgr_role role)
+			   enum smc_lgr_role role,
+			   struct smc_ib_device *smcibdev, u8 ibport)
 {
-	return !memcmp(lgr->peer_systemid, lcl->id_for_peer,
+	return lgr->lnk[SMC_SINGLE_LINK].smcibdev == smcibdev &&
+		lgr->lnk[SMC_SINGLE_LINK].ibport == ibport &&
+		!memcmp(lgr->peer_systemid, lcl->id_for_peer,
 		       SMC_SYSTEMID_LEN) &&
 		!memcmp(lgr->lnk[SMC_SINGLE_LINK].peer_gid, &lcl->gid,
 			SMC_GID_SIZE) &&
@@ -572,10 +600,15 @@ static bool smcr_lgr_match(struct smc_link_group *lgr,
 		lgr->role == role;
 }
 
+/* a loopback device has both ends of a link group on the same smcd and
+ * peer GID, tell them apart by role
+ */
 static bool smcd_lgr_match(struct smc_link_group *lgr,
-			   struct smcd_dev *smcismdev, u64 peer_gid)
+			   struct smcd_dev *smcismdev, u64 peer_gid,
+			   enum smc_lgr_role role)
 {
-	return lgr->peer_gid == peer_gid && lgr->smcd == smcismdev;
+	return lgr->peer_gid == peer_gid && lgr->smcd == smcismdev &&
+	       lgr->role == role;
 }
 
 /* create a new SMC connection (and a new link group if necessary) */
@@ -604,8 +637,8 @@ int smc_conn_create(struct smc_sock *smc, bool is_smcd, int srv_first_contact,
 	spin_lock_bh(&smc_lgr_list.lock);
 	list_for_each_entry(lgr, &smc_lgr_list.list, list) {
 		write_lock_bh(&lgr->conns_lock);
-		if ((is_smcd ? smcd_lgr_match(lgr, smcd, peer_gid) :
-		     smcr_lgr_match(lgr, lcl, role)) &&
+		if ((is_smcd ? smcd_lgr_match(lgr, smcd, peer_gid, role) :
+		     smcr_lgr_match(lgr, lcl, role, smcibdev, ibport)) &&
 		    !lgr->sync_err &&
 		    lgr->vlan_id == vlan_id &&
 		    (role == SMC_CLNT ||
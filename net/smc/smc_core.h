@@ -268,6 +268,7 @@ int smc_conn_create(struct smc_sock *smc, bool is_smcd, int srv_first_contact,
 void smcd_conn_free(struct smc_connection *conn);
 void smc_lgr_schedule_free_work_fast(struct smc_link_group *lgr);
 void smc_core_exit(void);
+int smc_lgr_port_conns(struct smc_ib_device *smcibdev, u8 ibport);
 
 static inline struct smc_link_group *smc_get_lgr(struct smc_link *link)
 {
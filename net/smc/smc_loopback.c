@@ -0,0 +1,338 @@
+// SPDX-License-Identifier: GPL-2.0
+/* Shared Memory Communications Direct over loopback (SMC-D loopback)
+ *
+ * A virtual ISM device for connections between sockets on the same host.
+ * Its DMBs are plain kernel memory, a move_data() is a memcpy() into the
+ * peer's DMB and the signal is delivered right away through
+ * smcd_handle_irq().  There is a single device, so two endpoints can talk
+ * exactly when they see the same GID; a peer on another host has a GID of
+ * its own, declines SMC-D in the CLC handshake and the connection stays on
+ * (or falls back to) what the peers agree on otherwise.
+ *
+ * The device is only offered to sockets of network namespaces that turn
+ * on net.smc.loopback.
+ */
+
+#include <linux/hashtable.h>
+#include <linux/random.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/sysctl.h>
+#include <net/net_namespace.h>
+#include <net/netns/generic.h>
+#include <net/smc.h>
+
+#include "smc_ism.h"
+#include "smc_loopback.h"
+
+#define SMC_LO_MAX_DMBS		5000
+#define SMC_LO_DMBS_HASH_BITS	12
+
+struct smc_lo_dmb_node {
+	struct hlist_node list;
+	u64 token;
+	u32 len;
+	u32 sba_idx;
+	void *cpu_addr;
+};
+
+struct smc_lo_dev {
+	struct smcd_dev *smcd;
+	DECLARE_BITMAP(sba_idx_mask, SMC_LO_MAX_DMBS);
+	rwlock_t dmb_ht_lock;	/* protects dmb_ht, and the DMBs in use */
+	DECLARE_HASHTABLE(dmb_ht, SMC_LO_DMBS_HASH_BITS);
+};
+
+struct smc_lo_net {
+	struct ctl_table_header *hdr;
+	int enabled;
+};
+
+static struct smc_lo_dev *smc_lo;
+static unsigned int smc_lo_net_id __read_mostly;
+
+static int smc_lo_query_rgid(struct smcd_dev *smcd, u64 rgid, u32 vid_valid,
+			     u32 vid)
+{
+	/* the peer shares this very device, or it is not on this host */
+	return rgid == smcd->local_gid ? 0 : -ENETUNREACH;
+}
+
+static int smc_lo_register_dmb(struct smcd_dev *smcd, struct smcd_dmb *dmb)
+{
+	struct smc_lo_dev *ldev = smcd->priv;
+	struct smc_lo_dmb_node *dmb_node, *tmp;
+	int sba_idx, rc;
+
+	if (dmb->sba_idx) {
+		if (dmb->sba_idx >= SMC_LO_MAX_DMBS ||
+		    test_and_set_bit(dmb->sba_idx, ldev->sba_idx_mask))
+			return -EINVAL;
+		sba_idx = dmb->sba_idx;
+	} else {
+		/* index 0 is what callers pass for "any", never hand it out */
+		do {
+			sba_idx = find_next_zero_bit(ldev->sba_idx_mask,
+						     SMC_LO_MAX_DMBS, 1);
+			if (sba_idx >= SMC_LO_MAX_DMBS)
+				return -ENOSPC;
+		} while (test_and_set_bit(sba_idx, ldev->sba_idx_mask));
+	}
+
+	dmb_node = kzalloc(sizeof(*dmb_node), GFP_KERNEL);
+	if (!dmb_node) {
+		rc = -ENOMEM;
+		goto err_bit;
+	}
+	/* physically contiguous, the RMB code takes virt_to_page() of it */
+	dmb_node->cpu_addr = kzalloc(dmb->dmb_len, GFP_KERNEL |
+				     __GFP_NOWARN | __GFP_NORETRY |
+				     __GFP_NOMEMALLOC);
+	if (!dmb_node->cpu_addr) {
+		rc = -ENOMEM;
+		goto err_node;
+	}
+	dmb_node->len = dmb->dmb_len;
+	dmb_node->sba_idx = sba_idx;
+
+	write_lock_bh(&ldev->dmb_ht_lock);
+again:
+	get_random_bytes(&dmb_node->token, sizeof(dmb_node->token));
+	if (!dmb_node->token)
+		goto again;
+	hash_for_each_possible(ldev->dmb_ht, tmp, list, dmb_node->token) {
+		if (tmp->token == dmb_node->token)
+			goto again;
+	}
+	hash_add(ldev->dmb_ht, &dmb_node->list, dmb_node->token);
+	write_unlock_bh(&ldev->dmb_ht_lock);
+
+	dmb->sba_idx = dmb_node->sba_idx;
+	dmb->dmb_tok = dmb_node->token;
+	dmb->cpu_addr = dmb_node->cpu_addr;
+	dmb->dma_addr = 0;
+	dmb->dmb_len = dmb_node->len;
+	return 0;
+
+err_node:
+	kfree(dmb_node);
+err_bit:
+	clear_bit(sba_idx, ldev->sba_idx_mask);
+	return rc;
+}
+
+static int smc_lo_unregister_dmb(struct smcd_dev *smcd, struct smcd_dmb *dmb)
+{
+	struct smc_lo_dev *ldev = smcd->priv;
+	struct smc_lo_dmb_node *dmb_node = NULL, *tmp;
+
+	write_lock_bh(&ldev->dmb_ht_lock);
+	hash_for_each_possible(ldev->dmb_ht, tmp, list, dmb->dmb_tok) {
+		if (tmp->token == dmb->dmb_tok) {
+			dmb_node = tmp;
+			hash_del(&dmb_node->list);
+			break;
+		}
+	}
+	write_unlock_bh(&ldev->dmb_ht_lock);
+	if (!dmb_node)
+		return -EINVAL;
+
+	clear_bit(dmb_node->sba_idx, ldev->sba_idx_mask);
+	kfree(dmb_node->cpu_addr);
+	kfree(dmb_node);
+	return 0;
+}
+
+static int smc_lo_add_vlan_id(struct smcd_dev *smcd, u64 vlan_id)
+{
+	return 0;
+}
+
+static int smc_lo_del_vlan_id(struct smcd_dev *smcd, u64 vlan_id)
+{
+	return 0;
+}
+
+static int smc_lo_set_vlan_required(struct smcd_dev *smcd)
+{
+	return 0;
+}
+
+static int smc_lo_reset_vlan_required(struct smcd_dev *smcd)
+{
+	return 0;
+}
+
+static int smc_lo_signal_event(struct smcd_dev *smcd, u64 rgid, u32 trigger_irq,
+			       u32 event_code, u64 info)
+{
+	return 0;
+}
+
+static int smc_lo_move_data(struct smcd_dev *smcd, u64 dmb_tok,
+			    unsigned int idx, bool sf, unsigned int offset,
+			    void *data, unsigned int size)
+{
+	struct smc_lo_dev *ldev = smcd->priv;
+	struct smc_lo_dmb_node *dmb_node = NULL, *tmp;
+
+	read_lock_bh(&ldev->dmb_ht_lock);
+	hash_for_each_possible(ldev->dmb_ht, tmp, list, dmb_tok) {
+		if (tmp->token == dmb_tok) {
+			dmb_node = tmp;
+			break;
+		}
+	}
+	if (!dmb_node) {
+		read_unlock_bh(&ldev->dmb_ht_lock);
+		return -EINVAL;
+	}
+	if (offset > dmb_node->len || size > dmb_node->len - offset) {
+		read_unlock_bh(&ldev->dmb_ht_lock);
+		return -EINVAL;
+	}
+	memcpy((char *)dmb_node->cpu_addr + offset, data, size);
+	if (sf)
+		smcd_handle_irq(smcd, dmb_node->sba_idx);
+	read_unlock_bh(&ldev->dmb_ht_lock);
+	return 0;
+}
+
+static const struct smcd_ops smc_lo_ops = {
+	.query_remote_gid	= smc_lo_query_rgid,
+	.register_dmb		= smc_lo_register_dmb,
+	.unregister_dmb		= smc_lo_unregister_dmb,
+	.add_vlan_id		= smc_lo_add_vlan_id,
+	.del_vlan_id		= smc_lo_del_vlan_id,
+	.set_vlan_required	= smc_lo_set_vlan_required,
+	.reset_vlan_required	= smc_lo_reset_vlan_required,
+	.signal_event		= smc_lo_signal_event,
+	.move_data		= smc_lo_move_data,
+};
+
+bool smc_lo_is_dev(struct smcd_dev *smcd)
+{
+	return smcd->ops == &smc_lo_ops;
+}
+
+/* Offer the loopback device to a socket whose namespace allows it. */
+void smc_lo_find_dev(struct net *net, struct smcd_dev **smcismdev)
+{
+	struct smc_lo_net *ln = net_generic(net, smc_lo_net_id);
+
+	if (smc_lo && READ_ONCE(ln->enabled))
+		*smcismdev = smc_lo->smcd;
+}
+
+static int zero;
+static int one = 1;
+
+static struct ctl_table smc_lo_table[] = {
+	{
+		.procname	= "loopback",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &zero,
+		.extra2		= &one,
+	},
+	{ }
+};
+
+static int __net_init smc_lo_net_init(struct net *net)
+{
+	struct smc_lo_net *ln = net_generic(net, smc_lo_net_id);
+	struct ctl_table *table;
+
+	table = kmemdup(smc_lo_table, sizeof(smc_lo_table), GFP_KERNEL);
+	if (!table)
+		return -ENOMEM;
+	table[0].data = &ln->enabled;
+
+	ln->enabled = 0;
+	ln->hdr = register_net_sysctl(net, "net/smc", table);
+	if (!ln->hdr) {
+		kfree(table);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+static void __net_exit smc_lo_net_exit(struct net *net)
+{
+	struct smc_lo_net *ln = net_generic(net, smc_lo_net_id);
+	struct ctl_table *table = ln->hdr->ctl_table_arg;
+
+	unregister_net_sysctl_table(ln->hdr);
+	kfree(table);
+}
+
+static struct pernet_operations smc_lo_net_ops = {
+	.init = smc_lo_net_init,
+	.exit = smc_lo_net_exit,
+	.id   = &smc_lo_net_id,
+	.size = sizeof(struct smc_lo_net),
+};
+
+int __init smc_lo_init(void)
+{
+	struct smc_lo_dev *ldev;
+	struct smcd_dev *smcd;
+	int rc;
+
+	ldev = kzalloc(sizeof(*ldev), GFP_KERNEL);
+	if (!ldev)
+		return -ENOMEM;
+	rwlock_init(&ldev->dmb_ht_lock);
+	hash_init(ldev->dmb_ht);
+
+	smcd = smcd_alloc_dev(NULL, "loopback-ism", &smc_lo_ops,
+			      SMC_LO_MAX_DMBS);
+	if (!smcd) {
+		rc = -ENOMEM;
+		goto out_ldev;
+	}
+	smcd->priv = ldev;
+	do {
+		get_random_bytes(&smcd->local_gid, sizeof(smcd->local_gid));
+	} while (!smcd->local_gid);
+	ldev->smcd = smcd;
+
+	rc = register_pernet_subsys(&smc_lo_net_ops);
+	if (rc)
+		goto out_smcd;
+
+	rc = smcd_register_dev(smcd);
+	if (rc) {
+		spin_lock(&smcd_dev_list.lock);
+		list_del(&smcd->list);
+		spin_unlock(&smcd_dev_list.lock);
+		destroy_workqueue(smcd->event_wq);
+		goto out_pernet;
+	}
+
+	smc_lo = ldev;
+	return 0;
+
+out_pernet:
+	unregister_pernet_subsys(&smc_lo_net_ops);
+out_smcd:
+	smcd_free_dev(smcd);
+out_ldev:
+	kfree(ldev);
+	return rc;
+}
+
+void smc_lo_exit(void)
+{
+	struct smc_lo_dev *ldev = smc_lo;
+
+	if (!ldev)
+		return;
+	smc_lo = NULL;
+	smcd_unregister_dev(ldev->smcd);
+	smcd_free_dev(ldev->smcd);
+	unregister_pernet_subsys(&smc_lo_net_ops);
+	kfree(ldev);
+}
@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Shared Memory Communications Direct over loopback (SMC-D loopback)
+ *
+ * SMC-D loopback device definitions.
+ */
+
+#ifndef SMC_LOOPBACK_H
+#define SMC_LOOPBACK_H
+
+#include <net/net_namespace.h>
+
+struct smcd_dev;
+
+#if IS_ENABLED(CONFIG_SMC_LO)
+int smc_lo_init(void) __init;
+void smc_lo_exit(void);
+bool smc_lo_is_dev(struct smcd_dev *smcd);
+void smc_lo_find_dev(struct net *net, struct smcd_dev **smcismdev);
+#else
+static inline int smc_lo_init(void)
+{
+	return 0;
+}
+
+static inline void smc_lo_exit(void)
+{
+}
+
+static inline bool smc_lo_is_dev(struct smcd_dev *smcd)
+{
+	return false;
+}
+
+static inline void smc_lo_find_dev(struct net *net,
+				   struct smcd_dev **smcismdev)
+{
+}
+#endif
+
+#endif
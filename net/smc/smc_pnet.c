@@ -21,8 +21,10 @@
 #include <rdma/ib_verbs.h>
 
 #include "smc_pnet.h"
+#include "smc_core.h"
 #include "smc_ib.h"
 #include "smc_ism.h"
+#include "smc_loopback.h"
 
 static struct nla_policy smc_pnet_policy[SMC_PNETID_MAX + 1] = {
 	[SMC_PNETID_NAME] = {
@@ -115,7 +117,6 @@ static int smc_pnet_remove_by_pnetid(char *pnet_name)
 			dev_put(pnetelem->ndev);
 			kfree(pnetelem);
 			rc = 0;
-			break;
 		}
 	}
 	write_unlock(&smc_pnettable.lock);
@@ -137,7 +138,6 @@ static int smc_pnet_remove_by_ndev(struct net_device *ndev)
 			dev_put(pnetelem->ndev);
 			kfree(pnetelem);
 			rc = 0;
-			break;
 		}
 	}
 	write_unlock(&smc_pnettable.lock);
@@ -159,7 +159,6 @@ int smc_pnet_remove_by_ibdev(struct smc_ib_device *ibdev)
 			dev_put(pnetelem->ndev);
 			kfree(pnetelem);
 			rc = 0;
-			break;
 		}
 	}
 	write_unlock(&smc_pnettable.lock);
@@ -167,18 +166,24 @@ int smc_pnet_remove_by_ibdev(struct smc_ib_device *ibdev)
 }
 
 /* Append a pnetid to the end of the pnet table if not already on this list.
+ * A pnetid may be entered more than once to put several IB device ports
+ * behind the same network device, new link groups are spread over them.
  */
 static int smc_pnet_enter(struct smc_pnetentry *new_pnetelem)
 {
 	struct smc_pnetentry *pnetelem;
+	bool same_name, same_ndev;
 	int rc = -EEXIST;
 
 	write_lock(&smc_pnettable.lock);
 	list_for_each_entry(pnetelem, &smc_pnettable.pnetlist, list) {
-		if (!strncmp(pnetelem->pnet_name, new_pnetelem->pnet_name,
-			     sizeof(new_pnetelem->pnet_name)) ||
-		    !strncmp(pnetelem->ndev->name, new_pnetelem->ndev->name,
-			     sizeof(new_pnetelem->ndev->name)) ||
+		same_name = !strncmp(pnetelem->pnet_name,
+				     new_pnetelem->pnet_name,
+				     sizeof(new_pnetelem->pnet_name));
+		same_ndev = !strncmp(pnetelem->ndev->name,
+				     new_pnetelem->ndev->name,
+				     sizeof(new_pnetelem->ndev->name));
+		if (same_name != same_ndev ||
 		    smc_pnet_same_ibname(pnetelem,
 					 new_pnetelem->smcibdev->ibdev->name,
 					 new_pnetelem->ib_port)) {
@@ -535,8 +540,8 @@ static struct net_device *pnet_find_base_ndev(struct net_device *ndev)
 }
 
 /* Determine the corresponding IB device port based on the hardware PNETID.
- * Searching stops at the first matching active IB device port with vlan_id
- * configured.
+ * Of the matching active IB device ports with vlan_id configured, take the
+ * one carrying the fewest connections.
  */
 static void smc_pnet_find_roce_by_pnetid(struct net_device *ndev,
 					 struct smc_ib_device **smcibdev,
@@ -545,6 +550,7 @@ static void smc_pnet_find_roce_by_pnetid(struct net_device *ndev,
 {
 	u8 ndev_pnetid[SMC_MAX_PNETID_LEN];
 	struct smc_ib_device *ibdev;
+	int conns, min_conns = INT_MAX;
 	int i;
 
 	ndev = pnet_find_base_ndev(ndev);
@@ -557,18 +563,21 @@ static void smc_pnet_find_roce_by_pnetid(struct net_device *ndev,
 		for (i = 1; i <= SMC_MAX_PORTS; i++) {
 			if (!rdma_is_port_valid(ibdev->ibdev, i))
 				continue;
-			if (!memcmp(ibdev->pnetid[i - 1], ndev_pnetid,
-				    SMC_MAX_PNETID_LEN) &&
-			    smc_ib_port_active(ibdev, i) &&
-			    !smc_ib_determine_gid(ibdev, i, vlan_id, gid,
-						  NULL))  {
+			if (memcmp(ibdev->pnetid[i - 1], ndev_pnetid,
+				   SMC_MAX_PNETID_LEN) ||
+			    !smc_ib_port_active(ibdev, i) ||
+			    smc_ib_determine_gid(ibdev, i, vlan_id, NULL, NULL))
+				continue;
+			conns = smc_lgr_port_conns(ibdev, i);
+			if (conns < min_conns) {
+				min_conns = conns;
 				*smcibdev = ibdev;
 				*ibport = i;
-				goto out;
 			}
 		}
 	}
-out:
+	if (*smcibdev)
+		smc_ib_determine_gid(*smcibdev, *ibport, vlan_id, gid, NULL);
 	spin_unlock(&smc_ib_devices.lock);
 }
 
@@ -585,6 +594,8 @@ static void smc_pnet_find_ism_by_pnetid(struct net_device *ndev,
 
 	spin_lock(&smcd_dev_list.lock);
 	list_for_each_entry(ismdev, &smcd_dev_list.list, list) {
+		if (smc_lo_is_dev(ismdev))
+			continue;
 		if (!memcmp(ismdev->pnetid, ndev_pnetid, SMC_MAX_PNETID_LEN)) {
 			*smcismdev = ismdev;
 			break;
@@ -600,21 +611,27 @@ static void smc_pnet_find_roce_by_table(struct net_device *netdev,
 					u8 gid[])
 {
 	struct smc_pnetentry *pnetelem;
+	int conns, min_conns = INT_MAX;
 
 	read_lock(&smc_pnettable.lock);
 	list_for_each_entry(pnetelem, &smc_pnettable.pnetlist, list) {
-		if (netdev == pnetelem->ndev) {
-			if (smc_ib_port_active(pnetelem->smcibdev,
-					       pnetelem->ib_port) &&
-			    !smc_ib_determine_gid(pnetelem->smcibdev,
-						  pnetelem->ib_port, vlan_id,
-						  gid, NULL)) {
-				*smcibdev = pnetelem->smcibdev;
-				*ibport = pnetelem->ib_port;
-			}
-			break;
+		if (netdev != pnetelem->ndev ||
+		    !smc_ib_port_active(pnetelem->smcibdev,
+					pnetelem->ib_port) ||
+		    smc_ib_determine_gid(pnetelem->smcibdev, pnetelem->ib_port,
+					 vlan_id, NULL, NULL))
+			continue;
+		/* several ports may serve netdev, take the least loaded */
+		conns = smc_lgr_port_conns(pnetelem->smcibdev,
+					   pnetelem->ib_port);
+		if (conns < min_conns) {
+			min_conns = conns;
+			*smcibdev = pnetelem->smcibdev;
+			*ibport = pnetelem->ib_port;
 		}
 	}
+	if (*smcibdev)
+		smc_ib_determine_gid(*smcibdev, *ibport, vlan_id, gid, NULL);
 	read_unlock(&smc_pnettable.lock);
 }
 
@@ -662,6 +679,11 @@ void smc_pnet_find_ism_resource(struct sock *sk, struct smcd_dev **smcismdev)
 
 	/* if possible, lookup via hardware-defined pnetid */
 	smc_pnet_find_ism_by_pnetid(dst->dev, smcismdev);
+	if (*smcismdev)
+		goto out_rel;
+
+	/* the peer may be on this host, try the loopback device */
+	smc_lo_find_dev(sock_net(sk), smcismdev);
 
 out_rel:
 	dst_release(dst);
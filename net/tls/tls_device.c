@@ -706,6 +706,12 @@ int tls_set_device_offload(struct sock *sk, struct tls_context *ctx)
 		goto out;
 	}
 
+	/* devices only know about TLS 1.2 AES-GCM records */
+	if (ctx->crypto_send.info.version != TLS_1_2_VERSION) {
+		rc = -EOPNOTSUPP;
+		goto out;
+	}
+
 	start_marker_record = kmalloc(sizeof(*start_marker_record), GFP_KERNEL);
 	if (!start_marker_record) {
 		rc = -ENOMEM;
@@ -853,6 +859,10 @@ int tls_set_device_offload_rx(struct sock *sk, struct tls_context *ctx)
 	struct net_device *netdev;
 	int rc = 0;
 
+	if (ctx->crypto_recv.info.version != TLS_1_2_VERSION ||
+	    ctx->crypto_recv.info.cipher_type != TLS_CIPHER_AES_GCM_128)
+		return -EOPNOTSUPP;
+
 	/* We support starting offload on multiple sockets
 	 * concurrently, so we only need a read lock here.
 	 * This lock must precede get_netdev_for_sock to prevent races between
@@ -377,6 +377,29 @@ static int do_tls_getsockopt_tx(struct sock *sk, char __user *optval,
 			rc = -EFAULT;
 		break;
 	}
+	case TLS_CIPHER_CHACHA20_POLY1305: {
+		struct tls12_crypto_info_chacha20_poly1305 *
+		  crypto_info_chacha20_poly1305 =
+		  container_of(crypto_info,
+			       struct tls12_crypto_info_chacha20_poly1305,
+			       info);
+
+		if (len != sizeof(*crypto_info_chacha20_poly1305)) {
+			rc = -EINVAL;
+			goto out;
+		}
+		lock_sock(sk);
+		memcpy(crypto_info_chacha20_poly1305->iv, ctx->tx.iv,
+		       TLS_CIPHER_CHACHA20_POLY1305_IV_SIZE);
+		memcpy(crypto_info_chacha20_poly1305->rec_seq, ctx->tx.rec_seq,
+		       TLS_CIPHER_CHACHA20_POLY1305_REC_SEQ_SIZE);
+		release_sock(sk);
+		if (copy_to_user(optval,
+				 crypto_info_chacha20_poly1305,
+				 sizeof(*crypto_info_chacha20_poly1305)))
+			rc = -EFAULT;
+		break;
+	}
 	default:
 		rc = -EINVAL;
 	}
@@ -443,7 +466,8 @@ static int do_tls_setsockopt_conf(struct sock *sk, char __user *optval,
 	}
 
 	/* check version */
-	if (crypto_info->version != TLS_1_2_VERSION) {
+	if (crypto_info->version != TLS_1_2_VERSION &&
+	    crypto_info->version != TLS_1_3_VERSION) {
 		rc = -ENOTSUPP;
 		goto err_crypto_info;
 	}
@@ -454,10 +478,12 @@ static int do_tls_setsockopt_conf(struct sock *sk, char __user *optval,
 			rc = -EINVAL;
 			goto err_crypto_info;
 		}
-		rc = copy_from_user(crypto_info + 1, optval + sizeof(*crypto_info),
-				    optlen - sizeof(*crypto_info));
-		if (rc) {
-			rc = -EFAULT;
+		break;
+	}
+	case TLS_CIPHER_CHACHA20_POLY1305: {
+		if (optlen !=
+		    sizeof(struct tls12_crypto_info_chacha20_poly1305)) {
+			rc = -EINVAL;
 			goto err_crypto_info;
 		}
 		break;
@@ -467,6 +493,13 @@ static int do_tls_setsockopt_conf(struct sock *sk, char __user *optval,
 		goto err_crypto_info;
 	}
 
+	rc = copy_from_user(crypto_info + 1, optval + sizeof(*crypto_info),
+			    optlen - sizeof(*crypto_info));
+	if (rc) {
+		rc = -EFAULT;
+		goto err_crypto_info;
+	}
+
 	if (tx) {
 #ifdef CONFIG_TLS_DEVICE
 		rc = tls_set_device_offload(sk, ctx);
@@ -41,28 +41,100 @@
 #include <net/strparser.h>
 #include <net/tls.h>
 
-#define MAX_IV_SIZE	TLS_CIPHER_AES_GCM_128_IV_SIZE
+#define MAX_IV_SIZE	16
+
+/* Completion of a record decrypted straight into user pages, see
+ * tls_sw_recvmsg(): the request, the pages and the skb were left to us.
+ */
+static void tls_decrypt_done(struct crypto_async_request *req, int err)
+{
+	struct aead_request *aead_req = (struct aead_request *)req;
+	struct scatterlist *sgout = aead_req->dst;
+	struct tls_sw_context_rx *ctx;
+	struct tls_context *tls_ctx;
+	struct scatterlist *sg;
+	struct sk_buff *skb;
+	unsigned int pages;
+	int pending;
+
+	/* a backlogged request is being started, it will complete later */
+	if (err == -EINPROGRESS)
+		return;
+
+	skb = (struct sk_buff *)req->data;
+	tls_ctx = tls_get_ctx(skb->sk);
+	ctx = tls_sw_ctx_rx(tls_ctx);
+
+	if (err) {
+		ctx->async_wait.err = err;
+		tls_err_abort(skb->sk, EBADMSG);
+	}
+
+	/* skb->sk only carried the socket here, see tls_do_decryption() */
+	skb->sk = NULL;
+	kfree_skb(skb);
+
+	/* the first entry is the AAD */
+	for_each_sg(sg_next(sgout), sg, UINT_MAX, pages) {
+		if (!sg)
+			break;
+		put_page(sg_page(sg));
+	}
+
+	kfree(aead_req);
+
+	pending = atomic_dec_return(&ctx->decrypt_pending);
+	if (!pending && READ_ONCE(ctx->async_notify))
+		complete(&ctx->async_wait.completion);
+}
 
 static int tls_do_decryption(struct sock *sk,
+			     struct sk_buff *skb,
 			     struct scatterlist *sgin,
 			     struct scatterlist *sgout,
 			     char *iv_recv,
 			     size_t data_len,
-			     struct aead_request *aead_req)
+			     struct aead_request *aead_req,
+			     bool async)
 {
 	struct tls_context *tls_ctx = tls_get_ctx(sk);
 	struct tls_sw_context_rx *ctx = tls_sw_ctx_rx(tls_ctx);
 	int ret;
 
 	aead_request_set_tfm(aead_req, ctx->aead_recv);
-	aead_request_set_ad(aead_req, TLS_AAD_SPACE_SIZE);
+	aead_request_set_ad(aead_req, tls_ctx->rx.aad_size);
 	aead_request_set_crypt(aead_req, sgin, sgout,
 			       data_len + tls_ctx->rx.tag_size,
 			       (u8 *)iv_recv);
-	aead_request_set_callback(aead_req, CRYPTO_TFM_REQ_MAY_BACKLOG,
-				  crypto_req_done, &ctx->async_wait);
 
-	ret = crypto_wait_req(crypto_aead_decrypt(aead_req), &ctx->async_wait);
+	if (async) {
+		/* The skb is a clone from strparser, skb->sk is free to pass
+		 * the socket to tls_decrypt_done(), which clears it again.
+		 */
+		skb->sk = sk;
+		aead_request_set_callback(aead_req,
+					  CRYPTO_TFM_REQ_MAY_BACKLOG,
+					  tls_decrypt_done, skb);
+		atomic_inc(&ctx->decrypt_pending);
+	} else {
+		aead_request_set_callback(aead_req,
+					  CRYPTO_TFM_REQ_MAY_BACKLOG,
+					  crypto_req_done, &ctx->async_wait);
+	}
+
+	ret = crypto_aead_decrypt(aead_req);
+	if (ret == -EINPROGRESS || ret == -EBUSY) {
+		if (async)
+			return -EINPROGRESS;
+
+		ret = crypto_wait_req(ret, &ctx->async_wait);
+	}
+
+	if (async) {
+		skb->sk = NULL;
+		atomic_dec(&ctx->decrypt_pending);
+	}
+
 	return ret;
 }
 
@@ -142,7 +214,7 @@ static int alloc_plaintext_sg(struct sock *sk, int len)
 			 tls_ctx->pending_open_record_frags);
 
 	if (rc == -ENOSPC)
-		ctx->sg_plaintext_num_elem = ARRAY_SIZE(ctx->sg_plaintext_data);
+		ctx->sg_plaintext_num_elem = MAX_SKB_FRAGS;
 
 	return rc;
 }
@@ -175,7 +247,7 @@ static void tls_free_both_sg(struct sock *sk)
 static int tls_do_encryption(struct tls_context *tls_ctx,
 			     struct tls_sw_context_tx *ctx,
 			     struct aead_request *aead_req,
-			     size_t data_len)
+			     size_t data_len, char *iv)
 {
 	int rc;
 
@@ -183,9 +255,9 @@ static int tls_do_encryption(struct tls_context *tls_ctx,
 	ctx->sg_encrypted_data[0].length -= tls_ctx->tx.prepend_size;
 
 	aead_request_set_tfm(aead_req, ctx->aead_send);
-	aead_request_set_ad(aead_req, TLS_AAD_SPACE_SIZE);
+	aead_request_set_ad(aead_req, tls_ctx->tx.aad_size);
 	aead_request_set_crypt(aead_req, ctx->sg_aead_in, ctx->sg_aead_out,
-			       data_len, tls_ctx->tx.iv);
+			       data_len, iv);
 
 	aead_request_set_callback(aead_req, CRYPTO_TFM_REQ_MAY_BACKLOG,
 				  crypto_req_done, &ctx->async_wait);
@@ -203,19 +275,41 @@ static int tls_push_record(struct sock *sk, int flags,
 {
 	struct tls_context *tls_ctx = tls_get_ctx(sk);
 	struct tls_sw_context_tx *ctx = tls_sw_ctx_tx(tls_ctx);
+	u16 version = tls_ctx->crypto_send.info.version;
+	int data_len = ctx->sg_plaintext_size;
 	struct aead_request *req;
+	char iv[MAX_IV_SIZE];
 	int rc;
 
 	req = aead_request_alloc(ctx->aead_send, sk->sk_allocation);
 	if (!req)
 		return -ENOMEM;
 
-	sg_mark_end(ctx->sg_plaintext_data + ctx->sg_plaintext_num_elem - 1);
+	if (tls_ctx->tx.tail_size) {
+		struct scatterlist *sg = ctx->sg_plaintext_data +
+					 ctx->sg_plaintext_num_elem;
+
+		/* the record type is encrypted after the data */
+		ctx->content_type = record_type;
+		if (ctx->sg_plaintext_num_elem)
+			sg_unmark_end(sg - 1);
+		sg_set_buf(sg, &ctx->content_type, tls_ctx->tx.tail_size);
+		sg_mark_end(sg);
+		data_len += tls_ctx->tx.tail_size;
+	} else {
+		sg_mark_end(ctx->sg_plaintext_data +
+			    ctx->sg_plaintext_num_elem - 1);
+	}
 	sg_mark_end(ctx->sg_encrypted_data + ctx->sg_encrypted_num_elem - 1);
 
-	tls_make_aad(ctx->aad_space, ctx->sg_plaintext_size,
+	memcpy(iv, tls_ctx->tx.iv, crypto_aead_ivsize(ctx->aead_send));
+	if (!tls_nonce_explicit(&tls_ctx->tx))
+		tls_xor_iv_with_seq(iv, tls_ctx->tx.rec_seq);
+
+	tls_make_aad(ctx->aad_space, version == TLS_1_3_VERSION ?
+		     data_len + tls_ctx->tx.tag_size : data_len,
 		     tls_ctx->tx.rec_seq, tls_ctx->tx.rec_seq_size,
-		     record_type);
+		     record_type, version);
 
 	tls_fill_prepend(tls_ctx,
 			 page_address(sg_page(&ctx->sg_encrypted_data[0])) +
@@ -225,7 +319,7 @@ static int tls_push_record(struct sock *sk, int flags,
 	tls_ctx->pending_open_record_frags = 0;
 	set_bit(TLS_PENDING_CLOSED_RECORD, &tls_ctx->flags);
 
-	rc = tls_do_encryption(tls_ctx, ctx, req, ctx->sg_plaintext_size);
+	rc = tls_do_encryption(tls_ctx, ctx, req, data_len, iv);
 	if (rc < 0) {
 		/* If we are called from write_space and
 		 * we fail, we need to set this SOCK_NOSPACE
@@ -417,8 +511,7 @@ int tls_sw_sendmsg(struct sock *sk, struct msghdr *msg, size_t size)
 			ret = zerocopy_from_iter(sk, &msg->msg_iter,
 				try_to_copy, &ctx->sg_plaintext_num_elem,
 				&ctx->sg_plaintext_size,
-				ctx->sg_plaintext_data,
-				ARRAY_SIZE(ctx->sg_plaintext_data),
+				ctx->sg_plaintext_data, MAX_SKB_FRAGS,
 				true);
 			if (ret)
 				goto fallback_to_reg_send;
@@ -579,8 +672,7 @@ int tls_sw_sendpage(struct sock *sk, struct page *page,
 		tls_ctx->pending_open_record_frags = ctx->sg_plaintext_num_elem;
 
 		if (full_record || eor ||
-		    ctx->sg_plaintext_num_elem ==
-		    ARRAY_SIZE(ctx->sg_plaintext_data)) {
+		    ctx->sg_plaintext_num_elem == MAX_SKB_FRAGS) {
 push_record:
 			ret = tls_push_record(sk, flags, record_type);
 			if (ret) {
@@ -668,7 +760,7 @@ static struct sk_buff *tls_wait_data(struct sock *sk, int flags,
 static int decrypt_internal(struct sock *sk, struct sk_buff *skb,
 			    struct iov_iter *out_iov,
 			    struct scatterlist *out_sg,
-			    int *chunk, bool *zc)
+			    int *chunk, bool *zc, bool async)
 {
 	struct tls_context *tls_ctx = tls_get_ctx(sk);
 	struct tls_sw_context_rx *ctx = tls_sw_ctx_rx(tls_ctx);
@@ -680,6 +772,7 @@ static int decrypt_internal(struct sock *sk, struct sk_buff *skb,
 	struct scatterlist *sgin = NULL;
 	struct scatterlist *sgout = NULL;
 	const int data_len = rxm->full_len - tls_ctx->rx.overhead_size;
+	u16 version = tls_ctx->crypto_recv.info.version;
 
 	if (*zc && (out_iov || out_sg)) {
 		if (out_iov)
@@ -721,23 +814,29 @@ static int decrypt_internal(struct sock *sk, struct sk_buff *skb,
 	iv = aad + TLS_AAD_SPACE_SIZE;
 
 	/* Prepare IV */
-	err = skb_copy_bits(skb, rxm->offset + TLS_HEADER_SIZE,
-			    iv + TLS_CIPHER_AES_GCM_128_SALT_SIZE,
-			    tls_ctx->rx.iv_size);
-	if (err < 0) {
-		kfree(mem);
-		return err;
+	if (tls_nonce_explicit(&tls_ctx->rx)) {
+		err = skb_copy_bits(skb, rxm->offset + TLS_HEADER_SIZE,
+				    iv + TLS_CIPHER_AES_GCM_128_SALT_SIZE,
+				    tls_ctx->rx.iv_size);
+		if (err < 0) {
+			kfree(mem);
+			return err;
+		}
+		memcpy(iv, tls_ctx->rx.iv, TLS_CIPHER_AES_GCM_128_SALT_SIZE);
+	} else {
+		memcpy(iv, tls_ctx->rx.iv, crypto_aead_ivsize(ctx->aead_recv));
+		tls_xor_iv_with_seq(iv, tls_ctx->rx.rec_seq);
 	}
-	memcpy(iv, tls_ctx->rx.iv, TLS_CIPHER_AES_GCM_128_SALT_SIZE);
 
 	/* Prepare AAD */
-	tls_make_aad(aad, rxm->full_len - tls_ctx->rx.overhead_size,
+	tls_make_aad(aad, version == TLS_1_3_VERSION ?
+		     rxm->full_len - TLS_HEADER_SIZE : data_len,
 		     tls_ctx->rx.rec_seq, tls_ctx->rx.rec_seq_size,
-		     ctx->control);
+		     ctx->control, version);
 
 	/* Prepare sgin */
 	sg_init_table(sgin, n_sgin);
-	sg_set_buf(&sgin[0], aad, TLS_AAD_SPACE_SIZE);
+	sg_set_buf(&sgin[0], aad, tls_ctx->rx.aad_size);
 	err = skb_to_sgvec(skb, &sgin[1],
 			   rxm->offset + tls_ctx->rx.prepend_size,
 			   rxm->full_len - tls_ctx->rx.prepend_size);
@@ -749,7 +848,7 @@ static int decrypt_internal(struct sock *sk, struct sk_buff *skb,
 	if (n_sgout) {
 		if (out_iov) {
 			sg_init_table(sgout, n_sgout);
-			sg_set_buf(&sgout[0], aad, TLS_AAD_SPACE_SIZE);
+			sg_set_buf(&sgout[0], aad, tls_ctx->rx.aad_size);
 
 			*chunk = 0;
 			err = zerocopy_from_iter(sk, out_iov, data_len, &pages,
@@ -770,8 +869,15 @@ static int decrypt_internal(struct sock *sk, struct sk_buff *skb,
 		*zc = false;
 	}
 
-	/* Prepare and submit AEAD request */
-	err = tls_do_decryption(sk, sgin, sgout, iv, data_len, aead_req);
+	/* Prepare and submit AEAD request, only a decryption straight into
+	 * the user's pages can be left to complete on its own.
+	 */
+	err = tls_do_decryption(sk, skb, sgin, sgout, iv,
+				rxm->full_len - tls_ctx->rx.prepend_size -
+				tls_ctx->rx.tag_size,
+				aead_req, async && pages);
+	if (err == -EINPROGRESS)
+		return err;
 
 	/* Release the pages in case iov was mapped to pages */
 	for (; pages > 0; pages--)
@@ -781,12 +887,39 @@ static int decrypt_internal(struct sock *sk, struct sk_buff *skb,
 	return err;
 }
 
+/* TLS 1.3 has the record type in the last non zero byte of the decrypted
+ * data, the zeroes after it are padding.  Returns the padding length.
+ */
+static int tls13_parse_record_type(struct sock *sk, struct sk_buff *skb)
+{
+	struct tls_context *tls_ctx = tls_get_ctx(sk);
+	struct tls_sw_context_rx *ctx = tls_sw_ctx_rx(tls_ctx);
+	struct strp_msg *rxm = strp_msg(skb);
+	int data_end = rxm->full_len - tls_ctx->rx.tag_size;
+	int pos, err;
+	u8 type;
+
+	for (pos = data_end - 1; pos >= tls_ctx->rx.prepend_size; pos--) {
+		err = skb_copy_bits(skb, rxm->offset + pos, &type, 1);
+		if (err < 0)
+			return err;
+		if (type) {
+			ctx->control = type;
+			return data_end - 1 - pos;
+		}
+	}
+
+	return -EBADMSG;
+}
+
 static int decrypt_skb_update(struct sock *sk, struct sk_buff *skb,
-			      struct iov_iter *dest, int *chunk, bool *zc)
+			      struct iov_iter *dest, int *chunk, bool *zc,
+			      bool async)
 {
 	struct tls_context *tls_ctx = tls_get_ctx(sk);
 	struct tls_sw_context_rx *ctx = tls_sw_ctx_rx(tls_ctx);
 	struct strp_msg *rxm = strp_msg(skb);
+	int padding = 0;
 	int err = 0;
 
 #ifdef CONFIG_TLS_DEVICE
@@ -795,15 +928,25 @@ static int decrypt_skb_update(struct sock *sk, struct sk_buff *skb,
 		return err;
 #endif
 	if (!ctx->decrypted) {
-		err = decrypt_internal(sk, skb, dest, NULL, chunk, zc);
-		if (err < 0)
+		err = decrypt_internal(sk, skb, dest, NULL, chunk, zc, async);
+		if (err < 0) {
+			/* the record is gone to tls_decrypt_done() */
+			if (err == -EINPROGRESS)
+				tls_advance_record_sn(sk, &tls_ctx->rx);
 			return err;
+		}
+
+		if (tls_ctx->crypto_recv.info.version == TLS_1_3_VERSION) {
+			padding = tls13_parse_record_type(sk, skb);
+			if (padding < 0)
+				return padding;
+		}
 	} else {
 		*zc = false;
 	}
 
 	rxm->offset += tls_ctx->rx.prepend_size;
-	rxm->full_len -= tls_ctx->rx.overhead_size;
+	rxm->full_len -= tls_ctx->rx.overhead_size + padding;
 	tls_advance_record_sn(sk, &tls_ctx->rx);
 	ctx->decrypted = true;
 	ctx->saved_data_ready(sk);
@@ -817,26 +960,30 @@ int decrypt_skb(struct sock *sk, struct sk_buff *skb,
 	bool zc = true;
 	int chunk;
 
-	return decrypt_internal(sk, skb, NULL, sgout, &chunk, &zc);
+	return decrypt_internal(sk, skb, NULL, sgout, &chunk, &zc, false);
 }
 
+/* A NULL @skb is a record handed over to tls_decrypt_done() */
 static bool tls_sw_advance_skb(struct sock *sk, struct sk_buff *skb,
 			       unsigned int len)
 {
 	struct tls_context *tls_ctx = tls_get_ctx(sk);
 	struct tls_sw_context_rx *ctx = tls_sw_ctx_rx(tls_ctx);
-	struct strp_msg *rxm = strp_msg(skb);
 
-	if (len < rxm->full_len) {
-		rxm->offset += len;
-		rxm->full_len -= len;
+	if (skb) {
+		struct strp_msg *rxm = strp_msg(skb);
+
+		if (len < rxm->full_len) {
+			rxm->offset += len;
+			rxm->full_len -= len;
 
-		return false;
+			return false;
+		}
+		kfree_skb(skb);
 	}
 
 	/* Finished with message */
 	ctx->recv_pkt = NULL;
-	kfree_skb(skb);
 	__strp_unpause(&ctx->strp);
 
 	return true;
@@ -851,12 +998,14 @@ int tls_sw_recvmsg(struct sock *sk,
 {
 	struct tls_context *tls_ctx = tls_get_ctx(sk);
 	struct tls_sw_context_rx *ctx = tls_sw_ctx_rx(tls_ctx);
+	bool tls13 = tls_ctx->crypto_recv.info.version == TLS_1_3_VERSION;
 	unsigned char control;
 	struct strp_msg *rxm;
 	struct sk_buff *skb;
 	ssize_t copied = 0;
 	bool cmsg = false;
 	int target, err = 0;
+	int num_async = 0;
 	long timeo;
 	bool is_kvec = iov_iter_is_kvec(&msg->msg_iter);
 
@@ -871,6 +1020,7 @@ int tls_sw_recvmsg(struct sock *sk,
 	timeo = sock_rcvtimeo(sk, flags & MSG_DONTWAIT);
 	do {
 		bool zc = false;
+		bool async = false;
 		int chunk = 0;
 
 		skb = tls_wait_data(sk, flags, timeo, &err);
@@ -878,6 +1028,19 @@ int tls_sw_recvmsg(struct sock *sk,
 			goto recv_end;
 
 		rxm = strp_msg(skb);
+
+		/* The type of a TLS 1.3 record is only known once decrypted,
+		 * so it can't go to the user's buffer directly.
+		 */
+		if (tls13 && !ctx->decrypted) {
+			err = decrypt_skb_update(sk, skb, NULL, &chunk, &zc,
+						 false);
+			if (err < 0) {
+				tls_err_abort(sk, EBADMSG);
+				goto recv_end;
+			}
+		}
+
 		if (!cmsg) {
 			int cerr;
 
@@ -902,8 +1065,19 @@ int tls_sw_recvmsg(struct sock *sk,
 			    likely(!(flags & MSG_PEEK)))
 				zc = true;
 
+			/* Data going straight to the user's pages needs
+			 * nothing more from us once decrypted, the AEAD can
+			 * complete it while the next records are handled.
+			 */
+			async = zc && ctx->async_capable &&
+				ctx->control == TLS_RECORD_TYPE_DATA;
 			err = decrypt_skb_update(sk, skb, &msg->msg_iter,
-						 &chunk, &zc);
+						 &chunk, &zc, async);
+			if (err == -EINPROGRESS) {
+				num_async++;
+				goto pick_next_record;
+			}
+			async = false;
 			if (err < 0) {
 				tls_err_abort(sk, EBADMSG);
 				goto recv_end;
@@ -919,12 +1093,13 @@ int tls_sw_recvmsg(struct sock *sk,
 				goto recv_end;
 		}
 
+pick_next_record:
 		copied += chunk;
 		len -= chunk;
 		if (likely(!(flags & MSG_PEEK))) {
 			u8 control = ctx->control;
 
-			if (tls_sw_advance_skb(sk, skb, chunk)) {
+			if (tls_sw_advance_skb(sk, async ? NULL : skb, chunk)) {
 				/* Return full control message to
 				 * userspace before trying to parse
 				 * another message type
@@ -948,6 +1123,22 @@ int tls_sw_recvmsg(struct sock *sk,
 	} while (len);
 
 recv_end:
+	if (num_async) {
+		/* Wait for all the records left to the AEAD */
+		smp_store_mb(ctx->async_notify, true);
+		if (atomic_read(&ctx->decrypt_pending)) {
+			err = crypto_wait_req(-EINPROGRESS, &ctx->async_wait);
+			if (err) {
+				/* one of them failed, the data is not good */
+				tls_err_abort(sk, EBADMSG);
+				copied = 0;
+			}
+		} else {
+			reinit_completion(&ctx->async_wait.completion);
+		}
+		WRITE_ONCE(ctx->async_notify, false);
+	}
+
 	release_sock(sk);
 	return copied ? : err;
 }
@@ -975,14 +1166,8 @@ ssize_t tls_sw_splice_read(struct socket *sock,  loff_t *ppos,
 	if (!skb)
 		goto splice_read_end;
 
-	/* splice does not support reading control messages */
-	if (ctx->control != TLS_RECORD_TYPE_DATA) {
-		err = -ENOTSUPP;
-		goto splice_read_end;
-	}
-
 	if (!ctx->decrypted) {
-		err = decrypt_skb_update(sk, skb, NULL, &chunk, &zc);
+		err = decrypt_skb_update(sk, skb, NULL, &chunk, &zc, false);
 
 		if (err < 0) {
 			tls_err_abort(sk, EBADMSG);
@@ -990,6 +1175,14 @@ ssize_t tls_sw_splice_read(struct socket *sock,  loff_t *ppos,
 		}
 		ctx->decrypted = true;
 	}
+
+	/* splice does not support reading control messages, checked once
+	 * decrypted as that is when a TLS 1.3 record gets its type
+	 */
+	if (ctx->control != TLS_RECORD_TYPE_DATA) {
+		err = -ENOTSUPP;
+		goto splice_read_end;
+	}
 	rxm = strp_msg(skb);
 
 	chunk = min_t(unsigned int, rxm->full_len, len);
@@ -1032,6 +1225,7 @@ static int tls_read_size(struct strparser *strp, struct sk_buff *skb)
 	struct strp_msg *rxm = strp_msg(skb);
 	size_t cipher_overhead;
 	size_t data_len = 0;
+	u16 version;
 	int ret;
 
 	/* Verify that we have a full TLS header, or wait for more data */
@@ -1054,7 +1248,7 @@ static int tls_read_size(struct strparser *strp, struct sk_buff *skb)
 
 	data_len = ((header[4] & 0xFF) | (header[3] << 8));
 
-	cipher_overhead = tls_ctx->rx.tag_size + tls_ctx->rx.iv_size;
+	cipher_overhead = tls_ctx->rx.overhead_size - TLS_HEADER_SIZE;
 
 	if (data_len > TLS_MAX_PAYLOAD_SIZE + cipher_overhead) {
 		ret = -EMSGSIZE;
@@ -1065,8 +1259,12 @@ static int tls_read_size(struct strparser *strp, struct sk_buff *skb)
 		goto read_failure;
 	}
 
-	if (header[1] != TLS_VERSION_MINOR(tls_ctx->crypto_recv.info.version) ||
-	    header[2] != TLS_VERSION_MAJOR(tls_ctx->crypto_recv.info.version)) {
+	/* TLS 1.3 records claim to be TLS 1.2 ones */
+	version = tls_ctx->crypto_recv.info.version;
+	if (version == TLS_1_3_VERSION)
+		version = TLS_1_2_VERSION;
+	if (header[1] != TLS_VERSION_MINOR(version) ||
+	    header[2] != TLS_VERSION_MAJOR(version)) {
 		ret = -EINVAL;
 		goto read_failure;
 	}
@@ -1149,15 +1347,15 @@ void tls_sw_free_resources_rx(struct sock *sk)
 
 int tls_set_sw_offload(struct sock *sk, struct tls_context *ctx, int tx)
 {
+	u16 nonce_size, tag_size, iv_size, rec_seq_size, salt_size, key_size;
 	struct tls_crypto_info *crypto_info;
-	struct tls12_crypto_info_aes_gcm_128 *gcm_128_info;
 	struct tls_sw_context_tx *sw_ctx_tx = NULL;
 	struct tls_sw_context_rx *sw_ctx_rx = NULL;
+	char *iv, *rec_seq, *salt, *key;
 	struct cipher_context *cctx;
 	struct crypto_aead **aead;
 	struct strp_callbacks cb;
-	u16 nonce_size, tag_size, iv_size, rec_seq_size;
-	char *iv, *rec_seq;
+	const char *cipher_name;
 	int rc = 0;
 
 	if (!ctx) {
@@ -1205,15 +1403,43 @@ int tls_set_sw_offload(struct sock *sk, struct tls_context *ctx, int tx)
 
 	switch (crypto_info->cipher_type) {
 	case TLS_CIPHER_AES_GCM_128: {
-		nonce_size = TLS_CIPHER_AES_GCM_128_IV_SIZE;
+		struct tls12_crypto_info_aes_gcm_128 *gcm_128_info;
+
+		gcm_128_info =
+			(struct tls12_crypto_info_aes_gcm_128 *)crypto_info;
+		/* TLS 1.3 derives the nonce from the IV, like ChaCha20 */
+		if (crypto_info->version == TLS_1_3_VERSION)
+			nonce_size = 0;
+		else
+			nonce_size = TLS_CIPHER_AES_GCM_128_IV_SIZE;
 		tag_size = TLS_CIPHER_AES_GCM_128_TAG_SIZE;
 		iv_size = TLS_CIPHER_AES_GCM_128_IV_SIZE;
-		iv = ((struct tls12_crypto_info_aes_gcm_128 *)crypto_info)->iv;
+		iv = gcm_128_info->iv;
 		rec_seq_size = TLS_CIPHER_AES_GCM_128_REC_SEQ_SIZE;
-		rec_seq =
-		 ((struct tls12_crypto_info_aes_gcm_128 *)crypto_info)->rec_seq;
-		gcm_128_info =
-			(struct tls12_crypto_info_aes_gcm_128 *)crypto_info;
+		rec_seq = gcm_128_info->rec_seq;
+		salt_size = TLS_CIPHER_AES_GCM_128_SALT_SIZE;
+		salt = gcm_128_info->salt;
+		key_size = TLS_CIPHER_AES_GCM_128_KEY_SIZE;
+		key = gcm_128_info->key;
+		cipher_name = "gcm(aes)";
+		break;
+	}
+	case TLS_CIPHER_CHACHA20_POLY1305: {
+		struct tls12_crypto_info_chacha20_poly1305 *chacha_info;
+
+		chacha_info =
+			(struct tls12_crypto_info_chacha20_poly1305 *)crypto_info;
+		nonce_size = 0;
+		tag_size = TLS_CIPHER_CHACHA20_POLY1305_TAG_SIZE;
+		iv_size = TLS_CIPHER_CHACHA20_POLY1305_IV_SIZE;
+		iv = chacha_info->iv;
+		rec_seq_size = TLS_CIPHER_CHACHA20_POLY1305_REC_SEQ_SIZE;
+		rec_seq = chacha_info->rec_seq;
+		salt_size = TLS_CIPHER_CHACHA20_POLY1305_SALT_SIZE;
+		salt = chacha_info->salt;
+		key_size = TLS_CIPHER_CHACHA20_POLY1305_KEY_SIZE;
+		key = chacha_info->key;
+		cipher_name = "rfc7539(chacha20,poly1305)";
 		break;
 	}
 	default:
@@ -1222,23 +1448,33 @@ int tls_set_sw_offload(struct sock *sk, struct tls_context *ctx, int tx)
 	}
 
 	/* Sanity-check the IV size for stack allocations. */
-	if (iv_size > MAX_IV_SIZE || nonce_size > MAX_IV_SIZE) {
+	if (iv_size + salt_size > MAX_IV_SIZE || nonce_size > MAX_IV_SIZE) {
 		rc = -EINVAL;
 		goto free_priv;
 	}
 
+	/* TLS 1.3 has the record header as AAD and the record type after
+	 * the data.
+	 */
+	if (crypto_info->version == TLS_1_3_VERSION) {
+		cctx->aad_size = TLS_HEADER_SIZE;
+		cctx->tail_size = 1;
+	} else {
+		cctx->aad_size = TLS_AAD_SPACE_SIZE;
+		cctx->tail_size = 0;
+	}
 	cctx->prepend_size = TLS_HEADER_SIZE + nonce_size;
 	cctx->tag_size = tag_size;
-	cctx->overhead_size = cctx->prepend_size + cctx->tag_size;
+	cctx->overhead_size = cctx->prepend_size + cctx->tag_size +
+			      cctx->tail_size;
 	cctx->iv_size = iv_size;
-	cctx->iv = kmalloc(iv_size + TLS_CIPHER_AES_GCM_128_SALT_SIZE,
-			   GFP_KERNEL);
+	cctx->iv = kmalloc(iv_size + salt_size, GFP_KERNEL);
 	if (!cctx->iv) {
 		rc = -ENOMEM;
 		goto free_priv;
 	}
-	memcpy(cctx->iv, gcm_128_info->salt, TLS_CIPHER_AES_GCM_128_SALT_SIZE);
-	memcpy(cctx->iv + TLS_CIPHER_AES_GCM_128_SALT_SIZE, iv, iv_size);
+	memcpy(cctx->iv, salt, salt_size);
+	memcpy(cctx->iv + salt_size, iv, iv_size);
 	cctx->rec_seq_size = rec_seq_size;
 	cctx->rec_seq = kmemdup(rec_seq, rec_seq_size, GFP_KERNEL);
 	if (!cctx->rec_seq) {
@@ -1254,20 +1490,20 @@ int tls_set_sw_offload(struct sock *sk, struct tls_context *ctx, int tx)
 
 		sg_init_table(sw_ctx_tx->sg_aead_in, 2);
 		sg_set_buf(&sw_ctx_tx->sg_aead_in[0], sw_ctx_tx->aad_space,
-			   sizeof(sw_ctx_tx->aad_space));
+			   cctx->aad_size);
 		sg_unmark_end(&sw_ctx_tx->sg_aead_in[1]);
 		sg_chain(sw_ctx_tx->sg_aead_in, 2,
 			 sw_ctx_tx->sg_plaintext_data);
 		sg_init_table(sw_ctx_tx->sg_aead_out, 2);
 		sg_set_buf(&sw_ctx_tx->sg_aead_out[0], sw_ctx_tx->aad_space,
-			   sizeof(sw_ctx_tx->aad_space));
+			   cctx->aad_size);
 		sg_unmark_end(&sw_ctx_tx->sg_aead_out[1]);
 		sg_chain(sw_ctx_tx->sg_aead_out, 2,
 			 sw_ctx_tx->sg_encrypted_data);
 	}
 
 	if (!*aead) {
-		*aead = crypto_alloc_aead("gcm(aes)", 0, 0);
+		*aead = crypto_alloc_aead(cipher_name, 0, 0);
 		if (IS_ERR(*aead)) {
 			rc = PTR_ERR(*aead);
 			*aead = NULL;
@@ -1277,8 +1513,7 @@ int tls_set_sw_offload(struct sock *sk, struct tls_context *ctx, int tx)
 
 	ctx->push_pending_record = tls_sw_push_pending_record;
 
-	rc = crypto_aead_setkey(*aead, gcm_128_info->key,
-				TLS_CIPHER_AES_GCM_128_KEY_SIZE);
+	rc = crypto_aead_setkey(*aead, key, key_size);
 	if (rc)
 		goto free_aead;
 
@@ -1287,6 +1522,13 @@ int tls_set_sw_offload(struct sock *sk, struct tls_context *ctx, int tx)
 		goto free_aead;
 
 	if (sw_ctx_rx) {
+		struct crypto_tfm *tfm = crypto_aead_tfm(sw_ctx_rx->aead_recv);
+
+		/* a TLS 1.3 record has to be decrypted to know where it goes */
+		sw_ctx_rx->async_capable =
+			crypto_info->version != TLS_1_3_VERSION &&
+			!!(tfm->__crt_alg->cra_flags & CRYPTO_ALG_ASYNC);
+
 		/* Set up strparser */
 		memset(&cb, 0, sizeof(cb));
 		cb.rcv_msg = tls_queue;
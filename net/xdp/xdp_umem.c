@@ -27,6 +27,8 @@ void xdp_add_sk_umem(struct xdp_umem *umem, struct xdp_sock *xs)
 		return;
 
 	spin_lock_irqsave(&umem->xsk_list_lock, flags);
+	if (umem->need_wakeup & XDP_WAKEUP_TX)
+		xs->tx->ring->flags |= XDP_RING_NEED_WAKEUP;
 	list_add_rcu(&xs->list, &umem->xsk_list);
 	spin_unlock_irqrestore(&umem->xsk_list_lock, flags);
 }
@@ -71,6 +73,14 @@ int xdp_umem_assign_dev(struct xdp_umem *umem, struct net_device *dev,
 	if (force_zc && force_copy)
 		return -EINVAL;
 
+	if (flags & XDP_USE_NEED_WAKEUP) {
+		umem->flags |= XDP_UMEM_USES_NEED_WAKEUP;
+		/* Tx needs to be explicitly woken up the first time, and
+		 * always in copy mode or with drivers which never clear it.
+		 */
+		umem->need_wakeup |= XDP_WAKEUP_TX;
+	}
+
 	if (force_copy)
 		return 0;
 
@@ -415,6 +415,12 @@ int security_sb_pivotroot(const struct path *old_path, const struct path *new_pa
 	return call_int_hook(sb_pivotroot, 0, old_path, new_path);
 }
 
+int security_move_mount(const struct path *from_path,
+			const struct path *to_path)
+{
+	return call_int_hook(move_mount, 0, from_path, to_path);
+}
+
 int security_sb_set_mnt_opts(struct super_block *sb,
 				struct security_mnt_opts *opts,
 				unsigned long kern_flags,
@@ -32,6 +32,8 @@ struct ring {
 	unsigned long *producer_pos;
 	unsigned long mask;
 	int map_fd;
+	/* rings of the map, starting with this one, that map_fd polls for */
+	int map_ring_cnt;
 };
 
 struct ring_buffer {
@@ -54,13 +56,103 @@ static void ringbuf_unmap_ring(struct ring_buffer *rb, struct ring *r)
 	}
 }
 
-/* Add extra RINGBUF maps to this ring buffer manager */
+/* Map the consumer page at @off and the producer and data pages after it */
+static int ringbuf_map_ring(struct ring_buffer *rb, struct ring *r,
+			    int map_fd, __u32 max_entries, off_t off)
+{
+	void *tmp;
+	int err;
+
+	/* Map writable consumer page */
+	tmp = mmap(NULL, rb->page_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   map_fd, off);
+	if (tmp == MAP_FAILED) {
+		err = -errno;
+		pr_warn("ringbuf: failed to mmap consumer page for map fd=%d: %d\n",
+			map_fd, err);
+		return err;
+	}
+	r->consumer_pos = tmp;
+
+	/* Map read-only producer page and data pages. We map twice as big
+	 * data size to allow simple reading of samples that wrap around the
+	 * end of a ring buffer. See kernel implementation for details.
+	 * */
+	tmp = mmap(NULL, rb->page_size + 2 * max_entries, PROT_READ,
+		   MAP_SHARED, map_fd, off + rb->page_size);
+	if (tmp == MAP_FAILED) {
+		err = -errno;
+		ringbuf_unmap_ring(rb, r);
+		pr_warn("ringbuf: failed to mmap data pages for map fd=%d: %d\n",
+			map_fd, err);
+		return err;
+	}
+	r->producer_pos = tmp;
+	r->data = tmp + rb->page_size;
+	return 0;
+}
+
+/*
+ * The cpus of a BPF_MAP_TYPE_RINGBUF_PERCPU map's rings, from a list such
+ * as "0-3,8-11" in /sys/devices/system/cpu/possible.  Returns the number
+ * of cpus, with their ids in a malloc()ed *@cpus.
+ */
+static int ringbuf_possible_cpus(int **cpus)
+{
+	int start, end, n, cnt = 0, *ids = NULL, *tmp;
+	char buf[256], *p;
+	FILE *f;
+
+	f = fopen("/sys/devices/system/cpu/possible", "r");
+	if (!f)
+		return -errno;
+	p = fgets(buf, sizeof(buf), f);
+	fclose(f);
+	if (!p)
+		return -EINVAL;
+
+	while (*p && *p != '\n') {
+		if (sscanf(p, "%d%n", &start, &n) != 1)
+			goto err_inval;
+		p += n;
+		end = start;
+		if (*p == '-') {
+			if (sscanf(p + 1, "%d%n", &end, &n) != 1 || end < start)
+				goto err_inval;
+			p += n + 1;
+		}
+		tmp = libbpf_reallocarray(ids, cnt + end - start + 1,
+					  sizeof(*ids));
+		if (!tmp) {
+			free(ids);
+			return -ENOMEM;
+		}
+		ids = tmp;
+		while (start <= end)
+			ids[cnt++] = start++;
+		if (*p == ',')
+			p++;
+	}
+	if (!cnt)
+		goto err_inval;
+
+	*cpus = ids;
+	return cnt;
+
+err_inval:
+	free(ids);
+	return -EINVAL;
+}
+
+/* Add extra RINGBUF or RINGBUF_PERCPU maps to this ring buffer manager */
 int ring_buffer__add(struct ring_buffer *rb, int map_fd,
 		     ring_buffer_sample_fn sample_cb, void *ctx)
 {
+	int i, first, ring_cnt = 1, *cpus = NULL;
 	struct bpf_map_info info;
 	__u32 len = sizeof(info);
 	struct epoll_event *e;
+	off_t stride = 0;
 	struct ring *r;
 	void *tmp;
 	int err;
@@ -75,72 +167,74 @@ int ring_buffer__add(struct ring_buffer *rb, int map_fd,
 		return err;
 	}
 
-	if (info.type != BPF_MAP_TYPE_RINGBUF) {
+	if (info.type == BPF_MAP_TYPE_RINGBUF_PERCPU) {
+		ring_cnt = ringbuf_possible_cpus(&cpus);
+		if (ring_cnt < 0) {
+			pr_warn("ringbuf: failed to get possible cpus: %d\n",
+				ring_cnt);
+			return ring_cnt;
+		}
+		/* consumer page, producer page, data pages mapped twice */
+		stride = 2 * rb->page_size + 2 * (off_t)info.max_entries;
+	} else if (info.type != BPF_MAP_TYPE_RINGBUF) {
 		pr_warn("ringbuf: map fd=%d is not BPF_MAP_TYPE_RINGBUF\n",
 			map_fd);
 		return -EINVAL;
 	}
 
-	tmp = libbpf_reallocarray(rb->rings, rb->ring_cnt + 1, sizeof(*rb->rings));
+	err = -ENOMEM;
+	tmp = libbpf_reallocarray(rb->rings, rb->ring_cnt + ring_cnt,
+				  sizeof(*rb->rings));
 	if (!tmp)
-		return -ENOMEM;
+		goto out;
 	rb->rings = tmp;
 
-	tmp = libbpf_reallocarray(rb->events, rb->ring_cnt + 1, sizeof(*rb->events));
+	tmp = libbpf_reallocarray(rb->events, rb->ring_cnt + ring_cnt,
+				  sizeof(*rb->events));
 	if (!tmp)
-		return -ENOMEM;
+		goto out;
 	rb->events = tmp;
 
-	r = &rb->rings[rb->ring_cnt];
-	memset(r, 0, sizeof(*r));
+	first = rb->ring_cnt;
+	for (i = 0; i < ring_cnt; i++) {
+		r = &rb->rings[first + i];
+		memset(r, 0, sizeof(*r));
 
-	r->map_fd = map_fd;
-	r->sample_cb = sample_cb;
-	r->ctx = ctx;
-	r->mask = info.max_entries - 1;
+		r->map_fd = map_fd;
+		r->sample_cb = sample_cb;
+		r->ctx = ctx;
+		r->mask = info.max_entries - 1;
 
-	/* Map writable consumer page */
-	tmp = mmap(NULL, rb->page_size, PROT_READ | PROT_WRITE, MAP_SHARED,
-		   map_fd, 0);
-	if (tmp == MAP_FAILED) {
-		err = -errno;
-		pr_warn("ringbuf: failed to mmap consumer page for map fd=%d: %d\n",
-			map_fd, err);
-		return err;
+		err = ringbuf_map_ring(rb, r, map_fd, info.max_entries,
+				       cpus ? cpus[i] * stride : 0);
+		if (err)
+			goto err_unmap;
 	}
-	r->consumer_pos = tmp;
+	rb->rings[first].map_ring_cnt = ring_cnt;
 
-	/* Map read-only producer page and data pages. We map twice as big
-	 * data size to allow simple reading of samples that wrap around the
-	 * end of a ring buffer. See kernel implementation for details.
-	 * */
-	tmp = mmap(NULL, rb->page_size + 2 * info.max_entries, PROT_READ,
-		   MAP_SHARED, map_fd, rb->page_size);
-	if (tmp == MAP_FAILED) {
-		err = -errno;
-		ringbuf_unmap_ring(rb, r);
-		pr_warn("ringbuf: failed to mmap data pages for map fd=%d: %d\n",
-			map_fd, err);
-		return err;
-	}
-	r->producer_pos = tmp;
-	r->data = tmp + rb->page_size;
-
-	e = &rb->events[rb->ring_cnt];
+	/* one wakeup source for all the rings of the map */
+	e = &rb->events[first];
 	memset(e, 0, sizeof(*e));
 
 	e->events = EPOLLIN;
-	e->data.fd = rb->ring_cnt;
+	e->data.fd = first;
 	if (epoll_ctl(rb->epoll_fd, EPOLL_CTL_ADD, map_fd, e) < 0) {
 		err = -errno;
-		ringbuf_unmap_ring(rb, r);
 		pr_warn("ringbuf: failed to epoll add map fd=%d: %d\n",
 			map_fd, err);
-		return err;
+		goto err_unmap;
 	}
 
-	rb->ring_cnt++;
-	return 0;
+	rb->ring_cnt += ring_cnt;
+	err = 0;
+	goto out;
+
+err_unmap:
+	while (i--)
+		ringbuf_unmap_ring(rb, &rb->rings[first + i]);
+out:
+	free(cpus);
+	return err;
 }
 
 void ring_buffer__free(struct ring_buffer *rb)
@@ -276,11 +370,13 @@ int ring_buffer__poll(struct ring_buffer *rb, int timeout_ms)
 	cnt = epoll_wait(rb->epoll_fd, rb->events, rb->ring_cnt, timeout_ms);
 	for (i = 0; i < cnt; i++) {
 		__u32 ring_id = rb->events[i].data.fd;
-		struct ring *ring = &rb->rings[ring_id];
+		int j, ring_cnt = rb->rings[ring_id].map_ring_cnt;
 
-		err = ringbuf_process_ring(ring);
-		if (err < 0)
-			return err;
+		for (j = 0; j < ring_cnt; j++) {
+			err = ringbuf_process_ring(&rb->rings[ring_id + j]);
+			if (err < 0)
+				return err;
+		}
 		res += cnt;
 	}
 	return cnt < 0 ? -errno : res;
@@ -0,0 +1,303 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * epoll-ctl: Threads adding, modifying and removing their file descriptors
+ * on epoll instances as fast as they can.
+ *
+ * All threads share one epoll instance unless --multiq is given, so the
+ * default measures the serialization of epoll_ctl() on a busy instance,
+ * which is what event loops that register and drop connections from many
+ * threads run into.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/time.h>
+#include <linux/compiler.h>
+#include <linux/kernel.h>
+
+#include "../util/stat.h"
+#include <subcmd/parse-options.h>
+#include "bench.h"
+#include "cpumap.h"
+
+#include <err.h>
+
+enum {
+	OP_EPOLL_ADD,
+	OP_EPOLL_MOD,
+	OP_EPOLL_DEL,
+	EPOLL_NR_OPS,
+};
+
+static const char * const op_names[EPOLL_NR_OPS] = {
+	[OP_EPOLL_ADD] = "ADD",
+	[OP_EPOLL_MOD] = "MOD",
+	[OP_EPOLL_DEL] = "DEL",
+};
+
+static unsigned int nthreads = 0;
+static unsigned int nsecs    = 8;
+/* amount of eventfds per thread */
+static unsigned int nfds     = 64;
+static bool multiq = false, done = false, silent = false;
+
+static pthread_mutex_t thread_lock;
+static unsigned int threads_starting;
+static struct stats all_stats[EPOLL_NR_OPS];
+static pthread_cond_t thread_parent, thread_worker;
+
+struct worker {
+	int tid;
+	int epollfd;
+	int *fds;
+	/* which fds are currently added */
+	bool *added;
+	pthread_t thread;
+	unsigned int seed;
+	unsigned long ops[EPOLL_NR_OPS];
+};
+
+static const struct option options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads, "Specify amount of threads"),
+	OPT_UINTEGER('r', "runtime", &nsecs,    "Specify runtime (in seconds)"),
+	OPT_UINTEGER('f', "nfds",    &nfds,     "Specify amount of file descriptors per thread"),
+	OPT_BOOLEAN( 'm', "multiq",  &multiq,   "Use an epoll instance per thread"),
+	OPT_BOOLEAN( 's', "silent",  &silent,   "Silent mode: do not display data/details"),
+	OPT_END()
+};
+
+static const char * const bench_epoll_ctl_usage[] = {
+	"perf bench epoll ctl <options>",
+	NULL
+};
+
+static void do_epoll_op(struct worker *w, unsigned int i, int op)
+{
+	struct epoll_event ev;
+	int ret;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = w->fds[i];
+
+	switch (op) {
+	case OP_EPOLL_ADD:
+		ret = epoll_ctl(w->epollfd, EPOLL_CTL_ADD, w->fds[i], &ev);
+		w->added[i] = true;
+		break;
+	case OP_EPOLL_MOD:
+		/* toggle between two event masks to keep MOD doing work */
+		ev.events = w->ops[OP_EPOLL_MOD] & 1 ? EPOLLIN : EPOLLOUT;
+		ret = epoll_ctl(w->epollfd, EPOLL_CTL_MOD, w->fds[i], &ev);
+		break;
+	default:
+		ret = epoll_ctl(w->epollfd, EPOLL_CTL_DEL, w->fds[i], NULL);
+		w->added[i] = false;
+		break;
+	}
+
+	if (ret)
+		err(EXIT_FAILURE, "epoll_ctl(%s)", op_names[op]);
+	w->ops[op]++;
+}
+
+static void *workerfn(void *arg)
+{
+	struct worker *w = (struct worker *) arg;
+	unsigned int i;
+
+	pthread_mutex_lock(&thread_lock);
+	threads_starting--;
+	if (!threads_starting)
+		pthread_cond_signal(&thread_parent);
+	pthread_cond_wait(&thread_worker, &thread_lock);
+	pthread_mutex_unlock(&thread_lock);
+
+	while (!done) {
+		i = rand_r(&w->seed) % nfds;
+
+		/* removed fds can only be added, added ones modified or removed */
+		if (!w->added[i])
+			do_epoll_op(w, i, OP_EPOLL_ADD);
+		else
+			do_epoll_op(w, i, rand_r(&w->seed) & 1 ?
+				    OP_EPOLL_MOD : OP_EPOLL_DEL);
+	}
+	return NULL;
+}
+
+static void setup_fds(struct worker *w, int epollfd)
+{
+	unsigned int i;
+
+	w->epollfd = epollfd;
+	w->fds = calloc(nfds, sizeof(int));
+	w->added = calloc(nfds, sizeof(bool));
+	if (!w->fds || !w->added)
+		err(EXIT_FAILURE, "calloc");
+
+	for (i = 0; i < nfds; i++) {
+		w->fds[i] = eventfd(0, EFD_NONBLOCK);
+		if (w->fds[i] < 0)
+			err(EXIT_FAILURE, "eventfd");
+	}
+}
+
+static int setup_epoll(void)
+{
+	int epollfd = epoll_create1(0);
+
+	if (epollfd < 0)
+		err(EXIT_FAILURE, "epoll_create1");
+	return epollfd;
+}
+
+static void toggle_done(int sig __maybe_unused,
+			siginfo_t *info __maybe_unused,
+			void *uc __maybe_unused)
+{
+	/* inform all threads that we're done for the day */
+	done = true;
+	gettimeofday(&bench__end, NULL);
+	timersub(&bench__end, &bench__start, &bench__runtime);
+}
+
+static void print_summary(void)
+{
+	int op;
+
+	printf("\n");
+	for (op = 0; op < EPOLL_NR_OPS; op++) {
+		unsigned long avg = avg_stats(&all_stats[op]);
+		double stddev = stddev_stats(&all_stats[op]);
+
+		printf("Averaged %ld %s operations/sec per thread (+- %.2f%%), total secs = %d\n",
+		       avg, op_names[op], rel_stddev_stats(stddev, avg),
+		       (int)bench__runtime.tv_sec);
+	}
+}
+
+int bench_epoll_ctl(int argc, const char **argv)
+{
+	int ret = 0, epollfd = -1, op;
+	cpu_set_t cpuset;
+	struct sigaction act;
+	unsigned int i, j;
+	pthread_attr_t thread_attr;
+	struct worker *worker = NULL;
+	struct cpu_map *cpu;
+
+	argc = parse_options(argc, argv, options, bench_epoll_ctl_usage, 0);
+	if (argc || !nfds) {
+		usage_with_options(bench_epoll_ctl_usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	cpu = cpu_map__new(NULL);
+	if (!cpu)
+		goto errmem;
+
+	sigfillset(&act.sa_mask);
+	act.sa_sigaction = toggle_done;
+	sigaction(SIGINT, &act, NULL);
+
+	if (!nthreads) /* default to the number of CPUs */
+		nthreads = cpu->nr;
+
+	worker = calloc(nthreads, sizeof(*worker));
+	if (!worker)
+		goto errmem;
+
+	printf("Run summary [PID %d]: %d threads doing epoll_ctl ops on %d fds each, %s, for %d secs.\n\n",
+	       getpid(), nthreads, nfds,
+	       multiq ? "an epoll instance per thread" : "one shared epoll instance",
+	       nsecs);
+
+	for (op = 0; op < EPOLL_NR_OPS; op++)
+		init_stats(&all_stats[op]);
+	pthread_mutex_init(&thread_lock, NULL);
+	pthread_cond_init(&thread_parent, NULL);
+	pthread_cond_init(&thread_worker, NULL);
+
+	if (!multiq)
+		epollfd = setup_epoll();
+	for (i = 0; i < nthreads; i++) {
+		worker[i].tid = i;
+		worker[i].seed = getpid() + i;
+		setup_fds(&worker[i], multiq ? setup_epoll() : epollfd);
+	}
+
+	threads_starting = nthreads;
+	pthread_attr_init(&thread_attr);
+	for (i = 0; i < nthreads; i++) {
+		CPU_ZERO(&cpuset);
+		CPU_SET(cpu->map[i % cpu->nr], &cpuset);
+
+		ret = pthread_attr_setaffinity_np(&thread_attr, sizeof(cpu_set_t), &cpuset);
+		if (ret)
+			err(EXIT_FAILURE, "pthread_attr_setaffinity_np");
+
+		ret = pthread_create(&worker[i].thread, &thread_attr, workerfn,
+				     (void *)(struct worker *) &worker[i]);
+		if (ret)
+			err(EXIT_FAILURE, "pthread_create");
+	}
+	pthread_attr_destroy(&thread_attr);
+
+	pthread_mutex_lock(&thread_lock);
+	while (threads_starting)
+		pthread_cond_wait(&thread_parent, &thread_lock);
+	gettimeofday(&bench__start, NULL);
+	pthread_cond_broadcast(&thread_worker);
+	pthread_mutex_unlock(&thread_lock);
+
+	sleep(nsecs);
+	toggle_done(0, NULL, NULL);
+
+	for (i = 0; i < nthreads; i++) {
+		ret = pthread_join(worker[i].thread, NULL);
+		if (ret)
+			err(EXIT_FAILURE, "pthread_join");
+	}
+
+	/* cleanup & report results */
+	pthread_cond_destroy(&thread_parent);
+	pthread_cond_destroy(&thread_worker);
+	pthread_mutex_destroy(&thread_lock);
+
+	for (i = 0; i < nthreads; i++) {
+		unsigned long t[EPOLL_NR_OPS];
+
+		for (op = 0; op < EPOLL_NR_OPS; op++) {
+			t[op] = worker[i].ops[op] / bench__runtime.tv_sec;
+			update_stats(&all_stats[op], t[op]);
+		}
+		if (!silent)
+			printf("[thread %2d] fdmap: %p [ add: %ld ops; mod: %ld ops; del: %ld ops ]\n",
+			       worker[i].tid, worker[i].fds, t[OP_EPOLL_ADD],
+			       t[OP_EPOLL_MOD], t[OP_EPOLL_DEL]);
+
+		for (j = 0; j < nfds; j++)
+			close(worker[i].fds[j]);
+		free(worker[i].fds);
+		free(worker[i].added);
+		if (multiq)
+			close(worker[i].epollfd);
+	}
+	if (!multiq)
+		close(epollfd);
+
+	print_summary();
+
+	free(worker);
+	free(cpu);
+	return ret;
+errmem:
+	err(EXIT_FAILURE, "calloc");
+}
@@ -0,0 +1,296 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * epoll-wait: A writer thread keeps a set of eventfds signalled while the
+ * worker threads collect the events through epoll_wait() and consume them.
+ *
+ * By default every worker has its own epoll instance watching its own
+ * eventfds, which measures how epoll_wait() and the wakeups scale as
+ * threads are added. With --shared all workers wait on a single instance
+ * watching all the eventfds, so they contend on its ready list and wait
+ * queue, much like a thread pool behind one epoll fd.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/time.h>
+#include <linux/compiler.h>
+#include <linux/kernel.h>
+
+#include "../util/stat.h"
+#include <subcmd/parse-options.h>
+#include "bench.h"
+#include "cpumap.h"
+
+#include <err.h>
+
+#define EPOLL_WAIT_MAXEVENTS	64
+
+static unsigned int nthreads = 0;
+static unsigned int nsecs    = 8;
+/* amount of eventfds per worker */
+static unsigned int nfds     = 64;
+static bool shared = false, edge = false, done = false, silent = false;
+
+static pthread_mutex_t thread_lock;
+static unsigned int threads_starting;
+static struct stats throughput_stats;
+static pthread_cond_t thread_parent, thread_worker;
+
+struct worker {
+	int tid;
+	int epollfd;
+	int *fds;
+	pthread_t thread;
+	unsigned long ops;
+};
+
+static const struct option options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads, "Specify amount of threads"),
+	OPT_UINTEGER('r', "runtime", &nsecs,    "Specify runtime (in seconds)"),
+	OPT_UINTEGER('f', "nfds",    &nfds,     "Specify amount of file descriptors per thread"),
+	OPT_BOOLEAN( 'S', "shared",  &shared,   "Use a single epoll instance for all threads"),
+	OPT_BOOLEAN( 'E', "edge",    &edge,     "Use edge-triggered instead of level-triggered events"),
+	OPT_BOOLEAN( 's', "silent",  &silent,   "Silent mode: do not display data/details"),
+	OPT_END()
+};
+
+static const char * const bench_epoll_wait_usage[] = {
+	"perf bench epoll wait <options>",
+	NULL
+};
+
+static void *workerfn(void *arg)
+{
+	struct worker *w = (struct worker *) arg;
+	struct epoll_event ev[EPOLL_WAIT_MAXEVENTS];
+	uint64_t val;
+	int i, n;
+
+	pthread_mutex_lock(&thread_lock);
+	threads_starting--;
+	if (!threads_starting)
+		pthread_cond_signal(&thread_parent);
+	pthread_cond_wait(&thread_worker, &thread_lock);
+	pthread_mutex_unlock(&thread_lock);
+
+	while (!done) {
+		/* time out now and then to notice the end of the run */
+		n = epoll_wait(w->epollfd, ev, EPOLL_WAIT_MAXEVENTS, 100);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			err(EXIT_FAILURE, "epoll_wait");
+		}
+
+		for (i = 0; i < n; i++) {
+			/* another thread might have consumed it already */
+			if (read(ev[i].data.fd, &val, sizeof(val)) == sizeof(val))
+				w->ops++;
+			else if (errno != EAGAIN)
+				err(EXIT_FAILURE, "read");
+		}
+	}
+	return NULL;
+}
+
+static void *writerfn(void *arg)
+{
+	struct worker *worker = (struct worker *) arg;
+	uint64_t val = 1;
+	unsigned int i, j;
+
+	while (!done) {
+		for (i = 0; i < nfds && !done; i++) {
+			for (j = 0; j < nthreads; j++) {
+				if (write(worker[j].fds[i], &val, sizeof(val)) != sizeof(val))
+					err(EXIT_FAILURE, "write");
+			}
+		}
+	}
+	return NULL;
+}
+
+static int setup_epoll(void)
+{
+	int epollfd = epoll_create1(0);
+
+	if (epollfd < 0)
+		err(EXIT_FAILURE, "epoll_create1");
+	return epollfd;
+}
+
+static void setup_fds(struct worker *w, int epollfd)
+{
+	struct epoll_event ev;
+	unsigned int i;
+
+	w->epollfd = epollfd;
+	w->fds = calloc(nfds, sizeof(int));
+	if (!w->fds)
+		err(EXIT_FAILURE, "calloc");
+
+	for (i = 0; i < nfds; i++) {
+		w->fds[i] = eventfd(0, EFD_NONBLOCK);
+		if (w->fds[i] < 0)
+			err(EXIT_FAILURE, "eventfd");
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN | (edge ? EPOLLET : 0);
+		ev.data.fd = w->fds[i];
+		if (epoll_ctl(epollfd, EPOLL_CTL_ADD, w->fds[i], &ev))
+			err(EXIT_FAILURE, "epoll_ctl");
+	}
+}
+
+static void toggle_done(int sig __maybe_unused,
+			siginfo_t *info __maybe_unused,
+			void *uc __maybe_unused)
+{
+	/* inform all threads that we're done for the day */
+	done = true;
+	gettimeofday(&bench__end, NULL);
+	timersub(&bench__end, &bench__start, &bench__runtime);
+}
+
+static void print_summary(void)
+{
+	unsigned long avg = avg_stats(&throughput_stats);
+	double stddev = stddev_stats(&throughput_stats);
+
+	printf("%sAveraged %ld events/sec per thread (+- %.2f%%), total secs = %d\n",
+	       !silent ? "\n" : "", avg, rel_stddev_stats(stddev, avg),
+	       (int)bench__runtime.tv_sec);
+}
+
+int bench_epoll_wait(int argc, const char **argv)
+{
+	int ret = 0, epollfd = -1;
+	cpu_set_t cpuset;
+	struct sigaction act;
+	unsigned int i, j;
+	pthread_attr_t thread_attr;
+	pthread_t writer;
+	struct worker *worker = NULL;
+	struct cpu_map *cpu;
+
+	argc = parse_options(argc, argv, options, bench_epoll_wait_usage, 0);
+	if (argc || !nfds) {
+		usage_with_options(bench_epoll_wait_usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	cpu = cpu_map__new(NULL);
+	if (!cpu)
+		goto errmem;
+
+	sigfillset(&act.sa_mask);
+	act.sa_sigaction = toggle_done;
+	sigaction(SIGINT, &act, NULL);
+
+	/* leave a CPU to the writer */
+	if (!nthreads)
+		nthreads = cpu->nr > 1 ? cpu->nr - 1 : 1;
+
+	worker = calloc(nthreads, sizeof(*worker));
+	if (!worker)
+		goto errmem;
+
+	printf("Run summary [PID %d]: %d threads waiting on %s epoll instance%s, %d %s-triggered fds each, for %d secs.\n\n",
+	       getpid(), nthreads, shared ? "one" : "their own",
+	       shared ? "" : "s", nfds, edge ? "edge" : "level", nsecs);
+
+	init_stats(&throughput_stats);
+	pthread_mutex_init(&thread_lock, NULL);
+	pthread_cond_init(&thread_parent, NULL);
+	pthread_cond_init(&thread_worker, NULL);
+
+	if (shared)
+		epollfd = setup_epoll();
+	for (i = 0; i < nthreads; i++) {
+		worker[i].tid = i;
+		setup_fds(&worker[i], shared ? epollfd : setup_epoll());
+	}
+
+	threads_starting = nthreads;
+	pthread_attr_init(&thread_attr);
+	for (i = 0; i < nthreads; i++) {
+		CPU_ZERO(&cpuset);
+		CPU_SET(cpu->map[i % cpu->nr], &cpuset);
+
+		ret = pthread_attr_setaffinity_np(&thread_attr, sizeof(cpu_set_t), &cpuset);
+		if (ret)
+			err(EXIT_FAILURE, "pthread_attr_setaffinity_np");
+
+		ret = pthread_create(&worker[i].thread, &thread_attr, workerfn,
+				     (void *)(struct worker *) &worker[i]);
+		if (ret)
+			err(EXIT_FAILURE, "pthread_create");
+	}
+
+	/* the writer goes on the CPU after the last worker's */
+	CPU_ZERO(&cpuset);
+	CPU_SET(cpu->map[nthreads % cpu->nr], &cpuset);
+	ret = pthread_attr_setaffinity_np(&thread_attr, sizeof(cpu_set_t), &cpuset);
+	if (ret)
+		err(EXIT_FAILURE, "pthread_attr_setaffinity_np");
+
+	pthread_mutex_lock(&thread_lock);
+	while (threads_starting)
+		pthread_cond_wait(&thread_parent, &thread_lock);
+	gettimeofday(&bench__start, NULL);
+	pthread_cond_broadcast(&thread_worker);
+	pthread_mutex_unlock(&thread_lock);
+
+	ret = pthread_create(&writer, &thread_attr, writerfn, (void *)worker);
+	if (ret)
+		err(EXIT_FAILURE, "pthread_create");
+	pthread_attr_destroy(&thread_attr);
+
+	sleep(nsecs);
+	toggle_done(0, NULL, NULL);
+
+	ret = pthread_join(writer, NULL);
+	if (ret)
+		err(EXIT_FAILURE, "pthread_join");
+	for (i = 0; i < nthreads; i++) {
+		ret = pthread_join(worker[i].thread, NULL);
+		if (ret)
+			err(EXIT_FAILURE, "pthread_join");
+	}
+
+	/* cleanup & report results */
+	pthread_cond_destroy(&thread_parent);
+	pthread_cond_destroy(&thread_worker);
+	pthread_mutex_destroy(&thread_lock);
+
+	for (i = 0; i < nthreads; i++) {
+		unsigned long t = worker[i].ops / bench__runtime.tv_sec;
+
+		update_stats(&throughput_stats, t);
+		if (!silent)
+			printf("[thread %2d] fdmap: %p [ %ld events/sec ]\n",
+			       worker[i].tid, worker[i].fds, t);
+
+		for (j = 0; j < nfds; j++)
+			close(worker[i].fds[j]);
+		free(worker[i].fds);
+		if (!shared)
+			close(worker[i].epollfd);
+	}
+	if (shared)
+		close(epollfd);
+
+	print_summary();
+
+	free(worker);
+	free(cpu);
+	return ret;
+errmem:
+	err(EXIT_FAILURE, "calloc");
+}
@@ -0,0 +1,326 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * io-aio: The io-uring benchmark done through native aio (io_submit()),
+ * to have the numbers of the older interface on the same kernel and device
+ * next to it.
+ *
+ * Like io-uring, keeps a queue of random O_DIRECT reads in flight on a
+ * file or block device, /dev/nullb0 by default, one aio context per thread.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <linux/aio_abi.h>
+#include <linux/compiler.h>
+#include <linux/fs.h>
+#include <linux/kernel.h>
+
+#include "../util/stat.h"
+#include <subcmd/parse-options.h>
+#include "bench.h"
+#include "cpumap.h"
+
+#include <err.h>
+
+static const char *target = "/dev/nullb0";
+static unsigned int nthreads = 1;
+static unsigned int nsecs    = 10;
+static unsigned int depth    = 128;
+static unsigned int bs       = 4096;
+static bool done = false, silent = false;
+
+static pthread_mutex_t thread_lock;
+static unsigned int threads_starting;
+static struct stats throughput_stats;
+static pthread_cond_t thread_parent, thread_worker;
+
+struct submitter {
+	int tid;
+	pthread_t thread;
+	int fd;
+	aio_context_t ctx;
+	unsigned long long size;
+	unsigned int seed;
+	char *bufs;
+	struct iocb *iocbs;
+	/* iocbs to (re)submit, the in-flight ones come back in io_event.obj */
+	struct iocb **free_iocbs;
+	unsigned int nr_free;
+	struct io_event *events;
+
+	unsigned long ops;
+};
+
+static const struct option options[] = {
+	OPT_STRING( 'f', "file",    &target,   "path", "Specify the file or block device to read from"),
+	OPT_UINTEGER('t', "threads", &nthreads, "Specify amount of threads, one aio context each"),
+	OPT_UINTEGER('r', "runtime", &nsecs,    "Specify runtime (in seconds)"),
+	OPT_UINTEGER('d', "depth",   &depth,    "Specify amount of requests in flight per thread"),
+	OPT_UINTEGER('b', "bs",      &bs,       "Specify the read size in bytes"),
+	OPT_BOOLEAN( 's', "silent",  &silent,   "Silent mode: do not display data/details"),
+	OPT_END()
+};
+
+static const char * const bench_io_aio_usage[] = {
+	"perf bench io aio <options>",
+	NULL
+};
+
+static int io_setup(unsigned int nr_events, aio_context_t *ctx)
+{
+	return syscall(__NR_io_setup, nr_events, ctx);
+}
+
+static int io_destroy(aio_context_t ctx)
+{
+	return syscall(__NR_io_destroy, ctx);
+}
+
+static int io_submit(aio_context_t ctx, long nr, struct iocb **iocbs)
+{
+	return syscall(__NR_io_submit, ctx, nr, iocbs);
+}
+
+static int io_getevents(aio_context_t ctx, long min_nr, long nr,
+			struct io_event *events)
+{
+	return syscall(__NR_io_getevents, ctx, min_nr, nr, events, NULL);
+}
+
+static void prep_read(struct submitter *s, struct iocb *iocb)
+{
+	unsigned long long off;
+
+	off = ((unsigned long long)rand_r(&s->seed) << 31 | rand_r(&s->seed)) %
+	      (s->size / bs);
+	iocb->aio_offset = off * bs;
+}
+
+static void *workerfn(void *arg)
+{
+	struct submitter *s = arg;
+	unsigned int i;
+	int ret;
+
+	pthread_mutex_lock(&thread_lock);
+	threads_starting--;
+	if (!threads_starting)
+		pthread_cond_signal(&thread_parent);
+	pthread_cond_wait(&thread_worker, &thread_lock);
+	pthread_mutex_unlock(&thread_lock);
+
+	while (!done || s->nr_free < depth) {
+		if (!done && s->nr_free) {
+			for (i = 0; i < s->nr_free; i++)
+				prep_read(s, s->free_iocbs[i]);
+			ret = io_submit(s->ctx, s->nr_free, s->free_iocbs);
+			if (ret < 0 && errno != EAGAIN && errno != EINTR)
+				err(EXIT_FAILURE, "io_submit");
+			if (ret > 0) {
+				/* keep what didn't make it for the next round */
+				s->nr_free -= ret;
+				memmove(s->free_iocbs, s->free_iocbs + ret,
+					s->nr_free * sizeof(*s->free_iocbs));
+			}
+		}
+
+		if (s->nr_free == depth)
+			continue;
+
+		/* wait for one or more, the buffers outlive the reads */
+		ret = io_getevents(s->ctx, 1, depth, s->events);
+		if (ret < 0 && errno != EINTR)
+			err(EXIT_FAILURE, "io_getevents");
+		for (i = 0; ret > 0 && i < (unsigned int)ret; i++) {
+			if (s->events[i].res != bs) {
+				errno = s->events[i].res < 0 ?
+					-s->events[i].res : EIO;
+				err(EXIT_FAILURE, "read");
+			}
+			s->free_iocbs[s->nr_free++] =
+				(struct iocb *)(unsigned long)s->events[i].obj;
+			s->ops++;
+		}
+	}
+	return NULL;
+}
+
+static void toggle_done(int sig __maybe_unused,
+			siginfo_t *info __maybe_unused,
+			void *uc __maybe_unused)
+{
+	/* inform all threads that we're done for the day */
+	done = true;
+	gettimeofday(&bench__end, NULL);
+	timersub(&bench__end, &bench__start, &bench__runtime);
+}
+
+static void print_summary(void)
+{
+	unsigned long avg = avg_stats(&throughput_stats);
+	double stddev = stddev_stats(&throughput_stats);
+
+	printf("%sAveraged %ld IOPS per thread (+- %.2f%%), %.1f MB/s total, total secs = %d\n",
+	       !silent ? "\n" : "", avg, rel_stddev_stats(stddev, avg),
+	       (double)avg * nthreads * bs / (1024 * 1024),
+	       (int)bench__runtime.tv_sec);
+}
+
+static unsigned long long target_size(int fd)
+{
+	unsigned long long size;
+	struct stat st;
+
+	if (fstat(fd, &st))
+		err(EXIT_FAILURE, "fstat");
+	if (!S_ISBLK(st.st_mode))
+		return st.st_size;
+	if (ioctl(fd, BLKGETSIZE64, &size))
+		err(EXIT_FAILURE, "BLKGETSIZE64");
+	return size;
+}
+
+static void setup_submitter(struct submitter *s)
+{
+	unsigned int i;
+
+	s->fd = open(target, O_RDONLY | O_DIRECT);
+	if (s->fd < 0)
+		err(EXIT_FAILURE, "open: %s", target);
+	s->size = target_size(s->fd);
+	if (s->size < bs)
+		errx(EXIT_FAILURE, "%s is smaller than %d bytes", target, bs);
+
+	if (io_setup(depth, &s->ctx))
+		err(EXIT_FAILURE, "io_setup");
+
+	if (posix_memalign((void **)&s->bufs, 4096, (size_t)depth * bs))
+		err(EXIT_FAILURE, "posix_memalign");
+	s->iocbs = calloc(depth, sizeof(*s->iocbs));
+	s->free_iocbs = calloc(depth, sizeof(*s->free_iocbs));
+	s->events = calloc(depth, sizeof(*s->events));
+	if (!s->iocbs || !s->free_iocbs || !s->events)
+		err(EXIT_FAILURE, "calloc");
+
+	for (i = 0; i < depth; i++) {
+		struct iocb *iocb = &s->iocbs[i];
+
+		iocb->aio_lio_opcode = IOCB_CMD_PREAD;
+		iocb->aio_fildes = s->fd;
+		iocb->aio_buf = (unsigned long)(s->bufs + (size_t)i * bs);
+		iocb->aio_nbytes = bs;
+		s->free_iocbs[i] = iocb;
+	}
+	s->nr_free = depth;
+}
+
+int bench_io_aio(int argc, const char **argv)
+{
+	int ret = 0;
+	cpu_set_t cpuset;
+	struct sigaction act;
+	unsigned int i;
+	pthread_attr_t thread_attr;
+	struct submitter *submitter;
+	struct cpu_map *cpu;
+
+	argc = parse_options(argc, argv, options, bench_io_aio_usage, 0);
+	if (argc || !nthreads || !depth || !bs) {
+		usage_with_options(bench_io_aio_usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	cpu = cpu_map__new(NULL);
+	if (!cpu)
+		err(EXIT_FAILURE, "calloc");
+
+	sigfillset(&act.sa_mask);
+	act.sa_sigaction = toggle_done;
+	sigaction(SIGINT, &act, NULL);
+
+	submitter = calloc(nthreads, sizeof(*submitter));
+	if (!submitter)
+		err(EXIT_FAILURE, "calloc");
+
+	printf("Run summary [PID %d]: %d threads reading %s, %d x %d bytes in flight each for %d secs.\n\n",
+	       getpid(), nthreads, target, depth, bs, nsecs);
+
+	init_stats(&throughput_stats);
+	pthread_mutex_init(&thread_lock, NULL);
+	pthread_cond_init(&thread_parent, NULL);
+	pthread_cond_init(&thread_worker, NULL);
+
+	threads_starting = nthreads;
+	pthread_attr_init(&thread_attr);
+	for (i = 0; i < nthreads; i++) {
+		struct submitter *s = &submitter[i];
+
+		s->tid = i;
+		s->seed = getpid() + i;
+		setup_submitter(s);
+
+		CPU_ZERO(&cpuset);
+		CPU_SET(cpu->map[i % cpu->nr], &cpuset);
+
+		ret = pthread_attr_setaffinity_np(&thread_attr, sizeof(cpu_set_t), &cpuset);
+		if (ret)
+			err(EXIT_FAILURE, "pthread_attr_setaffinity_np");
+
+		ret = pthread_create(&s->thread, &thread_attr, workerfn, s);
+		if (ret)
+			err(EXIT_FAILURE, "pthread_create");
+	}
+	pthread_attr_destroy(&thread_attr);
+
+	pthread_mutex_lock(&thread_lock);
+	while (threads_starting)
+		pthread_cond_wait(&thread_parent, &thread_lock);
+	gettimeofday(&bench__start, NULL);
+	pthread_cond_broadcast(&thread_worker);
+	pthread_mutex_unlock(&thread_lock);
+
+	sleep(nsecs);
+	toggle_done(0, NULL, NULL);
+
+	for (i = 0; i < nthreads; i++) {
+		ret = pthread_join(submitter[i].thread, NULL);
+		if (ret)
+			err(EXIT_FAILURE, "pthread_join");
+	}
+
+	/* cleanup & report results */
+	pthread_cond_destroy(&thread_parent);
+	pthread_cond_destroy(&thread_worker);
+	pthread_mutex_destroy(&thread_lock);
+
+	for (i = 0; i < nthreads; i++) {
+		struct submitter *s = &submitter[i];
+		unsigned long t = s->ops / bench__runtime.tv_sec;
+
+		update_stats(&throughput_stats, t);
+		if (!silent)
+			printf("[thread %2d] %ld IOPS\n", s->tid, t);
+
+		io_destroy(s->ctx);
+		close(s->fd);
+		free(s->events);
+		free(s->free_iocbs);
+		free(s->iocbs);
+		free(s->bufs);
+	}
+
+	print_summary();
+
+	free(submitter);
+	free(cpu);
+	return ret;
+}
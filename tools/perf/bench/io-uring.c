@@ -0,0 +1,433 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * io-uring: Keep a queue of random O_DIRECT reads in flight on a file or
+ * block device through io_uring, one ring per thread.
+ *
+ * Meant to be pointed at null_blk (the default target is /dev/nullb0),
+ * where the block layer and io_uring submission and completion paths are
+ * all there is to measure. SQPOLL, IOPOLL (which wants null_blk loaded
+ * with poll_queues=) and fixed buffers can be selected independently.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <linux/compiler.h>
+#include <linux/fs.h>
+#include <linux/io_uring.h>
+#include <linux/kernel.h>
+
+#include "../util/stat.h"
+#include <subcmd/parse-options.h>
+#include "bench.h"
+#include "cpumap.h"
+
+#include <err.h>
+
+#ifndef __NR_io_uring_setup
+# define __NR_io_uring_setup		425
+#endif
+#ifndef __NR_io_uring_enter
+# define __NR_io_uring_enter		426
+#endif
+#ifndef __NR_io_uring_register
+# define __NR_io_uring_register		427
+#endif
+
+static const char *target = "/dev/nullb0";
+static unsigned int nthreads = 1;
+static unsigned int nsecs    = 10;
+static unsigned int depth    = 128;
+static unsigned int bs       = 4096;
+static bool sqpoll = false, iopoll = false, fixed = false;
+static bool done = false, silent = false;
+
+static pthread_mutex_t thread_lock;
+static unsigned int threads_starting;
+static struct stats throughput_stats;
+static pthread_cond_t thread_parent, thread_worker;
+
+struct submitter {
+	int tid;
+	pthread_t thread;
+	int fd, ring_fd;
+	unsigned long long size;
+	unsigned int seed;
+	char *bufs;
+	/* free buffer indices, the in-flight ones are in user_data */
+	unsigned int *free_bufs;
+	unsigned int nr_free;
+
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_flags, *sq_array;
+	struct io_uring_sqe *sqes;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	unsigned long ops;
+};
+
+static const struct option options[] = {
+	OPT_STRING( 'f', "file",    &target,   "path", "Specify the file or block device to read from"),
+	OPT_UINTEGER('t', "threads", &nthreads, "Specify amount of threads, one ring each"),
+	OPT_UINTEGER('r', "runtime", &nsecs,    "Specify runtime (in seconds)"),
+	OPT_UINTEGER('d', "depth",   &depth,    "Specify amount of requests in flight per thread"),
+	OPT_UINTEGER('b', "bs",      &bs,       "Specify the read size in bytes"),
+	OPT_BOOLEAN( 'P', "sqpoll",  &sqpoll,   "Submit through a kernel SQ poll thread (IORING_SETUP_SQPOLL)"),
+	OPT_BOOLEAN( 'p', "iopoll",  &iopoll,   "Poll for completions (IORING_SETUP_IOPOLL)"),
+	OPT_BOOLEAN( 'x', "fixed",   &fixed,    "Use fixed files and registered buffers"),
+	OPT_BOOLEAN( 's', "silent",  &silent,   "Silent mode: do not display data/details"),
+	OPT_END()
+};
+
+static const char * const bench_io_uring_usage[] = {
+	"perf bench io uring <options>",
+	NULL
+};
+
+static int io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned int to_submit,
+			  unsigned int min_complete, unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+		       flags, NULL, 0);
+}
+
+static int io_uring_register(int fd, unsigned int opcode, const void *arg,
+			     unsigned int nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void register_fixed(struct submitter *s)
+{
+	struct iovec *iov;
+	unsigned int i;
+
+	if (io_uring_register(s->ring_fd, IORING_REGISTER_FILES, &s->fd, 1))
+		err(EXIT_FAILURE, "IORING_REGISTER_FILES");
+
+	iov = calloc(depth, sizeof(*iov));
+	if (!iov)
+		err(EXIT_FAILURE, "calloc");
+	for (i = 0; i < depth; i++) {
+		iov[i].iov_base = s->bufs + (size_t)i * bs;
+		iov[i].iov_len = bs;
+	}
+	if (io_uring_register(s->ring_fd, IORING_REGISTER_BUFFERS, iov, depth))
+		err(EXIT_FAILURE, "IORING_REGISTER_BUFFERS");
+	free(iov);
+}
+
+static void setup_ring(struct submitter *s)
+{
+	struct io_uring_params p;
+	void *ptr;
+
+	memset(&p, 0, sizeof(p));
+	if (sqpoll)
+		p.flags |= IORING_SETUP_SQPOLL;
+	if (iopoll)
+		p.flags |= IORING_SETUP_IOPOLL;
+
+	s->ring_fd = io_uring_setup(depth, &p);
+	if (s->ring_fd < 0)
+		err(EXIT_FAILURE, "io_uring_setup");
+
+	ptr = mmap(NULL, p.sq_off.array + p.sq_entries * sizeof(__u32),
+		   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		   s->ring_fd, IORING_OFF_SQ_RING);
+	if (ptr == MAP_FAILED)
+		err(EXIT_FAILURE, "mmap");
+	s->sq_head = ptr + p.sq_off.head;
+	s->sq_tail = ptr + p.sq_off.tail;
+	s->sq_mask = ptr + p.sq_off.ring_mask;
+	s->sq_flags = ptr + p.sq_off.flags;
+	s->sq_array = ptr + p.sq_off.array;
+
+	s->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+		       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		       s->ring_fd, IORING_OFF_SQES);
+	if (s->sqes == MAP_FAILED)
+		err(EXIT_FAILURE, "mmap");
+
+	ptr = mmap(NULL, p.cq_off.cqes +
+		   p.cq_entries * sizeof(struct io_uring_cqe),
+		   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		   s->ring_fd, IORING_OFF_CQ_RING);
+	if (ptr == MAP_FAILED)
+		err(EXIT_FAILURE, "mmap");
+	s->cq_head = ptr + p.cq_off.head;
+	s->cq_tail = ptr + p.cq_off.tail;
+	s->cq_mask = ptr + p.cq_off.ring_mask;
+	s->cqes = ptr + p.cq_off.cqes;
+
+	if (fixed)
+		register_fixed(s);
+}
+
+static void prep_read(struct submitter *s, struct io_uring_sqe *sqe,
+		      unsigned int buf)
+{
+	unsigned long long off;
+
+	off = ((unsigned long long)rand_r(&s->seed) << 31 | rand_r(&s->seed)) %
+	      (s->size / bs);
+
+	memset(sqe, 0, sizeof(*sqe));
+	if (fixed) {
+		sqe->opcode = IORING_OP_READ_FIXED;
+		sqe->flags = IOSQE_FIXED_FILE;
+		sqe->fd = 0;
+		sqe->buf_index = buf;
+	} else {
+		sqe->opcode = IORING_OP_READ;
+		sqe->fd = s->fd;
+	}
+	sqe->addr = (unsigned long)(s->bufs + (size_t)buf * bs);
+	sqe->len = bs;
+	sqe->off = off * bs;
+	sqe->user_data = buf;
+}
+
+/* fill the SQ ring with a read for each free buffer */
+static unsigned int queue_reads(struct submitter *s)
+{
+	unsigned int tail = *s->sq_tail, mask = *s->sq_mask, queued = 0;
+
+	while (s->nr_free) {
+		unsigned int idx = tail & mask;
+
+		prep_read(s, &s->sqes[idx], s->free_bufs[--s->nr_free]);
+		s->sq_array[idx] = idx;
+		tail++;
+		queued++;
+	}
+	/* the sqes must be visible before the kernel sees the new tail */
+	__atomic_store_n(s->sq_tail, tail, __ATOMIC_RELEASE);
+	return queued;
+}
+
+static void reap_completions(struct submitter *s)
+{
+	unsigned int head = *s->cq_head, mask = *s->cq_mask;
+
+	while (head != __atomic_load_n(s->cq_tail, __ATOMIC_ACQUIRE)) {
+		struct io_uring_cqe *cqe = &s->cqes[head & mask];
+
+		if (cqe->res != (int)bs) {
+			errno = cqe->res < 0 ? -cqe->res : EIO;
+			err(EXIT_FAILURE, "read");
+		}
+		s->free_bufs[s->nr_free++] = cqe->user_data;
+		s->ops++;
+		head++;
+	}
+	__atomic_store_n(s->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static void *workerfn(void *arg)
+{
+	struct submitter *s = arg;
+	unsigned int to_submit, flags;
+
+	pthread_mutex_lock(&thread_lock);
+	threads_starting--;
+	if (!threads_starting)
+		pthread_cond_signal(&thread_parent);
+	pthread_cond_wait(&thread_worker, &thread_lock);
+	pthread_mutex_unlock(&thread_lock);
+
+	while (!done) {
+		to_submit = queue_reads(s);
+		flags = IORING_ENTER_GETEVENTS;
+
+		if (sqpoll) {
+			/* the SQ thread picks the reads up, wake it if it sleeps */
+			__atomic_thread_fence(__ATOMIC_SEQ_CST);
+			if (__atomic_load_n(s->sq_flags, __ATOMIC_RELAXED) &
+			    IORING_SQ_NEED_WAKEUP)
+				flags |= IORING_ENTER_SQ_WAKEUP;
+			to_submit = 0;
+		}
+
+		if (io_uring_enter(s->ring_fd, to_submit, 1, flags) < 0 &&
+		    errno != EINTR)
+			err(EXIT_FAILURE, "io_uring_enter");
+		reap_completions(s);
+	}
+
+	/* drain, the buffers must not go away under the reads */
+	while (s->nr_free < depth) {
+		if (io_uring_enter(s->ring_fd, 0, 1,
+				   IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+			err(EXIT_FAILURE, "io_uring_enter");
+		reap_completions(s);
+	}
+	return NULL;
+}
+
+static void toggle_done(int sig __maybe_unused,
+			siginfo_t *info __maybe_unused,
+			void *uc __maybe_unused)
+{
+	/* inform all threads that we're done for the day */
+	done = true;
+	gettimeofday(&bench__end, NULL);
+	timersub(&bench__end, &bench__start, &bench__runtime);
+}
+
+static void print_summary(void)
+{
+	unsigned long avg = avg_stats(&throughput_stats);
+	double stddev = stddev_stats(&throughput_stats);
+
+	printf("%sAveraged %ld IOPS per thread (+- %.2f%%), %.1f MB/s total, total secs = %d\n",
+	       !silent ? "\n" : "", avg, rel_stddev_stats(stddev, avg),
+	       (double)avg * nthreads * bs / (1024 * 1024),
+	       (int)bench__runtime.tv_sec);
+}
+
+static unsigned long long target_size(int fd)
+{
+	unsigned long long size;
+	struct stat st;
+
+	if (fstat(fd, &st))
+		err(EXIT_FAILURE, "fstat");
+	if (!S_ISBLK(st.st_mode))
+		return st.st_size;
+	if (ioctl(fd, BLKGETSIZE64, &size))
+		err(EXIT_FAILURE, "BLKGETSIZE64");
+	return size;
+}
+
+int bench_io_uring(int argc, const char **argv)
+{
+	int ret = 0;
+	cpu_set_t cpuset;
+	struct sigaction act;
+	unsigned int i, j;
+	pthread_attr_t thread_attr;
+	struct submitter *submitter;
+	struct cpu_map *cpu;
+
+	argc = parse_options(argc, argv, options, bench_io_uring_usage, 0);
+	if (argc || !nthreads || !depth || !bs) {
+		usage_with_options(bench_io_uring_usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	cpu = cpu_map__new(NULL);
+	if (!cpu)
+		err(EXIT_FAILURE, "calloc");
+
+	sigfillset(&act.sa_mask);
+	act.sa_sigaction = toggle_done;
+	sigaction(SIGINT, &act, NULL);
+
+	submitter = calloc(nthreads, sizeof(*submitter));
+	if (!submitter)
+		err(EXIT_FAILURE, "calloc");
+
+	printf("Run summary [PID %d]: %d threads reading %s, %d x %d bytes in flight each%s%s%s for %d secs.\n\n",
+	       getpid(), nthreads, target, depth, bs, sqpoll ? ", sqpoll" : "",
+	       iopoll ? ", iopoll" : "", fixed ? ", fixed" : "", nsecs);
+
+	init_stats(&throughput_stats);
+	pthread_mutex_init(&thread_lock, NULL);
+	pthread_cond_init(&thread_parent, NULL);
+	pthread_cond_init(&thread_worker, NULL);
+
+	threads_starting = nthreads;
+	pthread_attr_init(&thread_attr);
+	for (i = 0; i < nthreads; i++) {
+		struct submitter *s = &submitter[i];
+
+		s->tid = i;
+		s->seed = getpid() + i;
+		s->fd = open(target, O_RDONLY | O_DIRECT);
+		if (s->fd < 0)
+			err(EXIT_FAILURE, "open: %s", target);
+		s->size = target_size(s->fd);
+		if (s->size < bs)
+			errx(EXIT_FAILURE, "%s is smaller than %d bytes", target, bs);
+
+		if (posix_memalign((void **)&s->bufs, 4096, (size_t)depth * bs))
+			err(EXIT_FAILURE, "posix_memalign");
+		s->free_bufs = calloc(depth, sizeof(*s->free_bufs));
+		if (!s->free_bufs)
+			err(EXIT_FAILURE, "calloc");
+		for (j = 0; j < depth; j++)
+			s->free_bufs[j] = j;
+		s->nr_free = depth;
+
+		setup_ring(s);
+
+		CPU_ZERO(&cpuset);
+		CPU_SET(cpu->map[i % cpu->nr], &cpuset);
+
+		ret = pthread_attr_setaffinity_np(&thread_attr, sizeof(cpu_set_t), &cpuset);
+		if (ret)
+			err(EXIT_FAILURE, "pthread_attr_setaffinity_np");
+
+		ret = pthread_create(&s->thread, &thread_attr, workerfn, s);
+		if (ret)
+			err(EXIT_FAILURE, "pthread_create");
+	}
+	pthread_attr_destroy(&thread_attr);
+
+	pthread_mutex_lock(&thread_lock);
+	while (threads_starting)
+		pthread_cond_wait(&thread_parent, &thread_lock);
+	gettimeofday(&bench__start, NULL);
+	pthread_cond_broadcast(&thread_worker);
+	pthread_mutex_unlock(&thread_lock);
+
+	sleep(nsecs);
+	toggle_done(0, NULL, NULL);
+
+	for (i = 0; i < nthreads; i++) {
+		ret = pthread_join(submitter[i].thread, NULL);
+		if (ret)
+			err(EXIT_FAILURE, "pthread_join");
+	}
+
+	/* cleanup & report results */
+	pthread_cond_destroy(&thread_parent);
+	pthread_cond_destroy(&thread_worker);
+	pthread_mutex_destroy(&thread_lock);
+
+	for (i = 0; i < nthreads; i++) {
+		struct submitter *s = &submitter[i];
+		unsigned long t = s->ops / bench__runtime.tv_sec;
+
+		update_stats(&throughput_stats, t);
+		if (!silent)
+			printf("[thread %2d] %ld IOPS\n", s->tid, t);
+
+		close(s->ring_fd);
+		close(s->fd);
+		free(s->free_bufs);
+		free(s->bufs);
+	}
+
+	print_summary();
+
+	free(submitter);
+	free(cpu);
+	return ret;
+}
@@ -0,0 +1,434 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * sched-coloc: Latency sensitive and batch threads sharing CPUs.
+ *
+ * Latency threads sleep until the next tick of their period, take the
+ * time they actually woke up at, and run a short burst. Batch threads
+ * either spin on the CPU or stream through a buffer, which is what hurts
+ * an SMT sibling most. At the end the wakeup latency percentiles of the
+ * latency threads, the throughput of the batch threads and, when they run
+ * in cgroups, how often their CFS bandwidth throttled them are reported.
+ *
+ * With --cgroup the two classes get a cgroup each under the given cpu
+ * controller mount, whose identity (--lat-identity/--batch-identity, for
+ * group identity kernels) and CFS quota (--batch-quota) can be set.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <linux/compiler.h>
+#include <linux/kernel.h>
+#include <linux/time64.h>
+
+#include "../util/stat.h"
+#include <subcmd/parse-options.h>
+#include "bench.h"
+#include "cpumap.h"
+
+#include <err.h>
+
+/* an identity that can't be set, i.e. leave it alone */
+#define COLOC_NO_IDENTITY	INT_MIN
+
+static unsigned int nsecs       = 10;
+static unsigned int nr_lat      = 4;
+static unsigned int nr_batch    = 0;
+static unsigned int lat_period  = 1000;	/* usecs */
+static unsigned int lat_burst   = 100;	/* usecs */
+static unsigned int batch_quota = 0;	/* usecs per 100ms period */
+static int lat_identity = COLOC_NO_IDENTITY;
+static int batch_identity = COLOC_NO_IDENTITY;
+static const char *cpu_list;
+static const char *cgroup_root;
+static const char *batch_mode = "spin";
+static bool done = false, silent = false;
+
+static pthread_mutex_t thread_lock;
+static unsigned int threads_starting;
+static pthread_cond_t thread_parent, thread_worker;
+static cpu_set_t cpuset;
+static char cgroup_dir[PATH_MAX];
+
+#define COLOC_MEM_SIZE		(32 << 20)	/* larger than any LLC share */
+
+struct worker {
+	int tid;
+	pthread_t thread;
+	const char *cgroup;		/* lat or batch */
+	/* latency threads */
+	u64 *samples;			/* wakeup latencies in ns */
+	unsigned long nr_samples, max_samples;
+	/* batch threads */
+	char *buf;
+	unsigned long ops;
+};
+
+static const struct option options[] = {
+	OPT_UINTEGER('r', "runtime", &nsecs, "Specify runtime (in seconds)"),
+	OPT_UINTEGER('l', "lat-threads", &nr_lat, "Specify amount of latency threads"),
+	OPT_UINTEGER('b', "batch-threads", &nr_batch, "Specify amount of batch threads (default: one per CPU)"),
+	OPT_UINTEGER('p', "lat-period", &lat_period, "Specify the wakeup period of latency threads (in usecs)"),
+	OPT_UINTEGER('B', "lat-burst", &lat_burst, "Specify how long latency threads run per wakeup (in usecs)"),
+	OPT_STRING( 'm', "batch-mode", &batch_mode, "spin|mem", "Specify what batch threads do: spin on the CPU or stream through memory"),
+	OPT_STRING( 'C', "cpu", &cpu_list, "cpu", "Specify the CPUs all threads share (e.g. 0-3)"),
+	OPT_STRING( 'G', "cgroup", &cgroup_root, "path", "Run the classes in cgroups under this cpu controller mount"),
+	OPT_INTEGER( 0 , "lat-identity", &lat_identity, "Specify the cpu.identity of the latency cgroup"),
+	OPT_INTEGER( 0 , "batch-identity", &batch_identity, "Specify the cpu.identity of the batch cgroup"),
+	OPT_UINTEGER('q', "batch-quota", &batch_quota, "Specify the CFS quota of the batch cgroup (in usecs per 100ms)"),
+	OPT_BOOLEAN( 's', "silent", &silent, "Silent mode: do not display data/details"),
+	OPT_END()
+};
+
+static const char * const bench_sched_coloc_usage[] = {
+	"perf bench sched coloc <options>",
+	NULL
+};
+
+static void cgroup_write(const char *cgroup, const char *file, const char *fmt, ...)
+{
+	char path[PATH_MAX], val[64];
+	va_list ap;
+	int fd, len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(val, sizeof(val), fmt, ap);
+	va_end(ap);
+
+	snprintf(path, sizeof(path), "%s/%s/%s", cgroup_dir, cgroup, file);
+	fd = open(path, O_WRONLY);
+	if (fd < 0)
+		err(EXIT_FAILURE, "open: %s", path);
+	if (write(fd, val, len) != len)
+		err(EXIT_FAILURE, "write: %s", path);
+	close(fd);
+}
+
+/* nr_throttled and throttled_time of a cgroup's cpu.stat */
+static void cgroup_throttling(const char *cgroup, unsigned long *nr, u64 *ns)
+{
+	char path[PATH_MAX], key[64];
+	unsigned long long val;
+	FILE *f;
+
+	*nr = 0;
+	*ns = 0;
+	snprintf(path, sizeof(path), "%s/%s/cpu.stat", cgroup_dir, cgroup);
+	f = fopen(path, "r");
+	if (!f)
+		return;
+	while (fscanf(f, "%63s %llu", key, &val) == 2) {
+		if (!strcmp(key, "nr_throttled"))
+			*nr = val;
+		else if (!strcmp(key, "throttled_time"))
+			*ns = val;
+	}
+	fclose(f);
+}
+
+static void setup_cgroups(void)
+{
+	static const char * const cgroups[] = { "lat", "batch" };
+	char path[PATH_MAX];
+	unsigned int i;
+
+	snprintf(cgroup_dir, sizeof(cgroup_dir), "%s/perf-bench-coloc-%d",
+		 cgroup_root, getpid());
+	if (mkdir(cgroup_dir, 0755))
+		err(EXIT_FAILURE, "mkdir: %s", cgroup_dir);
+	for (i = 0; i < ARRAY_SIZE(cgroups); i++) {
+		snprintf(path, sizeof(path), "%s/%s", cgroup_dir, cgroups[i]);
+		if (mkdir(path, 0755))
+			err(EXIT_FAILURE, "mkdir: %s", path);
+	}
+
+	if (lat_identity != COLOC_NO_IDENTITY)
+		cgroup_write("lat", "cpu.identity", "%d", lat_identity);
+	if (batch_identity != COLOC_NO_IDENTITY)
+		cgroup_write("batch", "cpu.identity", "%d", batch_identity);
+	if (batch_quota) {
+		cgroup_write("batch", "cpu.cfs_period_us", "%u", 100000);
+		cgroup_write("batch", "cpu.cfs_quota_us", "%u", batch_quota);
+	}
+}
+
+static void cleanup_cgroups(void)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "%s/lat", cgroup_dir);
+	rmdir(path);
+	snprintf(path, sizeof(path), "%s/batch", cgroup_dir);
+	rmdir(path);
+	rmdir(cgroup_dir);
+}
+
+static u64 now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void spin_until(u64 end)
+{
+	while (now_ns() < end)
+		;
+}
+
+static void worker_start(struct worker *w)
+{
+	if (sched_setaffinity(0, sizeof(cpuset), &cpuset))
+		err(EXIT_FAILURE, "sched_setaffinity");
+	if (cgroup_root)
+		cgroup_write(w->cgroup, "tasks", "%ld", syscall(SYS_gettid));
+
+	pthread_mutex_lock(&thread_lock);
+	threads_starting--;
+	if (!threads_starting)
+		pthread_cond_signal(&thread_parent);
+	pthread_cond_wait(&thread_worker, &thread_lock);
+	pthread_mutex_unlock(&thread_lock);
+}
+
+static void *lat_workerfn(void *arg)
+{
+	struct worker *w = (struct worker *) arg;
+	struct timespec ts;
+	u64 next, woken;
+
+	worker_start(w);
+
+	next = now_ns();
+	while (!done) {
+		next += lat_period * NSEC_PER_USEC;
+		ts.tv_sec = next / NSEC_PER_SEC;
+		ts.tv_nsec = next % NSEC_PER_SEC;
+		if (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL))
+			continue;
+		woken = now_ns();
+
+		if (w->nr_samples == w->max_samples) {
+			w->max_samples = w->max_samples ? w->max_samples * 2 : 4096;
+			w->samples = realloc(w->samples,
+					     w->max_samples * sizeof(*w->samples));
+			if (!w->samples)
+				err(EXIT_FAILURE, "realloc");
+		}
+		w->samples[w->nr_samples++] = woken - next;
+
+		spin_until(woken + lat_burst * NSEC_PER_USEC);
+		/* a late wakeup doesn't get ticks to catch up on */
+		if (now_ns() > next + lat_period * NSEC_PER_USEC)
+			next = now_ns();
+	}
+	return NULL;
+}
+
+static void *batch_workerfn(void *arg)
+{
+	struct worker *w = (struct worker *) arg;
+	volatile unsigned long x = 0;
+	unsigned long i;
+
+	worker_start(w);
+
+	while (!done) {
+		if (w->buf) {
+			/* a cache line at a time, one op per pass */
+			for (i = 0; i < COLOC_MEM_SIZE; i += 64)
+				w->buf[i]++;
+		} else {
+			for (i = 0; i < 100000; i++)
+				x += i;
+		}
+		w->ops++;
+	}
+	return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void toggle_done(int sig __maybe_unused,
+			siginfo_t *info __maybe_unused,
+			void *uc __maybe_unused)
+{
+	/* inform all threads that we're done for the day */
+	done = true;
+	gettimeofday(&bench__end, NULL);
+	timersub(&bench__end, &bench__start, &bench__runtime);
+}
+
+static void print_summary(struct worker *worker)
+{
+	static const double pcts[] = { 50, 90, 99, 99.9 };
+	unsigned long nr = 0, i, j, throttled;
+	struct stats batch_stats;
+	u64 *all, throttled_ns;
+
+	for (i = 0; i < nr_lat; i++)
+		nr += worker[i].nr_samples;
+	if (nr) {
+		all = malloc(nr * sizeof(*all));
+		if (!all)
+			err(EXIT_FAILURE, "malloc");
+		for (i = 0, j = 0; i < nr_lat; i++) {
+			memcpy(all + j, worker[i].samples,
+			       worker[i].nr_samples * sizeof(*all));
+			j += worker[i].nr_samples;
+		}
+		qsort(all, nr, sizeof(*all), cmp_u64);
+
+		printf("\nWakeup latency (usecs) of %lu wakeups:", nr);
+		for (i = 0; i < ARRAY_SIZE(pcts); i++)
+			printf(" p%g %.1f", pcts[i],
+			       all[(unsigned long)(nr * pcts[i] / 100)] /
+			       (double)NSEC_PER_USEC);
+		printf(" max %.1f\n", all[nr - 1] / (double)NSEC_PER_USEC);
+		free(all);
+	}
+
+	if (nr_batch) {
+		init_stats(&batch_stats);
+		for (i = nr_lat; i < nr_lat + nr_batch; i++) {
+			unsigned long t = worker[i].ops / bench__runtime.tv_sec;
+
+			update_stats(&batch_stats, t);
+			if (!silent)
+				printf("[batch thread %2d] %ld ops/sec\n",
+				       worker[i].tid, t);
+		}
+		printf("Batch throughput: averaged %.0f ops/sec per thread (+- %.2f%%)\n",
+		       avg_stats(&batch_stats),
+		       rel_stddev_stats(stddev_stats(&batch_stats),
+					avg_stats(&batch_stats)));
+	}
+
+	if (cgroup_root) {
+		cgroup_throttling("lat", &throttled, &throttled_ns);
+		printf("Latency cgroup: throttled %lu times, %.3f ms\n",
+		       throttled, throttled_ns / (double)NSEC_PER_MSEC);
+		cgroup_throttling("batch", &throttled, &throttled_ns);
+		printf("Batch cgroup: throttled %lu times, %.3f ms\n",
+		       throttled, throttled_ns / (double)NSEC_PER_MSEC);
+	}
+}
+
+int bench_sched_coloc(int argc, const char **argv)
+{
+	int ret = 0;
+	struct sigaction act;
+	unsigned int i;
+	struct worker *worker;
+	struct cpu_map *cpu;
+	bool mem;
+
+	argc = parse_options(argc, argv, options, bench_sched_coloc_usage, 0);
+	if (argc || !lat_period || (strcmp(batch_mode, "spin") &&
+				    strcmp(batch_mode, "mem"))) {
+		usage_with_options(bench_sched_coloc_usage, options);
+		exit(EXIT_FAILURE);
+	}
+	if (!cgroup_root && (batch_quota || lat_identity != COLOC_NO_IDENTITY ||
+			     batch_identity != COLOC_NO_IDENTITY))
+		errx(EXIT_FAILURE, "identities and quotas need --cgroup");
+	mem = !strcmp(batch_mode, "mem");
+
+	cpu = cpu_map__new(cpu_list);
+	if (!cpu)
+		err(EXIT_FAILURE, "calloc");
+	CPU_ZERO(&cpuset);
+	for (i = 0; i < (unsigned int)cpu->nr; i++)
+		CPU_SET(cpu->map[i], &cpuset);
+
+	sigfillset(&act.sa_mask);
+	act.sa_sigaction = toggle_done;
+	sigaction(SIGINT, &act, NULL);
+
+	if (!nr_batch) /* default to the number of CPUs */
+		nr_batch = cpu->nr;
+
+	worker = calloc(nr_lat + nr_batch, sizeof(*worker));
+	if (!worker)
+		err(EXIT_FAILURE, "calloc");
+
+	printf("Run summary [PID %d]: %d latency threads (every %d usecs for %d usecs) and %d %s batch threads on %d CPUs for %d secs.\n\n",
+	       getpid(), nr_lat, lat_period, lat_burst, nr_batch, batch_mode,
+	       cpu->nr, nsecs);
+
+	if (cgroup_root)
+		setup_cgroups();
+
+	pthread_mutex_init(&thread_lock, NULL);
+	pthread_cond_init(&thread_parent, NULL);
+	pthread_cond_init(&thread_worker, NULL);
+
+	threads_starting = nr_lat + nr_batch;
+	for (i = 0; i < nr_lat + nr_batch; i++) {
+		struct worker *w = &worker[i];
+		bool lat = i < nr_lat;
+
+		w->tid = lat ? i : i - nr_lat;
+		w->cgroup = lat ? "lat" : "batch";
+		if (!lat && mem) {
+			w->buf = calloc(1, COLOC_MEM_SIZE);
+			if (!w->buf)
+				err(EXIT_FAILURE, "calloc");
+		}
+
+		ret = pthread_create(&w->thread, NULL,
+				     lat ? lat_workerfn : batch_workerfn, w);
+		if (ret)
+			err(EXIT_FAILURE, "pthread_create");
+	}
+
+	pthread_mutex_lock(&thread_lock);
+	while (threads_starting)
+		pthread_cond_wait(&thread_parent, &thread_lock);
+	gettimeofday(&bench__start, NULL);
+	pthread_cond_broadcast(&thread_worker);
+	pthread_mutex_unlock(&thread_lock);
+
+	sleep(nsecs);
+	toggle_done(0, NULL, NULL);
+
+	for (i = 0; i < nr_lat + nr_batch; i++) {
+		ret = pthread_join(worker[i].thread, NULL);
+		if (ret)
+			err(EXIT_FAILURE, "pthread_join");
+	}
+
+	/* cleanup & report results */
+	pthread_cond_destroy(&thread_parent);
+	pthread_cond_destroy(&thread_worker);
+	pthread_mutex_destroy(&thread_lock);
+
+	print_summary(worker);
+	if (cgroup_root)
+		cleanup_cgroups();
+
+	for (i = 0; i < nr_lat + nr_batch; i++) {
+		free(worker[i].samples);
+		free(worker[i].buf);
+	}
+	free(worker);
+	free(cpu);
+	return ret;
+}
@@ -14,6 +14,8 @@
  *  mem   ... memory access performance
  *  numa  ... NUMA scheduling and MM performance
  *  futex ... Futex performance
+ *  epoll ... Event poll performance
+ *  io    ... Block I/O submission performance
  */
 #include "perf.h"
 #include "util/util.h"
@@ -45,6 +47,7 @@ static struct bench numa_benchmarks[] = {
 static struct bench sched_benchmarks[] = {
 	{ "messaging",	"Benchmark for scheduling and IPC",		bench_sched_messaging	},
 	{ "pipe",	"Benchmark for pipe() between two processes",	bench_sched_pipe	},
+	{ "coloc",	"Benchmark for latency and batch threads sharing CPUs",	bench_sched_coloc	},
 	{ "all",	"Run all scheduler benchmarks",		NULL			},
 	{ NULL,		NULL,						NULL			}
 };
@@ -67,6 +70,20 @@ static struct bench futex_benchmarks[] = {
 	{ NULL,		NULL,						NULL			}
 };
 
+static struct bench epoll_benchmarks[] = {
+	{ "wait",	"Benchmark epoll concurrent epoll_waits",	bench_epoll_wait	},
+	{ "ctl",	"Benchmark epoll concurrent epoll_ctls",	bench_epoll_ctl		},
+	{ "all",	"Run all epoll benchmarks",			NULL			},
+	{ NULL,		NULL,						NULL			}
+};
+
+static struct bench io_benchmarks[] = {
+	{ "uring",	"Benchmark for io_uring submission and completion", bench_io_uring	},
+	{ "aio",	"Benchmark for native aio submission and completion", bench_io_aio	},
+	{ "all",	"Run all I/O benchmarks",			NULL			},
+	{ NULL,		NULL,						NULL			}
+};
+
 struct collection {
 	const char	*name;
 	const char	*summary;
@@ -80,6 +97,8 @@ static struct collection collections[] = {
 	{ "numa",	"NUMA scheduling and MM benchmarks",		numa_benchmarks		},
 #endif
 	{"futex",       "Futex stressing benchmarks",                   futex_benchmarks        },
+	{"epoll",       "Epoll stressing benchmarks",                   epoll_benchmarks        },
+	{ "io",		"Block I/O submission benchmarks",		io_benchmarks		},
 	{ "all",	"All benchmarks",				NULL			},
 	{ NULL,		NULL,						NULL			}
 };
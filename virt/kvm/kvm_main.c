@@ -61,6 +61,7 @@
 
 #include "coalesced_mmio.h"
 #include "async_pf.h"
+#include "mmu_lock.h"
 #include "vfio.h"
 
 #define CREATE_TRACE_POINTS
@@ -128,7 +129,8 @@ static void hardware_disable_all(void);
 
 static void kvm_io_bus_destroy(struct kvm_io_bus *bus);
 
-static void mark_page_dirty_in_slot(struct kvm_memory_slot *memslot, gfn_t gfn);
+static void mark_page_dirty_in_slot(struct kvm *kvm,
+				    struct kvm_memory_slot *memslot, gfn_t gfn);
 
 __visible bool kvm_rebooting;
 EXPORT_SYMBOL_GPL(kvm_rebooting);
@@ -185,12 +187,17 @@ bool kvm_is_transparent_hugepage(kvm_pfn_t pfn)
 	return is_transparent_hugepage(compound_head(page));
 }
 
+/* The vcpu loaded on each cpu, see kvm_get_running_vcpu() */
+static DEFINE_PER_CPU(struct kvm_vcpu *, kvm_running_vcpu);
+
 /*
  * Switches to specified vcpu, until a matching vcpu_put()
  */
 void vcpu_load(struct kvm_vcpu *vcpu)
 {
 	int cpu = get_cpu();
+
+	__this_cpu_write(kvm_running_vcpu, vcpu);
 	preempt_notifier_register(&vcpu->preempt_notifier);
 	kvm_arch_vcpu_load(vcpu, cpu);
 	put_cpu();
@@ -202,10 +209,29 @@ void vcpu_put(struct kvm_vcpu *vcpu)
 	preempt_disable();
 	kvm_arch_vcpu_put(vcpu);
 	preempt_notifier_unregister(&vcpu->preempt_notifier);
+	__this_cpu_write(kvm_running_vcpu, NULL);
 	preempt_enable();
 }
 EXPORT_SYMBOL_GPL(vcpu_put);
 
+/**
+ * kvm_get_running_vcpu - get the vcpu running on the current CPU.
+ *
+ * That is the vcpu between vcpu_load() and vcpu_put() of the task, NULL
+ * outside of vcpu context.
+ */
+struct kvm_vcpu *kvm_get_running_vcpu(void)
+{
+	struct kvm_vcpu *vcpu;
+
+	preempt_disable();
+	vcpu = __this_cpu_read(kvm_running_vcpu);
+	preempt_enable();
+
+	return vcpu;
+}
+EXPORT_SYMBOL_GPL(kvm_get_running_vcpu);
+
 /* TODO: merge with kvm_arch_vcpu_should_kick */
 static bool kvm_request_needs_ipi(struct kvm_vcpu *vcpu, unsigned req)
 {
@@ -345,11 +371,20 @@ int kvm_vcpu_init(struct kvm_vcpu *vcpu, struct kvm *kvm, unsigned id)
 	kvm_vcpu_set_dy_eligible(vcpu, false);
 	vcpu->preempted = false;
 
+	if (kvm->dirty_ring_size) {
+		r = kvm_dirty_ring_alloc(&vcpu->dirty_ring, id,
+					 kvm->dirty_ring_size);
+		if (r)
+			goto fail_free_run;
+	}
+
 	r = kvm_arch_vcpu_init(vcpu);
 	if (r < 0)
-		goto fail_free_run;
+		goto fail_free_ring;
 	return 0;
 
+fail_free_ring:
+	kvm_dirty_ring_free(&vcpu->dirty_ring);
 fail_free_run:
 	free_page((unsigned long)vcpu->run);
 fail:
@@ -366,6 +401,7 @@ void kvm_vcpu_uninit(struct kvm_vcpu *vcpu)
 	 */
 	put_pid(rcu_dereference_protected(vcpu->pid, 1));
 	kvm_arch_vcpu_uninit(vcpu);
+	kvm_dirty_ring_free(&vcpu->dirty_ring);
 	free_page((unsigned long)vcpu->run);
 }
 EXPORT_SYMBOL_GPL(kvm_vcpu_uninit);
@@ -385,10 +421,10 @@ static void kvm_mmu_notifier_change_pte(struct mmu_notifier *mn,
 	int idx;
 
 	idx = srcu_read_lock(&kvm->srcu);
-	spin_lock(&kvm->mmu_lock);
+	KVM_MMU_LOCK(kvm);
 	kvm->mmu_notifier_seq++;
 	kvm_set_spte_hva(kvm, address, pte);
-	spin_unlock(&kvm->mmu_lock);
+	KVM_MMU_UNLOCK(kvm);
 	srcu_read_unlock(&kvm->srcu, idx);
 }
 
@@ -403,7 +439,7 @@ static int kvm_mmu_notifier_invalidate_range_start(struct mmu_notifier *mn,
 	int ret;
 
 	idx = srcu_read_lock(&kvm->srcu);
-	spin_lock(&kvm->mmu_lock);
+	KVM_MMU_LOCK(kvm);
 	/*
 	 * The count increase must become visible at unlock time as no
 	 * spte can be established without taking the mmu_lock and
@@ -416,7 +452,7 @@ static int kvm_mmu_notifier_invalidate_range_start(struct mmu_notifier *mn,
 	if (need_tlb_flush)
 		kvm_flush_remote_tlbs(kvm);
 
-	spin_unlock(&kvm->mmu_lock);
+	KVM_MMU_UNLOCK(kvm);
 
 	ret = kvm_arch_mmu_notifier_invalidate_range(kvm, start, end, blockable);
 
@@ -432,7 +468,7 @@ static void kvm_mmu_notifier_invalidate_range_end(struct mmu_notifier *mn,
 {
 	struct kvm *kvm = mmu_notifier_to_kvm(mn);
 
-	spin_lock(&kvm->mmu_lock);
+	KVM_MMU_LOCK(kvm);
 	/*
 	 * This sequence increase will notify the kvm page fault that
 	 * the page that is going to be mapped in the spte could have
@@ -446,7 +482,7 @@ static void kvm_mmu_notifier_invalidate_range_end(struct mmu_notifier *mn,
 	 * in conjunction with the smp_rmb in mmu_notifier_retry().
 	 */
 	kvm->mmu_notifier_count--;
-	spin_unlock(&kvm->mmu_lock);
+	KVM_MMU_UNLOCK(kvm);
 
 	BUG_ON(kvm->mmu_notifier_count < 0);
 }
@@ -460,13 +496,13 @@ static int kvm_mmu_notifier_clear_flush_young(struct mmu_notifier *mn,
 	int young, idx;
 
 	idx = srcu_read_lock(&kvm->srcu);
-	spin_lock(&kvm->mmu_lock);
+	KVM_MMU_LOCK(kvm);
 
 	young = kvm_age_hva(kvm, start, end);
 	if (young)
 		kvm_flush_remote_tlbs(kvm);
 
-	spin_unlock(&kvm->mmu_lock);
+	KVM_MMU_UNLOCK(kvm);
 	srcu_read_unlock(&kvm->srcu, idx);
 
 	return young;
@@ -481,7 +517,7 @@ static int kvm_mmu_notifier_clear_young(struct mmu_notifier *mn,
 	int young, idx;
 
 	idx = srcu_read_lock(&kvm->srcu);
-	spin_lock(&kvm->mmu_lock);
+	KVM_MMU_LOCK(kvm);
 	/*
 	 * Even though we do not flush TLB, this will still adversely
 	 * affect performance on pre-Haswell Intel EPT, where there is
@@ -496,7 +532,7 @@ static int kvm_mmu_notifier_clear_young(struct mmu_notifier *mn,
 	 * more sophisticated heuristic later.
 	 */
 	young = kvm_age_hva(kvm, start, end);
-	spin_unlock(&kvm->mmu_lock);
+	KVM_MMU_UNLOCK(kvm);
 	srcu_read_unlock(&kvm->srcu, idx);
 
 	return young;
@@ -510,9 +546,9 @@ static int kvm_mmu_notifier_test_young(struct mmu_notifier *mn,
 	int young, idx;
 
 	idx = srcu_read_lock(&kvm->srcu);
-	spin_lock(&kvm->mmu_lock);
+	KVM_MMU_LOCK(kvm);
 	young = kvm_test_age_hva(kvm, address);
-	spin_unlock(&kvm->mmu_lock);
+	KVM_MMU_UNLOCK(kvm);
 	srcu_read_unlock(&kvm->srcu, idx);
 
 	return young;
@@ -606,6 +642,67 @@ static void kvm_free_memslots(struct kvm *kvm, struct kvm_memslots *slots)
 	kvfree(slots);
 }
 
+static int halt_poll_hist_show(struct seq_file *m, void *unused)
+{
+	struct kvm *kvm = m->private;
+	u64 success[KVM_HALT_POLL_HIST_BUCKETS] = {};
+	u64 fail[KVM_HALT_POLL_HIST_BUCKETS] = {};
+	u64 success_ns = 0, fail_ns = 0;
+	struct kvm_vcpu *vcpu;
+	int i, b;
+
+	kvm_for_each_vcpu(i, vcpu, kvm) {
+		for (b = 0; b < KVM_HALT_POLL_HIST_BUCKETS; b++) {
+			success[b] += vcpu->halt_poll_hist.success[b];
+			fail[b] += vcpu->halt_poll_hist.fail[b];
+		}
+		success_ns += vcpu->halt_poll_hist.success_ns;
+		fail_ns += vcpu->halt_poll_hist.fail_ns;
+	}
+
+	seq_puts(m, "poll_us success fail\n");
+	for (b = 0; b < KVM_HALT_POLL_HIST_BUCKETS; b++)
+		seq_printf(m, "%s%lu %llu %llu\n",
+			   b == KVM_HALT_POLL_HIST_BUCKETS - 1 ? ">=" : "<",
+			   b == KVM_HALT_POLL_HIST_BUCKETS - 1 ?
+			   1UL << (b - 1) : 1UL << b,
+			   success[b], fail[b]);
+	seq_printf(m, "success_ns %llu\nfail_ns %llu\n", success_ns, fail_ns);
+	return 0;
+}
+
+static int halt_poll_hist_open(struct inode *inode, struct file *file)
+{
+	struct kvm *kvm = inode->i_private;
+	int r;
+
+	/* Same race against kvm_destroy_vm() as kvm_debugfs_open() */
+	if (!refcount_inc_not_zero(&kvm->users_count))
+		return -ENOENT;
+
+	r = single_open(file, halt_poll_hist_show, kvm);
+	if (r)
+		kvm_put_kvm(kvm);
+	return r;
+}
+
+static int halt_poll_hist_release(struct inode *inode, struct file *file)
+{
+	struct kvm *kvm = inode->i_private;
+
+	single_release(inode, file);
+	kvm_put_kvm(kvm);
+	return 0;
+}
+
+static const struct file_operations halt_poll_hist_fops = {
+	.owner   = THIS_MODULE,
+	.open    = halt_poll_hist_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = halt_poll_hist_release,
+};
+
 static void kvm_destroy_vm_debugfs(struct kvm *kvm)
 {
 	int i;
@@ -652,6 +749,8 @@ static int kvm_create_vm_debugfs(struct kvm *kvm, int fd)
 		debugfs_create_file(p->name, stat_data->mode, kvm->debugfs_dentry,
 				    stat_data, stat_fops_per_vm[p->kind]);
 	}
+	debugfs_create_file("halt_poll_histogram", 0444, kvm->debugfs_dentry,
+			    kvm, &halt_poll_hist_fops);
 	return 0;
 }
 
@@ -680,7 +779,7 @@ static struct kvm *kvm_create_vm(unsigned long type)
 	if (!kvm)
 		return ERR_PTR(-ENOMEM);
 
-	spin_lock_init(&kvm->mmu_lock);
+	KVM_MMU_LOCK_INIT(kvm);
 	mmgrab(current->mm);
 	kvm->mm = current->mm;
 	kvm_eventfd_init(kvm);
@@ -1020,6 +1119,7 @@ int __kvm_set_memory_region(struct kvm *kvm,
 	new = old = *slot;
 
 	new.id = id;
+	new.as_id = as_id;
 	new.base_gfn = base_gfn;
 	new.npages = npages;
 	new.flags = mem->flags;
@@ -1075,8 +1175,9 @@ int __kvm_set_memory_region(struct kvm *kvm,
 			goto out_free;
 	}
 
-	/* Allocate page dirty bitmap if needed */
-	if ((new.flags & KVM_MEM_LOG_DIRTY_PAGES) && !new.dirty_bitmap) {
+	/* Allocate page dirty bitmap if needed, the dirty ring replaces it */
+	if ((new.flags & KVM_MEM_LOG_DIRTY_PAGES) && !new.dirty_bitmap &&
+	    !kvm->dirty_ring_size) {
 		if (kvm_create_dirty_bitmap(&new) < 0)
 			goto out_free;
 	}
@@ -1241,7 +1342,7 @@ int kvm_get_dirty_log_protect(struct kvm *kvm,
 	dirty_bitmap_buffer = kvm_second_dirty_bitmap(memslot);
 	memset(dirty_bitmap_buffer, 0, n);
 
-	spin_lock(&kvm->mmu_lock);
+	KVM_MMU_LOCK(kvm);
 	*is_dirty = false;
 	for (i = 0; i < n / sizeof(long); i++) {
 		unsigned long mask;
@@ -1262,7 +1363,7 @@ int kvm_get_dirty_log_protect(struct kvm *kvm,
 		}
 	}
 
-	spin_unlock(&kvm->mmu_lock);
+	KVM_MMU_UNLOCK(kvm);
 	if (copy_to_user(log->dirty_bitmap, dirty_bitmap_buffer, n))
 		return -EFAULT;
 	return 0;
@@ -1915,7 +2016,8 @@ int kvm_vcpu_read_guest_atomic(struct kvm_vcpu *vcpu, gpa_t gpa,
 }
 EXPORT_SYMBOL_GPL(kvm_vcpu_read_guest_atomic);
 
-static int __kvm_write_guest_page(struct kvm_memory_slot *memslot, gfn_t gfn,
+static int __kvm_write_guest_page(struct kvm *kvm,
+				  struct kvm_memory_slot *memslot, gfn_t gfn,
 			          const void *data, int offset, int len)
 {
 	int r;
@@ -1927,7 +2029,7 @@ static int __kvm_write_guest_page(struct kvm_memory_slot *memslot, gfn_t gfn,
 	r = __copy_to_user((void __user *)addr + offset, data, len);
 	if (r)
 		return -EFAULT;
-	mark_page_dirty_in_slot(memslot, gfn);
+	mark_page_dirty_in_slot(kvm, memslot, gfn);
 	return 0;
 }
 
@@ -1936,7 +2038,7 @@ int kvm_write_guest_page(struct kvm *kvm, gfn_t gfn,
 {
 	struct kvm_memory_slot *slot = gfn_to_memslot(kvm, gfn);
 
-	return __kvm_write_guest_page(slot, gfn, data, offset, len);
+	return __kvm_write_guest_page(kvm, slot, gfn, data, offset, len);
 }
 EXPORT_SYMBOL_GPL(kvm_write_guest_page);
 
@@ -1945,7 +2047,7 @@ int kvm_vcpu_write_guest_page(struct kvm_vcpu *vcpu, gfn_t gfn,
 {
 	struct kvm_memory_slot *slot = kvm_vcpu_gfn_to_memslot(vcpu, gfn);
 
-	return __kvm_write_guest_page(slot, gfn, data, offset, len);
+	return __kvm_write_guest_page(vcpu->kvm, slot, gfn, data, offset, len);
 }
 EXPORT_SYMBOL_GPL(kvm_vcpu_write_guest_page);
 
@@ -2058,7 +2160,7 @@ int kvm_write_guest_offset_cached(struct kvm *kvm, struct gfn_to_hva_cache *ghc,
 	r = __copy_to_user((void __user *)ghc->hva + offset, data, len);
 	if (r)
 		return -EFAULT;
-	mark_page_dirty_in_slot(ghc->memslot, gpa >> PAGE_SHIFT);
+	mark_page_dirty_in_slot(kvm, ghc->memslot, gpa >> PAGE_SHIFT);
 
 	return 0;
 }
@@ -2123,13 +2225,27 @@ int kvm_clear_guest(struct kvm *kvm, gpa_t gpa, unsigned long len)
 }
 EXPORT_SYMBOL_GPL(kvm_clear_guest);
 
-static void mark_page_dirty_in_slot(struct kvm_memory_slot *memslot,
+static void mark_page_dirty_in_slot(struct kvm *kvm,
+				    struct kvm_memory_slot *memslot,
 				    gfn_t gfn)
 {
-	if (memslot && memslot->dirty_bitmap) {
+	struct kvm_vcpu *vcpu;
+
+	if (memslot && kvm_slot_dirty_track_enabled(memslot)) {
 		unsigned long rel_gfn = gfn - memslot->base_gfn;
+		u32 slot = (memslot->as_id << 16) | memslot->id;
 
-		set_bit_le(rel_gfn, memslot->dirty_bitmap);
+		if (!kvm->dirty_ring_size) {
+			set_bit_le(rel_gfn, memslot->dirty_bitmap);
+			return;
+		}
+
+		/* Pages are only logged to the ring of the running vcpu */
+		vcpu = kvm_get_running_vcpu();
+		if (WARN_ON_ONCE(!vcpu || vcpu->kvm != kvm))
+			return;
+
+		kvm_dirty_ring_push(&vcpu->dirty_ring, slot, rel_gfn);
 	}
 }
 
@@ -2138,7 +2254,7 @@ void mark_page_dirty(struct kvm *kvm, gfn_t gfn)
 	struct kvm_memory_slot *memslot;
 
 	memslot = gfn_to_memslot(kvm, gfn);
-	mark_page_dirty_in_slot(memslot, gfn);
+	mark_page_dirty_in_slot(kvm, memslot, gfn);
 }
 EXPORT_SYMBOL_GPL(mark_page_dirty);
 
@@ -2147,7 +2263,7 @@ void kvm_vcpu_mark_page_dirty(struct kvm_vcpu *vcpu, gfn_t gfn)
 	struct kvm_memory_slot *memslot;
 
 	memslot = kvm_vcpu_gfn_to_memslot(vcpu, gfn);
-	mark_page_dirty_in_slot(memslot, gfn);
+	mark_page_dirty_in_slot(vcpu->kvm, memslot, gfn);
 }
 EXPORT_SYMBOL_GPL(kvm_vcpu_mark_page_dirty);
 
@@ -2174,20 +2290,31 @@ void kvm_sigset_deactivate(struct kvm_vcpu *vcpu)
 	sigemptyset(&current->real_blocked);
 }
 
-static void grow_halt_poll_ns(struct kvm_vcpu *vcpu)
+static unsigned int kvm_max_halt_poll_ns(struct kvm *kvm)
+{
+	if (READ_ONCE(kvm->override_halt_poll))
+		return READ_ONCE(kvm->max_halt_poll_ns);
+	return READ_ONCE(halt_poll_ns);
+}
+
+static void grow_halt_poll_ns(struct kvm_vcpu *vcpu, unsigned int max)
 {
+	struct kvm *kvm = vcpu->kvm;
 	unsigned int old, val, grow;
 
 	old = val = vcpu->halt_poll_ns;
-	grow = READ_ONCE(halt_poll_ns_grow);
+	if (READ_ONCE(kvm->override_halt_poll))
+		grow = READ_ONCE(kvm->halt_poll_grow);
+	else
+		grow = READ_ONCE(halt_poll_ns_grow);
 	/* 10us base */
 	if (val == 0 && grow)
 		val = 10000;
 	else
 		val *= grow;
 
-	if (val > halt_poll_ns)
-		val = halt_poll_ns;
+	if (val > max)
+		val = max;
 
 	vcpu->halt_poll_ns = val;
 	trace_kvm_halt_poll_ns_grow(vcpu->vcpu_id, val, old);
@@ -2195,10 +2322,14 @@ static void grow_halt_poll_ns(struct kvm_vcpu *vcpu)
 
 static void shrink_halt_poll_ns(struct kvm_vcpu *vcpu)
 {
+	struct kvm *kvm = vcpu->kvm;
 	unsigned int old, val, shrink;
 
 	old = val = vcpu->halt_poll_ns;
-	shrink = READ_ONCE(halt_poll_ns_shrink);
+	if (READ_ONCE(kvm->override_halt_poll))
+		shrink = READ_ONCE(kvm->halt_poll_shrink);
+	else
+		shrink = READ_ONCE(halt_poll_ns_shrink);
 	if (shrink == 0)
 		val = 0;
 	else
@@ -2228,20 +2359,54 @@ static int kvm_vcpu_check_block(struct kvm_vcpu *vcpu)
 	return ret;
 }
 
+static bool kvm_vcpu_can_poll(struct kvm_vcpu *vcpu)
+{
+	/* The guest asked not to poll, e.g. it polls itself before halting */
+	if (kvm_arch_no_poll(vcpu))
+		return false;
+
+	/* Polling would only delay the other tasks waiting for this cpu */
+	if (READ_ONCE(vcpu->kvm->halt_poll_uncontended) &&
+	    !single_task_running())
+		return false;
+
+	return true;
+}
+
+static void kvm_vcpu_account_halt_poll(struct kvm_vcpu *vcpu, u64 poll_ns,
+				       bool success)
+{
+	struct kvm_halt_poll_hist *hist = &vcpu->halt_poll_hist;
+	int bucket;
+
+	bucket = min_t(int, fls64(poll_ns / NSEC_PER_USEC),
+		       KVM_HALT_POLL_HIST_BUCKETS - 1);
+	if (success) {
+		++hist->success[bucket];
+		hist->success_ns += poll_ns;
+	} else {
+		++hist->fail[bucket];
+		hist->fail_ns += poll_ns;
+	}
+}
+
 /*
  * The vCPU has executed a HLT instruction with in-kernel mode enabled.
  */
 void kvm_vcpu_block(struct kvm_vcpu *vcpu)
 {
-	ktime_t start, cur;
+	unsigned int max_poll_ns = kvm_max_halt_poll_ns(vcpu->kvm);
+	ktime_t start, cur, poll_end;
 	DECLARE_SWAITQUEUE(wait);
+	bool polled = false, poll_success = false;
 	bool waited = false;
 	u64 block_ns;
 
-	start = cur = ktime_get();
-	if (vcpu->halt_poll_ns && !kvm_arch_no_poll(vcpu)) {
-		ktime_t stop = ktime_add_ns(ktime_get(), vcpu->halt_poll_ns);
+	start = cur = poll_end = ktime_get();
+	if (vcpu->halt_poll_ns && kvm_vcpu_can_poll(vcpu)) {
+		ktime_t stop = ktime_add_ns(start, vcpu->halt_poll_ns);
 
+		polled = true;
 		++vcpu->stat.halt_attempted_poll;
 		do {
 			/*
@@ -2252,9 +2417,11 @@ void kvm_vcpu_block(struct kvm_vcpu *vcpu)
 				++vcpu->stat.halt_successful_poll;
 				if (!vcpu_valid_wakeup(vcpu))
 					++vcpu->stat.halt_poll_invalid;
+				poll_end = cur = ktime_get();
+				poll_success = true;
 				goto out;
 			}
-			cur = ktime_get();
+			poll_end = cur = ktime_get();
 		} while (single_task_running() && ktime_before(cur, stop));
 	}
 
@@ -2276,19 +2443,22 @@ void kvm_vcpu_block(struct kvm_vcpu *vcpu)
 	kvm_arch_vcpu_unblocking(vcpu);
 out:
 	block_ns = ktime_to_ns(cur) - ktime_to_ns(start);
+	if (polled)
+		kvm_vcpu_account_halt_poll(vcpu, ktime_to_ns(poll_end) -
+					   ktime_to_ns(start), poll_success);
 
 	if (!vcpu_valid_wakeup(vcpu))
 		shrink_halt_poll_ns(vcpu);
-	else if (halt_poll_ns) {
+	else if (max_poll_ns) {
 		if (block_ns <= vcpu->halt_poll_ns)
 			;
 		/* we had a long block, shrink polling */
-		else if (vcpu->halt_poll_ns && block_ns > halt_poll_ns)
+		else if (vcpu->halt_poll_ns && block_ns > max_poll_ns)
 			shrink_halt_poll_ns(vcpu);
 		/* we had a short halt and our poll time is too small */
-		else if (vcpu->halt_poll_ns < halt_poll_ns &&
-			block_ns < halt_poll_ns)
-			grow_halt_poll_ns(vcpu);
+		else if (vcpu->halt_poll_ns < max_poll_ns &&
+			block_ns < max_poll_ns)
+			grow_halt_poll_ns(vcpu, max_poll_ns);
 	} else
 		vcpu->halt_poll_ns = 0;
 
@@ -2469,6 +2639,17 @@ void kvm_vcpu_on_spin(struct kvm_vcpu *me, bool yield_to_kernel_mode)
 }
 EXPORT_SYMBOL_GPL(kvm_vcpu_on_spin);
 
+static bool kvm_page_in_dirty_ring(struct kvm *kvm, unsigned long pgoff)
+{
+#ifdef CONFIG_HAVE_KVM_DIRTY_RING
+	return (pgoff >= KVM_DIRTY_LOG_PAGE_OFFSET) &&
+	    (pgoff < KVM_DIRTY_LOG_PAGE_OFFSET +
+	     kvm->dirty_ring_size / PAGE_SIZE);
+#else
+	return false;
+#endif
+}
+
 static vm_fault_t kvm_vcpu_fault(struct vm_fault *vmf)
 {
 	struct kvm_vcpu *vcpu = vmf->vma->vm_file->private_data;
@@ -2484,6 +2665,10 @@ static vm_fault_t kvm_vcpu_fault(struct vm_fault *vmf)
 	else if (vmf->pgoff == KVM_COALESCED_MMIO_PAGE_OFFSET)
 		page = virt_to_page(vcpu->kvm->coalesced_mmio_ring);
 #endif
+	else if (kvm_page_in_dirty_ring(vcpu->kvm, vmf->pgoff))
+		page = kvm_dirty_ring_get_page(
+		    &vcpu->dirty_ring,
+		    vmf->pgoff - KVM_DIRTY_LOG_PAGE_OFFSET);
 	else
 		return kvm_arch_vcpu_fault(vcpu, vmf);
 	get_page(page);
@@ -2497,6 +2682,15 @@ static const struct vm_operations_struct kvm_vcpu_vm_ops = {
 
 static int kvm_vcpu_mmap(struct file *file, struct vm_area_struct *vma)
 {
+	struct kvm_vcpu *vcpu = file->private_data;
+	unsigned long pages = (vma->vm_end - vma->vm_start) >> PAGE_SHIFT;
+
+	/* The dirty ring is shared with KVM, and never executed */
+	if ((kvm_page_in_dirty_ring(vcpu->kvm, vma->vm_pgoff) ||
+	     kvm_page_in_dirty_ring(vcpu->kvm, vma->vm_pgoff + pages - 1)) &&
+	    ((vma->vm_flags & VM_EXEC) || !(vma->vm_flags & VM_SHARED)))
+		return -EINVAL;
+
 	vma->vm_ops = &kvm_vcpu_vm_ops;
 	return 0;
 }
@@ -3050,6 +3244,14 @@ static long kvm_vm_ioctl_check_extension_generic(struct kvm *kvm, long arg)
 #if KVM_ADDRESS_SPACE_NUM > 1
 	case KVM_CAP_MULTI_ADDRESS_SPACE:
 		return KVM_ADDRESS_SPACE_NUM;
+#endif
+	case KVM_CAP_HALT_POLL:
+		return KVM_HALT_POLL_SET_FACTORS | KVM_HALT_POLL_UNCONTENDED;
+	case KVM_CAP_DIRTY_LOG_RING:
+#ifdef CONFIG_HAVE_KVM_DIRTY_RING
+		return KVM_DIRTY_RING_MAX_ENTRIES * sizeof(struct kvm_dirty_gfn);
+#else
+		return 0;
 #endif
 	default:
 		break;
@@ -3057,6 +3259,104 @@ static long kvm_vm_ioctl_check_extension_generic(struct kvm *kvm, long arg)
 	return kvm_vm_ioctl_check_extension(kvm, arg);
 }
 
+static int kvm_vm_ioctl_enable_halt_poll(struct kvm *kvm,
+					 struct kvm_enable_cap *cap)
+{
+	unsigned int grow, shrink;
+
+	if (cap->flags & ~(KVM_HALT_POLL_SET_FACTORS |
+			   KVM_HALT_POLL_UNCONTENDED))
+		return -EINVAL;
+
+	if (cap->args[0] != (unsigned int)cap->args[0])
+		return -EINVAL;
+
+	if (cap->flags & KVM_HALT_POLL_SET_FACTORS) {
+		if (cap->args[1] != (unsigned int)cap->args[1] ||
+		    cap->args[2] != (unsigned int)cap->args[2])
+			return -EINVAL;
+		grow = cap->args[1];
+		shrink = cap->args[2];
+	} else {
+		grow = READ_ONCE(halt_poll_ns_grow);
+		shrink = READ_ONCE(halt_poll_ns_shrink);
+	}
+
+	mutex_lock(&kvm->lock);
+	WRITE_ONCE(kvm->max_halt_poll_ns, cap->args[0]);
+	WRITE_ONCE(kvm->halt_poll_grow, grow);
+	WRITE_ONCE(kvm->halt_poll_shrink, shrink);
+	WRITE_ONCE(kvm->halt_poll_uncontended,
+		   !!(cap->flags & KVM_HALT_POLL_UNCONTENDED));
+	WRITE_ONCE(kvm->override_halt_poll, true);
+	mutex_unlock(&kvm->lock);
+	return 0;
+}
+
+static int kvm_vm_ioctl_enable_dirty_log_ring(struct kvm *kvm, u32 size)
+{
+	int r;
+
+	if (!KVM_DIRTY_LOG_PAGE_OFFSET)
+		return -EINVAL;
+
+	/* the size should be power of 2 */
+	if (!size || (size & (size - 1)))
+		return -EINVAL;
+
+	/* Should be bigger to keep the reserved entries, or a page */
+	if (size < kvm_dirty_ring_get_rsvd_entries() *
+	    sizeof(struct kvm_dirty_gfn) || size < PAGE_SIZE)
+		return -EINVAL;
+
+	if (size > KVM_DIRTY_RING_MAX_ENTRIES *
+	    sizeof(struct kvm_dirty_gfn))
+		return -E2BIG;
+
+	/* We only allow it to set once */
+	if (kvm->dirty_ring_size)
+		return -EINVAL;
+
+	mutex_lock(&kvm->lock);
+
+	if (kvm->created_vcpus) {
+		/* We don't allow to change this value after vcpu created */
+		r = -EINVAL;
+	} else {
+		kvm->dirty_ring_size = size;
+		r = 0;
+	}
+
+	mutex_unlock(&kvm->lock);
+	return r;
+}
+
+/*
+ * Write protect again the pages userspace collected from the dirty rings,
+ * returns how many there were.
+ */
+static int kvm_vm_ioctl_reset_dirty_pages(struct kvm *kvm)
+{
+	struct kvm_vcpu *vcpu;
+	int cleared = 0;
+	int i;
+
+	if (!kvm->dirty_ring_size)
+		return -EINVAL;
+
+	mutex_lock(&kvm->slots_lock);
+
+	kvm_for_each_vcpu(i, vcpu, kvm)
+		cleared += kvm_dirty_ring_reset(vcpu->kvm, &vcpu->dirty_ring);
+
+	mutex_unlock(&kvm->slots_lock);
+
+	if (cleared)
+		kvm_flush_remote_tlbs(kvm);
+
+	return cleared;
+}
+
 static long kvm_vm_ioctl(struct file *filp,
 			   unsigned int ioctl, unsigned long arg)
 {
@@ -3084,6 +3384,11 @@ static long kvm_vm_ioctl(struct file *filp,
 	case KVM_GET_DIRTY_LOG: {
 		struct kvm_dirty_log log;
 
+		/* There are no dirty bitmaps with the dirty ring */
+		r = -ENXIO;
+		if (kvm->dirty_ring_size)
+			goto out;
+
 		r = -EFAULT;
 		if (copy_from_user(&log, argp, sizeof(log)))
 			goto out;
@@ -3219,6 +3524,29 @@ static long kvm_vm_ioctl(struct file *filp,
 	case KVM_CHECK_EXTENSION:
 		r = kvm_vm_ioctl_check_extension_generic(kvm, arg);
 		break;
+	case KVM_ENABLE_CAP: {
+		struct kvm_enable_cap cap;
+
+		r = -EFAULT;
+		if (copy_from_user(&cap, argp, sizeof(cap)))
+			goto out;
+		if (cap.cap == KVM_CAP_DIRTY_LOG_RING) {
+			r = -EINVAL;
+			if (cap.flags)
+				goto out;
+			r = kvm_vm_ioctl_enable_dirty_log_ring(kvm, cap.args[0]);
+			break;
+		}
+		if (cap.cap == KVM_CAP_HALT_POLL) {
+			r = kvm_vm_ioctl_enable_halt_poll(kvm, &cap);
+			break;
+		}
+		r = kvm_arch_vm_ioctl(filp, ioctl, arg);
+		break;
+	}
+	case KVM_RESET_DIRTY_RINGS:
+		r = kvm_vm_ioctl_reset_dirty_pages(kvm);
+		break;
 	default:
 		r = kvm_arch_vm_ioctl(filp, ioctl, arg);
 	}
@@ -3249,6 +3577,9 @@ static long kvm_vm_compat_ioctl(struct file *filp,
 		struct compat_kvm_dirty_log compat_log;
 		struct kvm_dirty_log log;
 
+		if (kvm->dirty_ring_size)
+			return -ENXIO;
+
 		if (copy_from_user(&compat_log, (void __user *)arg,
 				   sizeof(compat_log)))
 			return -EFAULT;
@@ -4067,6 +4398,8 @@ static void kvm_sched_in(struct preempt_notifier *pn, int cpu)
 	if (vcpu->preempted)
 		vcpu->preempted = false;
 
+	__this_cpu_write(kvm_running_vcpu, vcpu);
+
 	kvm_arch_sched_in(vcpu, cpu);
 
 	kvm_arch_vcpu_load(vcpu, cpu);
@@ -4080,6 +4413,7 @@ static void kvm_sched_out(struct preempt_notifier *pn,
 	if (current->state == TASK_RUNNING)
 		vcpu->preempted = true;
 	kvm_arch_vcpu_put(vcpu);
+	__this_cpu_write(kvm_running_vcpu, NULL);
 }
 
 int kvm_init(void *opaque, unsigned vcpu_size, unsigned vcpu_align,